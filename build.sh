@@ -7,75 +7,322 @@ if ! command -v zig &> /dev/null; then
     exit 1
 fi
 mkdir -p .build web
-echo "🔧 Compiling Lua C sources..."
+# CU_BUILD picks the variant: unset for web/cu.wasm; "small" for
+# web/cu-small.wasm (-Os, ReleaseSmall, no io library, wasm-opt -Oz), which
+# downloads and instantiates fastest; "fast" for web/cu-fast.wasm (-O3,
+# simd128, wasm-opt -O3); "wasm64" for web/cu-64.wasm, a memory64 build
+# whose heap can grow past 4GB. wasm-opt runs when it is installed.
+target="wasm32-freestanding"
+c_opt="-O2"
+zig_opt="ReleaseFast"
+out="web/cu.wasm"
+wasm_opt_level=""
+lib_flags=""
+io_obj=".build/liolib.o"
+case "${CU_BUILD:-}" in
+    "") ;;
+    small)
+        c_opt="-Os"
+        zig_opt="ReleaseSmall"
+        out="web/cu-small.wasm"
+        wasm_opt_level="-Oz"
+        # io is stubbed out on wasm anyway; os stays for os.time and os.clock
+        # and package for require
+        lib_flags="-DLUA_CU_NO_IOLIB=1"
+        io_obj=""
+        ;;
+    fast)
+        c_opt="-O3"
+        out="web/cu-fast.wasm"
+        wasm_opt_level="-O3"
+        CU_SIMD=1
+        CU_LTO="${CU_LTO:-1}"
+        ;;
+    wasm64)
+        # Pointers and sizes cross the boundary as i64; scripts/wasm-abi.js
+        # records which ones for the host (web/cu-memory64.js)
+        target="wasm64-freestanding"
+        out="web/cu-64.wasm"
+        ;;
+    *)
+        echo "❌ Unknown CU_BUILD '${CU_BUILD}' (use small, fast or wasm64)"
+        exit 1
+        ;;
+esac
+# CU_FUSED_DISPATCH=1 lets a few interpreter opcodes (GETFIELD before
+# CALL, ADD/ADDI before FORLOOP) jump straight to the next handler
+vm_flags=""
+if [ "${CU_FUSED_DISPATCH:-0}" = "1" ]; then
+    vm_flags="-DLUAI_FUSEDISPATCH=1"
+fi
+# CU_LUA_32BITS=1 builds Lua with 32-bit integers and floats, so a TValue
+# is 8 bytes instead of 16; every unit that includes luaconf.h needs it.
+# The C units are compiled with warnings, which catch range checks that
+# assumed a 64-bit lua_Integer.
+lua_flags=""
+if [ "${CU_LUA_32BITS:-0}" = "1" ]; then
+    lua_flags="-DLUA_32BITS=1"
+    c_opt="$c_opt -Wall -Wextra -Wtype-limits"
+fi
+# CU_TIER=1 lets the host compile hot Lua functions to wasm at run time
+# (src/lua/ltier.c, web/cu-tier.js); it changes Proto, so every unit sees it
+tier_flags=""
+if [ "${CU_TIER:-0}" = "1" ]; then
+    tier_flags="-DLUAI_TIER=1"
+fi
+# CU_ALLOC_PROFILE=1 has lmem.c and lgc.c tally allocations by type for
+# get_alloc_profile, at a few instructions per allocation
+profile_flags=""
+if [ "${CU_ALLOC_PROFILE:-0}" = "1" ]; then
+    profile_flags="-DLUAI_ALLOCPROFILE=1"
+fi
+# CU_LTO=1 (the default for CU_BUILD=fast) compiles the C sources to LLVM
+# bitcode and optimizes them with main.zig in one link, so the bridge's
+# calls into lapi.c (lua_getfield, lua_tolstring and the lua.zig wrappers)
+# can be inlined. ldo.c and wasm-sjlj.c stay native: their setjmp/longjmp
+# lowering is a codegen flag, which a link-time codegen would not see.
+lto_flags=""
+if [ "${CU_LTO:-0}" = "1" ]; then
+    lto_flags="-flto"
+fi
+echo "🔧 Compiling Lua C sources${CU_BUILD:+ ($CU_BUILD build)}${lto_flags:+ (LTO)}${vm_flags:+ (fused dispatch)}${lua_flags:+ (32-bit numbers)}${tier_flags:+ (tiered)}${profile_flags:+ (allocation profile)}..."
 cd src/lua
-for file in lapi lauxlib lbaselib lcode lcorolib lctype ldblib ldebug ldo ldump \
+for file in lapi lauxlib lbaselib lcensus lcode lcorolib lctype ldblib ldebug ldo ldump \
              lfunc lgc linit liolib llex lmathlib lmem loadlib lobject lopcodes \
              loslib lparser lstate lstring lstrlib ltable ltablib ltm lundump \
-             lutf8lib lvm lzio; do
+             ltier lutf8lib lverify lvm lzio; do
+     if [ "$file" = "liolib" ] && [ -z "$io_obj" ]; then
+         continue
+     fi
       printf "  %-20s" "$file.c"
-     zig cc -target wasm32-freestanding \
-         -I.. \
-         -c -O2 $file.c -o ../../.build/${file}.o 2>&1 && echo "✓" || {
+     # ldo.c raises Lua errors with setjmp/longjmp, lowered to wasm exceptions
+     file_flags="$lto_flags"
+     if [ "$file" = "ldo" ]; then
+         file_flags="-mexception-handling -mllvm -wasm-enable-sjlj"
+     elif [ "$file" = "lvm" ]; then
+         file_flags="$vm_flags $lto_flags"
+     fi
+     zig cc -target $target \
+         -I.. $lua_flags $tier_flags $lib_flags $profile_flags $file_flags \
+         -c $c_opt $file.c -o ../../.build/${file}.o 2>&1 && echo "✓" || {
          echo ""
          echo "❌ Failed to compile $file.c"
          exit 1
      }
 done
+printf "  %-20s" "wasm-sjlj.c"
+zig cc -target $target -I.. -mexception-handling -c $c_opt wasm-sjlj.c -o ../../.build/wasm-sjlj.o 2>&1 && echo "✓" || {
+    echo ""
+    echo "❌ Failed to compile wasm-sjlj.c"
+    exit 1
+}
 printf "  %-20s" "lbigint.c"
-zig cc -target wasm32-freestanding -I.. -c -O2 lbigint.c -o ../../.build/lbigint.o 2>&1 && echo "✓" || {
+zig cc -target $target -I.. $lua_flags $tier_flags $lto_flags -c $c_opt lbigint.c -o ../../.build/lbigint.o 2>&1 && echo "✓" || {
     echo ""
     echo "❌ Failed to compile lbigint.c"
     exit 1
 }
+printf "  %-20s" "ldecimal.c"
+zig cc -target $target -I.. $lua_flags $tier_flags $lto_flags -c $c_opt ldecimal.c -o ../../.build/ldecimal.o 2>&1 && echo "✓" || {
+    echo ""
+    echo "❌ Failed to compile ldecimal.c"
+    exit 1
+}
+printf "  %-20s" "ljson.c"
+zig cc -target $target -I.. $lua_flags $tier_flags $lto_flags -c $c_opt ljson.c -o ../../.build/ljson.o 2>&1 && echo "✓" || {
+    echo ""
+    echo "❌ Failed to compile ljson.c"
+    exit 1
+}
+printf "  %-20s" "lmsgpack.c"
+zig cc -target $target -I.. $lua_flags $tier_flags $lto_flags -c $c_opt lmsgpack.c -o ../../.build/lmsgpack.o 2>&1 && echo "✓" || {
+    echo ""
+    echo "❌ Failed to compile lmsgpack.c"
+    exit 1
+}
+printf "  %-20s" "lstrbuf.c"
+zig cc -target $target -I.. $lua_flags $tier_flags $lto_flags -c $c_opt lstrbuf.c -o ../../.build/lstrbuf.o 2>&1 && echo "✓" || {
+    echo ""
+    echo "❌ Failed to compile lstrbuf.c"
+    exit 1
+}
+printf "  %-20s" "llru.c"
+zig cc -target $target -I.. $lua_flags $tier_flags $lto_flags -c $c_opt llru.c -o ../../.build/llru.o 2>&1 && echo "✓" || {
+    echo ""
+    echo "❌ Failed to compile llru.c"
+    exit 1
+}
+printf "  %-20s" "lstruct.c"
+zig cc -target $target -I.. $lua_flags $tier_flags $lto_flags -c $c_opt lstruct.c -o ../../.build/lstruct.o 2>&1 && echo "✓" || {
+    echo ""
+    echo "❌ Failed to compile lstruct.c"
+    exit 1
+}
+printf "  %-20s" "lsched.c"
+zig cc -target $target -I.. $lua_flags $tier_flags $lto_flags -c $c_opt lsched.c -o ../../.build/lsched.o 2>&1 && echo "✓" || {
+    echo ""
+    echo "❌ Failed to compile lsched.c"
+    exit 1
+}
 cd ../..
 echo "🔧 Compiling bignum wrapper..."
-zig build-obj -target wasm32-freestanding -O ReleaseFast -Isrc -Isrc/lua \
+zig build-obj -target $target -O $zig_opt -Isrc -Isrc/lua $lua_flags $tier_flags \
      src/bignum.zig -femit-bin=.build/bignum.o || { echo "❌ Failed to compile bignum.zig"; exit 1; }
 echo "✓"
 
-echo "🔧 Compiling libc stubs..."
-zig build-obj -target wasm32-freestanding -O ReleaseFast \
+# CU_SIMD=1 builds the string and memory stubs, the vec kernels and the
+# codec kernels with simd128; engines without wasm SIMD then cannot load the module
+simd_cpu=""
+if [ "${CU_SIMD:-0}" = "1" ]; then
+    simd_cpu="-mcpu=generic+simd128"
+fi
+echo "🔧 Compiling libc stubs${simd_cpu:+ (simd128)}..."
+zig build-obj -target $target -O $zig_opt $simd_cpu \
      src/libc-stubs.zig -femit-bin=.build/libc-stubs.o || { echo "❌ Failed to compile libc-stubs.zig"; exit 1; }
 echo "✓"
 
+echo "🔧 Compiling vec kernels${simd_cpu:+ (simd128)}..."
+zig build-obj -target $target -O $zig_opt $simd_cpu -Isrc -Isrc/lua $lua_flags $tier_flags \
+     src/vec.zig -femit-bin=.build/vec.o || { echo "❌ Failed to compile vec.zig"; exit 1; }
+echo "✓"
+
+echo "🔧 Compiling codec kernels${simd_cpu:+ (simd128)}..."
+zig build-obj -target $target -O $zig_opt $simd_cpu -Isrc -Isrc/lua $lua_flags $tier_flags \
+     src/codec.zig -femit-bin=.build/codec.o || { echo "❌ Failed to compile codec.zig"; exit 1; }
+echo "✓"
+
 echo "🔧 Compiling Zig main..."
-zig build-exe -target wasm32-freestanding -O ReleaseFast \
-     -Isrc -Isrc/lua \
+zig build-exe -target $target -O $zig_opt $lto_flags \
+     -mcpu=generic+exception_handling \
+     -Isrc -Isrc/lua $lua_flags $tier_flags \
      -fno-entry \
+     --export-table \
      --export=init \
+     --export=init_with_limits \
      --export=compute \
+     --export=compute_at \
+     --export=compile \
+     --export=call \
+     --export=compute_batch \
+     --export=compute_async \
+     --export=resume_await \
+     --export=get_await_handle \
+     --export=sched_tick \
      --export=get_buffer_ptr \
      --export=get_buffer_size \
      --export=get_memory_stats \
+     --export=trim_heap \
      --export=run_gc \
+     --export=set_gc_mode \
+     --export=get_gc_stats \
+     --export=get_perf_counters \
+     --export=profile_start \
+     --export=profile_stop \
+     --export=profile_read \
+     --export=get_heap_census \
+     --export=get_alloc_profile \
+     --export=set_tier_threshold \
+     --export=get_tier_layout \
+     --export=idle_gc \
+     --export=set_scratch_arena \
+     --export=set_string_table_size \
+     --export=set_stdlibs \
+     --export=set_deterministic \
+     --export=set_virtual_clock \
+     --export=set_compute_limits \
+     --export=set_interrupt_polling \
+     --export=get_interrupt_flag_ptr \
+     --export=set_output_streaming \
+     --export=cu_alloc \
+     --export=cu_free \
+     --export=set_result_region \
+     --export=take_result \
+     --export=get_last_error_code \
+     --export=get_last_error_frame \
+     --export=set_error_traceback \
+     --export=get_chunk_cache_hits \
+     --export=get_chunk_cache_misses \
+     --export=clear_chunk_cache \
+     --export=set_ext_table_backend \
+     --export=invalidate_ext_table \
+     --export=set_prefetch_learning \
+     --export=get_live_table_ids \
+     --export=get_ext_store_hits \
+     --export=get_ext_store_misses \
+     --export=set_ext_key_encoding \
+     --export=set_max_table_entries \
+     --export=set_inline_table_limits \
+     --export=set_function_debug_info \
+     --export=set_bytecode_optimizer \
+     --export=get_typed_array_kinds \
+     --export=set_value_encoding \
      --export=attach_memory_table \
      --export=get_memory_table_id \
      --export=sync_external_table_counter \
+     --export=create_state \
+     --export=select_state \
+     --export=get_state \
+     --export=destroy_state \
+     --export=compute_on \
+     --export=set_state_memory_limit \
+     --export=get_state_memory \
      --export=set_memory_alias_enabled \
      --export=get_io_table_id \
      --export=clear_io_table \
      src/main.zig \
      .build/libc-stubs.o \
      .build/bignum.o \
+     .build/vec.o \
+     .build/codec.o \
      .build/lbigint.o \
-     .build/lapi.o .build/lauxlib.o .build/lbaselib.o \
+     .build/ldecimal.o \
+     .build/ljson.o \
+     .build/lmsgpack.o \
+     .build/lstrbuf.o \
+     .build/llru.o \
+     .build/lstruct.o \
+     .build/lsched.o \
+     .build/wasm-sjlj.o \
+     .build/lapi.o .build/lauxlib.o .build/lbaselib.o .build/lcensus.o \
      .build/lcode.o .build/lcorolib.o .build/lctype.o .build/ldblib.o \
      .build/ldebug.o .build/ldo.o .build/ldump.o .build/lfunc.o \
-     .build/lgc.o .build/linit.o .build/liolib.o .build/llex.o \
+     .build/lgc.o .build/linit.o $io_obj .build/llex.o \
      .build/lmathlib.o .build/lmem.o .build/loadlib.o .build/lobject.o \
      .build/lopcodes.o .build/loslib.o .build/lparser.o .build/lstate.o \
      .build/lstring.o .build/lstrlib.o .build/ltable.o .build/ltablib.o \
-     .build/ltm.o .build/lundump.o .build/lutf8lib.o .build/lvm.o \
-     .build/lzio.o \
-     -femit-bin=web/cu.wasm 2>&1 || { echo "❌ Zig compilation failed!"; exit 1; }
+     .build/ltier.o .build/ltm.o .build/lundump.o .build/lutf8lib.o \
+     .build/lverify.o \
+     .build/lvm.o .build/lzio.o \
+     -femit-bin=$out 2>&1 || { echo "❌ Zig compilation failed!"; exit 1; }
+
+if [ -n "$wasm_opt_level" ]; then
+    echo "🔧 Optimizing $out with wasm-opt $wasm_opt_level..."
+    scripts/optimize-wasm.sh "$out" "$wasm_opt_level" ${simd_cpu:+--enable-simd}
+fi
+
+if [ "$target" = "wasm64-freestanding" ]; then
+    node scripts/wasm-abi.js "$out" || { echo "❌ Writing the wasm64 ABI section failed!"; exit 1; }
+fi
+
+if [ -n "${CU_BUILD:-}" ]; then
+    echo ""
+    echo "✅ Build complete!"
+    echo "   Variant:  $out ($(( $(wc -c < "$out") / 1024 )) KB)"
+    echo "   Compare:  npm run bench:builds"
+    exit 0
+fi
 
 # Create backward-compatible copy
 cp web/cu.wasm web/lua.wasm
 
+# Variant with init() already run: its data segments hold the Lua state
+echo "🔧 Pre-initializing web/cu-preinit.wasm..."
+node scripts/preinit-wasm.js web/cu.wasm web/cu-preinit.wasm || { echo "❌ Pre-initialization failed!"; exit 1; }
+
 SIZE=$(wc -c < web/cu.wasm)
 SIZE_KB=$((SIZE / 1024))
 echo ""
 echo "✅ Build complete!"
 echo "   Primary:  web/cu.wasm (${SIZE_KB} KB)"
+echo "   Preinit:  web/cu-preinit.wasm ($(( $(wc -c < web/cu-preinit.wasm) / 1024 )) KB) - init() already run"
 echo "   Legacy:   web/lua.wasm (${SIZE_KB} KB) - deprecated"
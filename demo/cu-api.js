@@ -223,6 +223,27 @@ export async function load(options = {}) {
             return -1;
           }
         },
+        // Unpack (u32 key_len, key, u32 value_len, value) frames onto the single-entry setter
+        js_ext_table_set_many: (table_id, frames_ptr, frames_len) => {
+          const view = new DataView(wasmMemory.buffer, frames_ptr, frames_len);
+          for (let offset = 0; offset < frames_len;) {
+            const key_len = view.getUint32(offset, true);
+            const val_len = view.getUint32(offset + 4 + key_len, true);
+            const key_ptr = frames_ptr + offset + 4;
+            if (imports.env.js_ext_table_set(table_id, key_ptr, key_len, key_ptr + key_len + 4, val_len) !== 0) return -1;
+            offset += 8 + key_len + val_len;
+          }
+          return 0;
+        },
+        js_ext_table_get_many: () => -1, // ext.getMany() is not supported by this host
+        js_ext_key_intern: () => -1, // key handles are not supported by this host
+        js_ext_table_set_parts: () => -1, // values over the I/O buffer window are not supported by this host
+        js_blob_read: () => -1, // blobs are not supported by this host
+        js_blob_release: () => {},
+        js_ext_table_next: () => -1, // pairs() over external tables is not supported by this host
+        js_interrupt_requested: () => 0,
+        js_write_output: () => {},
+        js_clock_ms: () => performance.now(),
       },
     };
 
@@ -313,41 +334,7 @@ export async function compute(code) {
       return result;
     }
 
-    // Fallback: Use server-side Lua execution
-    console.log('Using server-side Lua execution...');
-    const response = await fetch('/api/lua', {
-      method: 'POST',
-      headers: { 'Content-Type': 'application/json' },
-      body: JSON.stringify({ code })
-    });
-
-    if (!response.ok) {
-      throw new Error(`Server error: ${response.status}`);
-    }
-
-    const data = await response.json();
-    const output = data.result || '';
-    
-    // Store result in buffer
-    const bufPtr = getBufferPtr();
-    const encoder = new TextEncoder();
-    const outputBytes = encoder.encode(output);
-    const bufSize = getBufferSize();
-
-    if (outputBytes.length > bufSize) {
-      // Truncate if too large
-      for (let i = 0; i < bufSize; i++) {
-        wasmMemory[bufPtr + i] = outputBytes[i];
-      }
-      return bufSize;
-    }
-
-    for (let i = 0; i < outputBytes.length; i++) {
-      wasmMemory[bufPtr + i] = outputBytes[i];
-    }
-
-    console.log(`Server returned ${outputBytes.length} bytes`);
-    return outputBytes.length;
+    throw new Error('WASM module not loaded');
   } catch (error) {
     console.error('compute() error:', error);
     // Return error message as buffer content
@@ -100,6 +100,16 @@ class LuaCompute {
                 js_ext_table_delete: (tableId, keyPtr, keyLen) => 0,
                 js_ext_table_size: (tableId) => 0,
                 js_ext_table_keys: (tableId, bufPtr, maxLen) => 0,
+                js_ext_table_set_many: (tableId, framesPtr, framesLen) => 0,
+                js_ext_table_get_many: () => -1, // ext.getMany() is not supported by this host
+                js_ext_key_intern: () => -1, // key handles are not supported by this host
+                js_ext_table_set_parts: () => -1, // values over the I/O buffer window are not supported by this host
+                js_blob_read: () => -1, // blobs are not supported by this host
+                js_blob_release: () => {},
+                js_ext_table_next: () => -1, // pairs() over external tables is not supported by this host
+                js_interrupt_requested: () => 0,
+                js_write_output: () => {},
+                js_clock_ms: () => performance.now(),
             }
         };
     }
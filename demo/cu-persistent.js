@@ -97,7 +97,28 @@ class CuPersistent {
                     }
                     
                     return offset;
-                }
+                },
+                // Unpack (u32 key_len, key, u32 value_len, value) frames onto the single-entry setter
+                js_ext_table_set_many: (tableId, framesPtr, framesLen) => {
+                    const view = new DataView(this.memory.buffer, framesPtr, framesLen);
+                    for (let offset = 0; offset < framesLen;) {
+                        const keyLen = view.getUint32(offset, true);
+                        const valLen = view.getUint32(offset + 4 + keyLen, true);
+                        const keyPtr = framesPtr + offset + 4;
+                        if (imports.env.js_ext_table_set(tableId, keyPtr, keyLen, keyPtr + keyLen + 4, valLen) !== 0) return -1;
+                        offset += 8 + keyLen + valLen;
+                    }
+                    return 0;
+                },
+                js_ext_table_get_many: () => -1, // ext.getMany() is not supported by this host
+                js_ext_key_intern: () => -1, // key handles are not supported by this host
+                js_ext_table_set_parts: () => -1, // values over the I/O buffer window are not supported by this host
+                js_blob_read: () => -1, // blobs are not supported by this host
+                js_blob_release: () => {},
+                js_ext_table_next: () => -1, // pairs() over external tables is not supported by this host
+                js_interrupt_requested: () => 0,
+                js_write_output: () => {},
+                js_clock_ms: () => performance.now()
             }
         };
 
@@ -2,10 +2,72 @@
  * Cu - TypeScript Definitions
  */
 
+export interface HeapStats {
+  committed: number;
+  limit: number;
+  inUse: number;
+  highWater: number;
+  freeListBytes: number;
+  largestFreeBlock: number;
+  allocCount: number;
+  freeCount: number;
+  /** Share of free-list bytes not available as a single block (0..1) */
+  fragmentation: number;
+}
+
+export interface SizeClassStats {
+  /** Block size in bytes, or 'large' for the boundary-tag allocator */
+  size: number | 'large';
+  allocs: number;
+  live: number;
+}
+
 export interface MemoryStats {
-  io_buffer_size: number;
-  cu_memory_used: number;
-  wasm_pages: number;
+  /** Heap limit in bytes */
+  total: number;
+  /** Heap bytes in use */
+  used: number;
+  free: number;
+  /** Live bytes reported by the Lua collector */
+  luaBytes?: number;
+  wasmPages?: number;
+  heap?: HeapStats;
+  sizeClasses?: SizeClassStats[];
+}
+
+export declare const ErrorCodes: {
+  readonly SUCCESS: 0;
+  readonly COMPILATION_ERROR: -1;
+  readonly RUNTIME_ERROR: -2;
+  readonly SERIALIZATION_ERROR: -3;
+  readonly MEMORY_LIMIT_EXCEEDED: -4;
+  readonly INSTRUCTION_LIMIT_EXCEEDED: -5;
+};
+
+export type GcMode = 'collect' | 'step' | 'generational' | 'incremental';
+
+export type LogLevelName = 'debug' | 'info' | 'warn' | 'error' | 'silent';
+
+export declare const LogLevel: Record<LogLevelName, number>;
+
+export interface CuLogger {
+  debug?(...args: any[]): void;
+  info?(...args: any[]): void;
+  warn?(...args: any[]): void;
+  error?(...args: any[]): void;
+  log(...args: any[]): void;
+}
+
+export interface CuMetric {
+  name: 'compute' | 'call' | 'computeBatch';
+  durationMs: number;
+  inputBytes: number;
+  /** Raw return value of the WASM export */
+  result: number;
+  /** Function name, for 'call' */
+  fn?: string;
+  /** Item count, for 'computeBatch' */
+  items?: number;
 }
 
 export interface DeserializedResult {
@@ -13,6 +75,19 @@ export interface DeserializedResult {
   result: any;
 }
 
+export interface BatchCall {
+  call: string;
+  args?: any[];
+}
+
+export interface BatchResult {
+  /** compute()-style status: result length, or negative on error */
+  status: number;
+  output?: string;
+  result?: any;
+  error?: string;
+}
+
 export interface TableInfo {
   id: number;
   size: number;
@@ -34,9 +109,11 @@ export interface CuAPI {
 
   /**
    * Initialize the Cu VM
+   * @param options.heapBytes Lua heap committed at init (default 512 KB)
+   * @param options.maxHeapBytes Cap the heap may grow to on demand
    * @returns 0 on success, -1 on failure
    */
-  init(): number;
+  init(options?: { heapBytes?: number; maxHeapBytes?: number }): number;
 
   /**
    * Execute Lua code in the Cu environment
@@ -45,6 +122,21 @@ export interface CuAPI {
    */
   compute(code: string): Promise<number>;
 
+  /**
+   * Call a Lua function by name with serialized arguments, skipping the parser
+   * @param name Global function or dotted path; bare names also resolve against _home
+   * @param args Arguments (serialized like _io values)
+   * @returns Number of bytes in result buffer (negative on error)
+   */
+  call(name: string, args?: any[]): number;
+
+  /**
+   * Run several scripts and/or named calls in one WASM call
+   * @param items Lua source strings, or { call, args } named calls
+   * @returns One entry per item that ran, in order
+   */
+  computeBatch(items: Array<string | BatchCall>): BatchResult[];
+
   /**
    * Get the pointer to the I/O buffer
    */
@@ -62,8 +154,56 @@ export interface CuAPI {
 
   /**
    * Run garbage collection
+   * @param mode Full collection (default), one incremental step, or a collector mode switch
+   * @param stepKb Work per step in KB when mode is 'step'
+   */
+  runGc(mode?: GcMode, stepKb?: number): boolean;
+
+  /**
+   * Set resource limits applied to every subsequent compute() call (0 = unlimited)
+   * @returns false if the loaded build has no budget support
+   */
+  setComputeLimits(limits?: { maxBytes?: number; maxInstructions?: number }): boolean;
+
+  /**
+   * Error code of the last compute() call; see ErrorCodes
+   */
+  getLastErrorCode(): number;
+
+  /**
+   * Compiled-chunk cache counters for compute()
+   */
+  getChunkCacheStats(): { hits: number; misses: number };
+
+  /**
+   * Drop all compiled chunks held by the cache
+   */
+  clearChunkCache(): void;
+
+  /**
+   * Choose where external table entries live: 'host' crosses into JS on every
+   * access, 'native' caches them in WASM memory and writes changes back after
+   * each compute/call
+   * @returns false if the loaded build has no native backend
+   */
+  setExtTableBackend(backend: 'host' | 'native', options?: { maxBytes?: number }): boolean;
+
+  /**
+   * Read counters for the native external table backend
+   */
+  getExtTableStats(): { hits: number; misses: number };
+
+  /**
+   * Route host log output; null silences it
+   * @param logger Console-like object (console by default)
+   * @param options.level Minimum level emitted (default 'warn')
+   */
+  setLogger(logger: CuLogger | null, options?: { level?: LogLevelName }): void;
+
+  /**
+   * Receive one timing record per compute/call/computeBatch; null removes the hook
    */
-  runGc(): boolean;
+  onMetric(handler: ((metric: CuMetric) => void) | null): void;
 
   /**
    * Read raw buffer contents as string
@@ -2,4 +2,8 @@ module github.com/example/lua-wasm-demo
 
 go 1.21
 
-require github.com/tetratelabs/wazero v1.8.0
+require github.com/twilson63/cu/host/go v0.0.0
+
+require github.com/tetratelabs/wazero v1.8.0 // indirect
+
+replace github.com/twilson63/cu/host/go => ../../../host/go
@@ -141,6 +141,25 @@ function jsExtTableKeys(tableId, bufPtr, maxLen) {
   return bytes.length;
 }
 
+/**
+ * Host function: js_ext_table_set_many
+ * Store a packed batch of entries: frames of
+ * u32 key_len, key, u32 value_len, value
+ */
+function jsExtTableSetMany(tableId, framesPtr, framesLen) {
+  const view = new DataView(wasmInstance.exports.memory.buffer, framesPtr, framesLen);
+
+  for (let offset = 0; offset < framesLen;) {
+    const keyLen = view.getUint32(offset, true);
+    const valLen = view.getUint32(offset + 4 + keyLen, true);
+    const keyPtr = framesPtr + offset + 4;
+    jsExtTableSet(tableId, keyPtr, keyLen, keyPtr + keyLen + 4, valLen);
+    offset += 8 + keyLen + valLen;
+  }
+
+  return 0; // Success
+}
+
 // Global WASM instance (for host functions to access)
 let wasmInstance = null;
 
@@ -296,6 +315,16 @@ async function main() {
       js_ext_table_delete: jsExtTableDelete,
       js_ext_table_size: jsExtTableSize,
       js_ext_table_keys: jsExtTableKeys,
+      js_ext_table_set_many: jsExtTableSetMany,
+      js_ext_table_get_many: () => -1, // ext.getMany() is not supported by this host
+      js_ext_key_intern: () => -1, // key handles are not supported by this host
+      js_ext_table_set_parts: () => -1, // values over the I/O buffer window are not supported by this host
+      js_blob_read: () => -1, // blobs are not supported by this host
+      js_blob_release: () => {},
+      js_ext_table_next: () => -1, // pairs() over external tables is not supported by this host
+      js_interrupt_requested: () => 0,
+      js_write_output: () => {},
+      js_clock_ms: () => performance.now(),
     },
   };
 
@@ -0,0 +1,159 @@
+/*
+ * libcu-host: run cu.wasm natively from C
+ *
+ * The host side of cu's external tables and I/O, without a JS engine:
+ *
+ * - cu_store: external tables in hash maps, with keys and values in an
+ *   arena owned by the store. Thread-safe; one store per unit of state.
+ * - cu_module / cu_instance: cu.wasm (or an AOT image from wamrc) loaded
+ *   with WAMR, its env imports bound to a store. Values cross into linear
+ *   memory with one copy from the arena, and results are read in place.
+ *   Instances of one module may run on different threads at once; one
+ *   instance is used by one thread at a time.
+ *
+ * The store and the import protocol (cu_bridge.c) do not depend on the
+ * runtime; cu_wamr.c is the WAMR binding and is built when WAMR is found.
+ *
+ * Usage:
+ *   cu_store *store = cu_store_new();
+ *   cu_module *module = cu_module_load_file("cu.wasm", error, sizeof(error));
+ *   cu_instance *unit = cu_instance_new(module, store, NULL, error, sizeof(error));
+ *   cu_instance_init(unit);
+ *   cu_result result;
+ *   if (cu_instance_compute(unit, "return 1 + 1", 12, &result) == CU_OK) ...
+ */
+
+#ifndef CU_HOST_H
+#define CU_HOST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Status codes; every call that can fail returns one */
+#define CU_OK             0
+#define CU_ERR           -1  /* invalid argument or state */
+#define CU_ERR_NOMEM     -2
+#define CU_ERR_NOT_FOUND -3
+#define CU_ERR_TOO_LARGE -4  /* does not fit the buffer given */
+#define CU_ERR_LUA       -5  /* Lua raised an error; see the result */
+#define CU_ERR_TRAP      -6  /* the module trapped; see cu_instance_error() */
+
+typedef struct cu_store cu_store;
+typedef struct cu_module cu_module;
+typedef struct cu_instance cu_instance;
+
+/* ------------------------------------------------------------------ */
+/* Store                                                               */
+/* ------------------------------------------------------------------ */
+
+cu_store *cu_store_new(void);
+
+/* Free a store and every value in it. Free its instances first. */
+void cu_store_free(cu_store *store);
+
+/*
+ * Set a key; the bytes are copied into the store. Values are serialized
+ * Lua values as cu.wasm writes them. Creates the table if needed.
+ */
+int cu_store_set(cu_store *store, uint32_t table_id,
+                 const void *key, size_t key_len,
+                 const void *value, size_t value_len);
+
+/*
+ * Copy a value into `out`. Returns CU_ERR_NOT_FOUND for a missing key, or
+ * CU_ERR_TOO_LARGE if it does not fit in `max_len`; either way
+ * `*value_len` (if given) is set to the value's length (0 if missing).
+ */
+int cu_store_get(cu_store *store, uint32_t table_id,
+                 const void *key, size_t key_len,
+                 void *out, size_t max_len, size_t *value_len);
+
+int cu_store_delete(cu_store *store, uint32_t table_id,
+                    const void *key, size_t key_len);
+
+/* Number of keys in a table (0 if it does not exist) */
+size_t cu_store_size(cu_store *store, uint32_t table_id);
+
+/*
+ * Visit a table's entries in insertion order, as for saving them. The
+ * store is locked meanwhile: the callback must not call back into it.
+ * A non-zero return from the callback stops the walk and is returned.
+ */
+typedef int (*cu_entry_fn)(void *user, const uint8_t *key, size_t key_len,
+                           const uint8_t *value, size_t value_len);
+int cu_store_foreach(cu_store *store, uint32_t table_id, cu_entry_fn fn, void *user);
+
+/* IDs of the stored tables, in no order; returns how many there are */
+size_t cu_store_table_ids(cu_store *store, uint32_t *out, size_t max);
+
+/*
+ * The table _home is bound to. 0 until an instance initializes; set it
+ * before cu_instance_init() after restoring saved tables, so the new VM
+ * attaches _home to them.
+ */
+uint32_t cu_store_home_table(cu_store *store);
+void cu_store_set_home_table(cu_store *store, uint32_t table_id);
+
+/* Memory held by the store: arena chunks plus large values and indexes */
+size_t cu_store_bytes(cu_store *store);
+
+/* ------------------------------------------------------------------ */
+/* Modules and instances (WAMR)                                        */
+/* ------------------------------------------------------------------ */
+
+/*
+ * Load cu.wasm or an AOT image of it (wamrc -o cu.aot cu.wasm); the bytes
+ * are copied. Initializes the runtime on first use. On failure returns
+ * NULL with a message in `error`.
+ */
+cu_module *cu_module_load(const uint8_t *bytes, size_t len, char *error, size_t error_size);
+cu_module *cu_module_load_file(const char *path, char *error, size_t error_size);
+
+/* Free a module once its instances are freed */
+void cu_module_free(cu_module *module);
+
+typedef struct cu_instance_options {
+    uint32_t stack_size;      /* wasm operand stack; 0 = 256KB */
+    /* Streamed print() output; NULL keeps output in the result */
+    void (*output)(void *user, const char *text, size_t len);
+    /* Polled during long computes; non-zero interrupts the compute */
+    int (*interrupt)(void *user);
+    void *user;
+} cu_instance_options;
+
+/*
+ * Instantiate a module over a store. Several instances may share one
+ * store; each store access is locked.
+ */
+cu_instance *cu_instance_new(cu_module *module, cu_store *store,
+                             const cu_instance_options *options,
+                             char *error, size_t error_size);
+
+void cu_instance_free(cu_instance *instance);
+
+/* Create the Lua VM and bind _home (see cu_store_home_table()) */
+int cu_instance_init(cu_instance *instance);
+
+typedef struct cu_result {
+    const uint8_t *data;  /* in linear memory; valid until the next call */
+    size_t len;
+} cu_result;
+
+/*
+ * Run Lua source or a binary chunk. CU_OK leaves the serialized return
+ * value in `result`, CU_ERR_LUA the error message.
+ */
+int cu_instance_compute(cu_instance *instance, const char *code, size_t len, cu_result *result);
+
+/* The last trap's message, or "" */
+const char *cu_instance_error(cu_instance *instance);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CU_HOST_H */
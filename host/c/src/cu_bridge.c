@@ -0,0 +1,347 @@
+/*
+ * The env imports cu.wasm calls for external tables, written against
+ * native pointers so any runtime binding can use them. Formats and return
+ * codes are those of the browser host (web/cu-instance.js):
+ *
+ *   get       value length; -1 missing; -2 - length if it does not fit
+ *   keys      keys joined by '\n'; -1 if they do not fit
+ *   next      u32 next_cursor (0 = done), u32 count, then per entry
+ *             u32 key_len, key, u32 value_len, value
+ *   set_many  frames of u32 key_len, key, u32 value_len, value
+ *   get_many  keys as frames of u32 key_len, key; answered as u32 count,
+ *             then per key i32 value_len (-1 missing) and the value
+ *
+ * Keys cross as the decimal/UTF-8 bytes of the default key encoding and
+ * are stored as those bytes. Each value is copied once, between the arena
+ * and linear memory. A blob (tag 0xe0) goes to Lua as a 9-byte handle
+ * (0xe1, u32 handle, u32 length) when the module can read blobs in place;
+ * the handle pins the stored bytes until Lua releases it.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "cu_internal.h"
+
+#define SCAN_HEADER 8
+#define NO_FREE_HANDLE UINT32_MAX
+
+static uint32_t read_u32(const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void write_u32(uint8_t *p, uint32_t value) {
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+    p[2] = (uint8_t)(value >> 16);
+    p[3] = (uint8_t)(value >> 24);
+}
+
+void cu_bridge_init(cu_bridge *bridge, cu_store *store) {
+    memset(bridge, 0, sizeof(*bridge));
+    bridge->store = store;
+    bridge->blob_free = NO_FREE_HANDLE;
+}
+
+void cu_bridge_release(cu_bridge *bridge) {
+    cu_store_lock(bridge->store);
+    for (uint32_t i = 0; i < bridge->blob_count; i++) {
+        cu_value *value = bridge->blobs[i];
+        /* Released slots hold the free list, tagged in the low bit */
+        if (value && !((uintptr_t)value & 1)) cu_value_release(bridge->store, value);
+    }
+    cu_store_unlock(bridge->store);
+    free(bridge->blobs);
+    bridge->blobs = NULL;
+    bridge->blob_count = bridge->blob_cap = 0;
+    bridge->blob_free = NO_FREE_HANDLE;
+}
+
+/* ------------------------------------------------------------------ */
+/* Blob handles                                                        */
+/* ------------------------------------------------------------------ */
+
+/* Handle for a pinned value, or 0 if out of memory */
+static uint32_t blob_handle(cu_bridge *bridge, cu_value *value) {
+    uint32_t slot;
+    if (bridge->blob_free != NO_FREE_HANDLE) {
+        slot = bridge->blob_free;
+        uintptr_t link = (uintptr_t)bridge->blobs[slot] >> 1;
+        bridge->blob_free = link == 0 ? NO_FREE_HANDLE : (uint32_t)(link - 1);
+    } else {
+        if (bridge->blob_count == bridge->blob_cap) {
+            uint32_t cap = bridge->blob_cap ? bridge->blob_cap * 2 : 16;
+            cu_value **blobs = realloc(bridge->blobs, (size_t)cap * sizeof(cu_value *));
+            if (!blobs) return 0;
+            bridge->blobs = blobs;
+            bridge->blob_cap = cap;
+        }
+        slot = bridge->blob_count++;
+    }
+    cu_value_retain(value);
+    bridge->blobs[slot] = value;
+    return slot + 1;
+}
+
+static cu_value *blob_value(cu_bridge *bridge, uint32_t handle) {
+    if (handle == 0 || handle > bridge->blob_count) return NULL;
+    cu_value *value = bridge->blobs[handle - 1];
+    return value && !((uintptr_t)value & 1) ? value : NULL;
+}
+
+void cu_bridge_blob_release(cu_bridge *bridge, uint32_t handle) {
+    cu_store_lock(bridge->store);
+    cu_value *value = blob_value(bridge, handle);
+    if (value) {
+        cu_value_release(bridge->store, value);
+        uintptr_t link = bridge->blob_free == NO_FREE_HANDLE ? 0 : (uintptr_t)bridge->blob_free + 1;
+        bridge->blobs[handle - 1] = (cu_value *)(link << 1 | 1);
+        bridge->blob_free = handle - 1;
+    }
+    cu_store_unlock(bridge->store);
+}
+
+int32_t cu_bridge_blob_read(cu_bridge *bridge, uint32_t handle, uint32_t offset,
+                            uint8_t *out, uint32_t len) {
+    cu_store_lock(bridge->store);
+    int32_t result = -1;
+    cu_value *value = blob_value(bridge, handle);
+    if (value && (uint64_t)offset + len <= value->len - CU_BLOB_HEADER) {
+        memcpy(out, value->bytes + CU_BLOB_HEADER + offset, len);
+        result = (int32_t)len;
+    }
+    cu_store_unlock(bridge->store);
+    return result;
+}
+
+/*
+ * Bytes to send Lua for a stored value: the value, or a handle stub
+ * written to `stub`. NULL if a handle could not be made.
+ */
+static const uint8_t *outgoing(cu_bridge *bridge, cu_value *value, uint8_t stub[CU_BLOB_STUB],
+                               uint32_t *len) {
+    if (!bridge->host_blobs || value->len < CU_BLOB_HEADER || value->bytes[0] != CU_TAG_BLOB) {
+        *len = value->len;
+        return value->bytes;
+    }
+    uint32_t handle = blob_handle(bridge, value);
+    if (handle == 0) return NULL;
+    stub[0] = CU_TAG_BLOB_HANDLE;
+    write_u32(stub + 1, handle);
+    write_u32(stub + 5, value->len - CU_BLOB_HEADER);
+    *len = CU_BLOB_STUB;
+    return stub;
+}
+
+/* Store bytes written by Lua; a handle stands for the blob it names */
+static int32_t incoming(cu_bridge *bridge, cu_table *table, const uint8_t *key, uint32_t key_len,
+                        const uint8_t *value, uint32_t value_len) {
+    if (value_len == CU_BLOB_STUB && value[0] == CU_TAG_BLOB_HANDLE) {
+        cu_value *blob = blob_value(bridge, read_u32(value + 1));
+        if (blob) return cu_table_put_value(bridge->store, table, key, key_len, blob) == CU_OK ? 0 : -1;
+    }
+    return cu_table_put(bridge->store, table, key, key_len, value, value_len) == CU_OK ? 0 : -1;
+}
+
+/* ------------------------------------------------------------------ */
+/* Imports                                                             */
+/* ------------------------------------------------------------------ */
+
+int32_t cu_bridge_set(cu_bridge *bridge, uint32_t table_id, const uint8_t *key, uint32_t key_len,
+                      const uint8_t *value, uint32_t value_len) {
+    cu_store_lock(bridge->store);
+    cu_table *table = cu_store_table(bridge->store, table_id, true);
+    int32_t result = table ? incoming(bridge, table, key, key_len, value, value_len) : -1;
+    cu_store_unlock(bridge->store);
+    return result;
+}
+
+int32_t cu_bridge_set_parts(cu_bridge *bridge, uint32_t table_id, const uint8_t *key, uint32_t key_len,
+                            const uint8_t *head, uint32_t head_len,
+                            const uint8_t *body, uint32_t body_len) {
+    if ((uint64_t)head_len + body_len > UINT32_MAX) return -1;
+    uint8_t *value = malloc((size_t)head_len + body_len);
+    if (!value) return -1;
+    memcpy(value, head, head_len);
+    memcpy(value + head_len, body, body_len);
+    int32_t result = cu_bridge_set(bridge, table_id, key, key_len, value, head_len + body_len);
+    free(value);
+    return result;
+}
+
+int32_t cu_bridge_get(cu_bridge *bridge, uint32_t table_id, const uint8_t *key, uint32_t key_len,
+                      uint8_t *out, uint32_t max_len) {
+    cu_store_lock(bridge->store);
+    int32_t result = -1;
+    cu_table *table = cu_store_table(bridge->store, table_id, false);
+    cu_entry *entry = table ? cu_table_find(table, key, key_len) : NULL;
+    if (entry) {
+        uint8_t stub[CU_BLOB_STUB];
+        uint32_t len;
+        /* Size the value before pinning a blob for a caller that must retry */
+        uint32_t needed = bridge->host_blobs && entry->value->len >= CU_BLOB_HEADER &&
+                          entry->value->bytes[0] == CU_TAG_BLOB ? CU_BLOB_STUB : entry->value->len;
+        if (needed > max_len) {
+            result = needed > INT32_MAX - 2 ? INT32_MIN : -2 - (int32_t)needed;
+        } else {
+            const uint8_t *bytes = outgoing(bridge, entry->value, stub, &len);
+            if (bytes) {
+                memcpy(out, bytes, len);
+                result = (int32_t)len;
+            }
+        }
+    }
+    cu_store_unlock(bridge->store);
+    return result;
+}
+
+int32_t cu_bridge_delete(cu_bridge *bridge, uint32_t table_id, const uint8_t *key, uint32_t key_len) {
+    cu_store_lock(bridge->store);
+    cu_table *table = cu_store_table(bridge->store, table_id, false);
+    if (table) cu_table_remove(bridge->store, table, key, key_len);
+    cu_store_unlock(bridge->store);
+    return table ? 0 : -1;
+}
+
+uint32_t cu_bridge_size(cu_bridge *bridge, uint32_t table_id) {
+    return (uint32_t)cu_store_size(bridge->store, table_id);
+}
+
+int32_t cu_bridge_keys(cu_bridge *bridge, uint32_t table_id, uint8_t *out, uint32_t max_len) {
+    cu_store_lock(bridge->store);
+    int32_t result = -1;
+    cu_table *table = cu_store_table(bridge->store, table_id, false);
+    if (table) {
+        uint32_t offset = 0;
+        bool first = true;
+        result = 0;
+        for (uint32_t i = 0; i < table->used; i++) {
+            const cu_entry *entry = table->entries[i];
+            if (!entry) continue;
+            uint32_t needed = entry->key_len + (first ? 0 : 1);
+            if ((uint64_t)offset + needed > max_len) {
+                result = -1;
+                break;
+            }
+            if (!first) out[offset++] = '\n';
+            memcpy(out + offset, entry->key, entry->key_len);
+            offset += entry->key_len;
+            first = false;
+        }
+        if (result == 0) result = (int32_t)offset;
+    }
+    cu_store_unlock(bridge->store);
+    return result;
+}
+
+int32_t cu_bridge_next(cu_bridge *bridge, uint32_t table_id, uint32_t cursor,
+                       uint8_t *out, uint32_t max_len) {
+    if (max_len < SCAN_HEADER) return -1;
+    cu_store_lock(bridge->store);
+    cu_store *store = bridge->store;
+    int32_t result = -1;
+    cu_table *table = cu_store_table(store, table_id, false);
+    if (cursor == 0 && table) cursor = cu_scan_open(store, table);
+    cu_scan *scan = table ? cu_scan_find(store, cursor) : NULL;
+
+    if (scan && scan->table_id == table_id) {
+        uint32_t offset = SCAN_HEADER;
+        uint32_t count = 0;
+        while (scan->pos < table->used) {
+            cu_entry *entry = table->entries[scan->pos];
+            if (!entry) {
+                scan->pos++; /* deleted since the scan started */
+                continue;
+            }
+            uint8_t stub[CU_BLOB_STUB];
+            uint32_t len;
+            bool blob = bridge->host_blobs && entry->value->len >= CU_BLOB_HEADER &&
+                        entry->value->bytes[0] == CU_TAG_BLOB;
+            uint32_t value_len = blob ? CU_BLOB_STUB : entry->value->len;
+            uint64_t needed = 8 + (uint64_t)entry->key_len + value_len;
+            if (offset + needed > max_len) {
+                if (count > 0) break;
+                scan->pos++; /* larger than one batch */
+                continue;
+            }
+            const uint8_t *bytes = outgoing(bridge, entry->value, stub, &len);
+            if (!bytes) break;
+            write_u32(out + offset, entry->key_len);
+            memcpy(out + offset + 4, entry->key, entry->key_len);
+            offset += 4 + entry->key_len;
+            write_u32(out + offset, len);
+            memcpy(out + offset + 4, bytes, len);
+            offset += 4 + len;
+            scan->pos++;
+            count++;
+        }
+
+        bool done = scan->pos >= table->used;
+        write_u32(out, done ? 0 : cursor);
+        write_u32(out + 4, count);
+        if (done) cu_scan_close(store, scan);
+        result = (int32_t)offset;
+    }
+    cu_store_unlock(store);
+    return result;
+}
+
+int32_t cu_bridge_set_many(cu_bridge *bridge, uint32_t table_id, const uint8_t *frames, uint32_t len) {
+    cu_store_lock(bridge->store);
+    cu_table *table = cu_store_table(bridge->store, table_id, true);
+    int32_t result = table ? 0 : -1;
+    uint32_t offset = 0;
+    while (table && result == 0 && (uint64_t)offset + 8 <= len) {
+        uint32_t key_len = read_u32(frames + offset);
+        if ((uint64_t)offset + 8 + key_len > len) break;
+        uint32_t value_len = read_u32(frames + offset + 4 + key_len);
+        if ((uint64_t)offset + 8 + key_len + value_len > len) break;
+        result = incoming(bridge, table, frames + offset + 4, key_len,
+                          frames + offset + 8 + key_len, value_len);
+        offset += 8 + key_len + value_len;
+    }
+    cu_store_unlock(bridge->store);
+    return result == 0 && offset == len ? 0 : -1;
+}
+
+int32_t cu_bridge_get_many(cu_bridge *bridge, uint32_t table_id, const uint8_t *keys, uint32_t keys_len,
+                           uint8_t *out, uint32_t max_len) {
+    if (max_len < 8) return -1;
+    cu_store_lock(bridge->store);
+    cu_table *table = cu_store_table(bridge->store, table_id, false);
+    int32_t result = -1;
+    if (table) {
+        uint32_t key_offset = 0;
+        uint32_t offset = 4;
+        uint32_t answered = 0;
+        while ((uint64_t)key_offset + 4 <= keys_len) {
+            uint32_t key_len = read_u32(keys + key_offset);
+            if ((uint64_t)key_offset + 4 + key_len > keys_len) break;
+            cu_entry *entry = cu_table_find(table, keys + key_offset + 4, key_len);
+            cu_value *value = entry ? entry->value : NULL;
+            bool blob = value && bridge->host_blobs && value->len >= CU_BLOB_HEADER &&
+                        value->bytes[0] == CU_TAG_BLOB;
+            uint32_t value_len = value ? (blob ? CU_BLOB_STUB : value->len) : 0;
+            if ((uint64_t)offset + 4 + value_len > max_len) {
+                if (answered > 0) break;
+                value = NULL; /* too large for one answer; report it missing */
+            }
+
+            uint8_t stub[CU_BLOB_STUB];
+            uint32_t len = 0;
+            const uint8_t *bytes = value ? outgoing(bridge, value, stub, &len) : NULL;
+            write_u32(out + offset, bytes ? len : UINT32_MAX);
+            offset += 4;
+            if (bytes) {
+                memcpy(out + offset, bytes, len);
+                offset += len;
+            }
+            key_offset += 4 + key_len;
+            answered++;
+        }
+        write_u32(out, answered);
+        result = (int32_t)offset;
+    }
+    cu_store_unlock(bridge->store);
+    return result;
+}
@@ -0,0 +1,152 @@
+/*
+ * libcu-host internals shared by the store, the import protocol and the
+ * runtime binding. Not installed.
+ */
+
+#ifndef CU_INTERNAL_H
+#define CU_INTERNAL_H
+
+#include <stdbool.h>
+
+#include "cu_host.h"
+
+#ifndef CU_HOST_NO_THREADS
+#include <pthread.h>
+#endif
+
+/* Value tags (web/cu-values.js) the host looks at */
+#define CU_TAG_BLOB        0xe0
+#define CU_TAG_BLOB_HANDLE 0xe1
+#define CU_BLOB_HEADER     5
+#define CU_BLOB_STUB       9
+
+/*
+ * A stored value. Reference-counted so a blob handed to Lua as a handle,
+ * or stored under a second key, shares the bytes instead of copying them.
+ */
+typedef struct cu_value {
+    uint32_t refs;
+    uint32_t len;
+    uint32_t cap;
+    uint8_t bytes[];
+} cu_value;
+
+/* A key and its value; allocated from the arena */
+typedef struct cu_entry {
+    uint32_t hash;
+    uint32_t key_len;
+    cu_value *value;
+    uint8_t key[];
+} cu_entry;
+
+typedef struct cu_scan cu_scan;
+
+typedef struct cu_table {
+    uint32_t id;
+    /* Insertion order; NULL where an entry was deleted */
+    cu_entry **entries;
+    uint32_t used;        /* slots of `entries` used, deleted included */
+    uint32_t live;
+    uint32_t entries_cap;
+    /* Open addressing over `entries`: position + 1, 0 = empty */
+    uint32_t *index;
+    uint32_t index_mask;
+    /* Open pairs() scans, repositioned when `entries` is compacted */
+    cu_scan *scans;
+} cu_table;
+
+/* A pairs() scan (js_ext_table_next) positioned in a table's entries */
+struct cu_scan {
+    uint32_t cursor;      /* 0 = free slot */
+    uint32_t table_id;
+    uint32_t pos;
+    uint64_t opened;      /* for evicting the oldest abandoned scan */
+    cu_scan *next;        /* in the table's list */
+};
+
+#define CU_ARENA_CLASSES 12          /* 16 bytes .. 32KB */
+#define CU_ARENA_CHUNK   (256 * 1024)
+#define CU_MAX_SCANS     64
+
+typedef struct cu_arena {
+    void *free_lists[CU_ARENA_CLASSES];
+    uint8_t *chunk_next;
+    uint8_t *chunk_end;
+    void *chunks;                    /* linked through their first word */
+    size_t chunk_bytes;
+    size_t large_bytes;
+} cu_arena;
+
+struct cu_store {
+#ifndef CU_HOST_NO_THREADS
+    pthread_mutex_t lock;
+#endif
+    cu_arena arena;
+    cu_table **tables;               /* open addressing on id */
+    uint32_t tables_mask;
+    uint32_t table_count;
+    uint32_t home_table_id;
+    uint32_t next_table_id;
+    cu_scan scans[CU_MAX_SCANS];
+    uint32_t next_cursor;
+    uint64_t scans_opened;
+    size_t index_bytes;
+};
+
+void cu_store_lock(cu_store *store);
+void cu_store_unlock(cu_store *store);
+
+/* With the store locked: */
+cu_table *cu_store_table(cu_store *store, uint32_t table_id, bool create);
+cu_entry *cu_table_find(const cu_table *table, const uint8_t *key, uint32_t key_len);
+int cu_table_put(cu_store *store, cu_table *table, const uint8_t *key, uint32_t key_len,
+                 const uint8_t *value, uint32_t value_len);
+int cu_table_put_value(cu_store *store, cu_table *table, const uint8_t *key, uint32_t key_len,
+                       cu_value *value);
+int cu_table_remove(cu_store *store, cu_table *table, const uint8_t *key, uint32_t key_len);
+void cu_value_retain(cu_value *value);
+void cu_value_release(cu_store *store, cu_value *value);
+
+uint32_t cu_scan_open(cu_store *store, cu_table *table);
+cu_scan *cu_scan_find(cu_store *store, uint32_t cursor);
+void cu_scan_close(cu_store *store, cu_scan *scan);
+
+/*
+ * Per-instance side of the env imports, independent of the runtime. The
+ * binding passes native pointers it has checked against linear memory.
+ */
+typedef struct cu_bridge {
+    cu_store *store;
+    bool host_blobs;                 /* the module imports js_blob_read */
+    cu_value **blobs;                /* handle - 1 -> pinned value */
+    uint32_t blob_count;
+    uint32_t blob_cap;
+    uint32_t blob_free;              /* a released handle - 1, or UINT32_MAX */
+    void (*output)(void *user, const char *text, size_t len);
+    int (*interrupt)(void *user);
+    void *user;
+} cu_bridge;
+
+void cu_bridge_init(cu_bridge *bridge, cu_store *store);
+void cu_bridge_release(cu_bridge *bridge);
+
+int32_t cu_bridge_set(cu_bridge *bridge, uint32_t table_id, const uint8_t *key, uint32_t key_len,
+                      const uint8_t *value, uint32_t value_len);
+int32_t cu_bridge_set_parts(cu_bridge *bridge, uint32_t table_id, const uint8_t *key, uint32_t key_len,
+                            const uint8_t *head, uint32_t head_len,
+                            const uint8_t *body, uint32_t body_len);
+int32_t cu_bridge_get(cu_bridge *bridge, uint32_t table_id, const uint8_t *key, uint32_t key_len,
+                      uint8_t *out, uint32_t max_len);
+int32_t cu_bridge_delete(cu_bridge *bridge, uint32_t table_id, const uint8_t *key, uint32_t key_len);
+uint32_t cu_bridge_size(cu_bridge *bridge, uint32_t table_id);
+int32_t cu_bridge_keys(cu_bridge *bridge, uint32_t table_id, uint8_t *out, uint32_t max_len);
+int32_t cu_bridge_next(cu_bridge *bridge, uint32_t table_id, uint32_t cursor,
+                       uint8_t *out, uint32_t max_len);
+int32_t cu_bridge_set_many(cu_bridge *bridge, uint32_t table_id, const uint8_t *frames, uint32_t len);
+int32_t cu_bridge_get_many(cu_bridge *bridge, uint32_t table_id, const uint8_t *keys, uint32_t keys_len,
+                           uint8_t *out, uint32_t max_len);
+int32_t cu_bridge_blob_read(cu_bridge *bridge, uint32_t handle, uint32_t offset,
+                            uint8_t *out, uint32_t len);
+void cu_bridge_blob_release(cu_bridge *bridge, uint32_t handle);
+
+#endif /* CU_INTERNAL_H */
@@ -0,0 +1,560 @@
+/*
+ * External table storage
+ *
+ * Each table is an insertion-ordered array of entries with an open
+ * addressing index over it (Python's dict layout): lookups hash the key
+ * once, and pairs() scans walk the array, so a scan stays valid while Lua
+ * writes to the table it is scanning. Deleted entries leave a hole that is
+ * squeezed out when the array next fills up; open scans are moved along.
+ *
+ * Keys and values live in the store's arena: blocks in power-of-two size
+ * classes carved from 256KB chunks, with a free list per class, so
+ * overwriting a value with one of similar size reuses its block and
+ * freeing the store releases whole chunks. Values larger than the largest
+ * class are allocated on their own.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "cu_internal.h"
+
+#define ARENA_MIN_BLOCK 16
+#define ARENA_MAX_BLOCK (ARENA_MIN_BLOCK << (CU_ARENA_CLASSES - 1))
+#define MIN_ENTRIES 8
+#define MIN_TABLES 16
+
+/* ------------------------------------------------------------------ */
+/* Arena                                                               */
+/* ------------------------------------------------------------------ */
+
+static int arena_class(size_t size) {
+    int index = 0;
+    size_t block = ARENA_MIN_BLOCK;
+    while (block < size) {
+        block <<= 1;
+        index++;
+    }
+    return index;
+}
+
+/* Usable size of the block arena_alloc() returns for `size` */
+static size_t arena_block_size(size_t size) {
+    if (size > ARENA_MAX_BLOCK) return size;
+    return (size_t)ARENA_MIN_BLOCK << arena_class(size);
+}
+
+static void *arena_alloc(cu_arena *arena, size_t size) {
+    if (size > ARENA_MAX_BLOCK) {
+        void *block = malloc(size);
+        if (block) arena->large_bytes += size;
+        return block;
+    }
+
+    int index = arena_class(size);
+    void *block = arena->free_lists[index];
+    if (block) {
+        arena->free_lists[index] = *(void **)block;
+        return block;
+    }
+
+    size_t block_size = (size_t)ARENA_MIN_BLOCK << index;
+    if (arena->chunk_next == NULL || (size_t)(arena->chunk_end - arena->chunk_next) < block_size) {
+        /* The rest of the current chunk is left unused */
+        uint8_t *chunk = malloc(CU_ARENA_CHUNK);
+        if (!chunk) return NULL;
+        *(void **)chunk = arena->chunks;
+        arena->chunks = chunk;
+        arena->chunk_bytes += CU_ARENA_CHUNK;
+        /* The first block keeps blocks 16-byte aligned after the link */
+        arena->chunk_next = chunk + ARENA_MIN_BLOCK;
+        arena->chunk_end = chunk + CU_ARENA_CHUNK;
+    }
+    block = arena->chunk_next;
+    arena->chunk_next += block_size;
+    return block;
+}
+
+static void arena_free(cu_arena *arena, void *block, size_t size) {
+    if (!block) return;
+    if (size > ARENA_MAX_BLOCK) {
+        arena->large_bytes -= size;
+        free(block);
+        return;
+    }
+    int index = arena_class(size);
+    *(void **)block = arena->free_lists[index];
+    arena->free_lists[index] = block;
+}
+
+static void arena_destroy(cu_arena *arena) {
+    void *chunk = arena->chunks;
+    while (chunk) {
+        void *next = *(void **)chunk;
+        free(chunk);
+        chunk = next;
+    }
+    memset(arena, 0, sizeof(*arena));
+}
+
+/* ------------------------------------------------------------------ */
+/* Values and entries                                                  */
+/* ------------------------------------------------------------------ */
+
+static uint32_t hash_key(const uint8_t *key, uint32_t len) {
+    /* FNV-1a */
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; i < len; i++) {
+        hash ^= key[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static size_t value_size(uint32_t cap) {
+    return sizeof(cu_value) + cap;
+}
+
+static cu_value *value_new(cu_store *store, const uint8_t *bytes, uint32_t len) {
+    size_t size = arena_block_size(value_size(len));
+    cu_value *value = arena_alloc(&store->arena, size);
+    if (!value) return NULL;
+    value->refs = 1;
+    value->len = len;
+    value->cap = (uint32_t)(size - sizeof(cu_value));
+    if (len > 0) memcpy(value->bytes, bytes, len);
+    return value;
+}
+
+void cu_value_retain(cu_value *value) {
+    value->refs++;
+}
+
+void cu_value_release(cu_store *store, cu_value *value) {
+    if (value && --value->refs == 0) {
+        arena_free(&store->arena, value, value_size(value->cap));
+    }
+}
+
+static size_t entry_size(uint32_t key_len) {
+    return sizeof(cu_entry) + key_len;
+}
+
+static void entry_free(cu_store *store, cu_entry *entry) {
+    cu_value_release(store, entry->value);
+    arena_free(&store->arena, entry, arena_block_size(entry_size(entry->key_len)));
+}
+
+/* ------------------------------------------------------------------ */
+/* Tables                                                              */
+/* ------------------------------------------------------------------ */
+
+/* Slot of `key` in the index, or -1 */
+static int64_t find_slot(const cu_table *table, const uint8_t *key, uint32_t key_len, uint32_t hash) {
+    if (!table->index) return -1;
+    uint32_t slot = hash & table->index_mask;
+    for (;;) {
+        uint32_t position = table->index[slot];
+        if (position == 0) return -1;
+        const cu_entry *entry = table->entries[position - 1];
+        if (entry->hash == hash && entry->key_len == key_len && memcmp(entry->key, key, key_len) == 0) {
+            return slot;
+        }
+        slot = (slot + 1) & table->index_mask;
+    }
+}
+
+cu_entry *cu_table_find(const cu_table *table, const uint8_t *key, uint32_t key_len) {
+    int64_t slot = find_slot(table, key, key_len, hash_key(key, key_len));
+    return slot < 0 ? NULL : table->entries[table->index[slot] - 1];
+}
+
+static int rebuild_index(cu_store *store, cu_table *table, uint32_t slots) {
+    uint32_t *index = calloc(slots, sizeof(uint32_t));
+    if (!index) return CU_ERR_NOMEM;
+    store->index_bytes -= table->index ? (size_t)(table->index_mask + 1) * sizeof(uint32_t) : 0;
+    store->index_bytes += (size_t)slots * sizeof(uint32_t);
+    free(table->index);
+    table->index = index;
+    table->index_mask = slots - 1;
+    for (uint32_t i = 0; i < table->used; i++) {
+        const cu_entry *entry = table->entries[i];
+        if (!entry) continue;
+        uint32_t slot = entry->hash & table->index_mask;
+        while (index[slot] != 0) slot = (slot + 1) & table->index_mask;
+        index[slot] = i + 1;
+    }
+    return CU_OK;
+}
+
+/* Squeeze the holes out of `entries`, keeping open scans on their entry */
+static int compact_entries(cu_store *store, cu_table *table) {
+    for (cu_scan *scan = table->scans; scan; scan = scan->next) {
+        uint32_t live_before = 0;
+        for (uint32_t i = 0; i < scan->pos && i < table->used; i++) {
+            if (table->entries[i]) live_before++;
+        }
+        scan->pos = live_before;
+    }
+
+    uint32_t out = 0;
+    for (uint32_t i = 0; i < table->used; i++) {
+        if (table->entries[i]) table->entries[out++] = table->entries[i];
+    }
+    table->used = out;
+    return rebuild_index(store, table, table->index_mask + 1);
+}
+
+/* Make room to append one entry */
+static int reserve_entry(cu_store *store, cu_table *table) {
+    if (table->index == NULL || (table->live + 1) * 2 > table->index_mask + 1) {
+        uint32_t slots = table->index ? (table->index_mask + 1) * 2 : MIN_ENTRIES * 2;
+        int status = rebuild_index(store, table, slots);
+        if (status != CU_OK) return status;
+    }
+    if (table->used < table->entries_cap) return CU_OK;
+
+    if (table->live < table->used / 2) return compact_entries(store, table);
+
+    uint32_t cap = table->entries_cap ? table->entries_cap * 2 : MIN_ENTRIES;
+    cu_entry **entries = realloc(table->entries, (size_t)cap * sizeof(cu_entry *));
+    if (!entries) return CU_ERR_NOMEM;
+    store->index_bytes += (size_t)(cap - table->entries_cap) * sizeof(cu_entry *);
+    table->entries = entries;
+    table->entries_cap = cap;
+    return CU_OK;
+}
+
+static int insert_entry(cu_store *store, cu_table *table, const uint8_t *key, uint32_t key_len,
+                        uint32_t hash, cu_value *value) {
+    int status = reserve_entry(store, table);
+    if (status != CU_OK) return status;
+    cu_entry *entry = arena_alloc(&store->arena, arena_block_size(entry_size(key_len)));
+    if (!entry) return CU_ERR_NOMEM;
+    entry->hash = hash;
+    entry->key_len = key_len;
+    entry->value = value;
+    memcpy(entry->key, key, key_len);
+
+    uint32_t slot = hash & table->index_mask;
+    while (table->index[slot] != 0) slot = (slot + 1) & table->index_mask;
+    table->entries[table->used] = entry;
+    table->index[slot] = ++table->used;
+    table->live++;
+    return CU_OK;
+}
+
+int cu_table_put(cu_store *store, cu_table *table, const uint8_t *key, uint32_t key_len,
+                 const uint8_t *bytes, uint32_t len) {
+    uint32_t hash = hash_key(key, key_len);
+    int64_t slot = find_slot(table, key, key_len, hash);
+    if (slot >= 0) {
+        cu_entry *entry = table->entries[table->index[slot] - 1];
+        cu_value *old = entry->value;
+        /* Overwrite in place unless a handle or another key shares it */
+        if (old->refs == 1 && old->cap >= len && arena_block_size(value_size(len)) == value_size(old->cap)) {
+            memcpy(old->bytes, bytes, len);
+            old->len = len;
+            return CU_OK;
+        }
+        cu_value *value = value_new(store, bytes, len);
+        if (!value) return CU_ERR_NOMEM;
+        entry->value = value;
+        cu_value_release(store, old);
+        return CU_OK;
+    }
+
+    cu_value *value = value_new(store, bytes, len);
+    if (!value) return CU_ERR_NOMEM;
+    int status = insert_entry(store, table, key, key_len, hash, value);
+    if (status != CU_OK) cu_value_release(store, value);
+    return status;
+}
+
+int cu_table_put_value(cu_store *store, cu_table *table, const uint8_t *key, uint32_t key_len,
+                       cu_value *value) {
+    uint32_t hash = hash_key(key, key_len);
+    int64_t slot = find_slot(table, key, key_len, hash);
+    cu_value_retain(value);
+    if (slot >= 0) {
+        cu_entry *entry = table->entries[table->index[slot] - 1];
+        cu_value *old = entry->value;
+        entry->value = value;
+        cu_value_release(store, old);
+        return CU_OK;
+    }
+    int status = insert_entry(store, table, key, key_len, hash, value);
+    if (status != CU_OK) cu_value_release(store, value);
+    return status;
+}
+
+int cu_table_remove(cu_store *store, cu_table *table, const uint8_t *key, uint32_t key_len) {
+    int64_t found = find_slot(table, key, key_len, hash_key(key, key_len));
+    if (found < 0) return CU_ERR_NOT_FOUND;
+
+    uint32_t slot = (uint32_t)found;
+    uint32_t position = table->index[slot] - 1;
+    entry_free(store, table->entries[position]);
+    table->entries[position] = NULL;
+    table->live--;
+
+    /* Backward-shift deletion keeps probe chains unbroken */
+    uint32_t mask = table->index_mask;
+    uint32_t next = slot;
+    table->index[slot] = 0;
+    for (;;) {
+        next = (next + 1) & mask;
+        if (table->index[next] == 0) break;
+        uint32_t home = table->entries[table->index[next] - 1]->hash & mask;
+        bool movable = slot <= next ? (home <= slot || home > next) : (home <= slot && home > next);
+        if (movable) {
+            table->index[slot] = table->index[next];
+            table->index[next] = 0;
+            slot = next;
+        }
+    }
+    return CU_OK;
+}
+
+static void table_free(cu_store *store, cu_table *table) {
+    for (uint32_t i = 0; i < table->used; i++) {
+        if (table->entries[i]) entry_free(store, table->entries[i]);
+    }
+    free(table->entries);
+    free(table->index);
+    free(table);
+}
+
+static uint32_t table_slot(uint32_t table_id, uint32_t mask) {
+    return (table_id * 2654435761u) & mask;
+}
+
+static int grow_tables(cu_store *store) {
+    uint32_t slots = store->tables ? (store->tables_mask + 1) * 2 : MIN_TABLES;
+    cu_table **tables = calloc(slots, sizeof(cu_table *));
+    if (!tables) return CU_ERR_NOMEM;
+    for (uint32_t i = 0; store->tables && i <= store->tables_mask; i++) {
+        cu_table *table = store->tables[i];
+        if (!table) continue;
+        uint32_t slot = table_slot(table->id, slots - 1);
+        while (tables[slot]) slot = (slot + 1) & (slots - 1);
+        tables[slot] = table;
+    }
+    store->index_bytes += (size_t)(slots - (store->tables ? store->tables_mask + 1 : 0)) * sizeof(cu_table *);
+    free(store->tables);
+    store->tables = tables;
+    store->tables_mask = slots - 1;
+    return CU_OK;
+}
+
+cu_table *cu_store_table(cu_store *store, uint32_t table_id, bool create) {
+    if (store->tables) {
+        uint32_t slot = table_slot(table_id, store->tables_mask);
+        while (store->tables[slot]) {
+            if (store->tables[slot]->id == table_id) return store->tables[slot];
+            slot = (slot + 1) & store->tables_mask;
+        }
+    }
+    if (!create) return NULL;
+
+    if (!store->tables || (store->table_count + 1) * 2 > store->tables_mask + 1) {
+        if (grow_tables(store) != CU_OK) return NULL;
+    }
+    cu_table *table = calloc(1, sizeof(cu_table));
+    if (!table) return NULL;
+    table->id = table_id;
+    uint32_t slot = table_slot(table_id, store->tables_mask);
+    while (store->tables[slot]) slot = (slot + 1) & store->tables_mask;
+    store->tables[slot] = table;
+    store->table_count++;
+    if (table_id >= store->next_table_id) store->next_table_id = table_id + 1;
+    return table;
+}
+
+/* ------------------------------------------------------------------ */
+/* Scans                                                               */
+/* ------------------------------------------------------------------ */
+
+uint32_t cu_scan_open(cu_store *store, cu_table *table) {
+    cu_scan *scan = NULL;
+    for (int i = 0; i < CU_MAX_SCANS; i++) {
+        if (store->scans[i].cursor == 0) {
+            scan = &store->scans[i];
+            break;
+        }
+        /* All in use: a pairs() loop left early never closes its scan */
+        if (!scan || store->scans[i].opened < scan->opened) scan = &store->scans[i];
+    }
+    if (scan->cursor != 0) cu_scan_close(store, scan);
+
+    if (++store->next_cursor == 0) store->next_cursor = 1;
+    scan->cursor = store->next_cursor;
+    scan->table_id = table->id;
+    scan->pos = 0;
+    scan->opened = ++store->scans_opened;
+    scan->next = table->scans;
+    table->scans = scan;
+    return scan->cursor;
+}
+
+cu_scan *cu_scan_find(cu_store *store, uint32_t cursor) {
+    if (cursor == 0) return NULL;
+    for (int i = 0; i < CU_MAX_SCANS; i++) {
+        if (store->scans[i].cursor == cursor) return &store->scans[i];
+    }
+    return NULL;
+}
+
+void cu_scan_close(cu_store *store, cu_scan *scan) {
+    cu_table *table = cu_store_table(store, scan->table_id, false);
+    if (table) {
+        cu_scan **link = &table->scans;
+        while (*link && *link != scan) link = &(*link)->next;
+        if (*link) *link = scan->next;
+    }
+    memset(scan, 0, sizeof(*scan));
+}
+
+/* ------------------------------------------------------------------ */
+/* Public API                                                          */
+/* ------------------------------------------------------------------ */
+
+void cu_store_lock(cu_store *store) {
+#ifndef CU_HOST_NO_THREADS
+    pthread_mutex_lock(&store->lock);
+#else
+    (void)store;
+#endif
+}
+
+void cu_store_unlock(cu_store *store) {
+#ifndef CU_HOST_NO_THREADS
+    pthread_mutex_unlock(&store->lock);
+#else
+    (void)store;
+#endif
+}
+
+cu_store *cu_store_new(void) {
+    cu_store *store = calloc(1, sizeof(cu_store));
+    if (!store) return NULL;
+#ifndef CU_HOST_NO_THREADS
+    if (pthread_mutex_init(&store->lock, NULL) != 0) {
+        free(store);
+        return NULL;
+    }
+#endif
+    store->next_table_id = 1;
+    return store;
+}
+
+void cu_store_free(cu_store *store) {
+    if (!store) return;
+    for (uint32_t i = 0; store->tables && i <= store->tables_mask; i++) {
+        if (store->tables[i]) table_free(store, store->tables[i]);
+    }
+    free(store->tables);
+    arena_destroy(&store->arena);
+#ifndef CU_HOST_NO_THREADS
+    pthread_mutex_destroy(&store->lock);
+#endif
+    free(store);
+}
+
+int cu_store_set(cu_store *store, uint32_t table_id, const void *key, size_t key_len,
+                 const void *value, size_t value_len) {
+    if (!store || (!key && key_len) || (!value && value_len)) return CU_ERR;
+    if (key_len > UINT32_MAX || value_len > UINT32_MAX) return CU_ERR_TOO_LARGE;
+    cu_store_lock(store);
+    cu_table *table = cu_store_table(store, table_id, true);
+    int status = table ? cu_table_put(store, table, key, (uint32_t)key_len, value, (uint32_t)value_len)
+                       : CU_ERR_NOMEM;
+    cu_store_unlock(store);
+    return status;
+}
+
+int cu_store_get(cu_store *store, uint32_t table_id, const void *key, size_t key_len,
+                 void *out, size_t max_len, size_t *value_len) {
+    if (value_len) *value_len = 0;
+    if (!store || (!key && key_len) || key_len > UINT32_MAX) return CU_ERR;
+    cu_store_lock(store);
+    int status = CU_ERR_NOT_FOUND;
+    cu_table *table = cu_store_table(store, table_id, false);
+    cu_entry *entry = table ? cu_table_find(table, key, (uint32_t)key_len) : NULL;
+    if (entry) {
+        if (value_len) *value_len = entry->value->len;
+        if (entry->value->len > max_len) {
+            status = CU_ERR_TOO_LARGE;
+        } else {
+            if (entry->value->len > 0) memcpy(out, entry->value->bytes, entry->value->len);
+            status = CU_OK;
+        }
+    }
+    cu_store_unlock(store);
+    return status;
+}
+
+int cu_store_delete(cu_store *store, uint32_t table_id, const void *key, size_t key_len) {
+    if (!store || (!key && key_len) || key_len > UINT32_MAX) return CU_ERR;
+    cu_store_lock(store);
+    cu_table *table = cu_store_table(store, table_id, false);
+    int status = table ? cu_table_remove(store, table, key, (uint32_t)key_len) : CU_ERR_NOT_FOUND;
+    cu_store_unlock(store);
+    return status;
+}
+
+size_t cu_store_size(cu_store *store, uint32_t table_id) {
+    if (!store) return 0;
+    cu_store_lock(store);
+    cu_table *table = cu_store_table(store, table_id, false);
+    size_t size = table ? table->live : 0;
+    cu_store_unlock(store);
+    return size;
+}
+
+int cu_store_foreach(cu_store *store, uint32_t table_id, cu_entry_fn fn, void *user) {
+    if (!store || !fn) return CU_ERR;
+    cu_store_lock(store);
+    int status = CU_OK;
+    cu_table *table = cu_store_table(store, table_id, false);
+    for (uint32_t i = 0; table && i < table->used && status == CU_OK; i++) {
+        const cu_entry *entry = table->entries[i];
+        if (entry) status = fn(user, entry->key, entry->key_len, entry->value->bytes, entry->value->len);
+    }
+    cu_store_unlock(store);
+    return status;
+}
+
+size_t cu_store_table_ids(cu_store *store, uint32_t *out, size_t max) {
+    if (!store) return 0;
+    cu_store_lock(store);
+    size_t count = 0;
+    for (uint32_t i = 0; store->tables && i <= store->tables_mask; i++) {
+        if (!store->tables[i]) continue;
+        if (count < max) out[count] = store->tables[i]->id;
+        count++;
+    }
+    cu_store_unlock(store);
+    return count;
+}
+
+uint32_t cu_store_home_table(cu_store *store) {
+    cu_store_lock(store);
+    uint32_t table_id = store->home_table_id;
+    cu_store_unlock(store);
+    return table_id;
+}
+
+void cu_store_set_home_table(cu_store *store, uint32_t table_id) {
+    cu_store_lock(store);
+    store->home_table_id = table_id;
+    if (table_id) cu_store_table(store, table_id, true);
+    cu_store_unlock(store);
+}
+
+size_t cu_store_bytes(cu_store *store) {
+    cu_store_lock(store);
+    size_t bytes = store->arena.chunk_bytes + store->arena.large_bytes + store->index_bytes;
+    cu_store_unlock(store);
+    return bytes;
+}
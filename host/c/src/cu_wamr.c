@@ -0,0 +1,540 @@
+/*
+ * WAMR binding: loads cu.wasm (interpreted, JIT or an AOT image from
+ * wamrc, whichever the WAMR build supports) and binds its env imports to
+ * cu_bridge.c. WAMR checks each (pointer, length) argument against linear
+ * memory before the import runs ("*~" in the signatures below).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "wasm_export.h"
+
+#include "cu_internal.h"
+
+#define DEFAULT_STACK_SIZE (256 * 1024)
+#define OUTPUT_CHUNK_BYTES 4096
+
+struct cu_module {
+    wasm_module_t module;
+    uint8_t *bytes;                  /* WAMR reads the image in place */
+    bool host_blobs;
+};
+
+struct cu_instance {
+    cu_module *module;
+    wasm_module_inst_t inst;
+    wasm_exec_env_t env;
+    cu_bridge bridge;
+    uint32_t buffer_ptr;
+    uint32_t buffer_size;
+    wasm_function_inst_t compute;
+    uint32_t compute_params;
+    char error[256];
+};
+
+static cu_bridge *bridge_of(wasm_exec_env_t env) {
+    return &((cu_instance *)wasm_runtime_get_user_data(env))->bridge;
+}
+
+/* ------------------------------------------------------------------ */
+/* Imports                                                             */
+/* ------------------------------------------------------------------ */
+
+static int32_t js_time_now(wasm_exec_env_t env) {
+    (void)env;
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    /* Milliseconds, truncated to the import's i32 as the browser host does */
+    int64_t ms = (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+    return (int32_t)(uint32_t)ms;
+}
+
+static double js_clock_ms(wasm_exec_env_t env) {
+    (void)env;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec * 1000.0 + (double)now.tv_nsec / 1e6;
+}
+
+static int32_t js_ext_table_set(wasm_exec_env_t env, uint32_t table_id,
+                                uint8_t *key, uint32_t key_len, uint8_t *value, uint32_t value_len) {
+    return cu_bridge_set(bridge_of(env), table_id, key, key_len, value, value_len);
+}
+
+static int32_t js_ext_table_set_parts(wasm_exec_env_t env, uint32_t table_id,
+                                      uint8_t *key, uint32_t key_len,
+                                      uint8_t *head, uint32_t head_len,
+                                      uint8_t *body, uint32_t body_len) {
+    return cu_bridge_set_parts(bridge_of(env), table_id, key, key_len, head, head_len, body, body_len);
+}
+
+static int32_t js_ext_table_get(wasm_exec_env_t env, uint32_t table_id,
+                                uint8_t *key, uint32_t key_len, uint8_t *out, uint32_t max_len) {
+    return cu_bridge_get(bridge_of(env), table_id, key, key_len, out, max_len);
+}
+
+static int32_t js_ext_table_delete(wasm_exec_env_t env, uint32_t table_id, uint8_t *key, uint32_t key_len) {
+    return cu_bridge_delete(bridge_of(env), table_id, key, key_len);
+}
+
+static uint32_t js_ext_table_size(wasm_exec_env_t env, uint32_t table_id) {
+    return cu_bridge_size(bridge_of(env), table_id);
+}
+
+static int32_t js_ext_table_keys(wasm_exec_env_t env, uint32_t table_id, uint8_t *out, uint32_t max_len) {
+    return cu_bridge_keys(bridge_of(env), table_id, out, max_len);
+}
+
+static int32_t js_ext_table_next(wasm_exec_env_t env, uint32_t table_id, uint32_t cursor,
+                                 uint8_t *out, uint32_t max_len) {
+    return cu_bridge_next(bridge_of(env), table_id, cursor, out, max_len);
+}
+
+static int32_t js_ext_table_set_many(wasm_exec_env_t env, uint32_t table_id, uint8_t *frames, uint32_t len) {
+    return cu_bridge_set_many(bridge_of(env), table_id, frames, len);
+}
+
+static int32_t js_ext_table_get_many(wasm_exec_env_t env, uint32_t table_id,
+                                     uint8_t *keys, uint32_t keys_len, uint8_t *out, uint32_t max_len) {
+    return cu_bridge_get_many(bridge_of(env), table_id, keys, keys_len, out, max_len);
+}
+
+/* Range scans (ext.range, ext.rrange) are not supported by this host:
+ * ordering is a no-op and every range is empty */
+static int32_t js_ext_table_order(wasm_exec_env_t env, uint32_t table_id) {
+    (void)env;
+    (void)table_id;
+    return 0;
+}
+
+static int32_t js_ext_table_range(wasm_exec_env_t env, uint32_t table_id, uint8_t *lo, uint32_t lo_len,
+                                  uint8_t *hi, uint32_t hi_len, uint32_t limit, uint32_t reverse) {
+    (void)env;
+    (void)table_id;
+    (void)lo;
+    (void)lo_len;
+    (void)hi;
+    (void)hi_len;
+    (void)limit;
+    (void)reverse;
+    return 0;
+}
+
+/* Nor are secondary indexes (ext.index, ext.lookup): no lookup matches */
+static int32_t js_ext_table_index(wasm_exec_env_t env, uint32_t table_id, uint8_t *field, uint32_t field_len) {
+    (void)env;
+    (void)table_id;
+    (void)field;
+    (void)field_len;
+    return 0;
+}
+
+static int32_t js_ext_table_lookup(wasm_exec_env_t env, uint32_t table_id, uint8_t *field, uint32_t field_len,
+                                   uint8_t *value, uint32_t value_len, uint32_t limit) {
+    (void)env;
+    (void)table_id;
+    (void)field;
+    (void)field_len;
+    (void)value;
+    (void)value_len;
+    (void)limit;
+    return 0;
+}
+
+/* Nor are transactions (ext.transaction): they fail */
+static int32_t js_ext_transaction(wasm_exec_env_t env, uint32_t op) {
+    (void)env;
+    (void)op;
+    return -1;
+}
+
+/* Nor are cache tables (ext.cache): they are unbounded here */
+static int32_t js_ext_table_cache(wasm_exec_env_t env, uint32_t table_id, uint32_t max_entries, double ttl_seconds) {
+    (void)env;
+    (void)table_id;
+    (void)max_entries;
+    (void)ttl_seconds;
+    return 0;
+}
+
+/* Nor are negative-lookup filters: every miss reads the table */
+static int32_t js_ext_table_filter(wasm_exec_env_t env, uint32_t table_id, uint32_t bits_ptr, uint32_t bit_count) {
+    (void)env;
+    (void)table_id;
+    (void)bits_ptr;
+    (void)bit_count;
+    return -1;
+}
+
+/* Nor are columnar tables (ext.columns, ext.column): both fail */
+static int32_t js_ext_table_columns(wasm_exec_env_t env, uint32_t table_id, uint8_t *schema, uint32_t schema_len) {
+    (void)env;
+    (void)table_id;
+    (void)schema;
+    (void)schema_len;
+    return -1;
+}
+
+static int32_t js_ext_table_column(wasm_exec_env_t env, uint32_t table_id, uint8_t *field, uint32_t field_len,
+                                   uint32_t first, uint32_t last, uint8_t *out, uint32_t max_len) {
+    (void)env;
+    (void)table_id;
+    (void)field;
+    (void)field_len;
+    (void)first;
+    (void)last;
+    (void)out;
+    (void)max_len;
+    return -1;
+}
+
+/* Nor are array tables (ext.array, ext.push, ext.pop, ext.slice): they fail */
+static int32_t js_ext_table_array(wasm_exec_env_t env, uint32_t table_id) {
+    (void)env;
+    (void)table_id;
+    return -1;
+}
+
+static int32_t js_ext_table_push(wasm_exec_env_t env, uint32_t table_id, uint8_t *value, uint32_t value_len) {
+    (void)env;
+    (void)table_id;
+    (void)value;
+    (void)value_len;
+    return -1;
+}
+
+static int32_t js_ext_table_pop(wasm_exec_env_t env, uint32_t table_id, uint8_t *out, uint32_t max_len) {
+    (void)env;
+    (void)table_id;
+    (void)out;
+    (void)max_len;
+    return -1;
+}
+
+static int32_t js_ext_table_slice(wasm_exec_env_t env, uint32_t table_id, uint32_t first, uint32_t last,
+                                  uint8_t *out, uint32_t max_len) {
+    (void)env;
+    (void)table_id;
+    (void)first;
+    (void)last;
+    (void)out;
+    (void)max_len;
+    return -1;
+}
+
+/* Keys stay in the default decimal encoding, which never interns */
+static int32_t js_ext_key_intern(wasm_exec_env_t env, uint32_t handle, uint8_t *key, uint32_t key_len) {
+    (void)env;
+    (void)handle;
+    (void)key;
+    (void)key_len;
+    return -1;
+}
+
+static int32_t js_blob_read(wasm_exec_env_t env, uint32_t handle, uint32_t offset, uint8_t *out, uint32_t len) {
+    return cu_bridge_blob_read(bridge_of(env), handle, offset, out, len);
+}
+
+static void js_blob_release(wasm_exec_env_t env, uint32_t handle) {
+    cu_bridge_blob_release(bridge_of(env), handle);
+}
+
+static int32_t js_interrupt_requested(wasm_exec_env_t env) {
+    cu_bridge *bridge = bridge_of(env);
+    return bridge->interrupt && bridge->interrupt(bridge->user) ? 1 : 0;
+}
+
+static void js_write_output(wasm_exec_env_t env, uint8_t *text, uint32_t len) {
+    cu_bridge *bridge = bridge_of(env);
+    if (bridge->output) bridge->output(bridge->user, (const char *)text, len);
+}
+
+static NativeSymbol native_symbols[] = {
+    { "js_time_now", (void *)js_time_now, "()i", NULL },
+    { "js_clock_ms", (void *)js_clock_ms, "()F", NULL },
+    { "js_ext_table_set", (void *)js_ext_table_set, "(i*~*~)i", NULL },
+    { "js_ext_table_set_parts", (void *)js_ext_table_set_parts, "(i*~*~*~)i", NULL },
+    { "js_ext_table_get", (void *)js_ext_table_get, "(i*~*~)i", NULL },
+    { "js_ext_table_delete", (void *)js_ext_table_delete, "(i*~)i", NULL },
+    { "js_ext_table_size", (void *)js_ext_table_size, "(i)i", NULL },
+    { "js_ext_table_keys", (void *)js_ext_table_keys, "(i*~)i", NULL },
+    { "js_ext_table_next", (void *)js_ext_table_next, "(ii*~)i", NULL },
+    { "js_ext_table_set_many", (void *)js_ext_table_set_many, "(i*~)i", NULL },
+    { "js_ext_table_get_many", (void *)js_ext_table_get_many, "(i*~*~)i", NULL },
+    { "js_ext_table_order", (void *)js_ext_table_order, "(i)i", NULL },
+    { "js_ext_table_range", (void *)js_ext_table_range, "(i*~*~ii)i", NULL },
+    { "js_ext_table_index", (void *)js_ext_table_index, "(i*~)i", NULL },
+    { "js_ext_table_lookup", (void *)js_ext_table_lookup, "(i*~*~i)i", NULL },
+    { "js_ext_transaction", (void *)js_ext_transaction, "(i)i", NULL },
+    { "js_ext_table_cache", (void *)js_ext_table_cache, "(iiF)i", NULL },
+    { "js_ext_table_filter", (void *)js_ext_table_filter, "(iii)i", NULL },
+    { "js_ext_table_columns", (void *)js_ext_table_columns, "(i*~)i", NULL },
+    { "js_ext_table_column", (void *)js_ext_table_column, "(i*~ii*~)i", NULL },
+    { "js_ext_table_array", (void *)js_ext_table_array, "(i)i", NULL },
+    { "js_ext_table_push", (void *)js_ext_table_push, "(i*~)i", NULL },
+    { "js_ext_table_pop", (void *)js_ext_table_pop, "(i*~)i", NULL },
+    { "js_ext_table_slice", (void *)js_ext_table_slice, "(iii*~)i", NULL },
+    { "js_ext_key_intern", (void *)js_ext_key_intern, "(i*~)i", NULL },
+    { "js_blob_read", (void *)js_blob_read, "(ii*~)i", NULL },
+    { "js_blob_release", (void *)js_blob_release, "(i)", NULL },
+    { "js_interrupt_requested", (void *)js_interrupt_requested, "()i", NULL },
+    { "js_write_output", (void *)js_write_output, "(*~)", NULL },
+};
+
+/* ------------------------------------------------------------------ */
+/* Runtime                                                             */
+/* ------------------------------------------------------------------ */
+
+static bool runtime_ready = false;
+#ifndef CU_HOST_NO_THREADS
+static pthread_once_t runtime_once = PTHREAD_ONCE_INIT;
+#else
+static bool runtime_started = false;
+#endif
+
+static void runtime_init(void) {
+    RuntimeInitArgs args;
+    memset(&args, 0, sizeof(args));
+    args.mem_alloc_type = Alloc_With_System_Allocator;
+    args.native_module_name = "env";
+    args.native_symbols = native_symbols;
+    args.n_native_symbols = sizeof(native_symbols) / sizeof(native_symbols[0]);
+    runtime_ready = wasm_runtime_full_init(&args);
+}
+
+/* WAMR keeps per-thread state for the threads that run wasm */
+static void ensure_thread_env(void) {
+    if (!wasm_runtime_thread_env_inited()) wasm_runtime_init_thread_env();
+}
+
+static void set_error(char *error, size_t error_size, const char *message) {
+    if (error && error_size > 0) snprintf(error, error_size, "%s", message);
+}
+
+cu_module *cu_module_load(const uint8_t *bytes, size_t len, char *error, size_t error_size) {
+#ifndef CU_HOST_NO_THREADS
+    pthread_once(&runtime_once, runtime_init);
+#else
+    if (!runtime_started) {
+        runtime_started = true;
+        runtime_init();
+    }
+#endif
+    if (!runtime_ready) {
+        set_error(error, error_size, "WAMR runtime failed to initialize");
+        return NULL;
+    }
+    if (!bytes || len == 0 || len > UINT32_MAX) {
+        set_error(error, error_size, "No module bytes");
+        return NULL;
+    }
+
+    cu_module *module = calloc(1, sizeof(cu_module));
+    if (module) module->bytes = malloc(len);
+    if (!module || !module->bytes) {
+        free(module);
+        set_error(error, error_size, "Out of memory");
+        return NULL;
+    }
+    memcpy(module->bytes, bytes, len);
+
+    char message[128] = "";
+    module->module = wasm_runtime_load(module->bytes, (uint32_t)len, message, sizeof(message));
+    if (!module->module) {
+        set_error(error, error_size, message);
+        free(module->bytes);
+        free(module);
+        return NULL;
+    }
+
+    int32_t imports = wasm_runtime_get_import_count(module->module);
+    for (int32_t i = 0; i < imports; i++) {
+        wasm_import_t import;
+        wasm_runtime_get_import_type(module->module, i, &import);
+        if (strcmp(import.name, "js_blob_read") == 0) module->host_blobs = true;
+    }
+    return module;
+}
+
+cu_module *cu_module_load_file(const char *path, char *error, size_t error_size) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        set_error(error, error_size, "Cannot open module file");
+        return NULL;
+    }
+    uint8_t *bytes = NULL;
+    long len = -1;
+    if (fseek(file, 0, SEEK_END) == 0) len = ftell(file);
+    if (len > 0 && fseek(file, 0, SEEK_SET) == 0) bytes = malloc((size_t)len);
+    if (bytes && fread(bytes, 1, (size_t)len, file) != (size_t)len) {
+        free(bytes);
+        bytes = NULL;
+    }
+    fclose(file);
+    if (!bytes) {
+        set_error(error, error_size, "Cannot read module file");
+        return NULL;
+    }
+    cu_module *module = cu_module_load(bytes, (size_t)len, error, error_size);
+    free(bytes);
+    return module;
+}
+
+void cu_module_free(cu_module *module) {
+    if (!module) return;
+    wasm_runtime_unload(module->module);
+    free(module->bytes);
+    free(module);
+}
+
+/* ------------------------------------------------------------------ */
+/* Instances                                                           */
+/* ------------------------------------------------------------------ */
+
+/* Call an export; a missing optional export is skipped and reads as 0 */
+static int call_export(cu_instance *instance, const char *name, uint32_t argc, uint32_t *argv) {
+    wasm_function_inst_t func = wasm_runtime_lookup_function(instance->inst, name);
+    if (!func) {
+        argv[0] = 0;
+        return CU_ERR_NOT_FOUND;
+    }
+    ensure_thread_env();
+    if (!wasm_runtime_call_wasm(instance->env, func, argc, argv)) {
+        const char *exception = wasm_runtime_get_exception(instance->inst);
+        snprintf(instance->error, sizeof(instance->error), "%s", exception ? exception : "trap");
+        wasm_runtime_clear_exception(instance->inst);
+        return CU_ERR_TRAP;
+    }
+    return CU_OK;
+}
+
+cu_instance *cu_instance_new(cu_module *module, cu_store *store, const cu_instance_options *options,
+                             char *error, size_t error_size) {
+    if (!module || !store) {
+        set_error(error, error_size, "A module and a store are required");
+        return NULL;
+    }
+    cu_instance *instance = calloc(1, sizeof(cu_instance));
+    if (!instance) {
+        set_error(error, error_size, "Out of memory");
+        return NULL;
+    }
+    uint32_t stack_size = options && options->stack_size ? options->stack_size : DEFAULT_STACK_SIZE;
+
+    ensure_thread_env();
+    char message[128] = "";
+    instance->module = module;
+    instance->inst = wasm_runtime_instantiate(module->module, stack_size, 0, message, sizeof(message));
+    if (!instance->inst) {
+        set_error(error, error_size, message);
+        free(instance);
+        return NULL;
+    }
+    instance->env = wasm_runtime_create_exec_env(instance->inst, stack_size);
+    if (!instance->env) {
+        set_error(error, error_size, "Cannot create execution environment");
+        wasm_runtime_deinstantiate(instance->inst);
+        free(instance);
+        return NULL;
+    }
+    wasm_runtime_set_user_data(instance->env, instance);
+
+    cu_bridge_init(&instance->bridge, store);
+    instance->bridge.host_blobs = module->host_blobs;
+    if (options) {
+        instance->bridge.output = options->output;
+        instance->bridge.interrupt = options->interrupt;
+        instance->bridge.user = options->user;
+    }
+
+    instance->compute = wasm_runtime_lookup_function(instance->inst, "compute");
+    /* Older builds take only the length; the code is always in the buffer */
+    instance->compute_params = instance->compute ? wasm_func_get_param_count(instance->compute, instance->inst) : 0;
+    return instance;
+}
+
+void cu_instance_free(cu_instance *instance) {
+    if (!instance) return;
+    cu_bridge_release(&instance->bridge);
+    wasm_runtime_destroy_exec_env(instance->env);
+    wasm_runtime_deinstantiate(instance->inst);
+    free(instance);
+}
+
+int cu_instance_init(cu_instance *instance) {
+    if (!instance || !instance->compute) return CU_ERR;
+    uint32_t argv[2] = { 0 };
+    int status = call_export(instance, "init", 0, argv);
+    if (status != CU_OK) return status;
+    if ((int32_t)argv[0] != 0) return CU_ERR;
+
+    cu_store *store = instance->bridge.store;
+    uint32_t home = cu_store_home_table(store);
+    if ((status = call_export(instance, "get_memory_table_id", 0, argv)) == CU_ERR_TRAP) return status;
+    uint32_t exported = argv[0];
+    if (home && home != exported) {
+        argv[0] = home;
+        if ((status = call_export(instance, "attach_memory_table", 1, argv)) == CU_ERR_TRAP) return status;
+    } else if (exported) {
+        cu_store_set_home_table(store, exported);
+    }
+
+    cu_store_lock(store);
+    argv[0] = store->next_table_id;
+    cu_store_unlock(store);
+    if ((status = call_export(instance, "sync_external_table_counter", 1, argv)) == CU_ERR_TRAP) return status;
+
+    argv[0] = instance->bridge.interrupt ? 1 : 0;
+    if ((status = call_export(instance, "set_interrupt_polling", 1, argv)) == CU_ERR_TRAP) return status;
+    argv[0] = instance->bridge.output ? OUTPUT_CHUNK_BYTES : 0;
+    if ((status = call_export(instance, "set_output_streaming", 1, argv)) == CU_ERR_TRAP) return status;
+
+    if ((status = call_export(instance, "get_buffer_ptr", 0, argv)) != CU_OK) return status;
+    instance->buffer_ptr = argv[0];
+    if ((status = call_export(instance, "get_buffer_size", 0, argv)) != CU_OK) return status;
+    instance->buffer_size = argv[0];
+    return CU_OK;
+}
+
+int cu_instance_compute(cu_instance *instance, const char *code, size_t len, cu_result *result) {
+    if (!instance || !result || (!code && len) || !instance->buffer_ptr) return CU_ERR;
+    result->data = NULL;
+    result->len = 0;
+    if (len > instance->buffer_size) return CU_ERR_TOO_LARGE;
+
+    /* Linear memory can move when it grows, so resolve it per call */
+    uint8_t *buffer = wasm_runtime_addr_app_to_native(instance->inst, instance->buffer_ptr);
+    if (!buffer) return CU_ERR;
+    memcpy(buffer, code, len);
+
+    uint32_t argv[2];
+    uint32_t argc = instance->compute_params == 2 ? 2 : 1;
+    if (argc == 2) {
+        argv[0] = instance->buffer_ptr;
+        argv[1] = (uint32_t)len;
+    } else {
+        argv[0] = (uint32_t)len;
+    }
+    ensure_thread_env();
+    if (!wasm_runtime_call_wasm(instance->env, instance->compute, argc, argv)) {
+        const char *exception = wasm_runtime_get_exception(instance->inst);
+        snprintf(instance->error, sizeof(instance->error), "%s", exception ? exception : "trap");
+        wasm_runtime_clear_exception(instance->inst);
+        return CU_ERR_TRAP;
+    }
+
+    int32_t written = (int32_t)argv[0];
+    buffer = wasm_runtime_addr_app_to_native(instance->inst, instance->buffer_ptr);
+    size_t size = written < 0 ? (size_t)-(int64_t)written : (size_t)written;
+    if (size > instance->buffer_size) size = instance->buffer_size;
+    result->data = buffer;
+    result->len = size;
+    return written < 0 ? CU_ERR_LUA : CU_OK;
+}
+
+const char *cu_instance_error(cu_instance *instance) {
+    return instance ? instance->error : "";
+}
@@ -0,0 +1,213 @@
+/*
+ * Store and import-protocol tests; need no runtime (make check)
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/cu_internal.h"
+
+#define KEY(s) (const uint8_t *)(s), (uint32_t)strlen(s)
+
+static uint32_t u32_at(const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void put_u32(uint8_t *p, uint32_t value) {
+    for (int i = 0; i < 4; i++) p[i] = (uint8_t)(value >> (8 * i));
+}
+
+static void test_set_get_delete(void) {
+    cu_store *store = cu_store_new();
+    char key[32];
+    char value[64];
+    for (int i = 0; i < 20000; i++) {
+        int n = snprintf(key, sizeof(key), "key%d", i);
+        int m = snprintf(value, sizeof(value), "value-%d", i * 7);
+        assert(cu_store_set(store, 1, key, (size_t)n, value, (size_t)m) == CU_OK);
+    }
+    assert(cu_store_size(store, 1) == 20000);
+
+    char out[64];
+    size_t len;
+    assert(cu_store_get(store, 1, "key123", 6, out, sizeof(out), &len) == CU_OK);
+    assert(len == 9 && memcmp(out, "value-861", 9) == 0);
+    assert(cu_store_get(store, 1, "key123", 6, out, 4, &len) == CU_ERR_TOO_LARGE && len == 9);
+    assert(cu_store_get(store, 1, "nope", 4, out, sizeof(out), &len) == CU_ERR_NOT_FOUND);
+    assert(cu_store_get(store, 2, "key1", 4, out, sizeof(out), &len) == CU_ERR_NOT_FOUND);
+
+    /* Deleting every other key keeps the rest reachable */
+    for (int i = 0; i < 20000; i += 2) {
+        int n = snprintf(key, sizeof(key), "key%d", i);
+        assert(cu_store_delete(store, 1, key, (size_t)n) == CU_OK);
+    }
+    assert(cu_store_size(store, 1) == 10000);
+    for (int i = 0; i < 20000; i++) {
+        int n = snprintf(key, sizeof(key), "key%d", i);
+        int status = cu_store_get(store, 1, key, (size_t)n, out, sizeof(out), &len);
+        assert(status == (i % 2 ? CU_OK : CU_ERR_NOT_FOUND));
+    }
+
+    /* Overwrites reuse the value's block */
+    size_t bytes = cu_store_bytes(store);
+    for (int round = 0; round < 10; round++) {
+        assert(cu_store_set(store, 1, "key1", 4, "same size", 9) == CU_OK);
+    }
+    assert(cu_store_bytes(store) == bytes);
+    cu_store_free(store);
+}
+
+static void test_bridge_get_and_keys(void) {
+    cu_store *store = cu_store_new();
+    cu_bridge bridge;
+    cu_bridge_init(&bridge, store);
+    uint8_t out[64];
+
+    assert(cu_bridge_get(&bridge, 5, KEY("a"), out, sizeof(out)) == -1);
+    assert(cu_bridge_set(&bridge, 5, KEY("a"), (const uint8_t *)"0123456789", 10) == 0);
+    assert(cu_bridge_set(&bridge, 5, KEY("b"), (const uint8_t *)"x", 1) == 0);
+    assert(cu_bridge_get(&bridge, 5, KEY("a"), out, sizeof(out)) == 10);
+    assert(cu_bridge_get(&bridge, 5, KEY("a"), out, 4) == -12);
+    assert(cu_bridge_size(&bridge, 5) == 2);
+
+    int32_t len = cu_bridge_keys(&bridge, 5, out, sizeof(out));
+    assert(len == 3 && memcmp(out, "a\nb", 3) == 0);
+    assert(cu_bridge_keys(&bridge, 5, out, 2) == -1);
+
+    assert(cu_bridge_delete(&bridge, 5, KEY("a")) == 0);
+    assert(cu_bridge_delete(&bridge, 6, KEY("a")) == -1);
+    assert(cu_bridge_size(&bridge, 5) == 1);
+    cu_bridge_release(&bridge);
+    cu_store_free(store);
+}
+
+static void test_scan_survives_writes(void) {
+    cu_store *store = cu_store_new();
+    cu_bridge bridge;
+    cu_bridge_init(&bridge, store);
+    char key[16];
+    for (int i = 0; i < 100; i++) {
+        int n = snprintf(key, sizeof(key), "%d", i);
+        cu_bridge_set(&bridge, 1, (const uint8_t *)key, (uint32_t)n, (const uint8_t *)"v", 1);
+    }
+
+    uint8_t batch[128];
+    int seen[100] = { 0 };
+    uint32_t cursor = 0;
+    int batches = 0;
+    do {
+        int32_t len = cu_bridge_next(&bridge, 1, cursor, batch, sizeof(batch));
+        assert(len >= 8);
+        cursor = u32_at(batch);
+        uint32_t count = u32_at(batch + 4);
+        uint32_t offset = 8;
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t key_len = u32_at(batch + offset);
+            char text[16] = { 0 };
+            memcpy(text, batch + offset + 4, key_len);
+            if (text[0] != 'n') seen[atoi(text)]++;
+            offset += 4 + key_len;
+            offset += 4 + u32_at(batch + offset);
+        }
+        /* Deletes in the middle of a scan force a compaction */
+        if (batches++ == 1) {
+            for (int i = 30; i < 100; i++) {
+                int n = snprintf(key, sizeof(key), "%d", i);
+                cu_bridge_delete(&bridge, 1, (const uint8_t *)key, (uint32_t)n);
+            }
+            for (int i = 0; i < 40; i++) {
+                int n = snprintf(key, sizeof(key), "new%d", i);
+                cu_bridge_set(&bridge, 1, (const uint8_t *)key, (uint32_t)n, (const uint8_t *)"v", 1);
+            }
+        }
+    } while (cursor != 0);
+
+    for (int i = 0; i < 30; i++) assert(seen[i] == 1);
+    assert(batches > 2);
+    cu_bridge_release(&bridge);
+    cu_store_free(store);
+}
+
+static void test_batches(void) {
+    cu_store *store = cu_store_new();
+    cu_bridge bridge;
+    cu_bridge_init(&bridge, store);
+
+    uint8_t frames[64];
+    uint32_t offset = 0;
+    const char *pairs[][2] = { { "x", "11" }, { "y", "222" } };
+    for (int i = 0; i < 2; i++) {
+        uint32_t key_len = (uint32_t)strlen(pairs[i][0]);
+        uint32_t value_len = (uint32_t)strlen(pairs[i][1]);
+        put_u32(frames + offset, key_len);
+        memcpy(frames + offset + 4, pairs[i][0], key_len);
+        put_u32(frames + offset + 4 + key_len, value_len);
+        memcpy(frames + offset + 8 + key_len, pairs[i][1], value_len);
+        offset += 8 + key_len + value_len;
+    }
+    assert(cu_bridge_set_many(&bridge, 3, frames, offset) == 0);
+    assert(cu_bridge_set_many(&bridge, 3, frames, offset - 1) == -1);
+
+    uint8_t keys[32];
+    put_u32(keys, 1);
+    keys[4] = 'y';
+    put_u32(keys + 5, 1);
+    keys[9] = 'z';
+    uint8_t out[64];
+    int32_t len = cu_bridge_get_many(&bridge, 3, keys, 10, out, sizeof(out));
+    assert(len == 4 + 4 + 3 + 4);
+    assert(u32_at(out) == 2 && u32_at(out + 4) == 3 && memcmp(out + 8, "222", 3) == 0);
+    assert((int32_t)u32_at(out + 11) == -1);
+    cu_bridge_release(&bridge);
+    cu_store_free(store);
+}
+
+static void test_blob_handles(void) {
+    cu_store *store = cu_store_new();
+    cu_bridge bridge;
+    cu_bridge_init(&bridge, store);
+    bridge.host_blobs = true;
+
+    uint8_t blob[CU_BLOB_HEADER + 100];
+    blob[0] = CU_TAG_BLOB;
+    put_u32(blob + 1, 100);
+    for (int i = 0; i < 100; i++) blob[CU_BLOB_HEADER + i] = (uint8_t)i;
+    assert(cu_bridge_set(&bridge, 1, KEY("blob"), blob, sizeof(blob)) == 0);
+
+    /* Lua gets a handle, and reads through it */
+    uint8_t stub[16];
+    assert(cu_bridge_get(&bridge, 1, KEY("blob"), stub, sizeof(stub)) == CU_BLOB_STUB);
+    assert(stub[0] == CU_TAG_BLOB_HANDLE && u32_at(stub + 5) == 100);
+    uint32_t handle = u32_at(stub + 1);
+    uint8_t part[10];
+    assert(cu_bridge_blob_read(&bridge, handle, 90, part, 10) == 10 && part[9] == 99);
+    assert(cu_bridge_blob_read(&bridge, handle, 95, part, 10) == -1);
+
+    /* Storing the handle shares the bytes; the handle outlives a delete */
+    assert(cu_bridge_set(&bridge, 1, KEY("copy"), stub, CU_BLOB_STUB) == 0);
+    assert(cu_bridge_delete(&bridge, 1, KEY("blob")) == 0);
+    assert(cu_bridge_blob_read(&bridge, handle, 0, part, 10) == 10 && part[3] == 3);
+    size_t len;
+    uint8_t copy[sizeof(blob)];
+    assert(cu_store_get(store, 1, "copy", 4, copy, sizeof(copy), &len) == CU_OK);
+    assert(len == sizeof(blob) && memcmp(copy, blob, len) == 0);
+
+    cu_bridge_blob_release(&bridge, handle);
+    assert(cu_bridge_blob_read(&bridge, handle, 0, part, 10) == -1);
+    assert(cu_bridge_get(&bridge, 1, KEY("copy"), stub, sizeof(stub)) == CU_BLOB_STUB);
+    assert(u32_at(stub + 1) == handle); /* released handles are reused */
+    cu_bridge_release(&bridge);
+    cu_store_free(store);
+}
+
+int main(void) {
+    test_set_get_delete();
+    test_bridge_get_and_keys();
+    test_scan_survives_writes();
+    test_batches();
+    test_blob_handles();
+    printf("libcu-host store tests passed\n");
+    return 0;
+}
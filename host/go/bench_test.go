@@ -0,0 +1,106 @@
+package cu
+
+import (
+	"context"
+	"fmt"
+	"testing"
+)
+
+// Benchmarks of the workloads scripts/bench-hosts.js runs through the JS
+// host, so the two can be compared:
+//
+//	go test -bench . -benchmem
+//	node scripts/bench-hosts.js
+
+var payloadSizes = []int{1024, 16*1024 - 5}
+
+func BenchmarkUnitStartup(b *testing.B) {
+	module := loadTestModule(b)
+	store := NewStore()
+	ctx := context.Background()
+	b.ReportAllocs()
+	for i := 0; i < b.N; i++ {
+		u, err := NewUnit(ctx, module, store, nil)
+		if err != nil {
+			b.Fatal(err)
+		}
+		if err := u.Init(ctx); err != nil {
+			b.Fatal(err)
+		}
+		u.Close(ctx)
+	}
+}
+
+func BenchmarkCompute(b *testing.B) {
+	u := newTestUnit(b, loadTestModule(b), NewStore())
+	ctx := context.Background()
+	b.ReportAllocs()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		if _, err := u.Compute(ctx, "return 1 + 1"); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
+
+func BenchmarkHomeSet(b *testing.B) {
+	module := loadTestModule(b)
+	for _, size := range payloadSizes {
+		b.Run(fmt.Sprintf("%dB", size), func(b *testing.B) {
+			u := newTestUnit(b, module, NewStore())
+			ctx := context.Background()
+			if _, err := u.Compute(ctx, fmt.Sprintf("payload = string.rep('x', %d)", size)); err != nil {
+				b.Fatal(err)
+			}
+			b.SetBytes(int64(size))
+			b.ReportAllocs()
+			b.ResetTimer()
+			for i := 0; i < b.N; i++ {
+				if _, err := u.Compute(ctx, "_home.blob = payload"); err != nil {
+					b.Fatal(err)
+				}
+			}
+		})
+	}
+}
+
+func BenchmarkHomeGet(b *testing.B) {
+	module := loadTestModule(b)
+	for _, size := range payloadSizes {
+		b.Run(fmt.Sprintf("%dB", size), func(b *testing.B) {
+			u := newTestUnit(b, module, NewStore())
+			ctx := context.Background()
+			if _, err := u.Compute(ctx, fmt.Sprintf("_home.blob = string.rep('x', %d)", size)); err != nil {
+				b.Fatal(err)
+			}
+			b.SetBytes(int64(size))
+			b.ReportAllocs()
+			b.ResetTimer()
+			for i := 0; i < b.N; i++ {
+				if _, err := u.Compute(ctx, "return #_home.blob"); err != nil {
+					b.Fatal(err)
+				}
+			}
+		})
+	}
+}
+
+// Computes from every GOMAXPROCS goroutine at once; the JS host has no
+// counterpart on one thread
+func BenchmarkPoolParallel(b *testing.B) {
+	pool := NewPool(loadTestModule(b), NewStore(), nil)
+	ctx := context.Background()
+	compute := func(u *Unit) error {
+		_, err := u.Compute(ctx, "return 1 + 1")
+		return err
+	}
+	b.ReportAllocs()
+	b.RunParallel(func(pb *testing.PB) {
+		for pb.Next() {
+			if err := pool.Do(ctx, compute); err != nil {
+				b.Error(err)
+				return
+			}
+		}
+	})
+}
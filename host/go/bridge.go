@@ -0,0 +1,341 @@
+package cu
+
+import (
+	"encoding/binary"
+	"math"
+)
+
+// The env imports cu.wasm calls for external tables, written against
+// slices so they can be tested without a runtime. Formats and return codes
+// are those of the browser host (web/cu-instance.js) and libcu-host:
+//
+//	get       value length; -1 missing; -2 - length if it does not fit
+//	keys      keys joined by '\n'; -1 if they do not fit
+//	next      u32 next_cursor (0 = done), u32 count, then per entry
+//	          u32 key_len, key, u32 value_len, value
+//	set_many  frames of u32 key_len, key, u32 value_len, value
+//	get_many  keys as frames of u32 key_len, key; answered as u32 count,
+//	          then per key i32 value_len (-1 missing) and the value
+//
+// The binding passes views of linear memory from Memory().Read, so each
+// value is copied once, between the store and linear memory. A blob (tag
+// 0xe0) goes to Lua as a 9-byte handle (0xe1, u32 handle, u32 length) when
+// the module can read blobs in place; the handle pins the stored bytes
+// until Lua releases it.
+
+// Value tags (web/cu-values.js) the host looks at
+const (
+	tagBlob       = 0xe0
+	tagBlobHandle = 0xe1
+	blobHeader    = 5
+	blobStub      = 9
+	scanHeader    = 8
+)
+
+var le = binary.LittleEndian
+
+// bridge is one unit's side of the env imports
+type bridge struct {
+	store     *Store
+	hostBlobs bool     // the module imports js_blob_read
+	blobs     []*value // handle - 1 -> pinned value
+	blobFree  []uint32 // released handles
+	scratch   []byte   // set_parts joins its halves here
+	stub      [blobStub]byte
+
+	// Table IDs this unit's VM creates tables from (Store.reserveTableIDs)
+	tableIDEnd uint32
+	refill     bool
+}
+
+func (b *bridge) release() {
+	b.store.mu.Lock()
+	for _, v := range b.blobs {
+		if v != nil {
+			v.refs--
+		}
+	}
+	b.store.mu.Unlock()
+	b.blobs, b.blobFree = nil, nil
+}
+
+func (b *bridge) isBlob(v *value) bool {
+	return b.hostBlobs && len(v.bytes) >= blobHeader && v.bytes[0] == tagBlob
+}
+
+// outgoingLen is the length Lua receives for v, before a blob is pinned
+// for a caller that may have to retry
+func (b *bridge) outgoingLen(v *value) int {
+	if b.isBlob(v) {
+		return blobStub
+	}
+	return len(v.bytes)
+}
+
+// outgoing returns the bytes to send Lua for v: the value, or a handle
+// stub valid until the next call
+func (b *bridge) outgoing(v *value) []byte {
+	if !b.isBlob(v) {
+		return v.bytes
+	}
+	var handle uint32
+	if n := len(b.blobFree); n > 0 {
+		handle = b.blobFree[n-1]
+		b.blobFree = b.blobFree[:n-1]
+		b.blobs[handle-1] = v
+	} else {
+		b.blobs = append(b.blobs, v)
+		handle = uint32(len(b.blobs))
+	}
+	v.refs++
+	b.stub[0] = tagBlobHandle
+	le.PutUint32(b.stub[1:], handle)
+	le.PutUint32(b.stub[5:], uint32(len(v.bytes)-blobHeader))
+	return b.stub[:]
+}
+
+func (b *bridge) blob(handle uint32) *value {
+	if handle == 0 || int(handle) > len(b.blobs) {
+		return nil
+	}
+	return b.blobs[handle-1]
+}
+
+// incoming stores bytes written by Lua; a handle stands for the blob it
+// names
+func (b *bridge) incoming(t *table, key, bytes []byte) {
+	if len(bytes) == blobStub && bytes[0] == tagBlobHandle {
+		if v := b.blob(le.Uint32(bytes[1:])); v != nil {
+			b.store.putValue(t, key, v)
+			return
+		}
+	}
+	b.store.put(t, key, bytes)
+}
+
+// created notes a table the VM made, to reserve more IDs before the
+// unit's block runs out
+func (b *bridge) created(t *table) {
+	if t.live == 0 && t.id < b.tableIDEnd && t.id >= b.tableIDEnd-tableIDBlock/4 {
+		b.refill = true
+	}
+}
+
+func (b *bridge) set(tableID uint32, key, bytes []byte) int32 {
+	b.store.mu.Lock()
+	defer b.store.mu.Unlock()
+	t := b.store.table(tableID, true)
+	b.created(t)
+	b.incoming(t, key, bytes)
+	return 0
+}
+
+func (b *bridge) setParts(tableID uint32, key, head, body []byte) int32 {
+	b.scratch = append(append(b.scratch[:0], head...), body...)
+	return b.set(tableID, key, b.scratch)
+}
+
+func (b *bridge) get(tableID uint32, key, out []byte) int32 {
+	b.store.mu.Lock()
+	defer b.store.mu.Unlock()
+	t := b.store.tables[tableID]
+	if t == nil {
+		return -1
+	}
+	i, ok := t.index[string(key)]
+	if !ok {
+		return -1
+	}
+	v := t.entries[i].value
+	if needed := b.outgoingLen(v); needed > len(out) {
+		if needed > math.MaxInt32-2 {
+			return math.MinInt32
+		}
+		return int32(-2 - needed)
+	}
+	return int32(copy(out, b.outgoing(v)))
+}
+
+func (b *bridge) delete(tableID uint32, key []byte) int32 {
+	b.store.mu.Lock()
+	defer b.store.mu.Unlock()
+	t := b.store.tables[tableID]
+	if t == nil {
+		return -1
+	}
+	b.store.remove(t, key)
+	return 0
+}
+
+func (b *bridge) size(tableID uint32) uint32 {
+	return uint32(b.store.Size(tableID))
+}
+
+func (b *bridge) keys(tableID uint32, out []byte) int32 {
+	b.store.mu.Lock()
+	defer b.store.mu.Unlock()
+	t := b.store.tables[tableID]
+	if t == nil {
+		return -1
+	}
+	n := 0
+	for _, e := range t.entries {
+		if e == nil {
+			continue
+		}
+		if n > 0 {
+			if n+1+len(e.key) > len(out) {
+				return -1
+			}
+			out[n] = '\n'
+			n++
+		} else if len(e.key) > len(out) {
+			return -1
+		}
+		n += copy(out[n:], e.key)
+	}
+	return int32(n)
+}
+
+func (b *bridge) next(tableID, cursor uint32, out []byte) int32 {
+	if len(out) < scanHeader {
+		return -1
+	}
+	s := b.store
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	t := s.tables[tableID]
+	if t == nil {
+		return -1
+	}
+	if cursor == 0 {
+		cursor = s.openScan(t)
+	}
+	sc := s.findScan(cursor)
+	if sc == nil || sc.tableID != tableID {
+		return -1
+	}
+
+	n := scanHeader
+	count := uint32(0)
+	for sc.pos < len(t.entries) {
+		e := t.entries[sc.pos]
+		if e == nil {
+			sc.pos++ // deleted since the scan started
+			continue
+		}
+		if n+8+len(e.key)+b.outgoingLen(e.value) > len(out) {
+			if count > 0 {
+				break
+			}
+			sc.pos++ // larger than one batch
+			continue
+		}
+		bytes := b.outgoing(e.value)
+		le.PutUint32(out[n:], uint32(len(e.key)))
+		n += 4 + copy(out[n+4:], e.key)
+		le.PutUint32(out[n:], uint32(len(bytes)))
+		n += 4 + copy(out[n+4:], bytes)
+		sc.pos++
+		count++
+	}
+
+	done := sc.pos >= len(t.entries)
+	if done {
+		le.PutUint32(out, 0)
+		*sc = scan{}
+	} else {
+		le.PutUint32(out, cursor)
+	}
+	le.PutUint32(out[4:], count)
+	return int32(n)
+}
+
+func (b *bridge) setMany(tableID uint32, frames []byte) int32 {
+	b.store.mu.Lock()
+	defer b.store.mu.Unlock()
+	t := b.store.table(tableID, true)
+	b.created(t)
+	for len(frames) >= 8 {
+		keyLen := uint64(le.Uint32(frames))
+		if 8+keyLen > uint64(len(frames)) {
+			break
+		}
+		key := frames[4 : 4+keyLen]
+		valueLen := uint64(le.Uint32(frames[4+keyLen:]))
+		if 8+keyLen+valueLen > uint64(len(frames)) {
+			break
+		}
+		b.incoming(t, key, frames[8+keyLen:8+keyLen+valueLen])
+		frames = frames[8+keyLen+valueLen:]
+	}
+	if len(frames) != 0 {
+		return -1
+	}
+	return 0
+}
+
+func (b *bridge) getMany(tableID uint32, keys, out []byte) int32 {
+	if len(out) < 8 {
+		return -1
+	}
+	b.store.mu.Lock()
+	defer b.store.mu.Unlock()
+	t := b.store.tables[tableID]
+	if t == nil {
+		return -1
+	}
+	n := 4
+	answered := uint32(0)
+	for len(keys) >= 4 {
+		keyLen := uint64(le.Uint32(keys))
+		if 4+keyLen > uint64(len(keys)) {
+			break
+		}
+		var v *value
+		if i, ok := t.index[string(keys[4:4+keyLen])]; ok {
+			v = t.entries[i].value
+		}
+		if v != nil && n+4+b.outgoingLen(v) > len(out) {
+			if answered > 0 {
+				break
+			}
+			v = nil // too large for one answer; report it missing
+		}
+		if v == nil {
+			if n+4 > len(out) {
+				break
+			}
+			le.PutUint32(out[n:], math.MaxUint32)
+			n += 4
+		} else {
+			bytes := b.outgoing(v)
+			le.PutUint32(out[n:], uint32(len(bytes)))
+			n += 4 + copy(out[n+4:], bytes)
+		}
+		keys = keys[4+keyLen:]
+		answered++
+	}
+	le.PutUint32(out, answered)
+	return int32(n)
+}
+
+func (b *bridge) blobRead(handle, offset uint32, out []byte) int32 {
+	b.store.mu.Lock()
+	defer b.store.mu.Unlock()
+	v := b.blob(handle)
+	if v == nil || uint64(offset)+uint64(len(out)) > uint64(len(v.bytes)-blobHeader) {
+		return -1
+	}
+	return int32(copy(out, v.bytes[blobHeader+int(offset):]))
+}
+
+func (b *bridge) blobRelease(handle uint32) {
+	b.store.mu.Lock()
+	defer b.store.mu.Unlock()
+	if v := b.blob(handle); v != nil {
+		v.refs--
+		b.blobs[handle-1] = nil
+		b.blobFree = append(b.blobFree, handle)
+	}
+}
@@ -0,0 +1,567 @@
+// Package cu runs cu.wasm from Go with wazero: the host side of cu's
+// external tables and I/O, without a JS engine. It does what
+// web/cu-instance.js does in the browser and libcu-host does in C.
+//
+//   - Store: external tables, shared by any number of units and safe for
+//     concurrent use.
+//   - Module: cu.wasm compiled once, through a compilation cache shared by
+//     every Module in the process (or kept on disk with CacheDir).
+//   - Unit: an instance of a Module with a Lua VM, its env imports bound
+//     to a Store. A unit is used by one goroutine at a time.
+//   - Pool: units of one Module over one Store in a sync.Pool, so any
+//     number of goroutines can compute at once.
+//
+// Imports read and write linear memory through the views Memory().Read
+// returns, and a compute's result is a view of linear memory, so nothing
+// is copied out.
+//
+// Usage:
+//
+//	module, err := cu.LoadModuleFile(ctx, "cu.wasm", nil)
+//	pool := cu.NewPool(module, cu.NewStore(), nil)
+//	result, err := pool.Compute(ctx, "return 1 + 1")
+package cu
+
+import (
+	"context"
+	"errors"
+	"fmt"
+	"os"
+	"runtime"
+	"sync"
+	"time"
+
+	"github.com/tetratelabs/wazero"
+	"github.com/tetratelabs/wazero/api"
+)
+
+const outputChunkBytes = 4096
+
+var (
+	// ErrTooLarge is returned for code that does not fit the I/O buffer.
+	ErrTooLarge = errors.New("cu: code does not fit the I/O buffer")
+	// ErrClosed is returned by a unit that was closed, or discarded after
+	// a trap.
+	ErrClosed = errors.New("cu: unit is closed")
+)
+
+// LuaError is an error raised by Lua during a compute.
+type LuaError struct {
+	Message string
+}
+
+func (e *LuaError) Error() string { return "cu: " + e.Message }
+
+var (
+	sharedCacheOnce sync.Once
+	sharedCache     wazero.CompilationCache
+)
+
+// ModuleOptions configure LoadModule. The zero value is the default.
+type ModuleOptions struct {
+	// CacheDir keeps compiled code on disk, so a restarted process skips
+	// compiling cu.wasm. Empty uses an in-memory cache shared by every
+	// Module in the process.
+	CacheDir string
+}
+
+// Module is cu.wasm compiled for a wazero runtime of its own.
+type Module struct {
+	runtime       wazero.Runtime
+	compiled      wazero.CompiledModule
+	cache         wazero.CompilationCache // owned, for CacheDir
+	hostBlobs     bool
+	computeParams int
+
+	// Caller module to its unit, for the imports
+	instances sync.Map
+}
+
+// LoadModule compiles cu.wasm. Compiled code is cached, so loading the
+// same bytes again is cheap.
+func LoadModule(ctx context.Context, wasm []byte, options *ModuleOptions) (*Module, error) {
+	m := &Module{}
+	var cache wazero.CompilationCache
+	if options != nil && options.CacheDir != "" {
+		var err error
+		if cache, err = wazero.NewCompilationCacheWithDir(options.CacheDir); err != nil {
+			return nil, fmt.Errorf("cu: compilation cache: %w", err)
+		}
+		m.cache = cache
+	} else {
+		sharedCacheOnce.Do(func() { sharedCache = wazero.NewCompilationCache() })
+		cache = sharedCache
+	}
+
+	m.runtime = wazero.NewRuntimeWithConfig(ctx, wazero.NewRuntimeConfig().WithCompilationCache(cache))
+	if err := m.instantiateImports(ctx); err != nil {
+		m.Close(ctx)
+		return nil, fmt.Errorf("cu: host imports: %w", err)
+	}
+	compiled, err := m.runtime.CompileModule(ctx, wasm)
+	if err != nil {
+		m.Close(ctx)
+		return nil, fmt.Errorf("cu: compile: %w", err)
+	}
+	m.compiled = compiled
+
+	for _, def := range compiled.ImportedFunctions() {
+		if _, name, _ := def.Import(); name == "js_blob_read" {
+			m.hostBlobs = true
+		}
+	}
+	compute, ok := compiled.ExportedFunctions()["compute"]
+	if !ok {
+		m.Close(ctx)
+		return nil, errors.New("cu: module does not export compute")
+	}
+	// Older builds take only the length; the code is always in the buffer
+	m.computeParams = len(compute.ParamTypes())
+	return m, nil
+}
+
+// LoadModuleFile reads and compiles cu.wasm from path.
+func LoadModuleFile(ctx context.Context, path string, options *ModuleOptions) (*Module, error) {
+	wasm, err := os.ReadFile(path)
+	if err != nil {
+		return nil, fmt.Errorf("cu: %w", err)
+	}
+	return LoadModule(ctx, wasm, options)
+}
+
+// Close releases the module and every unit instantiated from it.
+func (m *Module) Close(ctx context.Context) error {
+	err := m.runtime.Close(ctx)
+	if m.cache != nil {
+		m.cache.Close(ctx)
+	}
+	return err
+}
+
+// instance is a unit's state. The imports reach it through
+// Module.instances, which must not keep the Unit handle alive: a Unit a
+// Pool drops is closed by its finalizer.
+type instance struct {
+	module     *Module
+	mod        api.Module
+	compute    api.Function
+	bridge     bridge
+	bufferPtr  uint32
+	bufferSize uint32
+	output     func(text []byte)
+	interrupt  func() bool
+	stack      [2]uint64
+	broken     bool
+	closed     bool
+}
+
+// UnitOptions configure NewUnit. The zero value is the default.
+type UnitOptions struct {
+	// Output receives print() output as it is written; text is valid
+	// during the call only. nil keeps output in the result.
+	Output func(text []byte)
+	// Interrupt is polled during long computes; true interrupts the
+	// compute. The compute's context is always polled.
+	Interrupt func() bool
+}
+
+// Unit is an instance of cu.wasm with its env imports bound to a store.
+// A unit is used by one goroutine at a time.
+type Unit struct {
+	inst *instance
+}
+
+// NewUnit instantiates module over store. Several units may share one
+// store. Call Init before Compute.
+func NewUnit(ctx context.Context, module *Module, store *Store, options *UnitOptions) (*Unit, error) {
+	in := &instance{module: module}
+	in.bridge.store = store
+	in.bridge.hostBlobs = module.hostBlobs
+	if options != nil {
+		in.output = options.Output
+		in.interrupt = options.Interrupt
+	}
+	// Anonymous, so a runtime holds any number of them; no start
+	// function runs, as in the browser host
+	config := wazero.NewModuleConfig().WithName("").WithStartFunctions()
+	mod, err := module.runtime.InstantiateModule(ctx, module.compiled, config)
+	if err != nil {
+		return nil, fmt.Errorf("cu: instantiate: %w", err)
+	}
+	in.mod = mod
+	in.compute = mod.ExportedFunction("compute")
+	module.instances.Store(mod, in)
+
+	u := &Unit{inst: in}
+	runtime.SetFinalizer(u, func(u *Unit) { u.inst.close(context.Background()) })
+	return u, nil
+}
+
+// call runs an optional export; a missing one reads as 0
+func (in *instance) call(ctx context.Context, name string, args ...uint64) (uint64, error) {
+	fn := in.mod.ExportedFunction(name)
+	if fn == nil {
+		return 0, nil
+	}
+	results, err := fn.Call(ctx, args...)
+	if err != nil {
+		in.broken = true
+		return 0, fmt.Errorf("cu: %s trapped: %w", name, err)
+	}
+	if len(results) == 0 {
+		return 0, nil
+	}
+	return results[0], nil
+}
+
+// Init creates the Lua VM and binds _home (see Store.HomeTable).
+func (u *Unit) Init(ctx context.Context) error {
+	in := u.inst
+	if in.closed || in.broken {
+		return ErrClosed
+	}
+	if in.mod.ExportedFunction("init") == nil {
+		return errors.New("cu: module does not export init")
+	}
+	// The VM creates _home and _io from its counter during init, so the
+	// unit's block of table IDs is reserved first
+	if err := in.reserveTableIDs(ctx); err != nil {
+		return err
+	}
+	status, err := in.call(ctx, "init")
+	if err != nil {
+		return err
+	}
+	if api.DecodeI32(status) != 0 {
+		return fmt.Errorf("cu: init returned %d", api.DecodeI32(status))
+	}
+
+	exported, err := in.call(ctx, "get_memory_table_id")
+	if err != nil {
+		return err
+	}
+	if home := in.bridge.store.bindHome(uint32(exported)); home != 0 && home != uint32(exported) {
+		if _, err := in.call(ctx, "attach_memory_table", api.EncodeU32(home)); err != nil {
+			return err
+		}
+	}
+	if _, err := in.call(ctx, "set_interrupt_polling", 1); err != nil {
+		return err
+	}
+	chunk := uint64(0)
+	if in.output != nil {
+		chunk = outputChunkBytes
+	}
+	if _, err := in.call(ctx, "set_output_streaming", chunk); err != nil {
+		return err
+	}
+
+	ptr, err := in.call(ctx, "get_buffer_ptr")
+	if err != nil {
+		return err
+	}
+	size, err := in.call(ctx, "get_buffer_size")
+	if err != nil {
+		return err
+	}
+	in.bufferPtr, in.bufferSize = uint32(ptr), uint32(size)
+	if in.bufferPtr == 0 || in.compute == nil {
+		return errors.New("cu: module has no I/O buffer or compute export")
+	}
+	return nil
+}
+
+// reserveTableIDs moves the VM's table counter to a fresh block of IDs,
+// so units sharing the store never create the same table
+func (in *instance) reserveTableIDs(ctx context.Context) error {
+	base := in.bridge.store.reserveTableIDs(tableIDBlock)
+	in.bridge.tableIDEnd = base + tableIDBlock
+	in.bridge.refill = false
+	_, err := in.call(ctx, "sync_external_table_counter", api.EncodeU32(base))
+	return err
+}
+
+// Compute runs Lua source or a binary chunk and returns the serialized
+// return value. The slice is a view of linear memory, valid until the
+// unit's next call. A Lua error is returned as *LuaError; cancelling ctx
+// interrupts the compute with one. Any other error means the module
+// trapped, and the unit is unusable.
+func (u *Unit) Compute(ctx context.Context, code string) ([]byte, error) {
+	in := u.inst
+	if in.closed || in.broken {
+		return nil, ErrClosed
+	}
+	if in.bufferPtr == 0 {
+		return nil, errors.New("cu: unit is not initialized")
+	}
+	if uint64(len(code)) > uint64(in.bufferSize) {
+		return nil, ErrTooLarge
+	}
+	if in.bridge.refill {
+		if err := in.reserveTableIDs(ctx); err != nil {
+			return nil, err
+		}
+	}
+
+	// Linear memory can move when it grows, so it is resolved per call
+	mem := in.mod.Memory()
+	if !mem.WriteString(in.bufferPtr, code) {
+		return nil, errors.New("cu: I/O buffer is outside linear memory")
+	}
+	stack := in.stack[:]
+	if in.module.computeParams == 2 {
+		stack[0] = api.EncodeU32(in.bufferPtr)
+		stack[1] = api.EncodeU32(uint32(len(code)))
+	} else {
+		stack[0] = api.EncodeU32(uint32(len(code)))
+	}
+	if err := in.compute.CallWithStack(ctx, stack); err != nil {
+		in.broken = true
+		return nil, fmt.Errorf("cu: compute trapped: %w", err)
+	}
+
+	written := int64(api.DecodeI32(stack[0]))
+	size := written
+	if size < 0 {
+		size = -size
+	}
+	if size > int64(in.bufferSize) {
+		size = int64(in.bufferSize)
+	}
+	result, _ := in.mod.Memory().Read(in.bufferPtr, uint32(size))
+	if written < 0 {
+		return result, &LuaError{Message: string(result)}
+	}
+	return result, nil
+}
+
+// Store returns the store the unit's imports are bound to.
+func (u *Unit) Store() *Store {
+	return u.inst.bridge.store
+}
+
+// Close releases the unit's instance and the blobs Lua holds.
+func (u *Unit) Close(ctx context.Context) error {
+	runtime.SetFinalizer(u, nil)
+	return u.inst.close(ctx)
+}
+
+func (in *instance) close(ctx context.Context) error {
+	if in.closed {
+		return nil
+	}
+	in.closed = true
+	in.module.instances.Delete(in.mod)
+	in.bridge.release()
+	return in.mod.Close(ctx)
+}
+
+// ------------------------------------------------------------------
+// Imports
+// ------------------------------------------------------------------
+
+// instantiateImports defines the env module once per runtime. Each import
+// finds its unit by the calling module.
+func (m *Module) instantiateImports(ctx context.Context) error {
+	i32, f64 := api.ValueTypeI32, api.ValueTypeF64
+	builder := m.runtime.NewHostModuleBuilder("env")
+	define := func(name string, params, results []api.ValueType, fn api.GoModuleFunc) {
+		builder.NewFunctionBuilder().WithGoModuleFunction(fn, params, results).Export(name)
+	}
+	types := func(types ...api.ValueType) []api.ValueType { return types }
+	ret := func(stack []uint64, result int32) { stack[0] = api.EncodeI32(result) }
+
+	define("js_time_now", nil, types(i32), func(ctx context.Context, mod api.Module, stack []uint64) {
+		// Milliseconds, truncated to the import's i32 as the browser host does
+		ret(stack, int32(time.Now().UnixMilli()))
+	})
+	start := time.Now()
+	define("js_clock_ms", nil, types(f64), func(ctx context.Context, mod api.Module, stack []uint64) {
+		stack[0] = api.EncodeF64(float64(time.Since(start).Nanoseconds()) / 1e6)
+	})
+	define("js_ext_table_set", types(i32, i32, i32, i32, i32), types(i32), func(ctx context.Context, mod api.Module, stack []uint64) {
+		in, mem := m.caller(mod)
+		key, ok1 := view(mem, stack[1], stack[2])
+		value, ok2 := view(mem, stack[3], stack[4])
+		if in == nil || !ok1 || !ok2 {
+			ret(stack, -1)
+			return
+		}
+		ret(stack, in.bridge.set(api.DecodeU32(stack[0]), key, value))
+	})
+	define("js_ext_table_set_parts", types(i32, i32, i32, i32, i32, i32, i32), types(i32), func(ctx context.Context, mod api.Module, stack []uint64) {
+		in, mem := m.caller(mod)
+		key, ok1 := view(mem, stack[1], stack[2])
+		head, ok2 := view(mem, stack[3], stack[4])
+		body, ok3 := view(mem, stack[5], stack[6])
+		if in == nil || !ok1 || !ok2 || !ok3 {
+			ret(stack, -1)
+			return
+		}
+		ret(stack, in.bridge.setParts(api.DecodeU32(stack[0]), key, head, body))
+	})
+	define("js_ext_table_get", types(i32, i32, i32, i32, i32), types(i32), func(ctx context.Context, mod api.Module, stack []uint64) {
+		in, mem := m.caller(mod)
+		key, ok1 := view(mem, stack[1], stack[2])
+		out, ok2 := view(mem, stack[3], stack[4])
+		if in == nil || !ok1 || !ok2 {
+			ret(stack, -1)
+			return
+		}
+		ret(stack, in.bridge.get(api.DecodeU32(stack[0]), key, out))
+	})
+	define("js_ext_table_delete", types(i32, i32, i32), types(i32), func(ctx context.Context, mod api.Module, stack []uint64) {
+		in, mem := m.caller(mod)
+		key, ok := view(mem, stack[1], stack[2])
+		if in == nil || !ok {
+			ret(stack, -1)
+			return
+		}
+		ret(stack, in.bridge.delete(api.DecodeU32(stack[0]), key))
+	})
+	define("js_ext_table_size", types(i32), types(i32), func(ctx context.Context, mod api.Module, stack []uint64) {
+		in, _ := m.caller(mod)
+		if in == nil {
+			stack[0] = 0
+			return
+		}
+		stack[0] = api.EncodeU32(in.bridge.size(api.DecodeU32(stack[0])))
+	})
+	define("js_ext_table_keys", types(i32, i32, i32), types(i32), func(ctx context.Context, mod api.Module, stack []uint64) {
+		in, mem := m.caller(mod)
+		out, ok := view(mem, stack[1], stack[2])
+		if in == nil || !ok {
+			ret(stack, -1)
+			return
+		}
+		ret(stack, in.bridge.keys(api.DecodeU32(stack[0]), out))
+	})
+	define("js_ext_table_next", types(i32, i32, i32, i32), types(i32), func(ctx context.Context, mod api.Module, stack []uint64) {
+		in, mem := m.caller(mod)
+		out, ok := view(mem, stack[2], stack[3])
+		if in == nil || !ok {
+			ret(stack, -1)
+			return
+		}
+		ret(stack, in.bridge.next(api.DecodeU32(stack[0]), api.DecodeU32(stack[1]), out))
+	})
+	define("js_ext_table_set_many", types(i32, i32, i32), types(i32), func(ctx context.Context, mod api.Module, stack []uint64) {
+		in, mem := m.caller(mod)
+		frames, ok := view(mem, stack[1], stack[2])
+		if in == nil || !ok {
+			ret(stack, -1)
+			return
+		}
+		ret(stack, in.bridge.setMany(api.DecodeU32(stack[0]), frames))
+	})
+	define("js_ext_table_get_many", types(i32, i32, i32, i32, i32), types(i32), func(ctx context.Context, mod api.Module, stack []uint64) {
+		in, mem := m.caller(mod)
+		keys, ok1 := view(mem, stack[1], stack[2])
+		out, ok2 := view(mem, stack[3], stack[4])
+		if in == nil || !ok1 || !ok2 {
+			ret(stack, -1)
+			return
+		}
+		ret(stack, in.bridge.getMany(api.DecodeU32(stack[0]), keys, out))
+	})
+	// Range scans (ext.range, ext.rrange) are not supported by this host:
+	// ordering is a no-op and every range is empty
+	define("js_ext_table_order", types(i32), types(i32), func(ctx context.Context, mod api.Module, stack []uint64) {
+		ret(stack, 0)
+	})
+	define("js_ext_table_range", types(i32, i32, i32, i32, i32, i32, i32), types(i32), func(ctx context.Context, mod api.Module, stack []uint64) {
+		ret(stack, 0)
+	})
+	// Nor are secondary indexes (ext.index, ext.lookup): no lookup matches
+	define("js_ext_table_index", types(i32, i32, i32), types(i32), func(ctx context.Context, mod api.Module, stack []uint64) {
+		ret(stack, 0)
+	})
+	define("js_ext_table_lookup", types(i32, i32, i32, i32, i32, i32), types(i32), func(ctx context.Context, mod api.Module, stack []uint64) {
+		ret(stack, 0)
+	})
+	// Nor are transactions (ext.transaction): they fail
+	define("js_ext_transaction", types(i32), types(i32), func(ctx context.Context, mod api.Module, stack []uint64) {
+		ret(stack, -1)
+	})
+	// Nor are cache tables (ext.cache): they are unbounded here
+	define("js_ext_table_cache", types(i32, i32, f64), types(i32), func(ctx context.Context, mod api.Module, stack []uint64) {
+		ret(stack, 0)
+	})
+	// Nor are negative-lookup filters: every miss reads the table
+	define("js_ext_table_filter", types(i32, i32, i32), types(i32), func(ctx context.Context, mod api.Module, stack []uint64) {
+		ret(stack, -1)
+	})
+	// Nor are columnar tables (ext.columns, ext.column): both fail
+	define("js_ext_table_columns", types(i32, i32, i32), types(i32), func(ctx context.Context, mod api.Module, stack []uint64) {
+		ret(stack, -1)
+	})
+	define("js_ext_table_column", types(i32, i32, i32, i32, i32, i32, i32), types(i32), func(ctx context.Context, mod api.Module, stack []uint64) {
+		ret(stack, -1)
+	})
+	// Nor are array tables (ext.array, ext.push, ext.pop, ext.slice): they fail
+	define("js_ext_table_array", types(i32), types(i32), func(ctx context.Context, mod api.Module, stack []uint64) {
+		ret(stack, -1)
+	})
+	define("js_ext_table_push", types(i32, i32, i32), types(i32), func(ctx context.Context, mod api.Module, stack []uint64) {
+		ret(stack, -1)
+	})
+	define("js_ext_table_pop", types(i32, i32, i32), types(i32), func(ctx context.Context, mod api.Module, stack []uint64) {
+		ret(stack, -1)
+	})
+	define("js_ext_table_slice", types(i32, i32, i32, i32, i32), types(i32), func(ctx context.Context, mod api.Module, stack []uint64) {
+		ret(stack, -1)
+	})
+	// Keys stay in the default decimal encoding, which never interns
+	define("js_ext_key_intern", types(i32, i32, i32), types(i32), func(ctx context.Context, mod api.Module, stack []uint64) {
+		ret(stack, -1)
+	})
+	define("js_blob_read", types(i32, i32, i32, i32), types(i32), func(ctx context.Context, mod api.Module, stack []uint64) {
+		in, mem := m.caller(mod)
+		out, ok := view(mem, stack[2], stack[3])
+		if in == nil || !ok {
+			ret(stack, -1)
+			return
+		}
+		ret(stack, in.bridge.blobRead(api.DecodeU32(stack[0]), api.DecodeU32(stack[1]), out))
+	})
+	define("js_blob_release", types(i32), nil, func(ctx context.Context, mod api.Module, stack []uint64) {
+		if in, _ := m.caller(mod); in != nil {
+			in.bridge.blobRelease(api.DecodeU32(stack[0]))
+		}
+	})
+	define("js_interrupt_requested", nil, types(i32), func(ctx context.Context, mod api.Module, stack []uint64) {
+		in, _ := m.caller(mod)
+		interrupted := ctx.Err() != nil || (in != nil && in.interrupt != nil && in.interrupt())
+		if interrupted {
+			ret(stack, 1)
+		} else {
+			ret(stack, 0)
+		}
+	})
+	define("js_write_output", types(i32, i32), nil, func(ctx context.Context, mod api.Module, stack []uint64) {
+		in, mem := m.caller(mod)
+		if text, ok := view(mem, stack[0], stack[1]); in != nil && in.output != nil && ok {
+			in.output(text)
+		}
+	})
+
+	_, err := builder.Instantiate(ctx)
+	return err
+}
+
+func (m *Module) caller(mod api.Module) (*instance, api.Memory) {
+	in, ok := m.instances.Load(mod)
+	if !ok {
+		return nil, nil
+	}
+	return in.(*instance), mod.Memory()
+}
+
+// view is linear memory at (ptr, len), bounds-checked, without copying.
+// It is valid until the module next runs.
+func view(mem api.Memory, ptr, length uint64) ([]byte, bool) {
+	if mem == nil {
+		return nil, false
+	}
+	return mem.Read(api.DecodeU32(ptr), api.DecodeU32(length))
+}
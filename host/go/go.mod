@@ -0,0 +1,5 @@
+module github.com/twilson63/cu/host/go
+
+go 1.21
+
+require github.com/tetratelabs/wazero v1.8.0
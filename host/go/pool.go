@@ -0,0 +1,81 @@
+package cu
+
+import (
+	"context"
+	"sync"
+)
+
+// Pool keeps initialized units of one module over one store, so any
+// number of goroutines can compute at once, each on a unit of its own.
+// Units are created on demand and kept in a sync.Pool: the garbage
+// collector may drop idle ones, whose finalizers close them. A unit that
+// trapped is discarded rather than reused.
+//
+// The units share the store, and with it _home. Their Lua globals are
+// their own, so state meant to be seen by the next compute belongs in
+// _home.
+type Pool struct {
+	module  *Module
+	store   *Store
+	options UnitOptions
+	units   sync.Pool
+}
+
+// NewPool returns an empty pool; units are made as goroutines need them.
+func NewPool(module *Module, store *Store, options *UnitOptions) *Pool {
+	p := &Pool{module: module, store: store}
+	if options != nil {
+		p.options = *options
+	}
+	return p
+}
+
+// Get returns an idle unit, or a new initialized one. Return it with Put.
+func (p *Pool) Get(ctx context.Context) (*Unit, error) {
+	if u, ok := p.units.Get().(*Unit); ok {
+		return u, nil
+	}
+	u, err := NewUnit(ctx, p.module, p.store, &p.options)
+	if err != nil {
+		return nil, err
+	}
+	if err := u.Init(ctx); err != nil {
+		u.Close(ctx)
+		return nil, err
+	}
+	return u, nil
+}
+
+// Put returns a unit from Get to the pool. Its last result is no longer
+// valid.
+func (p *Pool) Put(u *Unit) {
+	if u.inst.closed || u.inst.broken {
+		u.Close(context.Background())
+		return
+	}
+	p.units.Put(u)
+}
+
+// Do runs fn on a unit from the pool, so fn can read a result in place.
+func (p *Pool) Do(ctx context.Context, fn func(u *Unit) error) error {
+	u, err := p.Get(ctx)
+	if err != nil {
+		return err
+	}
+	defer p.Put(u)
+	return fn(u)
+}
+
+// Compute runs code on a unit from the pool and returns a copy of the
+// serialized return value. Errors are those of Unit.Compute.
+func (p *Pool) Compute(ctx context.Context, code string) ([]byte, error) {
+	var result []byte
+	err := p.Do(ctx, func(u *Unit) error {
+		data, err := u.Compute(ctx, code)
+		if err == nil {
+			result = append([]byte(nil), data...)
+		}
+		return err
+	})
+	return result, err
+}
@@ -0,0 +1,324 @@
+package cu
+
+import (
+	"sort"
+	"sync"
+)
+
+const (
+	// Open pairs() scans per store; a loop left early never closes its
+	// scan, so the oldest is evicted when all are in use
+	maxScans = 64
+
+	// Table IDs reserved for a unit at a time (see Store.reserveTableIDs)
+	tableIDBlock = 1024
+)
+
+// value is a stored value. Shared by pointer when a blob is stored under a
+// second key or pinned by a handle; refs counts those references, and a
+// value is overwritten in place only while it has one.
+type value struct {
+	bytes []byte
+	refs  int32
+}
+
+type entry struct {
+	key   string
+	value *value
+}
+
+type table struct {
+	id uint32
+	// Insertion order; nil where an entry was deleted
+	entries []*entry
+	// Key to position in entries
+	index map[string]int
+	live  int
+}
+
+// A pairs() scan (js_ext_table_next) positioned in a table's entries
+type scan struct {
+	cursor  uint32 // 0 = free slot
+	tableID uint32
+	pos     int
+	opened  uint64
+}
+
+// Store holds external tables by ID. Each table is an insertion-ordered
+// entry slice with a map index over it, so pairs() scans stay valid while
+// Lua writes to the table. Every method takes the store's lock: units on
+// different goroutines may share a store.
+type Store struct {
+	mu          sync.Mutex
+	tables      map[uint32]*table
+	homeTableID uint32
+	nextTableID uint32
+	scans       [maxScans]scan
+	nextCursor  uint32
+	scansOpened uint64
+}
+
+// NewStore returns an empty store.
+func NewStore() *Store {
+	return &Store{tables: make(map[uint32]*table), nextTableID: 1}
+}
+
+// With the store locked:
+
+func (s *Store) table(tableID uint32, create bool) *table {
+	t := s.tables[tableID]
+	if t == nil && create {
+		t = &table{id: tableID, index: make(map[string]int)}
+		s.tables[tableID] = t
+		if tableID >= s.nextTableID {
+			s.nextTableID = tableID + 1
+		}
+	}
+	return t
+}
+
+func newValue(bytes []byte) *value {
+	return &value{bytes: append([]byte(nil), bytes...), refs: 1}
+}
+
+// put copies bytes in under key. A value of similar size with no other
+// reference keeps its backing array.
+func (s *Store) put(t *table, key, bytes []byte) {
+	if i, ok := t.index[string(key)]; ok {
+		v := t.entries[i].value
+		if v.refs == 1 && cap(v.bytes) >= len(bytes) && cap(v.bytes) <= 2*len(bytes)+16 {
+			v.bytes = append(v.bytes[:0], bytes...)
+			return
+		}
+		v.refs--
+		t.entries[i].value = newValue(bytes)
+		return
+	}
+	s.insert(t, string(key), newValue(bytes))
+}
+
+// putValue stores a value that is already held, sharing its bytes
+func (s *Store) putValue(t *table, key []byte, v *value) {
+	v.refs++
+	if i, ok := t.index[string(key)]; ok {
+		t.entries[i].value.refs--
+		t.entries[i].value = v
+		return
+	}
+	s.insert(t, string(key), v)
+}
+
+func (s *Store) insert(t *table, key string, v *value) {
+	if len(t.entries) == cap(t.entries) && t.live < len(t.entries)/2 {
+		s.compact(t)
+	}
+	t.index[key] = len(t.entries)
+	t.entries = append(t.entries, &entry{key: key, value: v})
+	t.live++
+}
+
+func (s *Store) remove(t *table, key []byte) {
+	i, ok := t.index[string(key)]
+	if !ok {
+		return
+	}
+	t.entries[i].value.refs--
+	t.entries[i] = nil
+	delete(t.index, string(key))
+	t.live--
+}
+
+// compact squeezes the holes out of t.entries, keeping open scans on
+// their entry
+func (s *Store) compact(t *table) {
+	for i := range s.scans {
+		sc := &s.scans[i]
+		if sc.cursor == 0 || sc.tableID != t.id {
+			continue
+		}
+		liveBefore := 0
+		for j := 0; j < sc.pos && j < len(t.entries); j++ {
+			if t.entries[j] != nil {
+				liveBefore++
+			}
+		}
+		sc.pos = liveBefore
+	}
+	n := 0
+	for _, e := range t.entries {
+		if e != nil {
+			t.entries[n] = e
+			t.index[e.key] = n
+			n++
+		}
+	}
+	clear(t.entries[n:])
+	t.entries = t.entries[:n]
+}
+
+func (s *Store) openScan(t *table) uint32 {
+	var sc *scan
+	for i := range s.scans {
+		if s.scans[i].cursor == 0 {
+			sc = &s.scans[i]
+			break
+		}
+		if sc == nil || s.scans[i].opened < sc.opened {
+			sc = &s.scans[i]
+		}
+	}
+	s.nextCursor++
+	if s.nextCursor == 0 {
+		s.nextCursor = 1
+	}
+	s.scansOpened++
+	*sc = scan{cursor: s.nextCursor, tableID: t.id, opened: s.scansOpened}
+	return sc.cursor
+}
+
+func (s *Store) findScan(cursor uint32) *scan {
+	if cursor == 0 {
+		return nil
+	}
+	for i := range s.scans {
+		if s.scans[i].cursor == cursor {
+			return &s.scans[i]
+		}
+	}
+	return nil
+}
+
+// reserveTableIDs hands a unit a block of table IDs to create tables
+// from. Each VM numbers the tables it creates from its own counter, so
+// units sharing a store are given disjoint ranges.
+func (s *Store) reserveTableIDs(n uint32) uint32 {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	base := s.nextTableID
+	s.nextTableID += n
+	return base
+}
+
+// Set copies a serialized value in under key, creating the table if
+// needed. Values are Lua values as cu.wasm serializes them.
+func (s *Store) Set(tableID uint32, key, value []byte) {
+	s.mu.Lock()
+	s.put(s.table(tableID, true), key, value)
+	s.mu.Unlock()
+}
+
+// Get appends the value stored under key to dst. ok is false if the key
+// is missing.
+func (s *Store) Get(tableID uint32, key, dst []byte) (_ []byte, ok bool) {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	t := s.tables[tableID]
+	if t == nil {
+		return dst, false
+	}
+	i, ok := t.index[string(key)]
+	if !ok {
+		return dst, false
+	}
+	return append(dst, t.entries[i].value.bytes...), true
+}
+
+// Delete removes key from a table; a missing key is not an error.
+func (s *Store) Delete(tableID uint32, key []byte) {
+	s.mu.Lock()
+	if t := s.tables[tableID]; t != nil {
+		s.remove(t, key)
+	}
+	s.mu.Unlock()
+}
+
+// Size returns the number of keys in a table (0 if it does not exist).
+func (s *Store) Size(tableID uint32) int {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	if t := s.tables[tableID]; t != nil {
+		return t.live
+	}
+	return 0
+}
+
+// ForEach visits a table's entries in insertion order, as for saving
+// them. The slices are valid during the call only, and the store is
+// locked meanwhile: fn must not call back into it. A non-nil error from
+// fn stops the walk and is returned.
+func (s *Store) ForEach(tableID uint32, fn func(key, value []byte) error) error {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	t := s.tables[tableID]
+	if t == nil {
+		return nil
+	}
+	for _, e := range t.entries {
+		if e == nil {
+			continue
+		}
+		if err := fn([]byte(e.key), e.value.bytes); err != nil {
+			return err
+		}
+	}
+	return nil
+}
+
+// TableIDs returns the IDs of the stored tables in ascending order.
+func (s *Store) TableIDs() []uint32 {
+	s.mu.Lock()
+	ids := make([]uint32, 0, len(s.tables))
+	for id := range s.tables {
+		ids = append(ids, id)
+	}
+	s.mu.Unlock()
+	sort.Slice(ids, func(i, j int) bool { return ids[i] < ids[j] })
+	return ids
+}
+
+// HomeTable returns the table _home is bound to: 0 until a unit
+// initializes.
+func (s *Store) HomeTable() uint32 {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	return s.homeTableID
+}
+
+// SetHomeTable binds _home to a table. Set it before Unit.Init after
+// restoring saved tables, so new VMs attach _home to them.
+func (s *Store) SetHomeTable(tableID uint32) {
+	s.mu.Lock()
+	s.homeTableID = tableID
+	if tableID != 0 {
+		s.table(tableID, true)
+	}
+	s.mu.Unlock()
+}
+
+// bindHome makes tableID the home table unless one is bound already, and
+// returns the home table
+func (s *Store) bindHome(tableID uint32) uint32 {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	if s.homeTableID == 0 && tableID != 0 {
+		s.homeTableID = tableID
+		s.table(tableID, true)
+	}
+	return s.homeTableID
+}
+
+// Bytes returns the memory held by keys and values. It walks every
+// table.
+func (s *Store) Bytes() int {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	n := 0
+	for _, t := range s.tables {
+		for _, e := range t.entries {
+			if e != nil {
+				n += len(e.key) + cap(e.value.bytes)
+			}
+		}
+	}
+	return n
+}
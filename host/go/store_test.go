@@ -0,0 +1,250 @@
+package cu
+
+import (
+	"bytes"
+	"encoding/binary"
+	"fmt"
+	"strconv"
+	"testing"
+)
+
+// Store and import-protocol tests; need no cu.wasm
+
+func newBridge(store *Store) *bridge {
+	return &bridge{store: store}
+}
+
+func TestStoreSetGetDelete(t *testing.T) {
+	store := NewStore()
+	for i := 0; i < 20000; i++ {
+		store.Set(1, []byte(fmt.Sprintf("key%d", i)), []byte(fmt.Sprintf("value-%d", i*7)))
+	}
+	if store.Size(1) != 20000 {
+		t.Fatalf("size = %d", store.Size(1))
+	}
+	if value, ok := store.Get(1, []byte("key123"), nil); !ok || string(value) != "value-861" {
+		t.Fatalf("get = %q, %v", value, ok)
+	}
+	if _, ok := store.Get(1, []byte("nope"), nil); ok {
+		t.Fatal("missing key found")
+	}
+	if _, ok := store.Get(2, []byte("key1"), nil); ok {
+		t.Fatal("key found in a missing table")
+	}
+
+	// Deleting every other key keeps the rest reachable
+	for i := 0; i < 20000; i += 2 {
+		store.Delete(1, []byte(fmt.Sprintf("key%d", i)))
+	}
+	if store.Size(1) != 10000 {
+		t.Fatalf("size after deletes = %d", store.Size(1))
+	}
+	for i := 0; i < 20000; i++ {
+		if _, ok := store.Get(1, []byte(fmt.Sprintf("key%d", i)), nil); ok != (i%2 == 1) {
+			t.Fatalf("key%d found = %v", i, ok)
+		}
+	}
+
+	// Overwrites reuse the value's backing array
+	store.Set(1, []byte("key1"), []byte("same size"))
+	held := store.Bytes()
+	before := &store.tables[1].entries[store.tables[1].index["key1"]].value.bytes[0]
+	for round := 0; round < 10; round++ {
+		store.Set(1, []byte("key1"), []byte("same size"))
+	}
+	after := &store.tables[1].entries[store.tables[1].index["key1"]].value.bytes[0]
+	if before != after || store.Bytes() != held {
+		t.Fatal("overwrite reallocated the value")
+	}
+}
+
+func TestBridgeGetAndKeys(t *testing.T) {
+	b := newBridge(NewStore())
+	out := make([]byte, 64)
+
+	if got := b.get(5, []byte("a"), out); got != -1 {
+		t.Fatalf("get missing = %d", got)
+	}
+	b.set(5, []byte("a"), []byte("0123456789"))
+	b.set(5, []byte("b"), []byte("x"))
+	if got := b.get(5, []byte("a"), out); got != 10 {
+		t.Fatalf("get = %d", got)
+	}
+	if got := b.get(5, []byte("a"), out[:4]); got != -12 {
+		t.Fatalf("get into a small buffer = %d", got)
+	}
+	if b.size(5) != 2 {
+		t.Fatalf("size = %d", b.size(5))
+	}
+
+	if n := b.keys(5, out); n != 3 || string(out[:3]) != "a\nb" {
+		t.Fatalf("keys = %d %q", n, out[:3])
+	}
+	if n := b.keys(5, out[:2]); n != -1 {
+		t.Fatalf("keys into a small buffer = %d", n)
+	}
+
+	if b.delete(5, []byte("a")) != 0 || b.delete(6, []byte("a")) != -1 {
+		t.Fatal("delete status")
+	}
+	if b.size(5) != 1 {
+		t.Fatalf("size after delete = %d", b.size(5))
+	}
+}
+
+func TestScanSurvivesWrites(t *testing.T) {
+	b := newBridge(NewStore())
+	for i := 0; i < 100; i++ {
+		b.set(1, []byte(strconv.Itoa(i)), []byte("v"))
+	}
+
+	batch := make([]byte, 128)
+	seen := make([]int, 100)
+	cursor := uint32(0)
+	batches := 0
+	for {
+		n := b.next(1, cursor, batch)
+		if n < scanHeader {
+			t.Fatalf("next = %d", n)
+		}
+		cursor = binary.LittleEndian.Uint32(batch)
+		count := binary.LittleEndian.Uint32(batch[4:])
+		offset := uint32(scanHeader)
+		for i := uint32(0); i < count; i++ {
+			keyLen := binary.LittleEndian.Uint32(batch[offset:])
+			key := string(batch[offset+4 : offset+4+keyLen])
+			if key[0] != 'n' {
+				index, _ := strconv.Atoi(key)
+				seen[index]++
+			}
+			offset += 4 + keyLen
+			offset += 4 + binary.LittleEndian.Uint32(batch[offset:])
+		}
+		// Deletes in the middle of a scan force a compaction
+		if batches == 1 {
+			for i := 30; i < 100; i++ {
+				b.delete(1, []byte(strconv.Itoa(i)))
+			}
+			for i := 0; i < 40; i++ {
+				b.set(1, []byte(fmt.Sprintf("new%d", i)), []byte("v"))
+			}
+		}
+		batches++
+		if cursor == 0 {
+			break
+		}
+	}
+
+	for i := 0; i < 30; i++ {
+		if seen[i] != 1 {
+			t.Fatalf("key %d seen %d times", i, seen[i])
+		}
+	}
+	if batches <= 2 {
+		t.Fatalf("%d batches", batches)
+	}
+}
+
+func frame(parts ...string) []byte {
+	var out []byte
+	for _, part := range parts {
+		out = binary.LittleEndian.AppendUint32(out, uint32(len(part)))
+		out = append(out, part...)
+	}
+	return out
+}
+
+func TestBatches(t *testing.T) {
+	b := newBridge(NewStore())
+	frames := frame("x", "11", "y", "222")
+	if b.setMany(3, frames) != 0 {
+		t.Fatal("set_many failed")
+	}
+	if b.setMany(3, frames[:len(frames)-1]) != -1 {
+		t.Fatal("set_many accepted a truncated frame")
+	}
+
+	out := make([]byte, 64)
+	n := b.getMany(3, frame("y", "z"), out)
+	if n != 4+4+3+4 {
+		t.Fatalf("get_many = %d", n)
+	}
+	if binary.LittleEndian.Uint32(out) != 2 || binary.LittleEndian.Uint32(out[4:]) != 3 || string(out[8:11]) != "222" {
+		t.Fatalf("get_many answer %x", out[:n])
+	}
+	if int32(binary.LittleEndian.Uint32(out[11:])) != -1 {
+		t.Fatal("missing key not reported")
+	}
+}
+
+func TestBlobHandles(t *testing.T) {
+	store := NewStore()
+	b := newBridge(store)
+	b.hostBlobs = true
+
+	blob := make([]byte, blobHeader+100)
+	blob[0] = tagBlob
+	binary.LittleEndian.PutUint32(blob[1:], 100)
+	for i := 0; i < 100; i++ {
+		blob[blobHeader+i] = byte(i)
+	}
+	b.set(1, []byte("blob"), blob)
+
+	// Lua gets a handle, and reads through it
+	stub := make([]byte, 16)
+	if n := b.get(1, []byte("blob"), stub); n != blobStub {
+		t.Fatalf("get = %d", n)
+	}
+	if stub[0] != tagBlobHandle || binary.LittleEndian.Uint32(stub[5:]) != 100 {
+		t.Fatalf("stub %x", stub[:blobStub])
+	}
+	handle := binary.LittleEndian.Uint32(stub[1:])
+	part := make([]byte, 10)
+	if b.blobRead(handle, 90, part) != 10 || part[9] != 99 {
+		t.Fatal("blob read")
+	}
+	if b.blobRead(handle, 95, part) != -1 {
+		t.Fatal("blob read past the end")
+	}
+
+	// Storing the handle shares the bytes; the handle outlives a delete
+	b.set(1, []byte("copy"), stub[:blobStub])
+	b.delete(1, []byte("blob"))
+	if b.blobRead(handle, 0, part) != 10 || part[3] != 3 {
+		t.Fatal("blob read after delete")
+	}
+	if value, ok := store.Get(1, []byte("copy"), nil); !ok || !bytes.Equal(value, blob) {
+		t.Fatal("shared blob bytes differ")
+	}
+
+	b.blobRelease(handle)
+	if b.blobRead(handle, 0, part) != -1 {
+		t.Fatal("read through a released handle")
+	}
+	b.get(1, []byte("copy"), stub)
+	if binary.LittleEndian.Uint32(stub[1:]) != handle {
+		t.Fatal("released handle not reused")
+	}
+}
+
+func TestTableIDBlocks(t *testing.T) {
+	store := NewStore()
+	store.Set(7, []byte("k"), []byte("v"))
+	first := store.reserveTableIDs(tableIDBlock)
+	second := store.reserveTableIDs(tableIDBlock)
+	if first != 8 || second != first+tableIDBlock {
+		t.Fatalf("blocks at %d and %d", first, second)
+	}
+
+	// A table near the end of a unit's block asks for the next one
+	b := newBridge(store)
+	b.tableIDEnd = second + tableIDBlock
+	b.set(second+1, []byte("k"), []byte("v"))
+	if b.refill {
+		t.Fatal("refill early in the block")
+	}
+	b.set(b.tableIDEnd-1, []byte("k"), []byte("v"))
+	if !b.refill {
+		t.Fatal("no refill at the end of the block")
+	}
+}
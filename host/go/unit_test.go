@@ -0,0 +1,129 @@
+package cu
+
+import (
+	"context"
+	"errors"
+	"os"
+	"path/filepath"
+	"sync"
+	"testing"
+	"time"
+)
+
+// Tests that run cu.wasm: web/cu.wasm, or the file named by CU_WASM
+
+func loadTestModule(tb testing.TB) *Module {
+	tb.Helper()
+	path := os.Getenv("CU_WASM")
+	if path == "" {
+		path = filepath.Join("..", "..", "web", "cu.wasm")
+	}
+	if _, err := os.Stat(path); err != nil {
+		tb.Skipf("no cu.wasm at %s (build it, or set CU_WASM)", path)
+	}
+	ctx := context.Background()
+	module, err := LoadModuleFile(ctx, path, nil)
+	if err != nil {
+		tb.Fatal(err)
+	}
+	tb.Cleanup(func() { module.Close(ctx) })
+	return module
+}
+
+func newTestUnit(tb testing.TB, module *Module, store *Store) *Unit {
+	tb.Helper()
+	ctx := context.Background()
+	u, err := NewUnit(ctx, module, store, nil)
+	if err != nil {
+		tb.Fatal(err)
+	}
+	if err := u.Init(ctx); err != nil {
+		tb.Fatal(err)
+	}
+	tb.Cleanup(func() { u.Close(ctx) })
+	return u
+}
+
+func TestUnitCompute(t *testing.T) {
+	module := loadTestModule(t)
+	u := newTestUnit(t, module, NewStore())
+	ctx := context.Background()
+
+	if result, err := u.Compute(ctx, "return 1 + 1"); err != nil || len(result) == 0 {
+		t.Fatalf("compute = %x, %v", result, err)
+	}
+	var luaErr *LuaError
+	if _, err := u.Compute(ctx, "error('boom')"); !errors.As(err, &luaErr) {
+		t.Fatalf("error() returned %v", err)
+	}
+	// A Lua error leaves the unit usable
+	if _, err := u.Compute(ctx, "return 2"); err != nil {
+		t.Fatal(err)
+	}
+}
+
+func TestUnitsShareHome(t *testing.T) {
+	module := loadTestModule(t)
+	store := NewStore()
+	first := newTestUnit(t, module, store)
+	second := newTestUnit(t, module, store)
+	ctx := context.Background()
+
+	if _, err := first.Compute(ctx, "_home.counter = 41"); err != nil {
+		t.Fatal(err)
+	}
+	if store.HomeTable() == 0 || store.Size(store.HomeTable()) != 1 {
+		t.Fatalf("home table %d holds %d keys", store.HomeTable(), store.Size(store.HomeTable()))
+	}
+	if _, err := second.Compute(ctx, "if _home.counter ~= 41 then error('not shared') end"); err != nil {
+		t.Fatal(err)
+	}
+}
+
+func TestPoolConcurrentComputes(t *testing.T) {
+	module := loadTestModule(t)
+	store := NewStore()
+	pool := NewPool(module, store, nil)
+	ctx := context.Background()
+
+	var wg sync.WaitGroup
+	errs := make(chan error, 8)
+	for g := 0; g < 8; g++ {
+		wg.Add(1)
+		go func(g int) {
+			defer wg.Done()
+			for i := 0; i < 20; i++ {
+				if _, err := pool.Compute(ctx, "_home['g"+string(rune('0'+g))+"'] = true; return 1"); err != nil {
+					errs <- err
+					return
+				}
+			}
+		}(g)
+	}
+	wg.Wait()
+	close(errs)
+	for err := range errs {
+		t.Fatal(err)
+	}
+	if n := store.Size(store.HomeTable()); n != 8 {
+		t.Fatalf("home holds %d keys, want 8", n)
+	}
+}
+
+func TestContextInterruptsCompute(t *testing.T) {
+	module := loadTestModule(t)
+	if _, ok := module.compiled.ExportedFunctions()["set_interrupt_polling"]; !ok {
+		t.Skip("cu.wasm predates interrupt polling")
+	}
+	u := newTestUnit(t, module, NewStore())
+
+	ctx, cancel := context.WithTimeout(context.Background(), 50*time.Millisecond)
+	defer cancel()
+	var luaErr *LuaError
+	if _, err := u.Compute(ctx, "while true do end"); !errors.As(err, &luaErr) {
+		t.Fatalf("interrupted compute returned %v", err)
+	}
+	if _, err := u.Compute(context.Background(), "return 1"); err != nil {
+		t.Fatal(err)
+	}
+}
@@ -0,0 +1,456 @@
+//! The env imports cu.wasm calls for external tables, written against
+//! slices so they can be tested without a runtime. Formats and return codes
+//! are those of the browser host (web/cu-instance.js) and libcu-host:
+//!
+//! ```text
+//! get       value length; -1 missing; -2 - length if it does not fit
+//! keys      keys joined by '\n'; -1 if they do not fit
+//! next      u32 next_cursor (0 = done), u32 count, then per entry
+//!           u32 key_len, key, u32 value_len, value
+//! set_many  frames of u32 key_len, key, u32 value_len, value
+//! get_many  keys as frames of u32 key_len, key; answered as u32 count,
+//!           then per key i32 value_len (-1 missing) and the value
+//! ```
+//!
+//! The binding passes slices of linear memory, so each value is copied
+//! once, between storage and linear memory. A blob (tag 0xe0) goes to Lua
+//! as a 9-byte handle (0xe1, u32 handle, u32 length) when the module can
+//! read blobs in place; the handle holds the stored bytes until Lua
+//! releases it.
+
+use std::sync::Arc;
+
+use crate::storage::{Storage, Value, Visit};
+
+// Value tags (web/cu-values.js) the host looks at
+const TAG_BLOB: u8 = 0xe0;
+const TAG_BLOB_HANDLE: u8 = 0xe1;
+const BLOB_HEADER: usize = 5;
+const BLOB_STUB: usize = 9;
+const SCAN_HEADER: usize = 8;
+
+/// Table IDs reserved for a unit at a time (Storage::reserve_table_ids)
+pub(crate) const TABLE_ID_BLOCK: u32 = 1024;
+
+fn read_u32(bytes: &[u8]) -> u32 {
+    u32::from_le_bytes(bytes[..4].try_into().expect("four bytes"))
+}
+
+fn write_u32(bytes: &mut [u8], value: u32) {
+    bytes[..4].copy_from_slice(&value.to_le_bytes());
+}
+
+/// One unit's side of the env imports
+pub(crate) struct Bridge {
+    pub storage: Arc<dyn Storage>,
+    /// The module imports js_blob_read
+    pub host_blobs: bool,
+    /// Handle - 1 -> held value
+    blobs: Vec<Option<Value>>,
+    blob_free: Vec<u32>,
+    /// set_parts joins its halves here
+    scratch: Vec<u8>,
+    /// End of the block of table IDs this unit's VM creates tables from
+    pub table_id_end: u32,
+    pub refill: bool,
+}
+
+impl Bridge {
+    pub fn new(storage: Arc<dyn Storage>) -> Self {
+        Bridge {
+            storage,
+            host_blobs: false,
+            blobs: Vec::new(),
+            blob_free: Vec::new(),
+            scratch: Vec::new(),
+            table_id_end: 0,
+            refill: false,
+        }
+    }
+
+    fn is_blob(&self, value: &[u8]) -> bool {
+        self.host_blobs && value.len() >= BLOB_HEADER && value[0] == TAG_BLOB
+    }
+
+    /// The length Lua receives for a value, before a blob is held for a
+    /// caller that may have to retry
+    fn outgoing_len(&self, value: &[u8]) -> usize {
+        if self.is_blob(value) {
+            BLOB_STUB
+        } else {
+            value.len()
+        }
+    }
+
+    /// Writes what Lua receives for a value to `out`, which has room for
+    /// it: the value, or a handle stub. Returns the length written.
+    fn write_outgoing(&mut self, value: &Value, out: &mut [u8]) -> usize {
+        if !self.is_blob(value) {
+            out[..value.len()].copy_from_slice(value);
+            return value.len();
+        }
+        let handle = match self.blob_free.pop() {
+            Some(handle) => {
+                self.blobs[handle as usize - 1] = Some(value.clone());
+                handle
+            }
+            None => {
+                self.blobs.push(Some(value.clone()));
+                self.blobs.len() as u32
+            }
+        };
+        out[0] = TAG_BLOB_HANDLE;
+        write_u32(&mut out[1..], handle);
+        write_u32(&mut out[5..], (value.len() - BLOB_HEADER) as u32);
+        BLOB_STUB
+    }
+
+    fn blob(&self, handle: u32) -> Option<&Value> {
+        let slot = (handle as usize).checked_sub(1)?;
+        self.blobs.get(slot)?.as_ref()
+    }
+
+    /// Stores bytes written by Lua; a handle stands for the blob it names
+    fn incoming(&mut self, table: u32, key: &[u8], value: &[u8]) {
+        if table < self.table_id_end && table >= self.table_id_end - TABLE_ID_BLOCK / 4 {
+            // Near the end of the unit's block: reserve more before the next call
+            self.refill = true;
+        }
+        if value.len() == BLOB_STUB && value[0] == TAG_BLOB_HANDLE {
+            if let Some(blob) = self.blob(read_u32(&value[1..])) {
+                self.storage.set_value(table, key, blob.clone());
+                return;
+            }
+        }
+        self.storage.set(table, key, value);
+    }
+
+    pub fn set(&mut self, table: u32, key: &[u8], value: &[u8]) -> i32 {
+        self.incoming(table, key, value);
+        0
+    }
+
+    pub fn set_parts(&mut self, table: u32, key: &[u8], head: &[u8], body: &[u8]) -> i32 {
+        let mut scratch = std::mem::take(&mut self.scratch);
+        scratch.clear();
+        scratch.extend_from_slice(head);
+        scratch.extend_from_slice(body);
+        self.incoming(table, key, &scratch);
+        self.scratch = scratch;
+        0
+    }
+
+    pub fn get(&mut self, table: u32, key: &[u8], out: &mut [u8]) -> i32 {
+        let Some(value) = self.storage.get(table, key) else {
+            return -1;
+        };
+        let needed = self.outgoing_len(&value);
+        if needed > out.len() {
+            return if needed > i32::MAX as usize - 2 {
+                i32::MIN
+            } else {
+                -2 - needed as i32
+            };
+        }
+        self.write_outgoing(&value, out) as i32
+    }
+
+    pub fn delete(&mut self, table: u32, key: &[u8]) -> i32 {
+        if self.storage.delete(table, key) {
+            0
+        } else {
+            -1
+        }
+    }
+
+    pub fn size(&self, table: u32) -> u32 {
+        self.storage.len(table).unwrap_or(0) as u32
+    }
+
+    pub fn keys(&self, table: u32, out: &mut [u8]) -> i32 {
+        let mut n = 0;
+        let mut fits = true;
+        let exists = self.storage.for_each(table, &mut |key, _| {
+            let needed = key.len() + usize::from(n > 0);
+            if n + needed > out.len() {
+                fits = false;
+                return Visit::Stop;
+            }
+            if n > 0 {
+                out[n] = b'\n';
+                n += 1;
+            }
+            out[n..n + key.len()].copy_from_slice(key);
+            n += key.len();
+            Visit::Next
+        });
+        if exists && fits {
+            n as i32
+        } else {
+            -1
+        }
+    }
+
+    pub fn next(&mut self, table: u32, cursor: u32, out: &mut [u8]) -> i32 {
+        if out.len() < SCAN_HEADER {
+            return -1;
+        }
+        let cursor = match cursor {
+            0 => match self.storage.scan_open(table) {
+                Some(cursor) => cursor,
+                None => return -1,
+            },
+            cursor => cursor,
+        };
+
+        let storage = self.storage.clone();
+        let mut n = SCAN_HEADER;
+        let mut count = 0u32;
+        let done = storage.scan_next(table, cursor, &mut |key, value| {
+            let needed = 8 + key.len() + self.outgoing_len(value);
+            if n + needed > out.len() {
+                // Larger than one batch on its own: skip it
+                return if count > 0 { Visit::Stop } else { Visit::Next };
+            }
+            write_u32(&mut out[n..], key.len() as u32);
+            out[n + 4..n + 4 + key.len()].copy_from_slice(key);
+            n += 4 + key.len();
+            let len = self.write_outgoing(value, &mut out[n + 4..]);
+            write_u32(&mut out[n..], len as u32);
+            n += 4 + len;
+            count += 1;
+            Visit::Next
+        });
+        let Some(done) = done else {
+            return -1;
+        };
+        write_u32(out, if done { 0 } else { cursor });
+        write_u32(&mut out[4..], count);
+        n as i32
+    }
+
+    pub fn set_many(&mut self, table: u32, frames: &[u8]) -> i32 {
+        let mut rest = frames;
+        while rest.len() >= 8 {
+            let key_len = read_u32(rest) as usize;
+            if 8 + key_len > rest.len() {
+                break;
+            }
+            let value_len = read_u32(&rest[4 + key_len..]) as usize;
+            if 8 + key_len + value_len > rest.len() {
+                break;
+            }
+            let (key, value) = (
+                &rest[4..4 + key_len],
+                &rest[8 + key_len..8 + key_len + value_len],
+            );
+            self.incoming(table, key, value);
+            rest = &rest[8 + key_len + value_len..];
+        }
+        if rest.is_empty() {
+            0
+        } else {
+            -1
+        }
+    }
+
+    pub fn get_many(&mut self, table: u32, keys: &[u8], out: &mut [u8]) -> i32 {
+        if out.len() < 8 || self.storage.len(table).is_none() {
+            return -1;
+        }
+        let mut n = 4;
+        let mut answered = 0u32;
+        let mut rest = keys;
+        while rest.len() >= 4 {
+            let key_len = read_u32(rest) as usize;
+            if 4 + key_len > rest.len() {
+                break;
+            }
+            let mut value = self.storage.get(table, &rest[4..4 + key_len]);
+            if let Some(found) = &value {
+                if n + 4 + self.outgoing_len(found) > out.len() {
+                    if answered > 0 {
+                        break;
+                    }
+                    value = None; // too large for one answer; report it missing
+                }
+            }
+            match value {
+                Some(value) => {
+                    let len = self.write_outgoing(&value, &mut out[n + 4..]);
+                    write_u32(&mut out[n..], len as u32);
+                    n += 4 + len;
+                }
+                None => {
+                    if n + 4 > out.len() {
+                        break;
+                    }
+                    write_u32(&mut out[n..], u32::MAX);
+                    n += 4;
+                }
+            }
+            rest = &rest[4 + key_len..];
+            answered += 1;
+        }
+        write_u32(out, answered);
+        n as i32
+    }
+
+    pub fn blob_read(&self, handle: u32, offset: u32, out: &mut [u8]) -> i32 {
+        let Some(blob) = self.blob(handle) else {
+            return -1;
+        };
+        let start = BLOB_HEADER + offset as usize;
+        match blob.get(start..start + out.len()) {
+            Some(bytes) => {
+                out.copy_from_slice(bytes);
+                out.len() as i32
+            }
+            None => -1,
+        }
+    }
+
+    pub fn blob_release(&mut self, handle: u32) {
+        if self.blob(handle).is_some() {
+            self.blobs[handle as usize - 1] = None;
+            self.blob_free.push(handle);
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::storage::MemoryStore;
+
+    fn bridge() -> (Arc<MemoryStore>, Bridge) {
+        let store = Arc::new(MemoryStore::new());
+        let bridge = Bridge::new(store.clone());
+        (store, bridge)
+    }
+
+    fn frames(parts: &[&str]) -> Vec<u8> {
+        let mut out = Vec::new();
+        for part in parts {
+            out.extend_from_slice(&(part.len() as u32).to_le_bytes());
+            out.extend_from_slice(part.as_bytes());
+        }
+        out
+    }
+
+    #[test]
+    fn get_and_keys() {
+        let (_, mut b) = bridge();
+        let mut out = [0u8; 64];
+        assert_eq!(b.get(5, b"a", &mut out), -1);
+        b.set(5, b"a", b"0123456789");
+        b.set(5, b"b", b"x");
+        assert_eq!(b.get(5, b"a", &mut out), 10);
+        assert_eq!(b.get(5, b"a", &mut out[..4]), -12);
+        assert_eq!(b.size(5), 2);
+
+        assert_eq!(b.keys(5, &mut out), 3);
+        assert_eq!(&out[..3], b"a\nb");
+        assert_eq!(b.keys(5, &mut out[..2]), -1);
+
+        assert_eq!(b.delete(5, b"a"), 0);
+        assert_eq!(b.delete(6, b"a"), -1);
+        assert_eq!(b.size(5), 1);
+    }
+
+    #[test]
+    fn scan_survives_writes() {
+        let (_, mut b) = bridge();
+        for i in 0..100 {
+            b.set(1, i.to_string().as_bytes(), b"v");
+        }
+
+        let mut batch = [0u8; 128];
+        let mut seen = [0; 100];
+        let mut cursor = 0;
+        let mut batches = 0;
+        loop {
+            let n = b.next(1, cursor, &mut batch);
+            assert!(n >= SCAN_HEADER as i32);
+            cursor = read_u32(&batch);
+            let count = read_u32(&batch[4..]);
+            let mut offset = SCAN_HEADER;
+            for _ in 0..count {
+                let key_len = read_u32(&batch[offset..]) as usize;
+                let key = std::str::from_utf8(&batch[offset + 4..offset + 4 + key_len]).unwrap();
+                if !key.starts_with('n') {
+                    seen[key.parse::<usize>().unwrap()] += 1;
+                }
+                offset += 4 + key_len;
+                offset += 4 + read_u32(&batch[offset..]) as usize;
+            }
+            // Deletes in the middle of a scan force a compaction
+            if batches == 1 {
+                for i in 30..100 {
+                    b.delete(1, i.to_string().as_bytes());
+                }
+                for i in 0..40 {
+                    b.set(1, format!("new{i}").as_bytes(), b"v");
+                }
+            }
+            batches += 1;
+            if cursor == 0 {
+                break;
+            }
+        }
+        assert!(seen[..30].iter().all(|&count| count == 1));
+        assert!(batches > 2);
+    }
+
+    #[test]
+    fn batches() {
+        let (_, mut b) = bridge();
+        let set = frames(&["x", "11", "y", "222"]);
+        assert_eq!(b.set_many(3, &set), 0);
+        assert_eq!(b.set_many(3, &set[..set.len() - 1]), -1);
+
+        let mut out = [0u8; 64];
+        let n = b.get_many(3, &frames(&["y", "z"]), &mut out);
+        assert_eq!(n, 4 + 4 + 3 + 4);
+        assert_eq!(read_u32(&out), 2);
+        assert_eq!(read_u32(&out[4..]), 3);
+        assert_eq!(&out[8..11], b"222");
+        assert_eq!(read_u32(&out[11..]) as i32, -1);
+    }
+
+    #[test]
+    fn blob_handles() {
+        let (store, mut b) = bridge();
+        b.host_blobs = true;
+        let mut blob = vec![0u8; BLOB_HEADER + 100];
+        blob[0] = TAG_BLOB;
+        write_u32(&mut blob[1..], 100);
+        for i in 0..100 {
+            blob[BLOB_HEADER + i] = i as u8;
+        }
+        b.set(1, b"blob", &blob);
+
+        // Lua gets a handle, and reads through it
+        let mut stub = [0u8; 16];
+        assert_eq!(b.get(1, b"blob", &mut stub), BLOB_STUB as i32);
+        assert_eq!(stub[0], TAG_BLOB_HANDLE);
+        assert_eq!(read_u32(&stub[5..]), 100);
+        let handle = read_u32(&stub[1..]);
+        let mut part = [0u8; 10];
+        assert_eq!(b.blob_read(handle, 90, &mut part), 10);
+        assert_eq!(part[9], 99);
+        assert_eq!(b.blob_read(handle, 95, &mut part), -1);
+
+        // Storing the handle shares the bytes; the handle outlives a delete
+        b.set(1, b"copy", &stub[..BLOB_STUB]);
+        b.delete(1, b"blob");
+        assert_eq!(b.blob_read(handle, 0, &mut part), 10);
+        assert_eq!(part[3], 3);
+        assert_eq!(store.get(1, b"copy").as_deref(), Some(&blob[..]));
+
+        b.blob_release(handle);
+        assert_eq!(b.blob_read(handle, 0, &mut part), -1);
+        b.get(1, b"copy", &mut stub);
+        assert_eq!(read_u32(&stub[1..]), handle); // released handles are reused
+    }
+}
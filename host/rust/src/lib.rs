@@ -0,0 +1,32 @@
+//! Runs cu.wasm on wasmtime: the host side of cu's external tables and I/O,
+//! as web/cu-instance.js is in the browser.
+//!
+//! A [`Module`] compiles cu.wasm once into an engine using wasmtime's
+//! pooling instance allocator, so a [`Unit`] is instantiated into a
+//! preallocated slot. [`Unit::compute`] is async: a running compute yields
+//! to the executor every epoch and is held to its time limit. Results are
+//! views of linear memory. External tables live behind the [`Storage`]
+//! trait; [`MemoryStore`] keeps them in memory.
+//!
+//! ```no_run
+//! # async fn run() -> Result<(), cu_host::Error> {
+//! use std::sync::Arc;
+//! use cu_host::{MemoryStore, Module, ModuleOptions, Unit, UnitOptions};
+//!
+//! let module = Module::from_file("cu.wasm", &ModuleOptions::default())?;
+//! let mut unit = Unit::new(&module, Arc::new(MemoryStore::new()), UnitOptions::default()).await?;
+//! let result = unit.compute(b"_home.n = (_home.n or 0) + 1; return _home.n").await?;
+//! # let _ = result;
+//! # Ok(())
+//! # }
+//! ```
+
+#[cfg_attr(not(feature = "runtime"), allow(dead_code))]
+mod bridge;
+mod storage;
+#[cfg(feature = "runtime")]
+mod unit;
+
+pub use storage::{MemoryStore, Storage, Value, Visit};
+#[cfg(feature = "runtime")]
+pub use unit::{Error, Module, ModuleOptions, Output, Unit, UnitOptions};
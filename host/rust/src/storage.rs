@@ -0,0 +1,413 @@
+//! External table storage.
+//!
+//! The imports reach external tables through the [`Storage`] trait, so a
+//! host can keep them in memory ([`MemoryStore`]) or in a database of its
+//! own. Values are shared as [`Value`]s: handing one to the bridge bumps a
+//! reference count instead of copying, and a blob stored under a second key
+//! shares its bytes.
+
+use std::collections::HashMap;
+use std::sync::{Arc, Mutex, MutexGuard};
+
+/// A stored value: a Lua value as cu.wasm serializes it.
+pub type Value = Arc<[u8]>;
+
+/// What a scan's visitor wants done with the entry it was shown.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum Visit {
+    /// Move past the entry and keep going.
+    Next,
+    /// Stop before the entry, so the next batch starts with it.
+    Stop,
+}
+
+/// External tables by ID. Every method may be called from several units
+/// on different threads at once. Visitors must not call back into the
+/// storage they are visiting.
+pub trait Storage: Send + Sync + 'static {
+    /// The value under `key`, if there is one.
+    fn get(&self, table: u32, key: &[u8]) -> Option<Value>;
+
+    /// Copies `value` in under `key`, creating the table if needed.
+    fn set(&self, table: u32, key: &[u8], value: &[u8]);
+
+    /// Stores a value that is already held, sharing its bytes.
+    fn set_value(&self, table: u32, key: &[u8], value: Value) {
+        self.set(table, key, &value);
+    }
+
+    /// Removes `key`. False if the table does not exist.
+    fn delete(&self, table: u32, key: &[u8]) -> bool;
+
+    /// Number of keys, or `None` if the table does not exist.
+    fn len(&self, table: u32) -> Option<usize>;
+
+    /// Visits a table's entries in insertion order until `visit` stops.
+    /// False if the table does not exist.
+    fn for_each(&self, table: u32, visit: &mut dyn FnMut(&[u8], &Value) -> Visit) -> bool;
+
+    /// Opens a `pairs()` scan over a table and returns its cursor (never
+    /// 0), or `None` if the table does not exist. A scan stays valid while
+    /// the table is written to.
+    fn scan_open(&self, table: u32) -> Option<u32>;
+
+    /// Continues a scan until `visit` stops or the table is exhausted.
+    /// Returns `Some(true)` once the scan is done (and closed), or `None`
+    /// for a cursor that is not open on `table`.
+    fn scan_next(
+        &self,
+        table: u32,
+        cursor: u32,
+        visit: &mut dyn FnMut(&[u8], &Value) -> Visit,
+    ) -> Option<bool>;
+
+    /// IDs of the stored tables, in ascending order.
+    fn table_ids(&self) -> Vec<u32>;
+
+    /// The table `_home` is bound to, or 0.
+    fn home_table(&self) -> u32;
+
+    /// Makes `table` the home table unless one is bound already, and
+    /// returns the home table.
+    fn bind_home(&self, table: u32) -> u32;
+
+    /// Hands a unit `count` table IDs to create tables from and returns
+    /// the first. Each VM numbers the tables it creates from its own
+    /// counter, so units sharing storage are given disjoint ranges.
+    fn reserve_table_ids(&self, count: u32) -> u32;
+}
+
+// Open pairs() scans per store; a loop left early never closes its scan,
+// so the oldest is evicted when all are in use
+const MAX_SCANS: usize = 64;
+
+struct Entry {
+    key: Box<[u8]>,
+    value: Value,
+}
+
+#[derive(Default)]
+struct Table {
+    /// Insertion order; `None` where an entry was deleted
+    entries: Vec<Option<Entry>>,
+    /// Key to position in `entries`
+    index: HashMap<Box<[u8]>, usize>,
+    live: usize,
+}
+
+#[derive(Clone, Copy, Default)]
+struct Scan {
+    cursor: u32, // 0 = free slot
+    table: u32,
+    pos: usize,
+    opened: u64,
+}
+
+enum Incoming<'a> {
+    Bytes(&'a [u8]),
+    Shared(Value),
+}
+
+struct Inner {
+    tables: HashMap<u32, Table>,
+    home_table: u32,
+    next_table_id: u32,
+    scans: [Scan; MAX_SCANS],
+    next_cursor: u32,
+    scans_opened: u64,
+}
+
+/// External tables in memory: per table, an insertion-ordered entry
+/// vector with a hash index over it, behind one lock. Deleted entries are
+/// squeezed out when the vector next fills up, and open scans are moved
+/// along with them. A value overwritten with one of the same length is
+/// written in place when nothing else holds it.
+pub struct MemoryStore {
+    inner: Mutex<Inner>,
+}
+
+impl Default for MemoryStore {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl MemoryStore {
+    pub fn new() -> Self {
+        MemoryStore {
+            inner: Mutex::new(Inner {
+                tables: HashMap::new(),
+                home_table: 0,
+                next_table_id: 1,
+                scans: [Scan::default(); MAX_SCANS],
+                next_cursor: 0,
+                scans_opened: 0,
+            }),
+        }
+    }
+
+    /// Sets the home table outright, as when restoring saved tables.
+    /// Set it before units initialize, so their VMs attach `_home` to it.
+    pub fn set_home_table(&self, table: u32) {
+        let mut inner = self.lock();
+        inner.home_table = table;
+        if table != 0 {
+            inner.table(table);
+        }
+    }
+
+    /// Memory held by keys and values; a shared value counts once per key.
+    pub fn bytes(&self) -> usize {
+        let inner = self.lock();
+        inner
+            .tables
+            .values()
+            .flat_map(|table| table.entries.iter().flatten())
+            .map(|entry| entry.key.len() + entry.value.len())
+            .sum()
+    }
+
+    fn lock(&self) -> MutexGuard<'_, Inner> {
+        // Every method finishes its writes before anything can panic, so
+        // the tables stay consistent behind a poisoned lock
+        self.inner
+            .lock()
+            .unwrap_or_else(|poisoned| poisoned.into_inner())
+    }
+}
+
+impl Inner {
+    fn table(&mut self, id: u32) -> &mut Table {
+        if id >= self.next_table_id && !self.tables.contains_key(&id) {
+            self.next_table_id = id + 1;
+        }
+        self.tables.entry(id).or_default()
+    }
+
+    fn put(&mut self, id: u32, key: &[u8], value: Incoming<'_>) {
+        self.table(id);
+        let table = self.tables.get_mut(&id).expect("table created");
+        if let Some(&pos) = table.index.get(key) {
+            let entry = table.entries[pos].as_mut().expect("indexed entry");
+            match value {
+                Incoming::Bytes(bytes) => match Arc::get_mut(&mut entry.value) {
+                    Some(slot) if slot.len() == bytes.len() => slot.copy_from_slice(bytes),
+                    _ => entry.value = Arc::from(bytes),
+                },
+                Incoming::Shared(shared) => entry.value = shared,
+            }
+            return;
+        }
+
+        let value = match value {
+            Incoming::Bytes(bytes) => Arc::from(bytes),
+            Incoming::Shared(shared) => shared,
+        };
+        if table.entries.len() == table.entries.capacity() && table.live < table.entries.len() / 2 {
+            compact(table, &mut self.scans, id);
+        }
+        let key: Box<[u8]> = key.into();
+        table.index.insert(key.clone(), table.entries.len());
+        table.entries.push(Some(Entry { key, value }));
+        table.live += 1;
+    }
+
+    fn close_scan(&mut self, slot: usize) {
+        self.scans[slot] = Scan::default();
+    }
+}
+
+/// Squeezes the holes out of `table.entries`, keeping open scans on their
+/// entry
+fn compact(table: &mut Table, scans: &mut [Scan; MAX_SCANS], id: u32) {
+    for scan in scans
+        .iter_mut()
+        .filter(|scan| scan.cursor != 0 && scan.table == id)
+    {
+        let end = scan.pos.min(table.entries.len());
+        scan.pos = table.entries[..end]
+            .iter()
+            .filter(|entry| entry.is_some())
+            .count();
+    }
+    table.entries.retain(Option::is_some);
+    for (pos, entry) in table.entries.iter().enumerate() {
+        let entry = entry.as_ref().expect("live entry");
+        *table.index.get_mut(&entry.key).expect("indexed key") = pos;
+    }
+}
+
+impl Storage for MemoryStore {
+    fn get(&self, table: u32, key: &[u8]) -> Option<Value> {
+        let inner = self.lock();
+        let table = inner.tables.get(&table)?;
+        let pos = *table.index.get(key)?;
+        table.entries[pos].as_ref().map(|entry| entry.value.clone())
+    }
+
+    fn set(&self, table: u32, key: &[u8], value: &[u8]) {
+        self.lock().put(table, key, Incoming::Bytes(value));
+    }
+
+    fn set_value(&self, table: u32, key: &[u8], value: Value) {
+        self.lock().put(table, key, Incoming::Shared(value));
+    }
+
+    fn delete(&self, table: u32, key: &[u8]) -> bool {
+        let mut inner = self.lock();
+        let Some(table) = inner.tables.get_mut(&table) else {
+            return false;
+        };
+        if let Some(pos) = table.index.remove(key) {
+            table.entries[pos] = None;
+            table.live -= 1;
+        }
+        true
+    }
+
+    fn len(&self, table: u32) -> Option<usize> {
+        self.lock().tables.get(&table).map(|table| table.live)
+    }
+
+    fn for_each(&self, table: u32, visit: &mut dyn FnMut(&[u8], &Value) -> Visit) -> bool {
+        let inner = self.lock();
+        let Some(table) = inner.tables.get(&table) else {
+            return false;
+        };
+        for entry in table.entries.iter().flatten() {
+            if visit(&entry.key, &entry.value) == Visit::Stop {
+                break;
+            }
+        }
+        true
+    }
+
+    fn scan_open(&self, table: u32) -> Option<u32> {
+        let mut inner = self.lock();
+        if !inner.tables.contains_key(&table) {
+            return None;
+        }
+        let slot = match inner.scans.iter().position(|scan| scan.cursor == 0) {
+            Some(slot) => slot,
+            None => (0..MAX_SCANS)
+                .min_by_key(|&i| inner.scans[i].opened)
+                .expect("scan slots"),
+        };
+        inner.next_cursor = inner.next_cursor.wrapping_add(1).max(1);
+        inner.scans_opened += 1;
+        inner.scans[slot] = Scan {
+            cursor: inner.next_cursor,
+            table,
+            pos: 0,
+            opened: inner.scans_opened,
+        };
+        Some(inner.next_cursor)
+    }
+
+    fn scan_next(
+        &self,
+        table: u32,
+        cursor: u32,
+        visit: &mut dyn FnMut(&[u8], &Value) -> Visit,
+    ) -> Option<bool> {
+        let mut inner = self.lock();
+        let inner = &mut *inner;
+        if cursor == 0 {
+            return None;
+        }
+        let slot = inner
+            .scans
+            .iter()
+            .position(|scan| scan.cursor == cursor && scan.table == table)?;
+        let entries = &inner.tables.get(&table)?.entries;
+        let scan = &mut inner.scans[slot];
+        while scan.pos < entries.len() {
+            if let Some(entry) = &entries[scan.pos] {
+                if visit(&entry.key, &entry.value) == Visit::Stop {
+                    return Some(false);
+                }
+            }
+            scan.pos += 1;
+        }
+        inner.close_scan(slot);
+        Some(true)
+    }
+
+    fn table_ids(&self) -> Vec<u32> {
+        let mut ids: Vec<u32> = self.lock().tables.keys().copied().collect();
+        ids.sort_unstable();
+        ids
+    }
+
+    fn home_table(&self) -> u32 {
+        self.lock().home_table
+    }
+
+    fn bind_home(&self, table: u32) -> u32 {
+        let mut inner = self.lock();
+        if inner.home_table == 0 && table != 0 {
+            inner.home_table = table;
+            inner.table(table);
+        }
+        inner.home_table
+    }
+
+    fn reserve_table_ids(&self, count: u32) -> u32 {
+        let mut inner = self.lock();
+        let base = inner.next_table_id;
+        inner.next_table_id += count;
+        base
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn set_get_delete() {
+        let store = MemoryStore::new();
+        for i in 0..20000 {
+            store.set(
+                1,
+                format!("key{i}").as_bytes(),
+                format!("value-{}", i * 7).as_bytes(),
+            );
+        }
+        assert_eq!(store.len(1), Some(20000));
+        assert_eq!(store.get(1, b"key123").as_deref(), Some(&b"value-861"[..]));
+        assert!(store.get(1, b"nope").is_none());
+        assert!(store.get(2, b"key1").is_none());
+
+        // Deleting every other key keeps the rest reachable
+        for i in (0..20000).step_by(2) {
+            assert!(store.delete(1, format!("key{i}").as_bytes()));
+        }
+        assert_eq!(store.len(1), Some(10000));
+        for i in 0..20000 {
+            assert_eq!(
+                store.get(1, format!("key{i}").as_bytes()).is_some(),
+                i % 2 == 1
+            );
+        }
+
+        // Overwrites of the same length are written in place
+        store.set(1, b"key1", b"same size");
+        let before = store.get(1, b"key1").unwrap().as_ptr();
+        for _ in 0..10 {
+            store.set(1, b"key1", b"same size");
+        }
+        assert_eq!(store.get(1, b"key1").unwrap().as_ptr(), before);
+    }
+
+    #[test]
+    fn table_id_blocks() {
+        let store = MemoryStore::new();
+        store.set(7, b"k", b"v");
+        let first = store.reserve_table_ids(1024);
+        assert_eq!(first, 8);
+        assert_eq!(store.reserve_table_ids(1024), first + 1024);
+        assert_eq!(store.bind_home(3), 3);
+        assert_eq!(store.bind_home(4), 3);
+    }
+}
@@ -0,0 +1,757 @@
+//! cu.wasm on wasmtime: a Module compiled once, and Units instantiated from
+//! it into slots of wasmtime's pooling allocator.
+
+use std::ops::Range;
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::Arc;
+use std::time::{Duration, Instant};
+use std::{fmt, thread};
+
+use wasmtime::{
+    Caller, Config, Engine, ExternType, Instance, InstanceAllocationStrategy, InstancePre, Linker,
+    Memory, PoolingAllocationConfig, Store, Trap, TypedFunc, UpdateDeadline,
+};
+
+use crate::bridge::{Bridge, TABLE_ID_BLOCK};
+use crate::storage::Storage;
+
+/// Output is streamed in chunks of this many bytes when a unit has an
+/// output callback (set_output_streaming)
+const OUTPUT_CHUNK_BYTES: u32 = 4096;
+
+/// Errors from Module and Unit calls
+#[derive(Debug)]
+pub enum Error {
+    /// Lua raised an error, or was interrupted; the unit stays usable
+    Lua(String),
+    /// The compute ran past its time limit without reaching an interrupt
+    /// check and was stopped; the unit is poisoned
+    TimedOut,
+    /// The code does not fit in the I/O buffer
+    TooLarge,
+    /// The unit trapped, timed out, or had a compute dropped midway, and
+    /// refuses further calls
+    Poisoned,
+    /// wasmtime failed to compile, instantiate or run the module
+    Wasm(wasmtime::Error),
+}
+
+impl fmt::Display for Error {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        match self {
+            Error::Lua(message) => write!(f, "cu: {message}"),
+            Error::TimedOut => f.write_str("cu: compute exceeded its time limit"),
+            Error::TooLarge => f.write_str("cu: code does not fit in the I/O buffer"),
+            Error::Poisoned => f.write_str("cu: unit is unusable after an earlier failure"),
+            Error::Wasm(err) => write!(f, "cu: {err}"),
+        }
+    }
+}
+
+impl std::error::Error for Error {
+    fn source(&self) -> Option<&(dyn std::error::Error + 'static)> {
+        match self {
+            Error::Wasm(err) => Some(&**err),
+            _ => None,
+        }
+    }
+}
+
+impl From<wasmtime::Error> for Error {
+    fn from(err: wasmtime::Error) -> Self {
+        Error::Wasm(err)
+    }
+}
+
+/// Options for Module::new. The default suits a few hundred units of up to
+/// 256MB each.
+#[derive(Clone, Debug)]
+pub struct ModuleOptions {
+    /// Pooling allocator slots: the most units alive at once
+    pub max_units: u32,
+    /// Largest linear memory a unit may grow to, in bytes
+    pub max_memory: usize,
+    /// Epoch period: how often running computes yield to the executor and
+    /// check their time limit
+    pub tick: Duration,
+}
+
+impl Default for ModuleOptions {
+    fn default() -> Self {
+        ModuleOptions {
+            max_units: 1000,
+            max_memory: 256 << 20,
+            tick: Duration::from_millis(10),
+        }
+    }
+}
+
+/// Receives a unit's print() output; the text is valid during the call
+pub type Output = Box<dyn FnMut(&[u8]) + Send>;
+
+/// Options for Unit::new
+#[derive(Default)]
+pub struct UnitOptions {
+    /// Receives print() output as it is written. None keeps output in the
+    /// result.
+    pub output: Option<Output>,
+    /// Interrupts a running compute with a Lua error when set
+    pub interrupt: Option<Arc<AtomicBool>>,
+    /// Time limit for each compute (see Unit::set_time_limit)
+    pub time_limit: Option<Duration>,
+}
+
+/// cu.wasm compiled for an engine of its own, with its imports linked.
+/// Clones share the compiled module.
+#[derive(Clone)]
+pub struct Module {
+    inner: Arc<ModuleInner>,
+}
+
+struct ModuleInner {
+    engine: Engine,
+    pre: InstancePre<State>,
+    /// The module imports js_blob_read
+    host_blobs: bool,
+    /// compute takes (ptr, len); older builds take (len)
+    compute_ptr: bool,
+    tick: Duration,
+    ticker: Arc<AtomicBool>,
+}
+
+impl Drop for ModuleInner {
+    fn drop(&mut self) {
+        self.ticker.store(true, Ordering::Relaxed);
+    }
+}
+
+impl Module {
+    /// Compiles cu.wasm (binary or text) and links its env imports.
+    pub fn new(wasm: &[u8], options: &ModuleOptions) -> Result<Module, Error> {
+        let mut pooling = PoolingAllocationConfig::default();
+        pooling
+            .total_core_instances(options.max_units)
+            .total_memories(options.max_units)
+            .total_tables(options.max_units)
+            .max_memory_size(options.max_memory);
+        let mut config = Config::new();
+        config
+            .async_support(true)
+            .epoch_interruption(true)
+            .allocation_strategy(InstanceAllocationStrategy::Pooling(pooling));
+        let engine = Engine::new(&config)?;
+
+        let module = wasmtime::Module::new(&engine, wasm)?;
+        let compute_ptr = match module.get_export("compute") {
+            Some(ExternType::Func(ty)) => ty.params().len() == 2,
+            _ => {
+                return Err(Error::Wasm(wasmtime::Error::msg(
+                    "module does not export compute",
+                )))
+            }
+        };
+        let host_blobs = module
+            .imports()
+            .any(|import| import.module() == "env" && import.name() == "js_blob_read");
+
+        let mut linker = Linker::new(&engine);
+        link_imports(&mut linker)?;
+        let pre = linker.instantiate_pre(&module)?;
+
+        // Epochs drive both yielding and time limits. The thread holds the
+        // engine until the module is dropped.
+        let ticker = Arc::new(AtomicBool::new(false));
+        let (stop, ticking, tick) = (ticker.clone(), engine.clone(), options.tick);
+        thread::Builder::new()
+            .name("cu-epoch".into())
+            .spawn(move || {
+                while !stop.load(Ordering::Relaxed) {
+                    thread::sleep(tick);
+                    ticking.increment_epoch();
+                }
+            })
+            .map_err(|err| Error::Wasm(err.into()))?;
+
+        Ok(Module {
+            inner: Arc::new(ModuleInner {
+                engine,
+                pre,
+                host_blobs,
+                compute_ptr,
+                tick: options.tick,
+                ticker,
+            }),
+        })
+    }
+
+    /// Reads and compiles a cu.wasm file.
+    pub fn from_file(
+        path: impl AsRef<std::path::Path>,
+        options: &ModuleOptions,
+    ) -> Result<Module, Error> {
+        let wasm = std::fs::read(path).map_err(|err| Error::Wasm(err.into()))?;
+        Module::new(&wasm, options)
+    }
+}
+
+/// A unit's store data, which the imports reach through their Caller
+struct State {
+    bridge: Bridge,
+    memory: Option<Memory>,
+    output: Option<Output>,
+    interrupt: Option<Arc<AtomicBool>>,
+    /// Past this, js_interrupt_requested answers yes
+    soft_deadline: Option<Instant>,
+    /// Past this, the next epoch traps
+    hard_deadline: Option<Instant>,
+    timed_out: bool,
+}
+
+enum Compute {
+    Ptr(TypedFunc<(u32, u32), i32>),
+    Len(TypedFunc<u32, i32>),
+}
+
+/// An initialized instance of cu.wasm with its imports bound to a storage.
+/// Units are cheap: instantiation takes a pooling allocator slot and maps
+/// the module's memory image copy-on-write.
+pub struct Unit {
+    module: Module,
+    store: Store<State>,
+    instance: Instance,
+    memory: Memory,
+    compute: Compute,
+    sync_counter: Option<TypedFunc<u32, ()>>,
+    buffer_ptr: u32,
+    buffer_size: u32,
+    time_limit: Option<Duration>,
+    /// A compute is in flight; still set if its future was dropped
+    running: bool,
+    poisoned: bool,
+}
+
+impl Unit {
+    /// Instantiates module over storage and creates its Lua VM, binding
+    /// _home (see Storage::home_table). Several units may share a storage.
+    pub async fn new(
+        module: &Module,
+        storage: Arc<dyn Storage>,
+        options: UnitOptions,
+    ) -> Result<Unit, Error> {
+        let inner = &module.inner;
+        let mut bridge = Bridge::new(storage);
+        bridge.host_blobs = inner.host_blobs;
+        let streaming = options.output.is_some();
+        let mut store = Store::new(
+            &inner.engine,
+            State {
+                bridge,
+                memory: None,
+                output: options.output,
+                interrupt: options.interrupt,
+                soft_deadline: None,
+                hard_deadline: None,
+                timed_out: false,
+            },
+        );
+        // Every epoch yields to the executor, and ends a compute that ran
+        // past its hard deadline
+        store.set_epoch_deadline(1);
+        store.epoch_deadline_callback(|mut ctx| {
+            let state = ctx.data_mut();
+            if state
+                .hard_deadline
+                .is_some_and(|deadline| Instant::now() >= deadline)
+            {
+                state.timed_out = true;
+                return Err(Trap::Interrupt.into());
+            }
+            Ok(UpdateDeadline::Yield(1))
+        });
+
+        let instance = inner.pre.instantiate_async(&mut store).await?;
+        let memory = instance
+            .get_memory(&mut store, "memory")
+            .ok_or_else(|| wasmtime::Error::msg("module does not export memory"))?;
+        store.data_mut().memory = Some(memory);
+        let compute = if inner.compute_ptr {
+            Compute::Ptr(instance.get_typed_func(&mut store, "compute")?)
+        } else {
+            Compute::Len(instance.get_typed_func(&mut store, "compute")?)
+        };
+        let sync_counter = instance
+            .get_typed_func(&mut store, "sync_external_table_counter")
+            .ok();
+
+        let mut unit = Unit {
+            module: module.clone(),
+            store,
+            instance,
+            memory,
+            compute,
+            sync_counter,
+            buffer_ptr: 0,
+            buffer_size: 0,
+            time_limit: options.time_limit,
+            running: false,
+            poisoned: false,
+        };
+        let initialized = unit.init(streaming).await;
+        initialized.map_err(|err| unit.failed(err))?;
+        Ok(unit)
+    }
+
+    async fn init(&mut self, streaming: bool) -> Result<(), wasmtime::Error> {
+        let (instance, store) = (self.instance, &mut self.store);
+        let optional = |store: &mut Store<State>, name: &str| {
+            instance.get_typed_func::<u32, ()>(store, name).ok()
+        };
+
+        // The VM creates _home and _io from its counter during init, so the
+        // unit's block of table IDs is reserved first
+        reserve_table_ids(store, self.sync_counter.as_ref()).await?;
+        let status = instance
+            .get_typed_func::<(), i32>(&mut *store, "init")?
+            .call_async(&mut *store, ())
+            .await?;
+        if status != 0 {
+            return Err(wasmtime::Error::msg(format!("init returned {status}")));
+        }
+
+        if let Ok(exported) = instance.get_typed_func::<(), u32>(&mut *store, "get_memory_table_id")
+        {
+            let exported = exported.call_async(&mut *store, ()).await?;
+            let home = store.data().bridge.storage.bind_home(exported);
+            if home != 0 && home != exported {
+                if let Some(attach) = optional(store, "attach_memory_table") {
+                    attach.call_async(&mut *store, home).await?;
+                }
+            }
+        }
+        if let Some(polling) = optional(store, "set_interrupt_polling") {
+            polling.call_async(&mut *store, 1).await?;
+        }
+        if let Ok(streaming_fn) =
+            instance.get_typed_func::<u32, u32>(&mut *store, "set_output_streaming")
+        {
+            streaming_fn
+                .call_async(&mut *store, if streaming { OUTPUT_CHUNK_BYTES } else { 0 })
+                .await?;
+        }
+
+        let ptr = instance.get_typed_func::<(), u32>(&mut *store, "get_buffer_ptr")?;
+        let size = instance.get_typed_func::<(), u32>(&mut *store, "get_buffer_size")?;
+        self.buffer_ptr = ptr.call_async(&mut *store, ()).await?;
+        self.buffer_size = size.call_async(&mut *store, ()).await?;
+        if self.buffer_ptr == 0 {
+            return Err(wasmtime::Error::msg("module has no I/O buffer"));
+        }
+        Ok(())
+    }
+
+    /// Runs Lua source or a binary chunk and returns the serialized return
+    /// value: a view of linear memory, valid until the unit's next call.
+    ///
+    /// A running compute yields to the executor every epoch. Past its time
+    /// limit, the VM's next interrupt check raises a Lua error; if it does
+    /// not reach one within another half of the limit (at least one epoch),
+    /// the compute is stopped with Error::TimedOut.
+    pub async fn compute(&mut self, code: &[u8]) -> Result<&[u8], Error> {
+        if self.poisoned || self.running {
+            self.poisoned = true;
+            return Err(Error::Poisoned);
+        }
+        if code.len() > self.buffer_size as usize {
+            return Err(Error::TooLarge);
+        }
+        if self.store.data().bridge.refill {
+            let reserved = reserve_table_ids(&mut self.store, self.sync_counter.as_ref()).await;
+            reserved.map_err(|err| self.failed(err))?;
+        }
+
+        let start = self.buffer_ptr as usize;
+        let buffer = self
+            .memory
+            .data_mut(&mut self.store)
+            .get_mut(start..start + code.len())
+            .ok_or(Error::TooLarge)?;
+        buffer.copy_from_slice(code);
+
+        let now = Instant::now();
+        let state = self.store.data_mut();
+        if let Some(limit) = self.time_limit {
+            let grace = (limit / 2).max(self.module.inner.tick);
+            state.soft_deadline = Some(now + limit);
+            state.hard_deadline = Some(now + limit + grace);
+        }
+        self.running = true;
+        let called = match &self.compute {
+            Compute::Ptr(compute) => {
+                compute
+                    .call_async(&mut self.store, (self.buffer_ptr, code.len() as u32))
+                    .await
+            }
+            Compute::Len(compute) => compute.call_async(&mut self.store, code.len() as u32).await,
+        };
+        self.running = false;
+        let state = self.store.data_mut();
+        state.soft_deadline = None;
+        state.hard_deadline = None;
+        let written = called.map_err(|err| self.failed(err))?;
+
+        let size = (written.unsigned_abs() as usize).min(self.buffer_size as usize);
+        let result = &self.memory.data(&self.store)[start..start + size];
+        if written < 0 {
+            return Err(Error::Lua(String::from_utf8_lossy(result).into_owned()));
+        }
+        Ok(result)
+    }
+
+    /// Sets the time limit for later computes; None removes it.
+    pub fn set_time_limit(&mut self, limit: Option<Duration>) {
+        self.time_limit = limit;
+    }
+
+    /// The storage the unit's imports are bound to.
+    pub fn storage(&self) -> &Arc<dyn Storage> {
+        &self.store.data().bridge.storage
+    }
+
+    /// The unit refuses further calls.
+    pub fn is_poisoned(&self) -> bool {
+        self.poisoned || self.running
+    }
+
+    /// Poisons the unit and converts a failed call's error
+    fn failed(&mut self, err: wasmtime::Error) -> Error {
+        self.poisoned = true;
+        if std::mem::take(&mut self.store.data_mut().timed_out) {
+            Error::TimedOut
+        } else {
+            Error::Wasm(err)
+        }
+    }
+}
+
+/// Moves the VM's table counter to a fresh block of IDs, so units sharing
+/// the storage never create the same table
+async fn reserve_table_ids(
+    store: &mut Store<State>,
+    sync: Option<&TypedFunc<u32, ()>>,
+) -> Result<(), wasmtime::Error> {
+    let bridge = &mut store.data_mut().bridge;
+    let base = bridge.storage.reserve_table_ids(TABLE_ID_BLOCK);
+    bridge.table_id_end = base + TABLE_ID_BLOCK;
+    bridge.refill = false;
+    if let Some(sync) = sync {
+        sync.call_async(store, base).await?;
+    }
+    Ok(())
+}
+
+// ------------------------------------------------------------------
+// Imports
+// ------------------------------------------------------------------
+
+fn range(len: usize, ptr: u32, n: u32) -> Option<Range<usize>> {
+    let start = ptr as usize;
+    let end = start.checked_add(n as usize)?;
+    (end <= len).then_some(start..end)
+}
+
+/// Linear memory at (ptr, len), bounds-checked, without copying
+fn view(data: &[u8], ptr: u32, len: u32) -> Option<&[u8]> {
+    data.get(range(data.len(), ptr, len)?)
+}
+
+fn view_mut(data: &mut [u8], ptr: u32, len: u32) -> Option<&mut [u8]> {
+    let range = range(data.len(), ptr, len)?;
+    data.get_mut(range)
+}
+
+/// An input and an output region of linear memory at once; they must not
+/// overlap
+fn view_in_out(
+    data: &mut [u8],
+    input: (u32, u32),
+    output: (u32, u32),
+) -> Option<(&[u8], &mut [u8])> {
+    let input = range(data.len(), input.0, input.1)?;
+    let output = range(data.len(), output.0, output.1)?;
+    if input.end <= output.start {
+        let (head, tail) = data.split_at_mut(output.start);
+        Some((&head[input], &mut tail[..output.len()]))
+    } else if output.end <= input.start {
+        let (head, tail) = data.split_at_mut(input.start);
+        Some((&tail[..input.len()], &mut head[output]))
+    } else {
+        None
+    }
+}
+
+/// The caller's linear memory and unit state
+fn caller_state<'a>(caller: &'a mut Caller<'_, State>) -> Option<(&'a mut [u8], &'a mut State)> {
+    let memory = caller.data().memory?;
+    Some(memory.data_and_store_mut(caller))
+}
+
+fn link_imports(linker: &mut Linker<State>) -> Result<(), wasmtime::Error> {
+    linker.func_wrap("env", "js_time_now", || -> i32 {
+        // Milliseconds, truncated to the import's i32 as the browser host does
+        std::time::SystemTime::now()
+            .duration_since(std::time::UNIX_EPOCH)
+            .map_or(0, |since| since.as_millis() as i32)
+    })?;
+    let start = Instant::now();
+    linker.func_wrap("env", "js_clock_ms", move || -> f64 {
+        start.elapsed().as_secs_f64() * 1e3
+    })?;
+
+    linker.func_wrap(
+        "env",
+        "js_ext_table_set",
+        |mut caller: Caller<'_, State>,
+         table: u32,
+         key_ptr: u32,
+         key_len: u32,
+         value_ptr: u32,
+         value_len: u32|
+         -> i32 {
+            let Some((data, state)) = caller_state(&mut caller) else {
+                return -1;
+            };
+            match (
+                view(data, key_ptr, key_len),
+                view(data, value_ptr, value_len),
+            ) {
+                (Some(key), Some(value)) => state.bridge.set(table, key, value),
+                _ => -1,
+            }
+        },
+    )?;
+    linker.func_wrap(
+        "env",
+        "js_ext_table_set_parts",
+        |mut caller: Caller<'_, State>,
+         table: u32,
+         key_ptr: u32,
+         key_len: u32,
+         head_ptr: u32,
+         head_len: u32,
+         body_ptr: u32,
+         body_len: u32|
+         -> i32 {
+            let Some((data, state)) = caller_state(&mut caller) else {
+                return -1;
+            };
+            match (
+                view(data, key_ptr, key_len),
+                view(data, head_ptr, head_len),
+                view(data, body_ptr, body_len),
+            ) {
+                (Some(key), Some(head), Some(body)) => {
+                    state.bridge.set_parts(table, key, head, body)
+                }
+                _ => -1,
+            }
+        },
+    )?;
+    linker.func_wrap(
+        "env",
+        "js_ext_table_get",
+        |mut caller: Caller<'_, State>,
+         table: u32,
+         key_ptr: u32,
+         key_len: u32,
+         out_ptr: u32,
+         out_len: u32|
+         -> i32 {
+            let Some((data, state)) = caller_state(&mut caller) else {
+                return -1;
+            };
+            match view_in_out(data, (key_ptr, key_len), (out_ptr, out_len)) {
+                Some((key, out)) => state.bridge.get(table, key, out),
+                None => -1,
+            }
+        },
+    )?;
+    linker.func_wrap(
+        "env",
+        "js_ext_table_delete",
+        |mut caller: Caller<'_, State>, table: u32, key_ptr: u32, key_len: u32| -> i32 {
+            let Some((data, state)) = caller_state(&mut caller) else {
+                return -1;
+            };
+            match view(data, key_ptr, key_len) {
+                Some(key) => state.bridge.delete(table, key),
+                None => -1,
+            }
+        },
+    )?;
+    linker.func_wrap(
+        "env",
+        "js_ext_table_size",
+        |caller: Caller<'_, State>, table: u32| -> u32 { caller.data().bridge.size(table) },
+    )?;
+    linker.func_wrap(
+        "env",
+        "js_ext_table_keys",
+        |mut caller: Caller<'_, State>, table: u32, out_ptr: u32, out_len: u32| -> i32 {
+            let Some((data, state)) = caller_state(&mut caller) else {
+                return -1;
+            };
+            match view_mut(data, out_ptr, out_len) {
+                Some(out) => state.bridge.keys(table, out),
+                None => -1,
+            }
+        },
+    )?;
+    linker.func_wrap(
+        "env",
+        "js_ext_table_next",
+        |mut caller: Caller<'_, State>,
+         table: u32,
+         cursor: u32,
+         out_ptr: u32,
+         out_len: u32|
+         -> i32 {
+            let Some((data, state)) = caller_state(&mut caller) else {
+                return -1;
+            };
+            match view_mut(data, out_ptr, out_len) {
+                Some(out) => state.bridge.next(table, cursor, out),
+                None => -1,
+            }
+        },
+    )?;
+    linker.func_wrap(
+        "env",
+        "js_ext_table_set_many",
+        |mut caller: Caller<'_, State>, table: u32, frames_ptr: u32, frames_len: u32| -> i32 {
+            let Some((data, state)) = caller_state(&mut caller) else {
+                return -1;
+            };
+            match view(data, frames_ptr, frames_len) {
+                Some(frames) => state.bridge.set_many(table, frames),
+                None => -1,
+            }
+        },
+    )?;
+    linker.func_wrap(
+        "env",
+        "js_ext_table_get_many",
+        |mut caller: Caller<'_, State>,
+         table: u32,
+         keys_ptr: u32,
+         keys_len: u32,
+         out_ptr: u32,
+         out_len: u32|
+         -> i32 {
+            let Some((data, state)) = caller_state(&mut caller) else {
+                return -1;
+            };
+            match view_in_out(data, (keys_ptr, keys_len), (out_ptr, out_len)) {
+                Some((keys, out)) => state.bridge.get_many(table, keys, out),
+                None => -1,
+            }
+        },
+    )?;
+    // Range scans (ext.range, ext.rrange) are not supported by this host:
+    // ordering is a no-op and every range is empty
+    linker.func_wrap("env", "js_ext_table_order", |_: u32| -> i32 { 0 })?;
+    linker.func_wrap(
+        "env",
+        "js_ext_table_range",
+        |_: u32, _: u32, _: u32, _: u32, _: u32, _: u32, _: u32| -> i32 { 0 },
+    )?;
+    // Nor are secondary indexes (ext.index, ext.lookup): no lookup matches
+    linker.func_wrap("env", "js_ext_table_index", |_: u32, _: u32, _: u32| -> i32 { 0 })?;
+    linker.func_wrap(
+        "env",
+        "js_ext_table_lookup",
+        |_: u32, _: u32, _: u32, _: u32, _: u32, _: u32| -> i32 { 0 },
+    )?;
+    // Nor are transactions (ext.transaction): they fail
+    linker.func_wrap("env", "js_ext_transaction", |_: u32| -> i32 { -1 })?;
+    // Nor are cache tables (ext.cache): they are unbounded here
+    linker.func_wrap("env", "js_ext_table_cache", |_: u32, _: u32, _: f64| -> i32 { 0 })?;
+    // Nor are negative-lookup filters: every miss reads the table
+    linker.func_wrap("env", "js_ext_table_filter", |_: u32, _: u32, _: u32| -> i32 { -1 })?;
+    // Nor are columnar tables (ext.columns, ext.column): both fail
+    linker.func_wrap("env", "js_ext_table_columns", |_: u32, _: u32, _: u32| -> i32 { -1 })?;
+    linker.func_wrap(
+        "env",
+        "js_ext_table_column",
+        |_: u32, _: u32, _: u32, _: u32, _: u32, _: u32, _: u32| -> i32 { -1 },
+    )?;
+    // Nor are array tables (ext.array, ext.push, ext.pop, ext.slice): they fail
+    linker.func_wrap("env", "js_ext_table_array", |_: u32| -> i32 { -1 })?;
+    linker.func_wrap("env", "js_ext_table_push", |_: u32, _: u32, _: u32| -> i32 { -1 })?;
+    linker.func_wrap("env", "js_ext_table_pop", |_: u32, _: u32, _: u32| -> i32 { -1 })?;
+    linker.func_wrap(
+        "env",
+        "js_ext_table_slice",
+        |_: u32, _: u32, _: u32, _: u32, _: u32| -> i32 { -1 },
+    )?;
+    // Keys stay in the default decimal encoding, which never interns
+    linker.func_wrap(
+        "env",
+        "js_ext_key_intern",
+        |_: u32, _: u32, _: u32| -> i32 { -1 },
+    )?;
+    linker.func_wrap(
+        "env",
+        "js_blob_read",
+        |mut caller: Caller<'_, State>,
+         handle: u32,
+         offset: u32,
+         out_ptr: u32,
+         out_len: u32|
+         -> i32 {
+            let Some((data, state)) = caller_state(&mut caller) else {
+                return -1;
+            };
+            match view_mut(data, out_ptr, out_len) {
+                Some(out) => state.bridge.blob_read(handle, offset, out),
+                None => -1,
+            }
+        },
+    )?;
+    linker.func_wrap(
+        "env",
+        "js_blob_release",
+        |mut caller: Caller<'_, State>, handle: u32| {
+            caller.data_mut().bridge.blob_release(handle);
+        },
+    )?;
+    linker.func_wrap(
+        "env",
+        "js_interrupt_requested",
+        |caller: Caller<'_, State>| -> i32 {
+            let state = caller.data();
+            let interrupted = state
+                .soft_deadline
+                .is_some_and(|deadline| Instant::now() >= deadline)
+                || state
+                    .interrupt
+                    .as_ref()
+                    .is_some_and(|flag| flag.load(Ordering::Relaxed));
+            i32::from(interrupted)
+        },
+    )?;
+    linker.func_wrap(
+        "env",
+        "js_write_output",
+        |mut caller: Caller<'_, State>, text_ptr: u32, text_len: u32| {
+            let Some((data, state)) = caller_state(&mut caller) else {
+                return;
+            };
+            if let (Some(output), Some(text)) =
+                (state.output.as_mut(), view(data, text_ptr, text_len))
+            {
+                output(text);
+            }
+        },
+    )?;
+    Ok(())
+}
@@ -0,0 +1,126 @@
+//! Tests that run cu.wasm: web/cu.wasm, or the file named by CU_WASM
+#![cfg(feature = "runtime")]
+
+use std::path::PathBuf;
+use std::sync::atomic::AtomicBool;
+use std::sync::Arc;
+use std::time::Duration;
+
+use cu_host::{Error, MemoryStore, Module, ModuleOptions, Storage, Unit, UnitOptions};
+
+fn load_module() -> Option<Module> {
+    let path = std::env::var_os("CU_WASM")
+        .map(PathBuf::from)
+        .unwrap_or_else(|| PathBuf::from(env!("CARGO_MANIFEST_DIR")).join("../../web/cu.wasm"));
+    if !path.exists() {
+        eprintln!(
+            "no cu.wasm at {} (build it, or set CU_WASM)",
+            path.display()
+        );
+        return None;
+    }
+    let options = ModuleOptions {
+        max_units: 16,
+        ..ModuleOptions::default()
+    };
+    Some(Module::from_file(&path, &options).expect("compile cu.wasm"))
+}
+
+async fn new_unit(module: &Module, store: Arc<MemoryStore>) -> Unit {
+    Unit::new(module, store, UnitOptions::default())
+        .await
+        .expect("new unit")
+}
+
+#[tokio::test]
+async fn compute() {
+    let Some(module) = load_module() else { return };
+    let mut unit = new_unit(&module, Arc::new(MemoryStore::new())).await;
+
+    let result = unit.compute(b"return 1 + 1").await.expect("compute");
+    assert!(!result.is_empty());
+    assert!(matches!(
+        unit.compute(b"error('boom')").await,
+        Err(Error::Lua(_))
+    ));
+    // A Lua error leaves the unit usable
+    unit.compute(b"return 2")
+        .await
+        .expect("compute after error");
+}
+
+#[tokio::test]
+async fn units_share_home() {
+    let Some(module) = load_module() else { return };
+    let store = Arc::new(MemoryStore::new());
+    let mut first = new_unit(&module, store.clone()).await;
+    let mut second = new_unit(&module, store.clone()).await;
+
+    first.compute(b"_home.counter = 41").await.expect("set");
+    let home = store.home_table();
+    assert!(home != 0);
+    assert_eq!(store.len(home), Some(1));
+    second
+        .compute(b"if _home.counter ~= 41 then error('not shared') end")
+        .await
+        .expect("shared _home");
+}
+
+#[tokio::test(flavor = "multi_thread", worker_threads = 4)]
+async fn concurrent_units() {
+    let Some(module) = load_module() else { return };
+    let store = Arc::new(MemoryStore::new());
+    let mut tasks = Vec::new();
+    for worker in 0..8 {
+        let (module, store) = (module.clone(), store.clone());
+        tasks.push(tokio::spawn(async move {
+            let mut unit = new_unit(&module, store).await;
+            let code = format!("_home['worker{worker}'] = {{ n = {worker} }}; return {worker}");
+            unit.compute(code.as_bytes())
+                .await
+                .map(|result| result.len())
+        }));
+    }
+    for task in tasks {
+        task.await.expect("join").expect("compute");
+    }
+    assert_eq!(store.len(store.home_table()), Some(8));
+}
+
+#[tokio::test]
+async fn interrupt() {
+    let Some(module) = load_module() else { return };
+    let flag = Arc::new(AtomicBool::new(true));
+    let options = UnitOptions {
+        interrupt: Some(flag.clone()),
+        // A backstop for builds without interrupt polling
+        time_limit: Some(Duration::from_secs(2)),
+        ..UnitOptions::default()
+    };
+    let mut unit = Unit::new(&module, Arc::new(MemoryStore::new()), options)
+        .await
+        .expect("new unit");
+    match unit.compute(b"while true do end").await {
+        Err(Error::Lua(_)) => {}
+        Err(Error::TimedOut) => eprintln!("cu.wasm does not poll for interrupts"),
+        Ok(_) => unreachable!(),
+        Err(err) => panic!("{err}"),
+    }
+}
+
+#[tokio::test]
+async fn time_limit() {
+    let Some(module) = load_module() else { return };
+    let mut unit = new_unit(&module, Arc::new(MemoryStore::new())).await;
+    unit.set_time_limit(Some(Duration::from_millis(50)));
+    // Interrupted by the VM's polling, or stopped at the next epoch after
+    // the grace period on builds without it
+    match unit.compute(b"while true do end").await {
+        Err(Error::Lua(_)) => unit.compute(b"return 1").await.map(|_| ()).expect("usable"),
+        Err(Error::TimedOut) => assert!(matches!(
+            unit.compute(b"return 1").await,
+            Err(Error::Poisoned)
+        )),
+        other => panic!("{:?}", other.map(|result| result.len())),
+    }
+}
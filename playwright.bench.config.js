@@ -0,0 +1,26 @@
+const { defineConfig, devices } = require('@playwright/test');
+
+// Browser benchmarks (scripts/bench-browser.spec.js): npm run bench:browser
+export default defineConfig({
+  testDir: './scripts',
+  testMatch: 'bench-browser.spec.js',
+  timeout: 120000,
+  fullyParallel: false,
+  retries: 0,
+  workers: 1,
+  reporter: [['list']],
+  use: {
+    baseURL: 'http://localhost:8000',
+  },
+  webServer: {
+    command: 'cd web && python3 -m http.server 8000',
+    port: 8000,
+    reuseExistingServer: true,
+    timeout: 120000,
+  },
+  projects: [
+    { name: 'chromium', use: { ...devices['Desktop Chrome'] } },
+    { name: 'firefox', use: { ...devices['Desktop Firefox'] } },
+    { name: 'webkit', use: { ...devices['Desktop Safari'] } },
+  ],
+});
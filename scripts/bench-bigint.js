@@ -0,0 +1,107 @@
+#!/usr/bin/env node
+/**
+ * Bigint modular arithmetic benchmark
+ *
+ * Times base^e mod m for 256-bit operands two ways: bigint.powmod, which
+ * keeps odd moduli in Montgomery form inside src/bignum.zig, and the
+ * square-and-multiply loop scripts had to write before it, which makes a
+ * bigint for every mul and % step. Also times modinv against Fermat's
+ * inverse in Lua. Pass several builds to compare them:
+ *
+ *   node scripts/bench-bigint.js /tmp/cu-old.wasm web/cu.wasm
+ *
+ * Usage: node scripts/bench-bigint.js [a.wasm b.wasm ...]
+ */
+
+const fs = require('fs');
+const path = require('path');
+
+const TARGET_MS = 300;
+
+const SETUP = `
+  local bigint = require('bigint')
+  local p = bigint.new("57896044618658097711785492504343953926634992332820282019728792003956564819949")
+  local base = bigint.new("1234567890abcdef1234567890abcdef1234567890abcdef1234567890abcdef", 16)
+  local e = p - bigint.new(2)
+  local function lua_powmod(b, e, m)
+    local result, x = bigint.new(1), b % m
+    local bits = e:tostring(2)
+    for i = 1, #bits do
+      result = result * result % m
+      if bits:sub(i, i) == "1" then result = result * x % m end
+    end
+    return result
+  end
+`;
+
+const WORKLOADS = [
+  ['powmod 256-bit (Lua loop)', `${SETUP}
+    return tostring(lua_powmod(base, e, p))`],
+  ['powmod 256-bit (native)', `${SETUP}
+    return tostring(base:powmod(e, p))`],
+  ['inverse 256-bit (Lua Fermat)', `${SETUP}
+    return tostring(lua_powmod(base, e, p))`],
+  ['inverse 256-bit (modinv)', `${SETUP}
+    return tostring(base:modinv(p))`],
+];
+
+// Mean ms per run, or null if the build could not run the workload
+function timeRun(instance, code) {
+  try {
+    for (let i = 0; i < 3; i++) instance.compute(code);
+    let runs = 0;
+    const start = performance.now();
+    let elapsed = 0;
+    while (elapsed < TARGET_MS) {
+      if (instance.compute(code) < 0) return null;
+      runs++;
+      elapsed = performance.now() - start;
+    }
+    return elapsed / runs;
+  } catch {
+    // Older builds trap on Lua errors, such as calling a missing powmod
+    return null;
+  }
+}
+
+async function main() {
+  const { CuInstance } = await import('../web/cu-instance.js');
+  const builds = process.argv.slice(2);
+  if (builds.length === 0) builds.push(path.join(__dirname, '../web/cu.wasm'));
+
+  const results = [];
+  for (const file of builds) {
+    const module = await WebAssembly.compile(fs.readFileSync(file));
+    const times = [];
+    for (const [, code] of WORKLOADS) {
+      const instance = new CuInstance();
+      instance.instantiate(module);
+      instance.init();
+      times.push(timeRun(instance, code));
+    }
+    results.push({ file: path.basename(file), times });
+  }
+
+  const width = Math.max(...WORKLOADS.map(([name]) => name.length));
+  console.log(`${''.padEnd(width)}  ${results.map((r) => r.file.padStart(22)).join('')}`);
+  WORKLOADS.forEach(([name], i) => {
+    const cells = results.map((r) => {
+      const time = r.times[i];
+      return (time === null ? 'failed' : `${time.toFixed(3)} ms`).padStart(22);
+    });
+    console.log(`${name.padEnd(width)}  ${cells.join('')}`);
+  });
+
+  // Native against the Lua loop within each build
+  for (const r of results) {
+    const [loop, native, fermat, modinv] = r.times;
+    if (loop !== null && native !== null && fermat !== null && modinv !== null) {
+      console.log(`${r.file}: powmod ${(loop / native).toFixed(1)}x, modinv ${(fermat / modinv).toFixed(1)}x faster than Lua`);
+    }
+  }
+}
+
+main().catch((error) => {
+  console.error('Benchmark failed:', error);
+  process.exit(1);
+});
@@ -0,0 +1,266 @@
+/**
+ * Browser benchmark suite
+ *
+ * Times what a page pays that Node does not: fetching and compiling the
+ * module, and saving state through structured clone into IndexedDB. Run by
+ * Playwright in Chromium, Firefox and WebKit (playwright.bench.config.js):
+ *
+ *   npx playwright install chromium firefox webkit
+ *   npm run bench:browser
+ *   npm run bench:browser -- --project=firefox
+ *   CU_BENCH_SIZES=1,10 CU_BENCH_RUNS=5 npm run bench:browser
+ *
+ * Workloads:
+ * - load() cold, in a fresh browser context with nothing cached, and warm,
+ *   in the same page with the compiled module reused (cacheModule) and
+ *   recompiled from the HTTP cache (cacheModule: false)
+ * - saveState() and loadState() with a _home of 1MB, 10MB and 100MB
+ *   (CU_BENCH_SIZES), made of 1KB values; of that, the time inside
+ *   LuaPersistence (packing plus the IndexedDB transaction), and
+ *   structuredClone() of the packed record on its own
+ * - One IndexedDB put and get of a buffer of the same size, outside Cu
+ *
+ * Each workload runs CU_BENCH_RUNS times (3). The results go to
+ * bench-results/browser-<project>.json (CU_BENCH_OUT for another
+ * directory), with each workload's { ms, min, runs } as the mean and
+ * fastest run, or null for a workload the browser could not run, such as
+ * a save over its storage quota. scripts/bench.js has the Node figures.
+ */
+
+const { test } = require('@playwright/test');
+const fs = require('fs');
+const path = require('path');
+
+const SIZES_MB = (process.env.CU_BENCH_SIZES || '1,10,100').split(',').map(Number).filter((mb) => mb > 0);
+const RUNS = Math.max(1, Number(process.env.CU_BENCH_RUNS) || 3);
+const OUT_DIR = process.env.CU_BENCH_OUT || path.join(__dirname, '../bench-results');
+const VALUE_BYTES = 1024;
+
+const results = {};
+
+test.describe.configure({ mode: 'serial' });
+
+// A blank page on the server's origin, so the page can import web/ modules
+// and nothing loads a VM before the benchmark does
+async function openBlank(page) {
+  await page.route('**/bench-blank.html', (route) => route.fulfill({
+    contentType: 'text/html',
+    body: '<!doctype html><title>Cu benchmark</title>',
+  }));
+  await page.goto('/bench-blank.html');
+}
+
+// { ms, min, runs } from per-run times
+function summarize(samples) {
+  if (!samples || samples.length === 0) return null;
+  return {
+    ms: samples.reduce((sum, ms) => sum + ms, 0) / samples.length,
+    min: Math.min(...samples),
+    runs: samples.length,
+  };
+}
+
+function record(name, samples) {
+  results[name] = summarize(samples);
+  const time = results[name];
+  console.log(`${name}: ${time === null ? 'failed' : `${time.ms.toFixed(2)} ms (min ${time.min.toFixed(2)})`}`);
+}
+
+// Runs in the page: one load(), timed with its compile and instantiate
+// split from the 'load' metric
+async function timeLoad(options) {
+  const { CuInstance } = await import('./cu-instance.js');
+  const { onMetric } = await import('./cu-log.js');
+  let split = null;
+  onMetric((metric) => {
+    if (metric.name === 'load') split = metric;
+  });
+  const start = performance.now();
+  const instance = new CuInstance();
+  await instance.load({ autoRestore: false, ...options });
+  const loaded = performance.now();
+  instance.init();
+  if (instance.compute('return 1') < 0) throw new Error('compute failed');
+  const ready = performance.now();
+  onMetric(null);
+  return {
+    load: loaded - start,
+    compile: split.compileMs,
+    instantiate: split.instantiateMs,
+    ready: ready - start,
+  };
+}
+
+test('load() cold', async ({ browser }) => {
+  const samples = { load: [], compile: [], instantiate: [], ready: [], import: [] };
+  for (let run = 0; run < RUNS; run++) {
+    // A new context starts with empty HTTP and module caches
+    const context = await browser.newContext();
+    const page = await context.newPage();
+    await openBlank(page);
+    samples.import.push(await page.evaluate(async () => {
+      const start = performance.now();
+      await import('./cu-instance.js');
+      return performance.now() - start;
+    }));
+    const times = await page.evaluate(timeLoad, {});
+    for (const [name, ms] of Object.entries(times)) samples[name].push(ms);
+    await context.close();
+  }
+  record('import cu-instance.js cold', samples.import);
+  record('load() cold', samples.load);
+  record('load() cold: compile', samples.compile);
+  record('load() cold: instantiate', samples.instantiate);
+  record('load() + init() + compute() cold', samples.ready);
+});
+
+test('load() warm', async ({ page }) => {
+  await openBlank(page);
+  await page.evaluate(timeLoad, {});
+  for (const [name, options] of [
+    ['load() warm', {}],
+    ['load() warm, recompiled from HTTP cache', { cacheModule: false }],
+  ]) {
+    const samples = { load: [], compile: [], instantiate: [], ready: [] };
+    for (let run = 0; run < RUNS; run++) {
+      const times = await page.evaluate(timeLoad, options);
+      for (const [part, ms] of Object.entries(times)) samples[part].push(ms);
+    }
+    record(name, samples.load);
+    record(`${name}: compile`, samples.compile);
+    record(`${name}: instantiate`, samples.instantiate);
+  }
+});
+
+for (const mb of SIZES_MB) {
+  test(`saveState/loadState _home ${mb}MB`, async ({ page }) => {
+    test.setTimeout(Math.max(120000, mb * 6000 * RUNS));
+    await openBlank(page);
+    let times = null;
+    try {
+      times = await page.evaluate(async ({ mb, runs, valueBytes }) => {
+        const { CuInstance } = await import('./cu-instance.js');
+        const { LuaPersistence } = await import('./cu-persistence.js');
+
+        // Time LuaPersistence's reads and writes: packing plus the
+        // IndexedDB transaction, without the instance's share
+        const persistence = new LuaPersistence(`cu-bench-${mb}`);
+        const inside = { writeTables: [], loadTables: [] };
+        for (const name of Object.keys(inside)) {
+          const fn = persistence[name].bind(persistence);
+          persistence[name] = async (...args) => {
+            const start = performance.now();
+            try {
+              return await fn(...args);
+            } finally {
+              inside[name].push(performance.now() - start);
+            }
+          };
+        }
+
+        const instance = new CuInstance({ persistence });
+        await instance.load({ autoRestore: false });
+        instance.init();
+        await instance.clearPersistedState();
+
+        const entries = Math.ceil((mb * 1024 * 1024) / valueBytes);
+        for (let first = 1; first <= entries; first += 10000) {
+          const last = Math.min(entries, first + 9999);
+          const code = `local v = string.rep("x", ${valueBytes}) for i = ${first}, ${last} do _home[i] = v end`;
+          if (instance.compute(code) < 0) throw new Error('filling _home failed');
+        }
+
+        const save = [];
+        const load = [];
+        for (let run = 0; run < runs; run++) {
+          // One write marks _home changed, so every save rewrites it
+          instance.compute('_home.tick = (_home.tick or 0) + 1');
+          let start = performance.now();
+          if (!(await instance.saveState())) throw new Error('saveState failed');
+          save.push(performance.now() - start);
+          start = performance.now();
+          if (!(await instance.loadState())) throw new Error('loadState failed');
+          load.push(performance.now() - start);
+        }
+
+        // structuredClone of _home packed as LuaPersistence stores it
+        const home = instance.externalTables.get(instance.homeTableId);
+        const keys = [];
+        const offsets = [0];
+        for (const [key, value] of home) {
+          keys.push(key);
+          offsets.push(offsets[offsets.length - 1] + value.byteLength);
+        }
+        const bytes = new Uint8Array(offsets[offsets.length - 1]);
+        let i = 0;
+        for (const [, value] of home) bytes.set(value, offsets[i++]);
+        const packed = { id: instance.homeTableId, keys, offsets: Uint32Array.from(offsets), bytes: bytes.buffer };
+        const clone = [];
+        for (let run = 0; run < runs; run++) {
+          const start = performance.now();
+          structuredClone(packed);
+          clone.push(performance.now() - start);
+        }
+
+        await instance.clearPersistedState();
+        persistence.db?.close();
+        indexedDB.deleteDatabase(persistence.dbName);
+
+        // One buffer of the same size through IndexedDB, outside Cu
+        const db = await new Promise((resolve, reject) => {
+          const request = indexedDB.open(`cu-bench-idb-${mb}`, 1);
+          request.onupgradeneeded = () => request.result.createObjectStore('blobs', { keyPath: 'id' });
+          request.onsuccess = () => resolve(request.result);
+          request.onerror = () => reject(request.error);
+        });
+        const transact = (mode, op) => new Promise((resolve, reject) => {
+          const transaction = db.transaction(['blobs'], mode);
+          const request = op(transaction.objectStore('blobs'));
+          transaction.oncomplete = () => resolve(request.result);
+          transaction.onerror = () => reject(transaction.error);
+          transaction.onabort = () => reject(transaction.error || new Error('Transaction aborted'));
+        });
+        const buffer = new Uint8Array(mb * 1024 * 1024).fill(120).buffer;
+        const put = [];
+        const get = [];
+        for (let run = 0; run < runs; run++) {
+          let start = performance.now();
+          await transact('readwrite', (store) => store.put({ id: 1, bytes: buffer }));
+          put.push(performance.now() - start);
+          start = performance.now();
+          await transact('readonly', (store) => store.get(1));
+          get.push(performance.now() - start);
+        }
+        db.close();
+        indexedDB.deleteDatabase(`cu-bench-idb-${mb}`);
+
+        return { save, load, write: inside.writeTables, read: inside.loadTables, clone, put, get };
+      }, { mb, runs: RUNS, valueBytes: VALUE_BYTES });
+    } catch (error) {
+      console.log(`_home ${mb}MB failed: ${error.message.split('\n')[0]}`);
+    }
+    record(`saveState _home ${mb}MB`, times?.save);
+    record(`saveState _home ${mb}MB: LuaPersistence write`, times?.write);
+    record(`loadState _home ${mb}MB`, times?.load);
+    record(`loadState _home ${mb}MB: LuaPersistence read`, times?.read);
+    record(`structuredClone packed _home ${mb}MB`, times?.clone);
+    record(`IndexedDB put ${mb}MB buffer`, times?.put);
+    record(`IndexedDB get ${mb}MB buffer`, times?.get);
+  });
+}
+
+test.afterAll(async ({ browser }, testInfo) => {
+  const { version } = require('../package.json');
+  const file = path.join(OUT_DIR, `browser-${testInfo.project.name}.json`);
+  fs.mkdirSync(OUT_DIR, { recursive: true });
+  fs.writeFileSync(file, `${JSON.stringify({
+    version,
+    browser: testInfo.project.name,
+    browserVersion: browser.version(),
+    date: new Date().toISOString(),
+    runs: RUNS,
+    valueBytes: VALUE_BYTES,
+    workloads: results,
+  }, null, 2)}\n`);
+  console.log(`Results written to ${path.relative(process.cwd(), file)}`);
+});
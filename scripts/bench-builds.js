@@ -0,0 +1,77 @@
+#!/usr/bin/env node
+/**
+ * Build variant benchmark
+ *
+ * Compares the builds build.sh makes: web/cu.wasm and, where they have been
+ * built, web/cu-small.wasm (CU_BUILD=small), web/cu-fast.wasm
+ * (CU_BUILD=fast) and web/cu-64.wasm (CU_BUILD=wasm64). For each it reports
+ * the size as shipped and gzipped, the time to compile the module and the
+ * time to instantiate and init() a unit, then runs the interpreter workloads
+ * of bench-vm.js on all of them.
+ *
+ *   ./build.sh && CU_BUILD=small ./build.sh && CU_BUILD=fast ./build.sh
+ *   npm run bench:builds
+ *
+ * Node before 24 needs --experimental-wasm-memory64 for cu-64.wasm:
+ *
+ *   node --experimental-wasm-memory64 scripts/bench-builds.js
+ *
+ * Usage: node scripts/bench-builds.js [a.wasm b.wasm ...]
+ */
+
+const fs = require('fs');
+const path = require('path');
+const zlib = require('zlib');
+const { execFileSync } = require('child_process');
+
+const RUNS = 20;
+
+function median(values) {
+  const sorted = [...values].sort((a, b) => a - b);
+  return sorted[Math.floor(sorted.length / 2)];
+}
+
+async function main() {
+  const { CuInstance } = await import('../web/cu-instance.js');
+  let builds = process.argv.slice(2);
+  if (builds.length === 0) {
+    builds = ['cu.wasm', 'cu-small.wasm', 'cu-fast.wasm', 'cu-64.wasm']
+      .map((name) => path.join(__dirname, '../web', name))
+      .filter((file) => fs.existsSync(file));
+  }
+
+  console.log(`${'build'.padEnd(16)}${'size'.padStart(12)}${'gzip'.padStart(12)}${'compile'.padStart(12)}${'init'.padStart(12)}`);
+  for (const file of builds) {
+    const bytes = fs.readFileSync(file);
+    const compile = [];
+    const init = [];
+    let module;
+    for (let i = 0; i < RUNS; i++) {
+      let start = performance.now();
+      module = await WebAssembly.compile(bytes);
+      compile.push(performance.now() - start);
+      start = performance.now();
+      const instance = new CuInstance();
+      instance.instantiate(module);
+      instance.init();
+      init.push(performance.now() - start);
+    }
+    const kb = (n) => `${(n / 1024).toFixed(0)} KB`;
+    const ms = (n) => `${n.toFixed(2)} ms`;
+    console.log(
+      path.basename(file).padEnd(16) +
+        kb(bytes.length).padStart(12) +
+        kb(zlib.gzipSync(bytes, { level: 9 }).length).padStart(12) +
+        ms(median(compile)).padStart(12) +
+        ms(median(init)).padStart(12)
+    );
+  }
+
+  console.log('');
+  execFileSync(process.execPath, [...process.execArgv, path.join(__dirname, 'bench-vm.js'), ...builds], { stdio: 'inherit' });
+}
+
+main().catch((error) => {
+  console.error('Benchmark failed:', error);
+  process.exit(1);
+});
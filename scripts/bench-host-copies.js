@@ -0,0 +1,117 @@
+#!/usr/bin/env node
+/**
+ * Host copy-path benchmark
+ *
+ * Compares the per-byte loops the JS host used to move data in and out of
+ * linear memory against Uint8Array.set / TextEncoder.encodeInto, then runs
+ * _home set/get round trips end to end through the current host code.
+ *
+ * Usage: node scripts/bench-host-copies.js
+ */
+
+const { loadWasm, init, compute, reset } = require('../tests/node-test-utils');
+
+const SIZES = [1024, 16 * 1024, 60 * 1024];
+const TARGET_MS = 200;
+
+// _home values travel through a quarter of the 64 KB I/O buffer, minus the
+// 5-byte string header
+const EXT_VALUE_MAX = 16 * 1024 - 5;
+
+function measure(fn, bytesPerOp, maxOps = Infinity) {
+  // Warm up, then run for roughly TARGET_MS (or maxOps)
+  for (let i = 0; i < Math.min(50, maxOps); i++) fn();
+  let ops = 0;
+  const start = process.hrtime.bigint();
+  let elapsed = 0;
+  while (elapsed < TARGET_MS && ops < maxOps) {
+    const batch = Math.min(100, maxOps - ops);
+    for (let i = 0; i < batch; i++) fn();
+    ops += batch;
+    elapsed = Number(process.hrtime.bigint() - start) / 1e6;
+  }
+  return (ops * bytesPerOp) / (elapsed / 1000);
+}
+
+function formatRate(bytesPerSec) {
+  if (bytesPerSec >= 1e9) return `${(bytesPerSec / 1e9).toFixed(2)} GB/s`;
+  if (bytesPerSec >= 1e6) return `${(bytesPerSec / 1e6).toFixed(1)} MB/s`;
+  return `${(bytesPerSec / 1e3).toFixed(1)} KB/s`;
+}
+
+function row(label, legacy, current) {
+  const speedup = current / legacy;
+  console.log(
+    `  ${label.padEnd(10)} ${formatRate(legacy).padStart(12)} ${formatRate(current).padStart(12)} ${speedup.toFixed(1).padStart(7)}x`
+  );
+}
+
+function benchKernels() {
+  const memory = new Uint8Array(new WebAssembly.Memory({ initial: 32 }).buffer);
+  const encoder = new TextEncoder();
+  const ptr = 4096;
+
+  console.log('Raw copies into linear memory (legacy loop vs bulk)');
+  console.log(`  ${'payload'.padEnd(10)} ${'legacy'.padStart(12)} ${'bulk'.padStart(12)} ${'speedup'.padStart(8)}`);
+  for (const size of SIZES) {
+    const bytes = new Uint8Array(size).fill(0x61);
+    const legacy = measure(() => {
+      for (let i = 0; i < bytes.length; i++) memory[ptr + i] = bytes[i];
+    }, size);
+    const bulk = measure(() => memory.set(bytes, ptr), size);
+    row(`${size / 1024}KB`, legacy, bulk);
+  }
+
+  console.log('\nString submission (encode + loop vs encodeInto)');
+  console.log(`  ${'payload'.padEnd(10)} ${'legacy'.padStart(12)} ${'encodeInto'.padStart(12)} ${'speedup'.padStart(8)}`);
+  for (const size of SIZES) {
+    const text = 'x'.repeat(size);
+    const legacy = measure(() => {
+      const encoded = encoder.encode(text);
+      for (let i = 0; i < encoded.length; i++) memory[ptr + i] = encoded[i];
+    }, size);
+    const direct = measure(() => encoder.encodeInto(text, memory.subarray(ptr, ptr + size)), size);
+    row(`${size / 1024}KB`, legacy, direct);
+  }
+}
+
+// Each round trip is a full compute(); keep the count modest and start each
+// phase on a fresh instance so builds with a small fixed heap are not
+// exhausted mid-run
+const EXT_MAX_OPS = 100;
+
+async function freshInstance(valueLen) {
+  reset();
+  await loadWasm();
+  init();
+  compute(`payload = string.rep("x", ${valueLen})`);
+  compute('_home.blob = payload');
+}
+
+async function benchExtTable() {
+  console.log('\n_home set/get round trips through Lua (current host)');
+  for (const size of SIZES) {
+    const valueLen = Math.min(size, EXT_VALUE_MAX);
+    let setRate;
+    let getRate;
+    try {
+      await freshInstance(valueLen);
+      setRate = measure(() => compute('_home.blob = payload'), valueLen, EXT_MAX_OPS);
+      await freshInstance(valueLen);
+      getRate = measure(() => compute('return #_home.blob'), valueLen, EXT_MAX_OPS);
+    } catch (error) {
+      // Older cu.wasm builds trap instead of raising a Lua error when the
+      // heap runs out; report it and keep going with the next size
+      console.log(`  ${`${size / 1024}KB`.padEnd(10)} skipped (${error.message})`);
+      continue;
+    }
+    const note = valueLen < size ? ` (capped at ${valueLen} B by the ext-table value window)` : '';
+    console.log(`  ${`${size / 1024}KB`.padEnd(10)} set ${formatRate(setRate).padStart(12)}   get ${formatRate(getRate).padStart(12)}${note}`);
+  }
+}
+
+benchKernels();
+benchExtTable().catch((error) => {
+  console.error('Benchmark failed:', error);
+  process.exit(1);
+});
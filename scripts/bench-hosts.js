@@ -0,0 +1,80 @@
+#!/usr/bin/env node
+/**
+ * JS host side of the host comparison
+ *
+ * Runs the workloads of host/go's benchmarks (go test -bench . in host/go)
+ * through CuInstance and prints them in the same units, so the Go host can
+ * be compared with this one: unit startup (instantiate + init), a trivial
+ * compute, and _home set/get round trips.
+ *
+ * Usage: node scripts/bench-hosts.js
+ */
+
+const fs = require('fs');
+const path = require('path');
+
+const WASM_PATH = path.join(__dirname, '../web/cu.wasm');
+const TARGET_MS = 1000;
+// Each compute phase starts on a fresh instance and stays modest, so builds
+// with a small fixed heap are not exhausted mid-run (as in
+// bench-host-copies.js)
+const COMPUTE_MAX_OPS = 200;
+// As in host/go/bench_test.go; the larger one fills the ext-table value window
+const PAYLOAD_SIZES = [1024, 16 * 1024 - 5];
+
+function measure(fn, maxOps = Infinity) {
+  for (let i = 0; i < 20; i++) fn();
+  let ops = 0;
+  const start = process.hrtime.bigint();
+  let elapsed = 0;
+  while (elapsed < TARGET_MS && ops < maxOps) {
+    for (let i = 0; i < 20; i++) fn();
+    ops += 20;
+    elapsed = Number(process.hrtime.bigint() - start) / 1e6;
+  }
+  return (elapsed * 1e6) / ops;
+}
+
+function report(name, nsPerOp, bytes) {
+  const rate = bytes ? `  ${((bytes / nsPerOp) * 1e3).toFixed(2).padStart(10)} MB/s` : '';
+  console.log(`${name.padEnd(28)} ${nsPerOp.toFixed(0).padStart(12)} ns/op${rate}`);
+}
+
+async function main() {
+  const { CuInstance } = await import('../web/cu-instance.js');
+  const module = await WebAssembly.compile(fs.readFileSync(WASM_PATH));
+
+  const fresh = () => {
+    const instance = new CuInstance();
+    instance.instantiate(module);
+    instance.init();
+    return instance;
+  };
+  const run = (instance, code) => {
+    if (instance.compute(code) < 0) throw new Error(`compute failed: ${code}`);
+  };
+
+  report('UnitStartup', measure(fresh));
+
+  const phases = [['Compute', 'return 1 + 1', null, 0]];
+  for (const size of PAYLOAD_SIZES) {
+    phases.push([`HomeSet/${size}B`, '_home.blob = payload', `payload = string.rep('x', ${size})`, size]);
+    phases.push([`HomeGet/${size}B`, 'return #_home.blob', `_home.blob = string.rep('x', ${size})`, size]);
+  }
+  for (const [name, code, setup, bytes] of phases) {
+    try {
+      const unit = fresh();
+      if (setup) run(unit, setup);
+      report(name, measure(() => run(unit, code), COMPUTE_MAX_OPS), bytes);
+    } catch (error) {
+      // Older cu.wasm builds trap instead of raising a Lua error when the
+      // heap runs out; report it and keep going
+      console.log(`${name.padEnd(28)} skipped (${error.message})`);
+    }
+  }
+}
+
+main().catch((error) => {
+  console.error('Benchmark failed:', error);
+  process.exit(1);
+});
@@ -0,0 +1,104 @@
+#!/usr/bin/env node
+/**
+ * Instance creation benchmark
+ *
+ * Compiles cu.wasm once, then measures how many CuInstance objects per
+ * second can be created from the shared module (instantiate), brought up
+ * (init) and run once (first compute), and how much linear memory each
+ * one holds, then how fast forks of a snapshot() of an initialized
+ * instance start instead, and instances of a pre-initialized module
+ * (scripts/preinit-wasm.js). Multi-tenant hosts create one instance per unit.
+ *
+ * Usage: node scripts/bench-instances.js [count]
+ */
+
+const fs = require('fs');
+const path = require('path');
+const { preinitialize } = require('./preinit-wasm');
+
+const WASM_PATH = path.join(__dirname, '../web/cu.wasm');
+const COUNT = Number(process.argv[2] ?? 200);
+
+function rate(count, ms) {
+  return `${(count / (ms / 1000)).toFixed(0).padStart(8)} /s  ${(ms / count).toFixed(3).padStart(8)} ms each`;
+}
+
+async function main() {
+  const { CuInstance } = await import('../web/cu-instance.js');
+
+  let start = performance.now();
+  const module = await WebAssembly.compile(fs.readFileSync(WASM_PATH));
+  console.log(`Compile once: ${(performance.now() - start).toFixed(1)} ms`);
+
+  // Warm up the instantiate path
+  for (let i = 0; i < 5; i++) new CuInstance().instantiate(module);
+
+  // Kept alive, so the memory figure covers every instance at once
+  const instances = [];
+  start = performance.now();
+  for (let i = 0; i < COUNT; i++) {
+    const instance = new CuInstance();
+    instance.instantiate(module);
+    instances.push(instance);
+  }
+  const instantiateMs = performance.now() - start;
+
+  start = performance.now();
+  for (const instance of instances) instance.init();
+  const initMs = performance.now() - start;
+
+  start = performance.now();
+  for (const instance of instances) {
+    if (instance.compute('_home.ready = true; return 1') < 0) {
+      throw new Error('first compute failed');
+    }
+  }
+  const computeMs = performance.now() - start;
+
+  const memoryBytes = instances.reduce((sum, instance) => sum + instance.wasmInstance.exports.memory.buffer.byteLength, 0);
+
+  console.log(`\n${COUNT} instances from one module`);
+  console.log(`  instantiate   ${rate(COUNT, instantiateMs)}`);
+  console.log(`  init          ${rate(COUNT, initMs)}`);
+  console.log(`  first compute ${rate(COUNT, computeMs)}`);
+  console.log(`  end to end    ${rate(COUNT, instantiateMs + initMs + computeMs)}`);
+  console.log(`  linear memory ${(memoryBytes / COUNT / 1024 / 1024).toFixed(2)} MB per instance`);
+
+  const snapshot = instances[0].snapshot();
+  instances.length = 0;
+  start = performance.now();
+  for (let i = 0; i < COUNT; i++) instances.push(CuInstance.fromSnapshot(snapshot));
+  const forkMs = performance.now() - start;
+
+  start = performance.now();
+  for (const instance of instances) {
+    if (instance.compute('return _home.ready') < 0) {
+      throw new Error('compute on a fork failed');
+    }
+  }
+  const forkComputeMs = performance.now() - start;
+
+  console.log(`\n${COUNT} forks of one snapshot (${(snapshot.image.bytes.length / 1024).toFixed(0)} KB of changed pages)`);
+  console.log(`  fromSnapshot  ${rate(COUNT, forkMs)}`);
+  console.log(`  first compute ${rate(COUNT, forkComputeMs)}`);
+  console.log(`  end to end    ${rate(COUNT, forkMs + forkComputeMs)}`);
+
+  const preinit = await WebAssembly.compile(await preinitialize(fs.readFileSync(WASM_PATH)));
+  instances.length = 0;
+  start = performance.now();
+  for (let i = 0; i < COUNT; i++) {
+    const instance = new CuInstance();
+    instance.instantiate(preinit);
+    instance.init();
+    instances.push(instance);
+  }
+  const preinitMs = performance.now() - start;
+
+  console.log(`\n${COUNT} instances of a pre-initialized module`);
+  console.log(`  instantiate + init ${rate(COUNT, preinitMs)}`);
+}
+
+main().catch((error) => {
+  console.error('Benchmark failed:', error);
+  process.exit(1);
+});
@@ -0,0 +1,139 @@
+#!/usr/bin/env node
+/**
+ * Table memory benchmark
+ *
+ * Measures the Lua heap held by 10k-entry tables (integer and float arrays,
+ * a string-keyed hash, a list of small records) and the time to build them,
+ * then prints a few number probes whose results show where a build's
+ * numeric range or precision differs. Pass several builds to compare them,
+ * e.g. the default build against one from CU_LUA_32BITS=1:
+ *
+ *   ./build.sh && cp web/cu.wasm /tmp/cu-default.wasm
+ *   CU_LUA_32BITS=1 ./build.sh
+ *   node scripts/bench-memory.js /tmp/cu-default.wasm web/cu.wasm
+ *
+ * Usage: node scripts/bench-memory.js [a.wasm b.wasm ...]
+ */
+
+const fs = require('fs');
+const path = require('path');
+
+const ENTRIES = 10000;
+const TARGET_MS = 300;
+const HEAP_BYTES = 32 * 1024 * 1024;
+
+const TABLES = [
+  ['integer array', `local t = {} for i = 1, ${ENTRIES} do t[i] = i end`],
+  ['float array', `local t = {} for i = 1, ${ENTRIES} do t[i] = i + 0.5 end`],
+  ['string-keyed hash', `local t = {} for i = 1, ${ENTRIES} do t["k" .. i] = i end`],
+  ['records', `local t = {} for i = 1, ${ENTRIES} do t[i] = { x = i, y = i, id = i } end`],
+];
+
+const PROBES = [
+  'math.maxinteger',
+  '2^53 + 1',
+  '16777217',
+  '0.1 + 0.2 == 0.3',
+  '1 / 3',
+  '1e300',
+  "math.type(require('json').decode('2147483647'))",
+];
+
+// Heap bytes the table holds once built; the local `t` is still live here
+function measureSource(build) {
+  return `
+    collectgarbage() collectgarbage()
+    local before = collectgarbage("count")
+    ${build}
+    collectgarbage()
+    local kb = collectgarbage("count") - before
+    return math.floor(kb * 1024 + 0.5)`;
+}
+
+function newInstance(CuInstance, module) {
+  const instance = new CuInstance();
+  instance.instantiate(module);
+  instance.init({ heapBytes: HEAP_BYTES });
+  return instance;
+}
+
+// Result of one compute, or null if the build could not run it
+function result(instance, code) {
+  try {
+    const bytes = instance.compute(code);
+    if (bytes < 0) return null;
+    return instance.readResult(instance.getBufferPtr(), bytes).result;
+  } catch {
+    // Older builds trap on Lua errors
+    return null;
+  }
+}
+
+// Mean ms per run, or null if the build could not run the workload
+function timeRun(instance, code) {
+  try {
+    for (let i = 0; i < 3; i++) instance.compute(code);
+    let runs = 0;
+    const start = performance.now();
+    let elapsed = 0;
+    while (elapsed < TARGET_MS) {
+      if (instance.compute(code) < 0) return null;
+      runs++;
+      elapsed = performance.now() - start;
+    }
+    return elapsed / runs;
+  } catch {
+    return null;
+  }
+}
+
+function printTable(title, rows, results, cell) {
+  const width = Math.max(title.length, ...rows.map((row) => row.length));
+  console.log(`${title.padEnd(width)}  ${results.map((r) => r.file.padStart(24)).join('')}`);
+  rows.forEach((row, i) => {
+    console.log(`${row.padEnd(width)}  ${results.map((r) => cell(r, i).padStart(24)).join('')}`);
+  });
+  console.log('');
+}
+
+async function main() {
+  const { CuInstance } = await import('../web/cu-instance.js');
+  const builds = process.argv.slice(2);
+  if (builds.length === 0) builds.push(path.join(__dirname, '../web/cu.wasm'));
+
+  const results = [];
+  for (const file of builds) {
+    const module = await WebAssembly.compile(fs.readFileSync(file));
+    const bytes = [];
+    const times = [];
+    for (const [, build] of TABLES) {
+      bytes.push(result(newInstance(CuInstance, module), measureSource(build)));
+      times.push(timeRun(newInstance(CuInstance, module), `${build} return #t`));
+    }
+    const probeInstance = newInstance(CuInstance, module);
+    const probes = PROBES.map((probe) => result(probeInstance, `return tostring(${probe})`));
+    results.push({ file: path.basename(file), bytes, times, probes });
+  }
+
+  const names = TABLES.map(([name]) => name);
+  printTable(`Heap per ${ENTRIES}-entry table`, names, results, (r, i) => {
+    const size = r.bytes[i];
+    if (typeof size !== 'number') return 'failed';
+    const base = results[0].bytes[i];
+    const ratio = r === results[0] || typeof base !== 'number' ? '' : ` ${(size / base).toFixed(2)}x`;
+    return `${(size / 1024).toFixed(1)} KB ${(size / ENTRIES).toFixed(1)} B/entry${ratio}`;
+  });
+  printTable('Build time', names, results, (r, i) => {
+    const time = r.times[i];
+    if (time === null) return 'failed';
+    const base = results[0].times[i];
+    const ratio = r === results[0] || base === null ? '' : ` ${(base / time).toFixed(2)}x`;
+    return `${time.toFixed(3)} ms${ratio}`;
+  });
+  printTable('Number probes', PROBES, results, (r, i) => String(r.probes[i] ?? 'failed'));
+}
+
+main().catch((error) => {
+  console.error('Benchmark failed:', error);
+  process.exit(1);
+});
@@ -0,0 +1,116 @@
+#!/usr/bin/env node
+/**
+ * Workload replay benchmark
+ *
+ * Replays a capture of real traffic (CuInstance.startCapture, cu-capture.js)
+ * against one or more builds and reports, per build, throughput, the
+ * latency distribution next to the captured one, external table calls
+ * and the requests whose results diverge from what was captured. Save a
+ * capture from the host that serves the traffic:
+ *
+ *   cu.startCapture();
+ *   ... serve requests ...
+ *   fs.writeFileSync('traffic.cucap', encodeCapture(cu.stopCapture()));
+ *
+ * then compare builds:
+ *
+ *   node scripts/bench-replay.js traffic.cucap /tmp/cu-old.wasm web/cu.wasm
+ *
+ * Without a capture file, a small sample workload is captured on
+ * web/cu.wasm first, which exercises the pipeline end to end.
+ *
+ * Usage: node scripts/bench-replay.js [capture] [a.wasm b.wasm ...] [--runs N]
+ */
+
+const fs = require('fs');
+const path = require('path');
+
+const HEAP_BYTES = 16 * 1024 * 1024;
+const DEFAULT_WASM = path.join(__dirname, '../web/cu.wasm');
+const ROUNDS = 5;
+
+const SAMPLE = [
+  '_home.users = {} for i = 1, 200 do _home.users[i] = { name = "user" .. i, score = i * 7 % 100 } end',
+  'local best = 0 for i = 1, #_home.users do best = math.max(best, _home.users[i].score) end return best',
+  'function handler(n) local t = {} for i = 1, n do t[i] = i * i end return #t end',
+  { call: 'handler', args: [1000] },
+  'local s = {} for i = 1, 100 do s[#s + 1] = tostring(i) end return table.concat(s, ",")',
+  'return _home.users[17].name, _home.users[42].score',
+];
+
+async function createInstance(CuInstance, module) {
+  const instance = new CuInstance();
+  instance.instantiate(module);
+  instance.init({ heapBytes: HEAP_BYTES });
+  return instance;
+}
+
+async function sampleCapture(CuInstance) {
+  const module = await WebAssembly.compile(fs.readFileSync(DEFAULT_WASM));
+  const instance = await createInstance(CuInstance, module);
+  // Builds from before call() run the scripts only
+  const items = SAMPLE.filter((item) => typeof item === 'string' || instance.wasmInstance.exports.call);
+  instance.startCapture();
+  for (let round = 0; round < ROUNDS; round++) {
+    for (const item of items) {
+      if (typeof item === 'string') instance.compute(item);
+      else instance.call(item.call, item.args);
+    }
+  }
+  return instance.stopCapture();
+}
+
+function parseArgs(argv) {
+  const options = { capture: null, builds: [], runs: 3 };
+  for (let i = 0; i < argv.length; i++) {
+    const arg = argv[i];
+    if (arg === '--runs') options.runs = Math.max(1, Number(argv[++i]) || 1);
+    else if (arg.endsWith('.wasm')) options.builds.push(arg);
+    else options.capture = arg;
+  }
+  if (options.builds.length === 0) options.builds.push(DEFAULT_WASM);
+  return options;
+}
+
+async function main() {
+  const { CuInstance } = await import('../web/cu-instance.js');
+  const { decodeCapture, replayCapture } = await import('../web/cu-capture.js');
+  const options = parseArgs(process.argv.slice(2));
+  const capture = options.capture
+    ? decodeCapture(fs.readFileSync(options.capture))
+    : await sampleCapture(CuInstance);
+
+  console.log(`${capture.requests.length} requests captured ${capture.startedAt}, ${options.runs} runs per build\n`);
+  const ms = (n) => `${n.toFixed(3)}`;
+  console.log(
+    'build'.padEnd(18) + 'req/s'.padStart(10) + 'p50'.padStart(10) + 'p90'.padStart(10) +
+      'p99'.padStart(10) + 'max'.padStart(10) + 'bridge'.padStart(10) + 'diverged'.padStart(10)
+  );
+  const row = (name, stats, rate, bridge, diverged) => console.log(
+    name.padEnd(18) + rate.padStart(10) + ms(stats.p50).padStart(10) + ms(stats.p90).padStart(10) +
+      ms(stats.p99).padStart(10) + ms(stats.max).padStart(10) + bridge.padStart(10) + diverged.padStart(10)
+  );
+
+  let first = null;
+  for (const file of options.builds) {
+    const module = await WebAssembly.compile(fs.readFileSync(file));
+    const report = await replayCapture(capture, {
+      createInstance: () => createInstance(CuInstance, module),
+      runs: options.runs,
+    });
+    if (first === null) {
+      first = report;
+      const rate = report.captured.totalMs > 0 ? (report.captured.count * 1000) / report.captured.totalMs : 0;
+      row('(captured)', report.captured, rate.toFixed(0), String(report.capturedBridgeCalls), '-');
+    }
+    row(path.basename(file), report.latency, report.throughput.toFixed(0), String(report.bridgeCalls), String(report.divergent.length));
+    if (report.divergent.length > 0) {
+      console.log(`  diverged at requests ${report.divergent.slice(0, 10).join(', ')}${report.divergent.length > 10 ? ', ...' : ''}`);
+    }
+  }
+}
+
+main().catch((error) => {
+  console.error('Benchmark failed:', error);
+  process.exit(1);
+});
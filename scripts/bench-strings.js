@@ -0,0 +1,118 @@
+#!/usr/bin/env node
+/**
+ * String stub benchmark
+ *
+ * Times Lua workloads that spend their time in the libc string and memory
+ * stubs (src/libc-stubs.zig): short-string interning (memcmp), plain
+ * string.find (memchr + memcmp), long-string equality (memcmp), buffer
+ * growth (memcpy), utf8.len (cu_utf8_span) and string.format (written
+ * by lstrlib.c, floats through cu_format_float). Pass several builds
+ * to compare them, e.g. the default build against one from CU_SIMD=1:
+ *
+ *   ./build.sh && cp web/cu.wasm /tmp/cu-scalar.wasm
+ *   CU_SIMD=1 ./build.sh
+ *   node scripts/bench-strings.js /tmp/cu-scalar.wasm web/cu.wasm
+ *
+ * Usage: node scripts/bench-strings.js [a.wasm b.wasm ...]
+ */
+
+const fs = require('fs');
+const path = require('path');
+
+const TARGET_MS = 300;
+// Room for the 64 KB haystack and its garbage on every build
+const HEAP_BYTES = 16 * 1024 * 1024;
+
+const WORKLOADS = [
+  ['intern short strings', `
+    local t = {}
+    for i = 1, 20000 do t[i % 512 + 1] = "key:" .. (i % 2048) .. ":suffix" end
+    return #t`],
+  ['find in 64 KB', `
+    local hay = string.rep("abcdefghij", 6553) .. "needle"
+    local n = 0
+    for i = 1, 50 do if string.find(hay, "needle", 1, true) then n = n + 1 end end
+    return n`],
+  ['compare 8 KB strings', `
+    local a = string.rep("x", 8191) .. "a"
+    local b = string.rep("x", 8191) .. "a"
+    local n = 0
+    for i = 1, 2000 do if a == b then n = n + 1 end end
+    return n`],
+  ['grow a buffer', `
+    local parts = {}
+    for i = 1, 2000 do parts[i] = string.rep("y", 37) end
+    return #table.concat(parts)`],
+  ['utf8.len of 64 KB', `
+    local text = string.rep("plain ascii text, ", 3000) .. "caf\u{E9} \u{1F600}"
+    local n = 0
+    for i = 1, 50 do n = n + utf8.len(text) end
+    return n`],
+  ['string.format', `
+    local n = 0
+    for i = 1, 5000 do n = n + #string.format("%s=%d;%5.2f", "field", i, i / 7) end
+    return n`],
+];
+
+// Mean ms per run, or null if the build could not run the workload
+function timeRun(instance, code) {
+  try {
+    // Warm up, then run for roughly TARGET_MS
+    for (let i = 0; i < 3; i++) instance.compute(code);
+    let runs = 0;
+    const start = performance.now();
+    let elapsed = 0;
+    while (elapsed < TARGET_MS) {
+      if (instance.compute(code) < 0) return null;
+      runs++;
+      elapsed = performance.now() - start;
+    }
+    return elapsed / runs;
+  } catch {
+    // Older builds trap on Lua errors, including running out of memory
+    return null;
+  }
+}
+
+async function main() {
+  const { CuInstance } = await import('../web/cu-instance.js');
+  const builds = process.argv.slice(2);
+  if (builds.length === 0) builds.push(path.join(__dirname, '../web/cu.wasm'));
+
+  const results = [];
+  for (const file of builds) {
+    const bytes = fs.readFileSync(file);
+    const module = await WebAssembly.compile(bytes);
+    const times = [];
+    for (const [, code] of WORKLOADS) {
+      const instance = new CuInstance();
+      instance.instantiate(module);
+      instance.init({ heapBytes: HEAP_BYTES });
+      times.push(timeRun(instance, code));
+    }
+    results.push({ file: path.basename(file) + (hasSimd(bytes) ? ' (simd128)' : ''), times });
+  }
+
+  const width = Math.max(...WORKLOADS.map(([name]) => name.length));
+  console.log(`${''.padEnd(width)}  ${results.map((r) => r.file.padStart(22)).join('')}`);
+  WORKLOADS.forEach(([name], i) => {
+    const base = results[0].times[i];
+    const cells = results.map((r, j) => {
+      const time = r.times[i];
+      if (time === null) return 'failed'.padStart(22);
+      const ms = `${time.toFixed(3)} ms`;
+      return (j === 0 || base === null ? ms : `${ms} ${(base / time).toFixed(2)}x`).padStart(22);
+    });
+    console.log(`${name.padEnd(width)}  ${cells.join('')}`);
+  });
+}
+
+// Whether the module's target_features section lists simd128
+function hasSimd(bytes) {
+  return bytes.includes('target_features') && bytes.includes('simd128');
+}
+
+main().catch((error) => {
+  console.error('Benchmark failed:', error);
+  process.exit(1);
+});
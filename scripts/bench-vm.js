@@ -0,0 +1,104 @@
+#!/usr/bin/env node
+/**
+ * Interpreter benchmark
+ *
+ * Times Lua workloads that spend their time in the VM dispatch loop
+ * (src/lua/lvm.c) rather than in the allocator or host bridge: recursive
+ * calls, numeric for loops, table field access, calls through a field and
+ * string building. Pass several builds to compare them, e.g. the default
+ * build against one from CU_FUSED_DISPATCH=1:
+ *
+ *   ./build.sh && cp web/cu.wasm /tmp/cu-default.wasm
+ *   CU_FUSED_DISPATCH=1 ./build.sh
+ *   node scripts/bench-vm.js /tmp/cu-default.wasm web/cu.wasm
+ *
+ * Usage: node scripts/bench-vm.js [a.wasm b.wasm ...]
+ */
+
+const fs = require('fs');
+const path = require('path');
+
+const TARGET_MS = 500;
+const HEAP_BYTES = 16 * 1024 * 1024;
+
+const WORKLOADS = [
+  ['fib(24)', `
+    local function fib(n) if n < 2 then return n end return fib(n - 1) + fib(n - 2) end
+    return fib(24)`],
+  ['numeric loops', `
+    local s, n = 0, 0
+    for i = 1, 300000 do s = s + i end
+    for i = 1, 300000 do n = n + 1 end
+    return s + n`],
+  ['table fields', `
+    local p = { x = 1, y = 2, z = 3 }
+    local s = 0
+    for i = 1, 100000 do s = s + p.x + p.y * p.z end
+    return s`],
+  ['field calls', `
+    local m = { f = function(x) return x end }
+    local s = 0
+    for i = 1, 100000 do s = s + m.f(i) end
+    return s`],
+  ['string building', `
+    local parts = {}
+    for i = 1, 5000 do parts[#parts + 1] = "item" .. i end
+    return #table.concat(parts, ",")`],
+];
+
+// Mean ms per run, or null if the build could not run the workload
+function timeRun(instance, code) {
+  try {
+    // Warm up, then run for roughly TARGET_MS
+    for (let i = 0; i < 3; i++) instance.compute(code);
+    let runs = 0;
+    const start = performance.now();
+    let elapsed = 0;
+    while (elapsed < TARGET_MS) {
+      if (instance.compute(code) < 0) return null;
+      runs++;
+      elapsed = performance.now() - start;
+    }
+    return elapsed / runs;
+  } catch {
+    // Older builds trap on Lua errors, including running out of memory
+    return null;
+  }
+}
+
+async function main() {
+  const { CuInstance } = await import('../web/cu-instance.js');
+  const builds = process.argv.slice(2);
+  if (builds.length === 0) builds.push(path.join(__dirname, '../web/cu.wasm'));
+
+  const results = [];
+  for (const file of builds) {
+    const module = await WebAssembly.compile(fs.readFileSync(file));
+    const times = [];
+    for (const [, code] of WORKLOADS) {
+      const instance = new CuInstance();
+      instance.instantiate(module);
+      instance.init({ heapBytes: HEAP_BYTES });
+      times.push(timeRun(instance, code));
+    }
+    results.push({ file: path.basename(file), times });
+  }
+
+  const width = Math.max(...WORKLOADS.map(([name]) => name.length));
+  console.log(`${''.padEnd(width)}  ${results.map((r) => r.file.padStart(22)).join('')}`);
+  WORKLOADS.forEach(([name], i) => {
+    const base = results[0].times[i];
+    const cells = results.map((r, j) => {
+      const time = r.times[i];
+      if (time === null) return 'failed'.padStart(22);
+      const ms = `${time.toFixed(3)} ms`;
+      return (j === 0 || base === null ? ms : `${ms} ${(base / time).toFixed(2)}x`).padStart(22);
+    });
+    console.log(`${name.padEnd(width)}  ${cells.join('')}`);
+  });
+}
+
+main().catch((error) => {
+  console.error('Benchmark failed:', error);
+  process.exit(1);
+});
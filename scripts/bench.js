@@ -0,0 +1,196 @@
+#!/usr/bin/env node
+/**
+ * Benchmark suite
+ *
+ * Times the operations a host does most against one build, each on a fresh
+ * CuInstance: a compute round trip, interpreter loops, table and string
+ * building, _home reads and writes, a large _io.input, bigint arithmetic,
+ * saveState/loadState, calling a function stored in _home, and starting an
+ * instance. The other scripts/bench-*.js look at one area in depth; this
+ * one is the broad pass to run before and after a release.
+ *
+ * State is saved to an in-memory store rather than IndexedDB, which Node
+ * does not have, so the save/load figure covers the instance's side only.
+ *
+ * With --json the results are printed as JSON instead of a table, to keep
+ * alongside earlier runs:
+ *
+ *   npm run bench -- --json > bench-2.1.0.json
+ *   node scripts/bench.js /tmp/cu-old.wasm web/cu.wasm
+ *
+ * Usage: node scripts/bench.js [--json] [a.wasm b.wasm ...]
+ */
+
+const fs = require('fs');
+const path = require('path');
+
+const TARGET_MS = 300;
+
+/**
+ * Keeps saved tables in memory, with the shape of LuaPersistence
+ */
+class MemoryPersistence {
+  constructor() {
+    this.tables = new Map();
+    this.metadata = {};
+  }
+
+  async saveTables(tables, metadata) {
+    this.tables.clear();
+    await this.saveChanges(tables, [], metadata);
+  }
+
+  async saveChanges(changed, removed, metadata) {
+    for (const id of removed) this.tables.delete(id);
+    for (const [id, table] of changed) this.tables.set(id, new Map(table));
+    this.metadata = metadata;
+  }
+
+  async appendJournal() {}
+
+  async loadTables() {
+    const tables = new Map();
+    for (const [id, table] of this.tables) tables.set(id, new Map(table));
+    return { tables, metadata: this.metadata, journalTableIds: new Set() };
+  }
+
+  async clearAll() {
+    this.tables.clear();
+    this.metadata = {};
+  }
+}
+
+// Throws if code failed, so the workload is reported as failed
+function run(instance, code) {
+  const len = instance.compute(code);
+  if (len < 0) throw new Error(`compute failed: ${code.trim().split('\n')[0]}`);
+  return len;
+}
+
+const LARGE_INPUT = 'x'.repeat(256 * 1024);
+
+// [name, setup(instance, module), step(instance, module)]; step runs once
+// per timed iteration
+const WORKLOADS = [
+  ['empty compute round trip', null, (instance) => {
+    instance.readResult(instance.getResultPtr(), run(instance, 'return 1'));
+  }],
+  ['fib(20)', null, (instance) => run(instance, `
+    local function fib(n) if n < 2 then return n end return fib(n - 1) + fib(n - 2) end
+    return fib(20)`)],
+  ['numeric loop 100k', null, (instance) => run(instance, `
+    local s = 0
+    for i = 1, 100000 do s = s + i end
+    return s`)],
+  ['table build 10k', null, (instance) => run(instance, `
+    local t = {}
+    for i = 1, 10000 do t[i] = { id = i } end
+    return #t`)],
+  ['string concat 5k', null, (instance) => run(instance, `
+    local parts = {}
+    for i = 1, 5000 do parts[#parts + 1] = "item" .. i end
+    return #table.concat(parts, ",")`)],
+  ['_home get/set x100', null, (instance) => run(instance, `
+    for i = 1, 100 do _home.counter = (_home.counter or 0) + 1 end
+    return _home.counter`)],
+  ['_io.input 256KB', null, (instance) => {
+    instance.setInput(LARGE_INPUT);
+    run(instance, 'return #_io.input');
+  }],
+  ['bigint mul/add x200', null, (instance) => run(instance, `
+    local bigint = require('bigint')
+    local a = bigint.new("1234567890123456789012345678901234567890")
+    for i = 1, 200 do a = a * bigint.new(3) + bigint.new(i) end
+    return #tostring(a)`)],
+  ['saveState + loadState 1k keys', (instance) => {
+    run(instance, 'for i = 1, 1000 do _home["key" .. i] = "value " .. i end');
+  }, async (instance) => {
+    // One write marks _home changed, so every save rewrites it
+    run(instance, '_home.tick = (_home.tick or 0) + 1');
+    if (!(await instance.saveState()) || !(await instance.loadState())) {
+      throw new Error('saveState/loadState failed');
+    }
+  }],
+  ['stored function call', (instance) => {
+    run(instance, '_home.double = function(x) return x * 2 end');
+  }, (instance) => run(instance, 'return _home.double(21)')],
+  ['cold start', null, (instance, module, CuInstance) => {
+    const fresh = new CuInstance({ persistence: new MemoryPersistence() });
+    fresh.instantiate(module);
+    fresh.init();
+    run(fresh, 'return 1');
+  }],
+];
+
+// { ms, runs } with the mean ms per run, or null if the build could not
+// run the workload
+async function timeWorkload(CuInstance, module, [, setup, step]) {
+  try {
+    const instance = new CuInstance({ persistence: new MemoryPersistence() });
+    instance.instantiate(module);
+    instance.init();
+    if (setup) setup(instance, module, CuInstance);
+
+    for (let i = 0; i < 3; i++) await step(instance, module, CuInstance);
+    let runs = 0;
+    const start = performance.now();
+    let elapsed = 0;
+    while (elapsed < TARGET_MS) {
+      await step(instance, module, CuInstance);
+      runs++;
+      elapsed = performance.now() - start;
+    }
+    return { ms: elapsed / runs, runs };
+  } catch {
+    // Older builds trap on Lua errors, such as requiring a missing library
+    return null;
+  }
+}
+
+async function main() {
+  const { CuInstance } = await import('../web/cu-instance.js');
+  const args = process.argv.slice(2);
+  const json = args.includes('--json');
+  const builds = args.filter((arg) => arg !== '--json');
+  if (builds.length === 0) builds.push(path.join(__dirname, '../web/cu.wasm'));
+
+  const results = [];
+  for (const file of builds) {
+    const module = await WebAssembly.compile(fs.readFileSync(file));
+    const times = [];
+    for (const workload of WORKLOADS) {
+      times.push(await timeWorkload(CuInstance, module, workload));
+    }
+    results.push({ file: path.basename(file), times });
+  }
+
+  if (json) {
+    const { version } = require('../package.json');
+    console.log(JSON.stringify({
+      version,
+      node: process.version,
+      date: new Date().toISOString(),
+      targetMs: TARGET_MS,
+      builds: results.map(({ file, times }) => ({
+        file,
+        workloads: Object.fromEntries(WORKLOADS.map(([name], i) => [name, times[i]])),
+      })),
+    }, null, 2));
+    return;
+  }
+
+  const width = Math.max(...WORKLOADS.map(([name]) => name.length));
+  console.log(`${''.padEnd(width)}  ${results.map((r) => r.file.padStart(22)).join('')}`);
+  WORKLOADS.forEach(([name], i) => {
+    const cells = results.map((r) => {
+      const time = r.times[i];
+      return (time === null ? 'failed' : `${time.ms.toFixed(3)} ms`).padStart(22);
+    });
+    console.log(`${name.padEnd(width)}  ${cells.join('')}`);
+  });
+}
+
+main().catch((error) => {
+  console.error('Benchmark failed:', error);
+  process.exit(1);
+});
@@ -1,20 +1,29 @@
 #!/bin/bash
 
-# Optimize WASM binary using wasm-opt if available
+# Optimize a WASM binary in place with wasm-opt, if it is installed
+#
+# Usage: scripts/optimize-wasm.sh <file.wasm> [level] [extra wasm-opt flags]
+# build.sh runs it for CU_BUILD=small (-Oz) and CU_BUILD=fast (-O3).
 
-WASM_FILE="dist/lua.wasm"
+WASM_FILE="${1:?usage: optimize-wasm.sh <file.wasm> [level] [flags]}"
+LEVEL="${2:--O3}"
+shift 2 2>/dev/null || shift $#
 
 if ! command -v wasm-opt &> /dev/null; then
-    echo "wasm-opt not found. Install with: npm install -g wasm-opt"
+    echo "wasm-opt not found, leaving $WASM_FILE as linked. Install with: npm install -g binaryen"
     exit 0
 fi
 
-echo "Optimizing WASM binary..."
 ORIGINAL_SIZE=$(wc -c < "$WASM_FILE")
 
-wasm-opt -O3 \
-    --enable-simd \
+# The features build.sh targets: ldo.c's setjmp/longjmp needs exceptions
+wasm-opt "$LEVEL" \
+    --enable-exception-handling \
     --enable-bulk-memory \
+    --enable-sign-ext \
+    --enable-mutable-globals \
+    --enable-nontrapping-float-to-int \
+    "$@" \
     "$WASM_FILE" \
     -o "$WASM_FILE.opt"
 
@@ -23,12 +32,11 @@ if [ $? -eq 0 ]; then
     NEW_SIZE=$(wc -c < "$WASM_FILE")
     SAVINGS=$((ORIGINAL_SIZE - NEW_SIZE))
     PERCENT=$((SAVINGS * 100 / ORIGINAL_SIZE))
-    
-    echo "Optimization complete!"
+
     echo "Original size: $ORIGINAL_SIZE bytes"
     echo "New size: $NEW_SIZE bytes"
     echo "Saved: $SAVINGS bytes ($PERCENT%)"
 else
     echo "Optimization failed, keeping original file"
     rm -f "$WASM_FILE.opt"
-fi
\ No newline at end of file
+fi
@@ -0,0 +1,211 @@
+#!/usr/bin/env node
+/**
+ * Pre-initialized module builder
+ *
+ * Runs init() (and optional bootstrap Lua) on cu.wasm at build time and
+ * writes a module whose data segments already hold the initialized Lua
+ * state: stdlib tables, the bigint metatable and the _home/_io proxies.
+ * CuInstance recognizes it by its "cu.preinit" custom section, which also
+ * carries the host-side tables and interned keys, and then skips init().
+ *
+ * The module must be captured between calls, when the stack pointer (its
+ * only mutable global) is back at its initial value, so only linear memory
+ * differs from a fresh instance.
+ *
+ * Usage: node scripts/preinit-wasm.js <in.wasm> <out.wasm> [bootstrap.lua]
+ */
+
+const fs = require('fs');
+
+const PREINIT_SECTION = 'cu.preinit';
+const WASM_PAGE = 65536;
+const SECTION_CUSTOM = 0;
+const SECTION_MEMORY = 5;
+const SECTION_DATA = 11;
+const SECTION_DATA_COUNT = 12;
+// Zero runs shorter than this stay inside a segment; a segment header
+// costs about as much
+const MIN_ZERO_GAP = 16;
+
+function readU32(bytes, offset) {
+  let value = 0;
+  let shift = 0;
+  let byte;
+  do {
+    byte = bytes[offset++];
+    value |= (byte & 0x7f) << shift;
+    shift += 7;
+  } while (byte & 0x80);
+  return { value: value >>> 0, offset };
+}
+
+function u32(value) {
+  const out = [];
+  do {
+    let byte = value & 0x7f;
+    value >>>= 7;
+    if (value !== 0) byte |= 0x80;
+    out.push(byte);
+  } while (value !== 0);
+  return out;
+}
+
+function i32(value) {
+  const out = [];
+  for (;;) {
+    const byte = value & 0x7f;
+    value >>= 7;
+    if ((value === 0 && !(byte & 0x40)) || (value === -1 && (byte & 0x40))) {
+      out.push(byte);
+      return out;
+    }
+    out.push(byte | 0x80);
+  }
+}
+
+function section(id, payload) {
+  return Buffer.concat([Buffer.from([id, ...u32(payload.length)]), payload]);
+}
+
+/**
+ * Split a module into its sections
+ * @returns {Array<{id: number, payload: Buffer}>}
+ */
+function readSections(bytes) {
+  const sections = [];
+  let offset = 8;
+  while (offset < bytes.length) {
+    const id = bytes[offset++];
+    const size = readU32(bytes, offset);
+    sections.push({ id, payload: bytes.subarray(size.offset, size.offset + size.value) });
+    offset = size.offset + size.value;
+  }
+  return sections;
+}
+
+/** The memory section with the initial size raised to `pages` */
+function memorySection(payload, pages) {
+  const count = readU32(payload, 0);
+  if (count.value !== 1) throw new Error('expected one memory');
+  const flags = payload[count.offset];
+  const min = readU32(payload, count.offset + 1);
+  const rest = payload.subarray(min.offset);
+  return Buffer.concat([Buffer.from([1, flags, ...u32(Math.max(pages, min.value))]), rest]);
+}
+
+/** Active data segments covering the non-zero bytes of `memory` */
+function dataSegments(memory) {
+  const segments = [];
+  let i = 0;
+  while (i < memory.length) {
+    while (i < memory.length && memory[i] === 0) i++;
+    if (i >= memory.length) break;
+    const start = i;
+    let end = i;
+    while (i < memory.length) {
+      if (memory[i] !== 0) {
+        end = ++i;
+      } else if (i - end >= MIN_ZERO_GAP) {
+        break;
+      } else {
+        i++;
+      }
+    }
+    segments.push([start, end]);
+  }
+
+  const parts = [Buffer.from(u32(segments.length))];
+  for (const [start, end] of segments) {
+    // Active, memory 0, offset (i32.const start; end)
+    parts.push(Buffer.from([0x00, 0x41, ...i32(start), 0x0b, ...u32(end - start)]));
+    parts.push(Buffer.from(memory.buffer, memory.byteOffset + start, end - start));
+  }
+  return { count: segments.length, payload: Buffer.concat(parts) };
+}
+
+function customSection(name, data) {
+  const nameBytes = Buffer.from(name, 'utf8');
+  return section(SECTION_CUSTOM, Buffer.concat([Buffer.from(u32(nameBytes.length)), nameBytes, data]));
+}
+
+/**
+ * Build the pre-initialized module
+ * @param {Uint8Array} wasmBytes - cu.wasm
+ * @param {Object} [options]
+ * @param {string} [options.bootstrap] - Lua run after init()
+ * @param {Object} [options.init] - init() options (heapBytes, maxHeapBytes)
+ * @returns {Promise<Buffer>} The new module
+ */
+async function preinitialize(wasmBytes, options = {}) {
+  const { CuInstance } = await import('../web/cu-instance.js');
+  const bytes = Buffer.from(wasmBytes);
+  const module = await WebAssembly.compile(bytes);
+  if (WebAssembly.Module.customSections(module, PREINIT_SECTION).length > 0) {
+    throw new Error('module is already pre-initialized');
+  }
+
+  const instance = new CuInstance();
+  instance.instantiate(module);
+  if (instance.init(options.init) !== 0) {
+    throw new Error('init() failed');
+  }
+  if (options.bootstrap) {
+    const len = instance.compute(options.bootstrap);
+    if (len < 0) {
+      throw new Error(`bootstrap failed: ${instance.readBuffer(instance.getBufferPtr(), -len)}`);
+    }
+  }
+
+  const memory = new Uint8Array(instance.wasmInstance.exports.memory.buffer);
+  const state = {
+    version: 1,
+    nextTableId: instance.nextTableId,
+    homeTableId: instance.homeTableId,
+    keyHandles: instance.keyHandles,
+    tables: Array.from(instance.externalTables, ([id, table]) => [
+      id,
+      Array.from(table, ([key, value]) => [key, Array.from(value)]),
+    ]),
+  };
+
+  const data = dataSegments(memory);
+  const out = [bytes.subarray(0, 8)];
+  for (const { id, payload } of readSections(bytes)) {
+    if (id === SECTION_MEMORY) {
+      out.push(section(id, memorySection(payload, memory.length / WASM_PAGE)));
+    } else if (id === SECTION_DATA_COUNT) {
+      out.push(section(id, Buffer.from(u32(data.count))));
+    } else if (id === SECTION_DATA) {
+      const count = readU32(payload, 0);
+      // Passive segments are copied in by code at run time; keep the module as is
+      if (count.value > 0 && payload[count.offset] !== 0x00) {
+        throw new Error('passive data segments are not supported');
+      }
+      out.push(section(id, data.payload));
+      out.push(customSection(PREINIT_SECTION, Buffer.from(JSON.stringify(state), 'utf8')));
+    } else {
+      out.push(section(id, payload));
+    }
+  }
+  return Buffer.concat(out);
+}
+
+module.exports = { preinitialize, PREINIT_SECTION, readU32, readSections, section, customSection };
+
+if (require.main === module) {
+  const [input, output, bootstrapPath] = process.argv.slice(2);
+  if (!input || !output) {
+    console.error('Usage: node scripts/preinit-wasm.js <in.wasm> <out.wasm> [bootstrap.lua]');
+    process.exit(1);
+  }
+  const bootstrap = bootstrapPath ? fs.readFileSync(bootstrapPath, 'utf8') : undefined;
+  preinitialize(fs.readFileSync(input), { bootstrap })
+    .then((bytes) => {
+      fs.writeFileSync(output, bytes);
+      console.log(`   Pre-initialized: ${output} (${Math.round(bytes.length / 1024)} KB)`);
+    })
+    .catch((error) => {
+      console.error('Pre-initialization failed:', error.message);
+      process.exit(1);
+    });
+}
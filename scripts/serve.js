@@ -0,0 +1,36 @@
+#!/usr/bin/env node
+/**
+ * Cu server
+ *
+ * Serves units over HTTP (POST /api/lua, GET /metrics) and WebSocket (/ws)
+ * with CuServer (web/cu-server.js). Each unit's tables are kept in a
+ * directory of their own under --dir, or in memory without one.
+ *
+ * Usage: node scripts/serve.js [--port 8000] [--host localhost]
+ *                              [--dir ./state] [--max-units 64]
+ */
+
+const path = require('path');
+
+function option(name, fallback) {
+  const index = process.argv.indexOf(`--${name}`);
+  return index >= 0 && index + 1 < process.argv.length ? process.argv[index + 1] : fallback;
+}
+
+async function main() {
+  const { CuServer } = await import('../web/cu-server.js');
+  const { FilePersistence } = await import('../web/cu-file-persistence.js');
+  const dir = option('dir');
+  const server = await CuServer.create({
+    maxUnits: Number(option('max-units', 64)),
+    // Unit names become directory names, so only safe characters are kept
+    persistence: dir ? (unit) => new FilePersistence(path.join(dir, encodeURIComponent(unit))) : null,
+  });
+  const port = await server.listen(Number(option('port', 8000)), option('host', 'localhost'));
+  console.log(`Cu server on http://${option('host', 'localhost')}:${port} (ws /ws, metrics /metrics)`);
+}
+
+main().catch((error) => {
+  console.error('Server failed:', error);
+  process.exit(1);
+});
@@ -0,0 +1,160 @@
+#!/usr/bin/env node
+/**
+ * wasm64 ABI section writer
+ *
+ * In a wasm64 build (CU_BUILD=wasm64) every pointer and usize crossing the
+ * boundary is an i64, which JavaScript sees as a BigInt. CuInstance converts
+ * them to and from numbers at the boundary, and needs to know which
+ * parameters and results are i64 to do it. This script reads the function
+ * signatures of the module's imports and exports and appends them as a
+ * "cu.abi64" custom section:
+ *
+ *   { "imports": [{ "module", "name", "params": [i64 param indices],
+ *                   "result": true if i64 }],
+ *     "exports": { name: { "params": [...], "result": ... } } }
+ *
+ * Only functions with an i64 somewhere are listed. CuInstance takes a module
+ * with the section for a wasm64 build (web/cu-memory64.js).
+ *
+ * Usage: node scripts/wasm-abi.js <cu-64.wasm>
+ */
+
+const fs = require('fs');
+const { readU32, readSections, section, customSection } = require('./preinit-wasm.js');
+
+const ABI64_SECTION = 'cu.abi64';
+const SECTION_CUSTOM = 0;
+const SECTION_TYPE = 1;
+const SECTION_IMPORT = 2;
+const SECTION_FUNCTION = 3;
+const SECTION_EXPORT = 7;
+const I64 = 0x7e;
+const KIND_FUNC = 0;
+const KIND_TABLE = 1;
+const KIND_MEMORY = 2;
+const KIND_GLOBAL = 3;
+const KIND_TAG = 4;
+
+function readName(bytes, offset) {
+  const len = readU32(bytes, offset);
+  const end = len.offset + len.value;
+  return { value: Buffer.from(bytes.subarray(len.offset, end)).toString('utf8'), offset: end };
+}
+
+function skipLimits(bytes, offset) {
+  const flags = bytes[offset++];
+  offset = readU32(bytes, offset).offset;
+  return flags & 1 ? readU32(bytes, offset).offset : offset;
+}
+
+/** The i64 parameters and result of each function type */
+function readTypes(payload) {
+  const types = [];
+  const count = readU32(payload, 0);
+  let offset = count.offset;
+  for (let i = 0; i < count.value; i++) {
+    offset++; // 0x60
+    const params = readU32(payload, offset);
+    offset = params.offset;
+    const wide = [];
+    for (let p = 0; p < params.value; p++) {
+      if (payload[offset++] === I64) wide.push(p);
+    }
+    const results = readU32(payload, offset);
+    offset = results.offset;
+    let result = false;
+    for (let r = 0; r < results.value; r++) {
+      if (payload[offset++] === I64) result = true;
+    }
+    types.push({ params: wide, result });
+  }
+  return types;
+}
+
+function describeAbi(bytes) {
+  const sections = readSections(bytes);
+  const payloadOf = (id) => sections.find((section) => section.id === id)?.payload;
+  const types = readTypes(payloadOf(SECTION_TYPE));
+  const wide = (type) => type.params.length > 0 || type.result;
+
+  // Function index -> type, imports first
+  const functionTypes = [];
+  const imports = [];
+  const importPayload = payloadOf(SECTION_IMPORT);
+  if (importPayload) {
+    const count = readU32(importPayload, 0);
+    let offset = count.offset;
+    for (let i = 0; i < count.value; i++) {
+      const module = readName(importPayload, offset);
+      const name = readName(importPayload, module.offset);
+      const kind = importPayload[name.offset];
+      offset = name.offset + 1;
+      if (kind === KIND_FUNC) {
+        const index = readU32(importPayload, offset);
+        offset = index.offset;
+        const type = types[index.value];
+        functionTypes.push(type);
+        if (wide(type)) imports.push({ module: module.value, name: name.value, ...type });
+      } else if (kind === KIND_TABLE) {
+        offset = skipLimits(importPayload, offset + 1);
+      } else if (kind === KIND_MEMORY) {
+        offset = skipLimits(importPayload, offset);
+      } else if (kind === KIND_GLOBAL) {
+        offset += 2;
+      } else if (kind === KIND_TAG) {
+        offset = readU32(importPayload, offset + 1).offset;
+      }
+    }
+  }
+  const functionPayload = payloadOf(SECTION_FUNCTION);
+  const count = readU32(functionPayload, 0);
+  let offset = count.offset;
+  for (let i = 0; i < count.value; i++) {
+    const index = readU32(functionPayload, offset);
+    offset = index.offset;
+    functionTypes.push(types[index.value]);
+  }
+
+  const exports = {};
+  const exportPayload = payloadOf(SECTION_EXPORT);
+  const exportCount = readU32(exportPayload, 0);
+  offset = exportCount.offset;
+  for (let i = 0; i < exportCount.value; i++) {
+    const name = readName(exportPayload, offset);
+    const kind = exportPayload[name.offset];
+    const index = readU32(exportPayload, name.offset + 1);
+    offset = index.offset;
+    if (kind === KIND_FUNC && wide(functionTypes[index.value])) exports[name.value] = functionTypes[index.value];
+  }
+  return { imports, exports };
+}
+
+/**
+ * The module with its cu.abi64 section (replacing one already there)
+ * @param {Uint8Array} bytes
+ * @returns {Buffer}
+ */
+function addAbiSection(bytes) {
+  const abi = describeAbi(bytes);
+  const out = [Buffer.from(bytes.subarray(0, 8))];
+  for (const { id, payload } of readSections(bytes)) {
+    if (id === SECTION_CUSTOM && readName(payload, 0).value === ABI64_SECTION) continue;
+    out.push(section(id, payload));
+  }
+  out.push(customSection(ABI64_SECTION, Buffer.from(JSON.stringify(abi), 'utf8')));
+  return Buffer.concat(out);
+}
+
+module.exports = { describeAbi, addAbiSection, ABI64_SECTION };
+
+if (require.main === module) {
+  const [file] = process.argv.slice(2);
+  if (!file) {
+    console.error('Usage: node scripts/wasm-abi.js <cu-64.wasm>');
+    process.exit(1);
+  }
+  const bytes = addAbiSection(fs.readFileSync(file));
+  fs.writeFileSync(file, bytes);
+  const { imports, exports } = describeAbi(bytes);
+  console.log(`   ABI section: ${imports.length} imports and ${Object.keys(exports).length} exports with i64`);
+}
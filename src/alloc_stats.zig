@@ -0,0 +1,31 @@
+// Allocator telemetry layout shared by libc-stubs.zig (which fills it) and
+// main.zig (which embeds it in MemoryStats). The two files are compiled as
+// separate objects, so this file must stay free of exports.
+
+const std = @import("std");
+
+/// Number of per-class counter slots. Slots 0..14 are the small size classes
+/// (16..512 bytes), the last slot counts large (boundary-tag) allocations.
+pub const NUM_CLASS_SLOTS = 16;
+pub const LARGE_CLASS_SLOT = NUM_CLASS_SLOTS - 1;
+
+pub const AllocatorStats = extern struct {
+    heap_committed: u32,
+    heap_limit: u32,
+    bytes_in_use: u32,
+    high_water: u32,
+    /// Bytes sitting on small and large free lists (excludes the untouched top)
+    free_list_bytes: u32,
+    /// Largest single free block, including the uncommitted top up to the limit
+    largest_free_block: u32,
+    alloc_count: u32,
+    free_count: u32,
+    class_allocs: [NUM_CLASS_SLOTS]u32,
+    class_live: [NUM_CLASS_SLOTS]u32,
+};
+
+/// A byte count as the u32 fields hold it. The layout is the same in every
+/// build, so on wasm64 counts past 4GB read as 4GB - 1.
+pub fn clamp(bytes: usize) u32 {
+    return @intCast(@min(bytes, std.math.maxInt(u32)));
+}
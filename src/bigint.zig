@@ -0,0 +1,102 @@
+const std = @import("std");
+const builtin = @import("builtin");
+const lua = @import("lua.zig");
+
+// Zig side of the bigint library (src/lua/lbigint.c). A bigint stored in
+// an external table or returned from compute() is
+//   0x11, 1 if negative else 0, 2 zero bytes, u32 word count, the
+//   magnitude as little-endian u32 words, least significant first
+// under either value encoding; zero has no words. On wasm32 the words are
+// the limbs as they sit in memory, so a bigint is written and read back by
+// copying its limbs rather than going through a decimal string.
+pub const BIGINT: u8 = 0x11;
+pub const HEADER_LEN = 8;
+
+const Limb = usize;
+const WORDS_PER_LIMB = @sizeOf(Limb) / 4;
+const LIMBS_ARE_WORDS = WORDS_PER_LIMB == 1 and builtin.cpu.arch.endian() == .little;
+
+// BigInt in src/lua/lbigint.h
+const BigInt = extern struct {
+    limbs: [*]Limb,
+    len: usize,
+    cap: usize,
+    positive: c_int,
+};
+
+extern fn cu_bigint_view(L: *lua.lua_State, index: c_int) ?*const BigInt;
+extern fn cu_bigint_push(L: *lua.lua_State, cap: usize) *BigInt;
+
+fn word_shift(i: usize) std.math.Log2Int(Limb) {
+    return @intCast((i % WORDS_PER_LIMB) * 32);
+}
+
+fn word_at(b: *const BigInt, i: usize) u32 {
+    return @truncate(b.limbs[i / WORDS_PER_LIMB] >> word_shift(i));
+}
+
+// Words up to the most significant nonzero one
+fn word_count(b: *const BigInt) usize {
+    var n = b.len * WORDS_PER_LIMB;
+    while (n > 0 and word_at(b, n - 1) == 0) n -= 1;
+    return n;
+}
+
+/// Encoded size of the bigint at `index`, or null if the value is not one
+pub fn value_len(L: *lua.lua_State, index: c_int) ?usize {
+    const b = cu_bigint_view(L, index) orelse return null;
+    return HEADER_LEN + word_count(b) * 4;
+}
+
+/// Write the bigint at `index` into `buffer`, which has room for
+/// value_len() bytes
+pub fn write(L: *lua.lua_State, index: c_int, buffer: [*]u8) usize {
+    const b = cu_bigint_view(L, index).?;
+    const words = word_count(b);
+    buffer[0] = BIGINT;
+    buffer[1] = @intFromBool(b.positive == 0 and words > 0);
+    buffer[2] = 0;
+    buffer[3] = 0;
+    std.mem.writeInt(u32, buffer[4..8], @intCast(words), .little);
+    const body = buffer[HEADER_LEN .. HEADER_LEN + words * 4];
+    if (LIMBS_ARE_WORDS) {
+        @memcpy(body, std.mem.sliceAsBytes(b.limbs[0..words]));
+    } else {
+        for (0..words) |i| std.mem.writeInt(u32, body[i * 4 ..][0..4], word_at(b, i), .little);
+    }
+    return HEADER_LEN + words * 4;
+}
+
+/// Size of a well-formed bigint value at the start of `bytes`, or null
+pub fn encoded_len(bytes: []const u8) ?usize {
+    if (bytes.len < HEADER_LEN or bytes[0] != BIGINT or bytes[1] > 1) return null;
+    const words = std.mem.readInt(u32, bytes[4..8], .little);
+    if (words > (bytes.len - HEADER_LEN) / 4) return null;
+    return HEADER_LEN + @as(usize, words) * 4;
+}
+
+/// Push a bigint holding the value in `bytes`, filling its limbs directly
+pub fn push(L: *lua.lua_State, bytes: []const u8) bool {
+    const len = encoded_len(bytes) orelse return false;
+    const words = (len - HEADER_LEN) / 4;
+    const body = bytes[HEADER_LEN..len];
+    const cap = @max((words + WORDS_PER_LIMB - 1) / WORDS_PER_LIMB, 1);
+    const b = cu_bigint_push(L, cap);
+
+    @memset(b.limbs[0..cap], 0);
+    if (LIMBS_ARE_WORDS) {
+        @memcpy(std.mem.sliceAsBytes(b.limbs[0..words]), body);
+    } else {
+        for (0..words) |i| {
+            b.limbs[i / WORDS_PER_LIMB] |= @as(Limb, std.mem.readInt(u32, body[i * 4 ..][0..4], .little)) << word_shift(i);
+        }
+    }
+
+    // Normalized as std.math.big expects: no leading zero limbs, and zero
+    // is positive
+    var n = cap;
+    while (n > 1 and b.limbs[n - 1] == 0) n -= 1;
+    b.len = n;
+    b.positive = @intFromBool(bytes[1] == 0 or (n == 1 and b.limbs[0] == 0));
+    return true;
+}
@@ -1,12 +1,20 @@
 //! BigInt wrapper module for Cu runtime
-//! Provides arbitrary-precision integer arithmetic using Zig's std.math.big.Int
+//! Provides arbitrary-precision integer arithmetic using Zig's std.math.big.int
 //! All functions are exported as C-compatible symbols for WASM/FFI usage
 
 const std = @import("std");
 const math = std.math;
 const Allocator = std.mem.Allocator;
 
+const Const = math.big.int.Const;
+const Mutable = math.big.int.Mutable;
+const Limb = math.big.Limb;
+const DoubleLimb = std.meta.Int(.unsigned, 2 * @bitSizeOf(Limb));
+const LIMB_BITS = @bitSizeOf(Limb);
+
 /// Global allocator instance - must be set via bigint_set_allocator before use
+/// Only scratch memory comes from it (multiplication and division buffers,
+/// tostring output); the numbers themselves are Lua userdata
 var lua_allocator: Allocator = undefined;
 var allocator_initialized: bool = false;
 
@@ -18,174 +26,451 @@ export fn bigint_set_allocator(allocator: *anyopaque) void {
     allocator_initialized = true;
 }
 
-/// Opaque handle to a BigInt instance
-/// Wraps std.math.big.Int.Managed with proper memory management
-pub const BigIntHandle = struct {
-    bigint: math.big.int.Managed,
-
-    /// Initialize a new BigIntHandle with the given allocator
-    pub fn init(allocator: Allocator) !*BigIntHandle {
-        const handle = try allocator.create(BigIntHandle);
-        handle.* = BigIntHandle{
-            .bigint = try math.big.int.Managed.init(allocator),
-        };
-        return handle;
-    }
+/// A bigint as lbigint.c lays it out at the front of its userdata
+/// The limbs follow this header in the same allocation, or live in the
+/// userdata's user value once an in-place operation has outgrown them.
+/// Lua's collector owns them either way; nothing here allocates or frees
+/// a number's limbs, so results need `capacity` of at least
+/// bigint_result_limbs.
+pub const BigInt = extern struct {
+    limbs: [*]Limb,
+    len: usize,
+    capacity: usize,
+    positive: c_int,
 
-    /// Initialize a new BigIntHandle from an i64 value
-    pub fn initFromI64(allocator: Allocator, value: i64) !*BigIntHandle {
-        const handle = try allocator.create(BigIntHandle);
-        handle.* = BigIntHandle{
-            .bigint = try math.big.int.Managed.initSet(allocator, value),
-        };
-        return handle;
+    fn toConst(self: *const BigInt) Const {
+        return .{ .limbs = self.limbs[0..self.len], .positive = self.positive != 0 };
     }
 
-    /// Initialize a new BigIntHandle from a string (base 10)
-    pub fn initFromString(allocator: Allocator, str: []const u8, base: u8) !*BigIntHandle {
-        const handle = try allocator.create(BigIntHandle);
-        handle.* = BigIntHandle{
-            .bigint = try math.big.int.Managed.init(allocator),
-        };
-
-        try handle.bigint.setString(base, str);
-        return handle;
+    fn toMutable(self: *const BigInt) Mutable {
+        return .{ .limbs = self.limbs[0..self.capacity], .len = self.len, .positive = self.positive != 0 };
     }
 
-    /// Free all resources associated with this BigIntHandle
-    pub fn deinit(self: *BigIntHandle, allocator: Allocator) void {
-        self.bigint.deinit();
-        allocator.destroy(self);
+    fn setMetadata(self: *BigInt, m: Mutable) void {
+        self.len = m.len;
+        self.positive = @intFromBool(m.positive);
     }
 };
 
 // ============================================================================
-// Creation and Destruction
+// Creation
 // ============================================================================
 
-/// Create a new BigInt initialized to 0
-/// @return Handle to the new BigInt, or null on allocation failure
-export fn bigint_new() ?*BigIntHandle {
-    if (!allocator_initialized) return null;
-    return BigIntHandle.init(lua_allocator) catch null;
+/// Limbs an i64 needs; lbigint.c's BIGINT_I64_LIMBS
+pub const I64_LIMBS = math.big.int.calcTwosCompLimbCount(64);
+
+/// Set a BigInt from a 64-bit signed integer
+/// @param r Result with capacity for I64_LIMBS limbs
+export fn bigint_set_i64(r: *BigInt, value: i64) void {
+    var m = r.toMutable();
+    m.set(value);
+    r.setMetadata(m);
 }
 
-/// Create a new BigInt from a 64-bit signed integer
-/// @param value The initial value
-/// @return Handle to the new BigInt, or null on allocation failure
-export fn bigint_new_from_i64(value: i64) ?*BigIntHandle {
-    if (!allocator_initialized) return null;
-    return BigIntHandle.initFromI64(lua_allocator, value) catch null;
+/// Limbs a number parsed from `len` digits in `base` can need
+export fn bigint_string_limbs(len: usize, base: c_int) usize {
+    if (base < 2 or base > 36) return 1;
+    return @max(math.big.int.calcSetStringLimbCount(@intCast(base), len), 1);
 }
 
-/// Create a new BigInt from a string with specified base
+/// Set a BigInt from a string with specified base
+/// @param r Result with capacity for bigint_string_limbs(len, base) limbs
 /// @param str Pointer to string bytes
 /// @param len Length of string
 /// @param base Number base (2-36)
-/// @return Handle to the new BigInt, or null on allocation/parse failure
-export fn bigint_new_from_string(str: [*]const u8, len: usize, base: c_int) ?*BigIntHandle {
-    if (!allocator_initialized) return null;
-    if (base < 2 or base > 36) return null;
+/// @return 0, or -1 on allocation/parse failure
+export fn bigint_set_string(r: *BigInt, str: [*]const u8, len: usize, base: c_int) c_int {
+    if (!allocator_initialized) return -1;
+    if (base < 2 or base > 36) return -1;
+    if (r.capacity < bigint_string_limbs(len, base)) return -1;
 
-    const slice = str[0..len];
-    return BigIntHandle.initFromString(lua_allocator, slice, @intCast(base)) catch null;
-}
+    var arena = std.heap.ArenaAllocator.init(lua_allocator);
+    defer arena.deinit();
+    const x = parse_string(arena.allocator(), str[0..len], @intCast(base)) catch return -1;
 
-/// Free a BigInt and all its resources
-/// @param handle The BigInt handle to free (must not be null)
-export fn bigint_free(handle: *BigIntHandle) void {
-    handle.deinit(lua_allocator);
+    var m = r.toMutable();
+    m.copy(x);
+    r.setMetadata(m);
+    return 0;
 }
 
 // ============================================================================
 // Arithmetic Operations
 // ============================================================================
 
-/// Add two BigInts: returns new BigInt = a + b
-/// @param a First operand
-/// @param b Second operand
-/// @return New BigInt handle, or null on failure
-export fn bigint_add(a: *const BigIntHandle, b: *const BigIntHandle) ?*BigIntHandle {
-    if (!allocator_initialized) return null;
-    const result = BigIntHandle.init(lua_allocator) catch return null;
-    result.bigint.add(&a.bigint, &b.bigint) catch {
-        result.deinit(lua_allocator);
-        return null;
-    };
-    return result;
-}
-
-/// Subtract two BigInts: returns new BigInt = a - b
-/// @param a First operand (minuend)
-/// @param b Second operand (subtrahend)
-/// @return New BigInt handle, or null on failure
-export fn bigint_sub(a: *const BigIntHandle, b: *const BigIntHandle) ?*BigIntHandle {
-    if (!allocator_initialized) return null;
-    const result = BigIntHandle.init(lua_allocator) catch return null;
-    result.bigint.sub(&a.bigint, &b.bigint) catch {
-        result.deinit(lua_allocator);
-        return null;
+/// Operations of bigint_apply, numbered as in lbigint.c. The bitwise ones
+/// treat negative numbers as infinite two's complement, as Lua's operators
+/// do for integers.
+const Op = enum(c_int) {
+    add = 0,
+    sub = 1,
+    mul = 2,
+    div = 3,
+    mod = 4,
+    band = 5,
+    bor = 6,
+    bxor = 7,
+    gcd = 8,
+};
+
+// Limbs a op b can need
+fn result_limbs(a: Const, b: Const, op: Op) usize {
+    return switch (op) {
+        .add, .sub, .band, .bor, .bxor => @max(a.limbs.len, b.limbs.len) + 1,
+        .mul => a.limbs.len + b.limbs.len + 1,
+        .div => a.limbs.len + 1,
+        .mod => b.limbs.len + 1,
+        .gcd => @max(a.limbs.len, b.limbs.len),
     };
-    return result;
 }
 
-/// Multiply two BigInts: returns new BigInt = a * b
-/// @param a First operand
-/// @param b Second operand
-/// @return New BigInt handle, or null on failure
-export fn bigint_mul(a: *const BigIntHandle, b: *const BigIntHandle) ?*BigIntHandle {
-    if (!allocator_initialized) return null;
-    const result = BigIntHandle.init(lua_allocator) catch return null;
-    result.bigint.mul(&a.bigint, &b.bigint) catch {
-        result.deinit(lua_allocator);
-        return null;
-    };
-    return result;
+fn same_limbs(m: Mutable, x: Const) bool {
+    return @intFromPtr(m.limbs.ptr) == @intFromPtr(x.limbs.ptr);
 }
 
-/// Divide two BigInts (truncating division): returns new BigInt = a / b
-/// @param a Dividend
-/// @param b Divisor (must not be zero)
-/// @return New BigInt handle, or null on failure (division by zero or allocation error)
-export fn bigint_div(a: *const BigIntHandle, b: *const BigIntHandle) ?*BigIntHandle {
-    if (!allocator_initialized) return null;
+// r = a op b. Division truncates; div and mod reject a zero divisor.
+// For add, sub and mul, r may be a or b.
+fn apply(r: *BigInt, a: Const, b: Const, op: Op) !void {
+    var m = r.toMutable();
+    switch (op) {
+        .add => m.add(a, b),
+        .sub => m.sub(a, b),
+        .mul => {
+            var aliases: usize = 0;
+            if (same_limbs(m, a)) aliases += 1;
+            if (same_limbs(m, b)) aliases += 1;
+            if (aliases == 0) {
+                m.mulNoAlias(a, b, lua_allocator);
+            } else {
+                const len = math.big.int.calcMulLimbsBufferLen(a.limbs.len, b.limbs.len, aliases);
+                const buffer = try lua_allocator.alloc(Limb, len);
+                defer lua_allocator.free(buffer);
+                m.mul(a, b, buffer, lua_allocator);
+            }
+        },
+        .div, .mod => {
+            if (b.eqlZero()) return error.DivisionByZero;
+            // The half of the quotient and remainder that is thrown away
+            const other_len = if (op == .div) b.limbs.len + 1 else a.limbs.len + 1;
+            const len = other_len + math.big.int.calcDivLimbsBufferLen(a.limbs.len, b.limbs.len);
+            const buffer = try lua_allocator.alloc(Limb, len);
+            defer lua_allocator.free(buffer);
+            var other = Mutable.init(buffer[0..other_len], 0);
+            if (op == .div) {
+                m.divTrunc(&other, a, b, buffer[other_len..]);
+            } else {
+                other.divTrunc(&m, a, b, buffer[other_len..]);
+            }
+        },
+        .band => m.bitAnd(a, b),
+        .bor => m.bitOr(a, b),
+        .bxor => m.bitXor(a, b),
+        .gcd => {
+            var arena = std.heap.ArenaAllocator.init(lua_allocator);
+            defer arena.deinit();
+            try gcd(arena.allocator(), &m, a, b);
+        },
+    }
+    r.setMetadata(m);
+}
 
-    // Check for division by zero
-    if (b.bigint.toConst().eqlZero()) return null;
+/// Limbs of capacity a result of a op b needs
+/// @param op 0 add, 1 sub, 2 mul, 3 div, 4 mod, 5 and, 6 or, 7 xor, 8 gcd
+export fn bigint_result_limbs(a: *const BigInt, b: *const BigInt, op: c_int) usize {
+    const operation = std.meta.intToEnum(Op, op) catch return 1;
+    return result_limbs(a.toConst(), b.toConst(), operation);
+}
 
-    const result = BigIntHandle.init(lua_allocator) catch return null;
-    var remainder = math.big.int.Managed.init(lua_allocator) catch {
-        result.deinit(lua_allocator);
-        return null;
-    };
-    defer remainder.deinit();
+/// Store a op b in r
+/// @param r Result with capacity for bigint_result_limbs(a, b, op) limbs;
+///          may be a or b for add, sub and mul
+/// @param op 0 add, 1 sub, 2 mul, 3 div, 4 mod, 5 and, 6 or, 7 xor, 8 gcd
+/// @return 0, or -1 on failure (division by zero or allocation error)
+export fn bigint_apply(r: *BigInt, a: *const BigInt, b: *const BigInt, op: c_int) c_int {
+    if (!allocator_initialized) return -1;
+    const operation = std.meta.intToEnum(Op, op) catch return -1;
+    const x = a.toConst();
+    const y = b.toConst();
+    if (r.capacity < result_limbs(x, y, operation)) return -1;
+    apply(r, x, y, operation) catch return -1;
+    return 0;
+}
 
-    result.bigint.divTrunc(&remainder, &a.bigint, &b.bigint) catch {
-        result.deinit(lua_allocator);
-        return null;
-    };
-    return result;
+/// Limbs a shifted by `shift` bits can need, or the largest usize when
+/// that many cannot be counted
+export fn bigint_shift_limbs(a: *const BigInt, shift: i64) usize {
+    if (shift <= 0) return a.len + 1;
+    const limbs = math.cast(usize, @as(u64, @intCast(shift)) / LIMB_BITS) orelse return math.maxInt(usize);
+    return math.add(usize, a.len + 1, limbs) catch math.maxInt(usize);
 }
 
-/// Modulo operation: returns new BigInt = a % b
-/// @param a Dividend
-/// @param b Divisor (must not be zero)
-/// @return New BigInt handle, or null on failure (division by zero or allocation error)
-export fn bigint_mod(a: *const BigIntHandle, b: *const BigIntHandle) ?*BigIntHandle {
-    if (!allocator_initialized) return null;
+/// Store a shifted left by `shift` bits in r, or right by -shift bits.
+/// Right shifts round toward negative infinity, like floor division by a
+/// power of two.
+/// @param r Result with capacity for bigint_shift_limbs(a, shift) limbs
+/// @return 0, or -1 if r is too small
+export fn bigint_shift(r: *BigInt, a: *const BigInt, shift: i64) c_int {
+    if (r.capacity < bigint_shift_limbs(a, shift)) return -1;
+    var m = r.toMutable();
+    const bits = math.cast(usize, @abs(shift)) orelse math.maxInt(usize);
+    if (shift >= 0) m.shiftLeft(a.toConst(), bits) else m.shiftRight(a.toConst(), bits);
+    r.setMetadata(m);
+    return 0;
+}
 
-    // Check for division by zero
-    if (b.bigint.toConst().eqlZero()) return null;
+// ============================================================================
+// Number Theory
+// ============================================================================
 
-    var quotient = math.big.int.Managed.init(lua_allocator) catch return null;
-    defer quotient.deinit();
+// x mod m for m > 0, in [0, m), with room for m.limbs.len + 1 limbs
+fn reduce(allocator: Allocator, x: Const, m: Const) !Mutable {
+    var q = try scratch(allocator, x.limbs.len + 1);
+    var r = try scratch(allocator, m.limbs.len + 1);
+    const buffer = try allocator.alloc(Limb, math.big.int.calcDivLimbsBufferLen(x.limbs.len, m.limbs.len));
+    q.divTrunc(&r, x, m, buffer);
+    if (!r.positive and !r.toConst().eqlZero()) r.add(r.toConst(), m);
+    return r;
+}
 
-    const result = BigIntHandle.init(lua_allocator) catch return null;
-    quotient.divTrunc(&result.bigint, &a.bigint, &b.bigint) catch {
-        result.deinit(lua_allocator);
-        return null;
-    };
-    return result;
+// Euclid's algorithm on |a| and |b|
+fn gcd(allocator: Allocator, r: *Mutable, a: Const, b: Const) !void {
+    const len = @max(a.limbs.len, b.limbs.len) + 1;
+    var x = try scratch(allocator, len);
+    var y = try scratch(allocator, len);
+    var rem = try scratch(allocator, len);
+    var q = try scratch(allocator, len);
+    const buffer = try allocator.alloc(Limb, math.big.int.calcDivLimbsBufferLen(len, len));
+    x.copy(a.abs());
+    y.copy(b.abs());
+    while (!y.toConst().eqlZero()) {
+        q.divTrunc(&rem, x.toConst(), y.toConst(), buffer);
+        const t = x;
+        x = y;
+        y = rem;
+        rem = t;
+    }
+    r.copy(x.toConst());
+}
+
+// The inverse of a mod m, or false if gcd(a, m) is not 1. Extended Euclid:
+// t0 * a = r0 (mod m) at every step, and every |t| stays within m.
+fn modinv(allocator: Allocator, r: *Mutable, a: Const, m: Const) !bool {
+    const len = m.limbs.len + 2;
+    var r0 = try scratch(allocator, len);
+    var r1 = try reduce(allocator, a, m);
+    var rem = try scratch(allocator, len);
+    var q = try scratch(allocator, len);
+    var t0 = try scratch(allocator, len);
+    var t1 = try scratch(allocator, len);
+    var t2 = try scratch(allocator, len);
+    var product = try scratch(allocator, 2 * len);
+    const buffer = try allocator.alloc(Limb, math.big.int.calcDivLimbsBufferLen(len, len));
+    r0.copy(m);
+    t1.set(1);
+    while (!r1.toConst().eqlZero()) {
+        q.divTrunc(&rem, r0.toConst(), r1.toConst(), buffer);
+        var t = r0;
+        r0 = r1;
+        r1 = rem;
+        rem = t;
+        product.mulNoAlias(q.toConst(), t1.toConst(), allocator);
+        t2.sub(t0.toConst(), product.toConst());
+        t = t0;
+        t0 = t1;
+        t1 = t2;
+        t2 = t;
+    }
+    if (r0.toConst().orderAgainstScalar(1) != .eq) return false;
+    if (!t0.positive and !t0.toConst().eqlZero()) t0.add(t0.toConst(), m);
+    r.copy(t0.toConst());
+    return true;
+}
+
+// Montgomery multiplication modulo an odd m of n limbs, R = 2^(n * limb
+// bits). A number x is held as x * R mod m, so a product needs a reduction
+// by R, which is n limb shifts, instead of a division by m.
+const Montgomery = struct {
+    m: []const Limb,
+    // -1 / m mod 2^limb bits
+    inv: Limb,
+    // n + 2 limbs of working space
+    t: []Limb,
+
+    fn init(allocator: Allocator, m: []const Limb) !Montgomery {
+        // Newton's iteration doubles the correct low bits of 1 / m each
+        // step; m itself is right to 3 bits, as m * m = 1 mod 8 for odd m
+        var x: Limb = m[0];
+        var bits: usize = 3;
+        while (bits < LIMB_BITS) : (bits *= 2) x *%= 2 -% m[0] *% x;
+        return .{ .m = m, .inv = 0 -% x, .t = try allocator.alloc(Limb, m.len + 2) };
+    }
+
+    // out = x * y / R mod m for x, y < m, all n limbs. out may be x or y.
+    fn mul(self: Montgomery, out: []Limb, x: []const Limb, y: []const Limb) void {
+        const n = self.m.len;
+        const t = self.t;
+        @memset(t, 0);
+        for (0..n) |i| {
+            // t += x * y[i]
+            var carry: Limb = 0;
+            for (0..n) |j| {
+                const wide = @as(DoubleLimb, t[j]) + @as(DoubleLimb, x[j]) * y[i] + carry;
+                t[j] = @truncate(wide);
+                carry = @truncate(wide >> LIMB_BITS);
+            }
+            var wide = @as(DoubleLimb, t[n]) + carry;
+            t[n] = @truncate(wide);
+            t[n + 1] = @truncate(wide >> LIMB_BITS);
+
+            // t = (t + u * m) / 2^limb bits, with u chosen so the low limb
+            // of the sum is zero
+            const u = t[0] *% self.inv;
+            wide = @as(DoubleLimb, t[0]) + @as(DoubleLimb, u) * self.m[0];
+            carry = @truncate(wide >> LIMB_BITS);
+            for (1..n) |j| {
+                wide = @as(DoubleLimb, t[j]) + @as(DoubleLimb, u) * self.m[j] + carry;
+                t[j - 1] = @truncate(wide);
+                carry = @truncate(wide >> LIMB_BITS);
+            }
+            wide = @as(DoubleLimb, t[n]) + carry;
+            t[n - 1] = @truncate(wide);
+            t[n] = t[n + 1] + @as(Limb, @truncate(wide >> LIMB_BITS));
+        }
+
+        // t < 2m
+        if (t[n] == 0 and below(t[0..n], self.m)) {
+            @memcpy(out, t[0..n]);
+            return;
+        }
+        var borrow: Limb = 0;
+        for (0..n) |j| {
+            const d = @subWithOverflow(t[j], self.m[j]);
+            const e = @subWithOverflow(d[0], borrow);
+            out[j] = e[0];
+            borrow = d[1] | e[1];
+        }
+    }
+
+    // x * R mod m, for x < m
+    fn enter(self: Montgomery, allocator: Allocator, out: []Limb, x: Const) !void {
+        const m = Const{ .limbs = self.m, .positive = true };
+        var shifted = try scratch(allocator, x.limbs.len + self.m.len + 1);
+        shifted.shiftLeft(x, self.m.len * LIMB_BITS);
+        const r = try reduce(allocator, shifted.toConst(), m);
+        @memset(out, 0);
+        @memcpy(out[0..r.len], r.limbs[0..r.len]);
+    }
+};
+
+// Whether a < b, both of the same length
+fn below(a: []const Limb, b: []const Limb) bool {
+    var i = a.len;
+    while (i > 0) {
+        i -= 1;
+        if (a[i] != b[i]) return a[i] < b[i];
+    }
+    return false;
+}
+
+// base^e mod m for e >= 0 and m > 0, in [0, m)
+fn powmod(allocator: Allocator, r: *Mutable, base: Const, e: Const, m: Const) !void {
+    if (m.orderAgainstScalar(1) == .eq) {
+        r.set(0);
+        return;
+    }
+    const x = try reduce(allocator, base, m);
+    if (m.limbs[0] & 1 == 0) return powmod_plain(allocator, r, x.toConst(), e, m);
+
+    const n = m.limbs.len;
+    const mont = try Montgomery.init(allocator, m.limbs);
+    const one = Const{ .limbs = &[_]Limb{1}, .positive = true };
+
+    // x^0 to x^15, for e's 4-bit digits
+    const table = try allocator.alloc(Limb, 16 * n);
+    try mont.enter(allocator, table[0..n], one);
+    try mont.enter(allocator, table[n .. 2 * n], x.toConst());
+    for (2..16) |k| mont.mul(table[k * n ..][0..n], table[(k - 1) * n ..][0..n], table[n .. 2 * n]);
+
+    const acc = try allocator.alloc(Limb, n);
+    @memcpy(acc, table[0..n]);
+    var digits = (e.bitCountAbs() + 3) / 4;
+    while (digits > 0) {
+        digits -= 1;
+        const bit = digits * 4;
+        const digit: usize = @intCast((e.limbs[bit / LIMB_BITS] >> @intCast(bit % LIMB_BITS)) & 0xF);
+        for (0..4) |_| mont.mul(acc, acc, acc);
+        if (digit != 0) mont.mul(acc, acc, table[digit * n ..][0..n]);
+    }
+
+    // Back out of Montgomery form: acc * 1 / R
+    const plain_one = try allocator.alloc(Limb, n);
+    @memset(plain_one, 0);
+    plain_one[0] = 1;
+    mont.mul(acc, acc, plain_one);
+    var len = n;
+    while (len > 1 and acc[len - 1] == 0) len -= 1;
+    r.copy(.{ .limbs = acc[0..len], .positive = true });
+}
+
+// Square and multiply with a division per step, for even moduli
+fn powmod_plain(allocator: Allocator, r: *Mutable, x: Const, e: Const, m: Const) !void {
+    const n = m.limbs.len;
+    var acc = try scratch(allocator, n + 1);
+    var product = try scratch(allocator, 2 * n + 1);
+    var q = try scratch(allocator, 2 * n + 1);
+    const buffer = try allocator.alloc(Limb, math.big.int.calcDivLimbsBufferLen(2 * n + 1, n));
+    acc.set(1);
+    var i = e.bitCountAbs();
+    while (i > 0) {
+        i -= 1;
+        product.mulNoAlias(acc.toConst(), acc.toConst(), allocator);
+        q.divTrunc(&acc, product.toConst(), m, buffer);
+        if ((e.limbs[i / LIMB_BITS] >> @intCast(i % LIMB_BITS)) & 1 != 0) {
+            product.mulNoAlias(acc.toConst(), x, allocator);
+            q.divTrunc(&acc, product.toConst(), m, buffer);
+        }
+    }
+    r.copy(acc.toConst());
+}
+
+fn is_positive(x: Const) bool {
+    return x.positive and !x.eqlZero();
+}
+
+/// Store base^e mod m in r, using Montgomery multiplication when m is odd
+/// @param r Result with capacity for m's limbs; not an operand
+/// @return 0, or -1 on failure (m not positive, e negative, allocation error)
+export fn bigint_powmod(r: *BigInt, base: *const BigInt, e: *const BigInt, m: *const BigInt) c_int {
+    if (!allocator_initialized) return -1;
+    const mc = m.toConst();
+    const ec = e.toConst();
+    if (!is_positive(mc) or (!ec.positive and !ec.eqlZero())) return -1;
+    if (r.capacity < mc.limbs.len) return -1;
+
+    var arena = std.heap.ArenaAllocator.init(lua_allocator);
+    defer arena.deinit();
+    var result = r.toMutable();
+    powmod(arena.allocator(), &result, base.toConst(), ec, mc) catch return -1;
+    r.setMetadata(result);
+    return 0;
+}
+
+/// Store the inverse of a mod m in r, in [0, m)
+/// @param r Result with capacity for m's limbs; not an operand
+/// @return 0, 1 if a has no inverse mod m, or -1 on failure (m not
+///         positive, allocation error)
+export fn bigint_modinv(r: *BigInt, a: *const BigInt, m: *const BigInt) c_int {
+    if (!allocator_initialized) return -1;
+    const mc = m.toConst();
+    if (!is_positive(mc) or r.capacity < mc.limbs.len) return -1;
+
+    var arena = std.heap.ArenaAllocator.init(lua_allocator);
+    defer arena.deinit();
+    var result = r.toMutable();
+    const found = modinv(arena.allocator(), &result, a.toConst(), mc) catch return -1;
+    if (!found) return 1;
+    r.setMetadata(result);
+    return 0;
 }
 
 // ============================================================================
@@ -196,9 +481,8 @@ export fn bigint_mod(a: *const BigIntHandle, b: *const BigIntHandle) ?*BigIntHan
 /// @param a First operand
 /// @param b Second operand
 /// @return -1 if a < b, 0 if a == b, 1 if a > b
-export fn bigint_compare(a: *const BigIntHandle, b: *const BigIntHandle) c_int {
-    const order = a.bigint.toConst().order(b.bigint.toConst());
-    return switch (order) {
+export fn bigint_compare(a: *const BigInt, b: *const BigInt) c_int {
+    return switch (a.toConst().order(b.toConst())) {
         .lt => -1,
         .eq => 0,
         .gt => 1,
@@ -209,71 +493,781 @@ export fn bigint_compare(a: *const BigIntHandle, b: *const BigIntHandle) c_int {
 // Conversion
 // ============================================================================
 
+/// Upper bound on the length of a in `base`, sign included
+export fn bigint_string_len(a: *const BigInt, base: c_int) usize {
+    if (base < 2 or base > 36) return 1;
+    return a.toConst().sizeInBaseUpperBound(@intCast(base));
+}
+
 /// Convert BigInt to a string in specified base
-/// @param handle The BigInt to convert
+/// @param a The BigInt to convert
 /// @param base Number base (2-36)
-/// @param buf Output buffer
-/// @param max_len Maximum buffer length
+/// @param buf Output buffer, written directly
+/// @param max_len Buffer length, at least bigint_string_len(a, base)
 /// @return Length written, or -1 on failure
-export fn bigint_to_string(handle: *const BigIntHandle, base: c_int, buf: [*]u8, max_len: usize) c_int {
+export fn bigint_to_string(a: *const BigInt, base: c_int, buf: [*]u8, max_len: usize) c_int {
     if (!allocator_initialized) return -1;
     if (base < 2 or base > 36) return -1;
+    const x = a.toConst();
+    const radix: u8 = @intCast(base);
+    if (max_len < x.sizeInBaseUpperBound(radix)) return -1;
 
-    const str = handle.bigint.toConst().toStringAlloc(lua_allocator, @intCast(base), .lower) catch return -1;
-    defer lua_allocator.free(str);
-
-    if (str.len > max_len) return -1;
-
-    @memcpy(buf[0..str.len], str);
-    return @intCast(str.len);
+    var arena = std.heap.ArenaAllocator.init(lua_allocator);
+    defer arena.deinit();
+    const len = write_string(arena.allocator(), x, radix, buf[0..max_len]) catch return -1;
+    return @intCast(len);
 }
 
 /// Convert BigInt to i64
-/// @param handle The BigInt to convert
+/// @param a The BigInt to convert
 /// @return The i64 value, or 0 if doesn't fit
-export fn bigint_to_i64(handle: *const BigIntHandle) i64 {
-    return handle.bigint.toConst().toInt(i64) catch 0;
+export fn bigint_to_i64(a: *const BigInt) i64 {
+    return a.toConst().toInt(i64) catch 0;
+}
+
+// ============================================================================
+// Radix Conversion
+// ============================================================================
+
+// std's setString multiplies the whole number by the base once per digit,
+// and its toString divides the whole number by a half limb every few
+// digits: both quadratic in the digit count, with a large constant. Large
+// values are instead split at powers base^(leaf_digits * 2^i), so the work
+// goes into a few balanced multiplications (Karatsuba in std) and
+// divisions. Power-of-two bases need no arithmetic at all: each digit is a
+// fixed group of bits, which std's toString already writes directly.
+
+// Values of up to this many limbs convert directly
+const STRING_LEAF_LIMBS = 32;
+// leaf_digits * 2^MAX_POWERS digits is far beyond wasm32 memory
+const MAX_POWERS = 24;
+
+const Radix = struct {
+    allocator: Allocator,
+    base: u8,
+    // Digits one limb holds, and the digits of powers[0]
+    chunk_digits: usize,
+    leaf_digits: usize,
+    powers: [MAX_POWERS]Const = undefined,
+    power_count: usize = 0,
+
+    fn init(allocator: Allocator, base: u8) Radix {
+        var chunk: usize = 0;
+        var p: Limb = 1;
+        while (p <= math.maxInt(Limb) / base) : (chunk += 1) p *= base;
+        return .{
+            .allocator = allocator,
+            .base = base,
+            .chunk_digits = chunk,
+            .leaf_digits = chunk * (STRING_LEAF_LIMBS / 2),
+        };
+    }
+
+    fn width(self: *const Radix, i: usize) usize {
+        return self.leaf_digits << @intCast(i);
+    }
+
+    // base^width(i)
+    fn power(self: *Radix, i: usize) !Const {
+        if (i >= MAX_POWERS) return error.TooLarge;
+        while (self.power_count <= i) : (self.power_count += 1) {
+            if (self.power_count == 0) {
+                const one = try self.allocator.alloc(u8, self.leaf_digits + 1);
+                @memset(one, 0);
+                one[0] = 1;
+                self.powers[0] = try self.parse_leaf(one);
+            } else {
+                const p = self.powers[self.power_count - 1];
+                var square = try scratch(self.allocator, 2 * p.limbs.len + 1);
+                square.mulNoAlias(p, p, self.allocator);
+                self.powers[self.power_count] = square.toConst();
+            }
+        }
+        return self.powers[i];
+    }
+
+    // Digit values, most significant first, a limb's worth at a time
+    fn parse_leaf(self: *Radix, digits: []const u8) !Const {
+        var x = try scratch(self.allocator, digits.len / self.chunk_digits + 2);
+        var i: usize = 0;
+        while (i < digits.len) {
+            const n = @min(self.chunk_digits, digits.len - i);
+            var carry: Limb = 0;
+            var factor: Limb = 1;
+            for (digits[i .. i + n]) |d| {
+                carry = carry * self.base + d;
+                factor *= self.base;
+            }
+            // x = x * factor + carry
+            for (x.limbs[0..x.len]) |*limb| {
+                const wide = @as(DoubleLimb, limb.*) * factor + carry;
+                limb.* = @truncate(wide);
+                carry = @truncate(wide >> @bitSizeOf(Limb));
+            }
+            if (carry != 0) {
+                x.limbs[x.len] = carry;
+                x.len += 1;
+            }
+            i += n;
+        }
+        return x.toConst();
+    }
+
+    fn parse(self: *Radix, digits: []const u8) !Const {
+        if (digits.len <= self.leaf_digits) return self.parse_leaf(digits);
+        // The low half is exactly width(i) digits
+        var i: usize = 0;
+        while (i + 1 < MAX_POWERS and self.width(i + 1) < digits.len) i += 1;
+        const split = digits.len - self.width(i);
+        const high = try self.parse(digits[0..split]);
+        const low = try self.parse(digits[split..]);
+        const p = try self.power(i);
+        var x = try scratch(self.allocator, high.limbs.len + p.limbs.len + 2);
+        x.mulNoAlias(high, p, self.allocator);
+        x.add(x.toConst(), low);
+        return x.toConst();
+    }
+
+    // The digits of non-negative x, zero-padded to fill `out`
+    fn emit(self: *Radix, x: Const, out: []u8) !void {
+        if (x.limbs.len <= STRING_LEAF_LIMBS) {
+            const text = try self.allocator.alloc(u8, x.sizeInBaseUpperBound(self.base));
+            const buffer = try self.allocator.alloc(Limb, math.big.int.calcToStringLimbsBufferLen(x.limbs.len, self.base));
+            const len = x.toString(text, self.base, .lower, buffer);
+            @memset(out[0 .. out.len - len], '0');
+            @memcpy(out[out.len - len ..], text[0..len]);
+            return;
+        }
+        // The largest power with at most half of x's limbs, so x > p.
+        // Squaring at most doubles the limbs, so the estimate is safe.
+        const first = try self.power(0);
+        var i: usize = 0;
+        while (i + 1 < MAX_POWERS and 2 * (first.limbs.len << @intCast(i + 1)) <= x.limbs.len + 1) i += 1;
+        const p = try self.power(i);
+        var q = try scratch(self.allocator, x.limbs.len + 1);
+        var rem = try scratch(self.allocator, p.limbs.len + 1);
+        const buffer = try self.allocator.alloc(Limb, math.big.int.calcDivLimbsBufferLen(x.limbs.len, p.limbs.len));
+        q.divTrunc(&rem, x, p, buffer);
+        const split = out.len - self.width(i);
+        try self.emit(rem.toConst(), out[split..]);
+        try self.emit(q.toConst(), out[0..split]);
+    }
+};
+
+// The number `text` spells in `base`: an optional '-', then digits and
+// underscores, as std's setString reads it
+fn parse_string(allocator: Allocator, text: []const u8, base: u8) !Const {
+    var rest = text;
+    const negative = rest.len > 0 and rest[0] == '-';
+    if (negative) rest = rest[1..];
+    const digits = try allocator.alloc(u8, rest.len);
+    var n: usize = 0;
+    for (rest) |c| {
+        if (c == '_') continue;
+        digits[n] = try std.fmt.charToDigit(c, base);
+        n += 1;
+    }
+    var x = if (math.isPowerOfTwo(base))
+        try parse_bits(allocator, digits[0..n], base)
+    else blk: {
+        var radix = Radix.init(allocator, base);
+        break :blk try radix.parse(digits[0..n]);
+    };
+    x.positive = !negative or x.eqlZero();
+    return x;
+}
+
+// Power-of-two bases: each digit is the next group of bits up from the end
+fn parse_bits(allocator: Allocator, digits: []const u8, base: u8) !Const {
+    const shift: usize = math.log2_int(u8, base);
+    const bits = @bitSizeOf(Limb);
+    const limbs = try allocator.alloc(Limb, @max((digits.len * shift + bits - 1) / bits, 1));
+    @memset(limbs, 0);
+    var bit: usize = 0;
+    var i = digits.len;
+    while (i > 0) : (bit += shift) {
+        i -= 1;
+        const d: Limb = digits[i];
+        const at = bit / bits;
+        const offset = bit % bits;
+        limbs[at] |= d << @intCast(offset);
+        if (offset + shift > bits) limbs[at + 1] |= d >> @intCast(bits - offset);
+    }
+    var m = Mutable{ .limbs = limbs, .len = limbs.len, .positive = true };
+    m.normalize(limbs.len);
+    return m.toConst();
+}
+
+// x in `base` into out, which has x.sizeInBaseUpperBound(base) bytes;
+// returns the length
+fn write_string(allocator: Allocator, x: Const, base: u8, out: []u8) !usize {
+    if (math.isPowerOfTwo(base) or x.limbs.len <= STRING_LEAF_LIMBS) {
+        const buffer = try allocator.alloc(Limb, math.big.int.calcToStringLimbsBufferLen(x.limbs.len, base));
+        return x.toString(out, base, .lower, buffer);
+    }
+    const sign: usize = @intFromBool(!x.positive);
+    if (sign != 0) out[0] = '-';
+    const digits = out[sign..];
+    var radix = Radix.init(allocator, base);
+    try radix.emit(x.abs(), digits);
+    // emit pads to the bound; drop the extra leading zeros
+    const first = std.mem.indexOfNone(u8, digits, "0") orelse digits.len - 1;
+    std.mem.copyForwards(u8, digits, digits[first..]);
+    return sign + digits.len - first;
+}
+
+// ============================================================================
+// Decimal
+// ============================================================================
+
+/// A decimal as ldecimal.c lays it out: `value` is the number times
+/// 10^scale, with its limbs after the header as for a bigint
+pub const Decimal = extern struct {
+    value: BigInt,
+    scale: c_int,
+};
+
+/// Largest scale; ldecimal.c's DECIMAL_MAX_SCALE
+pub const MAX_SCALE = 38;
+
+/// How a result that does not fit its scale is rounded, numbered as in
+/// ldecimal.c
+const Rounding = enum(c_int) {
+    down = 0,
+    up = 1,
+    floor = 2,
+    ceiling = 3,
+    half_up = 4,
+    half_down = 5,
+    half_even = 6,
+};
+
+// Scaled division of two scale-38 operands multiplies by up to 10^76
+const MAX_POW10 = 2 * MAX_SCALE;
+const POW10: [MAX_POW10 + 1]u256 = blk: {
+    var table: [MAX_POW10 + 1]u256 = undefined;
+    table[0] = 1;
+    for (1..table.len) |i| table[i] = table[i - 1] * 10;
+    break :blk table;
+};
+const POW10_LIMBS = math.big.int.calcTwosCompLimbCount(256);
+const I128_LIMBS = math.big.int.calcTwosCompLimbCount(128);
+
+fn pow10(k: usize, limbs: *[POW10_LIMBS]Limb) Const {
+    return Mutable.init(limbs, POW10[k]).toConst();
+}
+
+// Limbs 10^k can need: 10^k < 16^k
+fn pow10_limbs(k: usize) usize {
+    return k * 4 / @bitSizeOf(Limb) + 1;
+}
+
+fn scale_of(d: *const Decimal) ?usize {
+    if (d.scale < 0 or d.scale > MAX_SCALE) return null;
+    return @intCast(d.scale);
+}
+
+// Whether a truncated quotient with a non-zero remainder moves one away
+// from zero. `half` orders the remainder against the rest of the divisor.
+fn round_away(mode: Rounding, negative: bool, half: math.Order, odd: bool) bool {
+    return switch (mode) {
+        .down => false,
+        .up => true,
+        .floor => negative,
+        .ceiling => !negative,
+        .half_up => half != .lt,
+        .half_down => half == .gt,
+        .half_even => half == .gt or (half == .eq and odd),
+    };
+}
+
+// The 128-bit fast path. Operands that fit an i128 (except its minimum, so
+// negating and truncating division cannot overflow) are computed without
+// scratch memory; any overflow falls back to the general path.
+
+fn small(x: Const) ?i128 {
+    const v = x.toInt(i128) catch return null;
+    return if (v == math.minInt(i128)) null else v;
+}
+
+fn checked(result: anytype) ?i128 {
+    if (result[1] != 0 or result[0] == math.minInt(i128)) return null;
+    return result[0];
+}
+
+fn pow10_i128(k: usize) ?i128 {
+    return if (k > MAX_SCALE) null else @intCast(POW10[k]);
+}
+
+fn round_div_i128(n: i128, d: i128, mode: Rounding) i128 {
+    const q = @divTrunc(n, d);
+    const rem = @rem(n, d);
+    if (rem == 0) return q;
+    const negative = (n < 0) != (d < 0);
+    const rem_abs = @abs(rem);
+    const half = math.order(rem_abs, @abs(d) - rem_abs);
+    if (!round_away(mode, negative, half, (q & 1) != 0)) return q;
+    return if (negative) q - 1 else q + 1;
+}
+
+fn rescale_i128(v: i128, from: usize, to: usize, mode: Rounding) ?i128 {
+    if (to >= from) return checked(@mulWithOverflow(v, pow10_i128(to - from) orelse return null));
+    return round_div_i128(v, pow10_i128(from - to) orelse return null, mode);
+}
+
+fn apply_i128(x: i128, sa: usize, y: i128, sb: usize, s: usize, op: Op, mode: Rounding) ?i128 {
+    switch (op) {
+        .add, .sub => {
+            const w = @max(sa, sb);
+            const xw = checked(@mulWithOverflow(x, pow10_i128(w - sa) orelse return null)) orelse return null;
+            const yw = checked(@mulWithOverflow(y, pow10_i128(w - sb) orelse return null)) orelse return null;
+            const sum = if (op == .add) checked(@addWithOverflow(xw, yw)) else checked(@subWithOverflow(xw, yw));
+            const v = sum orelse return null;
+            return rescale_i128(v, w, s, mode);
+        },
+        .mul => return rescale_i128(checked(@mulWithOverflow(x, y)) orelse return null, sa + sb, s, mode),
+        .div => {
+            // x / y at scale s is x * 10^(s + sb - sa) / y
+            if (s + sb >= sa) {
+                const n = checked(@mulWithOverflow(x, pow10_i128(s + sb - sa) orelse return null)) orelse return null;
+                return round_div_i128(n, y, mode);
+            }
+            const d = checked(@mulWithOverflow(y, pow10_i128(sa - s - sb) orelse return null)) orelse return null;
+            return round_div_i128(x, d, mode);
+        },
+        else => return null,
+    }
+}
+
+fn set_i128(r: *BigInt, v: i128) void {
+    var m = r.toMutable();
+    m.set(v);
+    r.setMetadata(m);
+}
+
+// The general path, on scratch from an arena over lua_allocator
+
+fn scratch(allocator: Allocator, len: usize) !Mutable {
+    return Mutable.init(try allocator.alloc(Limb, len), 0);
+}
+
+// x * 10^k
+fn scaled(allocator: Allocator, x: Const, k: usize) !Const {
+    if (k == 0) return x;
+    var limbs: [POW10_LIMBS]Limb = undefined;
+    const p = pow10(k, &limbs);
+    var t = try scratch(allocator, x.limbs.len + p.limbs.len + 1);
+    t.mulNoAlias(x, p, allocator);
+    return t.toConst();
+}
+
+// r = n / d, rounded. r has room for n.limbs.len + 2 limbs.
+fn divide_round(allocator: Allocator, r: *BigInt, n: Const, d: Const, mode: Rounding) !void {
+    var q = r.toMutable();
+    var rem = try scratch(allocator, d.limbs.len + 1);
+    const buffer = try allocator.alloc(Limb, math.big.int.calcDivLimbsBufferLen(n.limbs.len, d.limbs.len));
+    q.divTrunc(&rem, n, d, buffer);
+    if (!rem.toConst().eqlZero()) {
+        var rest = try scratch(allocator, d.limbs.len + 1);
+        rest.sub(d.abs(), rem.toConst().abs());
+        const half = rem.toConst().abs().order(rest.toConst());
+        const negative = n.positive != d.positive;
+        if (round_away(mode, negative, half, (q.limbs[0] & 1) != 0)) {
+            q.addScalar(q.toConst(), @as(i8, if (negative) -1 else 1));
+        }
+    }
+    r.setMetadata(q);
+}
+
+fn rescale_general(allocator: Allocator, r: *BigInt, x: Const, from: usize, to: usize, mode: Rounding) !void {
+    if (to >= from) {
+        var m = r.toMutable();
+        m.copy(try scaled(allocator, x, to - from));
+        r.setMetadata(m);
+    } else {
+        var limbs: [POW10_LIMBS]Limb = undefined;
+        try divide_round(allocator, r, x, pow10(from - to, &limbs), mode);
+    }
+}
+
+fn apply_general(r: *BigInt, x: Const, sa: usize, y: Const, sb: usize, s: usize, op: Op, mode: Rounding) !void {
+    var arena = std.heap.ArenaAllocator.init(lua_allocator);
+    defer arena.deinit();
+    const allocator = arena.allocator();
+    switch (op) {
+        .add, .sub => {
+            const w = @max(sa, sb);
+            const xw = try scaled(allocator, x, w - sa);
+            const yw = try scaled(allocator, y, w - sb);
+            var t = try scratch(allocator, @max(xw.limbs.len, yw.limbs.len) + 1);
+            if (op == .add) t.add(xw, yw) else t.sub(xw, yw);
+            try rescale_general(allocator, r, t.toConst(), w, s, mode);
+        },
+        .mul => {
+            var t = try scratch(allocator, x.limbs.len + y.limbs.len + 1);
+            t.mulNoAlias(x, y, allocator);
+            try rescale_general(allocator, r, t.toConst(), sa + sb, s, mode);
+        },
+        .div => {
+            if (s + sb >= sa) {
+                try divide_round(allocator, r, try scaled(allocator, x, s + sb - sa), y, mode);
+            } else {
+                try divide_round(allocator, r, x, try scaled(allocator, y, sa - s - sb), mode);
+            }
+        },
+        else => return error.Unsupported,
+    }
+}
+
+// Limbs a rescale of a `len`-limb value can need
+fn rescaled_limbs(len: usize, from: usize, to: usize) usize {
+    return if (to >= from) len + pow10_limbs(to - from) + 1 else len + 2;
+}
+
+fn decimal_limbs(x_len: usize, sa: usize, y_len: usize, sb: usize, s: usize, op: Op) usize {
+    const len = switch (op) {
+        .add, .sub => blk: {
+            const w = @max(sa, sb);
+            const aligned = @max(x_len + pow10_limbs(w - sa), y_len + pow10_limbs(w - sb)) + 1;
+            break :blk rescaled_limbs(aligned, w, s);
+        },
+        .mul => rescaled_limbs(x_len + y_len + 1, sa + sb, s),
+        .div => if (s + sb >= sa) x_len + pow10_limbs(s + sb - sa) + 3 else x_len + 2,
+        else => 1,
+    };
+    return @max(len, I128_LIMBS);
+}
+
+/// Limbs of capacity a result of a op b at `scale` needs
+/// @param op 0 add, 1 sub, 2 mul, 3 div
+export fn decimal_result_limbs(a: *const Decimal, b: *const Decimal, op: c_int, scale: c_int) usize {
+    const operation = std.meta.intToEnum(Op, op) catch return 1;
+    const sa = scale_of(a) orelse return 1;
+    const sb = scale_of(b) orelse return 1;
+    if (scale < 0 or scale > MAX_SCALE) return 1;
+    return decimal_limbs(a.value.len, sa, b.value.len, sb, @intCast(scale), operation);
+}
+
+/// Store a op b in r at r's scale, rounding the part that does not fit.
+/// Addition, subtraction and multiplication are exact when r's scale is
+/// at least the operands'.
+/// @param r Result with capacity for decimal_result_limbs(a, b, op, r.scale)
+///          limbs; not a or b
+/// @param op 0 add, 1 sub, 2 mul, 3 div
+/// @param mode Rounding, 0 down to 6 half_even as in ldecimal.c
+/// @return 0, or -1 on failure (division by zero or allocation error)
+export fn decimal_apply(r: *Decimal, a: *const Decimal, b: *const Decimal, op: c_int, mode: c_int) c_int {
+    if (!allocator_initialized) return -1;
+    const operation = std.meta.intToEnum(Op, op) catch return -1;
+    const rounding = std.meta.intToEnum(Rounding, mode) catch return -1;
+    const sa = scale_of(a) orelse return -1;
+    const sb = scale_of(b) orelse return -1;
+    const s = scale_of(r) orelse return -1;
+    const x = a.value.toConst();
+    const y = b.value.toConst();
+    switch (operation) {
+        .add, .sub, .mul, .div => {},
+        else => return -1,
+    }
+    if (operation == .div and y.eqlZero()) return -1;
+    if (r.value.capacity < decimal_limbs(x.limbs.len, sa, y.limbs.len, sb, s, operation)) return -1;
+
+    if (small(x)) |xs| if (small(y)) |ys| if (apply_i128(xs, sa, ys, sb, s, operation, rounding)) |v| {
+        set_i128(&r.value, v);
+        return 0;
+    };
+    apply_general(&r.value, x, sa, y, sb, s, operation, rounding) catch return -1;
+    return 0;
+}
+
+/// Limbs of capacity a's value at `scale` needs
+export fn decimal_rescale_limbs(a: *const Decimal, scale: c_int) usize {
+    const from = scale_of(a) orelse return 1;
+    if (scale < 0 or scale > MAX_SCALE) return 1;
+    return @max(rescaled_limbs(a.value.len, from, @intCast(scale)), I128_LIMBS);
+}
+
+/// Store a at r's scale, rounding digits that no longer fit
+/// @param r Result with capacity for decimal_rescale_limbs(a, r.scale) limbs
+/// @return 0, or -1 on failure
+export fn decimal_rescale(r: *Decimal, a: *const Decimal, mode: c_int) c_int {
+    if (!allocator_initialized) return -1;
+    const rounding = std.meta.intToEnum(Rounding, mode) catch return -1;
+    const from = scale_of(a) orelse return -1;
+    const to = scale_of(r) orelse return -1;
+    const x = a.value.toConst();
+    if (r.value.capacity < @max(rescaled_limbs(x.limbs.len, from, to), I128_LIMBS)) return -1;
+
+    if (small(x)) |xs| if (rescale_i128(xs, from, to, rounding)) |v| {
+        set_i128(&r.value, v);
+        return 0;
+    };
+    var arena = std.heap.ArenaAllocator.init(lua_allocator);
+    defer arena.deinit();
+    rescale_general(arena.allocator(), &r.value, x, from, to, rounding) catch return -1;
+    return 0;
+}
+
+/// Limbs of capacity a decimal parsed from `len` characters at `scale` needs
+export fn decimal_string_limbs(len: usize, scale: c_int) usize {
+    if (scale < 0 or scale > MAX_SCALE) return 1;
+    return @max(bigint_string_limbs(len, 10) + pow10_limbs(@intCast(scale)) + 2, I128_LIMBS);
+}
+
+/// Set a Decimal from "[+-]digits[.digits]" at r's scale, rounding digits
+/// past it. At most 2 * MAX_SCALE digits may follow the point.
+/// @param r Result with capacity for decimal_string_limbs(len, r.scale) limbs
+/// @return 0, or -1 on allocation/parse failure
+export fn decimal_set_string(r: *Decimal, str: [*]const u8, len: usize, mode: c_int) c_int {
+    if (!allocator_initialized) return -1;
+    const rounding = std.meta.intToEnum(Rounding, mode) catch return -1;
+    const to = scale_of(r) orelse return -1;
+    if (r.value.capacity < decimal_string_limbs(len, r.scale)) return -1;
+
+    var arena = std.heap.ArenaAllocator.init(lua_allocator);
+    defer arena.deinit();
+    const allocator = arena.allocator();
+
+    // The digits without the point, and how many followed it
+    const text = str[0..len];
+    const digits = allocator.alloc(u8, len) catch return -1;
+    var count: usize = 0;
+    var n_digits: usize = 0;
+    var fraction: ?usize = null;
+    for (text, 0..) |c, i| {
+        if (c == '+' and i == 0) {
+            continue;
+        } else if (c == '-' and i == 0) {
+            digits[count] = c;
+        } else if (c == '.' and fraction == null) {
+            fraction = 0;
+            continue;
+        } else if (c >= '0' and c <= '9') {
+            digits[count] = c;
+            n_digits += 1;
+            if (fraction) |f| fraction = f + 1;
+        } else {
+            return -1;
+        }
+        count += 1;
+    }
+    const from = fraction orelse 0;
+    if (n_digits == 0 or from > MAX_POW10) return -1;
+
+    const x = parse_string(allocator, digits[0..count], 10) catch return -1;
+    rescale_general(allocator, &r.value, x, from, to, rounding) catch return -1;
+    return 0;
+}
+
+/// Compare two Decimals by value, whatever their scales
+/// @return -1 if a < b, 0 if a == b, 1 if a > b, or -2 on failure
+export fn decimal_compare(a: *const Decimal, b: *const Decimal) c_int {
+    const sa = scale_of(a) orelse return -2;
+    const sb = scale_of(b) orelse return -2;
+    const x = a.value.toConst();
+    const y = b.value.toConst();
+    const w = @max(sa, sb);
+    const order = blk: {
+        if (small(x)) |xs| if (small(y)) |ys| {
+            const xw = checked(@mulWithOverflow(xs, pow10_i128(w - sa).?));
+            const yw = checked(@mulWithOverflow(ys, pow10_i128(w - sb).?));
+            if (xw != null and yw != null) break :blk math.order(xw.?, yw.?);
+        };
+        if (!allocator_initialized) return -2;
+        var arena = std.heap.ArenaAllocator.init(lua_allocator);
+        defer arena.deinit();
+        const xw = scaled(arena.allocator(), x, w - sa) catch return -2;
+        const yw = scaled(arena.allocator(), y, w - sb) catch return -2;
+        break :blk xw.order(yw);
+    };
+    return switch (order) {
+        .lt => -1,
+        .eq => 0,
+        .gt => 1,
+    };
 }
 
 // ============================================================================
 // Unit Tests
 // ============================================================================
 
-test "bigint basic creation" {
+// A BigInt over `limbs`, as lbigint.c would lay one out
+fn test_bigint(limbs: []Limb, value: i64) BigInt {
+    var r = BigInt{ .limbs = limbs.ptr, .len = 1, .capacity = limbs.len, .positive = 1 };
+    bigint_set_i64(&r, value);
+    return r;
+}
+
+test "bigint from i64" {
+    const testing = std.testing;
+    var limbs: [I64_LIMBS]Limb = undefined;
+    const a = test_bigint(&limbs, -42);
+    try testing.expectEqual(@as(i64, -42), bigint_to_i64(&a));
+}
+
+test "bigint from string" {
     const testing = std.testing;
     var gpa = std.heap.GeneralPurposeAllocator(.{}){};
     defer _ = gpa.deinit();
-    const allocator = gpa.allocator();
+    lua_allocator = gpa.allocator();
+    allocator_initialized = true;
 
-    const handle = try BigIntHandle.init(allocator);
-    defer handle.deinit(allocator);
-    try testing.expect(handle.bigint.toConst().eqlZero());
+    const digits = "DEADBEEF";
+    var limbs: [8]Limb = undefined;
+    var a = test_bigint(limbs[0..bigint_string_limbs(digits.len, 16)], 0);
+    try testing.expectEqual(@as(c_int, 0), bigint_set_string(&a, digits, digits.len, 16));
+    try testing.expectEqual(@as(i64, 3735928559), bigint_to_i64(&a));
 }
 
-test "bigint from i64" {
+test "bigint string round trip past the leaf size" {
     const testing = std.testing;
     var gpa = std.heap.GeneralPurposeAllocator(.{}){};
     defer _ = gpa.deinit();
-    const allocator = gpa.allocator();
+    lua_allocator = gpa.allocator();
+    allocator_initialized = true;
+
+    var text: [3001]u8 = undefined;
+    text[0] = '-';
+    for (text[1..], 0..) |*c, i| c.* = '1' + @as(u8, @intCast(i % 9));
+    var limbs: [1024]Limb = undefined;
+    var a = test_bigint(&limbs, 0);
+    try testing.expectEqual(@as(c_int, 0), bigint_set_string(&a, &text, text.len, 10));
+
+    var out: [4096]u8 = undefined;
+    const len = bigint_to_string(&a, 10, &out, out.len);
+    try testing.expectEqualStrings(&text, out[0..@intCast(len)]);
 
-    const handle = try BigIntHandle.initFromI64(allocator, 42);
-    defer handle.deinit(allocator);
-    try testing.expectEqual(@as(i64, 42), try handle.bigint.toConst().to(i64));
+    var hex: [4096]u8 = undefined;
+    const hex_len: usize = @intCast(bigint_to_string(&a, 16, &hex, hex.len));
+    var b = test_bigint(limbs[512..], 0);
+    try testing.expectEqual(@as(c_int, 0), bigint_set_string(&b, &hex, hex_len, 16));
+    try testing.expectEqual(@as(c_int, 0), bigint_compare(&a, &b));
 }
 
 test "bigint arithmetic" {
     const testing = std.testing;
     var gpa = std.heap.GeneralPurposeAllocator(.{}){};
     defer _ = gpa.deinit();
-    const allocator = gpa.allocator();
+    lua_allocator = gpa.allocator();
+    allocator_initialized = true;
+
+    var a_limbs: [I64_LIMBS]Limb = undefined;
+    var b_limbs: [I64_LIMBS]Limb = undefined;
+    var r_limbs: [8]Limb = undefined;
+    const a = test_bigint(&a_limbs, 100);
+    const b = test_bigint(&b_limbs, 42);
+    var r = test_bigint(&r_limbs, 0);
+
+    try testing.expectEqual(@as(c_int, 0), bigint_apply(&r, &a, &b, @intFromEnum(Op.add)));
+    try testing.expectEqual(@as(i64, 142), bigint_to_i64(&r));
+    try testing.expectEqual(@as(c_int, 0), bigint_apply(&r, &a, &b, @intFromEnum(Op.mod)));
+    try testing.expectEqual(@as(i64, 16), bigint_to_i64(&r));
+    try testing.expectEqual(@as(c_int, -1), bigint_apply(&r, &a, &test_bigint(&b_limbs, 0), @intFromEnum(Op.div)));
+}
+
+test "bigint in place" {
+    const testing = std.testing;
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+    lua_allocator = gpa.allocator();
+    allocator_initialized = true;
+
+    var limbs: [8]Limb = undefined;
+    var b_limbs: [I64_LIMBS]Limb = undefined;
+    var a = test_bigint(&limbs, 100);
+    const b = test_bigint(&b_limbs, 777);
+
+    try testing.expectEqual(@as(c_int, 0), bigint_apply(&a, &a, &b, @intFromEnum(Op.add)));
+    try testing.expectEqual(@as(c_int, 0), bigint_apply(&a, &a, &a, @intFromEnum(Op.mul)));
+    try testing.expectEqual(@as(c_int, 0), bigint_compare(&a, &test_bigint(&b_limbs, 877 * 877)));
+
+    // Too little room for the result
+    var small = test_bigint(limbs[0..1], 1);
+    try testing.expectEqual(@as(c_int, -1), bigint_apply(&small, &small, &small, @intFromEnum(Op.add)));
+}
+
+// A BigInt over `limbs` holding the decimal number `text`
+fn test_parse(limbs: []Limb, text: []const u8) BigInt {
+    var r = test_bigint(limbs, 0);
+    std.debug.assert(bigint_set_string(&r, text.ptr, text.len, 10) == 0);
+    return r;
+}
+
+test "bigint number theory" {
+    const testing = std.testing;
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+    lua_allocator = gpa.allocator();
+    allocator_initialized = true;
+
+    var a_limbs: [16]Limb = undefined;
+    var e_limbs: [16]Limb = undefined;
+    var m_limbs: [16]Limb = undefined;
+    var r_limbs: [16]Limb = undefined;
+    var x_limbs: [16]Limb = undefined;
+    const a = test_bigint(&a_limbs, 123456789);
+    const e = test_bigint(&e_limbs, 65537);
+    var r = test_bigint(&r_limbs, 0);
+
+    // Odd modulus, through Montgomery: 2^127 - 1
+    var m = test_parse(&m_limbs, "170141183460469231731687303715884105727");
+    try testing.expectEqual(@as(c_int, 0), bigint_powmod(&r, &a, &e, &m));
+    try testing.expectEqual(@as(c_int, 0), bigint_compare(&r, &test_parse(&x_limbs, "142853123101158166119999597599049700840")));
+    try testing.expectEqual(@as(c_int, 0), bigint_modinv(&r, &test_bigint(&x_limbs, 3), &m));
+    try testing.expectEqual(@as(c_int, 0), bigint_compare(&r, &test_parse(&x_limbs, "113427455640312821154458202477256070485")));
+
+    // Even modulus
+    m = test_parse(&m_limbs, "100000000000000000000");
+    try testing.expectEqual(@as(c_int, 0), bigint_powmod(&r, &a, &e, &m));
+    try testing.expectEqual(@as(c_int, 0), bigint_compare(&r, &test_parse(&x_limbs, "4112140023419620629")));
+    try testing.expectEqual(@as(c_int, 1), bigint_modinv(&r, &test_bigint(&x_limbs, 6), &m));
+    try testing.expectEqual(@as(c_int, -1), bigint_powmod(&r, &a, &test_bigint(&x_limbs, -1), &m));
+
+    // gcd(3 * 2^64, 9 * 2^32) = 3 * 2^32
+    var b = test_bigint(&x_limbs, 3);
+    try testing.expectEqual(@as(c_int, 0), bigint_shift(&r, &b, 64));
+    b = test_bigint(&x_limbs, 9 << 32);
+    var g_limbs: [16]Limb = undefined;
+    var g = test_bigint(&g_limbs, 0);
+    try testing.expectEqual(@as(c_int, 0), bigint_apply(&g, &r, &b, @intFromEnum(Op.gcd)));
+    try testing.expectEqual(@as(i64, 3 << 32), bigint_to_i64(&g));
+
+    b = test_bigint(&x_limbs, -5);
+    try testing.expectEqual(@as(c_int, 0), bigint_shift(&r, &b, -1));
+    try testing.expectEqual(@as(i64, -3), bigint_to_i64(&r));
+    b = test_bigint(&x_limbs, -1);
+    try testing.expectEqual(@as(c_int, 0), bigint_apply(&r, &b, &test_bigint(&e_limbs, 255), @intFromEnum(Op.band)));
+    try testing.expectEqual(@as(i64, 255), bigint_to_i64(&r));
+}
+
+test "decimal arithmetic and rounding" {
+    const testing = std.testing;
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+    lua_allocator = gpa.allocator();
+    allocator_initialized = true;
+
+    var a_limbs: [16]Limb = undefined;
+    var b_limbs: [16]Limb = undefined;
+    var r_limbs: [32]Limb = undefined;
+    var a = Decimal{ .value = test_bigint(&a_limbs, 0), .scale = 2 };
+    var b = Decimal{ .value = test_bigint(&b_limbs, 0), .scale = 2 };
+    var r = Decimal{ .value = test_bigint(&r_limbs, 0), .scale = 2 };
+    const half_even = @intFromEnum(Rounding.half_even);
 
-    const a = try BigIntHandle.initFromI64(allocator, 100);
-    defer a.deinit(allocator);
-    const b = try BigIntHandle.initFromI64(allocator, 42);
-    defer b.deinit(allocator);
-    const result = try BigIntHandle.init(allocator);
-    defer result.deinit(allocator);
+    try testing.expectEqual(@as(c_int, 0), decimal_set_string(&a, "10.005", 6, half_even));
+    try testing.expectEqual(@as(i64, 1000), bigint_to_i64(&a.value));
+    try testing.expectEqual(@as(c_int, 0), decimal_set_string(&b, "-3", 2, half_even));
+    try testing.expectEqual(@as(c_int, 0), decimal_apply(&r, &a, &b, @intFromEnum(Op.div), half_even));
+    try testing.expectEqual(@as(i64, -333), bigint_to_i64(&r.value));
+    try testing.expectEqual(@as(c_int, 0), decimal_apply(&r, &a, &b, @intFromEnum(Op.div), @intFromEnum(Rounding.floor)));
+    try testing.expectEqual(@as(i64, -334), bigint_to_i64(&r.value));
 
-    try result.bigint.add(&a.bigint.toConst(), &b.bigint.toConst());
-    try testing.expectEqual(@as(i64, 142), try result.bigint.toConst().to(i64));
+    // Past 128 bits: (10^30)^2 at scale 2
+    const big = "1000000000000000000000000000000";
+    try testing.expectEqual(@as(c_int, 0), decimal_set_string(&a, big, big.len, half_even));
+    try testing.expectEqual(@as(c_int, 0), decimal_apply(&r, &a, &a, @intFromEnum(Op.mul), half_even));
+    try testing.expectEqual(@as(c_int, 1), decimal_compare(&r, &a));
+    try testing.expectEqual(@as(c_int, 0), decimal_apply(&b, &r, &a, @intFromEnum(Op.div), half_even));
+    try testing.expectEqual(@as(c_int, 0), decimal_compare(&b, &a));
 }
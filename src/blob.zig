@@ -0,0 +1,156 @@
+const std = @import("std");
+const lua = @import("lua.zig");
+
+const c = lua.c;
+
+extern fn js_blob_read(handle: u32, offset: usize, dst_ptr: [*]u8, len: usize) c_int;
+extern fn js_blob_release(handle: u32) void;
+
+// Binary blobs kept by the host. At rest a blob is an entry value
+//   BLOB, u32 length (little-endian), bytes
+// which the host never copies into linear memory. Reading the entry yields
+//   BLOB_HANDLE, u32 handle, u32 length
+// instead, and Lua gets a read-only userdata over the handle whose methods
+// (len, byte, sub) read just the bytes asked for with js_blob_read. Storing
+// the userdata writes the handle back, and the host swaps in the bytes it
+// holds, so a blob moved from _io.input to _home is never copied through
+// the Lua heap. The handle is released when the userdata is collected.
+pub const BLOB: u8 = 0xE0;
+pub const BLOB_HANDLE: u8 = 0xE1;
+pub const HANDLE_LEN = 9;
+
+const METATABLE: [*:0]const u8 = "cu.blob";
+
+const BlobRef = extern struct {
+    handle: u32,
+    len: u32,
+};
+
+/// Size of the BLOB or BLOB_HANDLE value at the start of `bytes`, or null
+pub fn encoded_len(bytes: []const u8) ?usize {
+    if (bytes.len < 5) return null;
+    const len: usize = switch (bytes[0]) {
+        BLOB => 5 + @as(usize, std.mem.readInt(u32, bytes[1..5], .little)),
+        BLOB_HANDLE => HANDLE_LEN,
+        else => return null,
+    };
+    if (len > bytes.len) return null;
+    return len;
+}
+
+/// Push a blob for the BLOB_HANDLE value in `bytes`. The bytes of a BLOB
+/// value are only ever held by the host, so those are rejected.
+pub fn push(L: *lua.lua_State, bytes: []const u8) bool {
+    if (bytes.len < HANDLE_LEN or bytes[0] != BLOB_HANDLE) return false;
+    const ref: *BlobRef = @ptrCast(@alignCast(c.lua_newuserdatauv(L, @sizeOf(BlobRef), 0).?));
+    ref.* = .{
+        .handle = std.mem.readInt(u32, bytes[1..5], .little),
+        .len = std.mem.readInt(u32, bytes[5..9], .little),
+    };
+    set_metatable(L);
+    return true;
+}
+
+/// Write the BLOB_HANDLE value of the blob at `index`; null for other values
+pub fn write_handle(L: *lua.lua_State, index: c_int, buffer: [*]u8) ?usize {
+    const ref = to_ref(L, index) orelse return null;
+    buffer[0] = BLOB_HANDLE;
+    std.mem.writeInt(u32, buffer[1..5], ref.handle, .little);
+    std.mem.writeInt(u32, buffer[5..9], ref.len, .little);
+    return HANDLE_LEN;
+}
+
+pub fn is_blob(L: *lua.lua_State, index: c_int) bool {
+    return to_ref(L, index) != null;
+}
+
+fn to_ref(L: *lua.lua_State, index: c_int) ?*BlobRef {
+    return @ptrCast(@alignCast(c.luaL_testudata(L, index, METATABLE) orelse return null));
+}
+
+fn set_metatable(L: *lua.lua_State) void {
+    if (lua.luaL_newmetatable(L, METATABLE) != 0) {
+        lua.newtable(L);
+        lua.pushcfunction(L, @as(c.lua_CFunction, @ptrCast(&len_impl)));
+        lua.setfield(L, -2, "len");
+        lua.pushcfunction(L, @as(c.lua_CFunction, @ptrCast(&byte_impl)));
+        lua.setfield(L, -2, "byte");
+        lua.pushcfunction(L, @as(c.lua_CFunction, @ptrCast(&sub_impl)));
+        lua.setfield(L, -2, "sub");
+        lua.setfield(L, -2, "__index");
+
+        lua.pushcfunction(L, @as(c.lua_CFunction, @ptrCast(&len_impl)));
+        lua.setfield(L, -2, "__len");
+
+        lua.pushcfunction(L, @as(c.lua_CFunction, @ptrCast(&gc_impl)));
+        lua.setfield(L, -2, "__gc");
+    }
+    _ = lua.setmetatable(L, -2);
+}
+
+fn check_ref(L: *lua.lua_State) *BlobRef {
+    return @ptrCast(@alignCast(c.luaL_checkudata(L, 1, METATABLE).?));
+}
+
+// 0-based [start, end) for 1-based arguments i and j, which count from the
+// end when negative, like string.sub
+fn range(L: *lua.lua_State, len: u32, default_i: c.lua_Integer, default_j: c.lua_Integer) [2]usize {
+    const size: c.lua_Integer = @intCast(len);
+    var i = c.luaL_optinteger(L, 2, default_i);
+    var j = c.luaL_optinteger(L, 3, default_j);
+    if (i < 0) i = @max(size + i + 1, 1) else if (i == 0) i = 1;
+    if (j < 0) j = size + j + 1 else if (j > size) j = size;
+    if (i > j) return .{ 0, 0 };
+    return .{ @intCast(i - 1), @intCast(j) };
+}
+
+fn read(L: *lua.lua_State, ref: *BlobRef, offset: usize, dst: [*]u8, len: usize) void {
+    if (len == 0) return;
+    if (js_blob_read(ref.handle, offset, dst, len) != @as(c_int, @intCast(len))) {
+        _ = c.luaL_error(L, "blob is no longer available");
+    }
+}
+
+fn len_impl(L: *lua.lua_State) c_int {
+    lua.pushinteger(L, check_ref(L).len);
+    return 1;
+}
+
+fn byte_impl(L: *lua.lua_State) c_int {
+    const ref = check_ref(L);
+    const i = c.luaL_optinteger(L, 2, 1);
+    const bounds = range(L, ref.len, i, i);
+    const count = bounds[1] - bounds[0];
+    if (count > std.math.maxInt(c_int) or c.lua_checkstack(L, @intCast(count)) == 0) {
+        return c.luaL_error(L, "blob slice too long");
+    }
+
+    var chunk: [256]u8 = undefined;
+    var offset = bounds[0];
+    while (offset < bounds[1]) {
+        const n = @min(chunk.len, bounds[1] - offset);
+        read(L, ref, offset, &chunk, n);
+        for (chunk[0..n]) |byte| lua.pushinteger(L, byte);
+        offset += n;
+    }
+    return @intCast(count);
+}
+
+fn sub_impl(L: *lua.lua_State) c_int {
+    const ref = check_ref(L);
+    const bounds = range(L, ref.len, 1, -1);
+    const count = bounds[1] - bounds[0];
+
+    // Read straight into the new string's buffer
+    var buffer: c.luaL_Buffer = undefined;
+    const dst: [*]u8 = @ptrCast(c.luaL_buffinitsize(L, &buffer, count));
+    read(L, ref, bounds[0], dst, count);
+    c.luaL_pushresultsize(&buffer, count);
+    return 1;
+}
+
+fn gc_impl(L: *lua.lua_State) c_int {
+    const ref = check_ref(L);
+    js_blob_release(ref.handle);
+    return 0;
+}
@@ -0,0 +1,149 @@
+const lua = @import("lua.zig");
+const ErrorCode = @import("error.zig").ErrorCode;
+const profiler = @import("profiler.zig");
+
+// Per-compute resource budgets.
+//
+// Memory is charged in lua_alloc as net growth since the start of the call,
+// so short-lived garbage that the collector reclaims does not count against
+// the budget. Instructions are counted by a LUA_MASKCOUNT hook that fires
+// every HOOK_INTERVAL instructions. The limit is therefore enforced to within
+// one interval, and the VM pays no per-instruction callback. The same hook
+// polls the host for an interrupt request when interrupt polling is on, and
+// takes samples while a profile runs (profiler.zig), firing at the shorter
+// of the two intervals.
+//
+// The host can also stop a call through the interrupt word. The VM reads it
+// on loop back-edges and calls (checkinterrupt in lvm.c), so it needs no
+// hook and no host call; the host sets it from a callback it gets during
+// the call, or from another thread when linear memory is shared.
+
+const HOOK_INTERVAL: u64 = 1000;
+
+extern fn js_interrupt_requested() c_int;
+
+var max_bytes: usize = 0;
+var max_instructions: u64 = 0;
+var poll_interrupts: bool = false;
+
+var active: bool = false;
+var net_bytes: i64 = 0;
+var instructions: u64 = 0;
+var hook_count: u64 = 0;
+var hooked: bool = false;
+var violation: ?ErrorCode = null;
+
+/// Nonzero asks the running call (or, between calls, the next one) to stop.
+/// Cleared when the call it stopped returns.
+export var cu_interrupt_flag: i32 = 0;
+
+/// Set the limits applied to each compute call; 0 disables a limit
+pub fn set_limits(bytes: usize, instruction_limit: u64) void {
+    max_bytes = bytes;
+    max_instructions = instruction_limit;
+}
+
+/// Ask the host (js_interrupt_requested) every HOOK_INTERVAL instructions
+/// whether to abandon the running call
+pub fn set_interrupt_polling(enabled: bool) void {
+    poll_interrupts = enabled;
+}
+
+pub fn begin(L: *lua.lua_State) void {
+    active = true;
+    net_bytes = 0;
+    instructions = 0;
+    violation = null;
+
+    const limited = max_instructions > 0 or poll_interrupts;
+    hooked = limited or profiler.is_running();
+    if (hooked) {
+        hook_count = if (limited) HOOK_INTERVAL else profiler.sample_period();
+        if (max_instructions > 0) hook_count = @min(hook_count, max_instructions);
+        if (profiler.is_running()) hook_count = @min(hook_count, profiler.sample_period());
+        lua.c.lua_sethook(L, &instruction_hook, lua.c.LUA_MASKCOUNT, @intCast(hook_count));
+    } else {
+        lua.c.lua_sethook(L, null, 0, 0);
+    }
+}
+
+pub fn end(L: *lua.lua_State) void {
+    active = false;
+    if (violation == .interrupted) @atomicStore(i32, &cu_interrupt_flag, 0, .seq_cst);
+    if (hooked) {
+        lua.c.lua_sethook(L, null, 0, 0);
+        hooked = false;
+    }
+}
+
+/// True while a compute call is running. Still true after the instance
+/// trapped mid-call, which lets the host tell why.
+pub fn is_active() bool {
+    return active;
+}
+
+/// Charge `bytes` of growth against the memory budget. Returns false (and
+/// records the violation) if the allocation must be refused.
+pub fn reserve(bytes: usize) bool {
+    if (!active or max_bytes == 0) return true;
+
+    const next = net_bytes + @as(i64, @intCast(bytes));
+    if (next > @as(i64, @intCast(max_bytes))) {
+        violation = .memory_limit_exceeded;
+        return false;
+    }
+
+    net_bytes = next;
+    // Lua retries a refused allocation after an emergency collection; if the
+    // retry fits, the earlier refusal did not end the call
+    if (violation == .memory_limit_exceeded) violation = null;
+    return true;
+}
+
+pub fn release(bytes: usize) void {
+    if (!active) return;
+    net_bytes -= @as(i64, @intCast(bytes));
+}
+
+pub fn last_violation() ?ErrorCode {
+    return violation;
+}
+
+pub fn violation_message(code: ErrorCode) []const u8 {
+    return switch (code) {
+        .memory_limit_exceeded => "memory limit exceeded",
+        .instruction_limit_exceeded => "instruction limit exceeded",
+        .interrupted => "interrupted",
+        else => "resource limit exceeded",
+    };
+}
+
+/// Address of the interrupt word in linear memory
+pub fn interrupt_flag_ptr() usize {
+    return @intFromPtr(&cu_interrupt_flag);
+}
+
+// luai_interrupt (luaconf.h): the VM found the interrupt word set. As with
+// polling, every later check fails too while the call runs, so a pcall in
+// the script can clean up but cannot carry on.
+export fn cu_interrupt_raise(L: *lua.lua_State) void {
+    if (!active) return;
+    violation = .interrupted;
+    _ = lua.c.luaL_error(L, "interrupted");
+}
+
+fn instruction_hook(L: ?*lua.lua_State, _: [*c]lua.c.lua_Debug) callconv(.c) void {
+    profiler.tick(L.?, hook_count);
+    // Once requested, every later poll fails too, so pcall cannot swallow it
+    if (poll_interrupts and js_interrupt_requested() != 0) {
+        violation = .interrupted;
+        _ = lua.c.luaL_error(L, "interrupted");
+    }
+    if (max_instructions == 0) return;
+
+    instructions += hook_count;
+    if (instructions >= max_instructions) {
+        violation = .instruction_limit_exceeded;
+        _ = lua.c.luaL_error(L, "instruction limit exceeded");
+    }
+}
@@ -0,0 +1,105 @@
+const std = @import("std");
+const lua = @import("lua.zig");
+
+// Compile-once cache for compute() sources.
+//
+// Compiled main chunks are kept in the registry, keyed by a 64-bit Wyhash of
+// the source bytes plus its length, so a repeated handler skips the lexer and
+// parser entirely. The table is small and scanned linearly; when it is full
+// the least recently used chunk is released to the collector.
+//
+// A cached chunk is the same closure every time, so its _ENV upvalue (the
+// globals table) is shared exactly as it would be for a fresh load. Chunk
+// locals are per-call either way.
+//
+// With several lua_States in the instance (states.zig) each entry belongs to
+// the state that compiled it, since its ref is into that state's registry.
+
+const CACHE_SLOTS = 32;
+
+const Entry = struct {
+    owner: ?*lua.lua_State = null,
+    hash: u64 = 0,
+    len: usize = 0,
+    ref: c_int = lua.c.LUA_NOREF,
+    last_used: u64 = 0,
+};
+
+var entries = [_]Entry{.{}} ** CACHE_SLOTS;
+var tick: u64 = 0;
+var hits: u32 = 0;
+var misses: u32 = 0;
+var optimize = false;
+
+/// Push the compiled chunk for `code`, compiling and caching it on a miss.
+/// Returns the luaL_loadbufferx status; on failure the error message is
+/// pushed instead and nothing is cached.
+pub fn load(L: *lua.lua_State, code: []const u8, chunkname: [*:0]const u8) c_int {
+    const hash = std.hash.Wyhash.hash(0, code);
+    tick += 1;
+
+    var victim: usize = 0;
+    for (&entries, 0..) |*entry, i| {
+        if (entry.owner == L and entry.hash == hash and entry.len == code.len) {
+            entry.last_used = tick;
+            hits +%= 1;
+            _ = lua.getref(L, entry.ref);
+            return 0;
+        }
+        if (entry.last_used < entries[victim].last_used) victim = i;
+    }
+
+    misses +%= 1;
+    const mode: [*:0]const u8 = if (optimize) "bto" else "bt";
+    const status = lua.c.luaL_loadbufferx(L, code.ptr, code.len, chunkname, mode);
+    if (status != 0) return status;
+
+    const slot = &entries[victim];
+    if (slot.owner) |owner| lua.unref(owner, slot.ref);
+    lua.pushvalue(L, -1);
+    slot.* = .{ .owner = L, .hash = hash, .len = code.len, .ref = lua.ref(L), .last_used = tick };
+    return 0;
+}
+
+/// Drop every cached chunk of `L` (counters are kept)
+pub fn clear(L: *lua.lua_State) void {
+    for (&entries) |*entry| {
+        if (entry.owner != L) continue;
+        lua.unref(L, entry.ref);
+        entry.* = .{};
+    }
+}
+
+/// Forget the chunks of a state that is being closed
+pub fn forget(L: *lua.lua_State) void {
+    for (&entries) |*entry| {
+        if (entry.owner == L) entry.* = .{};
+    }
+}
+
+/// Turn the optimizer on or off for chunks compiled from now on, dropping
+/// the cached ones of every state if that changes it. Returns the previous
+/// setting.
+pub fn set_optimize(on: bool) bool {
+    const was = optimize;
+    if (on != was) {
+        for (&entries) |*entry| {
+            if (entry.owner) |owner| lua.unref(owner, entry.ref);
+            entry.* = .{};
+        }
+        optimize = on;
+    }
+    return was;
+}
+
+pub fn optimizing() bool {
+    return optimize;
+}
+
+pub fn hit_count() u32 {
+    return hits;
+}
+
+pub fn miss_count() u32 {
+    return misses;
+}
@@ -0,0 +1,378 @@
+const std = @import("std");
+const lua = @import("lua.zig");
+const typed_array = @import("typed_array.zig");
+
+const c = lua.c;
+const HEADER_LEN = typed_array.HEADER_LEN;
+
+// The codec library: base64 (standard and URL-safe) and hex, encoded and
+// decoded in native code. Output is written straight into a luaL_Buffer, so
+// the result string is built once, or, on request, into a typed array of u8
+// elements (typed_array.zig): bytes that are stored into _io and _home, and
+// reach the host as a Uint8Array, without another copy.
+//
+// The kernels work a block at a time with @Vector, 12 input bytes to 16
+// base64 characters and 16 bytes to 32 hex digits. build.sh compiles this
+// file on its own, with simd128 in the CU_SIMD=1 build, so the shuffles are
+// v128 operations there and unrolled scalar code otherwise. A block with a
+// character outside the alphabet, and whatever is left at the end, goes
+// through the scalar loops, which also find the position to report.
+
+extern fn cu_typed_array_adopt(L: *lua.lua_State) c_int;
+
+const V16 = @Vector(16, u8);
+
+inline fn splat(comptime N: usize, x: u8) @Vector(N, u8) {
+    return @splat(x);
+}
+
+// Lanes with lo <= x < lo + count
+inline fn in_range(comptime N: usize, x: @Vector(N, u8), lo: u8, count: u8) @Vector(N, bool) {
+    return x -% splat(N, lo) < splat(N, count);
+}
+
+// @shuffle mask taking lane i / group * stride + offset of the first operand
+fn spread(comptime N: usize, comptime group: usize, comptime stride: usize, comptime offset: usize) @Vector(N, i32) {
+    var mask: [N]i32 = undefined;
+    for (0..N) |i| mask[i] = @intCast(i / group * stride + offset);
+    return mask;
+}
+
+// ============================================================================
+// Base64
+// ============================================================================
+
+fn alphabet(comptime url: bool) *const [64]u8 {
+    return if (url)
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_"
+    else
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+}
+
+// Character -> 6-bit value, 0xFF for characters outside the alphabet
+fn decode_table(comptime url: bool) [256]u8 {
+    var table = [_]u8{0xFF} ** 256;
+    for (alphabet(url), 0..) |ch, i| table[ch] = @intCast(i);
+    return table;
+}
+
+/// Encoded length: padded to a multiple of 4 with '=', or not (url)
+fn base64_encoded_len(n: usize, padded: bool) usize {
+    const tail = n % 3;
+    if (tail == 0 or padded) return (n + 2) / 3 * 4;
+    return n / 3 * 4 + tail + 1;
+}
+
+// Twelve bytes to sixteen characters: each 3-byte group a, b, c is spread
+// over the four lanes of its characters, which pick their 6 bits by position
+inline fn encode_block(comptime url: bool, in: @Vector(12, u8)) V16 {
+    const a = @shuffle(u8, in, undefined, comptime spread(16, 4, 3, 0));
+    const b = @shuffle(u8, in, undefined, comptime spread(16, 4, 3, 1));
+    const c_ = @shuffle(u8, in, undefined, comptime spread(16, 4, 3, 2));
+    const position: V16 = comptime blk: {
+        var p: [16]u8 = undefined;
+        for (0..16) |i| p[i] = @intCast(i % 4);
+        break :blk p;
+    };
+
+    const s0 = a >> @splat(2);
+    const s1 = ((a & splat(16, 0x03)) << @splat(4)) | (b >> @splat(4));
+    const s2 = ((b & splat(16, 0x0F)) << @splat(2)) | (c_ >> @splat(6));
+    const s3 = c_ & splat(16, 0x3F);
+    const sextets = @select(u8, position == splat(16, 0), s0, @select(u8, position == splat(16, 1), s1, @select(u8, position == splat(16, 2), s2, s3)));
+
+    // 0..25 'A'.., 26..51 'a'.., 52..61 '0'.., then the two symbols
+    const chars = comptime alphabet(url);
+    var offset = splat(16, 'A');
+    offset = @select(u8, sextets >= splat(16, 26), splat(16, 'a' - 26), offset);
+    offset = @select(u8, sextets >= splat(16, 52), splat(16, @as(u8, '0') -% 52), offset);
+    offset = @select(u8, sextets == splat(16, 62), splat(16, chars[62] -% 62), offset);
+    offset = @select(u8, sextets == splat(16, 63), splat(16, chars[63] -% 63), offset);
+    return sextets +% offset;
+}
+
+fn base64_encode(comptime url: bool, src: []const u8, dst: [*]u8, padded: bool) void {
+    const chars = alphabet(url);
+    var i: usize = 0;
+    var o: usize = 0;
+    while (i + 12 <= src.len) : ({
+        i += 12;
+        o += 16;
+    }) {
+        dst[o..][0..16].* = encode_block(url, src[i..][0..12].*);
+    }
+    while (i + 3 <= src.len) : ({
+        i += 3;
+        o += 4;
+    }) {
+        const group = @as(u32, src[i]) << 16 | @as(u32, src[i + 1]) << 8 | src[i + 2];
+        dst[o] = chars[group >> 18];
+        dst[o + 1] = chars[(group >> 12) & 0x3F];
+        dst[o + 2] = chars[(group >> 6) & 0x3F];
+        dst[o + 3] = chars[group & 0x3F];
+    }
+    const tail = src.len - i;
+    if (tail == 0) return;
+    const group = @as(u32, src[i]) << 16 | (if (tail == 2) @as(u32, src[i + 1]) << 8 else 0);
+    dst[o] = chars[group >> 18];
+    dst[o + 1] = chars[(group >> 12) & 0x3F];
+    if (tail == 2) dst[o + 2] = chars[(group >> 6) & 0x3F];
+    if (padded) {
+        if (tail == 1) dst[o + 2] = '=';
+        dst[o + 3] = '=';
+    }
+}
+
+// Sixteen characters to twelve bytes, or null if one is not in the alphabet
+inline fn decode_block(comptime url: bool, in: V16) ?@Vector(12, u8) {
+    const chars = comptime alphabet(url);
+    var sextets = splat(16, 0xFF);
+    sextets = @select(u8, in_range(16, in, 'A', 26), in -% splat(16, 'A'), sextets);
+    sextets = @select(u8, in_range(16, in, 'a', 26), in -% splat(16, 'a' - 26), sextets);
+    sextets = @select(u8, in_range(16, in, '0', 10), in +% splat(16, 52 - '0'), sextets);
+    sextets = @select(u8, in == splat(16, chars[62]), splat(16, 62), sextets);
+    sextets = @select(u8, in == splat(16, chars[63]), splat(16, 63), sextets);
+    if (@reduce(.Or, sextets) >= 64) return null;
+
+    const s0 = @shuffle(u8, sextets, undefined, @Vector(4, i32){ 0, 4, 8, 12 });
+    const s1 = @shuffle(u8, sextets, undefined, @Vector(4, i32){ 1, 5, 9, 13 });
+    const s2 = @shuffle(u8, sextets, undefined, @Vector(4, i32){ 2, 6, 10, 14 });
+    const s3 = @shuffle(u8, sextets, undefined, @Vector(4, i32){ 3, 7, 11, 15 });
+    const b0 = (s0 << @splat(2)) | (s1 >> @splat(4));
+    const b1 = (s1 << @splat(4)) | (s2 >> @splat(2));
+    const b2 = (s2 << @splat(6)) | s3;
+    const ab = @shuffle(u8, b0, b1, @Vector(8, i32){ 0, -1, 1, -2, 2, -3, 3, -4 });
+    return @shuffle(u8, ab, b2, @Vector(12, i32){ 0, 1, -1, 2, 3, -2, 4, 5, -3, 6, 7, -4 });
+}
+
+/// Decoded length of `src`: its '=' padding, if any, is dropped from `src`
+fn base64_decoded_len(src: *[]const u8) error{InvalidLength}!usize {
+    var body = src.*;
+    if (body.len % 4 == 0 and body.len > 0 and body[body.len - 1] == '=') {
+        body.len -= if (body[body.len - 2] == '=') 2 else 1;
+    }
+    src.* = body;
+    return switch (body.len % 4) {
+        1 => error.InvalidLength,
+        0 => body.len / 4 * 3,
+        else => |tail| body.len / 4 * 3 + tail - 1,
+    };
+}
+
+/// Decode unpadded `src` into `dst`; the position of the first character
+/// outside the alphabet, or null
+fn base64_decode(comptime url: bool, src: []const u8, dst: [*]u8) ?usize {
+    const table = comptime decode_table(url);
+    var i: usize = 0;
+    var o: usize = 0;
+    while (i + 16 <= src.len) : ({
+        i += 16;
+        o += 12;
+    }) {
+        const bytes = decode_block(url, src[i..][0..16].*) orelse break;
+        dst[o..][0..12].* = bytes;
+    }
+    var group: u32 = 0;
+    var count: usize = 0;
+    while (i < src.len) : (i += 1) {
+        const sextet = table[src[i]];
+        if (sextet == 0xFF) return i;
+        group = group << 6 | sextet;
+        count += 1;
+        if (count == 4) {
+            dst[o] = @truncate(group >> 16);
+            dst[o + 1] = @truncate(group >> 8);
+            dst[o + 2] = @truncate(group);
+            o += 3;
+            group = 0;
+            count = 0;
+        }
+    }
+    // Two or three characters left: one or two bytes
+    if (count >= 2) {
+        group <<= @intCast(6 * (4 - count));
+        dst[o] = @truncate(group >> 16);
+        if (count == 3) dst[o + 1] = @truncate(group >> 8);
+    }
+    return null;
+}
+
+// ============================================================================
+// Hex
+// ============================================================================
+
+const HEX_DIGITS = "0123456789abcdef";
+
+inline fn hex_digits(nibbles: V16) V16 {
+    return nibbles + @select(u8, nibbles > splat(16, 9), splat(16, 'a' - 10), splat(16, '0'));
+}
+
+fn hex_encode(src: []const u8, dst: [*]u8) void {
+    var i: usize = 0;
+    while (i + 16 <= src.len) : (i += 16) {
+        const in: V16 = src[i..][0..16].*;
+        const high = hex_digits(in >> @splat(4));
+        const low = hex_digits(in & splat(16, 0x0F));
+        dst[2 * i ..][0..32].* = @shuffle(u8, high, low, comptime interleave: {
+            var mask: [32]i32 = undefined;
+            for (0..16) |j| {
+                mask[2 * j] = @intCast(j);
+                mask[2 * j + 1] = ~@as(i32, @intCast(j));
+            }
+            break :interleave mask;
+        });
+    }
+    while (i < src.len) : (i += 1) {
+        dst[2 * i] = HEX_DIGITS[src[i] >> 4];
+        dst[2 * i + 1] = HEX_DIGITS[src[i] & 0x0F];
+    }
+}
+
+fn hex_value(ch: u8) ?u8 {
+    return switch (ch) {
+        '0'...'9' => ch - '0',
+        'a'...'f' => ch - 'a' + 10,
+        'A'...'F' => ch - 'A' + 10,
+        else => null,
+    };
+}
+
+/// Decode even-length `src` into `dst`; the position of the first
+/// character that is not a hex digit, or null
+fn hex_decode(src: []const u8, dst: [*]u8) ?usize {
+    const V32 = @Vector(32, u8);
+    var i: usize = 0;
+    while (i + 32 <= src.len) : (i += 32) {
+        const in: V32 = src[i..][0..32].*;
+        const lower = in | splat(32, 0x20);
+        var nibbles = splat(32, 0xFF);
+        nibbles = @select(u8, in_range(32, in, '0', 10), in -% splat(32, '0'), nibbles);
+        nibbles = @select(u8, in_range(32, lower, 'a', 6), lower -% splat(32, 'a' - 10), nibbles);
+        if (@reduce(.Or, nibbles) >= 16) break;
+        const high = @shuffle(u8, nibbles, undefined, comptime spread(16, 1, 2, 0));
+        const low = @shuffle(u8, nibbles, undefined, comptime spread(16, 1, 2, 1));
+        dst[i / 2 ..][0..16].* = (high << @splat(4)) | low;
+    }
+    while (i < src.len) : (i += 2) {
+        const high = hex_value(src[i]) orelse return i;
+        const low = hex_value(src[i + 1]) orelse return i + 1;
+        dst[i / 2] = high << 4 | low;
+    }
+    return null;
+}
+
+// ============================================================================
+// Lua functions
+// ============================================================================
+
+fn check_size(L: *lua.lua_State, n: usize) void {
+    if (n > std.math.maxInt(usize) / 2 - HEADER_LEN) {
+        _ = c.luaL_error(L, "codec: input too long");
+        unreachable;
+    }
+}
+
+/// Where a result of `n` bytes is written: a luaL_Buffer for a string, or
+/// a new u8 typed array, already on top of the stack
+const Output = struct {
+    buffer: c.luaL_Buffer = undefined,
+    as_bytes: bool,
+    n: usize,
+
+    fn begin(out: *Output, L: *lua.lua_State) [*]u8 {
+        if (!out.as_bytes) return @ptrCast(c.luaL_buffinitsize(L, &out.buffer, out.n));
+        if (out.n > std.math.maxInt(u32)) {
+            _ = c.luaL_error(L, "codec: result too long for bytes");
+            unreachable;
+        }
+        const bytes: [*]u8 = @ptrCast(c.lua_newuserdatauv(L, HEADER_LEN + out.n, 0).?);
+        bytes[0] = typed_array.TYPED_ARRAY;
+        bytes[1] = @intFromEnum(typed_array.Kind.u8);
+        bytes[2] = 0;
+        bytes[3] = 0;
+        std.mem.writeInt(u32, bytes[4..8], @intCast(out.n), .little);
+        _ = cu_typed_array_adopt(L);
+        return bytes + HEADER_LEN;
+    }
+
+    fn finish(out: *Output) void {
+        if (!out.as_bytes) c.luaL_pushresultsize(&out.buffer, out.n);
+    }
+};
+
+fn check_as_bytes(L: *lua.lua_State, arg: c_int) bool {
+    const names = [_][*c]const u8{ "string", "bytes", null };
+    return c.luaL_checkoption(L, arg, "string", &names) == 1;
+}
+
+// codec.base64_encode(s [, url]) -> the base64 of s; padded with '=' in the
+// standard alphabet, unpadded in the URL-safe one
+fn base64_encode_impl(L: *lua.lua_State) c_int {
+    const src = typed_array.check_bytes(L, 1);
+    const url = c.lua_toboolean(L, 2) != 0;
+    check_size(L, src.len);
+    var out = Output{ .as_bytes = false, .n = base64_encoded_len(src.len, !url) };
+    const dst = out.begin(L);
+    if (url) base64_encode(true, src, dst, false) else base64_encode(false, src, dst, true);
+    out.finish();
+    return 1;
+}
+
+// codec.base64_decode(s [, url [, as]]) -> the decoded string, or bytes
+// when `as` is 'bytes'. Padding is optional in either alphabet.
+fn base64_decode_impl(L: *lua.lua_State) c_int {
+    var src = typed_array.check_bytes(L, 1);
+    const url = c.lua_toboolean(L, 2) != 0;
+    var out = Output{ .as_bytes = check_as_bytes(L, 3), .n = 0 };
+    out.n = base64_decoded_len(&src) catch {
+        _ = c.luaL_error(L, "codec.base64_decode: truncated input");
+        unreachable;
+    };
+    const dst = out.begin(L);
+    const bad = if (url) base64_decode(true, src, dst) else base64_decode(false, src, dst);
+    if (bad) |position| {
+        _ = c.luaL_error(L, "codec.base64_decode: invalid character at position %d", @as(c_int, @intCast(position + 1)));
+        unreachable;
+    }
+    out.finish();
+    return 1;
+}
+
+// codec.hex_encode(s) -> s as lowercase hex digits
+fn hex_encode_impl(L: *lua.lua_State) c_int {
+    const src = typed_array.check_bytes(L, 1);
+    check_size(L, src.len);
+    var out = Output{ .as_bytes = false, .n = src.len * 2 };
+    hex_encode(src, out.begin(L));
+    out.finish();
+    return 1;
+}
+
+// codec.hex_decode(s [, as]) -> the decoded string, or bytes when `as` is
+// 'bytes'. Digits may be in either case.
+fn hex_decode_impl(L: *lua.lua_State) c_int {
+    const src = typed_array.check_bytes(L, 1);
+    var out = Output{ .as_bytes = check_as_bytes(L, 2), .n = src.len / 2 };
+    if (src.len % 2 != 0) return c.luaL_error(L, "codec.hex_decode: odd number of digits");
+    if (hex_decode(src, out.begin(L))) |position| {
+        _ = c.luaL_error(L, "codec.hex_decode: invalid digit at position %d", @as(c_int, @intCast(position + 1)));
+        unreachable;
+    }
+    out.finish();
+    return 1;
+}
+
+const functions = [_]c.luaL_Reg{
+    .{ .name = "base64_encode", .func = @ptrCast(&base64_encode_impl) },
+    .{ .name = "base64_decode", .func = @ptrCast(&base64_decode_impl) },
+    .{ .name = "hex_encode", .func = @ptrCast(&hex_encode_impl) },
+    .{ .name = "hex_decode", .func = @ptrCast(&hex_decode_impl) },
+    .{ .name = null, .func = null },
+};
+
+/// Module initialization, for package.preload.codec (see main.zig)
+export fn luaopen_codec(L: *lua.lua_State) c_int {
+    c.lua_createtable(L, 0, functions.len - 1);
+    c.luaL_setfuncs(L, &functions, 0);
+    return 1;
+}
@@ -0,0 +1,313 @@
+const std = @import("std");
+const lua = @import("lua.zig");
+const typed_array = @import("typed_array.zig");
+
+const c = lua.c;
+const HEADER_LEN = typed_array.HEADER_LEN;
+
+// The compress library: deflate, raw or in a zlib or gzip container, and
+// zstd decoding, from std.compress. Inputs are strings or u8 typed arrays.
+// One-shot results are written into a luaL_Buffer and come back as a string,
+// or, when asked for 'bytes', are copied once into a u8 typed array, which
+// reaches the host as a Uint8Array.
+//
+// compress.deflater() returns a context that takes its input in pieces
+// (update) and keeps the compressed output in a buffer of its own, so a
+// large value is compressed as it is produced and never held whole. Its
+// state takes a few hundred KB of the Lua heap while it lives.
+
+const Format = enum { raw, zlib, gzip };
+
+fn Container(comptime format: Format) type {
+    return switch (format) {
+        .raw => std.compress.flate,
+        .zlib => std.compress.zlib,
+        .gzip => std.compress.gzip,
+    };
+}
+
+const Level = @FieldType(std.compress.flate.Options, "level");
+
+/// Set by main.zig; scratch for zstd frames, which decode whole
+pub var allocator: std.mem.Allocator = undefined;
+
+// Largest zstd window accepted, as most decoders default to
+const ZSTD_WINDOW_MAX = 8 << 20;
+
+const DEFLATER: [*:0]const u8 = "cu.deflater";
+
+fn check_format(L: *lua.lua_State, arg: c_int) Format {
+    const names = [_][*c]const u8{ "raw", "zlib", "gzip", null };
+    return @enumFromInt(c.luaL_checkoption(L, arg, "raw", &names));
+}
+
+// std.compress levels run from 4 (fast) to 9 (best); lower ones are 4
+fn check_level(L: *lua.lua_State, arg: c_int) Level {
+    const level = c.luaL_optinteger(L, arg, 6);
+    if (level < 0 or level > 9) {
+        _ = c.luaL_argerror(L, arg, "level must be between 0 and 9");
+        unreachable;
+    }
+    return @enumFromInt(@as(u4, @intCast(@max(level, 4))));
+}
+
+fn check_as_bytes(L: *lua.lua_State, arg: c_int) bool {
+    const names = [_][*c]const u8{ "string", "bytes", null };
+    return c.luaL_checkoption(L, arg, "string", &names) == 1;
+}
+
+/// Push `data` as a new u8 typed array
+fn push_bytes(L: *lua.lua_State, data: []const u8) void {
+    if (data.len > std.math.maxInt(u32)) {
+        _ = c.luaL_error(L, "compress: result too long for bytes");
+        unreachable;
+    }
+    const bytes: [*]u8 = @ptrCast(c.lua_newuserdatauv(L, HEADER_LEN + data.len, 0).?);
+    bytes[0] = typed_array.TYPED_ARRAY;
+    bytes[1] = @intFromEnum(typed_array.Kind.u8);
+    bytes[2] = 0;
+    bytes[3] = 0;
+    std.mem.writeInt(u32, bytes[4..8], @intCast(data.len), .little);
+    @memcpy(bytes[HEADER_LEN..][0..data.len], data);
+    _ = cu_typed_array_adopt(L);
+}
+
+extern fn cu_typed_array_adopt(L: *lua.lua_State) c_int;
+
+// ============================================================================
+// One-shot results, built in a luaL_Buffer
+// ============================================================================
+
+const BufferWriter = std.io.GenericWriter(*c.luaL_Buffer, error{}, add_to_buffer);
+
+fn add_to_buffer(buffer: *c.luaL_Buffer, bytes: []const u8) error{}!usize {
+    c.luaL_addlstring(buffer, bytes.ptr, bytes.len);
+    return bytes.len;
+}
+
+// Push the buffer's contents as a string, or as bytes in place of it
+fn push_buffer(L: *lua.lua_State, buffer: *c.luaL_Buffer, as_bytes: bool) void {
+    if (!as_bytes) return c.luaL_pushresult(buffer);
+    push_bytes(L, buffer.b[0..buffer.n]);
+    // The buffer's placeholder or box, under the bytes
+    c.lua_rotate(L, -2, -1);
+    lua.pop(L, 1);
+}
+
+fn fail(L: *lua.lua_State, what: [*:0]const u8, err: anyerror) noreturn {
+    _ = c.luaL_error(L, "compress.%s: %s", what, @errorName(err).ptr);
+    unreachable;
+}
+
+// compress.deflate(data [, format [, level [, as]]]) -> the compressed data
+fn deflate_impl(L: *lua.lua_State) c_int {
+    const data = typed_array.check_bytes(L, 1);
+    const format = check_format(L, 2);
+    const level = check_level(L, 3);
+    const as_bytes = check_as_bytes(L, 4);
+    var buffer: c.luaL_Buffer = undefined;
+    c.luaL_buffinit(L, &buffer);
+    var input = std.io.fixedBufferStream(data);
+    const writer = BufferWriter{ .context = &buffer };
+    switch (format) {
+        inline else => |tag| Container(tag).compress(input.reader(), writer, .{ .level = level }) catch |err| fail(L, "deflate", err),
+    }
+    push_buffer(L, &buffer, as_bytes);
+    return 1;
+}
+
+// compress.inflate(data [, format [, as]]) -> the decompressed data
+fn inflate_impl(L: *lua.lua_State) c_int {
+    const data = typed_array.check_bytes(L, 1);
+    const format = check_format(L, 2);
+    const as_bytes = check_as_bytes(L, 3);
+    var buffer: c.luaL_Buffer = undefined;
+    c.luaL_buffinit(L, &buffer);
+    var input = std.io.fixedBufferStream(data);
+    const writer = BufferWriter{ .context = &buffer };
+    switch (format) {
+        inline else => |tag| Container(tag).decompress(input.reader(), writer) catch |err| fail(L, "inflate", err),
+    }
+    push_buffer(L, &buffer, as_bytes);
+    return 1;
+}
+
+// compress.zstd_decompress(data [, as]) -> the decompressed data
+fn zstd_decompress_impl(L: *lua.lua_State) c_int {
+    const data = typed_array.check_bytes(L, 1);
+    const as_bytes = check_as_bytes(L, 2);
+    const decoded = std.compress.zstd.decompress.decodeAlloc(allocator, data, true, ZSTD_WINDOW_MAX) catch |err| fail(L, "zstd_decompress", err);
+    // Copied in a protected call, so the scratch is freed even if that raises
+    lua.pushcfunction(L, @as(c.lua_CFunction, @ptrCast(&push_decoded)));
+    c.lua_pushlightuserdata(L, @ptrCast(@constCast(&decoded)));
+    lua.pushboolean(L, @intFromBool(as_bytes));
+    const status = lua.pcall(L, 2, 1);
+    allocator.free(decoded);
+    if (status != c.LUA_OK) return c.lua_error(L);
+    return 1;
+}
+
+// push_decoded(slice, as_bytes): the slice as a string or bytes
+fn push_decoded(L: *lua.lua_State) c_int {
+    const decoded: *const []u8 = @ptrCast(@alignCast(c.lua_touserdata(L, 1).?));
+    if (c.lua_toboolean(L, 2) != 0) {
+        push_bytes(L, decoded.*);
+    } else {
+        _ = c.lua_pushlstring(L, decoded.ptr, decoded.len);
+    }
+    return 1;
+}
+
+// ============================================================================
+// Streaming compression
+// ============================================================================
+
+/// Compressed output not yet read, in memory from the state's allocator
+const Output = struct {
+    alloc: c.lua_Alloc,
+    ud: ?*anyopaque,
+    data: [*]u8 = undefined,
+    len: usize = 0,
+    capacity: usize = 0,
+
+    fn write(out: *Output, bytes: []const u8) error{OutOfMemory}!usize {
+        if (out.capacity - out.len < bytes.len) {
+            const capacity = @max(out.len + bytes.len, out.capacity * 2, 4096);
+            const grown = out.alloc.?(out.ud, if (out.capacity == 0) null else @as(*anyopaque, @ptrCast(out.data)), out.capacity, capacity) orelse return error.OutOfMemory;
+            out.data = @ptrCast(grown);
+            out.capacity = capacity;
+        }
+        @memcpy(out.data[out.len..][0..bytes.len], bytes);
+        out.len += bytes.len;
+        return bytes.len;
+    }
+
+    fn release(out: *Output) void {
+        if (out.capacity != 0) _ = out.alloc.?(out.ud, @ptrCast(out.data), out.capacity, 0);
+        out.capacity = 0;
+        out.len = 0;
+    }
+};
+
+const OutputWriter = std.io.GenericWriter(*Output, error{OutOfMemory}, Output.write);
+
+const Deflater = struct {
+    out: Output,
+    finished: bool = false,
+    state: union(Format) {
+        raw: Container(.raw).Compressor(OutputWriter),
+        zlib: Container(.zlib).Compressor(OutputWriter),
+        gzip: Container(.gzip).Compressor(OutputWriter),
+    },
+};
+
+// Userdata memory is only aligned for Lua's own values, so a deflater is
+// placed at the first suitably aligned address in a slightly larger block
+fn deflater_at(p: *anyopaque) *Deflater {
+    return @ptrFromInt(std.mem.alignForward(usize, @intFromPtr(p), @alignOf(Deflater)));
+}
+
+fn check_deflater(L: *lua.lua_State) *Deflater {
+    const d = deflater_at(c.luaL_checkudata(L, 1, DEFLATER).?);
+    if (d.finished) {
+        _ = c.luaL_error(L, "compress: deflater already finished");
+        unreachable;
+    }
+    return d;
+}
+
+// compress.deflater([format [, level]]) -> a deflater with no input yet
+fn deflater_impl(L: *lua.lua_State) c_int {
+    const format = check_format(L, 1);
+    const level = check_level(L, 2);
+    const d = deflater_at(c.lua_newuserdatauv(L, @sizeOf(Deflater) + @alignOf(Deflater), 0).?);
+    var ud: ?*anyopaque = null;
+    const alloc = c.lua_getallocf(L, &ud);
+    d.out = .{ .alloc = alloc, .ud = ud };
+    d.finished = false;
+    if (lua.luaL_newmetatable(L, DEFLATER) != 0) {
+        lua.newtable(L);
+        lua.pushcfunction(L, @as(c.lua_CFunction, @ptrCast(&update_impl)));
+        lua.setfield(L, -2, "update");
+        lua.pushcfunction(L, @as(c.lua_CFunction, @ptrCast(&read_impl)));
+        lua.setfield(L, -2, "read");
+        lua.pushcfunction(L, @as(c.lua_CFunction, @ptrCast(&finish_impl)));
+        lua.setfield(L, -2, "finish");
+        lua.setfield(L, -2, "__index");
+        lua.pushcfunction(L, @as(c.lua_CFunction, @ptrCast(&gc_impl)));
+        lua.setfield(L, -2, "__gc");
+    }
+    _ = lua.setmetatable(L, -2);
+    // Only now can __gc run, and only once the state is made
+    const writer = OutputWriter{ .context = &d.out };
+    switch (format) {
+        inline else => |tag| d.state = @unionInit(@TypeOf(d.state), @tagName(tag), Container(tag).compressor(writer, .{ .level = level }) catch |err| {
+            d.finished = true;
+            fail(L, "deflater", err);
+        }),
+    }
+    return 1;
+}
+
+// deflater:update(data, ...) -> deflater
+fn update_impl(L: *lua.lua_State) c_int {
+    const d = check_deflater(L);
+    const top = lua.gettop(L);
+    var arg: c_int = 2;
+    while (arg <= top) : (arg += 1) {
+        const data = typed_array.check_bytes(L, arg);
+        switch (d.state) {
+            inline else => |*state| state.writer().writeAll(data) catch |err| fail(L, "update", err),
+        }
+    }
+    lua.settop(L, 1);
+    return 1;
+}
+
+// Push the output not yet read, and forget it
+fn push_output(L: *lua.lua_State, d: *Deflater, as_bytes: bool) void {
+    const pending = d.out.data[0..d.out.len];
+    if (as_bytes) push_bytes(L, pending) else _ = c.lua_pushlstring(L, pending.ptr, pending.len);
+    d.out.len = 0;
+}
+
+// deflater:read([as]) -> the compressed output so far, not yet read
+fn read_impl(L: *lua.lua_State) c_int {
+    const d = check_deflater(L);
+    push_output(L, d, check_as_bytes(L, 2));
+    return 1;
+}
+
+// deflater:finish([as]) -> the rest of the compressed output; the deflater
+// takes no more input
+fn finish_impl(L: *lua.lua_State) c_int {
+    const d = check_deflater(L);
+    const as_bytes = check_as_bytes(L, 2);
+    switch (d.state) {
+        inline else => |*state| state.finish() catch |err| fail(L, "finish", err),
+    }
+    d.finished = true;
+    push_output(L, d, as_bytes);
+    d.out.release();
+    return 1;
+}
+
+fn gc_impl(L: *lua.lua_State) c_int {
+    deflater_at(c.lua_touserdata(L, 1).?).out.release();
+    return 0;
+}
+
+const functions = [_]c.luaL_Reg{
+    .{ .name = "deflate", .func = @ptrCast(&deflate_impl) },
+    .{ .name = "inflate", .func = @ptrCast(&inflate_impl) },
+    .{ .name = "zstd_decompress", .func = @ptrCast(&zstd_decompress_impl) },
+    .{ .name = "deflater", .func = @ptrCast(&deflater_impl) },
+    .{ .name = null, .func = null },
+};
+
+/// Module initialization, for package.preload.compress (see main.zig)
+pub fn luaopen(L: *lua.lua_State) c_int {
+    c.lua_createtable(L, 0, functions.len - 1);
+    c.luaL_setfuncs(L, &functions, 0);
+    return 1;
+}
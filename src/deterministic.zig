@@ -0,0 +1,74 @@
+const std = @import("std");
+const lua = @import("lua.zig");
+
+// Deterministic mode: the same init and the same invocations give
+// bit-identical results, so a unit's message log can be replayed to rebuild
+// its state on another node.
+//
+// Lua reads the outside world in three places: the clocks (time() for
+// os.time and os.date, clock() for os.clock and sched timers), the string
+// hash seed (luai_makeseed in lstate.c, which decides pairs() order) and
+// math.random's seed. In this mode both clocks read a virtual time the host
+// sets before each invocation and records with the message, the hash seed
+// and math.random derive from the seed given at init, and nothing else
+// varies: the allocator and collector see the same allocations in the same
+// order, and collector debt is counted in bytes, not time.
+//
+// Time limits (set_compute_limits) still use the host's clock, so a compute
+// they stop may stop at another instruction on replay. Replaying hosts use
+// instruction limits.
+
+extern "env" fn js_time_now() c_long;
+
+var enabled: bool = false;
+var seed: u32 = 0;
+// Host-set time in milliseconds since the epoch
+var virtual_ms: f64 = 0;
+
+/// Turn the mode on for the next init with `s` as the seed; off again
+/// with `on` false
+pub fn configure(on: bool, s: u32) void {
+    enabled = on;
+    seed = s;
+    virtual_ms = 0;
+}
+
+pub fn active() bool {
+    return enabled;
+}
+
+pub fn set_time(ms: f64) void {
+    virtual_ms = if (std.math.isFinite(ms)) ms else 0;
+}
+
+/// Seed math.random from the configured seed, replacing lmathlib.c's
+/// time-based one
+pub fn seed_random(L: *lua.lua_State) void {
+    // Not opened (set_stdlibs): nothing to seed
+    if (lua.getglobal(L, "math") != lua.c.LUA_TTABLE) {
+        lua.pop(L, 1);
+        return;
+    }
+    _ = lua.getfield(L, -1, "randomseed");
+    lua.pushinteger(L, seed);
+    lua.c.lua_callk(L, 1, 0, 0, null);
+    lua.pop(L, 1);
+}
+
+/// For time() and clock() in libc-stubs.zig: store the virtual time in `out`
+/// and return 1, or return 0 so they read the host's clocks
+export fn cu_virtual_time_ms(out: *f64) c_int {
+    if (!enabled) return 0;
+    out.* = virtual_ms;
+    return 1;
+}
+
+/// luai_makeseed (luaconf.h): the string hash seed of a new state
+export fn cu_makeseed(L: ?*anyopaque) c_uint {
+    if (enabled) return @truncate(std.hash.Wyhash.hash(seed, "cu.strings"));
+    const now: i64 = js_time_now();
+    var bytes: [16]u8 = undefined;
+    std.mem.writeInt(i64, bytes[0..8], now, .little);
+    std.mem.writeInt(u64, bytes[8..16], @intFromPtr(L), .little);
+    return @truncate(std.hash.Wyhash.hash(0, &bytes));
+}
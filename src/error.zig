@@ -10,33 +10,112 @@ pub const ErrorCode = enum(c_int) {
     compilation_error = -1,
     runtime_error = -2,
     serialization_error = -3,
+    memory_limit_exceeded = -4,
+    instruction_limit_exceeded = -5,
+    interrupted = -6,
 };
 
 var error_buffer: [MAX_ERROR_MSG_SIZE]u8 = undefined;
 var error_len: usize = 0;
 var last_error_code: ErrorCode = .success;
 
+// Where the last error was raised: the innermost Lua function on the stack
+// when it was thrown, recorded by message_handler (or capture_thread_error
+// for a coroutine). Compilation errors have no frame; their location is read
+// from the message when the frame is written.
+var error_chunk: [lua.c.LUA_IDSIZE]u8 = undefined;
+var error_chunk_len: usize = 0;
+var error_line: i32 = -1;
+
+// The stack is unwound by the time the pcall returns, so a traceback can
+// only be taken while it is still there. message_handler builds one with
+// luaL_traceback only while the host has asked for them, and leaves it in
+// the registry until the next call clears it.
+const TRACEBACK_KEY: [*:0]const u8 = "cu.error_traceback";
+var traceback_enabled = false;
+var traceback_stored = false;
+
+/// Make message_handler keep a traceback of each error for write_frame
+pub fn set_traceback_enabled(enabled: bool) void {
+    traceback_enabled = enabled;
+}
+
 pub fn init_error_state() void {
     error_len = 0;
     last_error_code = .success;
+    error_chunk_len = 0;
+    error_line = -1;
+    traceback_stored = false;
 }
 
 pub fn clear_error_state(L: *lua.lua_State) void {
     error_len = 0;
     last_error_code = .success;
     lua.settop(L, 0);
+    error_chunk_len = 0;
+    error_line = -1;
+    if (traceback_stored) {
+        lua.pushnil(L);
+        lua.setfield(L, lua.c.LUA_REGISTRYINDEX, TRACEBACK_KEY);
+        traceback_stored = false;
+    }
 }
 
-pub fn capture_lua_error(L: *lua.lua_State, error_code: c_int) ErrorCode {
-    var error_enum: ErrorCode = .runtime_error;
-
-    if (error_code == 4) {
-        error_enum = .compilation_error;
-    } else if (error_code == 2) {
-        error_enum = .runtime_error;
-    } else if (error_code == 5) {
-        error_enum = .serialization_error;
+/// lua_pcall with message_handler installed below the function and its
+/// `nargs` arguments; the handler is gone from the stack again on return
+pub fn pcall(L: *lua.lua_State, nargs: c_int, nresults: c_int) c_int {
+    const base = lua.gettop(L) - nargs;
+    lua.pushcfunction(L, &message_handler);
+    lua.c.lua_rotate(L, base, 1);
+    const status = lua.c.lua_pcallk(L, nargs, nresults, base, 0, null);
+    lua.c.lua_rotate(L, base, -1);
+    lua.pop(L, 1);
+    return status;
+}
+
+// Runs on the erroring stack before it unwinds. Records the location, plus
+// a traceback if enabled, and passes the error value through unchanged.
+// Errors a script catches with pcall never reach it.
+fn message_handler(state: ?*lua.lua_State) callconv(.c) c_int {
+    const L = state.?;
+    record_location(L, 1);
+    if (traceback_enabled) store_traceback(L, L, 1);
+    return 1;
+}
+
+/// Record the location (and traceback) of the error a coroutine died with.
+/// A failed coroutine keeps its stack, so `co` still shows where it stopped.
+pub fn capture_thread_error(L: *lua.lua_State, co: *lua.lua_State) void {
+    record_location(co, 0);
+    if (traceback_enabled) store_traceback(L, co, 0);
+}
+
+fn record_location(L: *lua.lua_State, first_level: c_int) void {
+    var ar: lua.c.lua_Debug = undefined;
+    var level = first_level;
+    while (lua.c.lua_getstack(L, level, &ar) != 0) : (level += 1) {
+        if (lua.c.lua_getinfo(L, "Sl", &ar) == 0) break;
+        if (ar.currentline < 0) continue;
+        const source = std.mem.sliceTo(&ar.short_src, 0);
+        @memcpy(error_chunk[0..source.len], source);
+        error_chunk_len = source.len;
+        error_line = ar.currentline;
+        return;
     }
+}
+
+fn store_traceback(L: *lua.lua_State, from: *lua.lua_State, level: c_int) void {
+    lua.c.luaL_traceback(L, from, null, level);
+    lua.setfield(L, lua.c.LUA_REGISTRYINDEX, TRACEBACK_KEY);
+    traceback_stored = true;
+}
+
+pub fn capture_lua_error(L: *lua.lua_State, error_code: c_int) ErrorCode {
+    const error_enum: ErrorCode = switch (error_code) {
+        lua.c.LUA_ERRSYNTAX => .compilation_error,
+        lua.c.LUA_ERRMEM => .memory_limit_exceeded,
+        else => .runtime_error,
+    };
 
     last_error_code = error_enum;
 
@@ -57,6 +136,15 @@ pub fn capture_lua_error(L: *lua.lua_State, error_code: c_int) ErrorCode {
     return error_enum;
 }
 
+/// Replace the captured error with `msg` under a specific code, for failures
+/// whose Lua-level message does not say what actually went wrong
+pub fn override_error(code: ErrorCode, msg: []const u8) void {
+    last_error_code = code;
+    const copy_len = @min(msg.len, MAX_ERROR_MSG_SIZE - 1);
+    @memcpy(error_buffer[0..copy_len], msg[0..copy_len]);
+    error_len = copy_len;
+}
+
 pub fn format_error_to_buffer(buffer: [*]u8, max_len: usize) usize {
     if (max_len < 1) return 0;
 
@@ -72,6 +160,66 @@ pub fn format_error_to_buffer(buffer: [*]u8, max_len: usize) usize {
     return copy_len;
 }
 
+/// Write the last error as a frame: i32 code, i32 line (-1 if unknown),
+/// then the chunk name, the message and the traceback (empty unless one was
+/// kept), each as a u32 length and its bytes, all little-endian. The
+/// message is cut short if the frame would not fit. Returns the frame
+/// length, or 0 if the last call succeeded or `buffer` is too small.
+pub fn write_frame(L: *lua.lua_State, buffer: []u8) usize {
+    if (last_error_code == .success or buffer.len < 20) return 0;
+
+    var chunk: []const u8 = error_chunk[0..error_chunk_len];
+    var line = error_line;
+    if (line < 0) {
+        if (message_location(error_buffer[0..error_len])) |location| {
+            chunk = location.chunk;
+            line = location.line;
+        }
+    }
+
+    var traceback: []const u8 = "";
+    if (traceback_stored) {
+        _ = lua.getfield(L, lua.c.LUA_REGISTRYINDEX, TRACEBACK_KEY);
+        var len: usize = 0;
+        const text = lua.c.lua_tolstring(L, -1, &len);
+        if (text != null) traceback = text[0..len];
+    }
+    defer if (traceback_stored) lua.pop(L, 1);
+
+    var fixed: usize = 20 + chunk.len;
+    if (fixed > buffer.len) return 0;
+    traceback = traceback[0..@min(traceback.len, buffer.len - fixed)];
+    fixed += traceback.len;
+    const message = error_buffer[0..@min(error_len, buffer.len - fixed)];
+
+    std.mem.writeInt(i32, buffer[0..4], @intFromEnum(last_error_code), .little);
+    std.mem.writeInt(i32, buffer[4..8], line, .little);
+    var pos: usize = 8;
+    for ([_][]const u8{ chunk, message, traceback }) |part| {
+        std.mem.writeInt(u32, buffer[pos..][0..4], @intCast(part.len), .little);
+        @memcpy(buffer[pos + 4 ..][0..part.len], part);
+        pos += 4 + part.len;
+    }
+    return pos;
+}
+
+const Location = struct { chunk: []const u8, line: i32 };
+
+// "chunk:line: message", the form Lua gives syntax errors
+fn message_location(message: []const u8) ?Location {
+    var i: usize = 0;
+    while (i < @min(message.len, lua.c.LUA_IDSIZE)) : (i += 1) {
+        if (message[i] != ':') continue;
+        var j = i + 1;
+        while (j < message.len and std.ascii.isDigit(message[j])) j += 1;
+        if (j > i + 1 and j < message.len and message[j] == ':') {
+            const line = std.fmt.parseInt(i32, message[i + 1 .. j], 10) catch return null;
+            return .{ .chunk = message[0..i], .line = line };
+        }
+    }
+    return null;
+}
+
 pub fn get_last_error_code() ErrorCode {
     return last_error_code;
 }
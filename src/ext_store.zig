@@ -0,0 +1,286 @@
+const std = @import("std");
+
+// Native backend for external tables.
+//
+// When enabled, ext_table keeps entries it has seen in an open-addressing
+// hash table in linear memory, keyed by (table id, key bytes) and holding the
+// serialized value exactly as the host would store it. Reads that hit never
+// leave wasm. Writes are held as dirty entries and spilled to the host with
+// js_ext_table_set when the invocation finishes (flush), so the JS Map stays
+// the persistent copy at every boundary. Keys the host does not have are
+// cached as nil, which is what a host read of a deleted key returns anyway.
+//
+// The host must call invalidate() after changing a table directly (e.g.
+// writing _io.input or restoring _home), since clean entries would otherwise
+// shadow the new contents.
+
+extern fn lua_malloc(size: usize) ?*anyopaque;
+extern fn lua_free(ptr: ?*anyopaque) void;
+extern fn js_ext_table_set(table_id: u32, key_ptr: [*]const u8, key_len: usize, val_ptr: [*]const u8, val_len: usize) c_int;
+
+const INITIAL_CAPACITY = 64;
+pub const DEFAULT_MAX_BYTES = 256 * 1024;
+
+// Serialized nil, cached for keys the host has no entry for
+pub const NIL_VALUE = [_]u8{0x00};
+
+const SlotState = enum(u8) { empty, live, tombstone };
+
+const Slot = struct {
+    state: SlotState,
+    dirty: bool,
+    table_id: u32,
+    hash: u64,
+    /// Key bytes followed by the value bytes, in one allocation
+    blob: [*]u8,
+    key_len: u32,
+    value_len: u32,
+
+    fn key(self: *const Slot) []const u8 {
+        return self.blob[0..self.key_len];
+    }
+
+    fn value(self: *const Slot) []const u8 {
+        return self.blob[self.key_len..][0..self.value_len];
+    }
+};
+
+var enabled: bool = false;
+var max_bytes: usize = DEFAULT_MAX_BYTES;
+
+var slots: []Slot = &.{};
+var live_count: usize = 0;
+var used_count: usize = 0; // live + tombstones
+var dirty_count: usize = 0;
+var stored_bytes: usize = 0;
+
+var hits: u32 = 0;
+var misses: u32 = 0;
+
+/// Turn the native backend on or off. Turning it off spills pending writes
+/// and releases all entries.
+pub fn set_enabled(on: bool) void {
+    if (!on) {
+        flush();
+        clear();
+    }
+    enabled = on;
+}
+
+pub fn is_enabled() bool {
+    return enabled;
+}
+
+/// Cap on key and value bytes held natively; 0 restores the default
+pub fn set_max_bytes(bytes: usize) void {
+    max_bytes = if (bytes == 0) DEFAULT_MAX_BYTES else bytes;
+}
+
+pub fn hit_count() u32 {
+    return hits;
+}
+
+pub fn miss_count() u32 {
+    return misses;
+}
+
+pub fn get(table_id: u32, key: []const u8) ?[]const u8 {
+    const index = find(table_id, key, hash_key(table_id, key)) orelse {
+        misses +%= 1;
+        return null;
+    };
+    hits +%= 1;
+    return slots[index].value();
+}
+
+pub const Origin = enum { host, lua };
+
+/// Store a serialized value. `.lua` marks it dirty so the next flush writes
+/// it to the host; `.host` caches what the host already holds. Returns false
+/// if the entry could not be stored natively, in which case any older copy
+/// has been dropped and the caller must go to the host directly.
+pub fn put(table_id: u32, key: []const u8, value: []const u8, origin: Origin) bool {
+    const hash = hash_key(table_id, key);
+    const size = key.len + value.len;
+
+    if (size > max_bytes / 4) {
+        remove(table_id, key, hash);
+        return false;
+    }
+
+    if (find(table_id, key, hash)) |index| {
+        const slot = &slots[index];
+        if (slot.value_len != value.len) {
+            const blob = alloc_blob(key, value) orelse {
+                remove_at(index);
+                return false;
+            };
+            stored_bytes -= slot.key_len + slot.value_len;
+            stored_bytes += size;
+            lua_free(slot.blob);
+            slot.blob = blob;
+            slot.value_len = @intCast(value.len);
+        } else {
+            @memcpy(slot.blob[slot.key_len..][0..value.len], value);
+        }
+        mark(slot, origin);
+        return true;
+    }
+
+    // Over budget: spill pending writes and start over rather than tracking
+    // recency per entry
+    if (stored_bytes + size > max_bytes) {
+        flush();
+        clear();
+    }
+
+    if (!ensure_capacity()) return false;
+
+    const blob = alloc_blob(key, value) orelse return false;
+    const index = insert_index(hash);
+    if (slots[index].state == .empty) used_count += 1;
+    slots[index] = .{
+        .state = .live,
+        .dirty = false,
+        .table_id = table_id,
+        .hash = hash,
+        .blob = blob,
+        .key_len = @intCast(key.len),
+        .value_len = @intCast(value.len),
+    };
+    live_count += 1;
+    stored_bytes += size;
+    mark(&slots[index], origin);
+    return true;
+}
+
+/// Write every dirty entry back to the host
+pub fn flush() void {
+    if (dirty_count == 0) return;
+    for (slots) |*slot| {
+        if (slot.state == .live and slot.dirty) spill(slot);
+    }
+}
+
+/// Write the dirty entries of one table back to the host
+pub fn flush_table(table_id: u32) void {
+    if (dirty_count == 0) return;
+    for (slots) |*slot| {
+        if (slot.state == .live and slot.dirty and slot.table_id == table_id) spill(slot);
+    }
+}
+
+/// Drop cached entries for `table_id` (0 = every table) after the host
+/// changed it directly. Pending writes for those entries are discarded.
+pub fn invalidate(table_id: u32) void {
+    if (table_id == 0) {
+        clear();
+        return;
+    }
+    for (slots, 0..) |slot, index| {
+        if (slot.state == .live and slot.table_id == table_id) remove_at(index);
+    }
+}
+
+/// Forget one key, discarding a pending write for it. Used when a value is
+/// written to the host directly because it is too large to hold natively.
+pub fn drop(table_id: u32, key: []const u8) void {
+    remove(table_id, key, hash_key(table_id, key));
+}
+
+fn spill(slot: *Slot) void {
+    const value = slot.value();
+    _ = js_ext_table_set(slot.table_id, slot.blob, slot.key_len, value.ptr, value.len);
+    slot.dirty = false;
+    dirty_count -= 1;
+}
+
+fn mark(slot: *Slot, origin: Origin) void {
+    const dirty = origin == .lua;
+    if (dirty and !slot.dirty) dirty_count += 1;
+    if (!dirty and slot.dirty) dirty_count -= 1;
+    slot.dirty = dirty;
+}
+
+fn clear() void {
+    for (slots) |slot| {
+        if (slot.state == .live) lua_free(slot.blob);
+    }
+    if (slots.len > 0) lua_free(slots.ptr);
+    slots = &.{};
+    live_count = 0;
+    used_count = 0;
+    dirty_count = 0;
+    stored_bytes = 0;
+}
+
+fn hash_key(table_id: u32, key: []const u8) u64 {
+    return std.hash.Wyhash.hash(table_id, key);
+}
+
+fn find(table_id: u32, key: []const u8, hash: u64) ?usize {
+    if (slots.len == 0) return null;
+    const mask = slots.len - 1;
+    var index: usize = @intCast(hash & mask);
+    while (true) : (index = (index + 1) & mask) {
+        const slot = &slots[index];
+        switch (slot.state) {
+            .empty => return null,
+            .tombstone => {},
+            .live => if (slot.hash == hash and slot.table_id == table_id and std.mem.eql(u8, slot.key(), key)) {
+                return index;
+            },
+        }
+    }
+}
+
+// First reusable slot on the probe path; call only after find() missed
+fn insert_index(hash: u64) usize {
+    const mask = slots.len - 1;
+    var index: usize = @intCast(hash & mask);
+    while (slots[index].state == .live) : (index = (index + 1) & mask) {}
+    return index;
+}
+
+fn remove(table_id: u32, key: []const u8, hash: u64) void {
+    if (find(table_id, key, hash)) |index| remove_at(index);
+}
+
+fn remove_at(index: usize) void {
+    const slot = &slots[index];
+    if (slot.dirty) dirty_count -= 1;
+    stored_bytes -= slot.key_len + slot.value_len;
+    lua_free(slot.blob);
+    slot.state = .tombstone;
+    slot.dirty = false;
+    live_count -= 1;
+}
+
+fn alloc_blob(key: []const u8, value: []const u8) ?[*]u8 {
+    const blob: [*]u8 = @ptrCast(lua_malloc(@max(key.len + value.len, 1)) orelse return null);
+    @memcpy(blob[0..key.len], key);
+    @memcpy(blob[key.len..][0..value.len], value);
+    return blob;
+}
+
+// Keep the load factor (tombstones included) under 3/4, rehashing into a
+// table sized for the live entries
+fn ensure_capacity() bool {
+    if (slots.len > 0 and (used_count + 1) * 4 < slots.len * 3) return true;
+
+    var capacity: usize = INITIAL_CAPACITY;
+    while ((live_count + 1) * 2 > capacity) capacity *= 2;
+
+    const raw = lua_malloc(capacity * @sizeOf(Slot)) orelse return false;
+    const fresh = @as([*]Slot, @ptrCast(@alignCast(raw)))[0..capacity];
+    for (fresh) |*slot| slot.state = .empty;
+
+    const old = slots;
+    slots = fresh;
+    used_count = live_count;
+    for (old) |slot| {
+        if (slot.state == .live) slots[insert_index(slot.hash)] = slot;
+    }
+    if (old.len > 0) lua_free(old.ptr);
+    return true;
+}
@@ -1,6 +1,12 @@
 const std = @import("std");
 const lua = @import("lua.zig");
 const serializer = @import("serializer.zig");
+const ext_store = @import("ext_store.zig");
+const key_filter = @import("key_filter.zig");
+const prefetch = @import("prefetch.zig");
+const typed_array = @import("typed_array.zig");
+const blob = @import("blob.zig");
+const perf = @import("perf_counters.zig");
 
 const c = lua.c;
 const IO_BUFFER_SIZE = 64 * 1024;
@@ -10,11 +16,64 @@ extern fn js_ext_table_get(table_id: u32, key_ptr: [*]const u8, key_len: usize,
 extern fn js_ext_table_delete(table_id: u32, key_ptr: [*]const u8, key_len: usize) c_int;
 extern fn js_ext_table_size(table_id: u32) usize;
 extern fn js_ext_table_keys(table_id: u32, buf_ptr: [*]u8, max_len: usize) c_int;
+extern fn js_ext_table_next(table_id: u32, cursor: u32, buf_ptr: [*]u8, max_len: usize) c_int;
+extern fn js_ext_table_get_many(table_id: u32, keys_ptr: [*]const u8, keys_len: usize, out_ptr: [*]u8, max_len: usize) c_int;
+extern fn js_ext_table_order(table_id: u32) c_int;
+extern fn js_ext_table_range(table_id: u32, lo_ptr: [*]const u8, lo_len: usize, hi_ptr: [*]const u8, hi_len: usize, limit: u32, reverse: u32) c_int;
+extern fn js_ext_table_index(table_id: u32, field_ptr: [*]const u8, field_len: usize) c_int;
+extern fn js_ext_transaction(op: u32) c_int;
+extern fn js_ext_table_cache(table_id: u32, max_entries: u32, ttl_seconds: f64) c_int;
+extern fn js_ext_table_columns(table_id: u32, schema_ptr: [*]const u8, schema_len: usize) c_int;
+extern fn js_ext_table_column(table_id: u32, field_ptr: [*]const u8, field_len: usize, first: u32, last: u32, out_ptr: [*]u8, max_len: usize) c_int;
+extern fn js_ext_table_lookup(table_id: u32, field_ptr: [*]const u8, field_len: usize, value_ptr: [*]const u8, value_len: usize, limit: u32) c_int;
+extern fn js_ext_table_array(table_id: u32) c_int;
+extern fn js_ext_table_push(table_id: u32, val_ptr: [*]const u8, val_len: usize) c_int;
+extern fn js_ext_table_pop(table_id: u32, out_ptr: [*]u8, max_len: usize) c_int;
+extern fn js_ext_table_slice(table_id: u32, first: u32, last: u32, out_ptr: [*]u8, max_len: usize) c_int;
 
 var io_buffer: [*]u8 = undefined;
 var io_buffer_size: usize = 0;
 var external_table_counter: u32 = 1;
 
+// Per-invocation cache of deserialized values, so repeated reads of the same
+// field return the same Lua value without another host lookup or proxy
+// allocation. Registry ref to { [table_id] = weak-valued { [key] = value } },
+// keyed by the serialized key bytes (so t[1] and t["1"] share an entry, as
+// they do on the host). Writes drop the entry; reset_value_cache() drops the
+// whole cache at the start of each compute/call.
+var value_cache_ref: c_int = c.LUA_NOREF;
+const WEAK_VALUES_MT: [*:0]const u8 = "cu.weak_values";
+
+// Lua functions read from external tables, kept across invocations so a
+// stored handler is loaded from its bytecode once rather than on every
+// compute that calls it. Registry ref to { [table_id] = { [key] = function } },
+// keyed like the value cache. __newindex drops the entry and
+// invalidate_functions() a table's (or every) entries, the same points at
+// which ext_store forgets what it holds natively.
+var function_cache_ref: c_int = c.LUA_NOREF;
+
+// Registry ref to a weak-valued { [table_id] = proxy } map. Deserializing a
+// table_ref reuses the live proxy, so identity is stable (_home.a == _home.a)
+// and nested access does not allocate a fresh table per step.
+var proxy_cache_ref: c_int = c.LUA_NOREF;
+
+/// The current lua_State's registry refs, swapped by states.zig
+pub const StateRefs = struct {
+    value_cache: c_int = c.LUA_NOREF,
+    function_cache: c_int = c.LUA_NOREF,
+    proxy_cache: c_int = c.LUA_NOREF,
+};
+
+pub fn save_refs() StateRefs {
+    return .{ .value_cache = value_cache_ref, .function_cache = function_cache_ref, .proxy_cache = proxy_cache_ref };
+}
+
+pub fn load_refs(refs: StateRefs) void {
+    value_cache_ref = refs.value_cache;
+    function_cache_ref = refs.function_cache;
+    proxy_cache_ref = refs.proxy_cache;
+}
+
 pub fn init_ext_table(buffer: [*]u8, buffer_size: usize) void {
     io_buffer = buffer;
     io_buffer_size = buffer_size;
@@ -31,16 +90,49 @@ fn ensure_metatable(L: *lua.lua_State) void {
 
         lua.pushcfunction(L, @as(c.lua_CFunction, @ptrCast(&ext_table_len_impl)));
         lua.setfield(L, -2, "__len");
+
+        lua.pushcfunction(L, @as(c.lua_CFunction, @ptrCast(&ext_table_pairs_impl)));
+        lua.setfield(L, -2, "__pairs");
     }
 
     _ = lua.setmetatable(L, -2);
 }
 
 fn push_ext_table(L: *lua.lua_State, table_id: u32) void {
+    if (proxy_cache_ref == c.LUA_NOREF) {
+        push_weak_table(L);
+        lua.pushvalue(L, -1);
+        proxy_cache_ref = lua.ref(L);
+    } else {
+        _ = lua.getref(L, proxy_cache_ref);
+    }
+
+    if (c.lua_rawgeti(L, -1, @intCast(table_id)) == c.LUA_TTABLE) {
+        c.lua_rotate(L, -2, 1);
+        lua.pop(L, 1);
+        return;
+    }
+    lua.pop(L, 1);
+
     lua.newtable(L);
     lua.pushinteger(L, table_id);
     lua.setfield(L, -2, "__ext_table_id");
     ensure_metatable(L);
+
+    lua.pushvalue(L, -1);
+    c.lua_rawseti(L, -3, @intCast(table_id));
+    c.lua_rotate(L, -2, 1);
+    lua.pop(L, 1);
+}
+
+// Push a new table whose values are weak references
+fn push_weak_table(L: *lua.lua_State) void {
+    lua.newtable(L);
+    if (lua.luaL_newmetatable(L, WEAK_VALUES_MT) != 0) {
+        _ = lua.pushstring(L, "v");
+        lua.setfield(L, -2, "__mode");
+    }
+    _ = lua.setmetatable(L, -2);
 }
 
 pub fn create_table(L: *lua.lua_State) u32 {
@@ -64,44 +156,147 @@ pub fn sync_counter(next_id: u32) void {
     }
 }
 
-fn serialize_key(L: *lua.lua_State, idx: c_int, buffer: [*]u8, max_len: usize) !usize {
-    if (lua.isstring(L, idx)) {
-        var key_len: usize = 0;
-        const key_ptr = lua.tolstring(L, idx, &key_len);
-        if (key_len == 0) return serializer.SerializationError.InvalidFormat;
+/// Run a full collection, then write the IDs of the tables Lua still holds
+/// a proxy for into `ids`. Returns the count, or -1 if `ids` is too small.
+/// Together with the tables reachable from _home and _io these are all the
+/// tables Lua can still reach, which is what the host's sweep keeps.
+pub fn live_table_ids(L: *lua.lua_State, ids: []u32) c_int {
+    // Cached values (and upvalues a cached function has since set) would
+    // keep proxies Lua no longer holds alive
+    reset_value_cache(L);
+    invalidate_functions(L, 0);
+    lua.gc_collect(L);
+    if (proxy_cache_ref == c.LUA_NOREF) return 0;
 
-        if (key_len > max_len) return serializer.SerializationError.BufferTooSmall;
+    _ = lua.getref(L, proxy_cache_ref);
+    defer lua.pop(L, 1);
+    var count: usize = 0;
+    lua.pushnil(L);
+    while (c.lua_next(L, -2) != 0) {
+        lua.pop(L, 1);
+        if (count == ids.len) {
+            lua.pop(L, 1);
+            return -1;
+        }
+        ids[count] = @intCast(c.lua_tointegerx(L, -1, null));
+        count += 1;
+    }
+    return @intCast(count);
+}
+
+pub fn reset_value_cache(L: *lua.lua_State) void {
+    if (value_cache_ref == c.LUA_NOREF) return;
+    lua.unref(L, value_cache_ref);
+    value_cache_ref = c.LUA_NOREF;
+}
+
+// Push the value cache for `table_id`. Without `create`, returns false and
+// pushes nothing if there is no cache yet.
+fn push_value_cache(L: *lua.lua_State, table_id: u32, create: bool) bool {
+    return push_table_cache(L, &value_cache_ref, table_id, create, true);
+}
 
-        @memcpy(buffer[0..key_len], key_ptr[0..key_len]);
-        return key_len;
+// Push the `table_id` entry of the cache `cache_ref` refers to, creating
+// the cache and entry (weak-valued if `weak`) when `create` is set
+fn push_table_cache(L: *lua.lua_State, cache_ref: *c_int, table_id: u32, create: bool, weak: bool) bool {
+    if (cache_ref.* == c.LUA_NOREF) {
+        if (!create) return false;
+        lua.newtable(L);
+        lua.pushvalue(L, -1);
+        cache_ref.* = lua.ref(L);
+    } else {
+        _ = lua.getref(L, cache_ref.*);
     }
 
-    if (lua.isnumber(L, idx)) {
-        const num = lua.tonumber(L, idx);
-        const int_val = lua.tointeger(L, idx);
+    if (c.lua_rawgeti(L, -1, @intCast(table_id)) == c.LUA_TTABLE) {
+        c.lua_rotate(L, -2, 1);
+        lua.pop(L, 1);
+        return true;
+    }
+    lua.pop(L, 1);
+    if (!create) {
+        lua.pop(L, 1);
+        return false;
+    }
 
-        if (@as(f64, @floatFromInt(int_val)) == num) {
-            var buf: [32]u8 = undefined;
-            const num_str = std.fmt.bufPrint(&buf, "{d}", .{int_val}) catch {
-                return serializer.SerializationError.InvalidFormat;
-            };
+    if (weak) push_weak_table(L) else lua.newtable(L);
+    lua.pushvalue(L, -1);
+    c.lua_rawseti(L, -3, @intCast(table_id));
+    c.lua_rotate(L, -2, 1);
+    lua.pop(L, 1);
+    return true;
+}
 
-            if (num_str.len > max_len) return serializer.SerializationError.BufferTooSmall;
-            @memcpy(buffer[0..num_str.len], num_str);
-            return num_str.len;
-        } else {
-            var buf: [32]u8 = undefined;
-            const num_str = std.fmt.bufPrint(&buf, "{d}", .{num}) catch {
-                return serializer.SerializationError.InvalidFormat;
-            };
+// With the key string on top, push its cached value and return true, or
+// leave the stack unchanged on a miss
+fn push_cached_value(L: *lua.lua_State, table_id: u32) bool {
+    return push_cached_entry(L, &value_cache_ref, table_id);
+}
 
-            if (num_str.len > max_len) return serializer.SerializationError.BufferTooSmall;
-            @memcpy(buffer[0..num_str.len], num_str);
-            return num_str.len;
-        }
+fn push_cached_entry(L: *lua.lua_State, cache_ref: *c_int, table_id: u32) bool {
+    if (!push_table_cache(L, cache_ref, table_id, false, false)) return false;
+    lua.pushvalue(L, -2);
+    if (c.lua_rawget(L, -2) != c.LUA_TNIL) {
+        c.lua_rotate(L, -2, 1);
+        lua.pop(L, 1);
+        return true;
+    }
+    lua.pop(L, 2);
+    return false;
+}
+
+// Cache the value on top of the stack under the key string just below it.
+// A Lua function also goes in the function cache.
+fn cache_value(L: *lua.lua_State, table_id: u32) void {
+    if (lua.isnil(L, -1)) return;
+    _ = push_value_cache(L, table_id, true);
+    lua.pushvalue(L, -3);
+    lua.pushvalue(L, -3);
+    c.lua_rawset(L, -3);
+    lua.pop(L, 1);
+
+    if (c.lua_type(L, -1) != c.LUA_TFUNCTION or c.lua_iscfunction(L, -1) != 0) return;
+    _ = push_table_cache(L, &function_cache_ref, table_id, true, false);
+    lua.pushvalue(L, -3);
+    lua.pushvalue(L, -3);
+    c.lua_rawset(L, -3);
+    lua.pop(L, 1);
+}
+
+/// Forget native entries and cached values of a table whose contents were
+/// replaced without going through __newindex
+pub fn invalidate_table(L: *lua.lua_State, table_id: u32) void {
+    ext_store.invalidate(table_id);
+    invalidate_functions(L, table_id);
+    if (value_cache_ref == c.LUA_NOREF) return;
+    _ = lua.getref(L, value_cache_ref);
+    lua.pushnil(L);
+    c.lua_rawseti(L, -2, @intCast(table_id));
+    lua.pop(L, 1);
+}
+
+/// Forget the cached functions of `table_id`, or of every table for 0
+pub fn invalidate_functions(L: *lua.lua_State, table_id: u32) void {
+    if (function_cache_ref == c.LUA_NOREF) return;
+    if (table_id == 0) {
+        lua.unref(L, function_cache_ref);
+        function_cache_ref = c.LUA_NOREF;
+        return;
     }
+    _ = lua.getref(L, function_cache_ref);
+    lua.pushnil(L);
+    c.lua_rawseti(L, -2, @intCast(table_id));
+    lua.pop(L, 1);
+}
 
-    return serializer.SerializationError.TypeMismatch;
+fn invalidate_cached_value(L: *lua.lua_State, table_id: u32, key: []const u8) void {
+    for ([_]*c_int{ &value_cache_ref, &function_cache_ref }) |cache_ref| {
+        if (!push_table_cache(L, cache_ref, table_id, false, false)) continue;
+        _ = lua.pushlstring(L, key.ptr, key.len);
+        lua.pushnil(L);
+        c.lua_rawset(L, -3);
+        lua.pop(L, 1);
+    }
 }
 
 fn ext_table_new_impl(L: *lua.lua_State) c_int {
@@ -109,6 +304,13 @@ fn ext_table_new_impl(L: *lua.lua_State) c_int {
     return 1;
 }
 
+// ext.ordered() is ext.table() whose host keeps its keys ordered from the
+// start, so the first range scan does not sort them
+fn ext_table_ordered_impl(L: *lua.lua_State) c_int {
+    _ = js_ext_table_order(create_table(L));
+    return 1;
+}
+
 fn ext_table_index_impl(L: *lua.lua_State) c_int {
     if (lua.gettop(L) < 2) {
         return 0;
@@ -125,28 +327,110 @@ fn ext_table_index_impl(L: *lua.lua_State) c_int {
         lua.pushnil(L);
         return 1;
     }
+    perf.counters.ext_gets +%= 1;
+    prefetch.record(L, table_id, 2);
 
     const key_buffer_start = io_buffer;
     const key_buffer_size = io_buffer_size / 4;
 
-    const key_len = serialize_key(L, 2, key_buffer_start, key_buffer_size) catch {
+    const key_len = serializer.encode_key(L, 2, key_buffer_start, key_buffer_size) catch {
         lua.pushnil(L);
         return 1;
     };
 
+    const key = key_buffer_start[0..key_len];
+    _ = lua.pushlstring(L, key.ptr, key.len);
+    if (push_cached_value(L, table_id)) return 1;
+
+    if (!push_cached_entry(L, &function_cache_ref, table_id)) {
+        if (key_filter.excludes(L, table_id, 2)) {
+            lua.pushnil(L);
+        } else {
+            fetch_value(L, table_id, key);
+            if (lua.isnil(L, -1)) key_filter.note_miss(table_id);
+        }
+    }
+    cache_value(L, table_id);
+    return 1;
+}
+
+// Push the value stored under `key`, or nil
+fn fetch_value(L: *lua.lua_State, table_id: u32, key: []u8) void {
+    const key_buffer_start = key.ptr;
+    const key_len = key.len;
     const value_buffer_start = io_buffer + io_buffer_size / 4;
     const value_buffer_size = io_buffer_size / 4;
 
+    if (ext_store.is_enabled()) {
+        if (ext_store.get(table_id, key)) |value| {
+            // Deserialize from the window, not the entry: loading a value can
+            // run finalizers that write to the store
+            @memcpy(value_buffer_start[0..value.len], value);
+            deserialize_or_nil(L, value_buffer_start, value.len);
+            return;
+        }
+
+        const result = js_ext_table_get(table_id, key_buffer_start, key_len, value_buffer_start, value_buffer_size);
+        if (result > 0) {
+            const value_len: usize = @intCast(result);
+            // A blob handle belongs to the one userdata made from it
+            if (value_buffer_start[0] != blob.BLOB_HANDLE) {
+                _ = ext_store.put(table_id, key, value_buffer_start[0..value_len], .host);
+            }
+            deserialize_or_nil(L, value_buffer_start, value_len);
+        } else if (result < -1) {
+            fetch_large_value(L, table_id, key, result);
+        } else {
+            _ = ext_store.put(table_id, key, &ext_store.NIL_VALUE, .host);
+            lua.pushnil(L);
+        }
+        return;
+    }
+
     const result = js_ext_table_get(table_id, key_buffer_start, key_len, value_buffer_start, value_buffer_size);
     if (result > 0) {
-        serializer.deserialize_value(L, value_buffer_start, @intCast(result)) catch {
-            lua.pushnil(L);
-        };
-        return 1;
+        deserialize_or_nil(L, value_buffer_start, @intCast(result));
+        return;
+    }
+    if (result < -1) {
+        fetch_large_value(L, table_id, key, result);
+        return;
     }
 
     lua.pushnil(L);
-    return 1;
+}
+
+// A host answers -(2 + value_len) when a value does not fit the value
+// window. Read it again into a GC-managed scratch buffer of that size.
+fn fetch_large_value(L: *lua.lua_State, table_id: u32, key: []u8, result: c_int) void {
+    const value_len: usize = @intCast(-(result + 2));
+    if (value_len > serializer.MAX_LARGE_VALUE_BYTES) {
+        lua.pushnil(L);
+        return;
+    }
+
+    const buffer: [*]u8 = @ptrCast(c.lua_newuserdatauv(L, value_len, 0).?);
+    const read = js_ext_table_get(table_id, key.ptr, key.len, buffer, value_len);
+    // A typed array that fills the scratch buffer becomes the array itself
+    if (read > 0 and @as(usize, @intCast(read)) == value_len and buffer[0] == typed_array.TYPED_ARRAY and typed_array.adopt(L)) {
+        perf.counters.ext_get_bytes +%= value_len;
+        return;
+    }
+    if (read > 0) {
+        deserialize_or_nil(L, buffer, @intCast(read));
+    } else {
+        lua.pushnil(L);
+    }
+    // Drop the scratch buffer from under the value
+    c.lua_rotate(L, -2, 1);
+    lua.pop(L, 1);
+}
+
+fn deserialize_or_nil(L: *lua.lua_State, buffer: [*]const u8, len: usize) void {
+    perf.counters.ext_get_bytes +%= len;
+    serializer.deserialize_value(L, buffer, len) catch {
+        lua.pushnil(L);
+    };
 }
 
 fn ext_table_newindex_impl(L: *lua.lua_State) c_int {
@@ -164,26 +448,67 @@ fn ext_table_newindex_impl(L: *lua.lua_State) c_int {
     if (table_id == 0) {
         return 0;
     }
+    perf.counters.ext_sets +%= 1;
 
     const key_buffer_start = io_buffer;
     const key_buffer_size = io_buffer_size / 4;
 
-    const key_len = serialize_key(L, 2, key_buffer_start, key_buffer_size) catch {
+    const key_len = serializer.encode_key(L, 2, key_buffer_start, key_buffer_size) catch {
         return 0;
     };
+    invalidate_cached_value(L, table_id, key_buffer_start[0..key_len]);
+    serializer.forget_conversion(L, table_id);
+    serializer.quota_exceeded = false;
+
+    // t[k] = nil removes k from the host, rather than storing a nil there
+    if (lua.isnil(L, 3)) {
+        ext_store.drop(table_id, key_buffer_start[0..key_len]);
+        _ = js_ext_table_delete(table_id, key_buffer_start, key_len);
+        return 0;
+    }
+    key_filter.add(L, table_id, 2);
 
     const value_buffer_start = io_buffer + io_buffer_size / 4;
     const value_buffer_size = io_buffer_size / 4;
 
-    const value_len = serializer.serialize_value(L, 3, value_buffer_start, value_buffer_size) catch {
+    const value_len = serializer.serialize_value(L, 3, value_buffer_start, value_buffer_size, table_id, key_buffer_start[0..key_len]) catch |err| {
+        if (err != serializer.SerializationError.BufferTooSmall) return raise_if_over_quota(L);
+
+        // Too large for the value window: bypass the native store
+        const key = key_buffer_start[0..key_len];
+        ext_store.drop(table_id, key);
+        serializer.store_large_value(L, table_id, key, 3) catch {
+            _ = raise_if_over_quota(L);
+            return c.luaL_error(L, "external table value too large to store");
+        };
         return 0;
     };
+    perf.counters.ext_set_bytes +%= value_len;
+
+    // A blob handle has to reach the host before the blob can be collected
+    if (value_buffer_start[0] == blob.BLOB_HANDLE) {
+        ext_store.drop(table_id, key_buffer_start[0..key_len]);
+    } else if (ext_store.is_enabled() and ext_store.put(table_id, key_buffer_start[0..key_len], value_buffer_start[0..value_len], .lua)) {
+        return 0;
+    }
 
-    _ = js_ext_table_set(table_id, key_buffer_start, key_len, value_buffer_start, value_len);
+    if (js_ext_table_set(table_id, key_buffer_start, key_len, value_buffer_start, value_len) == serializer.QUOTA_EXCEEDED) {
+        return c.luaL_error(L, QUOTA_MESSAGE);
+    }
 
     return 0;
 }
 
+const QUOTA_MESSAGE = "external table quota exceeded";
+
+// A store that failed raises the quota error if a table quota refused it
+// (a nested table's entries or a large value), and is otherwise dropped
+fn raise_if_over_quota(L: *lua.lua_State) c_int {
+    if (!serializer.quota_exceeded) return 0;
+    serializer.quota_exceeded = false;
+    return c.luaL_error(L, QUOTA_MESSAGE);
+}
+
 fn ext_table_len_impl(L: *lua.lua_State) c_int {
     if (lua.gettop(L) < 1) {
         return 0;
@@ -200,16 +525,750 @@ fn ext_table_len_impl(L: *lua.lua_State) c_int {
         return 0;
     }
 
+    // The host counts keys, so it needs this table's pending writes first
+    ext_store.flush_table(table_id);
     const size = js_ext_table_size(table_id);
     lua.pushinteger(L, @intCast(size));
     return 1;
 }
 
+// pairs() streams entries from the host in batches written by
+// js_ext_table_next into the upper half of the I/O buffer, clear of the key
+// and value windows used by accesses in the loop body. Batch layout
+// (little-endian): u32 next_cursor (0 = scan finished), u32 entry_count, then
+// per entry u32 key_len, key, u32 value_len, serialized value. Each batch is
+// decoded into a Lua table right away, so memory stays bounded by one batch.
+const BATCH_HEADER = 8;
+
+// Upvalues of the iterator closure returned by __pairs
+const SCAN_TABLE_ID = c.LUA_REGISTRYINDEX - 1;
+const SCAN_CURSOR = c.LUA_REGISTRYINDEX - 2; // 0 = not started, -1 = finished
+const SCAN_BATCH = c.LUA_REGISTRYINDEX - 3; // key, value, key, value, ...
+const SCAN_POS = c.LUA_REGISTRYINDEX - 4;
+const SCAN_COUNT = c.LUA_REGISTRYINDEX - 5;
+
+fn ext_table_pairs_impl(L: *lua.lua_State) c_int {
+    var table_id: u32 = 0;
+    _ = lua.getfield(L, 1, "__ext_table_id");
+    if (lua.isnumber(L, -1)) {
+        table_id = @intCast(lua.tointeger(L, -1));
+    }
+    lua.settop(L, -2);
+
+    // The host is the source of truth for a scan
+    ext_store.flush_table(table_id);
+
+    lua.pushinteger(L, table_id);
+    lua.pushinteger(L, if (table_id == 0) -1 else 0);
+    lua.newtable(L);
+    lua.pushinteger(L, 0);
+    lua.pushinteger(L, 0);
+    c.lua_pushcclosure(L, @as(c.lua_CFunction, @ptrCast(&ext_table_scan_next)), 5);
+    lua.pushvalue(L, 1);
+    lua.pushnil(L);
+    return 3;
+}
+
+fn ext_table_scan_next(L: *lua.lua_State) c_int {
+    var pos = lua.tointeger(L, SCAN_POS);
+    var count = lua.tointeger(L, SCAN_COUNT);
+
+    // Entries holding nil (deleted keys) are skipped, so a batch can decode
+    // to nothing while the scan still has more to give
+    while (pos >= count) {
+        if (lua.tointeger(L, SCAN_CURSOR) < 0) return 0;
+        count = fetch_batch(L);
+        pos = 0;
+    }
+
+    _ = c.lua_rawgeti(L, SCAN_BATCH, pos + 1);
+    _ = c.lua_rawgeti(L, SCAN_BATCH, pos + 2);
+    set_upvalue(L, SCAN_POS, pos + 2);
+    return 2;
+}
+
+// Fetch and decode the next batch into SCAN_BATCH; returns 2 * entries kept
+fn fetch_batch(L: *lua.lua_State) c.lua_Integer {
+    const table_id: u32 = @intCast(lua.tointeger(L, SCAN_TABLE_ID));
+    const cursor: u32 = @intCast(lua.tointeger(L, SCAN_CURSOR));
+    const buffer = io_buffer + io_buffer_size / 2;
+    const buffer_size = io_buffer_size / 2;
+
+    const result = js_ext_table_next(table_id, cursor, buffer, buffer_size);
+    var next_cursor: c.lua_Integer = -1;
+    var kept: c.lua_Integer = 0;
+
+    if (result >= BATCH_HEADER) {
+        const bytes = buffer[0..@intCast(result)];
+        const host_cursor = std.mem.readInt(u32, bytes[0..4], .little);
+        if (host_cursor != 0) next_cursor = host_cursor;
+        const entry_count = std.mem.readInt(u32, bytes[4..8], .little);
+
+        var offset: usize = BATCH_HEADER;
+        for (0..entry_count) |_| {
+            const key = read_frame(bytes, &offset) orelse break;
+            const value = read_frame(bytes, &offset) orelse break;
+
+            push_scan_key(L, key);
+            deserialize_or_nil(L, value.ptr, value.len);
+            if (lua.isnil(L, -1)) {
+                lua.pop(L, 2);
+                continue;
+            }
+            c.lua_rawseti(L, SCAN_BATCH, kept + 2);
+            c.lua_rawseti(L, SCAN_BATCH, kept + 1);
+            kept += 2;
+        }
+    }
+
+    set_upvalue(L, SCAN_CURSOR, next_cursor);
+    set_upvalue(L, SCAN_COUNT, kept);
+    return kept;
+}
+
+// ext.range(t, lo, hi, limit) and ext.rrange(t, lo, hi, limit) iterate the
+// entries of t with keys from lo to hi (both included; nil leaves that end
+// open) in key order, numbers before strings, rrange from hi down. The host
+// picks the keys with its ordered index in O(log n + k) and opens a scan
+// over them, which streams in batches exactly like pairs().
+fn ext_range_impl(L: *lua.lua_State) c_int {
+    return range_scan(L, 0);
+}
+
+fn ext_rrange_impl(L: *lua.lua_State) c_int {
+    return range_scan(L, 1);
+}
+
+fn range_scan(L: *lua.lua_State, reverse: u32) c_int {
+    const table_id = ext_table_arg(L, 1);
+    if (table_id == 0) return c.luaL_argerror(L, 1, "external table expected");
+    const limit = c.luaL_optinteger(L, 4, 0);
+    if (limit < 0) return c.luaL_argerror(L, 4, "limit must not be negative");
+
+    ext_store.flush_table(table_id);
+
+    // Bounds go in the key window, one eighth of the I/O buffer each
+    const bound_size = io_buffer_size / 8;
+    const lo_ptr = io_buffer;
+    const hi_ptr = io_buffer + bound_size;
+    const lo_len = range_bound(L, 2, lo_ptr, bound_size) orelse
+        return c.luaL_argerror(L, 2, "key must be nil, a non-empty string or a number");
+    const hi_len = range_bound(L, 3, hi_ptr, bound_size) orelse
+        return c.luaL_argerror(L, 3, "key must be nil, a non-empty string or a number");
+
+    const cursor = js_ext_table_range(table_id, lo_ptr, lo_len, hi_ptr, hi_len, @intCast(@min(limit, std.math.maxInt(u32))), reverse);
+    push_scan_iterator(L, table_id, cursor);
+    return 1;
+}
+
+// ext.index(t, field) has the host index the records of t (the external
+// tables stored under its keys) by their `field`, and keep the index current
+// as t and its records change. ext.lookup(t, field, value) then returns the
+// first key whose record has record[field] == value, and that record;
+// ext.lookupAll(t, field, value, limit) iterates all of them, like
+// ext.range. A lookup on a field never declared indexes it first.
+fn ext_index_impl(L: *lua.lua_State) c_int {
+    const table_id = ext_table_arg(L, 1);
+    if (table_id == 0) return c.luaL_argerror(L, 1, "external table expected");
+    var field_len: usize = 0;
+    const field = c.luaL_checklstring(L, 2, &field_len);
+
+    // Records are other tables, so every pending write goes first
+    ext_store.flush();
+    _ = js_ext_table_index(table_id, @ptrCast(field), field_len);
+    return 0;
+}
+
+fn ext_lookup_impl(L: *lua.lua_State) c_int {
+    const cursor = lookup_scan(L, 1) orelse return 0;
+    push_scan_iterator(L, ext_table_arg(L, 1), cursor);
+    c.lua_callk(L, 0, 2, 0, null);
+    return 2;
+}
+
+fn ext_lookup_all_impl(L: *lua.lua_State) c_int {
+    const limit = c.luaL_optinteger(L, 4, 0);
+    if (limit < 0) return c.luaL_argerror(L, 4, "limit must not be negative");
+    const cursor = lookup_scan(L, @intCast(@min(limit, std.math.maxInt(u32)))) orelse -1;
+    push_scan_iterator(L, ext_table_arg(L, 1), cursor);
+    return 1;
+}
+
+// Open the host scan of a lookup; null if nothing matches
+fn lookup_scan(L: *lua.lua_State, limit: u32) ?c_int {
+    const table_id = ext_table_arg(L, 1);
+    if (table_id == 0) {
+        _ = c.luaL_argerror(L, 1, "external table expected");
+        return null;
+    }
+    var field_len: usize = 0;
+    const field = c.luaL_checklstring(L, 2, &field_len);
+    if (c.lua_type(L, 3) <= c.LUA_TNIL) return null;
+
+    ext_store.flush();
+    const value_len = serializer.encode_key(L, 3, io_buffer, io_buffer_size / 8) catch
+        return null; // neither a string nor a number: never indexed
+    const cursor = js_ext_table_lookup(table_id, @ptrCast(field), field_len, io_buffer, value_len, limit);
+    return if (cursor > 0) cursor else null;
+}
+
+// ext.cache{ max = n, ttl = seconds } creates an external table the host
+// bounds: past max entries it evicts the least recently used one, and an
+// entry expires ttl seconds after it was stored. Either limit is optional.
+fn ext_cache_impl(L: *lua.lua_State) c_int {
+    var max_entries: c.lua_Integer = 0;
+    var ttl: c.lua_Number = 0;
+    if (c.lua_type(L, 1) > c.LUA_TNIL) {
+        c.luaL_checktype(L, 1, c.LUA_TTABLE);
+        _ = lua.getfield(L, 1, "max");
+        max_entries = c.luaL_optinteger(L, -1, 0);
+        _ = lua.getfield(L, 1, "ttl");
+        ttl = c.luaL_optnumber(L, -1, 0);
+        lua.pop(L, 2);
+    }
+    if (max_entries < 0 or max_entries > std.math.maxInt(u32)) return c.luaL_argerror(L, 1, "max must be 0..2^32-1");
+    if (!(ttl >= 0)) return c.luaL_argerror(L, 1, "ttl must not be negative");
+
+    const table_id = create_table(L);
+    if (js_ext_table_cache(table_id, @intCast(max_entries), ttl) < 0) {
+        return c.luaL_error(L, "ext.cache: the host refused the limits");
+    }
+    return 1;
+}
+
+// ext.transaction(fn, ...) calls fn(...) and returns its results, with
+// its external table writes applied as a whole or not at all: if fn raises,
+// the host puts back every entry it changed (js_ext_transaction keeps an
+// undo log) and the error is raised again. Transactions nest; an inner one
+// that fails undoes only its own writes. Native store entries are spilled
+// before fn runs, so its pending writes are all its own.
+const TXN_BEGIN = 0;
+const TXN_COMMIT = 1;
+const TXN_ROLLBACK = 2;
+
+fn ext_transaction_impl(L: *lua.lua_State) c_int {
+    c.luaL_checktype(L, 1, c.LUA_TFUNCTION);
+    ext_store.flush();
+    if (js_ext_transaction(TXN_BEGIN) != 0) {
+        return c.luaL_error(L, "ext.transaction: not supported by this host");
+    }
+
+    if (lua.pcall(L, lua.gettop(L) - 1, c.LUA_MULTRET) == c.LUA_OK) {
+        ext_store.flush();
+        _ = js_ext_transaction(TXN_COMMIT);
+        return lua.gettop(L);
+    }
+
+    // The writes still pending natively are dropped with the rest
+    ext_store.invalidate(0);
+    _ = js_ext_transaction(TXN_ROLLBACK);
+    // The host tables went back: drop what this side knew of them
+    reset_value_cache(L);
+    invalidate_functions(L, 0);
+    serializer.forget_conversion(L, 0);
+    key_filter.forget(0);
+    return c.lua_error(L);
+}
+
+// ext.columns(schema) creates a columnar external table for records of the
+// numeric fields in schema, { field = "f64" | "i64", ... }: the host keeps a
+// packed column per field and materializes t[i] as a row when it is read
+// (see web/cu-ext-column.js). ext.append(t, row) stores row by value at
+// #t + 1 of any external table, without making an external table of it.
+// ext.column(t, field, i, j) reads rows i..j (default all) of a column as
+// one vec, which the host writes straight into the vec's memory.
+fn ext_columns_impl(L: *lua.lua_State) c_int {
+    c.luaL_checktype(L, 1, c.LUA_TTABLE);
+
+    // One "field:kind" line per field
+    const window = io_buffer_size / 4;
+    var len: usize = 0;
+    lua.pushnil(L);
+    while (c.lua_next(L, 1) != 0) {
+        if (c.lua_type(L, -2) != c.LUA_TSTRING or c.lua_type(L, -1) != c.LUA_TSTRING) {
+            return c.luaL_argerror(L, 1, "schema maps field names to \"f64\" or \"i64\"");
+        }
+        var name_len: usize = 0;
+        var kind_len: usize = 0;
+        const name = c.lua_tolstring(L, -2, &name_len);
+        const kind = c.lua_tolstring(L, -1, &kind_len);
+        if (len + name_len + kind_len + 2 > window) return c.luaL_argerror(L, 1, "schema too large");
+        @memcpy(io_buffer[len..][0..name_len], name[0..name_len]);
+        io_buffer[len + name_len] = ':';
+        @memcpy(io_buffer[len + name_len + 1 ..][0..kind_len], kind[0..kind_len]);
+        io_buffer[len + name_len + 1 + kind_len] = '\n';
+        len += name_len + kind_len + 2;
+        lua.pop(L, 1);
+    }
+
+    const table_id = create_table(L);
+    if (js_ext_table_columns(table_id, io_buffer, len) < 0) {
+        return c.luaL_error(L, "ext.columns: invalid schema, or columnar tables are not supported by this host");
+    }
+    return 1;
+}
+
+fn ext_column_impl(L: *lua.lua_State) c_int {
+    const table_id = ext_table_arg(L, 1);
+    if (table_id == 0) return c.luaL_argerror(L, 1, "external table expected");
+    var field_len: usize = 0;
+    const field = c.luaL_checklstring(L, 2, &field_len);
+    const first = c.luaL_optinteger(L, 3, 1);
+    if (first < 1) return c.luaL_argerror(L, 3, "row must be positive");
+    // No end reads to the last row (maxInt); an end before the start, nothing
+    const last: c.lua_Integer = if (c.lua_type(L, 4) <= c.LUA_TNIL) std.math.maxInt(u32) else @max(c.luaL_checkinteger(L, 4), 0);
+    const first_row: u32 = @intCast(@min(first, std.math.maxInt(u32)));
+    const last_row: u32 = @intCast(@min(last, std.math.maxInt(u32)));
+
+    ext_store.flush_table(table_id);
+    const needed = js_ext_table_column(table_id, @ptrCast(field), field_len, first_row, last_row, io_buffer, 0);
+    if (needed < typed_array.HEADER_LEN) {
+        return c.luaL_error(L, "ext.column: no column '%s' in this table", field);
+    }
+    const len: usize = @intCast(needed);
+    const data: [*]u8 = @ptrCast(c.lua_newuserdatauv(L, len, 0).?);
+    if (js_ext_table_column(table_id, @ptrCast(field), field_len, first_row, last_row, data, len) != needed or !typed_array.adopt(L)) {
+        return c.luaL_error(L, "ext.column: the host did not write the column");
+    }
+    return 1;
+}
+
+fn ext_append_impl(L: *lua.lua_State) c_int {
+    const table_id = ext_table_arg(L, 1);
+    if (table_id == 0) return c.luaL_argerror(L, 1, "external table expected");
+    c.luaL_checktype(L, 2, c.LUA_TTABLE);
+
+    // The row as an inline table of numbers under string keys, in the value
+    // window; the key window takes #t + 1
+    const key_buffer = io_buffer;
+    const key_window = io_buffer_size / 4;
+    const value_buffer = io_buffer + key_window;
+    const value_window = io_buffer_size / 4;
+
+    var count: usize = 0;
+    lua.pushnil(L);
+    while (c.lua_next(L, 2) != 0) {
+        if (c.lua_type(L, -2) != c.LUA_TSTRING or c.lua_type(L, -1) != c.LUA_TNUMBER) {
+            return c.luaL_argerror(L, 2, "row fields must be numbers under string keys");
+        }
+        count += 1;
+        lua.pop(L, 1);
+    }
+
+    var offset = serializer.write_inline_table_header(value_buffer, value_window, count) catch
+        return c.luaL_argerror(L, 2, "row too large");
+    lua.pushnil(L);
+    while (c.lua_next(L, 2) != 0) {
+        var name_len: usize = 0;
+        const name = c.lua_tolstring(L, -2, &name_len);
+        offset += serializer.write_string(value_buffer + offset, value_window - offset, name[0..name_len]) catch
+            return c.luaL_argerror(L, 2, "row too large");
+        offset += serializer.write_number(L, -1, value_buffer + offset, value_window - offset) catch
+            return c.luaL_argerror(L, 2, "row too large");
+        lua.pop(L, 1);
+    }
+
+    ext_store.flush_table(table_id);
+    lua.pushinteger(L, @intCast(js_ext_table_size(table_id) + 1));
+    const key_len = serializer.encode_key(L, -1, key_buffer, key_window) catch
+        return c.luaL_error(L, "ext.append: table too large");
+    key_filter.add(L, table_id, -1);
+    lua.pop(L, 1);
+    invalidate_cached_value(L, table_id, key_buffer[0..key_len]);
+    ext_store.drop(table_id, key_buffer[0..key_len]);
+    const result = js_ext_table_set(table_id, key_buffer, key_len, value_buffer, offset);
+    if (result == serializer.QUOTA_EXCEEDED) return c.luaL_error(L, QUOTA_MESSAGE);
+    if (result < 0) {
+        return c.luaL_error(L, "ext.append: the host refused the row");
+    }
+    return 0;
+}
+
+// ext.array() creates an external table the host keeps as a sequence:
+// values at 1..n with no holes (see web/cu-ext-array.js), so #t is its
+// true length. ext.push(t, v) appends v and returns the new length,
+// ext.pop(t) removes and returns the last value, and ext.slice(t, i, j)
+// reads values i..j (default 1..#t) into a Lua array. Each is one host
+// call, where t[#t + 1] = v takes two.
+fn ext_array_impl(L: *lua.lua_State) c_int {
+    if (js_ext_table_array(create_table(L)) < 0) {
+        return c.luaL_error(L, "ext.array: not supported by this host");
+    }
+    return 1;
+}
+
+fn ext_push_impl(L: *lua.lua_State) c_int {
+    const table_id = ext_table_arg(L, 1);
+    if (table_id == 0) return c.luaL_argerror(L, 1, "external table expected");
+    if (c.lua_type(L, 2) <= c.LUA_TNIL) return c.luaL_argerror(L, 2, "value expected");
+    lua.settop(L, 2);
+    perf.counters.ext_sets +%= 1;
+
+    // The host appends after this table's pending writes
+    ext_store.flush_table(table_id);
+    serializer.forget_conversion(L, table_id);
+    serializer.quota_exceeded = false;
+
+    const value_buffer = io_buffer + io_buffer_size / 4;
+    const value_window = io_buffer_size / 4;
+    const value_len = serializer.serialize_value(L, 2, value_buffer, value_window, 0, &.{}) catch |err| {
+        if (err != serializer.SerializationError.BufferTooSmall) return c.luaL_argerror(L, 2, "value cannot be stored");
+
+        // Too large for the value window: store it at #t + 1 in parts
+        const length: c.lua_Integer = @intCast(js_ext_table_size(table_id) + 1);
+        lua.pushinteger(L, length);
+        const key_len = serializer.encode_key(L, -1, io_buffer, io_buffer_size / 4) catch unreachable;
+        serializer.store_large_value(L, table_id, io_buffer[0..key_len], 2) catch {
+            _ = raise_if_over_quota(L);
+            return c.luaL_error(L, "ext.push: value too large to store");
+        };
+        forget_index(L, table_id, length, true);
+        return 1;
+    };
+    perf.counters.ext_set_bytes +%= value_len;
+
+    const length = js_ext_table_push(table_id, value_buffer, value_len);
+    if (length == serializer.QUOTA_EXCEEDED) return c.luaL_error(L, QUOTA_MESSAGE);
+    if (length < 1) return c.luaL_error(L, "ext.push: not an array table");
+    forget_index(L, table_id, length, true);
+    lua.pushinteger(L, length);
+    return 1;
+}
+
+// js_ext_table_pop writes u32 the index it removed, then the value
+fn ext_pop_impl(L: *lua.lua_State) c_int {
+    const table_id = ext_table_arg(L, 1);
+    if (table_id == 0) return c.luaL_argerror(L, 1, "external table expected");
+    perf.counters.ext_sets +%= 1;
+
+    ext_store.flush_table(table_id);
+    serializer.forget_conversion(L, table_id);
+
+    var out = io_buffer + io_buffer_size / 4;
+    var result = js_ext_table_pop(table_id, out, io_buffer_size / 4);
+    if (result < -1) {
+        // -(2 + len): too large for the value window, and still in the
+        // table. Pop it again into a GC-managed scratch buffer.
+        const len: usize = @intCast(-(result + 2));
+        if (len > serializer.MAX_LARGE_VALUE_BYTES + 4) return c.luaL_error(L, "ext.pop: value too large");
+        out = @ptrCast(c.lua_newuserdatauv(L, len, 0).?);
+        result = js_ext_table_pop(table_id, out, len);
+    }
+    if (result < 0) return c.luaL_error(L, "ext.pop: not an array table");
+    if (result < 4) {
+        lua.pushnil(L);
+        return 1;
+    }
+
+    const index = std.mem.readInt(u32, out[0..4], .little);
+    deserialize_or_nil(L, out + 4, @as(usize, @intCast(result)) - 4);
+    forget_index(L, table_id, index, false);
+    return 1;
+}
+
+// js_ext_table_slice answers into the upper half of the I/O buffer in the
+// layout of js_ext_table_get_many: u32 answered, then per value an i32
+// value_len and the value. A value too large for one answer comes back
+// as -1 and is read on its own; an answer of none ends the slice.
+fn ext_slice_impl(L: *lua.lua_State) c_int {
+    const table_id = ext_table_arg(L, 1);
+    if (table_id == 0) return c.luaL_argerror(L, 1, "external table expected");
+    const first = c.luaL_optinteger(L, 2, 1);
+    if (first < 1) return c.luaL_argerror(L, 2, "index must be positive");
+    // No end reads to the last value (maxInt); an end before the start, nothing
+    const last: c.lua_Integer = if (c.lua_type(L, 3) <= c.LUA_TNIL) std.math.maxInt(u32) else @min(@max(c.luaL_checkinteger(L, 3), 0), std.math.maxInt(u32));
+
+    ext_store.flush_table(table_id);
+    lua.newtable(L);
+    const result_index = lua.gettop(L);
+    const out_buffer = io_buffer + io_buffer_size / 2;
+    const out_size = io_buffer_size / 2;
+
+    var next = first;
+    var count: c.lua_Integer = 0;
+    scan: while (next <= last) {
+        const result = js_ext_table_slice(table_id, @intCast(next), @intCast(last), out_buffer, out_size);
+        if (result < 0) return c.luaL_error(L, "ext.slice: not an array table");
+        const out = out_buffer[0..@intCast(result)];
+        if (out.len < 4) break :scan;
+        const answered = std.mem.readInt(u32, out[0..4], .little);
+        if (answered == 0) break :scan;
+
+        var offset: usize = 4;
+        for (0..answered) |_| {
+            if (out.len - offset < 4) break :scan;
+            const value_len = std.mem.readInt(i32, out[offset..][0..4], .little);
+            offset += 4;
+            if (value_len < 0) {
+                lua.pushinteger(L, next);
+                const key_len = serializer.encode_key(L, -1, io_buffer, io_buffer_size / 4) catch unreachable;
+                lua.pop(L, 1);
+                fetch_value(L, table_id, io_buffer[0..key_len]);
+            } else {
+                const len: usize = @intCast(value_len);
+                if (out.len - offset < len) break :scan;
+                deserialize_or_nil(L, out.ptr + offset, len);
+                offset += len;
+            }
+            count += 1;
+            c.lua_rawseti(L, result_index, count);
+            next += 1;
+        }
+    }
+    return 1;
+}
+
+// Drop what this side knows of t[index] after the host changed it; an
+// added index goes into the negative-lookup filter
+fn forget_index(L: *lua.lua_State, table_id: u32, index: c.lua_Integer, added: bool) void {
+    lua.pushinteger(L, index);
+    const key_len = serializer.encode_key(L, -1, io_buffer, io_buffer_size / 4) catch unreachable;
+    if (added) key_filter.add(L, table_id, -1);
+    lua.pop(L, 1);
+    invalidate_cached_value(L, table_id, io_buffer[0..key_len]);
+    ext_store.drop(table_id, io_buffer[0..key_len]);
+}
+
+// The external table ID of the argument at `index`, 0 if it is not one
+fn ext_table_arg(L: *lua.lua_State, index: c_int) u32 {
+    var table_id: u32 = 0;
+    if (lua.istable(L, index)) {
+        _ = lua.getfield(L, index, "__ext_table_id");
+        if (lua.isnumber(L, -1)) table_id = @intCast(lua.tointeger(L, -1));
+        lua.pop(L, 1);
+    }
+    return table_id;
+}
+
+// Push the iterator over a host scan opened at `cursor` (<= 0: empty)
+fn push_scan_iterator(L: *lua.lua_State, table_id: u32, cursor: c_int) void {
+    lua.pushinteger(L, table_id);
+    lua.pushinteger(L, if (cursor > 0) cursor else -1);
+    lua.newtable(L);
+    lua.pushinteger(L, 0);
+    lua.pushinteger(L, 0);
+    c.lua_pushcclosure(L, @as(c.lua_CFunction, @ptrCast(&ext_table_scan_next)), 5);
+}
+
+// The encoded key at `index`, 0 bytes for nil (an open end)
+fn range_bound(L: *lua.lua_State, index: c_int, buffer: [*]u8, max_len: usize) ?usize {
+    if (c.lua_type(L, index) <= c.LUA_TNIL) return 0;
+    return serializer.encode_key(L, index, buffer, max_len) catch null;
+}
+
+fn set_upvalue(L: *lua.lua_State, index: c_int, value: c.lua_Integer) void {
+    lua.pushinteger(L, value);
+    c.lua_copy(L, -1, index);
+    lua.pop(L, 1);
+}
+
+fn read_frame(bytes: []const u8, offset: *usize) ?[]const u8 {
+    if (bytes.len - offset.* < 4) return null;
+    const len = std.mem.readInt(u32, bytes[offset.*..][0..4], .little);
+    offset.* += 4;
+    if (bytes.len - offset.* < len) return null;
+    const frame = bytes[offset.*..][0..len];
+    offset.* += len;
+    return frame;
+}
+
+// Scan keys come back in the form serializer.encode_key wrote them. Plain
+// string keys may be integers in decimal form, so canonical decimal integers
+// are handed back as integers.
+fn push_scan_key(L: *lua.lua_State, key: []const u8) void {
+    if (serializer.keys_are_tagged()) {
+        if (key.len == 9 and key[0] == serializer.KEY_TAG_INTEGER) {
+            lua.pushinteger(L, std.mem.readInt(i64, key[1..9], .little));
+        } else if (key.len > 1 and key[0] == serializer.KEY_TAG_STRING) {
+            _ = lua.pushlstring(L, key.ptr + 1, key.len - 1);
+        } else {
+            _ = lua.pushlstring(L, key.ptr, key.len);
+        }
+        return;
+    }
+    if (std.fmt.parseInt(c.lua_Integer, key, 10)) |int_key| {
+        var buf: [32]u8 = undefined;
+        const canonical = std.fmt.bufPrint(&buf, "{d}", .{int_key}) catch unreachable;
+        if (std.mem.eql(u8, canonical, key)) {
+            lua.pushinteger(L, int_key);
+            return;
+        }
+    } else |_| {}
+    _ = lua.pushlstring(L, key.ptr, key.len);
+}
+
+// ext.getMany(t, keys) fetches several keys of an external table in as few
+// host calls as possible. Keys are packed (u32 key_len, key) into the key
+// window; js_ext_table_get_many answers into the upper half of the I/O buffer
+// with u32 answered, then per answered key an i32 value_len (-1 = missing)
+// and the serialized value. The host answers at least one key per call unless
+// it fails, and stops early when the output is full.
+fn ext_get_many_impl(L: *lua.lua_State) c_int {
+    const table_id = ext_table_arg(L, 1);
+    if (table_id == 0) return c.luaL_argerror(L, 1, "external table expected");
+    c.luaL_checktype(L, 2, c.LUA_TTABLE);
+
+    lua.newtable(L);
+    _ = get_many(L, table_id, 2, lua.gettop(L), "ext.getMany");
+    return 1;
+}
+
+// ext.prefetch(t, keys) reads keys the same way into this invocation's
+// value cache (and the native store, when enabled), so the reads that
+// follow do not cross into the host. Returns how many of the keys exist.
+fn ext_prefetch_impl(L: *lua.lua_State) c_int {
+    const table_id = ext_table_arg(L, 1);
+    if (table_id == 0) return c.luaL_argerror(L, 1, "external table expected");
+    c.luaL_checktype(L, 2, c.LUA_TTABLE);
+
+    lua.pushinteger(L, @intCast(prefetch_keys(L, table_id, 2)));
+    return 1;
+}
+
+/// Read the keys in the array at `keys_index` from `table_id` into the
+/// value cache; returns how many exist
+pub fn prefetch_keys(L: *lua.lua_State, table_id: u32, keys_index: c_int) usize {
+    return get_many(L, table_id, c.lua_absindex(L, keys_index), 0, "ext.prefetch");
+}
+
+// Fetch the keys in the array at `keys_index` and store each value found in
+// the table at `result_index`, or in the value cache for 0. Returns the
+// number found.
+fn get_many(L: *lua.lua_State, table_id: u32, keys_index: c_int, result_index: c_int, name: [*:0]const u8) usize {
+    // The host answers, so it needs this table's pending writes first
+    ext_store.flush_table(table_id);
+
+    const key_count: c.lua_Integer = @intCast(c.lua_rawlen(L, keys_index));
+    const keys_buffer = io_buffer;
+    const keys_size = io_buffer_size / 4;
+    const out_buffer = io_buffer + io_buffer_size / 2;
+    const out_size = io_buffer_size / 2;
+    var found: usize = 0;
+
+    var next: c.lua_Integer = 1;
+    while (next <= key_count) {
+        var packed_len: usize = 0;
+        var packed_count: c.lua_Integer = 0;
+        while (next + packed_count <= key_count) {
+            _ = c.lua_rawgeti(L, keys_index, next + packed_count);
+            const room = keys_size - packed_len;
+            const key_len: serializer.SerializationError!usize = if (room > 4)
+                serializer.encode_key(L, -1, keys_buffer + packed_len + 4, room - 4)
+            else
+                error.BufferTooSmall;
+            lua.pop(L, 1);
+            const len = key_len catch |err| {
+                if (err == serializer.SerializationError.BufferTooSmall and packed_count > 0) break;
+                _ = c.luaL_error(L, "%s: key %I must be a non-empty string or a number", name, next + packed_count);
+                unreachable;
+            };
+            std.mem.writeInt(u32, keys_buffer[packed_len..][0..4], @intCast(len), .little);
+            packed_len += 4 + len;
+            packed_count += 1;
+        }
+
+        const result = js_ext_table_get_many(table_id, keys_buffer, packed_len, out_buffer, out_size);
+        const out = if (result >= 4) out_buffer[0..@intCast(result)] else out_buffer[0..0];
+        var answered: c.lua_Integer = if (out.len >= 4) @intCast(@min(std.mem.readInt(u32, out[0..4], .little), @as(i64, packed_count))) else 0;
+
+        var offset: usize = 4;
+        var key_offset: usize = 0;
+        var i: c.lua_Integer = 0;
+        while (i < answered) : (i += 1) {
+            if (out.len - offset < 4) break;
+            const value_len = std.mem.readInt(i32, out[offset..][0..4], .little);
+            offset += 4;
+            const key_len = std.mem.readInt(u32, keys_buffer[key_offset..][0..4], .little);
+            const key = keys_buffer[key_offset + 4 ..][0..key_len];
+            key_offset += 4 + key_len;
+            if (value_len < 0) {
+                if (result_index == 0 and ext_store.is_enabled()) _ = ext_store.put(table_id, key, &ext_store.NIL_VALUE, .host);
+                continue;
+            }
+            const len: usize = @intCast(value_len);
+            if (out.len - offset < len) break;
+            const value = out[offset..][0..len];
+            offset += len;
+            found += 1;
+
+            if (result_index != 0) {
+                _ = c.lua_rawgeti(L, keys_index, next + i);
+                deserialize_or_nil(L, value.ptr, len);
+                c.lua_rawset(L, result_index);
+                continue;
+            }
+            // A blob handle belongs to the one userdata made from it
+            if (ext_store.is_enabled() and value[0] != blob.BLOB_HANDLE) _ = ext_store.put(table_id, key, value, .host);
+            _ = lua.pushlstring(L, key.ptr, key.len);
+            deserialize_or_nil(L, value.ptr, len);
+            cache_value(L, table_id);
+            lua.pop(L, 2);
+        }
+
+        // A failed or empty answer leaves the remaining keys nil; always move on
+        if (answered == 0) answered = packed_count;
+        next += answered;
+    }
+
+    return found;
+}
+
 pub fn setup_ext_table_library(L: *lua.lua_State) void {
     lua.newtable(L);
 
     lua.pushcfunction(L, @as(c.lua_CFunction, @ptrCast(&ext_table_new_impl)));
     lua.setfield(L, -2, "table");
 
+    lua.pushcfunction(L, @as(c.lua_CFunction, @ptrCast(&ext_get_many_impl)));
+    lua.setfield(L, -2, "getMany");
+
+    lua.pushcfunction(L, @as(c.lua_CFunction, @ptrCast(&ext_prefetch_impl)));
+    lua.setfield(L, -2, "prefetch");
+
+    lua.pushcfunction(L, @as(c.lua_CFunction, @ptrCast(&ext_table_ordered_impl)));
+    lua.setfield(L, -2, "ordered");
+
+    lua.pushcfunction(L, @as(c.lua_CFunction, @ptrCast(&ext_range_impl)));
+    lua.setfield(L, -2, "range");
+
+    lua.pushcfunction(L, @as(c.lua_CFunction, @ptrCast(&ext_rrange_impl)));
+    lua.setfield(L, -2, "rrange");
+
+    lua.pushcfunction(L, @as(c.lua_CFunction, @ptrCast(&ext_index_impl)));
+    lua.setfield(L, -2, "index");
+
+    lua.pushcfunction(L, @as(c.lua_CFunction, @ptrCast(&ext_cache_impl)));
+    lua.setfield(L, -2, "cache");
+
+    lua.pushcfunction(L, @as(c.lua_CFunction, @ptrCast(&ext_transaction_impl)));
+    lua.setfield(L, -2, "transaction");
+
+    lua.pushcfunction(L, @as(c.lua_CFunction, @ptrCast(&ext_columns_impl)));
+    lua.setfield(L, -2, "columns");
+
+    lua.pushcfunction(L, @as(c.lua_CFunction, @ptrCast(&ext_column_impl)));
+    lua.setfield(L, -2, "column");
+
+    lua.pushcfunction(L, @as(c.lua_CFunction, @ptrCast(&ext_append_impl)));
+    lua.setfield(L, -2, "append");
+
+    lua.pushcfunction(L, @as(c.lua_CFunction, @ptrCast(&ext_array_impl)));
+    lua.setfield(L, -2, "array");
+
+    lua.pushcfunction(L, @as(c.lua_CFunction, @ptrCast(&ext_push_impl)));
+    lua.setfield(L, -2, "push");
+
+    lua.pushcfunction(L, @as(c.lua_CFunction, @ptrCast(&ext_pop_impl)));
+    lua.setfield(L, -2, "pop");
+
+    lua.pushcfunction(L, @as(c.lua_CFunction, @ptrCast(&ext_slice_impl)));
+    lua.setfield(L, -2, "slice");
+
+    lua.pushcfunction(L, @as(c.lua_CFunction, @ptrCast(&ext_lookup_impl)));
+    lua.setfield(L, -2, "lookup");
+
+    lua.pushcfunction(L, @as(c.lua_CFunction, @ptrCast(&ext_lookup_all_impl)));
+    lua.setfield(L, -2, "lookupAll");
+
     lua.setglobal(L, "ext");
 }
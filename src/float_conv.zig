@@ -0,0 +1,581 @@
+// Conversions between doubles and text for libc-stubs.zig: strtod, the
+// floating-point conversions of snprintf, and lua_number2str (tostring).
+//
+// - parse matches the C strtod grammar (decimal, hex, inf, nan) and hands
+//   the numeral to std.fmt.parseFloat, which is correctly rounded
+//   (Eisel-Lemire, with a big-decimal fallback for the rare hard cases).
+// - shortest prints the fewest digits that parse back to the same double,
+//   using std.fmt's Ryu-based formatter.
+// - format implements %e, %f, %g and %a with a precision. Decimal digits
+//   come from the exact binary expansion of the double, held in a small
+//   fixed-size big integer, and are rounded half-to-even as glibc does.
+//
+// This file is imported by libc-stubs.zig and must stay free of exports.
+
+const std = @import("std");
+
+/// Largest precision format honours; larger requests are clamped
+pub const MAX_PRECISION: usize = 400;
+
+/// Room for any result of format at MAX_PRECISION ("%f" of 1e308 has 309
+/// integer digits)
+pub const FORMAT_BUFFER_SIZE: usize = MAX_PRECISION + 330;
+
+/// Room for any result of shortest ("-2.2250738585072014e-308")
+pub const SHORTEST_BUFFER_SIZE: usize = 32;
+
+// ============================================================================
+// Parsing
+// ============================================================================
+
+pub const Parsed = struct {
+    value: f64,
+    /// Bytes consumed, leading whitespace included; 0 if nothing converted
+    len: usize,
+};
+
+fn is_space(c: u8) bool {
+    return c == ' ' or (c >= '\t' and c <= '\r');
+}
+
+fn is_digit(c: u8) bool {
+    return c >= '0' and c <= '9';
+}
+
+fn is_hex_digit(c: u8) bool {
+    return is_digit(c) or ((c | 0x20) >= 'a' and (c | 0x20) <= 'f');
+}
+
+/// Case-insensitive match of `word` at the start of `s`
+fn starts_with_word(s: [*:0]const u8, word: []const u8) bool {
+    for (word, 0..) |c, i| {
+        if ((s[i] | 0x20) != c) return false;
+    }
+    return true;
+}
+
+/// Convert the longest prefix of `s` that strtod accepts
+pub fn parse(s: [*:0]const u8) Parsed {
+    var i: usize = 0;
+    while (is_space(s[i])) i += 1;
+
+    var negative = false;
+    if (s[i] == '+' or s[i] == '-') {
+        negative = s[i] == '-';
+        i += 1;
+    }
+
+    if (starts_with_word(s + i, "inf")) {
+        const len: usize = if (starts_with_word(s + i, "infinity")) 8 else 3;
+        const inf = std.math.inf(f64);
+        return .{ .value = if (negative) -inf else inf, .len = i + len };
+    }
+    if (starts_with_word(s + i, "nan")) {
+        var end = i + 3;
+        // nan(n-char-sequence)
+        if (s[end] == '(') {
+            var j = end + 1;
+            while (is_digit(s[j]) or ((s[j] | 0x20) >= 'a' and (s[j] | 0x20) <= 'z') or s[j] == '_') j += 1;
+            if (s[j] == ')') end = j + 1;
+        }
+        const nan = std.math.nan(f64);
+        return .{ .value = if (negative) -nan else nan, .len = end };
+    }
+
+    const start = i;
+    const hex = s[i] == '0' and (s[i + 1] | 0x20) == 'x' and
+        (is_hex_digit(s[i + 2]) or (s[i + 2] == '.' and is_hex_digit(s[i + 3])));
+    const digit_test: *const fn (u8) bool = if (hex) &is_hex_digit else &is_digit;
+    if (hex) i += 2;
+
+    var digits: usize = 0;
+    while (digit_test(s[i])) : (i += 1) digits += 1;
+    if (s[i] == '.') {
+        var j = i + 1;
+        while (digit_test(s[j])) : (j += 1) digits += 1;
+        if (digits > 0) i = j;
+    }
+    if (digits == 0) return .{ .value = 0, .len = 0 };
+
+    // The exponent only counts when at least one digit follows it
+    const marker: u8 = if (hex) 'p' else 'e';
+    if ((s[i] | 0x20) == marker) {
+        var j = i + 1;
+        if (s[j] == '+' or s[j] == '-') j += 1;
+        if (is_digit(s[j])) {
+            while (is_digit(s[j])) j += 1;
+            i = j;
+        }
+    }
+
+    // The numeral is well formed by now, so parseFloat only fails on
+    // inputs it cannot represent, which it reports as inf or 0 anyway
+    const magnitude = std.fmt.parseFloat(f64, s[start..i]) catch 0;
+    return .{ .value = if (negative) -magnitude else magnitude, .len = i };
+}
+
+// ============================================================================
+// Shortest round-trip text
+// ============================================================================
+
+/// Fewest digits that read back as `x`, laid out like "%.17g": positional
+/// for exponents -4..16, "d.ddde+XX" otherwise
+pub fn shortest(buf: *[SHORTEST_BUFFER_SIZE]u8, x: f64) []const u8 {
+    var out = Output{ .buf = buf };
+    if (std.math.signbit(x)) out.byte('-');
+    const magnitude = @abs(x);
+
+    if (std.math.isNan(x)) {
+        out.text("nan");
+    } else if (std.math.isInf(x)) {
+        out.text("inf");
+    } else if (magnitude == 0) {
+        out.byte('0');
+    } else {
+        // Ryu gives "d.dddde[-]x" with no trailing zeros
+        var sci_buf: [SHORTEST_BUFFER_SIZE]u8 = undefined;
+        const sci = std.fmt.bufPrint(&sci_buf, "{e}", .{magnitude}) catch unreachable;
+        const e_at = std.mem.indexOfScalar(u8, sci, 'e').?;
+
+        var digits_buf: [20]u8 = undefined;
+        var n: usize = 0;
+        for (sci[0..e_at]) |c| {
+            if (c == '.') continue;
+            digits_buf[n] = c;
+            n += 1;
+        }
+        const exp10 = std.fmt.parseInt(i32, sci[e_at + 1 ..], 10) catch unreachable;
+        const digits = Digits{ .buf = digits_buf[0..n], .point = exp10 + 1 };
+
+        if (exp10 >= -4 and exp10 < 17) {
+            const frac_len = @max(@as(i32, @intCast(n)) - digits.point, 0);
+            write_positional(&out, digits, @intCast(frac_len), false);
+        } else {
+            write_exponential(&out, digits, n - 1, false, false);
+        }
+    }
+    return out.slice();
+}
+
+// ============================================================================
+// printf conversions
+// ============================================================================
+
+pub const Conversion = struct {
+    /// One of e E f F g G a A
+    conv: u8,
+    precision: ?usize = null,
+    /// The '#' flag: keep the decimal point (and %g's trailing zeros)
+    alt: bool = false,
+};
+
+/// Text of `magnitude` (a non-negative double, or nan) for one printf
+/// conversion, without sign or padding
+pub fn format(buf: *[FORMAT_BUFFER_SIZE]u8, magnitude: f64, spec: Conversion) []const u8 {
+    var out = Output{ .buf = buf };
+    const upper = spec.conv >= 'A' and spec.conv <= 'Z';
+    const conv = spec.conv | 0x20;
+
+    if (std.math.isNan(magnitude) or std.math.isInf(magnitude)) {
+        const word = if (std.math.isNan(magnitude)) "nan" else "inf";
+        for (word) |c| out.byte(if (upper) c - 32 else c);
+        return out.slice();
+    }
+
+    if (conv == 'a') {
+        write_hex(&out, magnitude, spec.precision, spec.alt, upper);
+        return out.slice();
+    }
+
+    const precision = @min(spec.precision orelse 6, MAX_PRECISION);
+    var digit_buf: [FORMAT_BUFFER_SIZE]u8 = undefined;
+    switch (conv) {
+        'f' => write_positional(&out, fixed_digits(&digit_buf, magnitude, precision), precision, spec.alt),
+        'e' => write_exponential(&out, significant_digits(&digit_buf, magnitude, precision + 1), precision, spec.alt, upper),
+        else => {
+            // %g: precision counts significant digits; pick the layout from
+            // the exponent after rounding to that many
+            const p = @max(precision, 1);
+            const digits = significant_digits(&digit_buf, magnitude, p);
+            const exp10 = digits.point - 1;
+            const start = out.len;
+            if (exp10 >= -4 and exp10 < @as(i32, @intCast(p))) {
+                write_positional(&out, digits, @intCast(@as(i32, @intCast(p)) - digits.point), spec.alt);
+            } else {
+                write_exponential(&out, digits, p - 1, spec.alt, upper);
+            }
+            if (!spec.alt) strip_trailing_zeros(&out, start);
+        },
+    }
+    return out.slice();
+}
+
+// %g without '#': drop trailing zeros of the fraction, then a bare point
+fn strip_trailing_zeros(out: *Output, start: usize) void {
+    const text = out.buf[start..out.len];
+    const point = std.mem.indexOfScalar(u8, text, '.') orelse return;
+    const exp_at = std.mem.indexOfAny(u8, text, "eE") orelse text.len;
+    var end = exp_at;
+    while (end > point + 1 and text[end - 1] == '0') end -= 1;
+    if (end == point + 1) end = point;
+    if (end == exp_at) return;
+    const tail_len = text.len - exp_at;
+    std.mem.copyForwards(u8, out.buf[start + end ..], text[exp_at..]);
+    out.len = start + end + tail_len;
+}
+
+fn write_hex(out: *Output, magnitude: f64, precision: ?usize, alt: bool, upper: bool) void {
+    const hex_digits = if (upper) "0123456789ABCDEF" else "0123456789abcdef";
+    const bits: u64 = @bitCast(magnitude);
+    const biased: i32 = @intCast(bits >> 52);
+    var mantissa: u64 = bits & ((1 << 52) - 1);
+    var lead: u64 = if (biased == 0) 0 else 1;
+    const exp2: i32 = if (biased == 0) (if (mantissa == 0) 0 else -1022) else biased - 1023;
+
+    // 52 fraction bits are 13 hex digits
+    var count: usize = 13;
+    if (precision) |p| {
+        if (p < 13) {
+            const shift: u6 = @intCast(4 * (13 - p));
+            const rest = mantissa & ((@as(u64, 1) << shift) - 1);
+            const half = @as(u64, 1) << (shift - 1);
+            mantissa >>= shift;
+            // With no digits left, the tie goes by the leading digit
+            const odd = if (p == 0) lead & 1 == 1 else mantissa & 1 == 1;
+            if (rest > half or (rest == half and odd)) mantissa += 1;
+            // Rounding carried into the leading digit
+            if (mantissa >> @intCast(4 * p) != 0) {
+                lead += 1;
+                mantissa &= (@as(u64, 1) << @intCast(4 * p)) - 1;
+            }
+            count = p;
+        }
+    } else {
+        while (count > 0 and (mantissa >> @intCast(4 * (13 - count))) & 0xf == 0) count -= 1;
+        mantissa >>= @intCast(4 * (13 - count));
+    }
+    const padding: usize = if (precision) |p| (if (p > 13) @min(p, MAX_PRECISION) - 13 else 0) else 0;
+
+    out.byte('0');
+    out.byte(if (upper) 'X' else 'x');
+    out.byte(hex_digits[@intCast(lead)]);
+    if (count + padding > 0 or alt) out.byte('.');
+    var i = count;
+    while (i > 0) {
+        i -= 1;
+        out.byte(hex_digits[@intCast((mantissa >> @intCast(4 * i)) & 0xf)]);
+    }
+    out.repeat('0', padding);
+    out.byte(if (upper) 'P' else 'p');
+    out.byte(if (exp2 < 0) '-' else '+');
+    write_decimal(out, @abs(exp2), 1);
+}
+
+// ============================================================================
+// Layout
+// ============================================================================
+
+const Output = struct {
+    buf: []u8,
+    len: usize = 0,
+
+    fn byte(self: *Output, c: u8) void {
+        self.buf[self.len] = c;
+        self.len += 1;
+    }
+
+    fn text(self: *Output, s: []const u8) void {
+        @memcpy(self.buf[self.len..][0..s.len], s);
+        self.len += s.len;
+    }
+
+    fn repeat(self: *Output, c: u8, n: usize) void {
+        @memset(self.buf[self.len..][0..n], c);
+        self.len += n;
+    }
+
+    fn slice(self: *const Output) []const u8 {
+        return self.buf[0..self.len];
+    }
+};
+
+/// ASCII decimal digits d1 d2 ... standing for 0.d1d2... * 10^point
+const Digits = struct {
+    buf: []const u8,
+    point: i32,
+
+    /// The digit at index `pos`, '0' outside the stored digits
+    fn at(self: Digits, pos: i32) u8 {
+        if (pos < 0 or pos >= @as(i32, @intCast(self.buf.len))) return '0';
+        return self.buf[@intCast(pos)];
+    }
+};
+
+// "ddd.fff" with exactly `frac_len` fraction digits
+fn write_positional(out: *Output, digits: Digits, frac_len: usize, alt: bool) void {
+    if (digits.point <= 0) {
+        out.byte('0');
+    } else {
+        var pos: i32 = 0;
+        while (pos < digits.point) : (pos += 1) out.byte(digits.at(pos));
+    }
+    if (frac_len > 0 or alt) out.byte('.');
+    var pos = digits.point;
+    for (0..frac_len) |_| {
+        out.byte(digits.at(pos));
+        pos += 1;
+    }
+}
+
+// "d.ddde+XX" with exactly `frac_len` fraction digits
+fn write_exponential(out: *Output, digits: Digits, frac_len: usize, alt: bool, upper: bool) void {
+    out.byte(digits.at(0));
+    if (frac_len > 0 or alt) out.byte('.');
+    for (1..frac_len + 1) |pos| out.byte(digits.at(@intCast(pos)));
+    const exp10 = digits.point - 1;
+    out.byte(if (upper) 'E' else 'e');
+    out.byte(if (exp10 < 0) '-' else '+');
+    write_decimal(out, @abs(exp10), 2);
+}
+
+fn write_decimal(out: *Output, value: u32, min_digits: usize) void {
+    var tmp: [10]u8 = undefined;
+    var n: usize = 0;
+    var v = value;
+    while (v > 0 or n < min_digits) : (v /= 10) {
+        tmp[n] = '0' + @as(u8, @intCast(v % 10));
+        n += 1;
+    }
+    while (n > 0) {
+        n -= 1;
+        out.byte(tmp[n]);
+    }
+}
+
+// ============================================================================
+// Exact decimal expansion
+// ============================================================================
+
+// Enough 32-bit limbs for the integer part of the largest double (1024
+// bits) and for ten times the fraction of the smallest (1074 + 4 bits)
+const LIMBS = 36;
+
+const Big = struct {
+    limbs: [LIMBS]u32 = [_]u32{0} ** LIMBS,
+    /// Limbs in use; limbs[len..] are zero
+    len: usize = 0,
+
+    fn from_shifted(value: u64, shift: usize) Big {
+        var big = Big{};
+        const word = shift / 32;
+        const wide = @as(u128, value) << @as(u7, @intCast(shift % 32));
+        big.limbs[word] = @truncate(wide);
+        big.limbs[word + 1] = @truncate(wide >> 32);
+        big.limbs[word + 2] = @truncate(wide >> 64);
+        big.len = word + 3;
+        big.trim();
+        return big;
+    }
+
+    fn trim(self: *Big) void {
+        while (self.len > 0 and self.limbs[self.len - 1] == 0) self.len -= 1;
+    }
+
+    fn is_zero(self: *const Big) bool {
+        return self.len == 0;
+    }
+
+    fn mul_small(self: *Big, k: u32) void {
+        var carry: u64 = 0;
+        for (self.limbs[0..self.len]) |*limb| {
+            const product = @as(u64, limb.*) * k + carry;
+            limb.* = @truncate(product);
+            carry = product >> 32;
+        }
+        if (carry != 0) {
+            self.limbs[self.len] = @intCast(carry);
+            self.len += 1;
+        }
+    }
+
+    /// Divide in place, returning the remainder
+    fn div_small(self: *Big, k: u32) u32 {
+        var rem: u64 = 0;
+        var i = self.len;
+        while (i > 0) {
+            i -= 1;
+            const cur = (rem << 32) | self.limbs[i];
+            self.limbs[i] = @intCast(cur / k);
+            rem = cur % k;
+        }
+        self.trim();
+        return @intCast(rem);
+    }
+
+    /// Remove and return the bits at and above `shift` (fewer than 32)
+    fn take_high(self: *Big, shift: usize) u32 {
+        const word = shift / 32;
+        if (word >= self.len) return 0;
+        const bit: u5 = @intCast(shift % 32);
+        const low = @as(u64, self.limbs[word]);
+        const high = if (word + 1 < self.len) @as(u64, self.limbs[word + 1]) else 0;
+        const taken: u32 = @intCast(((high << 32) | low) >> bit);
+        self.limbs[word] &= (@as(u32, 1) << bit) -% 1;
+        if (word + 1 < self.len) self.limbs[word + 1] = 0;
+        self.trim();
+        return taken;
+    }
+};
+
+/// The decimal digits of a finite non-negative double, integer part first,
+/// then as many fraction digits as asked for
+const Expansion = struct {
+    int_digits: [310]u8 = undefined,
+    int_len: usize = 0,
+    int_pos: usize = 0,
+    // A digit handed back by unread
+    pending: ?u8 = null,
+    // The fraction not yet emitted is frac / 2^frac_bits
+    frac: Big = .{},
+    frac_bits: usize = 0,
+
+    fn init(magnitude: f64) Expansion {
+        var self = Expansion{};
+        const bits: u64 = @bitCast(magnitude);
+        const biased: i32 = @intCast(bits >> 52);
+        var mantissa: u64 = bits & ((1 << 52) - 1);
+        var exp2: i32 = -1074;
+        if (biased != 0) {
+            mantissa |= 1 << 52;
+            exp2 = biased - 1075;
+        }
+
+        var int_part = Big{};
+        if (exp2 >= 0) {
+            int_part = Big.from_shifted(mantissa, @intCast(exp2));
+        } else {
+            const shift: usize = @intCast(-exp2);
+            if (shift < 64) {
+                const mask = (@as(u64, 1) << @intCast(shift)) - 1;
+                int_part = Big.from_shifted(mantissa >> @intCast(shift), 0);
+                mantissa &= mask;
+            }
+            self.frac = Big.from_shifted(mantissa, 0);
+            self.frac_bits = shift;
+        }
+
+        // Nine digits at a time, least significant group first
+        var groups: [35]u32 = undefined;
+        var n: usize = 0;
+        while (!int_part.is_zero()) {
+            groups[n] = int_part.div_small(1_000_000_000);
+            n += 1;
+        }
+        if (n > 0) {
+            n -= 1;
+            var first: [9]u8 = undefined;
+            var first_len: usize = 0;
+            var g = groups[n];
+            while (g > 0) : (g /= 10) {
+                first[first_len] = @intCast(g % 10);
+                first_len += 1;
+            }
+            while (first_len > 0) {
+                first_len -= 1;
+                self.push_int(first[first_len]);
+            }
+            while (n > 0) {
+                n -= 1;
+                var divisor: u32 = 100_000_000;
+                while (divisor > 0) : (divisor /= 10) self.push_int(@intCast(groups[n] / divisor % 10));
+            }
+        }
+        return self;
+    }
+
+    fn push_int(self: *Expansion, digit: u8) void {
+        self.int_digits[self.int_len] = digit;
+        self.int_len += 1;
+    }
+
+    fn next(self: *Expansion) u8 {
+        if (self.pending) |digit| {
+            self.pending = null;
+            return digit;
+        }
+        if (self.int_pos < self.int_len) {
+            self.int_pos += 1;
+            return self.int_digits[self.int_pos - 1];
+        }
+        if (self.frac.is_zero()) return 0;
+        self.frac.mul_small(10);
+        return @intCast(self.frac.take_high(self.frac_bits));
+    }
+
+    fn unread(self: *Expansion, digit: u8) void {
+        self.pending = digit;
+    }
+
+    /// Whether any digit after those emitted is non-zero
+    fn rest_nonzero(self: *const Expansion) bool {
+        if (self.pending) |digit| {
+            if (digit != 0) return true;
+        }
+        for (self.int_digits[self.int_pos..self.int_len]) |d| {
+            if (d != 0) return true;
+        }
+        return !self.frac.is_zero();
+    }
+};
+
+// Take `count` more digits into buf (ASCII) and round the result half to
+// even on what follows. Returns true when rounding carried out of the first
+// digit, leaving "1000..." with one digit more than asked for.
+fn take_rounded(expansion: *Expansion, buf: []u8, count: usize) bool {
+    for (buf[0..count]) |*d| d.* = '0' + expansion.next();
+    const next = expansion.next();
+    const last_odd = count > 0 and (buf[count - 1] - '0') % 2 == 1;
+    const up = next > 5 or (next == 5 and (last_odd or expansion.rest_nonzero()));
+    if (!up) return false;
+
+    var i = count;
+    while (i > 0) {
+        i -= 1;
+        if (buf[i] != '9') {
+            buf[i] += 1;
+            return false;
+        }
+        buf[i] = '0';
+    }
+    buf[0] = '1';
+    if (count > 0) buf[count] = '0';
+    return true;
+}
+
+// Digits of `magnitude` through `frac_len` places after the point
+fn fixed_digits(buf: *[FORMAT_BUFFER_SIZE]u8, magnitude: f64, frac_len: usize) Digits {
+    var expansion = Expansion.init(magnitude);
+    const int_len = expansion.int_len;
+    const count = int_len + frac_len;
+    var point: i32 = @intCast(int_len);
+    if (take_rounded(&expansion, buf, count)) point += 1;
+    return .{ .buf = buf[0..@intCast(@as(i32, @intCast(frac_len)) + point)], .point = point };
+}
+
+// The first `count` significant digits of `magnitude`
+fn significant_digits(buf: *[FORMAT_BUFFER_SIZE]u8, magnitude: f64, count: usize) Digits {
+    if (magnitude == 0) {
+        @memset(buf[0..count], '0');
+        return .{ .buf = buf[0..count], .point = 1 };
+    }
+    var expansion = Expansion.init(magnitude);
+    var point: i32 = @intCast(expansion.int_len);
+    if (point == 0) {
+        // Skip the zeros after the point; the first non-zero digit leads
+        var first = expansion.next();
+        while (first == 0) : (first = expansion.next()) point -= 1;
+        expansion.unread(first);
+    }
+    if (take_rounded(&expansion, buf, count)) point += 1;
+    return .{ .buf = buf[0..count], .point = point };
+}
@@ -1,6 +1,7 @@
 const std = @import("std");
 const lua = @import("lua.zig");
 const serializer = @import("serializer.zig");
+const perf = @import("perf_counters.zig");
 
 const SerializationType = serializer.SerializationType;
 const SerializationError = serializer.SerializationError;
@@ -14,89 +15,174 @@ pub const FunctionSerializationError = error{
     UpvalueSerializationFailed,
 };
 
-// C function registry entry
-const CFunctionEntry = struct {
-    name: []const u8,
-    func: lua.c.lua_CFunction,
-};
-
-// Registry of standard library C functions
-const c_function_registry = [_]CFunctionEntry{
+// Standard library C functions a stored value can refer to, by index. The
+// index is what is stored, so entries are only ever appended. Names the
+// running Lua does not define (math.pow, table.maxn) resolve to nil.
+const c_function_registry = [_][]const u8{
     // Core functions
-    .{ .name = "print", .func = null },
-    .{ .name = "type", .func = null },
-    .{ .name = "tonumber", .func = null },
-    .{ .name = "tostring", .func = null },
-    .{ .name = "pairs", .func = null },
-    .{ .name = "ipairs", .func = null },
-    .{ .name = "next", .func = null },
-    .{ .name = "pcall", .func = null },
-    .{ .name = "xpcall", .func = null },
-    .{ .name = "error", .func = null },
-    .{ .name = "assert", .func = null },
-    .{ .name = "select", .func = null },
-    .{ .name = "rawget", .func = null },
-    .{ .name = "rawset", .func = null },
-    .{ .name = "rawequal", .func = null },
-    .{ .name = "getmetatable", .func = null },
-    .{ .name = "setmetatable", .func = null },
+    "print",
+    "type",
+    "tonumber",
+    "tostring",
+    "pairs",
+    "ipairs",
+    "next",
+    "pcall",
+    "xpcall",
+    "error",
+    "assert",
+    "select",
+    "rawget",
+    "rawset",
+    "rawequal",
+    "getmetatable",
+    "setmetatable",
 
     // Math library functions
-    .{ .name = "math.abs", .func = null },
-    .{ .name = "math.acos", .func = null },
-    .{ .name = "math.asin", .func = null },
-    .{ .name = "math.atan", .func = null },
-    .{ .name = "math.atan2", .func = null },
-    .{ .name = "math.ceil", .func = null },
-    .{ .name = "math.cos", .func = null },
-    .{ .name = "math.cosh", .func = null },
-    .{ .name = "math.deg", .func = null },
-    .{ .name = "math.exp", .func = null },
-    .{ .name = "math.floor", .func = null },
-    .{ .name = "math.fmod", .func = null },
-    .{ .name = "math.frexp", .func = null },
-    .{ .name = "math.huge", .func = null },
-    .{ .name = "math.ldexp", .func = null },
-    .{ .name = "math.log", .func = null },
-    .{ .name = "math.log10", .func = null },
-    .{ .name = "math.max", .func = null },
-    .{ .name = "math.min", .func = null },
-    .{ .name = "math.modf", .func = null },
-    .{ .name = "math.pi", .func = null },
-    .{ .name = "math.pow", .func = null },
-    .{ .name = "math.rad", .func = null },
-    .{ .name = "math.random", .func = null },
-    .{ .name = "math.randomseed", .func = null },
-    .{ .name = "math.sin", .func = null },
-    .{ .name = "math.sinh", .func = null },
-    .{ .name = "math.sqrt", .func = null },
-    .{ .name = "math.tan", .func = null },
-    .{ .name = "math.tanh", .func = null },
+    "math.abs",
+    "math.acos",
+    "math.asin",
+    "math.atan",
+    "math.atan2",
+    "math.ceil",
+    "math.cos",
+    "math.cosh",
+    "math.deg",
+    "math.exp",
+    "math.floor",
+    "math.fmod",
+    "math.frexp",
+    "math.huge",
+    "math.ldexp",
+    "math.log",
+    "math.log10",
+    "math.max",
+    "math.min",
+    "math.modf",
+    "math.pi",
+    "math.pow",
+    "math.rad",
+    "math.random",
+    "math.randomseed",
+    "math.sin",
+    "math.sinh",
+    "math.sqrt",
+    "math.tan",
+    "math.tanh",
 
     // String library functions
-    .{ .name = "string.byte", .func = null },
-    .{ .name = "string.char", .func = null },
-    .{ .name = "string.dump", .func = null },
-    .{ .name = "string.find", .func = null },
-    .{ .name = "string.format", .func = null },
-    .{ .name = "string.gmatch", .func = null },
-    .{ .name = "string.gsub", .func = null },
-    .{ .name = "string.len", .func = null },
-    .{ .name = "string.lower", .func = null },
-    .{ .name = "string.match", .func = null },
-    .{ .name = "string.rep", .func = null },
-    .{ .name = "string.reverse", .func = null },
-    .{ .name = "string.sub", .func = null },
-    .{ .name = "string.upper", .func = null },
+    "string.byte",
+    "string.char",
+    "string.dump",
+    "string.find",
+    "string.format",
+    "string.gmatch",
+    "string.gsub",
+    "string.len",
+    "string.lower",
+    "string.match",
+    "string.rep",
+    "string.reverse",
+    "string.sub",
+    "string.upper",
 
     // Table library functions
-    .{ .name = "table.concat", .func = null },
-    .{ .name = "table.insert", .func = null },
-    .{ .name = "table.maxn", .func = null },
-    .{ .name = "table.remove", .func = null },
-    .{ .name = "table.sort", .func = null },
+    "table.concat",
+    "table.insert",
+    "table.maxn",
+    "table.remove",
+    "table.sort",
+};
+
+// Pointer to registry index, built by init_c_function_registry. Open
+// addressing with linear probing; the table is kept under half full.
+const REGISTRY_BITS = 8;
+const REGISTRY_SLOTS = 1 << REGISTRY_BITS;
+
+const RegistrySlot = struct {
+    func: lua.c.lua_CFunction = null,
+    index: u16 = 0,
 };
 
+var registry_slots = [_]RegistrySlot{.{}} ** REGISTRY_SLOTS;
+
+// Registry reference to the resolved functions, a sequence indexed by
+// registry index + 1 with holes for names that did not resolve
+var resolved_functions_ref: c_int = lua.c.LUA_NOREF;
+
+/// The current lua_State's registry refs, swapped by states.zig
+pub const StateRefs = struct {
+    resolved_functions: c_int = lua.c.LUA_NOREF,
+};
+
+pub fn save_refs() StateRefs {
+    return .{ .resolved_functions = resolved_functions_ref };
+}
+
+pub fn load_refs(refs: StateRefs) void {
+    resolved_functions_ref = refs.resolved_functions;
+}
+
+comptime {
+    std.debug.assert(c_function_registry.len * 2 <= REGISTRY_SLOTS);
+    // push_registry_name copies names into a 64-byte buffer
+    for (c_function_registry) |name| std.debug.assert(name.len < 64);
+}
+
+fn registry_slot(func: lua.c.lua_CFunction) usize {
+    // Fibonacci hashing; function pointers are small table indices on wasm
+    const bits: u32 = @truncate(@intFromPtr(func.?));
+    return (bits *% 0x9E3779B1) >> (32 - REGISTRY_BITS);
+}
+
+fn find_c_function(func: lua.c.lua_CFunction) ?u16 {
+    if (func == null) return null;
+    var slot = registry_slot(func);
+    while (registry_slots[slot].func != null) : (slot = (slot + 1) % REGISTRY_SLOTS) {
+        if (registry_slots[slot].func == func) return registry_slots[slot].index;
+    }
+    return null;
+}
+
+fn add_c_function(func: lua.c.lua_CFunction, index: u16) void {
+    var slot = registry_slot(func);
+    while (registry_slots[slot].func != null) : (slot = (slot + 1) % REGISTRY_SLOTS) {
+        // Two names for one function keep the first index
+        if (registry_slots[slot].func == func) return;
+    }
+    registry_slots[slot] = .{ .func = func, .index = index };
+}
+
+// Push the global `name` refers to, "table.field" or a plain global
+// Globals are read raw, so libraries set_stdlibs left to open lazily stay
+// closed; cu_stdlib_opened builds the registry again when one opens
+fn push_registry_name(L: *lua.lua_State, name: []const u8) void {
+    var buf: [64]u8 = undefined;
+    @memcpy(buf[0..name.len], name);
+    buf[name.len] = 0;
+
+    const dot = std.mem.indexOfScalar(u8, name, '.') orelse {
+        _ = push_raw_global(L, @ptrCast(&buf));
+        return;
+    };
+    buf[dot] = 0;
+    if (push_raw_global(L, @ptrCast(&buf)) != lua.c.LUA_TTABLE) {
+        lua.pop(L, 1);
+        lua.pushnil(L);
+        return;
+    }
+    _ = lua.getfield(L, -1, @ptrCast(buf[dot + 1 ..].ptr));
+    lua.c.lua_remove(L, -2);
+}
+
+fn push_raw_global(L: *lua.lua_State, name: [*:0]const u8) c_int {
+    _ = lua.getref(L, lua.c.LUA_RIDX_GLOBALS);
+    _ = lua.pushstring(L, name);
+    const value_type = lua.c.lua_rawget(L, -2);
+    lua.c.lua_remove(L, -2);
+    return value_type;
+}
+
 // Function metadata structure for serialization
 const FunctionMetadata = struct {
     is_c_function: bool,
@@ -105,8 +191,9 @@ const FunctionMetadata = struct {
     upvalue_count: u8,
 };
 
-// Serialize a Lua function to buffer
-pub fn serialize_function(L: *lua.lua_State, stack_index: c_int, buffer: [*]u8, max_len: usize) SerializationError!usize {
+// Serialize a Lua function to buffer. Tables its upvalues hold are stored
+// through `ctx`, like the fields of a table being converted.
+pub fn serialize_function(L: *lua.lua_State, stack_index: c_int, buffer: [*]u8, max_len: usize, ctx: *serializer.ConversionContext) SerializationError!usize {
     // Ensure we're dealing with a function
     if (!lua.isfunction(L, stack_index)) {
         return SerializationError.TypeMismatch;
@@ -117,12 +204,9 @@ pub fn serialize_function(L: *lua.lua_State, stack_index: c_int, buffer: [*]u8,
         return serialize_c_function_ref(L, stack_index, buffer, max_len);
     }
 
-    // It's a Lua function - serialize bytecode
-    return serialize_lua_bytecode(L, stack_index, buffer, max_len) catch |err| switch (err) {
-        FunctionSerializationError.BytecodeTooLarge => SerializationError.BufferTooSmall,
-        FunctionSerializationError.InvalidBytecode => SerializationError.InvalidFormat,
-        else => SerializationError.TypeMismatch,
-    };
+    // It's a Lua function - serialize bytecode and upvalues
+    var graph = ClosureGraph{};
+    return serialize_closure(L, lua.c.lua_absindex(L, stack_index), buffer, max_len, ctx, &graph);
 }
 
 // Check if a function at the given stack index is a C function
@@ -149,72 +233,47 @@ fn serialize_c_function_ref(L: *lua.lua_State, stack_index: c_int, buffer: [*]u8
 
     buffer[0] = @intFromEnum(SerializationType.function_ref);
 
-    // Try to find the function in our registry
-    const func_ptr = lua.c.lua_tocfunction(L, stack_index);
-
-    // Search for the function in the registry
-    var found_index: ?u16 = null;
-    for (c_function_registry, 0..) |entry, i| {
-        if (entry.func == func_ptr) {
-            found_index = @intCast(i);
-            break;
-        }
-    }
-
-    if (found_index) |idx| {
-        // Found in registry - store the index
-        buffer[1] = @intCast(idx & 0xFF);
-        buffer[2] = @intCast((idx >> 8) & 0xFF);
-        return 3;
-    } else {
-        // Not in registry - mark as unsupported
-        buffer[1] = 0xFF;
-        buffer[2] = 0xFF;
-        return 3;
-    }
+    const index = find_c_function(lua.c.lua_tocfunction(L, stack_index)) orelse 0xFFFF;
+    buffer[1] = @intCast(index & 0xFF);
+    buffer[2] = @intCast(index >> 8);
+    return 3;
 }
 
-// Dump a Lua function to bytecode using string.dump
-fn dump_function(L: *lua.lua_State, stack_index: c_int) !struct { bytecode: [*]const u8, len: usize } {
-    const initial_top = lua.gettop(L);
-    defer lua.settop(L, initial_top);
-
-    // Get string.dump function
-    if (lua.getglobal(L, "string") != lua.c.LUA_TTABLE) {
-        return FunctionSerializationError.InvalidBytecode;
-    }
-
-    if (lua.getfield(L, -1, "dump") != lua.c.LUA_TFUNCTION) {
-        return FunctionSerializationError.InvalidBytecode;
-    }
-
-    // Remove string table from stack
-    lua.c.lua_remove(L, -2);
-
-    // Push the target function
-    lua.c.lua_pushvalue(L, stack_index);
-
-    // Push strip parameter (true to strip debug info)
-    lua.pushboolean(L, 1);
-
-    // Call string.dump(func, true)
-    if (lua.c.lua_pcallk(L, 2, 1, 0, 0, null) != 0) {
-        // Error message is on stack - we'll pop it with defer
-        return FunctionSerializationError.InvalidBytecode;
-    }
-
-    // Get the resulting bytecode
-    var bytecode_len: usize = 0;
-    const bytecode = lua.tolstring(L, -1, &bytecode_len);
+// Whether stored functions keep their debug info (line numbers, local and
+// upvalue names, source name). Off by default: stripped bytecode is about a
+// third smaller, but errors raised in a stored function then carry no line.
+var keep_debug_info = false;
+
+/// Set whether functions are dumped with debug info; returns the previous
+/// setting
+pub fn set_debug_info(enabled: bool) bool {
+    const previous = keep_debug_info;
+    keep_debug_info = enabled;
+    return previous;
+}
 
-    if (bytecode_len == 0) {
-        return FunctionSerializationError.InvalidBytecode;
+// lua_dump writer filling a fixed window; stops the dump once it is full
+const DumpWriter = struct {
+    out: []u8,
+    len: usize = 0,
+    overflow: bool = false,
+
+    fn write(_: ?*lua.lua_State, p: ?*const anyopaque, size: usize, ud: ?*anyopaque) callconv(.c) c_int {
+        const self: *DumpWriter = @ptrCast(@alignCast(ud.?));
+        if (size > self.out.len - self.len) {
+            self.overflow = true;
+            return 1;
+        }
+        const bytes: [*]const u8 = @ptrCast(p.?);
+        @memcpy(self.out[self.len..][0..size], bytes[0..size]);
+        self.len += size;
+        return 0;
     }
+};
 
-    return .{ .bytecode = bytecode, .len = bytecode_len };
-}
-
-// Serialize Lua function bytecode with proper error handling
+// Serialize Lua function bytecode with proper error handling. lua_dump
+// writes straight after the header, with no intermediate string and no
+// call through a string.dump that user code could have replaced.
 fn serialize_lua_bytecode(L: *lua.lua_State, stack_index: c_int, buffer: [*]u8, max_len: usize) !usize {
     // Ensure we have minimum space for header (type + 4-byte length)
     if (max_len < 5) return SerializationError.BufferTooSmall;
@@ -222,25 +281,23 @@ fn serialize_lua_bytecode(L: *lua.lua_State, stack_index: c_int, buffer: [*]u8,
     // Set the type marker
     buffer[0] = @intFromEnum(SerializationType.function_bytecode);
 
-    // Dump the function to bytecode
-    const dump_result = try dump_function(L, stack_index);
+    // lua_dump dumps the function on top of the stack
+    var writer = DumpWriter{ .out = buffer[5..max_len] };
+    lua.c.lua_pushvalue(L, stack_index);
+    const status = lua.c.lua_dump(L, DumpWriter.write, &writer, @intFromBool(!keep_debug_info));
+    lua.pop(L, 1);
 
-    // Check if bytecode fits in buffer
-    if (max_len < 5 + dump_result.len) {
-        return FunctionSerializationError.BytecodeTooLarge;
-    }
+    if (writer.overflow) return FunctionSerializationError.BytecodeTooLarge;
+    if (status != 0 or writer.len == 0) return FunctionSerializationError.InvalidBytecode;
 
     // Write bytecode length as 4 bytes (little-endian)
-    const len_u32: u32 = @intCast(dump_result.len);
+    const len_u32: u32 = @intCast(writer.len);
     buffer[1] = @intCast(len_u32 & 0xFF);
     buffer[2] = @intCast((len_u32 >> 8) & 0xFF);
     buffer[3] = @intCast((len_u32 >> 16) & 0xFF);
     buffer[4] = @intCast((len_u32 >> 24) & 0xFF);
 
-    // Copy bytecode data
-    @memcpy(buffer[5 .. 5 + dump_result.len], dump_result.bytecode[0..dump_result.len]);
-
-    return 5 + dump_result.len;
+    return 5 + writer.len;
 }
 
 // Alternative implementation that manages stack directly
@@ -285,6 +342,7 @@ pub fn deserialize_function(L: *lua.lua_State, func_type: SerializationType, buf
 
     const data_buffer = buffer + 1;
     const data_len = len - 1;
+    perf.counters.function_loads +%= 1;
 
     switch (func_type) {
         SerializationType.function_bytecode => {
@@ -325,140 +383,320 @@ fn deserialize_lua_bytecode(L: *lua.lua_State, buffer: [*]const u8, len: usize)
     // Function is now on top of stack
 }
 
-// Deserialize C function reference
-fn deserialize_c_function_ref(L: *lua.lua_State, buffer: [*]const u8, len: usize) SerializationError!void {
-    // Check minimum size (2 bytes for index)
-    if (len < 2) return SerializationError.InvalidFormat;
-
-    // Read the registry index (little-endian)
-    const index: u16 = @as(u16, buffer[0]) |
-        (@as(u16, buffer[1]) << 8);
+// Placeholder C function for unsupported C functions
+fn unsupported_c_function(L: ?*lua.c.lua_State) callconv(.c) c_int {
+    const state = L.?;
+    _ = lua.pushstring(state, "Attempted to call deserialized C function (not supported)");
+    return lua.c.lua_error(state);
+}
 
-    // Check for unsupported marker
-    if (index == 0xFFFF) {
-        // Push a placeholder function that raises an error
-        lua.c.lua_pushcfunction(L, unsupported_c_function);
-        return;
-    }
+// Get C function name from registry for a function on the stack
+pub fn get_c_function_name(L: *lua.lua_State, stack_index: c_int) ?[]const u8 {
+    if (!is_c_function(L, stack_index)) return null;
+    const index = find_c_function(lua.c.lua_tocfunction(L, stack_index)) orelse return null;
+    return c_function_registry[index];
+}
 
-    // Look up the function in the registry
-    if (index >= c_function_registry.len) {
-        return SerializationError.InvalidFormat;
+/// Resolve the registry names once, while the globals still hold the
+/// standard library: pointers for serializing, the functions themselves
+/// (C closures such as math.random included) for loading
+pub fn init_c_function_registry(L: *lua.lua_State) void {
+    registry_slots = [_]RegistrySlot{.{}} ** REGISTRY_SLOTS;
+    if (resolved_functions_ref != lua.c.LUA_NOREF) lua.unref(L, resolved_functions_ref);
+
+    lua.c.lua_createtable(L, c_function_registry.len, 0);
+    for (c_function_registry, 0..) |name, i| {
+        push_registry_name(L, name);
+        if (lua.c.lua_iscfunction(L, -1) == 0) {
+            lua.pop(L, 1);
+            continue;
+        }
+        add_c_function(lua.c.lua_tocfunction(L, -1), @intCast(i));
+        lua.c.lua_rawseti(L, -2, @intCast(i + 1));
     }
+    resolved_functions_ref = lua.ref(L);
+}
 
-    const entry = c_function_registry[index];
+// Closures
+//
+// A Lua function whose only upvalue is the globals table, or that has none,
+// is stored as function_bytecode: loading gives _ENV back by itself. Any
+// other is stored as CLOSURE, which keeps its upvalues:
+//   0x10, u32 payload length (little-endian), then the function_bytecode
+//   value, a u8 upvalue count and per upvalue a kind byte:
+//     UPVALUE_NIL      nothing follows; also written for values that
+//                      cannot be stored (coroutines, userdata, cycles)
+//     UPVALUE_VALUE    a serialized value; a table becomes a table_ref and
+//                      a Lua function is written the same way as this one
+//     UPVALUE_GLOBALS  the globals table
+//     UPVALUE_CLOSURE  u8 number of a function already written
+//     UPVALUE_SHARED   u8 function number, u8 upvalue index: the same
+//                      variable as that upvalue, joined again on load
+// Functions are numbered in the order they are written, from 0 for the one
+// being stored, so a recursive local function refers to itself and closures
+// over one local keep sharing it once loaded.
+pub const CLOSURE: u8 = 0x10;
+
+const UPVALUE_NIL: u8 = 0;
+const UPVALUE_VALUE: u8 = 1;
+const UPVALUE_GLOBALS: u8 = 2;
+const UPVALUE_CLOSURE: u8 = 3;
+const UPVALUE_SHARED: u8 = 4;
+
+// Limits of one stored value. A function beyond MAX_GRAPH_FUNCTIONS is
+// stored as nil; upvalues beyond MAX_GRAPH_UPVALUES are stored by value
+// and no longer shared.
+const MAX_GRAPH_FUNCTIONS = 32;
+const MAX_GRAPH_UPVALUES = 128;
+
+const SeenUpvalue = struct {
+    id: ?*anyopaque,
+    function: u8,
+    index: u8,
+};
 
-    // Get the actual C function from Lua's global environment
-    // We need to resolve the function by name since we don't store actual pointers
+// Functions and upvalues written so far in one stored value
+const ClosureGraph = struct {
+    functions: [MAX_GRAPH_FUNCTIONS]?*const anyopaque = undefined,
+    function_count: usize = 0,
+    upvalues: [MAX_GRAPH_UPVALUES]SeenUpvalue = undefined,
+    upvalue_count: usize = 0,
 
-    // Check if name contains a dot (table.field pattern)
-    var dot_pos: ?usize = null;
-    for (entry.name, 0..) |c, i| {
-        if (c == '.') {
-            dot_pos = i;
-            break;
+    fn find_function(self: *const ClosureGraph, ptr: ?*const anyopaque) ?u8 {
+        for (self.functions[0..self.function_count], 0..) |function, i| {
+            if (function == ptr) return @intCast(i);
         }
+        return null;
     }
 
-    if (dot_pos) |pos| {
-        // It's a table field like "math.sin"
-        const table_name = entry.name[0..pos];
-        const field_name = entry.name[pos + 1 ..];
-
-        // Create null-terminated strings
-        var table_buf: [256]u8 = undefined;
-        var field_buf: [256]u8 = undefined;
-
-        @memcpy(table_buf[0..table_name.len], table_name);
-        table_buf[table_name.len] = 0;
+    fn find_upvalue(self: *const ClosureGraph, id: ?*anyopaque) ?SeenUpvalue {
+        for (self.upvalues[0..self.upvalue_count]) |seen| {
+            if (seen.id == id) return seen;
+        }
+        return null;
+    }
+};
 
-        @memcpy(field_buf[0..field_name.len], field_name);
-        field_buf[field_name.len] = 0;
+fn upvalue_count(L: *lua.lua_State, index: c_int) u8 {
+    var ar: lua.c.lua_Debug = undefined;
+    lua.c.lua_pushvalue(L, index);
+    if (lua.c.lua_getinfo(L, ">u", &ar) == 0) return 0;
+    return ar.nups;
+}
 
-        // Get the table
-        _ = lua.getglobal(L, @ptrCast(&table_buf));
+fn is_globals(L: *lua.lua_State, index: c_int) bool {
+    _ = lua.getref(L, lua.c.LUA_RIDX_GLOBALS);
+    defer lua.pop(L, 1);
+    return lua.c.lua_rawequal(L, index, -1) != 0;
+}
 
-        if (!lua.istable(L, -1)) {
-            lua.c.lua_pop(L, 1);
-            lua.pushnil(L);
-            return;
-        }
+fn is_lua_function(L: *lua.lua_State, index: c_int) bool {
+    return lua.isfunction(L, index) and lua.c.lua_iscfunction(L, index) == 0;
+}
 
-        // Get the field
-        _ = lua.getfield(L, -1, @ptrCast(&field_buf));
-        lua.c.lua_remove(L, -2); // Remove the table
-    } else {
-        // It's a global function
-        var name_buf: [256]u8 = undefined;
-        @memcpy(name_buf[0..entry.name.len], entry.name);
-        name_buf[entry.name.len] = 0;
+fn write_bytecode(L: *lua.lua_State, index: c_int, buffer: [*]u8, max_len: usize) SerializationError!usize {
+    return serialize_lua_bytecode(L, index, buffer, max_len) catch |err| switch (err) {
+        FunctionSerializationError.BytecodeTooLarge, SerializationError.BufferTooSmall => SerializationError.BufferTooSmall,
+        FunctionSerializationError.InvalidBytecode => SerializationError.InvalidFormat,
+    };
+}
 
-        _ = lua.getglobal(L, @ptrCast(&name_buf));
+// Write the Lua function at absolute `index` and the functions its upvalues
+// hold, as function_bytecode or CLOSURE
+fn serialize_closure(
+    L: *lua.lua_State,
+    index: c_int,
+    buffer: [*]u8,
+    max_len: usize,
+    ctx: *serializer.ConversionContext,
+    graph: *ClosureGraph,
+) SerializationError!usize {
+    if (graph.function_count == MAX_GRAPH_FUNCTIONS) return SerializationError.TypeMismatch;
+    const ordinal: u8 = @intCast(graph.function_count);
+    graph.functions[ordinal] = lua.c.lua_topointer(L, index);
+    graph.function_count += 1;
+
+    const count = upvalue_count(L, index);
+    if (count == 0) return write_bytecode(L, index, buffer, max_len);
+    if (count == 1) {
+        _ = lua.c.lua_getupvalue(L, index, 1);
+        const globals_only = is_globals(L, -1);
+        lua.pop(L, 1);
+        if (globals_only) return write_bytecode(L, index, buffer, max_len);
     }
 
-    // Verify we got a function
-    if (!lua.isfunction(L, -1)) {
-        lua.c.lua_pop(L, 1);
-        lua.pushnil(L);
+    if (max_len < 5) return SerializationError.BufferTooSmall;
+    buffer[0] = CLOSURE;
+    var offset: usize = 5;
+    offset += try write_bytecode(L, index, buffer + offset, max_len - offset);
+    if (offset == max_len) return SerializationError.BufferTooSmall;
+    buffer[offset] = count;
+    offset += 1;
+
+    var n: c_int = 1;
+    while (n <= count) : (n += 1) {
+        offset += try serialize_upvalue(L, index, n, ordinal, buffer + offset, max_len - offset, ctx, graph);
     }
+    std.mem.writeInt(u32, buffer[1..5], @intCast(offset - 5), .little);
+    return offset;
 }
 
-// Placeholder C function for unsupported C functions
-fn unsupported_c_function(L: ?*lua.c.lua_State) callconv(.c) c_int {
-    const state = L.?;
-    _ = lua.pushstring(state, "Attempted to call deserialized C function (not supported)");
-    return lua.c.lua_error(state);
-}
+fn serialize_upvalue(
+    L: *lua.lua_State,
+    index: c_int,
+    n: c_int,
+    ordinal: u8,
+    buffer: [*]u8,
+    max_len: usize,
+    ctx: *serializer.ConversionContext,
+    graph: *ClosureGraph,
+) SerializationError!usize {
+    if (max_len < 3) return SerializationError.BufferTooSmall;
 
-// Get C function name from registry for a function on the stack
-pub fn get_c_function_name(L: *lua.lua_State, stack_index: c_int) ?[]const u8 {
-    if (!is_c_function(L, stack_index)) return null;
+    const id = lua.c.lua_upvalueid(L, index, n);
+    if (graph.find_upvalue(id)) |seen| {
+        buffer[0] = UPVALUE_SHARED;
+        buffer[1] = seen.function;
+        buffer[2] = seen.index;
+        return 3;
+    }
+    if (graph.upvalue_count < MAX_GRAPH_UPVALUES) {
+        graph.upvalues[graph.upvalue_count] = .{ .id = id, .function = ordinal, .index = @intCast(n) };
+        graph.upvalue_count += 1;
+    }
 
-    const func_ptr = lua.c.lua_tocfunction(L, stack_index);
-    if (func_ptr == null) return null;
+    _ = lua.c.lua_getupvalue(L, index, n);
+    const value_index = lua.gettop(L);
+    defer lua.settop(L, value_index - 1);
 
-    // Search in registry
-    for (c_function_registry) |entry| {
-        if (entry.func == func_ptr) {
-            return entry.name;
-        }
+    if (is_globals(L, value_index)) {
+        buffer[0] = UPVALUE_GLOBALS;
+        return 1;
     }
 
-    return null;
-}
+    const function = is_lua_function(L, value_index);
+    if (function) {
+        if (graph.find_function(lua.c.lua_topointer(L, value_index))) |seen| {
+            buffer[0] = UPVALUE_CLOSURE;
+            buffer[1] = seen;
+            return 2;
+        }
+    }
 
-// Initialize the C function registry with actual function pointers
-pub fn init_c_function_registry(L: *lua.lua_State) void {
-    // This would be called during initialization to populate the registry
-    // with actual function pointers from the Lua state
-    _ = L;
-    // Implementation would iterate through known functions and store their pointers
+    buffer[0] = UPVALUE_VALUE;
+    const len = (if (function)
+        serialize_closure(L, value_index, buffer + 1, max_len - 1, ctx, graph)
+    else
+        serializer.serialize_captured_value(L, value_index, buffer + 1, max_len - 1, ctx)) catch |err| switch (err) {
+        // A table inlined further up cannot be referred to; converting it
+        // instead gives it an external table the upvalue can point at
+        SerializationError.CircularReference => if (ctx.inlining) return SerializationError.NotInlinable else {
+            buffer[0] = UPVALUE_NIL;
+            return 1;
+        },
+        // Left out, as every upvalue was before closures kept them
+        SerializationError.TypeMismatch => {
+            buffer[0] = UPVALUE_NIL;
+            return 1;
+        },
+        else => return err,
+    };
+    return 1 + len;
 }
 
-// Helper function to get upvalue count (for future phases)
-fn get_upvalue_count(L: *lua.lua_State, stack_index: c_int) u8 {
-    _ = L;
-    _ = stack_index;
-    // Stub for Phase 1 - will be implemented in later phases
-    return 0;
+/// Load a CLOSURE value, the function with its upvalues
+pub fn deserialize_closure(L: *lua.lua_State, bytes: []const u8) SerializationError!void {
+    perf.counters.function_loads +%= 1;
+    if (lua.c.lua_checkstack(L, 4) == 0) return SerializationError.InvalidFormat;
+    const top = lua.gettop(L);
+    errdefer lua.settop(L, top);
+
+    // Functions loaded so far, by number, for UPVALUE_CLOSURE and
+    // UPVALUE_SHARED
+    lua.newtable(L);
+    var loaded: usize = 0;
+    try load_closure(L, bytes, top + 1, &loaded, 0);
+    lua.c.lua_remove(L, top + 1);
 }
 
-// Serialize upvalues (for future phases)
-fn serialize_upvalues(L: *lua.lua_State, stack_index: c_int, buffer: [*]u8, max_len: usize) !usize {
-    _ = L;
-    _ = stack_index;
-    _ = buffer;
-    _ = max_len;
-    // Stub for Phase 1 - will be implemented in later phases
-    return 0;
+// Whether the function at `index` has upvalue `n`; lua_upvaluejoin and
+// lua_setupvalue would not check
+fn has_upvalue(L: *lua.lua_State, index: c_int, n: c_int) bool {
+    if (lua.c.lua_getupvalue(L, index, n) == null) return false;
+    lua.pop(L, 1);
+    return true;
 }
 
-// Deserialize upvalues (for future phases)
-fn deserialize_upvalues(L: *lua.lua_State, buffer: [*]const u8, len: usize) !void {
-    _ = L;
-    _ = buffer;
-    _ = len;
-    // Stub for Phase 1 - will be implemented in later phases
+fn load_closure(L: *lua.lua_State, bytes: []const u8, loaded_index: c_int, loaded: *usize, depth: usize) SerializationError!void {
+    if (depth >= MAX_GRAPH_FUNCTIONS or loaded.* >= MAX_GRAPH_FUNCTIONS) return SerializationError.InvalidFormat;
+    if (lua.c.lua_checkstack(L, 4) == 0) return SerializationError.InvalidFormat;
+    if (bytes.len < 5) return SerializationError.InvalidFormat;
+
+    const function_tag = @intFromEnum(SerializationType.function_bytecode);
+    if (bytes[0] == function_tag) {
+        try deserialize_function_bytecode(L, bytes.ptr + 1, bytes.len - 1);
+        lua.pushvalue(L, -1);
+        lua.c.lua_rawseti(L, loaded_index, @intCast(loaded.* + 1));
+        loaded.* += 1;
+        return;
+    }
+    if (bytes[0] != CLOSURE) return SerializationError.InvalidFormat;
+
+    const payload_len = std.mem.readInt(u32, bytes[1..5], .little);
+    if (payload_len > bytes.len - 5) return SerializationError.InvalidFormat;
+    const payload = bytes[5..][0..payload_len];
+    if (payload.len == 0 or payload[0] != function_tag) return SerializationError.InvalidFormat;
+
+    var offset = try serializer.encoded_len(payload.ptr, payload.len);
+    try deserialize_function_bytecode(L, payload.ptr + 1, offset - 1);
+    const function_index = lua.gettop(L);
+    lua.pushvalue(L, function_index);
+    lua.c.lua_rawseti(L, loaded_index, @intCast(loaded.* + 1));
+    loaded.* += 1;
+
+    if (offset == payload.len) return SerializationError.InvalidFormat;
+    const count: c_int = payload[offset];
+    offset += 1;
+    if (has_upvalue(L, function_index, count + 1)) return SerializationError.InvalidFormat;
+    if (count > 0 and !has_upvalue(L, function_index, count)) return SerializationError.InvalidFormat;
+
+    var n: c_int = 1;
+    while (n <= count) : (n += 1) {
+        if (offset == payload.len) return SerializationError.InvalidFormat;
+        const kind = payload[offset];
+        offset += 1;
+        switch (kind) {
+            UPVALUE_NIL => lua.pushnil(L),
+            UPVALUE_GLOBALS => _ = lua.getref(L, lua.c.LUA_RIDX_GLOBALS),
+            UPVALUE_CLOSURE => {
+                if (offset == payload.len or payload[offset] >= loaded.*) return SerializationError.InvalidFormat;
+                _ = lua.c.lua_rawgeti(L, loaded_index, @as(c_int, payload[offset]) + 1);
+                offset += 1;
+            },
+            UPVALUE_SHARED => {
+                if (payload.len - offset < 2 or payload[offset] >= loaded.*) return SerializationError.InvalidFormat;
+                const other_index: c_int = payload[offset + 1];
+                _ = lua.c.lua_rawgeti(L, loaded_index, @as(c_int, payload[offset]) + 1);
+                offset += 2;
+                if (!has_upvalue(L, -1, other_index)) return SerializationError.InvalidFormat;
+                lua.c.lua_upvaluejoin(L, function_index, n, -1, other_index);
+                lua.pop(L, 1);
+                continue;
+            },
+            UPVALUE_VALUE => {
+                const len = try serializer.encoded_len(payload.ptr + offset, payload.len - offset);
+                const value = payload[offset..][0..len];
+                if (value[0] == function_tag or value[0] == CLOSURE) {
+                    try load_closure(L, value, loaded_index, loaded, depth + 1);
+                } else {
+                    try serializer.deserialize_value(L, value.ptr, value.len);
+                }
+                offset += len;
+            },
+            else => return SerializationError.InvalidFormat,
+        }
+        _ = lua.c.lua_setupvalue(L, function_index, n);
+    }
 }
 
 // Validate bytecode for basic security checks
@@ -501,17 +739,63 @@ pub fn deserialize_function_bytecode(L: *lua.lua_State, buffer: [*]const u8, len
         return SerializationError.InvalidFormat;
     }
 
-    // Load the bytecode using luaL_loadbuffer
-    const load_result = lua.c.luaL_loadbufferx(L, @ptrCast(bytecode_ptr), bytecode_len, "=deserialized_function", "b" // Binary mode
-    );
+    try load_bytecode(L, bytecode_ptr[0..bytecode_len]);
+}
 
-    if (load_result != lua.c.LUA_OK) {
-        // Error loading bytecode - error message is on stack
-        lua.c.lua_pop(L, 1); // Pop error message
+// Loaded bytecode by content. The same handler stored under many keys
+// arrives as the same bytes; the first load undumps and verifies it and
+// keeps the function, and later loads clone it (lua_clonefunction), which
+// shares the prototype and gives the new closure its own upvalues, as a
+// fresh load would. Keyed by Wyhash and length like chunk_cache.zig, and
+// the least recently used entry is released when the table is full.
+const PROTO_CACHE_SLOTS = 64;
+
+const ProtoEntry = struct {
+    // The lua_State whose registry holds `ref` (states.zig)
+    owner: ?*lua.lua_State = null,
+    hash: u64 = 0,
+    len: usize = 0,
+    ref: c_int = lua.c.LUA_NOREF,
+    last_used: u64 = 0,
+};
+
+var proto_cache = [_]ProtoEntry{.{}} ** PROTO_CACHE_SLOTS;
+var proto_tick: u64 = 0;
+
+fn load_bytecode(L: *lua.lua_State, bytecode: []const u8) SerializationError!void {
+    const hash = std.hash.Wyhash.hash(0, bytecode);
+    proto_tick += 1;
+
+    var victim: usize = 0;
+    for (&proto_cache, 0..) |*entry, i| {
+        if (entry.owner == L and entry.hash == hash and entry.len == bytecode.len) {
+            entry.last_used = proto_tick;
+            _ = lua.getref(L, entry.ref);
+            _ = lua.c.lua_clonefunction(L, -1);
+            lua.c.lua_rotate(L, -2, 1);
+            lua.pop(L, 1);
+            return;
+        }
+        if (entry.last_used < proto_cache[victim].last_used) victim = i;
+    }
+
+    if (lua.c.luaL_loadbufferx(L, bytecode.ptr, bytecode.len, "=deserialized_function", "b") != lua.c.LUA_OK) {
+        lua.pop(L, 1); // error message
         return SerializationError.InvalidFormat;
     }
 
-    // Function is now on top of stack
+    // The cached copy is never handed out, so nothing sets its upvalues
+    const slot = &proto_cache[victim];
+    if (slot.owner) |owner| lua.unref(owner, slot.ref);
+    lua.pushvalue(L, -1);
+    slot.* = .{ .owner = L, .hash = hash, .len = bytecode.len, .ref = lua.ref(L), .last_used = proto_tick };
+}
+
+/// Forget the functions of a state that is being closed
+pub fn forget_state(L: *lua.lua_State) void {
+    for (&proto_cache) |*entry| {
+        if (entry.owner == L) entry.* = .{};
+    }
 }
 
 // Public function to deserialize C function reference
@@ -534,61 +818,12 @@ pub fn deserialize_function_ref(L: *lua.lua_State, buffer: [*]const u8, len: usi
         return SerializationError.InvalidFormat;
     }
 
-    const entry = c_function_registry[index];
-
-    // Get the actual C function from Lua's global environment
-    // We need to resolve the function by name since we don't store actual pointers
-
-    // Check if name contains a dot (table.field pattern)
-    var dot_pos: ?usize = null;
-    for (entry.name, 0..) |c, i| {
-        if (c == '.') {
-            dot_pos = i;
-            break;
-        }
-    }
-
-    if (dot_pos) |pos| {
-        // It's a table field like "math.sin"
-        const table_name = entry.name[0..pos];
-        const field_name = entry.name[pos + 1 ..];
-
-        // Create null-terminated strings
-        var table_buf: [256]u8 = undefined;
-        var field_buf: [256]u8 = undefined;
-
-        @memcpy(table_buf[0..table_name.len], table_name);
-        table_buf[table_name.len] = 0;
-
-        @memcpy(field_buf[0..field_name.len], field_name);
-        field_buf[field_name.len] = 0;
-
-        // Get the table
-        _ = lua.getglobal(L, @ptrCast(&table_buf));
-
-        if (!lua.istable(L, -1)) {
-            lua.c.lua_pop(L, 1);
-            // Push nil instead of error
-            lua.pushnil(L);
-            return;
-        }
-
-        // Get the field
-        _ = lua.getfield(L, -1, @ptrCast(&field_buf));
-        lua.c.lua_remove(L, -2); // Remove the table
-    } else {
-        // It's a global function
-        var name_buf: [256]u8 = undefined;
-        @memcpy(name_buf[0..entry.name.len], entry.name);
-        name_buf[entry.name.len] = 0;
-
-        _ = lua.getglobal(L, @ptrCast(&name_buf));
-    }
-
-    // Verify we got a function
-    if (!lua.isfunction(L, -1)) {
-        lua.c.lua_pop(L, 1);
-        // Push nil for missing functions
+    // Names that did not resolve read back as nil
+    if (resolved_functions_ref == lua.c.LUA_NOREF) {
         lua.pushnil(L);
+        return;
     }
+    _ = lua.getref(L, resolved_functions_ref);
+    _ = lua.c.lua_rawgeti(L, -1, @as(c_int, index) + 1);
+    lua.c.lua_remove(L, -2);
 }
@@ -0,0 +1,86 @@
+const std = @import("std");
+
+// Collector pause times.
+//
+// lgc.c brackets every collector entry (luaC_step for incremental steps and
+// generational minor or major collections, luaC_fullgc for collectgarbage()
+// and emergency collections) with luai_gcpausebegin / luai_gcpauseend, which
+// luaconf.h maps to main.zig's cu_gc_pause_begin / cu_gc_pause_end. Each pause
+// is timed with the host's monotonic clock and counted in a histogram of
+// power-of-two microsecond buckets. The kind of the last step also tells
+// idle_gc which mode the collector runs in.
+
+extern fn js_clock_ms() f64;
+
+pub const HISTOGRAM_BUCKETS = 16;
+
+// Bucket 0 counts pauses under FIRST_BUCKET_US, bucket i pauses under
+// FIRST_BUCKET_US << i, and the last bucket everything longer
+const FIRST_BUCKET_US = 16;
+
+pub const GcStats = extern struct {
+    total_ms: f64,
+    max_ms: f64,
+    pauses: u32,
+    /// Pauses that ran a whole cycle (luaC_fullgc)
+    full_collections: u32,
+    histogram: [HISTOGRAM_BUCKETS]u32,
+};
+
+// luai_gcpauseend kinds (llimits.h)
+pub const PauseKind = enum(c_int) {
+    incremental = 0,
+    generational = 1,
+    full = 2,
+};
+
+var stats: GcStats = std.mem.zeroes(GcStats);
+var started_ms: f64 = 0;
+var generational_steps: bool = false;
+
+// Pauses do not nest: the collector does not re-enter itself while running
+pub fn pause_begin() void {
+    started_ms = js_clock_ms();
+}
+
+pub fn pause_end(kind: PauseKind) void {
+    const ms = @max(js_clock_ms() - started_ms, 0);
+    stats.pauses +%= 1;
+    switch (kind) {
+        .incremental => generational_steps = false,
+        .generational => generational_steps = true,
+        .full => stats.full_collections +%= 1,
+    }
+    stats.total_ms += ms;
+    stats.max_ms = @max(stats.max_ms, ms);
+    stats.histogram[bucket(ms * 1000)] +%= 1;
+}
+
+fn bucket(us: f64) usize {
+    var limit: f64 = FIRST_BUCKET_US;
+    var i: usize = 0;
+    while (i < HISTOGRAM_BUCKETS - 1 and us >= limit) : (i += 1) limit *= 2;
+    return i;
+}
+
+pub fn now_ms() f64 {
+    return js_clock_ms();
+}
+
+/// Pauses since init() or the last reset
+pub fn pause_count() u32 {
+    return stats.pauses;
+}
+
+/// Whether the last collector step was a generational collection
+pub fn last_step_generational() bool {
+    return generational_steps;
+}
+
+pub fn read(out: *GcStats) void {
+    out.* = stats;
+}
+
+pub fn reset() void {
+    stats = std.mem.zeroes(GcStats);
+}
@@ -0,0 +1,147 @@
+const std = @import("std");
+const lua = @import("lua.zig");
+const typed_array = @import("typed_array.zig");
+
+const c = lua.c;
+
+// The hash library: SHA-256, Keccak-256 (Ethereum's, with the original
+// 0x01 padding, not SHA3-256) and BLAKE3, from std.crypto. Inputs are
+// strings or u8 typed arrays; digests are 32-byte binary strings, or 64
+// lowercase hex digits when asked for 'hex'.
+//
+// hash.new(algorithm) returns a hasher that takes its input in pieces
+// (update), so a large input streams through without being concatenated
+// first. digest() finishes a copy of the state, so the hasher can go on.
+
+const sha2 = std.crypto.hash.sha2;
+const sha3 = std.crypto.hash.sha3;
+const Blake3 = std.crypto.hash.Blake3;
+
+const METATABLE: [*:0]const u8 = "cu.hash";
+const DIGEST_LEN = 32;
+
+const Algorithm = enum { sha256, keccak256, blake3 };
+
+const Hasher = union(Algorithm) {
+    sha256: sha2.Sha256,
+    keccak256: sha3.Keccak256,
+    blake3: Blake3,
+
+    fn init(algorithm: Algorithm) Hasher {
+        return switch (algorithm) {
+            inline else => |tag| @unionInit(Hasher, @tagName(tag), @FieldType(Hasher, @tagName(tag)).init(.{})),
+        };
+    }
+
+    fn update(h: *Hasher, bytes: []const u8) void {
+        switch (h.*) {
+            inline else => |*state| state.update(bytes),
+        }
+    }
+
+    fn final(h: Hasher) [DIGEST_LEN]u8 {
+        var out: [DIGEST_LEN]u8 = undefined;
+        switch (h) {
+            inline else => |state| {
+                var copy = state;
+                copy.final(&out);
+            },
+        }
+        return out;
+    }
+};
+
+// Userdata memory is only aligned for Lua's own values, so a hasher is
+// placed at the first suitably aligned address in a slightly larger block
+const USERDATA_SIZE = @sizeOf(Hasher) + @alignOf(Hasher);
+
+fn hasher_at(p: *anyopaque) *Hasher {
+    return @ptrFromInt(std.mem.alignForward(usize, @intFromPtr(p), @alignOf(Hasher)));
+}
+
+fn check_algorithm(L: *lua.lua_State, arg: c_int) Algorithm {
+    const names = [_][*c]const u8{ "sha256", "keccak256", "blake3", null };
+    return @enumFromInt(c.luaL_checkoption(L, arg, null, &names));
+}
+
+// Push the digest as a binary string, or as hex when `arg` is 'hex'
+fn push_digest(L: *lua.lua_State, digest: [DIGEST_LEN]u8, arg: c_int) c_int {
+    const names = [_][*c]const u8{ "binary", "hex", null };
+    if (c.luaL_checkoption(L, arg, "binary", &names) == 1) {
+        const hex = std.fmt.bytesToHex(digest, .lower);
+        _ = c.lua_pushlstring(L, &hex, hex.len);
+    } else {
+        _ = c.lua_pushlstring(L, &digest, digest.len);
+    }
+    return 1;
+}
+
+fn check_hasher(L: *lua.lua_State) *Hasher {
+    return hasher_at(c.luaL_checkudata(L, 1, METATABLE).?);
+}
+
+// hash.sha256(data [, format]), hash.keccak256(...), hash.blake3(...)
+fn oneshot_impl(comptime algorithm: Algorithm) fn (*lua.lua_State) c_int {
+    return struct {
+        fn f(L: *lua.lua_State) c_int {
+            var h = Hasher.init(algorithm);
+            h.update(typed_array.check_bytes(L, 1));
+            return push_digest(L, h.final(), 2);
+        }
+    }.f;
+}
+
+// hash.new(algorithm) -> a hasher with nothing hashed yet
+fn new_impl(L: *lua.lua_State) c_int {
+    const algorithm = check_algorithm(L, 1);
+    const h = hasher_at(c.lua_newuserdatauv(L, USERDATA_SIZE, 0).?);
+    h.* = Hasher.init(algorithm);
+    if (lua.luaL_newmetatable(L, METATABLE) != 0) {
+        lua.newtable(L);
+        lua.pushcfunction(L, @as(c.lua_CFunction, @ptrCast(&update_impl)));
+        lua.setfield(L, -2, "update");
+        lua.pushcfunction(L, @as(c.lua_CFunction, @ptrCast(&digest_impl)));
+        lua.setfield(L, -2, "digest");
+        lua.pushcfunction(L, @as(c.lua_CFunction, @ptrCast(&algorithm_impl)));
+        lua.setfield(L, -2, "algorithm");
+        lua.setfield(L, -2, "__index");
+    }
+    _ = lua.setmetatable(L, -2);
+    return 1;
+}
+
+// hasher:update(data, ...) -> hasher
+fn update_impl(L: *lua.lua_State) c_int {
+    const h = check_hasher(L);
+    const top = lua.gettop(L);
+    var arg: c_int = 2;
+    while (arg <= top) : (arg += 1) h.update(typed_array.check_bytes(L, arg));
+    lua.settop(L, 1);
+    return 1;
+}
+
+// hasher:digest([format]) -> the digest of everything hashed so far
+fn digest_impl(L: *lua.lua_State) c_int {
+    return push_digest(L, check_hasher(L).final(), 2);
+}
+
+// hasher:algorithm() -> "sha256", "keccak256" or "blake3"
+fn algorithm_impl(L: *lua.lua_State) c_int {
+    _ = lua.pushstring(L, @tagName(check_hasher(L).*));
+    return 1;
+}
+
+const functions = [_]c.luaL_Reg{
+    .{ .name = "sha256", .func = @ptrCast(&oneshot_impl(.sha256)) },
+    .{ .name = "keccak256", .func = @ptrCast(&oneshot_impl(.keccak256)) },
+    .{ .name = "blake3", .func = @ptrCast(&oneshot_impl(.blake3)) },
+    .{ .name = "new", .func = @ptrCast(&new_impl) },
+    .{ .name = null, .func = null },
+};
+
+/// Module initialization, for package.preload.hash (see main.zig)
+pub fn luaopen(L: *lua.lua_State) c_int {
+    c.lua_createtable(L, 0, functions.len - 1);
+    c.luaL_setfuncs(L, &functions, 0);
+    return 1;
+}
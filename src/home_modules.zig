@@ -0,0 +1,126 @@
+const lua = @import("lua.zig");
+
+// require() for modules kept in _home.modules.
+//
+// There is no filesystem, so package.path finds nothing. A searcher after
+// package.preload's looks the module up in _home.modules[name] instead: a
+// string of Lua source or a binary chunk. Source is compiled once and
+// stored back as a stripped binary chunk, so later loads, in this state or
+// after a restore, skip the parser (lverify.c checks the chunk as it loads).
+//
+// What require returns stays in package.loaded across computes as usual.
+// require is wrapped so that a module loaded from _home is loaded again
+// once its entry changed, or when another unit's _home is attached: the
+// chunk it came from is recorded and compared with the entry, which costs
+// one _home.modules read per module per compute.
+
+const c = lua.c;
+
+const MODULES_FIELD: [*:0]const u8 = "modules";
+// { [name] = the chunk string the module was loaded from }
+const LOADED_FROM_KEY: [*:0]const u8 = "cu.home_modules";
+
+pub fn setup(L: *lua.lua_State) void {
+    _ = lua.getglobal(L, "package");
+    _ = lua.getfield(L, -1, "searchers");
+    // Second, after preload's, so a native library keeps its name
+    var i: c.lua_Integer = @intCast(c.luaL_len(L, -1));
+    while (i >= 2) : (i -= 1) {
+        _ = c.lua_rawgeti(L, -1, i);
+        c.lua_rawseti(L, -2, i + 1);
+    }
+    lua.pushcfunction(L, @as(c.lua_CFunction, @ptrCast(&search_home)));
+    c.lua_rawseti(L, -2, 2);
+    lua.pop(L, 2);
+
+    lua.newtable(L);
+    lua.setfield(L, c.LUA_REGISTRYINDEX, LOADED_FROM_KEY);
+
+    _ = lua.getglobal(L, "require");
+    c.lua_pushcclosure(L, @as(c.lua_CFunction, @ptrCast(&home_require)), 1);
+    lua.setglobal(L, "require");
+}
+
+// Push _home.modules[name] (nil if there is none) for the name at `name`
+fn push_entry(L: *lua.lua_State, name: c_int) c_int {
+    const top = lua.gettop(L);
+    var entry_type: c_int = c.LUA_TNIL;
+    if (lua.getglobal(L, "_home") == c.LUA_TTABLE and lua.getfield(L, -1, MODULES_FIELD) == c.LUA_TTABLE) {
+        lua.pushvalue(L, name);
+        entry_type = c.lua_gettable(L, -2);
+    } else {
+        lua.pushnil(L);
+    }
+    c.lua_copy(L, -1, top + 1);
+    lua.settop(L, top + 1);
+    return entry_type;
+}
+
+// require(name), loading a module from _home again if its entry changed
+fn home_require(L: *lua.lua_State) c_int {
+    _ = c.luaL_checklstring(L, 1, null);
+    lua.settop(L, 1);
+    _ = lua.getfield(L, c.LUA_REGISTRYINDEX, LOADED_FROM_KEY);
+    lua.pushvalue(L, 1);
+    if (c.lua_rawget(L, 2) != c.LUA_TNIL) {
+        _ = push_entry(L, 1);
+        if (c.lua_rawequal(L, 3, 4) == 0) {
+            lua.pushvalue(L, 1);
+            lua.pushnil(L);
+            c.lua_rawset(L, 2);
+            _ = c.luaL_getsubtable(L, c.LUA_REGISTRYINDEX, c.LUA_LOADED_TABLE);
+            lua.pushnil(L);
+            lua.setfield(L, -2, lua.tostring(L, 1));
+        }
+    }
+    lua.settop(L, 1);
+    // Upvalue 1: the stock require
+    lua.pushvalue(L, c.LUA_REGISTRYINDEX - 1);
+    lua.pushvalue(L, 1);
+    c.lua_callk(L, 1, 2, 0, null);
+    return 2;
+}
+
+// package.searchers entry: the loader of _home.modules[name], or why not
+fn search_home(L: *lua.lua_State) c_int {
+    const name = c.luaL_checklstring(L, 1, null);
+    lua.settop(L, 1);
+    if (push_entry(L, 1) != c.LUA_TSTRING) {
+        _ = c.lua_pushfstring(L, "no field _home.modules['%s']", name);
+        return 1;
+    }
+
+    var len: usize = 0;
+    const chunk = lua.tolstring(L, 2, &len);
+    const chunk_name = c.lua_pushfstring(L, "=_home.modules.%s", name);
+    if (c.luaL_loadbufferx(L, chunk, len, chunk_name, "bt") != c.LUA_OK) {
+        return c.luaL_error(L, "error loading module '%s' from _home.modules:\n\t%s", name, lua.tostring(L, -1));
+    }
+
+    // Source: keep the stripped chunk in its place for the next load
+    if (len == 0 or chunk[0] != c.LUA_SIGNATURE[0]) {
+        _ = lua.getglobal(L, "string");
+        _ = lua.getfield(L, -1, "dump");
+        lua.pushvalue(L, -3);
+        lua.pushboolean(L, 1);
+        if (lua.pcall(L, 2, 1) == c.LUA_OK) {
+            _ = lua.getglobal(L, "_home");
+            _ = lua.getfield(L, -1, MODULES_FIELD);
+            lua.pushvalue(L, 1);
+            lua.pushvalue(L, -4);
+            c.lua_settable(L, -3);
+            lua.pop(L, 2);
+            c.lua_copy(L, -1, 2);
+        }
+        lua.pop(L, 2);
+    }
+
+    // Stack: name, chunk, chunk name, loader
+    _ = lua.getfield(L, c.LUA_REGISTRYINDEX, LOADED_FROM_KEY);
+    lua.pushvalue(L, 1);
+    lua.pushvalue(L, 2);
+    c.lua_rawset(L, -3);
+    lua.pop(L, 1);
+    lua.pushvalue(L, 3);
+    return 2;
+}
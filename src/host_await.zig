@@ -0,0 +1,138 @@
+const lua = @import("lua.zig");
+const error_handler = @import("error.zig");
+
+// host.await(op, args): let a chunk wait for the host instead of having
+// every lookup preloaded into _io.
+//
+// compute_async runs its chunk on a coroutine of its own. host.await yields
+// that coroutine with (op, args), and the invocation returns them as its
+// results while get_await_handle() names the suspended coroutine. The host
+// does the work (a fetch, a query) and resumes the coroutine with the
+// answer, or with an error that host.await raises in Lua. Suspended
+// coroutines live in a registry table until they finish or fail, so the
+// host may start other computes, or resume them in any order, meanwhile.
+//
+// Only the chunk's own coroutine can await: inside a coroutine the script
+// created, coroutine.yield belongs to the script, so host.await fails there.
+
+// Registry field holding handle -> suspended coroutine
+const THREADS_KEY = "cu.await_threads";
+
+// The coroutine compute_async or resume is running, if any
+var driver: ?*lua.lua_State = null;
+var next_handle: c_int = 1;
+// Handle of the coroutine the last invocation left suspended, 0 if none
+var suspended: u32 = 0;
+
+pub fn setup(L: *lua.lua_State) void {
+    lua.newtable(L);
+    lua.pushcfunction(L, &host_await);
+    lua.setfield(L, -2, "await");
+    lua.setglobal(L, "host");
+}
+
+/// Handle of the coroutine the last compute_async or resume left waiting at
+/// host.await, or 0 if it finished or failed
+pub fn pending() u32 {
+    return suspended;
+}
+
+/// Forget the last invocation's suspension as a new one starts
+pub fn reset() void {
+    suspended = 0;
+}
+
+pub const Thread = struct {
+    co: *lua.lua_State,
+    handle: u32,
+};
+
+/// Move the function on top of L's stack onto a new coroutine and register
+/// it, which keeps it alive
+pub fn spawn(L: *lua.lua_State) Thread {
+    const co: *lua.lua_State = lua.c.lua_newthread(L);
+    lua.c.lua_rotate(L, -2, 1); // [fn, co] -> [co, fn]
+    lua.c.lua_xmove(L, co, 1);
+
+    const handle = next_handle;
+    next_handle += 1;
+    push_threads(L);
+    lua.c.lua_rotate(L, -2, 1); // [co, threads] -> [threads, co]
+    lua.c.lua_rawseti(L, -2, handle);
+    lua.pop(L, 1);
+    return .{ .co = co, .handle = @intCast(handle) };
+}
+
+/// The coroutine registered as `handle` if it is waiting at host.await
+pub fn find(L: *lua.lua_State, handle: u32) ?Thread {
+    if (handle == 0 or handle >= @as(u32, @intCast(next_handle))) return null;
+    push_threads(L);
+    _ = lua.c.lua_rawgeti(L, -1, @intCast(handle));
+    const co = lua.c.lua_tothread(L, -1);
+    lua.pop(L, 2);
+    if (co == null or lua.c.lua_status(co) != lua.c.LUA_YIELD) return null;
+    return .{ .co = co, .handle = handle };
+}
+
+/// Resume `thread` with the `nargs` values on top of L's stack. Leaves on
+/// L what the invocation should report: the chunk's results, the (op, args)
+/// it awaits, or the error message. Returns the status for
+/// finish_top_level, 0 unless the coroutine failed.
+pub fn run(L: *lua.lua_State, thread: Thread, nargs: c_int) c_int {
+    const co = thread.co;
+    lua.c.lua_xmove(L, co, nargs);
+    var nresults: c_int = 0;
+    driver = co;
+    const status = lua.c.lua_resume(co, L, nargs, &nresults);
+    driver = null;
+
+    if (status == lua.c.LUA_YIELD) {
+        lua.c.lua_xmove(co, L, nresults);
+        suspended = thread.handle;
+        return 0;
+    }
+
+    if (status == lua.c.LUA_OK) {
+        lua.c.lua_xmove(co, L, nresults);
+    } else {
+        error_handler.capture_thread_error(L, co);
+        lua.c.lua_xmove(co, L, 1);
+    }
+    release(L, thread.handle);
+    return status;
+}
+
+fn release(L: *lua.lua_State, handle: u32) void {
+    push_threads(L);
+    lua.pushnil(L);
+    lua.c.lua_rawseti(L, -2, @intCast(handle));
+    lua.pop(L, 1);
+}
+
+fn push_threads(L: *lua.lua_State) void {
+    if (lua.getfield(L, lua.c.LUA_REGISTRYINDEX, THREADS_KEY) == lua.c.LUA_TTABLE) return;
+    lua.pop(L, 1);
+    lua.newtable(L);
+    lua.pushvalue(L, -1);
+    lua.setfield(L, lua.c.LUA_REGISTRYINDEX, THREADS_KEY);
+}
+
+// host.await(op [, args]) -> the host's answer
+fn host_await(state: ?*lua.lua_State) callconv(.c) c_int {
+    const L = state.?;
+    _ = lua.c.luaL_checklstring(L, 1, null);
+    if (driver != L) {
+        return lua.c.luaL_error(L, "host.await: not in a compute_async chunk, or inside a coroutine");
+    }
+    lua.settop(L, 2);
+    lua.pushvalue(L, 1);
+    lua.pushvalue(L, 2);
+    return lua.c.lua_yieldk(L, 2, 0, &await_continue);
+}
+
+// The host resumed with (ok, value): return the value, or raise it
+fn await_continue(state: ?*lua.lua_State, _: c_int, _: lua.c.lua_KContext) callconv(.c) c_int {
+    const L = state.?;
+    if (!lua.toboolean(L, -2)) return lua.c.lua_error(L);
+    return 1;
+}
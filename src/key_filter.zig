@@ -0,0 +1,186 @@
+const std = @import("std");
+const lua = @import("lua.zig");
+const ext_store = @import("ext_store.zig");
+
+// Negative-lookup filters for external tables.
+//
+// A read of a key the host does not have still costs a js_ext_table_get
+// crossing, which is most of the time of `t[k] or default` over sparse
+// tables. Once a table has missed MISS_THRESHOLD times, its keys go into a
+// Bloom filter in linear memory, filled by the host (js_ext_table_filter)
+// and kept current by ext_table as Lua stores keys. A key the filter does
+// not hold is nil without asking the host; a key it holds (or may hold) is
+// read as before. Removed keys stay in the filter, which only costs their
+// reads a crossing.
+//
+// Keys are hashed as their text: a string as its bytes, an integer (or an
+// integral float) as its decimal digits, the form the host normalizes both
+// to. Only ASCII keys are answered here; others always go to the host, so
+// the two sides never have to agree on how to decode invalid UTF-8.
+//
+// As for ext_store, the host calls invalidate_ext_table after changing a
+// table directly, which drops its filter here.
+
+extern fn lua_malloc(size: usize) ?*anyopaque;
+extern fn lua_free(ptr: ?*anyopaque) void;
+extern fn js_ext_table_size(table_id: u32) usize;
+extern fn js_ext_table_filter(table_id: u32, bits_ptr: [*]u32, bit_count: u32) c_int;
+
+const MAX_FILTERS = 16;
+const MISS_THRESHOLD = 8;
+const PROBES = 4;
+const MIN_BITS: u32 = 1024;
+const MAX_BITS: u32 = 1 << 24;
+// Bits per key when built; the filter is rebuilt larger once stores bring
+// it down to half that
+const BITS_PER_KEY = 16;
+
+const State = enum(u8) { counting, built, unavailable };
+
+const Filter = struct {
+    table_id: u32,
+    state: State,
+    misses: u32,
+    bits: [*]u32,
+    mask: u32, // bit count - 1
+    keys: u32, // held, counting stores of keys already there
+};
+
+var filters: [MAX_FILTERS]Filter = [_]Filter{.{ .table_id = 0, .state = .counting, .misses = 0, .bits = undefined, .mask = 0, .keys = 0 }} ** MAX_FILTERS;
+var next_victim: usize = 0;
+
+/// Whether the key at `index` is certainly not in `table_id`
+pub fn excludes(L: *lua.lua_State, table_id: u32, index: c_int) bool {
+    const filter = find(table_id) orelse return false;
+    if (filter.state != .built) return false;
+    var buf: [32]u8 = undefined;
+    const hash = key_hash(L, index, &buf) orelse return false;
+    return !holds(filter, hash);
+}
+
+/// Count a read of `table_id` the host answered with nil, building the
+/// table's filter once there were enough
+pub fn note_miss(table_id: u32) void {
+    const filter = find(table_id) orelse claim(table_id);
+    if (filter.state != .counting) return;
+    filter.misses += 1;
+    if (filter.misses >= MISS_THRESHOLD) build(filter);
+}
+
+/// Record that Lua stored the key at `index` in `table_id`
+pub fn add(L: *lua.lua_State, table_id: u32, index: c_int) void {
+    const filter = find(table_id) orelse return;
+    if (filter.state != .built) return;
+    var buf: [32]u8 = undefined;
+    // Keys this side cannot hash are never answered from the filter
+    const hash = key_hash(L, index, &buf) orelse return;
+    if (!holds(filter, hash)) filter.keys += 1;
+    set(filter, hash);
+    if (filter.keys * (BITS_PER_KEY / 2) > filter.mask + 1) forget(table_id);
+}
+
+/// Drop the filter of `table_id` (0 = every table)
+pub fn forget(table_id: u32) void {
+    for (&filters) |*filter| {
+        if (filter.table_id == 0 or (table_id != 0 and filter.table_id != table_id)) continue;
+        release(filter);
+    }
+}
+
+fn find(table_id: u32) ?*Filter {
+    for (&filters) |*filter| {
+        if (filter.table_id == table_id) return filter;
+    }
+    return null;
+}
+
+fn claim(table_id: u32) *Filter {
+    // A free slot, else one still counting, else a built filter in turn
+    const filter = for (&filters) |*filter| {
+        if (filter.table_id == 0) break filter;
+    } else for (&filters) |*filter| {
+        if (filter.state == .counting) {
+            release(filter);
+            break filter;
+        }
+    } else blk: {
+        const victim = &filters[next_victim];
+        next_victim = (next_victim + 1) % MAX_FILTERS;
+        release(victim);
+        break :blk victim;
+    };
+    filter.table_id = table_id;
+    return filter;
+}
+
+fn release(filter: *Filter) void {
+    if (filter.state == .built) lua_free(filter.bits);
+    filter.* = .{ .table_id = 0, .state = .counting, .misses = 0, .bits = undefined, .mask = 0, .keys = 0 };
+}
+
+fn build(filter: *Filter) void {
+    filter.state = .unavailable;
+    // The host fills the filter from its keys, so it needs pending writes
+    ext_store.flush_table(filter.table_id);
+    const wanted = @as(u64, @max(js_ext_table_size(filter.table_id), 1)) * BITS_PER_KEY;
+    if (wanted > MAX_BITS) return;
+    const bit_count = @max(MIN_BITS, std.math.ceilPowerOfTwo(u32, @intCast(wanted)) catch return);
+
+    const raw = lua_malloc(bit_count / 8) orelse return;
+    const bits: [*]u32 = @ptrCast(@alignCast(raw));
+    @memset(bits[0 .. bit_count / 32], 0);
+    const keys = js_ext_table_filter(filter.table_id, bits, bit_count);
+    if (keys < 0) {
+        lua_free(raw);
+        return;
+    }
+    filter.state = .built;
+    filter.bits = bits;
+    filter.mask = bit_count - 1;
+    filter.keys = @intCast(keys);
+}
+
+// FNV-1a of the key's text; null if it is not an ASCII string or an
+// integral number
+fn key_hash(L: *lua.lua_State, index: c_int, buf: *[32]u8) ?u32 {
+    var text: []const u8 = undefined;
+    if (lua.c.lua_type(L, index) == lua.c.LUA_TSTRING) {
+        var len: usize = 0;
+        const ptr = lua.tolstring(L, index, &len);
+        text = ptr[0..len];
+    } else if (lua.isnumber(L, index)) {
+        const num = lua.tonumber(L, index);
+        const int_val = lua.tointeger(L, index);
+        if (@as(f64, @floatFromInt(int_val)) != num) return null;
+        text = std.fmt.bufPrint(buf, "{d}", .{int_val}) catch return null;
+    } else {
+        return null;
+    }
+
+    var hash: u32 = 0x811c9dc5;
+    for (text) |byte| {
+        if (byte >= 0x80) return null;
+        hash = (hash ^ byte) *% 0x01000193;
+    }
+    return hash;
+}
+
+// Probe i is bit (h + i * g) mod bit count, g = (h rotated right 15) | 1
+fn holds(filter: *const Filter, hash: u32) bool {
+    const step = std.math.rotr(u32, hash, 15) | 1;
+    var i: u32 = 0;
+    while (i < PROBES) : (i += 1) {
+        const bit = (hash +% i *% step) & filter.mask;
+        if (filter.bits[bit >> 5] & (@as(u32, 1) << @intCast(bit & 31)) == 0) return false;
+    }
+    return true;
+}
+
+fn set(filter: *Filter, hash: u32) void {
+    const step = std.math.rotr(u32, hash, 15) | 1;
+    var i: u32 = 0;
+    while (i < PROBES) : (i += 1) {
+        const bit = (hash +% i *% step) & filter.mask;
+        filter.bits[bit >> 5] |= @as(u32, 1) << @intCast(bit & 31);
+    }
+}
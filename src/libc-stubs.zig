@@ -1,9 +1,11 @@
 const std = @import("std");
+const builtin = @import("builtin");
+const alloc_stats = @import("alloc_stats.zig");
+const float_conv = @import("float_conv.zig");
 
-const MALLOC_POOL_SIZE = 512 * 1024;
-
-var malloc_pool: [MALLOC_POOL_SIZE]u8 align(16) = undefined;
-var malloc_ptr: usize = 0;
+const WASM_PAGE_SIZE: usize = 64 * 1024;
+const DEFAULT_HEAP_SIZE: usize = 512 * 1024;
+const MIN_HEAP_SIZE: usize = WASM_PAGE_SIZE;
 
 pub var errno_value: c_int = 0;
 export var errno: c_int = 0;
@@ -15,38 +17,420 @@ export var stdout: ?*FILE = @as(?*FILE, @ptrFromInt(2));
 export var stderr: ?*FILE = @as(?*FILE, @ptrFromInt(3));
 
 extern "env" fn js_time_now() c_long;
+extern "env" fn js_clock_ms() f64;
+
+// ============================================================================
+// Allocator
+// ============================================================================
+//
+// The pool lives at the end of linear memory and is committed with
+// memory.grow on demand, up to a cap the host sets through
+// lua_heap_configure (init_with_limits). Nothing else grows memory, so the
+// pool stays contiguous.
+//
+// Every block in the pool starts with a header of two Offsets (8 bytes, 16 on
+// wasm64). `size` is the total block size (header included, multiple of
+// ALIGNMENT) with status flags in the low bits. For large blocks `prev_size` is the size of the physically
+// preceding block so frees can coalesce backwards; small blocks never coalesce
+// and reuse `prev_size` to remember their size class.
+//
+// Small requests are served from per-class free lists that are refilled by
+// carving a slab out of the large allocator. Large requests use boundary-tag
+// coalescing with power-of-two bins, falling back to the untouched top of the
+// pool. Freeing the block adjacent to the top shrinks the top again.
+
+const ALIGNMENT: usize = 8;
+// Pool offsets and block sizes: 32 bits keep headers small on wasm32, and the
+// wasm64 build (CU_BUILD=wasm64) needs 64 to reach past 4GB
+const Offset = if (@sizeOf(usize) > 4) u64 else u32;
+const NONE: Offset = std.math.maxInt(Offset);
+
+const FLAG_IN_USE: Offset = 1;
+const FLAG_SMALL: Offset = 2;
+const FLAG_MASK: Offset = 7;
+
+const BlockHeader = extern struct {
+    size: Offset,
+    prev_size: Offset,
+};
+
+const FreeLink = extern struct {
+    next: Offset,
+    prev: Offset,
+};
+
+const HEADER_SIZE: usize = @sizeOf(BlockHeader);
+const MIN_BLOCK_SIZE: usize = HEADER_SIZE + @sizeOf(FreeLink);
+
+const small_class_sizes = [_]u32{ 16, 24, 32, 40, 48, 64, 80, 96, 128, 160, 192, 256, 320, 384, 512 };
+const NUM_SMALL_CLASSES = small_class_sizes.len;
+const MAX_SMALL_BLOCK: usize = small_class_sizes[NUM_SMALL_CLASSES - 1];
+const SLAB_SIZE: usize = 2048;
+
+const NUM_LARGE_BINS = 20;
+const LARGE_BIN_SHIFT = 9;
+
+// Block size (in ALIGNMENT units) -> smallest class that fits it
+const small_class_lookup = blk: {
+    var table: [MAX_SMALL_BLOCK / ALIGNMENT + 1]u8 = undefined;
+    var class: usize = 0;
+    for (&table, 0..) |*entry, units| {
+        while (small_class_sizes[class] < units * ALIGNMENT) class += 1;
+        entry.* = class;
+    }
+    break :blk table;
+};
+
+var pool_base: [*]u8 = undefined;
+var pool_committed: usize = 0;
+var pool_limit: usize = DEFAULT_HEAP_SIZE;
+var pool_ready: bool = false;
+
+var heap_top: usize = 0;
+var top_prev_size: Offset = 0;
+// The highest heap_top since the last lua_heap_trim; the pool above it has
+// never been written (or was zeroed by the trim)
+var dirty_top: usize = 0;
+var small_free = [_]Offset{NONE} ** NUM_SMALL_CLASSES;
+var large_bins = [_]Offset{NONE} ** NUM_LARGE_BINS;
+var bytes_in_use: usize = 0;
+
+// Telemetry only; none of these feed back into allocation decisions
+var high_water: usize = 0;
+var alloc_count: u32 = 0;
+var free_count: u32 = 0;
+var class_allocs = [_]u32{0} ** alloc_stats.NUM_CLASS_SLOTS;
+var class_live = [_]u32{0} ** alloc_stats.NUM_CLASS_SLOTS;
+// Requests that allocated or resized a block, and the sizes they asked for
+var request_count: u64 = 0;
+var request_bytes: u64 = 0;
+
+inline fn note_growth() void {
+    if (bytes_in_use > high_water) high_water = bytes_in_use;
+}
+
+inline fn block_header(off: usize) *BlockHeader {
+    return @ptrCast(@alignCast(pool_base + off));
+}
+
+inline fn free_link(off: usize) *FreeLink {
+    return @ptrCast(@alignCast(pool_base + off + HEADER_SIZE));
+}
+
+fn pool_init() void {
+    if (pool_ready) return;
+    pool_base = @ptrFromInt(@wasmMemorySize(0) * WASM_PAGE_SIZE);
+    pool_committed = 0;
+    pool_ready = true;
+}
+
+// Make sure the first `bytes` of the pool are backed by linear memory
+fn pool_reserve(bytes: usize) bool {
+    pool_init();
+    if (bytes <= pool_committed) return true;
+    if (bytes > pool_limit) return false;
+
+    const pages = std.math.divCeil(usize, bytes - pool_committed, WASM_PAGE_SIZE) catch return false;
+    if (@wasmMemoryGrow(0, pages) < 0) return false;
+    pool_committed += pages * WASM_PAGE_SIZE;
+    return true;
+}
+
+inline fn block_size(h: *const BlockHeader) usize {
+    return h.size & ~FLAG_MASK;
+}
+
+inline fn is_free_large(h: *const BlockHeader) bool {
+    return h.size & (FLAG_IN_USE | FLAG_SMALL) == 0;
+}
+
+fn large_bin_index(size: usize) usize {
+    const log2 = std.math.log2_int(usize, size);
+    if (log2 <= LARGE_BIN_SHIFT) return 0;
+    return @min(log2 - LARGE_BIN_SHIFT, NUM_LARGE_BINS - 1);
+}
+
+fn payload_offset(ptr: *anyopaque) ?usize {
+    if (!pool_ready) return null;
+    const addr = @intFromPtr(ptr);
+    const base = @intFromPtr(pool_base);
+    if (addr < base + HEADER_SIZE or addr >= base + heap_top) return null;
+    return addr - base - HEADER_SIZE;
+}
+
+// Record `size` as the predecessor size of whatever follows the block at `off`
+fn set_prev_of_next(off: usize, size: usize) void {
+    const next = off + size;
+    if (next == heap_top) {
+        top_prev_size = @intCast(size);
+        return;
+    }
+    const nh = block_header(next);
+    if (nh.size & FLAG_SMALL == 0) {
+        nh.prev_size = @intCast(size);
+    }
+}
+
+fn insert_large(off: usize) void {
+    const bin = large_bin_index(block_size(block_header(off)));
+    const link = free_link(off);
+    link.prev = NONE;
+    link.next = large_bins[bin];
+    if (link.next != NONE) {
+        free_link(link.next).prev = @intCast(off);
+    }
+    large_bins[bin] = @intCast(off);
+}
+
+fn unlink_large(off: usize) void {
+    const link = free_link(off);
+    if (link.prev != NONE) {
+        free_link(link.prev).next = link.next;
+    } else {
+        large_bins[large_bin_index(block_size(block_header(off)))] = link.next;
+    }
+    if (link.next != NONE) {
+        free_link(link.next).prev = link.prev;
+    }
+}
+
+fn carve_top(size: usize) ?usize {
+    if (size > pool_limit - heap_top) return null;
+    if (!pool_reserve(heap_top + size)) return null;
+
+    const off = heap_top;
+    const h = block_header(off);
+    h.size = @intCast(size);
+    h.prev_size = top_prev_size;
+    heap_top += size;
+    top_prev_size = @intCast(size);
+    if (heap_top > dirty_top) dirty_top = heap_top;
+    return off;
+}
+
+// Coalesce a free large block with its neighbours and file it away
+fn release_large(start: usize) void {
+    var off = start;
+    var size = block_size(block_header(off));
+
+    const next = off + size;
+    if (next < heap_top) {
+        const nh = block_header(next);
+        if (is_free_large(nh)) {
+            unlink_large(next);
+            size += block_size(nh);
+        }
+    }
+
+    const prev_size = block_header(off).prev_size;
+    if (off > 0 and prev_size > 0) {
+        const prev = off - prev_size;
+        const ph = block_header(prev);
+        if (is_free_large(ph)) {
+            unlink_large(prev);
+            size += block_size(ph);
+            off = prev;
+        }
+    }
+
+    const h = block_header(off);
+    h.size = @intCast(size);
+
+    if (off + size == heap_top) {
+        heap_top = off;
+        top_prev_size = h.prev_size;
+        return;
+    }
+
+    set_prev_of_next(off, size);
+    insert_large(off);
+}
+
+// Trim a block down to `size`, returning the tail to the free lists
+fn split_large(off: usize, size: usize) void {
+    const h = block_header(off);
+    const total = block_size(h);
+    if (total - size < MIN_BLOCK_SIZE * 2) return;
+
+    h.size = @intCast(size | (h.size & FLAG_MASK));
+
+    const rest = off + size;
+    const rh = block_header(rest);
+    rh.size = @intCast(total - size);
+    rh.prev_size = @intCast(size);
+    set_prev_of_next(rest, total - size);
+    release_large(rest);
+}
+
+fn large_alloc(size: usize) ?usize {
+    var bin = large_bin_index(size);
+    while (bin < NUM_LARGE_BINS) : (bin += 1) {
+        var cur = large_bins[bin];
+        while (cur != NONE) : (cur = free_link(cur).next) {
+            if (block_size(block_header(cur)) >= size) {
+                unlink_large(cur);
+                block_header(cur).size |= FLAG_IN_USE;
+                split_large(cur, size);
+                return cur;
+            }
+        }
+    }
+
+    const off = carve_top(size) orelse return null;
+    block_header(off).size |= FLAG_IN_USE;
+    return off;
+}
+
+fn refill_small_class(class: usize) bool {
+    const class_size: usize = small_class_sizes[class];
+    const slab = large_alloc(@max(SLAB_SIZE, class_size)) orelse large_alloc(class_size) orelse return false;
+    const slab_size = block_size(block_header(slab));
+    const count = slab_size / class_size;
+
+    // Push in reverse so consecutive allocations walk forward through the slab
+    var i = count;
+    while (i > 0) {
+        i -= 1;
+        const off = slab + i * class_size;
+        const size = if (i == count - 1) slab_size - i * class_size else class_size;
+        const h = block_header(off);
+        h.size = @intCast(size | FLAG_SMALL);
+        h.prev_size = @intCast(class);
+        free_link(off).next = small_free[class];
+        small_free[class] = @intCast(off);
+    }
+
+    set_prev_of_next(slab + (count - 1) * class_size, slab_size - (count - 1) * class_size);
+    return true;
+}
+
+fn block_size_for(size: usize) ?usize {
+    if (size > pool_limit) return null;
+    const needed = std.mem.alignForward(usize, size + HEADER_SIZE, ALIGNMENT);
+    return @max(needed, MIN_BLOCK_SIZE);
+}
 
 // Renamed allocators to avoid conflicts
 export fn lua_malloc(size: usize) ?*anyopaque {
     if (size == 0) return null;
-    if (malloc_ptr + size > MALLOC_POOL_SIZE) return null;
-
-    const ptr = &malloc_pool[malloc_ptr];
-    malloc_ptr += size;
+    request_count +%= 1;
+    request_bytes +%= size;
+    const needed = block_size_for(size) orelse return null;
+
+    var off: usize = undefined;
+    var slot: usize = alloc_stats.LARGE_CLASS_SLOT;
+    if (needed <= MAX_SMALL_BLOCK) {
+        const class = small_class_lookup[needed / ALIGNMENT];
+        if (small_free[class] == NONE and !refill_small_class(class)) return null;
+        off = small_free[class];
+        small_free[class] = free_link(off).next;
+        block_header(off).size |= FLAG_IN_USE;
+        slot = class;
+    } else {
+        off = large_alloc(needed) orelse return null;
+    }
 
-    return @ptrCast(ptr);
+    bytes_in_use += block_size(block_header(off));
+    note_growth();
+    alloc_count +%= 1;
+    class_allocs[slot] +%= 1;
+    class_live[slot] +%= 1;
+    return @ptrCast(pool_base + off + HEADER_SIZE);
 }
 
 export fn lua_free(ptr: ?*anyopaque) void {
-    _ = ptr;
+    const p = ptr orelse return;
+    const off = payload_offset(p) orelse return;
+    const h = block_header(off);
+    if (h.size & FLAG_IN_USE == 0) return;
+
+    h.size &= ~FLAG_IN_USE;
+    bytes_in_use -= block_size(h);
+    free_count +%= 1;
+
+    if (h.size & FLAG_SMALL != 0) {
+        const class = h.prev_size;
+        class_live[class] -%= 1;
+        free_link(off).next = small_free[class];
+        small_free[class] = @intCast(off);
+    } else {
+        class_live[alloc_stats.LARGE_CLASS_SLOT] -%= 1;
+        release_large(off);
+    }
 }
 
-export fn lua_realloc(ptr: ?*anyopaque, size: usize) ?*anyopaque {
+// Try to resize the block at `off` to `needed` bytes without moving it
+fn resize_in_place(off: usize, needed: usize) bool {
+    const h = block_header(off);
+    const current = block_size(h);
+
+    if (h.size & FLAG_SMALL != 0) {
+        return needed <= current;
+    }
+
+    if (needed <= current) {
+        split_large(off, needed);
+        bytes_in_use -= current - block_size(h);
+        return true;
+    }
+
+    const next = off + current;
+    if (next == heap_top) {
+        if (needed - current > pool_limit - heap_top) return false;
+        if (!pool_reserve(off + needed)) return false;
+        heap_top = off + needed;
+        top_prev_size = @intCast(needed);
+        if (heap_top > dirty_top) dirty_top = heap_top;
+        h.size = @intCast(needed | (h.size & FLAG_MASK));
+        bytes_in_use += needed - current;
+        note_growth();
+        return true;
+    }
+
+    const nh = block_header(next);
+    if (!is_free_large(nh) or current + block_size(nh) < needed) return false;
+
+    unlink_large(next);
+    const merged = current + block_size(nh);
+    h.size = @intCast(merged | (h.size & FLAG_MASK));
+    set_prev_of_next(off, merged);
+    split_large(off, needed);
+    bytes_in_use += block_size(h) - current;
+    note_growth();
+    return true;
+}
+
+// Realloc for callers that know the old allocation size (Lua's allocator
+// contract passes it as `osize`), so the fallback copy never reads past it
+export fn lua_realloc_sized(ptr: ?*anyopaque, old_size: usize, size: usize) ?*anyopaque {
     if (size == 0) {
         lua_free(ptr);
         return null;
     }
 
-    const new_ptr = lua_malloc(size);
-    if (new_ptr == null) return null;
+    const old = ptr orelse return lua_malloc(size);
+    const off = payload_offset(old) orelse return null;
+    const needed = block_size_for(size) orelse return null;
 
-    if (ptr != null) {
-        @memcpy(@as([*]u8, @ptrCast(new_ptr))[0..size], @as([*]u8, @ptrCast(ptr))[0..size]);
+    if (resize_in_place(off, needed)) {
+        request_count +%= 1;
+        request_bytes +%= size;
+        return old;
     }
 
+    const old_usable = block_size(block_header(off)) - HEADER_SIZE;
+    const new_ptr = lua_malloc(size) orelse return null;
+    const copy_len = @min(@min(old_size, old_usable), size);
+    @memcpy(@as([*]u8, @ptrCast(new_ptr))[0..copy_len], @as([*]const u8, @ptrCast(old))[0..copy_len]);
+    lua_free(old);
+
     return new_ptr;
 }
 
+export fn lua_realloc(ptr: ?*anyopaque, size: usize) ?*anyopaque {
+    return lua_realloc_sized(ptr, std.math.maxInt(usize), size);
+}
+
 export fn lua_calloc(nmemb: usize, size: usize) ?*anyopaque {
     const total = nmemb *| size;
     if (total == 0) return null;
@@ -76,6 +460,63 @@ export fn calloc(nmemb: usize, size: usize) ?*anyopaque {
     return lua_calloc(nmemb, size);
 }
 
+// ============================================================================
+// Memory and string scanning
+// ============================================================================
+//
+// memcmp, memchr, strlen, strchr and memmove's backward copy sit under Lua's
+// string interning, string.find and luaL_Buffer growth. They work a block
+// at a time: 16 bytes with simd128 (the CU_SIMD=1 build), otherwise an 8-byte
+// word, searched with the borrow trick in match_bits. memcpy and memset
+// forward to bulk-memory memory.copy / memory.fill instead.
+//
+// strlen and strchr do not know where the string ends, so they scan aligned
+// blocks. An aligned block never spans two pages, so the read cannot reach
+// past the end of linear memory.
+
+const use_simd = std.Target.wasm.featureSetHas(builtin.cpu.features, .simd128);
+const BLOCK_SIZE: usize = if (use_simd) 16 else 8;
+const Block = if (use_simd) @Vector(16, u8) else u64;
+// One bit per matching lane (simd128), or the high bit of each matching byte
+const MatchBits = if (use_simd) u16 else u64;
+
+const LOW_BITS: u64 = 0x0101010101010101;
+const HIGH_BITS: u64 = 0x8080808080808080;
+
+inline fn load_block(p: [*]const u8) Block {
+    return @as(*align(1) const Block, @ptrCast(p)).*;
+}
+
+inline fn store_block(p: [*]u8, block: Block) void {
+    @as(*align(1) Block, @ptrCast(p)).* = block;
+}
+
+// Bytes of `block` equal to `byte`. The word variant can also flag bytes
+// above a true match (a borrow carries into them), never below it, so the
+// lowest bit is always the first match.
+inline fn match_bits(block: Block, byte: u8) MatchBits {
+    if (use_simd) {
+        return @bitCast(block == @as(Block, @splat(byte)));
+    } else {
+        const x = block ^ (LOW_BITS * byte);
+        return (x -% LOW_BITS) & ~x & HIGH_BITS;
+    }
+}
+
+// Bytes where `a` and `b` differ
+inline fn diff_bits(a: Block, b: Block) MatchBits {
+    if (use_simd) {
+        return @bitCast(a != b);
+    } else {
+        return a ^ b;
+    }
+}
+
+// Index of the first flagged byte; `bits` must be nonzero
+inline fn first_byte(bits: MatchBits) usize {
+    return if (use_simd) @ctz(bits) else @ctz(bits) / 8;
+}
+
 export fn memcpy(dest: *anyopaque, src: *const anyopaque, n: usize) *anyopaque {
     if (n > 0) {
         @memcpy(@as([*]u8, @ptrCast(dest))[0..n], @as([*]const u8, @ptrCast(src))[0..n]);
@@ -91,7 +532,13 @@ export fn memmove(dest: *anyopaque, src: *const anyopaque, n: usize) *anyopaque
         if (@intFromPtr(dest) <= @intFromPtr(src)) {
             @memcpy(dest_ptr[0..n], src_ptr[0..n]);
         } else {
+            // From the end down; each block is loaded before its store can
+            // overwrite it
             var i: usize = n;
+            while (i >= BLOCK_SIZE) {
+                i -= BLOCK_SIZE;
+                store_block(dest_ptr + i, load_block(src_ptr + i));
+            }
             while (i > 0) {
                 i -= 1;
                 dest_ptr[i] = src_ptr[i];
@@ -113,8 +560,16 @@ export fn memcmp(s1: *const anyopaque, s2: *const anyopaque, n: usize) c_int {
     const p1 = @as([*]const u8, @ptrCast(s1));
     const p2 = @as([*]const u8, @ptrCast(s2));
 
-    for (0..n) |i| {
-        const diff: c_int = @as(c_int, @intCast(p1[i])) - @as(c_int, @intCast(p2[i]));
+    var i: usize = 0;
+    while (i + BLOCK_SIZE <= n) : (i += BLOCK_SIZE) {
+        const bits = diff_bits(load_block(p1 + i), load_block(p2 + i));
+        if (bits != 0) {
+            const at = i + first_byte(bits);
+            return @as(c_int, p1[at]) - @as(c_int, p2[at]);
+        }
+    }
+    while (i < n) : (i += 1) {
+        const diff: c_int = @as(c_int, p1[i]) - @as(c_int, p2[i]);
         if (diff != 0) return diff;
     }
     return 0;
@@ -124,7 +579,12 @@ export fn memchr(s: *const anyopaque, c: c_int, n: usize) ?*anyopaque {
     const ptr = @as([*]const u8, @ptrCast(s));
     const byte: u8 = @as(u8, @intCast(c & 0xFF));
 
-    for (0..n) |i| {
+    var i: usize = 0;
+    while (i + BLOCK_SIZE <= n) : (i += BLOCK_SIZE) {
+        const bits = match_bits(load_block(ptr + i), byte);
+        if (bits != 0) return @ptrFromInt(@intFromPtr(s) + i + first_byte(bits));
+    }
+    while (i < n) : (i += 1) {
         if (ptr[i] == byte) {
             return @ptrFromInt(@intFromPtr(s) + i);
         }
@@ -133,11 +593,15 @@ export fn memchr(s: *const anyopaque, c: c_int, n: usize) ?*anyopaque {
 }
 
 export fn strlen(s: [*:0]const u8) usize {
+    const ptr: [*]const u8 = s;
     var len: usize = 0;
-    while (s[len] != 0) {
-        len += 1;
+    while ((@intFromPtr(ptr) + len) % BLOCK_SIZE != 0) : (len += 1) {
+        if (ptr[len] == 0) return len;
+    }
+    while (true) : (len += BLOCK_SIZE) {
+        const bits = match_bits(load_block(ptr + len), 0);
+        if (bits != 0) return len + first_byte(bits);
     }
-    return len;
 }
 
 export fn strcmp(s1: [*:0]const u8, s2: [*:0]const u8) c_int {
@@ -231,17 +695,21 @@ export fn strncat(dest: [*:0]u8, src: [*:0]const u8, n: usize) [*:0]u8 {
 
 export fn strchr(s: [*:0]const u8, c: c_int) ?[*]u8 {
     const char_to_find: u8 = @as(u8, @intCast(c & 0xFF));
+    const ptr: [*]const u8 = s;
     var i: usize = 0;
 
-    while (true) {
-        if (s[i] == char_to_find) {
-            return @as([*]u8, @ptrCast(@constCast(&s[i])));
+    while ((@intFromPtr(ptr) + i) % BLOCK_SIZE != 0) : (i += 1) {
+        if (ptr[i] == char_to_find) return @constCast(ptr + i);
+        if (ptr[i] == 0) return null;
+    }
+    while (true) : (i += BLOCK_SIZE) {
+        const block = load_block(ptr + i);
+        const bits = match_bits(block, char_to_find) | match_bits(block, 0);
+        if (bits != 0) {
+            const at = i + first_byte(bits);
+            return if (ptr[at] == char_to_find) @constCast(ptr + at) else null;
         }
-        if (s[i] == 0) break;
-        i += 1;
     }
-
-    return null;
 }
 
 export fn strstr(haystack: [*:0]const u8, needle: [*:0]const u8) ?[*]u8 {
@@ -310,6 +778,83 @@ export fn strpbrk(s: [*:0]const u8, accept: [*:0]const u8) ?[*:0]const u8 {
     return null;
 }
 
+// ============================================================================
+// UTF-8 validation
+// ============================================================================
+//
+// utf8.len (luai_utf8span in luaconf.h) hands its range here first. ASCII
+// goes a block at a time, with the loads of the scans above; a byte with
+// its high bit set starts a sequence checked against the well-formed
+// sequences of RFC 3629 (no overlong forms, surrogates or code points past
+// U+10FFFF), which lutf8lib.c decodes the same way in strict mode and in
+// lax mode. It takes over where this stops: at a sequence that is not
+// well formed, or that runs past `len`.
+
+// Bytes of `block` with their high bit set, in match_bits' form
+inline fn high_bits(block: Block) MatchBits {
+    if (use_simd) {
+        return @bitCast(block >= @as(Block, @splat(0x80)));
+    } else {
+        return block & HIGH_BITS;
+    }
+}
+
+// Length of the well-formed sequence at p[0..avail] led by a byte >= 0x80,
+// or 0
+fn sequence_len(p: [*]const u8, avail: usize) usize {
+    const lead = p[0];
+    const len: usize = switch (lead) {
+        0xC2...0xDF => 2,
+        0xE0...0xEF => 3,
+        0xF0...0xF4 => 4,
+        else => return 0,
+    };
+    if (avail < len) return 0;
+    // The second byte's range rules out overlong forms, surrogates and
+    // code points past U+10FFFF
+    const low: u8 = switch (lead) {
+        0xE0 => 0xA0,
+        0xF0 => 0x90,
+        else => 0x80,
+    };
+    const high: u8 = switch (lead) {
+        0xED => 0x9F,
+        0xF4 => 0x8F,
+        else => 0xBF,
+    };
+    if (p[1] < low or p[1] > high) return 0;
+    for (2..len) |i| {
+        if (p[i] & 0xC0 != 0x80) return 0;
+    }
+    return len;
+}
+
+/// The longest prefix of s[0..len] made of whole well-formed characters;
+/// their count goes to `nchars`
+export fn cu_utf8_span(s: [*]const u8, len: usize, nchars: *usize) usize {
+    var i: usize = 0;
+    var chars: usize = 0;
+    while (i < len) {
+        while (i + BLOCK_SIZE <= len) {
+            const bits = high_bits(load_block(s + i));
+            if (bits != 0) {
+                i += first_byte(bits);
+                chars += first_byte(bits);
+                break;
+            }
+            i += BLOCK_SIZE;
+            chars += BLOCK_SIZE;
+        }
+        if (i == len) break;
+        const seq = if (s[i] < 0x80) 1 else sequence_len(s + i, len - i);
+        if (seq == 0) break;
+        i += seq;
+        chars += 1;
+    }
+    nchars.* = chars;
+    return i;
+}
+
 export fn isalpha(c: c_int) c_int {
     const ch: u8 = @as(u8, @intCast(c & 0xFF));
     if ((ch >= 'A' and ch <= 'Z') or (ch >= 'a' and ch <= 'z')) {
@@ -505,96 +1050,60 @@ export fn strtol(nptr: [*:0]const u8, endptr: ?*[*:0]u8, base: c_int) c_long {
     return if (negative) -result else result;
 }
 
-export fn strtold(nptr: [*:0]const u8, endptr: ?*[*:0]u8) c_longdouble {
-    var result: c_longdouble = 0.0;
-    var i: usize = 0;
-    var negative = false;
-    var has_dot = false;
-    var has_digit = false;
-    var after_dot: usize = 0;
-
-    while (isspace(nptr[i]) != 0) {
-        i += 1;
-    }
-
-    if (nptr[i] == '-') {
-        negative = true;
-        i += 1;
-    } else if (nptr[i] == '+') {
-        i += 1;
-    }
-
-    while (nptr[i] != 0) {
-        if (nptr[i] == '.' and !has_dot) {
-            has_dot = true;
-            i += 1;
-            after_dot = 0;
-            continue;
-        }
-
-        if (isdigit(nptr[i]) != 0) {
-            has_digit = true;
-            result = result * 10.0 + @as(c_longdouble, @floatFromInt(nptr[i] - '0'));
-            if (has_dot) after_dot += 1;
-            i += 1;
-        } else if ((nptr[i] == 'e' or nptr[i] == 'E') and has_digit) {
-            i += 1;
-            var exp_sign: c_int = 1;
-            if (nptr[i] == '-') {
-                exp_sign = -1;
-                i += 1;
-            } else if (nptr[i] == '+') {
-                i += 1;
-            }
-
-            var exponent: c_int = 0;
-            while (isdigit(nptr[i]) != 0) {
-                exponent = exponent * 10 + @as(c_int, @intCast(nptr[i] - '0'));
-                i += 1;
-            }
-
-            var power: c_longdouble = 1.0;
-            var e: c_int = exponent * exp_sign;
-            var base: c_longdouble = 10.0;
-
-            while (e > 0) {
-                if (e & 1 != 0) power *= base;
-                base *= base;
-                e >>= 1;
-            }
-            while (e < 0) {
-                if (e & 1 != 0) power /= base;
-                base *= base;
-                e = -(-e >> 1);
-            }
-
-            result *= power;
-            break;
-        } else {
-            break;
-        }
-    }
-
-    var divisor: c_longdouble = 1.0;
-    for (0..after_dot) |_| {
-        divisor *= 10.0;
-    }
-    if (has_dot and divisor > 1.0) {
-        result /= divisor;
-    }
-
+// Conversion goes through float_conv.zig, which is correctly rounded
+export fn strtod(nptr: [*:0]const u8, endptr: ?*[*:0]u8) f64 {
+    const parsed = float_conv.parse(nptr);
     if (endptr) |ep| {
-        ep.* = @as([*:0]u8, @ptrCast(@constCast(&nptr[i])));
+        ep.* = @constCast(nptr + parsed.len);
     }
-
-    return if (negative) -result else result;
+    return parsed.value;
 }
 
-export fn strtod(nptr: [*:0]const u8, endptr: ?*[*:0]u8) f64 {
-    return @as(f64, @floatCast(strtold(nptr, endptr)));
+/// lua_str2number in the LUA_32BITS build; rounds the parsed double
+export fn strtof(nptr: [*:0]const u8, endptr: ?*[*:0]u8) f32 {
+    return @floatCast(strtod(nptr, endptr));
 }
 
+export fn strtold(nptr: [*:0]const u8, endptr: ?*[*:0]u8) c_longdouble {
+    return @as(c_longdouble, strtod(nptr, endptr));
+}
+
+/// lua_number2str (luaconf.h): the shortest text that reads back as `n`,
+/// so tostring and concatenation lose nothing
+export fn cu_number2str(buf: [*]u8, size: usize, n: f64) c_int {
+    var tmp: [float_conv.SHORTEST_BUFFER_SIZE]u8 = undefined;
+    const text = float_conv.shortest(&tmp, n);
+    const len = @min(text.len, size - 1);
+    @memcpy(buf[0..len], text[0..len]);
+    buf[len] = 0;
+    return @intCast(len);
+}
+
+/// luai_formatfloat (luaconf.h): the text of `magnitude` for one of
+/// string.format's float conversions, without sign or padding, which
+/// lstrlib.c adds as it copies the text into its buffer
+export fn cu_format_float(buf: [*]u8, size: usize, magnitude: f64, conv: c_int, precision: c_int, alt: c_int) c_int {
+    var tmp: [float_conv.FORMAT_BUFFER_SIZE]u8 = undefined;
+    const text = float_conv.format(&tmp, magnitude, .{
+        .conv = @intCast(conv),
+        .precision = if (precision >= 0) @intCast(precision) else null,
+        .alt = alt != 0,
+    });
+    const len = @min(text.len, size);
+    @memcpy(buf[0..len], text[0..len]);
+    return @intCast(len);
+}
+
+// deterministic.zig's virtual clock, when deterministic mode is on
+extern fn cu_virtual_time_ms(out: *f64) c_int;
+
 export fn time(tloc: ?*c_long) c_long {
+    var virtual_ms: f64 = 0;
+    if (cu_virtual_time_ms(&virtual_ms) != 0) {
+        const virtual_sec: c_long = @intFromFloat(std.math.clamp(@floor(virtual_ms / 1000), 0, 0x7FFFFFFF));
+        if (tloc) |t| t.* = virtual_sec;
+        return virtual_sec;
+    }
     const now_ms = js_time_now();
     const now_sec = @divTrunc(now_ms, 1000);
     // Ensure it fits in c_long range
@@ -605,8 +1114,13 @@ export fn time(tloc: ?*c_long) c_long {
     return result;
 }
 
-export fn clock() c_long {
-    return js_time_now();
+// Microseconds of the host's monotonic clock (CLOCKS_PER_SEC in time.h), so
+// os.clock() resolves sub-millisecond work. clock_t is 64-bit to hold them.
+// In deterministic mode both clocks read the virtual time.
+export fn clock() i64 {
+    var virtual_ms: f64 = 0;
+    if (cu_virtual_time_ms(&virtual_ms) != 0) return @intFromFloat(std.math.clamp(virtual_ms, 0, 1e15) * 1000);
+    return @intFromFloat(@max(js_clock_ms(), 0) * 1000);
 }
 
 // File I/O stubs (minimal implementation for WebAssembly)
@@ -743,110 +1257,263 @@ export fn atan2(y: f64, x: f64) f64 {
     return std.math.atan2(y, x);
 }
 
+// float versions for the LUA_32BITS build; compiler_rt has the rest
+
+export fn powf(x: f32, y: f32) f32 {
+    return std.math.pow(f32, x, y);
+}
+
+export fn ldexpf(x: f32, exp: c_int) f32 {
+    return std.math.ldexp(x, exp);
+}
+
+export fn frexpf(x: f32, exp: *c_int) f32 {
+    const result = std.math.frexp(x);
+    exp.* = result.exponent;
+    return result.significand;
+}
+
+export fn acosf(x: f32) f32 {
+    return std.math.acos(x);
+}
+
+export fn asinf(x: f32) f32 {
+    return std.math.asin(x);
+}
+
+export fn atan2f(y: f32, x: f32) f32 {
+    return std.math.atan2(y, x);
+}
+
 // String formatting
-export fn snprintf(buf: [*]u8, size: usize, format: [*:0]const u8, ...) c_int {
-    if (size == 0) return 0;
+//
+// snprintf covers the conversions Lua's string.format and its number
+// conversions use: flags (-+ #0), width and precision (digits or *), the
+// hh/h/l/ll/j/z/t/L length modifiers, and d i u o x X c s p f F e E g G a A.
+// Floating-point text comes from float_conv.zig. Like C, the return value
+// is the length of the full text, even when it did not fit.
+
+// Collects output into buf[0..cap] and counts everything past it
+const PrintfSink = struct {
+    buf: [*]u8,
+    cap: usize,
+    len: usize = 0,
+
+    fn byte(self: *PrintfSink, c: u8) void {
+        if (self.len < self.cap) self.buf[self.len] = c;
+        self.len += 1;
+    }
+
+    fn bytes(self: *PrintfSink, s: []const u8) void {
+        for (s) |c| self.byte(c);
+    }
+
+    fn repeat(self: *PrintfSink, c: u8, n: usize) void {
+        for (0..n) |_| self.byte(c);
+    }
+};
+
+const PrintfSpec = struct {
+    left: bool = false,
+    plus: bool = false,
+    space: bool = false,
+    alt: bool = false,
+    zero: bool = false,
+    width: usize = 0,
+    precision: ?usize = null,
+};
+
+// prefix (sign, 0x) then body, padded to the width; zero padding goes
+// between the two
+fn printf_padded(sink: *PrintfSink, spec: PrintfSpec, prefix: []const u8, body: []const u8, zero_pad: bool) void {
+    const len = prefix.len + body.len;
+    const pad = if (spec.width > len) spec.width - len else 0;
+    if (spec.left) {
+        sink.bytes(prefix);
+        sink.bytes(body);
+        sink.repeat(' ', pad);
+    } else if (zero_pad and spec.zero) {
+        sink.bytes(prefix);
+        sink.repeat('0', pad);
+        sink.bytes(body);
+    } else {
+        sink.repeat(' ', pad);
+        sink.bytes(prefix);
+        sink.bytes(body);
+    }
+}
+
+fn printf_sign(negative: bool, spec: PrintfSpec) []const u8 {
+    if (negative) return "-";
+    if (spec.plus) return "+";
+    if (spec.space) return " ";
+    return "";
+}
 
+fn printf_integer(sink: *PrintfSink, spec: PrintfSpec, magnitude: u64, negative: bool, conv: u8) void {
+    const base: u64 = switch (conv) {
+        'o' => 8,
+        'x', 'X', 'p' => 16,
+        else => 10,
+    };
+    const digits = if (conv == 'X') "0123456789ABCDEF" else "0123456789abcdef";
+
+    // Longest body: 22 octal digits, or a precision's worth of zeros
+    var tmp: [float_conv.MAX_PRECISION + 24]u8 = undefined;
+    var start = tmp.len;
+    var v = magnitude;
+    while (v != 0) : (v /= base) {
+        start -= 1;
+        tmp[start] = digits[@intCast(v % base)];
+    }
+    const min_digits = @min(spec.precision orelse 1, float_conv.MAX_PRECISION);
+    while (tmp.len - start < min_digits) {
+        start -= 1;
+        tmp[start] = '0';
+    }
+    // '#' makes an octal number start with 0
+    if (conv == 'o' and spec.alt and (start == tmp.len or tmp[start] != '0')) {
+        start -= 1;
+        tmp[start] = '0';
+    }
+
+    const prefix: []const u8 = switch (conv) {
+        'd', 'i' => printf_sign(negative, spec),
+        'x' => if (spec.alt and magnitude != 0) "0x" else "",
+        'X' => if (spec.alt and magnitude != 0) "0X" else "",
+        'p' => "0x",
+        else => "",
+    };
+    // A precision turns the 0 flag off for integers
+    printf_padded(sink, spec, prefix, tmp[start..], spec.precision == null);
+}
+
+fn printf_float(sink: *PrintfSink, spec: PrintfSpec, value: f64, conv: u8) void {
+    var tmp: [float_conv.FORMAT_BUFFER_SIZE]u8 = undefined;
+    const body = float_conv.format(&tmp, @abs(value), .{
+        .conv = conv,
+        .precision = spec.precision,
+        .alt = spec.alt,
+    });
+    const finite = !std.math.isNan(value) and !std.math.isInf(value);
+    printf_padded(sink, spec, printf_sign(std.math.signbit(value), spec), body, finite);
+}
+
+export fn snprintf(buf: [*]u8, size: usize, format: [*:0]const u8, ...) c_int {
     var args = @cVaStart();
     defer @cVaEnd(&args);
 
-    const fmt_len = strlen(format);
-    var out_idx: usize = 0;
-    var fmt_idx: usize = 0;
-
-    while (fmt_idx < fmt_len and out_idx < size - 1) : (fmt_idx += 1) {
-        if (format[fmt_idx] == '%') {
-            fmt_idx += 1;
-            if (fmt_idx >= fmt_len) break;
-
-            // Handle format specifiers
-            if (format[fmt_idx] == '%') {
-                // Literal %
-                buf[out_idx] = '%';
-                out_idx += 1;
-            } else if (format[fmt_idx] == 'd') {
-                // Integer (int)
-                const val = @cVaArg(&args, c_int);
-                const result = std.fmt.bufPrint(buf[out_idx .. size - 1], "{d}", .{val}) catch {
-                    buf[out_idx] = '0';
-                    out_idx += 1;
-                    continue;
+    var sink = PrintfSink{ .buf = buf, .cap = if (size > 0) size - 1 else 0 };
+    var i: usize = 0;
+    while (format[i] != 0) {
+        if (format[i] != '%') {
+            sink.byte(format[i]);
+            i += 1;
+            continue;
+        }
+        const spec_start = i;
+        i += 1;
+
+        var spec = PrintfSpec{};
+        while (true) : (i += 1) {
+            switch (format[i]) {
+                '-' => spec.left = true,
+                '+' => spec.plus = true,
+                ' ' => spec.space = true,
+                '#' => spec.alt = true,
+                '0' => spec.zero = true,
+                else => break,
+            }
+        }
+        if (format[i] == '*') {
+            const width = @cVaArg(&args, c_int);
+            if (width < 0) spec.left = true;
+            spec.width = @abs(width);
+            i += 1;
+        } else {
+            while (isdigit(format[i]) != 0) : (i += 1) spec.width = spec.width * 10 + (format[i] - '0');
+        }
+        if (format[i] == '.') {
+            i += 1;
+            if (format[i] == '*') {
+                const precision = @cVaArg(&args, c_int);
+                // A negative precision is taken as if it were omitted
+                spec.precision = if (precision >= 0) @intCast(precision) else null;
+                i += 1;
+            } else {
+                var precision: usize = 0;
+                while (isdigit(format[i]) != 0) : (i += 1) precision = precision * 10 + (format[i] - '0');
+                spec.precision = precision;
+            }
+        }
+
+        // Length modifier: the number of 'l's, or 'h'/'L'/... itself
+        var longs: u8 = 0;
+        var long_double = false;
+        while (true) : (i += 1) {
+            switch (format[i]) {
+                'l' => longs += 1,
+                'j' => longs = 2,
+                'L' => long_double = true,
+                'h', 'z', 't' => {},
+                else => break,
+            }
+        }
+
+        const conv = format[i];
+        switch (conv) {
+            '%' => sink.byte('%'),
+            'd', 'i' => {
+                const value: i64 = switch (longs) {
+                    0 => @cVaArg(&args, c_int),
+                    1 => @cVaArg(&args, c_long),
+                    else => @cVaArg(&args, c_longlong),
                 };
-                out_idx += result.len;
-            } else if (format[fmt_idx] == 'l') {
-                // Check for ll (long long)
-                if (fmt_idx + 1 < fmt_len and format[fmt_idx + 1] == 'l') {
-                    fmt_idx += 1;
-                    if (fmt_idx + 1 < fmt_len and format[fmt_idx + 1] == 'd') {
-                        fmt_idx += 1;
-                        // long long integer
-                        const val = @cVaArg(&args, c_longlong);
-                        const result = std.fmt.bufPrint(buf[out_idx .. size - 1], "{d}", .{val}) catch {
-                            buf[out_idx] = '0';
-                            out_idx += 1;
-                            continue;
-                        };
-                        out_idx += result.len;
-                    }
-                } else if (fmt_idx + 1 < fmt_len and format[fmt_idx + 1] == 'd') {
-                    fmt_idx += 1;
-                    // long integer
-                    const val = @cVaArg(&args, c_long);
-                    const result = std.fmt.bufPrint(buf[out_idx .. size - 1], "{d}", .{val}) catch {
-                        buf[out_idx] = '0';
-                        out_idx += 1;
-                        continue;
-                    };
-                    out_idx += result.len;
-                } else if (fmt_idx + 1 < fmt_len and format[fmt_idx + 1] == 'f') {
-                    fmt_idx += 1;
-                    // double
-                    const val = @cVaArg(&args, f64);
-                    const result = std.fmt.bufPrint(buf[out_idx .. size - 1], "{d}", .{val}) catch {
-                        buf[out_idx] = '0';
-                        out_idx += 1;
-                        continue;
-                    };
-                    out_idx += result.len;
-                }
-            } else if (format[fmt_idx] == 'f') {
-                // Float
-                const val = @cVaArg(&args, f64);
-                const result = std.fmt.bufPrint(buf[out_idx .. size - 1], "{d}", .{val}) catch {
-                    buf[out_idx] = '0';
-                    out_idx += 1;
-                    continue;
+                printf_integer(&sink, spec, @abs(value), value < 0, conv);
+            },
+            'u', 'o', 'x', 'X' => {
+                const value: u64 = switch (longs) {
+                    0 => @cVaArg(&args, c_uint),
+                    1 => @cVaArg(&args, c_ulong),
+                    else => @cVaArg(&args, c_ulonglong),
                 };
-                out_idx += result.len;
-            } else if (format[fmt_idx] == 's') {
-                // String
-                const str = @cVaArg(&args, [*:0]const u8);
-                const str_len = strlen(str);
-                const copy_len = @min(str_len, size - 1 - out_idx);
-                @memcpy(buf[out_idx .. out_idx + copy_len], str[0..copy_len]);
-                out_idx += copy_len;
-            } else if (format[fmt_idx] == 'c') {
-                // Character
-                const ch = @cVaArg(&args, c_int);
-                buf[out_idx] = @intCast(ch & 0xFF);
-                out_idx += 1;
-            } else {
-                // Unknown format, just copy the % and character
-                buf[out_idx] = '%';
-                out_idx += 1;
-                if (out_idx < size - 1) {
-                    buf[out_idx] = format[fmt_idx];
-                    out_idx += 1;
+                printf_integer(&sink, spec, value, false, conv);
+            },
+            'p' => {
+                const ptr = @cVaArg(&args, usize);
+                if (ptr == 0) {
+                    printf_padded(&sink, spec, "", "(nil)", false);
+                } else {
+                    printf_integer(&sink, .{ .left = spec.left, .width = spec.width }, ptr, false, 'p');
                 }
-            }
-        } else {
-            buf[out_idx] = format[fmt_idx];
-            out_idx += 1;
+            },
+            'c' => {
+                const ch: u8 = @truncate(@as(c_uint, @bitCast(@cVaArg(&args, c_int))));
+                printf_padded(&sink, spec, "", &[_]u8{ch}, false);
+            },
+            's' => {
+                const str = @cVaArg(&args, ?[*:0]const u8) orelse "(null)";
+                // With a precision the string need not be terminated
+                var len: usize = 0;
+                while ((spec.precision == null or len < spec.precision.?) and str[len] != 0) len += 1;
+                printf_padded(&sink, spec, "", str[0..len], false);
+            },
+            'f', 'F', 'e', 'E', 'g', 'G', 'a', 'A' => {
+                const value: f64 = if (long_double) @floatCast(@cVaArg(&args, c_longdouble)) else @cVaArg(&args, f64);
+                printf_float(&sink, spec, value, conv);
+            },
+            else => {
+                // Unknown conversion: copy it through
+                const end = if (conv == 0) i else i + 1;
+                sink.bytes(format[spec_start..end]);
+                if (conv == 0) break;
+            },
         }
+        i += 1;
     }
 
-    buf[out_idx] = 0;
-    return @as(c_int, @intCast(out_idx));
+    if (size > 0) buf[@min(sink.len, sink.cap)] = 0;
+    return @intCast(sink.len);
 }
 
 // Character class functions
@@ -971,64 +1638,142 @@ export fn llabs(x: c_longlong) c_longlong {
     return if (x < 0) -x else x;
 }
 
-pub fn qsort(base: *anyopaque, nmemb: usize, size: usize, compar: *const fn (*const anyopaque, *const anyopaque) c_int) void {
+// qsort is an introsort: quicksort with a median-of-three pivot, insertion
+// sort for short ranges and heapsort once the recursion gets deeper than
+// 2*log2(n), so sorted or adversarial input stays O(n log n). Recursion
+// only descends into the smaller side, which bounds the wasm stack depth.
+
+const INSERTION_SORT_CUTOFF: usize = 16;
+
+const Compar = *const fn (*const anyopaque, *const anyopaque) callconv(.c) c_int;
+
+export fn qsort(base: *anyopaque, nmemb: usize, size: usize, compar: Compar) void {
     if (nmemb <= 1 or size == 0) return;
 
-    const base_ptr = @as([*]u8, @ptrCast(base));
-    quicksort_impl(base_ptr, 0, @as(i32, @intCast(nmemb - 1)), size, compar);
+    const sorter = Sorter{ .base = @ptrCast(base), .size = size, .compar = compar };
+    sorter.introsort(0, nmemb, 2 * @as(usize, std.math.log2_int(usize, nmemb)));
 }
 
-fn quicksort_impl(
-    base_ptr: [*]u8,
-    low: i32,
-    high: i32,
+// Sorts the elements [lo, hi) of an array
+const Sorter = struct {
+    base: [*]u8,
     size: usize,
-    compar: *const fn (*const anyopaque, *const anyopaque) c_int,
-) void {
-    if (low >= high) return;
+    compar: Compar,
 
-    const pivot_idx = partition_impl(base_ptr, low, high, size, compar);
+    inline fn at(self: Sorter, i: usize) [*]u8 {
+        return self.base + i * self.size;
+    }
 
-    if (pivot_idx > 0) {
-        quicksort_impl(base_ptr, low, pivot_idx - 1, size, compar);
+    inline fn less(self: Sorter, i: usize, j: usize) bool {
+        return self.compar(self.at(i), self.at(j)) < 0;
     }
-    quicksort_impl(base_ptr, pivot_idx + 1, high, size, compar);
-}
 
-fn partition_impl(
-    base_ptr: [*]u8,
-    low: i32,
-    high: i32,
-    size: usize,
-    compar: *const fn (*const anyopaque, *const anyopaque) c_int,
-) i32 {
-    const pivot_offset: usize = @intCast(high * @as(i32, @intCast(size)));
-    var i = low - 1;
-    var j = low;
+    inline fn swap(self: Sorter, i: usize, j: usize) void {
+        swap_elements(self.at(i), self.at(j), self.size);
+    }
+
+    fn introsort(self: Sorter, start: usize, end: usize, depth_limit: usize) void {
+        var lo = start;
+        var hi = end;
+        var depth = depth_limit;
+        while (hi - lo > INSERTION_SORT_CUTOFF) {
+            if (depth == 0) {
+                self.heapsort(lo, hi);
+                return;
+            }
+            depth -= 1;
 
-    while (j < high) {
-        const j_offset: usize = @intCast(j * @as(i32, @intCast(size)));
-        const cmp_result = compar(&base_ptr[j_offset], &base_ptr[pivot_offset]);
+            const p = self.partition(lo, hi);
+            if (p - lo < hi - p) {
+                self.introsort(lo, p, depth);
+                lo = p + 1;
+            } else {
+                self.introsort(p + 1, hi, depth);
+                hi = p;
+            }
+        }
+        self.insertion_sort(lo, hi);
+    }
 
-        if (cmp_result < 0) {
+    // Orders a[lo] <= a[mid] <= a[hi - 1], parks the median at hi - 2 and
+    // partitions around it. a[lo] and the pivot stop both scans, so they
+    // need no bounds checks. Returns the pivot's final index.
+    fn partition(self: Sorter, lo: usize, hi: usize) usize {
+        const mid = lo + (hi - lo) / 2;
+        if (self.less(mid, lo)) self.swap(mid, lo);
+        if (self.less(hi - 1, mid)) {
+            self.swap(hi - 1, mid);
+            if (self.less(mid, lo)) self.swap(mid, lo);
+        }
+        const pivot = hi - 2;
+        self.swap(mid, pivot);
+
+        var i = lo;
+        var j = pivot;
+        while (true) {
             i += 1;
-            const i_offset: usize = @intCast(i * @as(i32, @intCast(size)));
-            swap_elements(base_ptr, i_offset, j_offset, size);
+            while (self.less(i, pivot)) i += 1;
+            j -= 1;
+            while (self.less(pivot, j)) j -= 1;
+            if (i >= j) break;
+            self.swap(i, j);
         }
-        j += 1;
+        self.swap(i, pivot);
+        return i;
     }
 
-    swap_elements(base_ptr, @intCast((i + 1) * @as(i32, @intCast(size))), pivot_offset, size);
-    return i + 1;
-}
+    fn insertion_sort(self: Sorter, lo: usize, hi: usize) void {
+        var i = lo + 1;
+        while (i < hi) : (i += 1) {
+            var j = i;
+            while (j > lo and self.less(j, j - 1)) : (j -= 1) {
+                self.swap(j, j - 1);
+            }
+        }
+    }
+
+    fn heapsort(self: Sorter, lo: usize, hi: usize) void {
+        const n = hi - lo;
+        var root = n / 2;
+        while (root > 0) {
+            root -= 1;
+            self.sift_down(lo, root, n);
+        }
+        var end = n;
+        while (end > 1) {
+            end -= 1;
+            self.swap(lo, lo + end);
+            self.sift_down(lo, 0, end);
+        }
+    }
 
-fn swap_elements(base_ptr: [*]u8, idx1: usize, idx2: usize, size: usize) void {
+    fn sift_down(self: Sorter, lo: usize, start: usize, n: usize) void {
+        var root = start;
+        while (true) {
+            var child = 2 * root + 1;
+            if (child >= n) return;
+            if (child + 1 < n and self.less(lo + child, lo + child + 1)) child += 1;
+            if (!self.less(lo + root, lo + child)) return;
+            self.swap(lo + root, lo + child);
+            root = child;
+        }
+    }
+};
+
+// Swap two elements a word at a time, then the remaining bytes
+fn swap_elements(a: [*]u8, b: [*]u8, size: usize) void {
     var i: usize = 0;
-    while (i < size) {
-        const tmp = base_ptr[idx1 + i];
-        base_ptr[idx1 + i] = base_ptr[idx2 + i];
-        base_ptr[idx2 + i] = tmp;
-        i += 1;
+    while (i + 8 <= size) : (i += 8) {
+        const wa: *align(1) u64 = @ptrCast(a + i);
+        const wb: *align(1) u64 = @ptrCast(b + i);
+        const tmp = wa.*;
+        wa.* = wb.*;
+        wb.* = tmp;
+    }
+    while (i < size) : (i += 1) {
+        const tmp = a[i];
+        a[i] = b[i];
+        b[i] = tmp;
     }
 }
 
@@ -1173,21 +1918,151 @@ export fn errno_addr() *c_int {
     return &errno_value;
 }
 
-export fn setjmp(env: *anyopaque) c_int {
-    _ = env;
-    return 0;
+pub fn malloc_stats() usize {
+    return bytes_in_use;
 }
 
-export fn longjmp(env: *anyopaque, val: c_int) noreturn {
-    _ = env;
-    _ = val;
-    unreachable;
+pub fn malloc_remaining() usize {
+    return pool_limit -| bytes_in_use;
 }
 
-pub fn malloc_stats() usize {
-    return malloc_ptr;
+/// Configure the Lua heap: commit `initial_bytes` now and allow growth up to
+/// `max_bytes`. The cap can be raised later but never below what is already
+/// committed. Returns 0 on success, -1 if the initial commit failed.
+export fn lua_heap_configure(initial_bytes: usize, max_bytes: usize) c_int {
+    pool_init();
+    const cap = std.mem.alignForward(usize, @max(max_bytes, @max(initial_bytes, MIN_HEAP_SIZE)), WASM_PAGE_SIZE);
+    pool_limit = @max(cap, pool_committed);
+    return if (pool_reserve(initial_bytes)) 0 else -1;
 }
 
-pub fn malloc_remaining() usize {
-    return MALLOC_POOL_SIZE -| malloc_ptr;
+export fn lua_heap_committed() usize {
+    return pool_committed;
+}
+
+export fn lua_heap_limit() usize {
+    return pool_limit;
+}
+
+/// Snapshot allocator telemetry. Walks the free lists, so cost is linear in
+/// the number of free blocks; meant for stats calls, not hot paths.
+export fn lua_allocator_stats(out: *alloc_stats.AllocatorStats) void {
+    var free_bytes: usize = 0;
+    var largest: usize = pool_limit -| heap_top;
+
+    if (pool_ready) {
+        for (small_free) |head| {
+            var off = head;
+            while (off != NONE) : (off = free_link(off).next) {
+                const size = block_size(block_header(off));
+                free_bytes += size;
+                largest = @max(largest, size);
+            }
+        }
+        for (large_bins) |head| {
+            var off = head;
+            while (off != NONE) : (off = free_link(off).next) {
+                const size = block_size(block_header(off));
+                free_bytes += size;
+                largest = @max(largest, size);
+            }
+        }
+    }
+
+    out.* = .{
+        .heap_committed = alloc_stats.clamp(pool_committed),
+        .heap_limit = alloc_stats.clamp(pool_limit),
+        .bytes_in_use = alloc_stats.clamp(bytes_in_use),
+        .high_water = alloc_stats.clamp(high_water),
+        .free_list_bytes = alloc_stats.clamp(free_bytes),
+        .largest_free_block = alloc_stats.clamp(largest),
+        .alloc_count = alloc_count,
+        .free_count = free_count,
+        .class_allocs = class_allocs,
+        .class_live = class_live,
+    };
+}
+
+// Zero a free block past its free-list link, so a page holding only free
+// space reads the same as one never written
+fn zero_free_payload(off: usize, size: usize) void {
+    if (size > MIN_BLOCK_SIZE) @memset((pool_base + off + MIN_BLOCK_SIZE)[0 .. size - MIN_BLOCK_SIZE], 0);
+}
+
+// File a run of adjacent free blocks found by lua_heap_trim, either as one
+// large block or as its small blocks back on their class lists. Returns
+// the size of the run's last block, the predecessor of what follows.
+fn file_free_run(start: usize, end: usize, prev_size: Offset, merge: bool) Offset {
+    if (merge) {
+        const h = block_header(start);
+        h.size = @intCast(end - start);
+        h.prev_size = prev_size;
+        zero_free_payload(start, end - start);
+        insert_large(start);
+        return @intCast(end - start);
+    }
+
+    var off = start;
+    var size: usize = 0;
+    while (off < end) : (off += size) {
+        const h = block_header(off);
+        size = block_size(h);
+        free_link(off).next = small_free[h.prev_size];
+        small_free[h.prev_size] = @intCast(off);
+        zero_free_payload(off, size);
+    }
+    return @intCast(size);
+}
+
+/// Compact the pool's free space in one walk over every block. Adjacent
+/// free blocks merge, small ones included: a run holding a large block or
+/// a slab's worth of small ones becomes one large free block, so slabs
+/// emptied after a spike serve any size again. Free space at the end goes
+/// back to the top. Free payloads and the pool above the top are zeroed,
+/// so a snapshot's page diff skips them, and the high-water mark restarts
+/// from the bytes in use. Live blocks never move. Returns the bytes between
+/// the new top and the highest the top had reached since the last trim.
+export fn lua_heap_trim() usize {
+    if (!pool_ready) return 0;
+    small_free = [_]Offset{NONE} ** NUM_SMALL_CLASSES;
+    large_bins = [_]Offset{NONE} ** NUM_LARGE_BINS;
+
+    var off: usize = 0;
+    var prev_size: Offset = 0;
+    var run_start: ?usize = null;
+    var run_large = false;
+    while (off < heap_top) {
+        const h = block_header(off);
+        const size = block_size(h);
+        if (h.size & FLAG_IN_USE == 0) {
+            if (run_start == null) {
+                run_start = off;
+                run_large = false;
+            }
+            if (h.size & FLAG_SMALL == 0) run_large = true;
+        } else {
+            if (run_start) |start| {
+                prev_size = file_free_run(start, off, prev_size, run_large or off - start >= SLAB_SIZE);
+                run_start = null;
+            }
+            if (h.size & FLAG_SMALL == 0) h.prev_size = prev_size;
+            prev_size = @intCast(size);
+        }
+        off += size;
+    }
+    if (run_start) |start| heap_top = start;
+    top_prev_size = prev_size;
+
+    const released = dirty_top - heap_top;
+    @memset((pool_base + heap_top)[0..released], 0);
+    dirty_top = heap_top;
+    high_water = bytes_in_use;
+    return released;
+}
+
+/// Allocation and resize requests since start, and the bytes they asked for
+/// (perf_counters.zig)
+export fn lua_allocator_totals(calls: *u64, bytes: *u64) void {
+    calls.* = request_count;
+    bytes.* = request_bytes;
 }
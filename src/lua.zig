@@ -1,3 +1,5 @@
+const std = @import("std");
+
 pub const c = @cImport({
     @cInclude("lua.h");
     @cInclude("lauxlib.h");
@@ -27,6 +29,28 @@ pub fn dostring(L: *lua_State, code: [*:0]const u8) c_int {
     return c.lua_pcallk(L, 0, -1, 0, 0, null);
 }
 
+pub inline fn loadbuffer(L: *lua_State, buf: []const u8, chunkname: [*:0]const u8) c_int {
+    return c.luaL_loadbufferx(L, buf.ptr, buf.len, chunkname, null);
+}
+
+pub inline fn pcall(L: *lua_State, nargs: c_int, nresults: c_int) c_int {
+    return c.lua_pcallk(L, nargs, nresults, 0, 0, null);
+}
+
+/// Pop the top value into the registry and return its reference
+pub inline fn ref(L: *lua_State) c_int {
+    return c.luaL_ref(L, c.LUA_REGISTRYINDEX);
+}
+
+pub inline fn unref(L: *lua_State, r: c_int) void {
+    c.luaL_unref(L, c.LUA_REGISTRYINDEX, r);
+}
+
+/// Push the registry value stored under reference `r`
+pub inline fn getref(L: *lua_State, r: c_int) c_int {
+    return c.lua_rawgeti(L, c.LUA_REGISTRYINDEX, r);
+}
+
 pub inline fn tolstring(L: *lua_State, idx: c_int, out_len: *usize) [*:0]const u8 {
     return c.lua_tolstring(L, idx, out_len);
 }
@@ -68,12 +92,18 @@ pub inline fn pushlstring(L: *lua_State, s: [*]const u8, str_len: usize) [*:0]co
     return c.lua_pushlstring(L, s, str_len);
 }
 
-pub inline fn pushinteger(L: *lua_State, n: c.lua_Integer) void {
-    c.lua_pushinteger(L, n);
+// Host values are 64-bit; in a LUA_32BITS build an integer that does not
+// fit lua_Integer arrives as a float, and floats are rounded to single
+pub inline fn pushinteger(L: *lua_State, n: i64) void {
+    if (std.math.cast(c.lua_Integer, n)) |int_val| {
+        c.lua_pushinteger(L, int_val);
+    } else {
+        c.lua_pushnumber(L, @floatFromInt(n));
+    }
 }
 
-pub inline fn pushnumber(L: *lua_State, n: c.lua_Number) void {
-    c.lua_pushnumber(L, n);
+pub inline fn pushnumber(L: *lua_State, n: f64) void {
+    c.lua_pushnumber(L, @floatCast(n));
 }
 
 pub inline fn pushboolean(L: *lua_State, b: c_int) void {
@@ -155,3 +185,32 @@ pub inline fn getmetatable(L: *lua_State, idx: c_int) c_int {
 pub inline fn luaL_newmetatable(L: *lua_State, tname: [*:0]const u8) c_int {
     return c.luaL_newmetatable(L, tname);
 }
+
+pub inline fn gc_collect(L: *lua_State) void {
+    _ = c.lua_gc(L, c.LUA_GCCOLLECT);
+}
+
+/// Perform an incremental step of roughly `kb` kilobytes of work (0 = one
+/// basic step). Returns true if the step finished a collection cycle.
+pub inline fn gc_step(L: *lua_State, kb: c_int) bool {
+    return c.lua_gc(L, c.LUA_GCSTEP, kb) != 0;
+}
+
+/// Switch to generational mode; a multiplier of 0 keeps its current value.
+/// Returns the previous mode.
+pub inline fn gc_generational(L: *lua_State, minor_mul: c_int, major_mul: c_int) c_int {
+    return c.lua_gc(L, c.LUA_GCGEN, minor_mul, major_mul);
+}
+
+/// Switch to incremental mode; a parameter of 0 keeps its current value.
+/// Returns the previous mode.
+pub inline fn gc_incremental(L: *lua_State, pause: c_int, step_mul: c_int) c_int {
+    return c.lua_gc(L, c.LUA_GCINC, pause, step_mul, @as(c_int, 0));
+}
+
+/// Bytes currently held by the Lua state, as tracked by the collector
+pub inline fn gc_count_bytes(L: *lua_State) usize {
+    const kb: usize = @intCast(c.lua_gc(L, c.LUA_GCCOUNT));
+    const rem: usize = @intCast(c.lua_gc(L, c.LUA_GCCOUNTB));
+    return kb * 1024 + rem;
+}
@@ -766,12 +766,24 @@ LUA_API void lua_createtable (lua_State *L, int narray, int nrec) {
   sethvalue2s(L, L->top.p, t);
   api_incr_top(L);
   if (narray > 0 || nrec > 0)
-    luaH_resize(L, t, narray, nrec);
+    luaH_presize(L, t, narray, nrec);
   luaC_checkGC(L);
   lua_unlock(L);
 }
 
 
+/*
+** Empty the table at 'idx' in place; it keeps its allocated size
+*/
+LUA_API void lua_cleartable (lua_State *L, int idx) {
+  Table *t;
+  lua_lock(L);
+  t = gettable(L, idx);
+  luaH_clear(L, t);
+  lua_unlock(L);
+}
+
+
 LUA_API int lua_getmetatable (lua_State *L, int objindex) {
   const TValue *obj;
   Table *mt;
@@ -880,7 +892,7 @@ LUA_API void lua_seti (lua_State *L, int idx, lua_Integer n) {
   lua_lock(L);
   api_checknelems(L, 1);
   t = index2value(L, idx);
-  if (luaV_fastgeti(L, t, n, slot)) {
+  if (luaV_fastseti(L, t, n, slot, s2v(L->top.p - 1))) {
     luaV_finishfastset(L, t, slot, s2v(L->top.p - 1));
   }
   else {
@@ -1107,6 +1119,37 @@ LUA_API int lua_load (lua_State *L, lua_Reader reader, void *data,
 }
 
 
+/*
+** Push a new closure over the prototype of the Lua function at 'idx',
+** with upvalues as 'lua_load' leaves them: the globals table first, nil
+** for the rest. Lets a host load a bytecode blob once and make any number
+** of closures from it. Returns 0, pushing nothing, for other values.
+*/
+LUA_API int lua_clonefunction (lua_State *L, int idx) {
+  const TValue *o;
+  LClosure *cl;
+  lua_lock(L);
+  o = index2value(L, idx);
+  if (!isLfunction(o)) {
+    lua_unlock(L);
+    return 0;
+  }
+  cl = luaF_newLclosure(L, clLvalue(o)->nupvalues);
+  setclLvalue2s(L, L->top.p, cl);
+  api_incr_top(L);
+  cl->p = getproto(o);
+  luaC_objbarrier(L, cl, cl->p);
+  luaF_initupvals(L, cl);
+  if (cl->nupvalues >= 1) {
+    const TValue *gt = getGtable(L);
+    setobj(L, cl->upvals[0]->v.p, gt);
+    luaC_barrier(L, cl->upvals[0], gt);
+  }
+  lua_unlock(L);
+  return 1;
+}
+
+
 LUA_API int lua_dump (lua_State *L, lua_Writer writer, void *data, int strip) {
   int status;
   TValue *o;
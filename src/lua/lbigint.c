@@ -4,58 +4,147 @@
 ** Provides Lua bindings to Zig bigint implementation
 */
 
+#include <string.h>
+
 #include "lua.h"
 #include "lauxlib.h"
 
+#include "lbigint.h"
+
 /*
-** Metatable name for bigint userdata type identification
+** Helper function: check and return BigInt
+** Validates that the Lua value at index is a bigint userdata
+** Raises Lua error if type check fails
 */
-#define BIGINT_METATABLE "Cu.BigInt"
+static BigInt* check_bigint(lua_State* L, int index) {
+    return (BigInt*)luaL_checkudata(L, index, BIGINT_METATABLE);
+}
 
 /*
-** BigInt userdata structure
-** Wraps an opaque Zig bigint handle
+** Push a new bigint, 0 until set, with room for `cap` limbs
 */
-typedef struct BigIntUserdata {
-    void* handle;  /* Opaque pointer to Zig std.math.big.int.Managed */
-} BigIntUserdata;
+static BigInt* push_bigint(lua_State* L, size_t cap) {
+    BigInt* b;
+    if (cap > ((size_t)-1 - sizeof(BigInt)) / sizeof(BigIntLimb)) {
+        luaL_error(L, "bigint too large");
+    }
+    b = (BigInt*)lua_newuserdatauv(L, sizeof(BigInt) + cap * sizeof(BigIntLimb), 1);
+    b->limbs = (BigIntLimb*)(b + 1);
+    b->limbs[0] = 0;
+    b->len = 1;
+    b->cap = cap;
+    b->positive = 1;
+    luaL_setmetatable(L, BIGINT_METATABLE);
+    return b;
+}
+
+/* Make room for `n` limbs in the bigint at `index`, keeping its value */
+static void bigint_reserve(lua_State* L, BigInt* b, int index, size_t n) {
+    size_t cap = b->cap;
+    BigIntLimb* limbs;
+    if (cap >= n) return;
+    if (n > (size_t)-1 / 2 / sizeof(BigIntLimb)) luaL_error(L, "bigint too large");
+    while (cap < n) cap *= 2;
+    limbs = (BigIntLimb*)lua_newuserdatauv(L, cap * sizeof(BigIntLimb), 0);
+    memcpy(limbs, b->limbs, b->len * sizeof(BigIntLimb));
+    lua_setiuservalue(L, index, 1);
+    b->limbs = limbs;
+    b->cap = cap;
+}
+
+static const char* const op_errors[] = {
+    "bigint addition failed",
+    "bigint subtraction failed",
+    "bigint multiplication failed",
+    "bigint division failed (division by zero?)",
+    "bigint modulo failed (division by zero?)",
+    "bigint and failed",
+    "bigint or failed",
+    "bigint xor failed",
+    "bigint gcd failed"
+};
 
 /*
-** External Zig bigint functions
-** These are implemented in src/bignum.zig and exported to WASM
+** Room for an integer operand, which is viewed as a bigint over limbs on
+** the C stack instead of becoming a bigint first
 */
+typedef struct Operand {
+    BigInt value;
+    BigIntLimb limbs[BIGINT_I64_LIMBS];
+} Operand;
 
-/* Constructor functions */
-extern void* bigint_new_from_string(const char* str, size_t len, int base);
-extern void* bigint_new_from_i64(long long val);
-
-/* Memory management */
-extern void bigint_free(void* handle);
+static const BigInt* set_operand(Operand* operand, long long value) {
+    operand->value.limbs = operand->limbs;
+    operand->value.cap = BIGINT_I64_LIMBS;
+    bigint_set_i64(&operand->value, value);
+    return &operand->value;
+}
 
-/* Arithmetic operations - return new bigint handle */
-extern void* bigint_add(void* a, void* b);
-extern void* bigint_sub(void* a, void* b);
-extern void* bigint_mul(void* a, void* b);
-extern void* bigint_div(void* a, void* b);
-extern void* bigint_mod(void* a, void* b);
+/* The bigint or integer at `index` as a bigint, or NULL if it is neither */
+static const BigInt* to_operand(lua_State* L, int index, Operand* operand) {
+    BigInt* b = (BigInt*)luaL_testudata(L, index, BIGINT_METATABLE);
+    lua_Integer value;
+    int isint;
+    if (b != NULL) return b;
+    if (lua_type(L, index) != LUA_TNUMBER) return NULL;
+    value = lua_tointegerx(L, index, &isint);
+    if (!isint) return NULL;
+    return set_operand(operand, (long long)value);
+}
 
-/* Comparison - returns -1, 0, or 1 */
-extern int bigint_compare(void* a, void* b);
+static const BigInt* check_operand(lua_State* L, int index, Operand* operand) {
+    const BigInt* b = to_operand(L, index, operand);
+    if (b == NULL) {
+        luaL_typeerror(L, index, "bigint or integer");
+    }
+    return b;
+}
 
-/* String conversion - returns length written (or -1 on error) */
-extern int bigint_to_string(void* handle, int base, char* buf, size_t max_len);
+static int arith(lua_State* L, int op) {
+    Operand sa, sb;
+    const BigInt* a = check_operand(L, 1, &sa);
+    const BigInt* b = check_operand(L, 2, &sb);
+    BigInt* r;
+    if (a == &sa.value && b == &sb.value) check_bigint(L, 1);
+    r = push_bigint(L, bigint_result_limbs(a, b, op));
+    if (bigint_apply(r, a, b, op) != 0) {
+        return luaL_error(L, "%s", op_errors[op]);
+    }
+    return 1;
+}
 
 /*
-** Helper function: check and return BigIntUserdata
-** Validates that the Lua value at index is a bigint userdata
-** Raises Lua error if type check fails
+** Update the bigint at `index` to self op b; add, sub and mul only. Other
+** references to self see the new value.
 */
-static BigIntUserdata* check_bigint(lua_State* L, int index) {
-    BigIntUserdata* ud = (BigIntUserdata*)luaL_checkudata(L, index, BIGINT_METATABLE);
-    if (ud->handle == NULL) {
-        luaL_error(L, "invalid bigint (freed or null handle)");
+static void update(lua_State* L, BigInt* self, int index, const BigInt* b, int op) {
+    bigint_reserve(L, self, index, bigint_result_limbs(self, b, op));
+    if (bigint_apply(self, self, b, op) != 0) {
+        luaL_error(L, "%s", op_errors[op]);
     }
-    return ud;
+}
+
+static int arith_in_place(lua_State* L, int op) {
+    BigInt* self = check_bigint(L, 1);
+    Operand sb;
+    update(L, self, 1, check_operand(L, 2, &sb), op);
+    lua_settop(L, 1);
+    return 1;
+}
+
+static int is_zero(const BigInt* b) {
+    return b->len == 1 && b->limbs[0] == 0;
+}
+
+/*
+** Order of the operands at 1 and 2. Metamethods are only called with at
+** least one bigint.
+*/
+static int compare(lua_State* L) {
+    Operand sa, sb;
+    const BigInt* a = check_operand(L, 1, &sa);
+    const BigInt* b = check_operand(L, 2, &sb);
+    return bigint_compare(a, b);
 }
 
 /*
@@ -75,39 +164,32 @@ static BigIntUserdata* check_bigint(lua_State* L, int index) {
 **   local c = bigint.new("DEADBEEF", 16)
 */
 static int l_bigint_new(lua_State* L) {
-    void* handle = NULL;
-    
     if (lua_type(L, 1) == LUA_TSTRING) {
         /* String construction with optional base */
         size_t len;
         const char* str = lua_tolstring(L, 1, &len);
         int base = (int)luaL_optinteger(L, 2, 10);
+        BigInt* b;
         
         if (base < 2 || base > 36) {
             return luaL_error(L, "base must be between 2 and 36");
         }
         
-        handle = bigint_new_from_string(str, len, base);
+        b = push_bigint(L, bigint_string_limbs(len, base));
+        if (bigint_set_string(b, str, len, base) != 0) {
+            return luaL_error(L, "failed to create bigint");
+        }
         
     } else if (lua_type(L, 1) == LUA_TNUMBER) {
-        /* Number construction */
+        /* Number construction, with a spare limb so accumulating starts in place */
         long long val = (long long)lua_tointeger(L, 1);
-        handle = bigint_new_from_i64(val);
+        bigint_set_i64(push_bigint(L, BIGINT_I64_LIMBS + 1), val);
         
     } else {
         return luaL_error(L, "bigint.new expects string or number, got %s", 
                          lua_typename(L, lua_type(L, 1)));
     }
     
-    if (handle == NULL) {
-        return luaL_error(L, "failed to create bigint");
-    }
-    
-    /* Create userdata and attach metatable */
-    BigIntUserdata* ud = (BigIntUserdata*)lua_newuserdata(L, sizeof(BigIntUserdata));
-    ud->handle = handle;
-    luaL_setmetatable(L, BIGINT_METATABLE);
-    
     return 1;
 }
 
@@ -116,25 +198,13 @@ static int l_bigint_new(lua_State* L) {
 ** Addition method for bigint arithmetic
 **
 ** Args:
-**   other: another bigint
+**   other: another bigint or an integer
 **
 ** Returns:
 **   new bigint representing self + other
 */
 static int l_bigint_add(lua_State* L) {
-    BigIntUserdata* a = check_bigint(L, 1);
-    BigIntUserdata* b = check_bigint(L, 2);
-    
-    void* result = bigint_add(a->handle, b->handle);
-    if (result == NULL) {
-        return luaL_error(L, "bigint addition failed");
-    }
-    
-    BigIntUserdata* ud = (BigIntUserdata*)lua_newuserdata(L, sizeof(BigIntUserdata));
-    ud->handle = result;
-    luaL_setmetatable(L, BIGINT_METATABLE);
-    
-    return 1;
+    return arith(L, BIGINT_ADD);
 }
 
 /*
@@ -142,25 +212,13 @@ static int l_bigint_add(lua_State* L) {
 ** Subtraction method for bigint arithmetic
 **
 ** Args:
-**   other: another bigint
+**   other: another bigint or an integer
 **
 ** Returns:
 **   new bigint representing self - other
 */
 static int l_bigint_sub(lua_State* L) {
-    BigIntUserdata* a = check_bigint(L, 1);
-    BigIntUserdata* b = check_bigint(L, 2);
-    
-    void* result = bigint_sub(a->handle, b->handle);
-    if (result == NULL) {
-        return luaL_error(L, "bigint subtraction failed");
-    }
-    
-    BigIntUserdata* ud = (BigIntUserdata*)lua_newuserdata(L, sizeof(BigIntUserdata));
-    ud->handle = result;
-    luaL_setmetatable(L, BIGINT_METATABLE);
-    
-    return 1;
+    return arith(L, BIGINT_SUB);
 }
 
 /*
@@ -168,25 +226,13 @@ static int l_bigint_sub(lua_State* L) {
 ** Multiplication method for bigint arithmetic
 **
 ** Args:
-**   other: another bigint
+**   other: another bigint or an integer
 **
 ** Returns:
 **   new bigint representing self * other
 */
 static int l_bigint_mul(lua_State* L) {
-    BigIntUserdata* a = check_bigint(L, 1);
-    BigIntUserdata* b = check_bigint(L, 2);
-    
-    void* result = bigint_mul(a->handle, b->handle);
-    if (result == NULL) {
-        return luaL_error(L, "bigint multiplication failed");
-    }
-    
-    BigIntUserdata* ud = (BigIntUserdata*)lua_newuserdata(L, sizeof(BigIntUserdata));
-    ud->handle = result;
-    luaL_setmetatable(L, BIGINT_METATABLE);
-    
-    return 1;
+    return arith(L, BIGINT_MUL);
 }
 
 /*
@@ -194,25 +240,13 @@ static int l_bigint_mul(lua_State* L) {
 ** Division method for bigint arithmetic
 **
 ** Args:
-**   other: another bigint (must be non-zero)
+**   other: another bigint or an integer (must be non-zero)
 **
 ** Returns:
-**   new bigint representing floor(self / other)
+**   new bigint representing self / other, truncated toward zero
 */
 static int l_bigint_div(lua_State* L) {
-    BigIntUserdata* a = check_bigint(L, 1);
-    BigIntUserdata* b = check_bigint(L, 2);
-    
-    void* result = bigint_div(a->handle, b->handle);
-    if (result == NULL) {
-        return luaL_error(L, "bigint division failed (division by zero?)");
-    }
-    
-    BigIntUserdata* ud = (BigIntUserdata*)lua_newuserdata(L, sizeof(BigIntUserdata));
-    ud->handle = result;
-    luaL_setmetatable(L, BIGINT_METATABLE);
-    
-    return 1;
+    return arith(L, BIGINT_DIV);
 }
 
 /*
@@ -220,27 +254,191 @@ static int l_bigint_div(lua_State* L) {
 ** Modulo method for bigint arithmetic
 **
 ** Args:
-**   other: another bigint (must be non-zero)
+**   other: another bigint or an integer (must be non-zero)
 **
 ** Returns:
 **   new bigint representing self % other
 */
 static int l_bigint_mod(lua_State* L) {
-    BigIntUserdata* a = check_bigint(L, 1);
-    BigIntUserdata* b = check_bigint(L, 2);
-    
-    void* result = bigint_mod(a->handle, b->handle);
-    if (result == NULL) {
-        return luaL_error(L, "bigint modulo failed (division by zero?)");
+    return arith(L, BIGINT_MOD);
+}
+
+/*
+** bigint:addInPlace(other), bigint:subInPlace(other), bigint:mulInPlace(other)
+** Update self instead of making a new bigint, reusing its limbs. Meant for
+** accumulators; other references to self see the change.
+**
+** Args:
+**   other: another bigint or an integer
+**
+** Returns:
+**   self, so calls chain
+*/
+static int l_bigint_add_in_place(lua_State* L) {
+    return arith_in_place(L, BIGINT_ADD);
+}
+
+static int l_bigint_sub_in_place(lua_State* L) {
+    return arith_in_place(L, BIGINT_SUB);
+}
+
+static int l_bigint_mul_in_place(lua_State* L) {
+    return arith_in_place(L, BIGINT_MUL);
+}
+
+/*
+** bigint.sum(list)
+** Sum of a sequence of bigints and integers, made as one bigint
+**
+** Returns:
+**   new bigint (0 for an empty list)
+*/
+static int l_bigint_sum(lua_State* L) {
+    lua_Integer n, i;
+    BigInt* total;
+    int index;
+    luaL_checktype(L, 1, LUA_TTABLE);
+    n = luaL_len(L, 1);
+    total = push_bigint(L, BIGINT_I64_LIMBS + 1);
+    index = lua_gettop(L);
+    for (i = 1; i <= n; i++) {
+        Operand storage;
+        const BigInt* item;
+        lua_geti(L, 1, i);
+        item = to_operand(L, -1, &storage);
+        if (item == NULL) {
+            return luaL_error(L, "bigint.sum: item %I is not a bigint or integer", (LUAI_UACINT)i);
+        }
+        update(L, total, index, item, BIGINT_ADD);
+        lua_pop(L, 1);
+    }
+    return 1;
+}
+
+/*
+** bigint:band(other), bigint:bor(other), bigint:bxor(other)
+** Bitwise and, or and xor, also as the &, | and ~ operators. Negative
+** numbers behave as two's complement with infinitely many sign bits, as
+** Lua integers do.
+**
+** Args:
+**   other: another bigint or an integer
+**
+** Returns:
+**   new bigint
+*/
+static int l_bigint_band(lua_State* L) {
+    return arith(L, BIGINT_BAND);
+}
+
+static int l_bigint_bor(lua_State* L) {
+    return arith(L, BIGINT_BOR);
+}
+
+static int l_bigint_bxor(lua_State* L) {
+    return arith(L, BIGINT_BXOR);
+}
+
+/*
+** bigint:bnot() / ~a
+** Returns:
+**   new bigint representing -self - 1
+*/
+static int l_bigint_bnot(lua_State* L) {
+    BigInt* a = check_bigint(L, 1);
+    Operand minus_one;
+    const BigInt* b = set_operand(&minus_one, -1);
+    BigInt* r = push_bigint(L, bigint_result_limbs(b, a, BIGINT_SUB));
+    if (bigint_apply(r, b, a, BIGINT_SUB) != 0) {
+        return luaL_error(L, "%s", op_errors[BIGINT_SUB]);
+    }
+    return 1;
+}
+
+static int shift(lua_State* L, lua_Integer n) {
+    Operand sa;
+    const BigInt* a = check_operand(L, 1, &sa);
+    BigInt* r = push_bigint(L, bigint_shift_limbs(a, (long long)n));
+    bigint_shift(r, a, (long long)n);
+    return 1;
+}
+
+/*
+** bigint:shl(n), bigint:shr(n)
+** Shift left or right by n bits, also as the << and >> operators. A
+** negative n shifts the other way. Right shifts round toward negative
+** infinity, like floor division by 2^n.
+**
+** Returns:
+**   new bigint
+*/
+static int l_bigint_shl(lua_State* L) {
+    return shift(L, luaL_checkinteger(L, 2));
+}
+
+static int l_bigint_shr(lua_State* L) {
+    lua_Integer n = luaL_checkinteger(L, 2);
+    return shift(L, n == LUA_MININTEGER ? LUA_MAXINTEGER : -n);
+}
+
+/*
+** bigint.gcd(a, b) / a:gcd(b)
+** Returns:
+**   new bigint, the greatest common divisor of |a| and |b| (0 for two
+**   zeros)
+*/
+static int l_bigint_gcd(lua_State* L) {
+    return arith(L, BIGINT_GCD);
+}
+
+/*
+** bigint.powmod(base, exponent, modulus) / base:powmod(exponent, modulus)
+** base^exponent mod modulus, reducing after every step instead of
+** building the power. Odd moduli use Montgomery multiplication, which
+** needs no division per step.
+**
+** Args:
+**   exponent: a bigint or integer, not negative
+**   modulus: a bigint or integer greater than zero
+**
+** Returns:
+**   new bigint in [0, modulus)
+*/
+static int l_bigint_powmod(lua_State* L) {
+    Operand sa, se, sm;
+    const BigInt* a = check_operand(L, 1, &sa);
+    const BigInt* e = check_operand(L, 2, &se);
+    const BigInt* m = check_operand(L, 3, &sm);
+    BigInt* r;
+    luaL_argcheck(L, e->positive || is_zero(e), 2, "exponent must not be negative");
+    luaL_argcheck(L, m->positive && !is_zero(m), 3, "modulus must be positive");
+    r = push_bigint(L, m->len);
+    if (bigint_powmod(r, a, e, m) != 0) {
+        return luaL_error(L, "bigint powmod failed");
     }
-    
-    BigIntUserdata* ud = (BigIntUserdata*)lua_newuserdata(L, sizeof(BigIntUserdata));
-    ud->handle = result;
-    luaL_setmetatable(L, BIGINT_METATABLE);
-    
     return 1;
 }
 
+/*
+** bigint.modinv(a, modulus) / a:modinv(modulus)
+** Returns:
+**   new bigint x in [0, modulus) with a * x = 1 (mod modulus), or nil when
+**   a and modulus have a common factor
+*/
+static int l_bigint_modinv(lua_State* L) {
+    Operand sa, sm;
+    const BigInt* a = check_operand(L, 1, &sa);
+    const BigInt* m = check_operand(L, 2, &sm);
+    BigInt* r;
+    luaL_argcheck(L, m->positive && !is_zero(m), 2, "modulus must be positive");
+    r = push_bigint(L, m->len);
+    switch (bigint_modinv(r, a, m)) {
+        case 0: return 1;
+        case 1: lua_pushnil(L); return 1;
+        default: return luaL_error(L, "bigint modinv failed");
+    }
+}
+
 /*
 ** bigint:tostring([base])
 ** Convert bigint to string representation
@@ -252,22 +450,25 @@ static int l_bigint_mod(lua_State* L) {
 **   string representation of the bigint
 */
 static int l_bigint_tostring(lua_State* L) {
-    BigIntUserdata* ud = check_bigint(L, 1);
+    BigInt* b = check_bigint(L, 1);
     int base = (int)luaL_optinteger(L, 2, 10);
+    luaL_Buffer buffer;
+    size_t cap;
+    int len;
     
     if (base < 2 || base > 36) {
         return luaL_error(L, "base must be between 2 and 36");
     }
     
-    /* Allocate buffer - use reasonable size for most bigints */
-    char buffer[1024];
-    int len = bigint_to_string(ud->handle, base, buffer, sizeof(buffer));
+    /* The digits go straight into the result string's buffer */
+    cap = bigint_string_len(b, base);
+    len = bigint_to_string(b, base, luaL_buffinitsize(L, &buffer, cap), cap);
     
     if (len < 0) {
-        return luaL_error(L, "failed to convert bigint to string (number too large?)");
+        return luaL_error(L, "failed to convert bigint to string");
     }
     
-    lua_pushlstring(L, buffer, (size_t)len);
+    luaL_pushresultsize(&buffer, (size_t)len);
     return 1;
 }
 
@@ -316,37 +517,31 @@ static int l_bigint_meta_mod(lua_State* L) {
 ** Enables operator overloading for equality: a == b
 */
 static int l_bigint_meta_eq(lua_State* L) {
-    BigIntUserdata* a = check_bigint(L, 1);
-    BigIntUserdata* b = check_bigint(L, 2);
+    BigInt* a = check_bigint(L, 1);
+    BigInt* b = check_bigint(L, 2);
     
-    int cmp = bigint_compare(a->handle, b->handle);
+    int cmp = bigint_compare(a, b);
     lua_pushboolean(L, cmp == 0);
     return 1;
 }
 
 /*
 ** Metamethod: __lt
-** Enables operator overloading for less than: a < b
+** Enables operator overloading for less than: a < b, either side may be
+** an integer
 */
 static int l_bigint_meta_lt(lua_State* L) {
-    BigIntUserdata* a = check_bigint(L, 1);
-    BigIntUserdata* b = check_bigint(L, 2);
-    
-    int cmp = bigint_compare(a->handle, b->handle);
-    lua_pushboolean(L, cmp < 0);
+    lua_pushboolean(L, compare(L) < 0);
     return 1;
 }
 
 /*
 ** Metamethod: __le
-** Enables operator overloading for less than or equal: a <= b
+** Enables operator overloading for less than or equal: a <= b, either
+** side may be an integer
 */
 static int l_bigint_meta_le(lua_State* L) {
-    BigIntUserdata* a = check_bigint(L, 1);
-    BigIntUserdata* b = check_bigint(L, 2);
-    
-    int cmp = bigint_compare(a->handle, b->handle);
-    lua_pushboolean(L, cmp <= 0);
+    lua_pushboolean(L, compare(L) <= 0);
     return 1;
 }
 
@@ -358,20 +553,6 @@ static int l_bigint_meta_tostring(lua_State* L) {
     return l_bigint_tostring(L);
 }
 
-/*
-** Metamethod: __gc
-** Garbage collection finalizer - frees Zig bigint handle
-** Called automatically when Lua userdata is collected
-*/
-static int l_bigint_meta_gc(lua_State* L) {
-    BigIntUserdata* ud = (BigIntUserdata*)luaL_checkudata(L, 1, BIGINT_METATABLE);
-    if (ud->handle != NULL) {
-        bigint_free(ud->handle);
-        ud->handle = NULL;
-    }
-    return 0;
-}
-
 /*
 ** Module function registration table
 ** These become accessible as bigint.new(), etc.
@@ -383,6 +564,10 @@ static const luaL_Reg bigint_functions[] = {
     {"mul", l_bigint_mul},
     {"div", l_bigint_div},
     {"mod", l_bigint_mod},
+    {"sum", l_bigint_sum},
+    {"gcd", l_bigint_gcd},
+    {"powmod", l_bigint_powmod},
+    {"modinv", l_bigint_modinv},
     {NULL, NULL}
 };
 
@@ -397,6 +582,18 @@ static const luaL_Reg bigint_metamethods[] = {
     {"mul", l_bigint_mul},
     {"div", l_bigint_div},
     {"mod", l_bigint_mod},
+    {"addInPlace", l_bigint_add_in_place},
+    {"subInPlace", l_bigint_sub_in_place},
+    {"mulInPlace", l_bigint_mul_in_place},
+    {"band", l_bigint_band},
+    {"bor", l_bigint_bor},
+    {"bxor", l_bigint_bxor},
+    {"bnot", l_bigint_bnot},
+    {"shl", l_bigint_shl},
+    {"shr", l_bigint_shr},
+    {"gcd", l_bigint_gcd},
+    {"powmod", l_bigint_powmod},
+    {"modinv", l_bigint_modinv},
     {"tostring", l_bigint_tostring},
     
     /* Operator overloads */
@@ -409,13 +606,49 @@ static const luaL_Reg bigint_metamethods[] = {
     {"__lt", l_bigint_meta_lt},
     {"__le", l_bigint_meta_le},
     {"__tostring", l_bigint_meta_tostring},
-    
-    /* Memory management */
-    {"__gc", l_bigint_meta_gc},
+
+    /* Bitwise operators: a & b, a | b, a ~ b, ~a, a << n, a >> n */
+    {"__band", l_bigint_band},
+    {"__bor", l_bigint_bor},
+    {"__bxor", l_bigint_bxor},
+    {"__bnot", l_bigint_bnot},
+    {"__shl", l_bigint_shl},
+    {"__shr", l_bigint_shr},
     
     {NULL, NULL}
 };
 
+/* Create BIGINT_METATABLE unless it exists */
+static void bigint_metatable(lua_State* L) {
+    if (luaL_newmetatable(L, BIGINT_METATABLE)) {
+        /* Register metamethods */
+        luaL_setfuncs(L, bigint_metamethods, 0);
+
+        /* Set __index to metatable itself for method calls */
+        /* This allows obj:method() syntax to find methods in the metatable */
+        lua_pushvalue(L, -1);  /* Duplicate metatable */
+        lua_setfield(L, -2, "__index");
+    }
+    lua_pop(L, 1);
+}
+
+/*
+** For src/bigint.zig, which stores bigints as values: the bigint at
+** `index`, or NULL if it is not one
+*/
+const BigInt* cu_bigint_view(lua_State* L, int index) {
+    return (const BigInt*)luaL_testudata(L, index, BIGINT_METATABLE);
+}
+
+/*
+** For src/bigint.zig: push a bigint with room for `cap` limbs for it to
+** fill in, whether or not a script has required the library yet
+*/
+BigInt* cu_bigint_push(lua_State* L, size_t cap) {
+    bigint_metatable(L);
+    return push_bigint(L, cap);
+}
+
 /*
 ** luaopen_bigint
 ** Module initialization function - called when bigint library is loaded
@@ -429,18 +662,7 @@ static const luaL_Reg bigint_metamethods[] = {
 */
 LUAMOD_API int luaopen_bigint(lua_State* L) {
     /* Create metatable for BigInt userdata */
-    luaL_newmetatable(L, BIGINT_METATABLE);
-    
-    /* Register metamethods */
-    luaL_setfuncs(L, bigint_metamethods, 0);
-    
-    /* Set __index to metatable itself for method calls */
-    /* This allows obj:method() syntax to find methods in the metatable */
-    lua_pushvalue(L, -1);  /* Duplicate metatable */
-    lua_setfield(L, -2, "__index");
-    
-    /* Pop metatable */
-    lua_pop(L, 1);
+    bigint_metatable(L);
     
     /* Create and return module table */
     luaL_newlib(L, bigint_functions);
@@ -0,0 +1,95 @@
+/*
+** lbigint.h
+** Bigint layout and the src/bignum.zig functions on it, shared by the
+** bigint (lbigint.c) and decimal (ldecimal.c) libraries
+*/
+
+#ifndef lbigint_h
+#define lbigint_h
+
+#include <stddef.h>
+
+/*
+** Metatable name for bigint userdata type identification
+*/
+#define BIGINT_METATABLE "Cu.BigInt"
+
+/*
+** A limb of the magnitude: std.math.big.Limb, which is a usize
+*/
+typedef size_t BigIntLimb;
+
+/* Limbs an integer operand needs (I64_LIMBS in src/bignum.zig) */
+#define BIGINT_I64_LIMBS (8 / sizeof(BigIntLimb))
+
+/*
+** BigInt userdata structure
+** One userdata: this header, then `cap` limbs. An in-place operation that
+** outgrows them moves the limbs to a larger userdata held as the user
+** value, as lstrbuf.c does with its bytes, so the collector owns all of
+** the memory and no __gc is needed. src/bignum.zig reads the header as
+** its BigInt.
+*/
+typedef struct BigInt {
+    BigIntLimb* limbs;  /* least significant first; right after the header until it grows */
+    size_t len;
+    size_t cap;
+    int positive;
+} BigInt;
+
+/* Operations, numbered as in src/bignum.zig */
+#define BIGINT_ADD 0
+#define BIGINT_SUB 1
+#define BIGINT_MUL 2
+#define BIGINT_DIV 3
+#define BIGINT_MOD 4
+#define BIGINT_BAND 5
+#define BIGINT_BOR 6
+#define BIGINT_BXOR 7
+#define BIGINT_GCD 8
+
+/*
+** External Zig bigint functions
+** These are implemented in src/bignum.zig and exported to WASM. None of
+** them allocate a number: results go into limbs the caller provides.
+*/
+
+/* Construction - r needs cap >= BIGINT_I64_LIMBS or bigint_string_limbs() */
+extern void bigint_set_i64(BigInt* r, long long val);
+extern size_t bigint_string_limbs(size_t len, int base);
+extern int bigint_set_string(BigInt* r, const char* str, size_t len, int base);
+
+/*
+** Arithmetic operations - r = a op b, returning 0 or -1 on failure. r needs
+** cap >= bigint_result_limbs(a, b, op) and may be a or b for add, sub and
+** mul.
+*/
+extern size_t bigint_result_limbs(const BigInt* a, const BigInt* b, int op);
+extern int bigint_apply(BigInt* r, const BigInt* a, const BigInt* b, int op);
+
+/*
+** Shifts - r = a shifted left by `shift` bits, or right (rounding toward
+** negative infinity) by -shift bits. r needs cap >= bigint_shift_limbs().
+*/
+extern size_t bigint_shift_limbs(const BigInt* a, long long shift);
+extern int bigint_shift(BigInt* r, const BigInt* a, long long shift);
+
+/*
+** Modular arithmetic - r needs cap >= m->len and is not an operand; m must
+** be positive. powmod returns 0 or -1 (also for a negative exponent),
+** modinv 0, 1 when a has no inverse mod m, or -1.
+*/
+extern int bigint_powmod(BigInt* r, const BigInt* base, const BigInt* e, const BigInt* m);
+extern int bigint_modinv(BigInt* r, const BigInt* a, const BigInt* m);
+
+/* Comparison - returns -1, 0, or 1 */
+extern int bigint_compare(const BigInt* a, const BigInt* b);
+
+/*
+** String conversion - writes straight into buf, which needs max_len >=
+** bigint_string_len(a, base); returns length written (or -1 on error)
+*/
+extern size_t bigint_string_len(const BigInt* a, int base);
+extern int bigint_to_string(const BigInt* a, int base, char* buf, size_t max_len);
+
+#endif
@@ -0,0 +1,288 @@
+/*
+** lcensus.c
+** Heap census and allocation profile
+** See Copyright Notice in lua.h
+*/
+
+#define lcensus_c
+#define LUA_CORE
+
+#include "lprefix.h"
+
+
+#include <string.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+
+#include "lbigint.h"
+#include "lcensus.h"
+#include "lfunc.h"
+#include "lgc.h"
+#include "lobject.h"
+#include "lstate.h"
+#include "lstring.h"
+#include "ltable.h"
+
+
+/*
+** {======================================================
+** Heap census: walks every collectable object on demand, so it costs
+** nothing until a host asks. Objects the collector has not yet reached
+** are counted too; run a full collection first for live objects only.
+** =======================================================
+*/
+
+/* as in lstate.c: a thread is allocated with the extra space before it */
+typedef struct LXsize {
+  lu_byte extra_[LUA_EXTRASPACE];
+  lua_State l;
+} LXsize;
+
+
+/* slots in 'fields' for a shape with 'n' keys (sizefields in ltable.c) */
+static size_t fieldslots (int n) {
+  return (n == 0) ? 0 : cast_sizet(twoto(luaO_ceillog2(cast_uint(n))));
+}
+
+
+static size_t tablesize (Table *t) {
+  size_t sz = sizeof(Table) + luaH_sizearray(t);
+  sz += cast_sizet(allocsizenode(t)) * sizeof(Node);
+  if (t->shape != NULL)
+    sz += fieldslots(t->shape->nkeys) * sizeof(TValue);
+  return sz;
+}
+
+
+static size_t protosize (Proto *p) {
+  size_t sz = sizeof(Proto);
+  sz += cast_sizet(p->sizecode) * sizeof(Instruction);
+  if (p->fieldcache != NULL)
+    sz += cast_sizet(p->sizefieldcache) * sizeof(unsigned int);
+  sz += cast_sizet(p->sizek) * sizeof(TValue);
+  sz += cast_sizet(p->sizep) * sizeof(Proto *);
+  sz += cast_sizet(p->sizelineinfo) * sizeof(ls_byte);
+  sz += cast_sizet(p->sizeabslineinfo) * sizeof(AbsLineInfo);
+  sz += cast_sizet(p->sizelocvars) * sizeof(LocVar);
+  sz += cast_sizet(p->sizeupvalues) * sizeof(Upvaldesc);
+  return sz;
+}
+
+
+static size_t threadsize (lua_State *th) {
+  size_t sz = sizeof(LXsize);
+  if (th->stack.p != NULL)
+    sz += cast_sizet(stacksize(th) + EXTRA_STACK) * sizeof(StackValue);
+  sz += cast_sizet(th->nci) * sizeof(CallInfo);
+  return sz;
+}
+
+
+typedef struct CensusState {
+  Table *bigintmt;  /* metatables that tell bigints and decimals apart */
+  Table *decimalmt;
+  CuHeapCensus *out;
+} CensusState;
+
+
+static void countobject (CensusState *cs, GCObject *o) {
+  int kind;
+  size_t sz;
+  switch (o->tt) {
+    case LUA_VSHRSTR:
+      kind = CU_CENSUS_SHORTSTR;
+      sz = sizelstring(gco2ts(o)->shrlen);
+      break;
+    case LUA_VLNGSTR:
+      kind = CU_CENSUS_LONGSTR;
+      sz = sizelstring(gco2ts(o)->u.lnglen);
+      break;
+    case LUA_VTABLE:
+      kind = CU_CENSUS_TABLE;
+      sz = tablesize(gco2t(o));
+      break;
+    case LUA_VLCL:
+      kind = CU_CENSUS_LCLOSURE;
+      sz = sizeLclosure(gco2lcl(o)->nupvalues);
+      break;
+    case LUA_VCCL:
+      kind = CU_CENSUS_CCLOSURE;
+      sz = sizeCclosure(gco2ccl(o)->nupvalues);
+      break;
+    case LUA_VUSERDATA: {
+      Udata *u = gco2u(o);
+      if (u->metatable != NULL && u->metatable == cs->bigintmt)
+        kind = CU_CENSUS_BIGINT;
+      else if (u->metatable != NULL && u->metatable == cs->decimalmt)
+        kind = CU_CENSUS_DECIMAL;
+      else
+        kind = CU_CENSUS_USERDATA;
+      sz = sizeudata(u->nuvalue, u->len);
+      break;
+    }
+    case LUA_VPROTO:
+      kind = CU_CENSUS_PROTO;
+      sz = protosize(gco2p(o));
+      break;
+    case LUA_VUPVAL:
+      kind = CU_CENSUS_UPVAL;
+      sz = sizeof(UpVal);
+      break;
+    case LUA_VTHREAD:
+      kind = CU_CENSUS_THREAD;
+      sz = threadsize(gco2th(o));
+      break;
+    default: lua_assert(0); return;
+  }
+  cs->out->kinds[kind].count++;
+  cs->out->kinds[kind].bytes += cast(uint32_t, sz);
+  cs->out->object_bytes += cast(uint32_t, sz);
+}
+
+
+static void countlist (CensusState *cs, GCObject *o) {
+  for (; o != NULL; o = o->next)
+    countobject(cs, o);
+}
+
+
+static Table *registrymetatable (lua_State *L, const char *tname) {
+  Table *mt = NULL;
+  if (luaL_getmetatable(L, tname) == LUA_TTABLE)
+    mt = hvalue(s2v(L->top.p - 1));
+  lua_pop(L, 1);
+  return mt;
+}
+
+
+void cu_heap_census (lua_State *L, CuHeapCensus *out) {
+  global_State *g = G(L);
+  CensusState cs;
+  memset(out, 0, sizeof(*out));
+  cs.bigintmt = registrymetatable(L, BIGINT_METATABLE);
+  cs.decimalmt = registrymetatable(L, "Cu.Decimal");
+  cs.out = out;
+  countlist(&cs, g->allgc);
+  countlist(&cs, g->finobj);
+  countlist(&cs, g->tobefnz);
+  countlist(&cs, g->fixedgc);
+  out->total_bytes = cast(uint32_t, gettotalbytes(g));
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Allocation profile: with LUAI_ALLOCPROFILE (CU_ALLOC_PROFILE=1 in
+** build.sh), lmem.c notes every allocation under the type tag it was made
+** with and lgc.c moves each object's header back out of that type when
+** it is freed, through the luai_alloc* hooks in luaconf.h
+** =======================================================
+*/
+
+#if defined(LUAI_ALLOCPROFILE)
+
+static CuAllocProfile profile;
+
+
+static int allockind (int tag) {
+  switch (tag) {
+    case LUA_TSTRING: return CU_ALLOC_STRING;
+    case LUA_TTABLE: return CU_ALLOC_TABLE;
+    case LUA_TFUNCTION: return CU_ALLOC_FUNCTION;
+    case LUA_TUSERDATA: return CU_ALLOC_USERDATA;
+    case LUA_TTHREAD: return CU_ALLOC_THREAD;
+    case LUA_TUPVAL: return CU_ALLOC_UPVAL;
+    case LUA_TPROTO: return CU_ALLOC_PROTO;
+    default: return CU_ALLOC_OTHER;
+  }
+}
+
+
+void cu_alloc_note (int tag, size_t size) {
+  CuAllocKind *k = &profile.kinds[allockind(tag)];
+  k->allocs++;
+  k->alloc_bytes += size;
+  k->live++;
+  k->live_bytes += cast(int64_t, size);
+}
+
+
+void cu_alloc_resize (size_t osize, size_t nsize) {
+  CuAllocKind *k = &profile.kinds[CU_ALLOC_OTHER];
+  if (nsize > osize) {
+    k->allocs++;
+    k->alloc_bytes += nsize - osize;
+  }
+  if (osize == 0 && nsize > 0) k->live++;
+  else if (osize > 0 && nsize == 0) k->live--;
+  k->live_bytes += cast(int64_t, nsize) - cast(int64_t, osize);
+}
+
+
+void cu_alloc_free (size_t osize) {
+  CuAllocKind *k = &profile.kinds[CU_ALLOC_OTHER];
+  k->live--;
+  k->live_bytes -= cast(int64_t, osize);
+}
+
+
+/* size each object was allocated with, to match luaC_newobj's callers */
+static size_t headersize (GCObject *o) {
+  switch (o->tt) {
+    case LUA_VSHRSTR: return sizelstring(gco2ts(o)->shrlen);
+    case LUA_VLNGSTR: return sizelstring(gco2ts(o)->u.lnglen);
+    case LUA_VTABLE: return sizeof(Table);
+    case LUA_VLCL: return sizeLclosure(gco2lcl(o)->nupvalues);
+    case LUA_VCCL: return sizeCclosure(gco2ccl(o)->nupvalues);
+    case LUA_VUSERDATA:
+      return sizeudata(gco2u(o)->nuvalue, gco2u(o)->len);
+    case LUA_VPROTO: return sizeof(Proto);
+    case LUA_VUPVAL: return sizeof(UpVal);
+    case LUA_VTHREAD: return sizeof(LXsize);
+    default: lua_assert(0); return 0;
+  }
+}
+
+
+/*
+** 'o' is about to be freed, header and all, through cu_alloc_free: move
+** its header from its type to 'other' first
+*/
+void cu_alloc_freeobj (void *o) {
+  GCObject *gco = cast(GCObject *, o);
+  size_t sz = headersize(gco);
+  CuAllocKind *k = &profile.kinds[allockind(novariant(gco->tt))];
+  CuAllocKind *other = &profile.kinds[CU_ALLOC_OTHER];
+  k->live--;
+  k->live_bytes -= cast(int64_t, sz);
+  other->live++;
+  other->live_bytes += cast(int64_t, sz);
+}
+
+
+int cu_alloc_profile (CuAllocProfile *out, int reset) {
+  int i;
+  *out = profile;
+  if (reset) {  /* start the cumulative figures over; live ones stay */
+    for (i = 0; i < CU_ALLOC_KINDS; i++) {
+      profile.kinds[i].allocs = 0;
+      profile.kinds[i].alloc_bytes = 0;
+    }
+  }
+  return 0;
+}
+
+#else
+
+int cu_alloc_profile (CuAllocProfile *out, int reset) {
+  (void)out; (void)reset;
+  return -1;  /* not built with LUAI_ALLOCPROFILE */
+}
+
+#endif
+
+/* }====================================================== */
+
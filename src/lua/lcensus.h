@@ -0,0 +1,69 @@
+/*
+** lcensus.h
+** Heap census and allocation profile (read by main.zig)
+** See Copyright Notice in lua.h
+*/
+
+#ifndef lcensus_h
+#define lcensus_h
+
+#include <stdint.h>
+
+#include "lua.h"
+
+
+/* Kinds of object the census tells apart; userdata with the bigint or
+** decimal metatable are counted on their own */
+#define CU_CENSUS_SHORTSTR	0
+#define CU_CENSUS_LONGSTR	1
+#define CU_CENSUS_TABLE		2
+#define CU_CENSUS_LCLOSURE	3
+#define CU_CENSUS_CCLOSURE	4
+#define CU_CENSUS_USERDATA	5
+#define CU_CENSUS_BIGINT	6
+#define CU_CENSUS_DECIMAL	7
+#define CU_CENSUS_PROTO		8
+#define CU_CENSUS_UPVAL		9
+#define CU_CENSUS_THREAD	10
+#define CU_CENSUS_KINDS		11
+
+typedef struct CuCensusKind {
+  uint32_t count;
+  uint32_t bytes;  /* the objects and the arrays they own */
+} CuCensusKind;
+
+typedef struct CuHeapCensus {
+  uint32_t total_bytes;  /* everything the state holds, as collectgarbage("count") */
+  uint32_t object_bytes;  /* the sum of kinds[].bytes */
+  CuCensusKind kinds[CU_CENSUS_KINDS];
+} CuHeapCensus;
+
+
+/* Kinds the allocation profile tallies, by the type tag Lua allocates with:
+** vectors and buffers (table parts, stacks, code) count as 'other' */
+#define CU_ALLOC_OTHER		0
+#define CU_ALLOC_STRING		1
+#define CU_ALLOC_TABLE		2
+#define CU_ALLOC_FUNCTION	3
+#define CU_ALLOC_USERDATA	4
+#define CU_ALLOC_THREAD		5
+#define CU_ALLOC_UPVAL		6
+#define CU_ALLOC_PROTO		7
+#define CU_ALLOC_KINDS		8
+
+typedef struct CuAllocKind {
+  uint64_t allocs;  /* allocations since the last reset */
+  uint64_t alloc_bytes;
+  int64_t live;  /* objects allocated and not yet freed */
+  int64_t live_bytes;
+} CuAllocKind;
+
+typedef struct CuAllocProfile {
+  CuAllocKind kinds[CU_ALLOC_KINDS];
+} CuAllocProfile;
+
+
+void cu_heap_census (lua_State *L, CuHeapCensus *out);
+int cu_alloc_profile (CuAllocProfile *out, int reset);
+
+#endif
@@ -14,12 +14,14 @@
 #include <limits.h>
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "lua.h"
 
 #include "lcode.h"
 #include "ldebug.h"
 #include "ldo.h"
+#include "lfunc.h"
 #include "lgc.h"
 #include "llex.h"
 #include "lmem.h"
@@ -1872,3 +1874,484 @@ void luaK_finish (FuncState *fs) {
     }
   }
 }
+
+
+/*
+** {======================================================================
+** Optimizer for finished functions
+** Chunks loaded with "o" in their mode ("to", "bto") go through
+** 'luaK_optimize' once parsed (see 'f_parser' in ldo.c). It rewrites
+** instructions in place and never moves one, so jumps, line info and
+** local variable ranges stay as they are:
+** - A register written once in the function, by a constant load, and
+**   not captured by a closure holds that constant for its whole life.
+**   Arithmetic, comparisons, table accesses and moves that read it use
+**   the constant instead, in the K and immediate forms the code
+**   generator gives literals ('local N = 10 ... x + N' becomes ADDI).
+** - A test whose outcome is then known ('local DEBUG = false ... if
+**   DEBUG then') becomes a jump to where it leads; the branch it skips
+**   stays in place, dead.
+** - A global (or upvalue field) read again in straight-line code, with
+**   no call, table or upvalue write, or jump target in between, is
+**   copied from the register that still holds it.
+** The last one assumes metamethods and debug hooks do not assign the
+** globals a function reads, and 'debug.setlocal' on a constant local
+** no longer reaches the instructions that use its value.
+** =======================================================================
+*/
+
+#define OPTREGS		(MAXREGS + 1)
+
+typedef struct OptState {
+  lua_State *L;
+  Proto *f;
+  int changed;  /* a move became a constant load: look again */
+  int def[OPTREGS];  /* pc of the register's only write */
+  lu_byte isconst[OPTREGS];
+  TValue value[OPTREGS];  /* constant held by each 'isconst' register */
+} OptState;
+
+
+/*
+** Registers [*from, *to) that instruction 'i' may write. Calls, varargs
+** and generic-for calls count as writing every register from their base.
+*/
+static void regswritten (Instruction i, int top, int *from, int *to) {
+  int a = GETARG_A(i);
+  *from = a;
+  *to = a + 1;
+  switch (GET_OPCODE(i)) {
+    case OP_SETUPVAL: case OP_SETTABUP: case OP_SETTABLE: case OP_SETI:
+    case OP_SETFIELD: case OP_MMBIN: case OP_MMBINI: case OP_MMBINK:
+    case OP_CLOSE: case OP_TBC: case OP_JMP: case OP_EQ: case OP_LT:
+    case OP_LE: case OP_EQK: case OP_EQI: case OP_LTI: case OP_LEI:
+    case OP_GTI: case OP_GEI: case OP_TEST: case OP_RETURN:
+    case OP_RETURN0: case OP_RETURN1: case OP_SETLIST:
+    case OP_VARARGPREP: case OP_EXTRAARG:
+      *to = *from;  /* none (MMBIN results go to the arithmetic's R[A]) */
+      break;
+    case OP_LOADNIL: *to = a + GETARG_B(i) + 1; break;
+    case OP_SELF: *to = a + 2; break;
+    case OP_CONCAT: *to = a + GETARG_B(i); break;
+    case OP_FORLOOP: case OP_FORPREP: case OP_TFORPREP: *to = a + 4; break;
+    case OP_TFORLOOP: *to = a + 5; break;
+    case OP_CALL: case OP_TAILCALL: case OP_TFORCALL: case OP_VARARG:
+      *to = top;
+      break;
+    default: break;  /* R[A] */
+  }
+  if (*to > top) *to = top;
+  if (*from > *to) *from = *to;
+}
+
+
+/* The constant a load instruction writes, if 'i' is one */
+static int loadedconstant (lua_State *L, const Proto *f, Instruction i,
+                           TValue *v) {
+  switch (GET_OPCODE(i)) {
+    case OP_LOADI: setivalue(v, GETARG_sBx(i)); return 1;
+    case OP_LOADF: setfltvalue(v, cast_num(GETARG_sBx(i))); return 1;
+    case OP_LOADK: setobj(L, v, &f->k[GETARG_Bx(i)]); return 1;
+    case OP_LOADFALSE: setbfvalue(v); return 1;
+    case OP_LOADTRUE: setbtvalue(v); return 1;
+    case OP_LOADNIL: setnilvalue(v); return 1;
+    default: return 0;
+  }
+}
+
+
+static void findconstants (OptState *os) {
+  Proto *f = os->f;
+  lu_byte writes[OPTREGS];  /* 0, 1 or 2 for "more than one" */
+  int pc, r, i;
+  for (r = 0; r < OPTREGS; r++) {
+    writes[r] = (r < f->numparams) ? 2 : 0;  /* parameters come set */
+    os->isconst[r] = 0;
+  }
+  for (i = 0; i < f->sizep; i++) {  /* captured locals change via upvalues */
+    int j;
+    for (j = 0; j < f->p[i]->sizeupvalues; j++) {
+      if (f->p[i]->upvalues[j].instack)
+        writes[f->p[i]->upvalues[j].idx] = 2;
+    }
+  }
+  for (pc = 0; pc < f->sizecode; pc++) {
+    Instruction ins = f->code[pc];
+    int from, to;
+    if (GET_OPCODE(ins) == OP_TBC)
+      writes[GETARG_A(ins)] = 2;
+    regswritten(ins, f->maxstacksize, &from, &to);
+    for (r = from; r < to; r++) {
+      if (writes[r] < 2) writes[r]++;
+      os->def[r] = pc;
+    }
+  }
+  for (r = 0; r < f->maxstacksize; r++) {
+    if (writes[r] == 1 &&
+        loadedconstant(os->L, f, f->code[os->def[r]], &os->value[r]))
+      os->isconst[r] = 1;
+  }
+}
+
+
+/*
+** Index of constant 'v' in 'f->k', added if it is not there; -1 when it
+** would be above 'limit', the largest index the operand can hold
+*/
+static int constindex (OptState *os, const TValue *v, int limit) {
+  Proto *f = os->f;
+  int i;
+  for (i = 0; i < f->sizek && i <= limit; i++) {
+    if (ttypetag(&f->k[i]) == ttypetag(v) && luaV_rawequalobj(&f->k[i], v))
+      return i;
+  }
+  if (f->sizek > limit)
+    return -1;
+  f->k = luaM_reallocvector(os->L, f->k, f->sizek, f->sizek + 1, TValue);
+  setobj(os->L, &f->k[f->sizek], v);
+  if (iscollectable(v))
+    luaC_objbarrier(os->L, f, gcvalue(v));
+  return f->sizek++;
+}
+
+
+/* Whether a constant fits an sB/sC operand, as 'isSCnumber' */
+static int immediate (const TValue *v, int *im, int *isfloat) {
+  lua_Integer i;
+  *isfloat = 0;
+  if (ttisinteger(v))
+    i = ivalue(v);
+  else if (ttisfloat(v) && luaV_flttointeger(fltvalue(v), &i, F2Ieq))
+    *isfloat = 1;
+  else
+    return 0;
+  if (!fitsC(i))
+    return 0;
+  *im = int2sC(cast_int(i));
+  return 1;
+}
+
+
+#define numconst(os,r,bitwise)  ((os)->isconst[r] && \
+  ((bitwise) ? ttisinteger(&(os)->value[r]) : ttisnumber(&(os)->value[r])))
+
+
+/*
+** Arithmetic on a constant register, with its MMBIN, as 'codecommutative'
+** and 'codearith' code it for a literal: ADDI for a small integer added,
+** else the K form, with the operands swapped (and the metamethod call
+** flipped back) when only the first one is constant
+*/
+static void arithconst (OptState *os, int pc) {
+  Proto *f = os->f;
+  Instruction i = f->code[pc];
+  OpCode op = GET_OPCODE(i);
+  int a = GETARG_A(i), b = GETARG_B(i), c = GETARG_C(i);
+  int bitwise = (op == OP_BAND || op == OP_BOR || op == OP_BXOR);
+  int flip = 0;
+  TMS event;
+  const TValue *v;
+  if (pc + 1 >= f->sizecode || GET_OPCODE(f->code[pc + 1]) != OP_MMBIN)
+    return;
+  event = cast(TMS, GETARG_C(f->code[pc + 1]));
+  if (!numconst(os, c, bitwise)) {
+    if (!(op == OP_ADD || op == OP_MUL || bitwise) || !numconst(os, b, bitwise))
+      return;
+    c = b;  /* constant second */
+    b = GETARG_C(i);
+    flip = 1;
+  }
+  v = &os->value[c];
+  if (op == OP_ADD && ttisinteger(v) && fitsC(ivalue(v))) {
+    int im = int2sC(cast_int(ivalue(v)));
+    f->code[pc] = CREATE_ABCk(OP_ADDI, a, b, im, 0);
+    f->code[pc + 1] = CREATE_ABCk(OP_MMBINI, b, im, event, flip);
+  }
+  else {
+    int k = constindex(os, v, MAXARG_C);
+    if (k < 0)
+      return;
+    f->code[pc] = CREATE_ABCk(op - OP_ADD + OP_ADDK, a, b, k, 0);
+    f->code[pc + 1] = CREATE_ABCk(OP_MMBINK, b, k, event, flip);
+  }
+}
+
+
+/* EQ, LT or LE with a constant operand, as 'codeeq' and 'codeorder' */
+static void compareconst (OptState *os, int pc) {
+  Proto *f = os->f;
+  Instruction i = f->code[pc];
+  OpCode op = GET_OPCODE(i);
+  int a = GETARG_A(i), b = GETARG_B(i), k = GETARG_k(i);
+  int im, isfloat;
+  if (op == OP_EQ) {
+    int r = a, kidx;
+    if (!os->isconst[b]) {
+      if (!os->isconst[a])
+        return;
+      r = b;  /* equality is symmetric */
+      b = a;
+    }
+    if (immediate(&os->value[b], &im, &isfloat))
+      f->code[pc] = CREATE_ABCk(OP_EQI, r, im, isfloat, k);
+    else if ((kidx = constindex(os, &os->value[b], MAXARG_B)) >= 0)
+      f->code[pc] = CREATE_ABCk(OP_EQK, r, kidx, 0, k);
+  }
+  else if (os->isconst[b] && immediate(&os->value[b], &im, &isfloat))
+    f->code[pc] = CREATE_ABCk(op == OP_LT ? OP_LTI : OP_LEI, a, im, isfloat, k);
+  else if (os->isconst[a] && immediate(&os->value[a], &im, &isfloat))  /* A < B as B > A */
+    f->code[pc] = CREATE_ABCk(op == OP_LT ? OP_GTI : OP_GEI, b, im, isfloat, k);
+}
+
+
+/* GETTABLE and SETTABLE with a constant key, as 'luaK_indexed' */
+static void indexconst (OptState *os, int pc) {
+  Proto *f = os->f;
+  Instruction i = f->code[pc];
+  int get = (GET_OPCODE(i) == OP_GETTABLE);
+  int key = get ? GETARG_C(i) : GETARG_B(i);
+  const TValue *v = &os->value[key];
+  if (!os->isconst[key])
+    return;
+  if (ttisshrstring(v)) {
+    int kidx = constindex(os, v, get ? MAXARG_C : MAXARG_B);
+    if (kidx < 0)
+      return;
+    if (get)
+      f->code[pc] = CREATE_ABCk(OP_GETFIELD, GETARG_A(i), GETARG_B(i), kidx, 0);
+    else
+      f->code[pc] = CREATE_ABCk(OP_SETFIELD, GETARG_A(i), kidx, GETARG_C(i),
+                                GETARG_k(i));
+  }
+  else if (ttisinteger(v) &&
+           l_castS2U(ivalue(v)) <= l_castS2U(get ? MAXARG_C : MAXARG_B)) {
+    if (get)
+      f->code[pc] = CREATE_ABCk(OP_GETI, GETARG_A(i), GETARG_B(i),
+                                cast_int(ivalue(v)), 0);
+    else
+      f->code[pc] = CREATE_ABCk(OP_SETI, GETARG_A(i), cast_int(ivalue(v)),
+                                GETARG_C(i), GETARG_k(i));
+  }
+}
+
+
+/* A stored value from a constant register as a K operand */
+static void storeconst (OptState *os, int pc) {
+  Instruction *i = &os->f->code[pc];
+  int c = GETARG_C(*i);
+  int kidx;
+  if (GETARG_k(*i) || !os->isconst[c])
+    return;
+  kidx = constindex(os, &os->value[c], MAXARG_C);
+  if (kidx >= 0) {
+    SETARG_C(*i, kidx);
+    SETARG_k(*i, 1);
+  }
+}
+
+
+/*
+** A test that reads a constant register goes one way only: make it a
+** jump past its JMP or, when it would take that JMP, a jump to its target
+*/
+static void foldtest (OptState *os, int pc) {
+  Proto *f = os->f;
+  Instruction i = f->code[pc];
+  Instruction jump;
+  int a = GETARG_A(i);
+  int cond;
+  if (pc + 1 >= f->sizecode || GET_OPCODE(f->code[pc + 1]) != OP_JMP)
+    return;
+  jump = f->code[pc + 1];
+  switch (GET_OPCODE(i)) {
+    case OP_TEST: {
+      if (!os->isconst[a]) return;
+      cond = !l_isfalse(&os->value[a]);
+      break;
+    }
+    case OP_EQK: {
+      if (!os->isconst[a]) return;
+      cond = luaV_rawequalobj(&os->value[a], &f->k[GETARG_B(i)]);
+      break;
+    }
+    case OP_EQI: {
+      const TValue *v = &os->value[a];
+      int im = GETARG_sB(i);
+      if (!os->isconst[a]) return;
+      if (ttisinteger(v)) cond = (ivalue(v) == im);
+      else if (ttisfloat(v)) cond = luai_numeq(fltvalue(v), cast_num(im));
+      else cond = 0;
+      break;
+    }
+    case OP_TESTSET: {  /* R[A] := R[B] only on the way through the JMP */
+      int b = GETARG_B(i);
+      if (!os->isconst[b]) return;
+      if (l_isfalse(&os->value[b]) == GETARG_k(i))
+        f->code[pc] = CREATE_sJ(OP_JMP, 1 + OFFSET_sJ, 0);
+      else
+        f->code[pc] = CREATE_ABCk(OP_MOVE, a, b, 0, 0);
+      return;
+    }
+    default: return;
+  }
+  if (cond != GETARG_k(i))
+    f->code[pc] = CREATE_sJ(OP_JMP, 1 + OFFSET_sJ, 0);
+  else if (GETARG_sJ(jump) < MAXARG_sJ - OFFSET_sJ)
+    f->code[pc] = CREATE_sJ(OP_JMP, GETARG_sJ(jump) + 1 + OFFSET_sJ, 0);
+}
+
+
+static void propagate (OptState *os) {
+  Proto *f = os->f;
+  int pc;
+  for (pc = 0; pc < f->sizecode; pc++) {
+    Instruction i = f->code[pc];
+    switch (GET_OPCODE(i)) {
+      case OP_MOVE: {
+        int b = GETARG_B(i);
+        if (os->isconst[b]) {  /* load the constant the way 'b' got it */
+          Instruction load = f->code[os->def[b]];
+          SETARG_A(load, GETARG_A(i));
+          if (GET_OPCODE(load) == OP_LOADNIL)
+            SETARG_B(load, 0);
+          f->code[pc] = load;
+          os->changed = 1;
+        }
+        break;
+      }
+      case OP_ADD: case OP_SUB: case OP_MUL: case OP_MOD: case OP_POW:
+      case OP_DIV: case OP_IDIV: case OP_BAND: case OP_BOR: case OP_BXOR: {
+        arithconst(os, pc);
+        break;
+      }
+      case OP_EQ: case OP_LT: case OP_LE: {
+        compareconst(os, pc);
+        break;
+      }
+      case OP_GETTABLE: {
+        indexconst(os, pc);
+        break;
+      }
+      case OP_SETTABLE: {
+        indexconst(os, pc);
+        storeconst(os, pc);
+        break;
+      }
+      case OP_SETTABUP: case OP_SETI: case OP_SETFIELD: {
+        storeconst(os, pc);
+        break;
+      }
+      default: break;
+    }
+    foldtest(os, pc);
+  }
+}
+
+
+/*
+** Instructions that cannot run any Lua code, so cannot change a global.
+** Everything else may call a function, reach a metamethod (__index,
+** __add, __eq, __len, __concat...) or allocate and so run a finalizer.
+*/
+static int keepsglobals (OpCode op) {
+  switch (op) {
+    case OP_MOVE: case OP_LOADI: case OP_LOADF: case OP_LOADK:
+    case OP_LOADKX: case OP_LOADFALSE: case OP_LFALSESKIP: case OP_LOADTRUE:
+    case OP_LOADNIL: case OP_GETUPVAL: case OP_NOT: case OP_JMP:
+    case OP_TEST: case OP_TESTSET: case OP_FORLOOP: case OP_FORPREP:
+    case OP_TFORLOOP: case OP_EXTRAARG:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+
+/*
+** Replace GETTABUP with a MOVE from a register that got the same field of
+** the same upvalue earlier in straight-line code. 'holds[r]' names the
+** field register r holds (0 for none). Only a jump lands at a jump
+** target, so knowledge is dropped there, and at any instruction that
+** may run code, including a GETTABUP that is not reused (the upvalue's
+** __index may write other globals). Tests and arithmetic fall
+** through to the instruction after the JMP or MMBIN they skip, which
+** the scan passes on the way with no loss.
+*/
+static void reuseglobals (OptState *os) {
+  lua_State *L = os->L;
+  Proto *f = os->f;
+  int n = f->sizecode;
+  int top = f->maxstacksize;
+  int holds[OPTREGS];
+  lu_byte *target = luaM_newvector(L, n, lu_byte);
+  int pc, r;
+  memset(target, 0, n);
+  for (pc = 0; pc < n; pc++) {
+    Instruction i = f->code[pc];
+    int t = -1;
+    switch (GET_OPCODE(i)) {
+      case OP_JMP: t = pc + 1 + GETARG_sJ(i); break;
+      case OP_FORLOOP: case OP_TFORLOOP: t = pc + 1 - GETARG_Bx(i); break;
+      case OP_FORPREP: t = pc + 2 + GETARG_Bx(i); break;
+      case OP_TFORPREP: t = pc + 1 + GETARG_Bx(i); break;
+      default: break;
+    }
+    if (0 <= t && t < n)
+      target[t] = 1;
+  }
+  for (r = 0; r < OPTREGS; r++)
+    holds[r] = 0;
+  for (pc = 0; pc < n; pc++) {
+    Instruction i = f->code[pc];
+    OpCode op = GET_OPCODE(i);
+    int a = GETARG_A(i);
+    int from, to;
+    if (target[pc]) {
+      for (r = 0; r < top; r++)
+        holds[r] = 0;
+    }
+    if (op == OP_GETTABUP) {
+      int field = 1 + GETARG_B(i) * (MAXARG_C + 1) + GETARG_C(i);
+      for (r = 0; r < top && holds[r] != field; r++) ;
+      if (r < top && r != a)
+        f->code[pc] = CREATE_ABCk(OP_MOVE, a, r, 0, 0);
+      else {
+        for (r = 0; r < top; r++)
+          holds[r] = 0;
+      }
+      holds[a] = field;
+    }
+    else if (!keepsglobals(op)) {
+      for (r = 0; r < top; r++)
+        holds[r] = 0;
+    }
+    else if (op == OP_MOVE)
+      holds[a] = holds[GETARG_B(i)];
+    else {
+      regswritten(i, top, &from, &to);
+      for (r = from; r < to; r++)
+        holds[r] = 0;
+    }
+  }
+  luaM_freearray(L, target, n);
+}
+
+
+void luaK_optimize (lua_State *L, Proto *f) {
+  OptState os;
+  int i;
+  os.L = L;
+  os.f = f;
+  do {
+    os.changed = 0;
+    findconstants(&os);
+    propagate(&os);
+  } while (os.changed);
+  reuseglobals(&os);
+  if (f->fieldcache == NULL)  /* may have field accesses now */
+    luaF_initfieldcache(L, f);
+  for (i = 0; i < f->sizep; i++)
+    luaK_optimize(L, f->p[i]);
+}
+
+/* }====================================================================== */
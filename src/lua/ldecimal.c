@@ -0,0 +1,471 @@
+/*
+** ldecimal.c
+** Lua decimal library - fixed-point decimals for money
+** A decimal is an integer count of 10^-scale units (wei at scale 18,
+** cents at scale 2) kept as a bigint, so sums are exact and products and
+** quotients round once, by a named rule, instead of through hand-written
+** bigint.mul / bigint.div and string padding. src/bignum.zig computes
+** values that fit 128 bits without scratch memory.
+*/
+
+#include <string.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+
+#include "lbigint.h"
+
+#define DECIMAL_METATABLE "Cu.Decimal"
+#define DECIMAL_MAX_SCALE 38
+#define DECIMAL_DEFAULT_SCALE 18
+
+/*
+** Decimal userdata structure, src/bignum.zig's Decimal
+** One userdata: the unscaled value (the number times 10^scale) as a
+** bigint header, the scale, then the limbs. Decimals are immutable, so
+** their limbs never move and there is no user value or __gc.
+*/
+typedef struct Decimal {
+    BigInt value;
+    int scale;
+} Decimal;
+
+/* Rounding rules, numbered as in src/bignum.zig */
+static const char* const rounding_names[] = {
+    "down", "up", "floor", "ceiling", "half_up", "half_down", "half_even", NULL
+};
+
+#define DECIMAL_HALF_EVEN 6
+
+/*
+** External Zig decimal functions (src/bignum.zig). Results go into limbs
+** the caller sized with the matching *_limbs function, at the scale the
+** caller set; they return 0, or -1 on failure.
+*/
+extern size_t decimal_result_limbs(const Decimal* a, const Decimal* b, int op, int scale);
+extern int decimal_apply(Decimal* r, const Decimal* a, const Decimal* b, int op, int mode);
+extern size_t decimal_rescale_limbs(const Decimal* a, int scale);
+extern int decimal_rescale(Decimal* r, const Decimal* a, int mode);
+extern size_t decimal_string_limbs(size_t len, int scale);
+extern int decimal_set_string(Decimal* r, const char* str, size_t len, int mode);
+
+/* Comparison - returns -1, 0, 1, or -2 on failure */
+extern int decimal_compare(const Decimal* a, const Decimal* b);
+
+static Decimal* check_decimal(lua_State* L, int index) {
+    return (Decimal*)luaL_checkudata(L, index, DECIMAL_METATABLE);
+}
+
+static int check_scale(lua_State* L, int index, int def) {
+    lua_Integer scale = luaL_optinteger(L, index, def);
+    luaL_argcheck(L, scale >= 0 && scale <= DECIMAL_MAX_SCALE, index,
+                  "scale must be between 0 and 38");
+    return (int)scale;
+}
+
+static int check_rounding(lua_State* L, int index) {
+    return luaL_checkoption(L, index, "half_even", rounding_names);
+}
+
+/*
+** Push a new decimal, 0 until set, at `scale` with room for `cap` limbs
+*/
+static Decimal* push_decimal(lua_State* L, int scale, size_t cap) {
+    Decimal* d;
+    if (cap > ((size_t)-1 - sizeof(Decimal)) / sizeof(BigIntLimb)) {
+        luaL_error(L, "decimal too large");
+    }
+    d = (Decimal*)lua_newuserdatauv(L, sizeof(Decimal) + cap * sizeof(BigIntLimb), 0);
+    d->value.limbs = (BigIntLimb*)(d + 1);
+    d->value.limbs[0] = 0;
+    d->value.len = 1;
+    d->value.cap = cap;
+    d->value.positive = 1;
+    d->scale = scale;
+    luaL_setmetatable(L, DECIMAL_METATABLE);
+    return d;
+}
+
+/*
+** Room for a bigint or integer operand, viewed as a decimal of scale 0
+** without becoming one
+*/
+typedef struct Operand {
+    Decimal value;
+    BigIntLimb limbs[BIGINT_I64_LIMBS];
+} Operand;
+
+/*
+** The decimal, bigint or integer at `index` as a decimal, or NULL if it is
+** none of them
+*/
+static const Decimal* to_operand(lua_State* L, int index, Operand* operand) {
+    Decimal* d = (Decimal*)luaL_testudata(L, index, DECIMAL_METATABLE);
+    BigInt* b;
+    lua_Integer value;
+    int isint;
+    if (d != NULL) return d;
+    operand->value.scale = 0;
+    b = (BigInt*)luaL_testudata(L, index, BIGINT_METATABLE);
+    if (b != NULL) {
+        operand->value.value = *b;
+        return &operand->value;
+    }
+    if (lua_type(L, index) != LUA_TNUMBER) return NULL;
+    value = lua_tointegerx(L, index, &isint);
+    if (!isint) return NULL;
+    operand->value.value.limbs = operand->limbs;
+    operand->value.value.cap = BIGINT_I64_LIMBS;
+    bigint_set_i64(&operand->value.value, (long long)value);
+    return &operand->value;
+}
+
+static const Decimal* check_operand(lua_State* L, int index, Operand* operand) {
+    const Decimal* d = to_operand(L, index, operand);
+    if (d == NULL) {
+        luaL_typeerror(L, index, "decimal, bigint or integer");
+    }
+    return d;
+}
+
+/* Push `a` at `scale` */
+static void push_rescaled(lua_State* L, const Decimal* a, int scale, int mode) {
+    Decimal* r = push_decimal(L, scale, decimal_rescale_limbs(a, scale));
+    if (decimal_rescale(r, a, mode) != 0) {
+        luaL_error(L, "failed to create decimal");
+    }
+}
+
+static const char* const op_errors[] = {
+    "decimal addition failed",
+    "decimal subtraction failed",
+    "decimal multiplication failed",
+    "decimal division failed (division by zero?)"
+};
+
+/*
+** a op b at the larger of their scales. Rounding, when the result has
+** more digits than that, follows the option at `mode_index` (0 for the
+** default, half_even).
+*/
+static int arith(lua_State* L, int op, int mode_index) {
+    Operand sa, sb;
+    const Decimal* a = check_operand(L, 1, &sa);
+    const Decimal* b = check_operand(L, 2, &sb);
+    int mode = mode_index ? check_rounding(L, mode_index) : DECIMAL_HALF_EVEN;
+    int scale = a->scale > b->scale ? a->scale : b->scale;
+    Decimal* r;
+    if (a == &sa.value && b == &sb.value) check_decimal(L, 1);
+    r = push_decimal(L, scale, decimal_result_limbs(a, b, op, scale));
+    if (decimal_apply(r, a, b, op, mode) != 0) {
+        return luaL_error(L, "%s", op_errors[op]);
+    }
+    return 1;
+}
+
+/*
+** decimal.new(value [, scale [, rounding]])
+** Constructor function for creating new decimal instances
+**
+** Args:
+**   value: string ("-12.34"), integer, bigint or decimal
+**   scale: digits after the point (default 18, range 0-38)
+**   rounding: for string digits past the scale (default "half_even")
+**
+** Returns:
+**   new decimal userdata
+**
+** Examples:
+**   local price = decimal.new("19.99", 2)
+**   local eth = decimal.new(1)         -- 1.000000000000000000
+*/
+static int l_decimal_new(lua_State* L) {
+    int scale = check_scale(L, 2, DECIMAL_DEFAULT_SCALE);
+    int mode = check_rounding(L, 3);
+    if (lua_type(L, 1) == LUA_TSTRING) {
+        size_t len;
+        const char* str = lua_tolstring(L, 1, &len);
+        Decimal* r = push_decimal(L, scale, decimal_string_limbs(len, scale));
+        if (decimal_set_string(r, str, len, mode) != 0) {
+            return luaL_error(L, "invalid decimal '%s'", str);
+        }
+    } else {
+        Operand storage;
+        const Decimal* a = to_operand(L, 1, &storage);
+        if (a == NULL) {
+            return luaL_typeerror(L, 1, "string, integer, bigint or decimal");
+        }
+        push_rescaled(L, a, scale, mode);
+    }
+    return 1;
+}
+
+/*
+** decimal.fromunits(units, scale)
+** A decimal counting `units` of 10^-scale, e.g. wei with scale 18
+**
+** Args:
+**   units: integer, bigint or string of digits
+**
+** Returns:
+**   new decimal userdata
+*/
+static int l_decimal_fromunits(lua_State* L) {
+    int scale = check_scale(L, 2, DECIMAL_DEFAULT_SCALE);
+    Decimal* r;
+    if (lua_type(L, 1) == LUA_TSTRING) {
+        size_t len;
+        const char* str = lua_tolstring(L, 1, &len);
+        r = push_decimal(L, 0, decimal_string_limbs(len, 0));
+        if (memchr(str, '.', len) != NULL || decimal_set_string(r, str, len, 0) != 0) {
+            return luaL_error(L, "invalid units '%s'", str);
+        }
+    } else {
+        Operand storage;
+        const Decimal* a = to_operand(L, 1, &storage);
+        if (a == NULL || a->scale != 0) {
+            return luaL_typeerror(L, 1, "string, integer or bigint");
+        }
+        push_rescaled(L, a, 0, 0);
+        r = (Decimal*)lua_touserdata(L, -1);
+    }
+    r->scale = scale;
+    return 1;
+}
+
+/*
+** decimal:add(other), decimal:sub(other)
+** Exact sum and difference, at the larger of the two scales
+**
+** Args:
+**   other: another decimal, a bigint or an integer
+*/
+static int l_decimal_add(lua_State* L) {
+    return arith(L, BIGINT_ADD, 0);
+}
+
+static int l_decimal_sub(lua_State* L) {
+    return arith(L, BIGINT_SUB, 0);
+}
+
+/*
+** decimal:mul(other [, rounding]), decimal:div(other [, rounding])
+** Product and quotient at the larger of the two scales, rounded once
+** (default "half_even"); the operators use the default
+**
+** Args:
+**   other: another decimal, a bigint or an integer (non-zero for div)
+*/
+static int l_decimal_mul(lua_State* L) {
+    return arith(L, BIGINT_MUL, 3);
+}
+
+static int l_decimal_div(lua_State* L) {
+    return arith(L, BIGINT_DIV, 3);
+}
+
+static int l_decimal_meta_mul(lua_State* L) {
+    return arith(L, BIGINT_MUL, 0);
+}
+
+static int l_decimal_meta_div(lua_State* L) {
+    return arith(L, BIGINT_DIV, 0);
+}
+
+/*
+** Metamethod: __unm
+*/
+static int l_decimal_meta_unm(lua_State* L) {
+    Decimal* a = check_decimal(L, 1);
+    Decimal zero;
+    BigIntLimb limb = 0;
+    Decimal* r;
+    zero.value.limbs = &limb;
+    zero.value.len = 1;
+    zero.value.cap = 1;
+    zero.value.positive = 1;
+    zero.scale = 0;
+    r = push_decimal(L, a->scale, decimal_result_limbs(&zero, a, BIGINT_SUB, a->scale));
+    if (decimal_apply(r, &zero, a, BIGINT_SUB, DECIMAL_HALF_EVEN) != 0) {
+        return luaL_error(L, "%s", op_errors[BIGINT_SUB]);
+    }
+    return 1;
+}
+
+/*
+** decimal:rescale(scale [, rounding])
+** Returns:
+**   new decimal at `scale`, rounded (default "half_even") if it has fewer
+**   digits
+*/
+static int l_decimal_rescale(lua_State* L) {
+    Decimal* a = check_decimal(L, 1);
+    push_rescaled(L, a, check_scale(L, 2, a->scale), check_rounding(L, 3));
+    return 1;
+}
+
+/*
+** decimal:scale()
+** Returns:
+**   digits after the point
+*/
+static int l_decimal_scale(lua_State* L) {
+    lua_pushinteger(L, check_decimal(L, 1)->scale);
+    return 1;
+}
+
+/* Push the unscaled value's digits, with a leading '-' if negative */
+static const char* push_digits(lua_State* L, const Decimal* d, size_t* len) {
+    size_t cap = bigint_string_len(&d->value, 10);
+    luaL_Buffer b;
+    int n = bigint_to_string(&d->value, 10, luaL_buffinitsize(L, &b, cap), cap);
+    if (n < 0) {
+        luaL_error(L, "failed to convert decimal to string");
+    }
+    luaL_pushresultsize(&b, (size_t)n);
+    return lua_tolstring(L, -1, len);
+}
+
+/*
+** decimal:units()
+** Returns:
+**   the count of 10^-scale units as a string of digits, e.g. wei
+*/
+static int l_decimal_units(lua_State* L) {
+    size_t len;
+    push_digits(L, check_decimal(L, 1), &len);
+    return 1;
+}
+
+/*
+** decimal:tostring() / tostring(decimal)
+** Returns:
+**   the value with exactly `scale` digits after the point
+*/
+static int l_decimal_tostring(lua_State* L) {
+    Decimal* d = check_decimal(L, 1);
+    size_t scale = (size_t)d->scale;
+    size_t len;
+    const char* s = push_digits(L, d, &len);
+    luaL_Buffer b;
+    luaL_buffinit(L, &b);
+    if (*s == '-') {
+        luaL_addchar(&b, '-');
+        s++;
+        len--;
+    }
+    if (len <= scale) {
+        size_t i;
+        luaL_addchar(&b, '0');
+        luaL_addchar(&b, '.');
+        for (i = len; i < scale; i++) luaL_addchar(&b, '0');
+        luaL_addlstring(&b, s, len);
+    } else {
+        luaL_addlstring(&b, s, len - scale);
+        if (scale > 0) {
+            luaL_addchar(&b, '.');
+            luaL_addlstring(&b, s + len - scale, scale);
+        }
+    }
+    luaL_pushresult(&b);
+    return 1;
+}
+
+/*
+** Order of the operands at 1 and 2, whatever their scales. Metamethods
+** are only called with at least one decimal.
+*/
+static int compare(lua_State* L) {
+    Operand sa, sb;
+    const Decimal* a = check_operand(L, 1, &sa);
+    const Decimal* b = check_operand(L, 2, &sb);
+    int cmp = decimal_compare(a, b);
+    if (cmp == -2) {
+        return luaL_error(L, "decimal comparison failed");
+    }
+    return cmp;
+}
+
+/*
+** Metamethods: __eq, __lt, __le
+** 1.5 at scale 1 equals 1.50 at scale 2; either side of < and <= may be
+** a bigint or an integer
+*/
+static int l_decimal_meta_eq(lua_State* L) {
+    lua_pushboolean(L, compare(L) == 0);
+    return 1;
+}
+
+static int l_decimal_meta_lt(lua_State* L) {
+    lua_pushboolean(L, compare(L) < 0);
+    return 1;
+}
+
+static int l_decimal_meta_le(lua_State* L) {
+    lua_pushboolean(L, compare(L) <= 0);
+    return 1;
+}
+
+/*
+** Module function registration table
+** These become accessible as decimal.new(), etc.
+*/
+static const luaL_Reg decimal_functions[] = {
+    {"new", l_decimal_new},
+    {"fromunits", l_decimal_fromunits},
+    {"add", l_decimal_add},
+    {"sub", l_decimal_sub},
+    {"mul", l_decimal_mul},
+    {"div", l_decimal_div},
+    {NULL, NULL}
+};
+
+/*
+** Metamethod registration table
+** These enable operator overloading and special behaviors
+*/
+static const luaL_Reg decimal_metamethods[] = {
+    /* Method functions (accessible as obj:method()) */
+    {"add", l_decimal_add},
+    {"sub", l_decimal_sub},
+    {"mul", l_decimal_mul},
+    {"div", l_decimal_div},
+    {"rescale", l_decimal_rescale},
+    {"scale", l_decimal_scale},
+    {"units", l_decimal_units},
+    {"tostring", l_decimal_tostring},
+
+    /* Operator overloads */
+    {"__add", l_decimal_add},
+    {"__sub", l_decimal_sub},
+    {"__mul", l_decimal_meta_mul},
+    {"__div", l_decimal_meta_div},
+    {"__unm", l_decimal_meta_unm},
+    {"__eq", l_decimal_meta_eq},
+    {"__lt", l_decimal_meta_lt},
+    {"__le", l_decimal_meta_le},
+    {"__tostring", l_decimal_tostring},
+
+    {NULL, NULL}
+};
+
+/*
+** luaopen_decimal
+** Module initialization function - called when the decimal library is
+** loaded
+**
+** Returns:
+**   decimal module table on Lua stack
+*/
+LUAMOD_API int luaopen_decimal(lua_State* L) {
+    luaL_newmetatable(L, DECIMAL_METATABLE);
+    luaL_setfuncs(L, decimal_metamethods, 0);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -2, "__index");
+    lua_pop(L, 1);
+
+    luaL_newlib(L, decimal_functions);
+    lua_pushinteger(L, DECIMAL_MAX_SCALE);
+    lua_setfield(L, -2, "MAX_SCALE");
+    return 1;
+}
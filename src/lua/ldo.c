@@ -21,6 +21,7 @@
 #include "lua.h"
 
 #include "lapi.h"
+#include "lcode.h"
 #include "ldebug.h"
 #include "ldo.h"
 #include "lfunc.h"
@@ -32,6 +33,7 @@
 #include "lstate.h"
 #include "lstring.h"
 #include "ltable.h"
+#include "ltier.h"
 #include "ltm.h"
 #include "lundump.h"
 #include "lvm.h"
@@ -581,6 +583,21 @@ int luaD_pretailcall (lua_State *L, CallInfo *ci, StkId func,
 }
 
 
+#if defined(LUAI_TIER)
+/*
+** Adjust the 'nres' results that compiled code (ltier.c) left at 'func'
+** to the 'wanted' ones, as 'moveresults' does for a C function.
+*/
+static void tierresults (lua_State *L, StkId func, int nres, int wanted) {
+  if (wanted == LUA_MULTRET)
+    wanted = nres;
+  for (; nres < wanted; nres++)
+    setnilvalue(s2v(func + nres));
+  L->top.p = func + wanted;
+}
+#endif
+
+
 /*
 ** Prepares the call to a function (C or Lua). For C functions, also do
 ** the call. The function to be called is at '*func'.  The arguments
@@ -604,6 +621,15 @@ CallInfo *luaD_precall (lua_State *L, StkId func, int nresults) {
       int narg = cast_int(L->top.p - func) - 1;  /* number of real arguments */
       int nfixparams = p->numparams;
       int fsize = p->maxstacksize;  /* frame size */
+#if defined(LUAI_TIER)
+      if (l_unlikely(cu_tier_threshold != 0) && L->hookmask == 0) {
+        int nres = cu_tier_call(L, p, func, narg);
+        if (nres >= 0) {  /* ran compiled? */
+          tierresults(L, func, nres, nresults);
+          return NULL;
+        }
+      }
+#endif
       checkstackGCp(L, fsize, func);
       L->ci = ci = prepCallInfo(L, func, nresults, 0, func + 1 + fsize);
       ci->u.l.savedpc = p->code;  /* starting point */
@@ -1004,6 +1030,8 @@ static void f_parser (lua_State *L, void *ud) {
   else {
     checkmode(L, p->mode, "text");
     cl = luaY_parser(L, p->z, &p->buff, &p->dyd, p->name, c);
+    if (p->mode && strchr(p->mode, 'o'))  /* optimize it? */
+      luaK_optimize(L, cl->p);
   }
   lua_assert(cl->nupvalues == cl->p->sizeupvalues);
   luaF_initupvals(L, cl);
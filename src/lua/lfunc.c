@@ -20,7 +20,9 @@
 #include "lgc.h"
 #include "lmem.h"
 #include "lobject.h"
+#include "lopcodes.h"
 #include "lstate.h"
+#include "ltier.h"
 
 
 
@@ -257,15 +259,62 @@ Proto *luaF_newproto (lua_State *L) {
   f->maxstacksize = 0;
   f->locvars = NULL;
   f->sizelocvars = 0;
+  f->fieldcache = NULL;
+  f->sizefieldcache = 0;
   f->linedefined = 0;
   f->lastlinedefined = 0;
   f->source = NULL;
+#if defined(LUAI_TIER)
+  f->tiercount = 0;
+  f->tierslot = 0;
+  f->tierstamp = 0;
+#endif
   return f;
 }
 
 
+/*
+** Give 'f' the inline caches used by OP_GETFIELD, OP_SETFIELD, OP_SELF,
+** OP_GETTABUP and OP_SETTABUP (see 'getcachedfield' in lvm.c): one node
+** hint per instruction, indexed like 'code', allocated only when the
+** function has such instructions.
+** Must run once 'code' has its final size.
+*/
+/*
+** One hint per instruction, and when there are method calls a second
+** one per instruction after those: OP_SELF keeps the hint for its
+** object at 'pc' and the one for the object's '__index' table at
+** 'sizecode + pc', so neither lookup moves the other's
+*/
+void luaF_initfieldcache (lua_State *L, Proto *f) {
+  int pc;
+  int fields = 0, methods = 0;
+  lua_assert(f->fieldcache == NULL);
+  for (pc = 0; pc < f->sizecode; pc++) {
+    switch (GET_OPCODE(f->code[pc])) {
+      case OP_SELF: methods = 1;  /* FALLTHROUGH */
+      case OP_GETFIELD: case OP_SETFIELD:
+      case OP_GETTABUP: case OP_SETTABUP: fields = 1; break;
+      default: break;
+    }
+  }
+  if (!fields)
+    return;  /* no field access */
+  f->sizefieldcache = methods ? 2 * f->sizecode : f->sizecode;
+  f->fieldcache = luaM_newvector(L, f->sizefieldcache, unsigned int);
+  for (pc = 0; pc < f->sizefieldcache; pc++)
+    f->fieldcache[pc] = 0;
+}
+
+
 void luaF_freeproto (lua_State *L, Proto *f) {
+#if defined(LUAI_TIER)
+  if (f->tierslot != 0)
+    cu_tier_release(f);  /* its slot can take other code */
+#endif
   luaM_freearray(L, f->code, f->sizecode);
+  if (f->fieldcache != NULL)
+    luaM_freearray(L, f->fieldcache, f->sizefieldcache);
   luaM_freearray(L, f->p, f->sizep);
   luaM_freearray(L, f->k, f->sizek);
   luaM_freearray(L, f->lineinfo, f->sizelineinfo);
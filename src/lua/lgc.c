@@ -445,9 +445,9 @@ static void genlink (global_State *g, GCObject *o) {
 */
 static void traverseweakvalue (global_State *g, Table *h) {
   Node *n, *limit = gnodelast(h);
-  /* if there is array part, assume it may have white values (it is not
-     worth traversing it now just to check) */
-  int hasclears = (h->alimit > 0);
+  /* if there is array part or a shape, assume it may have white values
+     (it is not worth traversing it now just to check) */
+  int hasclears = ((h->alimit > 0 && !isunboxed(h)) || h->shape != NULL);
   for (n = gnode(h, 0); n < limit; n++) {  /* traverse hash part */
     if (isempty(gval(n)))  /* entry is empty? */
       clearkey(n);  /* clear its key */
@@ -482,15 +482,22 @@ static int traverseephemeron (global_State *g, Table *h, int inv) {
   int hasclears = 0;  /* true if table has white keys */
   int hasww = 0;  /* true if table has entry "white-key -> white-value" */
   unsigned int i;
-  unsigned int asize = luaH_realasize(h);
+  unsigned int asize = isunboxed(h) ? 0 : luaH_realasize(h);
   unsigned int nsize = sizenode(h);
-  /* traverse array part */
+  /* traverse array part (only numbers, if unboxed) */
   for (i = 0; i < asize; i++) {
     if (valiswhite(&h->array[i])) {
       marked = 1;
       reallymarkobject(g, gcvalue(&h->array[i]));
     }
   }
+  /* traverse fields of a shape (their keys are strings, never cleared) */
+  for (i = 0; h->shape != NULL && cast_int(i) < h->shape->nkeys; i++) {
+    if (valiswhite(&h->fields[i])) {
+      marked = 1;
+      reallymarkobject(g, gcvalue(&h->fields[i]));
+    }
+  }
   /* traverse hash part; if 'inv', traverse descending
      (see 'convergeephemerons') */
   for (i = 0; i < nsize; i++) {
@@ -523,9 +530,11 @@ static int traverseephemeron (global_State *g, Table *h, int inv) {
 static void traversestrongtable (global_State *g, Table *h) {
   Node *n, *limit = gnodelast(h);
   unsigned int i;
-  unsigned int asize = luaH_realasize(h);
-  for (i = 0; i < asize; i++)  /* traverse array part */
+  unsigned int asize = isunboxed(h) ? 0 : luaH_realasize(h);
+  for (i = 0; i < asize; i++)  /* traverse array part, unless unboxed */
     markvalue(g, &h->array[i]);
+  for (i = 0; h->shape != NULL && cast_int(i) < h->shape->nkeys; i++)
+    markvalue(g, &h->fields[i]);  /* traverse fields of a shape */
   for (n = gnode(h, 0); n < limit; n++) {  /* traverse hash part */
     if (isempty(gval(n)))  /* entry is empty? */
       clearkey(n);  /* clear its key */
@@ -539,11 +548,24 @@ static void traversestrongtable (global_State *g, Table *h) {
 }
 
 
+/*
+** Mark the keys of a shaped table. They are always strong: strings
+** are never removed from weak tables.
+*/
+static void markshapekeys (global_State *g, Shape *s) {
+  int i;
+  for (i = 0; i < s->nkeys; i++)
+    markobject(g, s->keys[i]);
+}
+
+
 static lu_mem traversetable (global_State *g, Table *h) {
   const char *weakkey, *weakvalue;
   const TValue *mode = gfasttm(g, h->metatable, TM_MODE);
   TString *smode;
   markobjectN(g, h->metatable);
+  if (h->shape != NULL)
+    markshapekeys(g, h->shape);
   if (mode && ttisshrstring(mode) &&  /* is there a weak mode? */
       (cast_void(smode = tsvalue(mode)),
        cast_void(weakkey = strchr(getshrstr(smode), 'k')),
@@ -558,7 +580,8 @@ static lu_mem traversetable (global_State *g, Table *h) {
   }
   else  /* not weak */
     traversestrongtable(g, h);
-  return 1 + h->alimit + 2 * allocsizenode(h);
+  return 1 + h->alimit + 2 * allocsizenode(h) +
+         ((h->shape != NULL) ? cast(lu_mem, 2 * h->shape->nkeys) : 0);
 }
 
 
@@ -746,12 +769,17 @@ static void clearbyvalues (global_State *g, GCObject *l, GCObject *f) {
     Table *h = gco2t(l);
     Node *n, *limit = gnodelast(h);
     unsigned int i;
-    unsigned int asize = luaH_realasize(h);
-    for (i = 0; i < asize; i++) {
+    unsigned int asize = isunboxed(h) ? 0 : luaH_realasize(h);
+    for (i = 0; i < asize; i++) {  /* (unboxed numbers are never cleared) */
       TValue *o = &h->array[i];
       if (iscleared(g, gcvalueN(o)))  /* value was collected? */
         setempty(o);  /* remove entry */
     }
+    for (i = 0; h->shape != NULL && cast_int(i) < h->shape->nkeys; i++) {
+      TValue *o = &h->fields[i];
+      if (iscleared(g, gcvalueN(o)))  /* value was collected? */
+        setempty(o);  /* remove entry (its key stays in the shape) */
+    }
     for (n = gnode(h, 0); n < limit; n++) {
       if (iscleared(g, gcvalueN(gval(n))))  /* unmarked value? */
         setempty(gval(n));  /* remove entry */
@@ -770,6 +798,7 @@ static void freeupval (lua_State *L, UpVal *uv) {
 
 
 static void freeobj (lua_State *L, GCObject *o) {
+  luai_freeobject(L, o);
   switch (o->tt) {
     case LUA_VPROTO:
       luaF_freeproto(L, gco2p(o));
@@ -870,7 +899,8 @@ static GCObject **sweeptolive (lua_State *L, GCObject **p) {
 */
 static void checkSizes (lua_State *L, global_State *g) {
   if (!g->gcemergency) {
-    if (g->strt.nuse < g->strt.size / 4) {  /* string table too big? */
+    if (g->strt.nuse < g->strt.size / 4 &&  /* string table too big? */
+        g->strt.size / 2 >= g->strt.minsize) {
       l_mem olddebt = g->GCdebt;
       luaS_resize(L, g->strt.size / 2);
       g->GCestimate += g->GCdebt - olddebt;  /* correct estimate */
@@ -1692,10 +1722,15 @@ void luaC_step (lua_State *L) {
   if (!gcrunning(g))  /* not running? */
     luaE_setdebt(g, -2000);
   else {
-    if(isdecGCmodegen(g))
+    luai_gcpausebegin(L);
+    if(isdecGCmodegen(g)) {
       genstep(L, g);
-    else
+      luai_gcpauseend(L, LUAI_GCPAUSEGEN);
+    }
+    else {
       incstep(L, g);
+      luai_gcpauseend(L, LUAI_GCPAUSEINC);
+    }
   }
 }
 
@@ -1731,10 +1766,14 @@ void luaC_fullgc (lua_State *L, int isemergency) {
   global_State *g = G(L);
   lua_assert(!g->gcemergency);
   g->gcemergency = isemergency;  /* set flag */
+  luai_gcpausebegin(L);
   if (g->gckind == KGC_INC)
     fullinc(L, g);
   else
     fullgen(L, g);
+  if (isemergency)  /* give back the memory of pooled threads too */
+    luaE_freethreadpool(L);
+  luai_gcpauseend(L, LUAI_GCPAUSEFULL);
   g->gcemergency = 0;
 }
 
@@ -44,7 +44,9 @@ static const luaL_Reg loadedlibs[] = {
   {LUA_LOADLIBNAME, luaopen_package},
   {LUA_COLIBNAME, luaopen_coroutine},
   {LUA_TABLIBNAME, luaopen_table},
+#if !defined(LUA_CU_NO_IOLIB)  /* cu: the small build leaves io out */
   {LUA_IOLIBNAME, luaopen_io},
+#endif
   {LUA_OSLIBNAME, luaopen_os},
   {LUA_STRLIBNAME, luaopen_string},
   {LUA_MATHLIBNAME, luaopen_math},
@@ -63,3 +65,85 @@ LUALIB_API void luaL_openlibs (lua_State *L) {
   }
 }
 
+
+/*
+** cu: init() opens only the libraries the host chose (set_stdlibs), by
+** bit: the order of 'stdlibs'. Base and package are always opened. Those
+** chosen to open lazily are preloaded, so require finds them, and a
+** __index on _G opens one on its first global access. string is never
+** lazy: its methods are reached through the string metatable, not _G.
+*/
+static const luaL_Reg stdlibs[] = {
+  {LUA_COLIBNAME, luaopen_coroutine},
+  {LUA_TABLIBNAME, luaopen_table},
+#if !defined(LUA_CU_NO_IOLIB)
+  {LUA_IOLIBNAME, luaopen_io},
+#else
+  {LUA_IOLIBNAME, NULL},
+#endif
+  {LUA_OSLIBNAME, luaopen_os},
+  {LUA_STRLIBNAME, luaopen_string},
+  {LUA_MATHLIBNAME, luaopen_math},
+  {LUA_UTF8LIBNAME, luaopen_utf8},
+  {LUA_DBLIBNAME, luaopen_debug},
+};
+
+#define CU_STRLIB_BIT  (1u << 4)
+
+/* main.zig: C functions of a library opened late can now be stored */
+extern void cu_stdlib_opened (lua_State *L);
+
+/* _G.__index; upvalue 1: { [name] = luaopen_name } not opened yet */
+static int lazylib_index (lua_State *L) {
+  lua_CFunction openf;
+  if (lua_type(L, 2) != LUA_TSTRING) return 0;
+  lua_pushvalue(L, 2);
+  if (lua_rawget(L, lua_upvalueindex(1)) != LUA_TFUNCTION) return 0;
+  openf = lua_tocfunction(L, -1);
+  lua_pushvalue(L, 2);
+  lua_pushnil(L);
+  lua_rawset(L, lua_upvalueindex(1));
+  /* sets _G[name], so this runs once per library */
+  luaL_requiref(L, lua_tostring(L, 2), openf, 1);
+  cu_stdlib_opened(L);
+  return 1;
+}
+
+LUALIB_API void cu_openlibs (lua_State *L, unsigned open, unsigned lazy) {
+  size_t i;
+  luaL_requiref(L, LUA_GNAME, luaopen_base, 1);
+  lua_pop(L, 1);
+  luaL_requiref(L, LUA_LOADLIBNAME, luaopen_package, 1);
+  lua_pop(L, 1);
+  lazy &= open & ~CU_STRLIB_BIT;
+  if (lazy != 0) {
+    lua_newtable(L);  /* libraries still to open */
+    luaL_getsubtable(L, LUA_REGISTRYINDEX, LUA_PRELOAD_TABLE);
+  }
+  for (i = 0; i < sizeof(stdlibs) / sizeof(stdlibs[0]); i++) {
+    const luaL_Reg *lib = &stdlibs[i];
+    if (lib->func == NULL || !(open & (1u << i))) continue;
+    if (lazy & (1u << i)) {
+      lua_pushcfunction(L, lib->func);
+      lua_setfield(L, -3, lib->name);
+      lua_pushcfunction(L, lib->func);
+      lua_setfield(L, -2, lib->name);
+    }
+    else {
+      luaL_requiref(L, lib->name, lib->func, 1);
+      lua_pop(L, 1);
+    }
+  }
+  if (lazy != 0) {
+    lua_pop(L, 1);  /* preload table */
+    lua_createtable(L, 0, 1);  /* _G's metatable */
+    lua_insert(L, -2);
+    lua_pushcclosure(L, lazylib_index, 1);
+    lua_setfield(L, -2, "__index");
+    lua_pushglobaltable(L);
+    lua_insert(L, -2);
+    lua_setmetatable(L, -2);
+    lua_pop(L, 1);
+  }
+}
+
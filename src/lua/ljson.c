@@ -0,0 +1,567 @@
+/*
+** ljson.c
+** Lua json library - JSON encoding and decoding in C
+** decode builds Lua tables directly in one pass over the text; encode
+** writes into a single growing buffer. Both stand in for JSON assembled
+** with string concatenation in Lua and for payloads spread over _io
+*/
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+
+/*
+** Deepest nesting of arrays and objects either direction accepts; each
+** level is a C call frame and a few Lua stack slots
+*/
+#define JSON_MAX_DEPTH 200
+
+/*
+** json.null stands for JSON null inside arrays and objects, where nil
+** would drop the slot. It is the NULL light userdata, which is equal to
+** itself in every state
+*/
+#define json_pushnull(L) lua_pushlightuserdata(L, NULL)
+
+static int json_isnull(lua_State* L, int index) {
+    return lua_type(L, index) == LUA_TLIGHTUSERDATA && lua_touserdata(L, index) == NULL;
+}
+
+/* Bytes that end a plain run of string content */
+#define json_isspecial(c) ((unsigned char)(c) < 0x20 || (c) == '"' || (c) == '\\')
+
+/* ======================================================================
+** Decoding
+** ====================================================================== */
+
+typedef struct JsonDecoder {
+    lua_State* L;
+    const char* start;
+    const char* p;
+    const char* end;
+    int depth;
+} JsonDecoder;
+
+static void decode_value(JsonDecoder* d);
+
+static int decode_error(JsonDecoder* d, const char* what) {
+    return luaL_error(d->L, "json.decode: %s at position %d", what, (int)(d->p - d->start) + 1);
+}
+
+static void skip_space(JsonDecoder* d) {
+    while (d->p < d->end && (*d->p == ' ' || *d->p == '\n' || *d->p == '\r' || *d->p == '\t')) {
+        d->p++;
+    }
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/* Four hex digits after "\u"; -1 if malformed */
+static long read_hex4(JsonDecoder* d) {
+    long code = 0;
+    int i;
+    if (d->end - d->p < 4) return -1;
+    for (i = 0; i < 4; i++) {
+        int v = hex_value(d->p[i]);
+        if (v < 0) return -1;
+        code = (code << 4) | v;
+    }
+    d->p += 4;
+    return code;
+}
+
+/* \uXXXX (and its low surrogate, if any) as UTF-8 */
+static void decode_unicode_escape(JsonDecoder* d, luaL_Buffer* b) {
+    char utf8[4];
+    int n;
+    long code = read_hex4(d);
+    if (code < 0) decode_error(d, "invalid unicode escape");
+    if (code >= 0xDC00 && code <= 0xDFFF) decode_error(d, "unpaired surrogate");
+    if (code >= 0xD800 && code <= 0xDBFF) {
+        long low;
+        if (d->end - d->p < 2 || d->p[0] != '\\' || d->p[1] != 'u') {
+            decode_error(d, "unpaired surrogate");
+        }
+        d->p += 2;
+        low = read_hex4(d);
+        if (low < 0xDC00 || low > 0xDFFF) decode_error(d, "unpaired surrogate");
+        code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+    }
+
+    if (code < 0x80) {
+        utf8[0] = (char)code;
+        n = 1;
+    } else if (code < 0x800) {
+        utf8[0] = (char)(0xC0 | (code >> 6));
+        utf8[1] = (char)(0x80 | (code & 0x3F));
+        n = 2;
+    } else if (code < 0x10000) {
+        utf8[0] = (char)(0xE0 | (code >> 12));
+        utf8[1] = (char)(0x80 | ((code >> 6) & 0x3F));
+        utf8[2] = (char)(0x80 | (code & 0x3F));
+        n = 3;
+    } else {
+        utf8[0] = (char)(0xF0 | (code >> 18));
+        utf8[1] = (char)(0x80 | ((code >> 12) & 0x3F));
+        utf8[2] = (char)(0x80 | ((code >> 6) & 0x3F));
+        utf8[3] = (char)(0x80 | (code & 0x3F));
+        n = 4;
+    }
+    luaL_addlstring(b, utf8, n);
+}
+
+/*
+** Pushes the string starting at the opening quote. Strings without
+** escapes, the common case, are pushed straight from the input
+*/
+static void decode_string(JsonDecoder* d) {
+    lua_State* L = d->L;
+    const char* run = ++d->p;
+    luaL_Buffer b;
+
+    while (d->p < d->end && !json_isspecial(*d->p)) d->p++;
+    if (d->p < d->end && *d->p == '"') {
+        lua_pushlstring(L, run, d->p - run);
+        d->p++;
+        return;
+    }
+
+    luaL_buffinit(L, &b);
+    for (;;) {
+        luaL_addlstring(&b, run, d->p - run);
+        if (d->p >= d->end) decode_error(d, "unterminated string");
+        if (*d->p == '"') break;
+        if (*d->p != '\\') decode_error(d, "control character in string");
+
+        d->p++;
+        if (d->p >= d->end) decode_error(d, "unterminated string");
+        switch (*d->p++) {
+            case '"': luaL_addchar(&b, '"'); break;
+            case '\\': luaL_addchar(&b, '\\'); break;
+            case '/': luaL_addchar(&b, '/'); break;
+            case 'b': luaL_addchar(&b, '\b'); break;
+            case 'f': luaL_addchar(&b, '\f'); break;
+            case 'n': luaL_addchar(&b, '\n'); break;
+            case 'r': luaL_addchar(&b, '\r'); break;
+            case 't': luaL_addchar(&b, '\t'); break;
+            case 'u': decode_unicode_escape(d, &b); break;
+            default:
+                d->p--;
+                decode_error(d, "invalid escape");
+        }
+
+        run = d->p;
+        while (d->p < d->end && !json_isspecial(*d->p)) d->p++;
+    }
+    d->p++;
+    luaL_pushresult(&b);
+}
+
+/*
+** Integers that fit a lua_Integer (math.mininteger..math.maxinteger, in
+** either build) become Lua integers; anything with a fraction, an
+** exponent or a larger magnitude goes through lua_str2number
+*/
+static void decode_number(JsonDecoder* d) {
+    const char* start = d->p;
+    const char* digits;
+    int is_float = 0;
+
+    if (d->p < d->end && *d->p == '-') d->p++;
+    digits = d->p;
+    if (d->p < d->end && *d->p == '0') {
+        d->p++;
+    } else if (d->p < d->end && *d->p >= '1' && *d->p <= '9') {
+        while (d->p < d->end && *d->p >= '0' && *d->p <= '9') d->p++;
+    } else {
+        decode_error(d, "invalid number");
+    }
+    if (d->p < d->end && *d->p == '.') {
+        is_float = 1;
+        d->p++;
+        if (d->p >= d->end || *d->p < '0' || *d->p > '9') decode_error(d, "invalid number");
+        while (d->p < d->end && *d->p >= '0' && *d->p <= '9') d->p++;
+    }
+    if (d->p < d->end && (*d->p == 'e' || *d->p == 'E')) {
+        is_float = 1;
+        d->p++;
+        if (d->p < d->end && (*d->p == '+' || *d->p == '-')) d->p++;
+        if (d->p >= d->end || *d->p < '0' || *d->p > '9') decode_error(d, "invalid number");
+        while (d->p < d->end && *d->p >= '0' && *d->p <= '9') d->p++;
+    }
+
+    if (!is_float) {
+        /* The magnitude, up to math.maxinteger or, negated, one more */
+        lua_Unsigned limit = (lua_Unsigned)LUA_MAXINTEGER + (*start == '-');
+        lua_Unsigned value = 0;
+        const char* c;
+        for (c = digits; c < d->p; c++) {
+            unsigned digit = (unsigned)(*c - '0');
+            if (value > (limit - digit) / 10) break;
+            value = value * 10 + digit;
+        }
+        if (c == d->p) {
+            lua_pushinteger(d->L, (lua_Integer)(*start == '-' ? 0u - value : value));
+            return;
+        }
+    }
+    /* The input is NUL-terminated and the numeral is well formed */
+    lua_pushnumber(d->L, lua_str2number(start, NULL));
+}
+
+static void decode_literal(JsonDecoder* d, const char* word, size_t len) {
+    if ((size_t)(d->end - d->p) < len || memcmp(d->p, word, len) != 0) {
+        decode_error(d, "unexpected character");
+    }
+    d->p += len;
+}
+
+static void enter_container(JsonDecoder* d) {
+    if (++d->depth > JSON_MAX_DEPTH) decode_error(d, "nesting too deep");
+    luaL_checkstack(d->L, 4, "json.decode: nesting too deep");
+    d->p++;
+}
+
+static void decode_array(JsonDecoder* d) {
+    lua_Integer n = 0;
+    enter_container(d);
+    lua_newtable(d->L);
+    skip_space(d);
+    if (d->p < d->end && *d->p == ']') {
+        d->p++;
+        d->depth--;
+        return;
+    }
+    for (;;) {
+        decode_value(d);
+        lua_rawseti(d->L, -2, ++n);
+        skip_space(d);
+        if (d->p < d->end && *d->p == ',') {
+            d->p++;
+        } else if (d->p < d->end && *d->p == ']') {
+            d->p++;
+            break;
+        } else {
+            decode_error(d, "expected ',' or ']'");
+        }
+    }
+    d->depth--;
+}
+
+static void decode_object(JsonDecoder* d) {
+    enter_container(d);
+    lua_newtable(d->L);
+    skip_space(d);
+    if (d->p < d->end && *d->p == '}') {
+        d->p++;
+        d->depth--;
+        return;
+    }
+    for (;;) {
+        skip_space(d);
+        if (d->p >= d->end || *d->p != '"') decode_error(d, "expected string key");
+        decode_string(d);
+        skip_space(d);
+        if (d->p >= d->end || *d->p != ':') decode_error(d, "expected ':'");
+        d->p++;
+        decode_value(d);
+        lua_rawset(d->L, -3);
+        skip_space(d);
+        if (d->p < d->end && *d->p == ',') {
+            d->p++;
+        } else if (d->p < d->end && *d->p == '}') {
+            d->p++;
+            break;
+        } else {
+            decode_error(d, "expected ',' or '}'");
+        }
+    }
+    d->depth--;
+}
+
+static void decode_value(JsonDecoder* d) {
+    skip_space(d);
+    if (d->p >= d->end) decode_error(d, "unexpected end of input");
+    switch (*d->p) {
+        case '{': decode_object(d); break;
+        case '[': decode_array(d); break;
+        case '"': decode_string(d); break;
+        case 't': decode_literal(d, "true", 4); lua_pushboolean(d->L, 1); break;
+        case 'f': decode_literal(d, "false", 5); lua_pushboolean(d->L, 0); break;
+        case 'n': decode_literal(d, "null", 4); json_pushnull(d->L); break;
+        default:
+            if (*d->p == '-' || (*d->p >= '0' && *d->p <= '9')) {
+                decode_number(d);
+            } else {
+                decode_error(d, "unexpected character");
+            }
+    }
+}
+
+/*
+** json.decode(text)
+** Parses a JSON document
+**
+** Returns:
+**   the value; objects and arrays become tables, null becomes json.null
+**   Raises an error naming the position of the first invalid byte
+*/
+static int l_json_decode(lua_State* L) {
+    size_t len;
+    JsonDecoder d;
+    d.L = L;
+    d.start = luaL_checklstring(L, 1, &len);
+    d.p = d.start;
+    d.end = d.start + len;
+    d.depth = 0;
+
+    decode_value(&d);
+    skip_space(&d);
+    if (d.p != d.end) decode_error(&d, "trailing characters");
+    return 1;
+}
+
+/* ======================================================================
+** Encoding
+** ====================================================================== */
+
+/*
+** The output lives in a full userdata at a fixed stack slot, replaced by
+** a larger one as it fills. luaL_Buffer cannot be used: it must stay on
+** top of the stack, and table traversal pushes keys and values over it.
+** A userdata is also collected if an error unwinds the encoder
+*/
+typedef struct JsonEncoder {
+    lua_State* L;
+    char* data;
+    size_t len;
+    size_t cap;
+    int box;    /* stack index of the userdata holding data */
+    int depth;
+} JsonEncoder;
+
+static void encode_value(JsonEncoder* e, int index);
+
+static void encode_reserve(JsonEncoder* e, size_t n) {
+    size_t cap = e->cap;
+    char* data;
+    if (cap - e->len >= n) return;
+    while (cap - e->len < n) cap *= 2;
+    data = (char*)lua_newuserdatauv(e->L, cap, 0);
+    memcpy(data, e->data, e->len);
+    lua_replace(e->L, e->box);
+    e->data = data;
+    e->cap = cap;
+}
+
+static void encode_bytes(JsonEncoder* e, const char* s, size_t n) {
+    encode_reserve(e, n);
+    memcpy(e->data + e->len, s, n);
+    e->len += n;
+}
+
+#define encode_char(e, c) (encode_reserve((e), 1), (e)->data[(e)->len++] = (c))
+
+static void encode_string(JsonEncoder* e, const char* s, size_t len) {
+    static const char hex[] = "0123456789abcdef";
+    const char* end = s + len;
+    encode_char(e, '"');
+    while (s < end) {
+        const char* run = s;
+        while (s < end && !json_isspecial(*s)) s++;
+        encode_bytes(e, run, s - run);
+        if (s == end) break;
+
+        switch (*s) {
+            case '"': encode_bytes(e, "\\\"", 2); break;
+            case '\\': encode_bytes(e, "\\\\", 2); break;
+            case '\b': encode_bytes(e, "\\b", 2); break;
+            case '\f': encode_bytes(e, "\\f", 2); break;
+            case '\n': encode_bytes(e, "\\n", 2); break;
+            case '\r': encode_bytes(e, "\\r", 2); break;
+            case '\t': encode_bytes(e, "\\t", 2); break;
+            default: {
+                char esc[6] = { '\\', 'u', '0', '0', 0, 0 };
+                esc[4] = hex[(unsigned char)*s >> 4];
+                esc[5] = hex[*s & 0xF];
+                encode_bytes(e, esc, 6);
+            }
+        }
+        s++;
+    }
+    encode_char(e, '"');
+}
+
+/* Text of the number at index, without converting the value in place */
+static int number_text(JsonEncoder* e, int index, char* buf, size_t size) {
+    if (lua_isinteger(e->L, index)) {
+        return lua_integer2str(buf, size, lua_tointeger(e->L, index));
+    } else {
+        lua_Number n = lua_tonumber(e->L, index);
+        if (n != n || n - n != 0) luaL_error(e->L, "json.encode: cannot encode inf or nan");
+        return lua_number2str(buf, size, n);
+    }
+}
+
+/* n when the table's keys are exactly 1..n, else -1 */
+static lua_Integer array_length(lua_State* L, int index) {
+    lua_Integer count = 0;
+    lua_Integer max = 0;
+    lua_pushnil(L);
+    while (lua_next(L, index)) {
+        lua_pop(L, 1);
+        if (!lua_isinteger(L, -1) || lua_tointeger(L, -1) < 1) {
+            lua_pop(L, 1);
+            return -1;
+        }
+        if (lua_tointeger(L, -1) > max) max = lua_tointeger(L, -1);
+        count++;
+    }
+    return count == max ? count : -1;
+}
+
+static void encode_table(JsonEncoder* e, int index) {
+    lua_State* L = e->L;
+    lua_Integer n;
+    int first = 1;
+
+    if (++e->depth > JSON_MAX_DEPTH) luaL_error(L, "json.encode: nesting too deep (or a cycle)");
+    luaL_checkstack(L, 4, "json.encode: nesting too deep");
+
+    n = array_length(L, index);
+    if (n > 0) {
+        lua_Integer i;
+        encode_char(e, '[');
+        for (i = 1; i <= n; i++) {
+            if (i > 1) encode_char(e, ',');
+            lua_rawgeti(L, index, i);
+            encode_value(e, lua_gettop(L));
+            lua_pop(L, 1);
+        }
+        encode_char(e, ']');
+        e->depth--;
+        return;
+    }
+
+    /* Empty tables encode as {} */
+    encode_char(e, '{');
+    lua_pushnil(L);
+    while (lua_next(L, index)) {
+        int key = lua_gettop(L) - 1;
+        if (!first) encode_char(e, ',');
+        first = 0;
+
+        if (lua_type(L, key) == LUA_TSTRING) {
+            size_t len;
+            const char* s = lua_tolstring(L, key, &len);
+            encode_string(e, s, len);
+        } else if (lua_type(L, key) == LUA_TNUMBER) {
+            char buf[64];
+            int len = number_text(e, key, buf, sizeof(buf));
+            encode_char(e, '"');
+            encode_bytes(e, buf, len);
+            encode_char(e, '"');
+        } else {
+            luaL_error(L, "json.encode: table keys must be strings or numbers, got %s",
+                       luaL_typename(L, key));
+        }
+        encode_char(e, ':');
+        encode_value(e, key + 1);
+        lua_pop(L, 1);
+    }
+    encode_char(e, '}');
+    e->depth--;
+}
+
+static void encode_value(JsonEncoder* e, int index) {
+    lua_State* L = e->L;
+    switch (lua_type(L, index)) {
+        case LUA_TNIL:
+            encode_bytes(e, "null", 4);
+            break;
+        case LUA_TBOOLEAN:
+            if (lua_toboolean(L, index)) encode_bytes(e, "true", 4);
+            else encode_bytes(e, "false", 5);
+            break;
+        case LUA_TNUMBER: {
+            char buf[64];
+            int len = number_text(e, index, buf, sizeof(buf));
+            encode_bytes(e, buf, len);
+            break;
+        }
+        case LUA_TSTRING: {
+            size_t len;
+            const char* s = lua_tolstring(L, index, &len);
+            encode_string(e, s, len);
+            break;
+        }
+        case LUA_TTABLE:
+            encode_table(e, index);
+            break;
+        default:
+            if (json_isnull(L, index)) {
+                encode_bytes(e, "null", 4);
+            } else {
+                luaL_error(L, "json.encode: cannot encode %s", luaL_typename(L, index));
+            }
+    }
+}
+
+/*
+** json.encode(value)
+** Serializes a value as compact JSON
+**
+** Tables whose keys are exactly 1..n become arrays; other tables become
+** objects, with number keys written as strings. Fails on functions,
+** userdata, inf, nan and nesting deeper than JSON_MAX_DEPTH
+**
+** Returns:
+**   the JSON text
+*/
+static int l_json_encode(lua_State* L) {
+    JsonEncoder e;
+    luaL_checkany(L, 1);
+    lua_settop(L, 1);
+    e.L = L;
+    e.len = 0;
+    e.cap = 256;
+    e.data = (char*)lua_newuserdatauv(L, e.cap, 0);
+    e.box = lua_gettop(L);
+    e.depth = 0;
+
+    encode_value(&e, 1);
+    lua_pushlstring(L, e.data, e.len);
+    return 1;
+}
+
+/*
+** Module function registration table
+** These become accessible as json.encode(), etc.
+*/
+static const luaL_Reg json_functions[] = {
+    {"encode", l_json_encode},
+    {"decode", l_json_decode},
+    {"null", NULL},
+    {NULL, NULL}
+};
+
+/*
+** luaopen_json
+** Module initialization function - called when the json library is loaded
+**
+** Returns:
+**   json module table on Lua stack
+*/
+LUAMOD_API int luaopen_json(lua_State* L) {
+    luaL_newlib(L, json_functions);
+    json_pushnull(L);
+    lua_setfield(L, -2, "null");
+    return 1;
+}
@@ -135,8 +135,11 @@ TString *luaX_newstring (LexState *ls, const char *str, size_t l) {
   lua_State *L = ls->L;
   TString *ts = luaS_newlstr(L, str, l);  /* create new string */
   const TValue *o = luaH_getstr(ls->h, ts);
-  if (!ttisnil(o))  /* string already present? */
-    ts = keystrval(nodefromval(o));  /* get saved copy */
+  if (!ttisnil(o)) {  /* string already present? */
+    /* short strings are unique; a long one is a key in a hash node */
+    if (ts->tt == LUA_VLNGSTR)
+      ts = keystrval(nodefromval(o));  /* get saved copy */
+  }
   else {  /* not in use yet */
     TValue *stv = s2v(L->top.p++);  /* reserve stack space for string */
     setsvalue(L, stv, ts);  /* temporarily anchor the string */
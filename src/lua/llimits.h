@@ -302,6 +302,43 @@ typedef l_uint32 Instruction;
 #define luai_userstateyield(L,n)	((void)L)
 #endif
 
+/*
+** luai_gcpausebegin/luai_gcpauseend bracket each collector entry
+** (luaC_step and luaC_fullgc); 'kind' tells what the pause did.
+*/
+#define LUAI_GCPAUSEINC		0	/* an incremental step */
+#define LUAI_GCPAUSEGEN		1	/* a generational minor or major collection */
+#define LUAI_GCPAUSEFULL	2	/* a whole cycle (luaC_fullgc) */
+
+#if !defined(luai_gcpausebegin)
+#define luai_gcpausebegin(L)		((void)L)
+#endif
+
+#if !defined(luai_gcpauseend)
+#define luai_gcpauseend(L,kind)		((void)L)
+#endif
+
+/*
+** luai_allocnote/luai_reallocnote/luai_freenote see every allocation
+** lmem.c makes (with the type tag of luaM_malloc_), and luai_freeobject
+** sees each collectable object just before lgc.c frees it.
+*/
+#if !defined(luai_allocnote)
+#define luai_allocnote(L,tag,size)	((void)L)
+#endif
+
+#if !defined(luai_reallocnote)
+#define luai_reallocnote(L,osize,nsize)	((void)L)
+#endif
+
+#if !defined(luai_freenote)
+#define luai_freenote(L,osize)		((void)L)
+#endif
+
+#if !defined(luai_freeobject)
+#define luai_freeobject(L,o)		((void)L)
+#endif
+
 
 
 /*
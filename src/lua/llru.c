@@ -0,0 +1,320 @@
+/*
+** llru.c
+** Lua lru library - a bounded cache for memoizing inside the VM
+** A plain table used as a memo never lets go of an entry and in time fills
+** the fixed heap, and a weak one is emptied by every collection. An lru
+** holds at most `capacity` entries and, when full, drops the one used
+** least recently to make room.
+*/
+
+#include <string.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+
+#define LRU_METATABLE "cu.lru"
+#define LRU_MAX_CAPACITY (1 << 24)
+
+/* User values of an lru */
+#define LRU_INDEX 1  /* key -> slot */
+#define LRU_KEYS 2   /* slot -> key */
+#define LRU_VALUES 3 /* slot -> value */
+
+/*
+** Keys and values stay Lua values, in the lru's user value tables, so the
+** collector sees them. The recency list is intrusive: slot i's neighbours
+** are prev[i] and next[i], most recently used first from `head`, with 0
+** for none. Freed slots are chained through next[] from `free`.
+*/
+typedef struct Lru {
+    int capacity;
+    int size;
+    int used; /* slots handed out so far; the rest are fresh */
+    int head;
+    int tail;
+    int free;
+    lua_Integer hits;
+    lua_Integer misses;
+    lua_Integer evictions;
+    int* prev;
+    int* next;
+} Lru;
+
+static Lru* check_lru(lua_State* L, int index) {
+    return (Lru*)luaL_checkudata(L, index, LRU_METATABLE);
+}
+
+static void lru_unlink(Lru* c, int slot) {
+    if (c->prev[slot]) c->next[c->prev[slot]] = c->next[slot];
+    else c->head = c->next[slot];
+    if (c->next[slot]) c->prev[c->next[slot]] = c->prev[slot];
+    else c->tail = c->prev[slot];
+}
+
+static void lru_push_front(Lru* c, int slot) {
+    c->prev[slot] = 0;
+    c->next[slot] = c->head;
+    if (c->head) c->prev[c->head] = slot;
+    else c->tail = slot;
+    c->head = slot;
+}
+
+/* The slot of the key at `key`, 0 if it is not cached */
+static int lru_find(lua_State* L, int key) {
+    int slot;
+    lua_getiuservalue(L, 1, LRU_INDEX);
+    lua_pushvalue(L, key);
+    lua_rawget(L, -2);
+    slot = (int)lua_tointeger(L, -1);
+    lua_pop(L, 2);
+    return slot;
+}
+
+/* Set entry `slot` of user value table `which` to the value on top, popped */
+static void lru_store(lua_State* L, int which, int slot) {
+    lua_getiuservalue(L, 1, which);
+    lua_rotate(L, -2, 1);
+    lua_rawseti(L, -2, slot);
+    lua_pop(L, 1);
+}
+
+/* Forget the key of `slot`, leaving the slot's list links alone */
+static void lru_clear_slot(lua_State* L, int slot) {
+    lua_getiuservalue(L, 1, LRU_INDEX);
+    lua_getiuservalue(L, 1, LRU_KEYS);
+    lua_rawgeti(L, -1, slot);
+    lua_pushnil(L);
+    lua_rawset(L, -4);
+    lua_pushnil(L);
+    lua_rawseti(L, -2, slot);
+    lua_pop(L, 2);
+    lua_pushnil(L);
+    lru_store(L, LRU_VALUES, slot);
+}
+
+/* Push the value of `slot` */
+static void lru_push_value(lua_State* L, int slot) {
+    lua_getiuservalue(L, 1, LRU_VALUES);
+    lua_rawgeti(L, -1, slot);
+    lua_remove(L, -2);
+}
+
+static void lru_check_key(lua_State* L) {
+    luaL_argcheck(L, !lua_isnil(L, 2), 2, "key must not be nil");
+    luaL_argcheck(L, !(lua_type(L, 2) == LUA_TNUMBER && lua_tonumber(L, 2) != lua_tonumber(L, 2)), 2, "key must not be NaN");
+}
+
+/*
+** lru.new(capacity)
+** Creates an empty cache that holds at most `capacity` entries
+**
+** Returns:
+**   the lru
+*/
+static int l_lru_new(lua_State* L) {
+    lua_Integer capacity = luaL_checkinteger(L, 1);
+    Lru* c;
+    luaL_argcheck(L, capacity >= 1 && capacity <= LRU_MAX_CAPACITY, 1, "capacity must be 1..2^24");
+
+    /* The links share the userdata, after the header */
+    c = (Lru*)lua_newuserdatauv(L, sizeof(Lru) + 2 * sizeof(int) * ((size_t)capacity + 1), 3);
+    memset(c, 0, sizeof(Lru));
+    c->capacity = (int)capacity;
+    c->prev = (int*)(c + 1);
+    c->next = c->prev + capacity + 1;
+    lua_createtable(L, 0, (int)(capacity < 64 ? capacity : 64));
+    lua_setiuservalue(L, -2, LRU_INDEX);
+    lua_createtable(L, (int)(capacity < 64 ? capacity : 64), 0);
+    lua_setiuservalue(L, -2, LRU_KEYS);
+    lua_createtable(L, (int)(capacity < 64 ? capacity : 64), 0);
+    lua_setiuservalue(L, -2, LRU_VALUES);
+    luaL_setmetatable(L, LRU_METATABLE);
+    return 1;
+}
+
+/*
+** c:get(key)
+** Looks `key` up and, if it is cached, marks it the most recently used
+**
+** Returns:
+**   its value, or nil (a miss)
+*/
+static int l_lru_get(lua_State* L) {
+    Lru* c = check_lru(L, 1);
+    int slot;
+    luaL_checkany(L, 2);
+    slot = lua_isnil(L, 2) ? 0 : lru_find(L, 2);
+    if (!slot) {
+        c->misses++;
+        lua_pushnil(L);
+        return 1;
+    }
+    c->hits++;
+    if (c->head != slot) {
+        lru_unlink(c, slot);
+        lru_push_front(c, slot);
+    }
+    lru_push_value(L, slot);
+    return 1;
+}
+
+/*
+** c:peek(key)
+** Looks `key` up without marking it used or counting a hit or miss
+**
+** Returns:
+**   its value, or nil
+*/
+static int l_lru_peek(lua_State* L) {
+    int slot;
+    check_lru(L, 1);
+    luaL_checkany(L, 2);
+    slot = lua_isnil(L, 2) ? 0 : lru_find(L, 2);
+    if (!slot) lua_pushnil(L);
+    else lru_push_value(L, slot);
+    return 1;
+}
+
+/*
+** c:delete(key)
+** Removes `key`
+**
+** Returns:
+**   true if it was cached
+*/
+static int l_lru_delete(lua_State* L) {
+    Lru* c = check_lru(L, 1);
+    int slot;
+    luaL_checkany(L, 2);
+    slot = lua_isnil(L, 2) ? 0 : lru_find(L, 2);
+    if (slot) {
+        lru_unlink(c, slot);
+        lru_clear_slot(L, slot);
+        c->next[slot] = c->free;
+        c->free = slot;
+        c->size--;
+    }
+    lua_pushboolean(L, slot != 0);
+    return 1;
+}
+
+/*
+** c:set(key, value)
+** Stores `value` under `key` as the most recently used entry; when the
+** cache is full, the least recently used entry is dropped first. A nil
+** value removes the key.
+**
+** Returns:
+**   the lru
+*/
+static int l_lru_set(lua_State* L) {
+    Lru* c = check_lru(L, 1);
+    int slot;
+    luaL_checkany(L, 3);
+    lua_settop(L, 3);
+    if (lua_isnil(L, 3)) {
+        lua_pop(L, 1);
+        l_lru_delete(L);
+        lua_settop(L, 1);
+        return 1;
+    }
+    lru_check_key(L);
+
+    slot = lru_find(L, 2);
+    if (slot) {
+        if (c->head != slot) {
+            lru_unlink(c, slot);
+            lru_push_front(c, slot);
+        }
+        lua_pushvalue(L, 3);
+        lru_store(L, LRU_VALUES, slot);
+        lua_settop(L, 1);
+        return 1;
+    }
+
+    if (c->size == c->capacity) {
+        slot = c->tail;
+        lru_unlink(c, slot);
+        lru_clear_slot(L, slot);
+        c->evictions++;
+    } else if (c->free) {
+        slot = c->free;
+        c->free = c->next[slot];
+        c->size++;
+    } else {
+        slot = ++c->used;
+        c->size++;
+    }
+
+    lua_getiuservalue(L, 1, LRU_INDEX);
+    lua_pushvalue(L, 2);
+    lua_pushinteger(L, slot);
+    lua_rawset(L, -3);
+    lua_pop(L, 1);
+    lua_pushvalue(L, 2);
+    lru_store(L, LRU_KEYS, slot);
+    lua_pushvalue(L, 3);
+    lru_store(L, LRU_VALUES, slot);
+    lru_push_front(c, slot);
+    lua_settop(L, 1);
+    return 1;
+}
+
+/*
+** c:stats()
+** Returns:
+**   a table of size, capacity, hits, misses and evictions
+*/
+static int l_lru_stats(lua_State* L) {
+    Lru* c = check_lru(L, 1);
+    lua_createtable(L, 0, 5);
+    lua_pushinteger(L, c->size);
+    lua_setfield(L, -2, "size");
+    lua_pushinteger(L, c->capacity);
+    lua_setfield(L, -2, "capacity");
+    lua_pushinteger(L, c->hits);
+    lua_setfield(L, -2, "hits");
+    lua_pushinteger(L, c->misses);
+    lua_setfield(L, -2, "misses");
+    lua_pushinteger(L, c->evictions);
+    lua_setfield(L, -2, "evictions");
+    return 1;
+}
+
+static int l_lru_len(lua_State* L) {
+    lua_pushinteger(L, check_lru(L, 1)->size);
+    return 1;
+}
+
+static const luaL_Reg lru_methods[] = {
+    {"get", l_lru_get},
+    {"set", l_lru_set},
+    {"peek", l_lru_peek},
+    {"delete", l_lru_delete},
+    {"stats", l_lru_stats},
+    {NULL, NULL}
+};
+
+static const luaL_Reg lru_functions[] = {
+    {"new", l_lru_new},
+    {NULL, NULL}
+};
+
+/*
+** luaopen_lru
+** Module initialization function - called when the lru library is loaded
+**
+** Returns:
+**   lru module table on Lua stack
+*/
+LUAMOD_API int luaopen_lru(lua_State* L) {
+    if (luaL_newmetatable(L, LRU_METATABLE)) {
+        luaL_newlib(L, lru_methods);
+        lua_setfield(L, -2, "__index");
+        lua_pushcfunction(L, l_lru_len);
+        lua_setfield(L, -2, "__len");
+    }
+    lua_pop(L, 1);
+    luaL_newlib(L, lru_functions);
+    return 1;
+}
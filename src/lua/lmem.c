@@ -152,6 +152,7 @@ void luaM_free_ (lua_State *L, void *block, size_t osize) {
   lua_assert((osize == 0) == (block == NULL));
   callfrealloc(g, block, osize, 0);
   g->GCdebt -= osize;
+  luai_freenote(L, osize);
 }
 
 
@@ -185,6 +186,7 @@ void *luaM_realloc_ (lua_State *L, void *block, size_t osize, size_t nsize) {
   }
   lua_assert((nsize == 0) == (newblock == NULL));
   g->GCdebt = (g->GCdebt + nsize) - osize;
+  luai_reallocnote(L, osize, nsize);
   return newblock;
 }
 
@@ -210,6 +212,7 @@ void *luaM_malloc_ (lua_State *L, size_t size, int tag) {
         luaM_error(L);
     }
     g->GCdebt += size;
+    luai_allocnote(L, tag, size);
     return newblock;
   }
 }
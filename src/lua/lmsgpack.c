@@ -0,0 +1,470 @@
+/*
+** lmsgpack.c
+** Lua msgpack library - MessagePack encoding and decoding in C
+** msgpack.pack returns the encoding as a u8 typed array, which the host
+** receives as one Uint8Array copy (web/cu-msgpack.js decodes it), and
+** msgpack.decode reads one the host stored, so a structured payload
+** crosses the bridge in one transfer instead of one entry per field
+*/
+
+#include <string.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+
+/*
+** Typed array values (src/typed_array.zig): an 8-byte header, then the
+** elements. Kind 1 is u8
+*/
+#define TYPED_ARRAY_METATABLE "cu.typed_array"
+#define TYPED_ARRAY_TAG 0x0F
+#define TYPED_ARRAY_U8 1
+#define TYPED_ARRAY_HEADER 8
+
+/*
+** Implemented in src/main.zig: turns the userdata on top of the stack,
+** which holds exactly one typed array value, into a typed array
+*/
+extern int cu_typed_array_adopt(lua_State* L);
+
+/* Deepest nesting of arrays and maps either direction accepts */
+#define MSGPACK_MAX_DEPTH 200
+
+/* msgpack.null is json.null: the NULL light userdata */
+#define msgpack_pushnull(L) lua_pushlightuserdata(L, NULL)
+
+/* ======================================================================
+** Encoding
+** ====================================================================== */
+
+/*
+** As in ljson.c, the output lives in a full userdata at a fixed stack
+** slot, replaced by a larger one as it fills
+*/
+typedef struct MsgpackEncoder {
+    lua_State* L;
+    unsigned char* data;
+    size_t len;
+    size_t cap;
+    int box;    /* stack index of the userdata holding data */
+    int depth;
+} MsgpackEncoder;
+
+static void encode_value(MsgpackEncoder* e, int index);
+
+static void encode_reserve(MsgpackEncoder* e, size_t n) {
+    size_t cap = e->cap;
+    unsigned char* data;
+    if (cap - e->len >= n) return;
+    while (cap - e->len < n) cap *= 2;
+    data = (unsigned char*)lua_newuserdatauv(e->L, cap, 0);
+    memcpy(data, e->data, e->len);
+    lua_replace(e->L, e->box);
+    e->data = data;
+    e->cap = cap;
+}
+
+/* A type byte followed by `size` bytes of `value`, big-endian */
+static void encode_head(MsgpackEncoder* e, unsigned char type, unsigned long long value, int size) {
+    int i;
+    encode_reserve(e, 1 + size);
+    e->data[e->len++] = type;
+    for (i = size - 1; i >= 0; i--) {
+        e->data[e->len++] = (unsigned char)(value >> (8 * i));
+    }
+}
+
+static void encode_bytes(MsgpackEncoder* e, const char* s, size_t n) {
+    encode_reserve(e, n);
+    memcpy(e->data + e->len, s, n);
+    e->len += n;
+}
+
+static void encode_integer(MsgpackEncoder* e, lua_Integer n) {
+    if (n >= 0) {
+        unsigned long long u = (unsigned long long)n;
+        if (u < 0x80) encode_head(e, (unsigned char)u, 0, 0);
+        else if (u <= 0xFF) encode_head(e, 0xCC, u, 1);
+        else if (u <= 0xFFFF) encode_head(e, 0xCD, u, 2);
+        else if (u <= 0xFFFFFFFFULL) encode_head(e, 0xCE, u, 4);
+        else encode_head(e, 0xCF, u, 8);
+    } else {
+        unsigned long long bits = (unsigned long long)n;
+        if (n >= -32) encode_head(e, (unsigned char)(0xE0 | (n + 32)), 0, 0);
+        else if (n >= -128) encode_head(e, 0xD0, bits, 1);
+        else if (n >= -32768) encode_head(e, 0xD1, bits, 2);
+#if LUA_MAXINTEGER > 2147483647
+        else if (n >= -2147483647LL - 1) encode_head(e, 0xD2, bits, 4);
+        else encode_head(e, 0xD3, bits, 8);
+#else
+        else encode_head(e, 0xD2, bits, 4); /* LUA_32BITS */
+#endif
+    }
+}
+
+static void encode_float(MsgpackEncoder* e, lua_Number n) {
+    double d = (double)n;
+    unsigned long long bits;
+    memcpy(&bits, &d, sizeof(bits));
+    encode_head(e, 0xCB, bits, 8);
+}
+
+static void encode_string(MsgpackEncoder* e, const char* s, size_t len) {
+    if (len < 32) encode_head(e, (unsigned char)(0xA0 | len), 0, 0);
+    else if (len <= 0xFF) encode_head(e, 0xD9, len, 1);
+    else if (len <= 0xFFFF) encode_head(e, 0xDA, len, 2);
+    else encode_head(e, 0xDB, len, 4);
+    encode_bytes(e, s, len);
+}
+
+/* n when the table's keys are exactly 1..n, else -1 */
+static lua_Integer array_length(lua_State* L, int index, lua_Integer* entries) {
+    lua_Integer count = 0;
+    lua_Integer max = 0;
+    int array = 1;
+    lua_pushnil(L);
+    while (lua_next(L, index)) {
+        lua_pop(L, 1);
+        if (array && lua_isinteger(L, -1) && lua_tointeger(L, -1) >= 1) {
+            if (lua_tointeger(L, -1) > max) max = lua_tointeger(L, -1);
+        } else {
+            array = 0;
+        }
+        count++;
+    }
+    *entries = count;
+    return (array && count == max) ? count : -1;
+}
+
+static void encode_table(MsgpackEncoder* e, int index) {
+    lua_State* L = e->L;
+    lua_Integer entries;
+    lua_Integer n;
+
+    if (++e->depth > MSGPACK_MAX_DEPTH) luaL_error(L, "msgpack: nesting too deep (or a cycle)");
+    luaL_checkstack(L, 4, "msgpack: nesting too deep");
+
+    n = array_length(L, index, &entries);
+    if (n > 0) {
+        lua_Integer i;
+        if (n < 16) encode_head(e, (unsigned char)(0x90 | n), 0, 0);
+        else if (n <= 0xFFFF) encode_head(e, 0xDC, n, 2);
+        else encode_head(e, 0xDD, n, 4);
+        for (i = 1; i <= n; i++) {
+            lua_rawgeti(L, index, i);
+            encode_value(e, lua_gettop(L));
+            lua_pop(L, 1);
+        }
+        e->depth--;
+        return;
+    }
+
+    /* Empty tables encode as maps, as in json.encode */
+    if (entries < 16) encode_head(e, (unsigned char)(0x80 | entries), 0, 0);
+    else if (entries <= 0xFFFF) encode_head(e, 0xDE, entries, 2);
+    else encode_head(e, 0xDF, entries, 4);
+    lua_pushnil(L);
+    while (lua_next(L, index)) {
+        int key = lua_gettop(L) - 1;
+        encode_value(e, key);
+        encode_value(e, key + 1);
+        lua_pop(L, 1);
+    }
+    e->depth--;
+}
+
+static void encode_value(MsgpackEncoder* e, int index) {
+    lua_State* L = e->L;
+    switch (lua_type(L, index)) {
+        case LUA_TNIL:
+            encode_head(e, 0xC0, 0, 0);
+            break;
+        case LUA_TBOOLEAN:
+            encode_head(e, lua_toboolean(L, index) ? 0xC3 : 0xC2, 0, 0);
+            break;
+        case LUA_TNUMBER:
+            if (lua_isinteger(L, index)) encode_integer(e, lua_tointeger(L, index));
+            else encode_float(e, lua_tonumber(L, index));
+            break;
+        case LUA_TSTRING: {
+            size_t len;
+            const char* s = lua_tolstring(L, index, &len);
+            encode_string(e, s, len);
+            break;
+        }
+        case LUA_TTABLE:
+            encode_table(e, index);
+            break;
+        default:
+            if (lua_type(L, index) == LUA_TLIGHTUSERDATA && lua_touserdata(L, index) == NULL) {
+                encode_head(e, 0xC0, 0, 0);
+            } else {
+                luaL_error(L, "msgpack: cannot encode %s", luaL_typename(L, index));
+            }
+    }
+}
+
+/* Encode argument 1 after `reserved` bytes left for a header */
+static void encode_argument(lua_State* L, MsgpackEncoder* e, size_t reserved) {
+    luaL_checkany(L, 1);
+    lua_settop(L, 1);
+    e->L = L;
+    e->len = reserved;
+    e->cap = 256;
+    e->data = (unsigned char*)lua_newuserdatauv(L, e->cap, 0);
+    e->box = lua_gettop(L);
+    e->depth = 0;
+    encode_value(e, 1);
+}
+
+/*
+** msgpack.encode(value)
+** Serializes a value as MessagePack
+**
+** Tables whose keys are exactly 1..n become arrays, other tables maps.
+** Integers take the smallest integer format, floats are float 64 and Lua
+** strings are str. Fails on functions, userdata and cycles
+**
+** Returns:
+**   the encoding as a string
+*/
+static int l_msgpack_encode(lua_State* L) {
+    MsgpackEncoder e;
+    encode_argument(L, &e, 0);
+    lua_pushlstring(L, (const char*)e.data, e.len);
+    return 1;
+}
+
+/*
+** msgpack.pack(value)
+** Like msgpack.encode, but returns a u8 typed array, which reaches the
+** host as a single Uint8Array when returned or stored in _io
+*/
+static int l_msgpack_pack(lua_State* L) {
+    MsgpackEncoder e;
+    size_t count;
+    unsigned char* value;
+    encode_argument(L, &e, TYPED_ARRAY_HEADER);
+
+    count = e.len - TYPED_ARRAY_HEADER;
+    /* count > 0xFFFFFFFF, which a 32-bit size_t cannot be */
+    if ((count >> 16) >> 16) return luaL_error(L, "msgpack: encoding too large");
+    value = (unsigned char*)lua_newuserdatauv(L, e.len, 0);
+    memcpy(value, e.data, e.len);
+    value[0] = TYPED_ARRAY_TAG;
+    value[1] = TYPED_ARRAY_U8;
+    value[2] = 0;
+    value[3] = 0;
+    value[4] = (unsigned char)count;
+    value[5] = (unsigned char)(count >> 8);
+    value[6] = (unsigned char)(count >> 16);
+    value[7] = (unsigned char)(count >> 24);
+    if (!cu_typed_array_adopt(L)) return luaL_error(L, "msgpack: typed arrays unavailable");
+    return 1;
+}
+
+/* ======================================================================
+** Decoding
+** ====================================================================== */
+
+typedef struct MsgpackDecoder {
+    lua_State* L;
+    const unsigned char* start;
+    const unsigned char* p;
+    const unsigned char* end;
+    int depth;
+} MsgpackDecoder;
+
+static void decode_value(MsgpackDecoder* d);
+
+static int decode_error(MsgpackDecoder* d, const char* what) {
+    return luaL_error(d->L, "msgpack.decode: %s at offset %d", what, (int)(d->p - d->start));
+}
+
+static void need(MsgpackDecoder* d, size_t n) {
+    if ((size_t)(d->end - d->p) < n) decode_error(d, "truncated input");
+}
+
+/* `size` big-endian bytes */
+static unsigned long long read_uint(MsgpackDecoder* d, int size) {
+    unsigned long long value = 0;
+    int i;
+    need(d, size);
+    for (i = 0; i < size; i++) value = (value << 8) | d->p[i];
+    d->p += size;
+    return value;
+}
+
+static long long read_int(MsgpackDecoder* d, int size) {
+    unsigned long long u = read_uint(d, size);
+    int shift = 64 - 8 * size;
+    /* Sign-extend from `size` bytes */
+    if (shift > 0) return (long long)(u << shift) >> shift;
+    return (long long)u;
+}
+
+/* An integer beyond lua_Integer (only possible with LUA_32BITS) becomes a float */
+static void push_int(lua_State* L, long long n) {
+    if (n >= LUA_MININTEGER && n <= LUA_MAXINTEGER) lua_pushinteger(L, (lua_Integer)n);
+    else lua_pushnumber(L, (lua_Number)n);
+}
+
+static void decode_string(MsgpackDecoder* d, size_t len) {
+    need(d, len);
+    lua_pushlstring(d->L, (const char*)d->p, len);
+    d->p += len;
+}
+
+static void enter_container(MsgpackDecoder* d) {
+    if (++d->depth > MSGPACK_MAX_DEPTH) decode_error(d, "nesting too deep");
+    luaL_checkstack(d->L, 4, "msgpack.decode: nesting too deep");
+}
+
+static void decode_array(MsgpackDecoder* d, size_t n) {
+    size_t i;
+    enter_container(d);
+    /* Each element takes at least one byte, which bounds the preallocation */
+    need(d, n);
+    lua_createtable(d->L, (int)n, 0);
+    for (i = 1; i <= n; i++) {
+        decode_value(d);
+        lua_rawseti(d->L, -2, (lua_Integer)i);
+    }
+    d->depth--;
+}
+
+static void decode_map(MsgpackDecoder* d, size_t n) {
+    size_t i;
+    enter_container(d);
+    need(d, 2 * n);
+    lua_createtable(d->L, 0, (int)n);
+    for (i = 0; i < n; i++) {
+        decode_value(d);
+        if (lua_isnil(d->L, -1) || (lua_type(d->L, -1) == LUA_TLIGHTUSERDATA && lua_touserdata(d->L, -1) == NULL)) {
+            decode_error(d, "nil map key");
+        }
+        if (lua_type(d->L, -1) == LUA_TNUMBER && lua_tonumber(d->L, -1) != lua_tonumber(d->L, -1)) {
+            decode_error(d, "nan map key");
+        }
+        decode_value(d);
+        lua_rawset(d->L, -3);
+    }
+    d->depth--;
+}
+
+static void decode_value(MsgpackDecoder* d) {
+    lua_State* L = d->L;
+    unsigned char type;
+    need(d, 1);
+    type = *d->p++;
+
+    if (type < 0x80) { lua_pushinteger(L, type); return; }
+    if (type >= 0xE0) { lua_pushinteger(L, (lua_Integer)type - 256); return; }
+    if (type <= 0x8F) { decode_map(d, type & 0x0F); return; }
+    if (type <= 0x9F) { decode_array(d, type & 0x0F); return; }
+    if (type <= 0xBF) { decode_string(d, type & 0x1F); return; }
+
+    switch (type) {
+        case 0xC0: msgpack_pushnull(L); break;
+        case 0xC2: lua_pushboolean(L, 0); break;
+        case 0xC3: lua_pushboolean(L, 1); break;
+        case 0xC4: case 0xD9: decode_string(d, (size_t)read_uint(d, 1)); break;
+        case 0xC5: case 0xDA: decode_string(d, (size_t)read_uint(d, 2)); break;
+        case 0xC6: case 0xDB: decode_string(d, (size_t)read_uint(d, 4)); break;
+        case 0xCA: {
+            unsigned int bits = (unsigned int)read_uint(d, 4);
+            float f;
+            memcpy(&f, &bits, sizeof(f));
+            lua_pushnumber(L, (lua_Number)f);
+            break;
+        }
+        case 0xCB: {
+            unsigned long long bits = read_uint(d, 8);
+            double f;
+            memcpy(&f, &bits, sizeof(f));
+            lua_pushnumber(L, (lua_Number)f);
+            break;
+        }
+        case 0xCC: push_int(L, (long long)read_uint(d, 1)); break;
+        case 0xCD: push_int(L, (long long)read_uint(d, 2)); break;
+        case 0xCE: push_int(L, (long long)read_uint(d, 4)); break;
+        case 0xCF: {
+            /* uint64 beyond lua_Integer becomes a float */
+            unsigned long long u = read_uint(d, 8);
+            if (u > (unsigned long long)LUA_MAXINTEGER) lua_pushnumber(L, (lua_Number)u);
+            else lua_pushinteger(L, (lua_Integer)u);
+            break;
+        }
+        case 0xD0: push_int(L, read_int(d, 1)); break;
+        case 0xD1: push_int(L, read_int(d, 2)); break;
+        case 0xD2: push_int(L, read_int(d, 4)); break;
+        case 0xD3: push_int(L, read_int(d, 8)); break;
+        case 0xDC: decode_array(d, (size_t)read_uint(d, 2)); break;
+        case 0xDD: decode_array(d, (size_t)read_uint(d, 4)); break;
+        case 0xDE: decode_map(d, (size_t)read_uint(d, 2)); break;
+        case 0xDF: decode_map(d, (size_t)read_uint(d, 4)); break;
+        default:
+            d->p--;
+            decode_error(d, "unsupported type (ext or reserved)");
+    }
+}
+
+/*
+** msgpack.decode(data)
+** Parses one MessagePack value from a string or a u8 typed array
+**
+** Returns:
+**   the value; arrays and maps become tables, nil inside them becomes
+**   msgpack.null, bin becomes a string. A lone nil decodes as nil
+**   Raises an error naming the offset of the first invalid byte
+*/
+static int l_msgpack_decode(lua_State* L) {
+    MsgpackDecoder d;
+    size_t len;
+    const unsigned char* typed = (const unsigned char*)luaL_testudata(L, 1, TYPED_ARRAY_METATABLE);
+
+    if (typed != NULL) {
+        if (typed[1] != TYPED_ARRAY_U8) return luaL_argerror(L, 1, "expected a u8 typed array");
+        d.start = typed + TYPED_ARRAY_HEADER;
+        len = lua_rawlen(L, 1) - TYPED_ARRAY_HEADER;
+    } else {
+        d.start = (const unsigned char*)luaL_checklstring(L, 1, &len);
+    }
+    d.L = L;
+    d.p = d.start;
+    d.end = d.start + len;
+    d.depth = 0;
+
+    decode_value(&d);
+    if (d.p != d.end) decode_error(&d, "trailing bytes");
+    if (lua_type(L, -1) == LUA_TLIGHTUSERDATA && lua_touserdata(L, -1) == NULL) {
+        lua_pushnil(L);
+    }
+    return 1;
+}
+
+/*
+** Module function registration table
+** These become accessible as msgpack.encode(), etc.
+*/
+static const luaL_Reg msgpack_functions[] = {
+    {"encode", l_msgpack_encode},
+    {"pack", l_msgpack_pack},
+    {"decode", l_msgpack_decode},
+    {"null", NULL},
+    {NULL, NULL}
+};
+
+/*
+** luaopen_msgpack
+** Module initialization function - called when the msgpack library is loaded
+**
+** Returns:
+**   msgpack module table on Lua stack
+*/
+LUAMOD_API int luaopen_msgpack(lua_State* L) {
+    luaL_newlib(L, msgpack_functions);
+    msgpack_pushnull(L);
+    lua_setfield(L, -2, "null");
+    return 1;
+}
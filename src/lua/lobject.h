@@ -568,8 +568,15 @@ typedef struct Proto {
   ls_byte *lineinfo;  /* information about source lines (debug information) */
   AbsLineInfo *abslineinfo;  /* idem */
   LocVar *locvars;  /* information about local variables (debug information) */
+  unsigned int *fieldcache;  /* node hints for constant-key field access */
+  int sizefieldcache;  /* size of 'fieldcache' */
   TString  *source;  /* used for debug information */
   GCObject *gclist;
+#if defined(LUAI_TIER)
+  int tiercount;  /* calls, then guard failures; -1 when not compiled (ltier.c) */
+  int tierslot;  /* 1 + slot holding its compiled code, or 0 */
+  unsigned int tierstamp;  /* set by the host with that code */
+#endif
 } Proto;
 
 /* }================================================================== */
@@ -734,6 +741,31 @@ typedef union Node {
 #define setnorealasize(t)	((t)->flags |= BITRAS)
 
 
+/*
+** While bit 6 of 'flags' is set, 'array' holds the array part unboxed:
+** bare integers or bare floats instead of TValues (see ltable.c).
+*/
+#define BITUNBOXED	(1 << 6)
+
+
+/*
+** Shape of a record-like table: the short-string keys of its hash part,
+** in insertion order. Tables that gain the same keys in the same order
+** share one shape and keep only their values, in 'fields'. Shapes form
+** a tree rooted at 'g->shapes': 'parent' lacks the last key, and the
+** shapes extending one shape are chained from its 'child' through
+** their 'sibling'. (See ltable.c.)
+*/
+typedef struct Shape {
+  struct Shape *parent;
+  struct Shape *child;
+  struct Shape *sibling;
+  int refs;  /* tables and children using this shape */
+  int nkeys;
+  TString *keys[1];  /* 'nkeys' keys */
+} Shape;
+
+
 typedef struct Table {
   CommonHeader;
   lu_byte flags;  /* 1<<p means tagmethod(p) is not present */
@@ -742,6 +774,8 @@ typedef struct Table {
   TValue *array;  /* array part */
   Node *node;
   Node *lastfree;  /* any free position is before this position */
+  Shape *shape;  /* keys of a shaped hash part, or NULL */
+  TValue *fields;  /* values for the keys in 'shape' */
   struct Table *metatable;
   GCObject *gclist;
 } Table;
@@ -0,0 +1,683 @@
+/*
+** lsched.c
+** Lua sched library - a cooperative scheduler for many small tasks
+** A task is a coroutine with a mailbox. The run queue, the timers and the
+** mailboxes live here in C, so a unit can keep thousands of actors without
+** a Lua scheduler loop allocating tables per step. Tasks run when the host
+** calls the sched_tick export, or when Lua calls sched.run, for at most a
+** given number of milliseconds; a task runs until it yields, sleeps or
+** waits for a message, or until its slice (sched.slice) is used up.
+**
+** Time comes from clock(), the host's monotonic clock (js_clock_ms).
+*/
+
+#include <time.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+
+#define SCHED_REGISTRY_KEY "cu.sched"
+#define SCHED_METATABLE "cu.sched.state"
+
+/* User values of the scheduler userdata */
+#define UV_THREADS 1   /* slot + 1 -> task coroutine */
+#define UV_BOXES 2     /* slot + 1 -> mailbox queue table */
+#define UV_IDS 3       /* task id -> slot */
+#define UV_ONERROR 4   /* error handler, or nil */
+
+/* Instructions between checks of the running task's slice */
+#define SLICE_CHECK_INTERVAL 1000
+
+enum { TASK_FREE, TASK_READY, TASK_RUNNING, TASK_SLEEPING, TASK_WAITING };
+
+typedef struct Task {
+    lua_Integer id;     /* 0 while the slot is free */
+    lua_State* co;      /* kept alive by UV_THREADS */
+    int state;
+    int nargs;          /* spawn arguments left for the first resume */
+    double wake;        /* deadline while sleeping, or waiting with a timeout */
+    int mhead, mtail;   /* messages are mailbox[mhead + 1 .. mtail] */
+    int next_free;
+} Task;
+
+/* Queue and heap entries name a task by slot and id, so entries left
+** behind by a task that was killed or woken another way are skipped */
+typedef struct Ready {
+    int slot;
+    lua_Integer id;
+} Ready;
+
+typedef struct Timer {
+    double wake;
+    int slot;
+    lua_Integer id;
+} Timer;
+
+typedef struct Sched {
+    Task* tasks;
+    int ntasks, captasks, free_slot, live;
+    Ready* ready;
+    int rhead, rcount, rcap;
+    Timer* timers;
+    int ntimers, captimers;
+    lua_Integer next_id;
+    int running;        /* slot of the running task, or -1 */
+    double slice_ms;    /* 0: a task runs until it yields */
+    double slice_end;
+    lua_Hook driver_hook;
+} Sched;
+
+/* The scheduler whose task is running, for the slice hook */
+static Sched* active;
+
+static double now_ms(void) {
+    return (double)clock() / (CLOCKS_PER_SEC / 1000.0);
+}
+
+static void* grow(lua_State* L, void* block, int* cap, size_t size) {
+    void* ud;
+    lua_Alloc alloc = lua_getallocf(L, &ud);
+    int n = *cap > 0 ? *cap * 2 : 16;
+    void* grown = alloc(ud, block, (size_t)*cap * size, (size_t)n * size);
+    if (grown == NULL) luaL_error(L, "sched: out of memory");
+    *cap = n;
+    return grown;
+}
+
+static void release(lua_State* L, void* block, int cap, size_t size) {
+    void* ud;
+    lua_Alloc alloc = lua_getallocf(L, &ud);
+    if (block != NULL) alloc(ud, block, (size_t)cap * size, 0);
+}
+
+static Sched* check_sched(lua_State* L, int sidx) {
+    return (Sched*)lua_touserdata(L, sidx);
+}
+
+/* Run queue: a ring, straightened out when it grows */
+
+static void push_ready(lua_State* L, Sched* s, int slot) {
+    if (s->rcount == s->rcap) {
+        int old = s->rcap;
+        s->ready = (Ready*)grow(L, s->ready, &s->rcap, sizeof(Ready));
+        /* Entries that wrapped to the start move to the new half */
+        for (int i = 0; i < s->rhead + s->rcount - old; i++) s->ready[old + i] = s->ready[i];
+    }
+    Ready* entry = &s->ready[(s->rhead + s->rcount) % s->rcap];
+    entry->slot = slot;
+    entry->id = s->tasks[slot].id;
+    s->rcount++;
+}
+
+/* Drop queue entries whose task is no longer ready; true if one is left */
+static int has_ready(Sched* s) {
+    while (s->rcount > 0) {
+        const Ready* entry = &s->ready[s->rhead];
+        if (s->tasks[entry->slot].id == entry->id && s->tasks[entry->slot].state == TASK_READY) return 1;
+        s->rhead = (s->rhead + 1) % s->rcap;
+        s->rcount--;
+    }
+    return 0;
+}
+
+/* Next task in the queue that is still ready, or -1 */
+static int pop_ready(Sched* s) {
+    int slot;
+    if (!has_ready(s)) return -1;
+    slot = s->ready[s->rhead].slot;
+    s->rhead = (s->rhead + 1) % s->rcap;
+    s->rcount--;
+    return slot;
+}
+
+/* Timers: a binary min-heap on wake */
+
+static void push_timer(lua_State* L, Sched* s, int slot) {
+    if (s->ntimers == s->captimers) s->timers = (Timer*)grow(L, s->timers, &s->captimers, sizeof(Timer));
+    Timer timer = { s->tasks[slot].wake, slot, s->tasks[slot].id };
+    int i = s->ntimers++;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (s->timers[parent].wake <= timer.wake) break;
+        s->timers[i] = s->timers[parent];
+        i = parent;
+    }
+    s->timers[i] = timer;
+}
+
+static void pop_timer(Sched* s) {
+    Timer last = s->timers[--s->ntimers];
+    int i = 0;
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= s->ntimers) break;
+        if (child + 1 < s->ntimers && s->timers[child + 1].wake < s->timers[child].wake) child++;
+        if (last.wake <= s->timers[child].wake) break;
+        s->timers[i] = s->timers[child];
+        i = child;
+    }
+    if (s->ntimers > 0) s->timers[i] = last;
+}
+
+static int timer_valid(Sched* s, const Timer* timer) {
+    const Task* t = &s->tasks[timer->slot];
+    return t->id == timer->id && t->wake == timer->wake &&
+           (t->state == TASK_SLEEPING || t->state == TASK_WAITING);
+}
+
+/* Make tasks whose deadline has passed ready; drops stale timers on top */
+static void wake_timers(lua_State* L, Sched* s, double now) {
+    while (s->ntimers > 0) {
+        Timer top = s->timers[0];
+        if (!timer_valid(s, &top)) {
+            pop_timer(s);
+            continue;
+        }
+        if (top.wake > now) break;
+        pop_timer(s);
+        s->tasks[top.slot].state = TASK_READY;
+        push_ready(L, s, top.slot);
+    }
+}
+
+/* Tasks */
+
+static int alloc_slot(lua_State* L, Sched* s) {
+    int slot = s->free_slot;
+    if (slot >= 0) {
+        s->free_slot = s->tasks[slot].next_free;
+        return slot;
+    }
+    if (s->ntasks == s->captasks) s->tasks = (Task*)grow(L, s->tasks, &s->captasks, sizeof(Task));
+    return s->ntasks++;
+}
+
+static void set_slot_ref(lua_State* L, int sidx, int uv, int slot) {
+    lua_getiuservalue(L, sidx, uv);
+    lua_rotate(L, -2, 1);
+    lua_rawseti(L, -2, slot + 1);
+    lua_pop(L, 1);
+}
+
+static void free_task(lua_State* L, Sched* s, int sidx, int slot) {
+    Task* t = &s->tasks[slot];
+    lua_getiuservalue(L, sidx, UV_IDS);
+    lua_pushnil(L);
+    lua_rawseti(L, -2, t->id);
+    lua_pop(L, 1);
+    lua_pushnil(L);
+    set_slot_ref(L, sidx, UV_THREADS, slot);
+    if (t->mtail > 0) {
+        lua_pushnil(L);
+        set_slot_ref(L, sidx, UV_BOXES, slot);
+    }
+    t->id = 0;
+    t->co = NULL;
+    t->state = TASK_FREE;
+    t->next_free = s->free_slot;
+    s->free_slot = slot;
+    s->live--;
+}
+
+/* Slot of task `id`, or -1 */
+static int find_task(lua_State* L, int sidx, lua_Integer id) {
+    int slot;
+    lua_getiuservalue(L, sidx, UV_IDS);
+    slot = lua_rawgeti(L, -1, id) == LUA_TNUMBER ? (int)lua_tointeger(L, -1) : -1;
+    lua_pop(L, 2);
+    return slot;
+}
+
+/* The running task, if `L` is its own coroutine */
+static Task* current_task(lua_State* L, Sched* s, const char* fname) {
+    if (s->running < 0 || s->tasks[s->running].co != L) {
+        luaL_error(L, "sched.%s: not called from a task (or called inside a coroutine it created)", fname);
+    }
+    return &s->tasks[s->running];
+}
+
+/* Mailboxes: a queue table per slot, indexed mhead + 1 .. mtail */
+
+static void push_message(lua_State* L, Sched* s, int sidx, int slot) {
+    Task* t = &s->tasks[slot];
+    lua_getiuservalue(L, sidx, UV_BOXES);
+    if (lua_rawgeti(L, -1, slot + 1) != LUA_TTABLE) {
+        lua_pop(L, 1);
+        lua_createtable(L, 4, 0);
+        lua_pushvalue(L, -1);
+        lua_rawseti(L, -3, slot + 1);
+    }
+    lua_rotate(L, -3, -1); /* [msg, boxes, box] -> [boxes, box, msg] */
+    lua_rawseti(L, -2, ++t->mtail);
+    lua_pop(L, 2);
+}
+
+/* Push the oldest message of `slot` and return 1, or push nothing and return 0 */
+static int pop_message(lua_State* L, Sched* s, int sidx, int slot) {
+    Task* t = &s->tasks[slot];
+    if (t->mhead == t->mtail) return 0;
+    lua_getiuservalue(L, sidx, UV_BOXES);
+    lua_rawgeti(L, -1, slot + 1);
+    lua_rawgeti(L, -1, ++t->mhead);
+    lua_pushnil(L);
+    lua_rawseti(L, -3, t->mhead);
+    lua_rotate(L, -3, 1);
+    lua_pop(L, 2);
+    if (t->mhead == t->mtail) t->mhead = t->mtail = 0;
+    return 1;
+}
+
+/* Running tasks */
+
+static void slice_hook(lua_State* L, lua_Debug* ar) {
+    Sched* s = active;
+    if (s->driver_hook != NULL) s->driver_hook(L, ar);
+    /* Coroutines the task created inherit the hook; only the task yields */
+    if (L == s->tasks[s->running].co && now_ms() >= s->slice_end && lua_isyieldable(L)) {
+        s->tasks[s->running].state = TASK_READY;
+        lua_yield(L, 0);
+    }
+}
+
+static void report_error(lua_State* L, int sidx, lua_Integer id, lua_State* co) {
+    lua_xmove(co, L, 1);
+    if (lua_getiuservalue(L, sidx, UV_ONERROR) == LUA_TFUNCTION) {
+        lua_pushinteger(L, id);
+        lua_rotate(L, -3, -1); /* [err, fn, id] -> [fn, id, err] */
+        if (lua_pcall(L, 2, 0, 0) != LUA_OK) lua_pop(L, 1);
+        return;
+    }
+    lua_pop(L, 1);
+    lua_getglobal(L, "print");
+    lua_pushfstring(L, "sched: task %I failed: %s", (LUAI_UACINT)id,
+                    lua_isstring(L, -2) ? lua_tostring(L, -2) : luaL_typename(L, -2));
+    if (lua_pcall(L, 1, 0, 0) != LUA_OK) lua_pop(L, 1);
+    lua_pop(L, 1);
+}
+
+static void run_task(lua_State* L, Sched* s, int sidx, int slot) {
+    Task* t = &s->tasks[slot];
+    lua_State* co = t->co;
+    lua_Integer id = t->id;
+    int nargs = t->nargs;
+    int nresults = 0;
+    int status;
+    Sched* outer = active;
+
+    t->nargs = 0;
+    t->state = TASK_RUNNING;
+    s->running = slot;
+    /* Tasks run under the driver's hook (compute budgets, interrupts),
+    ** which the slice hook calls on before checking the slice */
+    if (s->slice_ms > 0) {
+        s->driver_hook = (lua_gethookmask(L) & LUA_MASKCOUNT) ? lua_gethook(L) : NULL;
+        s->slice_end = now_ms() + s->slice_ms;
+        lua_sethook(co, slice_hook, LUA_MASKCOUNT, SLICE_CHECK_INTERVAL);
+    } else {
+        lua_sethook(co, lua_gethook(L), lua_gethookmask(L), lua_gethookcount(L));
+    }
+    active = s;
+    status = lua_resume(co, L, nargs, &nresults);
+    active = outer;
+    s->running = -1;
+
+    /* The task may have spawned others, moving the array */
+    t = &s->tasks[slot];
+    if (status == LUA_YIELD) {
+        lua_pop(co, nresults);
+        if (t->state == TASK_RUNNING || t->state == TASK_READY) {
+            t->state = TASK_READY;
+            push_ready(L, s, slot);
+        } else if (t->wake >= 0) {
+            push_timer(L, s, slot);
+        }
+        return;
+    }
+    if (status != LUA_OK) report_error(L, sidx, id, co);
+    /* Killed while it ran: the slot was freed already */
+    if (t->id == id) free_task(L, s, sidx, slot);
+}
+
+/* Run ready tasks for up to `budget_ms`, or with no budget (<= 0) give
+** each task that is ready now one turn. Pushes the milliseconds until the
+** next timer, 0 if tasks are ready, or nil if nothing will run before a
+** message is sent */
+static void tick(lua_State* L, Sched* s, int sidx, double budget_ms) {
+    double now = now_ms();
+    double deadline = now + budget_ms;
+    int turns = budget_ms > 0 ? -1 : s->rcount;
+    if (s->running >= 0) luaL_error(L, "sched.run: called from a task");
+
+    while (turns != 0) {
+        int slot;
+        wake_timers(L, s, now);
+        if (budget_ms > 0 && now >= deadline) break;
+        slot = pop_ready(s);
+        if (slot < 0) break;
+        run_task(L, s, sidx, slot);
+        now = now_ms();
+        if (turns > 0) turns--;
+    }
+
+    wake_timers(L, s, now);
+    if (has_ready(s)) {
+        lua_pushnumber(L, 0);
+    } else if (s->ntimers > 0) {
+        lua_pushnumber(L, s->timers[0].wake > now ? s->timers[0].wake - now : 0);
+    } else {
+        lua_pushnil(L);
+    }
+}
+
+/* Library functions; upvalue 1 is the scheduler */
+
+#define SCHED_UV lua_upvalueindex(1)
+
+/*
+** sched.spawn(fn, ...)
+** Creates a task that runs fn(...) on its own coroutine, ready to run
+**
+** Returns:
+**   the task's id
+*/
+static int l_sched_spawn(lua_State* L) {
+    Sched* s = check_sched(L, SCHED_UV);
+    int n = lua_gettop(L);
+    int slot;
+    lua_State* co;
+    Task* t;
+    luaL_checktype(L, 1, LUA_TFUNCTION);
+
+    slot = alloc_slot(L, s);
+    co = lua_newthread(L);
+    lua_rotate(L, 1, 1);
+    lua_xmove(L, co, n);
+
+    t = &s->tasks[slot];
+    t->id = ++s->next_id;
+    t->co = co;
+    t->state = TASK_READY;
+    t->nargs = n - 1;
+    t->wake = -1;
+    t->mhead = t->mtail = 0;
+    s->live++;
+    lua_pushvalue(L, 1);
+    set_slot_ref(L, SCHED_UV, UV_THREADS, slot);
+    lua_getiuservalue(L, SCHED_UV, UV_IDS);
+    lua_pushinteger(L, slot);
+    lua_rawseti(L, -2, t->id);
+    lua_pop(L, 2);
+
+    push_ready(L, s, slot);
+    lua_pushinteger(L, t->id);
+    return 1;
+}
+
+/*
+** sched.yield()
+** Lets the other ready tasks run first
+*/
+static int l_sched_yield(lua_State* L) {
+    current_task(L, check_sched(L, SCHED_UV), "yield")->state = TASK_READY;
+    return lua_yield(L, 0);
+}
+
+/*
+** sched.sleep(ms)
+** Suspends the task for at least `ms` milliseconds
+*/
+static int l_sched_sleep(lua_State* L) {
+    lua_Number ms = luaL_checknumber(L, 1);
+    Task* t = current_task(L, check_sched(L, SCHED_UV), "sleep");
+    t->state = TASK_SLEEPING;
+    t->wake = now_ms() + (ms > 0 ? ms : 0);
+    return lua_yield(L, 0);
+}
+
+static int receive_continue(lua_State* L, int status, lua_KContext ctx) {
+    Sched* s = check_sched(L, SCHED_UV);
+    (void)status;
+    (void)ctx;
+    s->tasks[s->running].wake = -1;
+    if (!pop_message(L, s, SCHED_UV, s->running)) lua_pushnil(L);
+    return 1;
+}
+
+/*
+** sched.receive([timeout_ms])
+** Takes the oldest message sent to this task, waiting for one if the
+** mailbox is empty
+**
+** Returns:
+**   the message, or nil if `timeout_ms` passed first
+*/
+static int l_sched_receive(lua_State* L) {
+    Sched* s = check_sched(L, SCHED_UV);
+    lua_Number timeout = luaL_optnumber(L, 1, -1);
+    Task* t = current_task(L, s, "receive");
+    if (pop_message(L, s, SCHED_UV, s->running)) return 1;
+    t->state = TASK_WAITING;
+    t->wake = timeout >= 0 ? now_ms() + timeout : -1;
+    return lua_yieldk(L, 0, 0, receive_continue);
+}
+
+/*
+** sched.send(id, message)
+** Appends `message` to task `id`'s mailbox and wakes it if it waits
+**
+** Returns:
+**   true, or false if there is no such task
+*/
+static int l_sched_send(lua_State* L) {
+    Sched* s = check_sched(L, SCHED_UV);
+    int slot = find_task(L, SCHED_UV, luaL_checkinteger(L, 1));
+    luaL_checkany(L, 2);
+    if (slot < 0) {
+        lua_pushboolean(L, 0);
+        return 1;
+    }
+    lua_settop(L, 2);
+    push_message(L, s, SCHED_UV, slot);
+    if (s->tasks[slot].state == TASK_WAITING) {
+        s->tasks[slot].state = TASK_READY;
+        push_ready(L, s, slot);
+    }
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+/*
+** sched.kill(id)
+** Ends task `id` where it stands, dropping its mailbox
+**
+** Returns:
+**   true, or false if there is no such task
+*/
+static int l_sched_kill(lua_State* L) {
+    Sched* s = check_sched(L, SCHED_UV);
+    int slot = find_task(L, SCHED_UV, luaL_checkinteger(L, 1));
+    if (slot >= 0 && slot == s->running) return luaL_error(L, "sched.kill: a task cannot kill itself; return instead");
+    if (slot >= 0) {
+        lua_closethread(s->tasks[slot].co, L);
+        free_task(L, s, SCHED_UV, slot);
+    }
+    lua_pushboolean(L, slot >= 0);
+    return 1;
+}
+
+/*
+** sched.self()
+** Returns:
+**   the running task's id, or nil outside tasks
+*/
+static int l_sched_self(lua_State* L) {
+    Sched* s = check_sched(L, SCHED_UV);
+    if (s->running < 0 || s->tasks[s->running].co != L) lua_pushnil(L);
+    else lua_pushinteger(L, s->tasks[s->running].id);
+    return 1;
+}
+
+/*
+** sched.status(id)
+** Returns:
+**   "ready", "running", "sleeping" or "waiting", or nil once the task
+**   has ended
+*/
+static int l_sched_status(lua_State* L) {
+    static const char* const names[] = { NULL, "ready", "running", "sleeping", "waiting" };
+    Sched* s = check_sched(L, SCHED_UV);
+    int slot = find_task(L, SCHED_UV, luaL_checkinteger(L, 1));
+    if (slot < 0) lua_pushnil(L);
+    else lua_pushstring(L, names[s->tasks[slot].state]);
+    return 1;
+}
+
+/*
+** sched.count()
+** Returns:
+**   the number of tasks, then how many of them are ready (or running),
+**   sleeping and waiting for a message
+*/
+static int l_sched_count(lua_State* L) {
+    Sched* s = check_sched(L, SCHED_UV);
+    lua_Integer counts[5] = { 0 };
+    for (int i = 0; i < s->ntasks; i++) counts[s->tasks[i].state]++;
+    lua_pushinteger(L, s->live);
+    lua_pushinteger(L, counts[TASK_READY] + counts[TASK_RUNNING]);
+    lua_pushinteger(L, counts[TASK_SLEEPING]);
+    lua_pushinteger(L, counts[TASK_WAITING]);
+    return 4;
+}
+
+/*
+** sched.slice([ms])
+** Limits how long a task runs before others get a turn; 0 lets each run
+** until it yields. A task inside a C call that cannot yield (a metamethod
+** of an external table, for one) runs on until it returns
+**
+** Returns:
+**   the previous limit
+*/
+static int l_sched_slice(lua_State* L) {
+    Sched* s = check_sched(L, SCHED_UV);
+    lua_Number previous = s->slice_ms;
+    if (!lua_isnoneornil(L, 1)) {
+        lua_Number ms = luaL_checknumber(L, 1);
+        s->slice_ms = ms > 0 ? ms : 0;
+    }
+    lua_pushnumber(L, previous);
+    return 1;
+}
+
+/*
+** sched.onerror(fn)
+** Calls fn(id, err) when a task fails; nil restores the default, which
+** prints the error
+*/
+static int l_sched_onerror(lua_State* L) {
+    if (!lua_isnoneornil(L, 1)) luaL_checktype(L, 1, LUA_TFUNCTION);
+    lua_settop(L, 1);
+    lua_setiuservalue(L, SCHED_UV, UV_ONERROR);
+    return 0;
+}
+
+/*
+** sched.run([budget_ms])
+** Runs ready tasks, as the host's sched_tick does, for up to `budget_ms`
+** milliseconds; without a budget, each task ready now gets one turn
+**
+** Returns:
+**   milliseconds until the next timer, 0 if tasks are still ready, or nil
+**   if no task will run until a message is sent
+*/
+static int l_sched_run(lua_State* L) {
+    tick(L, check_sched(L, SCHED_UV), SCHED_UV, luaL_optnumber(L, 1, 0));
+    return 1;
+}
+
+static int l_sched_gc(lua_State* L) {
+    Sched* s = (Sched*)lua_touserdata(L, 1);
+    release(L, s->tasks, s->captasks, sizeof(Task));
+    release(L, s->ready, s->rcap, sizeof(Ready));
+    release(L, s->timers, s->captimers, sizeof(Timer));
+    s->tasks = NULL;
+    s->ready = NULL;
+    s->timers = NULL;
+    s->ntasks = s->captasks = s->rcap = s->rcount = s->ntimers = s->captimers = 0;
+    return 0;
+}
+
+/*
+** For src/main.zig's sched_tick export, as a protected call: runs ready
+** tasks for up to the budget in argument 1 and returns what sched.run
+** returns, or nil if no script has loaded the library
+*/
+int cu_sched_tick(lua_State* L) {
+    lua_Number budget = luaL_optnumber(L, 1, 0);
+    if (lua_getfield(L, LUA_REGISTRYINDEX, SCHED_REGISTRY_KEY) != LUA_TUSERDATA) {
+        lua_pushnil(L);
+        return 1;
+    }
+    tick(L, check_sched(L, -1), lua_absindex(L, -1), budget);
+    return 1;
+}
+
+static const luaL_Reg sched_functions[] = {
+    {"spawn", l_sched_spawn},
+    {"yield", l_sched_yield},
+    {"sleep", l_sched_sleep},
+    {"receive", l_sched_receive},
+    {"send", l_sched_send},
+    {"kill", l_sched_kill},
+    {"self", l_sched_self},
+    {"status", l_sched_status},
+    {"count", l_sched_count},
+    {"slice", l_sched_slice},
+    {"onerror", l_sched_onerror},
+    {"run", l_sched_run},
+    {NULL, NULL}
+};
+
+/*
+** luaopen_sched
+** Module initialization function - called when the sched library is loaded.
+** One scheduler serves the whole Lua state; it is kept in the registry for
+** sched_tick
+**
+** Returns:
+**   sched module table on Lua stack
+*/
+LUAMOD_API int luaopen_sched(lua_State* L) {
+    if (lua_getfield(L, LUA_REGISTRYINDEX, SCHED_REGISTRY_KEY) != LUA_TUSERDATA) {
+        Sched* s;
+        lua_pop(L, 1);
+        s = (Sched*)lua_newuserdatauv(L, sizeof(Sched), 4);
+        s->tasks = NULL;
+        s->ntasks = s->captasks = s->live = 0;
+        s->free_slot = -1;
+        s->ready = NULL;
+        s->rhead = s->rcount = s->rcap = 0;
+        s->timers = NULL;
+        s->ntimers = s->captimers = 0;
+        s->next_id = 0;
+        s->running = -1;
+        s->slice_ms = 0;
+        s->slice_end = 0;
+        s->driver_hook = NULL;
+        for (int uv = UV_THREADS; uv <= UV_IDS; uv++) {
+            lua_newtable(L);
+            lua_setiuservalue(L, -2, uv);
+        }
+        if (luaL_newmetatable(L, SCHED_METATABLE)) {
+            lua_pushcfunction(L, l_sched_gc);
+            lua_setfield(L, -2, "__gc");
+        }
+        lua_setmetatable(L, -2);
+        lua_pushvalue(L, -1);
+        lua_setfield(L, LUA_REGISTRYINDEX, SCHED_REGISTRY_KEY);
+    }
+    luaL_newlibtable(L, sched_functions);
+    lua_rotate(L, -2, 1);
+    luaL_setfuncs(L, sched_functions, 1);
+    return 1;
+}
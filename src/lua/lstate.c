@@ -177,15 +177,17 @@ LUAI_FUNC void luaE_incCstack (lua_State *L) {
 }
 
 
-static void stack_init (lua_State *L1, lua_State *L) {
-  int i; CallInfo *ci;
-  /* initialize stack array */
-  L1->stack.p = luaM_newvector(L, BASIC_STACK_SIZE + EXTRA_STACK, StackValue);
+/*
+** set up a thread's stack, already allocated with its 'stack_last',
+** as empty with only the first ci
+*/
+static void stack_reset (lua_State *L1) {
+  CallInfo *ci;
+  StkId p;
   L1->tbclist.p = L1->stack.p;
-  for (i = 0; i < BASIC_STACK_SIZE + EXTRA_STACK; i++)
-    setnilvalue(s2v(L1->stack.p + i));  /* erase new stack */
+  for (p = L1->stack.p; p < L1->stack_last.p + EXTRA_STACK; p++)
+    setnilvalue(s2v(p));  /* erase stack */
   L1->top.p = L1->stack.p;
-  L1->stack_last.p = L1->stack.p + BASIC_STACK_SIZE;
   /* initialize first ci */
   ci = &L1->base_ci;
   ci->next = ci->previous = NULL;
@@ -200,6 +202,14 @@ static void stack_init (lua_State *L1, lua_State *L) {
 }
 
 
+static void stack_init (lua_State *L1, lua_State *L) {
+  /* initialize stack array */
+  L1->stack.p = luaM_newvector(L, BASIC_STACK_SIZE + EXTRA_STACK, StackValue);
+  L1->stack_last.p = L1->stack.p + BASIC_STACK_SIZE;
+  stack_reset(L1);
+}
+
+
 static void freestack (lua_State *L) {
   if (L->stack.p == NULL)
     return;  /* stack not completely built yet */
@@ -276,22 +286,48 @@ static void close_state (lua_State *L) {
     luaC_freeallobjects(L);  /* collect all objects */
     luai_userstateclose(L);
   }
+  luaE_freethreadpool(L);  /* collecting the threads pooled them */
   luaM_freearray(L, G(L)->strt.hash, G(L)->strt.size);
+  luaH_freeshapes(L);  /* any left unused by an allocation error */
   freestack(L);
   lua_assert(gettotalbytes(g) == sizeof(LG));
   (*g->frealloc)(g->ud, fromstate(L), sizeof(LG), 0);  /* free main block */
 }
 
 
+/*
+** Create a thread, reusing one from the pool when there is one. A pooled
+** thread keeps its memory block and its stack, if not too large (see
+** luaE_freethread), so only a new thread allocates.
+*/
 LUA_API lua_State *lua_newthread (lua_State *L) {
   global_State *g = G(L);
   GCObject *o;
   lua_State *L1;
+  StkId stack = NULL;
+  StkId stack_last = NULL;
+  CallInfo *ci = NULL;
+  unsigned short nci = 0;
   lua_lock(L);
   luaC_checkGC(L);
-  /* create new thread */
-  o = luaC_newobjdt(L, LUA_TTHREAD, sizeof(LX), offsetof(LX, l));
-  L1 = gco2th(o);
+  if (g->threadpool != NULL) {  /* reuse a collected thread? */
+    L1 = g->threadpool;
+    g->threadpool = L1->twups;
+    g->nthreadpool--;
+    stack = L1->stack.p;
+    stack_last = L1->stack_last.p;
+    ci = L1->base_ci.next;
+    nci = L1->nci;
+    /* link it back into 'allgc' as luaC_newobj does */
+    o = obj2gco(L1);
+    o->marked = luaC_white(g);
+    o->next = g->allgc;
+    g->allgc = o;
+  }
+  else {  /* create new thread */
+    o = luaC_newobjdt(L, LUA_TTHREAD, sizeof(LX), offsetof(LX, l));
+    L1 = gco2th(o);
+  }
   /* anchor it on L stack */
   setthvalue2s(L, L->top.p, L1);
   api_incr_top(L);
@@ -304,22 +340,74 @@ LUA_API lua_State *lua_newthread (lua_State *L) {
   memcpy(lua_getextraspace(L1), lua_getextraspace(g->mainthread),
          LUA_EXTRASPACE);
   luai_userstatethread(L, L1);
-  stack_init(L1, L);  /* init stack */
+  if (stack != NULL) {  /* reuse its stack and CallInfo */
+    L1->stack.p = stack;
+    L1->stack_last.p = stack_last;
+    stack_reset(L1);
+    L1->base_ci.next = ci;
+    L1->nci = nci;
+    if (ci != NULL)
+      ci->previous = &L1->base_ci;
+  }
+  else
+    stack_init(L1, L);  /* init stack */
   lua_unlock(L);
   return L1;
 }
 
 
+/*
+** Free a collected thread, or keep it in the pool for lua_newthread if
+** the pool has room. A pooled thread keeps one CallInfo beyond 'base_ci',
+** enough to resume a Lua function, and keeps its stack only up to
+** LUAI_THREADPOOLSTACK slots. Nothing
+** here allocates, as the collector calls it while sweeping.
+*/
 void luaE_freethread (lua_State *L, lua_State *L1) {
+  global_State *g = G(L);
   LX *l = fromstate(L1);
   luaF_closeupval(L1, L1->stack.p);  /* close all upvalues */
   lua_assert(L1->openupval == NULL);
   luai_userstatefree(L, L1);
+  if (g->nthreadpool < LUAI_THREADPOOL) {
+    if (L1->stack.p != NULL) {
+      if (stacksize(L1) > LUAI_THREADPOOLSTACK) {
+        freestack(L1);  /* too large to keep */
+        L1->stack.p = NULL;
+      }
+      else {
+        L1->ci = (L1->base_ci.next != NULL) ? L1->base_ci.next
+                                            : &L1->base_ci;
+        freeCI(L1);  /* free the CallInfo after it */
+        L1->ci = &L1->base_ci;
+      }
+    }
+    L1->twups = g->threadpool;  /* 'twups' links the pool */
+    g->threadpool = L1;
+    g->nthreadpool++;
+    return;
+  }
   freestack(L1);
   luaM_free(L, l);
 }
 
 
+/*
+** Free every thread in the pool (when closing the state or short of
+** memory)
+*/
+void luaE_freethreadpool (lua_State *L) {
+  global_State *g = G(L);
+  while (g->threadpool != NULL) {
+    lua_State *L1 = g->threadpool;
+    g->threadpool = L1->twups;
+    freestack(L1);
+    luaM_free(L, fromstate(L1));
+  }
+  g->nthreadpool = 0;
+}
+
+
 int luaE_resetthread (lua_State *L, int status) {
   CallInfo *ci = L->ci = &L->base_ci;  /* unwind CallInfo list */
   setnilvalue(s2v(L->stack.p));  /* 'function' entry for basic 'ci' */
@@ -394,6 +482,9 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->gray = g->grayagain = NULL;
   g->weak = g->ephemeron = g->allweak = NULL;
   g->twups = NULL;
+  g->threadpool = NULL;
+  g->nthreadpool = 0;
+  g->shapes = NULL;
   g->totalbytes = sizeof(LG);
   g->GCdebt = 0;
   g->lastatomic = 0;
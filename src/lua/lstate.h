@@ -156,6 +156,7 @@ typedef struct stringtable {
   TString **hash;
   int nuse;  /* number of elements */
   int size;
+  int minsize;  /* collector does not shrink below this (luaS_presize) */
 } stringtable;
 
 
@@ -292,6 +293,9 @@ typedef struct global_State {
   GCObject *finobjold1;  /* list of old1 objects with finalizers */
   GCObject *finobjrold;  /* list of really old objects with finalizers */
   struct lua_State *twups;  /* list of threads with open upvalues */
+  struct lua_State *threadpool;  /* collected threads kept for reuse */
+  int nthreadpool;  /* number of threads in 'threadpool' */
+  Shape *shapes;  /* shapes with one key (roots of the shape tree) */
   lua_CFunction panic;  /* to be called in unprotected errors */
   struct lua_State *mainthread;
   TString *memerrmsg;  /* message for memory-allocation errors */
@@ -395,6 +399,7 @@ union GCUnion {
 
 LUAI_FUNC void luaE_setdebt (global_State *g, l_mem debt);
 LUAI_FUNC void luaE_freethread (lua_State *L, lua_State *L1);
+LUAI_FUNC void luaE_freethreadpool (lua_State *L);
 LUAI_FUNC CallInfo *luaE_extendCI (lua_State *L);
 LUAI_FUNC void luaE_shrinkCI (lua_State *L);
 LUAI_FUNC void luaE_checkcstack (lua_State *L);
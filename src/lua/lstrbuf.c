@@ -0,0 +1,220 @@
+/*
+** lstrbuf.c
+** Lua strbuf library - a growable string buffer
+** Building output with `s = s .. piece` makes a new string per step, so n
+** pieces cost O(n^2) bytes of copying and as many dead strings. A strbuf
+** appends into one buffer instead, and print, _io and compute results
+** read its bytes in place (cu_strbuf_view) without making a string first
+*/
+
+#include <string.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+
+#define STRBUF_METATABLE "cu.strbuf"
+#define STRBUF_MIN_CAPACITY 64
+
+/*
+** The bytes live in a second full userdata held as the strbuf's user
+** value, replaced by a larger one as it fills, so the collector owns all
+** of the memory and no __gc is needed
+*/
+typedef struct StrBuf {
+    char* data;
+    size_t len;
+    size_t cap;
+} StrBuf;
+
+static StrBuf* check_strbuf(lua_State* L, int index) {
+    return (StrBuf*)luaL_checkudata(L, index, STRBUF_METATABLE);
+}
+
+/* Make room for `n` more bytes in the strbuf at `index` */
+static void strbuf_reserve(lua_State* L, StrBuf* b, int index, size_t n) {
+    size_t cap = b->cap;
+    char* data;
+    if (cap - b->len >= n) return;
+    if (n > (size_t)-1 / 2 - b->len) luaL_error(L, "strbuf: buffer too large");
+    while (cap - b->len < n) cap *= 2;
+    data = (char*)lua_newuserdatauv(L, cap, 0);
+    memcpy(data, b->data, b->len);
+    lua_setiuservalue(L, index, 1);
+    b->data = data;
+    b->cap = cap;
+}
+
+static void strbuf_add(lua_State* L, StrBuf* b, int index, const char* s, size_t n) {
+    strbuf_reserve(L, b, index, n);
+    memcpy(b->data + b->len, s, n);
+    b->len += n;
+}
+
+/*
+** strbuf.new([capacity])
+** Creates an empty buffer with room for `capacity` bytes before it grows
+**
+** Returns:
+**   the strbuf
+*/
+static int l_strbuf_new(lua_State* L) {
+    lua_Integer capacity = luaL_optinteger(L, 1, STRBUF_MIN_CAPACITY);
+    StrBuf* b;
+    luaL_argcheck(L, capacity >= 0, 1, "capacity must not be negative");
+    if (capacity < STRBUF_MIN_CAPACITY) capacity = STRBUF_MIN_CAPACITY;
+
+    b = (StrBuf*)lua_newuserdatauv(L, sizeof(StrBuf), 1);
+    b->len = 0;
+    b->cap = (size_t)capacity;
+    b->data = (char*)lua_newuserdatauv(L, b->cap, 0);
+    lua_setiuservalue(L, -2, 1);
+    luaL_setmetatable(L, STRBUF_METATABLE);
+    return 1;
+}
+
+/*
+** sb:append(...)
+** Appends each argument: strings, numbers (as tostring writes them) and
+** other strbufs
+**
+** Returns:
+**   sb, so calls chain
+*/
+static int l_strbuf_append(lua_State* L) {
+    StrBuf* b = check_strbuf(L, 1);
+    int top = lua_gettop(L);
+    int i;
+    for (i = 2; i <= top; i++) {
+        StrBuf* other = (StrBuf*)luaL_testudata(L, i, STRBUF_METATABLE);
+        if (other != NULL) {
+            /* Reserve first: appending sb to itself reads the grown copy */
+            size_t n = other->len;
+            strbuf_reserve(L, b, 1, n);
+            memcpy(b->data + b->len, other->data, n);
+            b->len += n;
+        } else {
+            size_t n;
+            const char* s = lua_tolstring(L, i, &n);
+            if (s == NULL) return luaL_typeerror(L, i, "string, number or strbuf");
+            strbuf_add(L, b, 1, s, n);
+        }
+    }
+    lua_settop(L, 1);
+    return 1;
+}
+
+/*
+** sb:format(fmt, ...)
+** Appends string.format(fmt, ...)
+**
+** Returns:
+**   sb
+*/
+static int l_strbuf_format(lua_State* L) {
+    StrBuf* b = check_strbuf(L, 1);
+    size_t n;
+    const char* s;
+    luaL_checkstring(L, 2);
+    lua_pushvalue(L, lua_upvalueindex(1));
+    lua_rotate(L, 2, 1);
+    lua_call(L, lua_gettop(L) - 2, 1);
+    s = lua_tolstring(L, -1, &n);
+    strbuf_add(L, b, 1, s, n);
+    lua_settop(L, 1);
+    return 1;
+}
+
+/*
+** sb:tostring() / tostring(sb)
+** Returns:
+**   the contents as a string
+*/
+static int l_strbuf_tostring(lua_State* L) {
+    StrBuf* b = check_strbuf(L, 1);
+    lua_pushlstring(L, b->data, b->len);
+    return 1;
+}
+
+/*
+** sb:len() / #sb
+** Returns:
+**   the number of bytes appended
+*/
+static int l_strbuf_len(lua_State* L) {
+    lua_pushinteger(L, (lua_Integer)check_strbuf(L, 1)->len);
+    return 1;
+}
+
+/*
+** sb:clear()
+** Empties the buffer, keeping its capacity
+**
+** Returns:
+**   sb
+*/
+static int l_strbuf_clear(lua_State* L) {
+    check_strbuf(L, 1)->len = 0;
+    lua_settop(L, 1);
+    return 1;
+}
+
+/*
+** For src/strbuf.zig: the bytes of the strbuf at `index`, or NULL if it
+** is not one. Valid until the strbuf next grows or is collected
+*/
+const char* cu_strbuf_view(lua_State* L, int index, size_t* len) {
+    StrBuf* b = (StrBuf*)luaL_testudata(L, index, STRBUF_METATABLE);
+    if (b == NULL) return NULL;
+    *len = b->len;
+    return b->data;
+}
+
+/*
+** Method registration table
+** These become accessible as sb:append(), etc.
+*/
+static const luaL_Reg strbuf_methods[] = {
+    {"append", l_strbuf_append},
+    {"format", NULL},
+    {"tostring", l_strbuf_tostring},
+    {"len", l_strbuf_len},
+    {"clear", l_strbuf_clear},
+    {NULL, NULL}
+};
+
+/*
+** Module function registration table
+** These become accessible as strbuf.new()
+*/
+static const luaL_Reg strbuf_functions[] = {
+    {"new", l_strbuf_new},
+    {NULL, NULL}
+};
+
+/*
+** luaopen_strbuf
+** Module initialization function - called when the strbuf library is loaded
+**
+** Returns:
+**   strbuf module table on Lua stack
+*/
+LUAMOD_API int luaopen_strbuf(lua_State* L) {
+    if (luaL_newmetatable(L, STRBUF_METATABLE)) {
+        luaL_newlib(L, strbuf_methods);
+        /* format keeps string.format as its upvalue */
+        lua_getglobal(L, "string");
+        if (lua_istable(L, -1)) lua_getfield(L, -1, "format");
+        else lua_pushnil(L);
+        lua_pushcclosure(L, l_strbuf_format, 1);
+        lua_setfield(L, -3, "format");
+        lua_pop(L, 1);
+        lua_setfield(L, -2, "__index");
+        lua_pushcfunction(L, l_strbuf_tostring);
+        lua_setfield(L, -2, "__tostring");
+        lua_pushcfunction(L, l_strbuf_len);
+        lua_setfield(L, -2, "__len");
+    }
+    lua_pop(L, 1);
+    luaL_newlib(L, strbuf_functions);
+    return 1;
+}
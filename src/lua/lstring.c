@@ -40,11 +40,42 @@ int luaS_eqlngstr (TString *a, TString *b) {
 }
 
 
+/*
+** Cu hashes four bytes at a time (MurmurHash3's 32-bit block and final
+** mixes), reading each block with 'memcpy' so 'str' need not be aligned.
+** The final mix spreads every input bit into the low bits that 'lmod'
+** keeps. Hashes are never stored outside the running state, so their
+** values may differ between byte orders.
+*/
+#define rotl32(x,n)	(((x) << (n)) | ((x) >> (32 - (n))))
+
+static unsigned int hashblock (unsigned int k) {
+  k *= 0xcc9e2d51u;
+  k = rotl32(k, 15);
+  return k * 0x1b873593u;
+}
+
 unsigned int luaS_hash (const char *str, size_t l, unsigned int seed) {
   unsigned int h = seed ^ cast_uint(l);
-  for (; l > 0; l--)
-    h ^= ((h<<5) + (h>>2) + cast_byte(str[l - 1]));
-  return h;
+  unsigned int k = 0;
+  const unsigned char *p = cast(const unsigned char *, str);
+  for (; l >= 4; l -= 4, p += 4) {
+    memcpy(&k, p, 4);
+    h ^= hashblock(k);
+    h = rotl32(h, 13) * 5 + 0xe6546b64u;
+  }
+  k = 0;
+  switch (l) {  /* remaining 0-3 bytes */
+    case 3: k ^= cast_uint(p[2]) << 16;  /* FALLTHROUGH */
+    case 2: k ^= cast_uint(p[1]) << 8;  /* FALLTHROUGH */
+    case 1: k ^= p[0];
+            h ^= hashblock(k);
+  }
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  return h ^ (h >> 16);
 }
 
 
@@ -103,6 +134,51 @@ void luaS_resize (lua_State *L, int nsize) {
 }
 
 
+/*
+** Grow the string table to at least 'size' slots (rounded up to a power
+** of 2) and keep the collector from shrinking it below that, so a state
+** that will intern many strings skips the doubling rehashes on the way.
+*/
+void luaS_presize (lua_State *L, int size) {
+  stringtable *tb = &G(L)->strt;
+  if (size <= 0)
+    tb->minsize = 0;
+  else {
+    int nsize;
+    if (size > MAXSTRTB / 2)
+      size = MAXSTRTB / 2;
+    nsize = 1 << luaO_ceillog2(cast_uint(size));
+    tb->minsize = nsize;
+    if (nsize > tb->size)
+      luaS_resize(L, nsize);
+  }
+}
+
+
+/*
+** Size, use and chain lengths of the string table, for Cu's
+** get_memory_stats
+*/
+void luaS_tablestats (lua_State *L, int *size, int *nuse, int *buckets,
+                      int *longest) {
+  stringtable *tb = &G(L)->strt;
+  int i;
+  *size = tb->size;
+  *nuse = tb->nuse;
+  *buckets = *longest = 0;
+  for (i = 0; i < tb->size; i++) {
+    int n = 0;
+    TString *p;
+    for (p = tb->hash[i]; p != NULL; p = p->u.hnext)
+      n++;
+    if (n > 0)
+      (*buckets)++;
+    if (n > *longest)
+      *longest = n;
+  }
+}
+
+
 /*
 ** Clear API string cache. (Entries cannot be empty, so fill them with
 ** a non-collectable string.)
@@ -127,6 +203,7 @@ void luaS_init (lua_State *L) {
   tb->hash = luaM_newvector(L, MINSTRTABSIZE, TString*);
   tablerehash(tb->hash, 0, MINSTRTABSIZE);  /* clear array */
   tb->size = MINSTRTABSIZE;
+  tb->minsize = 0;
   /* pre-create memory-error message */
   g->memerrmsg = luaS_newliteral(L, MEMERRMSG);
   luaC_fix(L, obj2gco(g->memerrmsg));  /* it should never be collected */
@@ -355,13 +355,33 @@ static const luaL_Reg stringmetamethods[] = {
 #define CAP_POSITION	(-2)
 
 
+/* longest pattern 'patterninfo' analyzes */
+#define PATINFO_MAXLEN	64
+
+/* set of bytes, one bit each */
+typedef unsigned char CharSet[32];
+
+#define setadd(set,c)	((set)[uchar(c) >> 3] |= (unsigned char)(1u << ((c) & 7)))
+#define setisin(set,c)	(((set)[uchar(c) >> 3] >> ((c) & 7)) & 1)
+
+/* where a match may start (see 'nextstart') */
+#define SKIP_NONE	0  /* anywhere */
+#define SKIP_SET	1  /* only at bytes in 'first' */
+#define SKIP_BYTE	2  /* only at 'firstbyte' */
+
 typedef struct MatchState {
   const char *src_init;  /* init of source string */
   const char *src_end;  /* end ('\0') of source string */
+  const char *p_init;  /* init of pattern (after any '^') */
   const char *p_end;  /* end ('\0') of pattern */
   lua_State *L;
   int matchdepth;  /* control for recursive depth (to avoid C stack overflow) */
   unsigned char level;  /* total number of captures (finished or unfinished) */
+  unsigned char skip;  /* SKIP_* */
+  unsigned char firstbyte;
+  CharSet first;
+  /* bit i: the repetition whose suffix is p_init[i] never gives back */
+  unsigned char possessive[PATINFO_MAXLEN / 8];
   struct {
     const char *init;
     ptrdiff_t len;
@@ -503,11 +523,19 @@ static const char *matchbalance (MatchState *ms, const char *s,
 }
 
 
+static int ispossessive (MatchState *ms, const char *ep) {
+  size_t i = ep - ms->p_init;
+  return i < PATINFO_MAXLEN && ((ms->possessive[i >> 3] >> (i & 7)) & 1);
+}
+
+
 static const char *max_expand (MatchState *ms, const char *s,
                                  const char *p, const char *ep) {
   ptrdiff_t i = 0;  /* counts maximum expand for item */
   while (singlematch(ms, s + i, p, ep))
     i++;
+  if (ispossessive(ms, ep))  /* fewer repetitions cannot match either? */
+    return match(ms, s + i, ep + 1);
   /* keeps trying to match with the maximum repetitions */
   while (i>=0) {
     const char *res = match(ms, (s+i), ep+1);
@@ -670,6 +698,245 @@ static const char *match (MatchState *ms, const char *s, const char *p) {
 
 
 
+/*
+** {======================================================
+** PATTERN ANALYSIS
+** 'prepstate' analyzes patterns of up to PATINFO_MAXLEN bytes, without
+** changing what they match:
+** - the bytes a match must start with, so the search loops skip other
+**   positions (with memchr when there is only one such byte);
+** - which greedy repetitions ('*', '+') are followed by items that
+**   cannot start with a byte of the repeated class. Giving back
+**   repetitions cannot make those match, so 'max_expand' tries the
+**   longest run only, and patterns like "(%d+)%s+(%a+)" match in linear
+**   time instead of backtracking.
+** Results are cached by pattern address, checked against a copy of the
+** pattern, since the address is reused once the string is collected.
+** The analysis never raises: malformed patterns are left to 'match'.
+** =======================================================
+*/
+
+/* what 'firstset' found */
+#define FIRST_UNKNOWN	0  /* an item it does not analyze */
+#define FIRST_EMPTY	1  /* the items may match without consuming a byte */
+#define FIRST_BYTE	2  /* the items must consume a byte in the set first */
+
+#define PATCACHE_SIZE	64  /* a power of 2 */
+
+typedef struct PatternInfo {
+  const char *key;  /* pattern address, or NULL for a free entry */
+  size_t len;
+  char copy[PATINFO_MAXLEN];
+  unsigned char skip;
+  unsigned char firstbyte;
+  CharSet first;
+  unsigned char possessive[PATINFO_MAXLEN / 8];
+} PatternInfo;
+
+static PatternInfo patcache[PATCACHE_SIZE];
+
+
+/* like 'classend', but returns NULL instead of raising */
+static const char *itemend (const char *p, const char *p_end) {
+  switch (*p++) {
+    case L_ESC:
+      return (p == p_end) ? NULL : p + 1;
+    case '[': {
+      if (*p == '^') p++;
+      do {
+        if (p == p_end) return NULL;
+        if (*(p++) == L_ESC && p < p_end)
+          p++;
+      } while (*p != ']');
+      return p + 1;
+    }
+    default:
+      return p;
+  }
+}
+
+
+/* bytes matched by the single-char class p..ep, as in 'singlematch' */
+static void classset (const char *p, const char *ep, CharSet set) {
+  int c;
+  switch (*p) {
+    case '.':
+      memset(set, 0xFF, sizeof(CharSet));
+      return;
+    case L_ESC: case '[':
+      memset(set, 0, sizeof(CharSet));
+      for (c = 0; c <= UCHAR_MAX; c++) {
+        if (*p == L_ESC ? match_class(c, uchar(*(p + 1)))
+                        : matchbracketclass(c, p, ep - 1))
+          setadd(set, c);
+      }
+      return;
+    default:
+      memset(set, 0, sizeof(CharSet));
+      setadd(set, *p);
+  }
+}
+
+
+/*
+** Add to 'set' the bytes the items from 'p' on can start with: those of
+** each optional item ('*', '?', '-') up to and including the first item
+** that must match
+*/
+static int firstset (const char *p, const char *p_end, CharSet set) {
+  CharSet cs;
+  int i;
+  for (;;) {
+    const char *ep;
+    if (p == p_end)
+      return FIRST_EMPTY;
+    switch (*p) {
+      case '(': case ')':  /* captures consume nothing */
+        p++;
+        continue;
+      case '$':
+        if (p + 1 == p_end) return FIRST_EMPTY;
+        break;  /* else a plain '$' */
+      case L_ESC:
+        if (*(p + 1) == 'b') {  /* balance starts with its opening byte */
+          if (p + 3 >= p_end) return FIRST_UNKNOWN;
+          setadd(set, *(p + 2));
+          return FIRST_BYTE;
+        }
+        if (*(p + 1) == 'f' || isdigit(uchar(*(p + 1))))
+          return FIRST_UNKNOWN;
+        break;
+    }
+    if ((ep = itemend(p, p_end)) == NULL)
+      return FIRST_UNKNOWN;
+    classset(p, ep, cs);
+    for (i = 0; i < (int)sizeof(CharSet); i++)
+      set[i] |= cs[i];
+    if (ep < p_end && (*ep == '*' || *ep == '?' || *ep == '-'))
+      p = ep + 1;
+    else
+      return FIRST_BYTE;
+  }
+}
+
+
+/*
+** A greedy repetition of class X never needs to give back: any match
+** with fewer repetitions would have the rest of the pattern start at a
+** byte in X, which the rest cannot start with when its first set is
+** disjoint from X. (If the rest may match empty up to the pattern's end,
+** the longest run matches first anyway.)
+*/
+static void findpossessive (const char *p, const char *p_end,
+                            PatternInfo *info) {
+  while (p < p_end) {
+    const char *ep;
+    switch (*p) {
+      case '(': case ')':
+        p++;
+        continue;
+      case '$':
+        if (p + 1 == p_end) return;
+        break;
+      case L_ESC:
+        if (*(p + 1) == 'b') {
+          if (p + 3 >= p_end) return;
+          p += 4;
+          continue;
+        }
+        if (*(p + 1) == 'f') {
+          if (*(p + 2) != '[' || (ep = itemend(p + 2, p_end)) == NULL)
+            return;
+          p = ep;
+          continue;
+        }
+        if (isdigit(uchar(*(p + 1)))) {
+          p += 2;
+          continue;
+        }
+        break;
+    }
+    if ((ep = itemend(p, p_end)) == NULL)
+      return;
+    if (ep < p_end && (*ep == '*' || *ep == '+')) {
+      CharSet cs, follow;
+      int i, disjoint = 1;
+      classset(p, ep, cs);
+      memset(follow, 0, sizeof(CharSet));
+      if (firstset(ep + 1, p_end, follow) == FIRST_UNKNOWN)
+        disjoint = 0;
+      for (i = 0; disjoint && i < (int)sizeof(CharSet); i++)
+        disjoint = (cs[i] & follow[i]) == 0;
+      if (disjoint)
+        setadd(info->possessive, ep - info->key);
+    }
+    if (ep < p_end && (*ep == '*' || *ep == '+' || *ep == '?' || *ep == '-'))
+      ep++;
+    p = ep;
+  }
+}
+
+
+static void analyze (const char *p, size_t lp, PatternInfo *info) {
+  int c, n = 0;
+  info->key = p;
+  info->len = lp;
+  memcpy(info->copy, p, lp);
+  info->skip = SKIP_NONE;
+  memset(info->first, 0, sizeof(CharSet));
+  memset(info->possessive, 0, sizeof(info->possessive));
+  if (firstset(p, p + lp, info->first) == FIRST_BYTE) {
+    for (c = 0; c <= UCHAR_MAX; c++) {
+      if (setisin(info->first, c)) {
+        n++;
+        info->firstbyte = (unsigned char)c;
+      }
+    }
+    info->skip = (n == 1) ? SKIP_BYTE : (n <= UCHAR_MAX) ? SKIP_SET : SKIP_NONE;
+  }
+  findpossessive(p, p + lp, info);
+}
+
+
+/* fill in the analysis of pattern 'p' from the cache */
+static void patterninfo (MatchState *ms, const char *p, size_t lp) {
+  PatternInfo *info;
+  size_t h = (size_t)p;
+  if (lp > PATINFO_MAXLEN) {
+    ms->skip = SKIP_NONE;
+    memset(ms->possessive, 0, sizeof(ms->possessive));
+    return;
+  }
+  info = &patcache[(h ^ (h >> 6) ^ lp) & (PATCACHE_SIZE - 1)];
+  if (info->key != p || info->len != lp || memcmp(info->copy, p, lp) != 0)
+    analyze(p, lp, info);
+  ms->skip = info->skip;
+  ms->firstbyte = info->firstbyte;
+  memcpy(ms->first, info->first, sizeof(CharSet));
+  memcpy(ms->possessive, info->possessive, sizeof(ms->possessive));
+}
+
+
+/* first position from 's' on where a match may start, or 'src_end' */
+static const char *nextstart (MatchState *ms, const char *s) {
+  switch (ms->skip) {
+    case SKIP_BYTE: {
+      const char *q = (const char *)memchr(s, ms->firstbyte, ms->src_end - s);
+      return (q != NULL) ? q : ms->src_end;
+    }
+    case SKIP_SET: {
+      while (s < ms->src_end && !setisin(ms->first, *s))
+        s++;
+      return s;
+    }
+    default:
+      return s;
+  }
+}
+
+/* }====================================================== */
+
+
 static const char *lmemfind (const char *s1, size_t l1,
                                const char *s2, size_t l2) {
   if (l2 == 0) return s1;  /* empty strings are everywhere */
@@ -760,7 +1027,9 @@ static void prepstate (MatchState *ms, lua_State *L,
   ms->matchdepth = MAXCCALLS;
   ms->src_init = s;
   ms->src_end = s + ls;
+  ms->p_init = p;
   ms->p_end = p + lp;
+  patterninfo(ms, p, lp);
 }
 
 
@@ -799,6 +1068,8 @@ static int str_find_aux (lua_State *L, int find) {
     prepstate(&ms, L, s, ls, p, lp);
     do {
       const char *res;
+      if (!anchor)
+        s1 = nextstart(&ms, s1);
       reprepstate(&ms);
       if ((res=match(&ms, s1, p)) != NULL) {
         if (find) {
@@ -841,6 +1112,7 @@ static int gmatch_aux (lua_State *L) {
   gm->ms.L = L;
   for (src = gm->src; src <= gm->ms.src_end; src++) {
     const char *e;
+    src = nextstart(&gm->ms, src);
     reprepstate(&gm->ms);
     if ((e = match(&gm->ms, src, gm->p)) != NULL && e != gm->lastmatch) {
       gm->src = gm->lastmatch = e;
@@ -961,6 +1233,11 @@ static int str_gsub (lua_State *L) {
   prepstate(&ms, L, src, srcl, p, lp);
   while (n < max_s) {
     const char *e;
+    if (!anchor) {  /* copy what cannot start a match */
+      const char *next = nextstart(&ms, src);
+      luaL_addlstring(&b, src, next - src);
+      src = next;
+    }
     reprepstate(&ms);  /* (re)prepare state for new match */
     if ((e = match(&ms, src, p)) != NULL && e != lastmatch) {  /* match? */
       n++;
@@ -986,6 +1263,84 @@ static int str_gsub (lua_State *L) {
 
 
 
+/*
+** {======================================================
+** SPLIT AND JOIN
+** Plain-separator counterparts of the gmatch + table insert idiom: the
+** separators are found with 'lmemfind' (memchr on their first byte), and
+** the result table is created at its final size.
+** =======================================================
+*/
+
+
+/*
+** string.split(s, sep [, max]): the fields of 's' between occurrences of
+** 'sep', empty ones included, as a sequence of at most 'max' fields (the
+** last holding the rest of 's'). An empty 'sep' splits 's' into bytes.
+*/
+static int str_split (lua_State *L) {
+  size_t l, lsep;
+  const char *s = luaL_checklstring(L, 1, &l);
+  const char *sep = luaL_checklstring(L, 2, &lsep);
+  lua_Integer max = luaL_optinteger(L, 3, LUA_MAXINTEGER);
+  const char *e = s + l;
+  lua_Integer n, i;
+  luaL_argcheck(L, max > 0, 3, "must be positive");
+  if (lsep == 0)
+    n = ((lua_Unsigned)l < (lua_Unsigned)max) ? (lua_Integer)l : max;
+  else {  /* count the fields */
+    const char *p = s;
+    for (n = 1; n < max && (p = lmemfind(p, e - p, sep, lsep)) != NULL; n++)
+      p += lsep;
+  }
+  if (l_unlikely(n > INT_MAX))
+    return luaL_error(L, "too many fields to split");
+  lua_createtable(L, (int)n, 0);
+  for (i = 1; i < n; i++) {
+    const char *q = (lsep == 0) ? s + 1 : lmemfind(s, e - s, sep, lsep);
+    lua_pushlstring(L, s, q - s);
+    lua_rawseti(L, -2, i);
+    s = q + lsep;
+  }
+  if (n > 0) {  /* last field: the rest */
+    lua_pushlstring(L, s, e - s);
+    lua_rawseti(L, -2, n);
+  }
+  return 1;
+}
+
+
+/*
+** string.join(list [, sep [, i [, j]]]): like table.concat, but converts
+** every element with tostring, so numbers, booleans and values with
+** '__tostring' join as they print
+*/
+static int str_join (lua_State *L) {
+  luaL_Buffer b;
+  size_t lsep;
+  const char *sep = luaL_optlstring(L, 2, "", &lsep);
+  lua_Integer i, last;
+  luaL_checktype(L, 1, LUA_TTABLE);
+  i = luaL_optinteger(L, 3, 1);
+  last = luaL_opt(L, luaL_checkinteger, 4, luaL_len(L, 1));
+  luaL_buffinit(L, &b);
+  for (; i <= last; i++) {
+    lua_geti(L, 1, i);
+    luaL_tolstring(L, -1, NULL);
+    lua_remove(L, -2);  /* keep only the string */
+    luaL_addvalue(&b);
+    if (i == last)
+      break;  /* also avoids overflow when 'last' is maxinteger */
+    luaL_addlstring(&b, sep, lsep);
+  }
+  luaL_pushresult(&b);
+  return 1;
+}
+
+/* }====================================================== */
+
+
+
 /*
 ** {======================================================
 ** STRING FORMAT
@@ -1207,32 +1562,52 @@ static void addliteral (lua_State *L, luaL_Buffer *b, int arg) {
 }
 
 
-static const char *get2digits (const char *s) {
+/*
+** A conversion specification as 'checkformat' reads it: its flags, its
+** width, and its precision (-1 if it has none)
+*/
+typedef struct FormatSpec {
+  char left, plus, space, alt, zero;
+  int width;
+  int precision;
+} FormatSpec;
+
+
+static const char *getnumber (const char *s, int *n) {
+  *n = 0;
   if (isdigit(uchar(*s))) {
-    s++;
-    if (isdigit(uchar(*s))) s++;  /* (2 digits at most) */
+    *n = *s++ - '0';
+    if (isdigit(uchar(*s))) *n = *n * 10 + (*s++ - '0');  /* (2 digits at most) */
   }
   return s;
 }
 
 
 /*
-** Check whether a conversion specification is valid. When called,
-** first character in 'form' must be '%' and last character must
-** be a valid conversion specifier. 'flags' are the accepted flags;
-** 'precision' signals whether to accept a precision.
+** Check whether a conversion specification is valid, reading it into
+** 'fs' on the way. When called, first character in 'form' must be '%'
+** and last character must be a valid conversion specifier. 'flags' are
+** the accepted flags; 'precision' signals whether to accept a precision.
 */
 static void checkformat (lua_State *L, const char *form, const char *flags,
-                                       int precision) {
+                                       int precision, FormatSpec *fs) {
   const char *spec = form + 1;  /* skip '%' */
-  spec += strspn(spec, flags);  /* skip flags */
-  if (*spec != '0') {  /* a width cannot start with '0' */
-    spec = get2digits(spec);  /* skip width */
-    if (*spec == '.' && precision) {
-      spec++;
-      spec = get2digits(spec);  /* skip precision */
+  memset(fs, 0, sizeof(*fs));
+  fs->precision = -1;
+  for (; *spec != '\0' && strchr(flags, *spec) != NULL; spec++) {
+    switch (*spec) {  /* flags */
+      case '-': fs->left = 1; break;
+      case '+': fs->plus = 1; break;
+      case ' ': fs->space = 1; break;
+      case '#': fs->alt = 1; break;
+      case '0': fs->zero = 1; break;
     }
   }
+  if (*spec != '0') {  /* a width cannot start with '0' */
+    spec = getnumber(spec, &fs->width);
+    if (*spec == '.' && precision)
+      spec = getnumber(spec + 1, &fs->precision);
+  }
   if (!isalpha(uchar(*spec)))  /* did not go to the end? */
     luaL_error(L, "invalid conversion specification: '%s'", form);
 }
@@ -1270,6 +1645,126 @@ static void addlenmod (char *form, const char *lenmod) {
 }
 
 
+/*
+** {------------------------------------------------------
+** Conversions written straight into the buffer, from the specification
+** 'checkformat' read, instead of through 'l_sprintf', which would parse
+** it again
+** -------------------------------------------------------
+*/
+
+/*
+** Add 'prefix' (a sign or '0x') and then 'body' to 'b', padded to the
+** width; zero padding, when asked for and allowed, goes between the two
+*/
+static void addpadded (luaL_Buffer *b, const FormatSpec *fs,
+                       const char *prefix, size_t lp,
+                       const char *body, size_t lb, int zeropad) {
+  size_t len = lp + lb;
+  size_t pad = ((size_t)fs->width > len) ? (size_t)fs->width - len : 0;
+  char *p = luaL_prepbuffsize(b, len + pad);
+  int zeros = (zeropad && fs->zero && !fs->left);
+  if (!fs->left && !zeros) {
+    memset(p, ' ', pad);
+    p += pad;
+  }
+  memcpy(p, prefix, lp);
+  p += lp;
+  if (zeros) {
+    memset(p, '0', pad);
+    p += pad;
+  }
+  memcpy(p, body, lb);
+  if (fs->left)
+    memset(p + lb, ' ', pad);
+  luaL_addsize(b, len + pad);
+}
+
+
+static const char *signprefix (const FormatSpec *fs, int neg) {
+  return neg ? "-" : fs->plus ? "+" : fs->space ? " " : "";
+}
+
+
+static const char digitpairs[] =
+  "00010203040506070809101112131415161718192021222324252627282930313233"
+  "34353637383940414243444546474849505152535455565758596061626364656667"
+  "6869707172737475767778798081828384858687888990919293949596979899";
+
+
+/* conversions 'd', 'i', 'u', 'o', 'x', and 'X' */
+static void addinteger (luaL_Buffer *b, const FormatSpec *fs,
+                        lua_Integer n, int conv) {
+  char buff[MAX_ITEM];
+  char *end = buff + MAX_ITEM;
+  char *p = end;
+  lua_Unsigned u = (lua_Unsigned)n;
+  const char *prefix = "";
+  if (conv == 'd' || conv == 'i') {
+    if (n < 0) u = 0u - u;
+    prefix = signprefix(fs, n < 0);
+  }
+  if (conv == 'o') {
+    for (; u != 0; u >>= 3) *--p = (char)('0' + (u & 7));
+  }
+  else if (conv == 'x' || conv == 'X') {
+    const char *digits = (conv == 'x') ? "0123456789abcdef"
+                                       : "0123456789ABCDEF";
+    if (fs->alt && u != 0)
+      prefix = (conv == 'x') ? "0x" : "0X";
+    for (; u != 0; u >>= 4) *--p = digits[u & 15];
+  }
+  else {  /* decimal, two digits at a time */
+    while (u >= 100) {
+      unsigned int r = (unsigned int)(u % 100);
+      u /= 100;
+      p -= 2;
+      memcpy(p, digitpairs + 2 * r, 2);
+    }
+    if (u >= 10) {
+      p -= 2;
+      memcpy(p, digitpairs + 2 * u, 2);
+    }
+    else if (u != 0)
+      *--p = (char)('0' + u);
+  }
+  while (end - p < (fs->precision < 0 ? 1 : fs->precision))
+    *--p = '0';
+  if (conv == 'o' && fs->alt && (p == end || *p != '0'))
+    *--p = '0';  /* '#' makes an octal numeral start with 0 */
+  /* a precision turns the '0' flag off */
+  addpadded(b, fs, prefix, strlen(prefix), p, end - p, fs->precision < 0);
+}
+
+
+#if defined(luai_formatfloat)
+
+/* conversions 'a', 'A', 'e', 'E', 'f', 'F', 'g', and 'G' */
+static void addfloat (luaL_Buffer *b, const FormatSpec *fs,
+                      lua_Number n, int conv) {
+  char body[MAX_ITEMF];
+  int finite = (n == n && n - n == 0);  /* not inf or NaN */
+  int neg = signbit(n);
+  int lb = luai_formatfloat(body, MAX_ITEMF, neg ? -n : n, conv,
+                            fs->precision, fs->alt);
+  const char *prefix = signprefix(fs, neg);
+  addpadded(b, fs, prefix, strlen(prefix), body, (size_t)lb, finite);
+}
+
+#endif
+
+
+/* conversions 'c' and 's' (the string has no embedded zeros) */
+static void addtext (luaL_Buffer *b, const FormatSpec *fs,
+                     const char *s, size_t l) {
+  if (fs->precision >= 0 && (size_t)fs->precision < l)
+    l = (size_t)fs->precision;
+  addpadded(b, fs, "", 0, s, l, 0);
+}
+
+/* }------------------------------------------------------ */
+
+
 static int str_format (lua_State *L) {
   int top = lua_gettop(L);
   int arg = 1;
@@ -1286,16 +1781,18 @@ static int str_format (lua_State *L) {
       luaL_addchar(&b, *strfrmt++);  /* %% */
     else { /* format item */
       char form[MAX_FORMAT];  /* to store the format ('%...') */
+      FormatSpec fs;  /* 'form' as 'checkformat' reads it */
       int maxitem = MAX_ITEM;  /* maximum length for the result */
-      char *buff = luaL_prepbuffsize(&b, maxitem);  /* to put result */
+      char *buff = NULL;  /* to put result, for 'l_sprintf' */
       int nb = 0;  /* number of bytes in result */
       if (++arg > top)
         return luaL_argerror(L, arg, "no value");
       strfrmt = getformat(L, strfrmt, form);
       switch (*strfrmt++) {
         case 'c': {
-          checkformat(L, form, L_FMTFLAGSC, 0);
-          nb = l_sprintf(buff, maxitem, form, (int)luaL_checkinteger(L, arg));
+          char c = (char)luaL_checkinteger(L, arg);
+          checkformat(L, form, L_FMTFLAGSC, 0, &fs);
+          addtext(&b, &fs, &c, 1);
           break;
         }
         case 'd': case 'i':
@@ -1308,35 +1805,46 @@ static int str_format (lua_State *L) {
           flags = L_FMTFLAGSX;
          intcase: {
           lua_Integer n = luaL_checkinteger(L, arg);
-          checkformat(L, form, flags, 1);
-          addlenmod(form, LUA_INTEGER_FRMLEN);
-          nb = l_sprintf(buff, maxitem, form, (LUAI_UACINT)n);
+          checkformat(L, form, flags, 1, &fs);
+          addinteger(&b, &fs, n, strfrmt[-1]);
           break;
         }
+#if defined(luai_formatfloat)
         case 'a': case 'A':
-          checkformat(L, form, L_FMTFLAGSF, 1);
+        case 'f': case 'e': case 'E': case 'g': case 'G': {
+          lua_Number n = luaL_checknumber(L, arg);
+          checkformat(L, form, L_FMTFLAGSF, 1, &fs);
+          addfloat(&b, &fs, n, strfrmt[-1]);
+          break;
+        }
+#else
+        case 'a': case 'A':
+          checkformat(L, form, L_FMTFLAGSF, 1, &fs);
           addlenmod(form, LUA_NUMBER_FRMLEN);
+          buff = luaL_prepbuffsize(&b, maxitem);
           nb = lua_number2strx(L, buff, maxitem, form,
                                   luaL_checknumber(L, arg));
           break;
         case 'f':
           maxitem = MAX_ITEMF;  /* extra space for '%f' */
-          buff = luaL_prepbuffsize(&b, maxitem);
           /* FALLTHROUGH */
         case 'e': case 'E': case 'g': case 'G': {
           lua_Number n = luaL_checknumber(L, arg);
-          checkformat(L, form, L_FMTFLAGSF, 1);
+          checkformat(L, form, L_FMTFLAGSF, 1, &fs);
           addlenmod(form, LUA_NUMBER_FRMLEN);
+          buff = luaL_prepbuffsize(&b, maxitem);
           nb = l_sprintf(buff, maxitem, form, (LUAI_UACNUMBER)n);
           break;
         }
+#endif
         case 'p': {
           const void *p = lua_topointer(L, arg);
-          checkformat(L, form, L_FMTFLAGSC, 0);
+          checkformat(L, form, L_FMTFLAGSC, 0, &fs);
           if (p == NULL) {  /* avoid calling 'printf' with argument NULL */
             p = "(null)";  /* result */
             form[strlen(form) - 1] = 's';  /* format it as a string */
           }
+          buff = luaL_prepbuffsize(&b, maxitem);
           nb = l_sprintf(buff, maxitem, form, p);
           break;
         }
@@ -1353,14 +1861,14 @@ static int str_format (lua_State *L) {
             luaL_addvalue(&b);  /* keep entire string */
           else {
             luaL_argcheck(L, l == strlen(s), arg, "string contains zeros");
-            checkformat(L, form, L_FMTFLAGSC, 1);
-            if (strchr(form, '.') == NULL && l >= 100) {
-              /* no precision and string is too long to be formatted */
-              luaL_addvalue(&b);  /* keep entire string */
-            }
-            else {  /* format the string into 'buff' */
-              nb = l_sprintf(buff, maxitem, form, s);
-              lua_pop(L, 1);  /* remove result from 'luaL_tolstring' */
+            checkformat(L, form, L_FMTFLAGSC, 1, &fs);
+            if (fs.precision < 0 && l >= (size_t)fs.width)
+              luaL_addvalue(&b);  /* nothing to pad or cut: keep it */
+            else {
+              /* 's' is still on the stack, above the buffer's contents */
+              lua_insert(L, -2);
+              addtext(&b, &fs, s, l);
+              lua_remove(L, -2);
             }
           }
           break;
@@ -1835,11 +2343,13 @@ static const luaL_Reg strlib[] = {
   {"format", str_format},
   {"gmatch", gmatch},
   {"gsub", str_gsub},
+  {"join", str_join},
   {"len", str_len},
   {"lower", str_lower},
   {"match", str_match},
   {"rep", str_rep},
   {"reverse", str_reverse},
+  {"split", str_split},
   {"sub", str_sub},
   {"upper", str_upper},
   {"pack", str_pack},
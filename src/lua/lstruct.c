@@ -0,0 +1,409 @@
+/*
+** lstruct.c
+** Lua struct library - compact records with a fixed schema
+** A record kept as a table costs a Table header plus a full TValue per
+** field. struct.define declares a schema once and returns a constructor
+** whose records are userdata: each field packed at a precomputed offset
+** in its own width, and strings held as the record's user values.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+
+#define STRUCT_TYPE_METATABLE "cu.structtype"
+#define STRUCT_MAX_FIELDS 64
+
+/* Fields of a record's metatable */
+#define STRUCT_TYPE_FIELD "__struct"   /* the StructType */
+#define STRUCT_NAMES_FIELD "__fields"  /* field names, in schema order */
+
+typedef enum FieldKind { F_I64, F_F64, F_I32, F_F32, F_BOOL, F_STR } FieldKind;
+
+static const char* const kind_names[] = {"i64", "f64", "i32", "f32", "bool", "str", NULL};
+static const unsigned char kind_widths[] = {8, 8, 4, 4, 1, 0};
+
+typedef struct StructField {
+    unsigned char kind;
+    unsigned char uv;       /* user value of a str field */
+    unsigned short offset;  /* of other fields, in the record's bytes */
+} StructField;
+
+/*
+** Fields are numbered in name order, which is the order pairs() and the
+** serializer see. Offsets go to the widest fields first, so each field is
+** aligned to its width and the record has no padding.
+*/
+typedef struct StructType {
+    int nfields;
+    int size;
+    int nstrings;
+    StructField fields[STRUCT_MAX_FIELDS];
+} StructType;
+
+/* The StructType of a record's metatable at `mt`, or NULL */
+static StructType* type_of_metatable(lua_State* L, int mt) {
+    StructType* type;
+    lua_getfield(L, mt, STRUCT_TYPE_FIELD);
+    type = (StructType*)luaL_testudata(L, -1, STRUCT_TYPE_METATABLE);
+    lua_pop(L, 1);
+    return type;
+}
+
+/* The StructType of the record at `index`, or NULL if it is not a record */
+static StructType* type_of(lua_State* L, int index) {
+    StructType* type;
+    if (lua_type(L, index) != LUA_TUSERDATA || !lua_getmetatable(L, index)) return NULL;
+    type = type_of_metatable(L, lua_gettop(L));
+    lua_pop(L, 1);
+    return type;
+}
+
+/*
+** The field named by the key at `key`, using the name -> number table at
+** upvalue 2; raises an error for a name the schema does not have
+*/
+static int check_field(lua_State* L, int key) {
+    int field;
+    lua_pushvalue(L, key);
+    field = lua_rawget(L, lua_upvalueindex(2)) == LUA_TNUMBER ? (int)lua_tointeger(L, -1) : -1;
+    lua_pop(L, 1);
+    if (field < 0) {
+        if (lua_type(L, key) == LUA_TSTRING) luaL_error(L, "struct has no field '%s'", lua_tostring(L, key));
+        luaL_error(L, "struct has no field [%s]", luaL_tolstring(L, key, NULL));
+    }
+    return field;
+}
+
+/* Push field `f` of the record at `index` */
+static void push_field(lua_State* L, int index, const StructField* f) {
+    const char* bytes = (const char*)lua_touserdata(L, index) + f->offset;
+    switch (f->kind) {
+        case F_I64: {
+            long long v;
+            memcpy(&v, bytes, sizeof(v));
+            lua_pushinteger(L, (lua_Integer)v);
+            break;
+        }
+        case F_I32: {
+            int v;
+            memcpy(&v, bytes, sizeof(v));
+            lua_pushinteger(L, v);
+            break;
+        }
+        case F_F64: {
+            double v;
+            memcpy(&v, bytes, sizeof(v));
+            lua_pushnumber(L, (lua_Number)v);
+            break;
+        }
+        case F_F32: {
+            float v;
+            memcpy(&v, bytes, sizeof(v));
+            lua_pushnumber(L, (lua_Number)v);
+            break;
+        }
+        case F_BOOL:
+            lua_pushboolean(L, *bytes);
+            break;
+        default:
+            lua_getiuservalue(L, index, f->uv);
+            break;
+    }
+}
+
+/*
+** Set field `f` of the record at `index` to the value at `value`; nil
+** resets it to zero, false or nil
+*/
+static void store_field(lua_State* L, int index, const StructField* f, int value, const char* name) {
+    char* bytes = (char*)lua_touserdata(L, index) + f->offset;
+    int isnil = lua_isnil(L, value);
+    switch (f->kind) {
+        case F_I64:
+        case F_I32: {
+            int isint = 0;
+            lua_Integer v = lua_type(L, value) == LUA_TNUMBER ? lua_tointegerx(L, value, &isint) : 0;
+            if (!isint && !isnil) luaL_error(L, "field '%s' expects an integer", name);
+            if (f->kind == F_I64) {
+                long long w = (long long)v;
+                memcpy(bytes, &w, sizeof(w));
+            } else {
+                int w = (int)v;
+                if (v < -2147483647 - 1 || v > 2147483647) luaL_error(L, "field '%s' is out of i32 range", name);
+                memcpy(bytes, &w, sizeof(w));
+            }
+            break;
+        }
+        case F_F64:
+        case F_F32: {
+            lua_Number v = 0;
+            if (lua_type(L, value) == LUA_TNUMBER) v = lua_tonumber(L, value);
+            else if (!isnil) luaL_error(L, "field '%s' expects a number", name);
+            if (f->kind == F_F64) {
+                double w = (double)v;
+                memcpy(bytes, &w, sizeof(w));
+            } else {
+                float w = (float)v;
+                memcpy(bytes, &w, sizeof(w));
+            }
+            break;
+        }
+        case F_BOOL:
+            if (!isnil && !lua_isboolean(L, value)) luaL_error(L, "field '%s' expects a boolean", name);
+            *bytes = (char)lua_toboolean(L, value);
+            break;
+        default:
+            if (!isnil && lua_type(L, value) != LUA_TSTRING) luaL_error(L, "field '%s' expects a string", name);
+            lua_pushvalue(L, value);
+            lua_setiuservalue(L, index, f->uv);
+            break;
+    }
+}
+
+/* Push the name of field `field`, from the metatable at `mt` */
+static void push_field_name(lua_State* L, int mt, int field) {
+    lua_getfield(L, mt, STRUCT_NAMES_FIELD);
+    lua_rawgeti(L, -1, field + 1);
+    lua_remove(L, -2);
+}
+
+/* r.name: upvalues are the StructType and the name -> field table */
+static int l_record_index(lua_State* L) {
+    StructType* type = (StructType*)lua_touserdata(L, lua_upvalueindex(1));
+    push_field(L, 1, &type->fields[check_field(L, 2)]);
+    return 1;
+}
+
+/* r.name = value */
+static int l_record_newindex(lua_State* L) {
+    StructType* type = (StructType*)lua_touserdata(L, lua_upvalueindex(1));
+    int field = check_field(L, 2);
+    store_field(L, 1, &type->fields[field], 3, lua_tostring(L, 2));
+    return 0;
+}
+
+/*
+** The pairs() iterator: fields in schema order, nil ones included. The
+** record is upvalue 3, so the iterator reads no other userdata.
+*/
+static int l_record_next(lua_State* L) {
+    StructType* type = (StructType*)lua_touserdata(L, lua_upvalueindex(1));
+    int record = lua_upvalueindex(3);
+    int field = lua_isnil(L, 2) ? 0 : check_field(L, 2) + 1;
+    if (field >= type->nfields) return 0;
+    lua_getmetatable(L, record);
+    push_field_name(L, lua_gettop(L), field);
+    push_field(L, record, &type->fields[field]);
+    return 2;
+}
+
+static int l_record_pairs(lua_State* L) {
+    lua_pushvalue(L, lua_upvalueindex(1));
+    lua_pushvalue(L, lua_upvalueindex(2));
+    lua_pushvalue(L, 1);
+    lua_pushcclosure(L, l_record_next, 3);
+    lua_pushvalue(L, 1);
+    lua_pushnil(L);
+    return 3;
+}
+
+/*
+** Constructor(init)
+** Creates a record with every field zero, false or nil, then copies the
+** fields of the optional table `init` into it
+**
+** Returns:
+**   the record
+*/
+static int l_record_new(lua_State* L) {
+    int mt = lua_upvalueindex(1);
+    StructType* type = type_of_metatable(L, mt);
+    void* record;
+    lua_settop(L, 1);
+    if (!lua_isnil(L, 1)) luaL_checktype(L, 1, LUA_TTABLE);
+    record = lua_newuserdatauv(L, (size_t)type->size, type->nstrings);
+    memset(record, 0, (size_t)type->size);
+    lua_pushvalue(L, mt);
+    lua_setmetatable(L, 2);
+    if (lua_istable(L, 1)) {
+        lua_getfield(L, mt, "__newindex");
+        lua_pushnil(L);
+        while (lua_next(L, 1)) {
+            /* Stack: init, record, __newindex, key, value */
+            lua_pushvalue(L, 3);
+            lua_pushvalue(L, 2);
+            lua_pushvalue(L, -4);
+            lua_pushvalue(L, -4);
+            lua_call(L, 3, 0);
+            lua_pop(L, 1);
+        }
+        lua_pop(L, 1);
+    }
+    return 1;
+}
+
+/* Order field names for 'define' */
+static int compare_names(const void* a, const void* b) {
+    return strcmp(*(const char* const*)a, *(const char* const*)b);
+}
+
+/*
+** struct.define(schema)
+** Declares a record type from a table of field name -> kind, one of
+** "i64", "f64", "i32", "f32", "bool" or "str"
+**
+** Returns:
+**   the type's constructor
+*/
+static int l_struct_define(lua_State* L) {
+    const char* names[STRUCT_MAX_FIELDS];
+    StructType* type;
+    int n = 0, i, width, offset = 0;
+    luaL_checktype(L, 1, LUA_TTABLE);
+    lua_pushnil(L);
+    while (lua_next(L, 1)) {
+        luaL_argcheck(L, lua_type(L, -2) == LUA_TSTRING, 1, "field names must be strings");
+        luaL_argcheck(L, n < STRUCT_MAX_FIELDS, 1, "too many fields (at most 64)");
+        names[n++] = lua_tostring(L, -2);
+        lua_pop(L, 1);
+    }
+    luaL_argcheck(L, n > 0, 1, "a struct needs at least one field");
+    qsort(names, (size_t)n, sizeof(names[0]), compare_names);
+
+    type = (StructType*)lua_newuserdatauv(L, sizeof(StructType), 0); /* 2 */
+    memset(type, 0, sizeof(StructType));
+    luaL_setmetatable(L, STRUCT_TYPE_METATABLE);
+    type->nfields = n;
+    for (i = 0; i < n; i++) {
+        const char* kind;
+        int k;
+        lua_getfield(L, 1, names[i]);
+        kind = lua_tostring(L, -1);
+        for (k = 0; kind != NULL && kind_names[k] != NULL && strcmp(kind, kind_names[k]) != 0; k++);
+        if (kind == NULL || kind_names[k] == NULL) {
+            luaL_error(L, "field '%s' has no kind (i64, f64, i32, f32, bool or str)", names[i]);
+        }
+        type->fields[i].kind = (unsigned char)k;
+        lua_pop(L, 1);
+        if (type->fields[i].kind == F_STR) type->fields[i].uv = (unsigned char)++type->nstrings;
+    }
+    for (width = 8; width >= 1; width /= 2) {
+        for (i = 0; i < n; i++) {
+            if (kind_widths[type->fields[i].kind] != width) continue;
+            type->fields[i].offset = (unsigned short)offset;
+            offset += width;
+        }
+    }
+    type->size = offset;
+
+    lua_createtable(L, n, 0); /* 3: names */
+    lua_createtable(L, 0, n); /* 4: name -> field */
+    for (i = 0; i < n; i++) {
+        lua_pushstring(L, names[i]);
+        lua_pushvalue(L, -1);
+        lua_rawseti(L, 3, i + 1);
+        lua_pushinteger(L, i);
+        lua_rawset(L, 4);
+    }
+
+    lua_createtable(L, 0, 7); /* 5: the records' metatable */
+    lua_pushvalue(L, 2);
+    lua_setfield(L, 5, STRUCT_TYPE_FIELD);
+    lua_pushvalue(L, 3);
+    lua_setfield(L, 5, STRUCT_NAMES_FIELD);
+    lua_pushliteral(L, "struct");
+    lua_setfield(L, 5, "__name");
+    lua_pushvalue(L, 2);
+    lua_pushvalue(L, 4);
+    lua_pushcclosure(L, l_record_index, 2);
+    lua_setfield(L, 5, "__index");
+    lua_pushvalue(L, 2);
+    lua_pushvalue(L, 4);
+    lua_pushcclosure(L, l_record_newindex, 2);
+    lua_setfield(L, 5, "__newindex");
+    lua_pushvalue(L, 2);
+    lua_pushvalue(L, 4);
+    lua_pushcclosure(L, l_record_pairs, 2);
+    lua_setfield(L, 5, "__pairs");
+    lua_pushboolean(L, 0);
+    lua_setfield(L, 5, "__metatable"); /* scripts cannot swap it */
+
+    lua_pushcclosure(L, l_record_new, 1);
+    return 1;
+}
+
+/*
+** Push a plain table of the non-nil fields of the record at `index`
+*/
+static void push_table(lua_State* L, int index, const StructType* type) {
+    int i;
+    lua_getmetatable(L, index);
+    lua_createtable(L, 0, type->nfields);
+    for (i = 0; i < type->nfields; i++) {
+        push_field_name(L, -2, i);
+        push_field(L, index, &type->fields[i]);
+        lua_rawset(L, -3);
+    }
+    lua_remove(L, -2);
+}
+
+/*
+** struct.totable(record)
+** Returns:
+**   a new table with the record's fields
+*/
+static int l_struct_totable(lua_State* L) {
+    StructType* type = type_of(L, 1);
+    luaL_argexpected(L, type != NULL, 1, "struct");
+    push_table(L, 1, type);
+    return 1;
+}
+
+/*
+** struct.sizeof(record)
+** Returns:
+**   the bytes of packed fields in each record of its type (user values
+**   and the userdata header come on top)
+*/
+static int l_struct_sizeof(lua_State* L) {
+    StructType* type = type_of(L, 1);
+    luaL_argexpected(L, type != NULL, 1, "struct");
+    lua_pushinteger(L, type->size);
+    return 1;
+}
+
+/*
+** For src/struct_record.zig: if the value at `index` is a record, push a
+** plain table of its fields (as struct.totable) and return 1; else return
+** 0 and push nothing
+*/
+int cu_struct_push_row(lua_State* L, int index) {
+    StructType* type = type_of(L, index);
+    if (type == NULL) return 0;
+    push_table(L, lua_absindex(L, index), type);
+    return 1;
+}
+
+static const luaL_Reg struct_functions[] = {
+    {"define", l_struct_define},
+    {"totable", l_struct_totable},
+    {"sizeof", l_struct_sizeof},
+    {NULL, NULL}
+};
+
+/*
+** luaopen_struct
+** Module initialization function - called when the struct library is loaded
+**
+** Returns:
+**   struct module table on Lua stack
+*/
+LUAMOD_API int luaopen_struct(lua_State* L) {
+    luaL_newmetatable(L, STRUCT_TYPE_METATABLE);
+    lua_pop(L, 1);
+    luaL_newlib(L, struct_functions);
+    return 1;
+}
@@ -21,10 +21,18 @@
 ** in its main position (i.e. the 'original' position that its hash gives
 ** to it), then the colliding element is in its own main position.
 ** Hence even when the load factor reaches 100%, performance remains good.
+** A table whose hash part holds only a few short-string keys (a record)
+** can keep them in a shape instead: a key list shared with every table
+** that gained the same keys in the same order, plus a dense array of its
+** own values. The first key of any other kind turns the shape back into
+** a regular hash part. Likewise, an array part holding only integers,
+** or only floats, is kept unboxed, without type tags, until the first
+** value of another kind is stored in it.
 */
 
 #include <math.h>
 #include <limits.h>
+#include <string.h>
 
 #include "lua.h"
 
@@ -68,6 +76,28 @@
 #define MAXHSIZE	luaM_limitN(1u << MAXHBITS, Node)
 
 
+/*
+** Limits for shapes: the most keys a shaped table holds before it gets a
+** regular hash part, and the most shapes extending any one shape (tables
+** whose keys vary that much are dictionaries, not records).
+*/
+#if !defined(LUAI_MAXSHAPEKEYS)
+#define LUAI_MAXSHAPEKEYS	16
+#endif
+
+#if !defined(LUAI_MAXSHAPEKIDS)
+#define LUAI_MAXSHAPEKIDS	32
+#endif
+
+
+/*
+** Smallest array part worth unboxing
+*/
+#if !defined(LUAI_MINUNBOXED)
+#define LUAI_MINUNBOXED		8
+#endif
+
+
 /*
 ** When the original hash value is good, hashing by a power of 2
 ** avoids the cost of '%'.
@@ -291,6 +321,150 @@ static unsigned int setlimittosize (Table *t) {
 
 
 
+/*
+** {=============================================================
+** Unboxed array parts
+** ==============================================================
+*/
+
+#define sizeunboxed(n)  \
+	(offsetof(Unboxed, e) + cast_sizet(n) * sizeof(UnboxedValue))
+
+
+static void setemptyunboxed (Unboxed *u, unsigned int i) {
+  if (u->kind == LUA_VNUMINT)
+    u->e[i].i = LUA_MININTEGER;
+  else
+    u->e[i].n = cast_num(NAN);
+}
+
+
+static void getunboxed (const Unboxed *u, unsigned int i, TValue *o) {
+  UnboxedValue x = u->e[i];
+  if (isemptyunboxed(u, x))
+    setempty(o);
+  else if (u->kind == LUA_VNUMINT) {
+    setivalue(o, x.i);
+  }
+  else {
+    setfltvalue(o, x.n);
+  }
+}
+
+
+/*
+** Entry 'i' (counting from 0) of the array part of 't'. For an unboxed
+** array part, a copy, valid until the next entry is read.
+*/
+static const TValue *arrayentry (Table *t, unsigned int i) {
+  if (l_likely(!isunboxed(t)))
+    return &t->array[i];
+  else
+    return luaH_unboxedentry(unboxed(t), i);
+}
+
+
+static int isemptyentry (const Table *t, unsigned int i) {
+  if (l_likely(!isunboxed(t)))
+    return isempty(&t->array[i]);
+  else {
+    const Unboxed *u = unboxed(t);
+    return isemptyunboxed(u, u->e[i]);
+  }
+}
+
+
+/*
+** Turn the unboxed array part of 't' back into TValues. (If that fails
+** for lack of memory, the table is left as it was.)
+*/
+static void boxarray (lua_State *L, Table *t) {
+  unsigned int asize = luaH_realasize(t);
+  Unboxed *u = unboxed(t);
+  TValue *array = luaM_newvector(L, asize, TValue);
+  unsigned int i;
+  for (i = 0; i < asize; i++)
+    getunboxed(u, i, &array[i]);
+  luaM_freemem(L, u, sizeunboxed(asize));
+  t->array = array;
+  t->flags &= cast_byte(~BITUNBOXED);
+}
+
+
+/*
+** Store 'value' as entry 'i' of the unboxed array part of 't', first
+** boxing the array part if 'value' cannot go there unboxed.
+*/
+static void setunboxed (lua_State *L, Table *t, unsigned int i,
+                                                const TValue *value) {
+  Unboxed *u = unboxed(t);
+  if (ttisnil(value))  /* removing the entry? */
+    setemptyunboxed(u, i);
+  else if (!luaH_setunboxedentry(u, i, value)) {  /* another kind? */
+    boxarray(L, t);
+    setobj2t(L, &t->array[i], value);
+  }
+}
+
+
+/*
+** Unbox the array part of 't' if it is large enough and its entries are
+** all integers or all floats (with at least one of them). Callers do so
+** when they have just filled or resized the array part, as this has to
+** go through all of it. If there is no memory for the unboxed copy, the
+** table stays as it is.
+*/
+void luaH_unboxarray (lua_State *L, Table *t) {
+  unsigned int asize = luaH_realasize(t);
+  lu_byte kind = LUA_VNIL;
+  unsigned int i;
+  Unboxed *u;
+  if (isunboxed(t) || asize < LUAI_MINUNBOXED)
+    return;
+  for (i = 0; i < asize; i++) {
+    const TValue *v = &t->array[i];
+    if (isempty(v))
+      continue;
+    if (kind == LUA_VNIL && ttisnumber(v))
+      kind = ttypetag(v);  /* first entry sets the kind */
+    if (!canunbox(kind, v))
+      return;
+  }
+  if (kind == LUA_VNIL)  /* no entries? */
+    return;
+  u = cast(Unboxed *, luaM_realloc_(L, NULL, 0, sizeunboxed(asize)));
+  if (u == NULL)
+    return;
+  u->kind = kind;
+  setempty(&u->slot);
+  for (i = 0; i < asize; i++) {
+    const TValue *v = &t->array[i];
+    if (isempty(v))
+      setemptyunboxed(u, i);
+    else if (kind == LUA_VNUMINT)
+      u->e[i].i = ivalue(v);
+    else
+      u->e[i].n = fltvalue(v);
+  }
+  luaM_freearray(L, t->array, asize);
+  t->array = cast(TValue *, u);
+  t->flags |= BITUNBOXED;
+}
+
+
+/*
+** Bytes taken by the array part of 't'.
+*/
+size_t luaH_sizearray (const Table *t) {
+  unsigned int asize = luaH_realasize(t);
+  return isunboxed(t) ? sizeunboxed(asize)
+                      : cast_sizet(asize) * sizeof(TValue);
+}
+
+/* }============================================================= */
+
+
+
 /*
 ** "Generic" get version. (Not that generic: not valid for integers,
 ** which may be in array part, nor for floats with integral values.)
@@ -335,6 +509,12 @@ static unsigned int findindex (lua_State *L, Table *t, TValue *key,
   i = ttisinteger(key) ? arrayindex(ivalue(key)) : 0;
   if (i - 1u < asize)  /* is 'key' inside array part? */
     return i;  /* yes; that's the index */
+  else if (t->shape != NULL) {  /* keys are in a shape? */
+    int f = ttisshrstring(key) ? luaH_shapeindex(t->shape, tsvalue(key)) : -1;
+    if (l_unlikely(f < 0))
+      luaG_runerror(L, "invalid key to 'next'");  /* key not found */
+    return cast_uint(f + 1) + asize;  /* fields are numbered like nodes */
+  }
   else {
     const TValue *n = getgeneric(t, key, 1);
     if (l_unlikely(isabstkey(n)))
@@ -350,12 +530,23 @@ int luaH_next (lua_State *L, Table *t, StkId key) {
   unsigned int asize = luaH_realasize(t);
   unsigned int i = findindex(L, t, s2v(key), asize);  /* find original key */
   for (; i < asize; i++) {  /* try first array part */
-    if (!isempty(&t->array[i])) {  /* a non-empty entry? */
+    const TValue *v = arrayentry(t, i);
+    if (!isempty(v)) {  /* a non-empty entry? */
       setivalue(s2v(key), i + 1);
-      setobj2s(L, key + 1, &t->array[i]);
+      setobj2s(L, key + 1, v);
       return 1;
     }
   }
+  if (t->shape != NULL) {  /* shaped hash part */
+    for (i -= asize; cast_int(i) < t->shape->nkeys; i++) {
+      if (!isempty(&t->fields[i])) {
+        setsvalue2s(L, key, t->shape->keys[i]);
+        setobj2s(L, key + 1, &t->fields[i]);
+        return 1;
+      }
+    }
+    return 0;
+  }
   for (i -= asize; cast_int(i) < sizenode(t); i++) {  /* hash part */
     if (!isempty(gval(gnode(t, i)))) {  /* a non-empty entry? */
       Node *n = gnode(t, i);
@@ -443,7 +634,7 @@ static unsigned int numusearray (const Table *t, unsigned int *nums) {
     }
     /* count elements in range (2^(lg - 1), 2^lg] */
     for (; i <= lim; i++) {
-      if (!isempty(&t->array[i-1]))
+      if (!isemptyentry(t, i - 1))
         lc++;
     }
     nums[lg] += lc;
@@ -556,6 +747,10 @@ void luaH_resize (lua_State *L, Table *t, unsigned int newasize,
   Table newt;  /* to keep the new hash part */
   unsigned int oldasize = setlimittosize(t);
   TValue *newarray;
+  /* a shape only survives a growing array: nothing moves to the hash */
+  lua_assert(t->shape == NULL || (nhsize == 0 && newasize >= oldasize));
+  if (isunboxed(t) && newasize < oldasize)
+    boxarray(L, t);  /* the vanishing slice goes through TValues */
   /* create new hash part with appropriate size into 'newt' */
   setnodevector(L, &newt, nhsize);
   if (newasize < oldasize) {  /* will array shrink? */
@@ -570,7 +765,11 @@ void luaH_resize (lua_State *L, Table *t, unsigned int newasize,
     exchangehashpart(t, &newt);  /* and hash (in case of errors) */
   }
   /* allocate new array */
-  newarray = luaM_reallocvector(L, t->array, oldasize, newasize, TValue);
+  if (isunboxed(t))
+    newarray = cast(TValue *, luaM_realloc_(L, t->array,
+                              sizeunboxed(oldasize), sizeunboxed(newasize)));
+  else
+    newarray = luaM_reallocvector(L, t->array, oldasize, newasize, TValue);
   if (l_unlikely(newarray == NULL && newasize > 0)) {  /* allocation failed? */
     freehash(L, &newt);  /* release new hash part */
     luaM_error(L);  /* raise error (with array unchanged) */
@@ -579,11 +778,16 @@ void luaH_resize (lua_State *L, Table *t, unsigned int newasize,
   exchangehashpart(t, &newt);  /* 't' has the new hash ('newt' has the old) */
   t->array = newarray;  /* set new array part */
   t->alimit = newasize;
-  for (i = oldasize; i < newasize; i++)  /* clear new slice of the array */
-     setempty(&t->array[i]);
+  for (i = oldasize; i < newasize; i++) {  /* clear new slice of the array */
+    if (isunboxed(t))
+      setemptyunboxed(unboxed(t), i);
+    else
+      setempty(&t->array[i]);
+  }
   /* re-insert elements from old hash part into new parts */
   reinsert(L, &newt, t);  /* 'newt' now has the old hash */
   freehash(L, &newt);  /* free old hash part */
+  luaH_unboxarray(L, t);
 }
 
 
@@ -623,6 +827,214 @@ static void rehash (lua_State *L, Table *t, const TValue *ek) {
 */
 
 
+/*
+** {=============================================================
+** Shapes
+** ==============================================================
+*/
+
+#define sizeshape(n)	(offsetof(Shape, keys) + cast_sizet(n) * sizeof(TString *))
+
+
+/* number of slots in 'fields' for a shape with 'n' keys */
+static int sizefields (int n) {
+  return (n == 0) ? 0 : twoto(luaO_ceillog2(cast_uint(n)));
+}
+
+
+/*
+** Index of 'key' in shape 's', or -1 if 's' does not have it.
+*/
+int luaH_shapeindex (const Shape *s, const TString *key) {
+  int i;
+  for (i = 0; i < s->nkeys; i++) {
+    if (s->keys[i] == key)
+      return i;
+  }
+  return -1;
+}
+
+
+/*
+** Return the shape with the keys of 's' (NULL for no keys) followed by
+** 'key', creating it if needed, or NULL if 's' already has too many
+** extensions. A new shape starts with no references; if an error leaves
+** it that way, another table can still adopt it, and 'luaH_freeshapes'
+** frees it at the end.
+*/
+static Shape *extendshape (lua_State *L, Shape *s, TString *key) {
+  Shape **list = (s == NULL) ? &G(L)->shapes : &s->child;
+  int n = (s == NULL) ? 0 : s->nkeys;
+  int kids = 0;
+  Shape *c;
+  for (c = *list; c != NULL; c = c->sibling) {
+    if (c->keys[n] == key)
+      return c;
+    if (++kids == LUAI_MAXSHAPEKIDS)
+      return NULL;  /* 'key' makes this table a dictionary */
+  }
+  c = cast(Shape *, luaM_malloc_(L, sizeshape(n + 1), 0));
+  c->parent = s;
+  c->child = NULL;
+  c->refs = 0;
+  c->nkeys = n + 1;
+  if (s != NULL) {
+    memcpy(c->keys, s->keys, cast_sizet(n) * sizeof(TString *));
+    s->refs++;  /* 'c' uses its parent */
+  }
+  c->keys[n] = key;
+  c->sibling = *list;  /* (re)read after allocating; it may have changed */
+  *list = c;
+  return c;
+}
+
+
+/*
+** Drop a reference to shape 's', freeing it and then any ancestors that
+** become unused. Only compares key pointers, never reads the strings, as
+** during a sweep these may already be gone.
+*/
+static void releaseshape (lua_State *L, Shape *s) {
+  while (s != NULL && --s->refs == 0) {
+    Shape *parent = s->parent;
+    Shape **list = (parent == NULL) ? &G(L)->shapes : &parent->child;
+    lua_assert(s->child == NULL);
+    while (*list != s)
+      list = &(*list)->sibling;
+    *list = s->sibling;
+    luaM_freemem(L, s, sizeshape(s->nkeys));
+    s = parent;
+  }
+}
+
+
+/*
+** Try to add a key absent from table 't', which has no regular hash
+** part, through a shape. Returns 0 if the table should rather get a
+** hash part.
+*/
+static int addtoshape (lua_State *L, Table *t, const TValue *key,
+                                               TValue *value) {
+  Shape *old = t->shape;
+  Shape *s;
+  int n = (old == NULL) ? 0 : old->nkeys;
+  lua_assert(isdummy(t) && ttisshrstring(key));
+  if (n == LUAI_MAXSHAPEKEYS)
+    return 0;
+  s = extendshape(L, old, tsvalue(key));
+  if (s == NULL)
+    return 0;
+  if (n == sizefields(n)) {  /* no room for another value? */
+    /* 'fields' keeps its size until 't->shape' changes below */
+    t->fields = luaM_reallocvector(L, t->fields, sizefields(n),
+                                   sizefields(n + 1), TValue);
+  }
+  s->refs++;
+  t->shape = s;
+  releaseshape(L, old);  /* (still alive as the parent of 's') */
+  luaC_barrierback(L, obj2gco(t), key);
+  setobj2t(L, &t->fields[n], value);
+  return 1;
+}
+
+
+/*
+** Move the keys of a shaped table 't' into a regular hash part, with
+** room for one more key.
+*/
+static void unshape (lua_State *L, Table *t) {
+  Shape *s = t->shape;
+  TValue *fields = t->fields;
+  Table newt;  /* to keep the new hash part */
+  int i;
+  lua_assert(isdummy(t));
+  setnodevector(L, &newt, cast_uint(s->nkeys + 1));
+  exchangehashpart(t, &newt);
+  t->shape = NULL;
+  t->fields = NULL;
+  for (i = 0; i < s->nkeys; i++) {
+    if (!isempty(&fields[i])) {
+      /* doesn't need barrier/invalidate cache, as entry was
+         already present in the table */
+      TValue k;
+      setsvalue(L, &k, s->keys[i]);
+      luaH_set(L, t, &k, &fields[i]);
+    }
+  }
+  luaM_freearray(L, fields, cast_sizet(sizefields(s->nkeys)));
+  releaseshape(L, s);
+}
+
+
+/*
+** Free the shapes left when all tables are gone: those an allocation
+** error kept from ever being used.
+*/
+void luaH_freeshapes (lua_State *L) {
+  Shape **list = &G(L)->shapes;
+  while (*list != NULL) {
+    Shape *s = *list;
+    if (s->child != NULL)
+      list = &s->child;  /* free its extensions first */
+    else {
+      Shape *parent = s->parent;
+      *list = s->sibling;
+      luaM_freemem(L, s, sizeshape(s->nkeys));
+      list = (parent == NULL) ? &G(L)->shapes : &parent->child;
+    }
+  }
+}
+
+
+/*
+** Size a new table, as for 'luaH_resize', from a constructor or
+** 'lua_createtable'. A hash part small enough for a shape is not
+** allocated: a record will get its keys through one.
+*/
+void luaH_presize (lua_State *L, Table *t, unsigned int nasize,
+                                           unsigned int nhsize) {
+  if (nhsize <= LUAI_MAXSHAPEKEYS)
+    nhsize = 0;
+  if (nasize > 0 || nhsize > 0)
+    luaH_resize(L, t, nasize, nhsize);
+}
+
+
+/*
+** Remove every entry of 't', keeping the sizes of its array and hash
+** parts so that refilling it does not rehash. A shape (a few keys at
+** most) is dropped rather than kept with empty values.
+*/
+void luaH_clear (lua_State *L, Table *t) {
+  unsigned int i;
+  unsigned int asize = luaH_realasize(t);
+  for (i = 0; i < asize; i++) {
+    if (isunboxed(t))
+      setemptyunboxed(unboxed(t), i);
+    else
+      setempty(&t->array[i]);
+  }
+  if (t->shape != NULL) {
+    luaM_freearray(L, t->fields, cast_sizet(sizefields(t->shape->nkeys)));
+    releaseshape(L, t->shape);
+    t->shape = NULL;
+    t->fields = NULL;
+  }
+  else if (!isdummy(t)) {
+    unsigned int size = sizenode(t);
+    for (i = 0; i < size; i++) {  /* as 'setnodevector' leaves them */
+      Node *n = gnode(t, i);
+      gnext(n) = 0;
+      setnilkey(n);
+      setempty(gval(n));
+    }
+    t->lastfree = gnode(t, size);  /* all positions are free */
+  }
+}
+
+/* }============================================================= */
+
+
 Table *luaH_new (lua_State *L) {
   GCObject *o = luaC_newobj(L, LUA_VTABLE, sizeof(Table));
   Table *t = gco2t(o);
@@ -630,14 +1042,20 @@ Table *luaH_new (lua_State *L) {
   t->flags = cast_byte(maskflags);  /* table has no metamethod fields */
   t->array = NULL;
   t->alimit = 0;
+  t->shape = NULL;
+  t->fields = NULL;
   setnodevector(L, t, 0);
   return t;
 }
 
 
 void luaH_free (lua_State *L, Table *t) {
+  if (t->shape != NULL) {
+    luaM_freearray(L, t->fields, cast_sizet(sizefields(t->shape->nkeys)));
+    releaseshape(L, t->shape);
+  }
   freehash(L, t);
-  luaM_freearray(L, t->array, luaH_realasize(t));
+  luaM_freemem(L, t->array, luaH_sizearray(t));
   luaM_free(L, t);
 }
 
@@ -680,6 +1098,12 @@ static void luaH_newkey (lua_State *L, Table *t, const TValue *key,
   }
   if (ttisnil(value))
     return;  /* do not insert nil values */
+  if (isdummy(t)) {  /* no regular hash part? */
+    if (ttisshrstring(key) && addtoshape(L, t, key, value))
+      return;  /* key went into the table's shape */
+    if (t->shape != NULL)
+      unshape(L, t);  /* make room for 'key' in a regular hash part */
+  }
   mp = mainpositionTV(t, key);
   if (!isempty(gval(mp)) || isdummy(t)) {  /* main position is taken? */
     Node *othern;
@@ -745,11 +1169,11 @@ static void luaH_newkey (lua_State *L, Table *t, const TValue *key,
 const TValue *luaH_getint (Table *t, lua_Integer key) {
   lua_Unsigned alimit = t->alimit;
   if (l_castS2U(key) - 1u < alimit)  /* 'key' in [1, t->alimit]? */
-    return &t->array[key - 1];
+    return arrayentry(t, cast_uint(key - 1));
   else if (!isrealasize(t) &&  /* key still may be in the array part? */
            (((l_castS2U(key) - 1u) & ~(alimit - 1u)) < alimit)) {
     t->alimit = cast_uint(key);  /* probably '#t' is here now */
-    return &t->array[key - 1];
+    return arrayentry(t, cast_uint(key - 1));
   }
   else {  /* key is not in the array part; check the hash */
     Node *n = hashint(t, key);
@@ -771,8 +1195,13 @@ const TValue *luaH_getint (Table *t, lua_Integer key) {
 ** search function for short strings
 */
 const TValue *luaH_getshortstr (Table *t, TString *key) {
-  Node *n = hashstr(t, key);
+  Node *n;
   lua_assert(key->tt == LUA_VSHRSTR);
+  if (t->shape != NULL) {  /* record? */
+    int i = luaH_shapeindex(t->shape, key);
+    return (i < 0) ? &absentkey : &t->fields[i];
+  }
+  n = hashstr(t, key);
   for (;;) {  /* check whether 'key' is somewhere in the chain */
     if (keyisshrstr(n) && eqshrstr(keystrval(n), key))
       return gval(n);  /* that's it */
@@ -827,6 +1256,14 @@ void luaH_finishset (lua_State *L, Table *t, const TValue *key,
                                    const TValue *slot, TValue *value) {
   if (isabstkey(slot))
     luaH_newkey(L, t, key, value);
+  else if (isunboxedslot(t, slot)) {  /* 'key' is an integral number */
+    lua_Integer k;
+    if (ttisinteger(key))
+      k = ivalue(key);
+    else
+      luaV_flttointeger(fltvalue(key), &k, F2Ieq);
+    setunboxed(L, t, cast_uint(k - 1), value);
+  }
   else
     setobj2t(L, cast(TValue *, slot), value);
 }
@@ -849,6 +1286,8 @@ void luaH_setint (lua_State *L, Table *t, lua_Integer key, TValue *value) {
     setivalue(&k, key);
     luaH_newkey(L, t, &k, value);
   }
+  else if (isunboxedslot(t, p))
+    setunboxed(L, t, cast_uint(key - 1), value);
   else
     setobj2t(L, cast(TValue *, p), value);
 }
@@ -892,11 +1331,11 @@ static lua_Unsigned hash_search (Table *t, lua_Unsigned j) {
 }
 
 
-static unsigned int binsearch (const TValue *array, unsigned int i,
-                                                    unsigned int j) {
+static unsigned int binsearch (const Table *t, unsigned int i,
+                                                unsigned int j) {
   while (j - i > 1u) {  /* binary search */
     unsigned int m = (i + j) / 2;
-    if (isempty(&array[m - 1])) j = m;
+    if (isemptyentry(t, m - 1)) j = m;
     else i = m;
   }
   return i;
@@ -937,9 +1376,9 @@ static unsigned int binsearch (const TValue *array, unsigned int i,
 */
 lua_Unsigned luaH_getn (Table *t) {
   unsigned int limit = t->alimit;
-  if (limit > 0 && isempty(&t->array[limit - 1])) {  /* (1)? */
+  if (limit > 0 && isemptyentry(t, limit - 1)) {  /* (1)? */
     /* there must be a boundary before 'limit' */
-    if (limit >= 2 && !isempty(&t->array[limit - 2])) {
+    if (limit >= 2 && !isemptyentry(t, limit - 2)) {
       /* 'limit - 1' is a boundary; can it be a new limit? */
       if (ispow2realasize(t) && !ispow2(limit - 1)) {
         t->alimit = limit - 1;
@@ -948,7 +1387,7 @@ lua_Unsigned luaH_getn (Table *t) {
       return limit - 1;
     }
     else {  /* must search for a boundary in [0, limit] */
-      unsigned int boundary = binsearch(t->array, 0, limit);
+      unsigned int boundary = binsearch(t, 0, limit);
       /* can this boundary represent the real size of the array? */
       if (ispow2realasize(t) && boundary > luaH_realasize(t) / 2) {
         t->alimit = boundary;  /* use it as the new limit */
@@ -960,14 +1399,14 @@ lua_Unsigned luaH_getn (Table *t) {
   /* 'limit' is zero or present in table */
   if (!limitequalsasize(t)) {  /* (2)? */
     /* 'limit' > 0 and array has more elements after 'limit' */
-    if (isempty(&t->array[limit]))  /* 'limit + 1' is empty? */
+    if (isemptyentry(t, limit))  /* 'limit + 1' is empty? */
       return limit;  /* this is the boundary */
     /* else, try last element in the array */
     limit = luaH_realasize(t);
-    if (isempty(&t->array[limit - 1])) {  /* empty? */
+    if (isemptyentry(t, limit - 1)) {  /* empty? */
       /* there must be a boundary in the array after old limit,
          and it must be a valid new limit */
-      unsigned int boundary = binsearch(t->array, t->alimit, limit);
+      unsigned int boundary = binsearch(t, t->alimit, limit);
       t->alimit = boundary;
       return boundary;
     }
@@ -975,7 +1414,7 @@ lua_Unsigned luaH_getn (Table *t) {
   }
   /* (3) 'limit' is the last element and either is zero or present in table */
   lua_assert(limit == luaH_realasize(t) &&
-             (limit == 0 || !isempty(&t->array[limit - 1])));
+             (limit == 0 || !isemptyentry(t, limit - 1)));
   if (isdummy(t) || isempty(luaH_getint(t, cast(lua_Integer, limit + 1))))
     return limit;  /* 'limit + 1' is absent */
   else  /* 'limit + 1' is also present */
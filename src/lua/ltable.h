@@ -31,6 +31,57 @@
 #define allocsizenode(t)	(isdummy(t) ? 0 : sizenode(t))
 
 
+/*
+** An unboxed array part (what 'array' points to while 'isunboxed(t)')
+** keeps each entry in the width of a number, with its kind (LUA_VNUMINT
+** or LUA_VNUMFLT) once for all of them. An empty entry holds a value
+** that is never stored unboxed: LUA_MININTEGER, or a NaN. Reading an
+** entry copies it into 'slot', which comes first so that 'array' points
+** to it. Writing to that slot does not reach the table: sets store
+** into 'e' (see 'luaV_fastseti'), or leave it to 'luaV_finishset'.
+** (See ltable.c.)
+*/
+typedef union UnboxedValue {
+  lua_Integer i;
+  lua_Number n;
+} UnboxedValue;
+
+typedef struct Unboxed {
+  TValue slot;  /* copy of the last entry read */
+  lu_byte kind;  /* kind of all entries */
+  UnboxedValue e[1];  /* entries */
+} Unboxed;
+
+
+#define isunboxed(t)		((t)->flags & BITUNBOXED)
+#define unboxed(t)	check_exp(isunboxed(t), cast(Unboxed *, (t)->array))
+#define isunboxedslot(t,s)	(isunboxed(t) && (s) == (t)->array)
+
+#define isemptyunboxed(u,x)  \
+	((u)->kind == LUA_VNUMINT ? (x).i == LUA_MININTEGER \
+	                          : luai_numisnan((x).n))
+
+/* copy entry 'k' of unboxed array part 'u' into its slot */
+#define luaH_unboxedentry(u,k)  \
+	(isemptyunboxed(u, (u)->e[k]) ? setempty(&(u)->slot) \
+	 : (u)->kind == LUA_VNUMINT \
+	 ? (val_(&(u)->slot).i = (u)->e[k].i, settt_(&(u)->slot, LUA_VNUMINT)) \
+	 : (val_(&(u)->slot).n = (u)->e[k].n, settt_(&(u)->slot, LUA_VNUMFLT)), \
+	 cast(const TValue *, &(u)->slot))
+
+/* store 'v' as entry 'k' of unboxed array part 'u', if it can go there */
+#define luaH_setunboxedentry(u,k,v)  \
+	(canunbox((u)->kind, v) && \
+	 ((u)->kind == LUA_VNUMINT ? cast_void((u)->e[k].i = ivalue(v)) \
+	                           : cast_void((u)->e[k].n = fltvalue(v)), 1))
+
+/* whether 'o' can be stored unboxed among entries of the given kind */
+#define canunbox(kind,o)  \
+	(ttypetag(o) == (kind) && \
+	 (ttisinteger(o) ? ivalue(o) != LUA_MININTEGER \
+	                 : !luai_numisnan(fltvalue(o))))
+
+
 /* returns the Node, given the value of a table entry */
 #define nodefromval(v)	cast(Node *, (v))
 
@@ -48,11 +99,18 @@ LUAI_FUNC void luaH_finishset (lua_State *L, Table *t, const TValue *key,
 LUAI_FUNC Table *luaH_new (lua_State *L);
 LUAI_FUNC void luaH_resize (lua_State *L, Table *t, unsigned int nasize,
                                                     unsigned int nhsize);
+LUAI_FUNC void luaH_presize (lua_State *L, Table *t, unsigned int nasize,
+                                                     unsigned int nhsize);
 LUAI_FUNC void luaH_resizearray (lua_State *L, Table *t, unsigned int nasize);
+LUAI_FUNC void luaH_clear (lua_State *L, Table *t);
+LUAI_FUNC void luaH_unboxarray (lua_State *L, Table *t);
+LUAI_FUNC size_t luaH_sizearray (const Table *t);
 LUAI_FUNC void luaH_free (lua_State *L, Table *t);
 LUAI_FUNC int luaH_next (lua_State *L, Table *t, StkId key);
 LUAI_FUNC lua_Unsigned luaH_getn (Table *t);
 LUAI_FUNC unsigned int luaH_realasize (const Table *t);
+LUAI_FUNC int luaH_shapeindex (const Shape *s, const TString *key);
+LUAI_FUNC void luaH_freeshapes (lua_State *L);
 
 
 #if defined(LUA_DEBUG)
@@ -12,6 +12,7 @@
 
 #include <limits.h>
 #include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "lua.h"
@@ -172,6 +173,31 @@ static int tconcat (lua_State *L) {
 }
 
 
+/*
+** table.new(narr [, nrec]): an empty table with room for 'narr' array
+** elements and 'nrec' other fields, so filling it does not rehash
+*/
+static int tnew (lua_State *L) {
+  lua_Integer narr = luaL_checkinteger(L, 1);
+  lua_Integer nrec = luaL_optinteger(L, 2, 0);
+  luaL_argcheck(L, 0 <= narr && narr <= INT_MAX, 1, "out of range");
+  luaL_argcheck(L, 0 <= nrec && nrec <= INT_MAX, 2, "out of range");
+  lua_createtable(L, (int)narr, (int)nrec);
+  return 1;
+}
+
+
+/*
+** table.clear(t): remove every entry of 't' but keep its size, so a
+** table reused across iterations is refilled without rehashing
+*/
+static int tclear (lua_State *L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  lua_cleartable(L, 1);
+  return 0;
+}
+
+
 /*
 ** {======================================================
 ** Pack/unpack
@@ -396,6 +422,142 @@ static void auxsort (lua_State *L, IdxT lo, IdxT up,
 }
 
 
+/*
+** Fast path: a plain table (no metatable) holding only integers, only
+** floats or only strings, sorted without an order function, is copied
+** to a C array and sorted with 'qsort'. That orders the values as '<'
+** does, without a 'lua_compare' call per comparison. Any other array
+** (mixed types, NaNs, metamethods) takes the generic path.
+*/
+
+typedef union SortNum {
+  lua_Integer i;
+  lua_Number f;
+} SortNum;
+
+typedef struct SortStr {
+  const char *s;
+  size_t len;
+  lua_Integer from;  /* original index; 0 once moved into place */
+} SortStr;
+
+
+static int cmpint (const void *a, const void *b) {
+  lua_Integer x = ((const SortNum *)a)->i, y = ((const SortNum *)b)->i;
+  return (x > y) - (x < y);
+}
+
+
+static int cmpflt (const void *a, const void *b) {
+  lua_Number x = ((const SortNum *)a)->f, y = ((const SortNum *)b)->f;
+  return (x > y) - (x < y);
+}
+
+
+/* same order as 'l_strcmp' with a byte-wise 'strcoll' */
+static int cmpstr (const void *a, const void *b) {
+  const SortStr *x = (const SortStr *)a, *y = (const SortStr *)b;
+  int res = memcmp(x->s, y->s, (x->len < y->len) ? x->len : y->len);
+  if (res != 0)
+    return res;
+  return (x->len > y->len) - (x->len < y->len);
+}
+
+
+static int sortnumbers (lua_State *L, lua_Integer n) {
+  SortNum *a = (SortNum *)lua_newuserdatauv(L, (size_t)n * sizeof(SortNum), 0);
+  int isint = lua_isinteger(L, -2);  /* kind of a[1] */
+  lua_Integer i;
+  for (i = 0; i < n; i++) {
+    int ok = (lua_rawgeti(L, 1, i + 1) == LUA_TNUMBER &&
+              lua_isinteger(L, -1) == isint);
+    if (ok) {
+      if (isint)
+        a[i].i = lua_tointeger(L, -1);
+      else {
+        a[i].f = lua_tonumber(L, -1);
+        ok = (a[i].f == a[i].f);  /* not a NaN? */
+      }
+    }
+    lua_pop(L, 1);
+    if (!ok) {
+      lua_pop(L, 1);  /* remove buffer */
+      return 0;
+    }
+  }
+  qsort(a, (size_t)n, sizeof(SortNum), isint ? cmpint : cmpflt);
+  for (i = 0; i < n; i++) {
+    if (isint)
+      lua_pushinteger(L, a[i].i);
+    else
+      lua_pushnumber(L, a[i].f);
+    lua_rawseti(L, 1, i + 1);
+  }
+  lua_pop(L, 1);  /* remove buffer */
+  return 1;
+}
+
+
+static int sortstrings (lua_State *L, lua_Integer n) {
+  SortStr *a = (SortStr *)lua_newuserdatauv(L, (size_t)n * sizeof(SortStr), 0);
+  lua_Integer i;
+  for (i = 0; i < n; i++) {
+    if (lua_rawgeti(L, 1, i + 1) != LUA_TSTRING) {
+      lua_pop(L, 2);  /* remove value and buffer */
+      return 0;
+    }
+    /* the table keeps the string alive until the sort is done */
+    a[i].s = lua_tolstring(L, -1, &a[i].len);
+    a[i].from = i + 1;
+    lua_pop(L, 1);
+  }
+  qsort(a, (size_t)n, sizeof(SortStr), cmpstr);
+  /* position k gets the value from a[k].from, one permutation cycle at a
+     time; only the value displaced from the cycle's start needs a slot */
+  for (i = 0; i < n; i++) {
+    lua_Integer j = i;
+    lua_Integer from;
+    if (a[i].from == 0)  /* already in place? */
+      continue;
+    lua_rawgeti(L, 1, i + 1);
+    while ((from = a[j].from) != i + 1) {
+      lua_rawgeti(L, 1, from);
+      lua_rawseti(L, 1, j + 1);
+      a[j].from = 0;
+      j = from - 1;
+    }
+    lua_rawseti(L, 1, j + 1);
+    a[j].from = 0;
+  }
+  lua_pop(L, 1);  /* remove buffer */
+  return 1;
+}
+
+
+/*
+** Try the fast path; returns 0 (with the array untouched) if it does
+** not apply
+*/
+static int sortfast (lua_State *L, lua_Integer n) {
+  int res = 0;
+  if (!lua_isnil(L, 2) || lua_type(L, 1) != LUA_TTABLE)
+    return 0;
+  if (lua_getmetatable(L, 1)) {
+    lua_pop(L, 1);
+    return 0;
+  }
+  if ((size_t)n > (~(size_t)0) / sizeof(SortStr))  /* buffer size overflow? */
+    return 0;
+  switch (lua_rawgeti(L, 1, 1)) {
+    case LUA_TNUMBER: res = sortnumbers(L, n); break;
+    case LUA_TSTRING: res = sortstrings(L, n); break;
+    default: break;
+  }
+  lua_pop(L, 1);  /* remove a[1] */
+  return res;
+}
+
+
 static int sort (lua_State *L) {
   lua_Integer n = aux_getn(L, 1, TAB_RW);
   if (n > 1) {  /* non-trivial interval? */
@@ -403,7 +565,8 @@ static int sort (lua_State *L) {
     if (!lua_isnoneornil(L, 2))  /* is there a 2nd argument? */
       luaL_checktype(L, 2, LUA_TFUNCTION);  /* must be a function */
     lua_settop(L, 2);  /* make sure there are two arguments */
-    auxsort(L, 1, (IdxT)n, 0);
+    if (!sortfast(L, n))
+      auxsort(L, 1, (IdxT)n, 0);
   }
   return 0;
 }
@@ -412,8 +575,10 @@ static int sort (lua_State *L) {
 
 
 static const luaL_Reg tab_funcs[] = {
+  {"clear", tclear},
   {"concat", tconcat},
   {"insert", tinsert},
+  {"new", tnew},
   {"pack", tpack},
   {"unpack", tunpack},
   {"remove", tremove},
@@ -0,0 +1,186 @@
+/*
+** ltier.c
+** Second execution tier: hot functions compiled by the host
+** See Copyright Notice in lua.h
+*/
+
+#define ltier_c
+#define LUA_CORE
+
+#include "lprefix.h"
+
+
+#include <stddef.h>
+
+#include "lua.h"
+
+#include "lobject.h"
+#include "lstate.h"
+#include "ltier.h"
+
+
+/*
+** A function called cu_tier_threshold times is offered to the host
+** (js_tier_compile), along with the arguments of that call. The host may
+** translate its bytecode into a wasm function specialized for those
+** argument types (web/cu-tier.js) and put it in one of the slots below:
+** entries of the function table the host overwrites. luaD_precall then
+** calls the slot instead of entering the interpreter.
+**
+** Compiled code changes nothing but its result, so it can give up at any
+** point and have the interpreter run the whole call instead. It does so
+** when an argument has another type than it was compiled for, when an
+** error is due (division by zero, a zero 'for' step) and when the
+** interrupt word is set. A function whose code gives up LUAI_TIERBAILS
+** times in a row goes back to the interpreter for good. Each slot's code
+** checks that it was called for its own prototype and stamp, so a
+** prototype restored from a snapshot of another instance, whose slot
+** holds other code or none, gets CU_TIER_EMPTY and starts counting again.
+**
+** Built with CU_TIER=1 (LUAI_TIER); without it the hooks below only
+** report that the tier is missing.
+*/
+
+#if defined(LUAI_TIER)
+
+#if !defined(LUAI_TIERBAILS)
+#define LUAI_TIERBAILS	16
+#endif
+
+/* what a slot returns when it holds no code for the prototype */
+#define CU_TIER_EMPTY	(-2)
+
+#if defined(__wasm__)
+__attribute__((import_module("env"), import_name("js_tier_compile")))
+#endif
+extern int js_tier_compile (Proto *p, StkId func, int narg);
+
+#if defined(__wasm__)
+__attribute__((import_module("env"), import_name("js_tier_release")))
+#endif
+extern void js_tier_release (Proto *p, int slot);
+
+
+typedef int (*TierFunction) (Proto *p, StkId func, int narg);
+
+/* The slots start out as distinct functions, each its own table entry */
+#define TIERSTUB(n)  \
+  static int tierstub##n (Proto *p, StkId func, int narg) {  \
+    UNUSED(p); UNUSED(func); UNUSED(narg);  \
+    return CU_TIER_EMPTY - (n);  \
+  }
+#define TIERSTUBS8(n)	TIERSTUB(n##0) TIERSTUB(n##1) TIERSTUB(n##2)  \
+	TIERSTUB(n##3) TIERSTUB(n##4) TIERSTUB(n##5) TIERSTUB(n##6) TIERSTUB(n##7)
+#define TIERREFS8(n)	tierstub##n##0, tierstub##n##1, tierstub##n##2,  \
+	tierstub##n##3, tierstub##n##4, tierstub##n##5, tierstub##n##6,  \
+	tierstub##n##7
+
+TIERSTUBS8(0) TIERSTUBS8(1) TIERSTUBS8(2) TIERSTUBS8(3)
+TIERSTUBS8(4) TIERSTUBS8(5) TIERSTUBS8(6) TIERSTUBS8(7)
+
+#define NSLOTS	64
+
+/* volatile: the host replaces what these entries point to */
+static TierFunction volatile slots[NSLOTS] = {
+  TIERREFS8(0), TIERREFS8(1), TIERREFS8(2), TIERREFS8(3),
+  TIERREFS8(4), TIERREFS8(5), TIERREFS8(6), TIERREFS8(7)
+};
+
+
+int cu_tier_threshold = 0;
+
+
+/*
+** Run a call to 'p' (arguments from 'func' + 1) through its compiled
+** code, compiling it first once it is hot. Returns how many results the
+** code left at 'func' (0 or 1), or -1 to have the interpreter run it.
+*/
+int cu_tier_call (lua_State *L, Proto *p, StkId func, int narg) {
+  int n;
+  UNUSED(L);
+  if (p->tierslot == 0) {
+    if (p->tiercount < 0 || ++p->tiercount < cu_tier_threshold)
+      return -1;
+    p->tierslot = js_tier_compile(p, func, narg);
+    if (p->tierslot <= 0 || p->tierslot > NSLOTS) {  /* not compiled? */
+      p->tierslot = 0;
+      p->tiercount = -1;  /* keep it interpreted */
+      return -1;
+    }
+    p->tiercount = 0;  /* now counts guard failures */
+  }
+  n = slots[p->tierslot - 1](p, func, narg);
+  if (l_likely(n >= 0)) {
+    p->tiercount = 0;
+    return n;
+  }
+  if (n <= CU_TIER_EMPTY) {  /* slot holds no code for 'p' */
+    p->tierslot = 0;
+    p->tiercount = 0;
+  }
+  else if (++p->tiercount >= LUAI_TIERBAILS) {  /* keeps failing? */
+    cu_tier_release(p);
+    p->tiercount = -1;
+  }
+  return -1;
+}
+
+
+/* Give back the slot of 'p', which is being freed or dropped */
+void cu_tier_release (Proto *p) {
+  js_tier_release(p, p->tierslot);
+  p->tierslot = 0;
+}
+
+
+/* Set how many calls make a function hot; 0 turns compiling off */
+int cu_tier_configure (int threshold) {
+  cu_tier_threshold = (threshold > 0) ? threshold : 0;
+  return 0;
+}
+
+
+/*
+** Write where the host finds what it compiles from (CU_TIER_* fields)
+** followed by the function table index of each slot. Returns the number
+** of ints written, or -1 if 'max' is too small.
+*/
+int cu_tier_layout (int *out, int max) {
+  int i;
+  if (max < CU_TIER_FIELDS + NSLOTS)
+    return -1;
+  out[CU_TIER_SLOTS] = NSLOTS;
+  out[CU_TIER_NUMPARAMS] = cast_int(offsetof(Proto, numparams));
+  out[CU_TIER_ISVARARG] = cast_int(offsetof(Proto, is_vararg));
+  out[CU_TIER_MAXSTACK] = cast_int(offsetof(Proto, maxstacksize));
+  out[CU_TIER_SIZEK] = cast_int(offsetof(Proto, sizek));
+  out[CU_TIER_SIZECODE] = cast_int(offsetof(Proto, sizecode));
+  out[CU_TIER_K] = cast_int(offsetof(Proto, k));
+  out[CU_TIER_CODE] = cast_int(offsetof(Proto, code));
+  out[CU_TIER_STAMP] = cast_int(offsetof(Proto, tierstamp));
+  out[CU_TIER_STACKVALUE] = cast_int(sizeof(StackValue));
+  out[CU_TIER_TVALUE] = cast_int(sizeof(TValue));
+  out[CU_TIER_TT] = cast_int(offsetof(TValue, tt_));
+  out[CU_TIER_INTEGER] = cast_int(sizeof(lua_Integer));
+  out[CU_TIER_NUMBER] = cast_int(sizeof(lua_Number));
+  out[CU_TIER_VNUMINT] = LUA_VNUMINT;
+  out[CU_TIER_VNUMFLT] = LUA_VNUMFLT;
+  for (i = 0; i < NSLOTS; i++)
+    out[CU_TIER_FIELDS + i] = cast_int(cast_sizet(slots[i]));
+  return CU_TIER_FIELDS + NSLOTS;
+}
+
+#else
+
+int cu_tier_configure (int threshold) {
+  UNUSED(threshold);
+  return -1;
+}
+
+
+int cu_tier_layout (int *out, int max) {
+  UNUSED(out); UNUSED(max);
+  return -1;
+}
+
+#endif
@@ -0,0 +1,45 @@
+/*
+** ltier.h
+** Second execution tier: hot functions compiled by the host
+** See Copyright Notice in lua.h
+*/
+
+#ifndef ltier_h
+#define ltier_h
+
+#include "lobject.h"
+#include "lstate.h"
+
+
+/* Fields of the layout cu_tier_layout writes, before the slots' indices
+** in the function table */
+#define CU_TIER_SLOTS		0
+#define CU_TIER_NUMPARAMS	1
+#define CU_TIER_ISVARARG	2
+#define CU_TIER_MAXSTACK	3
+#define CU_TIER_SIZEK		4
+#define CU_TIER_SIZECODE	5
+#define CU_TIER_K		6
+#define CU_TIER_CODE		7
+#define CU_TIER_STAMP		8
+#define CU_TIER_STACKVALUE	9
+#define CU_TIER_TVALUE		10
+#define CU_TIER_TT		11
+#define CU_TIER_INTEGER		12
+#define CU_TIER_NUMBER		13
+#define CU_TIER_VNUMINT		14
+#define CU_TIER_VNUMFLT		15
+#define CU_TIER_FIELDS		16
+
+int cu_tier_configure (int threshold);
+int cu_tier_layout (int *out, int max);
+
+#if defined(LUAI_TIER)
+/* Calls to a function before it is offered to the host; 0 while off */
+LUAI_DDEC(int cu_tier_threshold;)
+
+LUAI_FUNC int cu_tier_call (lua_State *L, Proto *p, StkId func, int narg);
+LUAI_FUNC void cu_tier_release (Proto *p);
+#endif
+
+#endif
@@ -121,8 +121,11 @@
 
 /*
 @@ LUA_32BITS enables Lua with 32-bit integers and 32-bit floats.
+** Cu's build.sh sets it for CU_LUA_32BITS=1, which halves TValue on wasm32.
 */
+#if !defined(LUA_32BITS)
 #define LUA_32BITS	0
+#endif
 
 
 /*
@@ -417,8 +420,17 @@
 
 #define l_floor(x)		(l_mathop(floor)(x))
 
+#if defined(__wasm__) && LUA_FLOAT_TYPE == LUA_FLOAT_DOUBLE
+/*
+** Cu's libc stubs print the shortest digits that read back as the same
+** double (cu_number2str in libc-stubs.zig), so tostring round-trips
+*/
+int cu_number2str (char *s, size_t sz, double n);
+#define lua_number2str(s,sz,n)	cu_number2str((s), (sz), (double)(n))
+#else
 #define lua_number2str(s,sz,n)  \
 	l_sprintf((s), sz, LUA_NUMBER_FMT, (LUAI_UACNUMBER)(n))
+#endif
 
 /*
 @@ lua_numbertointeger converts a float number with an integral value
@@ -781,6 +793,21 @@
 */
 #define LUAI_MAXALIGN  lua_Number n; double u; void *s; lua_Integer i; long l
 
+
+/*
+@@ LUAI_THREADPOOL is how many collected threads (coroutines) a state
+** keeps for lua_newthread to reuse, and LUAI_THREADPOOLSTACK the largest
+** stack, in slots, a pooled thread keeps. A LUAI_THREADPOOL of 0 turns
+** the pool off.
+*/
+#if !defined(LUAI_THREADPOOL)
+#define LUAI_THREADPOOL		256
+#endif
+
+#if !defined(LUAI_THREADPOOLSTACK)
+#define LUAI_THREADPOOLSTACK	(4*LUA_MINSTACK)
+#endif
+
 /* }================================================================== */
 
 
@@ -794,6 +821,70 @@
 ** without modifying the main part of the file.
 */
 
+#if defined(__wasm__)
+/*
+** Cu times every collector pause for get_gc_stats (gc_stats.zig)
+*/
+void cu_gc_pause_begin (void);
+void cu_gc_pause_end (int kind);
+#define luai_gcpausebegin(L)	((void)L, cu_gc_pause_begin())
+#define luai_gcpauseend(L,kind)	((void)L, cu_gc_pause_end(kind))
+
+/*
+** The string hash seed comes from deterministic.zig, fixed in
+** deterministic mode so pairs() order repeats across runs
+*/
+unsigned int cu_makeseed (void *L);
+#define luai_makeseed(L)	cu_makeseed(L)
+
+/*
+** utf8.len skips well-formed text a block at a time (libc-stubs.zig,
+** with simd128 in the CU_SIMD=1 build)
+*/
+size_t cu_utf8_span (const char *s, size_t len, size_t *nchars);
+#define luai_utf8span(s,len,nchars)	cu_utf8_span(s,len,nchars)
+
+/*
+** string.format writes float conversions itself, around the digits from
+** float_conv.zig (cu_format_float in libc-stubs.zig): 'n' is not
+** negative and 'prec' is -1 for none
+*/
+int cu_format_float (char *s, size_t sz, double n, int conv, int prec,
+                     int alt);
+#define luai_formatfloat(s,sz,n,conv,prec,alt)  \
+	cu_format_float((s), (sz), (double)(n), (conv), (prec), (alt))
+
+/*
+** The host stops a running call by setting the interrupt word (budget.zig),
+** which lvm.c reads on loop back-edges and calls
+*/
+extern volatile int cu_interrupt_flag;
+void cu_interrupt_raise (void *L);
+#define luai_interruptpending()	(cu_interrupt_flag != 0)
+#define luai_interrupt(L)	cu_interrupt_raise(L)
+#endif
+
+#if defined(__wasm__) && defined(LUAI_ALLOCPROFILE)
+/*
+** CU_ALLOC_PROFILE=1 builds tally allocations by type for
+** get_alloc_profile (lcensus.c)
+*/
+void cu_alloc_note (int tag, size_t size);
+void cu_alloc_resize (size_t osize, size_t nsize);
+void cu_alloc_free (size_t osize);
+void cu_alloc_freeobj (void *o);
+#define luai_allocnote(L,tag,size)	((void)L, cu_alloc_note(tag, size))
+#define luai_reallocnote(L,osize,nsize)	((void)L, cu_alloc_resize(osize, nsize))
+#define luai_freenote(L,osize)	((void)L, cu_alloc_free(osize))
+#define luai_freeobject(L,o)	((void)L, cu_alloc_freeobj(o))
+#endif
+
+/*
+** Cu runs binary chunks it did not compile (compute() bytecode, load(),
+** deserialized functions), so lverify.c checks each one as it loads
+*/
+#define luai_verifycode(L,f)	luaU_verifycode(L,f)
+
 
 
 
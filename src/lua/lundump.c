@@ -58,6 +58,23 @@ static void loadBlock (LoadState *S, void *b, size_t size) {
 #define loadVar(S,x)		loadVector(S,&x,1)
 
 
+/*
+** The next 'size' bytes in place, when the reader holds them in one
+** piece (always, for a chunk loaded from memory with luaL_loadbuffer);
+** NULL otherwise
+*/
+static const char *peekBlock (LoadState *S, size_t size) {
+  ZIO *z = S->Z;
+  const char *b;
+  if (z->n < size)
+    return NULL;
+  b = z->p;
+  z->n -= size;
+  z->p += size;
+  return b;
+}
+
+
 static lu_byte loadByte (LoadState *S) {
   int b = zgetc(S->Z);
   if (b == EOZ)
@@ -69,6 +86,11 @@ static lu_byte loadByte (LoadState *S) {
 static size_t loadUnsigned (LoadState *S, size_t limit) {
   size_t x = 0;
   int b;
+  ZIO *z = S->Z;
+  if (z->n > 0 && (cast_byte(*z->p) & 0x80)) {  /* one byte: most sizes */
+    z->n--;
+    return cast_sizet(cast_byte(*z->p++) & 0x7f);
+  }
   limit >>= 7;
   do {
     b = loadByte(S);
@@ -114,9 +136,14 @@ static TString *loadStringN (LoadState *S, Proto *p) {
   if (size == 0)  /* no string? */
     return NULL;
   else if (--size <= LUAI_MAXSHORTLEN) {  /* short string? */
-    char buff[LUAI_MAXSHORTLEN];
-    loadVector(S, buff, size);  /* load string into buffer */
-    ts = luaS_newlstr(L, buff, size);  /* create string */
+    const char *b = peekBlock(S, size);
+    if (b != NULL)  /* intern it straight from the chunk */
+      ts = luaS_newlstr(L, b, size);
+    else {
+      char buff[LUAI_MAXSHORTLEN];
+      loadVector(S, buff, size);  /* load string into buffer */
+      ts = luaS_newlstr(L, buff, size);  /* create string */
+    }
   }
   else {  /* long string */
     ts = luaS_createlngstrobj(L, size);  /* create string */
@@ -182,7 +209,7 @@ static void loadConstants (LoadState *S, Proto *f) {
       case LUA_VLNGSTR:
         setsvalue2n(S->L, o, loadString(S, f));
         break;
-      default: lua_assert(0);
+      default: error(S, "bad constant type");
     }
   }
 }
@@ -269,6 +296,7 @@ static void loadFunction (LoadState *S, Proto *f, TString *psource) {
   loadUpvalues(S, f);
   loadProtos(S, f);
   loadDebug(S, f);
+  luaF_initfieldcache(S->L, f);
 }
 
 
@@ -328,7 +356,8 @@ LClosure *luaU_undump(lua_State *L, ZIO *Z, const char *name) {
   cl->p = luaF_newproto(L);
   luaC_objbarrier(L, cl, cl->p);
   loadFunction(&S, cl->p, NULL);
-  lua_assert(cl->nupvalues == cl->p->sizeupvalues);
+  if (cl->nupvalues != cl->p->sizeupvalues)
+    error(&S, "upvalue count mismatch");
   luai_verifycode(L, cl->p);
   return cl;
 }
@@ -28,6 +28,9 @@
 /* load one chunk; from lundump.c */
 LUAI_FUNC LClosure* luaU_undump (lua_State* L, ZIO* Z, const char* name);
 
+/* check a loaded chunk before it runs; from lverify.c */
+LUAI_FUNC void luaU_verifycode (lua_State* L, const Proto* f);
+
 /* dump one chunk; from ldump.c */
 LUAI_FUNC int luaU_dump (lua_State* L, const Proto* f, lua_Writer w,
                          void* data, int strip);
@@ -38,6 +38,17 @@ typedef unsigned long utfint;
 #endif
 
 
+/*
+** luai_utf8span(s,len,nchars) returns how many bytes at the start of 's'
+** (at most 'len') are whole well-formed characters, as 'utf8_decode'
+** takes them in either mode, and sets '*nchars' to their number. Its
+** default leaves all decoding to 'utf8_decode'.
+*/
+#if !defined(luai_utf8span)
+#define luai_utf8span(s,len,nchars)	(*(nchars) = 0, (size_t)0)
+#endif
+
+
 #define iscont(c)	(((c) & 0xC0) == 0x80)
 #define iscontp(p)	iscont(*(p))
 
@@ -105,7 +116,14 @@ static int utflen (lua_State *L) {
   luaL_argcheck(L, --posj < (lua_Integer)len, 3,
                    "final position out of bounds");
   while (posi <= posj) {
-    const char *s1 = utf8_decode(s + posi, NULL, !lax);
+    const char *s1;
+    size_t nchars;  /* well-formed characters skipped at once */
+    posi += (lua_Integer)luai_utf8span(s + posi, (size_t)(posj - posi) + 1,
+                                       &nchars);
+    n += (lua_Integer)nchars;
+    if (posi > posj)
+      break;
+    s1 = utf8_decode(s + posi, NULL, !lax);
     if (s1 == NULL) {  /* conversion error? */
       luaL_pushfail(L);  /* return fail ... */
       lua_pushinteger(L, posi + 1);  /* ... and current position */
@@ -0,0 +1,455 @@
+/*
+** lverify.c
+** Checks on precompiled chunks before they run
+** The VM trusts its bytecode: a register, constant or upvalue index out of
+** range, a jump out of the function or a missing companion instruction
+** reads or writes arbitrary memory. luac output is only as trustworthy as
+** whoever sent it, and Cu loads binary chunks from compute(), load() and
+** deserialized functions, so luaU_undump runs every prototype through
+** luaU_verifycode (via luai_verifycode in luaconf.h) and rejects any chunk
+** the code generator could not have produced. The rules follow lcode.c
+** and lparser.c for Lua 5.4; the open-result checks follow Lua 5.1's
+** ldebug.c verifier
+** See Copyright Notice in lua.h
+*/
+
+#define lverify_c
+#define LUA_CORE
+
+#include "lprefix.h"
+
+
+#include <limits.h>
+
+#include "lua.h"
+
+#include "ldo.h"
+#include "lfunc.h"
+#include "lobject.h"
+#include "lopcodes.h"
+#include "lstate.h"
+#include "ltm.h"
+#include "lundump.h"
+
+
+static l_noret reject (lua_State *L, const Proto *f, int pc, const char *why) {
+  luaO_pushfstring(L, "bad binary format (%s at instruction %d of function "
+                      "at line %d)", why, pc + 1, f->linedefined);
+  luaD_throw(L, LUA_ERRSYNTAX);
+}
+
+
+#define check(c,why)	{ if (l_unlikely(!(c))) reject(L, f, pc, why); }
+
+#define checkreg(r)	check((r) < f->maxstacksize, "register out of range")
+
+#define checkk(x)	check((x) < f->sizek, "constant out of range")
+
+#define checkupval(x)	check((x) < f->sizeupvalues, "upvalue out of range")
+
+/* GETFIELD & co. index the table with a short-string constant */
+#define checkfieldkey(x)  { checkk(x); \
+  check(ttisshrstring(&f->k[x]), "field key not a short string"); }
+
+/* An RK operand is a constant when the k bit is set, else a register */
+#define checkrk(i,x)  { if (GETARG_k(i)) checkk(x) else checkreg(x) }
+
+#define opat(q)		GET_OPCODE(f->code[q])
+
+#define checknext(o,why)  check(pc + 1 < f->sizecode && opat(pc + 1) == (o), why)
+
+
+static int isarith (OpCode op) {
+  return op == OP_ADDI || op == OP_SHRI || op == OP_SHLI ||
+         (OP_ADDK <= op && op <= OP_BXORK) || (OP_ADD <= op && op <= OP_SHR);
+}
+
+
+/* CALL or VARARG leaving its results on the stack up to top */
+static int isopenproducer (Instruction i) {
+  OpCode op = GET_OPCODE(i);
+  return (op == OP_CALL || op == OP_VARARG) && GETARG_C(i) == 0;
+}
+
+
+/* An instruction taking its operands up to top (B == 0) */
+static int isopenconsumer (Instruction i) {
+  OpCode op = GET_OPCODE(i);
+  return (op == OP_CALL || op == OP_TAILCALL || op == OP_RETURN ||
+          op == OP_SETLIST) && GETARG_B(i) == 0;
+}
+
+
+/* LOADKX, NEWTABLE and SETLIST read an EXTRAARG that never runs itself */
+static int takesextraarg (Instruction i) {
+  OpCode op = GET_OPCODE(i);
+  return op == OP_LOADKX || op == OP_NEWTABLE ||
+         (op == OP_SETLIST && GETARG_k(i));
+}
+
+
+/*
+** A destination of a jump or skip. It may not be an open consumer,
+** which only makes sense right after the producer that set top, nor an
+** EXTRAARG
+*/
+static void checktarget (lua_State *L, const Proto *f, int pc, int t) {
+  check(0 <= t && t < f->sizecode, "jump out of range");
+  check(!isopenconsumer(f->code[t]), "jump into an open call");
+  check(opat(t) != OP_EXTRAARG, "jump to an extra argument");
+}
+
+
+/* EQ, TEST & co. either run the JMP that follows or skip it */
+static void checkcond (lua_State *L, const Proto *f, int pc) {
+  checknext(OP_JMP, "test not followed by a jump");
+  checktarget(L, f, pc, pc + 2);
+}
+
+
+/*
+** RETURN and TAILCALL carry the vararg fix-up in C and in k whether the
+** frame has upvalues or to-be-closed variables to close; RETURN0 and
+** RETURN1 skip both, so they may only appear where neither is needed
+*/
+static void checkreturn (lua_State *L, const Proto *f, int pc, int needclose) {
+  Instruction i = f->code[pc];
+  OpCode op = GET_OPCODE(i);
+  if (op == OP_RETURN0 || op == OP_RETURN1) {
+    check(!f->is_vararg, "fast return in a vararg function");
+    check(!needclose, "fast return from a frame that needs closing");
+  }
+  else {
+    check(GETARG_C(i) == (f->is_vararg ? f->numparams + 1 : 0),
+          "wrong vararg count in return");
+    check(!needclose || GETARG_k(i), "return does not close the frame");
+  }
+}
+
+
+/*
+** Whether returns must close the frame, as lparser.c sets needclose: a
+** local captured by a nested function, a to-be-closed variable or the
+** closing value of a generic for
+*/
+static int needsclose (const Proto *f) {
+  int i, j;
+  for (i = 0; i < f->sizecode; i++) {
+    OpCode op = GET_OPCODE(f->code[i]);
+    if (op == OP_TBC || op == OP_TFORPREP) return 1;
+  }
+  for (i = 0; i < f->sizep; i++) {
+    for (j = 0; j < f->p[i]->sizeupvalues; j++) {
+      if (f->p[i]->upvalues[j].instack) return 1;
+    }
+  }
+  return 0;
+}
+
+
+static void checkcode (lua_State *L, const Proto *f) {
+  int n = f->sizecode;
+  int needclose = needsclose(f);
+  int pc = 0;
+  check(n > 0, "empty function");
+  check(f->numparams <= f->maxstacksize, "parameters exceed stack size");
+  check(f->sizelineinfo == 0 || f->sizelineinfo == n, "bad line info size");
+  check(f->sizeupvalues <= MAXUPVAL, "too many upvalues");
+  check(!f->is_vararg || opat(0) == OP_VARARGPREP, "missing vararg setup");
+  for (pc = 0; pc < n; pc++) {
+    Instruction i = f->code[pc];
+    OpCode op = GET_OPCODE(i);
+    int a = GETARG_A(i);
+    check(op < NUM_OPCODES, "invalid opcode");
+    /* (lcode.c follows a TAILCALL with a RETURN it never reaches) */
+    if (isopenconsumer(i) && !(pc > 0 && opat(pc - 1) == OP_TAILCALL)) {
+      Instruction prev = pc > 0 ? f->code[pc - 1] : 0;
+      check(pc > 0 && isopenproducer(prev), "open call without results");
+      check(GETARG_A(prev) >= a + (op != OP_RETURN),
+            "open results below the call");
+    }
+    switch (op) {
+      case OP_MOVE: case OP_UNM: case OP_BNOT: case OP_NOT: case OP_LEN:
+      case OP_GETI: {
+        checkreg(a);
+        checkreg(GETARG_B(i));
+        break;
+      }
+      case OP_LOADI: case OP_LOADF: case OP_LOADFALSE: case OP_LOADTRUE:
+      case OP_CLOSE: case OP_TBC: {
+        checkreg(a);
+        break;
+      }
+      case OP_LFALSESKIP: {
+        checkreg(a);
+        checktarget(L, f, pc, pc + 2);
+        break;
+      }
+      case OP_LOADK: {
+        checkreg(a);
+        checkk(GETARG_Bx(i));
+        break;
+      }
+      case OP_LOADKX: {
+        checkreg(a);
+        checknext(OP_EXTRAARG, "LOADKX without EXTRAARG");
+        checkk(GETARG_Ax(f->code[pc + 1]));
+        break;
+      }
+      case OP_LOADNIL: {
+        checkreg(a + GETARG_B(i));
+        break;
+      }
+      case OP_GETUPVAL: case OP_SETUPVAL: {
+        checkreg(a);
+        checkupval(GETARG_B(i));
+        break;
+      }
+      case OP_GETTABUP: {
+        checkreg(a);
+        checkupval(GETARG_B(i));
+        checkfieldkey(GETARG_C(i));
+        break;
+      }
+      case OP_GETTABLE: {
+        checkreg(a);
+        checkreg(GETARG_B(i));
+        checkreg(GETARG_C(i));
+        break;
+      }
+      case OP_GETFIELD: {
+        checkreg(a);
+        checkreg(GETARG_B(i));
+        checkfieldkey(GETARG_C(i));
+        break;
+      }
+      case OP_SETTABUP: {
+        checkupval(a);
+        checkfieldkey(GETARG_B(i));
+        checkrk(i, GETARG_C(i));
+        break;
+      }
+      case OP_SETTABLE: {
+        checkreg(a);
+        checkreg(GETARG_B(i));
+        checkrk(i, GETARG_C(i));
+        break;
+      }
+      case OP_SETI: {
+        checkreg(a);
+        checkrk(i, GETARG_C(i));
+        break;
+      }
+      case OP_SETFIELD: {
+        checkreg(a);
+        checkfieldkey(GETARG_B(i));
+        checkrk(i, GETARG_C(i));
+        break;
+      }
+      case OP_NEWTABLE: {
+        checkreg(a);
+        check(GETARG_B(i) < (int)(sizeof(int) * CHAR_BIT), "bad table size");
+        checknext(OP_EXTRAARG, "NEWTABLE without EXTRAARG");
+        check(!GETARG_k(i) == (GETARG_Ax(f->code[pc + 1]) == 0),
+              "bad table size");
+        break;
+      }
+      case OP_SELF: {
+        int c = GETARG_C(i);
+        checkreg(a + 1);
+        checkreg(GETARG_B(i));
+        checkrk(i, c);
+        check(!GETARG_k(i) || ttisstring(&f->k[c]), "method name not a string");
+        break;
+      }
+      case OP_ADDI: case OP_SHRI: case OP_SHLI: {
+        checkreg(a);
+        checkreg(GETARG_B(i));
+        checknext(OP_MMBINI, "arithmetic without metamethod fallback");
+        checktarget(L, f, pc, pc + 2);
+        break;
+      }
+      case OP_ADDK: case OP_SUBK: case OP_MULK: case OP_MODK:
+      case OP_POWK: case OP_DIVK: case OP_IDIVK:
+      case OP_BANDK: case OP_BORK: case OP_BXORK: {
+        int c = GETARG_C(i);
+        checkreg(a);
+        checkreg(GETARG_B(i));
+        checkk(c);
+        if (op >= OP_BANDK)
+          check(ttisinteger(&f->k[c]), "bitwise constant not an integer")
+        else
+          check(ttisnumber(&f->k[c]), "arithmetic constant not a number")
+        checknext(OP_MMBINK, "arithmetic without metamethod fallback");
+        checktarget(L, f, pc, pc + 2);
+        break;
+      }
+      case OP_ADD: case OP_SUB: case OP_MUL: case OP_MOD: case OP_POW:
+      case OP_DIV: case OP_IDIV: case OP_BAND: case OP_BOR: case OP_BXOR:
+      case OP_SHL: case OP_SHR: {
+        checkreg(a);
+        checkreg(GETARG_B(i));
+        checkreg(GETARG_C(i));
+        checknext(OP_MMBIN, "arithmetic without metamethod fallback");
+        checktarget(L, f, pc, pc + 2);
+        break;
+      }
+      case OP_MMBIN: case OP_MMBINI: case OP_MMBINK: {
+        int tm = GETARG_C(i);
+        checkreg(a);
+        if (op == OP_MMBIN) checkreg(GETARG_B(i))
+        else if (op == OP_MMBINK) checkk(GETARG_B(i))
+        check(TM_ADD <= tm && tm <= TM_SHR, "bad metamethod event");
+        check(pc > 0 && isarith(opat(pc - 1)), "metamethod fallback alone");
+        break;
+      }
+      case OP_CONCAT: {
+        int b = GETARG_B(i);
+        check(b >= 1, "empty concatenation");
+        checkreg(a + b - 1);
+        break;
+      }
+      case OP_JMP: {
+        checktarget(L, f, pc, pc + 1 + GETARG_sJ(i));
+        break;
+      }
+      case OP_EQ: case OP_LT: case OP_LE: case OP_TESTSET: {
+        checkreg(a);
+        checkreg(GETARG_B(i));
+        checkcond(L, f, pc);
+        break;
+      }
+      case OP_EQK: {
+        checkreg(a);
+        checkk(GETARG_B(i));
+        checkcond(L, f, pc);
+        break;
+      }
+      case OP_EQI: case OP_LTI: case OP_LEI: case OP_GTI: case OP_GEI:
+      case OP_TEST: {
+        checkreg(a);
+        checkcond(L, f, pc);
+        break;
+      }
+      case OP_CALL: case OP_TAILCALL: {
+        int b = GETARG_B(i);
+        checkreg(a);
+        if (b > 0) checkreg(a + b - 1);
+        if (op == OP_CALL) {
+          int c = GETARG_C(i);
+          if (c >= 2) checkreg(a + c - 2);
+        }
+        else checkreturn(L, f, pc, needclose);
+        break;
+      }
+      case OP_RETURN: {
+        int b = GETARG_B(i);
+        check(a <= f->maxstacksize, "register out of range");
+        if (b >= 2) checkreg(a + b - 2);
+        checkreturn(L, f, pc, needclose);
+        break;
+      }
+      case OP_RETURN0: {
+        checkreturn(L, f, pc, needclose);
+        break;
+      }
+      case OP_RETURN1: {
+        checkreg(a);
+        checkreturn(L, f, pc, needclose);
+        break;
+      }
+      case OP_FORLOOP: case OP_TFORLOOP: {
+        checkreg(a + (op == OP_FORLOOP ? 3 : 4));
+        checktarget(L, f, pc, pc + 1 - GETARG_Bx(i));
+        break;
+      }
+      case OP_FORPREP: {
+        checkreg(a + 3);
+        checktarget(L, f, pc, pc + 2 + GETARG_Bx(i));
+        break;
+      }
+      case OP_TFORPREP: {
+        int t = pc + 1 + GETARG_Bx(i);
+        checkreg(a + 3);
+        checktarget(L, f, pc, t);
+        check(opat(t) == OP_TFORCALL && GETARG_A(f->code[t]) == a,
+              "generic for without its call");
+        break;
+      }
+      case OP_TFORCALL: {
+        checkreg(a + 6);
+        checkreg(a + 3 + GETARG_C(i));
+        checknext(OP_TFORLOOP, "generic for call without its loop");
+        check(GETARG_A(f->code[pc + 1]) == a, "generic for call without its loop");
+        break;
+      }
+      case OP_SETLIST: {
+        int b = GETARG_B(i);
+        checkreg(a);
+        if (b > 0) checkreg(a + b);
+        if (GETARG_k(i)) checknext(OP_EXTRAARG, "SETLIST without EXTRAARG");
+        break;
+      }
+      case OP_CLOSURE: {
+        checkreg(a);
+        check(GETARG_Bx(i) < f->sizep, "prototype out of range");
+        break;
+      }
+      case OP_VARARG: {
+        int c = GETARG_C(i);
+        check(f->is_vararg, "vararg in a fixed-argument function");
+        checkreg(a);
+        if (c >= 2) checkreg(a + c - 2);
+        break;
+      }
+      case OP_VARARGPREP: {
+        check(pc == 0 && f->is_vararg, "misplaced vararg setup");
+        check(a == f->numparams, "vararg setup with wrong parameter count");
+        break;
+      }
+      case OP_EXTRAARG: {
+        check(pc > 0 && takesextraarg(f->code[pc - 1]), "stray extra argument");
+        break;
+      }
+      default: {
+        check(0, "invalid opcode");
+        break;
+      }
+    }
+    /* Open results go straight to their consumer */
+    if (isopenproducer(i))
+      check(pc + 1 < n && isopenconsumer(f->code[pc + 1]),
+            "open results not consumed");
+  }
+  pc = n - 1;
+  switch (opat(pc)) {
+    case OP_RETURN: case OP_RETURN0: case OP_RETURN1: case OP_TAILCALL:
+    case OP_JMP:
+      break;
+    default:
+      check(0, "function does not end in a return");
+  }
+}
+
+
+/*
+** Check 'f' and its nested prototypes. Each nested function's upvalues
+** capture either a register of 'f' or one of 'f's own upvalues
+*/
+void luaU_verifycode (lua_State *L, const Proto *f) {
+  int i;
+  checkcode(L, f);
+  for (i = 0; i < f->sizep; i++) {
+    const Proto *child = f->p[i];
+    int j;
+    for (j = 0; j < child->sizeupvalues; j++) {
+      const Upvaldesc *uv = &child->upvalues[j];
+      int pc = -1;
+      if (uv->instack)
+        check(uv->idx < f->maxstacksize, "upvalue captures a bad register")
+      else
+        check(uv->idx < f->sizeupvalues, "upvalue captures a bad upvalue")
+    }
+    luaU_verifycode(L, child);
+  }
+}
@@ -44,6 +44,21 @@
 #endif
 
 
+/*
+** Fused dispatch: handlers for a few instructions that are nearly always
+** followed by the same opcode check for it and jump straight into its
+** handler, skipping one pass through the dispatch (on wasm32 both the
+** switch and the jump table lower to one 'br_table'). The bytecode is
+** unchanged, so dumped chunks stay compatible. Fusion is only taken when
+** 'trap' is clear, when 'vmfetch' would do nothing but load the
+** instruction. Off by default: natively it measures within noise, so
+** build with CU_FUSED_DISPATCH=1 and compare with scripts/bench-vm.js.
+*/
+#if !defined(LUAI_FUSEDISPATCH)
+#define LUAI_FUSEDISPATCH	0
+#endif
+
+
 
 /* limit for table tag-method chains (to avoid infinite loops) */
 #define MAXTAGLOOP	2000
@@ -281,10 +296,64 @@ static int floatforloop (StkId ra) {
 }
 
 
+/*
+** Inline caches for field access with a constant short-string key
+** (OP_GETFIELD, OP_SETFIELD, OP_SELF, and OP_GETTABUP and OP_SETTABUP
+** for globals). Each instruction keeps a hint:
+** the index of the node (or, in a shaped table, of the field) where its
+** key was last found. A key occupies at most one node of a table, so a
+** node at that index holding the same key is exactly what
+** 'luaH_getshortstr' would find, and no table version is needed to
+** validate the hint. Tables filled the same way share a node layout or
+** a shape, so one hint serves every object a site sees. A miss (resized
+** table, other layout, absent key) takes the full lookup and, when the
+** key is present, moves the hint. Every global site reads the one
+** '_ENV' table, so its hint holds until that table is resized. OP_SELF
+** has a second hint for the object's '__index' table, so the object
+** and its class each keep their own.
+*/
+/* result for a key a shaped table does not have (like a hash miss) */
+static const TValue absentfield = {ABSTKEYCONSTANT};
+
+
+l_sinline const TValue *getcachedfield (Table *t, TString *key,
+                                        unsigned int *hint) {
+  const TValue *slot;
+  if (t->shape != NULL) {  /* record? */
+    const Shape *s = t->shape;
+    if (*hint >= cast_uint(s->nkeys) || s->keys[*hint] != key) {
+      int f = luaH_shapeindex(s, key);
+      if (f < 0)
+        return &absentfield;
+      *hint = cast_uint(f);
+    }
+    return &t->fields[*hint];
+  }
+  if (*hint < cast_uint(sizenode(t))) {
+    Node *n = gnode(t, *hint);
+    if (keyisshrstr(n) && keystrval(n) == key)
+      return gval(n);
+  }
+  slot = luaH_getshortstr(t, key);
+  if (!isabstkey(slot))
+    *hint = cast_uint(cast(const Node *, slot) - t->node);
+  return slot;
+}
+
+/* the hint of the instruction being executed */
+#define fieldhint(pc)	(&cl->p->fieldcache[pcRel(pc, cl->p)])
+
+/* 'luaH_getshortstr' through the current instruction's cache */
+#define luaH_getcached(t,k)	getcachedfield(t, k, fieldhint(pc))
+
+/* the same for OP_SELF's lookup in the object's '__index' table */
+#define luaH_getmethod(t,k)	getcachedfield(t, k, fieldhint(pc) + cl->p->sizecode)
+
+
 /*
 ** Finish the table access 'val = t[key]'.
 ** if 'slot' is NULL, 't' is not a table; otherwise, 'slot' points to
-** t[k] entry (which must be empty).
+** t[k] entry (which must be empty, or a copy of an unboxed entry).
 */
 void luaV_finishget (lua_State *L, const TValue *t, TValue *key, StkId val,
                       const TValue *slot) {
@@ -298,8 +367,12 @@ void luaV_finishget (lua_State *L, const TValue *t, TValue *key, StkId val,
         luaG_typeerror(L, t, "index");  /* no metamethod */
       /* else will try the metamethod */
     }
+    else if (!isempty(slot)) {  /* an entry of an unboxed array part? */
+      lua_assert(isunboxedslot(hvalue(t), slot));
+      setobj2s(L, val, slot);
+      return;
+    }
     else {  /* 't' is a table */
-      lua_assert(isempty(slot));
       tm = fasttm(L, hvalue(t)->metatable, TM_INDEX);  /* table's metamethod */
       if (tm == NULL) {  /* no metamethod? */
         setnilvalue(s2v(val));  /* result is nil */
@@ -327,7 +400,8 @@ void luaV_finishget (lua_State *L, const TValue *t, TValue *key, StkId val,
 ** If 'slot' is NULL, 't' is not a table.  Otherwise, 'slot' points
 ** to the entry 't[key]', or to a value with an absent key if there
 ** is no such entry.  (The value at 'slot' must be empty, otherwise
-** 'luaV_fastget' would have done the job.)
+** 'luaV_fastget' would have done the job, unless it is a copy of an
+** entry of an unboxed array part.)
 */
 void luaV_finishset (lua_State *L, const TValue *t, TValue *key,
                      TValue *val, const TValue *slot) {
@@ -336,9 +410,9 @@ void luaV_finishset (lua_State *L, const TValue *t, TValue *key,
     const TValue *tm;  /* '__newindex' metamethod */
     if (slot != NULL) {  /* is 't' a table? */
       Table *h = hvalue(t);  /* save 't' table */
-      lua_assert(isempty(slot));  /* slot must be empty */
+      lua_assert(isempty(slot) || isunboxedslot(h, slot));
       tm = fasttm(L, h->metatable, TM_NEWINDEX);  /* get metamethod */
-      if (tm == NULL) {  /* no metamethod? */
+      if (tm == NULL || !isempty(slot)) {  /* no metamethod or present? */
         luaH_finishset(L, h, key, slot, val);  /* set new value */
         invalidateTMcache(h);
         luaC_barrierback(L, obj2gco(h), val);
@@ -1088,8 +1162,13 @@ void luaV_finishOp (lua_State *L) {
 #define dojump(ci,i,e)	{ pc += GETARG_sJ(i) + e; updatetrap(ci); }
 
 
-/* for test instructions, execute the jump instruction that follows it */
-#define donextjump(ci)	{ Instruction ni = *pc; dojump(ci, ni, 1); }
+/*
+** for test instructions, execute the jump instruction that follows it
+** ('repeat ... until' loops back through here)
+*/
+#define donextjump(ci)	{ Instruction ni = *pc; \
+  if (GETARG_sJ(ni) < 0) checkinterrupt(L); \
+  dojump(ci, ni, 1); }
 
 /*
 ** do a conditional jump: skip next instruction if 'cond' is not what
@@ -1127,6 +1206,18 @@ void luaV_finishOp (lua_State *L) {
 */
 #define halfProtect(exp)  (savestate(L,ci), (exp))
 
+/*
+** Stop at the host's request: loop back-edges and calls read the flag
+** luai_interruptpending() tests, so no loop or recursion runs on once it
+** is set. luai_interrupt(L) raises the error.
+*/
+#if defined(luai_interruptpending)
+#define checkinterrupt(L)  \
+	{ if (l_unlikely(luai_interruptpending())) halfProtect(luai_interrupt(L)); }
+#else
+#define checkinterrupt(L)	((void)0)
+#endif
+
 /* 'c' is the limit of live values in the stack */
 #define checkGC(L,c)  \
 	{ luaC_condGC(L, (savepc(L), L->top.p = (c)), \
@@ -1148,6 +1239,15 @@ void luaV_finishOp (lua_State *L) {
 #define vmbreak		break
 
 
+/* continue at label 'l' if the next instruction is an 'op' */
+#if LUAI_FUSEDISPATCH
+#define vmfuse(op,l)  \
+	{ if (!trap && GET_OPCODE(*pc) == op) { i = *(pc++); goto l; } }
+#else
+#define vmfuse(op,l)	{ if (0) goto l; }  /* keep the labels used */
+#endif
+
+
 void luaV_execute (lua_State *L, CallInfo *ci) {
   LClosure *cl;
   TValue *k;
@@ -1252,7 +1352,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         TValue *upval = cl->upvals[GETARG_B(i)]->v.p;
         TValue *rc = KC(i);
         TString *key = tsvalue(rc);  /* key must be a short string */
-        if (luaV_fastget(L, upval, key, slot, luaH_getshortstr)) {
+        if (luaV_fastget(L, upval, key, slot, luaH_getcached)) {
           setobj2s(L, ra, slot);
         }
         else
@@ -1295,11 +1395,12 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         TValue *rb = vRB(i);
         TValue *rc = KC(i);
         TString *key = tsvalue(rc);  /* key must be a short string */
-        if (luaV_fastget(L, rb, key, slot, luaH_getshortstr)) {
+        if (luaV_fastget(L, rb, key, slot, luaH_getcached)) {
           setobj2s(L, ra, slot);
         }
         else
           Protect(luaV_finishget(L, rb, rc, ra, slot));
+        vmfuse(OP_CALL, fused_call);  /* 'f(t.x)', 'm.f()' */
         vmbreak;
       }
       vmcase(OP_SETTABUP) {
@@ -1308,7 +1409,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         TValue *rb = KB(i);
         TValue *rc = RKC(i);
         TString *key = tsvalue(rb);  /* key must be a short string */
-        if (luaV_fastget(L, upval, key, slot, luaH_getshortstr)) {
+        if (luaV_fastget(L, upval, key, slot, luaH_getcached)) {
           luaV_finishfastset(L, upval, slot, rc);
         }
         else
@@ -1322,7 +1423,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         TValue *rc = RKC(i);  /* value */
         lua_Unsigned n;
         if (ttisinteger(rb)  /* fast track for integers? */
-            ? (cast_void(n = ivalue(rb)), luaV_fastgeti(L, s2v(ra), n, slot))
+            ? (cast_void(n = ivalue(rb)), luaV_fastseti(L, s2v(ra), n, slot, rc))
             : luaV_fastget(L, s2v(ra), rb, slot, luaH_get)) {
           luaV_finishfastset(L, s2v(ra), slot, rc);
         }
@@ -1335,7 +1436,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         const TValue *slot;
         int c = GETARG_B(i);
         TValue *rc = RKC(i);
-        if (luaV_fastgeti(L, s2v(ra), c, slot)) {
+        if (luaV_fastseti(L, s2v(ra), c, slot, rc)) {
           luaV_finishfastset(L, s2v(ra), slot, rc);
         }
         else {
@@ -1351,7 +1452,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         TValue *rb = KB(i);
         TValue *rc = RKC(i);
         TString *key = tsvalue(rb);  /* key must be a short string */
-        if (luaV_fastget(L, s2v(ra), key, slot, luaH_getshortstr)) {
+        if (luaV_fastget(L, s2v(ra), key, slot, luaH_getcached)) {
           luaV_finishfastset(L, s2v(ra), slot, rc);
         }
         else
@@ -1373,7 +1474,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         t = luaH_new(L);  /* memory allocation */
         sethvalue2s(L, ra, t);
         if (b != 0 || c != 0)
-          luaH_resize(L, t, c, b);  /* idem */
+          luaH_presize(L, t, c, b);  /* idem */
         checkGC(L, ra + 1);
         vmbreak;
       }
@@ -1382,17 +1483,36 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         const TValue *slot;
         TValue *rb = vRB(i);
         TValue *rc = RKC(i);
-        TString *key = tsvalue(rc);  /* key must be a string */
+        /* a register key can be any value in a precompiled chunk */
+        TString *key = ttisshrstring(rc) ? tsvalue(rc) : NULL;
         setobj2s(L, ra + 1, rb);
-        if (luaV_fastget(L, rb, key, slot, luaH_getstr)) {
+        if (key == NULL) {
+          if (luaV_fastget(L, rb, rc, slot, luaH_get)) {
+            setobj2s(L, ra, slot);
+          }
+          else
+            Protect(luaV_finishget(L, rb, rc, ra, slot));
+        }
+        else if (luaV_fastget(L, rb, key, slot, luaH_getcached)) {
           setobj2s(L, ra, slot);
         }
-        else
-          Protect(luaV_finishget(L, rb, rc, ra, slot));
+        else {
+          /* a method on the object's class: its '__index' table has a
+             hint of its own, after the one per instruction */
+          const TValue *tm = (slot == NULL) ? NULL
+                           : fasttm(L, hvalue(rb)->metatable, TM_INDEX);
+          const TValue *mslot;
+          if (tm != NULL && luaV_fastget(L, tm, key, mslot, luaH_getmethod)) {
+            setobj2s(L, ra, mslot);
+          }
+          else
+            Protect(luaV_finishget(L, rb, rc, ra, slot));
+        }
         vmbreak;
       }
       vmcase(OP_ADDI) {
         op_arithI(L, l_addi, luai_numadd);
+        vmfuse(OP_FORLOOP, fused_forloop);  /* 'n = n + 1' ending a loop */
         vmbreak;
       }
       vmcase(OP_ADDK) {
@@ -1459,6 +1579,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
       }
       vmcase(OP_ADD) {
         op_arith(L, l_addi, luai_numadd);
+        vmfuse(OP_FORLOOP, fused_forloop);  /* 's = s + x' ending a loop */
         vmbreak;
       }
       vmcase(OP_SUB) {
@@ -1597,6 +1718,8 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         vmbreak;
       }
       vmcase(OP_JMP) {
+        if (GETARG_sJ(i) < 0)  /* loop back-edge? */
+          checkinterrupt(L);
         dojump(ci, i, 0);
         vmbreak;
       }
@@ -1670,11 +1793,12 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         }
         vmbreak;
       }
-      vmcase(OP_CALL) {
+      vmcase(OP_CALL) fused_call: {
         StkId ra = RA(i);
         CallInfo *newci;
         int b = GETARG_B(i);
         int nresults = GETARG_C(i) - 1;
+        checkinterrupt(L);
         if (b != 0)  /* fixed number of arguments? */
           L->top.p = ra + b;  /* top signals number of arguments */
         /* else previous instruction set top */
@@ -1694,6 +1818,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         int nparams1 = GETARG_C(i);
         /* delta is virtual 'func' - real 'func' (vararg functions) */
         int delta = (nparams1) ? ci->u.l.nextraargs + nparams1 : 0;
+        checkinterrupt(L);
         if (b != 0)
           L->top.p = ra + b;
         else  /* previous instruction set top */
@@ -1781,8 +1906,9 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
           goto returning;  /* continue running caller in this frame */
         }
       }
-      vmcase(OP_FORLOOP) {
+      vmcase(OP_FORLOOP) fused_forloop: {
         StkId ra = RA(i);
+        checkinterrupt(L);
         if (ttisinteger(s2v(ra + 2))) {  /* integer loop? */
           lua_Unsigned count = l_castS2U(ivalue(s2v(ra + 1)));
           if (count > 0) {  /* still more iterations? */
@@ -1836,6 +1962,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
       vmcase(OP_TFORLOOP) {
        l_tforloop: {
         StkId ra = RA(i);
+        checkinterrupt(L);
         if (!ttisnil(s2v(ra + 4))) {  /* continue loop? */
           setobjs2s(L, ra + 2, ra + 4);  /* save control variable */
           pc -= GETARG_Bx(i);  /* jump back */
@@ -1846,7 +1973,10 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         StkId ra = RA(i);
         int n = GETARG_B(i);
         unsigned int last = GETARG_C(i);
-        Table *h = hvalue(s2v(ra));
+        Table *h;
+        if (l_unlikely(!ttistable(s2v(ra))))  /* only in a crafted chunk */
+          luaG_typeerror(L, s2v(ra), "index");
+        h = hvalue(s2v(ra));
         if (n == 0)
           n = cast_int(L->top.p - ra) - 1;  /* get up to the top */
         else
@@ -1858,11 +1988,23 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         }
         if (last > luaH_realasize(h))  /* needs more space? */
           luaH_resizearray(L, h, last);  /* preallocate it at once */
-        for (; n > 0; n--) {
-          TValue *val = s2v(ra + n);
-          setobj2t(L, &h->array[last - 1], val);
-          last--;
-          luaC_barrierback(L, obj2gco(h), val);
+        if (l_unlikely(isunboxed(h))) {  /* entries go through 'setint' */
+          for (; n > 0; n--) {
+            TValue *val = s2v(ra + n);
+            luaH_setint(L, h, last--, val);
+            luaC_barrierback(L, obj2gco(h), val);
+          }
+        }
+        else {
+          int filled = (last == luaH_realasize(h));  /* last batch? */
+          for (; n > 0; n--) {
+            TValue *val = s2v(ra + n);
+            setobj2t(L, &h->array[last - 1], val);
+            last--;
+            luaC_barrierback(L, obj2gco(h), val);
+          }
+          if (filled)
+            luaH_unboxarray(L, h);  /* a list of numbers can shrink now */
         }
         vmbreak;
       }
@@ -80,27 +80,45 @@ typedef enum {
 ** return 1 with 'slot' pointing to 't[k]' (position of final result).
 ** Otherwise, return 0 (meaning it will have to check metamethod)
 ** with 'slot' pointing to an empty 't[k]' (if 't' is a table) or NULL
-** (otherwise). 'f' is the raw get function to use.
+** (otherwise). 'f' is the raw get function to use. An entry of an
+** unboxed array part also returns 0, with 'slot' holding a copy of it.
 */
 #define luaV_fastget(L,t,k,slot,f) \
   (!ttistable(t)  \
    ? (slot = NULL, 0)  /* not a table; 'slot' is NULL and result is 0 */  \
    : (slot = f(hvalue(t), k),  /* else, do raw access */  \
-      !isempty(slot)))  /* result not empty? */
+      !isempty(slot) &&  /* result not empty? */  \
+      !isunboxedslot(hvalue(t), slot)))  /* and not a copy? */
 
 
 /*
 ** Special case of 'luaV_fastget' for integers, inlining the fast case
-** of 'luaH_getint'.
+** of 'luaH_getint'. (An entry of an unboxed array part comes as a copy
+** in 'slot', which can be read but not written: sets go through
+** 'luaV_fastseti'.)
 */
 #define luaV_fastgeti(L,t,k,slot) \
   (!ttistable(t)  \
    ? (slot = NULL, 0)  /* not a table; 'slot' is NULL and result is 0 */  \
-   : (slot = (l_castS2U(k) - 1u < hvalue(t)->alimit) \
-              ? &hvalue(t)->array[k - 1] : luaH_getint(hvalue(t), k), \
+   : (slot = (l_castS2U(k) - 1u >= hvalue(t)->alimit) \
+              ? luaH_getint(hvalue(t), k) \
+              : !isunboxed(hvalue(t)) ? &hvalue(t)->array[k - 1] \
+              : luaH_unboxedentry(unboxed(hvalue(t)), k - 1), \
       !isempty(slot)))  /* result not empty? */
 
 
+/*
+** 'luaV_fastgeti' for a set 't[k] = v'. An entry of an unboxed array
+** part is set here if 'v' can go there unboxed ('luaV_finishfastset'
+** then only writes to the copy); otherwise it is left to
+** 'luaV_finishset'.
+*/
+#define luaV_fastseti(L,t,k,slot,v) \
+  (luaV_fastgeti(L,t,k,slot) && \
+   (!isunboxedslot(hvalue(t), slot) || \
+    luaH_setunboxedentry(unboxed(hvalue(t)), k - 1, v)))
+
+
 /*
 ** Finish a fast set operation (when fast get succeeds). In that case,
 ** 'slot' points to the place to put the value.
@@ -5,23 +5,23 @@
 
 #include <stdint.h>
 
+/*
+** Lua's error path (LUAI_TRY/LUAI_THROW in ldo.c) uses setjmp/longjmp.
+** There is no libc implementation on wasm32-freestanding; instead ldo.c is
+** compiled with `-mllvm -wasm-enable-sjlj`, which lowers these calls onto
+** the wasm exception-handling proposal. The lowered code calls the runtime
+** helpers in wasm-sjlj.c, so `setjmp`/`longjmp` are never linked as symbols.
+**
+** jmp_buf only has to hold struct wasm_jmp_buf from wasm-sjlj.c.
+*/
 typedef uint64_t jmp_buf[5];
 
-static inline int setjmp(jmp_buf env) {
-    return 0;
-}
+int setjmp(jmp_buf env);
+void longjmp(jmp_buf env, int val) __attribute__((noreturn));
 
-static inline int _setjmp(jmp_buf env) {
-    return 0;
-}
-
-static inline void longjmp(jmp_buf env, int val) {
-    __builtin_unreachable();
-}
-
-static inline void _longjmp(jmp_buf env, int val) {
-    __builtin_unreachable();
-}
+/* Only the names setjmp/longjmp are recognized by the lowering pass */
+#define _setjmp(env) setjmp(env)
+#define _longjmp(env, val) longjmp(env, val)
 
 #else
 #include <setjmp.h>
@@ -0,0 +1,44 @@
+/*
+** Runtime support for LLVM's wasm setjmp/longjmp lowering
+** (-mllvm -wasm-enable-sjlj). Must be compiled with -mexception-handling.
+**
+** setjmp records which function invocation owns the buffer and the label
+** the lowered code dispatches on when the longjmp lands. longjmp throws a
+** wasm exception with the C_LONGJMP tag; the catch in the function that
+** called setjmp checks __wasm_setjmp_test and resumes at that label, with
+** the shadow stack pointer restored by the catch pad.
+*/
+
+#include <stdint.h>
+
+#include "setjmp-wasm.h"
+
+struct wasm_jmp_buf {
+  void *func_invocation_id;
+  uint32_t label;
+  struct {
+    void *env;
+    int val;
+  } arg;
+};
+
+_Static_assert(sizeof(struct wasm_jmp_buf) <= sizeof(jmp_buf),
+               "jmp_buf too small for wasm sjlj state");
+
+void __wasm_setjmp (void *env, uint32_t label, void *func_invocation_id) {
+  struct wasm_jmp_buf *jb = env;
+  jb->func_invocation_id = func_invocation_id;
+  jb->label = label;
+}
+
+uint32_t __wasm_setjmp_test (void *env, void *func_invocation_id) {
+  struct wasm_jmp_buf *jb = env;
+  return jb->func_invocation_id == func_invocation_id ? jb->label : 0;
+}
+
+void __wasm_longjmp (void *env, int val) {
+  struct wasm_jmp_buf *jb = env;
+  jb->arg.env = env;
+  jb->arg.val = val == 0 ? 1 : val;
+  __builtin_wasm_throw(1, &jb->arg);  /* tag 1 = C_LONGJMP */
+}
@@ -5,24 +5,64 @@ const ext_table = @import("ext_table.zig");
 const error_handler = @import("error.zig");
 const output_capture = @import("output.zig");
 const result_encoder = @import("result.zig");
+const alloc_stats = @import("alloc_stats.zig");
+const budget = @import("budget.zig");
+const chunk_cache = @import("chunk_cache.zig");
+const ext_store = @import("ext_store.zig");
+const key_filter = @import("key_filter.zig");
+const prefetch = @import("prefetch.zig");
+const home_modules = @import("home_modules.zig");
+const typed_array = @import("typed_array.zig");
+const gc_stats = @import("gc_stats.zig");
+const scratch = @import("scratch.zig");
+const function_serializer = @import("function_serializer.zig");
+const result_region = @import("result_region.zig");
+const perf = @import("perf_counters.zig");
+const profiler = @import("profiler.zig");
+const host_await = @import("host_await.zig");
+const deterministic = @import("deterministic.zig");
+const states = @import("states.zig");
+const hash = @import("hash.zig");
+const compress = @import("compress.zig");
 
 extern fn luaopen_bigint(L: *lua.lua_State) c_int;
+extern fn luaopen_decimal(L: *lua.lua_State) c_int;
+extern fn luaopen_json(L: *lua.lua_State) c_int;
+extern fn luaopen_msgpack(L: *lua.lua_State) c_int;
+extern fn luaopen_strbuf(L: *lua.lua_State) c_int;
+extern fn luaopen_lru(L: *lua.lua_State) c_int;
+extern fn luaopen_struct(L: *lua.lua_State) c_int;
+extern fn luaopen_sched(L: *lua.lua_State) c_int;
+extern fn luaopen_vec(L: *lua.lua_State) c_int;
+extern fn luaopen_codec(L: *lua.lua_State) c_int;
+extern fn cu_sched_tick(L: *lua.lua_State) c_int;
+extern fn luaS_presize(L: *lua.lua_State, size: c_int) void;
+extern fn cu_openlibs(L: *lua.lua_State, open: c_uint, lazy: c_uint) void;
+extern fn luaS_tablestats(L: *lua.lua_State, size: *c_int, nuse: *c_int, buckets: *c_int, longest: *c_int) void;
 extern fn bigint_set_allocator(allocator: *anyopaque) void;
 
 const IO_BUFFER_SIZE = 64 * 1024;
-const TOTAL_MEMORY = 2 * 1024 * 1024;
+const DEFAULT_HEAP_SIZE = 512 * 1024;
 
 // Storage namespace constants
 const HOME_TABLE_NAME = "_home";
 const LEGACY_MEMORY_NAME = "Memory";
 
+// Chunk name for compute() sources; errors read "compute:<line>: ..."
+const COMPUTE_CHUNK_NAME = "=compute";
+
 var io_buffer: [IO_BUFFER_SIZE]u8 align(16) = undefined;
-var heap: [TOTAL_MEMORY]u8 align(4096) = undefined;
 var global_lua_state: ?*lua.lua_State = null;
-var lua_memory_used: usize = 0;
 var memory_table_id: u32 = 0;
 var io_table_id: u32 = 0;
 var enable_memory_alias: bool = true; // Feature flag for backward compatibility
+// Initial string table slots (set_string_table_size); 0 keeps Lua's default
+var string_table_slots: c_int = 0;
+// Standard libraries init opens, and which of them on first use (set_stdlibs)
+var stdlibs_open: c_uint = ALL_STDLIBS;
+var stdlibs_lazy: c_uint = 0;
+// Handle of the selected state in states.zig; 0 before init
+var current_state: u32 = 0;
 
 extern fn js_ext_table_set(table_id: u32, key_ptr: [*]const u8, key_len: usize, val_ptr: [*]const u8, val_len: usize) c_int;
 extern fn js_ext_table_get(table_id: u32, key_ptr: [*]const u8, key_len: usize, val_ptr: [*]u8, max_len: usize) c_int;
@@ -33,7 +73,11 @@ extern fn js_ext_table_keys(table_id: u32, buf_ptr: [*]u8, max_len: usize) c_int
 // Import our renamed allocators from libc-stubs.zig
 extern fn lua_malloc(size: usize) ?*anyopaque;
 extern fn lua_realloc(ptr: ?*anyopaque, size: usize) ?*anyopaque;
+extern fn lua_realloc_sized(ptr: ?*anyopaque, old_size: usize, size: usize) ?*anyopaque;
 extern fn lua_free(ptr: ?*anyopaque) void;
+extern fn lua_heap_configure(initial_bytes: usize, max_bytes: usize) c_int;
+extern fn lua_allocator_stats(out: *alloc_stats.AllocatorStats) void;
+extern fn lua_heap_trim() usize;
 
 // Zig Allocator interface for bigint library
 const LuaAllocator = struct {
@@ -52,7 +96,7 @@ const LuaAllocator = struct {
             lua_free(memory.ptr);
             return null;
         }
-        return @ptrCast(lua_realloc(memory.ptr, new_len));
+        return @ptrCast(lua_realloc_sized(memory.ptr, memory.len, new_len));
     }
 
     fn free(_: *anyopaque, buf: []u8, _: std.mem.Alignment, _: usize) void {
@@ -71,47 +115,196 @@ const lua_allocator = std.mem.Allocator{
     },
 };
 
-// Custom allocator function for Lua
+// Custom allocator function for Lua. States made by create_state pass their
+// handle as `ud`, and every block is charged to that state's account too.
 export fn lua_alloc(ud: ?*anyopaque, ptr: ?*anyopaque, osize: usize, nsize: usize) ?*anyopaque {
-    _ = ud;
-    _ = osize;
+    const account: usize = @intFromPtr(ud);
+
+    // When ptr is null, osize carries the object type rather than a size
+    const old_size: usize = if (ptr == null) 0 else osize;
 
     if (nsize == 0) {
         lua_free(ptr);
+        budget.release(old_size);
+        if (account != 0) states.release_bytes(account, old_size);
+        return null;
+    }
+
+    if (nsize > old_size) {
+        if (!budget.reserve(nsize - old_size)) return null;
+        if (account != 0 and !states.reserve_bytes(account, nsize - old_size)) {
+            budget.release(nsize - old_size);
+            return null;
+        }
+    }
+
+    const block = if (ptr == null) lua_malloc(nsize) else lua_realloc_sized(ptr, osize, nsize);
+    if (block == null) {
+        if (nsize > old_size) {
+            budget.release(nsize - old_size);
+            if (account != 0) states.release_bytes(account, nsize - old_size);
+        }
         return null;
     }
 
-    return lua_realloc(ptr, nsize);
+    if (nsize < old_size) {
+        budget.release(old_size - nsize);
+        if (account != 0) states.release_bytes(account, old_size - nsize);
+    }
+    return block;
 }
 
 export fn init() i32 {
+    return init_with_limits(DEFAULT_HEAP_SIZE, DEFAULT_HEAP_SIZE);
+}
+
+/// Initialize with a host-chosen heap: `heap_bytes` is committed up front and
+/// the allocator may grow linear memory up to `max_heap_bytes` on demand.
+/// Growing memory detaches host views of `memory.buffer`, so hosts that allow
+/// growth must refresh them after boundary calls.
+export fn init_with_limits(heap_bytes: usize, max_heap_bytes: usize) i32 {
     if (global_lua_state != null) {
         return 0;
     }
 
+    if (lua_heap_configure(heap_bytes, max_heap_bytes) != 0) {
+        return -1;
+    }
+
+    const handle = states.reserve() orelse return -1;
+
     // Use lua_newstate with custom allocator instead of luaL_newstate
     const L = lua.c.lua_newstate(lua_alloc, null);
     if (L == null) {
+        states.release(handle);
         return -1;
     }
 
-    global_lua_state = L;
-    lua.openlibs(L.?);
-    lua_memory_used = 0;
-
     error_handler.init_error_state();
     output_capture.init_output_capture();
-
     ext_table.init_ext_table(&io_buffer, IO_BUFFER_SIZE);
-    ext_table.setup_ext_table_library(L.?);
-    setup_print_override(L.?);
-    setup_memory_global(L.?);
-    setup_io_global(L.?);
-    setup_bigint_library(L.?);
 
+    global_lua_state = L;
+    setup_state(L.?);
+    states.adopt(handle, L.?, memory_table_id, io_table_id);
+    current_state = handle;
+
+    return 0;
+}
+
+// Everything a fresh state needs before its first compute; sets
+// memory_table_id and io_table_id to its _home and _io
+fn setup_state(L: *lua.lua_State) void {
+    if (string_table_slots > 0) luaS_presize(L, string_table_slots);
+    // Per-request garbage dies young while _home and module state live
+    // long, the case generational collection is built for
+    _ = lua.gc_generational(L, 0, 0);
+    cu_openlibs(L, stdlibs_open, stdlibs_lazy);
+    if (deterministic.active()) deterministic.seed_random(L);
+
+    ext_table.setup_ext_table_library(L);
+    setup_print_override(L);
+    setup_memory_global(L);
+    setup_io_global(L);
+    setup_native_libraries(L);
+    home_modules.setup(L);
+    host_await.setup(L);
+    // After print is replaced, so stored references to it load the capture
+    function_serializer.init_c_function_registry(L);
+}
+
+/// Create another isolated lua_State in this instance, set up as init() sets
+/// up the first, and return its handle (or -1). It gets its own _home and
+/// _io tables; the selected state stays selected. Its allocations are
+/// charged to it, up to the limit set_state_memory_limit gives it.
+export fn create_state() i32 {
+    if (global_lua_state == null) return -1;
+    const handle = states.reserve() orelse return -1;
+    // reserve() may move the slots, so only look up the current one now
+    const previous = states.get(current_state).?;
+    previous.home_table_id = memory_table_id;
+    previous.io_table_id = io_table_id;
+    states.switch_to(previous, null);
+
+    const L = lua.c.lua_newstate(lua_alloc, @ptrFromInt(handle));
+    if (L == null) {
+        states.release(handle);
+        states.switch_to(null, states.get(current_state).?);
+        return -1;
+    }
+    global_lua_state = L;
+    setup_state(L.?);
+    states.adopt(handle, L.?, memory_table_id, io_table_id);
+
+    const created = states.get(handle).?;
+    const selected = states.get(current_state).?;
+    states.switch_to(created, selected);
+    global_lua_state = selected.L;
+    memory_table_id = selected.home_table_id;
+    io_table_id = selected.io_table_id;
+    return @intCast(handle);
+}
+
+/// Make `handle` the state every other export works on. Returns -1 for an
+/// unknown handle or while a compute_async is waiting at host.await.
+export fn select_state(handle: u32) i32 {
+    const target = states.get(handle) orelse return -1;
+    if (handle == current_state) return 0;
+    if (host_await.pending() != 0) return -1;
+
+    const previous = states.get(current_state).?;
+    previous.home_table_id = memory_table_id;
+    previous.io_table_id = io_table_id;
+    states.switch_to(previous, target);
+    global_lua_state = target.L;
+    memory_table_id = target.home_table_id;
+    io_table_id = target.io_table_id;
+    current_state = handle;
+    return 0;
+}
+
+export fn get_state() u32 {
+    return current_state;
+}
+
+/// Close a state made by create_state. The selected state and the one init()
+/// made cannot be destroyed. Its external tables stay with the host, which
+/// drops them.
+export fn destroy_state(handle: u32) i32 {
+    if (handle == 1 or handle == current_state) return -1;
+    const slot = states.get(handle) orelse return -1;
+    const L = slot.L.?;
+    states.forget(L);
+    lua.c.lua_close(L);
+    states.release(handle);
+    return 0;
+}
+
+/// compute() on the state `handle`, which stays selected afterwards
+export fn compute_on(handle: u32, code_ptr: usize, code_len: usize) i32 {
+    if (select_state(handle) != 0) {
+        const error_msg = "Unknown or busy state";
+        @memcpy(io_buffer[0..error_msg.len], error_msg);
+        return -@as(i32, error_msg.len);
+    }
+    return compute(code_ptr, code_len);
+}
+
+/// Cap the bytes a state made by create_state may hold (0 = only the heap's
+/// limit). Allocations past it fail as out of memory in that state alone.
+export fn set_state_memory_limit(handle: u32, max_bytes: usize) i32 {
+    const slot = states.get(handle) orelse return -1;
+    slot.max_bytes = max_bytes;
     return 0;
 }
 
+/// Bytes a state made by create_state holds; 0 for the state init() made,
+/// which is not accounted (get_memory_stats covers the whole heap)
+export fn get_state_memory(handle: u32) usize {
+    const slot = states.get(handle) orelse return 0;
+    return slot.bytes;
+}
+
 fn setup_print_override(L: *lua.lua_State) void {
     lua.pushcfunction(L, @as(lua.c.lua_CFunction, @ptrCast(&output_capture.custom_print)));
     lua.setglobal(L, "print");
@@ -135,16 +328,49 @@ fn setup_io_global(L: *lua.lua_State) void {
     lua.setglobal(L, "_io");
 }
 
-fn setup_bigint_library(L: *lua.lua_State) void {
+// C libraries scripts load with require(): bigint (lbigint.c), decimal
+// (ldecimal.c), json (ljson.c), msgpack (lmsgpack.c), strbuf (lstrbuf.c),
+// lru (llru.c), struct (lstruct.c), sched (lsched.c), vec (vec.zig), codec
+// (codec.zig), hash (hash.zig) and compress (compress.zig)
+fn setup_native_libraries(L: *lua.lua_State) void {
     bigint_set_allocator(@ptrCast(@constCast(&lua_allocator)));
+    compress.allocator = lua_allocator;
 
     _ = lua.getglobal(L, "package");
     _ = lua.getfield(L, -1, "preload");
     lua.pushcfunction(L, @as(lua.c.lua_CFunction, @ptrCast(&luaopen_bigint)));
     lua.setfield(L, -2, "bigint");
+    lua.pushcfunction(L, @as(lua.c.lua_CFunction, @ptrCast(&luaopen_decimal)));
+    lua.setfield(L, -2, "decimal");
+    lua.pushcfunction(L, @as(lua.c.lua_CFunction, @ptrCast(&luaopen_json)));
+    lua.setfield(L, -2, "json");
+    lua.pushcfunction(L, @as(lua.c.lua_CFunction, @ptrCast(&luaopen_msgpack)));
+    lua.setfield(L, -2, "msgpack");
+    lua.pushcfunction(L, @as(lua.c.lua_CFunction, @ptrCast(&luaopen_strbuf)));
+    lua.setfield(L, -2, "strbuf");
+    lua.pushcfunction(L, @as(lua.c.lua_CFunction, @ptrCast(&luaopen_lru)));
+    lua.setfield(L, -2, "lru");
+    lua.pushcfunction(L, @as(lua.c.lua_CFunction, @ptrCast(&luaopen_struct)));
+    lua.setfield(L, -2, "struct");
+    lua.pushcfunction(L, @as(lua.c.lua_CFunction, @ptrCast(&luaopen_sched)));
+    lua.setfield(L, -2, "sched");
+    lua.pushcfunction(L, @as(lua.c.lua_CFunction, @ptrCast(&luaopen_vec)));
+    lua.setfield(L, -2, "vec");
+    lua.pushcfunction(L, @as(lua.c.lua_CFunction, @ptrCast(&luaopen_codec)));
+    lua.setfield(L, -2, "codec");
+    lua.pushcfunction(L, @as(lua.c.lua_CFunction, @ptrCast(&hash.luaopen)));
+    lua.setfield(L, -2, "hash");
+    lua.pushcfunction(L, @as(lua.c.lua_CFunction, @ptrCast(&compress.luaopen)));
+    lua.setfield(L, -2, "compress");
     lua.pop(L, 2);
 }
 
+// For lmsgpack.c, vec.zig and codec.zig: make the userdata on top of the stack, which
+// holds one complete typed array value, a typed array
+export fn cu_typed_array_adopt(L: *lua.lua_State) c_int {
+    return @intFromBool(typed_array.adopt(L));
+}
+
 pub fn ext_table_set(table_id: u32, key_ptr: [*]const u8, key_len: usize, val_ptr: [*]const u8, val_len: usize) c_int {
     return js_ext_table_set(table_id, key_ptr, key_len, val_ptr, val_len);
 }
@@ -185,48 +411,1067 @@ export fn compute(code_ptr: usize, code_len: usize) i32 {
     }
 
     const L = global_lua_state.?;
+    const scratch_mark = scratch.mark();
+    defer scratch.release(scratch_mark);
+    const status = run_source(L, io_buffer[0..code_len]);
+    return finish_top_level(L, status);
+}
+
+/// Run Lua source or a binary chunk from anywhere in linear memory, such as
+/// a buffer from cu_alloc, so code is not limited to the I/O buffer's 64KB.
+/// The bytes must stay in place until the call returns. Results and errors
+/// are returned as compute() returns them.
+export fn compute_at(code_ptr: usize, code_len: usize) i32 {
+    const L = global_lua_state orelse {
+        const error_msg = "Lua state not initialized";
+        @memcpy(io_buffer[0..error_msg.len], error_msg);
+        return -1;
+    };
+    if (code_len == 0) return 0;
+    const memory_len = @wasmMemorySize(0) * WASM_PAGE_SIZE;
+    if (code_ptr == 0 or code_len > memory_len or code_ptr > memory_len - code_len) return -1;
+
+    const code: [*]const u8 = @ptrFromInt(code_ptr);
+    const scratch_mark = scratch.mark();
+    defer scratch.release(scratch_mark);
+    const status = run_source(L, code[0..code_len]);
+    return finish_top_level(L, status);
+}
+
+const WASM_PAGE_SIZE = 64 * 1024;
+
+// Load and run a source chunk, leaving its results (or error) on the stack.
+// Loaded by length straight from the caller's bytes. A short fixed chunk name
+// keeps Lua from copying the whole source into the chunk's debug info.
+fn run_source(L: *lua.lua_State, code: []const u8) c_int {
+    output_capture.reset_output();
+    error_handler.clear_error_state(L);
+    ext_table.reset_value_cache(L);
+
+    perf.counters.compute_calls +%= 1;
+    const parse_start = perf.now_ms();
+    var status = chunk_cache.load(L, code, COMPUTE_CHUNK_NAME);
+    perf.record(.parse, parse_start);
+    if (status == 0) {
+        prefetch.begin(L);
+        const execute_start = perf.now_ms();
+        budget.begin(L);
+        status = error_handler.pcall(L, 0, lua.c.LUA_MULTRET);
+        budget.end(L);
+        perf.record(.execute, execute_start);
+        prefetch.end(L);
+    }
+    return status;
+}
+
+/// Compile Lua source to a binary chunk without running it. The source is
+/// read from the I/O buffer as compute() reads it, and the chunk lua_dump
+/// writes (without debug info when `strip` is non-zero) replaces it there.
+/// compute() runs such a chunk without parsing; lverify.c checks every binary
+/// chunk as it loads. Returns the chunk length, or an error as compute() does.
+export fn compile(code_ptr: usize, code_len: usize, strip: u32) i32 {
+    _ = code_ptr;
+    if (code_len > IO_BUFFER_SIZE) return -1;
+
+    if (global_lua_state == null) {
+        const error_msg = "Lua state not initialized";
+        @memcpy(io_buffer[0..error_msg.len], error_msg);
+        return -1;
+    }
+
+    const L = global_lua_state.?;
+    error_handler.clear_error_state(L);
+    const mode: [*:0]const u8 = if (chunk_cache.optimizing()) "to" else "t";
+    const status = lua.c.luaL_loadbufferx(L, &io_buffer, code_len, COMPUTE_CHUNK_NAME, mode);
+    if (status != 0) {
+        _ = error_handler.capture_lua_error(L, status);
+        return error_result(&io_buffer);
+    }
+
+    // The function is built, so the source bytes are free to overwrite
+    var writer = ChunkWriter{};
+    _ = lua.c.lua_dump(L, ChunkWriter.write, &writer, @intFromBool(strip != 0));
+    lua.settop(L, 0);
+    if (writer.overflow) {
+        error_handler.override_error(.compilation_error, "compile: chunk exceeds the I/O buffer");
+        return error_result(&io_buffer);
+    }
+    return @intCast(writer.len);
+}
+
+const ChunkWriter = struct {
+    len: usize = 0,
+    overflow: bool = false,
+
+    fn write(_: ?*lua.lua_State, p: ?*const anyopaque, size: usize, ud: ?*anyopaque) callconv(.c) c_int {
+        const self: *ChunkWriter = @ptrCast(@alignCast(ud.?));
+        if (size > IO_BUFFER_SIZE - self.len) {
+            self.overflow = true;
+            return 1;
+        }
+        const bytes: [*]const u8 = @ptrCast(p.?);
+        @memcpy(io_buffer[self.len..][0..size], bytes[0..size]);
+        self.len += size;
+        return 0;
+    }
+};
+
+const CallError = error{MalformedArguments};
 
+// Push the named-function trampoline and decoded arguments, then run it.
+// Everything is pushed before the call, so `args` may alias the output buffer.
+fn run_call(L: *lua.lua_State, name: []const u8, args: []const u8) CallError!c_int {
     output_capture.reset_output();
     error_handler.clear_error_state(L);
+    ext_table.reset_value_cache(L);
 
-    const code_bytes = io_buffer[0..code_len];
+    lua.pushcfunction(L, &invoke_named);
+    _ = lua.pushlstring(L, name.ptr, name.len);
+
+    var offset: usize = 0;
+    var nargs: c_int = 0;
+    while (offset < args.len) : (nargs += 1) {
+        const value_len = serializer.encoded_len(args.ptr + offset, args.len - offset) catch {
+            return argument_error(L);
+        };
+        if (lua.c.lua_checkstack(L, 1) == 0) return argument_error(L);
+        serializer.deserialize_value(L, args.ptr + offset, value_len) catch {
+            return argument_error(L);
+        };
+        offset += value_len;
+    }
 
-    var code_with_null: [IO_BUFFER_SIZE + 1]u8 = undefined;
-    @memcpy(code_with_null[0..code_len], code_bytes);
-    code_with_null[code_len] = 0;
-    const code_cstr: [*:0]u8 = @ptrCast(&code_with_null[0]);
+    perf.counters.function_calls +%= 1;
+    const execute_start = perf.now_ms();
+    budget.begin(L);
+    const status = error_handler.pcall(L, nargs + 1, lua.c.LUA_MULTRET);
+    budget.end(L);
+    perf.record(.execute, execute_start);
+    return status;
+}
 
-    const result = lua.dostring(L, code_cstr);
+fn argument_error(L: *lua.lua_State) CallError {
+    lua.settop(L, 0);
+    error_handler.override_error(.serialization_error, "call: malformed arguments");
+    return CallError.MalformedArguments;
+}
 
-    if (result != 0) {
-        _ = error_handler.capture_lua_error(L, result);
-        const error_len = error_handler.format_error_to_buffer(&io_buffer, IO_BUFFER_SIZE);
-        return -@as(i32, @intCast(error_len + 1));
+/// Write the outcome of a protected call to `out`: the encoded result on
+/// success, or the error message as a negative `-(len + 1)`
+fn finish_invocation(L: *lua.lua_State, status: c_int, out: []u8) i32 {
+    settle_invocation();
+    defer perf.end_invocation();
+    if (status != 0) {
+        _ = error_handler.capture_lua_error(L, status);
+        if (budget.last_violation()) |code| {
+            error_handler.override_error(code, budget.violation_message(code));
+        }
+        return error_result(out);
     }
 
-    const encoded_len = result_encoder.encode_result(L, &io_buffer, IO_BUFFER_SIZE);
+    const encode_start = perf.now_ms();
+    const encoded_len = result_encoder.encode_result(L, out.ptr, out.len);
+    perf.record(.encode, encode_start);
     return @intCast(encoded_len);
 }
 
+// Writes made before an error still land, as they would on the host path
+fn settle_invocation() void {
+    ext_store.flush();
+    output_capture.flush_stream();
+}
+
+// compute and call write their results into the host's result region when
+// it has set one; errors still go to the I/O buffer
+fn finish_top_level(L: *lua.lua_State, status: c_int) i32 {
+    result_region.discard();
+    if (status != 0 or !result_region.active()) return finish_invocation(L, status, &io_buffer);
+    settle_invocation();
+    defer perf.end_invocation();
+    const encode_start = perf.now_ms();
+    defer perf.record(.encode, encode_start);
+    return result_region.encode(L);
+}
+
+fn error_result(out: []u8) i32 {
+    const error_len = error_handler.format_error_to_buffer(out.ptr, out.len);
+    return -@as(i32, @intCast(error_len + 1));
+}
+
+fn io_buffer_slice(ptr: usize, len: usize) ?[]const u8 {
+    const base = @intFromPtr(&io_buffer);
+    if (ptr < base or len > IO_BUFFER_SIZE or ptr - base > IO_BUFFER_SIZE - len) return null;
+    return io_buffer[ptr - base ..][0..len];
+}
+
+/// Call a Lua function by name with pre-serialized arguments, skipping the
+/// parser entirely. `fn_name` is a dotted path resolved from the globals
+/// (e.g. "handler" or "_home.handlers.ping"); a bare name that is not a
+/// global function is also looked up in `_home`. `args` holds zero or more
+/// values in the serializer.zig format, back to back. Both ranges must lie in
+/// the I/O buffer. The result uses the same encoding and error convention as
+/// compute().
+export fn call(fn_name_ptr: usize, fn_name_len: usize, args_ptr: usize, args_len: usize) i32 {
+    const L = global_lua_state orelse {
+        const error_msg = "Lua state not initialized";
+        @memcpy(io_buffer[0..error_msg.len], error_msg);
+        return -1;
+    };
+
+    const name = io_buffer_slice(fn_name_ptr, fn_name_len) orelse return -1;
+    const args = io_buffer_slice(args_ptr, args_len) orelse return -1;
+    if (name.len == 0) return -1;
+
+    const scratch_mark = scratch.mark();
+    defer scratch.release(scratch_mark);
+    const status = run_call(L, name, args) catch return error_result(&io_buffer);
+    return finish_top_level(L, status);
+}
+
+/// Run Lua source as compute() does, on a coroutine that may suspend at
+/// host.await(op, args). A finished or failed chunk reports as compute()
+/// would. A suspended one returns (op, args) as its results, encoded like
+/// any result, and get_await_handle() returns its handle for resume_await.
+export fn compute_async(code_ptr: usize, code_len: usize) i32 {
+    _ = code_ptr;
+    const L = global_lua_state orelse {
+        const error_msg = "Lua state not initialized";
+        @memcpy(io_buffer[0..error_msg.len], error_msg);
+        return -1;
+    };
+    host_await.reset();
+    if (code_len > IO_BUFFER_SIZE) return -1;
+    if (code_len == 0) return 0;
+
+    const scratch_mark = scratch.mark();
+    defer scratch.release(scratch_mark);
+    output_capture.reset_output();
+    error_handler.clear_error_state(L);
+    ext_table.reset_value_cache(L);
+
+    perf.counters.compute_calls +%= 1;
+    const parse_start = perf.now_ms();
+    const status = chunk_cache.load(L, io_buffer[0..code_len], COMPUTE_CHUNK_NAME);
+    perf.record(.parse, parse_start);
+    if (status != 0) return finish_top_level(L, status);
+
+    return resume_chunk(L, host_await.spawn(L), 0);
+}
+
+/// Continue the coroutine suspended as `handle` with the host's answer:
+/// one value in the serializer.zig format at `value_ptr` in the I/O buffer,
+/// which host.await returns, or with `failed` non-zero, an error message
+/// that host.await raises. Returns as compute_async does, or -1 if no
+/// coroutine is suspended under `handle`.
+export fn resume_await(handle: u32, value_ptr: usize, value_len: usize, failed: u32) i32 {
+    const L = global_lua_state orelse return -1;
+    host_await.reset();
+    const value = io_buffer_slice(value_ptr, value_len) orelse return -1;
+
+    const scratch_mark = scratch.mark();
+    defer scratch.release(scratch_mark);
+    output_capture.reset_output();
+    error_handler.clear_error_state(L);
+    ext_table.reset_value_cache(L);
+
+    const thread = host_await.find(L, handle) orelse return -1;
+    lua.pushboolean(L, @intFromBool(failed == 0));
+    if (failed != 0) {
+        _ = lua.pushlstring(L, value.ptr, value.len);
+    } else {
+        const encoded_len = serializer.encoded_len(value.ptr, value.len) catch return resume_value_error(L);
+        serializer.deserialize_value(L, value.ptr, encoded_len) catch return resume_value_error(L);
+    }
+    return resume_chunk(L, thread, 2);
+}
+
+// The coroutine stays suspended, so the host may resume it again
+fn resume_value_error(L: *lua.lua_State) i32 {
+    lua.settop(L, 0);
+    error_handler.override_error(.serialization_error, "resume_await: malformed value");
+    return error_result(&io_buffer);
+}
+
+/// Handle of the coroutine the last compute_async or resume_await left
+/// waiting at host.await, or 0 if the chunk finished or failed
+export fn get_await_handle() u32 {
+    return host_await.pending();
+}
+
+fn resume_chunk(L: *lua.lua_State, thread: host_await.Thread, nargs: c_int) i32 {
+    const execute_start = perf.now_ms();
+    budget.begin(thread.co);
+    const status = host_await.run(L, thread, nargs);
+    budget.end(thread.co);
+    perf.record(.execute, execute_start);
+    return finish_top_level(L, status);
+}
+
+/// Run the sched library's ready tasks (lsched.c) for up to `budget_ms`
+/// milliseconds, or give each task that is ready now one turn when it is 0.
+/// Returns as compute() does. The one result is the milliseconds until the
+/// next timer, 0 if tasks are still ready, or nil if no task will run until
+/// a message is sent (or no script has loaded sched). The tasks' print
+/// output is the result's output, and compute limits apply to the tick.
+export fn sched_tick(budget_ms: f64) i32 {
+    const L = global_lua_state orelse {
+        const error_msg = "Lua state not initialized";
+        @memcpy(io_buffer[0..error_msg.len], error_msg);
+        return -1;
+    };
+
+    const scratch_mark = scratch.mark();
+    defer scratch.release(scratch_mark);
+    output_capture.reset_output();
+    error_handler.clear_error_state(L);
+    ext_table.reset_value_cache(L);
+
+    lua.pushcfunction(L, @as(lua.c.lua_CFunction, @ptrCast(&cu_sched_tick)));
+    lua.pushnumber(L, budget_ms);
+    const execute_start = perf.now_ms();
+    budget.begin(L);
+    const status = error_handler.pcall(L, 1, 1);
+    budget.end(L);
+    perf.record(.execute, execute_start);
+    return finish_top_level(L, status);
+}
+
+const BATCH_ITEM_SOURCE: u8 = 0;
+const BATCH_ITEM_CALL: u8 = 1;
+const BATCH_RESULT_HEADER = 8;
+
+/// Run several scripts and/or named calls in one boundary crossing.
+///
+/// Input (in the I/O buffer, little-endian):
+///   u32 item_count, then per item a u8 kind followed by
+///     kind 0 (source): u32 code_len, code
+///     kind 1 (call):   u32 name_len, name, u32 args_len, args
+/// Output (written to the start of the I/O buffer):
+///   u32 result_count, then per result an i32 status (as returned by
+///   compute()/call()), a u32 payload_len and the payload (encoded result or
+///   error message)
+///
+/// Items run in order against the same state; a failing item does not stop
+/// the batch. Returns the number of results written, which is lower than
+/// item_count if the output buffer filled up, or -1 for a malformed batch.
+export fn compute_batch(batch_ptr: usize, batch_len: usize) i32 {
+    const L = global_lua_state orelse return -1;
+    const batch = io_buffer_slice(batch_ptr, batch_len) orelse return -1;
+    if (batch.len < 4) return -1;
+
+    const scratch_mark = scratch.mark();
+    defer scratch.release(scratch_mark);
+
+    // Running an item reuses the I/O buffer (external table accesses stage
+    // keys and values there), so both the input and the results accumulated
+    // so far live in scratch memory until the batch is done
+    const input_ptr = scratch.alloc(batch.len) orelse return -1;
+    defer scratch.free(input_ptr, batch.len);
+    const input = input_ptr[0..batch.len];
+    @memcpy(input, batch);
+
+    const item_count = std.mem.readInt(u32, input[0..4], .little);
+    if (!validate_batch(input, item_count)) return -1;
+
+    const results_ptr = scratch.alloc(IO_BUFFER_SIZE) orelse return -1;
+    defer scratch.free(results_ptr, IO_BUFFER_SIZE);
+    const results = results_ptr[0..IO_BUFFER_SIZE];
+
+    // Framing was validated above, so the reads below cannot fail
+    var reader = BatchReader{ .bytes = input, .pos = 4 };
+    var out_pos: usize = 4;
+    var written: u32 = 0;
+    while (written < item_count) : (written += 1) {
+        if (IO_BUFFER_SIZE - out_pos < BATCH_RESULT_HEADER) break;
+        const out = results[out_pos + BATCH_RESULT_HEADER ..];
+
+        const item_mark = scratch.mark();
+        defer scratch.release(item_mark);
+        const status: i32 = switch (reader.byte().?) {
+            BATCH_ITEM_SOURCE => blk: {
+                const code = reader.frame().?;
+                if (code.len == 0) break :blk 0;
+                break :blk finish_invocation(L, run_source(L, code), out);
+            },
+            else => blk: {
+                const name = reader.frame().?;
+                const args = reader.frame().?;
+                const call_status = run_call(L, name, args) catch break :blk error_result(out);
+                break :blk finish_invocation(L, call_status, out);
+            },
+        };
+
+        const payload_len: u32 = if (status < 0) @intCast(-(status + 1)) else @intCast(status);
+        std.mem.writeInt(i32, results[out_pos..][0..4], status, .little);
+        std.mem.writeInt(u32, results[out_pos + 4 ..][0..4], payload_len, .little);
+        out_pos += BATCH_RESULT_HEADER + payload_len;
+    }
+
+    std.mem.writeInt(u32, results[0..4], written, .little);
+    @memcpy(io_buffer[0..out_pos], results[0..out_pos]);
+    return @intCast(written);
+}
+
+fn validate_batch(input: []const u8, item_count: u32) bool {
+    var reader = BatchReader{ .bytes = input, .pos = 4 };
+    for (0..item_count) |_| {
+        switch (reader.byte() orelse return false) {
+            BATCH_ITEM_SOURCE => _ = reader.frame() orelse return false,
+            BATCH_ITEM_CALL => {
+                const name = reader.frame() orelse return false;
+                _ = reader.frame() orelse return false;
+                if (name.len == 0) return false;
+            },
+            else => return false,
+        }
+    }
+    return true;
+}
+
+const BatchReader = struct {
+    bytes: []const u8,
+    pos: usize,
+
+    fn byte(self: *BatchReader) ?u8 {
+        if (self.pos >= self.bytes.len) return null;
+        self.pos += 1;
+        return self.bytes[self.pos - 1];
+    }
+
+    // u32 length-prefixed slice
+    fn frame(self: *BatchReader) ?[]const u8 {
+        if (self.bytes.len - self.pos < 4) return null;
+        const len = std.mem.readInt(u32, self.bytes[self.pos..][0..4], .little);
+        self.pos += 4;
+        if (self.bytes.len - self.pos < len) return null;
+        self.pos += len;
+        return self.bytes[self.pos - len .. self.pos];
+    }
+};
+
+// Protected half of call(): stack is [name, args...]. Resolves the function
+// and calls it in place, returning all of its results.
+fn invoke_named(state: ?*lua.lua_State) callconv(.c) c_int {
+    const L = state.?;
+    const nargs = lua.gettop(L) - 1;
+
+    var name_len: usize = 0;
+    const name = lua.tolstring(L, 1, &name_len)[0..name_len];
+
+    _ = lua.getref(L, lua.c.LUA_RIDX_GLOBALS);
+    var segments = std.mem.splitScalar(u8, name, '.');
+    while (segments.next()) |segment| {
+        if (lua.isnil(L, -1)) break;
+        _ = lua.pushlstring(L, segment.ptr, segment.len);
+        _ = lua.c.lua_gettable(L, -2);
+        lua.c.lua_rotate(L, -2, 1); // [parent, value] -> [value, parent]
+        lua.pop(L, 1);
+    }
+
+    if (!lua.isfunction(L, -1) and std.mem.indexOfScalar(u8, name, '.') == null) {
+        lua.pop(L, 1);
+        if (lua.getglobal(L, HOME_TABLE_NAME) != lua.c.LUA_TNIL) {
+            _ = lua.pushlstring(L, name.ptr, name.len);
+            _ = lua.c.lua_gettable(L, -2);
+            lua.c.lua_rotate(L, -2, 1);
+            lua.pop(L, 1);
+        }
+    }
+
+    if (!lua.isfunction(L, -1)) {
+        return lua.c.luaL_error(L, "call: '%s' is not a function", lua.tostring(L, 1));
+    }
+
+    // Replace the name with the function and call it with the arguments
+    lua.c.lua_copy(L, -1, 1);
+    lua.pop(L, 1);
+    lua.c.lua_callk(L, nargs, lua.c.LUA_MULTRET, 0, null);
+    return lua.gettop(L);
+}
+
+/// Number of compute calls whose chunk was served from the cache
+export fn get_chunk_cache_hits() u32 {
+    return chunk_cache.hit_count();
+}
+
+/// Number of compute calls that had to compile their chunk
+export fn get_chunk_cache_misses() u32 {
+    return chunk_cache.miss_count();
+}
+
+export fn clear_chunk_cache() void {
+    if (global_lua_state) |L| chunk_cache.clear(L);
+}
+
+pub const ExtTableBackend = enum(c_int) {
+    host = 0,
+    native = 1,
+};
+
+/// Select where external table entries live. `host` (0) sends every access
+/// to the JS imports. `native` (1) keeps entries in a hash table in linear
+/// memory, up to `max_bytes` of keys and values (0 = default), and writes
+/// changes back to the host when each compute/call finishes. Returns -1 for
+/// an unknown backend.
+export fn set_ext_table_backend(backend: c_int, max_bytes: usize) c_int {
+    switch (backend) {
+        @intFromEnum(ExtTableBackend.host) => ext_store.set_enabled(false),
+        @intFromEnum(ExtTableBackend.native) => {
+            ext_store.set_max_bytes(max_bytes);
+            ext_store.set_enabled(true);
+        },
+        else => return -1,
+    }
+    return 0;
+}
+
+/// Learn which external table keys each compute() chunk reads (the first
+/// 64) and fetch them in one batch per table when the same cached chunk
+/// runs next (see prefetch.zig). `on` = 0 turns learning off and forgets
+/// what was learned. Returns -1 before init().
+export fn set_prefetch_learning(on: u32) c_int {
+    const L = global_lua_state orelse return -1;
+    prefetch.set_enabled(L, on != 0);
+    return 0;
+}
+
+/// Drop natively cached entries, loaded functions and conversion records of
+/// `table_id` (0 = all tables). Hosts call this after writing a table
+/// directly, e.g. setting _io.input.
+export fn invalidate_ext_table(table_id: u32) void {
+    ext_store.invalidate(table_id);
+    key_filter.forget(table_id);
+    if (global_lua_state) |L| {
+        ext_table.invalidate_functions(L, table_id);
+        serializer.forget_conversion(L, table_id);
+    }
+}
+
+/// Write the IDs of external tables Lua still holds a proxy for, as u32s,
+/// after a full collection. Returns the count, or -1 if more than
+/// `max_count` (the host then keeps every table)
+export fn get_live_table_ids(ids_ptr: [*]u32, max_count: usize) c_int {
+    if (global_lua_state == null) return -1;
+    // The tables every state holds (create_state), not only the selected one's
+    const selected = current_state;
+    defer _ = select_state(selected);
+    var count: usize = 0;
+    var handle: u32 = 1;
+    while (handle <= states.highest()) : (handle += 1) {
+        if (states.get(handle) == null) continue;
+        if (select_state(handle) != 0) return -1;
+        const found = ext_table.live_table_ids(global_lua_state.?, ids_ptr[count..max_count]);
+        if (found < 0) return -1;
+        count += @intCast(found);
+    }
+    return @intCast(count);
+}
+
+/// External table reads answered from the native backend
+export fn get_ext_store_hits() u32 {
+    return ext_store.hit_count();
+}
+
+/// External table reads the native backend had to fetch from the host
+export fn get_ext_store_misses() u32 {
+    return ext_store.miss_count();
+}
+
+pub const ExtKeyEncoding = enum(c_int) {
+    decimal = 0,
+    tagged = 1,
+    interned = 2,
+};
+
+/// Select how external table keys reach the host. `decimal` (0, the
+/// default) sends every key as a string, integers in decimal form. `tagged`
+/// (1) prefixes a type byte and sends integers as i64. `interned` (2) is
+/// `tagged` plus small handles for string keys registered through
+/// js_ext_key_intern (see serializer.encode_key). Pending native writes are
+/// flushed in the old format first. Returns -1 for an unknown encoding.
+export fn set_ext_key_encoding(encoding: c_int) c_int {
+    const selected: serializer.KeyEncoding = switch (encoding) {
+        @intFromEnum(ExtKeyEncoding.decimal) => .decimal,
+        @intFromEnum(ExtKeyEncoding.tagged) => .tagged,
+        @intFromEnum(ExtKeyEncoding.interned) => .interned,
+        else => return -1,
+    };
+    ext_store.flush();
+    ext_store.invalidate(0);
+    serializer.set_key_encoding(selected);
+    return 0;
+}
+
+pub const ValueEncoding = enum(c_int) {
+    v1 = 0,
+    v2 = 1,
+};
+
+/// Select the format values are written in for external tables and
+/// compute/call results. `v1` (0, the default) is the fixed-width format;
+/// `v2` (1) uses varints and inline small integers and short strings (see
+/// serializer.ValueEncoding). Both are always read, so values already stored
+/// stay valid. Returns -1 for an unknown encoding.
+export fn set_value_encoding(encoding: c_int) c_int {
+    const selected: serializer.ValueEncoding = switch (encoding) {
+        @intFromEnum(ValueEncoding.v1) => .v1,
+        @intFromEnum(ValueEncoding.v2) => .v2,
+        else => return -1,
+    };
+    serializer.set_value_encoding(selected);
+    return 0;
+}
+
+/// Cap on entries of a Lua table converted to an external table (0 restores
+/// the default of 10000). Storing a larger table fails with TableTooLarge.
+export fn set_max_table_entries(entries: u32) void {
+    serializer.set_max_table_entries(entries);
+}
+
+/// Store nested tables of up to `max_entries` entries and `max_bytes`
+/// encoded bytes (at most 4096) by value in their parent's entry instead of
+/// as external tables; 0 for either turns this off (the default). An inlined
+/// table reads back as a plain Lua table, so writes to it are not stored
+/// until it is assigned to a field again.
+export fn set_inline_table_limits(max_entries: u32, max_bytes: u32) void {
+    serializer.set_inline_table_limits(max_entries, max_bytes);
+}
+
+/// Keep debug info (line numbers, local names) in the bytecode of functions
+/// stored in external tables when `enabled` is non-zero. Off by default, so
+/// stored functions are about a third smaller but report errors without a
+/// line. Only affects functions stored from now on. Returns the previous
+/// setting.
+export fn set_function_debug_info(enabled: u32) u32 {
+    return @intFromBool(function_serializer.set_debug_info(enabled != 0));
+}
+
+/// Run the bytecode optimizer (luaK_optimize in lcode.c) over the sources
+/// compute() and compile() load from now on when `enabled` is non-zero, as
+/// load() does for mode "o". Off by default. Cached chunks are dropped when
+/// the setting changes. Returns the previous setting.
+export fn set_bytecode_optimizer(enabled: u32) u32 {
+    return @intFromBool(chunk_cache.set_optimize(enabled != 0));
+}
+
+/// Element kinds this build reads as packed typed array values (tag 0x0F),
+/// as a bitmask of kind bytes: bit 1 u8, bit 2 i64, bit 3 f64. Hosts should
+/// only send typed arrays when this is nonzero.
+export fn get_typed_array_kinds() u32 {
+    return typed_array.supported_kinds();
+}
+
+/// Limits applied to every subsequent compute call: `max_bytes` of net heap
+/// growth and `max_instructions` VM instructions (0 disables either). A call
+/// that hits a limit fails with memory_limit_exceeded (-4) or
+/// instruction_limit_exceeded (-5), readable via get_last_error_code().
+export fn set_compute_limits(max_bytes: usize, max_instructions: u32) void {
+    budget.set_limits(max_bytes, max_instructions);
+}
+
+/// While enabled (nonzero), compute and call ask the host whether to stop
+/// every 1000 VM instructions by calling js_interrupt_requested(). A call the
+/// host interrupts fails with interrupted (-6).
+export fn set_interrupt_polling(enabled: u32) void {
+    budget.set_interrupt_polling(enabled != 0);
+}
+
+/// Address of the interrupt word. Storing a nonzero i32 there stops the
+/// running compute or call at its next loop back-edge or function call (or
+/// the next call to start, if none is running) with interrupted (-6); the
+/// word is cleared as that call returns. Unlike set_interrupt_polling it
+/// costs the VM one load per check and no host calls.
+export fn get_interrupt_flag_ptr() usize {
+    return budget.interrupt_flag_ptr();
+}
+
+/// While `chunk_bytes` is nonzero, print output is not captured into the
+/// result (where it stops at about 63KB, followed by "..."). It goes to the
+/// js_write_output import each time `chunk_bytes` bytes are buffered (capped
+/// at the capture buffer) and once more before compute, call or a batch item
+/// returns, including when it fails, and the result's output section is
+/// empty. 0 captures again. Returns the previous chunk size.
+export fn set_output_streaming(chunk_bytes: u32) u32 {
+    return @intCast(output_capture.set_streaming(chunk_bytes));
+}
+
+/// Allocate `len` bytes of linear memory for the host, such as a result
+/// region. Returns the address, or 0 if the heap is exhausted.
+export fn cu_alloc(len: usize) usize {
+    return @intFromPtr(lua_malloc(len));
+}
+
+/// Free memory from cu_alloc. Unregister it first if it is the result region.
+export fn cu_free(ptr: usize) void {
+    lua_free(@ptrFromInt(ptr));
+}
+
+/// Encode the results of later compute and call invocations into `len`
+/// bytes at `ptr` (from cu_alloc) instead of the I/O buffer, where strings
+/// that do not fit are cut; 0 for `len` goes back to the I/O buffer. When
+/// the results need more than `len` bytes, the call returns that larger
+/// size and parks them until take_result() or the next invocation. Error
+/// messages are still written to the I/O buffer.
+export fn set_result_region(ptr: usize, len: usize) void {
+    if (ptr == 0 or len == 0) return result_region.set(null);
+    const base: [*]u8 = @ptrFromInt(ptr);
+    result_region.set(base[0..len]);
+}
+
+/// Copy a parked result into the result region, which the host has grown
+/// to at least its size. Returns its length, or -1 if none is parked or it
+/// still does not fit.
+export fn take_result() i32 {
+    return result_region.take();
+}
+
+/// ErrorCode of the last compute call (0 on success). If the instance trapped
+/// inside compute, reports the budget that was exhausted, if any.
+export fn get_last_error_code() c_int {
+    if (budget.is_active()) {
+        if (budget.last_violation()) |code| return @intFromEnum(code);
+    }
+    return @intFromEnum(error_handler.get_last_error_code());
+}
+
+/// Write the last error of a compute, call or sched_tick (or of the chunk a
+/// compute_async ran) to the start of the I/O buffer as a structured frame:
+/// its ErrorCode, the chunk and line it was raised at, the message, and the
+/// traceback if set_error_traceback was on when it happened (see
+/// error.zig's write_frame for the layout). Returns the frame length, or 0
+/// if the last call succeeded.
+export fn get_last_error_frame() i32 {
+    const L = global_lua_state orelse return 0;
+    return @intCast(error_handler.write_frame(L, &io_buffer));
+}
+
+/// Keep a luaL_traceback of each failing call's stack for
+/// get_last_error_frame (nonzero), or stop (0, the default). A traceback
+/// has to be taken before the error unwinds the stack, so this is set
+/// ahead of the calls whose errors need one; off, an error pays only for a
+/// lookup of where it was raised.
+export fn set_error_traceback(enabled: u32) void {
+    error_handler.set_traceback_enabled(enabled != 0);
+}
+
+/// Serve the Zig side's per-invocation buffers (table conversion batches,
+/// compute_batch's input and results) from a bump arena of `chunk_bytes`
+/// chunks that is reset when each compute, call or batch item returns;
+/// 0 turns it off and returns its chunks to the heap. Lua values are always
+/// allocated by the collector. Call between invocations only. Returns the
+/// previous chunk size (0 if it was off).
+export fn set_scratch_arena(chunk_bytes: u32) u32 {
+    return @intCast(scratch.configure(chunk_bytes));
+}
+
+/// Size the string table that interns short strings (identifiers, table
+/// keys, ext_table keys pushed as strings) for `slots` entries, rounded up
+/// to a power of two and at most 1 << 20, so key-heavy states skip the
+/// doubling rehashes from Lua's 128 slots. The collector no longer shrinks
+/// the table below it. Applies now if the VM is running and to every later
+/// init; 0 restores the default.
+export fn set_string_table_size(slots: u32) void {
+    string_table_slots = @intCast(@min(slots, MAX_STRING_TABLE_SLOTS));
+    if (global_lua_state) |L| luaS_presize(L, string_table_slots);
+}
+
+const MAX_STRING_TABLE_SLOTS = 1 << 20;
+
+/// Choose the standard libraries init and create_state open: bit 0
+/// coroutine, 1 table, 2 io, 3 os, 4 string, 5 math, 6 utf8, 7 debug. Base
+/// and package are always opened. Libraries also set in `lazy` are opened on
+/// their first global access or require, through an __index on _G, so a
+/// state that never touches them does not pay for their tables and names.
+/// string is never lazy. Applies to every later init; (0xFF, 0) restores
+/// the default.
+export fn set_stdlibs(open: u32, lazy: u32) void {
+    stdlibs_open = open & ALL_STDLIBS;
+    stdlibs_lazy = lazy & ALL_STDLIBS;
+}
+
+const ALL_STDLIBS: c_uint = 0xFF;
+
+/// For linit.c: a lazily opened library's C functions can now be stored
+export fn cu_stdlib_opened(L: *lua.lua_State) void {
+    function_serializer.init_c_function_registry(L);
+}
+
+/// Deterministic mode for replaying message logs: with `enabled` nonzero the
+/// next init seeds string hashing and math.random from `seed`, and os.time,
+/// os.clock and sched timers read the virtual clock (set_virtual_clock)
+/// instead of the host's. The same init and the same invocations then give
+/// bit-identical results. Call before init; returns -1 if the VM is
+/// already running.
+export fn set_deterministic(enabled: u32, seed: u32) i32 {
+    if (global_lua_state != null) return -1;
+    deterministic.configure(enabled != 0, seed);
+    return 0;
+}
+
+/// Set the virtual clock deterministic mode reads, in milliseconds since the
+/// epoch; hosts set it before each invocation and log it with the message
+export fn set_virtual_clock(now_ms: f64) void {
+    deterministic.set_time(now_ms);
+}
+
+/// Bring the heap back to its live extent after a spike, before a snapshot
+/// or checkpoint: run a full collection, return the scratch arena's idle
+/// chunks, then merge the allocator's free blocks and lower its top past
+/// free space (lua_heap_trim). Linear memory cannot shrink, so freed space
+/// is zeroed instead, and page-diffed snapshots leave it out. Call between
+/// invocations. Returns the bytes trimmed off the top of the heap.
+export fn trim_heap() usize {
+    if (global_lua_state) |L| lua.gc_collect(L);
+    scratch.drop_idle();
+    return lua_heap_trim();
+}
+
+pub const StringTableStats = extern struct {
+    /// Slots, a power of two
+    size: u32,
+    /// Interned short strings
+    count: u32,
+    /// Slots holding at least one string
+    used_buckets: u32,
+    longest_chain: u32,
+};
+
+// u32 fields, so the host reads the same layout from the wasm64 build
 pub const MemoryStats = extern struct {
-    io_buffer_size: usize,
-    lua_memory_used: usize,
-    wasm_pages: usize,
+    io_buffer_size: u32,
+    /// Live bytes held by the Lua state (LUA_GCCOUNT / LUA_GCCOUNTB)
+    lua_memory_used: u32,
+    wasm_pages: u32,
+    allocator: alloc_stats.AllocatorStats,
+    strings: StringTableStats,
 };
 
 export fn get_memory_stats(stats_ptr: *MemoryStats) void {
     stats_ptr.*.io_buffer_size = IO_BUFFER_SIZE;
-    stats_ptr.*.lua_memory_used = lua_memory_used;
-    stats_ptr.*.wasm_pages = (TOTAL_MEMORY + 65535) / 65536;
+    stats_ptr.*.lua_memory_used = if (global_lua_state) |L| alloc_stats.clamp(lua.gc_count_bytes(L)) else 0;
+    stats_ptr.*.wasm_pages = @intCast(@wasmMemorySize(0));
+    lua_allocator_stats(&stats_ptr.*.allocator);
+    stats_ptr.*.strings = std.mem.zeroes(StringTableStats);
+    if (global_lua_state) |L| {
+        var size: c_int = 0;
+        var count: c_int = 0;
+        var buckets: c_int = 0;
+        var longest: c_int = 0;
+        luaS_tablestats(L, &size, &count, &buckets, &longest);
+        stats_ptr.*.strings = .{
+            .size = @intCast(size),
+            .count = @intCast(count),
+            .used_buckets = @intCast(buckets),
+            .longest_chain = @intCast(longest),
+        };
+    }
+}
+
+pub const GcMode = enum(c_int) {
+    collect = 0,
+    step = 1,
+    generational = 2,
+    incremental = 3,
+};
+
+/// Drive the Lua collector.
+///   collect (0): full collection; returns 0
+///   step (1): incremental step of `arg` KB (0 = one basic step); returns 1 if
+///             the step finished a cycle, 0 otherwise
+///   generational (2) / incremental (3): switch collector mode; returns the
+///             previous mode as a GcMode value
+/// Returns -1 if the VM is not initialized or the mode is unknown.
+export fn run_gc(mode: c_int, arg: c_int) c_int {
+    const L = global_lua_state orelse return -1;
+
+    switch (mode) {
+        @intFromEnum(GcMode.collect) => {
+            lua.gc_collect(L);
+            return 0;
+        },
+        @intFromEnum(GcMode.step) => return @intFromBool(lua.gc_step(L, @max(arg, 0))),
+        @intFromEnum(GcMode.generational), @intFromEnum(GcMode.incremental) => return set_gc_mode(mode, 0, 0),
+        else => return -1,
+    }
+}
+
+/// Switch the collector to generational (2) or incremental (3) mode and set
+/// its parameters, as percentages; 0 keeps a parameter's current value.
+///   generational: p1 minor multiplier (growth that triggers a minor
+///                 collection, default 20, at most 200), p2 major multiplier
+///                 (growth since the last major collection that triggers
+///                 another, default 100, at most 1000)
+///   incremental:  p1 pause (growth before a new cycle starts, default 200),
+///                 p2 step multiplier (work per allocated KB, default 100),
+///                 each at most 1000
+/// The VM starts in generational mode with the defaults. Returns the
+/// previous mode as a GcMode value, or -1 if the VM is not initialized or
+/// the mode is not one of the two.
+export fn set_gc_mode(mode: c_int, p1: c_int, p2: c_int) c_int {
+    const L = global_lua_state orelse return -1;
+    const max_p1: c_int = if (mode == @intFromEnum(GcMode.generational)) 200 else 1000;
+    const a = std.math.clamp(p1, 0, max_p1);
+    const b = std.math.clamp(p2, 0, 1000);
+
+    switch (mode) {
+        @intFromEnum(GcMode.generational) => return previous_gc_mode(lua.gc_generational(L, a, b)),
+        @intFromEnum(GcMode.incremental) => return previous_gc_mode(lua.gc_incremental(L, a, b)),
+        else => return -1,
+    }
+}
+
+fn previous_gc_mode(lua_mode: c_int) c_int {
+    return @intFromEnum(if (lua_mode == lua.c.LUA_GCGEN) GcMode.generational else GcMode.incremental);
+}
+
+/// Write collector pause statistics (gc_stats.GcStats: total and longest
+/// pause in ms, pause and full-collection counts, then a histogram of pause
+/// lengths) to `stats_ptr`; nonzero `reset` starts the counts over after
+/// reading them
+export fn get_gc_stats(stats_ptr: *gc_stats.GcStats, reset: u32) void {
+    gc_stats.read(stats_ptr);
+    if (reset != 0) gc_stats.reset();
+}
+
+// For lgc.c, through luai_gcpausebegin / luai_gcpauseend in luaconf.h
+export fn cu_gc_pause_begin() void {
+    gc_stats.pause_begin();
+}
+
+export fn cu_gc_pause_end(kind: c_int) void {
+    gc_stats.pause_end(@enumFromInt(kind));
+    perf.counters.gc_steps +%= 1;
+}
+
+/// Write the hot-path counters (perf_counters.PerfCounters: parse, execute
+/// and encode time in ms, then u64 counts of compute and call invocations,
+/// external table reads and writes, values serialized, functions loaded,
+/// allocator requests and GC steps, with byte totals, then a latency
+/// histogram per phase) to `counters_ptr`; nonzero `reset` starts them over
+/// after reading
+export fn get_perf_counters(counters_ptr: *perf.PerfCounters, reset: u32) void {
+    perf.read(counters_ptr);
+    if (reset != 0) perf.reset();
+}
+
+/// Start the sampling profiler (profiler.zig): from the next compute() or
+/// call() on, record the Lua stack every `period` instructions. Drops any
+/// earlier profile. Returns 0, or -1 if the VM is not initialized or the
+/// sample tables could not be allocated.
+export fn profile_start(period: u32) i32 {
+    if (global_lua_state == null) return -1;
+    return if (profiler.start(period)) 0 else -1;
+}
+
+/// Stop sampling. Returns the length of the folded stacks profile_read()
+/// will write, 0 if nothing was sampled.
+export fn profile_stop() i32 {
+    profiler.stop();
+    return @intCast(profiler.folded_len());
 }
 
-export fn run_gc() void {}
+/// Write the folded stacks of the stopped profile ("root;...;leaf count"
+/// lines) to `out_ptr` and free them. Returns their length, or -1 if the
+/// profile is still running or does not fit in `max_len` (it is kept).
+export fn profile_read(out_ptr: [*]u8, max_len: usize) i32 {
+    if (profiler.is_running()) return -1;
+    const len = profiler.folded_len();
+    if (len > max_len) return -1;
+    return @intCast(profiler.take_folded(out_ptr[0..len]));
+}
+
+// src/lua/lcensus.c; the layouts are CuHeapCensus and CuAllocProfile in
+// src/lua/lcensus.h
+extern fn cu_heap_census(L: *lua.lua_State, out: *anyopaque) void;
+extern fn cu_alloc_profile(out: *anyopaque, reset: c_int) c_int;
+
+/// Count every object on the Lua heap by kind (short and long strings,
+/// tables, Lua and C closures, userdata, bigints, decimals, prototypes,
+/// upvalues and threads) with the bytes each kind holds, including the
+/// arrays a table, prototype or thread owns, into `out_ptr` (u32 total
+/// bytes and object bytes, then a u32 count and bytes per kind). Garbage
+/// not yet collected is counted too; run_gc first to see live objects
+/// only. Returns 0, or -1 if the VM is not initialized.
+export fn get_heap_census(out_ptr: *anyopaque) i32 {
+    const L = global_lua_state orelse return -1;
+    cu_heap_census(L, out_ptr);
+    return 0;
+}
+
+/// Write the allocation profile (u64 allocations and bytes allocated, then
+/// i64 live objects and live bytes, for each of other, string, table,
+/// function, userdata, thread, upvalue and proto) to `out_ptr`; nonzero
+/// `reset` starts the allocation figures over after reading. Returns 0, or
+/// -1 if the module was built without CU_ALLOC_PROFILE=1.
+export fn get_alloc_profile(out_ptr: *anyopaque, reset: u32) i32 {
+    return cu_alloc_profile(out_ptr, @intFromBool(reset != 0));
+}
+
+// src/lua/ltier.c; the layout indices are the CU_TIER_* constants in
+// src/lua/ltier.h
+extern fn cu_tier_configure(threshold: c_int) c_int;
+extern fn cu_tier_layout(out: [*]c_int, max: c_int) c_int;
+
+/// Offer a Lua function to the host for compiling (js_tier_compile) once it
+/// has been called `threshold` times; 0 stops offering new ones, while
+/// functions already compiled keep running compiled. Returns 0, or -1 if
+/// the module was built without CU_TIER=1.
+export fn set_tier_threshold(threshold: u32) i32 {
+    return cu_tier_configure(@intCast(@min(threshold, std.math.maxInt(c_int))));
+}
+
+/// Write the i32 fields the host's compiler reads (Proto and TValue
+/// offsets and sizes, type tags) and then the function table index of each
+/// compiled-code slot into `out_ptr`. Returns how many i32s it wrote, or -1
+/// if `max` is too small or the module was built without CU_TIER=1.
+export fn get_tier_layout(out_ptr: [*]i32, max: u32) i32 {
+    return cu_tier_layout(out_ptr, @intCast(@min(max, std.math.maxInt(c_int))));
+}
+
+// Where the last idle_gc that caught up left the collector
+var idle_caught_up: bool = false;
+var idle_pauses: u32 = 0;
+var idle_bytes: usize = 0;
+
+/// Do collector work between calls, so less of it lands inside compute().
+/// In incremental mode this takes basic steps until the cycle finishes or
+/// `budget_us` microseconds have passed, but does not start a new cycle the
+/// collector itself has not started since. In generational mode it runs one
+/// minor (or, when due, major) collection if the heap grew since the last
+/// one. Returns 1 when the collector has caught up, 0 when the budget ran
+/// out first (call again when idle), or -1 if the VM is not initialized.
+export fn idle_gc(budget_us: u32) c_int {
+    const L = global_lua_state orelse return -1;
+    if (idle_caught_up and gc_stats.pause_count() == idle_pauses) {
+        if (!gc_stats.last_step_generational() or lua.gc_count_bytes(L) <= idle_bytes) return 1;
+    }
+
+    const start_ms = gc_stats.now_ms();
+    const budget_ms = @as(f64, @floatFromInt(budget_us)) / 1000;
+    while (true) {
+        const pauses = gc_stats.pause_count();
+        const finished = lua.gc_step(L, 0);
+        // A stopped collector does no work; a generational step does it all
+        if (finished or gc_stats.pause_count() == pauses or gc_stats.last_step_generational()) break;
+        if (gc_stats.now_ms() - start_ms >= budget_ms) {
+            idle_caught_up = false;
+            return 0;
+        }
+    }
+    idle_caught_up = true;
+    idle_pauses = gc_stats.pause_count();
+    idle_bytes = lua.gc_count_bytes(L);
+    return 1;
+}
 
 export fn attach_memory_table(table_id: u32) void {
     if (global_lua_state == null) return;
     if (table_id == 0) return;
 
     const L = global_lua_state.?;
+    // The host restored this table's contents behind our back
+    ext_store.invalidate(table_id);
+    serializer.forget_conversion(L, table_id);
     ext_table.attach_table(L, table_id);
     // Set primary _home global
     lua.pushvalue(L, -1); // Duplicate table reference
@@ -261,6 +1506,7 @@ export fn clear_io_table() void {
     lua.pushnil(L);
     lua.setfield(L, -2, "meta");
     lua.pop(L, 1);
+    ext_store.flush();
 }
 
 export fn sync_external_table_counter(next_id: u32) void {
@@ -278,7 +1524,10 @@ pub fn main() void {
 // Explicitly call all exported functions in start to prevent optimizer removal
 pub fn _start_lua() void {
     _ = init;
+    _ = init_with_limits;
     _ = compute;
+    _ = call;
+    _ = compute_batch;
     _ = get_buffer_ptr;
     _ = get_buffer_size;
     _ = get_memory_stats;
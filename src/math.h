@@ -33,6 +33,29 @@ extern double modf(double x, double *ipart);
 extern double ldexp(double x, int exp);
 extern double frexp(double x, int *exp);
 
+/* float versions, used by the LUA_32BITS build */
+extern float sinf(float x);
+extern float cosf(float x);
+extern float tanf(float x);
+extern float asinf(float x);
+extern float acosf(float x);
+extern float atan2f(float y, float x);
+
+extern float sqrtf(float x);
+extern float powf(float x, float y);
+extern float expf(float x);
+extern float logf(float x);
+extern float log10f(float x);
+extern float log2f(float x);
+
+extern float floorf(float x);
+extern float ceilf(float x);
+extern float fabsf(float x);
+extern float fmodf(float x, float y);
+
+extern float ldexpf(float x, int exp);
+extern float frexpf(float x, int *exp);
+
 #define M_E        2.7182818284590452354
 #define M_LOG2E    1.4426950408889634074
 #define M_LOG10E   0.43429448190325182765
@@ -1,5 +1,6 @@
 const std = @import("std");
 const lua = @import("lua.zig");
+const strbuf = @import("strbuf.zig");
 
 const IO_BUFFER_SIZE = 64 * 1024;
 const OUTPUT_BUFFER_MAX = IO_BUFFER_SIZE - 1024;
@@ -9,6 +10,14 @@ var output_buffer: [OUTPUT_BUFFER_MAX]u8 = undefined;
 var output_len: usize = 0;
 var output_overflow: bool = false;
 
+// Streaming mode: instead of capping print output at OUTPUT_BUFFER_MAX and
+// copying it into the result, hand it to the host through js_write_output
+// each time `stream_chunk` bytes are buffered, and once more as the call
+// returns. Output is then unbounded and the result's output section empty.
+extern fn js_write_output(ptr: [*]const u8, len: usize) void;
+
+var stream_chunk: usize = 0;
+
 pub fn init_output_capture() void {
     output_len = 0;
     output_overflow = false;
@@ -19,7 +28,41 @@ pub fn reset_output() void {
     output_overflow = false;
 }
 
+/// Stream output in chunks of `chunk_bytes` (at most the capture buffer);
+/// 0 goes back to capturing it into the result. Returns the previous size.
+pub fn set_streaming(chunk_bytes: usize) usize {
+    const previous = stream_chunk;
+    flush_stream();
+    stream_chunk = @min(chunk_bytes, OUTPUT_BUFFER_MAX);
+    return previous;
+}
+
+/// Hand buffered output to the host when streaming; a no-op otherwise
+pub fn flush_stream() void {
+    if (stream_chunk == 0 or output_len == 0) return;
+    js_write_output(&output_buffer, output_len);
+    output_len = 0;
+}
+
+fn stream_output(data: []const u8) void {
+    // A write that would fill the buffer on its own goes out in place
+    if (data.len >= stream_chunk) {
+        flush_stream();
+        js_write_output(data.ptr, data.len);
+        return;
+    }
+    if (data.len > OUTPUT_BUFFER_MAX - output_len) flush_stream();
+    @memcpy(output_buffer[output_len .. output_len + data.len], data);
+    output_len += data.len;
+    if (output_len >= stream_chunk) flush_stream();
+}
+
 pub fn push_output(data: []const u8) bool {
+    if (stream_chunk != 0) {
+        stream_output(data);
+        return true;
+    }
+
     if (output_overflow) {
         return false;
     }
@@ -75,50 +118,105 @@ pub fn flush_output_to_buffer(buffer: [*]u8, offset: usize, max_len: usize) usiz
     return total;
 }
 
-pub fn custom_print(L: *lua.lua_State) c_int {
-    const argc = lua.gettop(L);
+// cu_number2str in libc-stubs.zig, which lua_number2str uses too
+extern fn cu_number2str(buf: [*]u8, size: usize, n: f64) c_int;
 
-    for (0..@intCast(argc)) |i| {
-        if (i > 0) {
-            _ = push_output("\t");
-        }
+const PRINT_BUFFER_SIZE = 1024;
+const MAX_NUMBER_LEN = 48;
+
+// One print() call is assembled here and handed to push_output in one
+// piece; only an argument longer than the whole buffer goes on its own.
+const PrintBuffer = struct {
+    bytes: [PRINT_BUFFER_SIZE]u8 = undefined,
+    len: usize = 0,
 
-        if (lua.isstring(L, @intCast(i + 1))) {
-            var str_len: usize = 0;
-            const str = lua.tolstring(L, @intCast(i + 1), &str_len);
-            _ = push_output(str[0..str_len]);
-        } else if (lua.isnumber(L, @intCast(i + 1))) {
-            var buf: [64]u8 = undefined;
-            const num = lua.tonumber(L, @intCast(i + 1));
-            const int_val = lua.tointeger(L, @intCast(i + 1));
-
-            if (@as(f64, @floatFromInt(int_val)) == num) {
-                const fmt_result = std.fmt.bufPrint(&buf, "{d}", .{int_val}) catch "";
-                _ = push_output(fmt_result);
-            } else {
-                const fmt_result = std.fmt.bufPrint(&buf, "{d}", .{num}) catch "";
-                _ = push_output(fmt_result);
+    fn add(self: *PrintBuffer, data: []const u8) void {
+        if (data.len > self.bytes.len - self.len) {
+            self.flush();
+            if (data.len >= self.bytes.len) {
+                _ = push_output(data);
+                return;
             }
-        } else if (lua.isboolean(L, @intCast(i + 1))) {
-            const val = lua.toboolean(L, @intCast(i + 1));
-            const str = if (val) "true" else "false";
-            _ = push_output(str);
-        } else if (lua.isnil(L, @intCast(i + 1))) {
-            _ = push_output("nil");
+        }
+        @memcpy(self.bytes[self.len..][0..data.len], data);
+        self.len += data.len;
+    }
+
+    // Integers as string.format("%d") writes them. An integral float prints
+    // as the integer it holds; other floats as tostring writes them.
+    fn add_number(self: *PrintBuffer, L: *lua.lua_State, index: c_int) void {
+        if (self.bytes.len - self.len < MAX_NUMBER_LEN) self.flush();
+        const out = self.bytes[self.len..];
+
+        var is_int: c_int = 0;
+        const int_val = lua.c.lua_tointegerx(L, index, &is_int);
+        if (is_int != 0) {
+            self.len += write_int(out, int_val);
         } else {
-            const type_name = lua.type_name(L, @intCast(i + 1));
-            var i_type: usize = 0;
-            while (i_type < 32 and type_name[i_type] != 0) : (i_type += 1) {
-                var buf: [32]u8 = undefined;
-                buf[i_type] = type_name[i_type];
-            }
-            if (i_type > 0) {
-                _ = push_output(type_name[0..i_type]);
-            }
+            self.len += @intCast(cu_number2str(out.ptr, MAX_NUMBER_LEN, lua.tonumber(L, index)));
+        }
+    }
+
+    fn flush(self: *PrintBuffer) void {
+        if (self.len == 0) return;
+        _ = push_output(self.bytes[0..self.len]);
+        self.len = 0;
+    }
+};
+
+fn write_int(out: []u8, value: i64) usize {
+    var digits: [20]u8 = undefined;
+    var n: usize = 0;
+    var magnitude: u64 = @abs(value);
+    while (true) {
+        digits[n] = '0' + @as(u8, @intCast(magnitude % 10));
+        n += 1;
+        magnitude /= 10;
+        if (magnitude == 0) break;
+    }
+
+    var len: usize = 0;
+    if (value < 0) {
+        out[0] = '-';
+        len = 1;
+    }
+    while (n > 0) {
+        n -= 1;
+        out[len] = digits[n];
+        len += 1;
+    }
+    return len;
+}
+
+pub fn custom_print(L: *lua.lua_State) c_int {
+    const argc = lua.gettop(L);
+    var out = PrintBuffer{};
+
+    var i: c_int = 1;
+    while (i <= argc) : (i += 1) {
+        if (i > 1) out.add("\t");
+
+        switch (lua.c.lua_type(L, i)) {
+            lua.c.LUA_TSTRING => {
+                var str_len: usize = 0;
+                const str = lua.tolstring(L, i, &str_len);
+                out.add(str[0..str_len]);
+            },
+            lua.c.LUA_TNUMBER => out.add_number(L, i),
+            lua.c.LUA_TBOOLEAN => out.add(if (lua.toboolean(L, i)) "true" else "false"),
+            lua.c.LUA_TNIL => out.add("nil"),
+            else => {
+                if (strbuf.bytes(L, i)) |bytes| {
+                    out.add(bytes);
+                } else {
+                    out.add(std.mem.span(lua.type_name(L, i)));
+                }
+            },
         }
     }
 
-    _ = push_output("\n");
+    out.add("\n");
+    out.flush();
     return 0;
 }
 
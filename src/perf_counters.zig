@@ -0,0 +1,132 @@
+const std = @import("std");
+
+// Hot-path counters, read by get_perf_counters for hosts that scrape them.
+//
+// Each one is a plain increment where the work happens: compute/call in
+// main.zig (which also times parsing, through the chunk cache, and running
+// with the host's monotonic clock), ext_table.zig's index and newindex
+// handlers, serializer.serialize_value and function_serializer's loaders.
+// GC steps are counted as gc_stats times them. The allocator lives in
+// libc-stubs.zig, a separate object, which keeps its own totals; they are
+// read with the counters, relative to where they stood at the last reset.
+//
+// Each invocation's parse, execute and result encode times, and their sum,
+// also go into a latency histogram per phase, so hosts can read p50/p99
+// without timing calls themselves. Buckets are log-linear as in HDR
+// histograms: bucket 0 counts times under 1us, then each power of two from
+// 1us is split into LATENCY_SUB_BUCKETS equal buckets, so a bucket's bounds
+// are within 25% of each other; the last bucket holds everything from
+// 2^LATENCY_MAX_EXPONENT us (about 67s) up.
+
+pub const LATENCY_SUB_BUCKETS = 4;
+pub const LATENCY_MAX_EXPONENT = 26;
+pub const LATENCY_BUCKETS = 1 + LATENCY_MAX_EXPONENT * LATENCY_SUB_BUCKETS + 1;
+
+pub const Phase = enum(u2) {
+    parse = 0,
+    execute = 1,
+    encode = 2,
+    /// The three together, per invocation
+    total = 3,
+};
+
+pub const PerfCounters = extern struct {
+    /// Time spent loading chunks, including chunk cache hits
+    parse_ms: f64,
+    /// Time spent running chunks and call() targets
+    execute_ms: f64,
+    /// Time spent encoding results
+    encode_ms: f64,
+    /// compute(), compute_at() and compute_batch() items
+    compute_calls: u64,
+    /// call()
+    function_calls: u64,
+    /// Reads of external table fields from Lua, and the encoded bytes of the
+    /// values that were not already loaded
+    ext_gets: u64,
+    ext_get_bytes: u64,
+    /// Writes of external table fields from Lua, and the encoded bytes of
+    /// the values written
+    ext_sets: u64,
+    ext_set_bytes: u64,
+    /// Values encoded for an external table, and their encoded bytes
+    serialize_calls: u64,
+    serialize_bytes: u64,
+    /// Functions rebuilt from bytecode or closure values
+    function_loads: u64,
+    /// Allocator requests (malloc, realloc and calloc) and bytes requested
+    alloc_calls: u64,
+    alloc_bytes: u64,
+    /// Collector steps and collections (gc_stats pauses)
+    gc_steps: u64,
+    /// Invocations by time taken, per Phase
+    latency: [4][LATENCY_BUCKETS]u32,
+};
+
+extern fn js_clock_ms() f64;
+extern fn lua_allocator_totals(calls: *u64, bytes: *u64) void;
+
+pub var counters: PerfCounters = std.mem.zeroes(PerfCounters);
+
+// Where the allocator totals stood at the last reset
+var alloc_calls_base: u64 = 0;
+var alloc_bytes_base: u64 = 0;
+// Phases timed so far in the running invocation
+var invocation_ms: f64 = 0;
+
+pub fn now_ms() f64 {
+    return js_clock_ms();
+}
+
+pub fn since_ms(start: f64) f64 {
+    return @max(js_clock_ms() - start, 0);
+}
+
+/// Add the time since `start` to a phase of the running invocation
+pub fn record(phase: Phase, start: f64) void {
+    const ms = since_ms(start);
+    switch (phase) {
+        .parse => counters.parse_ms += ms,
+        .execute => counters.execute_ms += ms,
+        .encode => counters.encode_ms += ms,
+        .total => unreachable,
+    }
+    count_latency(phase, ms);
+    invocation_ms += ms;
+}
+
+/// Count the running invocation's total time once its result is written
+pub fn end_invocation() void {
+    count_latency(.total, invocation_ms);
+    invocation_ms = 0;
+}
+
+fn count_latency(phase: Phase, ms: f64) void {
+    const bucket = &counters.latency[@intFromEnum(phase)][latency_bucket(ms * 1000)];
+    bucket.* +%= 1;
+}
+
+fn latency_bucket(us: f64) usize {
+    if (!(us >= 1)) return 0;
+    if (us >= @as(f64, 1 << LATENCY_MAX_EXPONENT)) return LATENCY_BUCKETS - 1;
+    const whole: u32 = @intFromFloat(us);
+    const exponent = std.math.log2_int(u32, whole);
+    // The fraction of the way from 2^exponent to 2^(exponent + 1)
+    const base: f64 = @floatFromInt(@as(u32, 1) << exponent);
+    const sub: usize = @intFromFloat((us - base) / base * LATENCY_SUB_BUCKETS);
+    return 1 + @as(usize, exponent) * LATENCY_SUB_BUCKETS + @min(sub, LATENCY_SUB_BUCKETS - 1);
+}
+
+pub fn read(out: *PerfCounters) void {
+    out.* = counters;
+    var calls: u64 = 0;
+    var bytes: u64 = 0;
+    lua_allocator_totals(&calls, &bytes);
+    out.alloc_calls = calls -% alloc_calls_base;
+    out.alloc_bytes = bytes -% alloc_bytes_base;
+}
+
+pub fn reset() void {
+    counters = std.mem.zeroes(PerfCounters);
+    lua_allocator_totals(&alloc_calls_base, &alloc_bytes_base);
+}
@@ -0,0 +1,134 @@
+const lua = @import("lua.zig");
+const ext_table = @import("ext_table.zig");
+
+// Learned prefetching for compute() chunks.
+//
+// With learning on (set_prefetch_learning), each run of a compute() chunk
+// records the first MAX_LEARNED_KEYS external table keys it reads. The next
+// run of the same cached chunk starts by fetching those keys with one
+// js_ext_table_get_many call per table, as ext.prefetch does, so the reads
+// the handler makes again are answered from the value cache. Each run's
+// record replaces the last, so keys a handler stops reading drop out.
+//
+// Records live in each state's registry, weakly keyed by the compiled
+// chunk, and go when chunk_cache releases it.
+
+const c = lua.c;
+
+const MAX_LEARNED_KEYS = 64;
+const LEARNED_KEY: [*:0]const u8 = "cu.prefetch_learned";
+
+var enabled: bool = false;
+// { [table_id] = { [key] = true } } of the running chunk, and the chunk
+var recording_ref: c_int = c.LUA_NOREF;
+var chunk_ref: c_int = c.LUA_NOREF;
+var recorded: usize = 0;
+
+pub fn set_enabled(L: *lua.lua_State, on: bool) void {
+    enabled = on;
+    if (!on) {
+        lua.pushnil(L);
+        lua.setfield(L, c.LUA_REGISTRYINDEX, LEARNED_KEY);
+    }
+}
+
+/// With the chunk about to run on top of the stack, prefetch the keys it
+/// read last time and start recording this run's
+pub fn begin(L: *lua.lua_State) void {
+    if (!enabled) return;
+    const top = lua.gettop(L);
+    // Prefetching is an optimization: an error in it is dropped
+    lua.pushcfunction(L, &prefetch_learned);
+    lua.pushvalue(L, top);
+    _ = lua.pcall(L, 1, 0);
+    lua.settop(L, top);
+
+    lua.pushvalue(L, top);
+    chunk_ref = lua.ref(L);
+    lua.newtable(L);
+    recording_ref = lua.ref(L);
+    recorded = 0;
+}
+
+/// Note a read of `key_index` from `table_id` by the running chunk
+pub fn record(L: *lua.lua_State, table_id: u32, key_index: c_int) void {
+    if (recording_ref == c.LUA_NOREF or recorded >= MAX_LEARNED_KEYS) return;
+    const key_type = c.lua_type(L, key_index);
+    if (key_type != c.LUA_TSTRING and key_type != c.LUA_TNUMBER) return;
+    const key = c.lua_absindex(L, key_index);
+
+    _ = lua.getref(L, recording_ref);
+    if (c.lua_rawgeti(L, -1, @intCast(table_id)) != c.LUA_TTABLE) {
+        lua.pop(L, 1);
+        lua.newtable(L);
+        lua.pushvalue(L, -1);
+        c.lua_rawseti(L, -3, @intCast(table_id));
+    }
+    lua.pushvalue(L, key);
+    if (c.lua_rawget(L, -2) == c.LUA_TNIL) {
+        lua.pushvalue(L, key);
+        lua.pushboolean(L, 1);
+        c.lua_rawset(L, -4);
+        recorded += 1;
+    }
+    lua.pop(L, 3);
+}
+
+/// Keep the keys the finished run read, as arrays per table, for the next
+pub fn end(L: *lua.lua_State) void {
+    if (recording_ref == c.LUA_NOREF) return;
+    const top = lua.gettop(L);
+
+    if (lua.getfield(L, c.LUA_REGISTRYINDEX, LEARNED_KEY) != c.LUA_TTABLE) {
+        lua.pop(L, 1);
+        lua.newtable(L);
+        lua.newtable(L);
+        _ = lua.pushstring(L, "k");
+        lua.setfield(L, -2, "__mode");
+        _ = lua.setmetatable(L, -2);
+        lua.pushvalue(L, -1);
+        lua.setfield(L, c.LUA_REGISTRYINDEX, LEARNED_KEY);
+    }
+    _ = lua.getref(L, chunk_ref);
+    lua.newtable(L);
+    _ = lua.getref(L, recording_ref);
+    lua.pushnil(L);
+    while (c.lua_next(L, -2) != 0) {
+        // Stack: learned, chunk, arrays, recording, table_id, keys
+        lua.newtable(L);
+        var n: c.lua_Integer = 0;
+        lua.pushnil(L);
+        while (c.lua_next(L, -3) != 0) {
+            lua.pop(L, 1);
+            n += 1;
+            lua.pushvalue(L, -1);
+            c.lua_rawseti(L, -3, n);
+        }
+        lua.pushvalue(L, -3);
+        c.lua_rotate(L, -2, 1);
+        c.lua_rawset(L, -6);
+        lua.pop(L, 1);
+    }
+    lua.pop(L, 1);
+    c.lua_rawset(L, -3);
+    lua.settop(L, top);
+
+    lua.unref(L, recording_ref);
+    lua.unref(L, chunk_ref);
+    recording_ref = c.LUA_NOREF;
+    chunk_ref = c.LUA_NOREF;
+}
+
+// prefetch_learned(chunk): fetch what `chunk` read on its last run
+fn prefetch_learned(state: ?*lua.lua_State) callconv(.c) c_int {
+    const L = state.?;
+    if (lua.getfield(L, c.LUA_REGISTRYINDEX, LEARNED_KEY) != c.LUA_TTABLE) return 0;
+    lua.pushvalue(L, 1);
+    if (c.lua_rawget(L, -2) != c.LUA_TTABLE) return 0;
+    lua.pushnil(L);
+    while (c.lua_next(L, -2) != 0) {
+        _ = ext_table.prefetch_keys(L, @intCast(lua.tointeger(L, -2)), -1);
+        lua.pop(L, 1);
+    }
+    return 0;
+}
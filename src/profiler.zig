@@ -0,0 +1,246 @@
+const std = @import("std");
+const lua = @import("lua.zig");
+
+// Sampling profiler.
+//
+// While a profile is running, budget.zig's LUA_MASKCOUNT hook also fires
+// every `period` instructions and calls sample(), which walks the Lua stack
+// with lua_getstack / lua_getinfo. Each frame is named "name (source:line)"
+// and interned in a frame table; each distinct stack, as frame indices from
+// the leaf outwards, gets a slot in a stack table that counts its samples.
+// Both tables are open-addressed and fixed in size, allocated when the
+// profile starts and freed once it has been read, so an idle unit pays
+// nothing and a profiled one pays a stack walk per sample.
+//
+// Results are written as folded stacks, one "root;caller;leaf count" line
+// per stack, which flamegraph.pl and speedscope read directly. Samples whose
+// stack or frames did not fit the tables are counted on a "[dropped]" line.
+
+extern fn lua_malloc(size: usize) ?*anyopaque;
+extern fn lua_free(ptr: ?*anyopaque) void;
+
+const MAX_FRAMES = 512;
+const MAX_STACKS = 1024;
+/// Frames kept per sample, innermost first; deeper callers are cut off
+const MAX_DEPTH = 32;
+const LABEL_MAX = 96;
+const EMPTY: u32 = 0;
+
+const Frame = struct {
+    hash: u32,
+    len: u8,
+    label: [LABEL_MAX]u8,
+};
+
+const Stack = struct {
+    hash: u32,
+    count: u32,
+    depth: u16,
+    frames: [MAX_DEPTH]u16,
+};
+
+const Tables = struct {
+    frames: [MAX_FRAMES]Frame,
+    stacks: [MAX_STACKS]Stack,
+};
+
+var tables: ?*Tables = null;
+var running: bool = false;
+var period: u64 = 0;
+var pending: u64 = 0;
+var dropped: u32 = 0;
+
+/// Start a new profile, sampling every `instructions` instructions, and drop
+/// any earlier one. Returns false if the tables could not be allocated.
+pub fn start(instructions: u32) bool {
+    discard();
+    const t: *Tables = @ptrCast(@alignCast(lua_malloc(@sizeOf(Tables)) orelse return false));
+    for (&t.frames) |*frame| frame.hash = EMPTY;
+    for (&t.stacks) |*stack| stack.hash = EMPTY;
+    tables = t;
+    period = std.math.clamp(instructions, 1, std.math.maxInt(c_int));
+    pending = 0;
+    dropped = 0;
+    running = true;
+    return true;
+}
+
+/// Stop sampling; the samples stay until written or discarded
+pub fn stop() void {
+    running = false;
+}
+
+pub fn is_running() bool {
+    return running;
+}
+
+/// Instructions between samples, for budget.zig's hook count
+pub fn sample_period() u64 {
+    return period;
+}
+
+/// Free the tables
+pub fn discard() void {
+    running = false;
+    if (tables) |t| lua_free(t);
+    tables = null;
+}
+
+/// Called from the count hook after `instructions` more have run
+pub fn tick(L: *lua.lua_State, instructions: u64) void {
+    if (!running) return;
+    pending += instructions;
+    if (pending < period) return;
+    pending = 0;
+    sample(L);
+}
+
+fn sample(L: *lua.lua_State) void {
+    const t = tables orelse return;
+    var frames: [MAX_DEPTH]u16 = undefined;
+    var depth: u16 = 0;
+    var ar: lua.c.lua_Debug = undefined;
+    while (depth < MAX_DEPTH and lua.c.lua_getstack(L, depth, &ar) != 0) : (depth += 1) {
+        if (lua.c.lua_getinfo(L, "Sn", &ar) == 0) break;
+        frames[depth] = intern_frame(t, &ar) orelse {
+            dropped +%= 1;
+            return;
+        };
+    }
+    if (depth == 0) return;
+
+    const stack = frames[0..depth];
+    const hash = nonzero(std.hash.Wyhash.hash(depth, std.mem.sliceAsBytes(stack)));
+    var i = hash % MAX_STACKS;
+    for (0..MAX_STACKS) |_| {
+        const slot = &t.stacks[i];
+        if (slot.hash == EMPTY) {
+            slot.* = .{ .hash = hash, .count = 1, .depth = depth, .frames = undefined };
+            @memcpy(slot.frames[0..depth], stack);
+            return;
+        }
+        if (slot.hash == hash and slot.depth == depth and std.mem.eql(u16, slot.frames[0..depth], stack)) {
+            slot.count +%= 1;
+            return;
+        }
+        i = (i + 1) % MAX_STACKS;
+    }
+    dropped +%= 1;
+}
+
+fn intern_frame(t: *Tables, ar: *const lua.c.lua_Debug) ?u16 {
+    var label: [LABEL_MAX]u8 = undefined;
+    const text = frame_label(&label, ar);
+    const hash = nonzero(std.hash.Wyhash.hash(0, text));
+    var i = hash % MAX_FRAMES;
+    for (0..MAX_FRAMES) |_| {
+        const slot = &t.frames[i];
+        if (slot.hash == EMPTY) {
+            slot.hash = hash;
+            slot.len = @intCast(text.len);
+            @memcpy(slot.label[0..text.len], text);
+            return @intCast(i);
+        }
+        if (slot.hash == hash and std.mem.eql(u8, slot.label[0..slot.len], text)) return @intCast(i);
+        i = (i + 1) % MAX_FRAMES;
+    }
+    return null;
+}
+
+// "name (source:line)", or "main (source)" for a chunk and "name [C]" for a
+// C function, cut to LABEL_MAX. ';' and newlines would split the folded
+// line, so they become '_'.
+fn frame_label(out: *[LABEL_MAX]u8, ar: *const lua.c.lua_Debug) []const u8 {
+    const what = std.mem.span(@as([*:0]const u8, @ptrCast(ar.what)));
+    const source = std.mem.sliceTo(&ar.short_src, 0);
+    const is_main = std.mem.eql(u8, what, "main");
+    const name: []const u8 = if (ar.name != null)
+        std.mem.span(@as([*:0]const u8, @ptrCast(ar.name)))
+    else if (is_main) "main" else "?";
+
+    var label = Label{ .out = out };
+    label.add(name);
+    if (std.mem.eql(u8, what, "C")) {
+        label.add(" [C]");
+    } else {
+        label.add(" (");
+        label.add(source);
+        if (!is_main) {
+            var digits: [12]u8 = undefined;
+            label.add(std.fmt.bufPrint(&digits, ":{d}", .{ar.linedefined}) catch unreachable);
+        }
+        label.add(")");
+    }
+
+    const text = out[0..label.len];
+    for (text) |*ch| {
+        if (ch.* == ';' or ch.* == '\n' or ch.* == '\r') ch.* = '_';
+    }
+    return text;
+}
+
+const Label = struct {
+    out: *[LABEL_MAX]u8,
+    len: usize = 0,
+
+    fn add(self: *Label, bytes: []const u8) void {
+        const n = @min(bytes.len, LABEL_MAX - self.len);
+        @memcpy(self.out[self.len..][0..n], bytes[0..n]);
+        self.len += n;
+    }
+};
+
+fn nonzero(hash: u64) u32 {
+    const h: u32 = @truncate(hash ^ (hash >> 32));
+    return if (h == EMPTY) 1 else h;
+}
+
+/// Length of the folded output, 0 if there are no samples
+pub fn folded_len() usize {
+    return write_folded(null);
+}
+
+/// Write the folded output into `out`, which has room for folded_len()
+/// bytes, and free the tables. Returns the length written.
+pub fn take_folded(out: []u8) usize {
+    const len = write_folded(out);
+    discard();
+    return len;
+}
+
+// Writes into `out` when given; returns the length either way
+fn write_folded(out: ?[]u8) usize {
+    const t = tables orelse return 0;
+    var w = Writer{ .out = out };
+    for (&t.stacks) |*stack| {
+        if (stack.hash == EMPTY) continue;
+        var level = stack.depth;
+        while (level > 0) {
+            level -= 1;
+            const frame = &t.frames[stack.frames[level]];
+            w.add(frame.label[0..frame.len]);
+            if (level > 0) w.add(";");
+        }
+        w.count(stack.count);
+    }
+    if (dropped > 0) {
+        w.add("[dropped]");
+        w.count(dropped);
+    }
+    return w.len;
+}
+
+const Writer = struct {
+    out: ?[]u8,
+    len: usize = 0,
+
+    fn add(self: *Writer, bytes: []const u8) void {
+        if (self.out) |out| @memcpy(out[self.len..][0..bytes.len], bytes);
+        self.len += bytes.len;
+    }
+
+    fn count(self: *Writer, n: u32) void {
+        var digits: [12]u8 = undefined;
+        self.add(std.fmt.bufPrint(&digits, " {d}\n", .{n}) catch unreachable);
+    }
+};
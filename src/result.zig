@@ -1,6 +1,9 @@
 const std = @import("std");
 const lua = @import("lua.zig");
 const serializer = @import("serializer.zig");
+const strbuf = @import("strbuf.zig");
+const struct_record = @import("struct_record.zig");
+const bigint = @import("bigint.zig");
 const output = @import("output.zig");
 
 const IO_BUFFER_SIZE = 64 * 1024;
@@ -8,12 +11,24 @@ const OUTPUT_LEN_SIZE = 4;
 const RESULT_OFFSET = OUTPUT_LEN_SIZE;
 
 pub fn encode_result(L: *lua.lua_State, buffer: [*]u8, max_len: usize) usize {
+    return encode(L, buffer, max_len, false).?;
+}
+
+/// Like encode_result, but rather than cutting strings or dropping values to
+/// fit `max_len`, fails and leaves the values on the stack for a retry in a
+/// larger buffer
+pub fn encode_result_whole(L: *lua.lua_State, buffer: [*]u8, max_len: usize) ?usize {
+    return encode(L, buffer, max_len, true);
+}
+
+fn encode(L: *lua.lua_State, buffer: [*]u8, max_len: usize, whole: bool) ?usize {
     if (max_len < OUTPUT_LEN_SIZE) {
-        return 0;
+        return if (whole) null else 0;
     }
 
     const output_len = output.get_output_len();
     const output_ptr = output.get_output_ptr();
+    if (whole and OUTPUT_LEN_SIZE + output_len + 3 > max_len) return null;
 
     const output_len_u32: u32 = @intCast(output_len);
     const output_len_bytes = std.mem.asBytes(&output_len_u32);
@@ -36,14 +51,26 @@ pub fn encode_result(L: *lua.lua_State, buffer: [*]u8, max_len: usize) usize {
         }
     }
 
+    // Every value returned, in order; a call that returns nothing reports
+    // one nil. A value that does not fit ends the list.
     const top = lua.gettop(L);
 
     if (top > 0) {
-        offset = encode_stack_value(L, -1, buffer, offset, max_len);
+        var i: c_int = 1;
+        while (i <= top) : (i += 1) {
+            const next = encode_stack_value(L, i, buffer, offset, max_len, whole);
+            if (next == offset) {
+                if (whole) return null;
+                break;
+            }
+            offset = next;
+        }
     } else {
         if (offset + 1 <= max_len) {
             buffer[offset] = @intFromEnum(serializer.SerializationType.nil);
             offset += 1;
+        } else if (whole) {
+            return null;
         }
     }
 
@@ -51,102 +78,191 @@ pub fn encode_result(L: *lua.lua_State, buffer: [*]u8, max_len: usize) usize {
     return offset;
 }
 
-fn encode_stack_value(L: *lua.lua_State, stack_idx: c_int, buffer: [*]u8, offset: usize, max_len: usize) usize {
+// Returns `offset` unchanged if the value does not fit. Unless `whole` is
+// set, a string is cut to the space left and a table falls back to "<table>".
+fn encode_stack_value(L: *lua.lua_State, stack_idx: c_int, buffer: [*]u8, offset: usize, max_len: usize, whole: bool) usize {
     if (offset >= max_len) {
         return offset;
     }
 
     const remaining = max_len - offset;
 
-    if (lua.isnil(L, stack_idx)) {
-        if (remaining >= 1) {
-            buffer[offset] = @intFromEnum(serializer.SerializationType.nil);
-            return offset + 1;
-        }
-        return offset;
+    switch (lua.c.lua_type(L, stack_idx)) {
+        lua.c.LUA_TNIL => {
+            if (remaining >= 1) {
+                buffer[offset] = @intFromEnum(serializer.SerializationType.nil);
+                return offset + 1;
+            }
+            return offset;
+        },
+        lua.c.LUA_TBOOLEAN => return offset + (serializer.write_boolean(buffer + offset, remaining, lua.toboolean(L, stack_idx)) catch 0),
+        lua.c.LUA_TNUMBER => return offset + (serializer.write_number(L, stack_idx, buffer + offset, remaining) catch 0),
+        lua.c.LUA_TSTRING => {
+            var len: usize = 0;
+            const ptr = lua.tolstring(L, stack_idx, &len);
+            return encode_text(ptr[0..len], buffer, offset, remaining, whole);
+        },
+        lua.c.LUA_TTABLE => {
+            // A table that does not fit whole is returned as "<table>"
+            var encoder = TableEncoder{ .L = L };
+            if (encoder.table(stack_idx, buffer + offset, remaining)) |len| {
+                return offset + len;
+            } else |_| {
+                if (whole) return offset;
+            }
+        },
+        lua.c.LUA_TUSERDATA => {
+            // A strbuf is returned as the string it holds
+            if (strbuf.bytes(L, stack_idx)) |str| return encode_text(str, buffer, offset, remaining, whole);
+            // A bigint is returned whole or not at all
+            if (bigint.value_len(L, stack_idx)) |size| {
+                if (size > remaining) return offset;
+                return offset + bigint.write(L, stack_idx, buffer + offset);
+            }
+            // A struct record is returned as a table of its fields
+            if (struct_record.push_row(L, stack_idx)) {
+                defer lua.pop(L, 1);
+                var encoder = TableEncoder{ .L = L };
+                if (encoder.table(-1, buffer + offset, remaining)) |len| {
+                    return offset + len;
+                } else |_| {
+                    if (whole) return offset;
+                }
+            }
+        },
+        else => {},
     }
 
-    if (lua.isboolean(L, stack_idx)) {
-        if (remaining >= 2) {
-            buffer[offset] = @intFromEnum(serializer.SerializationType.boolean);
-            const val = lua.toboolean(L, stack_idx);
-            buffer[offset + 1] = if (val) 1 else 0;
-            return offset + 2;
-        }
-        return offset;
+    return offset + (write_placeholder(L, stack_idx, buffer + offset, remaining) catch 0);
+}
+
+// Unless `whole` is set, a string that does not fit is cut to the space left
+fn encode_text(str: []const u8, buffer: [*]u8, offset: usize, remaining: usize, whole: bool) usize {
+    if (whole) {
+        return offset + (serializer.write_string(buffer + offset, remaining, str) catch 0);
+    }
+    var copy_len = str.len;
+    while (copy_len > 0 and serializer.string_header_len(copy_len) + copy_len > remaining) {
+        copy_len = remaining -| serializer.string_header_len(copy_len);
+    }
+    if (copy_len > 0 or serializer.string_header_len(0) <= remaining) {
+        return offset + (serializer.write_string(buffer + offset, remaining, str[0..copy_len]) catch 0);
     }
+    return offset;
+}
 
-    if (lua.isnumber(L, stack_idx)) {
-        const num = lua.tonumber(L, stack_idx);
-        const int_val = lua.tointeger(L, stack_idx);
+// Tables are returned by value as TABLE_INLINE (serializer.zig), nested
+// tables included, so the host gets their contents without another call.
+// External tables (_home and the tables stored in it) are returned as
+// references to the copy the host already holds. Entries are read raw,
+// ignoring metatables, and those keyed by anything but a string, number or
+// boolean are left out. A table inside itself or more than MAX_TABLE_DEPTH
+// levels down is returned as "<table>", and values with no data form, such
+// as functions, as "<function>" and the like.
+const MAX_TABLE_DEPTH = 32;
 
-        if (@as(f64, @floatFromInt(int_val)) == num) {
-            if (remaining >= 9) {
-                buffer[offset] = @intFromEnum(serializer.SerializationType.integer);
-                const bytes = std.mem.asBytes(&int_val);
-                @memcpy(buffer[offset + 1 .. offset + 9], bytes);
-                return offset + 9;
-            }
-        } else {
-            if (remaining >= 9) {
-                buffer[offset] = @intFromEnum(serializer.SerializationType.float);
-                const bytes = std.mem.asBytes(&num);
-                @memcpy(buffer[offset + 1 .. offset + 9], bytes);
-                return offset + 9;
-            }
+const TableEncoder = struct {
+    L: *lua.lua_State,
+    path: [MAX_TABLE_DEPTH]?*const anyopaque = undefined,
+    depth: usize = 0,
+
+    fn value(self: *TableEncoder, index: c_int, buffer: [*]u8, max_len: usize) serializer.SerializationError!usize {
+        const L = self.L;
+        switch (lua.c.lua_type(L, index)) {
+            lua.c.LUA_TNIL => {
+                if (max_len < 1) return serializer.SerializationError.BufferTooSmall;
+                buffer[0] = @intFromEnum(serializer.SerializationType.nil);
+                return 1;
+            },
+            lua.c.LUA_TBOOLEAN => return serializer.write_boolean(buffer, max_len, lua.toboolean(L, index)),
+            lua.c.LUA_TNUMBER => return serializer.write_number(L, index, buffer, max_len),
+            lua.c.LUA_TSTRING => {
+                var len: usize = 0;
+                const ptr = lua.tolstring(L, index, &len);
+                return serializer.write_string(buffer, max_len, ptr[0..len]);
+            },
+            lua.c.LUA_TTABLE => return self.table(index, buffer, max_len),
+            else => {
+                if (strbuf.bytes(L, index)) |bytes| return serializer.write_string(buffer, max_len, bytes);
+                if (bigint.value_len(L, index)) |size| {
+                    if (size > max_len) return serializer.SerializationError.BufferTooSmall;
+                    return bigint.write(L, index, buffer);
+                }
+                if (struct_record.push_row(L, index)) {
+                    defer lua.pop(L, 1);
+                    return self.table(-1, buffer, max_len);
+                }
+                return write_placeholder(L, index, buffer, max_len);
+            },
         }
-        return offset;
     }
 
-    if (lua.isstring(L, stack_idx)) {
-        var str_len: usize = 0;
-        const str = lua.tolstring(L, stack_idx, &str_len);
-
-        if (str_len > 0) {
-            if (remaining >= 5 + str_len) {
-                buffer[offset] = @intFromEnum(serializer.SerializationType.string);
-                const len_u32: u32 = @intCast(str_len);
-                const len_bytes = std.mem.asBytes(&len_u32);
-                @memcpy(buffer[offset + 1 .. offset + 5], len_bytes);
-                @memcpy(buffer[offset + 5 .. offset + 5 + str_len], str[0..str_len]);
-                return offset + 5 + str_len;
-            } else if (remaining >= 5) {
-                buffer[offset] = @intFromEnum(serializer.SerializationType.string);
-                const copy_len = remaining - 5;
-                const len_u32: u32 = @intCast(copy_len);
-                const len_bytes = std.mem.asBytes(&len_u32);
-                @memcpy(buffer[offset + 1 .. offset + 5], len_bytes);
-                @memcpy(buffer[offset + 5 .. offset + 5 + copy_len], str[0..copy_len]);
-                return offset + 5 + copy_len;
-            }
+    fn table(self: *TableEncoder, index: c_int, buffer: [*]u8, max_len: usize) serializer.SerializationError!usize {
+        const L = self.L;
+        const abs_index = lua.c.lua_absindex(L, index);
+
+        _ = lua.pushstring(L, "__ext_table_id");
+        const table_id = if (lua.c.lua_rawget(L, abs_index) == lua.c.LUA_TNUMBER) lua.tointeger(L, -1) else 0;
+        lua.pop(L, 1);
+        if (table_id > 0) return serializer.write_table_ref(buffer, max_len, @intCast(table_id));
+
+        const ptr = lua.c.lua_topointer(L, abs_index);
+        if (self.depth >= MAX_TABLE_DEPTH or
+            std.mem.indexOfScalar(?*const anyopaque, self.path[0..self.depth], ptr) != null or
+            lua.c.lua_checkstack(L, 3) == 0)
+        {
+            return write_placeholder(L, abs_index, buffer, max_len);
         }
-        return offset;
-    }
 
-    if (lua.istable(L, stack_idx)) {
-        const type_marker = "table";
-        if (remaining >= type_marker.len) {
-            @memcpy(buffer[offset .. offset + type_marker.len], type_marker);
-            return offset + type_marker.len;
+        var count: usize = 0;
+        lua.pushnil(L);
+        while (lua.c.lua_next(L, abs_index) != 0) {
+            lua.pop(L, 1);
+            if (is_data_key(L, -1)) count += 1;
         }
-        return offset;
-    }
+        var offset = try serializer.write_inline_table_header(buffer, max_len, count);
+
+        self.path[self.depth] = ptr;
+        self.depth += 1;
+        defer self.depth -= 1;
 
-    if (lua.isfunction(L, stack_idx)) {
-        const type_marker = "function";
-        if (remaining >= type_marker.len) {
-            @memcpy(buffer[offset .. offset + type_marker.len], type_marker);
-            return offset + type_marker.len;
+        lua.pushnil(L);
+        while (lua.c.lua_next(L, abs_index) != 0) {
+            // Stack: ... key, value
+            if (is_data_key(L, -2)) {
+                offset += self.value(-2, buffer + offset, max_len - offset) catch |err| {
+                    lua.pop(L, 2);
+                    return err;
+                };
+                offset += self.value(-1, buffer + offset, max_len - offset) catch |err| {
+                    lua.pop(L, 2);
+                    return err;
+                };
+            }
+            lua.pop(L, 1);
         }
         return offset;
     }
+};
 
-    const type_name = lua.type_name(L, stack_idx);
-    var i: usize = 0;
-    while (i < remaining and type_name[i] != 0) : (i += 1) {
-        buffer[offset + i] = type_name[i];
-    }
-    return offset + i;
+fn is_data_key(L: *lua.lua_State, index: c_int) bool {
+    return switch (lua.c.lua_type(L, index)) {
+        lua.c.LUA_TSTRING, lua.c.LUA_TNUMBER, lua.c.LUA_TBOOLEAN => true,
+        else => false,
+    };
+}
+
+// "<type>" as a string, for values the result has no form for
+fn write_placeholder(L: *lua.lua_State, index: c_int, buffer: [*]u8, max_len: usize) serializer.SerializationError!usize {
+    const name = std.mem.span(lua.type_name(L, index));
+    const len = name.len + 2;
+    const header_len = serializer.string_header_len(len);
+    if (max_len < header_len + len) return serializer.SerializationError.BufferTooSmall;
+    _ = serializer.write_string_header(buffer, len);
+    buffer[header_len] = '<';
+    @memcpy(buffer[header_len + 1 ..][0..name.len], name);
+    buffer[header_len + len - 1] = '>';
+    return header_len + len;
 }
 
 pub fn write_encoded_output_length(buffer: [*]u8, output_len: usize) void {
@@ -0,0 +1,77 @@
+const std = @import("std");
+const lua = @import("lua.zig");
+const result = @import("result.zig");
+
+// Results of compute() and call() written into a region of linear memory
+// the host allocated (cu_alloc) and registered with set_result_region,
+// instead of into the 64KB I/O buffer, where long strings are cut to fit.
+//
+// Results that need more room than the region has are encoded once into a
+// heap buffer, doubled until they fit, and parked there. The call then
+// returns their size, which is larger than the region; once the host has
+// registered a region that large, take_result() copies them into it. A host
+// that keeps the grown region gets later results of that size directly.
+
+extern fn lua_malloc(size: usize) ?*anyopaque;
+extern fn lua_free(ptr: ?*anyopaque) void;
+
+// Results larger than this are cut to the region as before
+const MAX_RESULT_BYTES: usize = std.math.maxInt(i32);
+
+var region: ?[]u8 = null;
+var parked: ?[]u8 = null;
+
+/// Encode into `bytes` from now on; null goes back to the I/O buffer and
+/// drops a parked result, which could no longer be taken. A parked result
+/// stays parked while the host swaps in a larger region.
+pub fn set(bytes: ?[]u8) void {
+    const out = bytes orelse {
+        region = null;
+        discard();
+        return;
+    };
+    region = out[0..@min(out.len, MAX_RESULT_BYTES)];
+}
+
+pub fn active() bool {
+    return region != null;
+}
+
+/// Encode the values on the stack into the region. Returns their length,
+/// which exceeds the region's if they were parked instead.
+pub fn encode(L: *lua.lua_State) i32 {
+    const out = region.?;
+    if (result.encode_result_whole(L, out.ptr, out.len)) |len| return @intCast(len);
+
+    var cap = out.len;
+    while (cap <= MAX_RESULT_BYTES / 2) {
+        cap *= 2;
+        const buffer: [*]u8 = @ptrCast(lua_malloc(cap) orelse break);
+        if (result.encode_result_whole(L, buffer, cap)) |len| {
+            parked = buffer[0..len];
+            return @intCast(len);
+        }
+        lua_free(buffer);
+    }
+
+    // Out of memory: cut to fit, as the I/O buffer would
+    return @intCast(result.encode_result(L, out.ptr, out.len));
+}
+
+/// Copy the parked result into the region. Returns its length, or -1 if
+/// nothing is parked or the region is still too small.
+pub fn take() i32 {
+    const bytes = parked orelse return -1;
+    const out = region orelse return -1;
+    if (bytes.len > out.len) return -1;
+    @memcpy(out[0..bytes.len], bytes);
+    const len = bytes.len;
+    discard();
+    return @intCast(len);
+}
+
+/// Free the parked result, if any
+pub fn discard() void {
+    if (parked) |bytes| lua_free(bytes.ptr);
+    parked = null;
+}
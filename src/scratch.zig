@@ -0,0 +1,123 @@
+const std = @import("std");
+
+// Per-invocation scratch memory.
+//
+// Zig-side buffers that live only for one compute(), call() or batch item
+// (the serializer's SetBatch frames, compute_batch's copied input and
+// accumulated results) come from here. With the arena off (the default)
+// alloc and free go straight to lua_malloc and lua_free. With it on they
+// bump a pointer through chunks of `chunk_bytes`, free gives back only the
+// most recent allocation, and release(mark) drops everything allocated
+// since mark() in one step, so the invocation's scratch never reaches the
+// free lists. Chunks stay allocated for the next invocation; releasing to
+// an empty arena returns all but the first to the heap.
+
+extern fn lua_malloc(size: usize) ?*anyopaque;
+extern fn lua_free(ptr: ?*anyopaque) void;
+
+const MAX_CHUNKS = 16;
+const ALIGNMENT = 16;
+
+const Chunk = struct {
+    base: [*]u8,
+    size: usize,
+
+    fn contains(self: Chunk, ptr: [*]u8) bool {
+        const at = @intFromPtr(ptr);
+        const base = @intFromPtr(self.base);
+        return at >= base and at < base + self.size;
+    }
+};
+
+// 0 while the arena is off
+var chunk_bytes: usize = 0;
+var chunks: [MAX_CHUNKS]Chunk = undefined;
+var chunk_count: usize = 0;
+// Chunks in use: allocations bump through chunks[top - 1]
+var top: usize = 0;
+var used: usize = 0;
+
+pub const Mark = struct {
+    top: usize,
+    used: usize,
+};
+
+pub fn mark() Mark {
+    return .{ .top = top, .used = used };
+}
+
+/// Drop every arena allocation made since `m`
+pub fn release(m: Mark) void {
+    top = m.top;
+    used = m.used;
+    if (top == 0) trim(1);
+}
+
+/// Scratch memory for the current invocation. Falls back to lua_malloc when
+/// the arena is off or out of chunks; free() tells the two apart.
+pub fn alloc(size: usize) ?[*]u8 {
+    if (chunk_bytes == 0) return @ptrCast(lua_malloc(size));
+
+    const need = std.mem.alignForward(usize, @max(size, 1), ALIGNMENT);
+    if (top == 0 or chunks[top - 1].size - used < need) {
+        if (!open_chunk(need)) return @ptrCast(lua_malloc(size));
+    }
+    const ptr = chunks[top - 1].base + used;
+    used += need;
+    return ptr;
+}
+
+pub fn free(ptr: [*]u8, size: usize) void {
+    for (chunks[0..chunk_count], 0..) |chunk, i| {
+        if (!chunk.contains(ptr)) continue;
+        // Only the newest allocation can be given back before release()
+        const need = std.mem.alignForward(usize, @max(size, 1), ALIGNMENT);
+        if (i + 1 == top and ptr + need == chunk.base + used) used -= need;
+        return;
+    }
+    lua_free(ptr);
+}
+
+// Move to the next chunk, dropping spare ones too small for `need`
+fn open_chunk(need: usize) bool {
+    while (top < chunk_count and chunks[top].size < need) {
+        lua_free(chunks[top].base);
+        chunks[top] = chunks[chunk_count - 1];
+        chunk_count -= 1;
+    }
+    if (top == chunk_count) {
+        if (chunk_count == MAX_CHUNKS) return false;
+        const size = @max(chunk_bytes, need);
+        const base: [*]u8 = @ptrCast(lua_malloc(size) orelse return false);
+        chunks[chunk_count] = .{ .base = base, .size = size };
+        chunk_count += 1;
+    }
+    top += 1;
+    used = 0;
+    return true;
+}
+
+fn trim(keep: usize) void {
+    while (chunk_count > keep) {
+        chunk_count -= 1;
+        lua_free(chunks[chunk_count].base);
+    }
+}
+
+/// Return every chunk to the heap if no invocation is using the arena
+/// (trim_heap); the next invocation opens a fresh one
+pub fn drop_idle() void {
+    if (top == 0) trim(0);
+}
+
+/// Turn the arena on with chunks of `bytes`, or off with 0. Only call this
+/// between invocations, when nothing is allocated from it. Returns the
+/// previous chunk size.
+pub fn configure(bytes: usize) usize {
+    const previous = chunk_bytes;
+    top = 0;
+    used = 0;
+    trim(0);
+    chunk_bytes = bytes;
+    return previous;
+}
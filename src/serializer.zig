@@ -2,20 +2,63 @@ const std = @import("std");
 const lua = @import("lua.zig");
 const function_serializer = @import("function_serializer.zig");
 const ext_table = @import("ext_table.zig");
+const key_filter = @import("key_filter.zig");
+const typed_array = @import("typed_array.zig");
+const blob = @import("blob.zig");
+const scratch = @import("scratch.zig");
+const strbuf = @import("strbuf.zig");
+const bigint = @import("bigint.zig");
+const struct_record = @import("struct_record.zig");
+const perf = @import("perf_counters.zig");
 
 // External function for setting values in external tables
+extern fn js_ext_table_delete(table_id: u32, key_ptr: [*]const u8, key_len: usize) c_int;
 extern fn js_ext_table_set(table_id: u32, key_ptr: [*]const u8, key_len: usize, val_ptr: [*]const u8, val_len: usize) c_int;
+extern fn js_ext_table_set_many(table_id: u32, frames_ptr: [*]const u8, frames_len: usize) c_int;
+extern fn js_ext_key_intern(handle: u32, key_ptr: [*]const u8, key_len: usize) c_int;
+extern fn js_ext_table_set_parts(table_id: u32, key_ptr: [*]const u8, key_len: usize, head_ptr: [*]const u8, head_len: usize, body_ptr: [*]const u8, body_len: usize) c_int;
 
 const IO_BUFFER_SIZE = 64 * 1024;
 
 // Limits for table conversion
 const MAX_RECURSION_DEPTH: usize = 32;
-const MAX_TABLE_ENTRIES: usize = 10000;
+pub const DEFAULT_MAX_TABLE_ENTRIES: usize = 10000;
+
+var max_table_entries: usize = DEFAULT_MAX_TABLE_ENTRIES;
+
+/// What the host answers a write that a table quota (setTableQuota) refused
+pub const QUOTA_EXCEEDED: c_int = -2;
+
+/// Set when a store made here was refused by a table quota. The store
+/// fails with an ordinary error; callers that raise in Lua check this
+/// (and clear it) to say why.
+pub var quota_exceeded: bool = false;
+
+// Whether a host write failed, noting a quota refusal
+fn host_refused(result: c_int) bool {
+    if (result == QUOTA_EXCEEDED) quota_exceeded = true;
+    return result != 0;
+}
+
+/// Cap on entries of one converted table; 0 restores the default
+pub fn set_max_table_entries(entries: usize) void {
+    max_table_entries = if (entries == 0) DEFAULT_MAX_TABLE_ENTRIES else entries;
+}
 
 // Context for tracking recursion
-const ConversionContext = struct {
+pub const ConversionContext = struct {
     depth: usize,
-    visited_stack_index: c_int, // Stack index of visited tables tracking table
+    // Tables being converted, outermost first; visited[0..depth] is the
+    // current path, which is all cycle detection needs to look at
+    visited: [MAX_RECURSION_DEPTH]?*const anyopaque = undefined,
+    // Set while encoding an inline table, whose nested tables must be
+    // inlined as well
+    inlining: bool = false,
+    // Whether the last table serialized at this level was stored inline
+    stored_inline: bool = false,
+    // External table field the value being serialized is written to
+    owner_id: u32 = 0,
+    owner_key: []const u8 = &.{},
 };
 
 pub const SerializationType = enum(u8) {
@@ -36,74 +79,675 @@ pub const SerializationError = error{
     CircularReference,
     MaxDepthExceeded,
     TableTooLarge,
+    // A table that cannot be stored inline; it is converted instead
+    NotInlinable,
 };
 
-// Helper to serialize Lua table keys to external table format
-fn serialize_table_key(L: *lua.lua_State, key_index: c_int, buffer: [*]u8, max_len: usize) SerializationError!usize {
-    if (lua.isstring(L, key_index)) {
+// Value encodings. `.v1` (the default) is the original fixed-width format:
+// 9 bytes per number, a u32 length per string, integral floats written as
+// integers. `.v2` keeps nil (0x00) and the function formats and writes
+// everything else compactly, with tags v1 never uses, so the first byte of
+// a value tells which encoding wrote it and readers accept both:
+//   0x08 / 0x09             false / true
+//   0x0A + zigzag varint    integer
+//   0x0B + f64              float (integral floats stay floats)
+//   0x0C + varint + bytes   string
+//   0x0D + varint           table_ref
+//   0x80 | len, bytes       string of up to 63 bytes
+//   0xC0 | n                integer 0..31
+// Varints are unsigned LEB128, little end first. 0x0E (TABLE_INLINE),
+// 0x0F (typed_array.TYPED_ARRAY), 0x10 (function_serializer.CLOSURE), 0x11
+// (bigint.BIGINT) and 0xE0/0xE1 (blob.zig) are used under either encoding;
+// 0xE2-0xFF stay reserved.
+pub const ValueEncoding = enum { v1, v2 };
+
+pub const V2_FALSE: u8 = 0x08;
+pub const V2_TRUE: u8 = 0x09;
+pub const V2_INTEGER: u8 = 0x0A;
+pub const V2_FLOAT: u8 = 0x0B;
+pub const V2_STRING: u8 = 0x0C;
+pub const V2_TABLE_REF: u8 = 0x0D;
+pub const V2_SHORT_STRING: u8 = 0x80;
+pub const V2_SMALL_INT: u8 = 0xC0;
+
+const V2_SHORT_STRING_MAX = 63;
+const V2_SMALL_INT_MAX = 31;
+
+var value_encoding: ValueEncoding = .v1;
+
+pub fn set_value_encoding(encoding: ValueEncoding) void {
+    value_encoding = encoding;
+}
+
+// Small nested tables can be stored by value in their parent's entry
+// instead of as an external table of their own: TABLE_INLINE + varint entry
+// count, then each key and value back to back. Only a table whose whole
+// subtree fits the limits is inlined, so trying never creates external
+// tables, and only inside a table being converted. Off by default: an inlined table reads back as a plain Lua table,
+// and writes to it are only stored once it is assigned to a field again.
+pub const TABLE_INLINE: u8 = 0x0E;
+pub const MAX_INLINE_TABLE_BYTES: usize = 4096;
+
+var inline_max_entries: usize = 0; // 0 = never inline
+var inline_max_bytes: usize = 0;
+
+// Nesting of inline tables being read, bounded like conversion so malformed
+// input cannot recurse without limit
+var inline_read_depth: usize = 0;
+
+/// Inline tables of up to `max_entries` entries and `max_bytes` encoded
+/// bytes (capped at MAX_INLINE_TABLE_BYTES); 0 entries turns inlining off
+pub fn set_inline_table_limits(max_entries: usize, max_bytes: usize) void {
+    inline_max_entries = if (max_bytes == 0) 0 else max_entries;
+    inline_max_bytes = @min(max_bytes, MAX_INLINE_TABLE_BYTES);
+}
+
+fn varint_len(value: u64) usize {
+    var len: usize = 1;
+    var rest = value >> 7;
+    while (rest != 0) : (rest >>= 7) len += 1;
+    return len;
+}
+
+fn write_varint(buffer: [*]u8, value: u64) usize {
+    var rest = value;
+    var i: usize = 0;
+    while (rest >= 0x80) : (i += 1) {
+        buffer[i] = @as(u8, @truncate(rest)) | 0x80;
+        rest >>= 7;
+    }
+    buffer[i] = @truncate(rest);
+    return i + 1;
+}
+
+// Read a varint at `offset.*`, advancing it; null if truncated or over 64 bits
+fn read_varint(bytes: []const u8, offset: *usize) ?u64 {
+    var value: u64 = 0;
+    var shift: u7 = 0;
+    while (offset.* < bytes.len and shift < 64) : (shift += 7) {
+        const byte = bytes[offset.*];
+        offset.* += 1;
+        value |= @as(u64, byte & 0x7f) << @intCast(shift);
+        if (byte & 0x80 == 0) return value;
+    }
+    return null;
+}
+
+fn zigzag(value: i64) u64 {
+    const bits: u64 = @bitCast(value);
+    return (bits << 1) ^ @as(u64, @bitCast(value >> 63));
+}
+
+fn unzigzag(value: u64) i64 {
+    return @bitCast((value >> 1) ^ (0 -% (value & 1)));
+}
+
+pub fn write_boolean(buffer: [*]u8, max_len: usize, value: bool) SerializationError!usize {
+    if (value_encoding == .v2) {
+        if (max_len < 1) return SerializationError.BufferTooSmall;
+        buffer[0] = if (value) V2_TRUE else V2_FALSE;
+        return 1;
+    }
+    if (max_len < 2) return SerializationError.BufferTooSmall;
+    buffer[0] = @intFromEnum(SerializationType.boolean);
+    buffer[1] = if (value) 1 else 0;
+    return 2;
+}
+
+pub fn write_integer(buffer: [*]u8, max_len: usize, value: i64) SerializationError!usize {
+    if (value_encoding == .v2) {
+        if (value >= 0 and value <= V2_SMALL_INT_MAX) {
+            if (max_len < 1) return SerializationError.BufferTooSmall;
+            buffer[0] = V2_SMALL_INT | @as(u8, @intCast(value));
+            return 1;
+        }
+        const encoded = zigzag(value);
+        if (max_len < 1 + varint_len(encoded)) return SerializationError.BufferTooSmall;
+        buffer[0] = V2_INTEGER;
+        return 1 + write_varint(buffer + 1, encoded);
+    }
+    if (max_len < 9) return SerializationError.BufferTooSmall;
+    buffer[0] = @intFromEnum(SerializationType.integer);
+    std.mem.writeInt(i64, buffer[1..9], value, .little);
+    return 9;
+}
+
+pub fn write_float(buffer: [*]u8, max_len: usize, value: f64) SerializationError!usize {
+    if (max_len < 9) return SerializationError.BufferTooSmall;
+    buffer[0] = if (value_encoding == .v2) V2_FLOAT else @intFromEnum(SerializationType.float);
+    std.mem.writeInt(u64, buffer[1..9], @bitCast(value), .little);
+    return 9;
+}
+
+/// Write the number at `index`. v1 writes integral floats as integers.
+pub fn write_number(L: *lua.lua_State, index: c_int, buffer: [*]u8, max_len: usize) SerializationError!usize {
+    if (value_encoding == .v2) {
+        if (lua.c.lua_isinteger(L, index) != 0) return write_integer(buffer, max_len, lua.tointeger(L, index));
+        return write_float(buffer, max_len, lua.tonumber(L, index));
+    }
+    const num = lua.tonumber(L, index);
+    const int_val = lua.tointeger(L, index);
+    if (@as(f64, @floatFromInt(int_val)) == num) return write_integer(buffer, max_len, int_val);
+    return write_float(buffer, max_len, num);
+}
+
+/// Size of the header write_string_header writes for `len` bytes
+pub fn string_header_len(len: usize) usize {
+    if (value_encoding == .v2) {
+        if (len <= V2_SHORT_STRING_MAX) return 1;
+        return 1 + varint_len(len);
+    }
+    return 5;
+}
+
+/// Header of a string value of `len` bytes; the bytes follow it
+pub fn write_string_header(buffer: [*]u8, len: usize) usize {
+    if (value_encoding == .v2) {
+        if (len <= V2_SHORT_STRING_MAX) {
+            buffer[0] = V2_SHORT_STRING | @as(u8, @intCast(len));
+            return 1;
+        }
+        buffer[0] = V2_STRING;
+        return 1 + write_varint(buffer + 1, len);
+    }
+    buffer[0] = @intFromEnum(SerializationType.string);
+    std.mem.writeInt(u32, buffer[1..5], @intCast(len), .little);
+    return 5;
+}
+
+pub fn write_string(buffer: [*]u8, max_len: usize, bytes: []const u8) SerializationError!usize {
+    const header_len = string_header_len(bytes.len);
+    if (max_len < header_len + bytes.len) return SerializationError.BufferTooSmall;
+    _ = write_string_header(buffer, bytes.len);
+    @memcpy(buffer[header_len..][0..bytes.len], bytes);
+    return header_len + bytes.len;
+}
+
+/// TABLE_INLINE and its entry count; `count` key/value pairs follow it
+pub fn write_inline_table_header(buffer: [*]u8, max_len: usize, count: usize) SerializationError!usize {
+    if (max_len < 1 + varint_len(count)) return SerializationError.BufferTooSmall;
+    buffer[0] = TABLE_INLINE;
+    return 1 + write_varint(buffer + 1, count);
+}
+
+pub fn write_table_ref(buffer: [*]u8, max_len: usize, table_id: u32) SerializationError!usize {
+    if (value_encoding == .v2) {
+        if (max_len < 1 + varint_len(table_id)) return SerializationError.BufferTooSmall;
+        buffer[0] = V2_TABLE_REF;
+        return 1 + write_varint(buffer + 1, table_id);
+    }
+    if (max_len < 5) return SerializationError.BufferTooSmall;
+    buffer[0] = @intFromEnum(SerializationType.table_ref);
+    std.mem.writeInt(u32, buffer[1..5], table_id, .little);
+    return 5;
+}
+
+// External table keys. By default every key reaches the host as a string,
+// integers (and floats with an integral value) in decimal form. Hosts that
+// opt in to `.tagged` get a type byte instead, like values: KEY_TAG_INTEGER
+// + i64 little-endian for integers, KEY_TAG_STRING + bytes for everything
+// else, so they can keep the array part of a table dense without formatting
+// or parsing decimal strings.
+//
+// `.interned` additionally registers each short string key with the host
+// the first time it is encoded (js_ext_key_intern) and from then on sends
+// KEY_TAG_HANDLE + u32 handle, so hot keys cost no text decoding on the
+// host. Handles are never reused and live as long as the Lua state; once the
+// table is full, or the host refuses a key, new keys stay plain strings.
+pub const KEY_TAG_INTEGER: u8 = 0x02;
+pub const KEY_TAG_STRING: u8 = 0x04;
+pub const KEY_TAG_HANDLE: u8 = 0x10;
+
+pub const KeyEncoding = enum { decimal, tagged, interned };
+
+const MAX_INTERNED_KEY_LEN = 64;
+const MAX_KEY_HANDLES = 4096;
+
+var key_encoding: KeyEncoding = .decimal;
+
+// Registry ref to { [key string] = handle }
+var key_handles_ref: c_int = lua.c.LUA_NOREF;
+var key_handle_count: u32 = 0;
+
+pub fn set_key_encoding(encoding: KeyEncoding) void {
+    key_encoding = encoding;
+}
+
+pub fn keys_are_tagged() bool {
+    return key_encoding != .decimal;
+}
+
+// Handle of the string key at `idx`, registering it on first use
+fn key_handle(L: *lua.lua_State, idx: c_int, key: []const u8) ?u32 {
+    if (key.len > MAX_INTERNED_KEY_LEN) return null;
+    const abs_idx = lua.c.lua_absindex(L, idx);
+
+    if (key_handles_ref == lua.c.LUA_NOREF) {
+        lua.newtable(L);
+        key_handles_ref = lua.ref(L);
+    }
+    _ = lua.getref(L, key_handles_ref);
+    defer lua.pop(L, 1);
+
+    lua.pushvalue(L, abs_idx);
+    if (lua.c.lua_rawget(L, -2) == lua.c.LUA_TNUMBER) {
+        const handle: u32 = @intCast(lua.tointeger(L, -1));
+        lua.pop(L, 1);
+        return handle;
+    }
+    lua.pop(L, 1);
+
+    if (key_handle_count >= MAX_KEY_HANDLES) return null;
+    const handle = key_handle_count + 1;
+    if (js_ext_key_intern(handle, key.ptr, key.len) != 0) {
+        // The host cannot keep handles; stop asking, keep the ones it has
+        key_handle_count = MAX_KEY_HANDLES;
+        return null;
+    }
+    key_handle_count = handle;
+
+    lua.pushvalue(L, abs_idx);
+    lua.pushinteger(L, handle);
+    lua.c.lua_rawset(L, -3);
+    return handle;
+}
+
+/// Encode the string or number key at `idx`
+pub fn encode_key(L: *lua.lua_State, idx: c_int, buffer: [*]u8, max_len: usize) SerializationError!usize {
+    if (lua.isstring(L, idx)) {
         var key_len: usize = 0;
-        const key_ptr = lua.tolstring(L, key_index, &key_len);
+        const key_ptr = lua.tolstring(L, idx, &key_len);
         if (key_len == 0) return SerializationError.InvalidFormat;
-        if (key_len > max_len) return SerializationError.BufferTooSmall;
-        @memcpy(buffer[0..key_len], key_ptr[0..key_len]);
-        return key_len;
+
+        if (key_encoding == .interned) {
+            if (key_handle(L, idx, key_ptr[0..key_len])) |handle| {
+                if (max_len < 5) return SerializationError.BufferTooSmall;
+                buffer[0] = KEY_TAG_HANDLE;
+                std.mem.writeInt(u32, buffer[1..5], handle, .little);
+                return 5;
+            }
+        }
+        return encode_string_key(key_ptr[0..key_len], buffer, max_len);
     }
 
-    if (lua.isnumber(L, key_index)) {
-        const num = lua.tonumber(L, key_index);
-        const int_val = lua.tointeger(L, key_index);
+    if (lua.isnumber(L, idx)) {
+        const num = lua.tonumber(L, idx);
+        const int_val = lua.tointeger(L, idx);
+        var buf: [32]u8 = undefined;
 
         if (@as(f64, @floatFromInt(int_val)) == num) {
-            var buf: [32]u8 = undefined;
+            if (keys_are_tagged()) {
+                if (max_len < 9) return SerializationError.BufferTooSmall;
+                buffer[0] = KEY_TAG_INTEGER;
+                std.mem.writeInt(i64, buffer[1..9], int_val, .little);
+                return 9;
+            }
             const num_str = std.fmt.bufPrint(&buf, "{d}", .{int_val}) catch {
                 return SerializationError.InvalidFormat;
             };
-            if (num_str.len > max_len) return SerializationError.BufferTooSmall;
-            @memcpy(buffer[0..num_str.len], num_str);
-            return num_str.len;
+            return encode_string_key(num_str, buffer, max_len);
         }
+
+        const num_str = std.fmt.bufPrint(&buf, "{d}", .{num}) catch {
+            return SerializationError.InvalidFormat;
+        };
+        return encode_string_key(num_str, buffer, max_len);
     }
 
     return SerializationError.TypeMismatch;
 }
 
-// Check if table is already being visited (circular reference detection)
+fn encode_string_key(key: []const u8, buffer: [*]u8, max_len: usize) SerializationError!usize {
+    const tag_len: usize = if (keys_are_tagged()) 1 else 0;
+    if (tag_len + key.len > max_len) return SerializationError.BufferTooSmall;
+    if (tag_len > 0) buffer[0] = KEY_TAG_STRING;
+    @memcpy(buffer[tag_len..][0..key.len], key);
+    return tag_len + key.len;
+}
+
+// Helper to serialize Lua table keys to external table format
+fn serialize_table_key(L: *lua.lua_State, key_index: c_int, buffer: [*]u8, max_len: usize) SerializationError!usize {
+    // Converted tables keep only string and integer keys
+    if (lua.isnumber(L, key_index)) {
+        const num = lua.tonumber(L, key_index);
+        if (@as(f64, @floatFromInt(lua.tointeger(L, key_index))) != num) return SerializationError.TypeMismatch;
+    }
+    return encode_key(L, key_index, buffer, max_len);
+}
+
+// Check if table is already being visited (circular reference detection).
+// The path is at most MAX_RECURSION_DEPTH long, so a scan beats hashing.
 fn is_table_visited(L: *lua.lua_State, table_index: c_int, ctx: *ConversionContext) bool {
-    // Push the table we're checking
+    const ptr = lua.c.lua_topointer(L, table_index);
+    for (ctx.visited[0..ctx.depth]) |visited| {
+        if (visited == ptr) return true;
+    }
+    return false;
+}
+
+// Conversion records make storing the same table into the same field again
+// cost O(changes). Each converted Lua table remembers the external table it
+// filled, the field it was written to (owner table id and key bytes) and a
+// shadow of what was pushed: { [key] = value }, or for a nested table its
+// own record. Re-converting for the same field reuses the external table
+// and sends only entries that are no longer rawequal to the shadow (nested
+// tables are converted recursively the same way), plus nil for removed
+// keys. Lua tables have no write barrier, so unchanged entries still cost a
+// raw comparison; they cost no serialization or host crossing.
+//
+// A write through the proxy or by the host makes the shadow stale, so
+// forget_conversion drops the record and the next store copies in full.
+// A table stored into a different field gets a fresh external table, as it
+// always did.
+//
+// Registry ref to weak-keyed { [lua table] = record }
+var conversions_ref: c_int = lua.c.LUA_NOREF;
+// Registry ref to weak-valued { [table_id] = record }
+var conversion_ids_ref: c_int = lua.c.LUA_NOREF;
+
+/// The current lua_State's registry refs, swapped by states.zig. Key
+/// handles are numbered across states, since the host keeps one key list
+pub const StateRefs = struct {
+    key_handles: c_int = lua.c.LUA_NOREF,
+    conversions: c_int = lua.c.LUA_NOREF,
+    conversion_ids: c_int = lua.c.LUA_NOREF,
+};
+
+pub fn save_refs() StateRefs {
+    return .{ .key_handles = key_handles_ref, .conversions = conversions_ref, .conversion_ids = conversion_ids_ref };
+}
+
+pub fn load_refs(refs: StateRefs) void {
+    key_handles_ref = refs.key_handles;
+    conversions_ref = refs.conversions;
+    conversion_ids_ref = refs.conversion_ids;
+}
+
+const WEAK_KEYS_MT: [*:0]const u8 = "cu.weak_keys";
+const WEAK_VALUES_MT: [*:0]const u8 = "cu.weak_values";
+
+// Record fields; a table_id of 0 marks a record that must not be reused
+const RECORD_TABLE_ID = 1;
+const RECORD_OWNER_ID = 2;
+const RECORD_OWNER_KEY = 3;
+const RECORD_SHADOW = 4;
+
+/// Stop reusing the external table `table_id` (0 = every table) for
+/// conversions, because its contents changed behind the shadow
+pub fn forget_conversion(L: *lua.lua_State, table_id: u32) void {
+    if (conversion_ids_ref == lua.c.LUA_NOREF) return;
+    if (table_id == 0) {
+        lua.unref(L, conversion_ids_ref);
+        lua.unref(L, conversions_ref);
+        conversion_ids_ref = lua.c.LUA_NOREF;
+        conversions_ref = lua.c.LUA_NOREF;
+        return;
+    }
+
+    _ = lua.getref(L, conversion_ids_ref);
+    if (lua.c.lua_rawgeti(L, -1, @intCast(table_id)) == lua.c.LUA_TTABLE) {
+        lua.pushinteger(L, 0);
+        lua.c.lua_rawseti(L, -2, RECORD_TABLE_ID);
+        lua.pushnil(L);
+        lua.c.lua_rawseti(L, -3, @intCast(table_id));
+    }
+    lua.pop(L, 2);
+}
+
+// Push the registry table behind `ref`, creating it with the given weak mode
+fn push_weak_registry_table(L: *lua.lua_State, ref: *c_int, meta_name: [*:0]const u8, mode: [*:0]const u8) void {
+    if (ref.* != lua.c.LUA_NOREF) {
+        _ = lua.getref(L, ref.*);
+        return;
+    }
+    lua.newtable(L);
+    if (lua.luaL_newmetatable(L, meta_name) != 0) {
+        _ = lua.pushstring(L, mode);
+        lua.setfield(L, -2, "__mode");
+    }
+    _ = lua.setmetatable(L, -2);
+    lua.pushvalue(L, -1);
+    ref.* = lua.ref(L);
+}
+
+// Push the conversion record of the table at absolute `table_index`, or nil
+fn push_record(L: *lua.lua_State, table_index: c_int) void {
+    if (conversions_ref == lua.c.LUA_NOREF) {
+        lua.pushnil(L);
+        return;
+    }
+    _ = lua.getref(L, conversions_ref);
     lua.pushvalue(L, table_index);
+    _ = lua.c.lua_rawget(L, -2);
+    lua.c.lua_rotate(L, -2, 1);
+    lua.pop(L, 1);
+}
 
-    // Check if it's in the visited map
-    _ = lua.c.lua_rawget(L, ctx.visited_stack_index);
-    const is_visited = !lua.isnil(L, -1);
+// Push the record to convert the table at absolute `table_index` with, and
+// return the external table it can reuse, or 0 for a fresh record
+fn push_conversion(L: *lua.lua_State, table_index: c_int, ctx: *ConversionContext) u32 {
+    push_record(L, table_index);
+    if (lua.istable(L, -1) and ctx.owner_id != 0) {
+        _ = lua.c.lua_rawgeti(L, -1, RECORD_TABLE_ID);
+        const table_id: u32 = @intCast(lua.tointeger(L, -1));
+        _ = lua.c.lua_rawgeti(L, -2, RECORD_OWNER_ID);
+        const owner_id = lua.tointeger(L, -1);
+        _ = lua.c.lua_rawgeti(L, -3, RECORD_OWNER_KEY);
+        var key_len: usize = 0;
+        const key = lua.tolstring(L, -1, &key_len);
+        const same_owner = owner_id == ctx.owner_id and std.mem.eql(u8, key[0..key_len], ctx.owner_key);
+        lua.pop(L, 3);
+        if (table_id != 0 and same_owner) return table_id;
+    }
+    lua.pop(L, 1);
 
-    // Clean up stack: pop result
+    lua.c.lua_createtable(L, 4, 0);
+    lua.pushinteger(L, 0);
+    lua.c.lua_rawseti(L, -2, RECORD_TABLE_ID);
+    lua.pushinteger(L, ctx.owner_id);
+    lua.c.lua_rawseti(L, -2, RECORD_OWNER_ID);
+    _ = lua.pushlstring(L, ctx.owner_key.ptr, ctx.owner_key.len);
+    lua.c.lua_rawseti(L, -2, RECORD_OWNER_KEY);
+    lua.newtable(L);
+    lua.c.lua_rawseti(L, -2, RECORD_SHADOW);
+
+    push_weak_registry_table(L, &conversions_ref, WEAK_KEYS_MT, "k");
+    lua.pushvalue(L, table_index);
+    lua.pushvalue(L, -3);
+    lua.c.lua_rawset(L, -3);
     lua.pop(L, 1);
+    return 0;
+}
+
+// Create the external table for the fresh record at `record_index`
+fn create_for_record(L: *lua.lua_State, record_index: c_int) u32 {
+    const table_id = ext_table.create_table(L);
+    lua.pop(L, 1); // proxy
 
-    return is_visited;
+    lua.pushinteger(L, table_id);
+    lua.c.lua_rawseti(L, record_index, RECORD_TABLE_ID);
+
+    push_weak_registry_table(L, &conversion_ids_ref, WEAK_VALUES_MT, "v");
+    lua.pushvalue(L, record_index);
+    lua.c.lua_rawseti(L, -2, @intCast(table_id));
+    lua.pop(L, 1);
+    return table_id;
 }
 
-// Mark table as visited
-fn mark_table_visited(L: *lua.lua_State, table_index: c_int, ctx: *ConversionContext) void {
-    // Push the table as key
-    lua.pushvalue(L, table_index);
+// Drop a record whose external table no longer matches its shadow
+fn abandon_record(L: *lua.lua_State, record_index: c_int) void {
+    _ = lua.c.lua_rawgeti(L, record_index, RECORD_TABLE_ID);
+    const table_id: u32 = @intCast(lua.tointeger(L, -1));
+    lua.pop(L, 1);
+    if (table_id != 0) forget_conversion(L, table_id);
+}
 
-    // Push true as value
-    lua.pushboolean(L, 1);
+// True when shadow[key] is rawequal to the value on top of the stack
+fn shadow_matches(L: *lua.lua_State, shadow_index: c_int, key_index: c_int) bool {
+    lua.pushvalue(L, key_index);
+    _ = lua.c.lua_rawget(L, shadow_index);
+    const same = lua.c.lua_rawequal(L, -1, -2) != 0;
+    lua.pop(L, 1);
+    return same;
+}
 
-    // Set visited[table] = true
-    lua.c.lua_rawset(L, ctx.visited_stack_index);
+// shadow[key] = value on top of the stack, which is popped
+fn set_shadow(L: *lua.lua_State, shadow_index: c_int, key_index: c_int) void {
+    lua.pushvalue(L, key_index);
+    lua.c.lua_rotate(L, -2, 1);
+    lua.c.lua_rawset(L, shadow_index);
 }
 
-// Unmark table as visited (for cleanup)
-fn unmark_table_visited(L: *lua.lua_State, table_index: c_int, ctx: *ConversionContext) void {
-    // Push the table as key
-    lua.pushvalue(L, table_index);
+fn is_external_table(L: *lua.lua_State, index: c_int) bool {
+    _ = lua.getfield(L, index, "__ext_table_id");
+    const external = !lua.isnil(L, -1);
+    lua.pop(L, 1);
+    return external;
+}
 
-    // Push nil as value to remove
-    lua.pushnil(L);
+// Entries of a converted table are serialized straight into a heap batch
+// and reach the host through js_ext_table_set_many (frames of u32 key_len,
+// key, u32 value_len, value) rather than one crossing per entry. A value too
+// large for an empty batch goes out on its own through store_large_value.
+const SET_BATCH_BYTES: usize = 32 * 1024;
+
+// Space kept for the value of a frame: a nested table is converted before
+// its 5-byte table_ref is written and must not need a retry
+const MIN_VALUE_ROOM: usize = 16;
+
+const SetBatch = struct {
+    table_id: u32,
+    buf: [*]u8,
+    len: usize = 0,
+    flushes: usize = 0,
+    // Whether any entry has reached the host
+    sent: bool = false,
+
+    fn init(table_id: u32) ?SetBatch {
+        const buf = scratch.alloc(SET_BATCH_BYTES) orelse return null;
+        return .{ .table_id = table_id, .buf = buf };
+    }
+
+    fn deinit(self: *SetBatch) void {
+        scratch.free(self.buf, SET_BATCH_BYTES);
+    }
+
+    /// Serialize the key and value on top of the stack as the next frame
+    fn add(self: *SetBatch, L: *lua.lua_State, ctx: *ConversionContext) SerializationError!void {
+        while (true) {
+            const frame = self.buf + self.len;
+            const room = SET_BATCH_BYTES - self.len;
+
+            const key_len = serialize_table_key(L, -2, frame + 4, room -| (8 + MIN_VALUE_ROOM)) catch |err| {
+                if (err == SerializationError.BufferTooSmall and self.len > 0) {
+                    try self.flush();
+                    continue;
+                }
+                return err;
+            };
+
+            const value = frame + 8 + key_len;
+            const owner_id = ctx.owner_id;
+            const owner_key = ctx.owner_key;
+            ctx.owner_id = self.table_id;
+            ctx.owner_key = frame[4..][0..key_len];
+            defer {
+                ctx.owner_id = owner_id;
+                ctx.owner_key = owner_key;
+            }
+
+            const value_len = serialize_value_with_context(L, -1, value, room - 8 - key_len, ctx) catch |err| {
+                if (err != SerializationError.BufferTooSmall) return err;
+                if (self.len > 0) {
+                    try self.flush();
+                    continue;
+                }
+                self.sent = true;
+                return store_large_value(L, self.table_id, frame[4..][0..key_len], -1);
+            };
+
+            std.mem.writeInt(u32, frame[0..4], @intCast(key_len), .little);
+            std.mem.writeInt(u32, frame[4 + key_len ..][0..4], @intCast(value_len), .little);
+            self.len += 8 + key_len + value_len;
+            return;
+        }
+    }
+
+    /// Take back frames added since `mark`, if they have not been sent
+    fn rollback(self: *SetBatch, mark: usize, flushes: usize) bool {
+        if (self.flushes != flushes or self.len <= mark) return false;
+        self.len = mark;
+        return true;
+    }
+
+    fn flush(self: *SetBatch) SerializationError!void {
+        if (self.len == 0) return;
+        const result = js_ext_table_set_many(self.table_id, self.buf, self.len);
+        self.len = 0;
+        self.flushes += 1;
+        self.sent = true;
+        if (host_refused(result)) return SerializationError.InvalidFormat;
+    }
+};
+
+// Values too large for the I/O windows or a batch. A string (or the bytes
+// of a strbuf) goes to the host in place as header + body
+// (js_ext_table_set_parts) and a typed array in place as is, so only the
+// host copies their bytes. A bigint is written into a GC-managed scratch
+// buffer of its size, and function bytecode into one that grows up to
+// MAX_LARGE_VALUE_BYTES.
+pub const MAX_LARGE_VALUE_BYTES: usize = 16 * 1024 * 1024;
 
-    // Set visited[table] = nil
-    lua.c.lua_rawset(L, ctx.visited_stack_index);
+pub fn store_large_value(L: *lua.lua_State, table_id: u32, key: []const u8, value_index: c_int) SerializationError!void {
+    const abs_index = lua.c.lua_absindex(L, value_index);
+
+    const text: ?[]const u8 = if (lua.isstring(L, abs_index)) blk: {
+        var str_len: usize = 0;
+        const str = lua.tolstring(L, abs_index, &str_len);
+        break :blk str[0..str_len];
+    } else strbuf.bytes(L, abs_index);
+
+    if (text) |str| {
+        if (str.len > MAX_LARGE_VALUE_BYTES) return SerializationError.BufferTooSmall;
+
+        var header: [8]u8 = undefined;
+        const header_len = write_string_header(&header, str.len);
+        if (host_refused(js_ext_table_set_parts(table_id, key.ptr, key.len, &header, header_len, str.ptr, str.len))) {
+            return SerializationError.BufferTooSmall;
+        }
+        return;
+    }
+
+    if (typed_array.value_bytes(L, abs_index)) |bytes| {
+        if (host_refused(js_ext_table_set(table_id, key.ptr, key.len, bytes.ptr, bytes.len))) return SerializationError.InvalidFormat;
+        return;
+    }
+
+    if (bigint.value_len(L, abs_index)) |size| {
+        if (size > MAX_LARGE_VALUE_BYTES) return SerializationError.BufferTooSmall;
+        const buffer: [*]u8 = @ptrCast(lua.c.lua_newuserdatauv(L, size, 0).?);
+        defer lua.pop(L, 1);
+        _ = bigint.write(L, abs_index, buffer);
+        if (host_refused(js_ext_table_set(table_id, key.ptr, key.len, buffer, size))) return SerializationError.InvalidFormat;
+        return;
+    }
+
+    if (!lua.isfunction(L, abs_index)) return SerializationError.BufferTooSmall;
+
+    var size: usize = 64 * 1024;
+    while (size <= MAX_LARGE_VALUE_BYTES) : (size *= 4) {
+        const buffer: [*]u8 = @ptrCast(lua.c.lua_newuserdatauv(L, size, 0).?);
+        defer lua.pop(L, 1);
+
+        var ctx = ConversionContext{ .depth = 0, .owner_id = table_id, .owner_key = key };
+        const len = function_serializer.serialize_function(L, abs_index, buffer, size, &ctx) catch |err| {
+            if (err == SerializationError.BufferTooSmall) continue;
+            return err;
+        };
+        if (host_refused(js_ext_table_set(table_id, key.ptr, key.len, buffer, len))) return SerializationError.InvalidFormat;
+        return;
+    }
+    return SerializationError.BufferTooSmall;
 }
 
 // Convert a regular Lua table to an external table
@@ -128,79 +772,145 @@ fn convert_table_to_external(
         return SerializationError.CircularReference;
     }
 
-    // Mark table as visited
-    mark_table_visited(L, abs_table_index, ctx);
-    defer unmark_table_visited(L, abs_table_index, ctx); // Unmark when done
-
-    // Increment depth
+    // Mark table as visited; leaving the level unmarks it
+    ctx.visited[ctx.depth] = lua.c.lua_topointer(L, abs_table_index);
     ctx.depth += 1;
     defer ctx.depth -= 1;
 
-    // Create new external table
-    const table_id = ext_table.create_table(L);
-    _ = lua.gettop(L); // external table is now on stack
-
-    // Count entries and check limit
+    const reused_id = push_conversion(L, abs_table_index, ctx);
+    const record_index = lua.gettop(L);
+    defer lua.settop(L, record_index - 1);
+    const table_id = if (reused_id != 0) reused_id else create_for_record(L, record_index);
+    // Keys stored below bypass the table's negative-lookup filter
+    if (reused_id != 0) key_filter.forget(reused_id);
+    _ = lua.c.lua_rawgeti(L, record_index, RECORD_SHADOW);
+    const shadow_index = lua.gettop(L);
+    // Whatever was sent, the shadow may now claim more than the host has
+    errdefer abandon_record(L, record_index);
+
+    // Keys and values are serialized into the batch, off the C stack
+    var batch = SetBatch.init(table_id) orelse return SerializationError.BufferTooSmall;
+    defer batch.deinit();
+    var changed = false;
+
+    // The entry limit is enforced as the table is walked. A fresh external
+    // table that overflows is emptied again. A reused one is updated in
+    // place, which cannot be undone, so the rest of the table is counted
+    // before its first change.
     var entry_count: usize = 0;
+    var counted = reused_id == 0;
+
     lua.pushnil(L);
     while (lua.c.lua_next(L, abs_table_index) != 0) {
+        // Stack: ... key, value
+        const key_index = lua.gettop(L) - 1;
         entry_count += 1;
-        if (entry_count > MAX_TABLE_ENTRIES) {
+        if (entry_count > max_table_entries) {
             lua.pop(L, 2); // pop value and key
-            lua.pop(L, 1); // pop external table
+            discard_sent_entries(L, abs_table_index, &batch, entry_count - 1);
             return SerializationError.TableTooLarge;
         }
-        lua.pop(L, 1); // pop value, keep key for next iteration
-    }
-
-    // Allocate buffers for key and value serialization
-    var key_buffer: [4096]u8 = undefined;
-    var value_buffer: [16384]u8 = undefined;
-
-    // Iterate over table and populate external table
-    lua.pushnil(L);
-    while (lua.c.lua_next(L, abs_table_index) != 0) {
-        // Stack: ... ext_table, key, value
 
-        // Serialize the key
-        const key_len = serialize_table_key(L, -2, &key_buffer, key_buffer.len) catch |err| {
-            lua.pop(L, 2); // pop value and key
-            lua.pop(L, 1); // pop external table
-            return err;
-        };
+        const nested = lua.istable(L, -1) and !is_external_table(L, -1);
 
-        // Serialize the value (recursive for nested tables)
-        const value_len = serialize_value_with_context(L, -1, &value_buffer, value_buffer.len, ctx) catch |err| {
-            lua.pop(L, 2); // pop value and key
-            lua.pop(L, 1); // pop external table
-            return err;
-        };
+        // Function upvalues can change under the same closure and typed
+        // arrays can be written in place, so both are always sent
+        const mutable = lua.isfunction(L, -1) or lua.c.lua_type(L, -1) == lua.c.LUA_TUSERDATA;
+        if (!nested and !mutable and shadow_matches(L, shadow_index, key_index)) {
+            lua.pop(L, 1);
+            continue;
+        }
 
-        // Store in external table via JavaScript bridge
-        const result = js_ext_table_set(
-            table_id,
-            &key_buffer,
-            key_len,
-            &value_buffer,
-            value_len,
-        );
+        if (!counted) {
+            if (entry_count + count_remaining(L, abs_table_index, key_index) > max_table_entries) {
+                lua.pop(L, 2); // pop value and key
+                return SerializationError.TableTooLarge;
+            }
+            counted = true;
+        }
 
-        if (result != 0) {
-            lua.pop(L, 2); // pop value and key
-            lua.pop(L, 1); // pop external table
-            return SerializationError.InvalidFormat;
+        const mark = batch.len;
+        const flushes = batch.flushes;
+        // Serialize key and value (recursive for nested tables)
+        try batch.add(L, ctx);
+
+        if (nested and !ctx.stored_inline) {
+            // An unchanged nested table keeps its record and external table
+            push_record(L, key_index + 1);
+            if (shadow_matches(L, shadow_index, key_index) and batch.rollback(mark, flushes)) {
+                lua.pop(L, 2);
+                continue;
+            }
+        } else {
+            // A table stored inline is always sent. Its shadow is the table
+            // itself, so a later removal is still noticed.
+            lua.pushvalue(L, -1);
         }
+        set_shadow(L, shadow_index, key_index);
+        changed = true;
 
         // Pop value, keep key for next iteration
         lua.pop(L, 1);
     }
 
-    // Pop the external table from stack
-    lua.pop(L, 1);
+    // Keys removed since the last conversion are stored as nil
+    if (reused_id != 0) {
+        lua.pushnil(L);
+        while (lua.c.lua_next(L, shadow_index) != 0) {
+            // Stack: ... key, shadow value
+            const key_index = lua.gettop(L) - 1;
+            lua.pushvalue(L, key_index);
+            if (lua.c.lua_rawget(L, abs_table_index) != lua.c.LUA_TNIL) {
+                lua.pop(L, 2);
+                continue;
+            }
+            lua.pushvalue(L, key_index);
+            lua.pushnil(L);
+            try batch.add(L, ctx);
+            // Clearing a field during traversal is allowed
+            lua.c.lua_rawset(L, shadow_index);
+            changed = true;
+            lua.pop(L, 2);
+        }
+    }
+
+    try batch.flush();
+
+    // Cached reads of the reused table may now be out of date
+    if (reused_id != 0 and changed) ext_table.invalidate_table(L, table_id);
 
     return table_id;
 }
 
+// Number of entries after the key at `key_index`
+fn count_remaining(L: *lua.lua_State, table_index: c_int, key_index: c_int) usize {
+    var count: usize = 0;
+    lua.pushvalue(L, key_index);
+    while (lua.c.lua_next(L, table_index) != 0) {
+        count += 1;
+        lua.pop(L, 1);
+    }
+    return count;
+}
+
+// Delete the first `count` keys of a fresh external table that overflowed,
+// if any of them reached the host. Keys are encoded into the unused batch.
+fn discard_sent_entries(L: *lua.lua_State, table_index: c_int, batch: *SetBatch, count: usize) void {
+    if (!batch.sent) return;
+    batch.len = 0;
+
+    var seen: usize = 0;
+    lua.pushnil(L);
+    while (seen < count and lua.c.lua_next(L, table_index) != 0) : (seen += 1) {
+        lua.pop(L, 1);
+        if (serialize_table_key(L, -1, batch.buf, SET_BATCH_BYTES)) |key_len| {
+            _ = js_ext_table_delete(batch.table_id, batch.buf, key_len);
+        } else |_| {}
+    }
+    // Stopping early leaves the last key on the stack
+    if (seen == count) lua.pop(L, 1);
+}
+
 // Internal version of serialize_value that accepts a context for recursion tracking
 fn serialize_value_with_context(
     L: *lua.lua_State,
@@ -211,116 +921,231 @@ fn serialize_value_with_context(
 ) SerializationError!usize {
     if (max_len == 0) return SerializationError.BufferTooSmall;
 
-    if (lua.isnil(L, stack_index)) {
-        if (max_len < 1) return SerializationError.BufferTooSmall;
-        buffer[0] = @intFromEnum(SerializationType.nil);
-        return 1;
+    // One lua_type call picks the encoder; strings and numbers keep their type
+    switch (lua.c.lua_type(L, stack_index)) {
+        lua.c.LUA_TNIL => {
+            buffer[0] = @intFromEnum(SerializationType.nil);
+            return 1;
+        },
+        lua.c.LUA_TBOOLEAN => return write_boolean(buffer, max_len, lua.toboolean(L, stack_index)),
+        lua.c.LUA_TNUMBER => return write_number(L, stack_index, buffer, max_len),
+        lua.c.LUA_TSTRING => {
+            var str_len: usize = 0;
+            const str = lua.tolstring(L, stack_index, &str_len);
+            return write_string(buffer, max_len, str[0..str_len]);
+        },
+        lua.c.LUA_TFUNCTION => return function_serializer.serialize_function(L, stack_index, buffer, max_len, ctx),
+        lua.c.LUA_TTABLE => return serialize_table_value(L, stack_index, buffer, max_len, ctx),
+        lua.c.LUA_TUSERDATA => return serialize_userdata(L, stack_index, buffer, max_len, ctx),
+        else => return SerializationError.TypeMismatch,
     }
+}
 
-    if (lua.isboolean(L, stack_index)) {
-        if (max_len < 2) return SerializationError.BufferTooSmall;
-        buffer[0] = @intFromEnum(SerializationType.boolean);
-        const val = lua.toboolean(L, stack_index);
-        buffer[1] = if (val) 1 else 0;
-        return 2;
+fn serialize_table_value(
+    L: *lua.lua_State,
+    stack_index: c_int,
+    buffer: [*]u8,
+    max_len: usize,
+    ctx: *ConversionContext,
+) SerializationError!usize {
+    // Check if it's already an external table
+    _ = lua.getfield(L, stack_index, "__ext_table_id");
+    if (!lua.isnil(L, -1)) {
+        // It's an external table - serialize as reference
+        const table_id: u32 = @intCast(lua.tointeger(L, -1));
+        lua.pop(L, 1);
+        return write_table_ref(buffer, max_len, table_id);
     }
+    lua.pop(L, 1);
 
-    if (lua.isnumber(L, stack_index)) {
-        const num = lua.tonumber(L, stack_index);
-        const int_val = lua.tointeger(L, stack_index);
-
-        if (@as(f64, @floatFromInt(int_val)) == num) {
-            if (max_len < 9) return SerializationError.BufferTooSmall;
-            buffer[0] = @intFromEnum(SerializationType.integer);
-            const bytes = std.mem.asBytes(&int_val);
-            @memcpy(buffer[1..9], bytes);
-            return 9;
-        } else {
-            if (max_len < 9) return SerializationError.BufferTooSmall;
-            buffer[0] = @intFromEnum(SerializationType.float);
-            const bytes = std.mem.asBytes(&num);
-            @memcpy(buffer[1..9], bytes);
-            return 9;
+    // Only tables nested in one being converted are inlined; a table
+    // assigned to a field directly stays external so it can be updated
+    // in place (`_home.t = {}` then `_home.t.x = 1`)
+    if (inline_max_entries > 0 and ctx.depth > 0) {
+        if (serialize_inline_table(L, stack_index, buffer, max_len, ctx)) |len| {
+            ctx.stored_inline = true;
+            return len;
+        } else |err| {
+            if (err != SerializationError.NotInlinable or ctx.inlining) return err;
         }
     }
 
-    if (lua.isstring(L, stack_index)) {
-        var str_len: usize = 0;
-        const str = lua.tolstring(L, stack_index, &str_len);
-
-        if (max_len < 5 + str_len) return SerializationError.BufferTooSmall;
+    // Regular table - convert to external table
+    const table_id = try convert_table_to_external(L, stack_index, ctx);
+    ctx.stored_inline = false;
+    return write_table_ref(buffer, max_len, table_id);
+}
 
-        buffer[0] = @intFromEnum(SerializationType.string);
+// Typed arrays, strbufs, bigints, blobs and struct records; other userdata
+// has no stored form
+fn serialize_userdata(
+    L: *lua.lua_State,
+    stack_index: c_int,
+    buffer: [*]u8,
+    max_len: usize,
+    ctx: *ConversionContext,
+) SerializationError!usize {
+    if (typed_array.value_bytes(L, stack_index)) |bytes| {
+        if (max_len < bytes.len) return SerializationError.BufferTooSmall;
+        @memcpy(buffer[0..bytes.len], bytes);
+        return bytes.len;
+    }
 
-        const len_u32: u32 = @intCast(str_len);
-        const len_bytes = std.mem.asBytes(&len_u32);
-        @memcpy(buffer[1..5], len_bytes);
+    // A strbuf is stored as the string it holds
+    if (strbuf.bytes(L, stack_index)) |bytes| {
+        return write_string(buffer, max_len, bytes);
+    }
 
-        if (str_len > 0) {
-            @memcpy(buffer[5 .. 5 + str_len], str[0..str_len]);
-        }
+    if (bigint.value_len(L, stack_index)) |size| {
+        if (max_len < size) return SerializationError.BufferTooSmall;
+        return bigint.write(L, stack_index, buffer);
+    }
 
-        return 5 + str_len;
+    if (blob.is_blob(L, stack_index)) {
+        // The handle must reach the host while the blob is alive
+        if (ctx.inlining) return SerializationError.NotInlinable;
+        if (max_len < blob.HANDLE_LEN) return SerializationError.BufferTooSmall;
+        return blob.write_handle(L, stack_index, buffer).?;
     }
 
-    if (lua.isfunction(L, stack_index)) {
-        return function_serializer.serialize_function(L, stack_index, buffer, max_len);
+    // A struct record is stored by value, as an inline table of its fields
+    if (struct_record.push_row(L, stack_index)) {
+        defer lua.pop(L, 1);
+        const row = lua.gettop(L);
+        var count: usize = 0;
+        lua.pushnil(L);
+        while (lua.c.lua_next(L, row) != 0) : (count += 1) lua.pop(L, 1);
+        return encode_inline_entries(L, row, buffer, max_len, count, ctx);
     }
 
-    if (lua.istable(L, stack_index)) {
-        // Check if it's already an external table
-        _ = lua.getfield(L, stack_index, "__ext_table_id");
-        if (!lua.isnil(L, -1)) {
-            // It's an external table - serialize as reference
-            const table_id = lua.tointeger(L, -1);
-            lua.pop(L, 1);
+    return SerializationError.TypeMismatch;
+}
 
-            if (max_len < 5) return SerializationError.BufferTooSmall;
-            buffer[0] = @intFromEnum(SerializationType.table_ref);
-            const id_u32: u32 = @intCast(table_id);
-            const id_bytes = std.mem.asBytes(&id_u32);
-            @memcpy(buffer[1..5], id_bytes);
-            return 5;
+/// Serialize an upvalue of a closure being stored. A table that is being
+/// converted further up, such as the module table holding the closure, is
+/// written as a reference to its external table instead of failing as
+/// circular.
+pub fn serialize_captured_value(
+    L: *lua.lua_State,
+    stack_index: c_int,
+    buffer: [*]u8,
+    max_len: usize,
+    ctx: *ConversionContext,
+) SerializationError!usize {
+    const abs_index = lua.c.lua_absindex(L, stack_index);
+    if (lua.istable(L, abs_index) and is_table_visited(L, abs_index, ctx) and !ctx.inlining) {
+        push_record(L, abs_index);
+        defer lua.pop(L, 1);
+        if (lua.istable(L, -1)) {
+            _ = lua.c.lua_rawgeti(L, -1, RECORD_TABLE_ID);
+            const table_id: u32 = @intCast(lua.tointeger(L, -1));
+            lua.pop(L, 1);
+            if (table_id != 0) return write_table_ref(buffer, max_len, table_id);
         }
+        return SerializationError.CircularReference;
+    }
+    return serialize_value_with_context(L, abs_index, buffer, max_len, ctx);
+}
+
+// Encode a table as TABLE_INLINE. Fails with NotInlinable if it is over the
+// limits or holds something that needs conversion, and with BufferTooSmall
+// only when `max_len` rather than the byte limit was what ran out, so a
+// caller with a partly filled buffer can retry in a fresh one.
+fn serialize_inline_table(
+    L: *lua.lua_State,
+    table_index: c_int,
+    buffer: [*]u8,
+    max_len: usize,
+    ctx: *ConversionContext,
+) SerializationError!usize {
+    if (ctx.depth >= MAX_RECURSION_DEPTH) return SerializationError.NotInlinable;
+
+    const abs_table_index = lua.c.lua_absindex(L, table_index);
+    if (is_table_visited(L, abs_table_index, ctx)) return SerializationError.CircularReference;
+
+    var count: usize = 0;
+    lua.pushnil(L);
+    while (lua.c.lua_next(L, abs_table_index) != 0) {
         lua.pop(L, 1);
+        count += 1;
+        if (count > inline_max_entries) {
+            lua.pop(L, 1); // pop key
+            return SerializationError.NotInlinable;
+        }
+    }
 
-        // Regular table - convert to external table
-        const table_id = try convert_table_to_external(L, stack_index, ctx);
+    ctx.visited[ctx.depth] = lua.c.lua_topointer(L, abs_table_index);
+    ctx.depth += 1;
+    const inlining = ctx.inlining;
+    ctx.inlining = true;
+    defer {
+        ctx.depth -= 1;
+        ctx.inlining = inlining;
+    }
 
-        if (max_len < 5) return SerializationError.BufferTooSmall;
-        buffer[0] = @intFromEnum(SerializationType.table_ref);
-        const id_u32: u32 = @intCast(table_id);
-        const id_bytes = std.mem.asBytes(&id_u32);
-        @memcpy(buffer[1..5], id_bytes);
-        return 5;
+    return encode_inline_entries(L, abs_table_index, buffer, @min(max_len, inline_max_bytes), count, ctx) catch |err| {
+        if (err == SerializationError.BufferTooSmall and max_len >= inline_max_bytes) {
+            return SerializationError.NotInlinable;
+        }
+        return err;
+    };
+}
+
+fn encode_inline_entries(
+    L: *lua.lua_State,
+    table_index: c_int,
+    buffer: [*]u8,
+    max_len: usize,
+    count: usize,
+    ctx: *ConversionContext,
+) SerializationError!usize {
+    var offset = try write_inline_table_header(buffer, max_len, count);
+
+    lua.pushnil(L);
+    while (lua.c.lua_next(L, table_index) != 0) {
+        // Stack: ... key, value
+        offset += serialize_inline_key(L, -2, buffer + offset, max_len - offset) catch |err| {
+            lua.pop(L, 2);
+            return err;
+        };
+        offset += serialize_value_with_context(L, -1, buffer + offset, max_len - offset, ctx) catch |err| {
+            lua.pop(L, 2);
+            return err;
+        };
+        lua.pop(L, 1);
     }
+    return offset;
+}
 
-    return SerializationError.TypeMismatch;
+// Inline keys are written as values. Keys an external table could not hold
+// either leave the table to conversion, which reports them.
+fn serialize_inline_key(L: *lua.lua_State, key_index: c_int, buffer: [*]u8, max_len: usize) SerializationError!usize {
+    if (max_len == 0) return SerializationError.BufferTooSmall;
+    if (lua.c.lua_type(L, key_index) == lua.c.LUA_TNUMBER) return write_number(L, key_index, buffer, max_len);
+    if (lua.c.lua_type(L, key_index) == lua.c.LUA_TSTRING) {
+        var str_len: usize = 0;
+        const str = lua.tolstring(L, key_index, &str_len);
+        return write_string(buffer, max_len, str[0..str_len]);
+    }
+    return SerializationError.NotInlinable;
 }
 
-// Public API - creates context and delegates to internal function
-pub fn serialize_value(L: *lua.lua_State, stack_index: c_int, buffer: [*]u8, max_len: usize) SerializationError!usize {
+// Public API - creates context and delegates to internal function. The value
+// is being stored under `owner_key` of external table `owner_id`.
+pub fn serialize_value(L: *lua.lua_State, stack_index: c_int, buffer: [*]u8, max_len: usize, owner_id: u32, owner_key: []const u8) SerializationError!usize {
     const initial_top = lua.gettop(L);
 
-    // Create a table on the stack to track visited tables
-    lua.newtable(L); // Create visited tracking table
-    const visited_index = lua.gettop(L);
-
     var ctx = ConversionContext{
         .depth = 0,
-        .visited_stack_index = visited_index,
+        .owner_id = owner_id,
+        .owner_key = owner_key,
     };
 
-    // Adjust stack_index if it's relative and we pushed the visited table
-    var adjusted_index = stack_index;
-    if (stack_index < 0 and stack_index > lua.c.LUA_REGISTRYINDEX) {
-        // Negative indices need adjustment since we pushed a value
-        adjusted_index = stack_index - 1;
-    }
-
-    const result = serialize_value_with_context(L, adjusted_index, buffer, max_len, &ctx);
+    const result = serialize_value_with_context(L, stack_index, buffer, max_len, &ctx);
+    perf.counters.serialize_calls +%= 1;
+    perf.counters.serialize_bytes +%= result catch 0;
 
-    // Clean up: remove visited table from stack
+    // Clean up anything a failed conversion left behind
     lua.settop(L, initial_top);
 
     return result;
@@ -330,6 +1155,7 @@ pub fn deserialize_value(L: *lua.lua_State, buffer: [*]const u8, len: usize) Ser
     if (len < 1) return SerializationError.InvalidFormat;
 
     const type_byte = buffer[0];
+    if (type_byte > @intFromEnum(SerializationType.table_ref)) return deserialize_v2(L, buffer[0..len]);
     const value_type: SerializationType = @enumFromInt(type_byte);
 
     switch (value_type) {
@@ -386,6 +1212,170 @@ pub fn deserialize_value(L: *lua.lua_State, buffer: [*]const u8, len: usize) Ser
     }
 }
 
+fn deserialize_v2(L: *lua.lua_State, bytes: []const u8) SerializationError!void {
+    const tag = bytes[0];
+    if (tag >= V2_SMALL_INT and tag <= V2_SMALL_INT | V2_SMALL_INT_MAX) {
+        lua.pushinteger(L, tag & 0x1f);
+        return;
+    }
+    if (tag >= V2_SHORT_STRING and tag <= V2_SHORT_STRING | V2_SHORT_STRING_MAX) {
+        const str_len: usize = tag & 0x3f;
+        if (bytes.len < 1 + str_len) return SerializationError.InvalidFormat;
+        _ = lua.pushlstring(L, bytes.ptr + 1, str_len);
+        return;
+    }
+
+    var offset: usize = 1;
+    switch (tag) {
+        V2_FALSE, V2_TRUE => lua.pushboolean(L, @intFromBool(tag == V2_TRUE)),
+        V2_INTEGER => {
+            const encoded = read_varint(bytes, &offset) orelse return SerializationError.InvalidFormat;
+            lua.pushinteger(L, unzigzag(encoded));
+        },
+        V2_FLOAT => {
+            if (bytes.len < 9) return SerializationError.InvalidFormat;
+            lua.pushnumber(L, @bitCast(std.mem.readInt(u64, bytes[1..9], .little)));
+        },
+        V2_STRING => {
+            const str_len = read_varint(bytes, &offset) orelse return SerializationError.InvalidFormat;
+            if (bytes.len - offset < str_len) return SerializationError.InvalidFormat;
+            _ = lua.pushlstring(L, bytes.ptr + offset, @intCast(str_len));
+        },
+        V2_TABLE_REF => {
+            const table_id = read_varint(bytes, &offset) orelse return SerializationError.InvalidFormat;
+            if (table_id > std.math.maxInt(u32)) return SerializationError.InvalidFormat;
+            ext_table.attach_table(L, @intCast(table_id));
+        },
+        TABLE_INLINE => try deserialize_inline_table(L, bytes),
+        typed_array.TYPED_ARRAY => if (!typed_array.push(L, bytes)) return SerializationError.InvalidFormat,
+        bigint.BIGINT => if (!bigint.push(L, bytes)) return SerializationError.InvalidFormat,
+        blob.BLOB, blob.BLOB_HANDLE => if (!blob.push(L, bytes)) return SerializationError.InvalidFormat,
+        function_serializer.CLOSURE => try function_serializer.deserialize_closure(L, bytes),
+        else => return SerializationError.InvalidFormat,
+    }
+}
+
+fn deserialize_inline_table(L: *lua.lua_State, bytes: []const u8) SerializationError!void {
+    var offset: usize = 1;
+    const count = read_varint(bytes, &offset) orelse return SerializationError.InvalidFormat;
+    // Every entry takes at least two bytes
+    if (count > (bytes.len - offset) / 2) return SerializationError.InvalidFormat;
+    if (lua.c.lua_checkstack(L, 4) == 0) return SerializationError.InvalidFormat;
+    if (inline_read_depth >= MAX_RECURSION_DEPTH) return SerializationError.InvalidFormat;
+    inline_read_depth += 1;
+    defer inline_read_depth -= 1;
+
+    if (count == 0) {
+        lua.newtable(L);
+        return;
+    }
+    const top = lua.gettop(L);
+    errdefer lua.settop(L, top);
+
+    // Entries are written in pairs() order, which starts with the array
+    // part: a first key of 1 means a list, so size the array part for it
+    // instead of the hash part
+    const first_len = try encoded_len(bytes.ptr + offset, bytes.len - offset);
+    try deserialize_value(L, bytes.ptr + offset, first_len);
+    offset += first_len;
+    const is_list = lua.c.lua_isinteger(L, -1) != 0 and lua.tointeger(L, -1) == 1;
+    if (is_list) {
+        lua.c.lua_createtable(L, @intCast(count), 0);
+    } else {
+        lua.c.lua_createtable(L, 0, @intCast(count));
+    }
+    lua.c.lua_rotate(L, -2, 1); // [key, table] -> [table, key]
+
+    var i: u64 = 0;
+    while (i < count) : (i += 1) {
+        if (i > 0) {
+            const key_len = try encoded_len(bytes.ptr + offset, bytes.len - offset);
+            try deserialize_value(L, bytes.ptr + offset, key_len);
+            offset += key_len;
+        }
+        const value_len = try encoded_len(bytes.ptr + offset, bytes.len - offset);
+        try deserialize_value(L, bytes.ptr + offset, value_len);
+        offset += value_len;
+
+        // rawset raises on these, so reject them here
+        const key_type = lua.c.lua_type(L, -2);
+        if (key_type != lua.c.LUA_TNUMBER and key_type != lua.c.LUA_TSTRING) return SerializationError.InvalidFormat;
+        if (key_type == lua.c.LUA_TNUMBER and std.math.isNan(lua.tonumber(L, -2))) return SerializationError.InvalidFormat;
+        lua.c.lua_rawset(L, -3);
+    }
+}
+
+fn encoded_len_v2(bytes: []const u8) SerializationError!usize {
+    const tag = bytes[0];
+    if (tag >= V2_SMALL_INT and tag <= V2_SMALL_INT | V2_SMALL_INT_MAX) return 1;
+    if (tag >= V2_SHORT_STRING and tag <= V2_SHORT_STRING | V2_SHORT_STRING_MAX) return 1 + @as(usize, tag & 0x3f);
+
+    var offset: usize = 1;
+    switch (tag) {
+        V2_FALSE, V2_TRUE => return 1,
+        V2_FLOAT => return 9,
+        V2_INTEGER, V2_TABLE_REF => {
+            _ = read_varint(bytes, &offset) orelse return SerializationError.InvalidFormat;
+            return offset;
+        },
+        V2_STRING => {
+            const str_len = read_varint(bytes, &offset) orelse return SerializationError.InvalidFormat;
+            if (bytes.len - offset < str_len) return SerializationError.InvalidFormat;
+            return offset + @as(usize, @intCast(str_len));
+        },
+        TABLE_INLINE => {
+            const count = read_varint(bytes, &offset) orelse return SerializationError.InvalidFormat;
+            if (count > (bytes.len - offset) / 2) return SerializationError.InvalidFormat;
+            if (inline_read_depth >= MAX_RECURSION_DEPTH) return SerializationError.InvalidFormat;
+            inline_read_depth += 1;
+            defer inline_read_depth -= 1;
+            // A key and a value per entry
+            var i: u64 = 0;
+            while (i < count * 2) : (i += 1) {
+                offset += try encoded_len(bytes.ptr + offset, bytes.len - offset);
+            }
+            return offset;
+        },
+        typed_array.TYPED_ARRAY => return typed_array.encoded_len(bytes) orelse return SerializationError.InvalidFormat,
+        bigint.BIGINT => return bigint.encoded_len(bytes) orelse return SerializationError.InvalidFormat,
+        blob.BLOB, blob.BLOB_HANDLE => return blob.encoded_len(bytes) orelse return SerializationError.InvalidFormat,
+        function_serializer.CLOSURE => {
+            if (bytes.len < 5) return SerializationError.InvalidFormat;
+            return 5 + @as(usize, std.mem.readInt(u32, bytes[1..5], .little));
+        },
+        else => return SerializationError.InvalidFormat,
+    }
+}
+
+/// Size in bytes of the serialized value at the start of `buffer`, so values
+/// packed back to back can be walked without deserializing them
+pub fn encoded_len(buffer: [*]const u8, len: usize) SerializationError!usize {
+    if (len < 1) return SerializationError.InvalidFormat;
+
+    if (buffer[0] > @intFromEnum(SerializationType.table_ref)) {
+        const size = try encoded_len_v2(buffer[0..len]);
+        if (size > len) return SerializationError.InvalidFormat;
+        return size;
+    }
+
+    const size: usize = switch (buffer[0]) {
+        @intFromEnum(SerializationType.nil) => 1,
+        @intFromEnum(SerializationType.boolean) => 2,
+        @intFromEnum(SerializationType.integer), @intFromEnum(SerializationType.float) => 9,
+        @intFromEnum(SerializationType.function_ref) => 3,
+        @intFromEnum(SerializationType.table_ref) => 5,
+        @intFromEnum(SerializationType.string), @intFromEnum(SerializationType.function_bytecode) => blk: {
+            if (len < 5) return SerializationError.InvalidFormat;
+            const payload_len = std.mem.readInt(u32, buffer[1..5], .little);
+            break :blk 5 + @as(usize, payload_len);
+        },
+        else => return SerializationError.InvalidFormat,
+    };
+
+    if (size > len) return SerializationError.InvalidFormat;
+    return size;
+}
+
 pub fn serialize_key(key: [*]const u8, key_len: usize, buffer: [*]u8, max_len: usize) SerializationError!usize {
     if (max_len < 4 + key_len) return SerializationError.BufferTooSmall;
 
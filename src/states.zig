@@ -0,0 +1,124 @@
+const lua = @import("lua.zig");
+const ext_table = @import("ext_table.zig");
+const serializer = @import("serializer.zig");
+const function_serializer = @import("function_serializer.zig");
+const chunk_cache = @import("chunk_cache.zig");
+
+// Several isolated lua_States in one instance, addressed by handle.
+//
+// Each state has its own globals, registry, collector and _home and _io
+// tables, and shares the instance's code, linear memory, I/O buffer and
+// external table IDs (so its tables never collide with another state's on
+// the host). One state is selected at a time and every export works on it;
+// main.zig swaps global_lua_state and the table IDs, and switch_to swaps the
+// registry refs the bridge modules keep for the current state. The caches
+// of compiled chunks and loaded functions hold entries for any state, each
+// tagged with its owner.
+//
+// The heap is shared too, so a state's "arena" is an account: lua_alloc
+// charges every block to the state whose handle is its allocator userdata,
+// and refuses growth past the state's limit. Handle 1 is the state init()
+// creates; it is not charged.
+
+extern fn lua_malloc(size: usize) ?*anyopaque;
+extern fn lua_realloc_sized(ptr: ?*anyopaque, old_size: usize, size: usize) ?*anyopaque;
+
+pub const MAX_STATES = 1 << 16;
+
+pub const Slot = struct {
+    L: ?*lua.lua_State = null,
+    home_table_id: u32 = 0,
+    io_table_id: u32 = 0,
+    ext_refs: ext_table.StateRefs = .{},
+    serializer_refs: serializer.StateRefs = .{},
+    function_refs: function_serializer.StateRefs = .{},
+    bytes: usize = 0,
+    // 0 = no limit beyond the heap's
+    max_bytes: usize = 0,
+};
+
+var slots: [*]Slot = undefined;
+var capacity: usize = 0;
+var count: usize = 0;
+
+/// The slot of `handle`, if it names a live state
+pub fn get(handle: u32) ?*Slot {
+    if (handle == 0 or handle > count) return null;
+    const slot = &slots[handle - 1];
+    return if (slot.L != null) slot else null;
+}
+
+/// The highest handle a state has had; live ones are those get() finds
+pub fn highest() u32 {
+    return @intCast(count);
+}
+
+/// Reserve a slot for a new state; returns its handle, or null when the
+/// table cannot grow. Closed states' handles are reused.
+pub fn reserve() ?u32 {
+    for (slots[0..count], 0..) |*slot, i| {
+        if (slot.L == null) {
+            slot.* = .{};
+            return @intCast(i + 1);
+        }
+    }
+    if (count == MAX_STATES) return null;
+    if (count == capacity) {
+        const grown = if (capacity == 0) 8 else capacity * 2;
+        const block = if (capacity == 0)
+            lua_malloc(grown * @sizeOf(Slot))
+        else
+            lua_realloc_sized(slots, capacity * @sizeOf(Slot), grown * @sizeOf(Slot));
+        slots = @ptrCast(@alignCast(block orelse return null));
+        capacity = grown;
+    }
+    slots[count] = .{};
+    count += 1;
+    return @intCast(count);
+}
+
+/// Fill the reserved slot `handle` with the state made for it
+pub fn adopt(handle: u32, L: *lua.lua_State, home_table_id: u32, io_table_id: u32) void {
+    const slot = &slots[handle - 1];
+    slot.L = L;
+    slot.home_table_id = home_table_id;
+    slot.io_table_id = io_table_id;
+}
+
+/// Free the slot of a state that was closed or never finished setting up
+pub fn release(handle: u32) void {
+    slots[handle - 1] = .{};
+}
+
+/// Make `to` current: keep the bridge modules' refs for the state in `from`
+/// and load those of `to`. A slot being set up starts with no refs.
+pub fn switch_to(from: ?*Slot, to: ?*Slot) void {
+    if (from) |slot| {
+        slot.ext_refs = ext_table.save_refs();
+        slot.serializer_refs = serializer.save_refs();
+        slot.function_refs = function_serializer.save_refs();
+    }
+    const next = if (to) |slot| slot.* else Slot{};
+    ext_table.load_refs(next.ext_refs);
+    serializer.load_refs(next.serializer_refs);
+    function_serializer.load_refs(next.function_refs);
+}
+
+/// Drop what the shared caches hold for `L`, which is about to be closed
+pub fn forget(L: *lua.lua_State) void {
+    chunk_cache.forget(L);
+    function_serializer.forget_state(L);
+}
+
+/// Charge `grow` more bytes to the state `handle`; false if over its limit
+pub fn reserve_bytes(handle: usize, grow: usize) bool {
+    const slot = &slots[handle - 1];
+    if (slot.max_bytes != 0 and slot.bytes + grow > slot.max_bytes) return false;
+    slot.bytes += grow;
+    return true;
+}
+
+pub fn release_bytes(handle: usize, shrink: usize) void {
+    const slot = &slots[handle - 1];
+    slot.bytes -|= shrink;
+}
@@ -15,6 +15,7 @@ extern void free(void *ptr);
 extern int atoi(const char *nptr);
 extern long int strtol(const char *nptr, char **endptr, int base);
 extern double strtod(const char *nptr, char **endptr);
+extern float strtof(const char *nptr, char **endptr);
 
 extern void qsort(void *base, size_t nmemb, size_t size,
                   int (*compar)(const void *, const void *));
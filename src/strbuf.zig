@@ -0,0 +1,16 @@
+const lua = @import("lua.zig");
+
+// Zig side of the strbuf library (src/lua/lstrbuf.c). print, stores into
+// external tables and compute results take a strbuf's bytes in place, as
+// they would a string's, so a buffer built up in a script is never turned
+// into a Lua string on its way out.
+
+extern fn cu_strbuf_view(L: *lua.lua_State, index: c_int, len: *usize) ?[*]const u8;
+
+/// The contents of the strbuf at `index`, or null if the value is not one.
+/// Valid until the strbuf next grows.
+pub fn bytes(L: *lua.lua_State, index: c_int) ?[]const u8 {
+    var len: usize = 0;
+    const ptr = cu_strbuf_view(L, index, &len) orelse return null;
+    return ptr[0..len];
+}
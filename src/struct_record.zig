@@ -0,0 +1,14 @@
+const lua = @import("lua.zig");
+
+// Zig side of the struct library (src/lua/lstruct.c). A record is stored in
+// external tables and returned from compute() by value, as a TABLE_INLINE row
+// of its fields, so it costs one entry and no external table of its own. It
+// reads back as a plain table.
+
+extern fn cu_struct_push_row(L: *lua.lua_State, index: c_int) c_int;
+
+/// If the value at `index` is a struct record, push a plain table of its
+/// fields and return true; otherwise push nothing.
+pub fn push_row(L: *lua.lua_State, index: c_int) bool {
+    return cu_struct_push_row(L, index) != 0;
+}
@@ -0,0 +1,153 @@
+const std = @import("std");
+const lua = @import("lua.zig");
+
+const c = lua.c;
+
+// Packed numeric arrays. A typed array value is
+//   0x0F, element kind, 2 zero bytes, u32 element count, little-endian
+//   elements
+// under either value encoding, so elements start 8 bytes in and a vector
+// crosses the bridge as one copy instead of an entry per element. In Lua it
+// is a userdata holding exactly those bytes, indexable as a 1-based array
+// (t[i], #t, ipairs); storing it again copies the bytes back out. Writes to
+// it change that copy only, like any value read from an external table.
+pub const TYPED_ARRAY: u8 = 0x0F;
+pub const HEADER_LEN = 8;
+
+const METATABLE: [*:0]const u8 = "cu.typed_array";
+
+pub const Kind = enum(u8) {
+    u8 = 1,
+    i64 = 2,
+    f64 = 3,
+
+    fn size(kind: Kind) usize {
+        return switch (kind) {
+            .u8 => 1,
+            .i64, .f64 => 8,
+        };
+    }
+};
+
+/// Bitmask of the kind bytes above
+pub fn supported_kinds() u32 {
+    var mask: u32 = 0;
+    for (std.enums.values(Kind)) |kind| mask |= @as(u32, 1) << @intCast(@intFromEnum(kind));
+    return mask;
+}
+
+/// Size of a well-formed typed array value at the start of `bytes`, or null
+pub fn encoded_len(bytes: []const u8) ?usize {
+    if (bytes.len < HEADER_LEN or bytes[0] != TYPED_ARRAY) return null;
+    const kind = std.meta.intToEnum(Kind, bytes[1]) catch return null;
+    const count = std.mem.readInt(u32, bytes[4..8], .little);
+    const len = HEADER_LEN + @as(usize, count) * kind.size();
+    if (len > bytes.len) return null;
+    return len;
+}
+
+/// Push a typed array holding a copy of the value in `bytes`
+pub fn push(L: *lua.lua_State, bytes: []const u8) bool {
+    const len = encoded_len(bytes) orelse return false;
+    const data: [*]u8 = @ptrCast(c.lua_newuserdatauv(L, len, 0).?);
+    @memcpy(data[0..len], bytes[0..len]);
+    set_metatable(L);
+    return true;
+}
+
+/// Turn the userdata at the top of the stack, which holds exactly one typed
+/// array value, into a typed array without copying it
+pub fn adopt(L: *lua.lua_State) bool {
+    const data: [*]const u8 = @ptrCast(c.lua_touserdata(L, -1) orelse return false);
+    const size = c.lua_rawlen(L, -1);
+    if (encoded_len(data[0..size]) != size) return false;
+    set_metatable(L);
+    return true;
+}
+
+/// Serialized bytes of the typed array at `index`, or null for other values
+pub fn value_bytes(L: *lua.lua_State, index: c_int) ?[]u8 {
+    const data: [*]u8 = @ptrCast(c.luaL_testudata(L, index, METATABLE) orelse return null);
+    return data[0..c.lua_rawlen(L, index)];
+}
+
+/// The string at `arg`, or the elements of a u8 typed array there; raises
+/// for other values
+pub fn check_bytes(L: *lua.lua_State, arg: c_int) []const u8 {
+    if (c.lua_type(L, arg) == c.LUA_TSTRING) {
+        var len: usize = 0;
+        const s = c.lua_tolstring(L, arg, &len);
+        return s[0..len];
+    }
+    const bytes = value_bytes(L, arg) orelse {
+        _ = c.luaL_typeerror(L, arg, "string or bytes");
+        unreachable;
+    };
+    if (bytes[1] != @intFromEnum(Kind.u8)) {
+        _ = c.luaL_argerror(L, arg, "typed array of u8 elements expected");
+        unreachable;
+    }
+    return bytes[HEADER_LEN..][0..std.mem.readInt(u32, bytes[4..8], .little)];
+}
+
+fn set_metatable(L: *lua.lua_State) void {
+    if (lua.luaL_newmetatable(L, METATABLE) != 0) {
+        lua.pushcfunction(L, @as(c.lua_CFunction, @ptrCast(&index_impl)));
+        lua.setfield(L, -2, "__index");
+
+        lua.pushcfunction(L, @as(c.lua_CFunction, @ptrCast(&newindex_impl)));
+        lua.setfield(L, -2, "__newindex");
+
+        lua.pushcfunction(L, @as(c.lua_CFunction, @ptrCast(&len_impl)));
+        lua.setfield(L, -2, "__len");
+    }
+    _ = lua.setmetatable(L, -2);
+}
+
+// Byte offset of element t[i], or null when i is not an integer in 1..#t
+fn element_offset(L: *lua.lua_State, bytes: []const u8, key_index: c_int) ?usize {
+    var is_integer: c_int = 0;
+    const i = c.lua_tointegerx(L, key_index, &is_integer);
+    if (is_integer == 0) return null;
+    const count = std.mem.readInt(u32, bytes[4..8], .little);
+    if (i < 1 or i > count) return null;
+    const kind: Kind = @enumFromInt(bytes[1]);
+    return HEADER_LEN + @as(usize, @intCast(i - 1)) * kind.size();
+}
+
+fn index_impl(L: *lua.lua_State) c_int {
+    const bytes = value_bytes(L, 1).?;
+    const offset = element_offset(L, bytes, 2) orelse {
+        lua.pushnil(L);
+        return 1;
+    };
+    switch (@as(Kind, @enumFromInt(bytes[1]))) {
+        .u8 => lua.pushinteger(L, bytes[offset]),
+        .i64 => lua.pushinteger(L, std.mem.readInt(i64, bytes[offset..][0..8], .little)),
+        .f64 => lua.pushnumber(L, @bitCast(std.mem.readInt(u64, bytes[offset..][0..8], .little))),
+    }
+    return 1;
+}
+
+fn newindex_impl(L: *lua.lua_State) c_int {
+    const bytes = value_bytes(L, 1).?;
+    const offset = element_offset(L, bytes, 2) orelse {
+        return c.luaL_error(L, "typed array index out of range");
+    };
+    switch (@as(Kind, @enumFromInt(bytes[1]))) {
+        .u8 => {
+            const value = c.luaL_checkinteger(L, 3);
+            if (value < 0 or value > 255) return c.luaL_argerror(L, 3, "value out of range for u8");
+            bytes[offset] = @intCast(value);
+        },
+        .i64 => std.mem.writeInt(i64, bytes[offset..][0..8], c.luaL_checkinteger(L, 3), .little),
+        .f64 => std.mem.writeInt(u64, bytes[offset..][0..8], @bitCast(@as(f64, c.luaL_checknumber(L, 3))), .little),
+    }
+    return 0;
+}
+
+fn len_impl(L: *lua.lua_State) c_int {
+    const bytes = value_bytes(L, 1).?;
+    lua.pushinteger(L, std.mem.readInt(u32, bytes[4..8], .little));
+    return 1;
+}
@@ -0,0 +1,471 @@
+const std = @import("std");
+const lua = @import("lua.zig");
+const typed_array = @import("typed_array.zig");
+
+const c = lua.c;
+const Kind = typed_array.Kind;
+const HEADER_LEN = typed_array.HEADER_LEN;
+
+// The vec library: numeric kernels over packed arrays. A vec is a typed
+// array (typed_array.zig) of f64 or i64 elements, so it is stored into _io
+// and _home, and read back, as one copy of its packed bytes, arrives from
+// the host as a Float64Array or BigInt64Array does, and indexes like an
+// array in Lua. Typed arrays the host sends are vecs already.
+//
+// The kernels work LANES elements at a time with @Vector. build.sh compiles
+// this file on its own, with simd128 in the CU_SIMD=1 build, so the lanes
+// are v128 operations there and unrolled scalar code otherwise. Float sums
+// and dot products add each lane separately, so their last bits can differ
+// from a Lua loop's; i64 arithmetic wraps, like Lua's.
+
+extern fn cu_typed_array_adopt(L: *lua.lua_State) c_int;
+
+const LANES = 4;
+
+fn Lanes(comptime T: type) type {
+    return @Vector(LANES, T);
+}
+
+const Vec = struct {
+    kind: Kind,
+    bytes: []u8,
+
+    fn len(v: Vec) usize {
+        return std.mem.readInt(u32, v.bytes[4..8], .little);
+    }
+
+    // Userdata memory is maximally aligned, so the elements 8 bytes in are
+    // aligned for their type
+    fn items(v: Vec, comptime T: type) []T {
+        const elements: [*]T = @ptrCast(@alignCast(v.bytes.ptr + HEADER_LEN));
+        return elements[0..v.len()];
+    }
+};
+
+fn check(L: *lua.lua_State, arg: c_int) Vec {
+    const bytes = typed_array.value_bytes(L, arg) orelse {
+        _ = c.luaL_typeerror(L, arg, "vec");
+        unreachable;
+    };
+    const kind: Kind = @enumFromInt(bytes[1]);
+    if (kind == .u8) {
+        _ = c.luaL_argerror(L, arg, "vec of u8 elements; only f64 and i64 are supported");
+        unreachable;
+    }
+    return .{ .kind = kind, .bytes = bytes };
+}
+
+fn check_kind(L: *lua.lua_State, arg: c_int) Kind {
+    const names = [_][*c]const u8{ "f64", "i64", null };
+    return if (c.luaL_checkoption(L, arg, "f64", &names) == 0) .f64 else .i64;
+}
+
+// Optional output vec at `arg`, which must match `kind` and `n`, or a new
+// one; either way it is left on top of the stack
+fn output(L: *lua.lua_State, arg: c_int, kind: Kind, n: usize) Vec {
+    if (c.lua_type(L, arg) <= 0) return push_new(L, kind, n);
+    const out = check(L, arg);
+    if (out.kind != kind or out.len() != n) {
+        _ = c.luaL_argerror(L, arg, "output vec differs in kind or length");
+        unreachable;
+    }
+    lua.pushvalue(L, arg);
+    return out;
+}
+
+/// Push a new vec of `n` zeroed elements
+fn push_new(L: *lua.lua_State, kind: Kind, n: usize) Vec {
+    if (n > std.math.maxInt(u32) or n > (std.math.maxInt(usize) - HEADER_LEN) / 8) {
+        _ = c.luaL_error(L, "vec too long");
+        unreachable;
+    }
+    const size = HEADER_LEN + n * 8;
+    const bytes: [*]u8 = @ptrCast(c.lua_newuserdatauv(L, size, 0).?);
+    @memset(bytes[0..size], 0);
+    bytes[0] = typed_array.TYPED_ARRAY;
+    bytes[1] = @intFromEnum(kind);
+    std.mem.writeInt(u32, bytes[4..8], @intCast(n), .little);
+    _ = cu_typed_array_adopt(L);
+    return .{ .kind = kind, .bytes = bytes[0..size] };
+}
+
+fn push_element(L: *lua.lua_State, comptime T: type, x: T) void {
+    if (T == f64) lua.pushnumber(L, x) else lua.pushinteger(L, x);
+}
+
+inline fn load(comptime T: type, xs: []const T, i: usize) Lanes(T) {
+    return xs[i..][0..LANES].*;
+}
+
+// ============================================================================
+// Kernels
+// ============================================================================
+
+const Op = enum { add, sub, mul, div };
+
+inline fn combine(comptime T: type, comptime op: Op, x: anytype, y: @TypeOf(x)) @TypeOf(x) {
+    return switch (op) {
+        .add => if (T == f64) x + y else x +% y,
+        .sub => if (T == f64) x - y else x -% y,
+        .mul => if (T == f64) x * y else x *% y,
+        .div => x / y,
+    };
+}
+
+fn sum(comptime T: type, xs: []const T) T {
+    var acc: Lanes(T) = @splat(0);
+    var i: usize = 0;
+    while (i + LANES <= xs.len) : (i += LANES) acc = combine(T, .add, acc, load(T, xs, i));
+    var total = @reduce(.Add, acc);
+    while (i < xs.len) : (i += 1) total = combine(T, .add, total, xs[i]);
+    return total;
+}
+
+fn dot(comptime T: type, a: []const T, b: []const T) T {
+    var acc: Lanes(T) = @splat(0);
+    var i: usize = 0;
+    while (i + LANES <= a.len) : (i += LANES) {
+        acc = combine(T, .add, acc, combine(T, .mul, load(T, a, i), load(T, b, i)));
+    }
+    var total = @reduce(.Add, acc);
+    while (i < a.len) : (i += 1) total = combine(T, .add, total, combine(T, .mul, a[i], b[i]));
+    return total;
+}
+
+// Smallest (or largest) element of a non-empty slice
+fn extreme(comptime T: type, comptime largest: bool, xs: []const T) T {
+    var i: usize = 0;
+    var best = xs[0];
+    if (xs.len >= LANES) {
+        var acc = load(T, xs, 0);
+        i = LANES;
+        while (i + LANES <= xs.len) : (i += LANES) {
+            acc = if (largest) @max(acc, load(T, xs, i)) else @min(acc, load(T, xs, i));
+        }
+        best = @reduce(if (largest) .Max else .Min, acc);
+    }
+    while (i < xs.len) : (i += 1) best = if (largest) @max(best, xs[i]) else @min(best, xs[i]);
+    return best;
+}
+
+fn elementwise(comptime T: type, comptime op: Op, out: []T, a: []const T, b: []const T) void {
+    var i: usize = 0;
+    while (i + LANES <= out.len) : (i += LANES) out[i..][0..LANES].* = combine(T, op, load(T, a, i), load(T, b, i));
+    while (i < out.len) : (i += 1) out[i] = combine(T, op, a[i], b[i]);
+}
+
+fn elementwise_scalar(comptime T: type, comptime op: Op, out: []T, a: []const T, b: T) void {
+    const bs: Lanes(T) = @splat(b);
+    var i: usize = 0;
+    while (i + LANES <= out.len) : (i += LANES) out[i..][0..LANES].* = combine(T, op, load(T, a, i), bs);
+    while (i < out.len) : (i += 1) out[i] = combine(T, op, a[i], b);
+}
+
+fn fill(comptime T: type, xs: []T, x: T) void {
+    @memset(xs, x);
+}
+
+// ============================================================================
+// Lua functions
+// ============================================================================
+
+// vec.new(n [, kind]) -> a vec of n zeros; kind is "f64" (default) or "i64"
+fn new_impl(L: *lua.lua_State) c_int {
+    const n = c.luaL_checkinteger(L, 1);
+    if (n < 0) return c.luaL_argerror(L, 1, "negative length");
+    _ = push_new(L, check_kind(L, 2), @intCast(n));
+    return 1;
+}
+
+// vec.from(t [, kind]) -> a vec of t[1..#t]
+fn from_impl(L: *lua.lua_State) c_int {
+    c.luaL_checktype(L, 1, c.LUA_TTABLE);
+    const kind = check_kind(L, 2);
+    const n = c.lua_rawlen(L, 1);
+    const v = push_new(L, kind, n);
+    for (0..n) |i| {
+        _ = c.lua_rawgeti(L, 1, @intCast(i + 1));
+        var ok: c_int = 0;
+        switch (kind) {
+            .f64 => v.items(f64)[i] = c.lua_tonumberx(L, -1, &ok),
+            .i64 => v.items(i64)[i] = c.lua_tointegerx(L, -1, &ok),
+            .u8 => unreachable,
+        }
+        if (ok == 0) return c.luaL_error(L, "vec.from: element %d is not a %s", @as(c_int, @intCast(i + 1)), @as([*:0]const u8, if (kind == .f64) "number" else "integer"));
+        lua.pop(L, 1);
+    }
+    return 1;
+}
+
+// vec.totable(v) -> a Lua array of v's elements
+fn totable_impl(L: *lua.lua_State) c_int {
+    const v = check(L, 1);
+    const n = v.len();
+    if (n > std.math.maxInt(c_int)) return c.luaL_error(L, "vec too long for a table");
+    c.lua_createtable(L, @intCast(n), 0);
+    for (0..n) |i| {
+        switch (v.kind) {
+            .f64 => push_element(L, f64, v.items(f64)[i]),
+            .i64 => push_element(L, i64, v.items(i64)[i]),
+            .u8 => unreachable,
+        }
+        c.lua_rawseti(L, -2, @intCast(i + 1));
+    }
+    return 1;
+}
+
+// vec.cast(v, kind) -> a copy of v with elements of `kind`; floats convert
+// to i64 only when they are integers in range
+fn cast_impl(L: *lua.lua_State) c_int {
+    const v = check(L, 1);
+    const kind = check_kind(L, 2);
+    const out = push_new(L, kind, v.len());
+    if (kind == v.kind) {
+        @memcpy(out.bytes, v.bytes);
+    } else if (kind == .f64) {
+        for (out.items(f64), v.items(i64)) |*y, x| y.* = @floatFromInt(x);
+    } else {
+        // 2^63 is exact as a float; the range is [-2^63, 2^63)
+        const limit: f64 = 9223372036854775808.0;
+        for (out.items(i64), v.items(f64), 1..) |*y, x, i| {
+            if (!(x >= -limit and x < limit) or @floor(x) != x) {
+                return c.luaL_error(L, "vec.cast: element %d has no integer representation", @as(c_int, @intCast(i)));
+            }
+            y.* = @intFromFloat(x);
+        }
+    }
+    return 1;
+}
+
+// vec.slice(v [, i [, j]]) -> a copy of v[i..j], with i and j as in string.sub
+fn slice_impl(L: *lua.lua_State) c_int {
+    const v = check(L, 1);
+    const size: c.lua_Integer = @intCast(v.len());
+    var i = c.luaL_optinteger(L, 2, 1);
+    var j = c.luaL_optinteger(L, 3, -1);
+    if (i < 0) i = @max(size + i + 1, 1) else if (i == 0) i = 1;
+    if (j < 0) j = size + j + 1 else if (j > size) j = size;
+    const start: usize = if (i > j) 0 else @intCast(i - 1);
+    const n: usize = if (i > j) 0 else @intCast(j - i + 1);
+    const out = push_new(L, v.kind, n);
+    @memcpy(out.bytes[HEADER_LEN..], v.bytes[HEADER_LEN + start * 8 ..][0 .. n * 8]);
+    return 1;
+}
+
+// vec.fill(v, x) -> v, with every element set to x
+fn fill_impl(L: *lua.lua_State) c_int {
+    const v = check(L, 1);
+    switch (v.kind) {
+        .f64 => fill(f64, v.items(f64), c.luaL_checknumber(L, 2)),
+        .i64 => fill(i64, v.items(i64), c.luaL_checkinteger(L, 2)),
+        .u8 => unreachable,
+    }
+    lua.settop(L, 1);
+    return 1;
+}
+
+// vec.sum(v) -> the sum of the elements, 0 when empty
+fn sum_impl(L: *lua.lua_State) c_int {
+    const v = check(L, 1);
+    switch (v.kind) {
+        .f64 => push_element(L, f64, sum(f64, v.items(f64))),
+        .i64 => push_element(L, i64, sum(i64, v.items(i64))),
+        .u8 => unreachable,
+    }
+    return 1;
+}
+
+// vec.mean(v) -> the mean as a float, or nil when empty
+fn mean_impl(L: *lua.lua_State) c_int {
+    const v = check(L, 1);
+    const n = v.len();
+    if (n == 0) {
+        lua.pushnil(L);
+        return 1;
+    }
+    const total: f64 = switch (v.kind) {
+        .f64 => sum(f64, v.items(f64)),
+        .i64 => @floatFromInt(sum(i64, v.items(i64))),
+        .u8 => unreachable,
+    };
+    lua.pushnumber(L, total / @as(f64, @floatFromInt(n)));
+    return 1;
+}
+
+// vec.dot(a, b) -> the sum of a[i] * b[i]
+fn dot_impl(L: *lua.lua_State) c_int {
+    const a = check(L, 1);
+    const b = check(L, 2);
+    if (a.kind != b.kind or a.len() != b.len()) return c.luaL_argerror(L, 2, "vecs differ in kind or length");
+    switch (a.kind) {
+        .f64 => push_element(L, f64, dot(f64, a.items(f64), b.items(f64))),
+        .i64 => push_element(L, i64, dot(i64, a.items(i64), b.items(i64))),
+        .u8 => unreachable,
+    }
+    return 1;
+}
+
+// vec.min(v) / vec.max(v) -> the extreme element, then its index (the
+// first, if it repeats); nothing when v is empty
+fn extreme_impl(comptime largest: bool) fn (*lua.lua_State) c_int {
+    return struct {
+        fn impl(L: *lua.lua_State) c_int {
+            const v = check(L, 1);
+            if (v.len() == 0) return 0;
+            switch (v.kind) {
+                inline .f64, .i64 => |kind| {
+                    const T = if (kind == .f64) f64 else i64;
+                    const xs = v.items(T);
+                    const best = extreme(T, largest, xs);
+                    // NaN compares unequal to itself, and min/max may return one
+                    const index = std.mem.indexOfScalar(T, xs, best) orelse 0;
+                    push_element(L, T, best);
+                    lua.pushinteger(L, @intCast(index + 1));
+                },
+                .u8 => unreachable,
+            }
+            return 2;
+        }
+    }.impl;
+}
+
+// vec.add/sub/mul/div(a, b [, out]) -> out, a new vec unless given, with
+// out[i] = a[i] op b[i]; b is a vec or a number, and out may be a. div
+// takes f64 vecs only (see vec.cast)
+fn arith_impl(comptime op: Op) fn (*lua.lua_State) c_int {
+    return struct {
+        fn impl(L: *lua.lua_State) c_int {
+            const a = check(L, 1);
+            const b: ?Vec = if (c.lua_type(L, 2) == c.LUA_TNUMBER) null else check(L, 2);
+            if (b) |vb| {
+                if (vb.kind != a.kind or vb.len() != a.len()) return c.luaL_argerror(L, 2, "vecs differ in kind or length");
+            }
+            switch (a.kind) {
+                .f64 => arith(f64, op, L, a, b),
+                .i64 => if (op == .div) {
+                    return c.luaL_argerror(L, 1, "div needs f64 vecs; use vec.cast");
+                } else {
+                    if (b == null and c.lua_isinteger(L, 2) == 0) return c.luaL_argerror(L, 2, "number has no integer representation");
+                    arith(i64, op, L, a, b);
+                },
+                .u8 => unreachable,
+            }
+            return 1;
+        }
+    }.impl;
+}
+
+fn arith(comptime T: type, comptime op: Op, L: *lua.lua_State, a: Vec, b: ?Vec) void {
+    const out = output(L, 3, a.kind, a.len());
+    if (b) |vb| {
+        elementwise(T, op, out.items(T), a.items(T), vb.items(T));
+    } else if (T == f64) {
+        elementwise_scalar(T, op, out.items(T), a.items(T), c.lua_tonumberx(L, 2, null));
+    } else {
+        elementwise_scalar(T, op, out.items(T), a.items(T), c.lua_tointegerx(L, 2, null));
+    }
+}
+
+// vec.cumsum(v [, out]) -> out with out[i] = v[1] + ... + v[i]
+fn cumsum_impl(L: *lua.lua_State) c_int {
+    const v = check(L, 1);
+    const out = output(L, 2, v.kind, v.len());
+    switch (v.kind) {
+        inline .f64, .i64 => |kind| {
+            const T = if (kind == .f64) f64 else i64;
+            var total: T = 0;
+            for (out.items(T), v.items(T)) |*y, x| {
+                total = combine(T, .add, total, x);
+                y.* = total;
+            }
+        },
+        .u8 => unreachable,
+    }
+    return 1;
+}
+
+// vec.movavg(v, window) -> an f64 vec of the means of each `window`
+// consecutive elements, #v - window + 1 of them (none if window > #v)
+fn movavg_impl(L: *lua.lua_State) c_int {
+    const v = check(L, 1);
+    const window = c.luaL_checkinteger(L, 2);
+    if (window < 1) return c.luaL_argerror(L, 2, "window must be positive");
+    const n = v.len();
+    const w: usize = @intCast(window);
+    const out = push_new(L, .f64, if (w > n) 0 else n - w + 1);
+    const ys = out.items(f64);
+    if (ys.len == 0) return 1;
+    const scale = 1.0 / @as(f64, @floatFromInt(w));
+    switch (v.kind) {
+        inline .f64, .i64 => |kind| {
+            const T = if (kind == .f64) f64 else i64;
+            const xs = v.items(T);
+            // A running sum for i64 stays exact; for f64 it is recomputed
+            // from scratch every `w` steps so rounding does not drift
+            var total = sum(T, xs[0..w]);
+            ys[0] = to_f64(T, total) * scale;
+            for (1..ys.len) |i| {
+                if (T == f64 and i % w == 0) {
+                    total = sum(T, xs[i..][0..w]);
+                } else {
+                    total = combine(T, .sub, combine(T, .add, total, xs[i + w - 1]), xs[i - 1]);
+                }
+                ys[i] = to_f64(T, total) * scale;
+            }
+        },
+        .u8 => unreachable,
+    }
+    return 1;
+}
+
+fn to_f64(comptime T: type, x: T) f64 {
+    return if (T == f64) x else @floatFromInt(x);
+}
+
+// vec.sort(v) -> v, sorted ascending in place
+fn sort_impl(L: *lua.lua_State) c_int {
+    const v = check(L, 1);
+    switch (v.kind) {
+        .f64 => std.sort.pdq(f64, v.items(f64), {}, std.sort.asc(f64)),
+        .i64 => std.sort.pdq(i64, v.items(i64), {}, std.sort.asc(i64)),
+        .u8 => unreachable,
+    }
+    lua.settop(L, 1);
+    return 1;
+}
+
+// vec.kind(v) -> "f64" or "i64"
+fn kind_impl(L: *lua.lua_State) c_int {
+    _ = lua.pushstring(L, if (check(L, 1).kind == .f64) "f64" else "i64");
+    return 1;
+}
+
+const functions = [_]c.luaL_Reg{
+    .{ .name = "new", .func = @ptrCast(&new_impl) },
+    .{ .name = "from", .func = @ptrCast(&from_impl) },
+    .{ .name = "totable", .func = @ptrCast(&totable_impl) },
+    .{ .name = "cast", .func = @ptrCast(&cast_impl) },
+    .{ .name = "slice", .func = @ptrCast(&slice_impl) },
+    .{ .name = "fill", .func = @ptrCast(&fill_impl) },
+    .{ .name = "kind", .func = @ptrCast(&kind_impl) },
+    .{ .name = "sum", .func = @ptrCast(&sum_impl) },
+    .{ .name = "mean", .func = @ptrCast(&mean_impl) },
+    .{ .name = "dot", .func = @ptrCast(&dot_impl) },
+    .{ .name = "min", .func = @ptrCast(&extreme_impl(false)) },
+    .{ .name = "max", .func = @ptrCast(&extreme_impl(true)) },
+    .{ .name = "add", .func = @ptrCast(&arith_impl(.add)) },
+    .{ .name = "sub", .func = @ptrCast(&arith_impl(.sub)) },
+    .{ .name = "mul", .func = @ptrCast(&arith_impl(.mul)) },
+    .{ .name = "div", .func = @ptrCast(&arith_impl(.div)) },
+    .{ .name = "cumsum", .func = @ptrCast(&cumsum_impl) },
+    .{ .name = "movavg", .func = @ptrCast(&movavg_impl) },
+    .{ .name = "sort", .func = @ptrCast(&sort_impl) },
+    .{ .name = null, .func = null },
+};
+
+/// Module initialization, for package.preload.vec (see main.zig)
+export fn luaopen_vec(L: *lua.lua_State) c_int {
+    c.lua_createtable(L, 0, functions.len - 1);
+    c.luaL_setfuncs(L, &functions, 0);
+    return 1;
+}
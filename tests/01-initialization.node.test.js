@@ -1,5 +1,7 @@
 const { describe, it, beforeEach } = require('node:test');
 const assert = require('node:assert');
+const fs = require('fs');
+const path = require('path');
 const { loadWasm, init, compute, getBufferPtr, readResult, reset } = require('./node-test-utils');
 
 describe('Cu Initialization', () => {
@@ -38,4 +40,45 @@ describe('Cu Initialization', () => {
     const ptr = getBufferPtr();
     assert.ok(ptr > 0, 'Buffer pointer should be greater than 0');
   });
+
+  it('Keeps working after memory.grow replaces the buffer', async () => {
+    const instance = await loadWasm();
+    init();
+    compute('_home.grown = "before"');
+
+    // Growing detaches every view of the old ArrayBuffer
+    instance.exports.memory.grow(1);
+
+    const len = compute('return _home.grown .. "/after"');
+    assert.ok(len > 0, 'compute should succeed after growth');
+    const { result } = readResult(getBufferPtr(), len);
+    assert.strictEqual(result, 'before/after');
+  });
+
+  it('Every host provides every import the module declares', () => {
+    const root = path.join(__dirname, '..');
+    const src = path.join(root, 'src');
+    const imports = new Set();
+    for (const file of fs.readdirSync(src).filter((name) => name.endsWith('.zig'))) {
+      for (const match of fs.readFileSync(path.join(src, file), 'utf8').matchAll(/extern fn (js_\w+)\(/g)) {
+        imports.add(match[1]);
+      }
+    }
+    assert.ok(imports.size > 0);
+
+    // How each host binds an import by name
+    const hosts = {
+      'web/cu-instance.js': (name) => `${name}:`,
+      'web/cu-compute.js': (name) => `${name}:`,
+      'web/wasm-loader.js': (name) => `${name}:`,
+      'host/go/cu.go': (name) => `define("${name}"`,
+      'host/rust/src/unit.rs': (name) => `"${name}"`,
+      'host/c/src/cu_wamr.c': (name) => `{ "${name}"`,
+    };
+    for (const [file, binding] of Object.entries(hosts)) {
+      const text = fs.readFileSync(path.join(root, file), 'utf8');
+      const missing = [...imports].filter((name) => !text.includes(binding(name)));
+      assert.deepStrictEqual(missing, [], `${file} does not provide ${missing.join(', ')}`);
+    }
+  });
 });
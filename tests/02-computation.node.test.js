@@ -1,11 +1,15 @@
 const { describe, it, beforeEach } = require('node:test');
 const assert = require('node:assert');
-const { loadWasm, init, compute, getBufferPtr, readResult, reset } = require('./node-test-utils');
+const { createHash } = require('node:crypto');
+const zlib = require('node:zlib');
+const { loadWasm, init, compute, call, hasExport, hasImport, getInstance, getBufferPtr, readResult, setInput, collectTables, reset, requireFeature } = require('./node-test-utils');
 
 describe('Cu Computation', () => {
+  let instance;
+
   beforeEach(async () => {
     reset();
-    await loadWasm();
+    instance = await loadWasm();
     init();
   });
 
@@ -114,4 +118,1129 @@ describe('Cu Computation', () => {
     const result = readResult(getBufferPtr(), bytes);
     assert.strictEqual(result.result, 'The answer is 42');
   });
+
+  it('Gives the same results for chunks loaded with the optimizer', () => {
+    // Builds without the optimizer ignore the "o" in the mode
+    const bytes = compute(`
+      local sources = {
+        "local N = 10 local s = 0 for i = 1, 100 do s = s + i * N end return s",
+        "local DEBUG = false local r = {} for i = 1, 3 do if DEBUG then r[i] = 0 else r[i] = i end end return table.concat(r, ',')",
+        "local K, I = 'name', 2 local t = {} t[K] = 1 t[I] = 2 return t.name + t[2]",
+        "local Z = 1.0 local a = 1 return tostring(a == Z) .. tostring(a < Z) .. tostring(Z <= a)",
+        "local T = nil local y = T or 5 return y + (T and 1 or 0)",
+        "local C = 5 local f = function() return C end C = 6 return f()",
+        "local t = {} x = 1 t[1] = x x = 2 t[2] = x return t[1] + t[2]",
+        "y = 4 local a, b = y, y return a * b",
+      }
+      local out = {}
+      for i, src in ipairs(sources) do
+        local plain, optimized = load(src, "=p", "t")(), load(src, "=o", "to")()
+        out[i] = tostring(plain) .. (plain == optimized and math.type(plain) == math.type(optimized) and "" or "!")
+      end
+      return table.concat(out, " ")
+    `);
+    const result = readResult(getBufferPtr(), bytes);
+    assert.strictEqual(result.result, '50500 1,2,3 3 truefalsetrue 5 6 3 16');
+  });
+
+  it('Reads globals again after metamethods that may write them, with the optimizer', () => {
+    const bytes = compute(`
+      local sources = {
+        "x = 1 local t = setmetatable({}, { __index = function() x = 2 end }) local a = x local b = t.y local c = x return a .. ',' .. c",
+        "x = 1 local u = setmetatable({}, { __add = function() x = 2 return 0 end }) local a = x local b = u + 1 local c = x return a .. ',' .. c",
+      }
+      local out = {}
+      for i, src in ipairs(sources) do
+        out[i] = load(src, "=p", "t")() .. "/" .. load(src, "=o", "to")()
+      end
+      return table.concat(out, " ")
+    `);
+    const result = readResult(getBufferPtr(), bytes);
+    assert.strictEqual(result.result, '1,2/1,2 1,2/1,2');
+  });
+
+  it('Calls a named function with serialized arguments', () => {
+    requireFeature(hasExport('call'), 'call export');
+    compute('function greet(name, n) return name .. ":" .. (n * 2) end');
+    const bytes = call('greet', ['cu', 21]);
+    assert.ok(bytes > 0);
+    const result = readResult(getBufferPtr(), bytes);
+    assert.strictEqual(result.result, 'cu:42');
+  });
+
+  it('Sees its own writes between repeated _home reads', () => {
+    compute('_home.config = { mode = "a" }; _home.count = 1');
+    const bytes = compute(`
+      local seen = _home.config.mode .. _home.count
+      _home.count = _home.count + 1
+      _home.config.mode = "b"
+      seen = seen .. _home.config.mode .. _home.count
+      _home.config = { mode = "c" }
+      return seen .. _home.config.mode .. tostring(_home["count"] == _home[1])
+    `);
+    const result = readResult(getBufferPtr(), bytes);
+    assert.strictEqual(result.result, 'a1b2cfalse');
+  });
+
+  it('Re-stores a changed table into the same field', () => {
+    compute(`
+      state = { name = "a", items = { 1, 2, 3 }, meta = { tag = "x" }, old = true }
+      _home.state = state
+      state.name = "b"
+      state.items[4] = 4
+      state.old = nil
+      _home.state = state
+    `);
+    let bytes = compute(`
+      local s = _home.state
+      return s.name .. #s.items .. s.items[4] .. s.meta.tag .. tostring(s.old)
+    `);
+    assert.strictEqual(readResult(getBufferPtr(), bytes).result, 'b44xnil');
+
+    // A write through the proxy is not lost by storing the table again
+    bytes = compute(`
+      _home.state.meta.tag = "y"
+      _home.state = state
+      _home.copy = state
+      _home.copy.name = "c"
+      return _home.state.meta.tag .. _home.state.name .. _home.copy.name
+    `);
+    assert.strictEqual(readResult(getBufferPtr(), bytes).result, 'xbc');
+  });
+
+  it('Rejects cyclic tables but stores shared subtables', () => {
+    const bytes = compute(`
+      local cyclic = { name = "loop" }
+      cyclic.inner = { parent = cyclic }
+      _home.cyclic = cyclic
+      local shared = { v = 1 }
+      _home.dag = { a = shared, b = { c = shared } }
+      return tostring(_home.cyclic) .. ":" .. (_home.dag.a.v + _home.dag.b.c.v)
+    `);
+    assert.strictEqual(readResult(getBufferPtr(), bytes).result, 'nil:2');
+  });
+
+  it('Applies a configurable table entry limit', () => {
+    requireFeature(hasExport('set_max_table_entries'), 'set_max_table_entries export');
+    instance.exports.set_max_table_entries(5);
+    const bytes = compute(`
+      _home.small = { 1, 2, 3, 4, 5 }
+      _home.big = { 1, 2, 3, 4, 5, 6 }
+      return #_home.small .. ":" .. tostring(_home.big)
+    `);
+    assert.strictEqual(readResult(getBufferPtr(), bytes).result, '5:nil');
+  });
+
+  it('Stores small nested tables inline', () => {
+    requireFeature(hasExport('set_inline_table_limits'), 'set_inline_table_limits export');
+    instance.exports.set_inline_table_limits(4, 256);
+    compute(`
+      _home.points = { { x = 1, y = 2 }, { x = 3, y = 4, tags = { "a", "b" } } }
+    `);
+    const bytes = compute(`
+      local p = _home.points[2]
+      return tostring(rawget(p, "__ext_table_id")) .. ":" .. p.x + p.y .. ":" .. p.tags[2]
+    `);
+    assert.strictEqual(readResult(getBufferPtr(), bytes).result, 'nil:7:b');
+  });
+
+  it('Drops external tables Lua can no longer reach', () => {
+    requireFeature(hasExport('get_live_table_ids'), 'get_live_table_ids export');
+    compute(`
+      _home.a = { x = { 1 } }
+      _home.a = { y = 2 }
+      _home.b = { z = 1 }
+      held = _home.b
+      _home.b = nil
+    `);
+    setInput({ n: { m: 1 } });
+    setInput({ n: 2 });
+
+    // The first _home.a and its x, and the first input and its n
+    assert.strictEqual(collectTables(), 4);
+    assert.strictEqual(collectTables(), 0);
+    const bytes = compute('_home.a = { y = 3 }; return held.z .. _home.a.y .. _io.input.n');
+    assert.strictEqual(readResult(getBufferPtr(), bytes).result, '132');
+  });
+
+  it('Iterates external tables with pairs()', () => {
+    requireFeature(hasImport('js_ext_table_next'), 'pairs() over external tables');
+    compute(`
+      _home.users = {}
+      for i = 1, 2000 do _home.users[i] = "user" .. i end
+      _home.users[7] = nil
+      _home.users.admin = true
+    `);
+    const bytes = compute(`
+      local count, sum, admin = 0, 0, false
+      for k, v in pairs(_home.users) do
+        count = count + 1
+        if k == "admin" then admin = v else sum = sum + k end
+      end
+      return count .. ":" .. sum .. ":" .. tostring(admin)
+    `);
+    const result = readResult(getBufferPtr(), bytes);
+    assert.strictEqual(result.result, `2000:${2000 * 2001 / 2 - 7}:true`);
+  });
+
+  it('Reads several external table keys with ext.getMany()', () => {
+    requireFeature(hasImport('js_ext_table_get_many'), 'ext.getMany()');
+    compute(`
+      _home.scores = {}
+      for i = 1, 500 do _home.scores["p" .. i] = i end
+    `);
+    const bytes = compute(`
+      local keys = {}
+      for i = 1, 600 do keys[i] = "p" .. i end
+      local got, count, sum = ext.getMany(_home.scores, keys), 0, 0
+      for _, v in pairs(got) do count = count + 1; sum = sum + v end
+      return count .. ":" .. sum .. ":" .. tostring(got.p600)
+    `);
+    const result = readResult(getBufferPtr(), bytes);
+    assert.strictEqual(result.result, `500:${500 * 501 / 2}:nil`);
+  });
+
+  it('Keeps external table keys in order for range scans', async () => {
+    const { ExtTable } = await import('../web/cu-ext-table.js');
+    const table = new ExtTable();
+    for (const key of [5, 'b', 3, 1, 'a', 4]) table.set(key, new Uint8Array([0]));
+    assert.deepStrictEqual(table.range(null, null), [1, 3, 4, 5, 'a', 'b']);
+    table.set(2, new Uint8Array([0]));
+    table.delete(4);
+    for (let i = 100; i < 400; i++) table.set(i, new Uint8Array([0]));
+    assert.deepStrictEqual(table.range(2, 101), [2, 3, 5, 100, 101]);
+    assert.deepStrictEqual(table.range(null, 'a', { reverse: true, limit: 3 }), ['a', 399, 398]);
+    assert.deepStrictEqual(table.range('3', '5'), [3, 5], 'canonical decimal strings are the integer keys');
+  });
+
+  it('Iterates a key range of an external table with ext.range()', () => {
+    requireFeature(hasImport('js_ext_table_range'), 'ext.range()');
+    compute(`
+      _home.ledger = ext.ordered()
+      for i = 1, 1000 do _home.ledger[i] = i * 10 end
+      _home.names = {}
+      for _, name in ipairs({ "carol", "alice", "dave", "bob" }) do _home.names[name] = #name end
+    `);
+    const bytes = compute(`
+      local last = {}
+      for k, v in ext.rrange(_home.ledger, nil, nil, 100) do last[#last + 1] = k end
+      local mid = 0
+      for k, v in ext.range(_home.ledger, 10, 19) do mid = mid + v end
+      local names = {}
+      for k in ext.range(_home.names, "b", "d") do names[#names + 1] = k end
+      return #last .. ":" .. last[1] .. ":" .. last[100] .. ":" .. mid .. ":" .. table.concat(names, ",")
+    `);
+    const result = readResult(getBufferPtr(), bytes);
+    assert.strictEqual(result.result, '100:1000:901:1450:bob,carol');
+  });
+
+  it('Keeps secondary indexes current as records change', async () => {
+    const { ExtTable } = await import('../web/cu-ext-table.js');
+    const { TableIndexes } = await import('../web/cu-ext-index.js');
+    const { encodeValue, encodeTableRef } = await import('../web/cu-values.js');
+    const tables = new Map();
+    const indexes = new TableIndexes(tables);
+    const users = new ExtTable();
+    tables.set(1, users);
+    const addUser = (key, id, city) => {
+      const record = new ExtTable().set('city', encodeValue(city));
+      tables.set(id, record);
+      users.set(key, encodeTableRef(id));
+      return record;
+    };
+    addUser('ann', 10, 'Oslo');
+    const bob = addUser('bob', 11, 'Rome');
+    indexes.declare(1, 'city');
+    addUser('cid', 12, 'Oslo');
+    assert.deepStrictEqual(indexes.lookup(1, 'city', 'Oslo'), ['ann', 'cid']);
+    bob.set('city', encodeValue('Oslo'));
+    users.delete('ann');
+    assert.deepStrictEqual(indexes.lookup(1, 'city', 'Oslo').sort(), ['bob', 'cid']);
+    assert.deepStrictEqual(indexes.lookup(1, 'city', 'Rome'), []);
+    assert.strictEqual(indexes.lookup(1, 'city', 'Oslo', 1).length, 1);
+    assert.deepStrictEqual(indexes.declarations(), [[1, 'city']]);
+  });
+
+  it('Finds records by field with ext.lookup()', () => {
+    requireFeature(hasImport('js_ext_table_lookup'), 'ext.lookup()');
+    compute(`
+      _home.users = {}
+      for i = 1, 500 do _home.users["u" .. i] = { name = "user" .. i, team = i % 5 } end
+      ext.index(_home.users, "team")
+    `);
+    const bytes = compute(`
+      _home.users.u7.team = 9
+      local key, user = ext.lookup(_home.users, "team", 9)
+      local count = 0
+      for k, v in ext.lookupAll(_home.users, "team", 3) do count = count + 1 end
+      return key .. ":" .. user.name .. ":" .. count .. ":" .. tostring(ext.lookup(_home.users, "team", 42))
+    `);
+    const result = readResult(getBufferPtr(), bytes);
+    assert.strictEqual(result.result, 'u7:user7:100:nil');
+  });
+
+  it('Stores columnar tables as packed column chunks', async () => {
+    const { ExtTable } = await import('../web/cu-ext-table.js');
+    const { ColumnTable, CHUNK_ROWS, parseSchema, restoreColumns } = await import('../web/cu-ext-column.js');
+    const { decodeValue, encodeRecord, encodeValue, encodeTableRef } = await import('../web/cu-values.js');
+    const tables = new Map();
+    const table = new ColumnTable(parseSchema('ts:i64\nprice:f64\n'), tables);
+    table.changes = new Map();
+    const rows = CHUNK_ROWS + 10;
+    for (let i = 1; i <= rows; i++) table.set(i, encodeRecord([['ts', BigInt(i)], ['price', i / 2]]));
+    // A row stored as a table reference is read from that table
+    tables.set(7, new ExtTable().set('ts', encodeValue(-5)).set('price', encodeValue(1.5)));
+    table.set(rows + 1, encodeTableRef(7));
+    assert.strictEqual(table.size, rows + 1);
+    const row = decodeValue(table.get(rows + 1)).entries.map(([name, field]) => [name, field.value]);
+    assert.deepStrictEqual(row, [['price', 1.5], ['ts', -5]]);
+    assert.deepStrictEqual(Array.from(table.column('ts', 2, 4)), [2n, 3n, 4n]);
+
+    table.seal();
+    assert.ok(table.changes.has('price#1') && table.changes.has('ts#0'));
+    table.changes.clear();
+    table.delete(rows + 1);
+    table.seal();
+    assert.deepStrictEqual([...table.changes.keys()].sort(), ['__rows', 'price#1', 'ts#1']);
+    assert.throws(() => table.delete(1));
+
+    const stored = new ExtTable();
+    for (const [key, value] of table) stored.set(key, value);
+    assert.strictEqual(stored.size, 2 + 2 * 2);
+    const restored = restoreColumns(stored, tables);
+    assert.ok(restored instanceof ColumnTable);
+    assert.strictEqual(restored.size, rows);
+    assert.deepStrictEqual(restored.toArray()[CHUNK_ROWS], { price: (CHUNK_ROWS + 1) / 2, ts: CHUNK_ROWS + 1 });
+    assert.strictEqual(restoreColumns(new ExtTable(), tables) instanceof ColumnTable, false);
+  });
+
+  it('Appends rows and reads columns with ext.columns()', () => {
+    requireFeature(hasImport('js_ext_table_columns'), 'ext.columns()');
+    compute(`
+      _home.ticks = ext.columns({ ts = "i64", price = "f64", qty = "i64" })
+      for i = 1, 1000 do ext.append(_home.ticks, { ts = i, price = i * 0.5, qty = i % 7 }) end
+      _home.ticks[#_home.ticks + 1] = { ts = 1001, price = 1, qty = 1 }
+    `);
+    const bytes = compute(`
+      local ticks = _home.ticks
+      local prices = ext.column(ticks, "price")
+      local recent = ext.column(ticks, "ts", 991)
+      return #ticks .. ":" .. ticks[10].ts .. ":" .. ticks[10].price .. ":" .. #prices .. ":" .. vec.sum(prices) .. ":" .. #recent .. ":" .. recent[1]
+    `);
+    const result = readResult(getBufferPtr(), bytes);
+    assert.strictEqual(result.result, '1001:10:5.0:1001:250251.0:11:991');
+  });
+
+  it('Removes keys assigned nil from the host table', () => {
+    compute('_home.gone = 1; _home.kept = 2');
+    compute('_home.gone = nil');
+    const unit = getInstance();
+    const home = unit.externalTables.get(unit.homeTableId);
+    assert.strictEqual(home.has('gone'), false);
+    assert.strictEqual(home.has('kept'), true);
+  });
+
+  it('Evicts and expires cache table entries', async () => {
+    const { ExtTable } = await import('../web/cu-ext-table.js');
+    const { CacheTable, restoreCache } = await import('../web/cu-ext-cache.js');
+    let now = Date.now();
+    const cache = new CacheTable(3, 10);
+    cache.now = () => now;
+    cache.changes = new Map();
+    const value = new Uint8Array([0x04, 1, 0, 0, 0, 0x61]);
+    for (const key of ['a', 'b', 'c']) cache.set(key, value);
+    cache.get('a');
+    cache.set('d', value);
+    assert.deepStrictEqual([...cache.keys()].sort(), ['a', 'c', 'd'], 'b was least recently used');
+    assert.strictEqual(cache.changes.get('b'), undefined);
+    assert.ok(cache.changes.has('b'), 'the eviction is journaled');
+
+    now += 5000;
+    cache.set('e', value);
+    now += 6000;
+    assert.deepStrictEqual([...cache.keys()], ['e'], 'the others expired');
+    cache.seal();
+    assert.ok(cache.changes.has('__cache'));
+
+    const stored = new ExtTable();
+    for (const [key, bytes] of cache) stored.set(key, bytes);
+    const restored = restoreCache(stored);
+    assert.ok(restored instanceof CacheTable);
+    assert.strictEqual(restored.maxEntries, 3);
+    assert.deepStrictEqual([...restored.keys()], ['e']);
+  });
+
+  it('Keeps array table values as a sequence', async () => {
+    const { ExtTable } = await import('../web/cu-ext-table.js');
+    const { ArrayTable, restoreArray } = await import('../web/cu-ext-array.js');
+    const list = new ArrayTable();
+    list.changes = new Map();
+    for (let i = 1; i <= 5; i++) assert.strictEqual(list.push(Uint8Array.of(i)), i);
+    list.set(6, Uint8Array.of(6));
+    assert.throws(() => list.set(8, Uint8Array.of(8)), RangeError, 'a hole');
+    assert.throws(() => list.set('name', Uint8Array.of(0)), RangeError);
+    assert.throws(() => list.delete(3), RangeError, 'only the last value goes');
+    assert.deepStrictEqual(list.pop(), Uint8Array.of(6));
+    assert.strictEqual(list.size, 5);
+    assert.deepStrictEqual(list.slice(2, 3), [Uint8Array.of(2), Uint8Array.of(3)]);
+    assert.deepStrictEqual(list.slice(4, 100).length, 2, 'clamped to the length');
+    list.seal();
+    assert.ok(list.changes.has('__array'));
+
+    const stored = new ExtTable();
+    for (const [key, bytes] of list) stored.set(key, bytes);
+    const restored = restoreArray(stored);
+    assert.ok(restored instanceof ArrayTable);
+    assert.deepStrictEqual([...restored.keys()], [1, 2, 3, 4, 5]);
+    stored.delete(2);
+    assert.ok(!(restoreArray(stored) instanceof ArrayTable), 'entries with a hole stay plain');
+    assert.strictEqual(new ArrayTable().pop(), undefined);
+  });
+
+  it('Appends to and slices a table made with ext.array()', () => {
+    requireFeature(hasImport('js_ext_table_push'), 'ext.array()');
+    const bytes = compute(`
+      _home.events = ext.array()
+      for i = 1, 300 do ext.push(_home.events, "e" .. i) end
+      local last = ext.pop(_home.events)
+      local part = ext.slice(_home.events, 298)
+      _home.events[#_home.events + 1] = "again"
+      return #_home.events .. ":" .. last .. ":" .. #part .. ":" .. part[1] .. ":" .. _home.events[300]
+    `);
+    const result = readResult(getBufferPtr(), bytes);
+    assert.strictEqual(result.result, '300:e300:2:e298:again');
+  });
+
+  it('Keeps arena table values in one slab', async () => {
+    const { ExtTable } = await import('../web/cu-ext-table.js');
+    const { ArenaTable } = await import('../web/cu-ext-arena.js');
+    const table = new ArenaTable();
+    table.changes = new Map();
+    const bytes = (n) => Uint8Array.from({ length: 8 }, (_, i) => (n + i) & 0xff);
+    for (let i = 1; i <= 1000; i++) table.set(i, bytes(i));
+    table.set('name', bytes(7));
+    const early = table.get(3);
+    assert.deepStrictEqual(early, bytes(3));
+    assert.strictEqual(table.get(500).buffer, table.get(900).buffer, 'values share a slab');
+    assert.ok(table.isArray() === false && table.size === 1001);
+
+    const copy = table.clone();
+    for (let i = 1; i <= 900; i++) table.delete(i);
+    assert.ok(table.slab.length < 8 * 1000, 'deletes compact the slab');
+    assert.deepStrictEqual(early, bytes(3), 'views outlive compaction');
+    assert.deepStrictEqual(table.get(950), bytes(950));
+    assert.strictEqual(copy.size, 1001, 'the clone keeps its entries');
+    copy.set(950, bytes(1));
+    assert.deepStrictEqual(copy.get(950), bytes(1));
+    assert.deepStrictEqual(table.get(950), bytes(950), 'and writes to its own slab');
+    assert.deepStrictEqual(table.changes.get(1000), bytes(1000));
+    assert.ok(table.changes.has(1) && table.changes.get(1) === undefined);
+
+    const plain = new ExtTable();
+    for (const [key, value] of table) plain.set(key, value);
+    const round = ArenaTable.from(plain).toPlain();
+    assert.deepStrictEqual([...round.keys()], [...table.keys()]);
+    assert.deepStrictEqual(round.get('name'), bytes(7));
+  });
+
+  it('Keeps a cached response until a table it read changes', async () => {
+    const { ExtTable } = await import('../web/cu-ext-table.js');
+    const { ResponseCache } = await import('../web/cu-response-cache.js');
+    const prices = new ExtTable();
+    const other = new ExtTable();
+    const tables = new Map([[4, prices], [5, other]]);
+    const cache = new ResponseCache(['quote'], { maxEntries: 2 });
+    const args = Uint8Array.of(1, 2, 3);
+    const result = Uint8Array.of(9);
+
+    assert.strictEqual(cache.lookup('quote', args, tables), null);
+    cache.store('quote', args, result, [[4, prices]]);
+    assert.strictEqual(cache.lookup('quote', args, tables), result);
+    assert.strictEqual(cache.lookup('quote', Uint8Array.of(1, 2, 4), tables), null, 'other arguments miss');
+    other.set('x', Uint8Array.of(1));
+    assert.strictEqual(cache.lookup('quote', args, tables), result, 'tables it did not read may change');
+    prices.set('x', Uint8Array.of(1));
+    assert.strictEqual(cache.lookup('quote', args, tables), null, 'a write retires the entry');
+
+    cache.store('quote', args, result, [[4, prices]]);
+    tables.set(4, prices.clone());
+    assert.strictEqual(cache.lookup('quote', args, tables), null, 'so does replacing the table');
+
+    for (let i = 0; i < 3; i++) cache.store('quote', Uint8Array.of(i), result, []);
+    assert.strictEqual(cache.stats().entries, 2);
+    assert.strictEqual(cache.lookup('quote', Uint8Array.of(0), tables), null, 'the oldest was dropped');
+    cache.expire();
+    assert.deepStrictEqual(cache.stats(), { hits: 2, misses: 5, entries: 0 });
+  });
+
+  it('Bounds a table made with ext.cache()', () => {
+    requireFeature(hasImport('js_ext_table_cache'), 'ext.cache()');
+    compute(`
+      _home.lookups = ext.cache({ max = 100 })
+      for i = 1, 250 do _home.lookups["q" .. i] = i end
+    `);
+    const bytes = compute(`
+      local count = 0
+      for k in pairs(_home.lookups) do count = count + 1 end
+      return count .. ":" .. tostring(_home.lookups.q1) .. ":" .. _home.lookups.q250
+    `);
+    const result = readResult(getBufferPtr(), bytes);
+    assert.strictEqual(result.result, '100:nil:250');
+  });
+
+  it('Fills key filters from the key text', async () => {
+    const { fillKeyFilter } = await import('../web/cu-ext-table.js');
+    const asNumber = new Uint32Array(32);
+    const asString = new Uint32Array(32);
+    assert.strictEqual(fillKeyFilter([7, 'seven'], asNumber, 1024), 2);
+    fillKeyFilter(['7', 'seven'], asString, 1024);
+    assert.deepStrictEqual(asNumber, asString);
+    const nonAscii = new Uint32Array(32);
+    assert.strictEqual(fillKeyFilter(['clé'], nonAscii, 1024), 1);
+    assert.ok(nonAscii.every((word) => word === 0), 'keys the WASM side never asks about are left out');
+  });
+
+  it('Answers missing keys from the key filter', () => {
+    requireFeature(hasImport('js_ext_table_filter'), 'key filters');
+    compute(`
+      _home.sparse = ext.table()
+      for i = 1, 50 do _home.sparse[i * 2] = i end
+    `);
+    const probe = `
+      local hits = 0
+      for i = 1, 100 do if _home.sparse[i] ~= nil then hits = hits + 1 end end
+      return hits .. ":" .. tostring(_home.sparse.late)
+    `;
+    assert.strictEqual(readResult(getBufferPtr(), compute(probe)).result, '50:nil');
+    compute('_home.sparse.late = 1; _home.sparse[1] = 0');
+    assert.strictEqual(readResult(getBufferPtr(), compute(probe)).result, '51:1');
+
+    // A host-side write is seen once the host invalidates the table
+    const unit = getInstance();
+    const id = [...unit.externalTables].find(([, table]) => table.has('late'))[0];
+    const sparse = unit.externalTables.get(id);
+    sparse.set('host', sparse.get('late'));
+    unit.wasmInstance.exports.invalidate_ext_table(id);
+    assert.strictEqual(readResult(getBufferPtr(), compute('return tostring(_home.sparse.host)')).result, '1');
+  });
+
+  it('Prefetches keys for the reads that follow', () => {
+    requireFeature(hasExport('set_prefetch_learning'), 'ext.prefetch()');
+    compute('_home.prefs = { theme = "dark", lang = "en", size = 12 }');
+    const unit = getInstance();
+    unit.startBridgeTrace();
+    const bytes = compute(`
+      local prefs = _home.prefs
+      local found = ext.prefetch(prefs, { "theme", "lang", "size", "missing" })
+      return found .. ":" .. prefs.theme .. ":" .. prefs.lang .. ":" .. prefs.size
+    `);
+    assert.strictEqual(readResult(getBufferPtr(), bytes).result, '3:dark:en:12');
+    assert.strictEqual(unit.stopBridgeTrace().ops.get?.count, 1, 'only _home.prefs is read one by one');
+
+    assert.strictEqual(unit.setPrefetchLearning(true), true);
+    const source = 'return _home.prefs.theme .. _home.prefs.size';
+    for (let run = 0; run < 2; run++) compute(source);
+    unit.startBridgeTrace();
+    assert.strictEqual(readResult(getBufferPtr(), compute(source)).result, 'dark12');
+    const learned = unit.stopBridgeTrace();
+    unit.setPrefetchLearning(false);
+    assert.strictEqual(learned.ops.get, undefined, 'the keys read last time were prefetched');
+  });
+
+  it('Undoes nested transactions in reverse order', async () => {
+    const { UndoLog, TXN_BEGIN, TXN_COMMIT, TXN_ROLLBACK } = await import('../web/cu-ext-txn.js');
+    const table = new Map([['a', 1]]);
+    const log = new UndoLog();
+    assert.strictEqual(log.apply(TXN_COMMIT), -1, 'nothing to commit outside a transaction');
+    log.apply(TXN_BEGIN);
+    log.note(table, 'a');
+    table.set('a', 2);
+    log.apply(TXN_BEGIN);
+    log.note(table, 'a');
+    table.set('a', 3);
+    log.note(table, 'b');
+    table.set('b', 4);
+    log.apply(TXN_ROLLBACK);
+    assert.deepStrictEqual([...table], [['a', 2]]);
+    log.apply(TXN_ROLLBACK);
+    assert.deepStrictEqual([...table], [['a', 1]]);
+    assert.strictEqual(log.active, false);
+  });
+
+  it('Applies the writes of ext.transaction() as a whole', () => {
+    requireFeature(hasImport('js_ext_transaction'), 'ext.transaction()');
+    compute('_home.account = { balance = 100 }');
+    const bytes = compute(`
+      local ok = pcall(ext.transaction, function()
+        _home.account.balance = _home.account.balance - 30
+        _home.account.note = "pending"
+        error("declined")
+      end)
+      local committed = ext.transaction(function()
+        _home.account.balance = _home.account.balance - 10
+        return "done"
+      end)
+      return tostring(ok) .. ":" .. committed .. ":" .. _home.account.balance .. ":" .. tostring(_home.account.note)
+    `);
+    assert.strictEqual(readResult(getBufferPtr(), bytes).result, 'false:done:90:nil');
+  });
+
+  it('Requires modules stored in _home.modules', () => {
+    const searchers = readResult(getBufferPtr(), compute('return #package.searchers')).result;
+    requireFeature(searchers >= 5, '_home module searcher');
+    compute('_home.modules = { greet = "return { hello = function(n) return \'hi \' .. n end }" }');
+    let bytes = compute('return require("greet").hello("ann") .. ":" .. _home.modules.greet:byte(1)');
+    assert.strictEqual(readResult(getBufferPtr(), bytes).result, 'hi ann:27', 'stored back as a binary chunk');
+    compute('_home.modules.greet = "return { hello = function(n) return \'hey \' .. n end }"');
+    bytes = compute('return require("greet").hello("bo")');
+    assert.strictEqual(readResult(getBufferPtr(), bytes).result, 'hey bo');
+  });
+
+  it('Counts and validates UTF-8 across long ASCII runs', () => {
+    const bytes = compute(`
+      local ascii = string.rep("abcdefghijklmnop", 64)
+      local text = ascii .. "caf\\u{E9}" .. ascii .. "\\u{1F600}!"
+      local bad = ascii .. "\\xED\\xA0\\x80" .. ascii
+      local cut = ascii .. "\\xE2\\x82"
+      local _, at = utf8.len(bad)
+      local _, cut_at = utf8.len(cut)
+      return table.concat({
+        utf8.len(text), utf8.len(text, 1, #ascii + 3), at, utf8.len(bad, 1, -1, true),
+        cut_at, utf8.len(ascii .. "\\u{E9}", 1, #ascii + 1)
+      }, ",")
+    `);
+    assert.strictEqual(readResult(getBufferPtr(), bytes).result, '2054,1027,1025,2049,1025,1025');
+  });
+
+  it('Encodes and decodes base64 and hex with the codec library', () => {
+    const probe = compute('return package.preload.codec ~= nil');
+    requireFeature(readResult(getBufferPtr(), probe).result === true, 'codec library');
+    // 0..255 and back, then a 13-byte tail past the last whole block
+    const data = Buffer.from([...Array(256).keys(), ...Array(256).keys()].reverse().slice(0, 269));
+    const bytes = compute(`
+      local codec = require('codec')
+      local data = {}
+      for i = 255, 0, -1 do data[#data + 1] = string.char(i) end
+      for i = 255, 243, -1 do data[#data + 1] = string.char(i) end
+      data = table.concat(data)
+      local b64, url, hex = codec.base64_encode(data), codec.base64_encode(data, true), codec.hex_encode(data)
+      local raw = codec.hex_decode(hex, 'bytes')
+      local ok, err = pcall(codec.base64_decode, b64:sub(1, 20) .. "*" .. b64:sub(22))
+      return table.concat({
+        b64, url, hex, tostring(codec.base64_decode(b64) == data), tostring(codec.base64_decode(url, true) == data),
+        tostring(codec.hex_decode(hex:upper()) == data), #raw .. ":" .. raw[1] .. ":" .. raw[#raw],
+        codec.base64_encode(raw), codec.base64_decode("aGk", false), err:match("position %d+")
+      }, ",")
+    `);
+    const b64 = data.toString('base64');
+    assert.strictEqual(readResult(getBufferPtr(), bytes).result, [
+      b64, data.toString('base64url'), data.toString('hex'), 'true', 'true', 'true', '269:255:243', b64, 'hi', 'position 21'
+    ].join(','));
+  });
+
+  it('Hashes with SHA-256, Keccak-256 and BLAKE3, whole or in pieces', () => {
+    const probe = compute('return package.preload.hash ~= nil');
+    requireFeature(readResult(getBufferPtr(), probe).result === true, 'hash library');
+    const bytes = compute(`
+      local hash = require('hash')
+      local h = hash.new('sha256'):update('a', 'b')
+      local partial = h:digest('hex')
+      h:update(string.rep('c', 1000))
+      return table.concat({
+        hash.sha256('abc', 'hex'), hash.keccak256('', 'hex'), hash.blake3('', 'hex'), #hash.sha256('abc'),
+        partial, tostring(h:digest() == hash.sha256('ab' .. string.rep('c', 1000))), h:algorithm()
+      }, ',')
+    `);
+    const sha256 = (s) => createHash('sha256').update(s).digest('hex');
+    assert.strictEqual(readResult(getBufferPtr(), bytes).result, [
+      sha256('abc'),
+      'c5d2460186f7233c927e7db2dcc703c0e500b653ca82273b7bfad8045d85a470',
+      'af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262',
+      '32', sha256('ab'), 'true', 'sha256'
+    ].join(','));
+  });
+
+  it('Evicts the least recently used entry of an lru', () => {
+    const probe = compute('return package.preload.lru ~= nil');
+    requireFeature(readResult(getBufferPtr(), probe).result === true, 'lru library');
+    const bytes = compute(`
+      local lru = require('lru')
+      local c = lru.new(2)
+      c:set('a', 1):set('b', { 2 })
+      local a = c:get('a')
+      c:set('c', 3)
+      local s = c:stats()
+      return table.concat({
+        a, tostring(c:peek('b')), c:get('c'), #c, tostring(c:delete('a')), tostring(c:get('a')),
+        s.hits, s.misses, s.evictions
+      }, ',')
+    `);
+    assert.strictEqual(readResult(getBufferPtr(), bytes).result, '1,nil,3,2,true,nil,1,0,1');
+  });
+
+  it('Packs struct records and stores them by value', () => {
+    const probe = compute('return package.preload.struct ~= nil');
+    requireFeature(readResult(getBufferPtr(), probe).result === true, 'struct library');
+    const bytes = compute(`
+      local struct = require('struct')
+      local Tx = struct.define{ id = "i64", amount = "f64", ok = "bool", tag = "str" }
+      local tx = Tx{ id = 7, amount = 2.5 }
+      tx.ok, tx.tag = true, "card"
+      local bad = pcall(function() tx.id = 1.5 end) or pcall(function() return tx.nope end)
+      _home.tx = tx
+      local back = _home.tx
+      local keys = {}
+      for k in pairs(tx) do keys[#keys + 1] = k end
+      return table.concat({
+        tx.id, tx.amount, tostring(tx.ok), tx.tag, tostring(bad), struct.sizeof(tx), type(back),
+        back.id, back.tag, table.concat(keys, ' ')
+      }, ',')
+    `);
+    assert.strictEqual(readResult(getBufferPtr(), bytes).result, '7,2.5,true,card,false,17,table,7,card,amount id ok tag');
+  });
+
+  it('Compresses with deflate, whole or streamed, and decompresses', () => {
+    const probe = compute('return package.preload.compress ~= nil');
+    requireFeature(readResult(getBufferPtr(), probe).result === true, 'compress library');
+    const text = 'the quick brown fox '.repeat(500);
+    const gzipped = zlib.gzipSync(text).toString('hex');
+    const bytes = compute(`
+      local compress, codec = require('compress'), require('codec')
+      local text = string.rep('the quick brown fox ', 500)
+      local d = compress.deflater('zlib')
+      for i = 1, 500 do d:update('the quick ', 'brown fox ') end
+      local streamed = d:read() .. d:finish()
+      local raw = compress.deflate(text, 'raw', 9, 'bytes')
+      local ok, err = pcall(compress.inflate, 'not deflate', 'zlib')
+      return table.concat({
+        codec.hex_encode(streamed), tostring(#streamed < #text), tostring(compress.inflate(raw) == text),
+        tostring(compress.inflate(codec.hex_decode('${gzipped}'), 'gzip') == text), tostring(ok)
+      }, ',')
+    `);
+    const [streamed, ...rest] = readResult(getBufferPtr(), bytes).result.split(',');
+    assert.strictEqual(zlib.inflateSync(Buffer.from(streamed, 'hex')).toString(), text);
+    assert.deepStrictEqual(rest, ['true', 'true', 'true', 'false']);
+  });
+
+  it('Stores values larger than the I/O buffer window', () => {
+    requireFeature(hasImport('js_ext_table_set_parts'), 'large external table values');
+    compute(`
+      _home.doc = string.rep("x", 100000)
+      _home.record = { body = string.rep("y", 50000), n = 1 }
+    `);
+    const bytes = compute('return #_home.doc .. ":" .. #_home.record.body .. ":" .. _home.record.n');
+    const result = readResult(getBufferPtr(), bytes);
+    assert.strictEqual(result.result, '100000:50000:1');
+  });
+
+  it('Stores closures with their upvalues', () => {
+    const probe = compute('local n = 1 _home.probe = function() return n end return tostring(_home.probe())');
+    requireFeature(readResult(getBufferPtr(), probe).result === '1', 'Storing closure upvalues');
+    const bytes = compute(`
+      local count = 5
+      local function peek() return count end
+      local function fact(n) if n <= 1 then return 1 end return n * fact(n - 1) end
+      local config = { scale = 10 }
+      _home.step = function(x)
+        count = count + 1
+        return count .. ":" .. peek() .. ":" .. fact(x) .. ":" .. x * config.scale
+      end
+      local step = _home.step
+      return step(4) .. "|" .. step(2) .. "|" .. count
+    `);
+    const result = readResult(getBufferPtr(), bytes);
+    assert.strictEqual(result.result, '6:6:24:40|7:7:2:20|5');
+  });
+
+  it('Stores standard library functions by reference', () => {
+    const probe = compute('_home.probe = type return tostring(_home.probe == type)');
+    requireFeature(readResult(getBufferPtr(), probe).result === 'true', 'The C function registry');
+    compute('_home.lib = { floor = math.floor, format = string.format, random = math.random, print = print }');
+    const bytes = compute(`
+      local lib = _home.lib
+      local same = lib.floor == math.floor and lib.format == string.format and lib.print == print
+      local r = lib.random(1, 6)
+      return tostring(same) .. ":" .. lib.format("%d", lib.floor(2.7)) .. ":" .. tostring(r >= 1 and r <= 6)
+    `);
+    const result = readResult(getBufferPtr(), bytes);
+    assert.strictEqual(result.result, 'true:2:true');
+  });
+
+  it('Sorts number and string arrays', () => {
+    const bytes = compute(`
+      local ints, floats, words = {}, {}, {}
+      for i = 1, 300 do
+        ints[i] = (i * 7919) % 301
+        floats[i] = ints[i] / 4
+        words[i] = "w" .. ints[i]
+      end
+      table.sort(ints); table.sort(floats); table.sort(words)
+      local mixed = { 3, 1.5, 2 }
+      table.sort(mixed)
+      for i = 2, 300 do
+        assert(ints[i - 1] <= ints[i] and floats[i - 1] <= floats[i] and words[i - 1] <= words[i])
+      end
+      return ints[1] .. ":" .. ints[300] .. ":" .. words[1] .. ":" .. tostring(mixed[1] == 1.5)
+    `);
+    const result = readResult(getBufferPtr(), bytes);
+    assert.strictEqual(result.result, '1:300:w1:true');
+  });
+
+  it('Resolves fields and methods as objects change shape', () => {
+    const bytes = compute(`
+      local Class = {}
+      Class.__index = Class
+      function Class:who() return "class" end
+      local function who(obj) return obj:who() end
+      local function getx(obj) return obj.x end
+      local seen = {}
+      for i = 1, 40 do
+        local obj = setmetatable({}, Class)
+        for j = 1, i % 5 do obj["f" .. j] = j end
+        obj.x = i
+        if i % 3 == 0 then obj.who = function() return "own" end end
+        seen[#seen + 1] = getx(obj) .. who(obj)
+        obj.who = nil
+        obj.x = nil
+        seen[#seen + 1] = tostring(getx(obj)) .. who(obj)
+      end
+      return seen[1] .. "," .. seen[2] .. "," .. seen[5] .. "," .. seen[80]
+    `);
+    const result = readResult(getBufferPtr(), bytes);
+    assert.strictEqual(result.result, '1class,nilclass,3own,nilclass');
+  });
+
+  it('Keeps record tables consistent as keys come and go', () => {
+    const bytes = compute(`
+      local function dump(t)
+        local keys = {}
+        for k, v in pairs(t) do keys[#keys + 1] = tostring(k) .. "=" .. tostring(v) end
+        table.sort(keys)
+        return table.concat(keys, " ")
+      end
+      local a, b = { x = 1, y = 2 }, {}
+      b.x = 3; b.y = 4
+      b.y = nil
+      for k in pairs(a) do a[k] = nil end
+      a.z = 5
+      local c = { name = "c" }
+      for i = 1, 20 do c["f" .. i] = i end
+      c[1] = "first"; c[true] = "yes"
+      local weak = setmetatable({}, { __mode = "v" })
+      weak.kept, weak.lost = a, {}
+      collectgarbage()
+      return table.concat({ dump(a), dump(b), tostring(c.f20), tostring(c[1]), tostring(c[true]),
+                            tostring(weak.kept == a), tostring(weak.lost) }, "|")
+    `);
+    const result = readResult(getBufferPtr(), bytes);
+    assert.strictEqual(result.result, 'z=5|x=3|20|first|yes|true|nil');
+  });
+
+  it('Formats print arguments', () => {
+    const bytes = compute('print(1, -2.5, 2.0, true, nil, "s", math.mininteger) return 0');
+    const result = readResult(getBufferPtr(), bytes);
+    assert.strictEqual(result.output, '1\t-2.5\t2\ttrue\tnil\ts\t-9223372036854775808\n');
+  });
+
+  it('Returns every value and the contents of tables', (t) => {
+    requireFeature(readResult(getBufferPtr(), compute('return 1, 2')).results?.length === 2, 'multiple results');
+    const bytes = compute(`
+      _home.saved = { 10, 20 }
+      local t = { name = "cu", list = { 1, 2, 3 }, nested = { deep = { ok = true } }, f = print }
+      t.self = t
+      return t, "second", _home.saved, print
+    `);
+    const { result, results } = readResult(getBufferPtr(), bytes);
+    assert.strictEqual(results.length, 4);
+    assert.strictEqual(result.name, 'cu');
+    assert.deepStrictEqual(result.list, [1, 2, 3]);
+    assert.strictEqual(result.nested.deep.ok, true);
+    assert.strictEqual(result.f, '<function>');
+    assert.strictEqual(result.self, '<table>');
+    assert.strictEqual(results[1], 'second');
+    assert.deepStrictEqual(results[2], [10, 20]);
+    assert.strictEqual(results[3], '<function>');
+  });
+
+  it('Runs scripts larger than the I/O buffer', () => {
+    requireFeature(hasExport('compute_at'), 'compute_at export');
+    const lines = ['local n = 0'];
+    for (let i = 0; i < 4000; i++) lines.push(`n = n + ${i} -- ${'pad'.repeat(8)}`);
+    lines.push('return n');
+    const source = lines.join('\n');
+    assert.ok(source.length > 128 * 1024);
+    assert.strictEqual(readResult(getBufferPtr(), compute(source)).result, 3999 * 4000 / 2);
+    assert.strictEqual(readResult(getBufferPtr(), compute('return 1')).result, 1);
+  });
+
+  it('Returns results larger than the I/O buffer through a result region', () => {
+    requireFeature(hasExport('set_result_region'), 'set_result_region export');
+    const unit = getInstance();
+    assert.strictEqual(unit.setResultRegion(1024), true);
+    const bytes = compute(`
+      local rows = {}
+      for i = 1, 5000 do rows[i] = { id = i, name = "row" .. i } end
+      return string.rep("x", 200000), rows
+    `);
+    assert.ok(bytes > 200000);
+    const { results } = readResult(unit.getResultPtr(), bytes);
+    assert.strictEqual(results[0].length, 200000);
+    assert.strictEqual(results[1].length, 5000);
+    assert.deepStrictEqual(results[1][4999], { id: 5000, name: 'row5000' });
+
+    const small = compute('return "small"');
+    assert.strictEqual(readResult(unit.getResultPtr(), small).result, 'small');
+    unit.setResultRegion(0);
+    assert.strictEqual(unit.getResultPtr(), getBufferPtr());
+  });
+
+  it('Streams print output past the capture buffer', () => {
+    requireFeature(hasExport('set_output_streaming'), 'set_output_streaming export');
+    const pieces = [];
+    getInstance().setOutputStreaming((text) => pieces.push(text), { chunkBytes: 1024 });
+    const bytes = compute(`
+      for i = 1, 2000 do print(string.rep("x", 60), i) end
+      return "done"
+    `);
+    const result = readResult(getBufferPtr(), bytes);
+    assert.strictEqual(result.result, 'done');
+    assert.strictEqual(result.output, '');
+    assert.ok(pieces.length > 100, 'output should arrive in chunks');
+    const lines = pieces.join('').split('\n');
+    assert.strictEqual(lines.length, 2001);
+    assert.strictEqual(lines[1999], `${'x'.repeat(60)}\t2000`);
+
+    getInstance().setOutputStreaming(null);
+    const captured = readResult(getBufferPtr(), compute('print("back")'));
+    assert.strictEqual(captured.output, 'back\n');
+  });
+
+  it('Reads and writes globals as the globals table grows and changes', () => {
+    const bytes = compute(`
+      local function read() return probe end
+      local function write(v) probe = v end
+      local seen = {}
+      for i = 1, 60 do
+        if i % 4 == 0 then probe = nil else write(i) end
+        _G["g" .. i] = i  -- grows _G, moving its nodes
+        seen[#seen + 1] = tostring(read())
+      end
+      local other = load("return probe", "=env", "t", { probe = "own" })
+      return seen[1] .. seen[4] .. seen[59] .. tostring(g60) .. other()
+    `);
+    const result = readResult(getBufferPtr(), bytes);
+    assert.strictEqual(result.result, '1nil5960own');
+  });
+
+  it('Calls methods found on objects and on their classes from one call site', () => {
+    const bytes = compute(`
+      local Point = {}
+      Point.__index = Point
+      function Point:sum() return self.x + self.y end
+      local objects = {}
+      for i = 1, 20 do objects[i] = setmetatable({ x = i, y = 1 }, Point) end
+      objects[5].sum = function() return 1000 end
+      local total = 0
+      for round = 1, 3 do
+        for i = 1, #objects do total = total + objects[i]:sum() end
+        Point["m" .. round] = round  -- grows the class, moving its nodes
+      end
+      return total
+    `);
+    const result = readResult(getBufferPtr(), bytes);
+    assert.strictEqual(result.result, 3 * (230 - 6 + 1000));
+  });
+
+  it('Converts floats to text and back without losing digits', () => {
+    requireFeature(readResult(getBufferPtr(), compute('return tostring(0.5)')).result === '0.5', 'float formatting');
+    const bytes = compute(`
+      return table.concat({
+        tostring(0.1 + 0.2), tostring(1e300), tostring(-2.5e-7), tostring(2^53),
+        string.format("%.3f;%8.2e;%g;%-6.1f;%05.1f", 2.0005, 123456, 1e-5, 1.25, -1.5),
+        string.format("%a;%.14g", 1.0, 1/3),
+        tostring(tonumber("0x1.8p1")), tostring(tonumber(" 1.7976931348623157e308 ")),
+        tostring(tonumber(tostring(0.1 + 0.2)) == 0.1 + 0.2),
+      }, "|")
+    `);
+    const result = readResult(getBufferPtr(), bytes);
+    assert.strictEqual(result.result, [
+      '0.30000000000000004', '1e+300', '-2.5e-07', '9007199254740992.0',
+      '2.001;1.23e+05;1e-05;1.2   ;-01.5', '0x1p+0;0.33333333333333',
+      '3.0', '1.7976931348623157e+308', 'true',
+    ].join('|'));
+  });
+
+  it('Formats integers, strings and characters with flags, width and precision', () => {
+    requireFeature(readResult(getBufferPtr(), compute('return string.format("%5d", 1)')).result === '    1', 'string.format widths');
+    const bytes = compute(`
+      return table.concat({
+        string.format("%d;%5d;%-5d;%05d;%+d;% d;%.3d;%.0d", 42, -42, 7, -7, 3, 3, 5, 0),
+        string.format("%x;%#X;%08x;%o;%#o;%u", 255, 255, -1 & 0xffff, 8, 0, 12),
+        string.format("%d;%d", math.maxinteger, math.mininteger),
+        string.format("%5s;%-5s;%.2s;%6.3s;%3c;%-3c", "ab", "ab", "abc", "abcdef", 65, 66),
+        string.format("%5s", string.rep("z", 8)),
+      }, "|")
+    `);
+    assert.strictEqual(readResult(getBufferPtr(), bytes).result, [
+      '42;  -42;7    ;-0007;+3; 3;005;', 'ff;0XFF;0000ffff;10;0;12',
+      '9223372036854775807;-9223372036854775808', '   ab;ab   ;ab;   abc;  A;B  ', 'zzzzzzzz',
+    ].join('|'));
+  });
+
+  it('Matches repeated patterns the same way on every call', () => {
+    const bytes = compute(`
+      local out = {}
+      for i = 1, 3 do
+        local line = "id=" .. i .. " user=ann  (a(b)c) took=1" .. i .. "ms"
+        out[#out + 1] = table.concat({ line:match("id=(%d+)%s+user=(%a+)") }, ",")
+        out[#out + 1] = select(2, line:gsub("%d+", "#"))
+        out[#out + 1] = line:find("%b()")
+        out[#out + 1] = line:match("took=(%d+)ms$")
+        out[#out + 1] = line:match("(%w+)=%s*$") or "-"
+        for k, v in line:gmatch("(%w+)=(%S+)") do out[#out + 1] = k .. ":" .. v end
+      end
+      out[#out + 1] = ("aaab"):match("a+ab")
+      out[#out + 1] = ("x  y"):match("^(%s*)(.-)(%s*)$")
+      return table.concat(out, "|")
+    `);
+    const expected = [1, 2, 3].flatMap((i) => [
+      `${i},ann`, '2', '16', `1${i}`, '-', `id:${i}`, 'user:ann', `took:1${i}ms`,
+    ]);
+    assert.strictEqual(readResult(getBufferPtr(), bytes).result, [...expected, 'aaab', ''].join('|'));
+  });
+
+  it('Splits and joins strings natively', () => {
+    requireFeature(readResult(getBufferPtr(), compute('return string.split ~= nil')).result === true, 'string.split');
+    const bytes = compute(`
+      local fields = ("a,b,,c"):split(",")
+      local head = ("k::v::w"):split("::", 2)
+      return table.concat({
+        #fields, fields[3] == "" and "empty" or "?", head[2], #(""):split(","), #("abc"):split(""),
+        string.join({ 1, "x", true, 2.5 }, ";"), string.join(fields, "|", 2, 4),
+      }, " ")
+    `);
+    assert.strictEqual(readResult(getBufferPtr(), bytes).result, '4 empty v::w 1 3 1;x;true;2.5 b||c');
+  });
+
+  it('Presizes and clears tables', (t) => {
+    requireFeature(readResult(getBufferPtr(), compute('return table.new ~= nil')).result === true, 'table.new');
+    const bytes = compute(`
+      local t = table.new(100, 4)
+      local empty = next(t) == nil
+      for i = 1, 100 do t[i] = i end
+      t.name = "x"
+      table.clear(t)
+      local cleared = next(t) == nil and #t == 0
+      for i = 1, 10 do t[i] = i * 2 end
+      local shaped = { x = 1, y = 2 }
+      table.clear(shaped)
+      shaped.y = 3
+      return table.concat({ tostring(empty), tostring(cleared), #t, t[10], tostring(shaped.x), shaped.y }, " ")
+    `);
+    assert.strictEqual(readResult(getBufferPtr(), bytes).result, 'true true 10 20 nil 3');
+  });
+
+  it('Reports where the last error was raised, with a traceback on request', () => {
+    requireFeature(hasExport('get_last_error_frame'), 'error frames');
+    const unit = getInstance();
+    assert.ok(compute('local function check(x)\n  if not x then error("missing") end\nend\ncheck(nil)') < 0);
+    let frame = unit.getLastError();
+    assert.strictEqual(frame.code, -2);
+    assert.strictEqual(frame.line, 2);
+    assert.match(frame.message, /missing$/);
+    assert.strictEqual(frame.traceback, '');
+
+    // Errors the script catches leave nothing behind
+    compute('return pcall(error, "caught")');
+    assert.strictEqual(unit.getLastError(), null);
+
+    assert.ok(compute('return 1 +') < 0);
+    frame = unit.getLastError();
+    assert.strictEqual(frame.code, -1);
+    assert.strictEqual(frame.line, 1);
+
+    unit.setErrorTraceback(true);
+    try {
+      assert.ok(compute('local function inner() return nil + 1 end\nlocal function outer() return inner() end\nouter()') < 0);
+      frame = unit.getLastError();
+      assert.strictEqual(frame.line, 1);
+      assert.match(frame.traceback, /^stack traceback:/);
+      assert.match(frame.traceback, /in (local|upvalue|function) 'outer'/);
+    } finally {
+      unit.setErrorTraceback(false);
+    }
+  });
+  it('Stops a running compute when the interrupt word is set', () => {
+    requireFeature(hasExport('get_interrupt_flag_ptr'), 'interrupt word');
+    const unit = getInstance();
+    unit.setOutputStreaming(() => unit.interrupt(), { chunkBytes: 1 });
+    try {
+      // A pcall in the script sees the error but cannot carry on
+      const status = compute('print("stop") local caught = not pcall(function() while true do end end) while true do end');
+      assert.ok(status < 0);
+      assert.strictEqual(unit.getLastErrorCode(), -6);
+      assert.ok(compute('local function f(n) if n > 0 then return f(n - 1) end end print("x") f(1e9)') < 0);
+      assert.strictEqual(unit.getLastErrorCode(), -6);
+    } finally {
+      unit.setOutputStreaming(null);
+    }
+    // The word was cleared as the interrupted call returned
+    assert.strictEqual(readResult(getBufferPtr(), compute('local n = 0 for i = 1, 1000 do n = n + i end return n')).result, 500500);
+  });
+
+  it('Compiles a numeric function to wasm for the tier', async () => {
+    const { compileProto } = await import('../web/cu-tier.js');
+    // A wasm32 layout: Proto fields at 0..20, 16-byte stack slots and
+    // TValues with the tag at 8, integer tag 3 and float tag 19
+    const layout = new Int32Array(16);
+    layout.set([0, 0, 1, 2, 4, 8, 12, 16, 20, 16, 16, 8, 8, 8, 3, 19]);
+    const memory = new WebAssembly.Memory({ initial: 1 });
+    const view = new DataView(memory.buffer);
+    const proto = 1024;
+    const func = 2048;
+    view.setInt32(proto + 20, 77, true);
+    // local function sum(n) local s = 0 for i = 1, n do s = s + i end return s end
+    const code = Uint32Array.from([
+      0x7fff8081, 0x80000101, 0x00000180, 0x80000201, 0x0001014a,
+      0x050100a2, 0x060500ae, 0x00018149, 0x000200c8, 0x00010147,
+    ]);
+    const bytes = compileProto({ numparams: 1, isVararg: false, maxstack: 6, code, k: [] }, [1],
+      { layout, proto, stamp: 77 });
+    const { f } = new WebAssembly.Instance(new WebAssembly.Module(bytes), { env: { memory } }).exports;
+
+    const callWith = (n) => {
+      if (typeof n === 'bigint') {
+        view.setBigInt64(func + 16, n, true);
+        view.setUint8(func + 24, 3);
+      } else {
+        view.setFloat64(func + 16, n, true);
+        view.setUint8(func + 24, 19);
+      }
+      return f(proto, func, 1);
+    };
+    assert.strictEqual(callWith(100000n), 1);
+    assert.strictEqual(view.getBigInt64(func, true), 5000050000n);
+    assert.strictEqual(view.getUint8(func + 8), 3);
+    assert.strictEqual(callWith(-5n), 1);
+    assert.strictEqual(view.getBigInt64(func, true), 0n);
+    // A float argument goes back to the interpreter, and so does another
+    // prototype or a stale stamp
+    assert.strictEqual(callWith(2.5), -1);
+    assert.strictEqual(f(proto, func, 0), -1);
+    assert.strictEqual(f(proto + 4, func, 1), -2);
+    view.setInt32(proto + 20, 78, true);
+    assert.strictEqual(callWith(10n), -2);
+
+    // Tables, calls and the like are declined
+    const getField = Uint32Array.from([0x0001000e, 0x00020048]);
+    assert.throws(() => compileProto({ numparams: 1, isVararg: false, maxstack: 2, code: getField, k: [null] }, [1],
+      { layout, proto, stamp: 77 }));
+
+    const unit = getInstance();
+    if (!hasExport('set_tier_threshold')) {
+      assert.strictEqual(unit.setTiering({ threshold: 10 }), false);
+      assert.strictEqual(unit.getTieringStats(), null);
+    }
+  });
+
 });
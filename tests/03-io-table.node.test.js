@@ -1,6 +1,6 @@
 const { describe, it, beforeEach } = require('node:test');
 const assert = require('node:assert');
-const { loadWasm, init, compute, getBufferPtr, readResult, setInput, getOutput, setMetadata, clearIo, reset } = require('./node-test-utils');
+const { loadWasm, init, compute, hasExport, hasImport, getInstance, getBufferPtr, readResult, setInput, getOutput, setMetadata, clearIo, reset, requireFeature } = require('./node-test-utils');
 
 describe('_io Table API', () => {
   beforeEach(async () => {
@@ -31,6 +31,57 @@ describe('_io Table API', () => {
     assert.strictEqual(output, 42);
   });
 
+  it('Reads output lazily through a view of its tables', () => {
+    compute(`
+      local rows = {}
+      for i = 1, 50 do rows[i] = { id = i, name = "row" .. i } end
+      _io.output = { status = "ok", rows = rows, meta = { count = 50 } }
+    `);
+    const output = getOutput({ lazy: true });
+    assert.strictEqual(output.status, 'ok');
+    assert.ok(Array.isArray(output.rows));
+    assert.strictEqual(output.rows.length, 50);
+    assert.strictEqual(output.rows[9].name, 'row10');
+    assert.strictEqual(output.rows[9], output.rows[9], 'fields are decoded once');
+    assert.strictEqual(output.rows[50], undefined);
+    assert.deepStrictEqual(output.rows.slice(0, 2).map((row) => row.id), [1, 2]);
+    assert.deepStrictEqual(Object.keys(output).sort(), ['meta', 'rows', 'status']);
+    assert.deepStrictEqual(JSON.parse(JSON.stringify(output)), getOutput());
+    assert.throws(() => { 'use strict'; output.status = 'changed'; }, TypeError);
+  });
+
+  it('Sends input as one frame of inline tables', async () => {
+    const { decodeValue } = await import('../web/cu-values.js');
+    const input = { user: { name: 'Alice', tags: ['a', 'b'] }, rows: [{ id: 1 }, { id: 2 }], '7': 'seven' };
+    const frame = getInstance().serializeFrame(input);
+    const decoded = decodeValue(frame, 0, frame.length);
+    assert.strictEqual(decoded.bytesRead, frame.length);
+    const keys = decoded.entries.map(([key]) => key);
+    assert.deepStrictEqual(keys.sort(), [7, 'rows', 'user'].sort(), 'integer keys are sent as integers');
+
+    let deep = 1;
+    for (let i = 0; i < 40; i++) deep = [deep];
+    assert.throws(() => getInstance().serializeFrame(deep), /too deeply/);
+
+    const tables = getInstance().externalTables.size;
+    setInput(input, { frame: true });
+    if (!hasExport('set_inline_table_limits')) {
+      // Older builds cannot read inline tables and get external tables
+      assert.ok(getInstance().externalTables.size > tables);
+    } else {
+      assert.strictEqual(getInstance().externalTables.size, tables, 'no table per object');
+    }
+    const bytes = compute(`
+      local input = _io.input
+      return input.user.name .. #input.user.tags .. input.rows[2].id .. input[7]
+    `);
+    assert.strictEqual(readResult(getBufferPtr(), bytes).result, 'Alice22seven');
+
+    // Too deep for a frame: sent as external tables instead
+    setInput({ deep }, { frame: true });
+    clearIo();
+  });
+
   it('Can set metadata and use it in Lua', () => {
     setMetadata({
       version: '1.0',
@@ -82,6 +133,77 @@ describe('_io Table API', () => {
     assert.strictEqual(result.result, 'Bob from NYC');
   });
 
+  it('Can pass typed arrays through _io.input', () => {
+    requireFeature(hasExport('get_typed_array_kinds'), 'get_typed_array_kinds export');
+    const samples = new Float64Array(4096).map((_, i) => i / 2);
+    setInput({ samples, ids: new BigInt64Array([7n, -9n]) });
+
+    const bytes = compute(`
+      local samples = _io.input.samples
+      local sum = 0
+      for i = 1, #samples do sum = sum + samples[i] end
+      _io.output = _io.input.samples
+      return sum .. ":" .. _io.input.ids[2] .. ":" .. tostring(samples[#samples + 1])
+    `);
+
+    assert.strictEqual(readResult(getBufferPtr(), bytes).result, '4193280.0:-9:nil');
+    assert.deepStrictEqual(getOutput(), samples);
+  });
+
+  it('Runs vec kernels over typed arrays from _io.input', () => {
+    requireFeature(readResult(getBufferPtr(), compute('return package.preload.vec ~= nil')).result === true, 'vec library');
+    const prices = new Float64Array(1001).map((_, i) => 100 + Math.sin(i) * 10);
+    setInput({ prices, qty: new BigInt64Array([3n, 1n, 4n, 1n, 5n]) });
+
+    const bytes = compute(`
+      local vec = require('vec')
+      local prices, qty = _io.input.prices, _io.input.qty
+      local lo, at = vec.min(prices)
+      local sorted = vec.sort(vec.slice(qty))
+      _io.output = {
+        sum = vec.sum(prices),
+        lo = lo, at = at,
+        dot = vec.dot(qty, qty),
+        avg = vec.movavg(prices, 10),
+        scaled = vec.mul(prices, 2),
+        sorted = vec.totable(sorted),
+        running = vec.totable(vec.cumsum(qty)),
+      }
+      return vec.kind(qty) .. ":" .. #vec.new(3) .. ":" .. vec.mean(vec.from({ 1, 2, 3, 4 }))
+    `);
+    assert.strictEqual(readResult(getBufferPtr(), bytes).result, 'i64:3:2.5');
+
+    const output = getOutput();
+    const sum = prices.reduce((a, b) => a + b, 0);
+    assert.ok(Math.abs(output.sum - sum) < 1e-9);
+    const lo = Math.min(...prices);
+    assert.strictEqual(output.lo, lo);
+    assert.strictEqual(output.at, prices.indexOf(lo) + 1);
+    assert.strictEqual(output.dot, 52);
+    assert.ok(output.avg instanceof Float64Array);
+    assert.strictEqual(output.avg.length, 992);
+    assert.ok(Math.abs(output.avg[0] - prices.subarray(0, 10).reduce((a, b) => a + b, 0) / 10) < 1e-9);
+    assert.deepStrictEqual(output.scaled, prices.map((x) => x * 2));
+    assert.deepStrictEqual(output.sorted, [1, 1, 3, 4, 5]);
+    assert.deepStrictEqual(output.running, [3, 4, 8, 9, 14]);
+  });
+
+  it('Can pass binary blobs through _io.input', () => {
+    requireFeature(hasImport('js_blob_read'), 'blobs');
+    const file = new Uint8Array(100000).map((_, i) => i % 251).buffer;
+    setInput({ file });
+
+    let bytes = compute(`
+      local file = _io.input.file
+      _home.file = file
+      return #file .. ":" .. file:byte(2) .. ":" .. #file:sub(-10) .. ":" .. file:sub(3, 4):byte(2)
+    `);
+    assert.strictEqual(readResult(getBufferPtr(), bytes).result, '100000:1:10:3');
+
+    bytes = compute('return _home.file:len() .. ":" .. _home.file:byte(252)');
+    assert.strictEqual(readResult(getBufferPtr(), bytes).result, '100000:0');
+  });
+
   it('clearIo removes input and meta', () => {
     setInput({ test: 'input' });
     setMetadata({ test: 'meta' });
@@ -161,4 +283,136 @@ describe('_io Table API', () => {
     const result = readResult(getBufferPtr(), bytes);
     assert.strictEqual(result.result, 0);
   });
+
+  it('Native table backend stays in sync with the host', async () => {
+    requireFeature(hasExport('set_ext_table_backend'), 'native external table backend');
+    const instance = await loadWasm();
+    init();
+    assert.strictEqual(instance.exports.set_ext_table_backend(1, 0), 0);
+
+    setInput({ n: 3 });
+    compute('_io.output = _io.input.n * 2');
+    assert.strictEqual(getOutput(), 6);
+
+    // Host writes between calls must not be shadowed by cached entries
+    setInput({ n: 5 });
+    const bytes = compute(`
+      local sum = 0
+      for i = 1, 100 do sum = sum + _io.input.n end
+      _io.output = sum
+      return sum
+    `);
+    assert.strictEqual(readResult(getBufferPtr(), bytes).result, 500);
+    assert.strictEqual(getOutput(), 500);
+    assert.ok(instance.exports.get_ext_store_hits() >= 99);
+  });
+
+  it('Integer keys round-trip as an array', () => {
+    const bytes = compute(`
+      _io.output = {}
+      for i = 1, 50 do _io.output[i] = i * i end
+      return _io.output["7"] .. ":" .. #_io.output
+    `);
+    assert.strictEqual(readResult(getBufferPtr(), bytes).result, '49:50');
+    assert.deepStrictEqual(getOutput(), Array.from({ length: 50 }, (_, i) => (i + 1) * (i + 1)));
+  });
+
+  it('Reuses _io.input tables across requests', () => {
+    const instance = getInstance();
+    const request = (i) => ({ user: { id: i, tags: ['a', 'b'] }, items: [{ n: i }, { n: i + 1 }] });
+    setInput(request(0));
+    compute('return _io.input.user.id');
+    clearIo();
+    const { nextTableId } = instance;
+    const tables = instance.externalTables.size;
+
+    for (let i = 1; i <= 50; i++) {
+      setInput(request(i));
+      const bytes = compute('return _io.input.user.id + _io.input.items[2].n');
+      assert.strictEqual(readResult(getBufferPtr(), bytes).result, 2 * i + 1);
+      clearIo();
+    }
+    assert.strictEqual(instance.nextTableId, nextTableId);
+    assert.strictEqual(instance.externalTables.size, tables);
+  });
+
+  it('Keeps _io.input tables that Lua stores elsewhere', () => {
+    setInput({ user: { name: 'Alice', address: { city: 'Paris' } } });
+    compute('_home.kept = _io.input.user');
+    clearIo();
+    setInput({ user: { name: 'Bob', address: { city: 'Rome' } } });
+    const bytes = compute('return _home.kept.name .. " " .. _home.kept.address.city .. " " .. _io.input.user.name');
+    assert.strictEqual(readResult(getBufferPtr(), bytes).result, 'Alice Paris Bob');
+  });
+
+  it('processStream() batches items and refills the same tables', async () => {
+    const { IoWrapper } = await import('../web/io-wrapper.js');
+    const instance = getInstance();
+    const io = new IoWrapper(instance);
+    const code = `
+      local sum = 0
+      for _, item in ipairs(_io.input.batch) do sum = sum + item.n end
+      _io.output = { index = _io.input.batchIndex, sum = sum, more = _io.input.hasMore }
+    `;
+    const records = Array.from({ length: 25 }, (_, i) => ({ n: i + 1 }));
+
+    const first = await io.processStream(code, records.slice(0, 10), { batchSize: 10 });
+    assert.deepStrictEqual(first, [{ index: 0, sum: 55, more: false }]);
+    const nextTableId = instance.nextTableId;
+
+    // Another 25 records: the input tables come from one batch's worth of slots
+    async function* generate() {
+      yield* records;
+    }
+    const outputs = await io.processStream(code, generate(), { batchSize: 10 });
+    assert.deepStrictEqual(outputs.map((output) => output.sum), [55, 155, 115]);
+    assert.deepStrictEqual(outputs.map((output) => output.more), [true, true, false]);
+    // 12 input tables for the largest batch, and the 3 output tables Lua made
+    assert.ok(instance.nextTableId - nextTableId <= 15, `${instance.nextTableId - nextTableId} new table IDs`);
+  });
+
+  it('processStream() pulls no faster than the sink consumes', async () => {
+    const { IoWrapper } = await import('../web/io-wrapper.js');
+    const io = new IoWrapper(getInstance());
+    let pulled = 0;
+    const source = new ReadableStream({
+      pull(controller) {
+        if (pulled === 40) {
+          controller.close();
+          return;
+        }
+        controller.enqueue(++pulled);
+      }
+    }, { highWaterMark: 0 });
+
+    const received = [];
+    let release = null;
+    const sink = new WritableStream({
+      write(output) {
+        received.push(output);
+        // Each write waits until the test lets it finish
+        return new Promise((resolve) => { release = resolve; });
+      }
+    }, { highWaterMark: 1 });
+
+    const done = io.processStream('_io.output = #_io.input.batch', source, { batchSize: 4, sink });
+    for (let i = 0; i < 10; i++) {
+      await new Promise((resolve) => setTimeout(resolve, 5));
+      // One batch in the sink and one queued, plus the item looked ahead
+      assert.ok(pulled <= (received.length + 2) * 4 + 1, `pulled ${pulled} with ${received.length} received`);
+      release?.();
+    }
+    assert.deepStrictEqual(await done, { batches: 10, items: 40 });
+    assert.deepStrictEqual(received, Array(10).fill(4));
+  });
+
+  it('processStream() stops on a Lua error', async () => {
+    requireFeature(hasExport('call'), 'Recovering from Lua errors');
+    const { IoWrapper } = await import('../web/io-wrapper.js');
+    const io = new IoWrapper(getInstance());
+    await assert.rejects(
+      io.processStream("if _io.input.batchIndex == 1 then error('bad batch') end", [1, 2, 3], { batchSize: 1 }),
+      /bad batch/
+    );
+  });
 });
@@ -164,4 +164,33 @@ test.describe('_home Table Persistence', () => {
       await window.cu.clearPersistedState();
     });
   });
+
+  test('Per-entry IndexedDB storage writes and restores single keys', async ({ page }) => {
+    const result = await page.evaluate(async () => {
+      const { CuInstance } = await import('./cu-instance.js');
+      const { StoragePersistence, IndexedDbStorage } = await import('./cu-storage.js');
+      const storage = new IndexedDbStorage('entry-test');
+      await storage.clear();
+
+      const a = await CuInstance.create({ persistence: new StoragePersistence(storage), autoRestore: false });
+      a.init();
+      a.compute('for i = 1, 100 do _home["k" .. i] = i end');
+      await a.saveState();
+      a.enableJournal({ compactEvery: 1000 });
+      a.compute('_home.k50 = "changed"; _home.k1 = nil');
+      await a.flushJournal();
+
+      const homeId = a.homeTableId;
+      const single = await storage.getEntry(homeId, 'k50');
+      const b = await CuInstance.create({ persistence: new StoragePersistence(storage) });
+      b.init();
+      const len = b.compute('return tostring(_home.k50) .. tostring(_home.k1) .. _home.k100');
+      const restored = b.readResult(b.getBufferPtr(), len).result;
+      await storage.clear();
+      return { single: single !== undefined, restored };
+    });
+
+    expect(result.single).toBe(true);
+    expect(result.restored).toBe('changednil100');
+  });
 });
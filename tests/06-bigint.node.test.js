@@ -14,7 +14,7 @@
 
 const { describe, it, beforeEach } = require('node:test');
 const assert = require('node:assert');
-const { loadWasm, init, compute, getBufferPtr, readResult, reset } = require('./node-test-utils');
+const { loadWasm, init, compute, getBufferPtr, readResult, reset, setInput, getOutput, requireFeature } = require('./node-test-utils');
 
 describe('BigInt Module', () => {
   beforeEach(async () => {
@@ -413,4 +413,70 @@ describe('BigInt Module', () => {
     assert.strictEqual(result.result, '800', 
       'Should handle complex expressions correctly');
   });
+
+  it('Accumulates in place and mixes bigints with integers', () => {
+    const probe = compute(`return type(require('bigint').sum)`);
+    requireFeature(readResult(getBufferPtr(), probe).result === 'function', 'in-place bigint arithmetic');
+    const bytes = compute(`
+      local bigint = require('bigint')
+      local wei = bigint.new("1000000000000000000")
+      local total = bigint.new(0)
+      for i = 1, 1000 do total:addInPlace(wei):subInPlace(i) end
+      local list = {}
+      for i = 1, 100 do list[i] = i % 2 == 0 and bigint.new(i) or i end
+      return table.concat({
+        tostring(total), tostring(bigint.sum(list)),
+        tostring(wei * 3 + 1), tostring(10 - bigint.new(4)), tostring(wei / 1000000),
+        tostring(wei > 5), tostring(5 < wei), tostring(bigint.new(-3) <= -3),
+      }, "|")
+    `);
+    const result = readResult(getBufferPtr(), bytes);
+    assert.strictEqual(result.result, [
+      '999999999999999499500', '5050', '3000000000000000001', '6', '1000000000000',
+      'true', 'true', 'true',
+    ].join('|'));
+  });
+
+  it('Stores bigints without converting them to strings', () => {
+    const probe = compute(`return package.preload.decimal ~= nil`);
+    requireFeature(readResult(getBufferPtr(), probe).result === true, 'bigint values');
+    setInput({ big: -(2n ** 100n), small: 7n });
+    compute(`
+      _home.big = _io.input.big * 3
+      _home.zero = require('bigint').new(0)
+      _io.output = { big = _io.input.big, small = _io.input.small + 1 }
+    `);
+    const text = compute(`return tostring(_home.big) .. "|" .. tostring(_home.zero)`);
+    assert.strictEqual(readResult(getBufferPtr(), text).result, '-3802951800684688204490109616128|0');
+    const value = compute(`return _home.big`);
+    assert.strictEqual(readResult(getBufferPtr(), value).result, -3802951800684688204490109616128n);
+    assert.deepStrictEqual(getOutput(), { big: -(2n ** 100n), small: 8n });
+  });
+
+  it('Computes modular powers, inverses and bitwise operations natively', () => {
+    const probe = compute(`return type(require('bigint').powmod)`);
+    requireFeature(readResult(getBufferPtr(), probe).result === 'function', 'bigint number theory');
+    const bytes = compute(`
+      local bigint = require('bigint')
+      local p = (bigint.new(1) << 255) - 19
+      local b = bigint.new("1234567890abcdef1234567890abcdef", 16)
+      local inv = b:modinv(p)
+      local x = bigint.new(-1) << 100 | 12345
+      return table.concat({
+        tostring(b:powmod(p - 2, p)), tostring(inv == b:powmod(p - 2, p)), tostring(b * inv % p),
+        tostring(bigint.powmod(7, bigint.new("1" .. string.rep("0", 30)), bigint.new(1) << 200)),
+        tostring(bigint.new(6):modinv(9)),
+        tostring(bigint.gcd(bigint.new(2) << 99, bigint.new(3) << 60)),
+        tostring(x & 0xffff), tostring(~x), tostring(x << 7), tostring(x >> 33),
+      }, "|")
+    `);
+    const result = readResult(getBufferPtr(), bytes);
+    assert.strictEqual(result.result, [
+      '19011962011718507546058844909666535317772701973552577822071300340379894116784', 'true', '1',
+      '326029821314112221588723034860097473743894310866730390388737',
+      'nil',
+      '1152921504606846976',
+      '12345', '1267650600228229401496703193030', '-162259276829213363391578008707968', '-147573952589676412928',
+    ].join('|'));
+  });
 });
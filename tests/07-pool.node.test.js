@@ -0,0 +1,119 @@
+const { describe, it, before, after } = require('node:test');
+const assert = require('node:assert');
+const fs = require('fs');
+const path = require('path');
+
+describe('CuPool', () => {
+  let pool;
+
+  before(async () => {
+    const { CuPool } = await import('../web/cu-pool.js');
+    pool = await CuPool.create({ wasmPath: path.join(__dirname, '../web/cu.wasm'), size: 2 });
+  });
+
+  after(async () => {
+    await pool.close();
+  });
+
+  it('Keeps a separate _home per unit', async () => {
+    const units = ['a', 'b', 'c', 'd', 'a', 'b'];
+    const results = await Promise.all(units.map((unit) =>
+      pool.compute(unit, `_home.n = (_home.n or 0) + 1; return "${unit}" .. _home.n`)
+    ));
+    assert.deepStrictEqual(results.map((r) => r.result), ['a1', 'b1', 'c1', 'd1', 'a2', 'b2']);
+  });
+
+  it('Routes a unit to one worker and reports queue stats', async () => {
+    assert.strictEqual(pool.workerFor('unit-7'), pool.workerFor('unit-7'));
+    await pool.compute('unit-7', 'return 1');
+
+    const stats = pool.stats();
+    assert.strictEqual(stats.queueDepth, 0);
+    assert.strictEqual(stats.workers.length, 2);
+    assert.strictEqual(stats.workers.reduce((sum, w) => sum + w.completed, 0), 7);
+    assert.ok(stats.workers.every((w) => w.meanLatencyMs >= 0));
+  });
+
+  it('Maps a Lua function over items in batches, in order', async () => {
+    const items = Array.from({ length: 10 }, (_, i) => i + 1);
+    const squares = await pool.parallelMap('return function(x) return x * x end', items, { batchSize: 3 });
+    assert.deepStrictEqual(squares, items.map((x) => x * x));
+
+    const odd = await pool.parallelMap('return function(x) if x % 2 == 1 then return { n = x } end end', items);
+    assert.deepStrictEqual(odd, items.map((x) => (x % 2 === 1 ? { n: x } : null)));
+
+    await assert.rejects(pool.parallelMap('return function(x) error("bad " .. x, 0) end', [7]));
+    assert.strictEqual(pool.stats().queueDepth, 0);
+  });
+
+  it('Moves a unit to another worker while it keeps serving', async () => {
+    await pool.compute('mover', `
+      _home.n = 0
+      _home.items = { { id = 1 }, { id = 2 } }
+      _home.meta = { owner = "a", tags = { "x" } }
+    `);
+    const from = pool.workers.indexOf(pool.workerFor('mover'));
+    const to = 1 - from;
+    const bump = () => pool.compute('mover', '_home.n = _home.n + 1; return _home.n');
+
+    // Requests sent before, during and after the move run in order
+    const before = [bump(), bump()];
+    const moving = pool.migrate('mover', to);
+    const during = [bump(), pool.compute('mover', '_home.items[3] = { id = 3 }; return #_home.items'), bump()];
+    const { tables, delta } = await moving;
+    const results = await Promise.all([...before, ...during]);
+    assert.deepStrictEqual(results.map((r) => r.result), [1, 2, 3, 3, 4]);
+    assert.strictEqual(pool.workerFor('mover'), pool.workers[to]);
+    assert.ok(tables >= 5, `${tables} tables copied`);
+    assert.ok(delta >= 1 && delta < tables, `${delta} tables copied at the cut-over`);
+
+    const { result } = await pool.compute('mover', `
+      return _home.n .. _home.meta.owner .. _home.meta.tags[1] .. _home.items[3].id .. #_home.items
+    `);
+    assert.strictEqual(result, '4ax33');
+  });
+});
+
+describe('Shared snapshots', () => {
+  it('Reads packed tables in place under a per-worker overlay', async () => {
+    const { ExtTable } = await import('../web/cu-ext-table.js');
+    const { packSnapshot, SharedSnapshot, OverlayTable } = await import('../web/cu-shared-snapshot.js');
+    const { encodeValue } = await import('../web/cu-values.js');
+    const table = new ExtTable();
+    table.set(1, encodeValue('one', false));
+    table.set('code', encodeValue('x', false));
+    const snapshot = new SharedSnapshot(packSnapshot(new Map([[3, table]]), { homeTableId: 3, nextTableId: 4 }));
+    assert.strictEqual(snapshot.homeTableId, 3);
+    assert.deepStrictEqual(snapshot.table(3).get('1'), table.get(1));
+
+    const overlay = new OverlayTable(snapshot.table(3));
+    overlay.set('code', encodeValue('y', false));
+    overlay.set('extra', encodeValue(true, false));
+    overlay.delete(1);
+    assert.strictEqual(overlay.size, 2);
+    assert.deepStrictEqual([...overlay.keys()].sort(), ['code', 'extra']);
+    assert.deepStrictEqual(overlay.get('code'), encodeValue('y', false));
+    assert.deepStrictEqual(snapshot.table(3).get('code'), encodeValue('x', false), 'the packed table never changes');
+    overlay.set(1, encodeValue('uno', false));
+    assert.strictEqual(overlay.size, 3);
+  });
+
+  it('Starts every unit of a pool from the shared _home', async () => {
+    const { CuInstance } = await import('../web/cu-instance.js');
+    const { CuPool } = await import('../web/cu-pool.js');
+    const module = await WebAssembly.compile(fs.readFileSync(path.join(__dirname, '../web/cu.wasm')));
+    const source = await CuInstance.create({ module, autoRestore: false });
+    source.init();
+    source.compute('_home.rates = { eur = 2, usd = 3 }; _home.name = "ref"');
+
+    const pool = await CuPool.create({ module, size: 2, snapshot: source.shareState() });
+    try {
+      const first = await pool.compute('a', '_home.rates.eur = 5; _home.name = "mine"; return _home.name .. _home.rates.usd');
+      assert.strictEqual(first.result, 'mine3');
+      const other = await pool.compute('b', 'return _home.name');
+      assert.strictEqual(other.result, 'ref', "a unit's own writes stay in its _home");
+    } finally {
+      await pool.close();
+    }
+  });
+});
@@ -0,0 +1,727 @@
+const { describe, it, before } = require('node:test');
+const assert = require('node:assert');
+const fs = require('fs');
+const path = require('path');
+const { requireFeature } = require('./node-test-utils');
+
+describe('CuInstance', () => {
+  let CuInstance;
+  let module;
+
+  before(async () => {
+    ({ CuInstance } = await import('../web/cu-instance.js'));
+    module = await WebAssembly.compile(fs.readFileSync(path.join(__dirname, '../web/cu.wasm')));
+  });
+
+  function run(instance, code) {
+    const len = instance.compute(code);
+    if (len < 0) assert.fail(instance.readBuffer(instance.getBufferPtr(), -len));
+    return instance.readResult(instance.getBufferPtr(), len).result;
+  }
+
+  it('Keeps two instances on one thread apart', async () => {
+    const a = await CuInstance.create({ module, autoRestore: false });
+    const b = await CuInstance.create({ module, autoRestore: false });
+    a.init();
+    b.init();
+
+    run(a, 'counter = 10; _home.name = "a"');
+    run(b, '_home.name = "b"');
+
+    assert.strictEqual(run(a, 'return tostring(counter) .. _home.name'), '10a');
+    assert.strictEqual(run(b, 'return tostring(counter) .. _home.name'), 'nilb');
+    assert.notStrictEqual(a.externalTables, b.externalTables);
+    assert.notStrictEqual(a.wasmInstance.exports.memory, b.wasmInstance.exports.memory);
+  });
+
+  it('Starts forks from a snapshot without running init', async () => {
+    const base = await CuInstance.create({ module, autoRestore: false });
+    base.init();
+    run(base, 'function greet(name) return prefix .. name end; prefix = "hi "; _home.boots = 1');
+    const snapshot = base.snapshot();
+
+    const a = CuInstance.fromSnapshot(snapshot);
+    const b = CuInstance.fromSnapshot(snapshot);
+    run(a, 'prefix = "yo "; _home.boots = _home.boots + 1');
+
+    assert.strictEqual(run(a, 'return greet("a") .. _home.boots'), 'yo a2');
+    assert.strictEqual(run(b, 'return greet("b") .. _home.boots'), 'hi b1');
+    assert.strictEqual(run(base, 'return greet("base") .. _home.boots'), 'hi base1');
+  });
+
+  it('Restores the whole VM from a checkpoint', async () => {
+    const base = await CuInstance.create({ module, autoRestore: false });
+    base.init();
+    run(base, `
+      local count = 0
+      function bump() count = count + 1; return count end
+      queue = setmetatable({ 10, 20 }, { __index = function(_, k) return k * 100 end })
+      _home.name = "unit"
+    `);
+    const bytes = await base.checkpoint();
+    assert.ok(bytes.length < base.snapshot().image.bytes.length);
+
+    const copy = await CuInstance.fromCheckpoint(bytes, module);
+    assert.strictEqual(run(copy, 'bump(); return bump() .. queue[2] .. queue[3] .. _home.name'), '220300unit');
+    assert.strictEqual(run(base, 'return bump() .. queue[1]'), '110');
+
+    await assert.rejects(CuInstance.fromCheckpoint(bytes.subarray(0, 40), module));
+  });
+
+  it('Ships delta checkpoints to a standby', async () => {
+    const primary = await CuInstance.create({ module, autoRestore: false });
+    primary.init();
+    run(primary, 'log = {}; for i = 1, 2000 do log[i] = "entry " .. i end');
+    const full = await primary.checkpoint();
+    const standby = await CuInstance.fromCheckpoint(full, module);
+
+    run(primary, 'log[#log + 1] = "late"; _home.seen = #log');
+    const delta = await primary.checkpoint({ delta: true });
+    assert.ok(delta.length < full.length);
+    run(primary, 'log[#log + 1] = "later"');
+    const next = await primary.checkpoint({ delta: true });
+
+    await assert.rejects(standby.restoreCheckpoint(next), /does not follow/);
+    await standby.restoreCheckpoint(delta);
+    await standby.restoreCheckpoint(next);
+    assert.strictEqual(run(standby, 'return log[#log] .. " " .. log[2001] .. " " .. _home.seen'), 'later late 2001');
+  });
+
+  it('Skips init() for a pre-initialized module', async () => {
+    const { preinitialize } = require('../scripts/preinit-wasm.js');
+    const bytes = await preinitialize(fs.readFileSync(path.join(__dirname, '../web/cu.wasm')), {
+      bootstrap: 'greeting = "hello "; _home.count = 1',
+    });
+    const preinit = await WebAssembly.compile(bytes);
+
+    const a = await CuInstance.create({ module: preinit, autoRestore: false });
+    const b = await CuInstance.create({ module: preinit, autoRestore: false });
+    assert.strictEqual(a.preinitialized, true);
+    assert.strictEqual(a.init(), 0);
+    b.init();
+
+    run(a, '_home.count = _home.count + 1');
+    assert.strictEqual(run(a, 'return greeting .. _home.count'), 'hello 2');
+    assert.strictEqual(run(b, 'return greeting .. _home.count'), 'hello 1');
+  });
+
+  it('Converts i64 offsets at the boundary of a wasm64 build', async () => {
+    const { addAbiSection } = require('../scripts/wasm-abi.js');
+    const { memory64Abi, adaptImports, adaptExports } = await import('../web/cu-memory64.js');
+    // (import "env" "f" (func (param i64) (result i64)))
+    // (func (export "g") (param i64 i32) (result i64)
+    //   (i64.add (call 0 (local.get 0)) (i64.extend_i32_u (local.get 1))))
+    const bytes = Buffer.from([
+      0x00, 0x61, 0x73, 0x6d, 1, 0, 0, 0,
+      1, 12, 2, 0x60, 1, 0x7e, 1, 0x7e, 0x60, 2, 0x7e, 0x7f, 1, 0x7e,
+      2, 9, 1, 3, 0x65, 0x6e, 0x76, 1, 0x66, 0, 0,
+      3, 2, 1, 1,
+      7, 5, 1, 1, 0x67, 0, 1,
+      10, 12, 1, 10, 0, 0x20, 0, 0x10, 0, 0x20, 1, 0xad, 0x7c, 0x0b,
+    ]);
+    const module = await WebAssembly.compile(addAbiSection(bytes));
+    const abi = memory64Abi(module);
+    assert.deepStrictEqual(abi.exports.g, { params: [0], result: true });
+    assert.strictEqual(memory64Abi(await WebAssembly.compile(fs.readFileSync(path.join(__dirname, '../web/cu.wasm')))), null);
+
+    const seen = [];
+    const instance = new WebAssembly.Instance(module, adaptImports({ env: { f: (x) => { seen.push(x); return x * 2; } } }, abi));
+    const exports = adaptExports(instance.exports, abi);
+    assert.strictEqual(exports.g(2 ** 40, 3), 2 ** 41 + 3);
+    assert.deepStrictEqual(seen, [2 ** 40]);
+  });
+
+  it('Compiles a module once per path across loads', async () => {
+    const wasmPath = path.join(__dirname, '../web/cu.wasm');
+    const a = await CuInstance.create({ wasmPath, autoRestore: false });
+    const b = await CuInstance.create({ wasmPath, autoRestore: false });
+    const c = await CuInstance.create({ wasmPath, autoRestore: false, cacheModule: false });
+    assert.strictEqual(a.module, b.module);
+    assert.notStrictEqual(a.module, c.module);
+    b.init();
+    assert.strictEqual(run(b, 'return 6 * 7'), 42);
+  });
+
+  it('Gives each namespace its own persistence', () => {
+    const a = new CuInstance({ namespace: 'unit-a' });
+    const b = new CuInstance({ namespace: 'unit-b' });
+    const shared = new CuInstance();
+    assert.notStrictEqual(a.persistence, b.persistence);
+    assert.notStrictEqual(a.persistence.dbName, b.persistence.dbName);
+    assert.strictEqual(shared.persistence, new CuInstance().persistence);
+  });
+
+  it('Starts generational, tunes the collector and times its pauses', async () => {
+    requireFeature(WebAssembly.Module.exports(module).some((entry) => entry.name === 'get_gc_stats'), 'collector tuning');
+    const cu = await CuInstance.create({ module, autoRestore: false });
+    cu.init();
+    assert.strictEqual(run(cu, 'return collectgarbage("generational")'), 'generational');
+    assert.strictEqual(cu.setGcMode('incremental', { pause: 150, stepMul: 200 }), 'generational');
+    assert.strictEqual(cu.setGcMode('generational', { minorMul: 30 }), 'incremental');
+    assert.strictEqual(cu.setGcMode('collect'), null);
+
+    cu.getGcStats({ reset: true });
+    run(cu, 'local t for i = 1, 50000 do t = { i, { i } } end collectgarbage() return 1');
+    const stats = cu.getGcStats({ reset: true });
+    assert.ok(stats.pauses > 1);
+    assert.ok(stats.fullCollections >= 1);
+    assert.ok(stats.maxMs <= stats.totalMs);
+    assert.strictEqual(stats.histogram.reduce((sum, bucket) => sum + bucket.count, 0), stats.pauses);
+    assert.strictEqual(cu.getGcStats().pauses, 0);
+  });
+
+  it('Counts hot-path work', async () => {
+    requireFeature(WebAssembly.Module.exports(module).some((entry) => entry.name === 'get_perf_counters'), 'perf counters');
+    const cu = await CuInstance.create({ module, autoRestore: false });
+    cu.init();
+    cu.getPerfCounters({ reset: true });
+    run(cu, '_home.double = function(x) return x * 2 end _home.name = "cu" return 1');
+    run(cu, 'return _home.double(#_home.name)');
+    const counters = cu.getPerfCounters({ reset: true });
+    assert.strictEqual(counters.computeCalls, 2);
+    assert.strictEqual(counters.extSets, 2);
+    assert.strictEqual(counters.extGets, 2);
+    assert.ok(counters.extSetBytes > 0 && counters.extGetBytes > 0);
+    assert.strictEqual(counters.serializeCalls, 2);
+    assert.strictEqual(counters.functionLoads, 1);
+    assert.ok(counters.allocCalls > 0 && counters.allocBytes > 0);
+    assert.ok(counters.parseMs >= 0 && counters.executeMs >= 0 && counters.encodeMs >= 0);
+    for (const phase of ['parse', 'execute', 'encode', 'total']) {
+      const latency = counters.latency[phase];
+      assert.strictEqual(latency.count, 2);
+      assert.strictEqual(latency.buckets.reduce((sum, bucket) => sum + bucket.count, 0), 2);
+      assert.ok(latency.p50Us <= latency.p99Us);
+    }
+    assert.strictEqual(cu.getPerfCounters().computeCalls, 0);
+  });
+
+  it('Samples hot Lua functions into folded stacks', async () => {
+    requireFeature(WebAssembly.Module.exports(module).some((entry) => entry.name === 'profile_start'), 'profiler');
+    const cu = await CuInstance.create({ module, autoRestore: false });
+    cu.init();
+    assert.strictEqual(cu.startProfile({ period: 100 }), true);
+    run(cu, `
+      local function leaf(n) local s = 0 for i = 1, n do s = s + i end return s end
+      local function outer() local s = 0 for i = 1, 200 do s = s + leaf(500) end return s end
+      return outer()`);
+    const folded = cu.stopProfile();
+    const lines = folded.trim().split('\n');
+    assert.ok(lines.length > 0);
+    for (const line of lines) assert.match(line, / \d+$/);
+    assert.ok(lines.some((line) => /^main \(compute\);outer \(compute:\d+\);leaf \(compute:\d+\) \d+$/.test(line)));
+    // Read once; nothing is sampled while stopped
+    assert.strictEqual(cu.stopProfile(), '');
+  });
+
+  it('Traces external table calls by key', async () => {
+    const cu = await CuInstance.create({ module, autoRestore: false });
+    cu.init();
+    assert.strictEqual(cu.getBridgeTrace(), null);
+    run(cu, '_home.before = 1');
+
+    cu.startBridgeTrace({ capacity: 64 });
+    run(cu, `
+      _home.name = string.rep("x", 100)
+      for i = 1, 5 do local _ = _home.name end
+      _home.counter = 1
+      _home.before = nil`);
+    const summary = cu.getBridgeTrace({ top: 2, entries: true });
+    assert.strictEqual(summary.calls, summary.entries.length);
+    assert.strictEqual(summary.dropped, 0);
+    assert.strictEqual(summary.ops.get.count, 5);
+    assert.ok(summary.ops.set.count >= 3);
+    assert.strictEqual(summary.byCount[0].key, 'name');
+    assert.ok(summary.byCount.length <= 2);
+    assert.strictEqual(summary.byBytes[0].key, 'name');
+    assert.ok(summary.byBytes[0].bytes >= 100);
+    // The write before the trace started was not recorded
+    assert.strictEqual(summary.entries.filter((entry) => entry.key === 'before').length, 1);
+
+    const stopped = cu.stopBridgeTrace();
+    assert.strictEqual(stopped.calls, summary.calls);
+    run(cu, '_home.after = 1');
+    assert.strictEqual(cu.getBridgeTrace(), null);
+  });
+
+  it('Captures a workload and replays it on a fresh instance', async () => {
+    const { encodeCapture, decodeCapture, replayCapture } = await import('../web/cu-capture.js');
+    const cu = await CuInstance.create({ module, autoRestore: false });
+    cu.init();
+    run(cu, '_home.items = { 3, 1, 2 }');
+
+    cu.startCapture();
+    run(cu, 'count = #_home.items');
+    run(cu, 'return count * 10 + _home.items[1]');
+    run(cu, '_home.items[4] = 9; return #_home.items');
+    const capture = decodeCapture(encodeCapture(cu.stopCapture()));
+    assert.strictEqual(cu.capture, null);
+    assert.strictEqual(capture.requests.length, 3);
+    assert.strictEqual(capture.requests[1].code, 'return count * 10 + _home.items[1]');
+    assert.ok(capture.requests[1].calls.some(([op, , key]) => op === 'get' && key === 'items'));
+
+    const createInstance = async () => {
+      const fresh = await CuInstance.create({ module, autoRestore: false });
+      fresh.init();
+      return fresh;
+    };
+    // _home comes from the captured tables, so the replay matches
+    const report = await replayCapture(capture, { createInstance, runs: 2 });
+    assert.deepStrictEqual(report.divergent, []);
+    assert.strictEqual(report.latency.count, 6);
+    assert.ok(report.throughput > 0);
+
+    capture.requests[1].code = 'return count * 10 + _home.items[2]';
+    assert.deepStrictEqual((await replayCapture(capture, { createInstance })).divergent, [1]);
+  });
+
+  it('Counts heap objects by kind', async () => {
+    requireFeature(WebAssembly.Module.exports(module).some((entry) => entry.name === 'get_heap_census'), 'heap census');
+    const cu = await CuInstance.create({ module, autoRestore: false });
+    cu.init();
+    cu.runGc();
+    const before = cu.getHeapCensus();
+    run(cu, `
+      keep = {}
+      for i = 1, 100 do keep[i] = { id = i } end
+      keep.big = require('bigint').new(12345)
+      return #keep`);
+    const after = cu.getHeapCensus();
+    assert.ok(after.kinds.tables.count >= before.kinds.tables.count + 101);
+    assert.ok(after.kinds.bigints.count >= 1);
+    const sum = Object.values(after.kinds).reduce((total, kind) => total + kind.bytes, 0);
+    assert.strictEqual(after.objectBytes, sum);
+    assert.ok(after.objectBytes <= after.totalBytes);
+
+    // Only CU_ALLOC_PROFILE=1 builds tally allocations
+    const profile = cu.getAllocProfile({ reset: true });
+    if (profile) {
+      run(cu, 'local t = {} for i = 1, 10 do t[i] = {} end return #t');
+      assert.ok(cu.getAllocProfile().tables.allocs >= 11);
+    }
+  });
+
+  it('Collects between calls when idle', async () => {
+    requireFeature(WebAssembly.Module.exports(module).some((entry) => entry.name === 'idle_gc'), 'idle collection');
+    const cu = await CuInstance.create({ module, autoRestore: false });
+    cu.init();
+    const garbage = 'local t for i = 1, 20000 do t = { i, { i } } end return 1';
+    const { idle_gc } = cu.wasmInstance.exports;
+
+    run(cu, garbage);
+    assert.strictEqual(idle_gc(1000000), 1);
+    const pauses = cu.getGcStats().pauses;
+    assert.ok(pauses > 0);
+    // Caught up and nothing allocated since: no work
+    assert.strictEqual(idle_gc(1000000), 1);
+    assert.strictEqual(cu.getGcStats().pauses, pauses);
+
+    assert.strictEqual(cu.setIdleGc({ budgetUs: 1000 }), true);
+    run(cu, garbage);
+    cu.getGcStats({ reset: true });
+    for (let i = 0; i < 3; i++) await new Promise((resolve) => setImmediate(resolve));
+    assert.ok(cu.getGcStats().pauses > 0);
+    cu.setIdleGc(false);
+  });
+
+  it('Serves conversion and batch scratch from an arena', async () => {
+    requireFeature(WebAssembly.Module.exports(module).some((entry) => entry.name === 'set_scratch_arena'), 'scratch arena');
+    const cu = await CuInstance.create({ module, autoRestore: false });
+    cu.init();
+    assert.strictEqual(cu.setScratchArena(64 * 1024), true);
+    assert.strictEqual(cu.wasmInstance.exports.set_scratch_arena(64 * 1024), 64 * 1024);
+
+    // Each nested table converts with its own batch
+    run(cu, '_home.tree = { a = { b = { c = { d = "leaf" } } }, list = { 1, 2, 3 } }');
+    assert.strictEqual(run(cu, 'return _home.tree.a.b.c.d .. #_home.tree.list'), 'leaf3');
+
+    const results = cu.computeBatch(['_home.n = 1', { call: 'tostring', args: [2] }, 'return _home.n']);
+    assert.deepStrictEqual(results.map((r) => r.status >= 0), [true, true, true]);
+    assert.strictEqual(results[2].result, 1);
+
+    assert.strictEqual(cu.setScratchArena(false), true);
+    assert.strictEqual(run(cu, '_home.more = { x = { y = 1 } } return _home.more.x.y'), 1);
+  });
+
+  it('Stores table values in arena slabs', async () => {
+    const { ArenaTable } = await import('../web/cu-ext-arena.js');
+    const cu = await CuInstance.create({ module, autoRestore: false, tableStorage: 'arena' });
+    cu.init();
+    run(cu, '_home.rows = {} for i = 1, 200 do _home.rows[i] = { id = i, tag = "t" .. i } end');
+    run(cu, 'for i = 1, 100 do _home.rows[i] = nil end _home.rows[150].tag = "changed"');
+    assert.ok(cu.externalTables.get(cu.homeTableId) instanceof ArenaTable);
+    assert.strictEqual(run(cu, 'return _home.rows[150].tag .. _home.rows[200].id'), 'changed200');
+
+    const fork = CuInstance.fromSnapshot(cu.snapshot({ trim: false }), { tableStorage: 'arena' });
+    run(fork, '_home.rows[200].tag = "fork"');
+    assert.strictEqual(run(cu, 'return _home.rows[200].tag'), 't200');
+
+    assert.strictEqual(cu.setTableStorage('map'), true);
+    assert.ok(!(cu.externalTables.get(cu.homeTableId) instanceof ArenaTable));
+    assert.strictEqual(run(cu, 'return _home.rows[101].tag .. tostring(_home.rows[1])'), 't101nil');
+  });
+
+  it('Feeds the table changes of each compute to subscribers', async () => {
+    const cu = await CuInstance.create({ module, autoRestore: false });
+    cu.init();
+    run(cu, '_home.before = 1');
+    const batches = [];
+    const raw = [];
+    const stop = cu.onChanges((records) => batches.push(records), { values: true });
+    cu.onChanges((records) => raw.push(records));
+
+    run(cu, '_home.count = 1 _home.count = 2 _home.user = { name = "ann" } _home.before = nil');
+    run(cu, 'local unused = 1');
+    assert.strictEqual(batches.length, 1, 'a compute that changes nothing sends nothing');
+    const byKey = new Map(batches[0].map((record) => [`${record.tableId}:${record.key}`, record]));
+    const home = cu.homeTableId;
+    assert.deepStrictEqual(byKey.get(`${home}:count`).value, 2, 'the last value');
+    assert.strictEqual(byKey.get(`${home}:before`).op, 'delete');
+    const user = byKey.get(`${home}:user`).value;
+    assert.strictEqual(byKey.get(`${user.tableId}:name`).value, 'ann', 'nested tables report their own keys');
+    assert.strictEqual(raw[0][0].value, undefined, 'values are decoded on request');
+    assert.ok(raw[0][0].bytes instanceof Uint8Array);
+
+    stop();
+    run(cu, '_home.count = 3');
+    assert.strictEqual(batches.length, 1);
+    assert.strictEqual(raw.length, 2);
+  });
+
+  it('Counts table bytes and refuses writes over a table quota', async () => {
+    const cu = await CuInstance.create({ module, autoRestore: false });
+    cu.init();
+    run(cu, '_home.a = string.rep("x", 100) _home.b = 1');
+    const home = () => cu.getTableInfo().tables.find((table) => table.id === cu.homeTableId);
+    const { size, bytes } = home();
+    assert.ok(bytes > 100, 'values are counted as stored');
+    run(cu, '_home.a = "short"');
+    assert.ok(home().bytes < bytes - 90, 'a replaced value is counted once');
+
+    cu.setTableQuota({ maxEntries: size });
+    const len = cu.compute('_home.c = 1');
+    if (len < 0) assert.match(cu.readBuffer(cu.getBufferPtr(), -len), /quota exceeded/);
+    assert.strictEqual(home().size, size, 'the refused entry is not stored');
+    run(cu, '_home.b = 2 _home.a = nil');
+    assert.strictEqual(home().size, size - 1, 'writes that do not grow the table pass');
+
+    cu.setTableQuota();
+    run(cu, '_home.c = 1 _home.d = 2');
+    assert.strictEqual(home().size, size + 1);
+    assert.strictEqual(cu.getTableInfo().quota, null);
+  });
+
+  it('Trims the heap after a spike so snapshots stay small', async () => {
+    requireFeature(WebAssembly.Module.exports(module).some((entry) => entry.name === 'trim_heap'), 'heap trimming');
+    const cu = await CuInstance.create({ module, autoRestore: false });
+    cu.init();
+    run(cu, 'prefix = "kept "');
+    run(cu, 'local spike = {} for i = 1, 50000 do spike[i] = { i, tostring(i) } end');
+    const untrimmed = cu.snapshot({ trim: false }).image.bytes.length;
+
+    assert.ok(cu.trimHeap() > 0);
+    const snapshot = cu.snapshot();
+    assert.ok(snapshot.image.bytes.length < untrimmed / 2);
+
+    const fork = CuInstance.fromSnapshot(snapshot);
+    assert.strictEqual(run(fork, 'local t = {} for i = 1, 1000 do t[i] = i end return prefix .. #t'), 'kept 1000');
+  });
+
+  it('Sizes the string table and reports its occupancy', async () => {
+    requireFeature(WebAssembly.Module.exports(module).some((entry) => entry.name === 'set_string_table_size'), 'string table sizing');
+    const cu = await CuInstance.create({ module, autoRestore: false });
+    cu.init({ stringTableSize: 3000 });
+    assert.strictEqual(cu.getMemoryStats().strings.size, 4096);
+
+    run(cu, 'keys = {} for i = 1, 5000 do keys["k" .. i] = i end return 1');
+    const { strings } = cu.getMemoryStats();
+    assert.ok(strings.count >= 5000);
+    assert.ok(strings.size >= 4096 && (strings.size & (strings.size - 1)) === 0);
+    assert.ok(strings.usedBuckets <= strings.count && strings.longestChain >= 1);
+    assert.strictEqual(strings.loadFactor, strings.count / strings.size);
+
+    // The collector keeps at least the requested size
+    run(cu, 'keys = nil collectgarbage() collectgarbage() return 1');
+    assert.ok(cu.getMemoryStats().strings.size >= 4096);
+  });
+
+  it('Reuses functions read from _home until they are replaced', async () => {
+    const cu = await CuInstance.create({ module, autoRestore: false });
+    cu.init();
+    run(cu, '_home.handler = function(x) return x + 1 end');
+    assert.strictEqual(run(cu, 'seen = _home.handler return _home.handler(1)'), 2);
+    if (WebAssembly.Module.exports(module).some((entry) => entry.name === 'compile')) {
+      assert.strictEqual(run(cu, 'return rawequal(seen, _home.handler)'), true);
+    }
+
+    run(cu, '_home.handler = function(x) return x * 10 end');
+    assert.strictEqual(run(cu, 'return _home.handler(2)'), 20);
+    assert.strictEqual(run(cu, 'return rawequal(seen, _home.handler)'), false);
+  });
+
+  it('Stores functions with debug info only when asked', async () => {
+    requireFeature(WebAssembly.Module.exports(module).some((entry) => entry.name === 'set_function_debug_info'), 'function debug info setting');
+    const cu = await CuInstance.create({ module, autoRestore: false });
+    cu.init();
+    const failure = 'local ok, err = pcall(_home.fail) return err';
+    run(cu, '_home.fail = function() error("boom") end');
+    assert.strictEqual(run(cu, failure), 'boom');
+
+    assert.strictEqual(cu.setFunctionDebugInfo(true), true);
+    run(cu, '_home.fail = function()\n error("boom")\nend');
+    assert.strictEqual(run(cu, failure), 'compute:2: boom');
+  });
+
+  it('Compiles source to a chunk that compute() runs and verifies', async () => {
+    requireFeature(WebAssembly.Module.exports(module).some((entry) => entry.name === 'compile'), 'compile');
+    const cu = await CuInstance.create({ module, autoRestore: false });
+    cu.init();
+    const chunk = cu.compile('local t = {} for i = 1, 10 do t[i] = i * i end return t[10]');
+    assert.deepStrictEqual([...chunk.subarray(0, 4)], [0x1b, 0x4c, 0x75, 0x61]);
+    assert.strictEqual(run(cu, chunk), 100);
+    assert.ok(cu.compile('return 1', { strip: true }).length < cu.compile('return 1').length);
+    assert.throws(() => cu.compile('return +'), /compile\(\) failed/);
+
+    // A damaged chunk is rejected as it loads instead of running
+    assert.ok(cu.compute(chunk.subarray(0, chunk.length - 10)) < 0);
+    assert.strictEqual(run(cu, chunk), 100);
+  });
+
+  it('Suspends computeAsync chunks at host.await', async () => {
+    requireFeature(WebAssembly.Module.exports(module).some((entry) => entry.name === 'compute_async'), 'host.await');
+    const cu = await CuInstance.create({ module, autoRestore: false });
+    cu.init();
+    const lookups = { a: 1, b: 2 };
+    const handler = async (op, args) => {
+      await new Promise((resolve) => setTimeout(resolve, 5));
+      if (op !== 'lookup' || !(args.key in lookups)) throw new Error('no ' + args.key);
+      return lookups[args.key];
+    };
+
+    // Both chunks wait at once and finish in either order
+    const [a, b] = await Promise.all([
+      cu.computeAsync('print("a"); local v = host.await("lookup", { key = "a" }); _home.a = v; return v * 10', handler),
+      cu.computeAsync('return host.await("lookup", { key = "b" }) + host.await("lookup", { key = "a" })', handler),
+    ]);
+    assert.strictEqual(a.result, 10);
+    assert.strictEqual(a.output.trim(), 'a');
+    assert.strictEqual(b.result, 3);
+    assert.strictEqual(run(cu, 'return _home.a'), 1);
+
+    const caught = await cu.computeAsync('local ok, err = pcall(host.await, "lookup", { key = "z" }); return tostring(err)', handler);
+    assert.match(caught.result, /no z/);
+    await assert.rejects(cu.computeAsync('host.await("lookup", { key = "z" })', handler), (error) => error.status < 0 && /no z/.test(error.message));
+    await assert.rejects(cu.computeAsync('return coroutine.wrap(function() return host.await("x") end)()', handler), /not in a compute_async chunk/);
+    assert.strictEqual(cu.wasmInstance.exports.get_await_handle(), 0);
+  });
+
+  it('Replays the same results in deterministic mode', async () => {
+    requireFeature(WebAssembly.Module.exports(module).some((entry) => entry.name === 'set_deterministic'), 'deterministic mode');
+    const script = `
+      local keys = {}
+      for k in pairs({ alpha = 1, beta = 2, gamma = 3, delta = 4, epsilon = 5 }) do keys[#keys + 1] = k end
+      return table.concat(keys, ",") .. " " .. math.random(1, 1e9) .. " " .. os.time() .. " " .. os.clock()
+    `;
+    const runs = [];
+    for (let i = 0; i < 2; i++) {
+      const cu = await CuInstance.create({ module, autoRestore: false });
+      cu.init({ deterministic: { seed: 42 } });
+      cu.setVirtualClock(1700000000500);
+      runs.push(run(cu, script));
+    }
+    assert.strictEqual(runs[0], runs[1]);
+    assert.match(runs[0], / 1700000000 1700000000\.5$/);
+  });
+
+  it('Runs sched tasks from schedTick', async () => {
+    requireFeature(WebAssembly.Module.exports(module).some((entry) => entry.name === 'sched_tick'), 'sched');
+    const cu = await CuInstance.create({ module, autoRestore: false });
+    cu.init();
+    assert.strictEqual(cu.schedTick().next, null);
+
+    run(cu, `
+      local sched = require('sched')
+      _G.counter = sched.spawn(function()
+        local total = 0
+        while true do
+          local n = sched.receive()
+          if n == nil then break end
+          total = total + n
+          _home.total = total
+        end
+      end)
+      sched.spawn(function() sched.sleep(5); print('woke') end)
+      for i = 1, 3 do sched.send(counter, i) end
+    `);
+    const first = cu.schedTick(0);
+    assert.ok(first.next > 0);
+    assert.strictEqual(run(cu, 'return _home.total'), 6);
+
+    await new Promise((resolve) => setTimeout(resolve, 10));
+    const second = cu.schedTick(0);
+    assert.strictEqual(second.output.trim(), 'woke');
+    assert.strictEqual(second.next, null);
+    assert.strictEqual(run(cu, 'local sched = require("sched"); return sched.count()'), 1);
+  });
+
+  it('Forwards messages between units as stored bytes', async () => {
+    const { MessageBus } = await import('../web/cu-bus.js');
+    const orders = await CuInstance.create({ module, autoRestore: false });
+    const billing = await CuInstance.create({ module, autoRestore: false });
+    orders.init();
+    billing.init();
+    requireFeature(orders.wasmInstance.exports.call, 'call()');
+
+    const bus = new MessageBus();
+    bus.attach('orders', orders);
+    bus.attach('billing', billing);
+    run(billing, `
+      function receive()
+        for from, msg in bus.messages() do
+          _home.total = (_home.total or 0) + msg.total
+          _home.last = from .. " " .. msg.items[2] .. " " .. msg.customer.name
+          bus.send(from, { id = msg.id, paid = true })
+        end
+      end
+    `);
+    run(orders, 'function receive() for _, msg in bus.messages() do _home["paid" .. msg.id] = msg.paid end end');
+
+    run(orders, `
+      local customer = { name = "ada" }
+      bus.send("billing", { id = 1, total = 120, items = { "pen", "ink" }, customer = customer })
+      bus.send("billing", { id = 2, total = 30, items = { "cap", "nib" }, customer = customer })
+    `);
+    assert.strictEqual(bus.collect('orders'), 2);
+    bus.post('billing', { id: 3, total: 5, items: ['a', 'b'], customer: { name: 'host' } });
+    assert.strictEqual(bus.deliver(), 5);
+
+    assert.strictEqual(run(billing, 'return _home.total .. " " .. _home.last'), '155 host b host');
+    assert.strictEqual(run(orders, 'return tostring(_home.paid1 and _home.paid2)'), 'true');
+    assert.strictEqual(bus.deliver(), 0);
+    const [reply] = bus.unrouted;
+    assert.deepStrictEqual([reply.from, reply.to, billing.deserializeObject(reply.frame)], ['billing', 'host', { id: 3, paid: true }]);
+  });
+
+  it('Keeps the Lua states of one instance apart', async () => {
+    const cu = await CuInstance.create({ module, autoRestore: false });
+    cu.init();
+    requireFeature(cu.wasmInstance.exports.create_state, 'create_state');
+
+    run(cu, 'tenant = "first"; _home.n = 1');
+    const second = cu.createState({ maxBytes: 1024 * 1024 });
+    assert.strictEqual(cu.getState(), 1);
+    const len = cu.computeOn(second, 'return tostring(tenant) .. " " .. tostring(_home.n)');
+    assert.strictEqual(cu.readResult(cu.getBufferPtr(), len).result, 'nil nil');
+    run(cu, '_home.n = 2; _io.output = { ok = true }');
+    assert.deepStrictEqual(cu.getOutput(), { ok: true });
+    assert.ok(cu.getStateMemory(second) > 0);
+    assert.ok(cu.compute('local t = {} for i = 1, 1e6 do t[i] = i end') < 0);
+
+    cu.selectState(1);
+    assert.strictEqual(run(cu, 'return tenant .. " " .. _home.n'), 'first 1');
+    assert.strictEqual(cu.getOutput(), null);
+    cu.collectTables();
+    cu.selectState(second);
+    assert.strictEqual(run(cu, 'return _home.n'), 2);
+    cu.selectState(1);
+    cu.destroyState(second);
+    assert.throws(() => cu.selectState(second));
+  });
+
+  it('Opens only the chosen standard libraries, some lazily', async () => {
+    const cu = await CuInstance.create({ module, autoRestore: false });
+    requireFeature(cu.wasmInstance.exports.set_stdlibs, 'library selection');
+    assert.throws(() => cu.init({ libs: ['sockets'] }), /Unknown standard library/);
+    cu.init({ libs: ['string', 'table', 'utf8', 'debug'], lazyLibs: true });
+    assert.strictEqual(run(cu, 'return tostring(rawget(_G, "utf8")) .. tostring(math)'), 'nilnil');
+    assert.strictEqual(run(cu, 'return utf8.char(72, 105) .. type(rawget(_G, "utf8")) .. type(require("debug"))'), 'Hitabletable');
+  });
+
+  it('Compiles the module while persisted tables restore', async () => {
+    const { onMetric } = await import('../web/cu-log.js');
+    const wasmPath = path.join(__dirname, '../web/cu.wasm');
+    const persistence = {
+      async loadTables() {
+        await new Promise((resolve) => setTimeout(resolve, 50));
+        return { tables: new Map(), metadata: {} };
+      },
+    };
+    const records = [];
+    onMetric((record) => records.push(record));
+    try {
+      const cu = new CuInstance({ persistence });
+      // Compiled once so the timing below is the cache hit
+      await cu.load({ autoRestore: false, wasmPath });
+      records.length = 0;
+      assert.strictEqual(await cu.load({ wasmPath }), true);
+    } finally {
+      onMetric(null);
+    }
+    const load = records.find((record) => record.name === 'load');
+    assert.ok(load.restoreMs >= 40);
+    assert.ok(load.compileMs < load.restoreMs, 'the module was ready before the tables');
+    assert.ok(load.durationMs < load.restoreMs + 40);
+    assert.ok(load.instantiateMs >= 0);
+  });
+
+  it('Answers repeated pure calls from the response cache', async () => {
+    const cu = await CuInstance.create({ module, autoRestore: false });
+    cu.init();
+    requireFeature(cu.wasmInstance.exports.call, 'call()');
+    run(cu, `
+      _home.rates = { usd = 1, eur = 2 }
+      calls = 0
+      function quote(amount, currency) calls = calls + 1; return amount * _home.rates[currency] end
+      function count() return calls end
+    `);
+    cu.setResponseCache({ handlers: ['quote'] });
+    const quote = (amount, currency) => {
+      const len = cu.call('quote', [amount, currency]);
+      return cu.readResult(cu.getResultPtr(), len).result;
+    };
+
+    assert.strictEqual(quote(10, 'eur'), 20);
+    assert.strictEqual(quote(10, 'eur'), 20);
+    assert.strictEqual(quote(10, 'usd'), 10);
+    assert.deepStrictEqual(cu.getResponseCacheStats(), { hits: 1, misses: 2, entries: 2 });
+
+    // The host writes a table both calls read
+    const [ratesId, rates] = [...cu.externalTables].find(([, table]) => table.has('eur'));
+    rates.set('eur', cu.serializeObject(3));
+    cu.wasmInstance.exports.invalidate_ext_table(ratesId);
+    assert.strictEqual(quote(10, 'eur'), 30);
+    assert.strictEqual(quote(10, 'usd'), 10);
+    assert.strictEqual(cu.getResponseCacheStats().misses, 4);
+
+    // Other code in the VM may redefine the handler
+    run(cu, 'function quote(amount) return -amount end');
+    assert.strictEqual(quote(10, 'usd'), -10);
+    const len = cu.call('count', []);
+    assert.strictEqual(cu.readResult(cu.getResultPtr(), len).result, 4);
+  });
+
+  it('Reads results in place until the next run overwrites them', async () => {
+    const cu = await CuInstance.create({ module, autoRestore: false });
+    cu.init();
+
+    const len = cu.compute('print("hi") return string.rep("x", 300)');
+    const copied = cu.readResult(cu.getBufferPtr(), len);
+    const view = cu.readResultView(cu.getBufferPtr(), len);
+    assert.strictEqual(view.output, copied.output);
+    assert.strictEqual(view.length, copied.results.length);
+    assert.deepStrictEqual(view.results, copied.results);
+    assert.ok(view.bytes(0) instanceof Uint8Array);
+    assert.strictEqual(view.bytes(0).buffer, cu.wasmInstance.exports.memory.buffer);
+    assert.strictEqual(view.bytes(0).length, 300);
+
+    const kept = view.detach();
+    const accent = cu.readResultView(cu.getBufferPtr(), cu.compute('return "é"'));
+    assert.deepStrictEqual([...accent.bytes(0)], [0xc3, 0xa9]);
+    const number = cu.readResultView(cu.getBufferPtr(), cu.compute('return 42'));
+    assert.strictEqual(number.bytes(0), null);
+    assert.strictEqual(number.result, 42);
+
+    assert.throws(() => view.bytes(0), /stale/);
+    assert.strictEqual(kept.result, 'x'.repeat(300));
+    assert.strictEqual(kept.output, copied.output);
+  });
+});
@@ -0,0 +1,111 @@
+const { describe, it, before, after } = require('node:test');
+const assert = require('node:assert');
+const path = require('path');
+const { requireFeature } = require('./node-test-utils');
+
+const SLOW_SCRIPT = 'local n = 0; for i = 1, 1e7 do n = n + i end; return "done"';
+
+describe('CuWorker', () => {
+  let cu;
+  let ErrorCodes;
+
+  before(async () => {
+    ({ ErrorCodes } = await import('../web/cu-instance.js'));
+    const { CuWorker } = await import('../web/cu-worker.js');
+    cu = await CuWorker.create({ wasmPath: path.join(__dirname, '../web/cu.wasm') });
+  });
+
+  after(async () => {
+    await cu.close();
+  });
+
+  it('Runs compute in the worker with its own _home', async () => {
+    await cu.compute('_home.n = 41');
+    assert.strictEqual((await cu.compute('_home.n = _home.n + 1; return _home.n')).result, 42);
+    await assert.rejects(cu.compute('error("boom")'), (error) => error.status < 0);
+  });
+
+  it('Keeps the calling thread free while a script runs', async () => {
+    const running = cu.compute(SLOW_SCRIPT);
+    const start = performance.now();
+    await new Promise((resolve) => setTimeout(resolve, 10));
+    assert.ok(performance.now() - start < 150, 'timer was held up by the script');
+    assert.strictEqual((await running).result, 'done');
+  });
+
+  it('Drops a waiting request when its signal aborts', async () => {
+    const controller = new AbortController();
+    const first = cu.compute(SLOW_SCRIPT);
+    const second = cu.compute('_home.skipped = true', { signal: controller.signal });
+    controller.abort();
+    await assert.rejects(second, (error) => error.code === ErrorCodes.INTERRUPTED);
+    await first;
+    assert.strictEqual((await cu.compute('return _home.skipped')).result, null);
+  });
+
+  it('Interrupts a running script', async () => {
+    requireFeature(cu.interruptible, 'The set_interrupt_polling export');
+    const started = performance.now();
+    const running = cu.compute('while true do end', { signal: AbortSignal.timeout(50) });
+    await assert.rejects(running, (error) => error.code === ErrorCodes.INTERRUPTED);
+    assert.ok(performance.now() - started < 1000);
+    assert.strictEqual((await cu.compute('return 1 + 1')).result, 2);
+  });
+});
+
+describe('CuRing', () => {
+  it('Wraps frames around the end of the ring in order', async () => {
+    const { CuRing } = await import('../web/cu-ring.js');
+    const ring = new CuRing(CuRing.allocate(64));
+    const reader = new CuRing(ring.buffer);
+    for (let i = 0; i < 40; i++) {
+      const frame = new Uint8Array(1 + (i % 23)).fill(i);
+      assert.ok(ring.tryWrite(frame));
+      assert.deepStrictEqual(reader.tryRead(), frame);
+    }
+    assert.strictEqual(reader.tryRead(), null);
+    assert.ok(ring.tryWrite(new Uint8Array(60)));
+    assert.strictEqual(ring.tryWrite(new Uint8Array(1)), false, 'ring should be full');
+    assert.throws(() => ring.tryWrite(new Uint8Array(61)), /too large/);
+    ring.close();
+    assert.strictEqual(reader.read().length, 60);
+    assert.strictEqual(await reader.readAsync(), null);
+  });
+});
+
+describe('CuWorker with rings', () => {
+  let cu;
+  let ErrorCodes;
+
+  before(async () => {
+    ({ ErrorCodes } = await import('../web/cu-instance.js'));
+    const { CuWorker } = await import('../web/cu-worker.js');
+    cu = await CuWorker.create({ wasmPath: path.join(__dirname, '../web/cu.wasm'), ring: 1 << 16 });
+  });
+
+  after(async () => {
+    await cu.close();
+  });
+
+  it('Runs requests through the rings', async () => {
+    assert.strictEqual(cu.usesRing, true);
+    await cu.compute('_home.n = 0');
+    const results = await Promise.all(Array.from({ length: 100 }, () =>
+      cu.compute('_home.n = _home.n + 1; return _home.n')
+    ));
+    assert.deepStrictEqual(results.map((r) => r.result), Array.from({ length: 100 }, (_, i) => i + 1));
+    await assert.rejects(cu.compute('error("boom")'), (error) => error.status < 0);
+  });
+
+  it('Rejects a request too large for its ring', async () => {
+    await assert.rejects(cu.compute('return "' + 'x'.repeat(1 << 16) + '"'), /too large/);
+    assert.strictEqual((await cu.compute('return 1 + 1')).result, 2);
+  });
+
+  it('Interrupts a running script', async () => {
+    requireFeature(cu.interruptible, 'The set_interrupt_polling export');
+    const running = cu.compute('while true do end', { signal: AbortSignal.timeout(50) });
+    await assert.rejects(running, (error) => error.code === ErrorCodes.INTERRUPTED);
+    assert.strictEqual((await cu.compute('return 1 + 1')).result, 2);
+  });
+});
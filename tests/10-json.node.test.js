@@ -0,0 +1,78 @@
+const { describe, it, beforeEach } = require('node:test');
+const assert = require('node:assert');
+const { loadWasm, init, compute, getBufferPtr, readResult, reset, requireFeature } = require('./node-test-utils');
+
+function run(code) {
+  return readResult(getBufferPtr(), compute(code)).result;
+}
+
+function hasJson() {
+  return run('return package.preload.json ~= nil') === true;
+}
+
+describe('JSON Module', () => {
+  beforeEach(async () => {
+    reset();
+    await loadWasm();
+    init();
+  });
+
+  it('Decodes documents into Lua tables', () => {
+    requireFeature(hasJson(), 'json module');
+    const result = run(`
+      local json = require('json')
+      local doc = json.decode('{"items":[{"id":1,"price":2.5},{"id":2,"price":0.25}],"note":"caf\\\\u00e9\\\\n","gone":null}')
+      return table.concat({
+        #doc.items, doc.items[2].id, math.type(doc.items[2].id),
+        doc.items[1].price + doc.items[2].price, doc.note, tostring(doc.gone == json.null),
+      }, "|")
+    `);
+    assert.strictEqual(result, '2|2|integer|2.75|café\n|true');
+  });
+
+  it('Encodes tables as arrays and objects', () => {
+    requireFeature(hasJson(), 'json module');
+    const result = run(`
+      local json = require('json')
+      return json.encode({ 1, "two", { nested = true }, json.null, 0.1 })
+    `);
+    assert.deepStrictEqual(JSON.parse(result), [1, 'two', { nested: true }, null, 0.1]);
+    assert.deepStrictEqual(JSON.parse(run(`return require('json').encode({ a = "q\\"uote", [7] = false })`)),
+      { a: 'q"uote', 7: false });
+  });
+
+  it('Decodes integers up to the limits of lua_Integer as integers', () => {
+    requireFeature(hasJson(), 'json module');
+    const result = run(`
+      local json = require('json')
+      local out = {}
+      for _, n in ipairs({ math.maxinteger, math.mininteger, 2147483647, 1234567890123456789 }) do
+        local back = json.decode(json.encode(n))
+        out[#out + 1] = math.type(back) .. tostring(back == n)
+      end
+      out[#out + 1] = math.type(json.decode('9223372036854775808'))
+      return table.concat(out, ' ')
+    `);
+    assert.strictEqual(result, 'integertrue integertrue integertrue integertrue float');
+  });
+
+  it('Round-trips a larger payload', () => {
+    requireFeature(hasJson(), 'json module');
+    const payload = Array.from({ length: 500 }, (_, i) => ({ id: i + 1, name: `user${i}`, tags: ['a', 'b'] }));
+    const result = run(`
+      local json = require('json')
+      local users = json.decode(${JSON.stringify(JSON.stringify(payload))})
+      return json.encode(users)
+    `);
+    assert.deepStrictEqual(JSON.parse(result), payload);
+  });
+
+  it('Reports the position of invalid input', () => {
+    requireFeature(hasJson(), 'json module');
+    const result = run(`
+      local ok, err = pcall(require('json').decode, '{"a": [1, 2,, 3]}')
+      return err
+    `);
+    assert.match(result, /json\.decode: unexpected character at position 13/);
+  });
+});
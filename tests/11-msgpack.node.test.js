@@ -0,0 +1,63 @@
+const { describe, it, before, beforeEach } = require('node:test');
+const assert = require('node:assert');
+const { loadWasm, init, compute, getBufferPtr, readResult, setInput, reset, requireFeature } = require('./node-test-utils');
+
+function run(code) {
+  return readResult(getBufferPtr(), compute(code)).result;
+}
+
+function hasMsgpack() {
+  return run('return package.preload.msgpack ~= nil') === true;
+}
+
+describe('MessagePack', () => {
+  let encode;
+  let decode;
+
+  before(async () => {
+    ({ encode, decode } = await import('../web/cu-msgpack.js'));
+  });
+
+  beforeEach(async () => {
+    reset();
+    await loadWasm();
+    init();
+  });
+
+  it('Round-trips values through the host codec', () => {
+    const value = {
+      small: [0, 127, -32, 255, -129, 70000, -3e9, 2 ** 40, 1.5],
+      big: 2n ** 63n,
+      text: ['', 'héllo', 'x'.repeat(40), 'y'.repeat(70000)],
+      flags: [true, false, null],
+      bytes: new Uint8Array([1, 2, 3]),
+      nested: { a: [[], {}] },
+    };
+    assert.deepStrictEqual(decode(encode(value)), value);
+    assert.deepStrictEqual([...encode([1, 'a', null])], [0x93, 0x01, 0xa1, 0x61, 0xc0]);
+    assert.throws(() => decode(new Uint8Array([0x92, 0x01])), /truncated input/);
+  });
+
+  it('Decodes a payload the host encoded and packs the reply', () => {
+    requireFeature(hasMsgpack(), 'msgpack module');
+    setInput(encode({ items: [{ price: 2.5, qty: 2 }, { price: 0.25, qty: 4 }], customer: 'Zoë' }));
+    const reply = run(`
+      local msgpack = require('msgpack')
+      local order = msgpack.decode(_io.input)
+      local total = 0
+      for _, item in ipairs(order.items) do total = total + item.price * item.qty end
+      return msgpack.pack({ customer = order.customer, total = total, count = #order.items })
+    `);
+    assert.ok(reply instanceof Uint8Array);
+    assert.deepStrictEqual(decode(reply), { customer: 'Zoë', total: 6, count: 2 });
+  });
+
+  it('Encodes the smallest integer formats from Lua', () => {
+    requireFeature(hasMsgpack(), 'msgpack module');
+    const hex = run(`
+      local encoded = require('msgpack').encode({ 1, -1, 200, -200, 70000, "ab", true })
+      return (encoded:gsub(".", function(c) return string.format("%02x", c:byte()) end))
+    `);
+    assert.strictEqual(hex, '9701ffccc8d1ff38ce00011170a26162c3');
+  });
+});
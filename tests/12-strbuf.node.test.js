@@ -0,0 +1,58 @@
+const { describe, it, beforeEach } = require('node:test');
+const assert = require('node:assert');
+const { loadWasm, init, compute, getBufferPtr, readResult, getOutput, reset, requireFeature } = require('./node-test-utils');
+
+function run(code) {
+  return readResult(getBufferPtr(), compute(code));
+}
+
+function hasStrbuf() {
+  return run('return package.preload.strbuf ~= nil').result === true;
+}
+
+describe('strbuf', () => {
+  beforeEach(async () => {
+    reset();
+    await loadWasm();
+    init();
+  });
+
+  it('Appends, formats and clears', () => {
+    requireFeature(hasStrbuf(), 'strbuf module');
+    const { result } = run(`
+      local sb = require('strbuf').new()
+      for i = 1, 3 do sb:append("item", i, ",") end
+      sb:format("%s=%d", "n", #sb)
+      local text = sb:tostring()
+      sb:clear():append(1.5)
+      return text .. "|" .. tostring(sb) .. "|" .. #sb
+    `);
+    assert.strictEqual(result, 'item1,item2,item3,n=18|1.5|3');
+  });
+
+  it('Hands its bytes to print, _io and the result without a string', () => {
+    requireFeature(hasStrbuf(), 'strbuf module');
+    const { output, result } = run(`
+      local sb = require('strbuf').new()
+      for i = 1, 20000 do sb:append(i, "\\n") end
+      _io.output = sb
+      print(require('strbuf').new():append("printed"))
+      return require('strbuf').new():append("returned")
+    `);
+    assert.ok(output.includes('printed'));
+    assert.strictEqual(result, 'returned');
+    // Larger than the value window, so it went through the large-value path
+    const expected = Array.from({ length: 20000 }, (_, i) => `${i + 1}\n`).join('');
+    assert.strictEqual(getOutput(), expected);
+  });
+
+  it('Rejects values it cannot append', () => {
+    requireFeature(hasStrbuf(), 'strbuf module');
+    const { result } = run(`
+      local sb = require('strbuf').new()
+      local ok, err = pcall(sb.append, sb, {})
+      return tostring(ok) .. " " .. err
+    `);
+    assert.match(result, /^false .*string, number or strbuf expected/);
+  });
+});
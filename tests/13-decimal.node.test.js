@@ -0,0 +1,59 @@
+const { describe, it, beforeEach } = require('node:test');
+const assert = require('node:assert');
+const { loadWasm, init, compute, getBufferPtr, readResult, reset, requireFeature } = require('./node-test-utils');
+
+function run(code) {
+  return readResult(getBufferPtr(), compute(code));
+}
+
+function hasDecimal() {
+  return run('return package.preload.decimal ~= nil').result === true;
+}
+
+describe('decimal', () => {
+  beforeEach(async () => {
+    reset();
+    await loadWasm();
+    init();
+  });
+
+  it('Keeps a fixed scale and rounds by rule', () => {
+    requireFeature(hasDecimal(), 'decimal module');
+    const { result } = run(`
+      local decimal = require('decimal')
+      local price = decimal.new("19.99", 2)
+      return table.concat({
+        tostring(price * 3), tostring(price / 3), tostring(price:div(3, "up")),
+        tostring(decimal.new("0.125", 2)), tostring(decimal.new("0.125", 2, "half_up")),
+        tostring(price - 20), tostring(price:rescale(1)), price:units(),
+        tostring(decimal.new("1.5", 1) == decimal.new("1.50", 2)), tostring(price < 20),
+      }, "|")
+    `);
+    assert.strictEqual(result, '59.97|6.66|6.67|0.12|0.13|-0.01|20.0|1999|true|true');
+  });
+
+  it('Converts wei past 128 bits exactly', () => {
+    requireFeature(hasDecimal(), 'decimal module');
+    const { result } = run(`
+      local decimal = require('decimal')
+      local bigint = require('bigint')
+      local wei = decimal.fromunits(bigint.new("123456789012345678901234567890123456789"), 18)
+      local doubled = wei * 2
+      return table.concat({ tostring(wei), tostring(doubled / 2 == wei), tostring(doubled:div(7, "floor")) }, "|")
+    `);
+    assert.strictEqual(result, [
+      '123456789012345678901.234567890123456789', 'true', '35273368289241622543.209876540035273368',
+    ].join('|'));
+  });
+
+  it('Rejects malformed input', () => {
+    requireFeature(hasDecimal(), 'decimal module');
+    const { result } = run(`
+      local decimal = require('decimal')
+      local ok, err = pcall(decimal.new, "1.2.3")
+      local ok2, err2 = pcall(function() return decimal.new(1) / 0 end)
+      return tostring(ok) .. " " .. err .. "|" .. tostring(ok2) .. " " .. err2
+    `);
+    assert.match(result, /^false .*invalid decimal '1\.2\.3'\|false .*division failed/);
+  });
+});
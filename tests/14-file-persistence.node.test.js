@@ -0,0 +1,137 @@
+const { describe, it, before, beforeEach, afterEach } = require('node:test');
+const assert = require('node:assert');
+const fs = require('fs');
+const os = require('os');
+const path = require('path');
+
+describe('File persistence', () => {
+  let createNodeInstance;
+  let FilePersistence;
+  let module;
+  let dir;
+
+  before(async () => {
+    ({ createNodeInstance, FilePersistence } = await import('../web/cu-node.js'));
+    module = await WebAssembly.compile(fs.readFileSync(path.join(__dirname, '../web/cu.wasm')));
+  });
+
+  beforeEach(() => {
+    dir = fs.mkdtempSync(path.join(os.tmpdir(), 'cu-state-'));
+  });
+
+  afterEach(() => {
+    fs.rmSync(dir, { recursive: true, force: true });
+  });
+
+  function run(instance, code) {
+    const len = instance.compute(code);
+    if (len < 0) assert.fail(instance.readBuffer(instance.getBufferPtr(), -len));
+    return instance.readResult(instance.getBufferPtr(), len).result;
+  }
+
+  async function unit(options = {}) {
+    const instance = await createNodeInstance({ dir, module, sync: false, ...options });
+    instance.init();
+    return instance;
+  }
+
+  it('Restores _home from a snapshot in a new process', async () => {
+    const a = await unit({ autoRestore: false });
+    run(a, '_home.name = "cu"; _home.items = { 1, 2, 3 }; _home[7] = "seven"');
+    assert.strictEqual(await a.saveState(), true);
+    assert.ok(fs.existsSync(path.join(dir, 'snapshot.bin')));
+
+    const b = await unit();
+    assert.strictEqual(run(b, 'return _home.name .. #_home.items .. _home[7]'), 'cu3seven');
+  });
+
+  it('Replays journal records written after the snapshot', async () => {
+    const a = await unit({ autoRestore: false });
+    run(a, '_home.count = 1');
+    await a.saveState();
+    a.enableJournal({ compactEvery: 1000 });
+    run(a, '_home.count = _home.count + 1');
+    run(a, '_home.count = _home.count + 1; _home.extra = true');
+    await a.flushJournal();
+
+    const b = await unit();
+    assert.strictEqual(run(b, 'return _home.count'), 3);
+    assert.strictEqual(run(b, 'return _home.extra'), true);
+  });
+
+  it('Ignores a record cut short at the end of the journal', async () => {
+    const a = await unit({ autoRestore: false });
+    a.enableJournal({ compactEvery: 1000 });
+    run(a, '_home.step = 1');
+    run(a, '_home.step = 2');
+    await a.flushJournal();
+    const [journal] = fs.readdirSync(dir).filter((name) => name.startsWith('journal-'));
+    const file = path.join(dir, journal);
+    fs.truncateSync(file, fs.statSync(file).size - 3);
+
+    const b = await unit();
+    assert.strictEqual(run(b, 'return _home.step'), 1);
+  });
+
+  it('Copies unchanged tables into the next snapshot and drops the old journal', async () => {
+    const a = await unit({ autoRestore: false });
+    run(a, '_home.big = ext.table(); for i = 1, 50 do _home.big[i] = i * i end _home.small = 1');
+    await a.saveState();
+    a.enableJournal({ compactEvery: 1000 });
+    run(a, '_home.small = 2');
+    await a.flushJournal();
+    await a.saveState();
+    assert.deepStrictEqual(fs.readdirSync(dir).filter((name) => name.startsWith('journal-')), []);
+
+    const b = await unit({ lazyTables: true });
+    await b.tablesReady();
+    assert.strictEqual(run(b, 'return _home.small + _home.big[50]'), 2502);
+  });
+
+  it('Deflates snapshot tables with compress and still reads plain ones', async () => {
+    const a = await unit({ autoRestore: false });
+    run(a, '_home.text = string.rep("abcdefgh", 500)');
+    await a.saveState();
+    const plain = fs.statSync(path.join(dir, 'snapshot.bin')).size;
+
+    // Restores the plain snapshot, then writes a deflated one
+    const b = await unit({ compress: true });
+    run(b, '_home.more = 1');
+    await b.saveState();
+    assert.ok(fs.statSync(path.join(dir, 'snapshot.bin')).size < plain / 4);
+
+    const c = await unit({ lazyTables: true });
+    await c.tablesReady();
+    assert.strictEqual(run(c, 'return #_home.text + _home.more'), 4001);
+  });
+
+  it('Inflates compressed tables on restore workers', async () => {
+    const { RestoreWorkers } = await import('../web/cu-restore-workers.js');
+    const a = await unit({ autoRestore: false, compress: true });
+    run(a, 'for i = 1, 8 do _home["t" .. i] = { text = string.rep("table " .. i, 300) } end');
+    await a.saveState();
+
+    const workers = await RestoreWorkers.create({ size: 2 });
+    try {
+      const persistence = new FilePersistence(dir, { sync: false, workers });
+      const b = await unit({ persistence });
+      assert.strictEqual(run(b, 'return #_home.t3.text .. _home.t8.text:sub(1, 7)'), '2100table 8');
+      const c = await unit({ persistence: new FilePersistence(dir, { sync: false, workers }), lazyTables: true });
+      await c.tablesReady();
+      assert.strictEqual(run(c, 'return #_home.t5.text'), 2100);
+    } finally {
+      await workers.close();
+    }
+  });
+
+  it('Clears the directory', async () => {
+    const persistence = new FilePersistence(dir, { sync: false });
+    const a = await unit({ autoRestore: false, persistence });
+    run(a, '_home.gone = 1');
+    await a.saveState();
+    assert.strictEqual(await a.clearPersistedState(), true);
+
+    const b = await unit();
+    assert.strictEqual(run(b, 'return _home.gone'), null);
+  });
+});
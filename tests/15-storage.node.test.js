@@ -0,0 +1,191 @@
+const { describe, it, before } = require('node:test');
+const assert = require('node:assert');
+const fs = require('fs');
+const path = require('path');
+
+describe('Storage adapters', () => {
+  let CuInstance;
+  let StoragePersistence;
+  let MemoryStorage;
+  let KvStorage;
+  let CompressedPersistence;
+  let COMPRESSED;
+  let module;
+
+  before(async () => {
+    ({ CuInstance } = await import('../web/cu-instance.js'));
+    ({ StoragePersistence, MemoryStorage, KvStorage } = await import('../web/cu-storage.js'));
+    ({ CompressedPersistence, COMPRESSED } = await import('../web/cu-compression.js'));
+    module = await WebAssembly.compile(fs.readFileSync(path.join(__dirname, '../web/cu.wasm')));
+  });
+
+  function run(instance, code) {
+    const len = instance.compute(code);
+    if (len < 0) assert.fail(instance.readBuffer(instance.getBufferPtr(), -len));
+    return instance.readResult(instance.getBufferPtr(), len).result;
+  }
+
+  async function unit(storage, options = {}) {
+    const instance = await CuInstance.create({ module, persistence: new StoragePersistence(storage), ...options });
+    instance.init();
+    return instance;
+  }
+
+  // A flat KV client as an LMDB or remote KV binding would offer
+  function kvClient() {
+    const store = new Map();
+    return {
+      store,
+      get: async (key) => store.get(key),
+      set: async (key, value) => { store.set(key, value); },
+      delete: async (key) => { store.delete(key); },
+      keys: async (prefix) => Array.from(store.keys()).filter((key) => key.startsWith(prefix)),
+    };
+  }
+
+  for (const [name, make] of [['MemoryStorage', () => new MemoryStorage()], ['KvStorage', () => new KvStorage(kvClient())]]) {
+    it(`Saves and restores tables through ${name}`, async () => {
+      const storage = make();
+      const a = await unit(storage, { autoRestore: false });
+      run(a, '_home.name = "cu"; _home.list = { 10, 20 }; _home[3] = "three"');
+      assert.strictEqual(await a.saveState(), true);
+
+      const b = await unit(storage);
+      assert.strictEqual(run(b, 'return _home.name .. _home.list[2] .. _home[3]'), 'cu20three');
+      const c = await unit(storage, { lazyTables: true });
+      await c.tablesReady();
+      assert.strictEqual(run(c, 'return #_home.list'), 2);
+    });
+
+    it(`Writes each compute's changes as entries through ${name}`, async () => {
+      const storage = make();
+      const a = await unit(storage, { autoRestore: false });
+      run(a, '_home.keep = 1; _home.drop = 2');
+      await a.saveState();
+      a.enableJournal({ compactEvery: 1000 });
+      run(a, '_home.keep = _home.keep + 1; _home.drop = nil; _home.added = "x"');
+      await a.flushJournal();
+
+      // No saveState(): the store already has the changes
+      const b = await unit(storage);
+      assert.strictEqual(run(b, 'return _home.keep'), 2);
+      assert.strictEqual(run(b, 'return _home.drop'), null);
+      assert.strictEqual(run(b, 'return _home.added'), 'x');
+    });
+  }
+
+  it("Hands a compute's changes to an adapter's write() at once", async () => {
+    const storage = new MemoryStorage();
+    const writes = [];
+    storage.write = (changes, metadata) => {
+      writes.push(changes);
+      for (const [tableId, puts, deletes] of changes) {
+        storage.putEntries(tableId, puts);
+        storage.deleteEntries(tableId, deletes);
+      }
+      storage.putMetadata(metadata);
+    };
+    const a = await unit(storage, { autoRestore: false });
+    a.enableJournal({ compactEvery: 1000 });
+    run(a, '_home.a = 1; _home.b = 2');
+    await a.flushJournal();
+    assert.strictEqual(writes.length, 1);
+    assert.deepStrictEqual(writes[0][0][1].map(([key]) => key).sort(), ['a', 'b']);
+    assert.strictEqual(storage.getMetadata().homeTableId, a.homeTableId);
+  });
+
+  it('Stores large values compressed and restores them as they were', async () => {
+    const storage = new MemoryStorage();
+    const persistence = new CompressedPersistence(new StoragePersistence(storage));
+    const a = await unit(storage, { autoRestore: false, persistence });
+    run(a, '_home.text = string.rep("compressible ", 400); _home.small = "s"');
+    await a.saveState();
+    a.enableJournal({ compactEvery: 1000 });
+    run(a, '_home.later = string.rep("journaled ", 400)');
+    await a.flushJournal();
+
+    const home = await storage.getTable(a.homeTableId);
+    for (const key of ['text', 'later']) {
+      assert.strictEqual(home.get(key)[0], COMPRESSED);
+      assert.ok(home.get(key).byteLength < 400);
+    }
+    assert.notStrictEqual(home.get('small')[0], COMPRESSED);
+
+    const b = await unit(storage, { persistence: new CompressedPersistence(new StoragePersistence(storage)) });
+    assert.strictEqual(run(b, 'return #_home.text + #_home.later .. _home.small'), '9200s');
+  });
+
+  it('Stores function bytecode once and restores every copy', async () => {
+    const { FunctionStorePersistence, FUNCTION_HASHED, FUNCTION_TABLE_ID } = await import('../web/cu-function-store.js');
+    const storage = new MemoryStorage();
+    const a = await unit(storage, { autoRestore: false, persistence: new FunctionStorePersistence(new StoragePersistence(storage)) });
+    run(a, `
+      local function handler(x) local t = {} for i = 1, x do t[i] = i * i end return #t, t[x] end
+      for i = 1, 20 do _home["h" .. i] = handler end
+    `);
+    await a.saveState();
+    a.enableJournal({ compactEvery: 1000 });
+    run(a, '_home.other = function(s) return s:upper() .. "!" end; _home.h21 = _home.h1');
+    await a.flushJournal();
+
+    const home = await storage.getTable(a.homeTableId);
+    assert.strictEqual(home.get('h5')[0], FUNCTION_HASHED);
+    // handler under 21 keys, and other
+    assert.strictEqual((await storage.getTable(FUNCTION_TABLE_ID)).size, 2);
+
+    const b = await unit(storage, { persistence: new FunctionStorePersistence(new StoragePersistence(storage)) });
+    assert.strictEqual(run(b, 'local n, last = _home.h7(6); return n .. " " .. last .. " " .. _home.other("hi") .. " " .. select(2, _home.h21(3))'), '6 36 HI! 9');
+    const c = await unit(storage, { lazyTables: true, persistence: new FunctionStorePersistence(new StoragePersistence(storage)) });
+    await c.tablesReady();
+    assert.strictEqual(run(c, 'return _home.other("lazy")'), 'LAZY!');
+  });
+
+  it('Stores repeated strings once per snapshot', async () => {
+    const { StringDictionaryPersistence, STRING_INDEXED, STRING_TABLE_ID } = await import('../web/cu-string-dictionary.js');
+    const storage = new MemoryStorage();
+    const a = await unit(storage, { autoRestore: false, persistence: new StringDictionaryPersistence(new StoragePersistence(storage)) });
+    run(a, `
+      local states = { "pending-review", "shipped-to-customer" }
+      for i = 1, 30 do _home["o" .. i] = states[i % 2 + 1] end
+      _home.once = "only stored here"
+    `);
+    await a.saveState();
+    a.enableJournal({ compactEvery: 1000 });
+    run(a, '_home.o31 = "shipped-to-customer"; _home.o32 = "cancelled-by-user"');
+    await a.flushJournal();
+
+    const home = await storage.getTable(a.homeTableId);
+    assert.strictEqual(home.get('o5')[0], STRING_INDEXED);
+    assert.ok(home.get('o5').length <= 2);
+    assert.strictEqual(home.get('o31')[0], STRING_INDEXED);
+    assert.notStrictEqual(home.get('once')[0], STRING_INDEXED);
+    assert.notStrictEqual(home.get('o32')[0], STRING_INDEXED);
+    assert.strictEqual((await storage.getTable(STRING_TABLE_ID)).size, 2);
+
+    const persistence = new StringDictionaryPersistence(new StoragePersistence(storage));
+    const b = await unit(storage, { persistence });
+    assert.strictEqual(run(b, 'return _home.o1 .. " " .. _home.o2 .. " " .. _home.o31 .. " " .. _home.o32 .. " " .. _home.once'),
+      'shipped-to-customer pending-review shipped-to-customer cancelled-by-user only stored here');
+    const loaded = await persistence.loadTables();
+    const table = loaded.tables.get(a.homeTableId);
+    assert.strictEqual(table.get('o1'), table.get('o3'));
+    const c = await unit(storage, { lazyTables: true, persistence: new StringDictionaryPersistence(new StoragePersistence(storage)) });
+    await c.tablesReady();
+    assert.strictEqual(run(c, 'return _home.o4'), 'pending-review');
+  });
+
+  it('Batches a compute into one setMany when the client has it', async () => {
+    const client = kvClient();
+    let batches = 0;
+    client.setMany = async (pairs) => {
+      batches++;
+      for (const [key, value] of pairs) client.store.set(key, value);
+    };
+    const a = await unit(new KvStorage(client, { prefix: 'unit-1/' }), { autoRestore: false });
+    a.enableJournal({ compactEvery: 1000 });
+    run(a, 'for i = 1, 20 do _home["k" .. i] = i end');
+    await a.flushJournal();
+    assert.strictEqual(batches, 1);
+    assert.ok(Array.from(client.store.keys()).every((key) => key.startsWith('unit-1/')));
+  });
+});
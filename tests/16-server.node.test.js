@@ -0,0 +1,110 @@
+const { describe, it, before, after } = require('node:test');
+const assert = require('node:assert');
+const crypto = require('crypto');
+const fs = require('fs');
+const http = require('http');
+const path = require('path');
+
+describe('CuServer', () => {
+  let CuServer;
+  let MemoryStorage;
+  let module;
+  let server;
+  let port;
+  const stores = new Map();
+
+  before(async () => {
+    ({ CuServer } = await import('../web/cu-server.js'));
+    ({ MemoryStorage } = await import('../web/cu-storage.js'));
+    module = await WebAssembly.compile(fs.readFileSync(path.join(__dirname, '../web/cu.wasm')));
+    server = await CuServer.create({
+      module,
+      maxUnits: 1,
+      storage: (unit) => {
+        if (!stores.has(unit)) stores.set(unit, new MemoryStorage());
+        return stores.get(unit);
+      },
+    });
+    port = await server.listen(0);
+  });
+
+  after(async () => {
+    await server.close();
+  });
+
+  function post(body) {
+    return new Promise((resolve, reject) => {
+      const req = http.request({ port, method: 'POST', path: '/api/lua', headers: { 'Content-Type': 'application/json' } }, (res) => {
+        const chunks = [];
+        res.on('data', (chunk) => chunks.push(chunk));
+        res.on('end', () => resolve({ status: res.statusCode, body: JSON.parse(Buffer.concat(chunks).toString()) }));
+      });
+      req.on('error', reject);
+      req.end(JSON.stringify(body));
+    });
+  }
+
+  // A client frame: text, masked as RFC 6455 requires
+  function clientFrame(text) {
+    const payload = Buffer.from(text);
+    const mask = crypto.randomBytes(4);
+    const masked = Buffer.from(payload.map((byte, i) => byte ^ mask[i & 3]));
+    const header = payload.length < 126
+      ? Buffer.from([0x81, 0x80 | payload.length])
+      : Buffer.from([0x81, 0x80 | 126, payload.length >> 8, payload.length & 0xff]);
+    return Buffer.concat([header, mask, masked]);
+  }
+
+  function connect() {
+    return new Promise((resolve, reject) => {
+      const req = http.request({
+        port,
+        path: '/ws',
+        headers: { Connection: 'Upgrade', Upgrade: 'websocket', 'Sec-WebSocket-Key': crypto.randomBytes(16).toString('base64'), 'Sec-WebSocket-Version': '13' },
+      });
+      req.on('upgrade', (res, socket) => resolve(socket));
+      req.on('error', reject);
+      req.end();
+    });
+  }
+
+  it('Keeps each unit in its storage across evictions', async () => {
+    assert.deepStrictEqual((await post({ unit: 'a', code: '_home.n = (_home.n or 0) + 1; return _home.n' })).body.result, 1);
+    // maxUnits is 1: b evicts a, which comes back from its storage
+    assert.deepStrictEqual((await post({ unit: 'b', code: '_home.n = 10; return _home.n' })).body.result, 10);
+    const again = await post({ unit: 'a', code: '_home.n = _home.n + 1; return _home.n' });
+    assert.strictEqual(again.status, 200);
+    assert.strictEqual(again.body.result, 2);
+    assert.ok(stores.get('a') && stores.get('b'));
+    assert.strictEqual((await post({ unit: 'a' })).status, 400);
+  });
+
+  it('Answers pipelined WebSocket requests by id', async () => {
+    const socket = await connect();
+    const replies = new Map();
+    let buffered = Buffer.alloc(0);
+    const done = new Promise((resolve) => {
+      socket.on('data', (data) => {
+        buffered = Buffer.concat([buffered, data]);
+        // Server frames here are small and unmasked
+        while (buffered.length >= 2 && buffered.length >= 2 + buffered[1]) {
+          const reply = JSON.parse(buffered.subarray(2, 2 + buffered[1]).toString());
+          buffered = buffered.subarray(2 + buffered[1]);
+          replies.set(reply.id, reply);
+          if (replies.size === 4) resolve();
+        }
+      });
+    });
+    for (let id = 1; id <= 4; id++) {
+      socket.write(clientFrame(JSON.stringify({ id, unit: `w${id % 2}`, code: `return ${id} * 2` })));
+    }
+    await done;
+    socket.destroy();
+    assert.deepStrictEqual([1, 2, 3, 4].map((id) => replies.get(id).result), [2, 4, 6, 8]);
+
+    const stats = server.stats();
+    assert.strictEqual(stats.requests, 7);
+    assert.ok(stats.p99LatencyMs >= stats.p50LatencyMs);
+    assert.ok(stats.units <= 1);
+  });
+});
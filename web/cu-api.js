@@ -7,286 +7,100 @@
  *   await cu.load();
  *   cu.init();
  *   const result = cu.compute('return 1+1');
+ *
+ * These functions drive one default CuInstance (see cu-instance.js);
+ * create more CuInstance objects to host several isolated VMs.
  */
 
-import { deserializeResult } from './cu-deserializer.js';
-import persistence from './cu-persistence.js';
-
-let wasmInstance = null;
-let wasmMemory = null;
+import { CuInstance, ErrorCodes } from './cu-instance.js';
+import { log, setLogger, onMetric, LogLevel } from './cu-log.js';
 
-// External table storage
-const externalTables = new Map();
-let nextTableId = 1;
-let homeTableId = null; // Renamed from memoryTableId
-let ioTableId = null; // For _io external table
-let stateRestored = false;
+import { compileModule, clearModuleCache } from './cu-module.js';
 
-// Table name constants
-const HOME_TABLE_NAME = '_home';
-const LEGACY_MEMORY_NAME = 'Memory';
+export { CuInstance, ErrorCodes, setLogger, onMetric, LogLevel, compileModule, clearModuleCache };
 
-// Feature flags
-let memoryAliasEnabled = false; // Controls backward compatibility with "Memory" name
+const textEncoder = new TextEncoder();
 
-function ensureExternalTable(tableId) {
-  const id = Number(tableId);
-  if (!externalTables.has(id)) {
-    externalTables.set(id, new Map());
-  }
-  if (id >= nextTableId) {
-    nextTableId = id + 1;
-  }
-  return externalTables.get(id);
-}
-
-function getMaxTableId() {
-  let maxId = 0;
-  for (const id of externalTables.keys()) {
-    if (id > maxId) {
-      maxId = id;
-    }
-  }
-  return maxId;
-}
+const instance = new CuInstance();
 
 /**
- * Check for deprecated WASM path and warn user
- * @param {string} wasmPath - Path to check
+ * The CuInstance behind this module's functions
+ * @returns {CuInstance}
  */
-function checkDeprecatedPath(wasmPath) {
-  if (wasmPath && wasmPath.includes('lua.wasm')) {
-    console.warn(
-      '[DEPRECATED] lua.wasm is deprecated and will be removed in v3.0. ' +
-      'Please update to cu.wasm. See: https://github.com/twilson63/cu#migration'
-    );
-  }
+export function getDefaultInstance() {
+  return instance;
 }
 
-async function restorePersistedTables() {
-  try {
-    const { tables, metadata } = await persistence.loadTables();
-
-    externalTables.clear();
-    nextTableId = 1;
-    homeTableId = null;
-
-    for (const [id, entries] of tables) {
-      const numericId = Number(id);
-      const tableMap = ensureExternalTable(numericId);
-      tableMap.clear();
-      for (const [key, value] of entries) {
-        tableMap.set(key, value);
-      }
-    }
-
-    if (metadata) {
-      // Try new homeTableId first, fall back to legacy memoryTableId
-      if (metadata.homeTableId !== undefined && metadata.homeTableId !== null) {
-        homeTableId = Number(metadata.homeTableId);
-      } else if (metadata.memoryTableId !== undefined && metadata.memoryTableId !== null) {
-        homeTableId = Number(metadata.memoryTableId);
-        console.warn('[Deprecated] Using legacy "memoryTableId" - please migrate to "homeTableId"');
-      }
-      if (metadata.nextTableId !== undefined && metadata.nextTableId !== null) {
-        const hint = Number(metadata.nextTableId);
-        if (!Number.isNaN(hint) && hint > nextTableId) {
-          nextTableId = hint;
-        }
-      }
-    }
-
-    if (homeTableId && homeTableId > 0) {
-      ensureExternalTable(homeTableId);
-    }
-
-    const maxId = getMaxTableId();
-    if (nextTableId <= maxId) {
-      nextTableId = maxId + 1;
-    }
-
-    stateRestored = tables.size > 0;
-    return true;
-  } catch (error) {
-    console.warn('Failed to restore persisted tables:', error);
-    stateRestored = false;
-    homeTableId = null;
-    nextTableId = Math.max(1, nextTableId);
-    return false;
-  }
+/**
+ * @returns {Promise<void>} Resolves once every table a lazy restore
+ *   (load({ lazyTables: true })) left loading in the background is in place
+ */
+export function tablesReady() {
+  return instance.tablesReady();
 }
 
 /**
  * Load and instantiate Cu WASM module
+ * @param {Object} [options]
+ * @param {boolean} [options.autoRestore=true] - Restore persisted tables first
+ * @param {boolean} [options.lazyTables=false] - Restore only _home and
+ *   prefetchTables up front, and the other tables in the background
+ * @param {Array<number>} [options.prefetchTables=[]] - Further hot tables
+ * @param {string} [options.wasmPath='./cu.wasm'] - Where to fetch the module
+ * @param {boolean} [options.cacheModule=true] - Reuse the module compiled
+ *   from wasmPath by an earlier load()
+ * @param {WebAssembly.Module} [options.module] - Compiled module to use
+ *   instead of fetching wasmPath
  * @returns {Promise<boolean>} Success status
  */
-export async function load(options = {}) {
-  try {
-    const { autoRestore = true } = options;
-    if (autoRestore) {
-      await restorePersistedTables();
-    } else {
-      externalTables.clear();
-      nextTableId = 1;
-      homeTableId = null;
-      stateRestored = false;
-    }
-
-    const wasmPath = options.wasmPath || './cu.wasm';
-    checkDeprecatedPath(wasmPath);
-    
-    const response = await fetch(wasmPath);
-    if (!response.ok) {
-      throw new Error(`Failed to fetch WASM: ${response.statusText}`);
-    }
-    const buffer = await response.arrayBuffer();
-
-    const imports = {
-      env: {
-        js_time_now: () => Date.now(),
-        js_ext_table_set: (table_id, key_ptr, key_len, val_ptr, val_len) => {
-          try {
-            const table = ensureExternalTable(table_id);
-
-            const key = new TextDecoder().decode(wasmMemory.slice(key_ptr, key_ptr + key_len));
-            // Store raw binary data to preserve function bytecode
-            const valueBytes = wasmMemory.slice(val_ptr, val_ptr + val_len);
-            const valueCopy = new Uint8Array(valueBytes);
-
-            table.set(key, valueCopy);
-            return 0;
-          } catch (e) {
-            console.error('js_ext_table_set error:', e);
-            return -1;
-          }
-        },
-        js_ext_table_get: (table_id, key_ptr, key_len, val_ptr, max_len) => {
-          try {
-            const table = externalTables.get(table_id);
-            if (!table) return -1;
-
-            const key = new TextDecoder().decode(wasmMemory.slice(key_ptr, key_ptr + key_len));
-            const value = table.get(key);
-
-            if (value === undefined) return -1;
-
-            // Handle binary data (Uint8Array) or legacy string data
-            let valueBytes;
-            if (value instanceof Uint8Array) {
-              valueBytes = value;
-            } else if (typeof value === 'string') {
-              // Legacy support for old string values
-              valueBytes = new TextEncoder().encode(value);
-            } else {
-              return -1;
-            }
-
-            if (valueBytes.length > max_len) return -1;
-
-            for (let i = 0; i < valueBytes.length; i++) {
-              wasmMemory[val_ptr + i] = valueBytes[i];
-            }
-
-            return valueBytes.length;
-          } catch (e) {
-            console.error('js_ext_table_get error:', e);
-            return -1;
-          }
-        },
-        js_ext_table_delete: (table_id, key_ptr, key_len) => {
-          try {
-            const table = externalTables.get(table_id);
-            if (!table) return -1;
-
-            const key = new TextDecoder().decode(wasmMemory.slice(key_ptr, key_ptr + key_len));
-            table.delete(key);
-            return 0;
-          } catch (e) {
-            console.error('js_ext_table_delete error:', e);
-            return -1;
-          }
-        },
-        js_ext_table_size: (table_id) => {
-          const table = externalTables.get(table_id);
-          return table ? table.size : 0;
-        },
-        js_ext_table_keys: (table_id, buf_ptr, max_len) => {
-          try {
-            const table = externalTables.get(table_id);
-            if (!table) return -1;
-
-            const keys = Array.from(table.keys()).join('\n');
-            const keysBytes = new TextEncoder().encode(keys);
-
-            if (keysBytes.length > max_len) return -1;
-
-            for (let i = 0; i < keysBytes.length; i++) {
-              wasmMemory[buf_ptr + i] = keysBytes[i];
-            }
-
-            return keysBytes.length;
-          } catch (e) {
-            console.error('js_ext_table_keys error:', e);
-            return -1;
-          }
-        },
-      },
-    };
-
-    const module = new WebAssembly.Module(buffer);
-    wasmInstance = new WebAssembly.Instance(module, imports);
-    wasmMemory = new Uint8Array(wasmInstance.exports.memory.buffer);
-
-    console.log('✅ Cu WASM loaded successfully');
-    return true;
-  } catch (error) {
-    console.error('❌ Load failed:', error);
-    throw error;
-  }
+export function load(options = {}) {
+  return instance.load(options);
 }
 
 /**
  * Initialize Lua VM
+ * @param {Object} options - Optional heap configuration
+ * @param {number} options.heapBytes - Lua heap committed at init
+ * @param {number} options.maxHeapBytes - Cap the heap may grow to on demand
  * @returns {number} Status code (0 = success)
  */
-export function init() {
-  if (!wasmInstance) {
-    throw new Error('WASM not loaded. Call loadLuaWasm() first');
-  }
-  try {
-    const result = wasmInstance.exports.init?.() ?? 0;
-
-    // Get the _home table ID from WASM
-    const exportedId = wasmInstance.exports.get_memory_table_id?.() ?? 0;
-    if (homeTableId && homeTableId !== exportedId && wasmInstance.exports.attach_memory_table) {
-      wasmInstance.exports.attach_memory_table(homeTableId);
-    } else if (!homeTableId && exportedId > 0) {
-      homeTableId = exportedId;
-    }
+export function init(options = {}) {
+  return instance.init(options);
+}
 
-    const confirmedId = wasmInstance.exports.get_memory_table_id?.() ?? exportedId;
-    if (confirmedId > 0) {
-      homeTableId = confirmedId;
-      ensureExternalTable(homeTableId);
-    }
+/**
+ * Capture the VM between calls (typically after init() and bootstrap code)
+ * so new instances can start from it: CuInstance.fromSnapshot(snapshot)
+ * @returns {Object} Snapshot; treat as opaque and immutable
+ */
+export function snapshot() {
+  return instance.snapshot();
+}
 
-    const maxId = getMaxTableId();
-    if (maxId >= nextTableId) {
-      nextTableId = maxId + 1;
-    }
-    if (homeTableId && homeTableId >= nextTableId) {
-      nextTableId = homeTableId + 1;
-    }
+/**
+ * Replace the VM and its tables with a copy of a snapshot()
+ * @param {Object} snapshot
+ */
+export function restoreSnapshot(snapshot) {
+  instance.restoreSnapshot(snapshot);
+}
 
-    if (wasmInstance.exports.sync_external_table_counter) {
-      wasmInstance.exports.sync_external_table_counter(nextTableId);
-    }
+/**
+ * The whole VM as compressed bytes, to store or restore in another process
+ * with the same cu.wasm; see CuInstance.checkpoint
+ * @returns {Promise<Uint8Array>}
+ */
+export function checkpoint() {
+  return instance.checkpoint();
+}
 
-    return result;
-  } catch (error) {
-    console.error('init() error:', error);
-    return 0;
-  }
+/**
+ * Replace the VM and its tables with those of a checkpoint()
+ * @param {Uint8Array} bytes
+ * @returns {Promise<void>}
+ */
+export function restoreCheckpoint(bytes) {
+  return instance.restoreCheckpoint(bytes);
 }
 
 /**
@@ -300,92 +114,93 @@ export async function compute(code) {
   }
 
   try {
-    // First, try the WASM implementation (if exports exist)
-    if (wasmInstance && wasmInstance.exports.compute) {
-      const bufPtr = getBufferPtr();
-      const encoder = new TextEncoder();
-      const codeBytes = encoder.encode(code);
-      const bufSize = getBufferSize();
-
-      if (codeBytes.length > bufSize) {
-        throw new Error(`Code too large (${codeBytes.length} > ${bufSize})`);
-      }
-
-      for (let i = 0; i < codeBytes.length; i++) {
-        wasmMemory[bufPtr + i] = codeBytes[i];
-      }
-
-      const result = wasmInstance.exports.compute(bufPtr, codeBytes.length);
-      console.log(`WASM compute() returned: ${result} bytes`);
-      return result;
-    }
-
-    // Fallback: Use server-side Lua execution
-    console.log('Using server-side Lua execution...');
-    const response = await fetch('/api/lua', {
-      method: 'POST',
-      headers: { 'Content-Type': 'application/json' },
-      body: JSON.stringify({ code })
-    });
+    if (instance.pendingTables.size > 0) await instance.tablesReady();
 
-    if (!response.ok) {
-      throw new Error(`Server error: ${response.status}`);
+    if (!instance.wasmInstance?.exports.compute) {
+      throw new Error('WASM module not loaded; call load() first');
     }
-
-    const data = await response.json();
-    const output = data.result || '';
-    
-    // Store result in buffer
-    const bufPtr = getBufferPtr();
-    const encoder = new TextEncoder();
-    const outputBytes = encoder.encode(output);
-    const bufSize = getBufferSize();
-
-    if (outputBytes.length > bufSize) {
-      // Truncate if too large
-      for (let i = 0; i < bufSize; i++) {
-        wasmMemory[bufPtr + i] = outputBytes[i];
-      }
-      return bufSize;
-    }
-
-    for (let i = 0; i < outputBytes.length; i++) {
-      wasmMemory[bufPtr + i] = outputBytes[i];
-    }
-
-    console.log(`Server returned ${outputBytes.length} bytes`);
-    return outputBytes.length;
+    return instance.compute(code);
   } catch (error) {
-    console.error('compute() error:', error);
+    log('error', 'compute() error:', error);
     // Return error message as buffer content
     const bufPtr = getBufferPtr();
-    const encoder = new TextEncoder();
+    const bufSize = getBufferSize();
     const errorMsg = `Error: ${error.message}`;
-    const errorBytes = encoder.encode(errorMsg);
-    
-    for (let i = 0; i < Math.min(errorBytes.length, getBufferSize()); i++) {
-      wasmMemory[bufPtr + i] = errorBytes[i];
-    }
-    
-    return -Math.min(errorBytes.length, getBufferSize());
+    const { written } = textEncoder.encodeInto(errorMsg, instance.memoryView().subarray(bufPtr, bufPtr + bufSize));
+
+    return -written;
   }
 }
 
+/**
+ * Call a Lua function by name without compiling any source
+ * @param {string} name - Global function or dotted path (e.g. 'handler',
+ *   '_home.handlers.ping'); bare names also resolve against _home
+ * @param {Array} [args=[]] - Arguments, serialized like _io values
+ * @returns {number} Result length in buffer (negative on error), as compute()
+ */
+export function call(name, args = []) {
+  return instance.call(name, args);
+}
+
+/**
+ * Run Lua source that may suspend at host.await(op, args) until
+ * `handler(op, args)` settles; see CuInstance.computeAsync
+ * @param {string} code
+ * @param {function(string, *): *} handler
+ * @returns {Promise<{status: number, output: string, result: *, results: Array}>}
+ */
+export function computeAsync(code, handler) {
+  return instance.computeAsync(code, handler);
+}
+
+/**
+ * Run the sched library's ready tasks for up to `budgetMs` milliseconds;
+ * see CuInstance.schedTick
+ * @param {number} [budgetMs=0]
+ * @returns {{status: number, output: string, next: number|null}}
+ */
+export function schedTick(budgetMs = 0) {
+  return instance.schedTick(budgetMs);
+}
+
+/**
+ * Run several scripts and/or named calls in a single WASM call
+ * @param {Array<string|{call: string, args?: Array}>} items - Lua source
+ *   strings, or named calls as accepted by call()
+ * @returns {Array<{status: number, output?: string, result?: *, error?: string}>}
+ *   One entry per item that ran, in order (fewer than items.length if the
+ *   result buffer filled up)
+ */
+export function computeBatch(items) {
+  return instance.computeBatch(items);
+}
+
 /**
  * Get input/output buffer pointer
  * @returns {number} Buffer address
  */
 export function getBufferPtr() {
-  if (!wasmInstance) {
-    throw new Error('WASM not loaded');
-  }
-  try {
-    const ptr = wasmInstance.exports.get_buffer_ptr?.() ?? 0;
-    return ptr;
-  } catch (error) {
-    console.error('getBufferPtr() error:', error);
-    return 0;
-  }
+  return instance.getBufferPtr();
+}
+
+/**
+ * Where the last successful compute() or call() left its results; see
+ * CuInstance.getResultPtr
+ * @returns {number} Address
+ */
+export function getResultPtr() {
+  return instance.getResultPtr();
+}
+
+/**
+ * Encode results into a growing region instead of the I/O buffer; see
+ * CuInstance.setResultRegion
+ * @param {number|false} bytes - Initial region size; false or 0 turns it off
+ * @returns {boolean} False if this build has no result regions
+ */
+export function setResultRegion(bytes) {
+  return instance.setResultRegion(bytes);
 }
 
 /**
@@ -393,56 +208,274 @@ export function getBufferPtr() {
  * @returns {number} Size in bytes (64KB)
  */
 export function getBufferSize() {
-  if (!wasmInstance) {
-    throw new Error('WASM not loaded');
-  }
-  try {
-    const size = wasmInstance.exports.get_buffer_size?.() ?? 65536;
-    return size;
-  } catch (error) {
-    console.error('getBufferSize() error:', error);
-    return 65536;
-  }
+  return instance.getBufferSize();
 }
 
 /**
  * Get memory statistics
- * @returns {object} Memory stats with total, used, free
+ * @returns {object} Memory stats: total/used/free for the Lua heap, plus
+ *   luaBytes (live bytes reported by the collector) and allocator telemetry
  */
 export function getMemoryStats() {
-  if (!wasmInstance) {
-    throw new Error('WASM not loaded');
-  }
-  try {
-    if (!wasmMemory) {
-      return { total: 0, used: 0, free: 0 };
-    }
-    const total = wasmMemory.length;
-    const used = Math.floor(total * 0.6);
-    const free = total - used;
-    return { total, used, free };
-  } catch (error) {
-    console.error('getMemoryStats() error:', error);
-    return { total: 0, used: 0, free: 0 };
-  }
+  return instance.getMemoryStats();
 }
 
 /**
- * Run garbage collection
+ * Get hot-path counters: parse and execute time, invocations, external table
+ * reads and writes, serialization, function loads, allocations and GC steps
+ * @param {object} [options]
+ * @param {boolean} [options.reset=false] Start the counters over after reading
+ * @returns {object|null} Counters, or null if this build does not count them
+ */
+export function getPerfCounters(options) {
+  return instance.getPerfCounters(options);
+}
+
+/**
+ * Count the objects on the Lua heap by kind, with the bytes each kind holds
+ * @returns {object|null} { totalBytes, objectBytes, kinds }, or null if this
+ *   build has no census
+ */
+export function getHeapCensus() {
+  return instance.getHeapCensus();
+}
+
+/**
+ * Get allocations by type, from a build made with CU_ALLOC_PROFILE=1
+ * @param {object} [options]
+ * @param {boolean} [options.reset=false] Start the allocation counts over
+ * @returns {object|null} Per type counts, or null if this build does not
+ *   profile allocations
+ */
+export function getAllocProfile(options) {
+  return instance.getAllocProfile(options);
+}
+
+/**
+ * Sampling profiler: profile.start({ period }) records the Lua stack every
+ * `period` instructions (default 10000) from the next compute() on, and
+ * profile.stop() returns the samples as folded stacks for flamegraph tools
+ */
+export const profile = {
+  start(options) {
+    return instance.startProfile(options);
+  },
+  stop() {
+    return instance.stopProfile();
+  },
+};
+
+/**
+ * External table call tracing: bridgeTrace.start({ capacity }) records each
+ * _home / _io / ext.table() call into the host, bridgeTrace.summary({ top })
+ * reports the busiest operations, tables and keys, and bridgeTrace.stop()
+ * returns the summary and stops recording
+ */
+export const bridgeTrace = {
+  start(options) {
+    return instance.startBridgeTrace(options);
+  },
+  summary(options) {
+    return instance.getBridgeTrace(options);
+  },
+  stop(options) {
+    return instance.stopBridgeTrace(options);
+  },
+};
+
+/**
+ * Run the Lua garbage collector
+ * @param {string} [mode='collect'] 'collect' (full cycle), 'step' (one
+ *   incremental step), 'generational' or 'incremental' (switch collector mode)
+ * @param {number} [stepKb=0] Work per step in KB when mode is 'step'
  * @returns {boolean} Success
  */
-export function runGc() {
-  if (!wasmInstance) {
-    throw new Error('WASM not loaded');
-  }
-  try {
-    wasmInstance.exports.run_gc?.();
-    console.log('runGc() completed');
-    return true;
-  } catch (error) {
-    console.error('runGc() error:', error);
-    return false;
-  }
+export function runGc(mode = 'collect', stepKb = 0) {
+  return instance.runGc(mode, stepKb);
+}
+
+/**
+ * Bring the heap back to its live extent after a spike; snapshot() and
+ * checkpoint() do this first
+ * @returns {number|null} Bytes trimmed off the top of the heap, or null if
+ *   this build cannot trim
+ */
+export function trimHeap() {
+  return instance.trimHeap();
+}
+
+/**
+ * Answer repeated call()s to pure handlers from a host-side cache until a
+ * table they read changes (see CuInstance.setResponseCache)
+ * @param {object|null} options - { handlers, maxEntries }; null turns it off
+ */
+export function setResponseCache(options) {
+  instance.setResponseCache(options);
+}
+
+/**
+ * @returns {{hits: number, misses: number, entries: number}|null}
+ */
+export function getResponseCacheStats() {
+  return instance.getResponseCacheStats();
+}
+
+/**
+ * Compile hot numeric Lua functions to WebAssembly in a CU_TIER=1 build
+ * (see CuInstance.setTiering)
+ * @param {object|null} options - { threshold }; null stops compiling
+ * @returns {boolean} False if this build cannot compile functions
+ */
+export function setTiering(options) {
+  return instance.setTiering(options);
+}
+
+/**
+ * @returns {{compiled: number, declined: number, released: number, active: number}|null}
+ */
+export function getTieringStats() {
+  return instance.getTieringStats();
+}
+
+/**
+ * Set resource limits applied to every subsequent compute() call
+ * @param {object} limits
+ * @param {number} [limits.maxBytes=0] Max net heap growth per call (0 = unlimited)
+ * @param {number} [limits.maxInstructions=0] Max VM instructions per call (0 = unlimited)
+ * @returns {boolean} False if this build has no budget support
+ */
+export function setComputeLimits(limits = {}) {
+  return instance.setComputeLimits(limits);
+}
+
+/**
+ * Set the clock a deterministic-mode VM reads; see CuInstance.setVirtualClock
+ * @param {number} nowMs - Milliseconds since the epoch
+ * @returns {boolean} False if this build has no deterministic mode
+ */
+export function setVirtualClock(nowMs) {
+  return instance.setVirtualClock(nowMs);
+}
+
+/**
+ * Poll `check` during compute() and call(); see CuInstance.setInterruptCheck
+ * @param {Function|null} check - Returns true to interrupt; null stops polling
+ * @returns {boolean} False if this build cannot poll for interrupts
+ */
+export function setInterruptCheck(check) {
+  return instance.setInterruptCheck(check);
+}
+
+/**
+ * Stream print output to `handler`; see CuInstance.setOutputStreaming
+ * @param {Function|null} handler - Called with each piece of output
+ * @param {object} [options]
+ * @param {number} [options.chunkBytes=4096] - Bytes buffered per call
+ * @returns {boolean} False if this build cannot stream output
+ */
+export function setOutputStreaming(handler, options = {}) {
+  return instance.setOutputStreaming(handler, options);
+}
+
+/**
+ * Stop the running compute() or call() (see CuInstance.interrupt)
+ * @returns {boolean} False if this build has no interrupt word
+ */
+export function interrupt() {
+  return instance.interrupt();
+}
+
+/**
+ * Error code of the last compute() call (see ErrorCodes)
+ * @returns {number}
+ */
+export function getLastErrorCode() {
+  return instance.getLastErrorCode();
+}
+
+/**
+ * The last error with its code, chunk, line and traceback (see
+ * CuInstance.getLastError)
+ * @returns {{code: number, message: string, chunk: string, line: number, traceback: string}|null}
+ */
+export function getLastError() {
+  return instance.getLastError();
+}
+
+/**
+ * Keep a traceback of each failing call for getLastError()
+ * @param {boolean} enabled
+ * @returns {boolean} False if this build cannot take tracebacks
+ */
+export function setErrorTraceback(enabled) {
+  return instance.setErrorTraceback(enabled);
+}
+
+/**
+ * Compiled-chunk cache counters for compute()
+ * @returns {{hits: number, misses: number}}
+ */
+export function getChunkCacheStats() {
+  return instance.getChunkCacheStats();
+}
+
+/**
+ * Drop all compiled chunks; the next compute() of any source recompiles it
+ */
+export function clearChunkCache() {
+  instance.clearChunkCache();
+}
+
+/**
+ * Choose where external table entries live
+ * @param {'host'|'native'} backend - 'host' crosses into JS on every access;
+ *   'native' caches entries in WASM memory and writes changes back to the
+ *   host Map after each compute/call
+ * @param {Object} [options]
+ * @param {number} [options.maxBytes=0] - Cap on natively cached bytes (0 = default)
+ * @returns {boolean} false if the loaded build has no native backend
+ */
+export function setExtTableBackend(backend, options = {}) {
+  return instance.setExtTableBackend(backend, options);
+}
+
+/**
+ * Read counters for the native external table backend
+ * @returns {{hits: number, misses: number}}
+ */
+export function getExtTableStats() {
+  return instance.getExtTableStats();
+}
+
+/**
+ * Cap the entries of a Lua table stored into an external table
+ * @param {number} entries - Entry limit per table (0 restores the default of 10000)
+ * @returns {boolean} false if the loaded build has a fixed limit
+ */
+export function setMaxTableEntries(entries) {
+  return instance.setMaxTableEntries(entries);
+}
+
+/**
+ * Limit how far Lua can grow each external table; writes past a limit
+ * raise "external table quota exceeded" in Lua
+ * @param {Object} [quota] - No argument removes the quota
+ * @param {number} [quota.maxEntries=0] - Entries per table (0: no limit)
+ * @param {number} [quota.maxBytes=0] - Value bytes per table (0: no limit)
+ */
+export function setTableQuota(quota) {
+  instance.setTableQuota(quota);
+}
+
+/**
+ * Store small nested tables by value instead of as external tables
+ * @param {Object} limits
+ * @param {number} limits.maxEntries - Entries per inlined table (0 turns inlining off)
+ * @param {number} limits.maxBytes - Encoded bytes per inlined table, at most 4096
+ * @returns {boolean} false if the loaded build cannot inline tables
+ */
+export function setInlineTableLimits(limits) {
+  return instance.setInlineTableLimits(limits);
 }
 
 /**
@@ -452,19 +485,7 @@ export function runGc() {
  * @returns {string} Decoded string
  */
 export function readBuffer(ptr, len) {
-  if (!wasmMemory) {
-    throw new Error('WASM not loaded');
-  }
-  try {
-    if (ptr < 0 || len < 0 || ptr + len > wasmMemory.length) {
-      throw new Error('Invalid buffer range');
-    }
-    const buffer = wasmMemory.slice(ptr, ptr + len);
-    return new TextDecoder().decode(buffer);
-  } catch (error) {
-    console.error('readBuffer() error:', error);
-    return '';
-  }
+  return instance.readBuffer(ptr, len);
 }
 
 /**
@@ -474,19 +495,17 @@ export function readBuffer(ptr, len) {
  * @returns {{output: string, result: any}} Deserialized result
  */
 export function readResult(ptr, len) {
-  if (!wasmMemory) {
-    throw new Error('WASM not loaded');
-  }
-  try {
-    if (ptr < 0 || len < 0 || ptr + len > wasmMemory.length) {
-      throw new Error('Invalid buffer range');
-    }
-    const buffer = wasmMemory.slice(ptr, ptr + len);
-    return deserializeResult(buffer, len);
-  } catch (error) {
-    console.error('readResult() error:', error);
-    return { output: '', result: null };
-  }
+  return instance.readResult(ptr, len);
+}
+
+/**
+ * Read a result in place, valid until the next run
+ * @param {number} ptr - Buffer pointer
+ * @param {number} len - Bytes to read
+ * @returns {ResultView} See CuInstance.readResultView
+ */
+export function readResultView(ptr, len) {
+  return instance.readResultView(ptr, len);
 }
 
 /**
@@ -496,149 +515,92 @@ export function readResult(ptr, len) {
  * @returns {number} Bytes written
  */
 export function writeBuffer(ptr, data) {
-  if (!wasmMemory) {
-    throw new Error('WASM not loaded');
-  }
-  try {
-    const encoder = new TextEncoder();
-    const bytes = encoder.encode(data);
-    if (ptr < 0 || ptr + bytes.length > wasmMemory.length) {
-      throw new Error('Buffer overflow');
-    }
-    for (let i = 0; i < bytes.length; i++) {
-      wasmMemory[ptr + i] = bytes[i];
-    }
-    return bytes.length;
-  } catch (error) {
-    console.error('writeBuffer() error:', error);
-    throw error;
-  }
+  return instance.writeBuffer(ptr, data);
 }
 
 /**
- * Save all external tables to IndexedDB
+ * Journal every compute: the _home changes it made are appended to
+ * IndexedDB as one record, so they survive a crash without a full
+ * saveState(). Every compactEvery records the journal is folded into a
+ * snapshot. loadState() and autoRestore replay the journal.
+ * @param {Object} [options]
+ * @param {number} [options.compactEvery=100] - Records between snapshots
  */
-export async function saveState() {
-  try {
-    const metadata = {
-      homeTableId,
-      memoryTableId: homeTableId, // Keep alias for backward compatibility
-      nextTableId,
-      savedAt: new Date().toISOString(),
-      stateRestored,
-    };
-    await persistence.saveTables(externalTables, metadata);
-    return true;
-  } catch (error) {
-    console.error('Failed to save state:', error);
-    return false;
-  }
+export function enableJournal(options = {}) {
+  instance.enableJournal(options);
 }
 
 /**
- * Load external tables from IndexedDB
+ * Stop journaling
+ * @returns {Promise<void>} Resolves once journal writes already made land
  */
-export async function loadState() {
-  try {
-    const { tables, metadata } = await persistence.loadTables();
-
-    externalTables.clear();
-    nextTableId = 1;
-    homeTableId = null;
-
-    for (const [id, table] of tables) {
-      const numericId = Number(id);
-      const tableMap = ensureExternalTable(numericId);
-      tableMap.clear();
-      for (const [key, value] of table) {
-        tableMap.set(key, value);
-      }
-    }
+export function disableJournal() {
+  return instance.disableJournal();
+}
 
-    if (metadata) {
-      // Try new homeTableId first, fall back to legacy memoryTableId
-      if (metadata.homeTableId !== undefined && metadata.homeTableId !== null) {
-        homeTableId = Number(metadata.homeTableId);
-      } else if (metadata.memoryTableId !== undefined && metadata.memoryTableId !== null) {
-        homeTableId = Number(metadata.memoryTableId);
-        console.warn('[Deprecated] Using legacy "memoryTableId" - please migrate to "homeTableId"');
-      }
-      if (metadata.nextTableId !== undefined && metadata.nextTableId !== null) {
-        const hint = Number(metadata.nextTableId);
-        if (!Number.isNaN(hint) && hint > nextTableId) {
-          nextTableId = hint;
-        }
-      }
-    }
+/**
+ * Subscribe to external table changes; see CuInstance.onChanges
+ * @param {Function} handler - Called with each compute's change records
+ * @param {Object} [options]
+ * @param {boolean} [options.values=false] - Decode each value
+ * @returns {Function} Call to unsubscribe
+ */
+export function onChanges(handler, options = {}) {
+  return instance.onChanges(handler, options);
+}
 
-    const maxId = getMaxTableId();
-    if (nextTableId <= maxId) {
-      nextTableId = maxId + 1;
-    }
+/**
+ * @returns {Promise<void>} Resolves once every journal record written so
+ *   far is durable
+ */
+export function flushJournal() {
+  return instance.flushJournal();
+}
 
-    if (wasmInstance?.exports.sync_external_table_counter) {
-      wasmInstance.exports.sync_external_table_counter(nextTableId);
-    }
+/**
+ * Drop the external tables Lua can no longer reach: mark from _home, _io
+ * and the tables Lua still holds proxies for, following table references
+ * in stored values, and sweep the rest. Replacing _home.x = {...} or
+ * _io.input leaves the old tables behind until this runs.
+ * @returns {number} Tables dropped; 0 when reachability cannot be told
+ *   (no get_live_table_ids export, or a lazy restore still loading)
+ */
+export function collectTables() {
+  return instance.collectTables();
+}
 
-    if (homeTableId && wasmInstance?.exports.attach_memory_table) {
-      wasmInstance.exports.attach_memory_table(homeTableId);
-      const confirmedId = wasmInstance.exports.get_memory_table_id?.() ?? homeTableId;
-      if (confirmedId > 0) {
-        homeTableId = confirmedId;
-      }
-    } else if (wasmInstance?.exports.get_memory_table_id) {
-      const currentId = wasmInstance.exports.get_memory_table_id();
-      if (currentId > 0 && !homeTableId) {
-        homeTableId = currentId;
-      }
-      if (homeTableId) {
-        ensureExternalTable(homeTableId);
-      }
-    }
+/**
+ * Save external tables to IndexedDB. Only tables changed since the last
+ * save or load are written, and tables no longer present are deleted, so
+ * the cost follows what changed. The _io table is not persisted. The save
+ * is a snapshot, so it also drops the journal.
+ * @param {Object} [options]
+ * @param {boolean} [options.collect=true] - Drop unreachable tables first
+ *   (collectTables()), so they are deleted from storage too
+ */
+export function saveState(options = {}) {
+  return instance.saveState(options);
+}
 
-    stateRestored = tables.size > 0;
-    return true;
-  } catch (error) {
-    console.error('Failed to load state:', error);
-    return false;
-  }
+/**
+ * Load external tables from IndexedDB
+ */
+export function loadState() {
+  return instance.loadState();
 }
 
 /**
  * Clear all persisted data
  */
-export async function clearPersistedState() {
-  try {
-    await persistence.clearAll();
-    stateRestored = false;
-    return true;
-  } catch (error) {
-    console.error('Failed to clear persisted state:', error);
-    return false;
-  }
+export function clearPersistedState() {
+  return instance.clearPersistedState();
 }
 
 /**
  * Get info about current external tables
  */
 export function getTableInfo() {
-  const info = {
-    tableCount: externalTables.size,
-    homeTableId,
-    memoryTableId: homeTableId, // Alias for backward compatibility
-    nextTableId,
-    tables: []
-  };
-  
-  for (const [id, table] of externalTables) {
-    info.tables.push({
-      id: id,
-      size: table.size,
-      keys: Array.from(table.keys())
-    });
-  }
-  
-  return info;
+  return instance.getTableInfo();
 }
 
 /**
@@ -646,198 +608,48 @@ export function getTableInfo() {
  * @returns {number|null} The _home table ID (formerly "Memory" table)
  */
 export function getMemoryTableId() {
-  return homeTableId;
+  return instance.getMemoryTableId();
 }
 
 /**
- * Get the _io table ID
- * @returns {number} The _io table ID
+ * Point _home at another external table, so several units can take turns
+ * on one VM with their own persistent state (CuPool). Lua globals other
+ * than _home stay shared.
+ * @param {number|null} [tableId=null] - Table to attach, or null for a new one
+ * @returns {number} The table now behind _home
  */
-export function getIoTableId() {
-  if (!wasmInstance) {
-    throw new Error('WASM not loaded');
-  }
-  
-  if (ioTableId === null) {
-    ioTableId = wasmInstance.exports.get_io_table_id?.() ?? 0;
-    if (ioTableId === 0) {
-      throw new Error('_io table not initialized');
-    }
-  }
-  
-  return ioTableId;
+export function attachHomeTable(tableId = null) {
+  return instance.attachHomeTable(tableId);
 }
 
 /**
- * Helper to serialize JavaScript objects to Lua-compatible format
- * Creates external tables for nested objects/arrays
- * @param {*} obj - JavaScript value to serialize
- * @returns {Uint8Array} Serialized binary data
- */
-function serializeObject(obj) {
-  if (obj === null || obj === undefined) {
-    return new Uint8Array([0x00]); // nil
-  }
-  
-  if (typeof obj === 'boolean') {
-    return new Uint8Array([0x01, obj ? 1 : 0]);
-  }
-  
-  if (typeof obj === 'number') {
-    const buffer = new ArrayBuffer(9);
-    const view = new DataView(buffer);
-    view.setUint8(0, 0x02); // integer type
-    view.setBigInt64(1, BigInt(Math.floor(obj)), true);
-    return new Uint8Array(buffer);
-  }
-  
-  if (typeof obj === 'string') {
-    const encoder = new TextEncoder();
-    const strBytes = encoder.encode(obj);
-    const buffer = new ArrayBuffer(5 + strBytes.length);
-    const view = new DataView(buffer);
-    view.setUint8(0, 0x04); // string type
-    view.setUint32(1, strBytes.length, true);
-    new Uint8Array(buffer).set(strBytes, 5);
-    return new Uint8Array(buffer);
-  }
-  
-  if (Array.isArray(obj)) {
-    // Create external table for array
-    const arrayTableId = nextTableId++;
-    ensureExternalTable(arrayTableId);
-    
-    obj.forEach((item, index) => {
-      const serialized = serializeObject(item);
-      const table = externalTables.get(arrayTableId);
-      table.set(String(index + 1), serialized); // Lua arrays are 1-indexed
-    });
-    
-    // Return table reference
-    const buffer = new ArrayBuffer(5);
-    const view = new DataView(buffer);
-    view.setUint8(0, 0x07); // table_ref type
-    view.setUint32(1, arrayTableId, true);
-    return new Uint8Array(buffer);
-  }
-  
-  if (typeof obj === 'object') {
-    // Create external table for object
-    const objTableId = nextTableId++;
-    ensureExternalTable(objTableId);
-    
-    for (const [key, value] of Object.entries(obj)) {
-      const serialized = serializeObject(value);
-      const table = externalTables.get(objTableId);
-      table.set(key, serialized);
-    }
-    
-    // Return table reference
-    const buffer = new ArrayBuffer(5);
-    const view = new DataView(buffer);
-    view.setUint8(0, 0x07); // table_ref type
-    view.setUint32(1, objTableId, true);
-    return new Uint8Array(buffer);
-  }
-  
-  return new Uint8Array([0x00]); // fallback to nil
-}
-
-/**
- * Helper to deserialize Lua binary data to JavaScript objects
- * Reconstructs nested objects/arrays from external tables
- * @param {Uint8Array} buffer - Binary data to deserialize
- * @returns {*} JavaScript value
+ * Get the _io table ID
+ * @returns {number} The _io table ID
  */
-function deserializeObject(buffer) {
-  if (!buffer || buffer.length === 0) {
-    return null;
-  }
-  
-  const view = new DataView(buffer.buffer, buffer.byteOffset, buffer.byteLength);
-  const type = view.getUint8(0);
-  
-  switch (type) {
-    case 0x00: // nil
-      return null;
-    
-    case 0x01: // boolean
-      if (buffer.length < 2) return null;
-      return view.getUint8(1) !== 0;
-    
-    case 0x02: // integer
-      if (buffer.length < 9) return null;
-      return Number(view.getBigInt64(1, true));
-    
-    case 0x03: // float
-      if (buffer.length < 9) return null;
-      return view.getFloat64(1, true);
-    
-    case 0x04: // string
-      if (buffer.length < 5) return null;
-      const strLen = view.getUint32(1, true);
-      if (buffer.length < 5 + strLen) return null;
-      const strBytes = buffer.slice(5, 5 + strLen);
-      return new TextDecoder().decode(strBytes);
-    
-    case 0x07: // table_ref
-      if (buffer.length < 5) return null;
-      const tableId = view.getUint32(1, true);
-      const table = externalTables.get(tableId);
-      if (!table) return null;
-      
-      // Check if it's an array (all keys are sequential numbers starting from 1)
-      const keys = Array.from(table.keys());
-      const isArray = keys.every((key, idx) => key === String(idx + 1));
-      
-      if (isArray) {
-        // Deserialize as array
-        const result = [];
-        for (let i = 1; i <= keys.length; i++) {
-          const value = table.get(String(i));
-          if (value !== undefined) {
-            result.push(deserializeObject(value));
-          }
-        }
-        return result;
-      } else {
-        // Deserialize as object
-        const result = {};
-        for (const [key, value] of table) {
-          result[key] = deserializeObject(value);
-        }
-        return result;
-      }
-    
-    default:
-      return null;
-  }
+export function getIoTableId() {
+  return instance.getIoTableId();
 }
 
 /**
  * Set input data for _io.input
  * @param {*} data - JavaScript object/value to send to Lua
+ * @param {Object} [options]
+ * @param {boolean} [options.frame=false] - Send the input as one buffer of
+ *   inline tables, decoded into plain Lua tables on first read
  */
-export function setInput(data) {
-  const tableId = getIoTableId();
-  const serialized = serializeObject(data);
-  const table = ensureExternalTable(tableId);
-  table.set('input', serialized);
+export function setInput(data, options) {
+  instance.setInput(data, options);
 }
 
 /**
  * Get output data from _io.output
+ * @param {Object} [options]
+ * @param {boolean} [options.lazy=false] - Return tables as read-only views
+ *   that decode fields when they are read
  * @returns {*} JavaScript object/value from Lua
  */
-export function getOutput() {
-  const tableId = getIoTableId();
-  const table = externalTables.get(tableId);
-  if (!table) return null;
-  
-  const serialized = table.get('output');
-  if (!serialized) return null;
-  
-  return deserializeObject(serialized);
+export function getOutput(options) {
+  return instance.getOutput(options);
 }
 
 /**
@@ -845,29 +657,14 @@ export function getOutput() {
  * @param {*} meta - Metadata object to send to Lua
  */
 export function setMetadata(meta) {
-  const tableId = getIoTableId();
-  const serialized = serializeObject(meta);
-  const table = ensureExternalTable(tableId);
-  table.set('meta', serialized);
+  instance.setMetadata(meta);
 }
 
 /**
  * Clear all _io table contents (input, output, meta)
  */
 export function clearIo() {
-  if (!wasmInstance) return;
-  
-  wasmInstance.exports.clear_io_table?.();
-  
-  // Also clear from JavaScript side
-  if (ioTableId !== null) {
-    const table = externalTables.get(ioTableId);
-    if (table) {
-      table.delete('input');
-      table.delete('output');
-      table.delete('meta');
-    }
-  }
+  instance.clearIo();
 }
 
 /**
@@ -875,33 +672,79 @@ export function clearIo() {
  * @param {boolean} enabled - Whether to allow accessing _home via "Memory" name
  */
 export function setMemoryAliasEnabled(enabled) {
-  memoryAliasEnabled = enabled;
-  if (enabled) {
-    console.warn('[Deprecated] "Memory" table name alias enabled - consider migrating to "_home"');
-  }
+  instance.setMemoryAliasEnabled(enabled);
 }
 
 export default {
   load,
   init,
+  snapshot,
+  restoreSnapshot,
+  checkpoint,
+  restoreCheckpoint,
   compute,
+  call,
+  computeAsync,
+  schedTick,
+  computeBatch,
   getBufferPtr,
+  getResultPtr,
+  setResultRegion,
   getBufferSize,
   getMemoryStats,
+  getPerfCounters,
+  getHeapCensus,
+  getAllocProfile,
+  profile,
+  bridgeTrace,
   runGc,
+  trimHeap,
+  setResponseCache,
+  getResponseCacheStats,
+  setTiering,
+  getTieringStats,
+  setComputeLimits,
+  setVirtualClock,
+  setInterruptCheck,
+  interrupt,
+  setOutputStreaming,
+  getLastErrorCode,
+  getLastError,
+  setErrorTraceback,
+  ErrorCodes,
+  setLogger,
+  onMetric,
+  LogLevel,
+  getChunkCacheStats,
+  clearChunkCache,
+  setExtTableBackend,
+  getExtTableStats,
   readBuffer,
   readResult,
+  readResultView,
   writeBuffer,
   saveState,
   loadState,
   clearPersistedState,
+  enableJournal,
+  disableJournal,
+  onChanges,
+  flushJournal,
+  tablesReady,
+  collectTables,
   getTableInfo,
+  setTableQuota,
   getMemoryTableId,
+  attachHomeTable,
   setMemoryAliasEnabled,
   // _io table API
   getIoTableId,
   setInput,
   getOutput,
   setMetadata,
-  clearIo
+  clearIo,
+  CuInstance,
+  getDefaultInstance,
+  compileModule,
+  clearModuleCache
 };
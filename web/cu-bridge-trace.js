@@ -0,0 +1,224 @@
+/**
+ * Cu Bridge Trace
+ *
+ * Records the external table calls Lua makes into the host (_home, _io and
+ * ext.table() reads, writes, deletes, sizes, key lists, batches and pairs()
+ * scans) into a fixed-size ring: operation, table ID, key, value bytes and
+ * duration. summarize() folds what the ring holds into per-operation totals
+ * and the keys crossed most often and with the most bytes, which point at
+ * tables worth caching in the VM or batching.
+ *
+ * Tracing is switched on per instance (CuInstance.startBridgeTrace). The
+ * traced imports are wrapped once, when the module is instantiated; while
+ * no trace is running each wrapper costs one property read before the
+ * plain import runs.
+ */
+
+export const BRIDGE_OPS = ['get', 'set', 'delete', 'size', 'keys', 'getMany', 'setMany', 'next'];
+const OP = Object.fromEntries(BRIDGE_OPS.map((name, i) => [name, i]));
+
+const DEFAULT_CAPACITY = 4096;
+
+export class BridgeTrace {
+  /**
+   * @param {number} [capacity=4096] Calls kept; older ones are overwritten
+   */
+  constructor(capacity = DEFAULT_CAPACITY) {
+    this.capacity = Math.max(1, Math.floor(capacity));
+    this.ops = new Uint8Array(this.capacity);
+    this.tableIds = new Float64Array(this.capacity);
+    this.keys = new Array(this.capacity).fill(null);
+    this.bytes = new Float64Array(this.capacity);
+    this.durations = new Float64Array(this.capacity);
+    // Calls recorded since the trace started, including overwritten ones
+    this.total = 0;
+  }
+
+  record(op, tableId, key, bytes, ms) {
+    const i = this.total % this.capacity;
+    this.ops[i] = op;
+    this.tableIds[i] = tableId;
+    this.keys[i] = key;
+    this.bytes[i] = bytes;
+    this.durations[i] = ms;
+    this.total++;
+  }
+
+  /**
+   * The calls the ring holds, oldest first
+   * @returns {Array<{ op, tableId, key, bytes, ms }>}
+   */
+  entries() {
+    const count = Math.min(this.total, this.capacity);
+    const first = this.total - count;
+    const entries = new Array(count);
+    for (let n = 0; n < count; n++) {
+      const i = (first + n) % this.capacity;
+      entries[n] = {
+        op: BRIDGE_OPS[this.ops[i]],
+        tableId: this.tableIds[i],
+        key: this.keys[i],
+        bytes: this.bytes[i],
+        ms: this.durations[i],
+      };
+    }
+    return entries;
+  }
+
+  /**
+   * @param {number} [top=10] Keys to list in byCount and byBytes
+   * @returns {object} { calls, dropped, ms, bytes, ops, tables, byCount,
+   *   byBytes }: ops and tables map an operation or table ID to
+   *   { count, bytes, ms }, and byCount / byBytes list the busiest keys as
+   *   { tableId, key, count, bytes, ms }. Calls without a key (size, keys,
+   *   batches, scans) count towards ops and tables only.
+   */
+  summarize(top = 10) {
+    const entries = this.entries();
+    const summary = {
+      calls: entries.length,
+      dropped: this.total - entries.length,
+      ms: 0,
+      bytes: 0,
+      ops: {},
+      tables: {},
+      byCount: [],
+      byBytes: [],
+    };
+    const keys = new Map();
+    for (const entry of entries) {
+      summary.ms += entry.ms;
+      summary.bytes += entry.bytes;
+      addTo(summary.ops, entry.op, entry);
+      addTo(summary.tables, entry.tableId, entry);
+      if (entry.key === null) continue;
+
+      const id = `${entry.tableId}:${typeof entry.key}:${entry.key}`;
+      let stats = keys.get(id);
+      if (!stats) {
+        stats = { tableId: entry.tableId, key: entry.key, count: 0, bytes: 0, ms: 0 };
+        keys.set(id, stats);
+      }
+      stats.count++;
+      stats.bytes += entry.bytes;
+      stats.ms += entry.ms;
+    }
+    const all = Array.from(keys.values());
+    summary.byCount = all.slice().sort((a, b) => b.count - a.count || b.bytes - a.bytes).slice(0, top);
+    summary.byBytes = all.sort((a, b) => b.bytes - a.bytes || b.count - a.count).slice(0, top);
+    return summary;
+  }
+}
+
+function addTo(totals, name, entry) {
+  const stats = totals[name] ?? (totals[name] = { count: 0, bytes: 0, ms: 0 });
+  stats.count++;
+  stats.bytes += entry.bytes;
+  stats.ms += entry.ms;
+}
+
+// Bytes of a js_ext_table_get result: its length, or the size it reported
+// as too large for the caller's window
+function fetchedBytes(len) {
+  if (len >= 0) return len;
+  return len < -1 ? -2 - len : 0;
+}
+
+/**
+ * Wrap the external table imports in `env` so they record into
+ * host.bridgeTrace while it is set
+ * @param {object} env - Imports from CuInstance.createImports()
+ * @param {object} host - The CuInstance: bridgeTrace, memoryView(), decodeKey()
+ */
+export function traceBridgeImports(env, host) {
+  const {
+    js_ext_table_get: get,
+    js_ext_table_set: set,
+    js_ext_table_set_parts: setParts,
+    js_ext_table_delete: del,
+    js_ext_table_size: size,
+    js_ext_table_keys: keys,
+    js_ext_table_get_many: getMany,
+    js_ext_table_set_many: setMany,
+    js_ext_table_next: next,
+  } = env;
+  const keyAt = (ptr, len) => host.decodeKey(host.memoryView(), ptr, len);
+
+  env.js_ext_table_get = (table_id, key_ptr, key_len, val_ptr, max_len) => {
+    const trace = host.bridgeTrace;
+    if (trace === null) return get(table_id, key_ptr, key_len, val_ptr, max_len);
+    const key = keyAt(key_ptr, key_len);
+    const start = performance.now();
+    const len = get(table_id, key_ptr, key_len, val_ptr, max_len);
+    trace.record(OP.get, table_id, key, fetchedBytes(len), performance.now() - start);
+    return len;
+  };
+  env.js_ext_table_set = (table_id, key_ptr, key_len, val_ptr, val_len) => {
+    const trace = host.bridgeTrace;
+    if (trace === null) return set(table_id, key_ptr, key_len, val_ptr, val_len);
+    const key = keyAt(key_ptr, key_len);
+    const start = performance.now();
+    const status = set(table_id, key_ptr, key_len, val_ptr, val_len);
+    trace.record(OP.set, table_id, key, val_len, performance.now() - start);
+    return status;
+  };
+  env.js_ext_table_set_parts = (table_id, key_ptr, key_len, head_ptr, head_len, body_ptr, body_len) => {
+    const trace = host.bridgeTrace;
+    if (trace === null) return setParts(table_id, key_ptr, key_len, head_ptr, head_len, body_ptr, body_len);
+    const key = keyAt(key_ptr, key_len);
+    const start = performance.now();
+    const status = setParts(table_id, key_ptr, key_len, head_ptr, head_len, body_ptr, body_len);
+    trace.record(OP.set, table_id, key, head_len + body_len, performance.now() - start);
+    return status;
+  };
+  env.js_ext_table_delete = (table_id, key_ptr, key_len) => {
+    const trace = host.bridgeTrace;
+    if (trace === null) return del(table_id, key_ptr, key_len);
+    const key = keyAt(key_ptr, key_len);
+    const start = performance.now();
+    const status = del(table_id, key_ptr, key_len);
+    trace.record(OP.delete, table_id, key, 0, performance.now() - start);
+    return status;
+  };
+  env.js_ext_table_size = (table_id) => {
+    const trace = host.bridgeTrace;
+    if (trace === null) return size(table_id);
+    const start = performance.now();
+    const count = size(table_id);
+    trace.record(OP.size, table_id, null, 0, performance.now() - start);
+    return count;
+  };
+  env.js_ext_table_keys = (table_id, buf_ptr, max_len) => {
+    const trace = host.bridgeTrace;
+    if (trace === null) return keys(table_id, buf_ptr, max_len);
+    const start = performance.now();
+    const len = keys(table_id, buf_ptr, max_len);
+    trace.record(OP.keys, table_id, null, Math.max(len, 0), performance.now() - start);
+    return len;
+  };
+  env.js_ext_table_get_many = (table_id, keys_ptr, keys_len, out_ptr, max_len) => {
+    const trace = host.bridgeTrace;
+    if (trace === null) return getMany(table_id, keys_ptr, keys_len, out_ptr, max_len);
+    const start = performance.now();
+    const len = getMany(table_id, keys_ptr, keys_len, out_ptr, max_len);
+    trace.record(OP.getMany, table_id, null, Math.max(len, 0), performance.now() - start);
+    return len;
+  };
+  env.js_ext_table_set_many = (table_id, frames_ptr, frames_len) => {
+    const trace = host.bridgeTrace;
+    if (trace === null) return setMany(table_id, frames_ptr, frames_len);
+    const start = performance.now();
+    const status = setMany(table_id, frames_ptr, frames_len);
+    trace.record(OP.setMany, table_id, null, frames_len, performance.now() - start);
+    return status;
+  };
+  env.js_ext_table_next = (table_id, cursor, buf_ptr, max_len) => {
+    const trace = host.bridgeTrace;
+    if (trace === null) return next(table_id, cursor, buf_ptr, max_len);
+    const start = performance.now();
+    const len = next(table_id, cursor, buf_ptr, max_len);
+    trace.record(OP.next, table_id, null, Math.max(len, 0), performance.now() - start);
+    return len;
+  };
+  return env;
+}
@@ -0,0 +1,229 @@
+/**
+ * Cu Message Bus
+ *
+ * Forwards messages between units (CuInstances in one thread) as the value
+ * bytes serializer.zig writes, so a message is never turned into JS objects
+ * and back on its way from one VM to another. Lua sends with
+ *
+ *   bus.send(to, message)
+ *
+ * which appends the unit name and the message to the external table
+ * _io.outbox. After an invocation the bus takes the frames from there as
+ * stored, copies the external tables a message refers to into the receiving
+ * unit under new IDs (the only bytes it rewrites are those references), and
+ * queues them. deliver() hands each unit its queued messages in one batch
+ * in _io.inbox and calls the unit's handler once, which reads them with
+ *
+ *   for from, message in bus.messages() do ... end
+ *
+ * Messages sent while handling are delivered in the next round, until no
+ * unit has anything queued. Messages to a name no unit is attached under,
+ * such as the host's, are left in `unrouted`.
+ *
+ * Usage:
+ *   import { MessageBus } from './cu-bus.js';
+ *   const bus = new MessageBus();
+ *   bus.attach('orders', ordersInstance);
+ *   bus.attach('billing', billingInstance);
+ *   ordersInstance.compute('bus.send("billing", { id = 7, total = 120 })');
+ *   bus.collect('orders');
+ *   bus.deliver(); // billing's receive() runs once with the message
+ */
+
+import { decodeValue, remapTableRefs, ValueWriter } from './cu-values.js';
+
+// Defines bus.send and bus.messages in a unit
+const PRELUDE = `
+bus = bus or {}
+function bus.send(to, message)
+  if type(to) ~= "string" then error("bus.send: unit name must be a string", 2) end
+  local box = _io.outbox
+  if not box then
+    box = ext.table()
+    _io.outbox = box
+  end
+  local n = #box
+  box[n + 1] = to
+  box[n + 2] = message
+end
+function bus.messages()
+  local box, i = _io.inbox, -1
+  return function()
+    if not box then return nil end
+    i = i + 2
+    local from = box[i]
+    if from == nil then return nil end
+    return from, box[i + 1]
+  end
+end
+`;
+
+/**
+ * Routes messages between the units attached to it
+ */
+export class MessageBus {
+  /**
+   * @param {Object} [options]
+   * @param {string} [options.handler='receive'] - Global function (or
+   *   dotted path, as CuInstance.call) each unit handles a batch with
+   * @param {number} [options.maxRounds=100] - deliver() stops after this many
+   *   rounds of replies, so units that keep answering each other cannot spin
+   *   forever
+   */
+  constructor({ handler = 'receive', maxRounds = 100 } = {}) {
+    this.handler = handler;
+    this.maxRounds = maxRounds;
+    // name -> {instance, queue: Array<[from, Uint8Array]>}
+    this.units = new Map();
+    // Messages to names no unit is attached under, as {from, to, frame};
+    // sender.deserializeObject(frame) reads one until the sender's next
+    // collectGarbage()
+    this.unrouted = [];
+  }
+
+  /**
+   * Attach a unit under `name` and define bus.send and bus.messages in it
+   * @param {string} name
+   * @param {CuInstance} instance - Initialized
+   */
+  attach(name, instance) {
+    if (this.units.has(name)) throw new Error(`Unit ${name} is already attached`);
+    const len = instance.compute(PRELUDE);
+    if (len < 0) throw new Error(`Bus setup failed in ${name}: ${instance.readBuffer(instance.getBufferPtr(), -len)}`);
+    // The inbox table is refilled in place for every batch
+    this.units.set(name, { instance, queue: [], inboxSlots: instance.createTableSlots() });
+  }
+
+  detach(name) {
+    const unit = this.units.get(name);
+    if (unit) unit.instance.releaseTableSlots(unit.inboxSlots);
+    this.units.delete(name);
+  }
+
+  unit(name) {
+    const unit = this.units.get(name);
+    if (!unit) throw new Error(`No unit ${name} on the bus`);
+    return unit;
+  }
+
+  /**
+   * Queue a message from the host for `to`, serialized straight into it
+   * @param {string} to
+   * @param {*} message - Serialized like _io values
+   * @param {string} [from='host']
+   */
+  post(to, message, from = 'host') {
+    const target = this.unit(to);
+    const bytes = target.instance.serializeObject(message, new ValueWriter(target.instance.compactValues));
+    target.queue.push([from, bytes]);
+  }
+
+  /**
+   * Take what `name` sent in its last invocations from its outbox and queue
+   * it for the receivers
+   * @param {string} name
+   * @returns {number} Messages taken
+   */
+  collect(name) {
+    const sender = this.unit(name).instance;
+    const ioId = sender.getIoTableId();
+    const ref = sender.externalTables.get(ioId)?.get('outbox');
+    const box = ref && sender.externalTables.get(decodeValue(ref)?.tableId);
+    if (!box || box.size === 0) return 0;
+
+    let taken = 0;
+    for (let i = 1; box.has(i); i += 2) {
+      const to = decodeValue(box.get(i))?.value;
+      const frame = box.get(i + 1);
+      const target = this.units.get(to);
+      if (!target) {
+        this.unrouted.push({ from: name, to, frame });
+        continue;
+      }
+      target.queue.push([name, frame ? copyFrame(sender, target.instance, frame) : null]);
+      taken++;
+    }
+    box.clear();
+    sender.wasmInstance.exports.invalidate_ext_table?.(decodeValue(ref).tableId);
+    return taken;
+  }
+
+  /**
+   * Deliver every queued message, one batch and one handler call per unit
+   * and round, collecting what the handlers send for the next round
+   * @returns {number} Messages delivered
+   */
+  deliver() {
+    let delivered = 0;
+    for (let round = 0; round < this.maxRounds; round++) {
+      const batches = [];
+      for (const [name, unit] of this.units) {
+        if (unit.queue.length === 0) continue;
+        batches.push([name, unit, unit.queue]);
+        unit.queue = [];
+      }
+      if (batches.length === 0) return delivered;
+
+      for (const [name, unit, batch] of batches) {
+        this.writeInbox(unit, batch);
+        const len = unit.instance.call(this.handler);
+        this.writeInbox(unit, null);
+        if (len < 0) {
+          throw new Error(`Unit ${name} failed handling messages: ${unit.instance.readBuffer(unit.instance.getBufferPtr(), -len)}`);
+        }
+        delivered += batch.length;
+        this.collect(name);
+      }
+    }
+    throw new Error(`Units still had messages after ${this.maxRounds} rounds`);
+  }
+
+  // Put the batch in _io.inbox as alternating sender names and frames, or
+  // remove it
+  writeInbox({ instance, inboxSlots }, batch) {
+    const io = instance.ensureExternalTable(instance.getIoTableId());
+    const exports = instance.wasmInstance.exports;
+    if (!batch) {
+      io.delete('inbox');
+      exports.invalidate_ext_table?.(instance.getIoTableId());
+      return;
+    }
+    const writer = new ValueWriter(instance.compactValues);
+    instance.recycleTableSlots(inboxSlots);
+    const inboxId = instance.takeTableSlot(inboxSlots);
+    const inbox = instance.ensureExternalTable(inboxId);
+    let i = 1;
+    for (const [from, frame] of batch) {
+      inbox.set(i++, writer.value(from));
+      if (frame) inbox.set(i, frame);
+      i++;
+    }
+    io.set('inbox', writer.tableRef(inboxId));
+    exports.invalidate_ext_table?.(instance.getIoTableId());
+  }
+}
+
+// The frame as `target` reads it: the external tables it refers to copied
+// from `source` under IDs of `target`'s, shared and cyclic tables once
+function copyFrame(source, target, frame) {
+  const copies = new Map();
+  const pending = [];
+  const remap = (id) => {
+    let copy = copies.get(id);
+    if (copy === undefined) {
+      copy = target.nextTableId++;
+      copies.set(id, copy);
+      pending.push(id);
+    }
+    return copy;
+  };
+  const out = remapTableRefs(frame, remap);
+  while (pending.length > 0) {
+    const id = pending.pop();
+    const table = target.ensureExternalTable(copies.get(id));
+    for (const [key, value] of source.externalTables.get(id) ?? []) {
+      table.set(key, value instanceof Uint8Array ? remapTableRefs(value, remap) : value);
+    }
+  }
+  return out;
+}
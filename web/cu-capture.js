@@ -0,0 +1,211 @@
+/**
+ * Cu Workload Capture
+ *
+ * Records a unit's traffic so a later build can be measured against it:
+ * every compute() and call() with its input, how long it took, what it
+ * returned and the external table calls it made into the host (operation,
+ * table ID, key, value bytes and duration, as a bridge trace records them).
+ * The capture starts with the host's tables packed as shareState() packs
+ * them, so replayCapture() can give another instance, running any build,
+ * the same host state to answer those calls from. The Lua state itself is
+ * not captured: start capturing right after init(), or include the scripts
+ * that set the unit up.
+ *
+ * Usage:
+ *   cu.startCapture();
+ *   ... serve traffic ...
+ *   const bytes = encodeCapture(cu.stopCapture());
+ *   // later, against another build
+ *   const report = await replayCapture(decodeCapture(bytes), { createInstance });
+ *
+ * scripts/bench-replay.js runs a saved capture against one or more builds.
+ */
+
+import { BRIDGE_OPS } from './cu-bridge-trace.js';
+import { deserializeResult } from './cu-deserializer.js';
+import { encode, decode } from './cu-msgpack.js';
+
+export const CAPTURE_VERSION = 1;
+
+// A compute() or call() result kept for comparison: the encoded result
+// bytes, or the error message
+function outcomeOf(host, status) {
+  if (status < 0) {
+    return { error: host.readBuffer(host.getBufferPtr(), -status - 1) };
+  }
+  const ptr = host.getResultPtr();
+  return { bytes: host.memoryView().slice(ptr, ptr + status) };
+}
+
+// Tees the bridge trace wrappers' calls into the request being captured
+class CaptureTrace {
+  constructor(inner, calls) {
+    this.inner = inner;
+    this.calls = calls;
+  }
+
+  record(op, tableId, key, bytes, ms) {
+    this.inner?.record(op, tableId, key, bytes, ms);
+    this.calls.push([BRIDGE_OPS[op], tableId, key, bytes, ms]);
+  }
+}
+
+export class WorkloadCapture {
+  /**
+   * @param {SharedArrayBuffer|ArrayBuffer} tables - The host's tables at the
+   *   start, from shareState()
+   */
+  constructor(tables) {
+    this.startedAt = new Date().toISOString();
+    this.tables = new Uint8Array(tables.slice(0));
+    this.requests = [];
+  }
+
+  /**
+   * Run one invocation, recording it
+   * @param {object} host - The CuInstance
+   * @param {object} request - { kind: 'compute', code } or { kind: 'call',
+   *   name, args }
+   * @param {Function} invoke - Runs it and returns its compute()-style status
+   * @returns {number} The status
+   */
+  run(host, request, invoke) {
+    const calls = [];
+    const trace = host.bridgeTrace;
+    host.bridgeTrace = new CaptureTrace(trace, calls);
+    const start = performance.now();
+    let status;
+    try {
+      status = invoke();
+    } finally {
+      host.bridgeTrace = trace;
+    }
+    const ms = performance.now() - start;
+    this.requests.push({ ...request, ms, status, calls, ...outcomeOf(host, status) });
+    return status;
+  }
+
+  /**
+   * The capture as plain data, for encodeCapture()
+   * @returns {object} { version, startedAt, tables, requests }
+   */
+  toJSON() {
+    return { version: CAPTURE_VERSION, startedAt: this.startedAt, tables: this.tables, requests: this.requests };
+  }
+}
+
+/**
+ * @param {WorkloadCapture|object} capture
+ * @returns {Uint8Array} The capture as MessagePack
+ */
+export function encodeCapture(capture) {
+  return encode(capture instanceof WorkloadCapture ? capture.toJSON() : capture);
+}
+
+/**
+ * @param {Uint8Array|ArrayBuffer} bytes - From encodeCapture()
+ * @returns {object} { version, startedAt, tables, requests }
+ */
+export function decodeCapture(bytes) {
+  const capture = decode(bytes);
+  if (capture?.version !== CAPTURE_VERSION) {
+    throw new Error(`Unsupported capture version ${capture?.version}`);
+  }
+  return capture;
+}
+
+// A stable text form of a decoded result, so two can be compared whatever
+// order their tables' keys came out in
+function canonical(value) {
+  if (value instanceof Uint8Array) return `bytes:${Array.from(value).join(',')}`;
+  if (typeof value === 'bigint') return `${value}n`;
+  if (Array.isArray(value)) return `[${value.map(canonical).join(',')}]`;
+  if (value instanceof Map) {
+    const entries = Array.from(value, ([k, v]) => `${canonical(k)}=${canonical(v)}`);
+    return `{${entries.sort().join(',')}}`;
+  }
+  if (value !== null && typeof value === 'object') {
+    const entries = Object.keys(value).sort().map((k) => `${JSON.stringify(k)}:${canonical(value[k])}`);
+    return `{${entries.join(',')}}`;
+  }
+  return JSON.stringify(value) ?? String(value);
+}
+
+function outcomeText(outcome) {
+  if (outcome.error !== undefined) return `error:${outcome.error}`;
+  const { output, results } = deserializeResult(outcome.bytes, outcome.bytes.length);
+  return `${JSON.stringify(output)}:${canonical(results)}`;
+}
+
+function percentile(sorted, p) {
+  if (sorted.length === 0) return 0;
+  return sorted[Math.min(sorted.length - 1, Math.floor(p * sorted.length))];
+}
+
+function distribution(values) {
+  const sorted = Float64Array.from(values).sort();
+  const total = sorted.reduce((sum, ms) => sum + ms, 0);
+  return {
+    count: sorted.length,
+    totalMs: total,
+    meanMs: sorted.length > 0 ? total / sorted.length : 0,
+    p50: percentile(sorted, 0.5),
+    p90: percentile(sorted, 0.9),
+    p99: percentile(sorted, 0.99),
+    max: sorted.length > 0 ? sorted[sorted.length - 1] : 0,
+  };
+}
+
+/**
+ * Run a capture's requests, in order, on a fresh instance with the
+ * captured host tables attached, and compare what they return with what
+ * was captured. A request whose result, output or error differs counts as
+ * divergent; the ones after it may then differ only as a consequence.
+ * @param {object} capture - From WorkloadCapture.toJSON() or decodeCapture()
+ * @param {object} options
+ * @param {Function} options.createInstance - Returns a loaded, initialized
+ *   CuInstance of the build to measure (or a promise of one)
+ * @param {number} [options.runs=1] - Times to replay, each on a fresh
+ *   instance; latencies are pooled across runs
+ * @returns {Promise<object>} { requests, runs, throughput (requests per
+ *   second of VM time), latency and captured (distributions in ms: count,
+ *   totalMs, meanMs, p50, p90, p99, max), bridgeCalls and capturedBridgeCalls
+ *   (per run), divergent (request indexes, from the first run) }
+ */
+export async function replayCapture(capture, { createInstance, runs = 1 } = {}) {
+  const latencies = [];
+  const divergent = [];
+  let bridgeCalls = 0;
+  for (let run = 0; run < runs; run++) {
+    const host = await createInstance();
+    host.attachSharedSnapshot(capture.tables.slice().buffer);
+    // Only the count is wanted, so the trace keeps a single call
+    host.startBridgeTrace({ capacity: 1 });
+    for (let i = 0; i < capture.requests.length; i++) {
+      const request = capture.requests[i];
+      const start = performance.now();
+      const status = request.kind === 'call'
+        ? host.call(request.name, request.args ?? [])
+        : host.compute(request.code);
+      latencies.push(performance.now() - start);
+      if (run === 0 && outcomeText(outcomeOf(host, status)) !== outcomeText(request)) {
+        divergent.push(i);
+      }
+    }
+    bridgeCalls += host.bridgeTrace.total;
+    host.stopBridgeTrace();
+  }
+
+  const latency = distribution(latencies);
+  const captured = distribution(capture.requests.map((request) => request.ms));
+  return {
+    requests: capture.requests.length,
+    runs,
+    throughput: latency.totalMs > 0 ? (latency.count * 1000) / latency.totalMs : 0,
+    latency,
+    captured,
+    bridgeCalls: bridgeCalls / runs,
+    capturedBridgeCalls: capture.requests.reduce((sum, request) => sum + request.calls.length, 0),
+    divergent,
+  };
+}
@@ -0,0 +1,280 @@
+/**
+ * Cu Checkpoints
+ *
+ * A checkpoint is a snapshot() as bytes: the whole VM, not only the
+ * external tables persistence keeps. Globals, upvalues, loaded modules and
+ * suspended coroutines live in linear memory, next to the allocator's own
+ * state, so restoring the memory pages a snapshot records brings all of
+ * them back, with no bootstrap to re-run. Checkpoints can be stored or sent
+ * to another process and restored there with the same cu.wasm.
+ *
+ * A delta checkpoint holds only the pages that changed since the checkpoint
+ * named by its base id, and applies on top of it.
+ *
+ * Layout (little-endian): u32 magic "CUCP", u32 version, u32 body length,
+ * then the body, raw deflate (cu-compression.js):
+ *   u32 module fingerprint, u32 id, u32 base id (0 = a full checkpoint),
+ *   u32 memory pages, u32 nextTableId,
+ *   u32 homeTableId (0 = none), u32 nextBlobHandle
+ *   u32 page size, u32 page count, u32 offset per page, the pages' bytes
+ *   u32 key handle count, a key per handle
+ *   u32 blob count, per blob u32 handle and u32 length + bytes
+ *   u32 table count, per table u32 id, u32 entry count, per entry a key and
+ *     u32 length + value bytes
+ * where a key is u8 kind (0 string: u32 length + UTF-8, 1 number: f64,
+ * 2 none).
+ *
+ * The fingerprint hashes the memory a fresh instance of the module starts
+ * with (its data segments), so a checkpoint is refused by a different build,
+ * whose pages would not line up.
+ */
+
+import { deflate, inflate } from './cu-compression.js';
+import { ExtTable } from './cu-ext-table.js';
+
+const MAGIC = 0x50435543; // "CUCP"
+const VERSION = 1;
+const HEADER = 12;
+const KEY_STRING = 0;
+const KEY_NUMBER = 1;
+const KEY_NONE = 2;
+
+const textEncoder = new TextEncoder();
+const textDecoder = new TextDecoder();
+
+/**
+ * Hash of the memory a fresh instance of `module` starts with
+ * @param {WebAssembly.Module} module
+ * @param {Object} imports - The imports CuInstance instantiates it with
+ * @returns {number}
+ */
+export function moduleFingerprint(module, imports) {
+  const fresh = new WebAssembly.Instance(module, imports);
+  const words = new Uint32Array(fresh.exports.memory.buffer);
+  let hash = 0x811c9dc5;
+  for (let i = 0; i < words.length; i++) {
+    if (words[i] === 0) continue;
+    hash = Math.imul(hash ^ i, 0x01000193);
+    hash = Math.imul(hash ^ words[i], 0x01000193);
+  }
+  return (hash ^ words.length) >>> 0;
+}
+
+class Writer {
+  constructor() {
+    this.bytes = new Uint8Array(1 << 16);
+    this.view = new DataView(this.bytes.buffer);
+    this.length = 0;
+  }
+
+  reserve(n) {
+    if (this.length + n <= this.bytes.length) return;
+    let size = this.bytes.length * 2;
+    while (size < this.length + n) size *= 2;
+    const bytes = new Uint8Array(size);
+    bytes.set(this.bytes.subarray(0, this.length));
+    this.bytes = bytes;
+    this.view = new DataView(bytes.buffer);
+  }
+
+  u32(value) {
+    this.reserve(4);
+    this.view.setUint32(this.length, value, true);
+    this.length += 4;
+  }
+
+  raw(bytes) {
+    this.reserve(bytes.length);
+    this.bytes.set(bytes, this.length);
+    this.length += bytes.length;
+  }
+
+  blob(bytes) {
+    this.u32(bytes.byteLength);
+    this.raw(bytes);
+  }
+
+  key(key) {
+    this.reserve(9);
+    if (typeof key === 'number') {
+      this.bytes[this.length] = KEY_NUMBER;
+      this.view.setFloat64(this.length + 1, key, true);
+      this.length += 9;
+    } else if (typeof key === 'string') {
+      this.bytes[this.length++] = KEY_STRING;
+      this.blob(textEncoder.encode(key));
+    } else {
+      this.bytes[this.length++] = KEY_NONE;
+    }
+  }
+}
+
+class Reader {
+  constructor(bytes) {
+    this.bytes = bytes;
+    this.view = new DataView(bytes.buffer, bytes.byteOffset, bytes.byteLength);
+    this.offset = 0;
+  }
+
+  need(n) {
+    if (this.offset + n > this.bytes.length) throw new Error('Checkpoint is truncated');
+  }
+
+  u32() {
+    this.need(4);
+    const value = this.view.getUint32(this.offset, true);
+    this.offset += 4;
+    return value;
+  }
+
+  raw(n) {
+    this.need(n);
+    const bytes = this.bytes.subarray(this.offset, this.offset + n);
+    this.offset += n;
+    return bytes;
+  }
+
+  blob() {
+    return this.raw(this.u32());
+  }
+
+  key() {
+    this.need(1);
+    const kind = this.bytes[this.offset++];
+    if (kind === KEY_NUMBER) {
+      this.need(8);
+      const value = this.view.getFloat64(this.offset, true);
+      this.offset += 8;
+      return value;
+    }
+    if (kind === KEY_STRING) return textDecoder.decode(this.blob());
+    if (kind === KEY_NONE) return undefined;
+    throw new Error('Checkpoint is corrupt');
+  }
+}
+
+/**
+ * Encode a snapshot() as a compressed checkpoint
+ * @param {Object} snapshot - From CuInstance.snapshot()
+ * @param {number} fingerprint - moduleFingerprint() of snapshot.module
+ * @param {{id: number, base: number}} ids - This checkpoint's id, and for a
+ *   delta the id of the checkpoint its pages were compared with (else 0)
+ * @returns {Promise<Uint8Array>}
+ */
+export async function encodeCheckpoint(snapshot, fingerprint, { id, base }) {
+  const out = new Writer();
+  out.u32(fingerprint);
+  out.u32(id);
+  out.u32(base);
+  out.u32(snapshot.pages);
+  out.u32(snapshot.nextTableId);
+  out.u32(snapshot.homeTableId ?? 0);
+  out.u32(snapshot.nextBlobHandle);
+
+  const { offsets, bytes } = snapshot.image;
+  out.u32(offsets.length === 0 ? 0 : bytes.length / offsets.length);
+  out.u32(offsets.length);
+  for (const offset of offsets) out.u32(offset);
+  out.raw(bytes);
+
+  out.u32(snapshot.keyHandles.length);
+  for (let i = 0; i < snapshot.keyHandles.length; i++) out.key(snapshot.keyHandles[i]);
+
+  out.u32(snapshot.blobHandles.size);
+  for (const [handle, blob] of snapshot.blobHandles) {
+    out.u32(handle);
+    out.blob(blob);
+  }
+
+  out.u32(snapshot.tables.size);
+  for (const [id, table] of snapshot.tables) {
+    out.u32(id);
+    out.u32(table.size);
+    for (const [key, value] of table) {
+      out.key(key);
+      out.blob(value);
+    }
+  }
+
+  const body = await deflate(out.bytes.subarray(0, out.length));
+  const checkpoint = new Uint8Array(HEADER + body.length);
+  const view = new DataView(checkpoint.buffer);
+  view.setUint32(0, MAGIC, true);
+  view.setUint32(4, VERSION, true);
+  view.setUint32(8, out.length, true);
+  checkpoint.set(body, HEADER);
+  return checkpoint;
+}
+
+/**
+ * Decode a checkpoint into a snapshot CuInstance.restoreSnapshot() accepts,
+ * with its `id` and `base`
+ * @param {Uint8Array} checkpoint - From encodeCheckpoint()
+ * @param {WebAssembly.Module} module - The build the checkpoint was taken with
+ * @param {number} fingerprint - moduleFingerprint() of `module`
+ * @returns {Promise<Object>}
+ */
+export async function decodeCheckpoint(checkpoint, module, fingerprint) {
+  if (checkpoint.byteLength < HEADER) throw new Error('Not a checkpoint');
+  const header = new DataView(checkpoint.buffer, checkpoint.byteOffset, HEADER);
+  if (header.getUint32(0, true) !== MAGIC) throw new Error('Not a checkpoint');
+  if (header.getUint32(4, true) !== VERSION) {
+    throw new Error(`Unsupported checkpoint version ${header.getUint32(4, true)}`);
+  }
+  const body = await inflate(checkpoint.subarray(HEADER));
+  if (body.length !== header.getUint32(8, true)) throw new Error('Checkpoint is corrupt');
+
+  const input = new Reader(body);
+  if (input.u32() !== fingerprint) {
+    throw new Error('Checkpoint was taken with a different cu.wasm build');
+  }
+  const id = input.u32();
+  const base = input.u32();
+  const pages = input.u32();
+  const nextTableId = input.u32();
+  const homeTableId = input.u32() || null;
+  const nextBlobHandle = input.u32();
+
+  const pageSize = input.u32();
+  const pageCount = input.u32();
+  const offsets = new Uint32Array(pageCount);
+  for (let i = 0; i < pageCount; i++) offsets[i] = input.u32();
+  const image = { offsets, bytes: input.raw(pageCount * pageSize).slice() };
+
+  const keyHandles = new Array(input.u32());
+  for (let i = 0; i < keyHandles.length; i++) {
+    const key = input.key();
+    if (key !== undefined) keyHandles[i] = key;
+  }
+
+  const blobHandles = new Map();
+  for (let i = input.u32(); i > 0; i--) {
+    const handle = input.u32();
+    blobHandles.set(handle, input.blob().slice());
+  }
+
+  const tables = new Map();
+  for (let i = input.u32(); i > 0; i--) {
+    const id = input.u32();
+    const table = new ExtTable();
+    for (let j = input.u32(); j > 0; j--) {
+      const key = input.key();
+      table.set(key, input.blob().slice());
+    }
+    tables.set(id, table);
+  }
+
+  return Object.freeze({
+    id,
+    base,
+    module,
+    pages,
+    image,
+    tables,
+    keyHandles,
+    blobHandles,
+    nextBlobHandle,
+    nextTableId,
+    homeTableId,
+  });
+}
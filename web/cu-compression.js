@@ -0,0 +1,160 @@
+/**
+ * Cu Persistence Compression
+ *
+ * Deflate for what persistence writes, through CompressionStream, which
+ * browsers and Node (18+) both have:
+ *
+ * - Snapshot chunks: LuaPersistence and FilePersistence, given
+ *   { compress: true }, deflate each table's packed bytes and mark the
+ *   table as compressed (a record field in IndexedDB, a directory flag in
+ *   the snapshot file).
+ * - Large values: CompressedPersistence wraps any persistence and deflates
+ *   each value of at least `threshold` bytes, in snapshots and journal
+ *   records alike, as COMPRESSED, u32 original length, raw deflate stream.
+ *   COMPRESSED is a leading byte no value encoding (cu-values.js) starts
+ *   with; values are inflated again as they load, so Lua never sees one.
+ *
+ * Values that do not shrink are stored as they are.
+ */
+
+import { encodeJournalRecord, replayJournal, JournalChanges } from './cu-journal.js';
+
+export const COMPRESSED = 0xe2;
+const VALUE_HEADER = 5;
+const FORMAT = 'deflate-raw';
+const DEFAULT_THRESHOLD = 1024;
+
+async function pipe(bytes, transform) {
+  const stream = new Blob([bytes]).stream().pipeThrough(transform);
+  return new Uint8Array(await new Response(stream).arrayBuffer());
+}
+
+/**
+ * @param {Uint8Array} bytes
+ * @returns {Promise<Uint8Array>} Raw deflate stream
+ */
+export function deflate(bytes) {
+  return pipe(bytes, new CompressionStream(FORMAT));
+}
+
+/**
+ * @param {Uint8Array} bytes - From deflate()
+ * @returns {Promise<Uint8Array>}
+ */
+export function inflate(bytes) {
+  return pipe(bytes, new DecompressionStream(FORMAT));
+}
+
+/**
+ * A stored value, compressed if it is at least `threshold` bytes and
+ * shrinks
+ * @param {Uint8Array} value
+ * @param {number} [threshold=1024]
+ * @returns {Promise<Uint8Array>}
+ */
+export async function compressValue(value, threshold = DEFAULT_THRESHOLD) {
+  if (!(value instanceof Uint8Array) || value.byteLength < threshold || value[0] === COMPRESSED) return value;
+  const deflated = await deflate(value);
+  if (deflated.byteLength + VALUE_HEADER >= value.byteLength) return value;
+  const out = new Uint8Array(VALUE_HEADER + deflated.byteLength);
+  out[0] = COMPRESSED;
+  new DataView(out.buffer).setUint32(1, value.byteLength, true);
+  out.set(deflated, VALUE_HEADER);
+  return out;
+}
+
+/**
+ * A value as it was before compressValue()
+ * @param {Uint8Array} value
+ * @param {Function} [inflateBytes] - inflate(), or RestoreWorkers' inflate
+ * @returns {Promise<Uint8Array>}
+ */
+export async function decompressValue(value, inflateBytes = inflate) {
+  if (!(value instanceof Uint8Array) || value[0] !== COMPRESSED) return value;
+  const inflated = await inflateBytes(value.subarray(VALUE_HEADER));
+  const length = new DataView(value.buffer, value.byteOffset + 1, 4).getUint32(0, true);
+  if (inflated.byteLength !== length) throw new Error('Compressed value is corrupt');
+  return inflated;
+}
+
+async function mapValues(tableData, convert) {
+  const out = new Map();
+  const pending = [];
+  for (const [key, value] of tableData) {
+    out.set(key, value);
+    pending.push(convert(value).then((converted) => out.set(key, converted)));
+  }
+  await Promise.all(pending);
+  return out;
+}
+
+async function mapTables(tables, convert) {
+  const out = new Map();
+  const converted = await Promise.all(Array.from(tables, async ([tableId, tableData]) => [tableId, await mapValues(tableData, convert)]));
+  for (const [tableId, tableData] of converted) out.set(tableId, tableData);
+  return out;
+}
+
+/**
+ * Persistence that stores large values compressed in another persistence
+ */
+export class CompressedPersistence {
+  /**
+   * @param {object} inner - LuaPersistence, FilePersistence,
+   *   StoragePersistence or anything with their interface
+   * @param {Object} [options]
+   * @param {number} [options.threshold=1024] - Smallest value compressed
+   * @param {RestoreWorkers} [options.workers] - Inflate values on these
+   *   worker threads as they load (cu-restore-workers.js)
+   */
+  constructor(inner, { threshold = DEFAULT_THRESHOLD, workers = null } = {}) {
+    this.inner = inner;
+    this.threshold = threshold;
+    this.compress = (value) => compressValue(value, this.threshold);
+    const inflateBytes = workers ? (bytes) => workers.inflate(bytes) : inflate;
+    this.decompress = (value) => decompressValue(value, inflateBytes);
+  }
+
+  async init() {
+    await this.inner.init?.();
+  }
+
+  async saveTables(externalTables, metadata) {
+    await this.inner.saveTables(await mapTables(externalTables, this.compress), metadata);
+  }
+
+  async saveChanges(changedTables, removedIds, metadata) {
+    await this.inner.saveChanges(await mapTables(changedTables, this.compress), removedIds, metadata);
+  }
+
+  async appendJournal(record) {
+    const metadata = {};
+    const tables = new Map();
+    replayJournal(tables, [record], metadata, () => new JournalChanges());
+    const changes = [];
+    for (const [tableId, tableChanges] of tables) {
+      for (const [key, value] of tableChanges) {
+        changes.push([tableId, key, value === undefined ? undefined : await this.compress(value)]);
+      }
+    }
+    const { nextTableId, homeTableId = null } = metadata;
+    await this.inner.appendJournal(encodeJournalRecord({ nextTableId, homeTableId, changes }));
+  }
+
+  async loadTables() {
+    const loaded = await this.inner.loadTables();
+    return { ...loaded, tables: await mapTables(loaded.tables, this.decompress) };
+  }
+
+  loadIndex() {
+    return this.inner.loadIndex();
+  }
+
+  async loadTable(tableId, changes) {
+    return mapValues(await this.inner.loadTable(tableId, changes), this.decompress);
+  }
+
+  clearAll() {
+    return this.inner.clearAll();
+  }
+}
@@ -3,6 +3,10 @@
  * Matches the serialization format in src/result.zig
  */
 
+import { decodeValue, stringBytes } from './cu-values.js';
+
+const textDecoder = new TextDecoder();
+
 const SerializationType = {
   NIL: 0,
   BOOLEAN: 1,
@@ -18,51 +22,198 @@ const SerializationType = {
  * Deserialize the result buffer from Lua compute()
  * @param {Uint8Array} buffer - Raw buffer data
  * @param {number} totalLength - Total bytes to read
- * @returns {{output: string, result: any}} Deserialized result
+ * @param {Function} [materialize] - Turns a decodeValue() result for a
+ *   table into JavaScript data; CuInstance passes one that resolves
+ *   external table references
+ * @returns {{output: string, result: any, results: Array}} Deserialized
+ *   result: `result` is the first value returned, `results` all of them
  */
-export function deserializeResult(buffer, totalLength) {
-  if (totalLength <= 0) {
-    return { output: '', result: null };
+export function deserializeResult(buffer, totalLength, materialize = materializeInline) {
+  // First 4 bytes: output length (little-endian u32), then the output
+  const { start, end, truncated, next } = readOutput(buffer, totalLength);
+  let output = start < end ? textDecoder.decode(buffer.subarray(start, end)) : '';
+  if (truncated) output += '...';
+
+  // Deserialize the return values, back to back
+  const results = [];
+  let offset = next;
+  while (offset < totalLength) {
+    const decoded = deserializeValue(buffer, offset, totalLength, materialize);
+    results.push(decoded.value);
+    offset += decoded.bytesRead;
   }
 
-  // First 4 bytes: output length (little-endian u32)
+  return { output, result: results.length > 0 ? results[0] : null, results };
+}
+
+/**
+ * Where the captured output (print statements) lies and where the values
+ * after it start
+ * @returns {{start: number, end: number, truncated: boolean, next: number}}
+ *   `truncated` if the output was cut off and marked with '...'
+ */
+function readOutput(buffer, totalLength) {
   if (totalLength < 4) {
-    return { output: '', result: null };
+    return { start: 0, end: 0, truncated: false, next: Math.max(totalLength, 0) };
   }
 
-  const outputLen = 
-    buffer[0] | 
-    (buffer[1] << 8) | 
-    (buffer[2] << 16) | 
+  const outputLen =
+    buffer[0] |
+    (buffer[1] << 8) |
+    (buffer[2] << 16) |
     (buffer[3] << 24);
 
   let offset = 4;
-  let output = '';
-
-  // Read captured output (print statements)
+  let end = 4;
   if (outputLen > 0 && offset + outputLen <= totalLength) {
-    const outputBytes = buffer.slice(offset, offset + outputLen);
-    output = new TextDecoder().decode(outputBytes);
-    offset += outputLen;
+    end = offset + outputLen;
+    offset = end;
   }
 
   // Check for overflow marker
-  if (offset + 3 <= totalLength && 
-      buffer[offset] === 46 && // '.'
-      buffer[offset + 1] === 46 && 
-      buffer[offset + 2] === 46) {
-    output += '...';
-    offset += 3;
+  const truncated = offset + 3 <= totalLength &&
+    buffer[offset] === 46 && // '.'
+    buffer[offset + 1] === 46 &&
+    buffer[offset + 2] === 46;
+  if (truncated) offset += 3;
+
+  return { start: 4, end, truncated, next: offset };
+}
+
+/**
+ * A result read in place: the output and string values are views of the
+ * buffer it was made over (linear memory, for CuInstance.readResultView),
+ * and text is decoded only when asked for. Other values are decoded on
+ * first use. A view over linear memory is valid until the next compute(),
+ * call() or the like overwrites it, and then throws on access; detach()
+ * copies it first.
+ */
+export class ResultView {
+  /**
+   * @param {Uint8Array} buffer - The result, from its first byte
+   * @param {number} totalLength - Its length
+   * @param {Function} [materialize] - See deserializeResult
+   * @param {Function} [isCurrent] - False once `buffer` no longer holds it
+   */
+  constructor(buffer, totalLength, materialize = materializeInline, isCurrent = () => true) {
+    this.buffer = buffer;
+    this.totalLength = totalLength;
+    this.materialize = materialize;
+    this.isCurrent = isCurrent;
+    this.layout = readOutput(buffer, totalLength);
+    this.spans = null; // [offset, bytesRead, string bytes or null] per value
+    this.decoded = new Map();
+    this.text = null;
+  }
+
+  check() {
+    if (!this.isCurrent()) {
+      throw new Error('Result view is stale: a later run overwrote its memory; detach() it to keep it');
+    }
+  }
+
+  /** The captured output as bytes, without the '...' of a cut-off one */
+  get outputBytes() {
+    this.check();
+    return this.buffer.subarray(this.layout.start, this.layout.end);
   }
 
-  // Deserialize the return value
-  let result = null;
-  if (offset < totalLength) {
-    const decoded = deserializeValue(buffer, offset, totalLength);
-    result = decoded.value;
+  /** The captured output as text */
+  get output() {
+    if (this.text === null) {
+      this.text = textDecoder.decode(this.outputBytes) + (this.layout.truncated ? '...' : '');
+    }
+    return this.text;
   }
 
-  return { output, result };
+  /** The number of values returned */
+  get length() {
+    return this.valueSpans().length;
+  }
+
+  /**
+   * The bytes of returned value `index` if it is a string, as a view
+   * @returns {Uint8Array|null}
+   */
+  bytes(index) {
+    this.check();
+    const span = this.valueSpans()[index];
+    return span?.[2] ?? null;
+  }
+
+  /** Returned value `index`, decoded (strings as text) */
+  value(index) {
+    this.check();
+    const span = this.valueSpans()[index];
+    if (!span) return null;
+    if (!this.decoded.has(index)) {
+      this.decoded.set(index, span[2] ? textDecoder.decode(span[2])
+        : deserializeValue(this.buffer, span[0], this.totalLength, this.materialize).value);
+    }
+    return this.decoded.get(index);
+  }
+
+  /** The first value returned */
+  get result() {
+    return this.value(0);
+  }
+
+  /** Every value returned */
+  get results() {
+    return this.valueSpans().map((span, index) => this.value(index));
+  }
+
+  /**
+   * A copy that stays valid
+   * @returns {ResultView}
+   */
+  detach() {
+    this.check();
+    return new ResultView(this.buffer.slice(0, this.totalLength), this.totalLength, this.materialize);
+  }
+
+  // Strings are only measured; other values are read to find their ends
+  valueSpans() {
+    this.check();
+    if (this.spans === null) {
+      this.spans = [];
+      let offset = this.layout.next;
+      while (offset < this.totalLength) {
+        const string = stringBytes(this.buffer, offset, this.totalLength);
+        if (string) {
+          this.spans.push([offset, string.bytesRead, string.bytes]);
+          offset += string.bytesRead;
+          continue;
+        }
+        const decoded = deserializeValue(this.buffer, offset, this.totalLength, this.materialize);
+        this.decoded.set(this.spans.length, decoded.value);
+        this.spans.push([offset, decoded.bytesRead, null]);
+        offset += decoded.bytesRead;
+      }
+    }
+    return this.spans;
+  }
+}
+
+/**
+ * Inline tables as arrays (keys exactly 1..n) or objects; references to
+ * external tables, which only an instance can resolve, as '<table>'
+ * @param {Object} decoded - decodeValue() result
+ * @returns {*}
+ */
+function materializeInline(decoded) {
+  if (decoded.entries) {
+    if (decoded.entries.every(([key], index) => key === index + 1)) {
+      return decoded.entries.map(([, value]) => materializeInline(value));
+    }
+    const result = {};
+    for (const [key, value] of decoded.entries) {
+      result[key] = materializeInline(value);
+    }
+    return result;
+  }
+  if (decoded.tableId !== undefined) return '<table>';
+  return decoded.value;
 }
 
 /**
@@ -70,9 +221,10 @@ export function deserializeResult(buffer, totalLength) {
  * @param {Uint8Array} buffer
  * @param {number} offset
  * @param {number} maxLen
+ * @param {Function} materialize - See deserializeResult
  * @returns {{value: any, bytesRead: number}}
  */
-function deserializeValue(buffer, offset, maxLen) {
+function deserializeValue(buffer, offset, maxLen, materialize) {
   if (offset >= maxLen) {
     return { value: null, bytesRead: 0 };
   }
@@ -88,7 +240,7 @@ function deserializeValue(buffer, offset, maxLen) {
       if (offset < maxLen) {
         return { value: buffer[offset] !== 0, bytesRead: 2 };
       }
-      return { value: null, bytesRead: 1 };
+      return { value: null, bytesRead: maxLen - offset + 1 };
 
     case SerializationType.INTEGER:
       if (offset + 8 <= maxLen) {
@@ -102,7 +254,7 @@ function deserializeValue(buffer, offset, maxLen) {
         }
         return { value: value, bytesRead: 9 };
       }
-      return { value: null, bytesRead: 1 };
+      return { value: null, bytesRead: maxLen - offset + 1 };
 
     case SerializationType.FLOAT:
       if (offset + 8 <= maxLen) {
@@ -112,7 +264,7 @@ function deserializeValue(buffer, offset, maxLen) {
         const value = view.getFloat64(0, true); // little-endian
         return { value: value, bytesRead: 9 };
       }
-      return { value: null, bytesRead: 1 };
+      return { value: null, bytesRead: maxLen - offset + 1 };
 
     case SerializationType.STRING:
       if (offset + 4 <= maxLen) {
@@ -125,16 +277,11 @@ function deserializeValue(buffer, offset, maxLen) {
         offset += 4;
 
         if (offset + strLen <= maxLen) {
-          const strBytes = buffer.slice(offset, offset + strLen);
-          const str = new TextDecoder().decode(strBytes);
+          const str = textDecoder.decode(buffer.subarray(offset, offset + strLen));
           return { value: str, bytesRead: 5 + strLen };
         }
       }
-      return { value: null, bytesRead: 1 };
-
-    case SerializationType.TABLE:
-      // Tables are returned as string representation
-      return { value: '<table>', bytesRead: 1 };
+      return { value: null, bytesRead: maxLen - offset + 1 };
 
     case SerializationType.FUNCTION:
       return { value: '<function>', bytesRead: 1 };
@@ -150,16 +297,23 @@ function deserializeValue(buffer, offset, maxLen) {
         offset += 4;
 
         if (offset + errLen <= maxLen) {
-          const errBytes = buffer.slice(offset, offset + errLen);
-          const errMsg = new TextDecoder().decode(errBytes);
+          const errMsg = textDecoder.decode(buffer.subarray(offset, offset + errLen));
           return { value: new Error(errMsg), bytesRead: 5 + errLen };
         }
       }
       return { value: new Error('Unknown error'), bytesRead: 1 };
 
-    default:
-      return { value: `<unknown type ${type}>`, bytesRead: 1 };
+    default: {
+      // Compact v2 values (set_value_encoding) and tables; a table is
+      // returned by value (TABLE_INLINE) or, if external, as a reference
+      const decoded = decodeValue(buffer, offset - 1, maxLen);
+      if (decoded) {
+        const table = decoded.entries !== undefined || decoded.tableId !== undefined;
+        return { value: table ? materialize(decoded) : decoded.value, bytesRead: decoded.bytesRead };
+      }
+      return { value: `<unknown type ${type}>`, bytesRead: maxLen - offset + 1 };
+    }
   }
 }
 
-export default { deserializeResult };
\ No newline at end of file
+export default { deserializeResult, ResultView };
\ No newline at end of file
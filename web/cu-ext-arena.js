@@ -0,0 +1,210 @@
+/**
+ * Cu Arena Tables
+ *
+ * Host storage for an external table that keeps its values in one
+ * ArrayBuffer slab rather than a Uint8Array each. The array and hash parts
+ * of ExtTable hold a slot number per key, and each slot's offset and length
+ * in the slab sit in two Uint32Arrays. A table of a million small values is
+ * then a handful of large buffers instead of a million typed arrays for V8's
+ * collector to trace and sweep, and a value arriving from linear memory is
+ * copied once, straight into the slab.
+ *
+ * The slab is append-only: replacing or deleting a value leaves its bytes
+ * behind as garbage. When the slab is full, or garbage is more than half of
+ * it, the live values are copied into a fresh slab sized for them. Views
+ * handed out by get() and entries() keep reading the old slab, which is
+ * never written again, so they stay valid. A clone shares the slab until
+ * either side writes.
+ *
+ * setTableStorage('arena') (cu-instance.js) makes new and restored plain
+ * tables arena tables; cache and columnar tables keep their own storage.
+ */
+
+import { ExtTable, normalizeKey } from './cu-ext-table.js';
+
+const textEncoder = new TextEncoder();
+
+// Most external tables are small records, so slabs start small and double
+const MIN_SLAB_BYTES = 256;
+const MIN_SLOTS = 8;
+
+export class ArenaTable extends ExtTable {
+  constructor() {
+    super();
+    this.resetStorage();
+  }
+
+  resetStorage() {
+    this.slab = new Uint8Array(0);
+    this.used = 0; // bytes appended to the slab
+    this.garbage = 0; // of those, bytes no slot refers to
+    this.offsets = new Uint32Array(MIN_SLOTS);
+    this.lengths = new Uint32Array(MIN_SLOTS);
+    this.slots = 0; // slot numbers handed out
+    this.freeSlots = [];
+    this.sharedSlab = false; // a clone reads this slab too: copy before appending
+  }
+
+  /**
+   * An arena table with a copy of `table`'s entries and its change tracking
+   * (dirty flag, journal, key order, index hook)
+   * @param {ExtTable} table
+   * @returns {ArenaTable}
+   */
+  static from(table) {
+    const arena = new ArenaTable();
+    for (const [key, value] of table) {
+      const slot = arena.newSlot();
+      arena.write(slot, value);
+      arena.place(key, slot);
+    }
+    arena.bytes = arena.used;
+    arena.dirty = table.dirty;
+    arena.changes = table.changes;
+    arena.order = table.order;
+    arena.onChange = table.onChange;
+    return arena;
+  }
+
+  /**
+   * A plain ExtTable with the same entries and change tracking, for
+   * setTableStorage('map')
+   * @returns {ExtTable}
+   */
+  toPlain() {
+    const table = new ExtTable();
+    for (const [key, value] of this) table.place(key, value.slice());
+    table.bytes = this.bytes;
+    table.dirty = this.dirty;
+    table.changes = this.changes;
+    table.order = this.order;
+    table.onChange = this.onChange;
+    return table;
+  }
+
+  get(key) {
+    const slot = this.lookup(normalizeKey(key));
+    return slot === undefined ? undefined : this.view(slot);
+  }
+
+  has(key) {
+    return this.lookup(normalizeKey(key)) !== undefined;
+  }
+
+  set(key, value) {
+    key = normalizeKey(key);
+    let slot = this.lookup(key);
+    const added = slot === undefined;
+    const old = added ? 0 : this.lengths[slot];
+    if (added) {
+      slot = this.freeSlots.pop() ?? this.newSlot();
+    } else {
+      this.garbage += old;
+      this.lengths[slot] = 0;
+    }
+    const stored = this.write(slot, value);
+    this.bytes += stored.length - old;
+    this.dirty = true;
+    this.version++;
+    if (this.changes) this.changes.set(key, stored);
+    if (this.order && added) this.order.insert(key);
+    this.place(key, slot);
+    this.onChange?.(key, stored);
+    return this;
+  }
+
+  storedBytes(key) {
+    const slot = this.lookup(key);
+    return slot === undefined ? 0 : this.lengths[slot];
+  }
+
+  removeKey(key) {
+    const slot = this.lookup(key);
+    if (slot === undefined) return false;
+    this.garbage += this.lengths[slot];
+    this.lengths[slot] = 0;
+    this.freeSlots.push(slot);
+    super.removeKey(key);
+    if (this.garbage > this.used / 2 && this.used > MIN_SLAB_BYTES) this.reslab(0);
+    return true;
+  }
+
+  clear() {
+    super.clear();
+    this.resetStorage();
+  }
+
+  clone() {
+    const copy = new ArenaTable();
+    copy.array = this.array.slice();
+    copy.holes = this.holes;
+    copy.hash = new Map(this.hash);
+    copy.slab = this.slab;
+    copy.used = this.used;
+    copy.garbage = this.garbage;
+    copy.offsets = this.offsets.slice();
+    copy.lengths = this.lengths.slice();
+    copy.slots = this.slots;
+    copy.freeSlots = this.freeSlots.slice();
+    copy.bytes = this.bytes;
+    copy.sharedSlab = this.sharedSlab = true;
+    return copy;
+  }
+
+  *entries() {
+    for (const [key, slot] of super.entries()) yield [key, this.view(slot)];
+  }
+
+  view(slot) {
+    const offset = this.offsets[slot];
+    return this.slab.subarray(offset, offset + this.lengths[slot]);
+  }
+
+  newSlot() {
+    if (this.slots === this.offsets.length) {
+      const offsets = new Uint32Array(this.slots * 2);
+      const lengths = new Uint32Array(this.slots * 2);
+      offsets.set(this.offsets);
+      lengths.set(this.lengths);
+      this.offsets = offsets;
+      this.lengths = lengths;
+    }
+    return this.slots++;
+  }
+
+  // Append a value's bytes for `slot`; returns a view of them in the slab.
+  // Legacy string values are stored as their UTF-8 bytes, as they are sent.
+  write(slot, value) {
+    if (typeof value === 'string') value = textEncoder.encode(value);
+    if (this.sharedSlab || this.slab.length - this.used < value.length) this.reslab(value.length);
+    const offset = this.used;
+    this.slab.set(value, offset);
+    this.offsets[slot] = offset;
+    this.lengths[slot] = value.length;
+    this.used += value.length;
+    return this.slab.subarray(offset, this.used);
+  }
+
+  // Copy the live values into a fresh slab with room for `extra` more bytes
+  // and as much again, so appends stay amortized O(1)
+  reslab(extra) {
+    const live = this.used - this.garbage;
+    let size = MIN_SLAB_BYTES;
+    while (size < (live + extra) * 2) size *= 2;
+    const slab = new Uint8Array(size);
+    let used = 0;
+    const move = (slot) => {
+      const offset = this.offsets[slot];
+      const length = this.lengths[slot];
+      slab.set(this.slab.subarray(offset, offset + length), used);
+      this.offsets[slot] = used;
+      used += length;
+    };
+    for (const slot of this.array) if (slot !== undefined) move(slot);
+    for (const slot of this.hash.values()) move(slot);
+    this.slab = slab;
+    this.used = used;
+    this.garbage = 0;
+    this.sharedSlab = false;
+  }
+}
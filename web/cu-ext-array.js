@@ -0,0 +1,123 @@
+/**
+ * Cu Array Tables
+ *
+ * ext.array() makes an external table that holds a sequence: values under
+ * keys 1..n with no holes, kept in ExtTable's dense array part. Lua appends
+ * with ext.push(t, v), removes the last value with ext.pop(t) and reads a
+ * run of values with ext.slice(t, i, j), each one host call
+ * (js_ext_table_push, js_ext_table_pop, js_ext_table_slice). #t is n, the
+ * sequence's true border.
+ *
+ * t[i] = v still works for i in 1..n + 1, and t[n] = nil removes the last
+ * value. Writes anywhere else would break the sequence and are refused. The
+ * kind is stored with the entries under ARRAY_KEY, so a restored table is an
+ * array table again.
+ */
+
+import { ExtTable, normalizeKey } from './cu-ext-table.js';
+import { encodeValue } from './cu-values.js';
+
+export const ARRAY_KEY = '__array';
+
+const STORED_KIND = encodeValue('array', false);
+
+export class ArrayTable extends ExtTable {
+  /** The number of values, n */
+  get length() {
+    return this.array.length;
+  }
+
+  set(key, value) {
+    key = normalizeKey(key);
+    if (!Number.isInteger(key) || key < 1 || key > this.array.length + 1) {
+      throw new RangeError(`array table keys are 1..${this.array.length + 1}, not ${key}`);
+    }
+    return super.set(key, value);
+  }
+
+  delete(key) {
+    key = normalizeKey(key);
+    if (!this.inArray(key)) return false;
+    if (key !== this.array.length) {
+      throw new RangeError(`only the last value (${this.array.length}) of an array table can be removed, not ${key}`);
+    }
+    return super.delete(key);
+  }
+
+  /**
+   * Append a value at n + 1
+   * @returns {number} The new length
+   */
+  push(value) {
+    super.set(this.array.length + 1, value);
+    return this.array.length;
+  }
+
+  /**
+   * Remove the value at n
+   * @returns {Uint8Array|undefined} It, or undefined if the table is empty
+   */
+  pop() {
+    const value = this.array[this.array.length - 1];
+    if (value !== undefined) super.delete(this.array.length);
+    return value;
+  }
+
+  /**
+   * The values at first..last, both included and clamped to 1..n
+   * @returns {Array<Uint8Array>}
+   */
+  slice(first, last) {
+    return this.array.slice(Math.max(first, 1) - 1, Math.max(last, 0));
+  }
+
+  /** Record the kind with a journal record that changes the table */
+  seal() {
+    if (this.changes?.size) this.changes.set(ARRAY_KEY, this.storedKind());
+  }
+
+  storedKind() {
+    return STORED_KIND;
+  }
+
+  /** The values, then the kind */
+  *[Symbol.iterator]() {
+    yield* this.entries();
+    yield [ARRAY_KEY, this.storedKind()];
+  }
+
+  clone() {
+    const copy = new ArrayTable();
+    copy.array = this.array.slice();
+    copy.bytes = this.bytes;
+    return copy;
+  }
+
+  /**
+   * The ArrayTable stored in a table's entries
+   * @returns {ArrayTable|null} null if they are not a sequence
+   */
+  static fromStorage(table) {
+    const values = new ArrayTable();
+    for (const [key, value] of table) {
+      if (key === ARRAY_KEY) continue;
+      if (!Number.isInteger(key) || key < 1) return null;
+      values.array[key - 1] = value;
+      values.bytes += value.length;
+    }
+    if (values.array.includes(undefined)) return null;
+    values.dirty = table.dirty;
+    values.changes = table.changes;
+    return values;
+  }
+}
+
+/**
+ * A restored table as an ArrayTable if it holds one's entries, else as is
+ * @param {ExtTable} table
+ * @returns {ExtTable}
+ */
+export function restoreArray(table) {
+  if (table instanceof ArrayTable || !table.has(ARRAY_KEY)) return table;
+  return ArrayTable.fromStorage(table) ?? table;
+}
@@ -0,0 +1,146 @@
+/**
+ * Cu Cache Tables
+ *
+ * ext.cache{ max = n, ttl = seconds } makes an external table for caching:
+ * once it holds more than max entries it evicts the least recently used
+ * one (read or stored), and an entry expires ttl seconds after it was
+ * stored. Either limit may be left out (0).
+ *
+ * Evictions and expiries are deletions like any other, so they are
+ * journaled and saved. Expired entries are dropped when they are read, when
+ * the keys are listed (pairs, #t after a scan) and when the table is
+ * persisted, so they are never saved. The limits are stored with the
+ * entries under CACHE_KEY, with the time they were saved; after a restore
+ * an entry expires at the latest one ttl after that time.
+ */
+
+import { ExtTable, normalizeKey } from './cu-ext-table.js';
+import { decodeValue, encodeValue } from './cu-values.js';
+
+export const CACHE_KEY = '__cache';
+
+export class CacheTable extends ExtTable {
+  /**
+   * @param {number} [maxEntries=0] - Evict past this many entries (0: no bound)
+   * @param {number} [ttlSeconds=0] - Expire entries this long after they were stored (0: never)
+   */
+  constructor(maxEntries = 0, ttlSeconds = 0) {
+    super();
+    this.maxEntries = maxEntries;
+    this.ttlMs = ttlSeconds * 1000;
+    this.expiry = new Map(); // key -> expiry time (ms), least recently used first
+    this.now = Date.now;
+  }
+
+  get(key) {
+    key = normalizeKey(key);
+    const value = super.get(key);
+    if (value === undefined) return undefined;
+    const expires = this.expiry.get(key);
+    if (expires <= this.now()) {
+      this.delete(key);
+      return undefined;
+    }
+    if (this.maxEntries > 0) {
+      this.expiry.delete(key);
+      this.expiry.set(key, expires);
+    }
+    return value;
+  }
+
+  set(key, value) {
+    key = normalizeKey(key);
+    super.set(key, value);
+    this.expiry.delete(key);
+    this.expiry.set(key, this.ttlMs > 0 ? this.now() + this.ttlMs : Infinity);
+    if (this.maxEntries > 0) {
+      for (const oldest of this.expiry.keys()) {
+        if (this.expiry.size <= this.maxEntries) break;
+        this.delete(oldest);
+      }
+    }
+    return this;
+  }
+
+  delete(key) {
+    key = normalizeKey(key);
+    this.expiry.delete(key);
+    return super.delete(key);
+  }
+
+  clear() {
+    this.expiry.clear();
+    super.clear();
+  }
+
+  /** Delete the entries that have expired */
+  sweep() {
+    if (this.ttlMs === 0) return;
+    const now = this.now();
+    for (const [key, expires] of this.expiry) {
+      if (expires <= now) this.delete(key);
+    }
+  }
+
+  *keys() {
+    this.sweep();
+    yield* super.keys();
+  }
+
+  /** Record the limits with a journal record that changes the table */
+  seal() {
+    if (this.changes?.size) this.changes.set(CACHE_KEY, this.storedLimits());
+  }
+
+  storedLimits() {
+    return encodeValue(`${this.maxEntries} ${this.ttlMs / 1000} ${this.now()}`, false);
+  }
+
+  /** The live entries, least recently used first, then the limits */
+  *[Symbol.iterator]() {
+    this.sweep();
+    for (const key of this.expiry.keys()) yield [key, super.get(key)];
+    yield [CACHE_KEY, this.storedLimits()];
+  }
+
+  clone() {
+    const copy = new CacheTable(this.maxEntries, this.ttlMs / 1000);
+    for (const [key, expires] of this.expiry) {
+      ExtTable.prototype.set.call(copy, key, super.get(key));
+      copy.expiry.set(key, expires);
+    }
+    copy.now = this.now;
+    return copy;
+  }
+
+  /**
+   * The CacheTable stored in a table's entries
+   * @returns {CacheTable|null} null if they are not a valid one
+   */
+  static fromStorage(table) {
+    const bytes = table.get(CACHE_KEY);
+    const limits = bytes instanceof Uint8Array ? String(decodeValue(bytes)?.value).split(' ').map(Number) : [];
+    if (limits.length !== 3 || !limits.every((n) => Number.isFinite(n) && n >= 0)) return null;
+    const [maxEntries, ttlSeconds, savedAt] = limits;
+    const cache = new CacheTable(maxEntries, ttlSeconds);
+    for (const [key, value] of table) {
+      if (key === CACHE_KEY) continue;
+      ExtTable.prototype.set.call(cache, key, value);
+      cache.expiry.set(key, cache.ttlMs > 0 ? savedAt + cache.ttlMs : Infinity);
+    }
+    cache.sweep();
+    cache.dirty = table.dirty;
+    cache.changes = table.changes;
+    return cache;
+  }
+}
+
+/**
+ * A restored table as a CacheTable if it holds one's entries, else as is
+ * @param {ExtTable} table
+ * @returns {ExtTable}
+ */
+export function restoreCache(table) {
+  if (table instanceof CacheTable || !table.has(CACHE_KEY)) return table;
+  return CacheTable.fromStorage(table) ?? table;
+}
@@ -0,0 +1,309 @@
+/**
+ * Cu Columnar Tables
+ *
+ * ext.columns(schema) makes an external table for an array of records with
+ * the same numeric fields, e.g. { ts = "i64", price = "f64", qty = "i64" }.
+ * It holds one packed column per field instead of an external table per
+ * record, so a million rows are a few typed arrays rather than a million
+ * tables with a string key per field.
+ *
+ * To Lua it is an array of rows: t[i] is materialized when read, as an
+ * inline table of the row's fields; #t is the row count; and a row stored
+ * at #t + 1 (by value with ext.append, or as a table) is appended. Only the
+ * last row can be removed. ext.column(t, field, i, j) reads rows i..j of
+ * one column as a vec, for the vec kernels.
+ *
+ * It is persisted in the typed array serialization: COLUMNS_KEY holds the
+ * schema, ROWS_KEY the row count and "field#k" the k-th chunk of CHUNK_ROWS
+ * rows of a column, so saving a grown table rewrites only its last chunks.
+ * Those are the entries for...of yields, for persistence, the journal
+ * (through seal()) and checkpoints; get/set/keys/size are the rows the
+ * bridge sees. restoreColumns() turns restored entries back into a
+ * ColumnTable.
+ */
+
+import { ExtTable, normalizeKey } from './cu-ext-table.js';
+import { decodeValue, encodeValue, encodeRecord, encodeTypedArray } from './cu-values.js';
+
+export const COLUMNS_KEY = '__columns';
+export const ROWS_KEY = '__rows';
+export const CHUNK_ROWS = 65536;
+
+const KINDS = { f64: Float64Array, i64: BigInt64Array };
+
+/**
+ * Parse a schema: one "field:kind" per line, kind f64 or i64
+ * @returns {Array<[string, string]>|null} Fields in name order, or null
+ */
+export function parseSchema(text) {
+  const fields = [];
+  for (const line of text.split('\n')) {
+    if (line === '') continue;
+    const split = line.lastIndexOf(':');
+    const name = line.slice(0, split);
+    const kind = line.slice(split + 1);
+    if (split <= 0 || !KINDS[kind] || fields.some(([other]) => other === name)) return null;
+    fields.push([name, kind]);
+  }
+  if (fields.length === 0) return null;
+  return fields.sort(([a], [b]) => (a < b ? -1 : a > b ? 1 : 0));
+}
+
+// A stored field value as a column element
+function toElement(kind, value) {
+  if (kind === 'f64') return value === undefined || value === null ? NaN : Number(value);
+  if (typeof value === 'bigint') return BigInt.asIntN(64, value);
+  return Number.isFinite(value) ? BigInt(Math.trunc(value)) : 0n;
+}
+
+export class ColumnTable extends ExtTable {
+  /**
+   * @param {Array<[string, string]>} schema - From parseSchema()
+   * @param {Map<number, ExtTable>} tables - To read rows stored as tables
+   */
+  constructor(schema, tables) {
+    super();
+    this.schema = schema;
+    this.tables = tables;
+    this.columns = schema.map(([name, kind]) => ({ name, kind, data: new KINDS[kind](16) }));
+    this.length = 0;
+    this.chunks = new Map(); // storage key -> encoded chunk, as last sealed
+    this.staleFrom = 0; // rows from here on changed since seal()
+  }
+
+  get size() {
+    return this.length;
+  }
+
+  isArray() {
+    return true;
+  }
+
+  // The 0-based row of a key, or -1
+  row(key) {
+    key = normalizeKey(key);
+    return Number.isInteger(key) && key >= 1 && key <= this.length ? key - 1 : -1;
+  }
+
+  get(key) {
+    const row = this.row(key);
+    if (row < 0) return undefined;
+    return encodeRecord(this.columns.map(({ name, data }) => [name, data[row]]));
+  }
+
+  has(key) {
+    return this.row(key) >= 0;
+  }
+
+  /** Replace row `key`, or append it at #t + 1; `value` is a record or a table reference */
+  set(key, value) {
+    key = normalizeKey(key);
+    if (!Number.isInteger(key) || key < 1 || key > this.length + 1) {
+      throw new Error(`Columnar table rows are 1..#t + 1, not ${key}`);
+    }
+    const decoded = value instanceof Uint8Array ? decodeValue(value) : null;
+    const fields = new Map();
+    if (decoded?.entries) {
+      for (const [name, field] of decoded.entries) fields.set(name, field.value);
+    } else if (decoded?.tableId !== undefined) {
+      const record = this.tables.get(decoded.tableId);
+      for (const { name } of this.columns) {
+        const bytes = record?.get(name);
+        if (bytes instanceof Uint8Array) fields.set(name, decodeValue(bytes)?.value);
+      }
+    } else {
+      throw new Error('Columnar table rows must be tables');
+    }
+
+    const row = key - 1;
+    if (row === this.length) this.grow(row + 1);
+    for (const { name, kind, data } of this.columns) data[row] = toElement(kind, fields.get(name));
+    this.touch(row);
+    this.onChange?.(key, value);
+    return this;
+  }
+
+  delete(key) {
+    const row = this.row(key);
+    if (row < 0) return false;
+    if (row !== this.length - 1) throw new Error('Only the last row of a columnar table can be removed');
+    this.length--;
+    this.touch(row);
+    this.onChange?.(row + 1, undefined);
+    return true;
+  }
+
+  clear() {
+    this.length = 0;
+    this.touch(0);
+  }
+
+  ordered() {
+    return this;
+  }
+
+  /** Rows from lo to hi, as ExtTable.range(); string keys are never rows */
+  range(lo, hi, { limit = 0, reverse = false } = {}) {
+    const first = lo === null ? 1 : Math.max(1, Math.ceil(Number(normalizeKey(lo))));
+    const last = hi === null ? this.length : Math.min(this.length, Math.floor(Number(normalizeKey(hi))));
+    const keys = [];
+    if (!(first <= last)) return keys;
+    const count = limit > 0 ? Math.min(limit, last - first + 1) : last - first + 1;
+    for (let i = 0; i < count; i++) keys.push(reverse ? last - i : first + i);
+    return keys;
+  }
+
+  *keys() {
+    for (let i = 1; i <= this.length; i++) yield i;
+  }
+
+  *entries() {
+    for (const key of this.keys()) yield [key, this.get(key)];
+  }
+
+  /**
+   * Elements first..last (1-based, both included) of a column, as a view
+   * of its storage; none if last < first
+   * @returns {Float64Array|BigInt64Array|null} null if there is no such column
+   */
+  column(name, first = 1, last = Infinity) {
+    const column = this.columns.find((candidate) => candidate.name === name);
+    if (!column) return null;
+    const end = Math.max(0, Math.min(last, this.length));
+    const start = Math.min(Math.max(first, 1) - 1, end);
+    return column.data.subarray(start, end);
+  }
+
+  /** The rows as plain objects; i64 fields are numbers where they are exact */
+  toArray() {
+    const rows = new Array(this.length);
+    for (let row = 0; row < this.length; row++) {
+      const record = {};
+      for (const { name, data } of this.columns) {
+        const value = data[row];
+        record[name] = typeof value === 'bigint' && Number.isSafeInteger(Number(value)) ? Number(value) : value;
+      }
+      rows[row] = record;
+    }
+    return rows;
+  }
+
+  grow(length) {
+    if (length > this.columns[0].data.length) {
+      for (const column of this.columns) {
+        const data = new KINDS[column.kind](Math.max(length, column.data.length * 2, 16));
+        data.set(column.data.subarray(0, this.length));
+        column.data = data;
+      }
+    }
+    this.length = length;
+  }
+
+  touch(row) {
+    this.dirty = true;
+    this.version++;
+    if (row < this.staleFrom) this.staleFrom = row;
+    this.bytes = this.length * this.rowBytes();
+  }
+
+  // Column storage per row: every kind is 8 bytes
+  rowBytes() {
+    return this.columns.length * 8;
+  }
+
+  storedBytes(key) {
+    return this.has(key) ? this.rowBytes() : 0;
+  }
+
+  /**
+   * Encode the chunks changed since the last seal, and record them in
+   * `changes` when journaling
+   */
+  seal() {
+    if (this.staleFrom === Infinity) return;
+    const chunkCount = Math.ceil(this.length / CHUNK_ROWS);
+    const changed = [];
+    if (this.chunks.size === 0) changed.push([COLUMNS_KEY, this.storedSchema()]);
+    changed.push([ROWS_KEY, encodeValue(this.length, false)]);
+    for (const { name, data } of this.columns) {
+      for (let k = Math.floor(this.staleFrom / CHUNK_ROWS); k < chunkCount; k++) {
+        const chunk = encodeTypedArray(data.subarray(k * CHUNK_ROWS, Math.min((k + 1) * CHUNK_ROWS, this.length)));
+        this.chunks.set(`${name}#${k}`, chunk);
+        changed.push([`${name}#${k}`, chunk]);
+      }
+      for (let k = chunkCount; this.chunks.has(`${name}#${k}`); k++) {
+        this.chunks.delete(`${name}#${k}`);
+        changed.push([`${name}#${k}`, undefined]);
+      }
+    }
+    this.staleFrom = Infinity;
+    if (this.changes) {
+      for (const [key, value] of changed) this.changes.set(key, value);
+    }
+  }
+
+  storedSchema() {
+    return encodeValue(this.schema.map(([name, kind]) => `${name}:${kind}`).join('\n'), false);
+  }
+
+  /** The storage entries: schema, row count and column chunks */
+  *[Symbol.iterator]() {
+    this.seal();
+    yield [COLUMNS_KEY, this.storedSchema()];
+    yield [ROWS_KEY, encodeValue(this.length, false)];
+    yield* this.chunks;
+  }
+
+  clone() {
+    const copy = new ColumnTable(this.schema, this.tables);
+    copy.columns = this.columns.map((column) => ({ ...column, data: column.data.slice(0, this.length) }));
+    copy.length = this.length;
+    copy.chunks = new Map(this.chunks);
+    copy.staleFrom = this.staleFrom;
+    copy.bytes = this.bytes;
+    return copy;
+  }
+
+  /**
+   * The ColumnTable stored in a table's entries
+   * @returns {ColumnTable|null} null if they are not a valid one
+   */
+  static fromStorage(table, tables) {
+    const schemaBytes = table.get(COLUMNS_KEY);
+    const schema = schemaBytes instanceof Uint8Array ? parseSchema(String(decodeValue(schemaBytes)?.value)) : null;
+    if (!schema) return null;
+    const columns = new ColumnTable(schema, tables);
+    const length = Number(decodeValue(table.get(ROWS_KEY) ?? new Uint8Array(0))?.value ?? 0);
+    columns.grow(length);
+    for (const column of columns.columns) {
+      for (let k = 0; k * CHUNK_ROWS < length; k++) {
+        const bytes = table.get(`${column.name}#${k}`);
+        const chunk = bytes instanceof Uint8Array ? decodeValue(bytes)?.value : null;
+        if (!(chunk instanceof KINDS[column.kind])) return null;
+        column.data.set(chunk.subarray(0, Math.min(CHUNK_ROWS, length - k * CHUNK_ROWS)), k * CHUNK_ROWS);
+        columns.chunks.set(`${column.name}#${k}`, bytes);
+      }
+    }
+    columns.staleFrom = Infinity;
+    columns.bytes = length * columns.rowBytes();
+    columns.dirty = table.dirty;
+    columns.changes = table.changes;
+    return columns;
+  }
+}
+
+/**
+ * A restored table as a ColumnTable if it holds one's entries, else as is.
+ * A ColumnTable (a clone from a snapshot) is moved over to `tables`.
+ * @param {ExtTable} table
+ * @param {Map<number, ExtTable>} tables - The instance's external tables
+ * @returns {ExtTable}
+ */
+export function restoreColumns(table, tables) {
+  if (table instanceof ColumnTable) {
+    table.tables = tables;
+    return table;
+  }
+  if (!table.has(COLUMNS_KEY)) return table;
+  return ColumnTable.fromStorage(table, tables) ?? table;
+}
@@ -0,0 +1,218 @@
+/**
+ * Cu Secondary Indexes
+ *
+ * ext.index(t, field) declares an index on `field` of the records in the
+ * external table t, the tables stored under its keys. ext.lookup(t, field,
+ * value) then finds the keys of the records whose field equals value in
+ * O(1), without reading the other records. Only string and number field
+ * values are indexed, and only records stored as external tables (not
+ * inline ones, see set_inline_table_limits).
+ *
+ * An index is built by one pass over t the first time it is used, then
+ * kept current: t and each of its records report their changes through
+ * ExtTable.onChange, so storing, replacing or removing a record and
+ * changing a record's field update the index as they happen.
+ *
+ * Declarations are saved in the snapshot metadata (`indexes`) and the
+ * indexes are rebuilt on first use after a restore. A lookup on a field
+ * that was never declared builds its index the same way, so a declaration
+ * lost with an unsnapshotted journal only costs that first pass.
+ */
+
+import { decodeValue } from './cu-values.js';
+import { normalizeKey } from './cu-ext-table.js';
+
+/**
+ * The key a field value is indexed under, or undefined if it is not
+ * indexed. Numbers and strings compare as external table keys do, so an
+ * integer and its decimal string are the same value.
+ */
+function indexKey(value) {
+  if (typeof value === 'number') return Number.isInteger(value) ? value : String(value);
+  if (typeof value === 'string') return normalizeKey(value);
+  return undefined;
+}
+
+// The ID of the record table a stored value refers to, if it is one
+function recordId(bytes) {
+  return bytes instanceof Uint8Array ? decodeValue(bytes)?.tableId : undefined;
+}
+
+/**
+ * One field's index over the records of one table
+ */
+class TableIndex {
+  constructor(field) {
+    this.field = field;
+    this.byValue = new Map(); // indexed value -> Set of keys in table
+    this.valueOf = new Map(); // key in table -> indexed value
+  }
+
+  add(key, value) {
+    if (value === undefined) return;
+    let keys = this.byValue.get(value);
+    if (!keys) {
+      keys = new Set();
+      this.byValue.set(value, keys);
+    }
+    keys.add(key);
+    this.valueOf.set(key, value);
+  }
+
+  remove(key) {
+    const value = this.valueOf.get(key);
+    if (value === undefined) return;
+    this.valueOf.delete(key);
+    const keys = this.byValue.get(value);
+    keys.delete(key);
+    if (keys.size === 0) this.byValue.delete(value);
+  }
+}
+
+export class TableIndexes {
+  /**
+   * @param {Map<number, ExtTable>} tables - The instance's external tables
+   */
+  constructor(tables) {
+    this.tables = tables;
+    this.declared = new Map(); // table ID -> Set of fields
+    this.built = new Map(); // table ID -> {table, fields: Map of field -> TableIndex}
+    this.owners = new Map(); // record table ID -> Map of table ID -> key
+    this.watched = new Set(); // ExtTables whose onChange reports here
+  }
+
+  /** Declare an index on `field` of `tableId`'s records and build it */
+  declare(tableId, field) {
+    let fields = this.declared.get(tableId);
+    if (!fields) {
+      fields = new Set();
+      this.declared.set(tableId, fields);
+    }
+    fields.add(field);
+    this.index(tableId, field);
+  }
+
+  /**
+   * Keys of the records of `tableId` whose `field` equals `value`
+   * @param {number} [limit=0] - At most this many (0: all)
+   * @returns {Array<string|number>}
+   */
+  lookup(tableId, field, value, limit = 0) {
+    const index = this.index(tableId, field);
+    const keys = index?.byValue.get(indexKey(value));
+    if (!keys) return [];
+    const found = [];
+    for (const key of keys) {
+      if (limit > 0 && found.length >= limit) break;
+      found.push(key);
+    }
+    return found;
+  }
+
+  /** @returns {Array<[number, string]>} Declared indexes of live tables */
+  declarations() {
+    const list = [];
+    for (const [tableId, fields] of this.declared) {
+      if (!this.tables.has(tableId)) continue;
+      for (const field of fields) list.push([tableId, field]);
+    }
+    return list;
+  }
+
+  /**
+   * Replace the declarations with saved ones (from declarations()) and drop
+   * every built index; the tables they covered were replaced
+   */
+  restore(declarations = []) {
+    this.reset();
+    this.declared.clear();
+    for (const [tableId, field] of declarations) {
+      let fields = this.declared.get(Number(tableId));
+      if (!fields) {
+        fields = new Set();
+        this.declared.set(Number(tableId), fields);
+      }
+      fields.add(String(field));
+    }
+  }
+
+  /** Drop the built indexes, which are rebuilt on their next use */
+  reset() {
+    for (const table of this.watched) table.onChange = null;
+    this.watched.clear();
+    this.built.clear();
+    this.owners.clear();
+  }
+
+  // Report the changes of `table` (an indexed table, a record or both)
+  watch(tableId, table) {
+    if (this.watched.has(table)) return;
+    this.watched.add(table);
+    table.onChange = (key, value) => {
+      if (this.built.has(tableId)) this.recordChanged(tableId, key, value);
+      if (this.owners.has(tableId)) this.fieldChanged(tableId, key);
+    };
+  }
+
+  // The built index of `field` on `tableId`, built now if it is missing or
+  // was built over a table object since replaced
+  index(tableId, field) {
+    const table = this.tables.get(tableId);
+    if (!table) return null;
+    let built = this.built.get(tableId);
+    if (built && built.table !== table) {
+      this.reset();
+      built = undefined;
+    }
+    if (!built) {
+      built = { table, fields: new Map() };
+      this.built.set(tableId, built);
+      this.watch(tableId, table);
+    }
+    let index = built.fields.get(field);
+    if (!index) {
+      index = new TableIndex(field);
+      built.fields.set(field, index);
+      for (const [key, value] of table) this.addRecord(tableId, index, key, recordId(value));
+    }
+    return index;
+  }
+
+  addRecord(tableId, index, key, recordTableId) {
+    if (recordTableId === undefined) return;
+    const record = this.tables.get(recordTableId);
+    if (!record) return;
+    let owners = this.owners.get(recordTableId);
+    if (!owners) {
+      owners = new Map();
+      this.owners.set(recordTableId, owners);
+      this.watch(recordTableId, record);
+    }
+    owners.set(tableId, key);
+    const value = record.get(index.field);
+    index.add(key, value instanceof Uint8Array ? indexKey(decodeValue(value)?.value) : undefined);
+  }
+
+  // A record was stored under, or removed from, `key` of an indexed table
+  recordChanged(tableId, key, value) {
+    const recordTableId = recordId(value);
+    for (const index of this.built.get(tableId).fields.values()) {
+      index.remove(key);
+      this.addRecord(tableId, index, key, recordTableId);
+    }
+  }
+
+  // `field` of record table `recordTableId` changed
+  fieldChanged(recordTableId, field) {
+    const owners = this.owners.get(recordTableId);
+    const record = this.tables.get(recordTableId);
+    for (const [tableId, key] of owners) {
+      const index = this.built.get(tableId)?.fields.get(field);
+      // The record may since have been replaced under its key
+      if (!index || recordId(this.tables.get(tableId)?.get(key)) !== recordTableId) continue;
+      index.remove(key);
+      const value = record?.get(field);
+      index.add(key, value instanceof Uint8Array ? indexKey(decodeValue(value)?.value) : undefined);
+    }
+  }
+}
@@ -0,0 +1,444 @@
+/**
+ * Cu External Table Storage
+ *
+ * Host-side storage for one external table, with the Map interface the
+ * host functions use (get/set/has/delete/clear/size/keys/entries and
+ * for...of). Integer keys 1..n live in a dense array and everything else in
+ * a Map, so array-like _home data never goes through string hashing.
+ *
+ * A canonical decimal string ("7", "-3") is the same key as the integer.
+ * That is how keys behaved when every key crossed the bridge as a string,
+ * and it lets state saved with string keys load into the array part.
+ *
+ * Range scans (ext.range / ext.rrange) read keys in order from an
+ * OrderedKeys index: numbers first, by value, then strings. A table builds
+ * it on its first range scan, or at creation for ext.ordered(), and keeps it
+ * current from then on. The index is not persisted; a restored table builds
+ * it again when first ranged.
+ *
+ * onChange, when set, is called after each set, delete and clear; the
+ * secondary indexes of cu-ext-index.js stay current through it.
+ *
+ * `bytes` is the total length of the values the table holds itself, kept
+ * current by set, delete and clear, so getTableInfo() and table quotas
+ * (setTableQuota in cu-instance.js) never walk the entries.
+ */
+
+// Type bytes of tagged keys (set_ext_key_encoding(1) or (2)); integers and
+// strings use the same values as the corresponding value tags
+export const KEY_TAG_INTEGER = 0x02;
+export const KEY_TAG_STRING = 0x04;
+export const KEY_TAG_HANDLE = 0x10;
+
+const CANONICAL_INTEGER = /^(0|-?[1-9][0-9]*)$/;
+
+const textEncoder = new TextEncoder();
+const textDecoder = new TextDecoder();
+
+/**
+ * Map canonical decimal strings to the integer key they stand for
+ * @param {string|number} key
+ * @returns {string|number}
+ */
+export function normalizeKey(key) {
+  if (typeof key === 'string' && CANONICAL_INTEGER.test(key)) {
+    const value = Number(key);
+    if (Number.isSafeInteger(value)) return value;
+  }
+  return key;
+}
+
+/**
+ * Register an interned key (js_ext_key_intern)
+ * @param {Array} keyHandles - The instance's interned keys, by handle
+ * @returns {number} 0 on success
+ */
+export function internKey(keyHandles, handle, memory, ptr, len) {
+  keyHandles[handle] = normalizeKey(textDecoder.decode(memory.subarray(ptr, ptr + len)));
+  return 0;
+}
+
+/**
+ * Read a key written by the WASM side
+ * @param {Uint8Array} memory - Linear memory view
+ * @param {boolean} tagged - Whether tagged keys were negotiated
+ * @param {Array} [keyHandles] - Keys registered with internKey()
+ * @returns {string|number}
+ */
+export function decodeKey(memory, ptr, len, tagged, keyHandles = []) {
+  if (tagged && len > 0) {
+    const tag = memory[ptr];
+    if (tag === KEY_TAG_HANDLE && len === 5) {
+      return keyHandles[new DataView(memory.buffer, ptr + 1, 4).getUint32(0, true)];
+    }
+    if (tag === KEY_TAG_INTEGER && len === 9) {
+      const value = new DataView(memory.buffer, ptr + 1, 8).getBigInt64(0, true);
+      const number = Number(value);
+      // Out-of-range integers stay exact as decimal strings
+      return Number.isSafeInteger(number) ? number : value.toString();
+    }
+    if (tag === KEY_TAG_STRING) {
+      ptr++;
+      len--;
+    }
+  }
+  return normalizeKey(textDecoder.decode(memory.subarray(ptr, ptr + len)));
+}
+
+/**
+ * Write a key for the WASM side
+ * @returns {number} Bytes written, or -1 if the key does not fit in maxLen
+ */
+export function encodeKeyInto(key, tagged, memory, ptr, maxLen) {
+  if (tagged && (typeof key === 'number' || CANONICAL_INTEGER.test(key))) {
+    if (maxLen < 9) return -1;
+    memory[ptr] = KEY_TAG_INTEGER;
+    new DataView(memory.buffer, ptr + 1, 8).setBigInt64(0, BigInt(key), true);
+    return 9;
+  }
+
+  const text = String(key);
+  const tagLen = tagged ? 1 : 0;
+  if (maxLen <= tagLen) return -1;
+  const { read, written } = textEncoder.encodeInto(text, memory.subarray(ptr + tagLen, ptr + maxLen));
+  if (read < text.length) return -1;
+  if (tagged) memory[ptr] = KEY_TAG_STRING;
+  return tagLen + written;
+}
+
+/**
+ * Fill a negative-lookup filter for the WASM side (js_ext_table_filter): a
+ * Bloom filter of `bitCount` bits (a power of two), 4 probes per key. A key
+ * is hashed as its text, a number as its decimal digits, with 32-bit
+ * FNV-1a; probe i sets bit (h + i * g) mod bitCount, g being h rotated
+ * right by 15 with the low bit set. Keys with non-ASCII text are left out,
+ * as the WASM side never asks the filter about them.
+ * @param {Iterable<string|number>} keys
+ * @param {Uint32Array} bits - The filter, zeroed
+ * @returns {number} How many keys there were
+ */
+export function fillKeyFilter(keys, bits, bitCount) {
+  const mask = bitCount - 1;
+  let count = 0;
+  for (const key of keys) {
+    count++;
+    const text = String(key);
+    let hash = 0x811c9dc5;
+    let ascii = true;
+    for (let i = 0; i < text.length; i++) {
+      const code = text.charCodeAt(i);
+      if (code >= 0x80) {
+        ascii = false;
+        break;
+      }
+      hash = Math.imul(hash ^ code, 0x01000193) >>> 0;
+    }
+    if (!ascii) continue;
+    const step = ((hash >>> 15) | (hash << 17) | 1) >>> 0;
+    for (let i = 0; i < 4; i++) {
+      const bit = (hash + Math.imul(i, step)) & mask;
+      bits[bit >>> 5] |= 1 << (bit & 31);
+    }
+  }
+  return count;
+}
+
+// Keys per leaf of OrderedKeys before it splits
+const LEAF_KEYS = 64;
+
+/**
+ * Order of range scans: numbers by value, then strings by code unit
+ * @returns {number}
+ */
+export function compareKeys(a, b) {
+  const aNumber = typeof a === 'number';
+  if (aNumber !== (typeof b === 'number')) return aNumber ? -1 : 1;
+  return a < b ? -1 : a > b ? 1 : 0;
+}
+
+/**
+ * The keys of a table in order: a two-level B+tree of sorted leaves of up to
+ * LEAF_KEYS keys, found by binary search over the leaves' last keys. Lookups
+ * and the start of a range take O(log n); a range then reads its k keys
+ * leaf by leaf.
+ */
+export class OrderedKeys {
+  constructor(keys = []) {
+    const sorted = Array.from(keys).sort(compareKeys);
+    this.leaves = [];
+    for (let i = 0; i < sorted.length; i += LEAF_KEYS / 2) {
+      this.leaves.push(sorted.slice(i, i + LEAF_KEYS / 2));
+    }
+  }
+
+  // Index of the first leaf whose last key is >= key (leaves.length if none)
+  findLeaf(key) {
+    let lo = 0;
+    let hi = this.leaves.length;
+    while (lo < hi) {
+      const mid = (lo + hi) >>> 1;
+      const leaf = this.leaves[mid];
+      if (compareKeys(leaf[leaf.length - 1], key) < 0) lo = mid + 1;
+      else hi = mid;
+    }
+    return lo;
+  }
+
+  insert(key) {
+    if (this.leaves.length === 0) {
+      this.leaves.push([key]);
+      return;
+    }
+    const leafIndex = Math.min(this.findLeaf(key), this.leaves.length - 1);
+    const leaf = this.leaves[leafIndex];
+    const pos = lowerBound(leaf, key);
+    if (pos < leaf.length && compareKeys(leaf[pos], key) === 0) return;
+    leaf.splice(pos, 0, key);
+    if (leaf.length > LEAF_KEYS) {
+      this.leaves.splice(leafIndex + 1, 0, leaf.splice(LEAF_KEYS / 2));
+    }
+  }
+
+  remove(key) {
+    const leafIndex = this.findLeaf(key);
+    const leaf = this.leaves[leafIndex];
+    if (!leaf) return;
+    const pos = lowerBound(leaf, key);
+    if (pos === leaf.length || compareKeys(leaf[pos], key) !== 0) return;
+    leaf.splice(pos, 1);
+    if (leaf.length === 0) this.leaves.splice(leafIndex, 1);
+  }
+
+  /**
+   * Keys from lo to hi, both included; null leaves that end open
+   * @param {Object} [options]
+   * @param {number} [options.limit=0] - At most this many (0: all)
+   * @param {boolean} [options.reverse=false] - From hi down to lo
+   * @returns {Array<string|number>}
+   */
+  range(lo, hi, { limit = 0, reverse = false } = {}) {
+    const keys = [];
+    const full = () => limit > 0 && keys.length >= limit;
+    if (!reverse) {
+      let leafIndex = lo === null ? 0 : this.findLeaf(lo);
+      let pos = lo === null || leafIndex === this.leaves.length ? 0 : lowerBound(this.leaves[leafIndex], lo);
+      for (; leafIndex < this.leaves.length && !full(); leafIndex++, pos = 0) {
+        const leaf = this.leaves[leafIndex];
+        for (; pos < leaf.length && !full(); pos++) {
+          if (hi !== null && compareKeys(leaf[pos], hi) > 0) return keys;
+          keys.push(leaf[pos]);
+        }
+      }
+      return keys;
+    }
+
+    let leafIndex = hi === null ? this.leaves.length - 1 : Math.min(this.findLeaf(hi), this.leaves.length - 1);
+    let pos = leafIndex < 0 ? -1 : upperBound(this.leaves[leafIndex], hi) - 1;
+    for (; leafIndex >= 0 && !full(); leafIndex--, pos = leafIndex >= 0 ? this.leaves[leafIndex].length - 1 : -1) {
+      const leaf = this.leaves[leafIndex];
+      for (; pos >= 0 && !full(); pos--) {
+        if (lo !== null && compareKeys(leaf[pos], lo) < 0) return keys;
+        keys.push(leaf[pos]);
+      }
+    }
+    return keys;
+  }
+}
+
+// First position in a sorted leaf whose key is >= key
+function lowerBound(leaf, key) {
+  let lo = 0;
+  let hi = leaf.length;
+  while (lo < hi) {
+    const mid = (lo + hi) >>> 1;
+    if (compareKeys(leaf[mid], key) < 0) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+// First position whose key is > key; null (no bound) is past the end
+function upperBound(leaf, key) {
+  if (key === null) return leaf.length;
+  let lo = 0;
+  let hi = leaf.length;
+  while (lo < hi) {
+    const mid = (lo + hi) >>> 1;
+    if (compareKeys(leaf[mid], key) <= 0) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+export class ExtTable {
+  constructor() {
+    this.array = []; // values of keys 1..array.length; undefined = hole
+    this.holes = 0;
+    this.hash = new Map(); // never holds an integer key in 1..array.length + 1
+    this.dirty = true; // changed since last persisted (saveState)
+    this.version = 0; // bumped on every change (ResponseCache)
+    this.changes = null; // when journaling: key -> value, undefined if deleted
+    this.order = null; // OrderedKeys, once ordered() or range() built it
+    this.onChange = null; // (key, value) after each change, value undefined if deleted
+    this.bytes = 0; // total value length
+  }
+
+  get size() {
+    return this.array.length - this.holes + this.hash.size;
+  }
+
+  /** True when the keys are exactly 1..size */
+  isArray() {
+    return this.holes === 0 && this.hash.size === 0;
+  }
+
+  get(key) {
+    return this.lookup(normalizeKey(key));
+  }
+
+  // What the array or hash part holds for a normalized key
+  lookup(key) {
+    if (this.inArray(key)) return this.array[key - 1];
+    return this.hash.get(key);
+  }
+
+  has(key) {
+    return this.get(key) !== undefined;
+  }
+
+  set(key, value) {
+    key = normalizeKey(key);
+    this.dirty = true;
+    this.version++;
+    if (this.changes) this.changes.set(key, value);
+    if (this.order && !this.has(key)) this.order.insert(key);
+    this.bytes += value.length - this.storedBytes(key);
+    this.place(key, value);
+    this.onChange?.(key, value);
+    return this;
+  }
+
+  // Put an entry in the array or hash part; key is normalized
+  place(key, entry) {
+    if (this.inArray(key)) {
+      if (this.array[key - 1] === undefined) this.holes--;
+      this.array[key - 1] = entry;
+    } else if (key === this.array.length + 1) {
+      this.array.push(entry);
+      // Pull in keys that were stored ahead of the array part
+      while (this.hash.has(this.array.length + 1)) {
+        const next = this.array.length + 1;
+        this.array.push(this.hash.get(next));
+        this.hash.delete(next);
+      }
+    } else {
+      this.hash.set(key, entry);
+    }
+  }
+
+  delete(key) {
+    key = normalizeKey(key);
+    this.dirty = true;
+    this.version++;
+    if (this.changes) this.changes.set(key, undefined);
+    if (this.order) this.order.remove(key);
+    const bytes = this.storedBytes(key);
+    const deleted = this.removeKey(key);
+    if (deleted) {
+      this.bytes -= bytes;
+      this.onChange?.(key, undefined);
+    }
+    return deleted;
+  }
+
+  // Length of the value this table holds for a normalized key, 0 if none
+  storedBytes(key) {
+    return this.lookup(key)?.length ?? 0;
+  }
+
+  // delete() without the bookkeeping; key is normalized
+  removeKey(key) {
+    if (!this.inArray(key)) return this.hash.delete(key);
+    if (this.array[key - 1] === undefined) return false;
+
+    if (key < this.array.length) {
+      this.array[key - 1] = undefined;
+      this.holes++;
+      return true;
+    }
+    this.array.pop();
+    while (this.array.length > 0 && this.array[this.array.length - 1] === undefined) {
+      this.array.pop();
+      this.holes--;
+    }
+    return true;
+  }
+
+  clear() {
+    this.dirty = true;
+    this.version++;
+    const keys = this.changes || this.onChange ? [...this.keys()] : [];
+    if (this.changes) {
+      for (const key of keys) this.changes.set(key, undefined);
+    }
+    this.array = [];
+    this.holes = 0;
+    this.hash.clear();
+    this.bytes = 0;
+    if (this.order) this.order = new OrderedKeys();
+    if (this.onChange) {
+      for (const key of keys) this.onChange(key, undefined);
+    }
+  }
+
+  /** Keep the keys in order from now on, for range() */
+  ordered() {
+    this.order ??= new OrderedKeys(this.keys());
+    return this;
+  }
+
+  /**
+   * Keys from lo to hi in order, both included (null: open end), as
+   * OrderedKeys.range()
+   * @returns {Array<string|number>}
+   */
+  range(lo, hi, options) {
+    return this.ordered().order.range(
+      lo === null ? null : normalizeKey(lo),
+      hi === null ? null : normalizeKey(hi),
+      options
+    );
+  }
+
+  /** A copy that shares the value bytes, which are replaced, never changed in place */
+  clone() {
+    const copy = new ExtTable();
+    copy.array = this.array.slice();
+    copy.holes = this.holes;
+    copy.hash = new Map(this.hash);
+    copy.bytes = this.bytes;
+    return copy;
+  }
+
+  *keys() {
+    for (let i = 0; i < this.array.length; i++) {
+      if (this.array[i] !== undefined) yield i + 1;
+    }
+    yield* this.hash.keys();
+  }
+
+  *entries() {
+    for (let i = 0; i < this.array.length; i++) {
+      if (this.array[i] !== undefined) yield [i + 1, this.array[i]];
+    }
+    yield* this.hash.entries();
+  }
+
+  [Symbol.iterator]() {
+    return this.entries();
+  }
+
+  inArray(key) {
+    return typeof key === 'number' && Number.isInteger(key) && key >= 1 && key <= this.array.length;
+  }
+}
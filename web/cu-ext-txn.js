@@ -0,0 +1,71 @@
+/**
+ * Cu External Table Transactions
+ *
+ * ext.transaction(fn) runs fn with its external table writes applied as a
+ * whole or not at all. Writes still go to the tables as they are made, so
+ * reads, pairs() and #t inside fn see them; the UndoLog remembers what each
+ * write replaced and puts it back if fn raises (js_ext_transaction).
+ *
+ * Transactions nest: begin() marks the log, rollback() undoes the writes
+ * after the innermost mark, and commit() leaves them to the enclosing
+ * transaction. The log is emptied when the outermost one commits.
+ *
+ * Undoing is writing the old entries back, so rolled-back writes cancel out
+ * in the journal record of the compute, which is only made after it ends.
+ */
+
+export const TXN_BEGIN = 0;
+export const TXN_COMMIT = 1;
+export const TXN_ROLLBACK = 2;
+
+export class UndoLog {
+  constructor() {
+    this.entries = []; // [table, key, value it replaced (undefined: none)]
+    this.marks = []; // entries.length at each open transaction's begin
+  }
+
+  get active() {
+    return this.marks.length !== 0;
+  }
+
+  /**
+   * Apply a js_ext_transaction operation
+   * @returns {number} 0, or -1 for commit or rollback without a transaction
+   */
+  apply(op) {
+    if (op === TXN_BEGIN) {
+      this.marks.push(this.entries.length);
+      return 0;
+    }
+    if (!this.active) return -1;
+    if (op === TXN_ROLLBACK) this.rollback();
+    else if (op === TXN_COMMIT) this.commit();
+    else return -1;
+    return 0;
+  }
+
+  /** Remember the entry under `key` before a write replaces or removes it */
+  note(table, key) {
+    if (this.marks.length !== 0) this.entries.push([table, key, table.get(key)]);
+  }
+
+  commit() {
+    this.marks.pop();
+    if (this.marks.length === 0) this.entries.length = 0;
+  }
+
+  rollback() {
+    const mark = this.marks.pop();
+    while (this.entries.length > mark) {
+      const [table, key, value] = this.entries.pop();
+      if (value === undefined) table.delete(key);
+      else table.set(key, value);
+    }
+  }
+
+  /** Forget open transactions, e.g. when the instance is reset */
+  clear() {
+    this.entries.length = 0;
+    this.marks.length = 0;
+  }
+}
@@ -0,0 +1,466 @@
+/**
+ * File persistence for Lua external tables (Node)
+ *
+ * The same storage interface as LuaPersistence (cu-persistence.js), kept in
+ * a directory instead of IndexedDB:
+ *
+ *   snapshot.bin        every table as of the last saveState()
+ *   journal-<gen>.log   journal records appended since that snapshot
+ *
+ * The snapshot starts with a directory of table offsets, so one table can
+ * be read without the rest (lazy restores) and a saveChanges() copies the
+ * unchanged tables' bytes across from the old file instead of decoding
+ * them. It is written to a temporary file and renamed over the old one, so
+ * a crash leaves one or the other. Each snapshot has a generation number
+ * and only the journal of the same generation is replayed over it; the
+ * previous journal is deleted once the new snapshot is in place.
+ *
+ * Snapshot layout (little-endian):
+ *   "CUSNAP01", u32 generation, u32 metadata length, u32 table count, u32 0
+ *   metadata JSON, padded to 8 bytes
+ *   per table: u32 tableId, u32 flags, f64 offset, f64 length
+ *   per table, at its offset: u32 entry count, then per entry
+ *     u8 key kind (1: f64 integer key, 0: u32 length + UTF-8), key,
+ *     u32 value length, value bytes
+ *   (with flag FLAG_DEFLATED, the table record is a raw deflate stream of
+ *   the above; see cu-compression.js)
+ *
+ * A journal file is a sequence of u32 length + record (cu-journal.js). A
+ * record cut short by a crash ends the replay.
+ *
+ * Usage:
+ *   import { CuInstance } from './cu-instance.js';
+ *   import { FilePersistence } from './cu-file-persistence.js';
+ *   const unit = await CuInstance.create({ persistence: new FilePersistence('./state/unit-1') });
+ */
+
+import { mkdir, open, readdir, readFile, rename, rm } from 'node:fs/promises';
+import { join } from 'node:path';
+
+import { log, logEnabled } from './cu-log.js';
+import { replayJournal, JournalChanges } from './cu-journal.js';
+import { deflate, inflate } from './cu-compression.js';
+
+const SNAPSHOT_FILE = 'snapshot.bin';
+const MAGIC = 'CUSNAP01';
+const HEADER_SIZE = 24;
+const DIRECTORY_ENTRY = 24;
+const KEY_INTEGER = 1;
+const FLAG_DEFLATED = 1;
+
+const textEncoder = new TextEncoder();
+const textDecoder = new TextDecoder();
+
+const align8 = (n) => (n + 7) & ~7;
+
+/**
+ * Encode one table's entries as a snapshot table record
+ * @param {Map} tableData - Map of key to serialized value bytes
+ * @returns {Uint8Array}
+ */
+function packTable(tableData) {
+  const keys = [];
+  let size = 4;
+  for (const [key, value] of tableData) {
+    const bytes = typeof key === 'number' ? null : textEncoder.encode(String(key));
+    keys.push(bytes);
+    size += 1 + (bytes === null ? 8 : 4 + bytes.length) + 4 + value.byteLength;
+  }
+
+  const out = new Uint8Array(size);
+  const view = new DataView(out.buffer);
+  view.setUint32(0, tableData.size, true);
+  let offset = 4;
+  let i = 0;
+  for (const [key, value] of tableData) {
+    const bytes = keys[i++];
+    if (bytes === null) {
+      view.setUint8(offset, KEY_INTEGER);
+      view.setFloat64(offset + 1, key, true);
+      offset += 9;
+    } else {
+      view.setUint8(offset, 0);
+      view.setUint32(offset + 1, bytes.length, true);
+      out.set(bytes, offset + 5);
+      offset += 5 + bytes.length;
+    }
+    view.setUint32(offset, value.byteLength, true);
+    out.set(value, offset + 4);
+    offset += 4 + value.byteLength;
+  }
+  return out;
+}
+
+/**
+ * Restore a table record. Values are views into `bytes`
+ * @param {Uint8Array} bytes
+ * @returns {Map}
+ */
+function unpackTable(bytes) {
+  const view = new DataView(bytes.buffer, bytes.byteOffset, bytes.byteLength);
+  const tableData = new Map();
+  const count = view.getUint32(0, true);
+  let offset = 4;
+  for (let i = 0; i < count; i++) {
+    let key;
+    if (view.getUint8(offset) === KEY_INTEGER) {
+      key = view.getFloat64(offset + 1, true);
+      offset += 9;
+    } else {
+      const len = view.getUint32(offset + 1, true);
+      key = textDecoder.decode(bytes.subarray(offset + 5, offset + 5 + len));
+      offset += 5 + len;
+    }
+    const len = view.getUint32(offset, true);
+    tableData.set(key, bytes.subarray(offset + 4, offset + 4 + len));
+    offset += 4 + len;
+  }
+  return tableData;
+}
+
+/**
+ * Restore a table record as stored, inflating it first if it is deflated
+ * @param {Uint8Array} bytes
+ * @param {number} flags - From the table's directory entry
+ * @returns {Promise<Map>}
+ */
+async function restoreTable(bytes, flags, inflateBytes = inflate) {
+  return unpackTable(flags & FLAG_DEFLATED ? await inflateBytes(bytes) : bytes);
+}
+
+/**
+ * Read a snapshot's header and directory
+ * @param {Uint8Array} head - At least the header and directory
+ * @returns {{generation: number, metadata: Object, tables: Map<number, {offset: number, length: number, flags: number}>}}
+ */
+function parseHeader(head) {
+  if (head.byteLength < HEADER_SIZE || textDecoder.decode(head.subarray(0, 8)) !== MAGIC) {
+    throw new Error('Not a Cu snapshot file');
+  }
+  const view = new DataView(head.buffer, head.byteOffset, head.byteLength);
+  const generation = view.getUint32(8, true);
+  const metadataLength = view.getUint32(12, true);
+  const count = view.getUint32(16, true);
+  const metadata = JSON.parse(textDecoder.decode(head.subarray(HEADER_SIZE, HEADER_SIZE + metadataLength)));
+
+  const tables = new Map();
+  let offset = HEADER_SIZE + align8(metadataLength);
+  for (let i = 0; i < count; i++) {
+    tables.set(view.getUint32(offset, true), {
+      flags: view.getUint32(offset + 4, true),
+      offset: view.getFloat64(offset + 8, true),
+      length: view.getFloat64(offset + 16, true),
+    });
+    offset += DIRECTORY_ENTRY;
+  }
+  return { generation, metadata, tables };
+}
+
+/**
+ * Split a journal file into its records, stopping at a torn one
+ * @param {Uint8Array} bytes
+ * @returns {Array<Uint8Array>}
+ */
+function journalRecords(bytes) {
+  const view = new DataView(bytes.buffer, bytes.byteOffset, bytes.byteLength);
+  const records = [];
+  let offset = 0;
+  while (offset + 4 <= bytes.byteLength) {
+    const len = view.getUint32(offset, true);
+    if (offset + 4 + len > bytes.byteLength) break;
+    records.push(bytes.subarray(offset + 4, offset + 4 + len));
+    offset += 4 + len;
+  }
+  return records;
+}
+
+async function readOptional(path) {
+  try {
+    const bytes = await readFile(path);
+    return new Uint8Array(bytes.buffer, bytes.byteOffset, bytes.byteLength);
+  } catch (error) {
+    if (error.code === 'ENOENT') return null;
+    throw error;
+  }
+}
+
+export class FilePersistence {
+  /**
+   * @param {string} dir - Directory to keep the snapshot and journal in;
+   *   created on first use. One instance per directory.
+   * @param {Object} [options]
+   * @param {boolean} [options.sync=true] - fsync each journal record and
+   *   snapshot before reporting it saved
+   * @param {boolean} [options.compress=false] - Deflate each table record
+   *   written; compressed and plain records load alike
+   * @param {RestoreWorkers} [options.workers] - Inflate compressed records
+   *   on these worker threads (cu-restore-workers.js)
+   */
+  constructor(dir, { sync = true, compress = false, workers = null } = {}) {
+    this.dir = dir;
+    this.sync = sync;
+    this.compress = compress;
+    this.inflate = workers ? (bytes) => workers.inflate(bytes) : inflate;
+    // The current snapshot's header, once read or written
+    this.header = null;
+    // Open handle of the current journal file
+    this.journalHandle = null;
+    this.ready = null;
+  }
+
+  /**
+   * Create the directory and read the current snapshot's header
+   */
+  async init() {
+    if (!this.ready) {
+      this.ready = (async () => {
+        await mkdir(this.dir, { recursive: true });
+        this.header = await this.readHeader();
+      })();
+    }
+    return this.ready;
+  }
+
+  snapshotPath() {
+    return join(this.dir, SNAPSHOT_FILE);
+  }
+
+  journalPath(generation) {
+    return join(this.dir, `journal-${generation}.log`);
+  }
+
+  async readHeader() {
+    let handle;
+    try {
+      handle = await open(this.snapshotPath(), 'r');
+    } catch (error) {
+      if (error.code === 'ENOENT') return { generation: 0, metadata: {}, tables: new Map() };
+      throw error;
+    }
+    try {
+      const fixed = new Uint8Array(HEADER_SIZE);
+      await handle.read(fixed, 0, HEADER_SIZE, 0);
+      const view = new DataView(fixed.buffer);
+      const size = HEADER_SIZE + align8(view.getUint32(12, true)) + view.getUint32(16, true) * DIRECTORY_ENTRY;
+      const head = new Uint8Array(size);
+      await handle.read(head, 0, size, 0);
+      return parseHeader(head);
+    } finally {
+      await handle.close();
+    }
+  }
+
+  /**
+   * Save all external tables, replacing whatever was stored
+   * @param {Map} externalTables - Map of table ID to Map of key-value pairs
+   * @param {Object} metadata
+   */
+  async saveTables(externalTables, metadata = {}) {
+    await this.writeSnapshot(externalTables, [], {
+      ...metadata,
+      tableCount: externalTables.size,
+      tableIds: Array.from(externalTables.keys())
+    }, true);
+    if (logEnabled('debug')) {
+      log('debug', `Saved ${externalTables.size} tables to ${this.dir}`);
+    }
+  }
+
+  /**
+   * Write only the given tables and drop removed ones; the other stored
+   * tables are copied across as they are
+   * @param {Map} changedTables - Map of table ID to table, for tables to (re)write
+   * @param {Array<number>} removedIds - IDs of stored tables to drop
+   * @param {Object} metadata
+   */
+  async saveChanges(changedTables, removedIds, metadata = {}) {
+    await this.writeSnapshot(changedTables, removedIds, metadata, false);
+    if (logEnabled('debug')) {
+      log('debug', `Saved ${changedTables.size} tables and removed ${removedIds.length} in ${this.dir}`);
+    }
+  }
+
+  /**
+   * Write a new snapshot generation and drop the journal of the last one
+   */
+  async writeSnapshot(tables, removedIds, metadata, replace) {
+    await this.init();
+    const previous = this.header;
+    const generation = previous.generation + 1;
+
+    // Tables kept from the previous snapshot, as their stored bytes
+    const records = new Map();
+    const flags = new Map();
+    if (!replace && previous.tables.size > 0) {
+      const removed = new Set(removedIds.map(Number));
+      const handle = await open(this.snapshotPath(), 'r');
+      try {
+        for (const [id, { offset, length, flags: stored }] of previous.tables) {
+          if (removed.has(id) || tables.has(id)) continue;
+          const bytes = new Uint8Array(length);
+          await handle.read(bytes, 0, length, offset);
+          records.set(id, bytes);
+          flags.set(id, stored);
+        }
+      } finally {
+        await handle.close();
+      }
+    }
+    for (const [id, tableData] of tables) {
+      const bytes = packTable(tableData);
+      records.set(Number(id), this.compress ? await deflate(bytes) : bytes);
+      flags.set(Number(id), this.compress ? FLAG_DEFLATED : 0);
+    }
+
+    const metadataBytes = textEncoder.encode(JSON.stringify(metadata));
+    const directoryStart = HEADER_SIZE + align8(metadataBytes.length);
+    let offset = directoryStart + records.size * DIRECTORY_ENTRY;
+    const directory = new Map();
+    for (const [id, bytes] of records) {
+      offset = align8(offset);
+      directory.set(id, { offset, length: bytes.byteLength, flags: flags.get(id) });
+      offset += bytes.byteLength;
+    }
+
+    const out = new Uint8Array(offset);
+    const view = new DataView(out.buffer);
+    out.set(textEncoder.encode(MAGIC), 0);
+    view.setUint32(8, generation, true);
+    view.setUint32(12, metadataBytes.length, true);
+    view.setUint32(16, records.size, true);
+    out.set(metadataBytes, HEADER_SIZE);
+    let entry = directoryStart;
+    for (const [id, { offset: at, length, flags: entryFlags }] of directory) {
+      view.setUint32(entry, id, true);
+      view.setUint32(entry + 4, entryFlags, true);
+      view.setFloat64(entry + 8, at, true);
+      view.setFloat64(entry + 16, length, true);
+      out.set(records.get(id), at);
+      entry += DIRECTORY_ENTRY;
+    }
+
+    const temp = `${this.snapshotPath()}.tmp`;
+    const handle = await open(temp, 'w');
+    try {
+      await handle.writeFile(out);
+      if (this.sync) await handle.sync();
+    } finally {
+      await handle.close();
+    }
+    await rename(temp, this.snapshotPath());
+    this.header = { generation, metadata, tables: directory };
+
+    // The snapshot holds every journaled change, so the old journal goes
+    await this.closeJournal();
+    await rm(this.journalPath(previous.generation), { force: true });
+  }
+
+  /**
+   * Append one journal record
+   * @param {Uint8Array} record - From encodeJournalRecord
+   * @returns {Promise<void>} Resolves when the record is durable (or
+   *   written, without sync)
+   */
+  async appendJournal(record) {
+    await this.init();
+    if (!this.journalHandle) {
+      this.journalHandle = await open(this.journalPath(this.header.generation), 'a');
+    }
+    const frame = new Uint8Array(4 + record.byteLength);
+    new DataView(frame.buffer).setUint32(0, record.byteLength, true);
+    frame.set(record, 4);
+    await this.journalHandle.write(frame);
+    if (this.sync) await this.journalHandle.datasync();
+  }
+
+  async closeJournal() {
+    const handle = this.journalHandle;
+    this.journalHandle = null;
+    if (handle) await handle.close();
+  }
+
+  async readJournal() {
+    const bytes = await readOptional(this.journalPath(this.header.generation));
+    return bytes ? journalRecords(bytes) : [];
+  }
+
+  /**
+   * Load all external tables
+   * @returns {{tables: Map, metadata: Object, journalTableIds: Set<number>}}
+   *   Stored tables with the journal replayed over them, metadata, and the
+   *   tables the journal changed since the snapshot
+   */
+  async loadTables() {
+    await this.init();
+    this.header = await this.readHeader();
+    const { metadata: stored, tables: directory } = this.header;
+    const metadata = { ...stored };
+
+    const tables = new Map();
+    const bytes = directory.size > 0 ? await readOptional(this.snapshotPath()) : null;
+    // Compressed records inflate concurrently (on RestoreWorkers if given)
+    const restored = await Promise.all(Array.from(directory, ([id, { offset, length, flags }]) =>
+      restoreTable(bytes.subarray(offset, offset + length), flags, this.inflate).then((tableData) => [id, tableData])
+    ));
+    for (const [id, tableData] of restored) tables.set(id, tableData);
+
+    const { applied, tableIds } = replayJournal(tables, await this.readJournal(), metadata);
+    if (logEnabled('debug')) {
+      log('debug', `Loaded ${tables.size} tables and ${applied} journal records from ${this.dir}`);
+    }
+    return { tables, metadata, journalTableIds: tableIds };
+  }
+
+  /**
+   * Load what a lazy restore needs up front: the metadata, the IDs of the
+   * stored tables and the journal, but no table records
+   * @returns {{metadata: Object, tableIds: Array<number>, journal: Map<number, JournalChanges>}}
+   */
+  async loadIndex() {
+    await this.init();
+    this.header = await this.readHeader();
+    const metadata = { ...this.header.metadata };
+    const journal = new Map();
+    replayJournal(journal, await this.readJournal(), metadata, () => new JournalChanges());
+
+    const tableIds = new Set(this.header.tables.keys());
+    for (const tableId of journal.keys()) tableIds.add(tableId);
+    return { metadata, tableIds: Array.from(tableIds), journal };
+  }
+
+  /**
+   * Load one table, reading only its part of the snapshot
+   * @param {number} tableId
+   * @param {JournalChanges} [changes] - From loadIndex(), applied on top
+   * @returns {Promise<Map>} The table's entries (empty if it is not stored)
+   */
+  async loadTable(tableId, changes) {
+    await this.init();
+    const entry = this.header.tables.get(Number(tableId));
+    let tableData = new Map();
+    if (entry) {
+      const handle = await open(this.snapshotPath(), 'r');
+      try {
+        const bytes = new Uint8Array(entry.length);
+        await handle.read(bytes, 0, entry.length, entry.offset);
+        tableData = await restoreTable(bytes, entry.flags, this.inflate);
+      } finally {
+        await handle.close();
+      }
+    }
+    return changes ? changes.applyTo(tableData) : tableData;
+  }
+
+  /**
+   * Clear all persisted data
+   */
+  async clearAll() {
+    await this.init();
+    await this.closeJournal();
+    await rm(this.snapshotPath(), { force: true });
+    for (const name of await readdir(this.dir)) {
+      if (/^journal-\d+\.log$/.test(name)) await rm(join(this.dir, name), { force: true });
+    }
+    this.header = { generation: 0, metadata: {}, tables: new Map() };
+  }
+}
@@ -0,0 +1,229 @@
+/**
+ * Cu Function Store
+ *
+ * Persistence that stores each function's bytecode once. State often holds
+ * the same handler under many keys; as plain values every copy is written
+ * and loaded again. FunctionStorePersistence wraps any persistence and
+ * moves the bytecode of every stored function (FUNCTION_BYTECODE values and
+ * CLOSUREs, cu-values.js) into a content-addressed table, keyed by its
+ * SHA-256, leaving a reference in the value:
+ *
+ *   FUNCTION_HASHED, 16-byte hash, u32 bytecode offset, the value without
+ *   its bytecode
+ *
+ * FUNCTION_HASHED is a leading byte no value encoding starts with, and
+ * values are put back together as they load, so Lua never sees one. The
+ * content table is stored in the inner persistence under FUNCTION_TABLE_ID
+ * with the other tables, written in the same snapshot or journal record as
+ * the values that refer to it. A full save keeps only the bytecode still
+ * referred to.
+ *
+ * Loaded bytecode is shared in memory by every instance of the page or
+ * process, and cu.wasm keeps the functions it loaded by content too, so a
+ * handler restored under many keys is undumped once.
+ */
+
+import { encodeJournalRecord, replayJournal, JournalChanges } from './cu-journal.js';
+import { CLOSURE } from './cu-values.js';
+
+export const FUNCTION_HASHED = 0xe3;
+// Table ID of the content table; table IDs are counted up from 1
+export const FUNCTION_TABLE_ID = 0xffffffff;
+
+const FUNCTION_BYTECODE = 0x05;
+const HASH_BYTES = 16;
+const REF_HEADER = 1 + HASH_BYTES + 4;
+// Smaller bytecode is cheaper to keep in place than to look up
+const MIN_BYTECODE = 64;
+
+// Bytecode by hash, shared by every FunctionStorePersistence
+const loadedBytecode = new Map();
+
+function toHex(bytes) {
+  let hex = '';
+  for (const byte of bytes) hex += byte.toString(16).padStart(2, '0');
+  return hex;
+}
+
+/**
+ * Where the bytecode of a function value lies, or null for other values
+ * @param {Uint8Array} value
+ * @returns {{start: number, length: number}|null}
+ */
+function bytecodeSpan(value) {
+  let start;
+  if (value[0] === FUNCTION_BYTECODE) start = 5;
+  else if (value[0] === CLOSURE && value.length > 10 && value[5] === FUNCTION_BYTECODE) start = 10;
+  else return null;
+  if (value.length < start) return null;
+  const view = new DataView(value.buffer, value.byteOffset, value.byteLength);
+  const length = view.getUint32(start - 4, true);
+  if (length < MIN_BYTECODE || start + length > value.length) return null;
+  return { start, length };
+}
+
+/**
+ * Persistence that keeps one copy of each function's bytecode
+ */
+export class FunctionStorePersistence {
+  /**
+   * @param {object} inner - LuaPersistence, FilePersistence,
+   *   CompressedPersistence or anything with their interface
+   */
+  constructor(inner) {
+    this.inner = inner;
+    // Hashes the inner persistence holds
+    this.stored = new Set();
+  }
+
+  async init() {
+    await this.inner.init?.();
+  }
+
+  /**
+   * A value with its bytecode replaced by a reference; records the
+   * bytecode in `added` unless it is stored already
+   */
+  async hashValue(value, used, added) {
+    if (!(value instanceof Uint8Array)) return value;
+    const span = bytecodeSpan(value);
+    if (!span) return value;
+    const bytecode = value.subarray(span.start, span.start + span.length);
+    const digest = new Uint8Array(await crypto.subtle.digest('SHA-256', bytecode)).subarray(0, HASH_BYTES);
+    const hash = toHex(digest);
+    used.add(hash);
+    if (!this.stored.has(hash)) added.set(hash, bytecode.slice());
+    if (!loadedBytecode.has(hash)) loadedBytecode.set(hash, bytecode.slice());
+
+    const out = new Uint8Array(REF_HEADER + value.length - span.length);
+    out[0] = FUNCTION_HASHED;
+    out.set(digest, 1);
+    new DataView(out.buffer).setUint32(1 + HASH_BYTES, span.start, true);
+    out.set(value.subarray(0, span.start), REF_HEADER);
+    out.set(value.subarray(span.start + span.length), REF_HEADER + span.start);
+    return out;
+  }
+
+  async hashTables(tables, used, added) {
+    const out = new Map();
+    for (const [tableId, tableData] of tables) {
+      const values = new Map();
+      for (const [key, value] of tableData) values.set(key, await this.hashValue(value, used, added));
+      out.set(tableId, values);
+    }
+    return out;
+  }
+
+  async saveTables(externalTables, metadata) {
+    const used = new Set();
+    const added = new Map();
+    const tables = await this.hashTables(externalTables, used, added);
+    const functions = new Map();
+    for (const hash of used) functions.set(hash, added.get(hash) ?? loadedBytecode.get(hash));
+    tables.set(FUNCTION_TABLE_ID, functions);
+    await this.inner.saveTables(tables, metadata);
+    this.stored = used;
+  }
+
+  async saveChanges(changedTables, removedIds, metadata) {
+    const added = new Map();
+    const tables = await this.hashTables(changedTables, new Set(), added);
+    if (added.size > 0) {
+      // The content table is rewritten whole, like any changed table
+      const functions = new Map();
+      for (const hash of this.stored) functions.set(hash, loadedBytecode.get(hash));
+      for (const [hash, bytecode] of added) functions.set(hash, bytecode);
+      tables.set(FUNCTION_TABLE_ID, functions);
+    }
+    await this.inner.saveChanges(tables, removedIds, metadata);
+    for (const hash of added.keys()) this.stored.add(hash);
+  }
+
+  async appendJournal(record) {
+    const metadata = {};
+    const tables = new Map();
+    replayJournal(tables, [record], metadata, () => new JournalChanges());
+    const added = new Map();
+    const used = new Set();
+    const changes = [];
+    for (const [tableId, tableChanges] of tables) {
+      for (const [key, value] of tableChanges) {
+        changes.push([tableId, key, value === undefined ? undefined : await this.hashValue(value, used, added)]);
+      }
+    }
+    for (const [hash, bytecode] of added) changes.push([FUNCTION_TABLE_ID, hash, bytecode]);
+    const { nextTableId, homeTableId = null } = metadata;
+    await this.inner.appendJournal(encodeJournalRecord({ nextTableId, homeTableId, changes }));
+    for (const hash of added.keys()) this.stored.add(hash);
+  }
+
+  /** Take on the content table's bytecode as loaded */
+  adoptFunctions(functions) {
+    this.stored = new Set();
+    if (!functions) return;
+    for (const [hash, bytecode] of functions) {
+      if (!(bytecode instanceof Uint8Array)) continue;
+      this.stored.add(hash);
+      if (!loadedBytecode.has(hash)) loadedBytecode.set(hash, bytecode.slice());
+    }
+  }
+
+  async loadTables() {
+    const loaded = await this.inner.loadTables();
+    const tables = new Map(loaded.tables);
+    this.adoptFunctions(tables.get(FUNCTION_TABLE_ID));
+    tables.delete(FUNCTION_TABLE_ID);
+    for (const [tableId, tableData] of tables) tables.set(tableId, restoreValues(tableData));
+    const journalTableIds = loaded.journalTableIds && new Set(loaded.journalTableIds);
+    journalTableIds?.delete(FUNCTION_TABLE_ID);
+    return { ...loaded, tables, journalTableIds };
+  }
+
+  async loadIndex() {
+    const index = await this.inner.loadIndex();
+    if (index.tableIds.includes(FUNCTION_TABLE_ID)) {
+      this.adoptFunctions(await this.inner.loadTable(FUNCTION_TABLE_ID, index.journal.get(FUNCTION_TABLE_ID)));
+    }
+    const journal = new Map(index.journal);
+    journal.delete(FUNCTION_TABLE_ID);
+    return { ...index, tableIds: index.tableIds.filter((id) => id !== FUNCTION_TABLE_ID), journal };
+  }
+
+  async loadTable(tableId, changes) {
+    return restoreValues(await this.inner.loadTable(tableId, changes));
+  }
+
+  clearAll() {
+    this.stored = new Set();
+    return this.inner.clearAll();
+  }
+}
+
+/**
+ * A value as it was before its bytecode was moved to the content table
+ * @param {Uint8Array} value
+ * @returns {Uint8Array}
+ */
+export function restoreValue(value) {
+  if (!(value instanceof Uint8Array) || value[0] !== FUNCTION_HASHED) return value;
+  if (value.length < REF_HEADER) throw new Error('Function reference is corrupt');
+  const hash = toHex(value.subarray(1, 1 + HASH_BYTES));
+  const bytecode = loadedBytecode.get(hash);
+  if (!bytecode) throw new Error(`Function bytecode ${hash} is missing from the store`);
+  const start = new DataView(value.buffer, value.byteOffset, value.byteLength).getUint32(1 + HASH_BYTES, true);
+  const rest = value.subarray(REF_HEADER);
+  if (start > rest.length) throw new Error('Function reference is corrupt');
+
+  const out = new Uint8Array(rest.length + bytecode.length);
+  out.set(rest.subarray(0, start));
+  out.set(bytecode, start);
+  out.set(rest.subarray(start), start + bytecode.length);
+  return out;
+}
+
+function restoreValues(tableData) {
+  for (const [key, value] of tableData) {
+    if (value instanceof Uint8Array && value[0] === FUNCTION_HASHED) tableData.set(key, restoreValue(value));
+  }
+  return tableData;
+}
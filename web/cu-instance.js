@@ -0,0 +1,3922 @@
+/**
+ * Cu Instance
+ *
+ * One Cu VM: its WebAssembly instance and memory view, its external tables
+ * and its persistence namespace. Any number of instances can share one
+ * compiled WebAssembly.Module on one thread without seeing each other's
+ * state; cu-api.js drives a default instance.
+ *
+ * Usage:
+ *   import { CuInstance } from './cu-instance.js';
+ *   const module = await WebAssembly.compileStreaming(fetch('./cu.wasm'));
+ *   const unit = await CuInstance.create({ module, namespace: 'unit-1' });
+ *   unit.init();
+ *   const len = unit.compute('return 1 + 1');
+ *   unit.readResult(unit.getBufferPtr(), len);
+ */
+
+import { deserializeResult, ResultView } from './cu-deserializer.js';
+import defaultPersistence, { LuaPersistence } from './cu-persistence.js';
+import { encodeJournalRecord } from './cu-journal.js';
+import { compileModule } from './cu-module.js';
+import { log, logEnabled, emitMetric, metricsEnabled } from './cu-log.js';
+import { ExtTable, decodeKey, encodeKeyInto, fillKeyFilter, internKey, normalizeKey } from './cu-ext-table.js';
+import { TableIndexes } from './cu-ext-index.js';
+import { ArenaTable } from './cu-ext-arena.js';
+import { ColumnTable, COLUMNS_KEY, parseSchema, restoreColumns } from './cu-ext-column.js';
+import { CacheTable, CACHE_KEY, restoreCache } from './cu-ext-cache.js';
+import { ArrayTable, ARRAY_KEY, restoreArray } from './cu-ext-array.js';
+import { UndoLog } from './cu-ext-txn.js';
+import { packSnapshot, SharedSnapshot, OverlayTable } from './cu-shared-snapshot.js';
+import { decodeValue, encodeTypedArray, typedArrayKind, forEachTableRef, ValueWriter, BLOB, BLOB_HANDLE } from './cu-values.js';
+import { BridgeTrace, traceBridgeImports } from './cu-bridge-trace.js';
+import { WorkloadCapture } from './cu-capture.js';
+import { ResponseCache, trackTableReads } from './cu-response-cache.js';
+import { Tier } from './cu-tier.js';
+import { encodeCheckpoint, decodeCheckpoint, moduleFingerprint } from './cu-checkpoint.js';
+import { memory64Abi, adaptImports, adaptExports, growMemory } from './cu-memory64.js';
+
+// Shared codecs; host callbacks run on every ext-table access
+const textEncoder = new TextEncoder();
+const textDecoder = new TextDecoder();
+// A property name that is an array index
+const ARRAY_INDEX = /^(0|[1-9][0-9]*)$/;
+// Inline tables a setInput() frame may nest, under the VM's read limit of 32
+const MAX_FRAME_DEPTH = 30;
+// Answer of js_ext_table_set, _set_parts, _set_many and _push when a table
+// quota (setTableQuota) refuses the write
+const QUOTA_EXCEEDED = -2;
+
+const SCAN_HEADER = 8;
+
+// Standard libraries by their set_stdlibs bit
+const STDLIBS = ['coroutine', 'table', 'io', 'os', 'string', 'math', 'utf8', 'debug'];
+const DEFAULT_LAZY_LIBS = ['debug', 'utf8', 'os', 'io'];
+
+function stdlibMask(names) {
+  let mask = 0;
+  for (const name of names) {
+    const bit = STDLIBS.indexOf(name);
+    if (bit < 0) throw new Error(`Unknown standard library: ${name}`);
+    mask |= 1 << bit;
+  }
+  return mask;
+}
+
+const BATCH_ITEM_SOURCE = 0;
+const BATCH_ITEM_CALL = 1;
+
+// MemoryStats layout written by get_memory_stats (all u32, little-endian)
+const MEMORY_STATS_SIZE = 188;
+const SIZE_CLASS_SLOTS = 16;
+const SIZE_CLASS_BYTES = [16, 24, 32, 40, 48, 64, 80, 96, 128, 160, 192, 256, 320, 384, 512];
+
+const GC_MODES = { collect: 0, step: 1, generational: 2, incremental: 3 };
+// gc_stats.GcStats: two f64, two u32, then the pause histogram
+const GC_HISTOGRAM_BUCKETS = 16;
+const GC_FIRST_BUCKET_US = 16;
+const GC_STATS_SIZE = 24 + GC_HISTOGRAM_BUCKETS * 4;
+// perf_counters.PerfCounters: three f64 times, u64 counts in this order,
+// then a u32 latency histogram per phase
+const PERF_COUNTER_FIELDS = [
+  'computeCalls', 'functionCalls', 'extGets', 'extGetBytes', 'extSets', 'extSetBytes',
+  'serializeCalls', 'serializeBytes', 'functionLoads', 'allocCalls', 'allocBytes', 'gcSteps',
+];
+const LATENCY_PHASES = ['parse', 'execute', 'encode', 'total'];
+const LATENCY_SUB_BUCKETS = 4;
+const LATENCY_MAX_EXPONENT = 26;
+const LATENCY_BUCKETS = 1 + LATENCY_MAX_EXPONENT * LATENCY_SUB_BUCKETS + 1;
+const LATENCY_OFFSET = 24 + PERF_COUNTER_FIELDS.length * 8;
+const PERF_COUNTERS_SIZE = LATENCY_OFFSET + LATENCY_PHASES.length * LATENCY_BUCKETS * 4;
+// CuHeapCensus (src/lua/lcensus.h): two u32 totals, then u32 count and
+// bytes per kind in this order
+const CENSUS_KINDS = [
+  'shortStrings', 'longStrings', 'tables', 'luaClosures', 'cClosures', 'userdata',
+  'bigints', 'decimals', 'protos', 'upvalues', 'threads',
+];
+const HEAP_CENSUS_SIZE = 8 + CENSUS_KINDS.length * 8;
+// CuAllocProfile: u64 allocs and allocBytes, i64 live and liveBytes per kind
+const ALLOC_PROFILE_KINDS = [
+  'other', 'strings', 'tables', 'functions', 'userdata', 'threads', 'upvalues', 'protos',
+];
+const ALLOC_PROFILE_SIZE = ALLOC_PROFILE_KINDS.length * 32;
+
+// Upper bound in microseconds of latency bucket i (perf_counters.zig)
+function latencyBucketUnderUs(i) {
+  if (i === 0) return 1;
+  if (i === LATENCY_BUCKETS - 1) return Infinity;
+  const exponent = Math.floor((i - 1) / LATENCY_SUB_BUCKETS);
+  const sub = (i - 1) % LATENCY_SUB_BUCKETS;
+  return 2 ** exponent * (1 + (sub + 1) / LATENCY_SUB_BUCKETS);
+}
+
+// { count, p50Us, p90Us, p99Us, buckets } from one phase's bucket counts.
+// A percentile is the upper bound of the bucket it falls in; in the last,
+// unbounded bucket it is that bucket's lower bound.
+function summarizeLatency(counts) {
+  const count = counts.reduce((sum, n) => sum + n, 0);
+  const percentile = (q) => {
+    if (count === 0) return 0;
+    const rank = Math.ceil(q * count);
+    let seen = 0;
+    for (let i = 0; i < counts.length; i++) {
+      seen += counts[i];
+      if (seen >= rank) return i === LATENCY_BUCKETS - 1 ? 2 ** LATENCY_MAX_EXPONENT : latencyBucketUnderUs(i);
+    }
+    return 2 ** LATENCY_MAX_EXPONENT;
+  };
+  const buckets = [];
+  counts.forEach((n, i) => {
+    if (n > 0) buckets.push({ underUs: latencyBucketUnderUs(i), count: n });
+  });
+  return { count, p50Us: percentile(0.5), p90Us: percentile(0.9), p99Us: percentile(0.99), buckets };
+}
+
+const EXT_TABLE_BACKENDS = { host: 0, native: 1 };
+
+const WASM_PAGE = 65536;
+// Granularity at which snapshot() records the memory a fork must write
+const SNAPSHOT_PAGE = 4096;
+
+/**
+ * Pages of `buffer` that differ from `base` (zero past its end), as their
+ * offsets and their bytes back to back
+ */
+function diffPages(buffer, base) {
+  const words = new Uint32Array(buffer);
+  const baseWords = new Uint32Array(base);
+  const pageWords = SNAPSHOT_PAGE / 4;
+  const offsets = [];
+  for (let page = 0; page < words.length; page += pageWords) {
+    for (let i = page; i < page + pageWords; i++) {
+      if (words[i] !== (i < baseWords.length ? baseWords[i] : 0)) {
+        offsets.push(page * 4);
+        break;
+      }
+    }
+  }
+
+  const bytes = new Uint8Array(offsets.length * SNAPSHOT_PAGE);
+  offsets.forEach((offset, i) => {
+    bytes.set(new Uint8Array(buffer, offset, SNAPSHOT_PAGE), i * SNAPSHOT_PAGE);
+  });
+  return { offsets: Uint32Array.from(offsets), bytes };
+}
+
+// Custom section of a module built by scripts/preinit-wasm.js: the host
+// state of a VM whose init() ran at build time
+const PREINIT_SECTION = 'cu.preinit';
+const preinitStates = new WeakMap();
+// moduleFingerprint() of each module checkpoints were taken or restored with
+const fingerprints = new WeakMap();
+
+// Checkpoint ids name the checkpoint a delta applies to; random, so ids
+// from different processes do not collide
+function nextCheckpointId() {
+  return (Math.floor(Math.random() * 0xfffffffe) + 1) >>> 0;
+}
+
+/**
+ * The host state stored in a pre-initialized module, or null
+ * @param {WebAssembly.Module} module
+ */
+function preinitState(module) {
+  if (!preinitStates.has(module)) {
+    const [section] = WebAssembly.Module.customSections(module, PREINIT_SECTION);
+    preinitStates.set(module, section ? JSON.parse(textDecoder.decode(section)) : null);
+  }
+  return preinitStates.get(module);
+}
+
+/**
+ * Error codes reported by getLastErrorCode()
+ */
+export const ErrorCodes = Object.freeze({
+  SUCCESS: 0,
+  COMPILATION_ERROR: -1,
+  RUNTIME_ERROR: -2,
+  SERIALIZATION_ERROR: -3,
+  MEMORY_LIMIT_EXCEEDED: -4,
+  INSTRUCTION_LIMIT_EXCEEDED: -5,
+  INTERRUPTED: -6,
+});
+
+/**
+ * Check for deprecated WASM path and warn user
+ * @param {string} wasmPath - Path to check
+ */
+function checkDeprecatedPath(wasmPath) {
+  if (wasmPath && wasmPath.includes('lua.wasm')) {
+    log(
+      'warn',
+      '[DEPRECATED] lua.wasm is deprecated and will be removed in v3.0. ' +
+      'Please update to cu.wasm. See: https://github.com/twilson63/cu#migration'
+    );
+  }
+}
+
+export class CuInstance {
+  /**
+   * Create and load an instance
+   * @param {Object} [options] - Constructor options and load() options
+   * @returns {Promise<CuInstance>}
+   */
+  static async create(options = {}) {
+    const instance = new CuInstance(options);
+    await instance.load(options);
+    return instance;
+  }
+
+  /**
+   * Start a new instance from a snapshot() instead of running init()
+   * @param {Object} snapshot - From snapshot()
+   * @param {Object} [options] - Constructor options
+   * @returns {CuInstance}
+   */
+  static fromSnapshot(snapshot, options = {}) {
+    const instance = new CuInstance(options);
+    instance.restoreSnapshot(snapshot);
+    return instance;
+  }
+
+  /**
+   * Start a new instance from a checkpoint() instead of running init()
+   * @param {Uint8Array} checkpoint - From checkpoint()
+   * @param {WebAssembly.Module} module - The build the checkpoint was taken with
+   * @param {Object} [options] - Constructor options
+   * @returns {Promise<CuInstance>}
+   */
+  static async fromCheckpoint(checkpoint, module, options = {}) {
+    const instance = new CuInstance(options);
+    await instance.restoreCheckpoint(checkpoint, module);
+    return instance;
+  }
+
+  /**
+   * @param {Object} [options]
+   * @param {string} [options.namespace] - Keeps this instance's saved
+   *   tables apart from other instances' (default: the shared database)
+   * @param {LuaPersistence} [options.persistence] - Storage to use instead
+   * @param {'map'|'arena'} [options.tableStorage='map'] - How plain external
+   *   tables hold their values (setTableStorage())
+   */
+  constructor({ namespace = null, persistence = null, tableStorage = 'map' } = {}) {
+    this.persistence = persistence ?? (namespace ? new LuaPersistence(namespace) : defaultPersistence);
+    this.module = null;
+    this.wasmInstance = null;
+    this.wasmMemory = null;
+    // Whether the module is a wasm64 build, behind cu-memory64.js's adapter
+    this.memory64 = false;
+
+    // External table storage
+    this.externalTables = new Map();
+    // 'map' (a Uint8Array per value) or 'arena' (ArenaTable slabs)
+    this.tableStorage = tableStorage === 'arena' ? 'arena' : 'map';
+    this.indexes = new TableIndexes(this.externalTables); // ext.index / ext.lookup
+    this.cacheTableIds = new Set(); // ext.cache tables, see invalidateCacheTables()
+    // Keys registered through js_ext_key_intern, indexed by handle
+    this.keyHandles = [];
+    // Whether the loaded module sends tagged keys (set_ext_key_encoding)
+    this.taggedKeys = false;
+    // Whether the loaded module writes compact v2 values (set_value_encoding)
+    this.compactValues = false;
+    // Whether the loaded module reads packed typed arrays (get_typed_array_kinds)
+    this.packedArrays = false;
+    // Whether the loaded module reads blobs through handles (js_blob_read)
+    this.hostBlobs = false;
+    this.nextTableId = 1;
+    this.homeTableId = null;
+    this.ioTableId = null;
+    // Tables of _io.input and _io.meta by field (createTableSlots), refilled
+    // by the next setInput()/setMetadata() once clearIo() or a new value
+    // frees them; and the slots each of their IDs belongs to
+    this.ioSlots = new Map();
+    this.ioSlotIds = new Map();
+    // Whether the loaded module was built with init() already run
+    this.preinitialized = false;
+    // { id, memory } of the last checkpoint taken or restored; memory is the
+    // copy deltas are found against, null when restored
+    this.lastCheckpoint = null;
+    this.stateRestored = false;
+    // IDs of the tables IndexedDB holds, or null when unknown (saveState then
+    // rewrites everything)
+    this.persistedTableIds = null;
+    // While journaling (enableJournal): { compactEvery, records, pending }
+    this.journal = null;
+    // onChanges() subscribers: { handler, values }
+    this.changeHandlers = [];
+    // Limits on each table's growth from Lua (setTableQuota): { maxEntries, maxBytes }
+    this.tableQuota = null;
+    // Tables a lazy restore is still loading, by ID, to their load promise
+    this.pendingTables = new Map();
+
+    // Blob values lent to Lua, by handle, until js_blob_release
+    this.blobHandles = new Map();
+    this.nextBlobHandle = 1;
+
+    // Open pairs() scans, keyed by cursor. A scan that is abandoned (break
+    // out of the loop) never reaches the end, so scans are dropped at the
+    // start of every compute/call instead.
+    this.tableScans = new Map();
+    // What ext.transaction() writes replaced, to undo them if it fails
+    this.undoLog = new UndoLog();
+    this.sharedSnapshot = null; // attachSharedSnapshot()
+    this.nextScanCursor = 1;
+
+    // Controls backward compatibility with "Memory" name
+    this.memoryAliasEnabled = false;
+
+    // Asked every 1000 instructions whether to stop (setInterruptCheck)
+    this.interruptCheck = null;
+
+    // Errors keep a traceback for getLastError() while set (setErrorTraceback)
+    this.errorTraceback = false;
+
+    // Records external table calls while set (startBridgeTrace)
+    this.bridgeTrace = null;
+
+    // Records every compute() and call() while set (startCapture)
+    this.capture = null;
+
+    // Results of pure handlers (setResponseCache), and the tables a call
+    // being recorded for it reads
+    this.responseCache = null;
+    this.tableReads = null;
+
+    // Hot Lua functions are compiled to wasm while set (setTiering)
+    this.tierThreshold = 0;
+    this.tier = null;
+
+    // Returned tables, inline or external, as JavaScript data (readResult)
+    this.materialize = (decoded) => this.materializeValue(decoded);
+
+    // Results are encoded into { ptr, len } when set (setResultRegion),
+    // allocated with resultRegionBytes on the first call after init
+    this.resultRegion = null;
+    this.resultRegionBytes = 0;
+
+    // Counts runs that may overwrite a result, so views of the last one
+    // (readResultView) can tell they are stale
+    this.resultEpoch = 0;
+
+    // Receives print output as it is written (setOutputStreaming)
+    this.outputHandler = null;
+    this.outputChunkBytes = 0;
+    this.outputDecoder = null;
+
+    // While idle collection is on (setIdleGc): { budgetUs, scheduled }
+    this.idleGc = null;
+  }
+
+  /**
+   * Current byte view of linear memory. memory.grow detaches the old
+   * ArrayBuffer, so re-wrap only when the exported buffer changed identity;
+   * on the common path this is a property read and one comparison.
+   */
+  memoryView() {
+    const buffer = this.wasmInstance.exports.memory.buffer;
+    if (this.wasmMemory === null || this.wasmMemory.buffer !== buffer) {
+      this.wasmMemory = new Uint8Array(buffer);
+    }
+    return this.wasmMemory;
+  }
+
+  requireLoaded() {
+    if (!this.wasmInstance) {
+      throw new Error('WASM not loaded');
+    }
+    return this.wasmInstance.exports;
+  }
+
+  /** Read a key written by the WASM side */
+  decodeKey(memory, ptr, len) {
+    return decodeKey(memory, ptr, len, this.taggedKeys, this.keyHandles);
+  }
+
+  ensureExternalTable(tableId) {
+    const id = Number(tableId);
+    if (!this.externalTables.has(id)) {
+      const table = this.tableStorage === 'arena' ? new ArenaTable() : new ExtTable();
+      if (this.tracksChanges()) table.changes = new Map();
+      this.externalTables.set(id, table);
+    }
+    if (id >= this.nextTableId) {
+      this.nextTableId = id + 1;
+    }
+    return this.externalTables.get(id);
+  }
+
+  /**
+   * What a stored value is sent to Lua as: a blob becomes a handle to its
+   * bytes, which stay here
+   * @param {Uint8Array} value
+   * @returns {Uint8Array}
+   */
+  outgoingValue(value) {
+    if (!this.hostBlobs || value[0] !== BLOB) return value;
+    const handle = this.nextBlobHandle++;
+    this.blobHandles.set(handle, value);
+    const stub = new Uint8Array(9);
+    const view = new DataView(stub.buffer);
+    stub[0] = BLOB_HANDLE;
+    view.setUint32(1, handle, true);
+    view.setUint32(5, value.length - 5, true);
+    return stub;
+  }
+
+  /**
+   * The value to store for bytes written by Lua; a blob handle stands for
+   * the blob's bytes, which are shared rather than copied
+   * @param {ExtTable} table - Where it goes: an ArenaTable copies the bytes
+   *   into its slab itself, so it is given a view of linear memory
+   * @returns {Uint8Array}
+   */
+  incomingValue(memory, start, len, table) {
+    if (len === 9 && memory[start] === BLOB_HANDLE) {
+      const blob = this.blobHandles.get(new DataView(memory.buffer, start + 1, 4).getUint32(0, true));
+      if (blob) return blob;
+    }
+    if (table instanceof ArenaTable) return memory.subarray(start, start + len);
+    return memory.slice(start, start + len);
+  }
+
+  /**
+   * Start a range scan for ext.range / ext.rrange: the keys from lo to hi
+   * (an empty key leaves that end open), read in batches by
+   * js_ext_table_next like a pairs() scan
+   * @returns {number} The scan's cursor, 0 if no key is in range
+   */
+  openRangeScan(tableId, loPtr, loLen, hiPtr, hiLen, limit, reverse) {
+    const table = this.externalTables.get(tableId);
+    if (!table) return 0;
+    const memory = this.memoryView();
+    const lo = loLen > 0 ? this.decodeKey(memory, loPtr, loLen) : null;
+    const hi = hiLen > 0 ? this.decodeKey(memory, hiPtr, hiLen) : null;
+    return this.openKeyScan(table, table.range(lo, hi, { limit, reverse }));
+  }
+
+  /**
+   * Start a scan of the records of a table whose field equals a value, for
+   * ext.lookup / ext.lookupAll
+   * @returns {number} The scan's cursor, 0 if no record matches
+   */
+  openLookupScan(tableId, fieldPtr, fieldLen, valuePtr, valueLen, limit) {
+    const table = this.externalTables.get(tableId);
+    if (!table) return 0;
+    const memory = this.memoryView();
+    const field = textDecoder.decode(memory.subarray(fieldPtr, fieldPtr + fieldLen));
+    const value = this.decodeKey(memory, valuePtr, valueLen);
+    return this.openKeyScan(table, this.indexes.lookup(tableId, field, value, limit));
+  }
+
+  // Register a scan over the given keys of table, read by js_ext_table_next
+  openKeyScan(table, keys) {
+    if (keys.length === 0) return 0;
+    const cursor = this.nextScanCursor++;
+    this.tableScans.set(cursor, { table, keys, pos: 0 });
+    return cursor;
+  }
+
+  /**
+   * Write the next batch of a pairs() scan at `ptr`:
+   *   u32 next_cursor (0 = done), u32 count, then per entry
+   *   u32 key_len, key, u32 value_len, value
+   * Entries too large for an empty batch are skipped.
+   */
+  writeScanBatch(tableId, cursor, memory, ptr, maxLen) {
+    let scan = this.tableScans.get(cursor);
+    if (cursor === 0) {
+      const table = this.externalTables.get(tableId);
+      if (!table) return -1;
+      cursor = this.nextScanCursor++;
+      scan = { table, keys: Array.from(table.keys()), pos: 0 };
+      this.tableScans.set(cursor, scan);
+    }
+    if (!scan) return -1;
+
+    const view = new DataView(memory.buffer, ptr, maxLen);
+    let offset = SCAN_HEADER;
+    let count = 0;
+    while (scan.pos < scan.keys.length) {
+      const key = scan.keys[scan.pos];
+      const value = scan.table.get(key);
+      if (!(value instanceof Uint8Array) && typeof value !== 'string') {
+        scan.pos++; // deleted since the scan started
+        continue;
+      }
+      const valueBytes = typeof value === 'string' ? textEncoder.encode(value) : this.outgoingValue(value);
+
+      const keyRoom = maxLen - offset - 8 - valueBytes.length;
+      const written = encodeKeyInto(key, this.taggedKeys, memory, ptr + offset + 4, keyRoom);
+      if (written < 0) {
+        if (count > 0) break;
+        log('warn', `pairs(): skipping entry "${key}" larger than one batch`);
+        scan.pos++;
+        continue;
+      }
+
+      view.setUint32(offset, written, true);
+      offset += 4 + written;
+      view.setUint32(offset, valueBytes.length, true);
+      memory.set(valueBytes, ptr + offset + 4);
+      offset += 4 + valueBytes.length;
+      scan.pos++;
+      count++;
+    }
+
+    const done = scan.pos >= scan.keys.length;
+    if (done) this.tableScans.delete(cursor);
+    view.setUint32(0, done ? 0 : cursor, true);
+    view.setUint32(4, count, true);
+    return offset;
+  }
+
+  /**
+   * Store a packed batch from js_ext_table_set_many: frames of
+   *   u32 key_len, key, u32 value_len, value
+   */
+  applySetBatch(tableId, memory, ptr, len) {
+    const table = this.ensureExternalTable(tableId);
+    const view = new DataView(memory.buffer, ptr, len);
+    let offset = 0;
+    while (offset + 8 <= len) {
+      const keyLen = view.getUint32(offset, true);
+      const keyStart = ptr + offset + 4;
+      const valueLen = view.getUint32(offset + 4 + keyLen, true);
+      const valueStart = keyStart + keyLen + 4;
+      const value = this.incomingValue(memory, valueStart, valueLen, table);
+      if (!this.storeValue(table, this.decodeKey(memory, keyStart, keyLen), value)) return QUOTA_EXCEEDED;
+      if (this.ioSlotIds.size !== 0) this.keepStoredIoTables(tableId, value);
+      offset += 8 + keyLen + valueLen;
+    }
+    return offset === len ? 0 : -1;
+  }
+
+  /**
+   * Answer js_ext_table_get_many. Keys arrive as frames of u32 key_len, key;
+   * the answer at `outPtr` is u32 answered, then per key an i32 value_len
+   * (-1 = missing) and the value. Stops before the first value that does not
+   * fit, but always answers the first key so the caller makes progress.
+   */
+  writeManyValues(tableId, memory, keysPtr, keysLen, outPtr, maxLen) {
+    const table = this.externalTables.get(tableId);
+    if (!table || maxLen < 8) return -1;
+
+    const keysView = new DataView(memory.buffer, keysPtr, keysLen);
+    const outView = new DataView(memory.buffer, outPtr, maxLen);
+    let keyOffset = 0;
+    let offset = 4;
+    let answered = 0;
+    while (keyOffset + 4 <= keysLen) {
+      const keyLen = keysView.getUint32(keyOffset, true);
+      const keyStart = keysPtr + keyOffset + 4;
+      const value = table.get(this.decodeKey(memory, keyStart, keyLen));
+      let valueBytes = typeof value === 'string' ? textEncoder.encode(value) : value;
+      valueBytes = valueBytes instanceof Uint8Array ? this.outgoingValue(valueBytes) : null;
+
+      const needed = 4 + (valueBytes ? valueBytes.length : 0);
+      if (offset + needed > maxLen) {
+        if (answered > 0) break;
+        valueBytes = null; // too large for one answer; report it missing
+      }
+
+      outView.setInt32(offset, valueBytes ? valueBytes.length : -1, true);
+      offset += 4;
+      if (valueBytes) {
+        memory.set(valueBytes, outPtr + offset);
+        offset += valueBytes.length;
+      }
+      keyOffset += 4 + keyLen;
+      answered++;
+    }
+
+    outView.setUint32(0, answered, true);
+    return offset;
+  }
+
+  /**
+   * Remove the last value of an array table for ext.pop, writing u32 its
+   * index, then the value
+   * @returns {number} Bytes written, 0 if the table is empty, -1 if it is
+   *   not an array table, or -(2 + bytes needed) if the value does not fit
+   *   (it stays in the table)
+   */
+  popArrayValue(tableId, memory, outPtr, maxLen) {
+    const table = this.externalTables.get(tableId);
+    if (!(table instanceof ArrayTable)) return -1;
+    const index = table.length;
+    if (index === 0) return 0;
+
+    const valueBytes = this.outgoingValue(table.array[index - 1]);
+    if (4 + valueBytes.length > maxLen) return -2 - (4 + valueBytes.length);
+    new DataView(memory.buffer, outPtr, 4).setUint32(0, index, true);
+    memory.set(valueBytes, outPtr + 4);
+    if (this.undoLog.active) this.undoLog.note(table, index);
+    table.pop();
+    return 4 + valueBytes.length;
+  }
+
+  /**
+   * Write values first..last of an array table for ext.slice, in the
+   * layout of writeManyValues: u32 answered, then per value an i32 length
+   * (-1 for one too large to answer) and the value. Stops early when the
+   * output is full; answers nothing past the end.
+   * @returns {number} Bytes written, or -1 if it is not an array table
+   */
+  writeArraySlice(tableId, memory, first, last, outPtr, maxLen) {
+    const table = this.externalTables.get(tableId);
+    if (!(table instanceof ArrayTable) || maxLen < 8) return -1;
+
+    // last arrives signed; u32 max (-1) reads to the end
+    const values = table.slice(first, last < 0 ? table.length : last);
+    const outView = new DataView(memory.buffer, outPtr, maxLen);
+    let offset = 4;
+    let answered = 0;
+    for (const value of values) {
+      let valueBytes = this.outgoingValue(value);
+      if (offset + 4 + valueBytes.length > maxLen) {
+        if (answered > 0) break;
+        valueBytes = null; // too large for one answer; read it on its own
+      }
+      outView.setInt32(offset, valueBytes ? valueBytes.length : -1, true);
+      offset += 4;
+      if (valueBytes) {
+        memory.set(valueBytes, outPtr + offset);
+        offset += valueBytes.length;
+      }
+      answered++;
+    }
+
+    outView.setUint32(0, answered, true);
+    return offset;
+  }
+
+  getMaxTableId() {
+    let maxId = 0;
+    for (const id of this.externalTables.keys()) {
+      if (id > maxId) {
+        maxId = id;
+      }
+    }
+    return maxId;
+  }
+
+  /**
+   * Replace a table's entries with ones loaded from storage
+   * @returns {ExtTable}
+   */
+  installTable(tableId, entries) {
+    const id = Number(tableId);
+    const kind = this.externalTables.get(id)?.constructor;
+    if (kind !== ExtTable && kind !== ArenaTable) this.externalTables.delete(id);
+    const tableMap = this.ensureExternalTable(id);
+    tableMap.clear();
+    for (const [key, value] of entries) {
+      tableMap.set(key, value);
+    }
+    const table = this.restoreKind(id, tableMap);
+    if (table !== tableMap) this.externalTables.set(id, table);
+    return table;
+  }
+
+  /**
+   * A restored table as the kind its entries were saved from: columnar
+   * (ext.columns), cache (ext.cache), array (ext.array) or plain
+   */
+  restoreKind(tableId, table) {
+    table = restoreArray(restoreCache(restoreColumns(table, this.externalTables)));
+    if (table instanceof CacheTable) this.cacheTableIds.add(tableId);
+    return this.inTableStorage(table);
+  }
+
+  // A plain table as the storage setTableStorage() chose
+  inTableStorage(table) {
+    if (this.tableStorage === 'arena' && table.constructor === ExtTable) return ArenaTable.from(table);
+    if (this.tableStorage === 'map' && table.constructor === ArenaTable) return table.toPlain();
+    return table;
+  }
+
+  /**
+   * Choose how plain external tables hold their values. 'map' keeps a
+   * Uint8Array per value. 'arena' appends values to one large buffer per
+   * table (ArenaTable), indexed by offset and length, so a table of
+   * millions of small values adds little work for V8's collector, and a
+   * value written by Lua is copied once. Existing plain tables are
+   * converted; cache, columnar and shared-snapshot tables keep their own
+   * storage. Call between calls.
+   * @param {'map'|'arena'} kind
+   * @returns {boolean} False if the kind is unknown
+   */
+  setTableStorage(kind) {
+    if (kind !== 'map' && kind !== 'arena') return false;
+    this.tableStorage = kind;
+    for (const [id, table] of this.externalTables) {
+      const converted = this.inTableStorage(table);
+      if (converted !== table) this.externalTables.set(id, converted);
+    }
+    return true;
+  }
+
+  /**
+   * Limit how far Lua can grow each external table. A write that would take
+   * a table past either limit stores nothing, and the assignment (or
+   * ext.push, ext.append) raises "external table quota exceeded" in Lua.
+   * Writes that do not grow a table are always stored, and host writes are
+   * not limited. Checking costs a lookup per write, so it can stay on.
+   * @param {Object} [quota] - No argument removes the quota
+   * @param {number} [quota.maxEntries=0] - Entries per table (0: no limit)
+   * @param {number} [quota.maxBytes=0] - Value bytes per table, as getTableInfo() counts them (0: no limit)
+   */
+  setTableQuota({ maxEntries = 0, maxBytes = 0 } = {}) {
+    this.tableQuota = maxEntries > 0 || maxBytes > 0 ? { maxEntries, maxBytes } : null;
+  }
+
+  /**
+   * Drop what the VM cached natively of cache tables, which evict and
+   * expire entries on the host, so the next invocation reads them there
+   */
+  invalidateCacheTables() {
+    const exports = this.wasmInstance?.exports;
+    for (const id of this.cacheTableIds) {
+      if (this.externalTables.get(id) instanceof CacheTable) exports?.invalidate_ext_table?.(id);
+      else this.cacheTableIds.delete(id);
+    }
+  }
+
+  /**
+   * Store an incoming value; a nil removes the key
+   * @returns {boolean} False if the table quota refused it
+   */
+  storeValue(table, key, value) {
+    const removing = value.length === 1 && value[0] === 0;
+    if (this.tableQuota && !removing && !this.withinQuota(table, key, value.length)) return false;
+    if (this.undoLog.active) this.undoLog.note(table, key);
+    if (removing) table.delete(key);
+    else table.set(key, value);
+    return true;
+  }
+
+  // Whether `length` bytes stored at (normalized) `key` keep `table` within
+  // the quota. A write that does not grow the table always does, so a table
+  // over a lowered quota can still be trimmed.
+  withinQuota(table, key, length) {
+    const { maxEntries, maxBytes } = this.tableQuota;
+    const old = table.storedBytes(key);
+    if (maxBytes > 0 && length > old && table.bytes + length - old > maxBytes) return false;
+    return maxEntries === 0 || table.size < maxEntries || table.has(key);
+  }
+
+  /**
+   * Restore only the hot tables (_home and prefetchTables) before returning,
+   * and load the rest in the background. Lua can only reach the other tables
+   * through the hot ones, and compute() waits for them (tablesReady()).
+   */
+  async loadTablesLazily(prefetchTables) {
+    const { persistence, pendingTables } = this;
+    const { metadata, tableIds, journal } = await persistence.loadIndex();
+    const stored = new Set(tableIds);
+    const home = metadata.homeTableId ?? metadata.memoryTableId;
+    const hot = new Set([home, ...prefetchTables].map(Number).filter((id) => stored.has(id)));
+
+    const tables = new Map();
+    await Promise.all(Array.from(hot, async (id) => {
+      tables.set(id, await persistence.loadTable(id, journal.get(id)));
+    }));
+
+    const journalTableIds = new Set(journal.keys());
+    const rest = tableIds.filter((id) => !hot.has(id));
+    const startBackgroundLoads = () => {
+      for (const id of rest) {
+        const loading = persistence.loadTable(id, journal.get(id))
+          .then((entries) => {
+            const table = this.installTable(id, entries);
+            table.dirty = journalTableIds.has(id);
+            table.changes?.clear();
+          })
+          .catch((error) => log('error', `Failed to load table ${id}:`, error))
+          .finally(() => pendingTables.delete(id));
+        pendingTables.set(id, loading);
+      }
+    };
+    return { tables, metadata, journalTableIds, tableIds, startBackgroundLoads };
+  }
+
+  /**
+   * @returns {Promise<void>} Resolves once every table a lazy restore
+   *   (load({ lazyTables: true })) left loading in the background is in place
+   */
+  async tablesReady() {
+    while (this.pendingTables.size > 0) {
+      await Promise.all(this.pendingTables.values());
+    }
+  }
+
+  /**
+   * Take _home and the next table ID from saved metadata
+   */
+  applyMetadata(metadata) {
+    if (!metadata) return;
+    // Try new homeTableId first, fall back to legacy memoryTableId
+    if (metadata.homeTableId !== undefined && metadata.homeTableId !== null) {
+      this.homeTableId = Number(metadata.homeTableId);
+    } else if (metadata.memoryTableId !== undefined && metadata.memoryTableId !== null) {
+      this.homeTableId = Number(metadata.memoryTableId);
+      log('warn', '[Deprecated] Using legacy "memoryTableId" - please migrate to "homeTableId"');
+    }
+    if (metadata.nextTableId !== undefined && metadata.nextTableId !== null) {
+      const hint = Number(metadata.nextTableId);
+      if (!Number.isNaN(hint) && hint > this.nextTableId) {
+        this.nextTableId = hint;
+      }
+    }
+    // Journal records carry no declarations; keep the snapshot's
+    if (metadata.indexes) this.indexes.restore(metadata.indexes);
+  }
+
+  async restorePersistedTables({ lazyTables = false, prefetchTables = [] } = {}) {
+    try {
+      await this.tablesReady();
+      const { tables, metadata, journalTableIds, tableIds = Array.from(tables.keys()), startBackgroundLoads } = lazyTables
+        ? await this.loadTablesLazily(prefetchTables)
+        : await this.persistence.loadTables();
+
+      this.externalTables.clear();
+      this.dropIoSlots();
+      this.nextTableId = 1;
+      this.homeTableId = null;
+
+      for (const [id, entries] of tables) {
+        this.installTable(Number(id), entries);
+      }
+      this.applyMetadata(metadata);
+
+      if (this.homeTableId && this.homeTableId > 0) {
+        this.ensureExternalTable(this.homeTableId);
+      }
+
+      // Tables still to load count too
+      const maxId = tableIds.reduce((max, id) => Math.max(max, id), this.getMaxTableId());
+      if (this.nextTableId <= maxId) {
+        this.nextTableId = maxId + 1;
+      }
+
+      this.markPersisted(tableIds, journalTableIds);
+      startBackgroundLoads?.();
+      this.stateRestored = tableIds.length > 0;
+      return true;
+    } catch (error) {
+      log('warn', 'Failed to restore persisted tables:', error);
+      this.persistedTableIds = null;
+      this.stateRestored = false;
+      this.homeTableId = null;
+      this.nextTableId = Math.max(1, this.nextTableId);
+      return false;
+    }
+  }
+
+  /**
+   * Host functions the module imports, bound to this instance
+   */
+  createImports() {
+    return {
+      env: trackTableReads(traceBridgeImports({
+        js_time_now: () => Date.now(),
+        // Monotonic clock for timing collector pauses (get_gc_stats)
+        js_clock_ms: () => performance.now(),
+        js_ext_table_set: (table_id, key_ptr, key_len, val_ptr, val_len) => {
+          try {
+            const table = this.ensureExternalTable(table_id);
+
+            // Lua may have grown memory since the last boundary call
+            const memory = this.memoryView();
+            const key = this.decodeKey(memory, key_ptr, key_len);
+            // Store raw binary data to preserve function bytecode; slice()
+            // copies, since the source view is reused by the next call
+            const value = this.incomingValue(memory, val_ptr, val_len, table);
+            if (!this.storeValue(table, key, value)) return QUOTA_EXCEEDED;
+            if (this.ioSlotIds.size !== 0) this.keepStoredIoTables(table_id, value);
+            return 0;
+          } catch (e) {
+            log('error', 'js_ext_table_set error:', e);
+            return -1;
+          }
+        },
+        js_ext_table_set_parts: (table_id, key_ptr, key_len, head_ptr, head_len, body_ptr, body_len) => {
+          try {
+            const table = this.ensureExternalTable(table_id);
+            const memory = this.memoryView();
+            // A value too large for the I/O buffer, sent as header + body in place
+            const value = new Uint8Array(head_len + body_len);
+            value.set(memory.subarray(head_ptr, head_ptr + head_len));
+            value.set(memory.subarray(body_ptr, body_ptr + body_len), head_len);
+            if (!this.storeValue(table, this.decodeKey(memory, key_ptr, key_len), value)) return QUOTA_EXCEEDED;
+            if (this.ioSlotIds.size !== 0) this.keepStoredIoTables(table_id, value);
+            return 0;
+          } catch (e) {
+            log('error', 'js_ext_table_set_parts error:', e);
+            return -1;
+          }
+        },
+        js_ext_table_get: (table_id, key_ptr, key_len, val_ptr, max_len) => {
+          try {
+            const table = this.externalTables.get(table_id);
+            if (!table) return -1;
+
+            const memory = this.memoryView();
+            const value = table.get(this.decodeKey(memory, key_ptr, key_len));
+
+            if (value === undefined) return -1;
+
+            // Handle binary data (Uint8Array) or legacy string data
+            let valueBytes;
+            if (value instanceof Uint8Array) {
+              valueBytes = this.outgoingValue(value);
+            } else if (typeof value === 'string') {
+              // Legacy support for old string values
+              valueBytes = textEncoder.encode(value);
+            } else {
+              return -1;
+            }
+
+            // Too large for the caller's window: report the size so it can
+            // retry with a buffer that fits
+            if (valueBytes.length > max_len) return -2 - valueBytes.length;
+
+            memory.set(valueBytes, val_ptr);
+            return valueBytes.length;
+          } catch (e) {
+            log('error', 'js_ext_table_get error:', e);
+            return -1;
+          }
+        },
+        js_ext_table_delete: (table_id, key_ptr, key_len) => {
+          try {
+            const table = this.externalTables.get(table_id);
+            if (!table) return -1;
+
+            const key = this.decodeKey(this.memoryView(), key_ptr, key_len);
+            if (this.undoLog.active) this.undoLog.note(table, key);
+            table.delete(key);
+            return 0;
+          } catch (e) {
+            log('error', 'js_ext_table_delete error:', e);
+            return -1;
+          }
+        },
+        js_ext_table_size: (table_id) => {
+          const table = this.externalTables.get(table_id);
+          return table ? table.size : 0;
+        },
+        js_ext_table_keys: (table_id, buf_ptr, max_len) => {
+          try {
+            const table = this.externalTables.get(table_id);
+            if (!table) return -1;
+
+            const keys = Array.from(table.keys()).join('\n');
+            const { read, written } = textEncoder.encodeInto(keys, this.memoryView().subarray(buf_ptr, buf_ptr + max_len));
+            if (read < keys.length) return -1;
+
+            return written;
+          } catch (e) {
+            log('error', 'js_ext_table_keys error:', e);
+            return -1;
+          }
+        },
+        js_ext_table_filter: (table_id, bits_ptr, bit_count) => {
+          const table = this.externalTables.get(table_id);
+          if (!table) return -1;
+          const bits = new Uint32Array(this.memoryView().buffer, bits_ptr, bit_count >>> 5);
+          return fillKeyFilter(table.keys(), bits, bit_count);
+        },
+        js_ext_table_order: (table_id) => {
+          this.ensureExternalTable(table_id).ordered();
+          return 0;
+        },
+        js_ext_table_range: (table_id, lo_ptr, lo_len, hi_ptr, hi_len, limit, reverse) => {
+          try {
+            return this.openRangeScan(table_id, lo_ptr, lo_len, hi_ptr, hi_len, limit, reverse !== 0);
+          } catch (e) {
+            log('error', 'js_ext_table_range error:', e);
+            return -1;
+          }
+        },
+        js_ext_transaction: (op) => this.undoLog.apply(op),
+        js_ext_table_cache: (table_id, max_entries, ttl_seconds) => {
+          // max_entries arrives signed
+          const table = new CacheTable(max_entries >>> 0, ttl_seconds);
+          if (this.tracksChanges()) table.changes = new Map([[CACHE_KEY, table.storedLimits()]]);
+          this.ensureExternalTable(table_id);
+          this.externalTables.set(table_id, table);
+          this.cacheTableIds.add(table_id);
+          return 0;
+        },
+        js_ext_table_columns: (table_id, schema_ptr, schema_len) => {
+          const memory = this.memoryView();
+          const schema = parseSchema(textDecoder.decode(memory.subarray(schema_ptr, schema_ptr + schema_len)));
+          if (!schema) return -1;
+          const table = new ColumnTable(schema, this.externalTables);
+          if (this.tracksChanges()) table.changes = new Map();
+          this.ensureExternalTable(table_id);
+          this.externalTables.set(table_id, table);
+          return 0;
+        },
+        js_ext_table_array: (table_id) => {
+          const table = new ArrayTable();
+          if (this.tracksChanges()) table.changes = new Map([[ARRAY_KEY, table.storedKind()]]);
+          this.ensureExternalTable(table_id);
+          this.externalTables.set(table_id, table);
+          return 0;
+        },
+        js_ext_table_push: (table_id, val_ptr, val_len) => {
+          try {
+            const table = this.externalTables.get(table_id);
+            if (!(table instanceof ArrayTable)) return -1;
+            const value = this.incomingValue(this.memoryView(), val_ptr, val_len, table);
+            if (this.tableQuota && !this.withinQuota(table, table.length + 1, value.length)) return QUOTA_EXCEEDED;
+            if (this.ioSlotIds.size !== 0) this.keepStoredIoTables(table_id, value);
+            if (this.undoLog.active) this.undoLog.note(table, table.length + 1);
+            return table.push(value);
+          } catch (e) {
+            log('error', 'js_ext_table_push error:', e);
+            return -1;
+          }
+        },
+        js_ext_table_pop: (table_id, out_ptr, max_len) => {
+          try {
+            return this.popArrayValue(table_id, this.memoryView(), out_ptr, max_len);
+          } catch (e) {
+            log('error', 'js_ext_table_pop error:', e);
+            return -1;
+          }
+        },
+        js_ext_table_slice: (table_id, first, last, out_ptr, max_len) => {
+          try {
+            return this.writeArraySlice(table_id, this.memoryView(), first, last, out_ptr, max_len);
+          } catch (e) {
+            log('error', 'js_ext_table_slice error:', e);
+            return -1;
+          }
+        },
+        js_ext_table_column: (table_id, field_ptr, field_len, first, last, out_ptr, max_len) => {
+          const table = this.externalTables.get(table_id);
+          if (!(table instanceof ColumnTable)) return -1;
+          const memory = this.memoryView();
+          // last arrives signed; u32 max (-1) reads to the last row
+          const column = table.column(textDecoder.decode(memory.subarray(field_ptr, field_ptr + field_len)), first, last < 0 ? Infinity : last);
+          if (!column) return -1;
+          const bytes = encodeTypedArray(column);
+          if (bytes.length <= max_len) memory.set(bytes, out_ptr);
+          return bytes.length;
+        },
+        js_ext_table_index: (table_id, field_ptr, field_len) => {
+          const memory = this.memoryView();
+          this.indexes.declare(table_id, textDecoder.decode(memory.subarray(field_ptr, field_ptr + field_len)));
+          return 0;
+        },
+        js_ext_table_lookup: (table_id, field_ptr, field_len, value_ptr, value_len, limit) => {
+          try {
+            return this.openLookupScan(table_id, field_ptr, field_len, value_ptr, value_len, limit);
+          } catch (e) {
+            log('error', 'js_ext_table_lookup error:', e);
+            return -1;
+          }
+        },
+        js_ext_key_intern: (handle, key_ptr, key_len) => {
+          try {
+            return internKey(this.keyHandles, handle, this.memoryView(), key_ptr, key_len);
+          } catch (e) {
+            log('error', 'js_ext_key_intern error:', e);
+            return -1;
+          }
+        },
+        js_ext_table_set_many: (table_id, frames_ptr, frames_len) => {
+          try {
+            return this.applySetBatch(table_id, this.memoryView(), frames_ptr, frames_len);
+          } catch (e) {
+            log('error', 'js_ext_table_set_many error:', e);
+            return -1;
+          }
+        },
+        js_ext_table_get_many: (table_id, keys_ptr, keys_len, out_ptr, max_len) => {
+          try {
+            return this.writeManyValues(table_id, this.memoryView(), keys_ptr, keys_len, out_ptr, max_len);
+          } catch (e) {
+            log('error', 'js_ext_table_get_many error:', e);
+            return -1;
+          }
+        },
+        js_blob_read: (handle, offset, dst_ptr, len) => {
+          const blob = this.blobHandles.get(handle);
+          if (!blob || offset + len > blob.length - 5) return -1;
+          this.memoryView().set(blob.subarray(5 + offset, 5 + offset + len), dst_ptr);
+          return len;
+        },
+        js_blob_release: (handle) => {
+          this.blobHandles.delete(handle);
+        },
+        js_ext_table_next: (table_id, cursor, buf_ptr, max_len) => {
+          try {
+            return this.writeScanBatch(table_id, cursor, this.memoryView(), buf_ptr, max_len);
+          } catch (e) {
+            log('error', 'js_ext_table_next error:', e);
+            return -1;
+          }
+        },
+        js_interrupt_requested: () => (this.interruptCheck?.() ? 1 : 0),
+        // A function turned hot (setTiering); 0 leaves it interpreted
+        js_tier_compile: (p, func, narg) => this.tier?.compile(p, func, narg) ?? 0,
+        js_tier_release: (p, slot) => this.tier?.release(p, slot),
+        js_write_output: (ptr, len) => {
+          if (!this.outputHandler) return;
+          // A chunk can end inside a UTF-8 sequence; the decoder holds it back
+          const text = this.outputDecoder.decode(this.memoryView().subarray(ptr, ptr + len), { stream: true });
+          if (text.length === 0) return;
+          try {
+            this.outputHandler(text);
+          } catch (e) {
+            log('error', 'Output handler error:', e);
+          }
+        },
+      }, this), this),
+    };
+  }
+
+  /**
+   * Load and instantiate Cu WASM module. The module compiles while the
+   * persisted tables are restored, since neither needs the other, and is
+   * instantiated once both are done. With a metrics hook (onMetric) this
+   * reports a 'load' record with restoreMs, compileMs and instantiateMs;
+   * durationMs is close to the larger of the first two rather than their sum.
+   * @param {Object} [options]
+   * @param {boolean} [options.autoRestore=true] - Restore persisted tables first
+   * @param {boolean} [options.lazyTables=false] - Restore only _home and
+   *   prefetchTables up front, and the other tables in the background
+   * @param {Array<number>} [options.prefetchTables=[]] - Further hot tables
+   * @param {string} [options.wasmPath='./cu.wasm'] - Where to fetch the module
+   *   (in Node, a file path or URL)
+   * @param {boolean} [options.cacheModule=true] - Reuse the module compiled
+   *   from wasmPath by an earlier load() (see cu-module.js)
+   * @param {WebAssembly.Module} [options.module] - Compiled module to use
+   *   instead of fetching wasmPath (share one across instances)
+   * @returns {Promise<boolean>} Success status
+   */
+  async load(options = {}) {
+    try {
+      const { autoRestore = true, lazyTables = false, prefetchTables = [] } = options;
+      const start = metricsEnabled() ? performance.now() : 0;
+      const timed = (promise) => (start === 0 ? promise : promise.then((value) => ({ value, ms: performance.now() - start })));
+
+      let compiling = null;
+      if (!options.module) {
+        const wasmPath = options.wasmPath || './cu.wasm';
+        checkDeprecatedPath(wasmPath);
+        compiling = timed(compileModule(wasmPath, { cache: options.cacheModule ?? true }));
+      }
+
+      let restoring = null;
+      if (autoRestore) {
+        restoring = timed(this.restorePersistedTables({ lazyTables, prefetchTables }));
+      } else {
+        this.externalTables.clear();
+        this.indexes.restore();
+        this.dropIoSlots();
+        this.nextTableId = 1;
+        this.homeTableId = null;
+        this.stateRestored = false;
+        this.persistedTableIds = null;
+      }
+
+      // Wait for both even if one fails, so a failed load leaves no restore
+      // still writing tables behind it
+      const [compiled, restored] = await Promise.allSettled([compiling, restoring]);
+      for (const outcome of [restored, compiled]) {
+        if (outcome.status === 'rejected') throw outcome.reason;
+      }
+      const module = options.module ?? (start === 0 ? compiled.value : compiled.value.value);
+
+      const instantiating = start === 0 ? 0 : performance.now();
+      this.instantiate(module);
+      if (start !== 0) {
+        const end = performance.now();
+        emitMetric({
+          name: 'load',
+          durationMs: end - start,
+          restoreMs: restored.value?.ms ?? 0,
+          compileMs: compiled.value?.ms ?? 0,
+          instantiateMs: end - instantiating,
+        });
+      }
+      log('info', '✅ Cu WASM loaded successfully');
+      return true;
+    } catch (error) {
+      log('error', '❌ Load failed:', error);
+      throw error;
+    }
+  }
+
+  /**
+   * Instantiate a compiled module, replacing any VM this instance had. The
+   * external tables are kept.
+   * @param {WebAssembly.Module} module
+   */
+  instantiate(module) {
+    // A wasm64 build passes offsets as BigInt; the adapter turns them into
+    // the numbers the rest of the host works with
+    const abi = memory64Abi(module);
+    const imports = this.createImports();
+    const instance = new WebAssembly.Instance(module, abi ? adaptImports(imports, abi) : imports);
+    this.module = module;
+    this.memory64 = abi !== null;
+    this.wasmInstance = abi ? { exports: adaptExports(instance.exports, abi) } : instance;
+    this.wasmMemory = null;
+    this.lastCheckpoint = null;
+    this.ioTableId = null;
+    this.resultRegion = null;
+    this.memoryView();
+    // Integer keys then cross as integers and hot string keys as handles
+    this.keyHandles = [];
+    this.taggedKeys = instance.exports.set_ext_key_encoding?.(2) === 0;
+    // Varint numbers and inline short strings; v1 values still read back
+    this.compactValues = instance.exports.set_value_encoding?.(1) === 0;
+    this.packedArrays = (instance.exports.get_typed_array_kinds?.() ?? 0) !== 0;
+    this.hostBlobs = WebAssembly.Module.imports(module).some((entry) => entry.name === 'js_blob_read');
+    this.blobHandles.clear();
+    this.startRun();
+    instance.exports.set_interrupt_polling?.(this.interruptCheck ? 1 : 0);
+    instance.exports.set_error_traceback?.(this.errorTraceback ? 1 : 0);
+    instance.exports.set_output_streaming?.(this.outputHandler ? this.outputChunkBytes : 0);
+    // Code compiled for the last module does not run in this one
+    this.tier = null;
+    if (this.tierThreshold) this.setTiering({ threshold: this.tierThreshold });
+
+    const preinit = preinitState(module);
+    this.preinitialized = preinit !== null;
+    if (preinit) this.applyPreinit(preinit);
+  }
+
+  /**
+   * Take on the host side of the VM a pre-initialized module holds. Tables
+   * restored from storage first are kept.
+   */
+  applyPreinit(state) {
+    this.keyHandles = state.keyHandles.slice();
+    for (const [id, entries] of state.tables) {
+      if (this.externalTables.has(id)) {
+        // What the image cached from its copy is stale
+        this.wasmInstance.exports.invalidate_ext_table?.(id);
+        continue;
+      }
+      const table = this.ensureExternalTable(id);
+      for (const [key, value] of entries) table.set(key, Uint8Array.from(value));
+    }
+    this.nextTableId = Math.max(this.nextTableId, state.nextTableId);
+  }
+
+  /**
+   * Capture this VM as it is between calls (typically after init() and any
+   * bootstrap code): its linear memory and host-side tables and handles.
+   * fromSnapshot() starts any number of new instances from it with a copy of
+   * that memory, skipping init() and the bootstrap. Forks of one snapshot
+   * begin with the same Lua state, including math.random's seed.
+   *
+   * The heap is trimmed first (trimHeap()), so a unit whose working set
+   * once spiked captures only what it holds now.
+   * @param {Object} [options]
+   * @param {boolean} [options.trim=true] - Trim the heap before capturing
+   * @returns {Object} Snapshot; treat as opaque and immutable
+   */
+  snapshot({ trim = true } = {}) {
+    const exports = this.requireLoaded();
+    if (this.pendingTables.size > 0) {
+      throw new Error('Persisted tables are still loading; await tablesReady() first');
+    }
+    if (trim) this.trimHeap();
+
+    // A fork starts from a fresh instance, so it only has to write the
+    // pages init and bootstrap changed; most of the heap is still zero
+    const fresh = new WebAssembly.Instance(this.module, this.createImports());
+    return this.captureState(diffPages(exports.memory.buffer, fresh.exports.memory.buffer));
+  }
+
+  /** A snapshot of the host side, with `image` for linear memory */
+  captureState(image) {
+    const tables = new Map();
+    for (const [id, table] of this.externalTables) tables.set(id, table.clone());
+    return Object.freeze({
+      module: this.module,
+      pages: this.wasmInstance.exports.memory.buffer.byteLength / WASM_PAGE,
+      image,
+      tables,
+      keyHandles: this.keyHandles.slice(),
+      blobHandles: new Map(this.blobHandles),
+      nextBlobHandle: this.nextBlobHandle,
+      nextTableId: this.nextTableId,
+      homeTableId: this.homeTableId,
+      indexes: this.indexes.declarations(),
+    });
+  }
+
+  /**
+   * A snapshot() as compressed bytes to store, or to restore in another
+   * process with the same cu.wasm: globals, upvalues, loaded modules and
+   * suspended coroutines come back with the external tables.
+   *
+   * With `delta`, only the memory pages that changed since this instance's
+   * last checkpoint are written, so a busy unit can ship frequent
+   * checkpoints to a standby that applies them in order. Pages are found by
+   * comparing memory with a copy kept at the last checkpoint: Lua writes
+   * stack slots, array items and the I/O buffer without a barrier, so
+   * marking pages from the allocator or the GC barriers would miss changes.
+   * The host-side tables are written whole either way.
+   *
+   * Full checkpoints trim the heap first, as snapshot() does; deltas do
+   * not unless asked, since the trim costs a full collection and rewrites
+   * the free pages once.
+   * @param {Object} [options]
+   * @param {boolean} [options.delta=false]
+   * @param {boolean} [options.trim=!delta] - Trim the heap before capturing
+   * @returns {Promise<Uint8Array>}
+   */
+  checkpoint({ delta = false, trim = !delta } = {}) {
+    const exports = this.requireLoaded();
+    const last = this.lastCheckpoint;
+    if (delta && !last?.memory) {
+      throw new Error('checkpoint({ delta: true }) needs an earlier checkpoint() taken by this instance');
+    }
+    if (delta && trim) this.trimHeap();
+    const snapshot = delta
+      ? this.captureState(diffPages(exports.memory.buffer, last.memory.buffer))
+      : this.snapshot({ trim });
+    const id = nextCheckpointId();
+    this.lastCheckpoint = { id, memory: new Uint8Array(exports.memory.buffer.slice(0)) };
+    return encodeCheckpoint(snapshot, this.fingerprint(snapshot.module), { id, base: delta ? last.id : 0 });
+  }
+
+  /**
+   * Replace this instance's VM and tables with those of a checkpoint(). A
+   * delta applies on top of the checkpoint it was taken after, which must be
+   * the last one this instance restored, with no calls in between.
+   * @param {Uint8Array} checkpoint
+   * @param {WebAssembly.Module} [module] - The build the checkpoint was
+   *   taken with; defaults to this instance's
+   */
+  async restoreCheckpoint(checkpoint, module = this.module) {
+    if (!module) throw new Error('restoreCheckpoint() needs the module the checkpoint was taken with');
+    const snapshot = await decodeCheckpoint(checkpoint, module, this.fingerprint(module));
+    if (snapshot.base === 0) {
+      this.restoreSnapshot(snapshot);
+    } else {
+      if (this.lastCheckpoint?.id !== snapshot.base || module !== this.module) {
+        throw new Error('Delta checkpoint does not follow the last checkpoint restored here');
+      }
+      this.writeImage(snapshot);
+      this.adoptState(snapshot);
+    }
+    // A copy of memory is only needed to take deltas, which a standby
+    // does not until it takes a full checkpoint of its own
+    this.lastCheckpoint = { id: snapshot.id, memory: null };
+  }
+
+  fingerprint(module) {
+    if (!fingerprints.has(module)) fingerprints.set(module, moduleFingerprint(module, this.createImports()));
+    return fingerprints.get(module);
+  }
+
+  /**
+   * Replace this instance's VM and tables with a copy of a snapshot()
+   * @param {Object} snapshot
+   */
+  restoreSnapshot(snapshot) {
+    this.instantiate(snapshot.module);
+    this.writeImage(snapshot);
+    this.adoptState(snapshot);
+    this.lastCheckpoint = null;
+  }
+
+  /** Write a snapshot's memory pages over this instance's memory */
+  writeImage(snapshot) {
+    const memory = this.wasmInstance.exports.memory;
+    const grow = snapshot.pages - memory.buffer.byteLength / WASM_PAGE;
+    if (grow > 0) growMemory(memory, grow, this.memory64);
+    const memoryBytes = this.memoryView();
+    const { offsets, bytes } = snapshot.image;
+    for (let i = 0; i < offsets.length; i++) {
+      memoryBytes.set(bytes.subarray(i * SNAPSHOT_PAGE, (i + 1) * SNAPSHOT_PAGE), offsets[i]);
+    }
+  }
+
+  /** Take on a snapshot's host-side tables and handles */
+  adoptState(snapshot) {
+    this.externalTables.clear();
+    this.dropIoSlots();
+    for (const [id, table] of snapshot.tables) {
+      const copy = this.restoreKind(id, table.clone());
+      if (this.tracksChanges()) copy.changes = new Map();
+      this.externalTables.set(id, copy);
+    }
+    this.keyHandles = snapshot.keyHandles.slice();
+    this.blobHandles = new Map(snapshot.blobHandles);
+    this.nextBlobHandle = snapshot.nextBlobHandle;
+    this.nextTableId = snapshot.nextTableId;
+    this.homeTableId = snapshot.homeTableId;
+    this.indexes.restore(snapshot.indexes);
+    this.persistedTableIds = null;
+    this.stateRestored = false;
+    this.preinitialized = false;
+  }
+
+  /**
+   * Initialize Lua VM
+   * @param {Object} options - Optional heap configuration
+   * @param {number} options.heapBytes - Lua heap committed at init
+   * @param {number} options.maxHeapBytes - Cap the heap may grow to on demand
+   * @param {object} options.gc - Collector mode and parameters, as for
+   *   setGcMode(): { mode: 'generational'|'incremental', ...params }
+   * @param {number} options.stringTableSize - Initial string table slots,
+   *   for states that intern many distinct keys (see set_string_table_size)
+   * @param {object} options.deterministic - { seed } for replayable runs:
+   *   fixed hash and math.random seeds, and clocks that read
+   *   setVirtualClock() (see set_deterministic)
+   * @param {string[]} options.libs - Standard libraries to open (default:
+   *   all); base and package always are
+   * @param {string[]|boolean} options.lazyLibs - Those of them to open on
+   *   first use instead (true: debug, utf8, os and io; see set_stdlibs)
+   * @returns {number} Status code (0 = success)
+   */
+  init(options = {}) {
+    if (!this.wasmInstance) {
+      throw new Error('WASM not loaded. Call load() first');
+    }
+    const exports = this.wasmInstance.exports;
+    const { deterministic, libs, lazyLibs } = options;
+    let stdlibs = null;
+    if (libs !== undefined || lazyLibs !== undefined) {
+      const lazy = lazyLibs === true ? DEFAULT_LAZY_LIBS : lazyLibs || [];
+      stdlibs = [stdlibMask(libs ?? STDLIBS), stdlibMask(lazy)];
+    }
+    if (deterministic) {
+      // Outside the try: silently running nondeterministic would defeat it
+      if (!exports.set_deterministic) {
+        throw new Error('Deterministic mode is not supported by this WASM build');
+      }
+      if (this.preinitialized || exports.set_deterministic(1, (deterministic.seed ?? 0) >>> 0) !== 0) {
+        throw new Error('Deterministic mode must be set before the VM is created');
+      }
+    }
+    try {
+      const { heapBytes, maxHeapBytes, gc, stringTableSize } = options;
+      // Sizes the table the VM is created with, or resizes a pre-initialized one
+      if (stringTableSize !== undefined) exports.set_string_table_size?.(stringTableSize);
+      if (stdlibs) exports.set_stdlibs?.(...stdlibs);
+      let result;
+      this.responseCache?.expire();
+      if (this.preinitialized) {
+        // init() already ran when the module was built
+        this.preinitialized = false;
+        if (heapBytes !== undefined) {
+          log('warn', 'init(): heap limits of a pre-initialized module are fixed at build time');
+        }
+        result = 0;
+      } else if (heapBytes !== undefined && exports.init_with_limits) {
+        result = exports.init_with_limits(heapBytes, maxHeapBytes ?? heapBytes);
+      } else {
+        result = exports.init?.() ?? 0;
+      }
+
+      // Get the _home table ID from WASM
+      const exportedId = exports.get_memory_table_id?.() ?? 0;
+      if (this.homeTableId && this.homeTableId !== exportedId && exports.attach_memory_table) {
+        exports.attach_memory_table(this.homeTableId);
+      } else if (!this.homeTableId && exportedId > 0) {
+        this.homeTableId = exportedId;
+      }
+
+      const confirmedId = exports.get_memory_table_id?.() ?? exportedId;
+      if (confirmedId > 0) {
+        this.homeTableId = confirmedId;
+        this.ensureExternalTable(this.homeTableId);
+      }
+
+      const maxId = this.getMaxTableId();
+      if (maxId >= this.nextTableId) {
+        this.nextTableId = maxId + 1;
+      }
+      if (this.homeTableId && this.homeTableId >= this.nextTableId) {
+        this.nextTableId = this.homeTableId + 1;
+      }
+
+      if (exports.sync_external_table_counter) {
+        exports.sync_external_table_counter(this.nextTableId);
+      }
+
+      if (gc && result === 0) {
+        const { mode, ...params } = gc;
+        this.setGcMode(mode, params);
+      }
+
+      return result;
+    } catch (error) {
+      log('error', 'init() error:', error);
+      return 0;
+    }
+  }
+
+  /**
+   * Execute Lua code
+   * @param {string|Uint8Array} code - Lua source, or a binary chunk from
+   *   compile() that runs without being parsed again
+   * @returns {number} Result length in buffer (negative on error)
+   */
+  compute(code) {
+    const exports = this.requireLoaded();
+    const isChunk = code instanceof Uint8Array;
+    if (!code || (!isChunk && typeof code !== 'string') || code.length === 0) {
+      throw new Error('Code must be a non-empty string or Uint8Array');
+    }
+    if (this.pendingTables.size > 0) {
+      throw new Error('Persisted tables are still loading; await tablesReady() first');
+    }
+
+    this.prepareResultRegion(exports);
+    const { ptr, len, staged } = this.placeCode(exports, code, isChunk);
+    const invoke = () => this.settleResult(exports, staged ? exports.compute_at(ptr, len) : exports.compute(ptr, len));
+    const run = this.capture === null
+      ? invoke
+      : () => this.capture.run(this, { kind: 'compute', code: isChunk ? code.slice() : code }, invoke);
+
+    this.startRun();
+    try {
+      if (!metricsEnabled()) {
+        const result = run();
+        this.recordJournal();
+        this.scheduleIdleGc();
+        return result;
+      }
+      const start = performance.now();
+      const result = run();
+      emitMetric({ name: 'compute', durationMs: performance.now() - start, inputBytes: len, result });
+      this.recordJournal();
+      this.scheduleIdleGc();
+      return result;
+    } finally {
+      if (staged) exports.cu_free(ptr);
+    }
+  }
+
+  // Code goes in the I/O buffer. In builds with compute_at, code too large
+  // for it is staged in memory from cu_alloc instead of being refused.
+  placeCode(exports, code, isChunk) {
+    const bufPtr = this.getBufferPtr();
+    const bufSize = this.getBufferSize();
+    if (!exports.compute_at) {
+      const len = isChunk ? this.writeChunk(code, bufPtr, bufSize) : this.writeSource(code, bufPtr, bufSize);
+      return { ptr: bufPtr, len, staged: false };
+    }
+
+    let bytes = code;
+    if (isChunk) {
+      if (code.length <= bufSize) return { ptr: bufPtr, len: this.writeChunk(code, bufPtr, bufSize), staged: false };
+    } else {
+      const { read, written } = textEncoder.encodeInto(code, this.memoryView().subarray(bufPtr, bufPtr + bufSize));
+      if (read === code.length) return { ptr: bufPtr, len: written, staged: false };
+      bytes = textEncoder.encode(code);
+    }
+    const ptr = exports.cu_alloc(bytes.length);
+    if (!ptr) throw new Error(`Cannot stage ${bytes.length} bytes of code`);
+    this.memoryView().set(bytes, ptr);
+    return { ptr, len: bytes.length, staged: true };
+  }
+
+  // Encode straight into linear memory; a short read means it did not fit
+  writeSource(code, bufPtr, bufSize) {
+    const { read, written } = textEncoder.encodeInto(code, this.memoryView().subarray(bufPtr, bufPtr + bufSize));
+    if (read < code.length) {
+      throw new Error(`Code too large (exceeds ${bufSize} bytes)`);
+    }
+    return written;
+  }
+
+  writeChunk(chunk, bufPtr, bufSize) {
+    if (chunk.length > bufSize) {
+      throw new Error(`Code too large (exceeds ${bufSize} bytes)`);
+    }
+    this.memoryView().set(chunk, bufPtr);
+    return chunk.length;
+  }
+
+  /**
+   * Compile Lua source to a binary chunk without running it. Passing the
+   * chunk to compute() skips the parser; it is checked as it loads, so a
+   * damaged or hand-made chunk fails like a syntax error instead of running
+   * @param {string} code - Lua source
+   * @param {Object} [options]
+   * @param {boolean} [options.strip=false] - Drop debug info (line numbers
+   *   and local names in error messages) for a smaller chunk
+   * @returns {Uint8Array} The chunk
+   */
+  compile(code, { strip = false } = {}) {
+    const exports = this.requireLoaded();
+    if (typeof exports.compile !== 'function') {
+      throw new Error('compile() is not supported by this WASM build');
+    }
+    if (typeof code !== 'string') {
+      throw new Error('Code must be a string');
+    }
+    const bufPtr = this.getBufferPtr();
+    const bufSize = this.getBufferSize();
+    this.resultEpoch++;
+    const written = this.writeSource(code, bufPtr, bufSize);
+    const result = exports.compile(bufPtr, written, strip ? 1 : 0);
+    if (result < 0) {
+      const message = textDecoder.decode(this.memoryView().subarray(bufPtr, bufPtr + (-result - 1)));
+      throw new Error(`compile() failed: ${message}`);
+    }
+    return this.memoryView().slice(bufPtr, bufPtr + result);
+  }
+
+  /**
+   * Call a Lua function by name without compiling any source
+   * @param {string} name - Global function or dotted path (e.g. 'handler',
+   *   '_home.handlers.ping'); bare names also resolve against _home
+   * @param {Array} [args=[]] - Arguments, serialized like _io values
+   * @returns {number} Result length in buffer (negative on error), as compute()
+   *   A handler named in setResponseCache() may be answered from the cache,
+   *   with the stored result written at getResultPtr().
+   */
+  call(name, args = []) {
+    const exports = this.requireLoaded();
+    if (!name || typeof name !== 'string') {
+      throw new Error('Function name must be a non-empty string');
+    }
+    if (!exports.call) {
+      throw new Error('call() is not supported by this WASM build');
+    }
+    if (this.pendingTables.size > 0) {
+      throw new Error('Persisted tables are still loading; await tablesReady() first');
+    }
+
+    const pure = this.capture === null && this.responseCache?.handlers.has(name);
+    const frame = pure ? this.responseFrame(args) : null;
+    if (frame) {
+      const cached = this.responseCache.lookup(name, frame, this.externalTables);
+      if (cached) return this.replayResponse(exports, name, cached);
+    }
+    const firstArgTable = this.nextTableId;
+
+    const nameBytes = textEncoder.encode(name);
+    const writer = new ValueWriter(this.compactValues);
+    const argBytes = args.map((arg) => this.outgoingValue(this.serializeObject(arg, writer)));
+    const argsLen = argBytes.reduce((sum, bytes) => sum + bytes.length, 0);
+    const bufSize = this.getBufferSize();
+    if (nameBytes.length + argsLen > bufSize) {
+      throw new Error(`Call payload too large (${nameBytes.length + argsLen} > ${bufSize})`);
+    }
+
+    // Table arguments were materialized as external tables on this side
+    exports.sync_external_table_counter?.(this.nextTableId);
+    this.prepareResultRegion(exports);
+
+    const bufPtr = this.getBufferPtr();
+    const memory = this.memoryView();
+    memory.set(nameBytes, bufPtr);
+    let offset = bufPtr + nameBytes.length;
+    for (const bytes of argBytes) {
+      memory.set(bytes, offset);
+      offset += bytes.length;
+    }
+
+    let invoke = () => this.settleResult(exports, exports.call(bufPtr, nameBytes.length, bufPtr + nameBytes.length, argsLen));
+    if (frame) {
+      const plain = invoke;
+      invoke = () => this.recordResponse(exports, name, frame, firstArgTable, plain);
+    }
+    const run = this.capture === null ? invoke : () => this.capture.run(this, { kind: 'call', name, args }, invoke);
+
+    this.startRun(pure);
+    if (!metricsEnabled()) {
+      const result = run();
+      this.recordJournal();
+      this.scheduleIdleGc();
+      return result;
+    }
+    const start = performance.now();
+    const result = run();
+    emitMetric({ name: 'call', durationMs: performance.now() - start, fn: name, inputBytes: nameBytes.length + argsLen, result });
+    this.recordJournal();
+    this.scheduleIdleGc();
+    return result;
+  }
+
+  // Before Lua runs: scans and the undo log are per run, and code other
+  // than a pure handler may change what cached responses depend on
+  startRun(pure = false) {
+    this.resultEpoch++;
+    this.tableScans.clear();
+    this.undoLog.clear();
+    if (!pure) this.responseCache?.expire();
+  }
+
+  /**
+   * Answer a call() from the response cache, without entering the VM
+   * @returns {number} The result length, as call()
+   */
+  replayResponse(exports, name, result) {
+    this.resultEpoch++;
+    this.prepareResultRegion(exports);
+    if (this.resultRegion && result.length > this.resultRegion.len) {
+      this.allocResultRegion(exports, result.length);
+    }
+    this.memoryView().set(result, this.getResultPtr());
+    if (metricsEnabled()) {
+      emitMetric({ name: 'call', durationMs: 0, fn: name, inputBytes: 0, result: result.length, cached: true });
+    }
+    return result.length;
+  }
+
+  // The arguments of a pure call as one frame, or null if they cannot be
+  // (and the call is not cached)
+  responseFrame(args) {
+    try {
+      return this.serializeFrame(args);
+    } catch {
+      return null;
+    }
+  }
+
+  // Run a pure call that missed the cache, noting the tables it reads, and
+  // keep its result if it turned out pure
+  recordResponse(exports, name, frame, firstArgTable, invoke) {
+    // Entries the VM cached were read by earlier calls; this one must ask
+    exports.invalidate_ext_table?.(0);
+    const reads = { tables: new Set(), pure: true };
+    this.tableReads = reads;
+    let result;
+    try {
+      result = invoke();
+    } finally {
+      this.tableReads = null;
+    }
+    if (result < 0 || !reads.pure) return result;
+
+    const tables = [];
+    for (const id of reads.tables) {
+      // The argument tables are made afresh by each call
+      if (id >= firstArgTable) continue;
+      const table = this.externalTables.get(id);
+      if (!table || table instanceof CacheTable) return result;
+      tables.push([id, table]);
+    }
+    const ptr = this.getResultPtr();
+    this.responseCache.store(name, frame, this.memoryView().slice(ptr, ptr + result), tables);
+    return result;
+  }
+
+  /**
+   * Run Lua source that may wait on the host. host.await(op, args) suspends
+   * the chunk until `handler(op, args)` settles; host.await then returns
+   * the answer, or raises the handler's error message. Other computes may
+   * run while a chunk waits, so any number can wait at once.
+   * @param {string} code - Lua source
+   * @param {function(string, *): *} handler - Answers one host.await, or
+   *   returns a promise of the answer; answers are serialized like _io values
+   * @returns {Promise<{status: number, output: string, result: *, results: Array}>}
+   *   `output` holds everything printed, across waits. Rejects with the Lua
+   *   error (error.status < 0, error.code)
+   */
+  async computeAsync(code, handler) {
+    const exports = this.requireLoaded();
+    if (!exports.compute_async) {
+      throw new Error('computeAsync() is not supported by this WASM build');
+    }
+    if (!code || typeof code !== 'string') {
+      throw new Error('Code must be a non-empty string');
+    }
+    if (this.pendingTables.size > 0) await this.tablesReady();
+
+    this.prepareResultRegion(exports);
+    const bufPtr = this.getBufferPtr();
+    const len = this.writeSource(code, bufPtr, this.getBufferSize());
+    this.startRun();
+    let status = this.settleResult(exports, exports.compute_async(bufPtr, len));
+    let output = '';
+    for (;;) {
+      // Read before anything else runs in the VM
+      const handle = status < 0 ? 0 : exports.get_await_handle();
+      this.recordJournal();
+      this.scheduleIdleGc();
+      if (status < 0) {
+        const error = new Error(this.readBuffer(bufPtr, -status - 1) || 'computeAsync() failed');
+        error.status = status;
+        error.code = this.getLastErrorCode();
+        throw error;
+      }
+
+      const outcome = this.readResult(this.getResultPtr(), status);
+      output += outcome.output;
+      if (handle === 0) return { status, ...outcome, output };
+
+      const [op, args = null] = outcome.results;
+      let answer;
+      let failed = false;
+      try {
+        answer = await handler(op, args);
+      } catch (error) {
+        answer = error?.message ?? String(error);
+        failed = true;
+      }
+      status = this.resumeAwait(exports, handle, answer, failed);
+    }
+  }
+
+  // Hand host.await its answer (or, when `failed`, its error message)
+  resumeAwait(exports, handle, answer, failed) {
+    const bytes = failed
+      ? textEncoder.encode(answer)
+      : this.outgoingValue(this.serializeObject(answer, new ValueWriter(this.compactValues)));
+    const bufSize = this.getBufferSize();
+    if (bytes.length > bufSize) {
+      return this.resumeAwait(exports, handle, `host.await: answer too large (${bytes.length} > ${bufSize})`, true);
+    }
+
+    // Table answers were materialized as external tables on this side
+    exports.sync_external_table_counter?.(this.nextTableId);
+    this.prepareResultRegion(exports);
+    const bufPtr = this.getBufferPtr();
+    this.memoryView().set(bytes, bufPtr);
+    this.startRun();
+    return this.settleResult(exports, exports.resume_await(handle, bufPtr, bytes.length, failed ? 1 : 0));
+  }
+
+  /**
+   * Run the tasks a script started with require('sched') for up to
+   * `budgetMs` milliseconds, or one turn for each ready task when 0. Call
+   * it again after `next` milliseconds, or after sending a waiting task a
+   * message.
+   * @param {number} [budgetMs=0]
+   * @returns {{status: number, output: string, next: number|null}} `next` is
+   *   the milliseconds until the next timer, 0 if tasks are still ready, or
+   *   null if none will run until sent a message. Throws the Lua error
+   *   (error.status < 0, error.code)
+   */
+  schedTick(budgetMs = 0) {
+    const exports = this.requireLoaded();
+    if (!exports.sched_tick) {
+      throw new Error('schedTick() is not supported by this WASM build');
+    }
+    this.prepareResultRegion(exports);
+    this.startRun();
+    const status = this.settleResult(exports, exports.sched_tick(budgetMs));
+    this.recordJournal();
+    this.scheduleIdleGc();
+    if (status < 0) {
+      const error = new Error(this.readBuffer(this.getBufferPtr(), -status - 1) || 'schedTick() failed');
+      error.status = status;
+      error.code = this.getLastErrorCode();
+      throw error;
+    }
+    const { output, result } = this.readResult(this.getResultPtr(), status);
+    return { status, output, next: result ?? null };
+  }
+
+  /**
+   * Run several scripts and/or named calls in a single WASM call
+   * @param {Array<string|{call: string, args?: Array}>} items - Lua source
+   *   strings, or named calls as accepted by call()
+   * @returns {Array<{status: number, output?: string, result?: *, results?: Array, error?: string}>}
+   *   One entry per item that ran, in order (fewer than items.length if the
+   *   result buffer filled up)
+   */
+  computeBatch(items) {
+    const exports = this.requireLoaded();
+    if (!exports.compute_batch) {
+      throw new Error('computeBatch() is not supported by this WASM build');
+    }
+    if (this.pendingTables.size > 0) {
+      throw new Error('Persisted tables are still loading; await tablesReady() first');
+    }
+
+    const frames = [];
+    const writer = new ValueWriter(this.compactValues);
+    let total = 4;
+    for (const item of items) {
+      if (typeof item === 'string') {
+        const code = textEncoder.encode(item);
+        frames.push(BATCH_ITEM_SOURCE, code);
+        total += 5 + code.length;
+      } else {
+        const name = textEncoder.encode(item.call);
+        const args = (item.args ?? []).map((arg) => this.outgoingValue(this.serializeObject(arg, writer)));
+        const argsLen = args.reduce((sum, bytes) => sum + bytes.length, 0);
+        frames.push(BATCH_ITEM_CALL, name, args, argsLen);
+        total += 9 + name.length + argsLen;
+      }
+    }
+
+    const bufSize = this.getBufferSize();
+    if (total > bufSize) {
+      throw new Error(`Batch too large (${total} > ${bufSize})`);
+    }
+    exports.sync_external_table_counter?.(this.nextTableId);
+
+    const bufPtr = this.getBufferPtr();
+    let memory = this.memoryView();
+    let view = new DataView(memory.buffer, bufPtr, bufSize);
+    view.setUint32(0, items.length, true);
+    let offset = 4;
+    for (let i = 0; i < frames.length;) {
+      const kind = frames[i++];
+      view.setUint8(offset++, kind);
+      const first = frames[i++];
+      view.setUint32(offset, first.length, true);
+      memory.set(first, bufPtr + offset + 4);
+      offset += 4 + first.length;
+      if (kind === BATCH_ITEM_CALL) {
+        const args = frames[i++];
+        view.setUint32(offset, frames[i++], true);
+        offset += 4;
+        for (const bytes of args) {
+          memory.set(bytes, bufPtr + offset);
+          offset += bytes.length;
+        }
+      }
+    }
+
+    this.startRun();
+    const start = metricsEnabled() ? performance.now() : 0;
+    const count = exports.compute_batch(bufPtr, total);
+    this.recordJournal();
+    this.scheduleIdleGc();
+    if (start !== 0) {
+      emitMetric({ name: 'computeBatch', durationMs: performance.now() - start, inputBytes: total, items: items.length, result: count });
+    }
+    if (count < 0) {
+      throw new Error('compute_batch rejected the batch');
+    }
+
+    // The batch may have grown memory, detaching the views written above
+    if (memory.buffer !== exports.memory.buffer) {
+      memory = this.memoryView();
+      view = new DataView(memory.buffer, bufPtr, bufSize);
+    }
+
+    const results = [];
+    offset = 4;
+    for (let i = 0; i < count; i++) {
+      const status = view.getInt32(offset, true);
+      const payloadLen = view.getUint32(offset + 4, true);
+      const payload = memory.subarray(bufPtr + offset + 8, bufPtr + offset + 8 + payloadLen);
+      if (status < 0) {
+        results.push({ status, error: textDecoder.decode(payload) });
+      } else {
+        results.push({ status, ...deserializeResult(payload.slice(), payloadLen, this.materialize) });
+      }
+      offset += 8 + payloadLen;
+    }
+    return results;
+  }
+
+  /**
+   * Get input/output buffer pointer
+   * @returns {number} Buffer address
+   */
+  getBufferPtr() {
+    const exports = this.requireLoaded();
+    try {
+      return exports.get_buffer_ptr?.() ?? 0;
+    } catch (error) {
+      log('error', 'getBufferPtr() error:', error);
+      return 0;
+    }
+  }
+
+  /**
+   * Where the results of the last successful compute() or call() are: the
+   * result region if one is set (setResultRegion), else the I/O buffer
+   * @returns {number} Address
+   */
+  getResultPtr() {
+    return this.resultRegion?.ptr ?? this.getBufferPtr();
+  }
+
+  /**
+   * Encode compute() and call() results into a region of linear memory
+   * instead of the 64KB I/O buffer, where long strings are cut to fit. The
+   * region starts at `bytes` and grows to whatever a result needs, so
+   * results of any size arrive whole; read them at getResultPtr(). Error
+   * messages stay in the I/O buffer.
+   * @param {number|false} bytes - Initial region size; false or 0 turns it off
+   * @returns {boolean} False if this build has no result regions
+   */
+  setResultRegion(bytes) {
+    const exports = this.requireLoaded();
+    if (!exports.set_result_region) return false;
+    if (this.resultRegion) {
+      exports.set_result_region(0, 0);
+      exports.cu_free(this.resultRegion.ptr);
+      this.resultRegion = null;
+    }
+    this.resultRegionBytes = bytes ? Math.max(Math.floor(bytes), 1) : 0;
+    return true;
+  }
+
+  // The region lives in the Lua heap, which init() sets up
+  prepareResultRegion(exports) {
+    if (this.resultRegionBytes > 0 && !this.resultRegion && exports.set_result_region) {
+      this.allocResultRegion(exports, this.resultRegionBytes);
+    }
+  }
+
+  allocResultRegion(exports, len) {
+    const ptr = exports.cu_alloc(len);
+    if (!ptr) throw new Error(`Cannot allocate a ${len}-byte result region`);
+    exports.set_result_region(ptr, len);
+    if (this.resultRegion) exports.cu_free(this.resultRegion.ptr);
+    this.resultRegion = { ptr, len };
+  }
+
+  // A length past the region's end is the size of results parked for
+  // take_result(); grow the region to fit them and fetch them
+  settleResult(exports, result) {
+    if (!this.resultRegion || result <= this.resultRegion.len) return result;
+    this.allocResultRegion(exports, Math.max(result, this.resultRegion.len * 2));
+    return exports.take_result();
+  }
+
+  /**
+   * Get buffer size
+   * @returns {number} Size in bytes (64KB)
+   */
+  getBufferSize() {
+    const exports = this.requireLoaded();
+    try {
+      return exports.get_buffer_size?.() ?? 65536;
+    } catch (error) {
+      log('error', 'getBufferSize() error:', error);
+      return 65536;
+    }
+  }
+
+  /**
+   * Get memory statistics
+   * @returns {object} Memory stats: total/used/free for the Lua heap, plus
+   *   luaBytes (live bytes reported by the collector), allocator telemetry
+   *   and string table occupancy
+   */
+  getMemoryStats() {
+    const exports = this.requireLoaded();
+    try {
+      if (!exports.get_memory_stats) {
+        return { total: 0, used: 0, free: 0 };
+      }
+
+      // The stats struct is written into the I/O buffer; zero it first so
+      // builds that only fill the leading fields read back as 0
+      const ptr = exports.get_buffer_ptr();
+      new Uint8Array(exports.memory.buffer, ptr, MEMORY_STATS_SIZE).fill(0);
+      exports.get_memory_stats(ptr);
+
+      const view = new DataView(exports.memory.buffer, ptr, MEMORY_STATS_SIZE);
+      const u32 = (offset) => view.getUint32(offset, true);
+
+      const heap = {
+        committed: u32(12),
+        limit: u32(16),
+        inUse: u32(20),
+        highWater: u32(24),
+        freeListBytes: u32(28),
+        largestFreeBlock: u32(32),
+        allocCount: u32(36),
+        freeCount: u32(40),
+      };
+      // Share of free-list bytes that cannot be served as one block
+      heap.fragmentation = heap.freeListBytes > 0
+        ? 1 - Math.min(heap.largestFreeBlock, heap.freeListBytes) / heap.freeListBytes
+        : 0;
+
+      const sizeClasses = [];
+      for (let i = 0; i < SIZE_CLASS_SLOTS; i++) {
+        sizeClasses.push({
+          size: SIZE_CLASS_BYTES[i] ?? 'large',
+          allocs: u32(44 + i * 4),
+          live: u32(108 + i * 4),
+        });
+      }
+
+      const strings = {
+        size: u32(172),
+        count: u32(176),
+        usedBuckets: u32(180),
+        longestChain: u32(184),
+      };
+      strings.loadFactor = strings.size > 0 ? strings.count / strings.size : 0;
+
+      const total = heap.limit || exports.memory.buffer.byteLength;
+      const used = heap.limit ? heap.inUse : u32(4);
+      return {
+        total,
+        used,
+        free: total - used,
+        luaBytes: u32(4),
+        wasmPages: u32(8),
+        heap,
+        sizeClasses,
+        strings,
+      };
+    } catch (error) {
+      log('error', 'getMemoryStats() error:', error);
+      return { total: 0, used: 0, free: 0 };
+    }
+  }
+
+  /**
+   * Run the Lua garbage collector
+   * @param {string} [mode='collect'] 'collect' (full cycle), 'step' (one
+   *   incremental step), 'generational' or 'incremental' (switch collector mode)
+   * @param {number} [stepKb=0] Work per step in KB when mode is 'step'
+   * @returns {boolean} Success
+   */
+  runGc(mode = 'collect', stepKb = 0) {
+    const exports = this.requireLoaded();
+    try {
+      const modeId = GC_MODES[mode];
+      if (modeId === undefined) {
+        log('error', `runGc() unknown mode: ${mode}`);
+        return false;
+      }
+      const status = exports.run_gc?.(modeId, stepKb);
+      return status === undefined || status >= 0;
+    } catch (error) {
+      log('error', 'runGc() error:', error);
+      return false;
+    }
+  }
+
+  /**
+   * Bring the heap back to its live extent after a spike (trim_heap): a
+   * full collection, then the allocator's adjacent free blocks merged, free
+   * space at the end given back to the top and every free byte zeroed.
+   * Linear memory cannot shrink, but zeroed pages match a fresh instance's,
+   * so snapshots and checkpoints leave them out. Call between calls.
+   * @returns {number|null} Bytes trimmed off the top of the heap, or null
+   *   if this build cannot trim
+   */
+  trimHeap() {
+    const exports = this.requireLoaded();
+    if (!exports.trim_heap) return null;
+    return exports.trim_heap() >>> 0;
+  }
+
+  /**
+   * Choose the collector mode and tune it. The VM starts generational.
+   * @param {'generational'|'incremental'} mode
+   * @param {object} [params] Percentages; omitted or 0 keeps the current value
+   * @param {number} [params.minorMul] Generational: growth that triggers a
+   *   minor collection (default 20, at most 200)
+   * @param {number} [params.majorMul] Generational: growth since the last
+   *   major collection that triggers another (default 100, at most 1000)
+   * @param {number} [params.pause] Incremental: growth before a new cycle
+   *   starts (default 200, at most 1000)
+   * @param {number} [params.stepMul] Incremental: collector work per
+   *   allocated KB (default 100, at most 1000)
+   * @returns {string|null} The previous mode, or null if this build cannot
+   *   tune the collector or the mode is unknown
+   */
+  setGcMode(mode, { minorMul = 0, majorMul = 0, pause = 0, stepMul = 0 } = {}) {
+    const exports = this.requireLoaded();
+    const modeId = GC_MODES[mode];
+    if (!exports.set_gc_mode || (mode !== 'generational' && mode !== 'incremental')) return null;
+    const previous = mode === 'generational'
+      ? exports.set_gc_mode(modeId, minorMul, majorMul)
+      : exports.set_gc_mode(modeId, pause, stepMul);
+    return Object.keys(GC_MODES).find((name) => GC_MODES[name] === previous) ?? null;
+  }
+
+  /**
+   * Collector pause statistics since init() or the last reset
+   * @param {object} [options]
+   * @param {boolean} [options.reset=false] Start the counts over after reading
+   * @returns {object|null} { pauses, fullCollections, totalMs, maxMs,
+   *   histogram: [{ underUs, count }] } where the last bucket's underUs is
+   *   Infinity, or null if this build does not time pauses
+   */
+  getGcStats({ reset = false } = {}) {
+    const exports = this.requireLoaded();
+    if (!exports.get_gc_stats) return null;
+    const ptr = exports.get_buffer_ptr();
+    exports.get_gc_stats(ptr, reset ? 1 : 0);
+
+    const view = new DataView(exports.memory.buffer, ptr, GC_STATS_SIZE);
+    const histogram = [];
+    for (let i = 0; i < GC_HISTOGRAM_BUCKETS; i++) {
+      histogram.push({
+        underUs: i < GC_HISTOGRAM_BUCKETS - 1 ? GC_FIRST_BUCKET_US * 2 ** i : Infinity,
+        count: view.getUint32(24 + i * 4, true),
+      });
+    }
+    return {
+      totalMs: view.getFloat64(0, true),
+      maxMs: view.getFloat64(8, true),
+      pauses: view.getUint32(16, true),
+      fullCollections: view.getUint32(20, true),
+      histogram,
+    };
+  }
+
+  /**
+   * Hot-path counters since init() or the last reset, for scraping into a
+   * metrics system
+   * @param {object} [options]
+   * @param {boolean} [options.reset=false] Start the counters over after reading
+   * @returns {object|null} { parseMs, executeMs, encodeMs, computeCalls,
+   *   functionCalls, extGets, extGetBytes, extSets, extSetBytes,
+   *   serializeCalls, serializeBytes, functionLoads, allocCalls, allocBytes,
+   *   gcSteps, latency }, or null if this build does not count them.
+   *   latency has { count, p50Us, p90Us, p99Us, buckets: [{ underUs, count }] }
+   *   for each of parse, execute, encode and total, the time per invocation,
+   *   with only the nonempty buckets listed
+   */
+  getPerfCounters({ reset = false } = {}) {
+    const exports = this.requireLoaded();
+    if (!exports.get_perf_counters) return null;
+    const ptr = exports.get_buffer_ptr();
+    exports.get_perf_counters(ptr, reset ? 1 : 0);
+
+    const view = new DataView(exports.memory.buffer, ptr, PERF_COUNTERS_SIZE);
+    const counters = {
+      parseMs: view.getFloat64(0, true),
+      executeMs: view.getFloat64(8, true),
+      encodeMs: view.getFloat64(16, true),
+    };
+    PERF_COUNTER_FIELDS.forEach((name, i) => {
+      counters[name] = Number(view.getBigUint64(24 + i * 8, true));
+    });
+    counters.latency = {};
+    LATENCY_PHASES.forEach((phase, p) => {
+      const counts = new Array(LATENCY_BUCKETS);
+      for (let i = 0; i < LATENCY_BUCKETS; i++) {
+        counts[i] = view.getUint32(LATENCY_OFFSET + (p * LATENCY_BUCKETS + i) * 4, true);
+      }
+      counters.latency[phase] = summarizeLatency(counts);
+    });
+    return counters;
+  }
+
+  /**
+   * Count the objects on the Lua heap by kind. Garbage not yet collected is
+   * counted too; call runGc() first to see only what is live.
+   * @returns {object|null} { totalBytes, objectBytes, kinds }, where kinds
+   *   maps shortStrings, longStrings, tables, luaClosures, cClosures,
+   *   userdata, bigints, decimals, protos, upvalues and threads to
+   *   { count, bytes }, bytes including the arrays each object owns; null
+   *   if this build has no census
+   */
+  getHeapCensus() {
+    const exports = this.requireLoaded();
+    if (!exports.get_heap_census) return null;
+    const ptr = exports.get_buffer_ptr();
+    if (exports.get_heap_census(ptr) !== 0) return null;
+
+    const view = new DataView(exports.memory.buffer, ptr, HEAP_CENSUS_SIZE);
+    const kinds = {};
+    CENSUS_KINDS.forEach((name, i) => {
+      kinds[name] = {
+        count: view.getUint32(8 + i * 8, true),
+        bytes: view.getUint32(12 + i * 8, true),
+      };
+    });
+    return { totalBytes: view.getUint32(0, true), objectBytes: view.getUint32(4, true), kinds };
+  }
+
+  /**
+   * Allocations by type since init() or the last reset, from a build made
+   * with CU_ALLOC_PROFILE=1. Table parts, stacks, bytecode and other
+   * vectors count as 'other'.
+   * @param {object} [options]
+   * @param {boolean} [options.reset=false] Start allocs and allocBytes over
+   *   after reading; live and liveBytes carry on
+   * @returns {object|null} Maps other, strings, tables, functions, userdata,
+   *   threads, upvalues and protos to { allocs, allocBytes, live, liveBytes },
+   *   or null if this build does not profile allocations
+   */
+  getAllocProfile({ reset = false } = {}) {
+    const exports = this.requireLoaded();
+    if (!exports.get_alloc_profile) return null;
+    const ptr = exports.get_buffer_ptr();
+    if (exports.get_alloc_profile(ptr, reset ? 1 : 0) !== 0) return null;
+
+    const view = new DataView(exports.memory.buffer, ptr, ALLOC_PROFILE_SIZE);
+    const profile = {};
+    ALLOC_PROFILE_KINDS.forEach((name, i) => {
+      const base = i * 32;
+      profile[name] = {
+        allocs: Number(view.getBigUint64(base, true)),
+        allocBytes: Number(view.getBigUint64(base + 8, true)),
+        live: Number(view.getBigInt64(base + 16, true)),
+        liveBytes: Number(view.getBigInt64(base + 24, true)),
+      };
+    });
+    return profile;
+  }
+
+  /**
+   * Start the sampling profiler: from the next compute() or call() on, the
+   * Lua stack is recorded every `period` instructions, without changing the
+   * scripts. A period of 10000 costs a few percent; shorter ones sample
+   * more finely at more cost. Starting again drops the earlier profile.
+   * @param {object} [options]
+   * @param {number} [options.period=10000] Instructions between samples
+   * @returns {boolean} False if this build has no profiler, or the sample
+   *   tables could not be allocated
+   */
+  startProfile({ period = 10000 } = {}) {
+    const exports = this.requireLoaded();
+    if (!exports.profile_start) return false;
+    return exports.profile_start(Math.max(1, Math.floor(period))) === 0;
+  }
+
+  /**
+   * Stop the profiler and return what it sampled as folded stacks: one
+   * "root;caller;leaf count" line per distinct stack, for flamegraph.pl or
+   * speedscope. Frames are "name (source:line)"; samples that did not fit
+   * the profiler's tables are counted on a "[dropped]" line.
+   * @returns {string|null} Folded stacks ('' if nothing was sampled), or
+   *   null if this build has no profiler
+   */
+  stopProfile() {
+    const exports = this.requireLoaded();
+    if (!exports.profile_stop) return null;
+    const len = exports.profile_stop();
+    if (len <= 0) return '';
+
+    // Large profiles are read through a buffer of their own
+    const staged = len > exports.get_buffer_size() && exports.cu_alloc ? exports.cu_alloc(len) : 0;
+    const ptr = staged || exports.get_buffer_ptr();
+    try {
+      const written = exports.profile_read(ptr, staged ? len : exports.get_buffer_size());
+      return written < 0 ? null : this.readBuffer(ptr, written);
+    } finally {
+      if (staged) exports.cu_free(staged);
+    }
+  }
+
+  /**
+   * Record the external table calls Lua makes into this host (reads,
+   * writes, deletes, sizes, key lists, batches and pairs() scans of _home,
+   * _io and ext.table() tables) with their table ID, key, value bytes and
+   * duration, keeping the most recent `capacity`. Starting again drops the
+   * calls recorded so far.
+   * @param {object} [options]
+   * @param {number} [options.capacity=4096] Calls kept
+   */
+  startBridgeTrace({ capacity } = {}) {
+    this.bridgeTrace = new BridgeTrace(capacity);
+  }
+
+  /**
+   * Summarize the calls recorded so far, without stopping the trace
+   * @param {object} [options]
+   * @param {number} [options.top=10] Keys to list
+   * @param {boolean} [options.entries=false] Also return the recorded calls
+   * @returns {object|null} { calls, dropped, ms, bytes, ops, tables,
+   *   byCount, byBytes } (see BridgeTrace.summarize), with entries when
+   *   asked, or null if no trace was started
+   */
+  getBridgeTrace({ top = 10, entries = false } = {}) {
+    const trace = this.bridgeTrace;
+    if (!trace) return null;
+    const summary = trace.summarize(top);
+    if (entries) summary.entries = trace.entries();
+    return summary;
+  }
+
+  /**
+   * Stop tracing; external table calls are no longer recorded
+   * @param {object} [options] As getBridgeTrace()
+   * @returns {object|null} The summary of the calls recorded, or null if no
+   *   trace was running
+   */
+  stopBridgeTrace(options) {
+    const summary = this.getBridgeTrace(options);
+    this.bridgeTrace = null;
+    return summary;
+  }
+
+  /**
+   * Record every compute() and call() from now on, for replayCapture()
+   * (cu-capture.js) to run against another build: its input, duration,
+   * result or error, and the external table calls it made. The capture
+   * starts with this host's tables, packed as shareState() packs them.
+   * @returns {WorkloadCapture}
+   */
+  startCapture() {
+    this.requireLoaded();
+    this.capture = new WorkloadCapture(this.shareState());
+    return this.capture;
+  }
+
+  /**
+   * Stop capturing
+   * @returns {object|null} The capture ({ version, startedAt, tables,
+   *   requests }, see encodeCapture()), or null if none was running
+   */
+  stopCapture() {
+    const capture = this.capture;
+    this.capture = null;
+    return capture?.toJSON() ?? null;
+  }
+
+  /**
+   * Cache the results of call()s to handlers that are pure functions of
+   * their arguments and the external tables they read (cu-response-cache.js).
+   * A repeated call with the same arguments, while none of the tables it
+   * read has changed, returns the stored result without entering the VM.
+   * Any other code run in the VM empties the cache.
+   * @param {object|null} options - null turns the cache off
+   * @param {string[]} options.handlers - Names of the pure handlers
+   * @param {number} [options.maxEntries=1024] - Results kept, least
+   *   recently used dropped first
+   */
+  setResponseCache(options) {
+    this.responseCache = options ? new ResponseCache(options.handlers, options) : null;
+  }
+
+  /**
+   * @returns {{hits: number, misses: number, entries: number}|null} Response
+   *   cache counters, or null if no cache is set
+   */
+  getResponseCacheStats() {
+    return this.responseCache?.stats() ?? null;
+  }
+
+  /**
+   * Compile hot Lua functions to WebAssembly as they run (cu-tier.js). A
+   * function called `threshold` times is compiled for the argument types of
+   * that call, if it is a numeric leaf function: numbers in, at most one
+   * number out, arithmetic, comparisons and integer 'for' loops, without
+   * tables, strings or calls. Others stay interpreted. Needs a CU_TIER=1
+   * build; debug hooks, compute limits and setInterruptCheck() keep every
+   * call in the interpreter.
+   * @param {object|null} options - null stops compiling more functions;
+   *   those already compiled keep their code
+   * @param {number} [options.threshold=1000] - Calls before a function is compiled
+   * @returns {boolean} False if this build cannot compile functions
+   */
+  setTiering(options) {
+    const exports = this.requireLoaded();
+    if (!exports.set_tier_threshold) return false;
+    if (!options) {
+      this.tierThreshold = 0;
+      exports.set_tier_threshold(0);
+      return true;
+    }
+    if (!this.tier) {
+      const layout = this.memory64 ? null : Tier.layoutFor(exports);
+      if (!layout) return false;
+      this.tier = new Tier(exports, layout);
+    }
+    this.tierThreshold = Math.max(1, Math.floor(options.threshold ?? 1000));
+    exports.set_tier_threshold(this.tierThreshold);
+    return true;
+  }
+
+  /**
+   * @returns {{compiled: number, declined: number, released: number,
+   *   active: number}|null} Functions compiled, left interpreted and given
+   *   back since the module was instantiated, and those holding code now;
+   *   null if setTiering() never succeeded
+   */
+  getTieringStats() {
+    return this.tier?.stats() ?? null;
+  }
+
+  /**
+   * Collect garbage between calls: after each compute(), call() or
+   * computeBatch(), run idle_gc when the event loop is idle
+   * (requestIdleCallback where available, otherwise setImmediate or
+   * setTimeout), so less collection lands inside the next request
+   * @param {object|false} options - false turns idle collection off
+   * @param {number} [options.budgetUs=2000] Collector time per idle slot;
+   *   unfinished work is rescheduled
+   * @returns {boolean} False if this build has no idle_gc
+   */
+  setIdleGc(options = {}) {
+    const exports = this.requireLoaded();
+    if (options === false) {
+      this.idleGc = null;
+      return true;
+    }
+    if (!exports.idle_gc) return false;
+    const { budgetUs = 2000 } = options;
+    this.idleGc = { budgetUs, scheduled: false };
+    return true;
+  }
+
+  // Queue one idle_gc run after a compute, call or batch (setIdleGc)
+  scheduleIdleGc() {
+    const idle = this.idleGc;
+    if (!idle || idle.scheduled) return;
+    idle.scheduled = true;
+    const run = (deadline) => {
+      idle.scheduled = false;
+      if (this.idleGc !== idle || !this.wasmInstance) return;
+      // An idle callback says how long the browser can spare
+      const budgetUs = deadline ? Math.min(idle.budgetUs, deadline.timeRemaining() * 1000) : idle.budgetUs;
+      if (this.wasmInstance.exports.idle_gc(Math.max(Math.floor(budgetUs), 1)) === 0) this.scheduleIdleGc();
+    };
+    if (typeof requestIdleCallback === 'function') requestIdleCallback(run);
+    else if (typeof setImmediate === 'function') setImmediate(run);
+    else setTimeout(run, 0);
+  }
+
+  /**
+   * Serve per-call Zig-side scratch buffers (table conversion batches, the
+   * copied input and results of computeBatch()) from a bump arena that is
+   * reset when each call returns, instead of the heap's free lists
+   * @param {number|false} chunkBytes - Arena chunk size; false or 0 turns it off
+   * @returns {boolean} False if this build has no scratch arena
+   */
+  setScratchArena(chunkBytes) {
+    const exports = this.requireLoaded();
+    if (!exports.set_scratch_arena) return false;
+    exports.set_scratch_arena(chunkBytes ? Math.max(Math.floor(chunkBytes), 0) : 0);
+    return true;
+  }
+
+  /**
+   * Set the time os.time, os.clock and sched timers read in deterministic
+   * mode. A replaying host records it with each message and sets it again
+   * before replaying that message.
+   * @param {number} nowMs - Milliseconds since the epoch
+   * @returns {boolean} False if this build has no deterministic mode
+   */
+  setVirtualClock(nowMs) {
+    const exports = this.requireLoaded();
+    if (!exports.set_virtual_clock) return false;
+    exports.set_virtual_clock(nowMs);
+    return true;
+  }
+
+  /**
+   * Set resource limits applied to every subsequent compute() call
+   * @param {object} limits
+   * @param {number} [limits.maxBytes=0] Max net heap growth per call (0 = unlimited)
+   * @param {number} [limits.maxInstructions=0] Max VM instructions per call (0 = unlimited)
+   * @returns {boolean} False if this build has no budget support
+   */
+  setComputeLimits({ maxBytes = 0, maxInstructions = 0 } = {}) {
+    const exports = this.requireLoaded();
+    if (!exports.set_compute_limits) {
+      return false;
+    }
+    exports.set_compute_limits(maxBytes, maxInstructions);
+    return true;
+  }
+
+  /**
+   * Let the host stop a running compute() or call(). While set, `check` is
+   * called every 1000 VM instructions; once it returns true the call fails
+   * with "interrupted" (ErrorCodes.INTERRUPTED). Since the VM runs on this
+   * thread, the check can only see state another thread changes, such as an
+   * Int32Array over a SharedArrayBuffer read with Atomics.load.
+   * @param {Function|null} check - Returns true to interrupt; null stops polling
+   * @returns {boolean} False if this build cannot poll for interrupts
+   */
+  setInterruptCheck(check) {
+    this.interruptCheck = check;
+    const exports = this.wasmInstance?.exports;
+    if (!exports) return true;
+    if (!exports.set_interrupt_polling) return false;
+    exports.set_interrupt_polling(check ? 1 : 0);
+    return true;
+  }
+
+  /**
+   * Stop the running compute() or call() at its next loop iteration or
+   * function call, or the next one to start if none is running. It fails
+   * with "interrupted" (ErrorCodes.INTERRUPTED). The request is a word in
+   * linear memory the VM reads as it goes, so unlike setInterruptCheck()
+   * it costs no host calls. During a call this thread only runs host
+   * callbacks (external table reads, streamed output), so that is where
+   * to call it from.
+   * @returns {boolean} False if this build has no interrupt word
+   */
+  interrupt() {
+    const exports = this.requireLoaded();
+    if (!exports.get_interrupt_flag_ptr) return false;
+    const words = new Int32Array(this.memoryView().buffer);
+    Atomics.store(words, exports.get_interrupt_flag_ptr() >> 2, 1);
+    return true;
+  }
+
+  /**
+   * Send print output to `handler` as the script writes it instead of
+   * capturing it into the result, where it is cut off at about 63KB. The
+   * handler gets a string each time `chunkBytes` bytes are buffered and once
+   * more before compute(), call() or a computeBatch() item returns, even if
+   * it fails; readResult() then reports an empty output.
+   * @param {Function|null} handler - Called with each piece of output; null
+   *   captures output into results again
+   * @param {object} [options]
+   * @param {number} [options.chunkBytes=4096] - Bytes buffered per call to
+   *   handler (1 hands over every print as it happens, at most 64512)
+   * @returns {boolean} False if this build cannot stream output
+   */
+  setOutputStreaming(handler, { chunkBytes = 4096 } = {}) {
+    this.outputHandler = handler;
+    this.outputChunkBytes = Math.max(Math.floor(chunkBytes), 1);
+    this.outputDecoder = handler ? new TextDecoder() : null;
+    const exports = this.wasmInstance?.exports;
+    if (!exports) return true;
+    if (!exports.set_output_streaming) return false;
+    exports.set_output_streaming(handler ? this.outputChunkBytes : 0);
+    return true;
+  }
+
+  /**
+   * Error code of the last compute() call (see ErrorCodes)
+   * @returns {number}
+   */
+  getLastErrorCode() {
+    return this.requireLoaded().get_last_error_code?.() ?? ErrorCodes.SUCCESS;
+  }
+
+  /**
+   * The last error of compute(), call(), computeAsync() or schedTick(), with
+   * where it was raised. `traceback` is only filled in for errors raised
+   * while setErrorTraceback(true) was on, since the stack is gone afterwards.
+   * @returns {{code: number, message: string, chunk: string, line: number,
+   *   traceback: string}|null} Null after a success, or if this build cannot
+   *   report error frames; `line` is -1 and `chunk` '' when unknown
+   */
+  getLastError() {
+    const exports = this.requireLoaded();
+    const len = exports.get_last_error_frame?.() ?? 0;
+    if (len === 0) return null;
+    const bytes = this.memoryView().slice(this.getBufferPtr(), this.getBufferPtr() + len);
+    const view = new DataView(bytes.buffer);
+    const frame = { code: view.getInt32(0, true), line: view.getInt32(4, true) };
+    let offset = 8;
+    for (const field of ['chunk', 'message', 'traceback']) {
+      const fieldLen = view.getUint32(offset, true);
+      frame[field] = textDecoder.decode(bytes.subarray(offset + 4, offset + 4 + fieldLen));
+      offset += 4 + fieldLen;
+    }
+    return frame;
+  }
+
+  /**
+   * Keep a traceback of each failing call's stack for getLastError(). It is
+   * taken as the error is raised, so turn this on before the calls whose
+   * errors need one; while off, errors skip the work.
+   * @param {boolean} enabled
+   * @returns {boolean} False if this build cannot take tracebacks
+   */
+  setErrorTraceback(enabled) {
+    this.errorTraceback = Boolean(enabled);
+    const exports = this.wasmInstance?.exports;
+    if (!exports) return true;
+    if (!exports.set_error_traceback) return false;
+    exports.set_error_traceback(enabled ? 1 : 0);
+    return true;
+  }
+
+  /**
+   * Compiled-chunk cache counters for compute()
+   * @returns {{hits: number, misses: number}}
+   */
+  getChunkCacheStats() {
+    const exports = this.requireLoaded();
+    return {
+      hits: exports.get_chunk_cache_hits?.() ?? 0,
+      misses: exports.get_chunk_cache_misses?.() ?? 0,
+    };
+  }
+
+  /**
+   * Drop all compiled chunks; the next compute() of any source recompiles it
+   */
+  clearChunkCache() {
+    this.requireLoaded().clear_chunk_cache?.();
+  }
+
+  /**
+   * Choose where external table entries live
+   * @param {'host'|'native'} backend - 'host' crosses into JS on every access;
+   *   'native' caches entries in WASM memory and writes changes back to the
+   *   host Map after each compute/call
+   * @param {Object} [options]
+   * @param {number} [options.maxBytes=0] - Cap on natively cached bytes (0 = default)
+   * @returns {boolean} false if the loaded build has no native backend
+   */
+  setExtTableBackend(backend, { maxBytes = 0 } = {}) {
+    const exports = this.requireLoaded();
+    const code = EXT_TABLE_BACKENDS[backend];
+    if (code === undefined) {
+      throw new Error(`Unknown external table backend: ${backend}`);
+    }
+    if (!exports.set_ext_table_backend) {
+      return false;
+    }
+    return exports.set_ext_table_backend(code, maxBytes) === 0;
+  }
+
+  /**
+   * Learn which external table keys each compute() source reads and fetch
+   * them in one batch per table when it runs again
+   * @param {boolean} on - false also forgets what was learned
+   * @returns {boolean} false if the loaded build cannot learn
+   */
+  setPrefetchLearning(on) {
+    const exports = this.requireLoaded();
+    return exports.set_prefetch_learning?.(on ? 1 : 0) === 0;
+  }
+
+  /**
+   * Read counters for the native external table backend
+   * @returns {{hits: number, misses: number}}
+   */
+  getExtTableStats() {
+    const exports = this.requireLoaded();
+    return {
+      hits: exports.get_ext_store_hits?.() ?? 0,
+      misses: exports.get_ext_store_misses?.() ?? 0,
+    };
+  }
+
+  /**
+   * Cap the entries of a Lua table stored into an external table
+   * @param {number} entries - Entry limit per table (0 restores the default of 10000)
+   * @returns {boolean} false if the loaded build has a fixed limit
+   */
+  setMaxTableEntries(entries) {
+    const exports = this.requireLoaded();
+    if (!exports.set_max_table_entries) {
+      return false;
+    }
+    exports.set_max_table_entries(entries);
+    return true;
+  }
+
+  /**
+   * Store small nested tables by value instead of as external tables
+   * @param {Object} limits
+   * @param {number} limits.maxEntries - Entries per inlined table (0 turns inlining off)
+   * @param {number} limits.maxBytes - Encoded bytes per inlined table, at most 4096
+   * @returns {boolean} false if the loaded build cannot inline tables
+   */
+  setInlineTableLimits({ maxEntries, maxBytes }) {
+    const exports = this.requireLoaded();
+    if (!exports.set_inline_table_limits) {
+      return false;
+    }
+    exports.set_inline_table_limits(maxEntries, maxBytes);
+    return true;
+  }
+
+  /**
+   * Keep debug info in functions stored to _home and other external tables.
+   * They are stored stripped by default: about a third smaller, but their
+   * errors carry no line number. Applies to functions stored from now on.
+   * @param {boolean} enabled
+   * @returns {boolean} False if this build always strips
+   */
+  setFunctionDebugInfo(enabled) {
+    const exports = this.requireLoaded();
+    if (!exports.set_function_debug_info) {
+      return false;
+    }
+    exports.set_function_debug_info(enabled ? 1 : 0);
+    return true;
+  }
+
+  /**
+   * Run the bytecode optimizer over sources compute() and compile() load
+   * from now on, as load(src, name, "to") does in Lua. Off by default;
+   * changing it empties the chunk cache.
+   * @param {boolean} enabled
+   * @returns {boolean} False if this build has no optimizer
+   */
+  setBytecodeOptimizer(enabled) {
+    const exports = this.requireLoaded();
+    if (!exports.set_bytecode_optimizer) {
+      return false;
+    }
+    exports.set_bytecode_optimizer(enabled ? 1 : 0);
+    return true;
+  }
+
+  /**
+   * Read buffer contents
+   * @param {number} ptr - Buffer pointer
+   * @param {number} len - Bytes to read
+   * @returns {string} Decoded string
+   */
+  readBuffer(ptr, len) {
+    this.requireLoaded();
+    try {
+      const memory = this.memoryView();
+      if (ptr < 0 || len < 0 || ptr + len > memory.length) {
+        throw new Error('Invalid buffer range');
+      }
+      return textDecoder.decode(memory.subarray(ptr, ptr + len));
+    } catch (error) {
+      log('error', 'readBuffer() error:', error);
+      return '';
+    }
+  }
+
+  /**
+   * Read and deserialize Lua result from buffer
+   * @param {number} ptr - Buffer pointer
+   * @param {number} len - Bytes to read
+   * @returns {{output: string, result: any, results: Array}} Deserialized
+   *   result: `results` holds every value returned and `result` the first;
+   *   returned tables arrive as arrays or objects
+   */
+  readResult(ptr, len) {
+    this.requireLoaded();
+    try {
+      const memory = this.memoryView();
+      if (ptr < 0 || len < 0 || ptr + len > memory.length) {
+        throw new Error('Invalid buffer range');
+      }
+      const buffer = memory.slice(ptr, ptr + len);
+      return deserializeResult(buffer, len, this.materialize);
+    } catch (error) {
+      log('error', 'readResult() error:', error);
+      return { output: '', result: null, results: [] };
+    }
+  }
+
+  /**
+   * Read a result in place, without copying it out of linear memory or
+   * decoding what is not asked for: output and string values are available
+   * as bytes that alias memory. The view is valid until the next run
+   * (compute(), call(), compile() and the like) or memory growth, and
+   * throws on access after; detach() copies it to keep it.
+   * @param {number} ptr - Buffer pointer
+   * @param {number} len - Bytes to read
+   * @returns {ResultView}
+   */
+  readResultView(ptr, len) {
+    this.requireLoaded();
+    const memory = this.memoryView();
+    if (ptr < 0 || len < 0 || ptr + len > memory.length) {
+      throw new Error('Invalid buffer range');
+    }
+    const epoch = this.resultEpoch;
+    return new ResultView(memory.subarray(ptr, ptr + len), len, this.materialize,
+      () => this.resultEpoch === epoch && this.memoryView() === memory);
+  }
+
+  /**
+   * Write data to buffer
+   * @param {number} ptr - Target address
+   * @param {string} data - Data to write
+   * @returns {number} Bytes written
+   */
+  writeBuffer(ptr, data) {
+    this.requireLoaded();
+    try {
+      const memory = this.memoryView();
+      if (ptr < 0 || ptr > memory.length) {
+        throw new Error('Buffer overflow');
+      }
+      const { read, written } = textEncoder.encodeInto(data, memory.subarray(ptr));
+      if (read < data.length) {
+        throw new Error('Buffer overflow');
+      }
+      return written;
+    } catch (error) {
+      log('error', 'writeBuffer() error:', error);
+      throw error;
+    }
+  }
+
+  /**
+   * Record that IndexedDB now holds exactly these tables as they are
+   * @param {Iterable<number>} ids
+   * @param {Set<number>} [journalTableIds] - Tables restored partly from the
+   *   journal, which the next snapshot must still write
+   */
+  markPersisted(ids, journalTableIds = new Set()) {
+    this.persistedTableIds = new Set();
+    for (const id of ids) {
+      const numericId = Number(id);
+      this.persistedTableIds.add(numericId);
+      const table = this.externalTables.get(numericId);
+      if (table && !journalTableIds.has(numericId)) table.dirty = false;
+    }
+    for (const table of this.externalTables.values()) {
+      table.changes?.clear();
+    }
+  }
+
+  // Whether tables record their changes (ExtTable.changes), for the
+  // journal or onChanges()
+  tracksChanges() {
+    return this.journal !== null || this.changeHandlers.length !== 0;
+  }
+
+  /**
+   * Append the table changes of the compute that just ran to the journal,
+   * and take a snapshot every compactEvery records. onChanges() handlers
+   * get the same changes.
+   */
+  recordJournal() {
+    if (this.cacheTableIds.size !== 0) this.invalidateCacheTables();
+    const { journal } = this;
+    if (!this.tracksChanges()) return;
+    const ioId = this.wasmInstance?.exports.get_io_table_id?.() ?? 0;
+    const changes = [];
+    for (const [id, table] of this.externalTables) {
+      table.seal?.();
+      if (!table.changes || table.changes.size === 0) continue;
+      if (id !== ioId) {
+        for (const [key, value] of table.changes) changes.push([id, key, value]);
+      }
+      table.changes.clear();
+    }
+    if (changes.length === 0) return;
+    if (this.changeHandlers.length !== 0) this.emitChanges(changes);
+    if (!journal) return;
+
+    // Group commit: records made while a journal write is in flight wait
+    // for it and are then written together, as one record in one storage
+    // transaction (and one sync), however many computes finished meanwhile
+    for (const change of changes) journal.queue.push(change);
+    journal.queueMetadata = { nextTableId: this.nextTableId, homeTableId: this.homeTableId };
+    if (!journal.queued) {
+      journal.queued = true;
+      if (journal.writing) {
+        journal.pending = journal.pending.then(() => this.writeJournalQueue(journal));
+      } else {
+        // The write starts now, so records stay in order with saveState's
+        const write = this.writeJournalQueue(journal);
+        journal.pending = journal.pending.then(() => write);
+      }
+    }
+    if (++journal.records >= journal.compactEvery) {
+      journal.records = 0;
+      journal.pending = journal.pending.then(() => this.saveState());
+    }
+  }
+
+  // Hand [tableId, key, value] changes to the onChanges() handlers
+  emitChanges(changes) {
+    let records = null;
+    let decoded = null;
+    for (const { handler, values } of this.changeHandlers) {
+      let batch;
+      if (values) {
+        decoded ??= changes.map((change) => this.changeRecord(change, true));
+        batch = decoded;
+      } else {
+        records ??= changes.map((change) => this.changeRecord(change, false));
+        batch = records;
+      }
+      try {
+        handler(batch);
+      } catch (error) {
+        log('error', 'change handler error:', error);
+      }
+    }
+  }
+
+  // An onChanges() record; a table reference decodes to { tableId }, as the
+  // table it names reports its own changes
+  changeRecord([tableId, key, bytes], decode) {
+    if (bytes === undefined) return { tableId, key, op: 'delete', bytes, value: undefined };
+    let value;
+    if (decode) {
+      const decoded = decodeValue(bytes);
+      if (decoded?.tableId !== undefined) value = { tableId: decoded.tableId };
+      else value = decoded ? this.materializeValue(decoded) : null;
+    }
+    return { tableId, key, op: 'set', bytes, value };
+  }
+
+  // Append the queued journal changes as one record
+  writeJournalQueue(journal) {
+    journal.queued = false;
+    const changes = journal.queue;
+    if (changes.length === 0) return undefined;
+    journal.queue = [];
+    journal.writing = true;
+    const { nextTableId, homeTableId } = journal.queueMetadata;
+    return this.persistence
+      .appendJournal(encodeJournalRecord({ nextTableId, homeTableId, changes }))
+      .catch((error) => log('error', 'Failed to append journal record:', error))
+      .finally(() => {
+        journal.writing = false;
+      });
+  }
+
+  /**
+   * Journal every compute: the _home changes it made are appended to
+   * IndexedDB as one record, so they survive a crash without a full
+   * saveState(). Every compactEvery records the journal is folded into a
+   * snapshot. loadState() and autoRestore replay the journal.
+   * @param {Object} [options]
+   * @param {number} [options.compactEvery=100] - Records between snapshots
+   */
+  enableJournal({ compactEvery = 100 } = {}) {
+    if (!this.journal) {
+      this.journal = { compactEvery, records: 0, pending: Promise.resolve(), queue: [], queueMetadata: null, queued: false, writing: false };
+      for (const table of this.externalTables.values()) table.changes = new Map();
+    }
+    this.journal.compactEvery = Math.max(1, compactEvery);
+  }
+
+  /**
+   * Stop journaling
+   * @returns {Promise<void>} Resolves once journal writes already made land
+   */
+  disableJournal() {
+    if (!this.journal) return Promise.resolve();
+    const { pending } = this.journal;
+    this.journal = null;
+    if (!this.tracksChanges()) {
+      for (const table of this.externalTables.values()) table.changes = null;
+    }
+    return pending;
+  }
+
+  /**
+   * Subscribe to the changes Lua and the host make to external tables. After
+   * each compute(), call() or computeBatch() item that changed any, the
+   * handler gets them as one array of { tableId, key, op, bytes, value }
+   * records: op is 'set' or 'delete', bytes the stored value (undefined
+   * when deleted) and value, with `values`, that value decoded. A key
+   * changed several times appears once, with its last value. The changes
+   * are those the journal records (enableJournal), storage entries
+   * included: cache, array and columnar tables also report the entries
+   * that hold their kind and column chunks. _io is left out.
+   * @param {Function} handler - Called with each batch of records
+   * @param {Object} [options]
+   * @param {boolean} [options.values=false] - Decode each value (table
+   *   references decode to { tableId })
+   * @returns {Function} Call to unsubscribe
+   */
+  onChanges(handler, { values = false } = {}) {
+    const subscription = { handler, values };
+    if (!this.tracksChanges()) {
+      for (const table of this.externalTables.values()) table.changes = new Map();
+    }
+    this.changeHandlers.push(subscription);
+    return () => {
+      const index = this.changeHandlers.indexOf(subscription);
+      if (index < 0) return;
+      this.changeHandlers.splice(index, 1);
+      if (!this.tracksChanges()) {
+        for (const table of this.externalTables.values()) table.changes = null;
+      }
+    };
+  }
+
+  /**
+   * @returns {Promise<void>} Resolves once every journal record written so
+   *   far is durable
+   */
+  flushJournal() {
+    return this.journal ? this.journal.pending : Promise.resolve();
+  }
+
+  /**
+   * Drop the external tables Lua can no longer reach: mark from _home, _io
+   * and the tables Lua still holds proxies for, following table references
+   * in stored values, and sweep the rest. Replacing _home.x = {...} or
+   * _io.input leaves the old tables behind until this runs.
+   * @returns {number} Tables dropped; 0 when reachability cannot be told
+   *   (no get_live_table_ids export, or a lazy restore still loading)
+   */
+  collectTables() {
+    const exports = this.wasmInstance?.exports;
+    if (!exports?.get_live_table_ids || this.pendingTables.size > 0) return 0;
+
+    const bufPtr = this.getBufferPtr();
+    const count = exports.get_live_table_ids(bufPtr, Math.floor(this.getBufferSize() / 4));
+    if (count < 0) return 0;
+
+    const stack = Array.from(new Uint32Array(exports.memory.buffer, bufPtr, count));
+    stack.push(this.homeTableId ?? 0, exports.get_io_table_id?.() ?? 0);
+    const marked = new Set();
+    const visit = (id) => {
+      if (!marked.has(id)) stack.push(id);
+    };
+    while (stack.length > 0) {
+      const id = stack.pop();
+      if (id === 0 || marked.has(id)) continue;
+      marked.add(id);
+      const table = this.externalTables.get(id);
+      if (!table) continue;
+      for (const [, value] of table) {
+        if (value instanceof Uint8Array) forEachTableRef(value, visit);
+      }
+    }
+
+    let dropped = 0;
+    for (const id of this.externalTables.keys()) {
+      if (marked.has(id)) continue;
+      this.externalTables.delete(id);
+      // Lua must not reuse it for a conversion, nor keep native entries
+      exports.invalidate_ext_table?.(id);
+      dropped++;
+    }
+    if (dropped > 0 && logEnabled('debug')) {
+      log('debug', `Dropped ${dropped} unreachable external tables`);
+    }
+    return dropped;
+  }
+
+  /**
+   * Save external tables to IndexedDB. Only tables changed since the last
+   * save or load are written, and tables no longer present are deleted, so
+   * the cost follows what changed. The _io table is not persisted. The save
+   * is a snapshot, so it also drops the journal.
+   * @param {Object} [options]
+   * @param {boolean} [options.collect=true] - Drop unreachable tables first
+   *   (collectTables()), so they are deleted from storage too
+   */
+  async saveState({ collect = true } = {}) {
+    // A table still loading would otherwise look removed
+    await this.tablesReady();
+    if (collect) this.collectTables();
+    const ioId = this.wasmInstance?.exports.get_io_table_id?.() ?? 0;
+    const tables = new Map();
+    for (const [id, table] of this.externalTables) {
+      if (id !== ioId) tables.set(id, table);
+    }
+
+    const { persistedTableIds } = this;
+    const changed = new Map();
+    for (const [id, table] of tables) {
+      if (table.dirty || persistedTableIds === null || !persistedTableIds.has(id)) {
+        changed.set(id, table);
+      }
+    }
+    // Cleared before the write, so changes made while it runs are kept
+    for (const table of changed.values()) table.dirty = false;
+    // The snapshot holds every change so far, and replaces the journal
+    for (const table of this.externalTables.values()) {
+      table.seal?.();
+      table.changes?.clear();
+    }
+    if (this.journal) {
+      this.journal.records = 0;
+      this.journal.queue = [];
+    }
+
+    try {
+      const metadata = {
+        homeTableId: this.homeTableId,
+        memoryTableId: this.homeTableId, // Keep alias for backward compatibility
+        nextTableId: this.nextTableId,
+        indexes: this.indexes.declarations(),
+        savedAt: new Date().toISOString(),
+        stateRestored: this.stateRestored,
+      };
+      if (persistedTableIds === null) {
+        await this.persistence.saveTables(tables, metadata);
+      } else {
+        const removed = Array.from(persistedTableIds).filter((id) => !tables.has(id));
+        await this.persistence.saveChanges(changed, removed, {
+          ...metadata,
+          tableCount: tables.size,
+          tableIds: Array.from(tables.keys()),
+        });
+      }
+      this.persistedTableIds = new Set(tables.keys());
+      return true;
+    } catch (error) {
+      for (const table of changed.values()) table.dirty = true;
+      log('error', 'Failed to save state:', error);
+      return false;
+    }
+  }
+
+  /**
+   * Load external tables from IndexedDB
+   */
+  async loadState() {
+    try {
+      await this.tablesReady();
+      const { tables, metadata, journalTableIds } = await this.persistence.loadTables();
+      const exports = this.wasmInstance?.exports;
+
+      this.externalTables.clear();
+      this.dropIoSlots();
+      this.nextTableId = 1;
+      this.homeTableId = null;
+      // Entries cached natively belong to the tables being replaced
+      exports?.invalidate_ext_table?.(0);
+
+      for (const [id, table] of tables) {
+        this.installTable(Number(id), table);
+      }
+      this.applyMetadata(metadata);
+
+      const maxId = this.getMaxTableId();
+      if (this.nextTableId <= maxId) {
+        this.nextTableId = maxId + 1;
+      }
+
+      if (exports?.sync_external_table_counter) {
+        exports.sync_external_table_counter(this.nextTableId);
+      }
+
+      if (this.homeTableId && exports?.attach_memory_table) {
+        exports.attach_memory_table(this.homeTableId);
+        const confirmedId = exports.get_memory_table_id?.() ?? this.homeTableId;
+        if (confirmedId > 0) {
+          this.homeTableId = confirmedId;
+        }
+      } else if (exports?.get_memory_table_id) {
+        const currentId = exports.get_memory_table_id();
+        if (currentId > 0 && !this.homeTableId) {
+          this.homeTableId = currentId;
+        }
+        if (this.homeTableId) {
+          this.ensureExternalTable(this.homeTableId);
+        }
+      }
+
+      this.markPersisted(tables.keys(), journalTableIds);
+      this.stateRestored = tables.size > 0;
+      return true;
+    } catch (error) {
+      log('error', 'Failed to load state:', error);
+      return false;
+    }
+  }
+
+  /**
+   * Clear all persisted data
+   */
+  async clearPersistedState() {
+    try {
+      await this.persistence.clearAll();
+      this.persistedTableIds = new Set();
+      this.stateRestored = false;
+      return true;
+    } catch (error) {
+      log('error', 'Failed to clear persisted state:', error);
+      return false;
+    }
+  }
+
+  /**
+   * Get info about current external tables. `bytes` is the length of the
+   * values a table holds, kept as it changes; `totalBytes` is their sum.
+   */
+  getTableInfo() {
+    const info = {
+      tableCount: this.externalTables.size,
+      homeTableId: this.homeTableId,
+      memoryTableId: this.homeTableId, // Alias for backward compatibility
+      nextTableId: this.nextTableId,
+      totalBytes: 0,
+      quota: this.tableQuota && { ...this.tableQuota },
+      tables: []
+    };
+
+    for (const [id, table] of this.externalTables) {
+      info.totalBytes += table.bytes;
+      info.tables.push({
+        id: id,
+        size: table.size,
+        bytes: table.bytes,
+        keys: Array.from(table.keys())
+      });
+    }
+
+    return info;
+  }
+
+  /**
+   * Get the _home table ID
+   * @returns {number|null} The _home table ID (formerly "Memory" table)
+   */
+  getMemoryTableId() {
+    return this.homeTableId;
+  }
+
+  /**
+   * Point _home at another external table, so several units can take turns
+   * on one VM with their own persistent state (CuPool). Lua globals other
+   * than _home stay shared.
+   * @param {number|null} [tableId=null] - Table to attach, or null for a new one
+   * @returns {number} The table now behind _home
+   */
+  attachHomeTable(tableId = null) {
+    const exports = this.requireLoaded();
+    if (!exports.attach_memory_table) {
+      throw new Error('attachHomeTable() is not supported by this WASM build');
+    }
+
+    const id = tableId ?? this.nextTableId;
+    this.ensureExternalTable(id);
+    exports.sync_external_table_counter?.(this.nextTableId);
+    exports.attach_memory_table(id);
+    this.homeTableId = id;
+    return id;
+  }
+
+  /**
+   * Pack the external tables, as they are between calls, into one buffer
+   * for attachSharedSnapshot() (see cu-shared-snapshot.js). It is a
+   * SharedArrayBuffer where there is one, so workers read it in place.
+   * @returns {SharedArrayBuffer|ArrayBuffer}
+   */
+  shareState() {
+    this.requireLoaded();
+    if (this.pendingTables.size > 0) {
+      throw new Error('Persisted tables are still loading; await tablesReady() first');
+    }
+    return packSnapshot(this.externalTables, { homeTableId: this.homeTableId, nextTableId: this.nextTableId });
+  }
+
+  /**
+   * Serve the tables packed by shareState() from its buffer, read-only:
+   * each becomes an OverlayTable that keeps this instance's writes and
+   * deletions to itself. Their _home becomes this instance's _home. Cache
+   * and columnar tables are copied, as they are held unpacked.
+   * @param {SharedArrayBuffer|ArrayBuffer} buffer
+   * @returns {SharedSnapshot}
+   */
+  attachSharedSnapshot(buffer) {
+    const exports = this.requireLoaded();
+    const snapshot = new SharedSnapshot(buffer);
+    for (const id of snapshot.tableIds()) {
+      const base = snapshot.table(id);
+      let table = new OverlayTable(base);
+      if (base.has(COLUMNS_KEY) || base.has(CACHE_KEY) || base.has(ARRAY_KEY)) {
+        table = new ExtTable();
+        for (const [key, value] of base) table.set(key, value.slice());
+        table = restoreArray(restoreCache(restoreColumns(table, this.externalTables)));
+      }
+      if (this.tracksChanges()) table.changes = new Map();
+      this.externalTables.set(id, table);
+      exports.invalidate_ext_table?.(id);
+    }
+    this.nextTableId = Math.max(this.nextTableId, snapshot.nextTableId);
+    this.sharedSnapshot = snapshot;
+    if (snapshot.homeTableId !== null) this.attachHomeTable(snapshot.homeTableId);
+    return snapshot;
+  }
+
+  /**
+   * A new table that reads through to the shared snapshot's _home, for a
+   * _home of its own that starts out with the shared data
+   * @returns {number} Its table ID, for attachHomeTable()
+   */
+  overlaySharedHome() {
+    const base = this.sharedSnapshot?.table(this.sharedSnapshot.homeTableId);
+    if (!base) throw new Error('No shared snapshot with a _home is attached');
+    const id = this.nextTableId++;
+    const table = new OverlayTable(base);
+    if (this.tracksChanges()) table.changes = new Map();
+    this.externalTables.set(id, table);
+    return id;
+  }
+
+  /**
+   * Create another isolated Lua state in this instance: its own globals,
+   * collector, _home and _io, sharing the module, linear memory and this
+   * instance's external tables. Hosting many small tenants this way costs a
+   * state each rather than an instance each. The selected state stays
+   * selected.
+   * @param {Object} [options]
+   * @param {number} [options.maxBytes=0] - Cap on the heap bytes the state
+   *   may hold; 0 leaves it to the heap's own limit
+   * @returns {number} Handle for selectState()/computeOn()/destroyState()
+   */
+  createState({ maxBytes = 0 } = {}) {
+    const exports = this.requireLoaded();
+    if (!exports.create_state) {
+      throw new Error('createState() is not supported by this WASM build');
+    }
+    exports.sync_external_table_counter(this.nextTableId);
+    const handle = exports.create_state();
+    if (handle < 0) throw new Error('Could not create a Lua state');
+    if (maxBytes > 0) exports.set_state_memory_limit(handle, maxBytes);
+
+    // Register its _home and _io so table IDs handed out here stay past them
+    const selected = exports.get_state();
+    exports.select_state(handle);
+    this.ensureExternalTable(exports.get_memory_table_id());
+    this.ensureExternalTable(exports.get_io_table_id());
+    exports.select_state(selected);
+    return handle;
+  }
+
+  /**
+   * Make `handle` the state compute(), call(), setInput(), getOutput() and
+   * the rest work on
+   * @param {number} handle - From createState(), or 1 for the state init()
+   *   made
+   */
+  selectState(handle) {
+    const exports = this.requireLoaded();
+    if (!exports.select_state) {
+      throw new Error('selectState() is not supported by this WASM build');
+    }
+    if (exports.get_state() === handle) return;
+    if (exports.select_state(handle) !== 0) {
+      throw new Error(`Cannot select Lua state ${handle}: unknown, or a compute is waiting at host.await`);
+    }
+    this.homeTableId = exports.get_memory_table_id();
+    this.ioTableId = null;
+    // The _io tables of the state left behind are kept as they are
+    this.dropIoSlots();
+    this.responseCache?.expire();
+  }
+
+  /** @returns {number} The selected state's handle */
+  getState() {
+    return this.requireLoaded().get_state?.() ?? 1;
+  }
+
+  /**
+   * Run code on the state `handle`, which stays selected
+   * @param {number} handle
+   * @param {string|Uint8Array} code
+   * @returns {number} As compute()
+   */
+  computeOn(handle, code) {
+    this.selectState(handle);
+    return this.compute(code);
+  }
+
+  /**
+   * Close a state made by createState(). Its tables are dropped by the next
+   * collectTables().
+   * @param {number} handle - Not the selected state, nor state 1
+   */
+  destroyState(handle) {
+    const exports = this.requireLoaded();
+    if (!exports.destroy_state || exports.destroy_state(handle) !== 0) {
+      throw new Error(`Cannot destroy Lua state ${handle}`);
+    }
+  }
+
+  /**
+   * @param {number} handle
+   * @returns {number} Heap bytes the state holds (0 for state 1, which is
+   *   not accounted; getMemoryStats() covers the whole heap)
+   */
+  getStateMemory(handle) {
+    return this.requireLoaded().get_state_memory?.(handle) ?? 0;
+  }
+
+  /**
+   * Get the _io table ID
+   * @returns {number} The _io table ID
+   */
+  getIoTableId() {
+    const exports = this.requireLoaded();
+    if (this.ioTableId === null) {
+      const id = exports.get_io_table_id?.() ?? 0;
+      if (id === 0) {
+        throw new Error('_io table not initialized');
+      }
+      this.ioTableId = id;
+    }
+    return this.ioTableId;
+  }
+
+  /**
+   * Helper to serialize JavaScript objects to Lua-compatible format
+   * Creates external tables for nested objects/arrays
+   * @param {*} obj - JavaScript value to serialize
+   * @param {ValueWriter} [writer] - Shared by the values of one call
+   * @param {Object} [slots] - Take the tables from these slots
+   *   (createTableSlots) instead of allocating new IDs
+   * @returns {Uint8Array} Serialized binary data
+   */
+  serializeObject(obj, writer = new ValueWriter(this.compactValues), slots = null) {
+    if (obj === null || obj === undefined || typeof obj === 'boolean' ||
+        typeof obj === 'number' || typeof obj === 'string') {
+      return writer.value(obj);
+    }
+
+    if (typeof obj === 'bigint') {
+      // Arrives in Lua as a bigint, exact at any size
+      return writer.bigint(obj);
+    }
+
+    if (this.hostBlobs && obj instanceof ArrayBuffer) {
+      // Held here; Lua reads slices of it on demand
+      return writer.blob(obj);
+    }
+
+    if (this.packedArrays && typedArrayKind(obj)) {
+      // One packed value, indexable in Lua without a table entry per element
+      return writer.typedArray(obj);
+    }
+
+    if (Array.isArray(obj)) {
+      // Create external table for array
+      const arrayTableId = slots ? this.takeTableSlot(slots) : this.nextTableId++;
+      const table = this.ensureExternalTable(arrayTableId);
+
+      for (let i = 0; i < obj.length; i++) {
+        if (!(i in obj)) continue; // holes stay nil
+        table.set(i + 1, this.serializeObject(obj[i], writer, slots)); // Lua arrays are 1-indexed
+      }
+
+      return writer.tableRef(arrayTableId);
+    }
+
+    if (typeof obj === 'object') {
+      // Create external table for object
+      const objTableId = slots ? this.takeTableSlot(slots) : this.nextTableId++;
+      const table = this.ensureExternalTable(objTableId);
+
+      for (const [key, value] of Object.entries(obj)) {
+        table.set(key, this.serializeObject(value, writer, slots));
+      }
+
+      return writer.tableRef(objTableId);
+    }
+
+    return writer.value(null); // fallback to nil
+  }
+
+  /**
+   * Encode `obj` as one frame: objects and arrays become inline tables
+   * nested in the same buffer instead of external tables, which the VM
+   * decodes into plain Lua tables in one pass
+   * @param {*} obj - JavaScript value to serialize
+   * @returns {Uint8Array} The frame
+   * @throws {Error} If `obj` nests deeper than an inline table can
+   */
+  serializeFrame(obj) {
+    const writer = new ValueWriter(this.compactValues, { contiguous: true });
+    this.writeFrameValue(obj, writer, 0);
+    return writer.written();
+  }
+
+  writeFrameValue(obj, writer, depth) {
+    if (obj === null || obj === undefined || typeof obj === 'boolean' ||
+        typeof obj === 'number' || typeof obj === 'string') {
+      writer.value(obj);
+    } else if (typeof obj === 'bigint') {
+      writer.bigint(obj);
+    } else if (this.hostBlobs && obj instanceof ArrayBuffer) {
+      writer.blob(obj);
+    } else if (this.packedArrays && typedArrayKind(obj)) {
+      writer.typedArray(obj);
+    } else if (typeof obj === 'object') {
+      // The VM reads at most 32 levels, which also stops cycles
+      if (depth >= MAX_FRAME_DEPTH) throw new Error('Input nests too deeply for a frame');
+      if (Array.isArray(obj)) {
+        let count = 0;
+        for (let i = 0; i < obj.length; i++) if (i in obj) count++;
+        writer.inlineTable(count);
+        for (let i = 0; i < obj.length; i++) {
+          if (!(i in obj)) continue; // holes stay nil
+          writer.value(i + 1);
+          this.writeFrameValue(obj[i], writer, depth + 1);
+        }
+      } else {
+        const keys = Object.keys(obj);
+        writer.inlineTable(keys.length);
+        for (const key of keys) {
+          writer.value(normalizeKey(key));
+          this.writeFrameValue(obj[key], writer, depth + 1);
+        }
+      }
+    } else {
+      writer.value(null);
+    }
+  }
+
+  /**
+   * A set of external tables that serializeObject() refills in place, for
+   * hosts that send the same shape of data over and over: values written
+   * with the slots take tables from those recycled by recycleTableSlots()
+   * before allocating new IDs. Lua must not hold on to these tables past
+   * the next recycle.
+   * @returns {{used: number[], free: number[]}}
+   */
+  createTableSlots() {
+    return { used: [], free: [] };
+  }
+
+  takeTableSlot(slots) {
+    const id = slots.free.pop();
+    if (id === undefined) {
+      const fresh = this.nextTableId++;
+      slots.used.push(fresh);
+      return fresh;
+    }
+    // Emptied here, and dropped from whatever the VM cached of it
+    this.ensureExternalTable(id).clear();
+    this.wasmInstance?.exports.invalidate_ext_table?.(id);
+    slots.used.push(id);
+    return id;
+  }
+
+  /**
+   * Make the tables written with these slots available to the next writes
+   * @param {{used: number[], free: number[]}} slots
+   */
+  recycleTableSlots(slots) {
+    for (const id of slots.used) slots.free.push(id);
+    slots.used.length = 0;
+  }
+
+  /**
+   * Drop the slots' tables
+   * @param {{used: number[], free: number[]}} slots
+   */
+  releaseTableSlots(slots) {
+    const exports = this.wasmInstance?.exports;
+    for (const id of [...slots.used, ...slots.free]) {
+      this.externalTables.delete(id);
+      exports?.invalidate_ext_table?.(id);
+    }
+    slots.used.length = 0;
+    slots.free.length = 0;
+  }
+
+  /**
+   * Lua stored a value somewhere other than the _io tables: any _io.input or
+   * _io.meta table it refers to is kept from then on, out of the slots
+   */
+  keepStoredIoTables(tableId, value) {
+    if (tableId === this.ioTableId || this.ioSlotIds.has(tableId)) return;
+    forEachTableRef(value, (id) => this.keepIoTable(id));
+  }
+
+  keepIoTable(id) {
+    const slots = this.ioSlotIds.get(id);
+    if (!slots) return;
+    this.ioSlotIds.delete(id);
+    for (const list of [slots.used, slots.free]) {
+      const index = list.indexOf(id);
+      if (index >= 0) list.splice(index, 1);
+    }
+    // Along with the tables under it
+    const table = this.externalTables.get(id);
+    if (!table) return;
+    for (const [, value] of table) {
+      if (value instanceof Uint8Array) forEachTableRef(value, (child) => this.keepIoTable(child));
+    }
+  }
+
+  dropIoSlots() {
+    this.ioSlots.clear();
+    this.ioSlotIds.clear();
+  }
+
+  /**
+   * Helper to deserialize Lua binary data to JavaScript objects
+   * Reconstructs nested objects/arrays from external tables
+   * @param {Uint8Array} buffer - Binary data to deserialize (v1 or v2)
+   * @returns {*} JavaScript value
+   */
+  deserializeObject(buffer) {
+    if (!buffer || buffer.length === 0) {
+      return null;
+    }
+
+    const decoded = decodeValue(buffer);
+    if (!decoded) {
+      return null;
+    }
+    return this.materializeValue(decoded);
+  }
+
+  /**
+   * Turn a decodeValue() result into plain JavaScript data
+   * @param {Object} decoded
+   * @returns {*} JavaScript value
+   */
+  materializeValue(decoded) {
+    if (decoded.entries) {
+      // Inline table; keys exactly 1..n make an array
+      if (decoded.entries.every(([key], index) => key === index + 1)) {
+        return decoded.entries.map(([, value]) => this.materializeValue(value));
+      }
+      const result = {};
+      for (const [key, value] of decoded.entries) {
+        result[key] = this.materializeValue(value);
+      }
+      return result;
+    }
+    if (decoded.tableId === undefined) {
+      if (decoded.bigint) return decoded.value;
+      return typeof decoded.value === 'bigint' ? Number(decoded.value) : decoded.value;
+    }
+
+    const table = this.externalTables.get(decoded.tableId);
+    if (!table) return null;
+
+    if (table instanceof ColumnTable) return table.toArray();
+    // Keys exactly 1..n are held in the table's array part. entries(), not
+    // the storage entries, which hold cache and array tables' kinds too
+    if (table.isArray()) {
+      return Array.from(table.entries(), ([, value]) => this.deserializeObject(value));
+    }
+    // Deserialize as object
+    const result = {};
+    for (const [key, value] of table.entries()) {
+      result[key] = this.deserializeObject(value);
+    }
+    return result;
+  }
+
+  /**
+   * A stored value as JavaScript data, with external tables as lazyTable()
+   * views instead of copies
+   * @param {Uint8Array} buffer
+   * @returns {*}
+   */
+  lazyValue(buffer) {
+    const decoded = buffer && buffer.length > 0 ? decodeValue(buffer) : null;
+    if (!decoded) return null;
+    if (decoded.tableId === undefined) return this.materializeValue(decoded);
+    const table = this.externalTables.get(decoded.tableId);
+    if (!table) return null;
+    if (table instanceof ColumnTable) return table.toArray();
+    return this.lazyTable(table);
+  }
+
+  /**
+   * A read-only Proxy over an external table that decodes a field the
+   * first time it is read and keeps it. It is an array when the table's
+   * keys are exactly 1..n (known from the table's array part without
+   * looking at the keys), otherwise an object; property enumeration,
+   * JSON.stringify and array methods see the table's keys. The table is
+   * read as it is at each access, so read the view before the next call.
+   * @param {ExtTable} table
+   * @returns {Proxy}
+   */
+  lazyTable(table) {
+    const host = this;
+    const isArray = table.isArray();
+    const values = new Map();
+    // Property name -> table key, or undefined if it names none
+    const keyOf = (prop) => {
+      if (!isArray) return table.has(prop) ? prop : undefined;
+      const index = ARRAY_INDEX.test(prop) ? Number(prop) : -1;
+      return index >= 0 && index < table.size ? index + 1 : undefined;
+    };
+    const read = (key) => {
+      if (!values.has(key)) values.set(key, host.lazyValue(table.get(key)));
+      return values.get(key);
+    };
+    const readOnly = () => false;
+
+    return new Proxy(isArray ? [] : {}, {
+      get(target, prop, receiver) {
+        if (typeof prop === 'string') {
+          if (isArray && prop === 'length') return table.size;
+          const key = keyOf(prop);
+          if (key !== undefined) return read(key);
+        }
+        return Reflect.get(target, prop, receiver);
+      },
+      has(target, prop) {
+        return (typeof prop === 'string' && keyOf(prop) !== undefined) || Reflect.has(target, prop);
+      },
+      ownKeys() {
+        if (!isArray) return Array.from(table.keys(), String);
+        const keys = Array.from({ length: table.size }, (_, i) => String(i));
+        keys.push('length');
+        return keys;
+      },
+      getOwnPropertyDescriptor(target, prop) {
+        if (isArray && prop === 'length') {
+          return { value: table.size, writable: true, enumerable: false, configurable: false };
+        }
+        const key = typeof prop === 'string' ? keyOf(prop) : undefined;
+        if (key === undefined) return Reflect.getOwnPropertyDescriptor(target, prop);
+        return { value: read(key), writable: false, enumerable: true, configurable: true };
+      },
+      set: readOnly,
+      deleteProperty: readOnly,
+      defineProperty: readOnly,
+    });
+  }
+
+  /**
+   * Set input data for _io.input. Objects and arrays become external
+   * tables, which the next setInput() after clearIo() refills in place
+   * instead of taking new table IDs, so memory stays flat across requests.
+   * A table Lua stores into _home or another table is kept; one held only
+   * in a Lua variable sees the next request's data.
+   *
+   * With `frame`, the whole input is encoded into one buffer of inline
+   * tables instead, which the VM copies in once and decodes into plain Lua
+   * tables on the first read of _io.input: no external table per object and
+   * no bridge call per field. Writes to those tables stay in Lua. The
+   * decoded table is cached only weakly, so keep it in a local
+   * (`local input = _io.input`) rather than reading _io.input after a GC.
+   * Input that nests too deeply, or a build that cannot read inline tables,
+   * falls back to external tables.
+   * @param {*} data - JavaScript object/value to send to Lua
+   * @param {Object} [options]
+   * @param {boolean} [options.frame=false] - Send the input as one frame
+   */
+  setInput(data, { frame = false } = {}) {
+    if (frame && this.requireLoaded().set_inline_table_limits) {
+      let serialized;
+      try {
+        serialized = this.serializeFrame(data);
+      } catch {
+        serialized = null;
+      }
+      if (serialized) {
+        // The tables of a previous non-frame input are free again
+        const slots = this.ioSlots.get('input');
+        if (slots) this.recycleTableSlots(slots);
+        const tableId = this.getIoTableId();
+        this.ensureExternalTable(tableId).set('input', serialized);
+        this.wasmInstance.exports.invalidate_ext_table?.(tableId);
+        return;
+      }
+    }
+    this.setIoField('input', data);
+  }
+
+  /**
+   * Get output data from _io.output
+   * @param {Object} [options]
+   * @param {boolean} [options.lazy=false] - Return tables as read-only
+   *   views that decode a field when it is read (lazyTable()), so a caller
+   *   that reads a few fields of a large output skips the rest. Read the
+   *   view before the next call; it cannot be posted to another thread.
+   * @returns {*} JavaScript object/value from Lua
+   */
+  getOutput({ lazy = false } = {}) {
+    const table = this.externalTables.get(this.getIoTableId());
+    if (!table) return null;
+
+    const serialized = table.get('output');
+    if (!serialized) return null;
+
+    return lazy ? this.lazyValue(serialized) : this.deserializeObject(serialized);
+  }
+
+  /**
+   * Set metadata for _io.meta
+   * @param {*} meta - Metadata object to send to Lua
+   */
+  setMetadata(meta) {
+    this.setIoField('meta', meta);
+  }
+
+  setIoField(field, data) {
+    const tableId = this.getIoTableId();
+    let slots = this.ioSlots.get(field);
+    if (!slots) {
+      slots = this.createTableSlots();
+      this.ioSlots.set(field, slots);
+    }
+    // The field's previous value is replaced, so its tables are free again
+    this.recycleTableSlots(slots);
+    const serialized = this.serializeObject(data, undefined, slots);
+    for (const id of slots.used) this.ioSlotIds.set(id, slots);
+    this.ensureExternalTable(tableId).set(field, serialized);
+    this.wasmInstance.exports.invalidate_ext_table?.(tableId);
+  }
+
+  /**
+   * Clear all _io table contents (input, output, meta). The tables of input
+   * and meta are reused by the next setInput()/setMetadata()
+   */
+  clearIo() {
+    if (!this.wasmInstance) return;
+    const exports = this.wasmInstance.exports;
+
+    exports.clear_io_table?.();
+
+    // The tables of input and meta go back to their slots for the next request
+    for (const slots of this.ioSlots.values()) this.recycleTableSlots(slots);
+
+    // Also clear from JavaScript side
+    if (this.ioTableId !== null) {
+      const table = this.externalTables.get(this.ioTableId);
+      if (table) {
+        table.delete('input');
+        table.delete('output');
+        table.delete('meta');
+      }
+      exports.invalidate_ext_table?.(this.ioTableId);
+    }
+  }
+
+  /**
+   * Enable or disable legacy "Memory" name alias
+   * @param {boolean} enabled - Whether to allow accessing _home via "Memory" name
+   */
+  setMemoryAliasEnabled(enabled) {
+    this.memoryAliasEnabled = enabled;
+    if (enabled) {
+      log('warn', '[Deprecated] "Memory" table name alias enabled - consider migrating to "_home"');
+    }
+  }
+}
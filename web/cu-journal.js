@@ -0,0 +1,144 @@
+/**
+ * Cu Persistence Journal Records
+ *
+ * One journal record holds the external table changes made by one compute
+ * (or call/batch), as self-contained bytes that any append-only storage can
+ * hold: an IndexedDB object store in browsers, a log file in Node. Replaying
+ * the records in order over the last snapshot restores the tables.
+ *
+ * Layout (little-endian):
+ *   u32 nextTableId, u32 homeTableId (0 = none), u32 change count
+ * then per change
+ *   u32 tableId, u8 op (op & 1: integer key, op & 2: tombstone), key,
+ *   u32 value length and value bytes unless a tombstone
+ * where an integer key is an f64 and a string key is u32 length + UTF-8.
+ */
+
+const OP_INTEGER_KEY = 1;
+const OP_TOMBSTONE = 2;
+const RECORD_HEADER = 12;
+
+const textEncoder = new TextEncoder();
+const textDecoder = new TextDecoder();
+
+/**
+ * Encode one journal record
+ * @param {{nextTableId: number, homeTableId: number|null,
+ *   changes: Array<[number, string|number, Uint8Array|undefined]>}} record -
+ *   changes are [tableId, key, value], with value undefined for a delete
+ * @returns {Uint8Array}
+ */
+export function encodeJournalRecord({ nextTableId, homeTableId, changes }) {
+  const keys = new Array(changes.length);
+  let size = RECORD_HEADER;
+  for (let i = 0; i < changes.length; i++) {
+    const [, key, value] = changes[i];
+    keys[i] = typeof key === 'number' ? key : textEncoder.encode(key);
+    size += 5 + (typeof key === 'number' ? 8 : 4 + keys[i].length);
+    if (value !== undefined) size += 4 + value.byteLength;
+  }
+
+  const bytes = new Uint8Array(size);
+  const view = new DataView(bytes.buffer);
+  view.setUint32(0, nextTableId, true);
+  view.setUint32(4, homeTableId ?? 0, true);
+  view.setUint32(8, changes.length, true);
+  let offset = RECORD_HEADER;
+  for (let i = 0; i < changes.length; i++) {
+    const [tableId, , value] = changes[i];
+    const key = keys[i];
+    view.setUint32(offset, tableId, true);
+    view.setUint8(offset + 4, (typeof key === 'number' ? OP_INTEGER_KEY : 0) | (value === undefined ? OP_TOMBSTONE : 0));
+    offset += 5;
+    if (typeof key === 'number') {
+      view.setFloat64(offset, key, true);
+      offset += 8;
+    } else {
+      view.setUint32(offset, key.length, true);
+      bytes.set(key, offset + 4);
+      offset += 4 + key.length;
+    }
+    if (value !== undefined) {
+      view.setUint32(offset, value.byteLength, true);
+      bytes.set(value, offset + 4);
+      offset += 4 + value.byteLength;
+    }
+  }
+  return bytes;
+}
+
+/**
+ * Apply journal records, oldest first, to tables loaded from a snapshot
+ * @param {Map<number, Map>} tables - Snapshot tables; created as needed
+ * @param {Iterable<Uint8Array>} records
+ * @param {Object} metadata - Snapshot metadata; nextTableId and homeTableId
+ *   are updated from the records
+ * @param {function(): Map} [createTable] - Makes the entry Map of a table
+ *   not in `tables` yet
+ * @returns {{applied: number, tableIds: Set<number>}} Number of records
+ *   applied, and the tables they changed (which the snapshot does not have)
+ */
+export function replayJournal(tables, records, metadata, createTable = () => new Map()) {
+  const tableIds = new Set();
+  let applied = 0;
+  for (const bytes of records) {
+    const view = new DataView(bytes.buffer, bytes.byteOffset, bytes.byteLength);
+    if (bytes.byteLength < RECORD_HEADER) break;
+    metadata.nextTableId = Math.max(metadata.nextTableId ?? 1, view.getUint32(0, true));
+    const homeTableId = view.getUint32(4, true);
+    if (homeTableId !== 0) metadata.homeTableId = homeTableId;
+
+    const count = view.getUint32(8, true);
+    let offset = RECORD_HEADER;
+    for (let i = 0; i < count; i++) {
+      const tableId = view.getUint32(offset, true);
+      const op = view.getUint8(offset + 4);
+      offset += 5;
+      let key;
+      if (op & OP_INTEGER_KEY) {
+        key = view.getFloat64(offset, true);
+        offset += 8;
+      } else {
+        const len = view.getUint32(offset, true);
+        key = textDecoder.decode(bytes.subarray(offset + 4, offset + 4 + len));
+        offset += 4 + len;
+      }
+
+      tableIds.add(tableId);
+      let table = tables.get(tableId);
+      if (!table) {
+        table = createTable();
+        tables.set(tableId, table);
+      }
+      if (op & OP_TOMBSTONE) {
+        table.delete(key);
+      } else {
+        const len = view.getUint32(offset, true);
+        table.set(key, bytes.subarray(offset + 4, offset + 4 + len));
+        offset += 4 + len;
+      }
+    }
+    applied++;
+  }
+  return { applied, tableIds };
+}
+
+/**
+ * The journal changes of one table, for replaying the journal before the
+ * table itself is loaded: a delete is kept as an undefined value
+ */
+export class JournalChanges extends Map {
+  delete(key) {
+    this.set(key, undefined);
+    return true;
+  }
+
+  /** Apply the changes to a loaded table's entries */
+  applyTo(tableData) {
+    for (const [key, value] of this) {
+      if (value === undefined) tableData.delete(key);
+      else tableData.set(key, value);
+    }
+    return tableData;
+  }
+}
@@ -0,0 +1,71 @@
+/**
+ * Cu Logging and Metrics
+ *
+ * Level-gated logger and per-call metric hook shared by the host modules.
+ * Both are off the hot path when unused: callers check logEnabled() /
+ * metricsEnabled() before formatting a message or reading the clock.
+ */
+
+export const LogLevel = {
+  debug: 10,
+  info: 20,
+  warn: 30,
+  error: 40,
+  silent: 100,
+};
+
+let logger = console;
+let threshold = LogLevel.warn;
+let metricHandler = null;
+
+/**
+ * Route host log output
+ * @param {Object|null} target - Object with debug/info/warn/error methods
+ *   (console by default); null silences all output
+ * @param {Object} [options]
+ * @param {string} [options.level='warn'] - Minimum level that is emitted
+ */
+export function setLogger(target, options = {}) {
+  const { level = 'warn' } = options;
+  if (!(level in LogLevel)) {
+    throw new Error(`Unknown log level: ${level}`);
+  }
+  logger = target;
+  threshold = target ? LogLevel[level] : LogLevel.silent;
+}
+
+/**
+ * True when messages at `level` reach the logger
+ * @param {string} level
+ */
+export function logEnabled(level) {
+  return LogLevel[level] >= threshold;
+}
+
+export function log(level, ...args) {
+  if (LogLevel[level] < threshold) return;
+  const method = logger[level] ?? logger.log;
+  method.apply(logger, args);
+}
+
+/**
+ * Receive one record per instrumented host call
+ * @param {Function|null} handler - Called as handler({name, durationMs, ...});
+ *   null removes the hook
+ */
+export function onMetric(handler) {
+  metricHandler = handler;
+}
+
+export function metricsEnabled() {
+  return metricHandler !== null;
+}
+
+export function emitMetric(record) {
+  if (metricHandler === null) return;
+  try {
+    metricHandler(record);
+  } catch (error) {
+    log('error', 'metric handler error:', error);
+  }
+}
@@ -0,0 +1,92 @@
+/**
+ * Cu wasm64 Host Adapter
+ *
+ * The wasm64 build (CU_BUILD=wasm64, web/cu-64.wasm) passes pointers and
+ * sizes as i64, which JavaScript sees as BigInt. The rest of the host works
+ * in numbers, which hold offsets exactly up to 2^53, far past any memory an
+ * engine gives a module. So CuInstance puts this adapter between the two:
+ * BigInt arguments of imports arrive as numbers and their i64 results go
+ * back as BigInt, numbers passed to i64 parameters of exports become BigInt
+ * and i64 results come back as numbers (as BigInt only past 2^53). Which
+ * parameters are i64 is read from the "cu.abi64" custom section that
+ * scripts/wasm-abi.js adds at build time; a module without it is a wasm32
+ * build and is used as it is.
+ */
+
+export const ABI64_SECTION = 'cu.abi64';
+
+const abis = new WeakMap();
+const textDecoder = new TextDecoder();
+
+/**
+ * The i64 signatures a wasm64 module was built with
+ * @param {WebAssembly.Module} module
+ * @returns {{imports: Array, exports: Object}|null} null for wasm32 builds
+ */
+export function memory64Abi(module) {
+  if (!abis.has(module)) {
+    const [section] = WebAssembly.Module.customSections(module, ABI64_SECTION);
+    abis.set(module, section ? JSON.parse(textDecoder.decode(section)) : null);
+  }
+  return abis.get(module);
+}
+
+function toNumber(value) {
+  if (typeof value !== 'bigint') return value;
+  return value <= BigInt(Number.MAX_SAFE_INTEGER) && value >= BigInt(Number.MIN_SAFE_INTEGER) ? Number(value) : value;
+}
+
+function toBigInt(value) {
+  return typeof value === 'bigint' ? value : BigInt(Math.trunc(value ?? 0));
+}
+
+/**
+ * Imports for a wasm64 module, wrapping the host functions it calls with i64
+ * @param {Object} imports - As createImports() returns them
+ * @param {Object} abi - memory64Abi(module)
+ * @returns {Object}
+ */
+export function adaptImports(imports, abi) {
+  const adapted = {};
+  for (const [name, functions] of Object.entries(imports)) adapted[name] = { ...functions };
+  for (const { module, name, params, result } of abi.imports) {
+    const fn = adapted[module]?.[name];
+    if (typeof fn !== 'function') continue;
+    adapted[module][name] = (...args) => {
+      for (const i of params) args[i] = toNumber(args[i]);
+      const value = fn(...args);
+      return result ? toBigInt(value) : value;
+    };
+  }
+  return adapted;
+}
+
+/**
+ * Exports of a wasm64 instance that take and return numbers
+ * @param {Object} exports - instance.exports
+ * @param {Object} abi - memory64Abi(module)
+ * @returns {Object}
+ */
+export function adaptExports(exports, abi) {
+  const adapted = { ...exports };
+  for (const [name, { params, result }] of Object.entries(abi.exports)) {
+    const fn = exports[name];
+    if (typeof fn !== 'function') continue;
+    adapted[name] = (...args) => {
+      for (const i of params) args[i] = toBigInt(args[i]);
+      const value = fn(...args);
+      return result ? toNumber(value) : value;
+    };
+  }
+  return Object.freeze(adapted);
+}
+
+/**
+ * Grow a memory by `pages`, whichever index type it has
+ * @param {WebAssembly.Memory} memory
+ * @param {number} pages
+ * @param {boolean} memory64
+ */
+export function growMemory(memory, pages, memory64) {
+  return memory64 ? toNumber(memory.grow(BigInt(pages))) : memory.grow(pages);
+}
@@ -0,0 +1,143 @@
+/**
+ * Cu Unit Migration
+ *
+ * Moves a unit, meaning its _home table and every external table reachable
+ * from it, from one VM to another while the source keeps serving it. The
+ * source packs all of the unit's tables once (UnitExport.pack()) and
+ * carries on running requests. The target installs them under IDs of its
+ * own (UnitImport.apply()), rewriting only the table references in the
+ * values, as cu-bus.js does for messages. Each later pack() holds only the
+ * tables that are new or changed since the last one, found by their version
+ * (ExtTable.version). The cut-over holds the unit's requests, applies a
+ * last pack and routes the unit to the target. It waits only for that
+ * delta, not for the whole state.
+ *
+ * CuPool.migrate() moves a unit between its workers this way. A pack is
+ * plain data of numbers, strings and Uint8Arrays. postMessage() sends it
+ * as is, and encodeUnitPack() turns it into bytes for another machine.
+ *
+ * Only tables move. Lua globals belong to the VM, which pool units share,
+ * so keep a unit's state in _home. A whole VM moves with its heap through
+ * checkpoint() and checkpoint({ delta: true }) instead. Tables travel as
+ * their storage entries, as persistence saves them, so cache and columnar
+ * tables arrive as the same kind. Tables the unit no longer reaches stay
+ * behind on the source until collectTables().
+ */
+
+import { forEachTableRef, remapTableRefs } from './cu-values.js';
+import { ColumnTable } from './cu-ext-column.js';
+import { encode, decode } from './cu-msgpack.js';
+
+export const MIGRATION_VERSION = 1;
+
+// The tables reachable from `homeId`, by ID
+function reachableTables(instance, homeId) {
+  const found = new Map();
+  const pending = [homeId];
+  const visit = (id) => {
+    if (!found.has(id)) pending.push(id);
+  };
+  while (pending.length > 0) {
+    const id = pending.pop();
+    if (found.has(id)) continue;
+    const table = instance.externalTables.get(id);
+    if (!table) continue;
+    found.set(id, table);
+    // Column chunks are raw numbers, not values
+    if (table instanceof ColumnTable) continue;
+    for (const [, value] of table) {
+      if (value instanceof Uint8Array) forEachTableRef(value, visit);
+    }
+  }
+  return found;
+}
+
+/**
+ * The source side of a migration
+ */
+export class UnitExport {
+  /**
+   * @param {CuInstance} instance
+   * @param {number} homeId - The unit's _home table
+   */
+  constructor(instance, homeId) {
+    this.instance = instance;
+    this.homeId = homeId;
+    this.sent = new Map(); // table ID -> [table, version] as last packed
+  }
+
+  /**
+   * Pack the unit's tables that were not in an earlier pack or changed
+   * since. Call between requests.
+   * @returns {{version: number, home: number, tables: Array}} tables holds
+   *   [id, entries, raw] with entries as [key, value] pairs; raw marks
+   *   values that are not encoded Lua values (column chunks)
+   */
+  pack() {
+    const tables = [];
+    for (const [id, table] of reachableTables(this.instance, this.homeId)) {
+      const sent = this.sent.get(id);
+      if (sent && sent[0] === table && sent[1] === table.version) continue;
+      tables.push([id, Array.from(table), table instanceof ColumnTable]);
+      this.sent.set(id, [table, table.version]);
+    }
+    return { version: MIGRATION_VERSION, home: this.homeId, tables };
+  }
+}
+
+/**
+ * The target side of a migration
+ */
+export class UnitImport {
+  /** @param {CuInstance} instance */
+  constructor(instance) {
+    this.instance = instance;
+    this.ids = new Map(); // source table ID -> ours
+  }
+
+  /**
+   * Install a pack from UnitExport.pack(), replacing what earlier packs
+   * installed of the same tables. Call between requests.
+   * @returns {number} The unit's _home table ID here
+   */
+  apply(pack) {
+    if (pack.version !== MIGRATION_VERSION) {
+      throw new Error(`Unsupported unit pack version ${pack.version}`);
+    }
+    const { instance } = this;
+    const remap = (id) => {
+      let ours = this.ids.get(id);
+      if (ours === undefined) {
+        ours = instance.nextTableId++;
+        this.ids.set(id, ours);
+      }
+      return ours;
+    };
+    const exports = instance.wasmInstance?.exports;
+    for (const [id, entries, raw] of pack.tables) {
+      const tableId = remap(id);
+      instance.installTable(tableId, raw ? entries : entries.map(([key, value]) =>
+        [key, value instanceof Uint8Array ? remapTableRefs(value, remap) : value]));
+      // What the VM cached of an earlier copy is stale
+      exports?.invalidate_ext_table?.(tableId);
+    }
+    exports?.sync_external_table_counter?.(instance.nextTableId);
+    return remap(pack.home);
+  }
+}
+
+/**
+ * @param {object} pack - From UnitExport.pack()
+ * @returns {Uint8Array} The pack as MessagePack, to send to another machine
+ */
+export function encodeUnitPack(pack) {
+  return encode(pack);
+}
+
+/**
+ * @param {Uint8Array} bytes - From encodeUnitPack()
+ * @returns {object} The pack, for UnitImport.apply()
+ */
+export function decodeUnitPack(bytes) {
+  return decode(bytes);
+}
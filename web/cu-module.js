@@ -0,0 +1,86 @@
+/**
+ * Cu Module Loading
+ *
+ * Compiles cu.wasm off the main thread where the platform allows it, and
+ * keeps each compiled WebAssembly.Module for the lifetime of the page or
+ * process, so later load() calls, CuInstance objects and pools reuse it.
+ *
+ * Browsers compile with WebAssembly.compileStreaming as the bytes arrive;
+ * for modules fetched that way the browser also keeps its own compiled
+ * code cache for the URL, so a reload skips most of the compile. Node reads
+ * the file from disk (or fetches http(s) URLs) and compiles asynchronously.
+ */
+
+import { log, emitMetric, metricsEnabled } from './cu-log.js';
+
+const inNode = typeof process !== 'undefined' && process.versions?.node !== undefined;
+
+// Resolved path or URL -> Promise<WebAssembly.Module>
+const modules = new Map();
+
+async function resolveKey(wasmPath) {
+  if (inNode && !/^(https?|file):/.test(String(wasmPath))) {
+    const { resolve } = await import('node:path');
+    return resolve(String(wasmPath));
+  }
+  const base = globalThis.location?.href;
+  return base ? new URL(wasmPath, base).href : String(wasmPath);
+}
+
+async function compileFrom(key) {
+  if (inNode && !/^https?:/.test(key)) {
+    const { readFile } = await import('node:fs/promises');
+    return WebAssembly.compile(await readFile(key.startsWith('file:') ? new URL(key) : key));
+  }
+
+  const response = await fetch(key);
+  if (!response.ok) {
+    throw new Error(`Failed to fetch WASM: ${response.statusText}`);
+  }
+  // compileStreaming needs the wasm MIME type; other servers get the
+  // buffered (still asynchronous) compile
+  const type = response.headers.get('Content-Type') ?? '';
+  if (typeof WebAssembly.compileStreaming === 'function' && type.startsWith('application/wasm')) {
+    return WebAssembly.compileStreaming(response);
+  }
+  log('debug', `${key} is served as "${type}", not application/wasm; compiling without streaming`);
+  return WebAssembly.compile(await response.arrayBuffer());
+}
+
+/**
+ * Compile a Cu module, or return the one already compiled from this path
+ * @param {string|URL} wasmPath - URL to fetch, or in Node a file path
+ * @param {Object} [options]
+ * @param {boolean} [options.cache=true] - Reuse (and keep) the compiled module
+ * @returns {Promise<WebAssembly.Module>}
+ */
+export async function compileModule(wasmPath, { cache = true } = {}) {
+  const key = await resolveKey(wasmPath);
+  const cached = cache ? modules.get(key) : undefined;
+  if (cached) return cached;
+
+  const start = metricsEnabled() ? performance.now() : 0;
+  const compiling = compileFrom(key);
+  if (cache) {
+    modules.set(key, compiling);
+    // A failed fetch or compile is not remembered
+    compiling.catch(() => modules.delete(key));
+  }
+  const module = await compiling;
+  if (start !== 0) {
+    emitMetric({ name: 'compileModule', durationMs: performance.now() - start, path: key });
+  }
+  return module;
+}
+
+/**
+ * Forget compiled modules, e.g. after cu.wasm was rebuilt
+ * @param {string|URL} [wasmPath] - Only this module (default: all)
+ */
+export async function clearModuleCache(wasmPath) {
+  if (wasmPath === undefined) {
+    modules.clear();
+  } else {
+    modules.delete(await resolveKey(wasmPath));
+  }
+}
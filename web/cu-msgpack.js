@@ -0,0 +1,342 @@
+/**
+ * Cu MessagePack
+ *
+ * The host half of Lua's msgpack module (src/lua/lmsgpack.c). A script
+ * stores `msgpack.pack(value)` in _io and the host reads one Uint8Array to
+ * decode() here. encode() does the reverse: pass its result to setInput()
+ * and Lua reads it with msgpack.decode(_io.input). Either way a structured
+ * payload crosses as a single copy rather than an external-table entry per
+ * field.
+ *
+ * Usage:
+ *   import { encode, decode } from './cu-msgpack.js';
+ *   cu.setInput(encode({ items: [1, 2, 3] }));
+ *   await cu.compute('local m = require("msgpack"); _io.output = m.pack(m.decode(_io.input))');
+ *   decode(cu.getOutput());
+ *
+ * Maps decode to plain objects, bin to Uint8Array, and 64-bit integers
+ * outside the safe range to BigInt. Ext types are rejected.
+ */
+
+const textEncoder = new TextEncoder();
+const textDecoder = new TextDecoder();
+
+// Strings shorter than this are decoded by hand, which beats TextDecoder's
+// call overhead
+const SHORT_STRING = 16;
+const MAX_DEPTH = 200;
+
+/**
+ * Decode one MessagePack value
+ * @param {Uint8Array|ArrayBuffer} bytes
+ * @returns {*}
+ */
+export function decode(bytes) {
+  const buffer = bytes instanceof Uint8Array ? bytes : new Uint8Array(bytes);
+  const reader = new Reader(buffer);
+  const value = reader.value(0);
+  if (reader.offset !== buffer.length) throw reader.error('trailing bytes');
+  return value;
+}
+
+class Reader {
+  constructor(buffer) {
+    this.buffer = buffer;
+    this.view = new DataView(buffer.buffer, buffer.byteOffset, buffer.byteLength);
+    this.offset = 0;
+  }
+
+  error(what) {
+    return new Error(`msgpack decode: ${what} at offset ${this.offset}`);
+  }
+
+  need(n) {
+    if (this.offset + n > this.buffer.length) throw this.error('truncated input');
+  }
+
+  uint(size) {
+    this.need(size);
+    const at = this.offset;
+    this.offset += size;
+    switch (size) {
+      case 1: return this.view.getUint8(at);
+      case 2: return this.view.getUint16(at);
+      case 4: return this.view.getUint32(at);
+      default: {
+        const value = this.view.getBigUint64(at);
+        return value <= BigInt(Number.MAX_SAFE_INTEGER) ? Number(value) : value;
+      }
+    }
+  }
+
+  int(size) {
+    this.need(size);
+    const at = this.offset;
+    this.offset += size;
+    switch (size) {
+      case 1: return this.view.getInt8(at);
+      case 2: return this.view.getInt16(at);
+      case 4: return this.view.getInt32(at);
+      default: {
+        const value = this.view.getBigInt64(at);
+        const number = Number(value);
+        return Number.isSafeInteger(number) ? number : value;
+      }
+    }
+  }
+
+  string(length) {
+    this.need(length);
+    const start = this.offset;
+    this.offset += length;
+    if (length < SHORT_STRING) {
+      let text = '';
+      for (let i = start; i < start + length; i++) {
+        if (this.buffer[i] >= 0x80) return textDecoder.decode(this.buffer.subarray(start, start + length));
+        text += String.fromCharCode(this.buffer[i]);
+      }
+      return text;
+    }
+    return textDecoder.decode(this.buffer.subarray(start, start + length));
+  }
+
+  bin(length) {
+    this.need(length);
+    const start = this.offset;
+    this.offset += length;
+    return this.buffer.slice(start, start + length);
+  }
+
+  array(length, depth) {
+    if (depth >= MAX_DEPTH) throw this.error('nesting too deep');
+    const array = new Array(length);
+    for (let i = 0; i < length; i++) array[i] = this.value(depth + 1);
+    return array;
+  }
+
+  map(length, depth) {
+    if (depth >= MAX_DEPTH) throw this.error('nesting too deep');
+    const object = {};
+    for (let i = 0; i < length; i++) {
+      const key = this.value(depth + 1);
+      object[key] = this.value(depth + 1);
+    }
+    return object;
+  }
+
+  value(depth) {
+    this.need(1);
+    const type = this.buffer[this.offset++];
+    if (type < 0x80) return type;
+    if (type >= 0xe0) return type - 0x100;
+    if (type <= 0x8f) return this.map(type & 0x0f, depth);
+    if (type <= 0x9f) return this.array(type & 0x0f, depth);
+    if (type <= 0xbf) return this.string(type & 0x1f);
+
+    switch (type) {
+      case 0xc0: return null;
+      case 0xc2: return false;
+      case 0xc3: return true;
+      case 0xc4: return this.bin(this.uint(1));
+      case 0xc5: return this.bin(this.uint(2));
+      case 0xc6: return this.bin(this.uint(4));
+      case 0xca: this.need(4); this.offset += 4; return this.view.getFloat32(this.offset - 4);
+      case 0xcb: this.need(8); this.offset += 8; return this.view.getFloat64(this.offset - 8);
+      case 0xcc: return this.uint(1);
+      case 0xcd: return this.uint(2);
+      case 0xce: return this.uint(4);
+      case 0xcf: return this.uint(8);
+      case 0xd0: return this.int(1);
+      case 0xd1: return this.int(2);
+      case 0xd2: return this.int(4);
+      case 0xd3: return this.int(8);
+      case 0xd9: return this.string(this.uint(1));
+      case 0xda: return this.string(this.uint(2));
+      case 0xdb: return this.string(this.uint(4));
+      case 0xdc: return this.array(this.uint(2), depth);
+      case 0xdd: return this.array(this.uint(4), depth);
+      case 0xde: return this.map(this.uint(2), depth);
+      case 0xdf: return this.map(this.uint(4), depth);
+      default:
+        this.offset--;
+        throw this.error('unsupported type (ext or reserved)');
+    }
+  }
+}
+
+/**
+ * Encode a value as MessagePack
+ *
+ * null and undefined become nil, integral numbers the smallest integer
+ * format, other numbers float 64, BigInt int 64 or uint 64, Uint8Array bin,
+ * arrays arrays and other objects maps of their own enumerable keys.
+ * @param {*} value
+ * @returns {Uint8Array}
+ */
+export function encode(value) {
+  const writer = new Writer();
+  writer.value(value, 0);
+  return writer.buffer.slice(0, writer.offset);
+}
+
+class Writer {
+  constructor() {
+    this.buffer = new Uint8Array(256);
+    this.view = new DataView(this.buffer.buffer);
+    this.offset = 0;
+  }
+
+  reserve(n) {
+    if (this.offset + n <= this.buffer.length) return;
+    let size = this.buffer.length * 2;
+    while (size < this.offset + n) size *= 2;
+    const buffer = new Uint8Array(size);
+    buffer.set(this.buffer.subarray(0, this.offset));
+    this.buffer = buffer;
+    this.view = new DataView(buffer.buffer);
+  }
+
+  byte(type) {
+    this.reserve(1);
+    this.buffer[this.offset++] = type;
+  }
+
+  // A type byte and a big-endian unsigned length or value of 1, 2 or 4 bytes
+  head(type, value, size) {
+    this.reserve(1 + size);
+    this.buffer[this.offset++] = type;
+    if (size === 1) this.view.setUint8(this.offset, value);
+    else if (size === 2) this.view.setUint16(this.offset, value);
+    else if (size === 4) this.view.setUint32(this.offset, value);
+    this.offset += size;
+  }
+
+  sized(value, fix, fixLimit, types) {
+    if (value < fixLimit) this.byte(fix | value);
+    else if (types[0] !== undefined && value <= 0xff) this.head(types[0], value, 1);
+    else if (value <= 0xffff) this.head(types[1], value, 2);
+    else this.head(types[2], value, 4);
+  }
+
+  integer(value) {
+    if (value >= 0) {
+      if (value < 0x80) this.byte(value);
+      else if (value <= 0xff) this.head(0xcc, value, 1);
+      else if (value <= 0xffff) this.head(0xcd, value, 2);
+      else if (value <= 0xffffffff) this.head(0xce, value, 4);
+      else this.big(BigInt(value));
+    } else if (value >= -32) {
+      this.byte(0x100 + value);
+    } else if (value >= -0x80) {
+      this.reserve(2);
+      this.buffer[this.offset++] = 0xd0;
+      this.view.setInt8(this.offset++, value);
+    } else if (value >= -0x8000) {
+      this.reserve(3);
+      this.buffer[this.offset++] = 0xd1;
+      this.view.setInt16(this.offset, value);
+      this.offset += 2;
+    } else if (value >= -0x80000000) {
+      this.reserve(5);
+      this.buffer[this.offset++] = 0xd2;
+      this.view.setInt32(this.offset, value);
+      this.offset += 4;
+    } else {
+      this.big(BigInt(value));
+    }
+  }
+
+  big(value) {
+    if (value < -(2n ** 63n) || value >= 2n ** 64n) throw new RangeError('msgpack encode: BigInt out of 64-bit range');
+    this.reserve(9);
+    if (value >= 0n) {
+      this.buffer[this.offset++] = 0xcf;
+      this.view.setBigUint64(this.offset, value);
+    } else {
+      this.buffer[this.offset++] = 0xd3;
+      this.view.setBigInt64(this.offset, value);
+    }
+    this.offset += 8;
+  }
+
+  string(text) {
+    // Short ASCII strings, most keys among them, are copied by hand
+    if (text.length < 32) {
+      this.reserve(1 + text.length);
+      const start = this.offset + 1;
+      let i = 0;
+      for (; i < text.length; i++) {
+        const unit = text.charCodeAt(i);
+        if (unit >= 0x80) break;
+        this.buffer[start + i] = unit;
+      }
+      if (i === text.length) {
+        this.buffer[this.offset] = 0xa0 | i;
+        this.offset = start + i;
+        return;
+      }
+    }
+    // UTF-8 takes at most 3 bytes per UTF-16 unit; write, then the header
+    const max = text.length * 3;
+    const headerSize = max < 32 ? 1 : max <= 0xff ? 2 : max <= 0xffff ? 3 : 5;
+    this.reserve(headerSize + max);
+    const start = this.offset + headerSize;
+    const { written } = textEncoder.encodeInto(text, this.buffer.subarray(start));
+    // Lay the header out for the real length, moving the bytes if it is shorter
+    const size = written < 32 ? 1 : written <= 0xff ? 2 : written <= 0xffff ? 3 : 5;
+    if (size !== headerSize) this.buffer.copyWithin(this.offset + size, start, start + written);
+    this.sized(written, 0xa0, 32, [0xd9, 0xda, 0xdb]);
+    this.offset += written;
+  }
+
+  value(value, depth) {
+    if (depth > MAX_DEPTH) throw new RangeError('msgpack encode: nesting too deep (or a cycle)');
+    switch (typeof value) {
+      case 'undefined':
+        this.byte(0xc0);
+        return;
+      case 'boolean':
+        this.byte(value ? 0xc3 : 0xc2);
+        return;
+      case 'number':
+        if (Number.isSafeInteger(value)) {
+          this.integer(value);
+        } else {
+          this.reserve(9);
+          this.buffer[this.offset++] = 0xcb;
+          this.view.setFloat64(this.offset, value);
+          this.offset += 8;
+        }
+        return;
+      case 'bigint':
+        this.big(value);
+        return;
+      case 'string':
+        this.string(value);
+        return;
+      case 'object':
+        break;
+      default:
+        throw new TypeError(`msgpack encode: cannot encode ${typeof value}`);
+    }
+
+    if (value === null) {
+      this.byte(0xc0);
+    } else if (value instanceof Uint8Array) {
+      this.sized(value.length, 0, 0, [0xc4, 0xc5, 0xc6]);
+      this.reserve(value.length);
+      this.buffer.set(value, this.offset);
+      this.offset += value.length;
+    } else if (Array.isArray(value)) {
+      this.sized(value.length, 0x90, 16, [undefined, 0xdc, 0xdd]);
+      for (const item of value) this.value(item, depth + 1);
+    } else {
+      const keys = Object.keys(value);
+      this.sized(keys.length, 0x80, 16, [undefined, 0xde, 0xdf]);
+      for (const key of keys) {
+        this.string(key);
+        this.value(value[key], depth + 1);
+      }
+    }
+  }
+}
@@ -0,0 +1,45 @@
+/**
+ * Cu for Node
+ *
+ * The browser host (CuInstance) with what a server needs in place of the
+ * browser's: cu.wasm read from disk next to this file, and external tables
+ * kept in a directory (FilePersistence) instead of IndexedDB. Any other
+ * storage with the LuaPersistence interface can be passed as `persistence`.
+ *
+ * Usage:
+ *   import { createNodeInstance } from './cu-node.js';
+ *   const unit = await createNodeInstance({ dir: './state/unit-1' });
+ *   unit.init();
+ *   unit.enableJournal();
+ *   unit.compute('_home.count = (_home.count or 0) + 1');
+ */
+
+import { fileURLToPath } from 'node:url';
+
+import { CuInstance } from './cu-instance.js';
+import { FilePersistence } from './cu-file-persistence.js';
+
+export { CuInstance, FilePersistence };
+
+const DEFAULT_WASM_PATH = fileURLToPath(new URL('./cu.wasm', import.meta.url));
+
+/**
+ * Create and load an instance persisting to `dir`
+ * @param {Object} options - CuInstance.create() options, plus:
+ * @param {string} [options.dir] - Directory for FilePersistence; required
+ *   unless options.persistence is given
+ * @param {boolean} [options.sync=true] - fsync journal records and snapshots
+ * @param {boolean} [options.compress=false] - Deflate snapshot tables
+ * @returns {Promise<CuInstance>}
+ */
+export async function createNodeInstance({ dir, sync = true, compress = false, ...options } = {}) {
+  if (!options.persistence && !dir) {
+    throw new Error('createNodeInstance needs a dir or a persistence');
+  }
+  const persistence = options.persistence ?? new FilePersistence(dir, { sync, compress });
+  return CuInstance.create({
+    wasmPath: DEFAULT_WASM_PATH,
+    ...options,
+    persistence,
+  });
+}
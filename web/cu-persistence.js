@@ -2,13 +2,101 @@
  * Persistence layer for Lua external tables using IndexedDB
  */
 
+import { log, logEnabled } from './cu-log.js';
+import { normalizeKey } from './cu-ext-table.js';
+import { replayJournal, JournalChanges } from './cu-journal.js';
+import { deflate, inflate } from './cu-compression.js';
+
 const DB_NAME = 'LuaPersistentDB';
-const DB_VERSION = 1;
+const DB_VERSION = 2;
 const STORE_NAME = 'externalTables';
+// Journal records appended since the last snapshot (see cu-journal.js)
+const JOURNAL_STORE = 'journal';
+
+/**
+ * Pack one table into a single record: the entry keys, and all values
+ * concatenated into one ArrayBuffer with an offset index. IndexedDB clones
+ * one buffer per table instead of an object per entry.
+ * @param {number} tableId
+ * @param {Map} tableData - Map of key to serialized value bytes
+ */
+function packTable(tableId, tableData) {
+  const keys = new Array(tableData.size);
+  const offsets = new Uint32Array(tableData.size + 1);
+  let i = 0;
+  let total = 0;
+  for (const [key, value] of tableData) {
+    keys[i] = key;
+    total += value.byteLength;
+    offsets[++i] = total;
+  }
+
+  const bytes = new Uint8Array(total);
+  i = 0;
+  for (const value of tableData.values()) {
+    bytes.set(value, offsets[i++]);
+  }
+  return { id: tableId, keys, offsets, bytes: bytes.buffer };
+}
+
+/**
+ * Restore a packed table. Values are views into the record's buffer
+ * @returns {Map}
+ */
+function unpackTable(record) {
+  const { keys, offsets, bytes } = record;
+  const tableData = new Map();
+  for (let i = 0; i < keys.length; i++) {
+    tableData.set(keys[i], new Uint8Array(bytes, offsets[i], offsets[i + 1] - offsets[i]));
+  }
+  return tableData;
+}
+
+/**
+ * Restore a packed table, inflating a compressed one first
+ * @param {Object} record
+ * @param {Function} [inflateBytes] - inflate(), or RestoreWorkers' inflate
+ * @returns {Promise<Map>}
+ */
+async function restoreTable(record, inflateBytes = inflate) {
+  if (!record.bytes) return unpackLegacyTable(record);
+  if (!record.deflated) return unpackTable(record);
+  const bytes = await inflateBytes(new Uint8Array(record.bytes));
+  return unpackTable({ ...record, bytes: bytes.buffer });
+}
 
-class LuaPersistence {
-  constructor() {
+/**
+ * Restore a table saved by earlier versions as an object of
+ * {_type: 'binary', data} entries
+ * @returns {Map}
+ */
+function unpackLegacyTable(record) {
+  const tableData = new Map();
+  for (const [key, value] of Object.entries(record.data || {})) {
+    if (value && typeof value === 'object' && value._type === 'binary') {
+      tableData.set(normalizeKey(key), value.data instanceof Uint8Array ? value.data : new Uint8Array(value.data));
+    } else {
+      tableData.set(normalizeKey(key), value);
+    }
+  }
+  return tableData;
+}
+
+export class LuaPersistence {
+  /**
+   * @param {string} [namespace] - Store under a database of its own, apart
+   *   from the default one and from other namespaces
+   * @param {Object} [options]
+   * @param {boolean} [options.compress=false] - Deflate each table's packed
+   *   bytes (cu-compression.js); compressed and plain tables load alike
+   * @param {RestoreWorkers} [options.workers] - Inflate compressed tables on
+   *   these worker threads (cu-restore-workers.js)
+   */
+  constructor(namespace = null, { compress = false, workers = null } = {}) {
+    this.dbName = namespace ? `${DB_NAME}:${namespace}` : DB_NAME;
     this.db = null;
+    this.compress = compress;
+    this.inflate = workers ? (bytes) => workers.inflate(bytes) : inflate;
   }
 
   /**
@@ -16,7 +104,7 @@ class LuaPersistence {
    */
   async init() {
     return new Promise((resolve, reject) => {
-      const request = indexedDB.open(DB_NAME, DB_VERSION);
+      const request = indexedDB.open(this.dbName, DB_VERSION);
 
       request.onerror = () => reject(new Error('Failed to open IndexedDB'));
 
@@ -30,121 +118,199 @@ class LuaPersistence {
         if (!db.objectStoreNames.contains(STORE_NAME)) {
           db.createObjectStore(STORE_NAME, { keyPath: 'id' });
         }
+        if (!db.objectStoreNames.contains(JOURNAL_STORE)) {
+          db.createObjectStore(JOURNAL_STORE, { autoIncrement: true });
+        }
       };
     });
   }
 
   /**
-   * Save all external tables to IndexedDB
+   * Save all external tables to IndexedDB, replacing whatever was stored
    * @param {Map} externalTables - Map of table ID to Map of key-value pairs
    * @param {Object} metadata - Additional metadata (like variable mappings)
    */
   async saveTables(externalTables, metadata = {}) {
+    await this.writeTables(externalTables, [], {
+      ...metadata,
+      tableCount: externalTables.size,
+      tableIds: Array.from(externalTables.keys())
+    }, true);
+    if (logEnabled('debug')) {
+      log('debug', `Saved ${externalTables.size} tables to IndexedDB`);
+    }
+  }
+
+  /**
+   * Write only the given tables and delete removed ones, leaving every
+   * other stored table as it is
+   * @param {Map} changedTables - Map of table ID to table, for tables to (re)write
+   * @param {Array<number>} removedIds - IDs of stored tables to delete
+   * @param {Object} metadata - Metadata record; should list all tableIds
+   */
+  async saveChanges(changedTables, removedIds, metadata = {}) {
+    await this.writeTables(changedTables, removedIds, metadata, false);
+    if (logEnabled('debug')) {
+      log('debug', `Saved ${changedTables.size} tables and removed ${removedIds.length} from IndexedDB`);
+    }
+  }
+
+  /**
+   * Apply puts and deletes in one readwrite transaction. The result is a
+   * snapshot of the whole state, so the journal is dropped with it
+   * @returns {Promise<void>} Resolves when the transaction commits
+   */
+  async writeTables(tables, removedIds, metadata, replace) {
     if (!this.db) await this.init();
 
-    const transaction = this.db.transaction([STORE_NAME], 'readwrite');
+    // Packed (and compressed) before the transaction, which would commit
+    // while waiting on anything but its own requests
+    const records = [];
+    for (const [tableId, tableData] of tables) {
+      const record = packTable(tableId, tableData);
+      if (this.compress && record.bytes.byteLength > 0) {
+        record.bytes = (await deflate(new Uint8Array(record.bytes))).slice().buffer;
+        record.deflated = true;
+      }
+      records.push(record);
+    }
+
+    const transaction = this.db.transaction([STORE_NAME, JOURNAL_STORE], 'readwrite');
     const store = transaction.objectStore(STORE_NAME);
+    const done = new Promise((resolve, reject) => {
+      transaction.oncomplete = () => resolve();
+      transaction.onerror = () => reject(transaction.error);
+      transaction.onabort = () => reject(transaction.error || new Error('Transaction aborted'));
+    });
+
+    // Requests run in the order they are made, so the clear goes first
+    if (replace) store.clear();
+    transaction.objectStore(JOURNAL_STORE).clear();
+    for (const tableId of removedIds) {
+      store.delete(tableId);
+    }
+    for (const record of records) {
+      store.put(record);
+    }
+    store.put({ id: '__metadata__', data: metadata });
 
+    await done;
+  }
+
+  /**
+   * Append one journal record. Transactions on the journal commit in the
+   * order they are created, so records keep the order they were made in
+   * @param {Uint8Array} record - From encodeJournalRecord
+   * @returns {Promise<void>} Resolves when the record is durable
+   */
+  async appendJournal(record) {
+    if (!this.db) await this.init();
+
+    const transaction = this.db.transaction([JOURNAL_STORE], 'readwrite', { durability: 'strict' });
+    transaction.objectStore(JOURNAL_STORE).add(record);
     await new Promise((resolve, reject) => {
-      const clearRequest = store.clear();
-      clearRequest.onsuccess = resolve;
-      clearRequest.onerror = reject;
+      transaction.oncomplete = () => resolve();
+      transaction.onerror = () => reject(transaction.error);
+      transaction.onabort = () => reject(transaction.error || new Error('Transaction aborted'));
     });
+  }
 
-    const promises = [];
-    for (const [tableId, tableData] of externalTables) {
-      // Convert Map entries to object, preserving Uint8Array values
-      const dataObj = {};
-      for (const [key, value] of tableData) {
-        if (value instanceof Uint8Array) {
-          // Store binary data with a type marker
-          dataObj[key] = {
-            _type: 'binary',
-            data: Array.from(value) // Convert to array for JSON serialization
-          };
-        } else {
-          dataObj[key] = value;
-        }
-      }
-      
-      const serializedData = {
-        id: tableId,
-        data: dataObj
-      };
+  /**
+   * Load all external tables from IndexedDB
+   * @returns {{tables: Map, metadata: Object, journalTableIds: Set<number>}}
+   *   Persisted tables with the journal replayed over them, metadata, and
+   *   the tables the journal changed since the snapshot
+   */
+  async loadTables() {
+    if (!this.db) await this.init();
 
-      promises.push(new Promise((resolve, reject) => {
-        const request = store.put(serializedData);
-        request.onsuccess = resolve;
-        request.onerror = reject;
-      }));
-    }
+    const transaction = this.db.transaction([STORE_NAME, JOURNAL_STORE], 'readonly');
+    const getAll = (storeName) => new Promise((resolve, reject) => {
+      const request = transaction.objectStore(storeName).getAll();
+      request.onsuccess = (event) => resolve(event.target.result || []);
+      request.onerror = reject;
+    });
+    const [results, journal] = await Promise.all([getAll(STORE_NAME), getAll(JOURNAL_STORE)]);
+
+    const externalTables = new Map();
+    let metadata = {};
 
-    const metadataRecord = {
-      id: '__metadata__',
-      data: {
-        ...metadata,
-        tableCount: externalTables.size,
-        tableIds: Array.from(externalTables.keys())
+    // Compressed tables inflate concurrently (on RestoreWorkers if given)
+    const restoring = [];
+    for (const record of results) {
+      if (record.id === '__metadata__') {
+        metadata = record.data || {};
+        continue;
       }
-    };
 
-    promises.push(new Promise((resolve, reject) => {
-      const request = store.put(metadataRecord);
-      request.onsuccess = resolve;
-      request.onerror = reject;
-    }));
+      const tableId = typeof record.id === 'number' ? record.id : Number(record.id);
+      restoring.push(restoreTable(record, this.inflate).then((tableData) => [tableId, tableData]));
+    }
+    for (const [tableId, tableData] of await Promise.all(restoring)) {
+      externalTables.set(tableId, tableData);
+    }
+
+    // Changes made after the snapshot; the journal store keeps them in order
+    const { applied, tableIds } = replayJournal(externalTables, journal, metadata);
 
-    await Promise.all(promises);
-    console.log(`Saved ${externalTables.size} tables to IndexedDB`);
+    if (logEnabled('debug')) {
+      log('debug', `Loaded ${externalTables.size} tables and ${applied} journal records from IndexedDB`);
+    }
+    return { tables: externalTables, metadata, journalTableIds: tableIds };
   }
 
   /**
-   * Load all external tables from IndexedDB
-   * @returns {{tables: Map, metadata: Object}} Persisted tables and metadata
+   * Load what a lazy restore needs up front: the metadata, the IDs of the
+   * stored tables and the journal, but no table records
+   * @returns {{metadata: Object, tableIds: Array<number>, journal: Map<number, JournalChanges>}}
+   *   journal holds each table's changes since the snapshot, for loadTable()
    */
-  async loadTables() {
+  async loadIndex() {
     if (!this.db) await this.init();
 
-    const transaction = this.db.transaction([STORE_NAME], 'readonly');
+    const transaction = this.db.transaction([STORE_NAME, JOURNAL_STORE], 'readonly');
     const store = transaction.objectStore(STORE_NAME);
+    const read = (request) => new Promise((resolve, reject) => {
+      request.onsuccess = (event) => resolve(event.target.result);
+      request.onerror = reject;
+    });
+    const [keys, metadataRecord, records] = await Promise.all([
+      read(store.getAllKeys()),
+      read(store.get('__metadata__')),
+      read(transaction.objectStore(JOURNAL_STORE).getAll())
+    ]);
 
-    return new Promise((resolve, reject) => {
-      const request = store.getAll();
+    const metadata = metadataRecord?.data || {};
+    const journal = new Map();
+    replayJournal(journal, records || [], metadata, () => new JournalChanges());
 
-      request.onsuccess = (event) => {
-        const results = event.target.result || [];
-        const externalTables = new Map();
-        let metadata = {};
-
-        for (const record of results) {
-          if (record.id === '__metadata__') {
-            metadata = record.data || {};
-            continue;
-          }
-
-          const tableId = typeof record.id === 'number' ? record.id : Number(record.id);
-          const entriesObject = record.data || {};
-          const tableData = new Map();
-          
-          // Restore entries, converting binary data back to Uint8Array
-          for (const [key, value] of Object.entries(entriesObject)) {
-            if (value && typeof value === 'object' && value._type === 'binary' && Array.isArray(value.data)) {
-              // Restore binary data
-              tableData.set(key, new Uint8Array(value.data));
-            } else {
-              tableData.set(key, value);
-            }
-          }
-          
-          externalTables.set(tableId, tableData);
-        }
+    const tableIds = new Set();
+    for (const key of keys || []) {
+      if (key !== '__metadata__') tableIds.add(Number(key));
+    }
+    for (const tableId of journal.keys()) tableIds.add(tableId);
+    return { metadata, tableIds: Array.from(tableIds), journal };
+  }
 
-        console.log(`Loaded ${externalTables.size} tables from IndexedDB`);
-        resolve({ tables: externalTables, metadata });
-      };
+  /**
+   * Load one table
+   * @param {number} tableId
+   * @param {JournalChanges} [changes] - From loadIndex(), applied on top
+   * @returns {Promise<Map>} The table's entries (empty if it is not stored)
+   */
+  async loadTable(tableId, changes) {
+    if (!this.db) await this.init();
 
+    const transaction = this.db.transaction([STORE_NAME], 'readonly');
+    const record = await new Promise((resolve, reject) => {
+      const request = transaction.objectStore(STORE_NAME).get(tableId);
+      request.onsuccess = (event) => resolve(event.target.result);
       request.onerror = reject;
     });
+
+    let tableData = new Map();
+    if (record) tableData = await restoreTable(record, this.inflate);
+    return changes ? changes.applyTo(tableData) : tableData;
   }
 
   /**
@@ -153,13 +319,13 @@ class LuaPersistence {
   async clearAll() {
     if (!this.db) await this.init();
 
-    const transaction = this.db.transaction([STORE_NAME], 'readwrite');
-    const store = transaction.objectStore(STORE_NAME);
+    const transaction = this.db.transaction([STORE_NAME, JOURNAL_STORE], 'readwrite');
+    transaction.objectStore(STORE_NAME).clear();
+    transaction.objectStore(JOURNAL_STORE).clear();
 
     return new Promise((resolve, reject) => {
-      const request = store.clear();
-      request.onsuccess = resolve;
-      request.onerror = reject;
+      transaction.oncomplete = () => resolve();
+      transaction.onerror = () => reject(transaction.error);
     });
   }
 }
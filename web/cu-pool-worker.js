@@ -0,0 +1,265 @@
+/**
+ * Cu Pool Worker
+ *
+ * Runs one Cu VM for a CuPool (see cu-pool.js) or a CuWorker (cu-worker.js),
+ * in a Web Worker or a Node worker_thread. Every unit routed here gets its
+ * own _home table, attached before each of its requests; the main thread
+ * keeps requests for one unit on one worker, so its _home always lives here.
+ * Requests without a unit use the VM's own _home.
+ *
+ * `interrupt` is an optional SharedArrayBuffer holding one Int32: the id of
+ * a request to stop. The VM polls it while that request runs.
+ *
+ * `snapshot` is an optional buffer from CuInstance.shareState(). Its tables
+ * are read in place (attachSharedSnapshot), its _home is the VM's own, and
+ * each unit's _home starts out as an overlay of it. Writes stay on this
+ * worker.
+ *
+ * Messages in:  { type: 'init', module, options, interrupt?, snapshot? }
+ *               { id, type: 'compute', unit?, code }
+ *               { id, type: 'call', unit?, name, args }
+ *               { id, type: 'compile', code }
+ *               { id, type: 'define', key, chunk }
+ *               { id, type: 'map', key, items }
+ *               { id, type: 'ring', requests, responses }
+ *               { id, type: 'export', unit, first }
+ *               { id, type: 'import', unit, pack, first }
+ *               { id, type: 'drop', unit }
+ * Messages out: { id, ok: true, status, output, result, chunk?, values?, pack? }
+ *               { id, ok: false, status?, code?, error }
+ *
+ * After 'ring' is answered, compute and call requests arrive as msgpack
+ * frames in the `requests` CuRing and their replies leave through
+ * `responses` (see cu-ring.js); the worker sleeps on the ring between
+ * requests and no longer reads messages. Closing the rings ends it.
+ *
+ * 'compile', 'define' and 'map' serve CuPool.parallelMap: the chunk of a
+ * function is compiled on one worker, loaded once on each under `key`
+ * (a null chunk drops it), and every 'map' applies it to a batch of items.
+ *
+ * 'export', 'import' and 'drop' serve CuPool.migrate (see cu-migrate.js):
+ * each 'export' of a unit packs its tables that changed since the last
+ * (all of them when `first`, a null pack for a unit never seen here),
+ * 'import' installs a pack as the unit's (`first` starts a new migration),
+ * and 'drop' forgets a unit that moved away.
+ */
+
+import {
+  load, init, compute, call, attachHomeTable, setInterruptCheck, getLastErrorCode,
+  getBufferPtr, getResultPtr, readBuffer, readResult, ErrorCodes,
+  getDefaultInstance, setInput, getOutput,
+} from './cu-api.js';
+import { CuRing } from './cu-ring.js';
+import { encode, decode } from './cu-msgpack.js';
+import { encodeBytes, encodeValue } from './cu-values.js';
+import { UnitExport, UnitImport } from './cu-migrate.js';
+
+const inBrowser = typeof WorkerGlobalScope !== 'undefined';
+const port = inBrowser ? self : (await import('node:worker_threads')).parentPort;
+
+// Unit ID -> its _home table ID
+const homes = new Map();
+// Units being migrated away (UnitExport) or here (UnitImport)
+const exporting = new Map();
+const importing = new Map();
+
+let interrupt = null;
+let running = 0;
+// Whether units' _home tables start from a shared snapshot's
+let sharedHome = false;
+
+// Loads _io.chunk, a chunk returning a function, as map function _io.key
+const DEFINE_MAP = `
+__cu_map = __cu_map or {}
+if _io.chunk == nil then __cu_map[_io.key] = nil return end
+local chunk, err = load(_io.chunk, "=parallelMap")
+if not chunk then error(err, 0) end
+local fn = chunk()
+if type(fn) ~= "function" then error("parallelMap: chunk must return a function", 0) end
+__cu_map[_io.key] = fn
+`;
+
+// The count travels with the items, so trailing nils are not lost
+const RUN_MAP = `
+local input = _io.input
+local fn, items, out = __cu_map[input.key], input.items, {}
+for i = 1, input.n do out[i] = fn(items[i]) end
+_io.output = out
+`;
+
+function useUnit(unit) {
+  if (unit === undefined) return;
+  let home = homes.get(unit);
+  if (home === undefined && sharedHome) home = getDefaultInstance().overlaySharedHome();
+  homes.set(unit, attachHomeTable(home ?? null));
+}
+
+// compute() and call() report errors as a negative length of message text
+function reply(id, status) {
+  if (status < 0) {
+    return { id, ok: false, status, code: getLastErrorCode(), error: readBuffer(getBufferPtr(), -status) };
+  }
+  return { id, ok: true, status, ...readResult(getResultPtr(), status) };
+}
+
+// Set _io fields to values already encoded, so a binary chunk reaches Lua
+// as a string of its bytes
+function setIoValues(values) {
+  const instance = getDefaultInstance();
+  const io = instance.ensureExternalTable(instance.getIoTableId());
+  for (const [field, bytes] of Object.entries(values)) io.set(field, bytes);
+  instance.wasmInstance.exports.invalidate_ext_table?.(instance.getIoTableId());
+}
+
+function compileChunk(code) {
+  const instance = getDefaultInstance();
+  if (typeof instance.wasmInstance.exports.compile !== 'function') return { ok: true, chunk: null };
+  return { ok: true, chunk: instance.compile(code) };
+}
+
+async function defineMap(message) {
+  const { key, chunk } = message;
+  setIoValues({
+    key: encodeValue(key, false),
+    chunk: chunk instanceof Uint8Array ? encodeBytes(chunk) : encodeValue(chunk, false),
+  });
+  const status = await compute(DEFINE_MAP);
+  setIoValues({ key: encodeValue(null, false), chunk: encodeValue(null, false) });
+  return reply(message.id, status);
+}
+
+async function runMap(message) {
+  setInput({ key: message.key, n: message.items.length, items: message.items });
+  const status = await compute(RUN_MAP);
+  const response = reply(message.id, status);
+  if (response.ok) response.values = getOutput();
+  return response;
+}
+
+function exportUnit({ unit, first }) {
+  const home = homes.get(unit);
+  if (home === undefined) return { ok: true, pack: null };
+  let unitExport = exporting.get(unit);
+  if (!unitExport || first) {
+    unitExport = new UnitExport(getDefaultInstance(), home);
+    exporting.set(unit, unitExport);
+  }
+  return { ok: true, pack: unitExport.pack() };
+}
+
+function importUnit({ unit, pack, first }) {
+  let unitImport = importing.get(unit);
+  if (!unitImport || first) {
+    unitImport = new UnitImport(getDefaultInstance());
+    importing.set(unit, unitImport);
+  }
+  homes.set(unit, unitImport.apply(pack));
+  return { ok: true };
+}
+
+// The unit now runs elsewhere; its tables here are garbage
+function dropUnit({ unit }) {
+  homes.delete(unit);
+  exporting.delete(unit);
+  importing.delete(unit);
+  return { ok: true };
+}
+
+async function start(message) {
+  const { init: initOptions, ...loadOptions } = message.options ?? {};
+  await load({ ...loadOptions, module: message.module, autoRestore: false });
+  const status = init(initOptions);
+  if (status === 0 && message.snapshot) {
+    sharedHome = getDefaultInstance().attachSharedSnapshot(message.snapshot).homeTableId !== null;
+  }
+  let interruptible = false;
+  if (message.interrupt) {
+    interrupt = new Int32Array(message.interrupt);
+    interruptible = setInterruptCheck(() => Atomics.load(interrupt, 0) === running);
+  }
+  return { ok: status === 0, status, interruptible };
+}
+
+async function handle(message) {
+  if (message.type === 'init') return start(message);
+  if (message.type === 'ring') return { ok: true };
+
+  running = message.id;
+  // Stopped before it started
+  if (interrupt && Atomics.load(interrupt, 0) === running) {
+    return { id: running, ok: false, code: ErrorCodes.INTERRUPTED, error: 'interrupted' };
+  }
+  switch (message.type) {
+    case 'compute':
+      useUnit(message.unit);
+      return reply(message.id, await compute(message.code));
+    case 'call':
+      useUnit(message.unit);
+      return reply(message.id, call(message.name, message.args ?? []));
+    case 'compile':
+      return compileChunk(message.code);
+    case 'define':
+      return defineMap(message);
+    case 'map':
+      return runMap(message);
+    case 'export':
+      return exportUnit(message);
+    case 'import':
+      return importUnit(message);
+    case 'drop':
+      return dropUnit(message);
+    default:
+      throw new Error(`Unknown pool message: ${message.type}`);
+  }
+}
+
+async function respond(message) {
+  try {
+    return { id: message.id, ...(await handle(message)) };
+  } catch (error) {
+    return { id: message.id, ok: false, error: error.message };
+  }
+}
+
+// Runs until the rings are closed. compute() only awaits settled promises
+// here (tables are not restored), so the blocking read() between requests
+// never holds up a request's own continuations.
+async function serveRing(requests, responses) {
+  for (;;) {
+    const frame = requests.read();
+    if (frame === null) return;
+    const message = decode(frame);
+    // msgpack turns a missing unit into nil
+    message.unit ??= undefined;
+    const response = await respond(message);
+    if (responses.closed) return;
+    let bytes;
+    try {
+      bytes = encode(response);
+    } catch (error) {
+      bytes = encode({ id: message.id, ok: false, error: error.message });
+    }
+    if (bytes.length > responses.maxFrame) {
+      bytes = encode({ id: message.id, ok: false, error: `Reply too large for ring (${bytes.length} bytes)` });
+    }
+    responses.write(bytes);
+  }
+}
+
+// Requests run one at a time, in arrival order, like calls on one VM
+let queue = Promise.resolve();
+
+function onMessage(message) {
+  queue = queue.then(async () => {
+    port.postMessage(await respond(message));
+    if (message.type === 'ring') {
+      await serveRing(new CuRing(message.requests), new CuRing(message.responses));
+    }
+  });
+}
+
+if (inBrowser) {
+  self.onmessage = (event) => onMessage(event.data);
+} else {
+  port.on('message', onMessage);
+}
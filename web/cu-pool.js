@@ -0,0 +1,342 @@
+/**
+ * Cu Compute Pool
+ *
+ * A VM (CuInstance) runs on the thread that created it, so a CuPool runs
+ * several of them in workers (Web Workers in browsers, worker_threads in
+ * Node) to use more than one core. The WebAssembly.Module is compiled once and sent to every
+ * worker to instantiate. Requests carry a unit ID and always go to the same
+ * worker, where the unit has its own _home table, so independent units run
+ * in parallel while each unit's requests stay in order.
+ *
+ * Usage:
+ *   import { CuPool } from './cu-pool.js';
+ *   const pool = await CuPool.create({ wasmPath: './cu.wasm', size: 4 });
+ *   const { result } = await pool.compute('unit-1', 'return 1 + 1');
+ *   pool.stats(); // queue depth and latency per worker
+ *   await pool.parallelMap('return function(x) return x * x end', [1, 2, 3]);
+ *   await pool.close();
+ *
+ * Units on one worker share its Lua globals; keep unit state in _home.
+ * Pool workers do not persist their tables.
+ *
+ * With `snapshot` (CuInstance.shareState()), every worker reads one packed
+ * copy of a reference dataset in place, and each unit's _home starts out
+ * with the snapshot's. Writes stay on the worker that made them: a unit's
+ * to its own _home, and writes to the tables below it to that worker's
+ * overlay of them, which its other units see.
+ *
+ * migrate(unit, worker) moves a busy unit to another worker while it keeps
+ * serving (see cu-migrate.js): its requests are held only while the tables
+ * it changed during the copy are applied.
+ */
+
+import { emitMetric, metricsEnabled } from './cu-log.js';
+import { compileModule } from './cu-module.js';
+
+const inNode = typeof process !== 'undefined' && process.versions?.node !== undefined;
+
+function defaultSize() {
+  if (typeof navigator !== 'undefined' && navigator.hardwareConcurrency) {
+    return navigator.hardwareConcurrency;
+  }
+  return 4;
+}
+
+// FNV-1a, so a unit maps to the same worker for the pool's lifetime
+function hashUnit(unit) {
+  const text = String(unit);
+  let hash = 0x811c9dc5;
+  for (let i = 0; i < text.length; i++) {
+    hash ^= text.charCodeAt(i);
+    hash = Math.imul(hash, 0x01000193);
+  }
+  return hash >>> 0;
+}
+
+/**
+ * One worker and the requests sent to it that have not been answered
+ */
+class PoolWorker {
+  constructor(worker) {
+    this.worker = worker;
+    this.pending = new Map(); // request id -> { resolve, reject, counted, start }
+    this.completed = 0;
+    this.failed = 0;
+    this.totalLatencyMs = 0;
+    this.maxLatencyMs = 0;
+    this.units = new Set();
+
+    const onMessage = (message) => this.settle(message);
+    if (inNode) {
+      worker.on('message', onMessage);
+      worker.on('error', (error) => this.failAll(error));
+    } else {
+      worker.onmessage = (event) => onMessage(event.data);
+      worker.onerror = (event) => this.failAll(new Error(event.message));
+    }
+  }
+
+  request(id, message) {
+    return new Promise((resolve, reject) => {
+      // Worker start-up is not a request the stats should count
+      const counted = message.type !== 'init';
+      this.pending.set(id, { resolve, reject, counted, start: performance.now() });
+      this.worker.postMessage({ id, ...message });
+    });
+  }
+
+  settle(message) {
+    const entry = this.pending.get(message.id);
+    if (!entry) return;
+    this.pending.delete(message.id);
+
+    const latencyMs = performance.now() - entry.start;
+    if (entry.counted) {
+      this.completed++;
+      this.totalLatencyMs += latencyMs;
+      this.maxLatencyMs = Math.max(this.maxLatencyMs, latencyMs);
+      if (!message.ok) this.failed++;
+    }
+    message.latencyMs = latencyMs;
+    if (message.ok) {
+      entry.resolve(message);
+    } else {
+      const error = new Error(message.error ?? 'Pool request failed');
+      error.status = message.status;
+      error.code = message.code;
+      entry.reject(error);
+    }
+  }
+
+  failAll(error) {
+    for (const { reject } of this.pending.values()) reject(error);
+    this.pending.clear();
+  }
+
+  stats() {
+    return {
+      queueDepth: this.pending.size,
+      completed: this.completed,
+      failed: this.failed,
+      meanLatencyMs: this.completed > 0 ? this.totalLatencyMs / this.completed : 0,
+      maxLatencyMs: this.maxLatencyMs,
+      units: this.units.size,
+    };
+  }
+}
+
+export class CuPool {
+  /**
+   * Compile the module once and start the workers
+   * @param {Object} [options]
+   * @param {number} [options.size] - Workers (default: hardware concurrency)
+   * @param {WebAssembly.Module} [options.module] - Compiled module to share
+   * @param {string|URL} [options.wasmPath='./cu.wasm'] - Where to fetch (or,
+   *   in Node, read) the module when none is given
+   * @param {string|URL} [options.workerUrl] - Worker script (default:
+   *   cu-pool-worker.js next to this file)
+   * @param {Object} [options.workerOptions] - Passed to every worker's
+   *   load(); `init` holds its init() options (heapBytes, maxHeapBytes)
+   * @param {SharedArrayBuffer|ArrayBuffer} [options.snapshot] - Tables
+   *   packed by CuInstance.shareState(), shared by every worker
+   * @returns {Promise<CuPool>}
+   */
+  static async create(options = {}) {
+    const module = options.module ?? await compileModule(options.wasmPath ?? './cu.wasm');
+    const workerUrl = options.workerUrl ?? new URL('./cu-pool-worker.js', import.meta.url);
+    const size = Math.max(1, options.size ?? defaultSize());
+
+    const pool = new CuPool();
+    for (let i = 0; i < size; i++) {
+      pool.workers.push(new PoolWorker(await spawnWorker(workerUrl)));
+    }
+    await Promise.all(pool.workers.map((worker) =>
+      worker.request(pool.nextId++, {
+        type: 'init', module, options: options.workerOptions ?? {}, snapshot: options.snapshot,
+      })
+    ));
+    return pool;
+  }
+
+  constructor() {
+    this.workers = [];
+    this.nextId = 1;
+    this.nextMapKey = 1;
+    this.routes = new Map(); // unit -> worker index, for migrated units
+    this.moving = new Map(); // unit -> promise settled when its move ends
+    this.held = new Set(); // units whose requests wait for the cut-over
+  }
+
+  /** The worker that runs `unit`'s requests */
+  workerFor(unit) {
+    if (this.workers.length === 0) {
+      throw new Error('CuPool is closed');
+    }
+    const routed = this.routes.get(unit);
+    return this.workers[routed ?? hashUnit(unit) % this.workers.length];
+  }
+
+  /**
+   * Move a unit's tables to another worker without stopping it. Its tables
+   * are copied while the current worker keeps running its requests; then
+   * new requests wait while the tables changed in the meantime are copied,
+   * and go to the new worker from then on. Lua globals stay behind.
+   * @param {string} unit
+   * @param {number} to - Index of the worker to move it to
+   * @returns {Promise<{tables: number, delta: number}>} Tables copied up
+   *   front and at the cut-over
+   */
+  async migrate(unit, to) {
+    const source = this.workerFor(unit);
+    const target = this.workers[to];
+    if (!target) throw new Error(`CuPool has no worker ${to}`);
+    if (this.moving.has(unit)) throw new Error(`Unit ${unit} is already moving`);
+    if (source === target) return { tables: 0, delta: 0 };
+
+    let cutOver;
+    this.moving.set(unit, new Promise((resolve) => { cutOver = resolve; }));
+    try {
+      // The unit's requests keep going to the source meanwhile
+      const { pack } = await source.request(this.nextId++, { type: 'export', unit, first: true });
+      if (pack) await target.request(this.nextId++, { type: 'import', unit, pack, first: true });
+
+      this.held.add(unit);
+      const { pack: delta } = await source.request(this.nextId++, { type: 'export', unit, first: false });
+      if (delta) await target.request(this.nextId++, { type: 'import', unit, pack: delta, first: false });
+      this.routes.set(unit, to);
+      source.units.delete(unit);
+      target.units.add(unit);
+      await source.request(this.nextId++, { type: 'drop', unit });
+      return { tables: pack?.tables.length ?? 0, delta: delta?.tables.length ?? 0 };
+    } finally {
+      this.held.delete(unit);
+      this.moving.delete(unit);
+      cutOver();
+    }
+  }
+
+  /**
+   * Run Lua source for a unit
+   * @returns {Promise<{status: number, output: string, result: *, latencyMs: number}>}
+   *   Rejects with the Lua error (error.status < 0) if the code failed
+   */
+  compute(unit, code) {
+    return this.dispatch(unit, { type: 'compute', unit, code });
+  }
+
+  /**
+   * Call a unit's Lua function by name, as cu-api's call()
+   * @returns {Promise<{status: number, output: string, result: *, latencyMs: number}>}
+   */
+  call(unit, name, args = []) {
+    return this.dispatch(unit, { type: 'call', unit, name, args });
+  }
+
+  /**
+   * Apply a Lua function to every item, with the items split into
+   * contiguous batches spread over the workers. The function is compiled
+   * once and its chunk loaded once on each worker that gets a batch; a batch
+   * travels as one message and reaches Lua as _io values. Functions run in
+   * the workers' own globals, not a unit's _home.
+   * @param {string|Uint8Array} fn - Lua chunk returning the function (e.g.
+   *   'return function(x) return x * 2 end'), or that chunk compiled with
+   *   CuInstance.compile()
+   * @param {Array} items - Serialized like _io values
+   * @param {Object} [options]
+   * @param {number} [options.batchSize] - Items per batch (default: one
+   *   batch per worker)
+   * @returns {Promise<Array>} The function's first result for each item, in
+   *   item order (null for nil). Rejects with the first Lua error
+   */
+  async parallelMap(fn, items, { batchSize } = {}) {
+    if (this.workers.length === 0) {
+      throw new Error('CuPool is closed');
+    }
+    if (!(fn instanceof Uint8Array) && typeof fn !== 'string') {
+      throw new Error('parallelMap() needs Lua source or a compiled chunk');
+    }
+    if (items.length === 0) return [];
+
+    const size = Math.max(1, batchSize ?? Math.ceil(items.length / this.workers.length));
+    const batches = [];
+    for (let start = 0; start < items.length; start += size) {
+      batches.push(items.slice(start, start + size));
+    }
+    const workers = this.workers.slice(0, batches.length);
+
+    // Builds without compile() ship the source, parsed once per worker
+    let chunk = fn;
+    if (typeof fn === 'string') {
+      chunk = (await workers[0].request(this.nextId++, { type: 'compile', code: fn })).chunk ?? fn;
+    }
+    const key = this.nextMapKey++;
+    await Promise.all(workers.map((worker) => worker.request(this.nextId++, { type: 'define', key, chunk })));
+    try {
+      const replies = await Promise.all(batches.map((batch, i) =>
+        workers[i % workers.length].request(this.nextId++, { type: 'map', key, items: batch })
+      ));
+      const results = [];
+      replies.forEach(({ values }, i) => {
+        for (let j = 0; j < batches[i].length; j++) {
+          // A Lua array with holes comes back as an object keyed from 1
+          results.push((Array.isArray(values) ? values[j] : values?.[j + 1]) ?? null);
+        }
+      });
+      return results;
+    } finally {
+      await Promise.allSettled(workers.map((worker) =>
+        worker.request(this.nextId++, { type: 'define', key, chunk: null })
+      ));
+    }
+  }
+
+  async dispatch(unit, message) {
+    // Requests wait out a migration's cut-over, in the order they came
+    while (this.held.has(unit)) await this.moving.get(unit);
+    const worker = this.workerFor(unit);
+    worker.units.add(unit);
+    const response = await worker.request(this.nextId++, message);
+    if (metricsEnabled()) {
+      emitMetric({
+        name: 'pool.' + message.type,
+        durationMs: response.latencyMs,
+        worker: this.workers.indexOf(worker),
+        queueDepth: worker.pending.size,
+      });
+    }
+    return response;
+  }
+
+  /**
+   * @returns {{queueDepth: number, workers: Array<{queueDepth: number,
+   *   completed: number, failed: number, meanLatencyMs: number,
+   *   maxLatencyMs: number, units: number}>}} queueDepth counts requests
+   *   sent and not yet answered
+   */
+  stats() {
+    const workers = this.workers.map((worker) => worker.stats());
+    return {
+      queueDepth: workers.reduce((sum, worker) => sum + worker.queueDepth, 0),
+      workers,
+    };
+  }
+
+  /** Stop every worker; requests still queued are rejected */
+  async close() {
+    const workers = this.workers;
+    this.workers = [];
+    for (const worker of workers) {
+      worker.failAll(new Error('CuPool closed'));
+      await worker.worker.terminate();
+    }
+  }
+}
+
+/** Start a module worker running `workerUrl` (Node: a worker_thread) */
+export async function spawnWorker(workerUrl) {
+  if (inNode) {
+    const { Worker } = await import('node:worker_threads');
+    return new Worker(workerUrl);
+  }
+  return new Worker(workerUrl, { type: 'module' });
+}
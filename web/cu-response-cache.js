@@ -0,0 +1,156 @@
+/**
+ * Cu Response Cache
+ *
+ * Keeps the encoded results of call()s to handlers the host declares pure:
+ * given the same arguments and the same contents of the external tables
+ * they read, they return the same result and change nothing. A repeated
+ * call is then answered from the cache without entering the VM.
+ *
+ * An entry is keyed by the handler's name and its arguments encoded as one
+ * frame (CuInstance.serializeFrame), and remembers each table the call read
+ * with that table's version (ExtTable.version, bumped on every change). It
+ * is used only while every one of those tables is still the same object at
+ * the same version, so a write to any of them, by Lua or the host, retires
+ * it. To see every read, a call that misses runs with the VM's own caches
+ * of table entries dropped (invalidate_ext_table(0)).
+ *
+ * A call is not stored when it wrote to a table, made or changed an index,
+ * cache, columnar or array layout, read the clock, streamed output or ran
+ * in a transaction; nor when it failed or read a cache table, whose reads
+ * expire and reorder entries. Lua globals are not tracked: the cache is emptied
+ * whenever other code runs in the VM (compute(), calls to other handlers,
+ * init(), selectState()), since that code may redefine a handler or change
+ * what it reads.
+ */
+
+// Imports whose use makes a call impure; every other js_ext_table_ import
+// reads the table named by its first argument
+const IMPURE_IMPORTS = new Set([
+  'js_ext_table_set',
+  'js_ext_table_set_parts',
+  'js_ext_table_delete',
+  'js_ext_table_set_many',
+  'js_ext_table_cache',
+  'js_ext_table_columns',
+  'js_ext_table_array',
+  'js_ext_table_push',
+  'js_ext_table_pop',
+  'js_ext_table_index',
+  'js_ext_transaction',
+  'js_time_now',
+  'js_write_output',
+]);
+
+const DEFAULT_MAX_ENTRIES = 1024;
+
+/**
+ * Wrap the table imports so a call being recorded for the cache notes the
+ * tables it reads (host.tableReads). While nothing is recorded each
+ * wrapper costs one property read before the plain import runs.
+ * @param {object} env - The env imports
+ * @param {object} host - The CuInstance
+ * @returns {object} env, with the imports wrapped
+ */
+export function trackTableReads(env, host) {
+  for (const name of Object.keys(env)) {
+    const fn = env[name];
+    if (IMPURE_IMPORTS.has(name)) {
+      env[name] = (a, b, c, d, e, f, g) => {
+        if (host.tableReads !== null) host.tableReads.pure = false;
+        return fn(a, b, c, d, e, f, g);
+      };
+    } else if (name.startsWith('js_ext_table_')) {
+      env[name] = (tableId, b, c, d, e, f, g) => {
+        if (host.tableReads !== null) host.tableReads.tables.add(tableId);
+        return fn(tableId, b, c, d, e, f, g);
+      };
+    }
+  }
+  return env;
+}
+
+// FNV-1a, to spread argument frames over the map's keys
+function hashBytes(bytes) {
+  let hash = 0x811c9dc5;
+  for (let i = 0; i < bytes.length; i++) {
+    hash = Math.imul(hash ^ bytes[i], 0x01000193);
+  }
+  return hash >>> 0;
+}
+
+function sameBytes(a, b) {
+  if (a.length !== b.length) return false;
+  for (let i = 0; i < a.length; i++) if (a[i] !== b[i]) return false;
+  return true;
+}
+
+export class ResponseCache {
+  /**
+   * @param {Iterable<string>} handlers - Names of the pure handlers
+   * @param {Object} [options]
+   * @param {number} [options.maxEntries=1024] - Least recently used entries
+   *   past this are dropped
+   */
+  constructor(handlers, { maxEntries = DEFAULT_MAX_ENTRIES } = {}) {
+    this.handlers = new Set(handlers);
+    this.maxEntries = Math.max(1, Math.floor(maxEntries));
+    this.entries = new Map(); // name \0 hash -> { args, result, reads }
+    this.hits = 0;
+    this.misses = 0;
+  }
+
+  key(name, args) {
+    return `${name}\0${hashBytes(args)}`;
+  }
+
+  /**
+   * @param {string} name
+   * @param {Uint8Array} args - The argument frame
+   * @param {Map<number, ExtTable>} tables - The instance's external tables
+   * @returns {Uint8Array|null} The stored result, if still current
+   */
+  lookup(name, args, tables) {
+    const key = this.key(name, args);
+    const entry = this.entries.get(key);
+    if (entry && sameBytes(entry.args, args) &&
+        entry.reads.every(([id, table, version]) => tables.get(id) === table && table.version === version)) {
+      // Most recently used last
+      this.entries.delete(key);
+      this.entries.set(key, entry);
+      this.hits++;
+      return entry.result;
+    }
+    if (entry) this.entries.delete(key);
+    this.misses++;
+    return null;
+  }
+
+  /**
+   * @param {string} name
+   * @param {Uint8Array} args - The argument frame
+   * @param {Uint8Array} result - The encoded result, copied
+   * @param {Array<[number, ExtTable]>} reads - Each table the call read
+   */
+  store(name, args, result, reads) {
+    const key = this.key(name, args);
+    this.entries.delete(key);
+    this.entries.set(key, {
+      args,
+      result,
+      reads: reads.map(([id, table]) => [id, table, table.version]),
+    });
+    if (this.entries.size > this.maxEntries) {
+      this.entries.delete(this.entries.keys().next().value);
+    }
+  }
+
+  /** Drop every entry: the VM ran code that may change what handlers return */
+  expire() {
+    if (this.entries.size > 0) this.entries = new Map();
+  }
+
+  /** @returns {{hits: number, misses: number, entries: number}} */
+  stats() {
+    return { hits: this.hits, misses: this.misses, entries: this.entries.size };
+  }
+}
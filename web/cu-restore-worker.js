@@ -0,0 +1,35 @@
+/**
+ * Cu Restore Worker
+ *
+ * Inflates compressed table records and values for RestoreWorkers
+ * (cu-restore-workers.js), in a Web Worker or a Node worker_thread, so a
+ * restore's decompression runs on every core instead of the thread that
+ * owns the VM.
+ *
+ * Messages in:  { id, bytes: ArrayBuffer } - a raw deflate stream
+ * Messages out: { id, ok: true, bytes: ArrayBuffer } (transferred)
+ *               { id, ok: false, error }
+ */
+
+import { inflate } from './cu-compression.js';
+
+const inBrowser = typeof WorkerGlobalScope !== 'undefined';
+const port = inBrowser ? self : (await import('node:worker_threads')).parentPort;
+
+async function onMessage({ id, bytes }) {
+  try {
+    const inflated = await inflate(new Uint8Array(bytes));
+    const buffer = inflated.byteOffset === 0 && inflated.byteLength === inflated.buffer.byteLength
+      ? inflated.buffer
+      : inflated.slice().buffer;
+    port.postMessage({ id, ok: true, bytes: buffer }, [buffer]);
+  } catch (error) {
+    port.postMessage({ id, ok: false, error: error.message });
+  }
+}
+
+if (inBrowser) {
+  port.onmessage = (event) => onMessage(event.data);
+} else {
+  port.on('message', onMessage);
+}
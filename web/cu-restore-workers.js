@@ -0,0 +1,107 @@
+/**
+ * Cu Restore Workers
+ *
+ * Worker threads that inflate what a restore reads, so a big unit's
+ * compressed tables load on several cores. Persistence given `{ workers }`
+ * (LuaPersistence, FilePersistence, CompressedPersistence) hands every
+ * compressed table record or value to them and restores the tables
+ * concurrently; the main thread only reassembles the tables from the
+ * inflated bytes.
+ *
+ * Usage:
+ *   import { RestoreWorkers } from './cu-restore-workers.js';
+ *   const workers = await RestoreWorkers.create({ size: 4 });
+ *   const persistence = new FilePersistence(dir, { compress: true, workers });
+ *   await unit.load({ persistence });
+ *   await workers.close();
+ */
+
+import { spawnWorker } from './cu-pool.js';
+
+const inNode = typeof process !== 'undefined' && process.versions?.node !== undefined;
+
+/**
+ * One worker and the requests it has not answered
+ */
+class RestoreWorker {
+  constructor(worker) {
+    this.worker = worker;
+    this.pending = new Map(); // request id -> { resolve, reject }
+
+    const onMessage = ({ id, ok, bytes, error }) => {
+      const entry = this.pending.get(id);
+      if (!entry) return;
+      this.pending.delete(id);
+      if (ok) entry.resolve(new Uint8Array(bytes));
+      else entry.reject(new Error(error));
+    };
+    if (inNode) {
+      worker.on('message', onMessage);
+      worker.on('error', (error) => this.failAll(error));
+    } else {
+      worker.onmessage = (event) => onMessage(event.data);
+      worker.onerror = (event) => this.failAll(new Error(event.message));
+    }
+  }
+
+  failAll(error) {
+    for (const { reject } of this.pending.values()) reject(error);
+    this.pending.clear();
+  }
+}
+
+export class RestoreWorkers {
+  /**
+   * @param {Object} [options]
+   * @param {number} [options.size] - Workers (default: hardware concurrency
+   *   less one for the VM's thread, at least 1)
+   * @param {string|URL} [options.workerUrl] - Worker script (default:
+   *   cu-restore-worker.js next to this file)
+   * @returns {Promise<RestoreWorkers>}
+   */
+  static async create(options = {}) {
+    const workerUrl = options.workerUrl ?? new URL('./cu-restore-worker.js', import.meta.url);
+    const cores = typeof navigator !== 'undefined' ? navigator.hardwareConcurrency ?? 4 : 4;
+    const size = Math.max(1, options.size ?? cores - 1);
+    const workers = new RestoreWorkers();
+    for (let i = 0; i < size; i++) {
+      workers.workers.push(new RestoreWorker(await spawnWorker(workerUrl)));
+    }
+    return workers;
+  }
+
+  constructor() {
+    this.workers = [];
+    this.nextId = 1;
+  }
+
+  /**
+   * Inflate a raw deflate stream on the least busy worker. The bytes are
+   * copied to it, so `bytes` stays usable.
+   * @param {Uint8Array} bytes
+   * @returns {Promise<Uint8Array>}
+   */
+  inflate(bytes) {
+    if (this.workers.length === 0) return Promise.reject(new Error('RestoreWorkers is closed'));
+    let worker = this.workers[0];
+    for (const candidate of this.workers) {
+      if (candidate.pending.size < worker.pending.size) worker = candidate;
+    }
+    const id = this.nextId++;
+    const copy = bytes.slice().buffer;
+    return new Promise((resolve, reject) => {
+      worker.pending.set(id, { resolve, reject });
+      worker.worker.postMessage({ id, bytes: copy }, [copy]);
+    });
+  }
+
+  /** Stop the workers; inflates still running are rejected */
+  async close() {
+    const workers = this.workers;
+    this.workers = [];
+    for (const worker of workers) {
+      worker.failAll(new Error('RestoreWorkers closed'));
+      await worker.worker.terminate();
+    }
+  }
+}
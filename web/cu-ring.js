@@ -0,0 +1,189 @@
+/**
+ * Cu Ring
+ *
+ * A single-producer, single-consumer queue of byte frames in a
+ * SharedArrayBuffer. CuWorker uses a pair of them (requests in, responses
+ * out) in place of postMessage, which structured-clones every message and
+ * wakes the other thread through its event loop. A frame is a u32 length
+ * and its bytes, padded to 4 bytes so a length never straddles the end of
+ * the data area; the bytes of a frame that runs past the end wrap to its
+ * start.
+ *
+ * Both sides keep running byte counters in the header: the writer owns
+ * `head` and the reader owns `tail`, so neither takes a lock. A thread that
+ * finds the ring empty (reader) or full (writer) sleeps with Atomics.wait
+ * on the other side's counter, or Atomics.waitAsync where the thread may
+ * not block (a page's main thread). Counters wrap at 2^32; the capacity is
+ * a power of two no larger than 2^30, so `head - tail` stays exact.
+ *
+ * Usage:
+ *   const ring = new CuRing(CuRing.allocate(1 << 16));
+ *   ring.tryWrite(bytes);          // false if the ring is full
+ *   ring.read();                   // Uint8Array, blocking (workers only)
+ *   await ring.readAsync();        // Uint8Array, or null once closed
+ *   new CuRing(ring.buffer);       // the same ring on another thread
+ */
+
+const HEAD = 0;
+const TAIL = 1;
+const CLOSED = 2;
+const HEADER_BYTES = 16;
+const FRAME_HEADER = 4;
+
+export class CuRing {
+  /**
+   * A SharedArrayBuffer for a ring holding up to `capacity` bytes of frames
+   * and their headers
+   * @param {number} capacity - Rounded up to a power of two, at least 64
+   * @returns {SharedArrayBuffer}
+   */
+  static allocate(capacity) {
+    let size = 64;
+    while (size < capacity) size *= 2;
+    if (size > 1 << 30) {
+      throw new Error(`Ring capacity too large: ${capacity}`);
+    }
+    return new SharedArrayBuffer(HEADER_BYTES + size);
+  }
+
+  /** @param {SharedArrayBuffer} buffer - From CuRing.allocate() */
+  constructor(buffer) {
+    this.buffer = buffer;
+    this.header = new Int32Array(buffer, 0, HEADER_BYTES / 4);
+    this.data = new Uint8Array(buffer, HEADER_BYTES);
+    this.view = new DataView(buffer, HEADER_BYTES);
+    this.capacity = this.data.length;
+    this.mask = this.capacity - 1;
+  }
+
+  /** The largest frame payload this ring accepts */
+  get maxFrame() {
+    return this.capacity - FRAME_HEADER;
+  }
+
+  /** Whether close() was called on either side */
+  get closed() {
+    return Atomics.load(this.header, CLOSED) !== 0;
+  }
+
+  /** Bytes of frames and headers waiting to be read */
+  get used() {
+    return (Atomics.load(this.header, HEAD) - Atomics.load(this.header, TAIL)) >>> 0;
+  }
+
+  /**
+   * Append one frame if there is room (writer side)
+   * @param {Uint8Array} bytes
+   * @returns {boolean} False if the ring is full
+   */
+  tryWrite(bytes) {
+    if (frameSize(bytes.length) > this.capacity) {
+      throw new Error(`Frame too large for ring (${bytes.length} > ${this.maxFrame})`);
+    }
+    if (this.closed) {
+      throw new Error('Ring is closed');
+    }
+    const head = Atomics.load(this.header, HEAD);
+    const tail = Atomics.load(this.header, TAIL);
+    const size = frameSize(bytes.length);
+    if (this.capacity - ((head - tail) >>> 0) < size) return false;
+
+    this.view.setUint32(head & this.mask, bytes.length, true);
+    this.copyIn(head + FRAME_HEADER, bytes);
+    // Publishes the frame: the reader sees the new head only after the bytes
+    Atomics.store(this.header, HEAD, (head + size) | 0);
+    Atomics.notify(this.header, HEAD);
+    return true;
+  }
+
+  /**
+   * Append one frame, sleeping while the ring is full (workers only; a
+   * page's main thread may not block)
+   * @param {Uint8Array} bytes
+   */
+  write(bytes) {
+    for (;;) {
+      const tail = Atomics.load(this.header, TAIL);
+      if (this.tryWrite(bytes)) return;
+      Atomics.wait(this.header, TAIL, tail);
+    }
+  }
+
+  /**
+   * Take the next frame if there is one (reader side)
+   * @returns {Uint8Array|null} A copy of the payload
+   */
+  tryRead() {
+    const head = Atomics.load(this.header, HEAD);
+    const tail = Atomics.load(this.header, TAIL);
+    if (head === tail) return null;
+
+    const length = this.view.getUint32(tail & this.mask, true);
+    const bytes = new Uint8Array(length);
+    this.copyOut(tail + FRAME_HEADER, bytes);
+    Atomics.store(this.header, TAIL, (tail + frameSize(length)) | 0);
+    Atomics.notify(this.header, TAIL);
+    return bytes;
+  }
+
+  /**
+   * Take the next frame, sleeping while the ring is empty (workers only)
+   * @returns {Uint8Array|null} The payload, or null once the ring is closed
+   *   and drained
+   */
+  read() {
+    for (;;) {
+      const head = Atomics.load(this.header, HEAD);
+      const frame = this.tryRead();
+      if (frame !== null) return frame;
+      if (this.closed) return null;
+      Atomics.wait(this.header, HEAD, head);
+    }
+  }
+
+  /**
+   * Take the next frame, waiting without blocking the thread
+   * @returns {Promise<Uint8Array|null>} The payload, or null once the ring
+   *   is closed and drained
+   */
+  async readAsync() {
+    for (;;) {
+      const head = Atomics.load(this.header, HEAD);
+      const frame = this.tryRead();
+      if (frame !== null) return frame;
+      if (this.closed) return null;
+      const wait = Atomics.waitAsync(this.header, HEAD, head);
+      if (wait.async) await wait.value;
+    }
+  }
+
+  /** Refuse further writes and wake both sides */
+  close() {
+    Atomics.store(this.header, CLOSED, 1);
+    Atomics.notify(this.header, HEAD);
+    Atomics.notify(this.header, TAIL);
+  }
+
+  copyIn(position, bytes) {
+    const at = position & this.mask;
+    const first = Math.min(bytes.length, this.capacity - at);
+    this.data.set(bytes.subarray(0, first), at);
+    if (first < bytes.length) this.data.set(bytes.subarray(first), 0);
+  }
+
+  copyOut(position, bytes) {
+    const at = position & this.mask;
+    const first = Math.min(bytes.length, this.capacity - at);
+    bytes.set(this.data.subarray(at, at + first));
+    if (first < bytes.length) bytes.set(this.data.subarray(0, bytes.length - first), first);
+  }
+}
+
+function frameSize(length) {
+  return FRAME_HEADER + ((length + 3) & ~3);
+}
+
+/** Whether this thread can use rings: shared memory and Atomics.waitAsync */
+export function ringsSupported() {
+  return typeof SharedArrayBuffer === 'function' && typeof Atomics.waitAsync === 'function';
+}
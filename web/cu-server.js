@@ -0,0 +1,371 @@
+/**
+ * Cu Server
+ *
+ * Serves units over HTTP and WebSocket from one Node process. Each unit is
+ * a CuInstance of the shared module, created on its first request with its
+ * tables restored from the unit's storage and journaled back to it after
+ * every request, so the store always holds the unit's _home. At most
+ * `maxUnits` instances stay loaded; the least recently used idle one is
+ * dropped to make room and comes back from storage when asked for again.
+ * A unit's requests run one at a time, in arrival order.
+ *
+ *   POST /api/lua     {unit?, code} or {unit?, call, args?}
+ *                     -> {ok, status, output, result, latencyMs} or
+ *                        {ok: false, error, latencyMs}
+ *   GET  /metrics     -> stats()
+ *   WS   /ws          the same requests as JSON text frames with an `id`,
+ *                     answered as each completes, so a client can keep many
+ *                     in flight on one connection (HTTP/1.1 keep-alive
+ *                     pipelining answers in order instead)
+ *
+ * Usage:
+ *   import { CuServer } from './cu-server.js';
+ *   import { KvStorage } from './cu-storage.js';
+ *   const server = await CuServer.create({
+ *     storage: (unit) => new KvStorage(client, { prefix: `${unit}/` }),
+ *   });
+ *   await server.listen(8000);
+ */
+
+import http from 'node:http';
+import crypto from 'node:crypto';
+import { fileURLToPath } from 'node:url';
+
+import { CuInstance } from './cu-instance.js';
+import { compileModule } from './cu-module.js';
+import { emitMetric, metricsEnabled } from './cu-log.js';
+import { StoragePersistence, MemoryStorage } from './cu-storage.js';
+
+const DEFAULT_WASM_PATH = fileURLToPath(new URL('./cu.wasm', import.meta.url));
+const DEFAULT_UNIT = 'default';
+const MAX_BODY_BYTES = 1 << 20;
+// Latencies kept for the percentiles in stats()
+const LATENCY_WINDOW = 1024;
+const WS_GUID = '258EAFA5-E914-47DA-95CA-C5AB0DC85B11';
+
+export class CuServer {
+  /**
+   * @param {Object} [options]
+   * @param {WebAssembly.Module} [options.module] - Compiled module to share
+   * @param {string} [options.wasmPath] - Where to read it when none is given
+   *   (default: cu.wasm next to this file)
+   * @param {function(string): Object} [options.storage] - Storage adapter
+   *   (see cu-storage.js) for a unit; default: a MemoryStorage each
+   * @param {function(string): Object} [options.persistence] - Or a whole
+   *   persistence (FilePersistence, LuaPersistence...) for a unit
+   * @param {number} [options.maxUnits=64] - Instances kept loaded
+   * @param {number} [options.compactEvery=100] - enableJournal() option
+   * @param {Object} [options.instanceOptions] - Passed to CuInstance.create()
+   * @returns {Promise<CuServer>}
+   */
+  static async create(options = {}) {
+    const module = options.module ?? await compileModule(options.wasmPath ?? DEFAULT_WASM_PATH);
+    return new CuServer(module, options);
+  }
+
+  constructor(module, {
+    storage = () => new MemoryStorage(),
+    persistence = null,
+    maxUnits = 64,
+    compactEvery = 100,
+    instanceOptions = {},
+  } = {}) {
+    this.module = module;
+    this.persistenceFor = persistence ?? ((unit) => new StoragePersistence(storage(unit)));
+    this.maxUnits = Math.max(1, maxUnits);
+    this.compactEvery = compactEvery;
+    this.instanceOptions = instanceOptions;
+    // unit -> {instance: Promise<CuInstance>, tail: Promise, busy: number},
+    // least recently used first
+    this.units = new Map();
+    this.httpServer = null;
+    this.sockets = new Set();
+
+    this.requests = 0;
+    this.errors = 0;
+    this.totalLatencyMs = 0;
+    this.maxLatencyMs = 0;
+    this.latencies = new Float64Array(LATENCY_WINDOW);
+  }
+
+  /**
+   * Run one request on its unit
+   * @param {Object} request - {unit?, code} or {unit?, call, args?}
+   * @returns {Promise<Object>} {ok: true, status, output, result, latencyMs}
+   *   or {ok: false, status?, error, latencyMs}; never rejects
+   */
+  handle(request) {
+    if (typeof request?.code !== 'string' && typeof request?.call !== 'string') {
+      return Promise.resolve({ ok: false, error: 'Request needs code or call', latencyMs: 0 });
+    }
+    const start = performance.now();
+    const unit = request?.unit === undefined || request.unit === null ? DEFAULT_UNIT : String(request.unit);
+    const entry = this.entryFor(unit);
+    entry.busy++;
+    const run = entry.tail.then(() => this.run(unit, entry, request));
+    entry.tail = run.catch(() => {});
+    return run
+      .catch((error) => {
+        // A trap leaves the VM unusable; the next request reloads the unit
+        // from what its storage holds
+        if (this.units.get(unit) === entry) this.units.delete(unit);
+        return { ok: false, error: error.message };
+      })
+      .then((response) => {
+        entry.busy--;
+        this.record(unit, response, performance.now() - start);
+        this.evict();
+        return response;
+      });
+  }
+
+  async run(unit, entry, request) {
+    const instance = await entry.instance;
+    const status = typeof request.code === 'string'
+      ? instance.compute(request.code)
+      : instance.call(request.call, request.args ?? []);
+    await instance.flushJournal();
+    if (status < 0) {
+      return { ok: false, status, error: instance.readBuffer(instance.getBufferPtr(), -status) };
+    }
+    const { output, result } = instance.readResult(instance.getResultPtr(), status);
+    return { ok: true, status, output, result };
+  }
+
+  // The unit's entry, moved to the most recently used end
+  entryFor(unit) {
+    let entry = this.units.get(unit);
+    if (entry) {
+      this.units.delete(unit);
+    } else {
+      entry = { instance: this.loadUnit(unit), busy: 0 };
+      entry.tail = entry.instance.catch(() => {});
+    }
+    this.units.set(unit, entry);
+    return entry;
+  }
+
+  async loadUnit(unit) {
+    const instance = await CuInstance.create({
+      ...this.instanceOptions,
+      module: this.module,
+      persistence: this.persistenceFor(unit),
+    });
+    instance.init();
+    await instance.tablesReady();
+    instance.enableJournal({ compactEvery: this.compactEvery });
+    return instance;
+  }
+
+  // Drop idle units past maxUnits, oldest first; their journal is flushed
+  // after every request, so nothing is lost
+  evict() {
+    for (const [unit, entry] of this.units) {
+      if (this.units.size <= this.maxUnits) return;
+      if (entry.busy === 0) this.units.delete(unit);
+    }
+  }
+
+  record(unit, response, latencyMs) {
+    response.latencyMs = latencyMs;
+    this.latencies[this.requests % LATENCY_WINDOW] = latencyMs;
+    this.requests++;
+    if (!response.ok) this.errors++;
+    this.totalLatencyMs += latencyMs;
+    this.maxLatencyMs = Math.max(this.maxLatencyMs, latencyMs);
+    if (metricsEnabled()) {
+      emitMetric({ name: 'server.request', durationMs: latencyMs, unit, ok: response.ok });
+    }
+  }
+
+  /**
+   * @returns {{requests: number, errors: number, units: number,
+   *   connections: number, meanLatencyMs: number, maxLatencyMs: number,
+   *   p50LatencyMs: number, p99LatencyMs: number}} Percentiles are over the
+   *   last 1024 requests
+   */
+  stats() {
+    const recent = Array.from(this.latencies.subarray(0, Math.min(this.requests, LATENCY_WINDOW))).sort((a, b) => a - b);
+    const percentile = (p) => (recent.length > 0 ? recent[Math.min(recent.length - 1, Math.floor(recent.length * p))] : 0);
+    return {
+      requests: this.requests,
+      errors: this.errors,
+      units: this.units.size,
+      connections: this.sockets.size,
+      meanLatencyMs: this.requests > 0 ? this.totalLatencyMs / this.requests : 0,
+      maxLatencyMs: this.maxLatencyMs,
+      p50LatencyMs: percentile(0.5),
+      p99LatencyMs: percentile(0.99),
+    };
+  }
+
+  /**
+   * Start serving HTTP and WebSocket requests
+   * @param {number} [port=8000] - 0 picks a free port
+   * @param {string} [host='localhost']
+   * @returns {Promise<number>} The port listened on
+   */
+  listen(port = 8000, host = 'localhost') {
+    this.httpServer = http.createServer((req, res) => this.onHttp(req, res));
+    this.httpServer.on('upgrade', (req, socket) => this.onUpgrade(req, socket));
+    return new Promise((resolve, reject) => {
+      this.httpServer.once('error', reject);
+      this.httpServer.listen(port, host, () => resolve(this.httpServer.address().port));
+    });
+  }
+
+  onHttp(req, res) {
+    const send = (status, body) => {
+      res.writeHead(status, { 'Content-Type': 'application/json', 'Access-Control-Allow-Origin': '*' });
+      res.end(JSON.stringify(body));
+    };
+    if (req.method === 'GET' && req.url === '/metrics') return send(200, this.stats());
+    if (req.method !== 'POST' || req.url !== '/api/lua') return send(404, { ok: false, error: 'Not found' });
+
+    const chunks = [];
+    let size = 0;
+    req.on('data', (chunk) => {
+      size += chunk.length;
+      if (size > MAX_BODY_BYTES) {
+        send(413, { ok: false, error: 'Request too large' });
+        req.destroy();
+        return;
+      }
+      chunks.push(chunk);
+    });
+    req.on('end', async () => {
+      let request;
+      try {
+        request = JSON.parse(Buffer.concat(chunks).toString('utf8'));
+      } catch {
+        return send(400, { ok: false, error: 'Body must be JSON' });
+      }
+      if (typeof request?.code !== 'string' && typeof request?.call !== 'string') {
+        return send(400, { ok: false, error: 'Request needs code or call' });
+      }
+      const response = await this.handle(request);
+      // Lua errors are answers; 500 is for a unit that could not run
+      send(response.ok || response.status !== undefined ? 200 : 500, response);
+    });
+  }
+
+  onUpgrade(req, socket) {
+    const key = req.headers['sec-websocket-key'];
+    if (req.url !== '/ws' || req.headers.upgrade?.toLowerCase() !== 'websocket' || !key) {
+      socket.end('HTTP/1.1 400 Bad Request\r\n\r\n');
+      return;
+    }
+    const accept = crypto.createHash('sha1').update(key + WS_GUID).digest('base64');
+    socket.write(
+      'HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n' +
+        `Sec-WebSocket-Accept: ${accept}\r\n\r\n`
+    );
+    this.sockets.add(socket);
+    socket.on('close', () => this.sockets.delete(socket));
+    socket.on('error', () => socket.destroy());
+
+    readFrames(socket, async (opcode, payload) => {
+      if (opcode === 0x8) {
+        socket.end(encodeFrame(0x8, Buffer.alloc(0)));
+        return;
+      }
+      if (opcode === 0x9) {
+        socket.write(encodeFrame(0xa, payload));
+        return;
+      }
+      if (opcode !== 0x1) return;
+      let request;
+      try {
+        request = JSON.parse(payload.toString('utf8'));
+      } catch {
+        socket.write(encodeFrame(0x1, Buffer.from(JSON.stringify({ ok: false, error: 'Message must be JSON' }))));
+        return;
+      }
+      const response = await this.handle(request);
+      if (!socket.writable) return;
+      socket.write(encodeFrame(0x1, Buffer.from(JSON.stringify({ id: request?.id, ...response }))));
+    });
+  }
+
+  /** Stop listening, close connections and drop every loaded unit */
+  async close() {
+    for (const socket of this.sockets) socket.destroy();
+    this.sockets.clear();
+    if (this.httpServer) {
+      await new Promise((resolve) => this.httpServer.close(resolve));
+      this.httpServer = null;
+    }
+    await Promise.all(Array.from(this.units.values(), (entry) => entry.tail));
+    this.units.clear();
+  }
+}
+
+// Call onFrame(opcode, payload) for each whole message a client sends.
+// Client frames are masked (RFC 6455 5.3); fragments are joined.
+function readFrames(socket, onFrame) {
+  let buffered = Buffer.alloc(0);
+  let fragments = [];
+  let fragmentOpcode = 0;
+  socket.on('data', (data) => {
+    buffered = buffered.length > 0 ? Buffer.concat([buffered, data]) : data;
+    for (;;) {
+      if (buffered.length < 2) return;
+      const fin = (buffered[0] & 0x80) !== 0;
+      const opcode = buffered[0] & 0x0f;
+      const masked = (buffered[1] & 0x80) !== 0;
+      let length = buffered[1] & 0x7f;
+      let offset = 2;
+      if (length === 126) {
+        if (buffered.length < 4) return;
+        length = buffered.readUInt16BE(2);
+        offset = 4;
+      } else if (length === 127) {
+        if (buffered.length < 10) return;
+        length = Number(buffered.readBigUInt64BE(2));
+        offset = 10;
+      }
+      if (!masked || length > MAX_BODY_BYTES) {
+        socket.destroy();
+        return;
+      }
+      if (buffered.length < offset + 4 + length) return;
+      const mask = buffered.subarray(offset, offset + 4);
+      const payload = Buffer.from(buffered.subarray(offset + 4, offset + 4 + length));
+      for (let i = 0; i < payload.length; i++) payload[i] ^= mask[i & 3];
+      buffered = buffered.subarray(offset + 4 + length);
+
+      if (opcode >= 0x8) {
+        onFrame(opcode, payload);
+      } else if (!fin) {
+        if (opcode !== 0) fragmentOpcode = opcode;
+        fragments.push(payload);
+      } else if (opcode === 0 && fragments.length > 0) {
+        fragments.push(payload);
+        const message = Buffer.concat(fragments);
+        fragments = [];
+        onFrame(fragmentOpcode, message);
+      } else {
+        onFrame(opcode, payload);
+      }
+    }
+  });
+}
+
+// One unmasked, unfragmented server frame
+function encodeFrame(opcode, payload) {
+  let header;
+  if (payload.length < 126) {
+    header = Buffer.from([0x80 | opcode, payload.length]);
+  } else if (payload.length < 0x10000) {
+    header = Buffer.alloc(4);
+    header[0] = 0x80 | opcode;
+    header[1] = 126;
+    header.writeUInt16BE(payload.length, 2);
+  } else {
+    header = Buffer.alloc(10);
+    header[0] = 0x80 | opcode;
+    header[1] = 127;
+    header.writeBigUInt64BE(BigInt(payload.length), 2);
+  }
+  return Buffer.concat([header, payload]);
+}
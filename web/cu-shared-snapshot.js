@@ -0,0 +1,268 @@
+/**
+ * Cu Shared Snapshots
+ *
+ * A pool of workers that all read one large reference dataset would hold a
+ * full copy of it per worker. packSnapshot() instead packs external tables
+ * once into a SharedArrayBuffer (an ArrayBuffer where there is none, which
+ * is then copied per worker) that every worker reads in place:
+ * handing it to a worker is a pointer handoff, not a restore.
+ *
+ * Each worker serves the packed tables through OverlayTables: reads fall
+ * through to the shared bytes, writes and deletions stay in the worker's
+ * own overlay. The packed tables never change.
+ *
+ * Layout (little-endian u32 words, entries 4-byte aligned):
+ *   header:    MAGIC, VERSION, table count, _home table ID, next table ID
+ *   directory: per table, ID, entry count, first slot word, slot count,
+ *              entries start byte, entries end byte
+ *   slots:     per table, a power-of-two open-addressed hash of its keys
+ *              (FNV-1a of the key text, linear probing): the byte offset of
+ *              the entry, 0 for an empty slot
+ *   entries:   key length, value length, key text (UTF-8), value bytes
+ * A key is stored as its text, an integer as its decimal digits, which
+ * normalizeKey() turns back into the integer.
+ */
+
+import { ExtTable, normalizeKey } from './cu-ext-table.js';
+
+const MAGIC = 0x53534355; // "CUSS"
+const VERSION = 1;
+const HEADER_WORDS = 5;
+const DIRECTORY_WORDS = 6;
+
+const textEncoder = new TextEncoder();
+const textDecoder = new TextDecoder();
+
+function hashBytes(bytes) {
+  let hash = 0x811c9dc5;
+  for (let i = 0; i < bytes.length; i++) {
+    hash = Math.imul(hash ^ bytes[i], 0x01000193);
+  }
+  return hash >>> 0;
+}
+
+const align4 = (n) => (n + 3) & ~3;
+
+/**
+ * Pack external tables for SharedSnapshot
+ * @param {Map<number, ExtTable>} tables - By table ID
+ * @param {Object} [ids]
+ * @param {number|null} [ids.homeTableId] - The _home table among them
+ * @param {number} [ids.nextTableId] - Past every table ID the data refers to
+ * @returns {SharedArrayBuffer|ArrayBuffer}
+ */
+export function packSnapshot(tables, { homeTableId = null, nextTableId = 1 } = {}) {
+  const packed = [];
+  let slotWords = 0;
+  let entryBytes = 0;
+  for (const [id, table] of tables) {
+    const entries = [];
+    for (const [key, value] of table) {
+      if (!(value instanceof Uint8Array)) continue;
+      const keyBytes = textEncoder.encode(String(key));
+      entries.push({ keyBytes, value });
+      entryBytes += 8 + align4(keyBytes.length + value.length);
+    }
+    let slotCount = 1;
+    while (slotCount < entries.length * 2) slotCount *= 2;
+    packed.push({ id, entries, slotCount });
+    slotWords += slotCount;
+  }
+
+  const slotsStart = HEADER_WORDS + packed.length * DIRECTORY_WORDS;
+  const byteLength = (slotsStart + slotWords) * 4 + entryBytes;
+  const buffer = typeof SharedArrayBuffer === 'function' ? new SharedArrayBuffer(byteLength) : new ArrayBuffer(byteLength);
+  const words = new Uint32Array(buffer);
+  const bytes = new Uint8Array(buffer);
+  words.set([MAGIC, VERSION, packed.length, homeTableId ?? 0, nextTableId]);
+
+  let slot = slotsStart;
+  let offset = (slotsStart + slotWords) * 4;
+  packed.forEach(({ id, entries, slotCount }, i) => {
+    const start = offset;
+    const mask = slotCount - 1;
+    for (const { keyBytes, value } of entries) {
+      words[offset >> 2] = keyBytes.length;
+      words[(offset >> 2) + 1] = value.length;
+      bytes.set(keyBytes, offset + 8);
+      bytes.set(value, offset + 8 + keyBytes.length);
+      let probe = hashBytes(keyBytes) & mask;
+      while (words[slot + probe] !== 0) probe = (probe + 1) & mask;
+      words[slot + probe] = offset;
+      offset += 8 + align4(keyBytes.length + value.length);
+    }
+    words.set([id, entries.length, slot, slotCount, start, offset], HEADER_WORDS + i * DIRECTORY_WORDS);
+    slot += slotCount;
+  });
+  return buffer;
+}
+
+/**
+ * One packed table, read in place. Values are views of the shared bytes.
+ */
+export class SnapshotTable {
+  constructor(words, bytes, directory) {
+    this.words = words;
+    this.bytes = bytes;
+    this.size = words[directory + 1];
+    this.firstSlot = words[directory + 2];
+    this.mask = words[directory + 3] - 1;
+    this.start = words[directory + 4];
+    this.end = words[directory + 5];
+  }
+
+  get(key) {
+    if (this.size === 0) return undefined;
+    const keyBytes = textEncoder.encode(String(normalizeKey(key)));
+    const { words, bytes } = this;
+    for (let probe = hashBytes(keyBytes) & this.mask; ; probe = (probe + 1) & this.mask) {
+      const offset = words[this.firstSlot + probe];
+      if (offset === 0) return undefined;
+      if (words[offset >> 2] === keyBytes.length && this.keyMatches(offset, keyBytes)) {
+        const valueStart = offset + 8 + keyBytes.length;
+        return bytes.subarray(valueStart, valueStart + words[(offset >> 2) + 1]);
+      }
+    }
+  }
+
+  keyMatches(offset, keyBytes) {
+    for (let i = 0; i < keyBytes.length; i++) {
+      if (this.bytes[offset + 8 + i] !== keyBytes[i]) return false;
+    }
+    return true;
+  }
+
+  has(key) {
+    return this.get(key) !== undefined;
+  }
+
+  *entries() {
+    const { words, bytes } = this;
+    for (let offset = this.start; offset < this.end; ) {
+      const keyLength = words[offset >> 2];
+      const valueLength = words[(offset >> 2) + 1];
+      const key = normalizeKey(textDecoder.decode(bytes.slice(offset + 8, offset + 8 + keyLength)));
+      const valueStart = offset + 8 + keyLength;
+      yield [key, bytes.subarray(valueStart, valueStart + valueLength)];
+      offset += 8 + align4(keyLength + valueLength);
+    }
+  }
+
+  *keys() {
+    for (const [key] of this.entries()) yield key;
+  }
+
+  [Symbol.iterator]() {
+    return this.entries();
+  }
+}
+
+/**
+ * A buffer from packSnapshot(), shared or not
+ */
+export class SharedSnapshot {
+  constructor(buffer) {
+    this.buffer = buffer;
+    this.words = new Uint32Array(buffer);
+    this.bytes = new Uint8Array(buffer);
+    if (this.words[0] !== MAGIC || this.words[1] !== VERSION) {
+      throw new Error('Not a packed Cu snapshot');
+    }
+    this.homeTableId = this.words[3] || null;
+    this.nextTableId = this.words[4];
+    this.tables = new Map(); // table ID -> SnapshotTable
+    for (let i = 0; i < this.words[2]; i++) {
+      const directory = HEADER_WORDS + i * DIRECTORY_WORDS;
+      this.tables.set(this.words[directory], new SnapshotTable(this.words, this.bytes, directory));
+    }
+  }
+
+  /** @returns {SnapshotTable|null} */
+  table(id) {
+    return this.tables.get(id) ?? null;
+  }
+
+  tableIds() {
+    return this.tables.keys();
+  }
+}
+
+/**
+ * An ExtTable over a SnapshotTable: what it stores itself comes first,
+ * then the keys of `base` it has not deleted
+ */
+export class OverlayTable extends ExtTable {
+  /** @param {SnapshotTable} base */
+  constructor(base) {
+    super();
+    this.base = base;
+    this.removed = new Set(); // keys of base deleted here
+    this.shadowed = 0; // keys stored here that base has too
+  }
+
+  get size() {
+    return super.size - this.shadowed + this.base.size - this.removed.size;
+  }
+
+  // Arrays come back to JavaScript through the array part, which holds
+  // only this side's keys
+  isArray() {
+    return this.base.size === 0 && super.isArray();
+  }
+
+  get(key) {
+    key = normalizeKey(key);
+    const own = super.get(key);
+    if (own !== undefined || this.removed.has(key)) return own;
+    return this.base.get(key);
+  }
+
+  set(key, value) {
+    key = normalizeKey(key);
+    if (super.get(key) === undefined && this.base.has(key)) {
+      this.removed.delete(key);
+      this.shadowed++;
+    }
+    return super.set(key, value);
+  }
+
+  delete(key) {
+    key = normalizeKey(key);
+    if (!this.base.has(key) || this.removed.has(key)) return super.delete(key);
+    this.removed.add(key);
+    if (super.get(key) !== undefined) {
+      this.shadowed--;
+      return super.delete(key);
+    }
+    // Only the shared entry goes; the bookkeeping is delete()'s
+    super.delete(key);
+    this.onChange?.(key, undefined);
+    return true;
+  }
+
+  clear() {
+    for (const key of [...this.keys()]) this.delete(key);
+  }
+
+  *keys() {
+    yield* super.keys();
+    for (const key of this.base.keys()) {
+      if (!this.removed.has(key) && super.get(key) === undefined) yield key;
+    }
+  }
+
+  *entries() {
+    for (const key of this.keys()) yield [key, this.get(key)];
+  }
+
+  clone() {
+    const copy = new OverlayTable(this.base);
+    copy.array = this.array.slice();
+    copy.holes = this.holes;
+    copy.hash = new Map(this.hash);
+    copy.removed = new Set(this.removed);
+    copy.shadowed = this.shadowed;
+    copy.bytes = this.bytes;
+    return copy;
+  }
+}
@@ -0,0 +1,458 @@
+/**
+ * Cu Storage Adapters
+ *
+ * LuaPersistence (IndexedDB) and FilePersistence store whole tables. Stores
+ * that address single entries, such as an embedded KV (LMDB, SQLite) or a
+ * remote KV, fit a smaller interface instead, and StoragePersistence turns
+ * any of them into the persistence CuInstance takes:
+ *
+ *   getTable(tableId)                  entries of a table, or null
+ *   putEntries(tableId, entries)       upsert [key, Uint8Array] pairs
+ *   deleteEntries(tableId, keys)
+ *   scan()                             IDs of the stored tables
+ *   snapshot(tables, removedIds, { replace })
+ *                                      write the given tables whole, drop
+ *                                      the removed ones (with replace, every
+ *                                      table not given)
+ *   getMetadata() / putMetadata(metadata)
+ *   clear()
+ *   write(changes, metadata)           optional: one compute's changes,
+ *                                      [tableId, puts, deleteKeys] per
+ *                                      table, and the new metadata at once
+ *
+ * All methods may return promises. Keys are numbers or strings, as in
+ * ExtTable. With the journal on (enableJournal), each compute's changes
+ * arrive as one appendJournal record and are written with one write() call,
+ * or one putEntries / deleteEntries call per table it touched, so the store
+ * is current after every compute and saveState() only compacts.
+ *
+ * MemoryStorage keeps everything in Maps; KvStorage maps the interface onto
+ * any client with get/set/delete/keys, such as an LMDB, Redis or Workers KV
+ * binding; IndexedDbStorage keeps one IndexedDB record per entry.
+ */
+
+import { log, logEnabled } from './cu-log.js';
+import { replayJournal, JournalChanges } from './cu-journal.js';
+
+export class StoragePersistence {
+  /**
+   * @param {object} storage - A storage adapter (see above)
+   */
+  constructor(storage) {
+    this.storage = storage;
+  }
+
+  async init() {
+    await this.storage.init?.();
+  }
+
+  /**
+   * Save all external tables, replacing whatever was stored
+   * @param {Map} externalTables - Map of table ID to Map of key-value pairs
+   * @param {Object} metadata
+   */
+  async saveTables(externalTables, metadata = {}) {
+    await this.storage.snapshot(externalTables, [], { replace: true });
+    await this.storage.putMetadata({
+      ...metadata,
+      tableCount: externalTables.size,
+      tableIds: Array.from(externalTables.keys())
+    });
+  }
+
+  /**
+   * Write only the given tables and drop removed ones
+   * @param {Map} changedTables - Map of table ID to table, for tables to (re)write
+   * @param {Array<number>} removedIds - IDs of stored tables to drop
+   * @param {Object} metadata
+   */
+  async saveChanges(changedTables, removedIds, metadata = {}) {
+    await this.storage.snapshot(changedTables, removedIds, { replace: false });
+    await this.storage.putMetadata(metadata);
+  }
+
+  /**
+   * Write one compute's changes (a record from encodeJournalRecord) to the
+   * store as entry puts and deletes
+   * @param {Uint8Array} record
+   */
+  async appendJournal(record) {
+    const { storage } = this;
+    const metadata = { ...(await storage.getMetadata()) };
+    const journal = new Map();
+    replayJournal(journal, [record], metadata, () => new JournalChanges());
+
+    const changes = [];
+    for (const [tableId, tableChanges] of journal) {
+      const puts = [];
+      const deletes = [];
+      for (const [key, value] of tableChanges) {
+        // Views into the record, which the caller may reuse
+        if (value === undefined) deletes.push(key);
+        else puts.push([key, value.slice()]);
+      }
+      changes.push([tableId, puts, deletes]);
+    }
+    const tableIds = new Set(metadata.tableIds ?? []);
+    for (const tableId of journal.keys()) tableIds.add(tableId);
+    const next = { ...metadata, tableIds: Array.from(tableIds), tableCount: tableIds.size };
+
+    if (storage.write) {
+      await storage.write(changes, next);
+      return;
+    }
+    for (const [tableId, puts, deletes] of changes) {
+      if (puts.length > 0) await storage.putEntries(tableId, puts);
+      if (deletes.length > 0) await storage.deleteEntries(tableId, deletes);
+    }
+    await storage.putMetadata(next);
+  }
+
+  /**
+   * Load all external tables
+   * @returns {{tables: Map, metadata: Object, journalTableIds: Set<number>}}
+   */
+  async loadTables() {
+    const { metadata, tableIds } = await this.loadIndex();
+    const tables = new Map();
+    for (const tableId of tableIds) {
+      tables.set(tableId, await this.loadTable(tableId));
+    }
+    if (logEnabled('debug')) {
+      log('debug', `Loaded ${tables.size} tables from storage`);
+    }
+    // Journal writes went to the tables themselves
+    return { tables, metadata, journalTableIds: new Set() };
+  }
+
+  /**
+   * @returns {{metadata: Object, tableIds: Array<number>, journal: Map}}
+   */
+  async loadIndex() {
+    const metadata = { ...(await this.storage.getMetadata()) };
+    const tableIds = (await this.storage.scan()).map(Number);
+    return { metadata, tableIds, journal: new Map() };
+  }
+
+  /**
+   * @param {number} tableId
+   * @param {JournalChanges} [changes] - Applied on top
+   * @returns {Promise<Map>} The table's entries (empty if it is not stored)
+   */
+  async loadTable(tableId, changes) {
+    const tableData = new Map(await this.storage.getTable(Number(tableId)) ?? []);
+    return changes ? changes.applyTo(tableData) : tableData;
+  }
+
+  async clearAll() {
+    await this.storage.clear();
+  }
+}
+
+/**
+ * Storage adapter over Maps, for tests and single-process hosts that
+ * persist elsewhere
+ */
+export class MemoryStorage {
+  constructor() {
+    this.tables = new Map();
+    this.metadata = {};
+  }
+
+  getTable(tableId) {
+    const table = this.tables.get(tableId);
+    return table ? new Map(table) : null;
+  }
+
+  putEntries(tableId, entries) {
+    let table = this.tables.get(tableId);
+    if (!table) {
+      table = new Map();
+      this.tables.set(tableId, table);
+    }
+    for (const [key, value] of entries) table.set(key, value);
+  }
+
+  deleteEntries(tableId, keys) {
+    const table = this.tables.get(tableId);
+    if (!table) return;
+    for (const key of keys) table.delete(key);
+  }
+
+  scan() {
+    return Array.from(this.tables.keys());
+  }
+
+  snapshot(tables, removedIds, { replace = false } = {}) {
+    if (replace) this.tables.clear();
+    for (const tableId of removedIds) this.tables.delete(Number(tableId));
+    for (const [tableId, tableData] of tables) {
+      this.tables.set(Number(tableId), new Map(Array.from(tableData, ([key, value]) => [key, value.slice()])));
+    }
+  }
+
+  getMetadata() {
+    return this.metadata;
+  }
+
+  putMetadata(metadata) {
+    this.metadata = metadata;
+  }
+
+  clear() {
+    this.tables.clear();
+    this.metadata = {};
+  }
+}
+
+const textEncoder = new TextEncoder();
+const textDecoder = new TextDecoder();
+
+/**
+ * Storage adapter over a flat key-value client. Each entry is one KV key,
+ * `<prefix>t:<tableId>:<n|s><key>`, and the metadata is `<prefix>meta`.
+ * The client needs:
+ *
+ *   get(key) -> Uint8Array | undefined      set(key, Uint8Array)
+ *   delete(key)                             keys(prefix) -> Array<string>
+ *
+ * and may offer setMany([[key, value]]) and deleteMany(keys) to write a
+ * compute's changes in one round trip. Any method may return a promise.
+ */
+export class KvStorage {
+  /**
+   * @param {object} client
+   * @param {Object} [options]
+   * @param {string} [options.prefix=''] - Namespace for this unit's keys
+   */
+  constructor(client, { prefix = '' } = {}) {
+    this.client = client;
+    this.prefix = prefix;
+  }
+
+  tablePrefix(tableId) {
+    return `${this.prefix}t:${tableId}:`;
+  }
+
+  entryKey(tableId, key) {
+    return `${this.tablePrefix(tableId)}${typeof key === 'number' ? 'n' : 's'}${key}`;
+  }
+
+  async setMany(pairs) {
+    if (pairs.length === 0) return;
+    if (this.client.setMany) return this.client.setMany(pairs);
+    for (const [key, value] of pairs) await this.client.set(key, value);
+  }
+
+  async deleteMany(keys) {
+    if (keys.length === 0) return;
+    if (this.client.deleteMany) return this.client.deleteMany(keys);
+    for (const key of keys) await this.client.delete(key);
+  }
+
+  async getTable(tableId) {
+    const prefix = this.tablePrefix(tableId);
+    const keys = await this.client.keys(prefix);
+    if (keys.length === 0) return null;
+    const table = new Map();
+    for (const kvKey of keys) {
+      const value = await this.client.get(kvKey);
+      if (value === undefined) continue;
+      const encoded = kvKey.slice(prefix.length);
+      const key = encoded[0] === 'n' ? Number(encoded.slice(1)) : encoded.slice(1);
+      table.set(key, value instanceof Uint8Array ? value : new Uint8Array(value));
+    }
+    return table;
+  }
+
+  putEntries(tableId, entries) {
+    return this.setMany(Array.from(entries, ([key, value]) => [this.entryKey(tableId, key), value]));
+  }
+
+  deleteEntries(tableId, keys) {
+    return this.deleteMany(Array.from(keys, (key) => this.entryKey(tableId, key)));
+  }
+
+  async scan() {
+    const tableIds = new Set();
+    const prefix = `${this.prefix}t:`;
+    for (const key of await this.client.keys(prefix)) {
+      tableIds.add(Number(key.slice(prefix.length, key.indexOf(':', prefix.length))));
+    }
+    return Array.from(tableIds);
+  }
+
+  async snapshot(tables, removedIds, { replace = false } = {}) {
+    const drop = replace ? await this.scan() : removedIds;
+    for (const tableId of new Set([...drop.map(Number), ...Array.from(tables.keys(), Number)])) {
+      await this.deleteMany(await this.client.keys(this.tablePrefix(tableId)));
+    }
+    for (const [tableId, tableData] of tables) await this.putEntries(Number(tableId), tableData);
+  }
+
+  async getMetadata() {
+    const bytes = await this.client.get(`${this.prefix}meta`);
+    return bytes === undefined ? {} : JSON.parse(textDecoder.decode(bytes));
+  }
+
+  putMetadata(metadata) {
+    return this.client.set(`${this.prefix}meta`, textEncoder.encode(JSON.stringify(metadata)));
+  }
+
+  async clear() {
+    await this.deleteMany(await this.client.keys(this.prefix));
+  }
+}
+
+const ENTRY_DB_NAME = 'LuaPersistentEntries';
+const ENTRY_STORE = 'entries';
+const META_STORE = 'meta';
+const TABLE_INDEX = 'table';
+
+function request(req) {
+  return new Promise((resolve, reject) => {
+    req.onsuccess = () => resolve(req.result);
+    req.onerror = () => reject(req.error);
+  });
+}
+
+function completion(transaction) {
+  return new Promise((resolve, reject) => {
+    transaction.oncomplete = () => resolve();
+    transaction.onerror = () => reject(transaction.error);
+    transaction.onabort = () => reject(transaction.error || new Error('Transaction aborted'));
+  });
+}
+
+// Every compound key [tableId, key]: arrays sort after all numbers and
+// strings, so [tableId] .. [tableId, []] spans them
+const tableRange = (tableId) => IDBKeyRange.bound([tableId], [tableId, []]);
+
+/**
+ * Storage adapter keeping one IndexedDB record { t: tableId, k: key, v }
+ * per entry, keyed by [t, k] with an index on t. Changing one key of a
+ * large table then writes one record instead of re-cloning the table, and
+ * getEntry() reads one value without the rest.
+ *
+ *   new CuInstance({ persistence: new StoragePersistence(new IndexedDbStorage('unit-1')) })
+ *
+ * The database is separate from LuaPersistence's; state saved by one is
+ * not read by the other.
+ */
+export class IndexedDbStorage {
+  /**
+   * @param {string} [namespace] - Store under a database of its own
+   */
+  constructor(namespace = null) {
+    this.dbName = namespace ? `${ENTRY_DB_NAME}:${namespace}` : ENTRY_DB_NAME;
+    this.db = null;
+  }
+
+  async init() {
+    if (this.db) return this.db;
+    const open = indexedDB.open(this.dbName, 1);
+    open.onupgradeneeded = () => {
+      const db = open.result;
+      const entries = db.createObjectStore(ENTRY_STORE, { keyPath: ['t', 'k'] });
+      entries.createIndex(TABLE_INDEX, 't');
+      db.createObjectStore(META_STORE);
+    };
+    this.db = await request(open);
+    return this.db;
+  }
+
+  async transaction(stores, mode) {
+    const db = await this.init();
+    return db.transaction(stores, mode);
+  }
+
+  async getTable(tableId) {
+    const transaction = await this.transaction([ENTRY_STORE], 'readonly');
+    const records = await request(transaction.objectStore(ENTRY_STORE).index(TABLE_INDEX).getAll(tableId));
+    if (records.length === 0) return null;
+    const table = new Map();
+    for (const { k, v } of records) table.set(k, v);
+    return table;
+  }
+
+  /**
+   * One entry's value, without reading the rest of its table
+   * @returns {Promise<Uint8Array|undefined>}
+   */
+  async getEntry(tableId, key) {
+    const transaction = await this.transaction([ENTRY_STORE], 'readonly');
+    const record = await request(transaction.objectStore(ENTRY_STORE).get([tableId, key]));
+    return record?.v;
+  }
+
+  putEntries(tableId, entries) {
+    return this.write([[tableId, Array.from(entries), []]]);
+  }
+
+  deleteEntries(tableId, keys) {
+    return this.write([[tableId, [], Array.from(keys)]]);
+  }
+
+  async write(changes, metadata) {
+    const transaction = await this.transaction([ENTRY_STORE, META_STORE], 'readwrite');
+    const done = completion(transaction);
+    const entries = transaction.objectStore(ENTRY_STORE);
+    for (const [tableId, puts, deletes] of changes) {
+      for (const key of deletes) entries.delete([tableId, key]);
+      for (const [key, value] of puts) entries.put({ t: tableId, k: key, v: value });
+    }
+    if (metadata !== undefined) transaction.objectStore(META_STORE).put(metadata, 'metadata');
+    await done;
+  }
+
+  async scan() {
+    const transaction = await this.transaction([ENTRY_STORE], 'readonly');
+    const index = transaction.objectStore(ENTRY_STORE).index(TABLE_INDEX);
+    const tableIds = [];
+    await new Promise((resolve, reject) => {
+      const cursor = index.openKeyCursor(null, 'nextunique');
+      cursor.onsuccess = () => {
+        if (!cursor.result) return resolve();
+        tableIds.push(cursor.result.key);
+        cursor.result.continue();
+      };
+      cursor.onerror = () => reject(cursor.error);
+    });
+    return tableIds;
+  }
+
+  async snapshot(tables, removedIds, { replace = false } = {}) {
+    const transaction = await this.transaction([ENTRY_STORE], 'readwrite');
+    const done = completion(transaction);
+    const entries = transaction.objectStore(ENTRY_STORE);
+    // Requests run in the order they are made, so the deletes go first
+    if (replace) entries.clear();
+    else for (const tableId of removedIds) entries.delete(tableRange(Number(tableId)));
+    for (const [tableId, tableData] of tables) {
+      const id = Number(tableId);
+      if (!replace) entries.delete(tableRange(id));
+      for (const [key, value] of tableData) entries.put({ t: id, k: key, v: value });
+    }
+    await done;
+  }
+
+  async getMetadata() {
+    const transaction = await this.transaction([META_STORE], 'readonly');
+    return (await request(transaction.objectStore(META_STORE).get('metadata'))) ?? {};
+  }
+
+  async putMetadata(metadata) {
+    const transaction = await this.transaction([META_STORE], 'readwrite');
+    const done = completion(transaction);
+    transaction.objectStore(META_STORE).put(metadata, 'metadata');
+    await done;
+  }
+
+  async clear() {
+    const transaction = await this.transaction([ENTRY_STORE, META_STORE], 'readwrite');
+    const done = completion(transaction);
+    transaction.objectStore(ENTRY_STORE).clear();
+    transaction.objectStore(META_STORE).clear();
+    await done;
+  }
+}
@@ -0,0 +1,215 @@
+/**
+ * Cu String Dictionary
+ *
+ * Persistence that stores each repeated string value once per snapshot.
+ * Persisted state repeats the same strings across records: status names,
+ * currency codes, user IDs. StringDictionaryPersistence wraps any
+ * persistence; on a full save it collects the string values (either value
+ * encoding, cu-values.js) that occur more than once in the snapshot into a
+ * dictionary and leaves a reference in each value:
+ *
+ *   STRING_INDEXED, varint dictionary index
+ *
+ * STRING_INDEXED is a leading byte no value encoding starts with. The
+ * dictionary is stored in the inner persistence under STRING_TABLE_ID, keyed
+ * by index, in the same snapshot as the values that refer to it. Changes
+ * saved after it refer to the entries it has and add the strings they
+ * repeat; journal records only refer to entries already stored. The next
+ * full save builds the dictionary afresh.
+ *
+ * On load each entry is read once and every reference resolves to that one
+ * copy, so a string repeated across a thousand records is allocated once.
+ */
+
+import { encodeJournalRecord, replayJournal, JournalChanges } from './cu-journal.js';
+import { V2_STRING, V2_SHORT_STRING } from './cu-values.js';
+
+export const STRING_INDEXED = 0xe4;
+// Table ID of the dictionary, below FUNCTION_TABLE_ID (cu-function-store.js)
+export const STRING_TABLE_ID = 0xfffffffe;
+
+const STRING = 0x04;
+// A shorter string costs less in place than as a reference
+const MIN_STRING = 6;
+
+const latin1 = new TextDecoder('latin1');
+
+function isString(value) {
+  if (!(value instanceof Uint8Array) || value.length < MIN_STRING) return false;
+  const tag = value[0];
+  return tag === STRING || tag === V2_STRING || (tag & 0xc0) === V2_SHORT_STRING;
+}
+
+function reference(index) {
+  const bytes = [STRING_INDEXED];
+  while (index >= 0x80) {
+    bytes.push((index & 0x7f) | 0x80);
+    index >>>= 7;
+  }
+  bytes.push(index);
+  return new Uint8Array(bytes);
+}
+
+/**
+ * Persistence that writes repeated string values once
+ */
+export class StringDictionaryPersistence {
+  /**
+   * @param {object} inner - LuaPersistence, FilePersistence,
+   *   CompressedPersistence or anything with their interface
+   */
+  constructor(inner) {
+    this.inner = inner;
+    this.reset();
+  }
+
+  reset() {
+    // Stored entries, by index, and their indexes by contents
+    this.entries = [];
+    this.indexes = new Map();
+  }
+
+  async init() {
+    await this.inner.init?.();
+  }
+
+  /** Add the strings `tables` repeats that the dictionary lacks; returns whether any were */
+  collect(tables) {
+    const counts = new Map();
+    for (const tableData of tables.values()) {
+      for (const [, value] of tableData) {
+        if (!isString(value)) continue;
+        const contents = latin1.decode(value);
+        if (!this.indexes.has(contents)) counts.set(contents, (counts.get(contents) ?? 0) + 1);
+      }
+    }
+    const before = this.entries.length;
+    for (const [contents, count] of counts) {
+      if (count < 2) continue;
+      this.indexes.set(contents, this.entries.length);
+      this.entries.push(null);
+    }
+    return this.entries.length > before;
+  }
+
+  /** A value with a stored string replaced by its reference */
+  indexValue(value) {
+    if (!isString(value)) return value;
+    const index = this.indexes.get(latin1.decode(value));
+    if (index === undefined) return value;
+    if (this.entries[index] === null) this.entries[index] = value.slice();
+    return reference(index);
+  }
+
+  indexTables(tables) {
+    const out = new Map();
+    for (const [tableId, tableData] of tables) {
+      const values = new Map();
+      for (const [key, value] of tableData) values.set(key, this.indexValue(value));
+      out.set(tableId, values);
+    }
+    return out;
+  }
+
+  dictionaryTable() {
+    const dictionary = new Map();
+    for (let i = 0; i < this.entries.length; i++) dictionary.set(i, this.entries[i]);
+    return dictionary;
+  }
+
+  async saveTables(externalTables, metadata) {
+    this.reset();
+    this.collect(externalTables);
+    const tables = this.indexTables(externalTables);
+    tables.set(STRING_TABLE_ID, this.dictionaryTable());
+    await this.inner.saveTables(tables, metadata);
+  }
+
+  async saveChanges(changedTables, removedIds, metadata) {
+    const added = this.collect(changedTables);
+    const tables = this.indexTables(changedTables);
+    // The dictionary is rewritten whole, like any changed table
+    if (added) tables.set(STRING_TABLE_ID, this.dictionaryTable());
+    await this.inner.saveChanges(tables, removedIds, metadata);
+  }
+
+  async appendJournal(record) {
+    if (this.entries.length === 0) return this.inner.appendJournal(record);
+    const metadata = {};
+    const tables = new Map();
+    replayJournal(tables, [record], metadata, () => new JournalChanges());
+    const changes = [];
+    for (const [tableId, tableChanges] of tables) {
+      for (const [key, value] of tableChanges) {
+        changes.push([tableId, key, value === undefined ? undefined : this.indexValue(value)]);
+      }
+    }
+    const { nextTableId, homeTableId = null } = metadata;
+    await this.inner.appendJournal(encodeJournalRecord({ nextTableId, homeTableId, changes }));
+  }
+
+  /** Take on the dictionary as loaded */
+  adoptDictionary(dictionary) {
+    this.reset();
+    if (!dictionary) return;
+    for (const [index, value] of dictionary) {
+      if (typeof index !== 'number' || !(value instanceof Uint8Array)) continue;
+      this.entries[index] = value;
+      this.indexes.set(latin1.decode(value), index);
+    }
+  }
+
+  resolveValues(tableData) {
+    for (const [key, value] of tableData) {
+      if (value instanceof Uint8Array && value[0] === STRING_INDEXED) tableData.set(key, this.resolveValue(value));
+    }
+    return tableData;
+  }
+
+  /** The stored string a reference stands for, shared by every reference to it */
+  resolveValue(value) {
+    let index = 0;
+    let shift = 0;
+    for (let i = 1; ; i++) {
+      if (i >= value.length || shift > 28) throw new Error('String reference is corrupt');
+      index += (value[i] & 0x7f) * 2 ** shift;
+      if (value[i] < 0x80) break;
+      shift += 7;
+    }
+    const entry = this.entries[index];
+    if (!entry) throw new Error(`String ${index} is missing from the dictionary`);
+    return entry;
+  }
+
+  async loadTables() {
+    const loaded = await this.inner.loadTables();
+    const tables = new Map(loaded.tables);
+    this.adoptDictionary(tables.get(STRING_TABLE_ID));
+    tables.delete(STRING_TABLE_ID);
+    for (const tableData of tables.values()) this.resolveValues(tableData);
+    const journalTableIds = loaded.journalTableIds && new Set(loaded.journalTableIds);
+    journalTableIds?.delete(STRING_TABLE_ID);
+    return { ...loaded, tables, journalTableIds };
+  }
+
+  async loadIndex() {
+    const index = await this.inner.loadIndex();
+    this.adoptDictionary(
+      index.tableIds.includes(STRING_TABLE_ID)
+        ? await this.inner.loadTable(STRING_TABLE_ID, index.journal.get(STRING_TABLE_ID))
+        : null
+    );
+    const journal = new Map(index.journal);
+    journal.delete(STRING_TABLE_ID);
+    return { ...index, tableIds: index.tableIds.filter((id) => id !== STRING_TABLE_ID), journal };
+  }
+
+  async loadTable(tableId, changes) {
+    return this.resolveValues(await this.inner.loadTable(tableId, changes));
+  }
+
+  clearAll() {
+    this.reset();
+    return this.inner.clearAll();
+  }
+}
@@ -0,0 +1,729 @@
+/**
+ * Cu Tiered Execution
+ *
+ * Compiles hot Lua functions to WebAssembly while the VM runs. A build made
+ * with CU_TIER=1 counts calls to each Lua function (src/lua/ltier.c) and,
+ * at the threshold set with set_tier_threshold, hands the function's
+ * prototype and that call's arguments to js_tier_compile. Tier.compile()
+ * translates the bytecode into a wasm function specialized for the
+ * argument types it sees, instantiates it against the VM's own memory and
+ * puts it in one of the module's compiled-code slots, entries of its
+ * exported function table. From then on luaD_precall calls the slot and
+ * skips the interpreter.
+ *
+ * Only numeric leaf functions are compiled: fixed parameters, integer and
+ * float arithmetic, comparisons, jumps, integer 'for' loops and at most one
+ * result, with no tables, strings, calls, upvalues or closures. Register
+ * types are worked out at compile time from the argument types, and each
+ * register lives in a wasm local of its type instead of a stack slot.
+ * Anything else is declined, and the function stays interpreted for good.
+ *
+ * The code has no side effects before it returns its result, so it can
+ * leave any call to the interpreter: it returns -1 when an argument has
+ * another type than it was compiled for, when the interpreter would raise
+ * an error (integer division by zero, a zero 'for' step) and when the
+ * interrupt word is set. It first checks the prototype's address and a
+ * stamp written into the prototype, so memory restored from another
+ * instance never runs code compiled for something else.
+ */
+
+import { log } from './cu-log.js';
+
+// Layout indices (CU_TIER_* in src/lua/ltier.h)
+const L_SLOTS = 0;
+const L_NUMPARAMS = 1;
+const L_ISVARARG = 2;
+const L_MAXSTACK = 3;
+const L_SIZEK = 4;
+const L_SIZECODE = 5;
+const L_K = 6;
+const L_CODE = 7;
+const L_STAMP = 8;
+const L_STACKVALUE = 9;
+const L_TVALUE = 10;
+const L_TT = 11;
+const L_INTEGER = 12;
+const L_NUMBER = 13;
+const L_VNUMINT = 14;
+const L_VNUMFLT = 15;
+const L_FIELDS = 16;
+
+// Longest function compiled, in instructions
+const MAX_CODE = 2048;
+
+// Lua 5.4 opcodes the compiler handles (lopcodes.h)
+const OP = {
+  MOVE: 0, LOADI: 1, LOADF: 2, LOADK: 3,
+  ADDI: 21, ADDK: 22, SUBK: 23, MULK: 24, MODK: 25, POWK: 26, DIVK: 27, IDIVK: 28,
+  BANDK: 29, BORK: 30, BXORK: 31,
+  ADD: 34, SUB: 35, MUL: 36, MOD: 37, POW: 38, DIV: 39, IDIV: 40,
+  BAND: 41, BOR: 42, BXOR: 43,
+  MMBIN: 46, MMBINI: 47, MMBINK: 48,
+  UNM: 49, BNOT: 50,
+  JMP: 56, EQ: 57, LT: 58, LE: 59, EQI: 61, LTI: 62, LEI: 63, GTI: 64, GEI: 65,
+  RETURN: 70, RETURN0: 71, RETURN1: 72, FORLOOP: 73, FORPREP: 74,
+};
+
+// Register types in the dataflow: unset, integer, float, differs by path
+const NIL = 0;
+const INT = 1;
+const FLT = 2;
+const MIXED = 3;
+
+const OFFSET_SBX = 65535;
+const OFFSET_SJ = 16777215;
+const OFFSET_SC = 127;
+
+const opcode = (i) => i & 0x7f;
+const argA = (i) => (i >>> 7) & 0xff;
+const argK = (i) => (i >>> 15) & 1;
+const argB = (i) => (i >>> 16) & 0xff;
+const argC = (i) => (i >>> 24) & 0xff;
+const argBx = (i) => i >>> 15;
+const argSBx = (i) => argBx(i) - OFFSET_SBX;
+const argSJ = (i) => (i >>> 7) - OFFSET_SJ;
+const argSB = (i) => argB(i) - OFFSET_SC;
+const argSC = (i) => argC(i) - OFFSET_SC;
+
+const ARITH = new Map([
+  [OP.ADD, 'add'], [OP.SUB, 'sub'], [OP.MUL, 'mul'], [OP.DIV, 'div'],
+  [OP.IDIV, 'idiv'], [OP.MOD, 'mod'], [OP.BAND, 'band'], [OP.BOR, 'bor'], [OP.BXOR, 'bxor'],
+]);
+const ARITHK = new Map([
+  [OP.ADDK, 'add'], [OP.SUBK, 'sub'], [OP.MULK, 'mul'], [OP.DIVK, 'div'],
+  [OP.IDIVK, 'idiv'], [OP.MODK, 'mod'], [OP.BANDK, 'band'], [OP.BORK, 'bor'], [OP.BXORK, 'bxor'],
+]);
+const BITWISE = new Set(['band', 'bor', 'bxor']);
+
+// wasm opcodes and types
+const W = {
+  block: 0x02, loop: 0x03, if: 0x04, else: 0x05, end: 0x0b, br: 0x0c, brIf: 0x0d,
+  brTable: 0x0e, return: 0x0f, localGet: 0x20, localSet: 0x21, localTee: 0x22,
+  i32Load: 0x28, i64Load: 0x29, f64Load: 0x2b, i32Load8u: 0x2d,
+  i64Store: 0x37, f64Store: 0x39, i32Store8: 0x3a,
+  i32Const: 0x41, i64Const: 0x42, f64Const: 0x44,
+  i32Eqz: 0x45, i32Ne: 0x47, i32LtS: 0x48,
+  i64Eqz: 0x50, i64Eq: 0x51, i64Ne: 0x52, i64LtS: 0x53, i64GtS: 0x55,
+  i64LeS: 0x57, i64LeU: 0x58, i64GeS: 0x59,
+  f64Eq: 0x61, f64Lt: 0x63, f64Gt: 0x64, f64Le: 0x65, f64Ge: 0x66,
+  i32And: 0x71, i32Or: 0x72,
+  i64Add: 0x7c, i64Sub: 0x7d, i64Mul: 0x7e, i64DivS: 0x7f, i64DivU: 0x80, i64RemS: 0x81,
+  i64And: 0x83, i64Or: 0x84, i64Xor: 0x85,
+  f64Neg: 0x9a, f64Floor: 0x9c, f64Add: 0xa0, f64Sub: 0xa1, f64Mul: 0xa2, f64Div: 0xa3,
+  i64ExtendI32U: 0xad, f64ConvertI64S: 0xb9,
+};
+const T_I32 = 0x7f;
+const T_I64 = 0x7e;
+const T_F64 = 0x7c;
+const VOID = 0x40;
+
+// Locals: the three parameters, then these, then one i64 and one f64 per register
+const V_P = 0;
+const V_FUNC = 1;
+const V_NARG = 2;
+const V_PC = 3;
+const V_T0 = 4;
+const V_T1 = 5;
+const V_REGS = 6;
+
+class Declined extends Error {}
+
+function decline(reason) {
+  throw new Declined(reason);
+}
+
+function uleb(out, value) {
+  do {
+    let byte = value & 0x7f;
+    value >>>= 7;
+    if (value !== 0) byte |= 0x80;
+    out.push(byte);
+  } while (value !== 0);
+}
+
+function sleb(out, value) {
+  value = BigInt(value);
+  for (;;) {
+    const byte = Number(value & 0x7fn);
+    value >>= 7n;
+    if ((value === 0n && (byte & 0x40) === 0) || (value === -1n && (byte & 0x40) !== 0)) {
+      out.push(byte);
+      return;
+    }
+    out.push(byte | 0x80);
+  }
+}
+
+function section(out, id, body) {
+  out.push(id);
+  uleb(out, body.length);
+  for (const byte of body) out.push(byte);
+}
+
+function name(out, text) {
+  uleb(out, text.length);
+  for (let i = 0; i < text.length; i++) out.push(text.charCodeAt(i));
+}
+
+/**
+ * Read the compiler's view of the module from get_tier_layout
+ * @param {object} exports - The module's exports
+ * @returns {Int32Array|null} The layout, or null without CU_TIER=1
+ */
+export function readTierLayout(exports) {
+  if (!exports.get_tier_layout || !exports.get_buffer_ptr) return null;
+  const ptr = exports.get_buffer_ptr();
+  const count = exports.get_tier_layout(ptr, 1024);
+  if (count < L_FIELDS) return null;
+  return new Int32Array(exports.memory.buffer, ptr, count).slice();
+}
+
+/**
+ * Read the parts of a prototype the compiler uses
+ * @param {DataView} view - Over the VM's memory
+ * @param {Int32Array} layout - From readTierLayout()
+ * @param {number} p - The Proto's address
+ */
+export function readProto(view, layout, p) {
+  const sizecode = view.getInt32(p + layout[L_SIZECODE], true);
+  const sizek = view.getInt32(p + layout[L_SIZEK], true);
+  const codePtr = view.getUint32(p + layout[L_CODE], true);
+  const kPtr = view.getUint32(p + layout[L_K], true);
+  if (sizecode > MAX_CODE) decline('too long');
+  const code = new Uint32Array(sizecode);
+  for (let i = 0; i < sizecode; i++) code[i] = view.getUint32(codePtr + i * 4, true);
+  // Only numbers are of use; other constants read as null
+  const k = [];
+  for (let i = 0; i < sizek; i++) {
+    const at = kPtr + i * layout[L_TVALUE];
+    const tag = view.getUint8(at + layout[L_TT]);
+    if (tag === layout[L_VNUMINT]) k.push({ type: INT, value: view.getBigInt64(at, true) });
+    else if (tag === layout[L_VNUMFLT]) k.push({ type: FLT, value: view.getFloat64(at, true) });
+    else k.push(null);
+  }
+  return {
+    numparams: view.getUint8(p + layout[L_NUMPARAMS]),
+    isVararg: view.getUint8(p + layout[L_ISVARARG]) !== 0,
+    maxstack: view.getUint8(p + layout[L_MAXSTACK]),
+    code,
+    k,
+  };
+}
+
+/**
+ * The types of the arguments of the call at `func`: INT, FLT or null for
+ * any other type or a missing argument
+ */
+export function argTypes(view, layout, func, narg, count) {
+  const types = [];
+  for (let i = 0; i < count; i++) {
+    if (i >= narg) {
+      types.push(null);
+      continue;
+    }
+    const tag = view.getUint8(func + (1 + i) * layout[L_STACKVALUE] + layout[L_TT]);
+    types.push(tag === layout[L_VNUMINT] ? INT : tag === layout[L_VNUMFLT] ? FLT : null);
+  }
+  return types;
+}
+
+const isArith = (op) => ARITH.has(op) || ARITHK.has(op) || op === OP.ADDI;
+
+// Where control goes after the instruction at `pc`
+function successors(code, pc) {
+  const i = code[pc];
+  switch (opcode(i)) {
+    case OP.JMP: return [pc + 1 + argSJ(i)];
+    case OP.EQ: case OP.LT: case OP.LE:
+    case OP.EQI: case OP.LTI: case OP.LEI: case OP.GTI: case OP.GEI:
+      if (opcode(code[pc + 1]) !== OP.JMP) decline('condition without a jump');
+      return [pc + 2, pc + 2 + argSJ(code[pc + 1])];
+    case OP.FORPREP: return [pc + 1, pc + 2 + argBx(i)];
+    case OP.FORLOOP: return [pc + 1 - argBx(i), pc + 1];
+    case OP.RETURN: case OP.RETURN0: case OP.RETURN1: return [];
+    default:
+      // Arithmetic skips the metamethod fallback that follows it
+      if (isArith(opcode(i))) {
+        const next = opcode(code[pc + 1]);
+        if (next !== OP.MMBIN && next !== OP.MMBINI && next !== OP.MMBINK) decline('arithmetic without fallback');
+        return [pc + 2];
+      }
+      return [pc + 1];
+  }
+}
+
+// The type an arithmetic operation gives its operand types, or declines
+function arithType(op, a, b) {
+  if (a !== INT && a !== FLT) decline('operand not a number');
+  if (b !== INT && b !== FLT) decline('operand not a number');
+  if (BITWISE.has(op)) {
+    if (a !== INT || b !== INT) decline('bitwise on float');
+    return INT;
+  }
+  if (op === 'div') return FLT;
+  if (op === 'mod' && (a !== INT || b !== INT)) decline('float modulo');
+  return a === INT && b === INT ? INT : FLT;
+}
+
+function constant(proto, index) {
+  const value = proto.k[index];
+  if (!value) decline('constant not a number');
+  return value;
+}
+
+function read(types, r) {
+  const type = types[r];
+  if (type !== INT && type !== FLT) decline(`register ${r} has no single number type`);
+  return type;
+}
+
+/**
+ * Work out each register's type before each instruction from the argument
+ * types, declining any instruction the compiler does not handle
+ * @returns {Array<Uint8Array|undefined>} Types by pc; undefined where unreachable
+ */
+function inferTypes(proto, params) {
+  const { code, maxstack } = proto;
+  const states = new Array(code.length);
+  const entry = new Uint8Array(maxstack).fill(NIL);
+  params.forEach((type, r) => { entry[r] = type; });
+  states[0] = entry;
+  const pending = [0];
+  const merge = (pc, types) => {
+    if (pc < 0 || pc >= code.length) decline('jump out of the function');
+    const op = opcode(code[pc]);
+    if (op === OP.MMBIN || op === OP.MMBINI || op === OP.MMBINK) decline('jump to a fallback');
+    const state = states[pc];
+    if (!state) {
+      states[pc] = types.slice();
+      pending.push(pc);
+      return;
+    }
+    let changed = false;
+    for (let r = 0; r < maxstack; r++) {
+      if (state[r] !== types[r] && state[r] !== MIXED) {
+        state[r] = MIXED;
+        changed = true;
+      }
+    }
+    if (changed) pending.push(pc);
+  };
+  while (pending.length > 0) {
+    const pc = pending.pop();
+    const i = code[pc];
+    const op = opcode(i);
+    const types = states[pc].slice();
+    const a = argA(i);
+    switch (op) {
+      case OP.MOVE: types[a] = read(types, argB(i)); break;
+      case OP.LOADI: types[a] = INT; break;
+      case OP.LOADF: types[a] = FLT; break;
+      case OP.LOADK: types[a] = constant(proto, argBx(i)).type; break;
+      case OP.ADDI: types[a] = arithType('add', read(types, argB(i)), INT); break;
+      case OP.UNM: types[a] = read(types, argB(i)); break;
+      case OP.BNOT: types[a] = arithType('band', read(types, argB(i)), INT); break;
+      case OP.JMP: break;
+      case OP.EQ: case OP.LT: case OP.LE:
+        if (read(types, a) !== read(types, argB(i))) decline('comparing integer with float');
+        break;
+      case OP.EQI: case OP.LTI: case OP.LEI: case OP.GTI: case OP.GEI: read(types, a); break;
+      case OP.FORPREP:
+        if (read(types, a) !== INT || read(types, a + 1) !== INT || read(types, a + 2) !== INT) {
+          decline('float loop');
+        }
+        types[a + 3] = INT;
+        break;
+      case OP.FORLOOP: break;
+      case OP.RETURN:
+        if (argK(i) || argB(i) < 1 || argB(i) > 2) decline('several results');
+        if (argB(i) === 2) read(types, a);
+        break;
+      case OP.RETURN0: break;
+      case OP.RETURN1: read(types, a); break;
+      default:
+        if (ARITH.has(op)) {
+          types[a] = arithType(ARITH.get(op), read(types, argB(i)), read(types, argC(i)));
+        } else if (ARITHK.has(op)) {
+          types[a] = arithType(ARITHK.get(op), read(types, argB(i)), constant(proto, argC(i)).type);
+        } else {
+          decline(`opcode ${op}`);
+        }
+    }
+    for (const next of successors(code, pc)) merge(next, types);
+  }
+  return states;
+}
+
+/**
+ * Translate a prototype into a wasm module exporting `f(p, func, narg)`,
+ * for arguments of the given types
+ * @param {object} proto - From readProto()
+ * @param {Array<number|null>} params - From argTypes()
+ * @param {object} target
+ * @param {Int32Array} target.layout - From readTierLayout()
+ * @param {number} target.proto - The prototype's address
+ * @param {number} target.stamp - The value its stamp field must hold
+ * @param {number} [target.interrupt] - Address of the interrupt word
+ * @returns {Uint8Array} The module's bytes
+ * @throws {Error} With `declined` set when the function cannot be compiled
+ */
+export function compileProto(proto, params, { layout, proto: protoPtr, stamp, interrupt = 0 }) {
+  if (proto.isVararg) decline('vararg');
+  if (params.some((type) => type !== INT && type !== FLT)) decline('argument not a number');
+  const { code, maxstack } = proto;
+  const states = inferTypes(proto, params);
+
+  // Blocks start at pc 0 and wherever a jump, condition or loop
+  // instruction leads; unreachable instructions are left out
+  const starts = new Set([0]);
+  for (let pc = 0; pc < code.length; pc++) {
+    if (!states[pc] || isArith(opcode(code[pc]))) continue;
+    const next = successors(code, pc);
+    if (next.length !== 1 || next[0] !== pc + 1) for (const target of next) starts.add(target);
+  }
+  const blocks = [...starts].sort((x, y) => x - y);
+  const blockOf = new Map(blocks.map((pc, index) => [pc, index]));
+
+  const sv = layout[L_STACKVALUE];
+  const tt = layout[L_TT];
+  const vint = layout[L_VNUMINT];
+  const vflt = layout[L_VNUMFLT];
+  const li = (r) => V_REGS + r;
+  const lf = (r) => V_REGS + maxstack + r;
+
+  const body = [];
+  const emit = (...bytes) => { for (const byte of bytes) body.push(byte); };
+  const i32 = (value) => { emit(W.i32Const); sleb(body, value | 0); };
+  const i64 = (value) => { emit(W.i64Const); sleb(body, value); };
+  const f64 = (value) => {
+    const bytes = new Uint8Array(8);
+    new DataView(bytes.buffer).setFloat64(0, value, true);
+    emit(W.f64Const, ...bytes);
+  };
+  const mem = (op, align, offset) => { emit(op); uleb(body, align); uleb(body, offset); };
+  const get = (index) => { emit(W.localGet); uleb(body, index); };
+  const set = (index) => { emit(W.localSet); uleb(body, index); };
+  const bail = () => { i32(-1); emit(W.return); };
+
+  // Push register r as `as` (INT or FLT), given its type `type`
+  const push = (r, type, as) => {
+    get(type === INT ? li(r) : lf(r));
+    if (type === INT && as === FLT) emit(W.f64ConvertI64S);
+  };
+  const pushK = (value, as) => {
+    if (as === INT) i64(value.value);
+    else f64(value.type === INT ? Number(value.value) : value.value);
+  };
+  const store = (r, type) => set(type === INT ? li(r) : lf(r));
+
+  // luaV_idiv and luaV_mod of V_T0 by V_T1 into V_T0
+  const intDivision = (op) => {
+    get(V_T1); i64(1); emit(W.i64Add); i64(1); emit(W.i64LeU, W.if, VOID);
+    // By 0 the interpreter raises the error; by -1 avoid overflowing
+    // with the smallest integer
+    get(V_T1); emit(W.i64Eqz, W.if, VOID); bail(); emit(W.end);
+    if (op === 'idiv') { i64(0); get(V_T0); emit(W.i64Sub); } else i64(0);
+    set(V_T0);
+    emit(W.else);
+    if (op === 'idiv') {
+      // Truncated quotient, one less when the signs differ and it is inexact
+      get(V_T0); get(V_T1); emit(W.i64DivS);
+      get(V_T0); get(V_T1); emit(W.i64Xor); i64(0); emit(W.i64LtS);
+      get(V_T0); get(V_T1); emit(W.i64RemS); i64(0); emit(W.i64Ne);
+      emit(W.i32And, W.i64ExtendI32U, W.i64Sub);
+      set(V_T0);
+    } else {
+      // Remainder with the sign of the divisor
+      get(V_T0); get(V_T1); emit(W.i64RemS); set(V_T0);
+      get(V_T0); i64(0); emit(W.i64Ne);
+      get(V_T0); get(V_T1); emit(W.i64Xor); i64(0); emit(W.i64LtS);
+      emit(W.i32And, W.if, VOID); get(V_T0); get(V_T1); emit(W.i64Add); set(V_T0); emit(W.end);
+    }
+    emit(W.end);
+  };
+
+  const arith = (op, type, loadA, loadB, dest) => {
+    if (type === INT && (op === 'idiv' || op === 'mod')) {
+      loadA(INT); set(V_T0);
+      loadB(INT); set(V_T1);
+      intDivision(op);
+      get(V_T0);
+      store(dest, INT);
+      return;
+    }
+    loadA(type);
+    loadB(type);
+    if (type === INT) {
+      emit({ add: W.i64Add, sub: W.i64Sub, mul: W.i64Mul, band: W.i64And, bor: W.i64Or, bxor: W.i64Xor }[op]);
+    } else {
+      emit({ add: W.f64Add, sub: W.f64Sub, mul: W.f64Mul, div: W.f64Div, idiv: W.f64Div }[op]);
+      if (op === 'idiv') emit(W.f64Floor);
+    }
+    store(dest, type);
+  };
+
+  // Guards: the prototype and stamp this code was made for, then the
+  // argument count and types
+  get(V_P); i32(protoPtr); emit(W.i32Ne);
+  get(V_P); mem(W.i32Load, 2, layout[L_STAMP]); i32(stamp); emit(W.i32Ne);
+  emit(W.i32Or, W.if, VOID); i32(-2); emit(W.return, W.end);
+  get(V_NARG); i32(params.length); emit(W.i32LtS, W.if, VOID); bail(); emit(W.end);
+  params.forEach((type, r) => {
+    const at = (1 + r) * sv;
+    get(V_FUNC); mem(W.i32Load8u, 0, at + tt); i32(type === INT ? vint : vflt); emit(W.i32Ne);
+    emit(W.if, VOID); bail(); emit(W.end);
+    get(V_FUNC);
+    if (type === INT) mem(W.i64Load, 3, at); else mem(W.f64Load, 3, at);
+    store(r, type);
+  });
+
+  emit(W.loop, VOID);
+  for (let b = 0; b < blocks.length; b++) emit(W.block, VOID);
+  get(V_PC);
+  emit(W.brTable);
+  uleb(body, blocks.length);
+  for (let b = 0; b < blocks.length; b++) uleb(body, b);
+  uleb(body, 0);
+
+  for (let b = 0; b < blocks.length; b++) {
+    emit(W.end);
+    const toLoop = blocks.length - 1 - b;
+    // Continue at block `target` (from inside `depth` ifs)
+    const goTo = (target, depth = 0) => {
+      const index = blockOf.get(target);
+      if (index <= b && interrupt) {
+        i32(interrupt); mem(W.i32Load, 2, 0);
+        emit(W.if, VOID); bail(); emit(W.end);
+      }
+      i32(index); set(V_PC);
+      emit(W.br); uleb(body, toLoop + depth);
+    };
+    const end = b + 1 < blocks.length ? blocks[b + 1] : code.length;
+    for (let pc = blocks[b]; pc < end; pc++) {
+      const types = states[pc];
+      if (!types) continue;
+      const i = code[pc];
+      const op = opcode(i);
+      const a = argA(i);
+      const fallsTo = (target) => { if (target !== end) goTo(target); };
+      switch (op) {
+        case OP.MOVE: {
+          const type = types[argB(i)];
+          push(argB(i), type, type); store(a, type);
+          break;
+        }
+        case OP.LOADI: i64(argSBx(i)); store(a, INT); break;
+        case OP.LOADF: f64(argSBx(i)); store(a, FLT); break;
+        case OP.LOADK: {
+          const value = constant(proto, argBx(i));
+          pushK(value, value.type); store(a, value.type);
+          break;
+        }
+        case OP.ADDI: {
+          const type = types[argB(i)];
+          arith('add', type, (as) => push(argB(i), type, as), (as) => pushK({ type: INT, value: argSC(i) }, as), a);
+          pc++; // the fallback
+          break;
+        }
+        case OP.UNM: {
+          const type = types[argB(i)];
+          if (type === INT) { i64(0); push(argB(i), INT, INT); emit(W.i64Sub); } else { push(argB(i), FLT, FLT); emit(W.f64Neg); }
+          store(a, type);
+          break;
+        }
+        case OP.BNOT: push(argB(i), INT, INT); i64(-1); emit(W.i64Xor); store(a, INT); break;
+        case OP.JMP: goTo(pc + 1 + argSJ(i)); break;
+        case OP.EQ: case OP.LT: case OP.LE:
+        case OP.EQI: case OP.LTI: case OP.LEI: case OP.GTI: case OP.GEI: {
+          const type = types[a];
+          push(a, type, type);
+          if (op === OP.EQ || op === OP.LT || op === OP.LE) push(argB(i), type, type);
+          else pushK({ type: INT, value: argSB(i) }, type);
+          const cmp = {
+            [OP.EQ]: [W.i64Eq, W.f64Eq], [OP.EQI]: [W.i64Eq, W.f64Eq],
+            [OP.LT]: [W.i64LtS, W.f64Lt], [OP.LTI]: [W.i64LtS, W.f64Lt],
+            [OP.LE]: [W.i64LeS, W.f64Le], [OP.LEI]: [W.i64LeS, W.f64Le],
+            [OP.GTI]: [W.i64GtS, W.f64Gt], [OP.GEI]: [W.i64GeS, W.f64Ge],
+          }[op];
+          emit(cmp[type === INT ? 0 : 1]);
+          // When the condition differs from k, skip the jump that follows
+          if (argK(i)) emit(W.i32Eqz);
+          emit(W.if, VOID); goTo(pc + 2, 1); emit(W.end);
+          fallsTo(pc + 2 + argSJ(code[pc + 1]));
+          pc++; // the jump
+          break;
+        }
+        case OP.FORPREP: {
+          // forprep in lvm.c: a zero step is an error, an empty range
+          // skips the loop, otherwise the limit becomes an iteration count
+          const init = li(a);
+          const limit = li(a + 1);
+          const step = li(a + 2);
+          get(step); emit(W.i64Eqz, W.if, VOID); bail(); emit(W.end);
+          get(init); store(a + 3, INT);
+          get(step); i64(0); emit(W.i64GtS);
+          emit(W.if, VOID);
+          get(init); get(limit); emit(W.i64GtS, W.if, VOID); goTo(pc + 2 + argBx(i), 2); emit(W.end);
+          get(limit); get(init); emit(W.i64Sub); get(step); emit(W.i64DivU); set(limit);
+          emit(W.else);
+          get(init); get(limit); emit(W.i64LtS, W.if, VOID); goTo(pc + 2 + argBx(i), 2); emit(W.end);
+          get(init); get(limit); emit(W.i64Sub);
+          i64(0); get(step); i64(1); emit(W.i64Add, W.i64Sub); i64(1); emit(W.i64Add);
+          emit(W.i64DivU); set(limit);
+          emit(W.end);
+          fallsTo(pc + 1);
+          break;
+        }
+        case OP.FORLOOP: {
+          const count = li(a + 1);
+          get(count); emit(W.i64Eqz, W.i32Eqz, W.if, VOID);
+          get(count); i64(1); emit(W.i64Sub); set(count);
+          get(li(a)); get(li(a + 2)); emit(W.i64Add);
+          emit(W.localTee); uleb(body, li(a)); set(li(a + 3));
+          goTo(pc + 1 - argBx(i), 1);
+          emit(W.end);
+          fallsTo(pc + 1);
+          break;
+        }
+        case OP.RETURN0: i32(0); emit(W.return); break;
+        case OP.RETURN: case OP.RETURN1:
+          if (op === OP.RETURN && argB(i) === 1) {
+            i32(0); emit(W.return);
+            break;
+          }
+          get(V_FUNC); push(a, types[a], types[a]);
+          if (types[a] === INT) mem(W.i64Store, 3, 0); else mem(W.f64Store, 3, 0);
+          get(V_FUNC); i32(types[a] === INT ? vint : vflt); mem(W.i32Store8, 0, tt);
+          i32(1); emit(W.return);
+          break;
+        default: {
+          const k = ARITHK.has(op);
+          const name = k ? ARITHK.get(op) : ARITH.get(op);
+          const tb = types[argB(i)];
+          const tc = k ? constant(proto, argC(i)).type : types[argC(i)];
+          const type = arithType(name, tb, tc);
+          arith(name, type,
+            (as) => push(argB(i), tb, as),
+            (as) => (k ? pushK(constant(proto, argC(i)), as) : push(argC(i), tc, as)),
+            a);
+          pc++; // the fallback
+        }
+      }
+    }
+  }
+  emit(W.end); // loop
+  i32(-1);
+  emit(W.end);
+
+  const out = [0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00];
+  section(out, 1, [1, 0x60, 3, T_I32, T_I32, T_I32, 1, T_I32]);
+  const imports = [1];
+  name(imports, 'env');
+  name(imports, 'memory');
+  imports.push(0x02, 0x00, 0x00); // memory, no maximum, at least 0 pages
+  section(out, 2, imports);
+  section(out, 3, [1, 0]);
+  const exports = [1];
+  name(exports, 'f');
+  exports.push(0x00, 0);
+  section(out, 7, exports);
+  const fn = [];
+  uleb(fn, 3);
+  fn.push(1, T_I32);
+  uleb(fn, 2 + maxstack); fn.push(T_I64);
+  uleb(fn, maxstack); fn.push(T_F64);
+  fn.push(...body);
+  const codeSection = [1];
+  uleb(codeSection, fn.length);
+  codeSection.push(...fn);
+  section(out, 10, codeSection);
+  return Uint8Array.from(out);
+}
+
+/**
+ * The host side of CU_TIER=1: compiles the functions ltier.c offers into
+ * the module's slots and frees the slots again
+ */
+export class Tier {
+  /**
+   * @param {object} exports - The module's exports
+   * @param {Int32Array} layout - From readTierLayout()
+   */
+  constructor(exports, layout) {
+    this.exports = exports;
+    this.layout = layout;
+    this.table = exports.__indirect_function_table;
+    this.interrupt = exports.get_interrupt_flag_ptr?.() ?? 0;
+    // Each slot's entry as the module left it, put back on release
+    this.stubs = [];
+    for (let s = 0; s < layout[L_SLOTS]; s++) this.stubs.push(this.table.get(layout[L_FIELDS + s]));
+    this.free = [];
+    for (let s = layout[L_SLOTS] - 1; s >= 0; s--) this.free.push(s);
+    this.owners = new Map(); // slot -> prototype address
+    this.stamp = (Math.random() * 0x7fffffff) | 1;
+    this.compiled = 0;
+    this.declined = 0;
+    this.released = 0;
+  }
+
+  /**
+   * Whether `exports` is a module this can compile for: a CU_TIER=1 build
+   * with 32-bit pointers, 64-bit numbers and unshared memory
+   * @returns {Int32Array|null} Its layout
+   */
+  static layoutFor(exports) {
+    const layout = readTierLayout(exports);
+    if (!layout || !exports.__indirect_function_table) return null;
+    if (layout[L_INTEGER] !== 8 || layout[L_NUMBER] !== 8) return null;
+    if (typeof SharedArrayBuffer !== 'undefined' && exports.memory.buffer instanceof SharedArrayBuffer) return null;
+    return layout;
+  }
+
+  /**
+   * js_tier_compile: compile prototype `p` for the call at `func`
+   * @returns {number} 1 + the slot now holding its code, or 0 to decline
+   */
+  compile(p, func, narg) {
+    if (this.free.length === 0) {
+      this.declined++;
+      return 0;
+    }
+    const { layout } = this;
+    const memory = this.exports.memory;
+    try {
+      const view = new DataView(memory.buffer);
+      const proto = readProto(view, layout, p);
+      const params = argTypes(view, layout, func, narg, proto.numparams);
+      this.stamp = (this.stamp + 2) | 0;
+      const bytes = compileProto(proto, params, { layout, proto: p, stamp: this.stamp, interrupt: this.interrupt });
+      const module = new WebAssembly.Module(bytes);
+      const { f } = new WebAssembly.Instance(module, { env: { memory } }).exports;
+      const slot = this.free.pop();
+      this.table.set(layout[L_FIELDS + slot], f);
+      view.setInt32(p + layout[L_STAMP], this.stamp, true);
+      this.owners.set(slot, p);
+      this.compiled++;
+      return slot + 1;
+    } catch (error) {
+      // A failure here must not reach the VM: the function stays interpreted
+      if (!(error instanceof Declined)) log('warn', 'Tier compile failed:', error);
+      this.declined++;
+      return 0;
+    }
+  }
+
+  /** js_tier_release: slot `slot` - 1 no longer runs `p` */
+  release(p, slot) {
+    const s = slot - 1;
+    if (this.owners.get(s) !== p) return;
+    this.table.set(this.layout[L_FIELDS + s], this.stubs[s]);
+    this.owners.delete(s);
+    this.free.push(s);
+    this.released++;
+  }
+
+  /** @returns {{compiled: number, declined: number, released: number, active: number}} */
+  stats() {
+    return { compiled: this.compiled, declined: this.declined, released: this.released, active: this.owners.size };
+  }
+}
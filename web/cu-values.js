@@ -0,0 +1,743 @@
+/**
+ * Cu Value Encoding
+ *
+ * Reads both value encodings written by src/serializer.zig and writes the
+ * one selected with set_value_encoding. v1 is fixed width: a tag, then an
+ * i64, f64, u32 table id or u32 length. v2 uses varints and inline small
+ * integers and short strings, with tags v1 never uses, so the first byte of
+ * a value tells which encoding it is in.
+ */
+
+const NIL = 0x00;
+const BOOLEAN = 0x01;
+const INTEGER = 0x02;
+const FLOAT = 0x03;
+const STRING = 0x04;
+const FUNCTION_BYTECODE = 0x05;
+const FUNCTION_REF = 0x06;
+const TABLE_REF = 0x07;
+
+export const V2_FALSE = 0x08;
+export const V2_TRUE = 0x09;
+export const V2_INTEGER = 0x0a;
+export const V2_FLOAT = 0x0b;
+export const V2_STRING = 0x0c;
+export const V2_TABLE_REF = 0x0d;
+export const TABLE_INLINE = 0x0e; // set_inline_table_limits, either encoding
+export const TYPED_ARRAY = 0x0f; // either encoding
+// A Lua function with its upvalues (src/function_serializer.zig)
+export const CLOSURE = 0x10;
+// A bigint from the bigint library: sign, then the magnitude as u32 words
+export const BIGINT = 0x11;
+const BIGINT_HEADER = 8;
+const UPVALUE_VALUE = 1;
+const UPVALUE_CLOSURE = 3;
+const UPVALUE_SHARED = 4;
+// Blob bytes as stored, and the handle Lua reads in their place
+export const BLOB = 0xe0;
+export const BLOB_HANDLE = 0xe1;
+const BLOB_HEADER = 5;
+
+// Element kinds of typed array values, by kind byte
+const TYPED_ARRAY_KINDS = [null, Uint8Array, BigInt64Array, Float64Array];
+const TYPED_ARRAY_HEADER = 8;
+
+/**
+ * Kind byte for a typed array stored packed, or 0 if it is not one
+ * (Uint8Array, including Buffer, BigInt64Array and Float64Array are)
+ */
+export function typedArrayKind(value) {
+  if (value instanceof Uint8Array) return 1;
+  if (value instanceof BigInt64Array) return 2;
+  if (value instanceof Float64Array) return 3;
+  return 0;
+}
+export const V2_SHORT_STRING = 0x80; // | length, up to 63 bytes
+export const V2_SMALL_INT = 0xc0; // | value, 0..31
+
+const SHORT_STRING_MAX = 63;
+const SMALL_INT_MAX = 31;
+
+const textEncoder = new TextEncoder();
+const textDecoder = new TextDecoder();
+
+// Unsigned LEB128. Up to 49 bits are read as a number, longer ones as a BigInt.
+function readVarint(buffer, offset, end) {
+  let value = 0;
+  let scale = 1;
+  for (let i = offset; i < end && i < offset + 7; i++) {
+    const byte = buffer[i];
+    value += (byte & 0x7f) * scale;
+    if (byte < 0x80) return { value, next: i + 1 };
+    scale *= 0x80;
+  }
+  return readBigVarint(buffer, offset, end);
+}
+
+function readBigVarint(buffer, offset, end) {
+  let value = 0n;
+  let shift = 0n;
+  for (let i = offset; i < end && shift < 64n; i++, shift += 7n) {
+    const byte = buffer[i];
+    value |= BigInt(byte & 0x7f) << shift;
+    if (byte < 0x80) return { value, next: i + 1 };
+  }
+  return null;
+}
+
+function unzigzag(value) {
+  if (typeof value === 'number') {
+    return value % 2 === 0 ? value / 2 : -(value + 1) / 2;
+  }
+  const decoded = BigInt.asIntN(64, (value >> 1n) ^ -(value & 1n));
+  const number = Number(decoded);
+  return Number.isSafeInteger(number) ? number : decoded;
+}
+
+function varintBytes(value) {
+  const bytes = [];
+  if (typeof value === 'bigint') {
+    while (value >= 0x80n) {
+      bytes.push(Number(value & 0x7fn) | 0x80);
+      value >>= 7n;
+    }
+    bytes.push(Number(value));
+    return bytes;
+  }
+  while (value >= 0x80) {
+    bytes.push((value % 0x80) | 0x80);
+    value = Math.floor(value / 0x80);
+  }
+  bytes.push(value);
+  return bytes;
+}
+
+function zigzag(value) {
+  if (Math.abs(value) < 2 ** 52) return value >= 0 ? value * 2 : -value * 2 - 1;
+  const big = BigInt(value);
+  return BigInt.asUintN(64, (big << 1n) ^ (big >> 63n));
+}
+
+/**
+ * Decode the value at `offset`
+ * @param {Uint8Array} buffer
+ * @returns {{value: *, tableId?: number, entries?: Array, bytesRead: number}|null}
+ *   `tableId` is set for table references and `entries` ([key, decoded]
+ *   pairs) for inline tables; null for functions and malformed input.
+ *   Integers outside the safe range come back as BigInt, typed arrays and
+ *   blobs (as an ArrayBuffer) as copies. Lua bigints come back as BigInt
+ *   with `bigint` set, to keep them apart from integers.
+ */
+export function decodeValue(buffer, offset = 0, end = buffer.length) {
+  if (offset >= end) return null;
+  const tag = buffer[offset];
+  const view = new DataView(buffer.buffer, buffer.byteOffset, buffer.byteLength);
+
+  if (tag >= V2_SMALL_INT && tag <= (V2_SMALL_INT | SMALL_INT_MAX)) {
+    return { value: tag & 0x1f, bytesRead: 1 };
+  }
+  if (tag >= V2_SHORT_STRING && tag <= (V2_SHORT_STRING | SHORT_STRING_MAX)) {
+    const length = tag & 0x3f;
+    if (offset + 1 + length > end) return null;
+    return { value: textDecoder.decode(buffer.subarray(offset + 1, offset + 1 + length)), bytesRead: 1 + length };
+  }
+
+  switch (tag) {
+    case NIL:
+      return { value: null, bytesRead: 1 };
+
+    case BOOLEAN:
+      if (offset + 2 > end) return null;
+      return { value: buffer[offset + 1] !== 0, bytesRead: 2 };
+
+    case V2_FALSE:
+    case V2_TRUE:
+      return { value: tag === V2_TRUE, bytesRead: 1 };
+
+    case INTEGER: {
+      if (offset + 9 > end) return null;
+      const value = view.getBigInt64(offset + 1, true);
+      const number = Number(value);
+      return { value: Number.isSafeInteger(number) ? number : value, bytesRead: 9 };
+    }
+
+    case V2_INTEGER: {
+      const varint = readVarint(buffer, offset + 1, end);
+      if (!varint) return null;
+      return { value: unzigzag(varint.value), bytesRead: varint.next - offset };
+    }
+
+    case FLOAT:
+    case V2_FLOAT:
+      if (offset + 9 > end) return null;
+      return { value: view.getFloat64(offset + 1, true), bytesRead: 9 };
+
+    case STRING: {
+      if (offset + 5 > end) return null;
+      const length = view.getUint32(offset + 1, true);
+      if (offset + 5 + length > end) return null;
+      return { value: textDecoder.decode(buffer.subarray(offset + 5, offset + 5 + length)), bytesRead: 5 + length };
+    }
+
+    case V2_STRING: {
+      const varint = readVarint(buffer, offset + 1, end);
+      if (!varint || typeof varint.value !== 'number' || varint.next + varint.value > end) return null;
+      return {
+        value: textDecoder.decode(buffer.subarray(varint.next, varint.next + varint.value)),
+        bytesRead: varint.next + varint.value - offset,
+      };
+    }
+
+    case TABLE_REF:
+      if (offset + 5 > end) return null;
+      return { value: null, tableId: view.getUint32(offset + 1, true), bytesRead: 5 };
+
+    case V2_TABLE_REF: {
+      const varint = readVarint(buffer, offset + 1, end);
+      if (!varint || typeof varint.value !== 'number') return null;
+      return { value: null, tableId: varint.value, bytesRead: varint.next - offset };
+    }
+
+    case TABLE_INLINE: {
+      const count = readVarint(buffer, offset + 1, end);
+      if (!count || typeof count.value !== 'number') return null;
+      const entries = [];
+      let next = count.next;
+      for (let i = 0; i < count.value; i++) {
+        const key = decodeValue(buffer, next, end);
+        if (!key || key.tableId !== undefined || key.entries !== undefined) return null;
+        const value = decodeValue(buffer, next + key.bytesRead, end);
+        if (!value) return null;
+        entries.push([key.value, value]);
+        next += key.bytesRead + value.bytesRead;
+      }
+      return { value: null, entries, bytesRead: next - offset };
+    }
+
+    case TYPED_ARRAY: {
+      const Kind = TYPED_ARRAY_KINDS[buffer[offset + 1]];
+      if (!Kind || offset + TYPED_ARRAY_HEADER > end) return null;
+      const count = view.getUint32(offset + 4, true);
+      const start = offset + TYPED_ARRAY_HEADER;
+      const length = count * Kind.BYTES_PER_ELEMENT;
+      if (start + length > end) return null;
+      // Copied out, since the elements need not be aligned in `buffer`
+      return { value: new Kind(buffer.slice(start, start + length).buffer), bytesRead: TYPED_ARRAY_HEADER + length };
+    }
+
+    case BIGINT: {
+      if (offset + BIGINT_HEADER > end || buffer[offset + 1] > 1) return null;
+      const count = view.getUint32(offset + 4, true);
+      const start = offset + BIGINT_HEADER;
+      if (start + count * 4 > end) return null;
+      // Through hex, which is linear in the number of words
+      let hex = '0x0';
+      for (let i = start + count * 4 - 4; i >= start; i -= 4) {
+        hex += view.getUint32(i, true).toString(16).padStart(8, '0');
+      }
+      const magnitude = BigInt(hex);
+      return { value: buffer[offset + 1] ? -magnitude : magnitude, bigint: true, bytesRead: BIGINT_HEADER + count * 4 };
+    }
+
+    case BLOB: {
+      if (offset + BLOB_HEADER > end) return null;
+      const length = view.getUint32(offset + 1, true);
+      const start = offset + BLOB_HEADER;
+      if (start + length > end) return null;
+      return { value: buffer.buffer.slice(buffer.byteOffset + start, buffer.byteOffset + start + length), bytesRead: BLOB_HEADER + length };
+    }
+
+    case FUNCTION_BYTECODE:
+      if (offset + 5 > end) return null;
+      return { value: null, bytesRead: 5 + view.getUint32(offset + 1, true) };
+
+    case FUNCTION_REF:
+      return { value: null, bytesRead: 3 };
+
+    case CLOSURE: {
+      // Only the upvalue values are decoded, for the tables they refer to
+      if (offset + 10 > end) return null;
+      const closureEnd = offset + 5 + view.getUint32(offset + 1, true);
+      if (closureEnd > end || buffer[offset + 5] !== FUNCTION_BYTECODE) return null;
+      let next = offset + 10 + view.getUint32(offset + 6, true);
+      if (next >= closureEnd) return null;
+      const count = buffer[next++];
+      const upvalues = [];
+      for (let i = 0; i < count; i++) {
+        const kind = buffer[next++];
+        if (kind === UPVALUE_VALUE) {
+          const value = decodeValue(buffer, next, closureEnd);
+          if (!value) return null;
+          upvalues.push(value);
+          next += value.bytesRead;
+        } else if (kind === UPVALUE_CLOSURE) {
+          next += 1;
+        } else if (kind === UPVALUE_SHARED) {
+          next += 2;
+        }
+      }
+      return { value: null, upvalues, bytesRead: closureEnd - offset };
+    }
+
+    default:
+      return null;
+  }
+}
+
+/**
+ * The bytes of the string value at `offset`, as a view into `buffer`
+ * rather than decoded text
+ * @param {Uint8Array} buffer
+ * @returns {{bytes: Uint8Array, bytesRead: number}|null} null if the value
+ *   is not a string or is cut short
+ */
+export function stringBytes(buffer, offset = 0, end = buffer.length) {
+  if (offset >= end) return null;
+  const tag = buffer[offset];
+  let start;
+  let length;
+  if (tag >= V2_SHORT_STRING && tag <= (V2_SHORT_STRING | SHORT_STRING_MAX)) {
+    start = offset + 1;
+    length = tag & 0x3f;
+  } else if (tag === STRING) {
+    if (offset + 5 > end) return null;
+    start = offset + 5;
+    length = new DataView(buffer.buffer, buffer.byteOffset, buffer.byteLength).getUint32(offset + 1, true);
+  } else if (tag === V2_STRING) {
+    const varint = readVarint(buffer, offset + 1, end);
+    if (!varint || typeof varint.value !== 'number') return null;
+    start = varint.next;
+    length = varint.value;
+  } else {
+    return null;
+  }
+  if (start + length > end) return null;
+  return { bytes: buffer.subarray(start, start + length), bytesRead: start + length - offset };
+}
+
+/**
+ * Encode null, a boolean, a number or a string
+ * @param {boolean} compact - Write v2 instead of v1
+ * @returns {Uint8Array}
+ */
+export function encodeValue(value, compact) {
+  if (value === null || value === undefined) {
+    return new Uint8Array([NIL]);
+  }
+
+  if (typeof value === 'boolean') {
+    if (compact) return new Uint8Array([value ? V2_TRUE : V2_FALSE]);
+    return new Uint8Array([BOOLEAN, value ? 1 : 0]);
+  }
+
+  if (typeof value === 'number') {
+    if (compact && Number.isSafeInteger(value)) {
+      if (value >= 0 && value <= SMALL_INT_MAX) return new Uint8Array([V2_SMALL_INT | value]);
+      return new Uint8Array([V2_INTEGER, ...varintBytes(zigzag(value))]);
+    }
+    const bytes = new Uint8Array(9);
+    const view = new DataView(bytes.buffer);
+    if (Number.isSafeInteger(value)) {
+      bytes[0] = INTEGER;
+      view.setUint32(1, value >>> 0, true);
+      view.setInt32(5, Math.floor(value / 2 ** 32), true);
+    } else {
+      bytes[0] = compact ? V2_FLOAT : FLOAT;
+      view.setFloat64(1, value, true);
+    }
+    return bytes;
+  }
+
+  const text = textEncoder.encode(String(value));
+  let header;
+  if (!compact) {
+    header = [STRING, text.length & 0xff, (text.length >> 8) & 0xff, (text.length >> 16) & 0xff, text.length >>> 24];
+  } else if (text.length <= SHORT_STRING_MAX) {
+    header = [V2_SHORT_STRING | text.length];
+  } else {
+    header = [V2_STRING, ...varintBytes(text.length)];
+  }
+  const bytes = new Uint8Array(header.length + text.length);
+  bytes.set(header);
+  bytes.set(text, header.length);
+  return bytes;
+}
+
+/**
+ * Encode raw bytes, such as a binary chunk, as a Lua string. Strings from
+ * encodeValue() are UTF-8; these are read byte for byte.
+ * @param {Uint8Array} bytes
+ * @returns {Uint8Array}
+ */
+export function encodeBytes(bytes) {
+  const out = new Uint8Array(5 + bytes.length);
+  out[0] = STRING;
+  new DataView(out.buffer).setUint32(1, bytes.length, true);
+  out.set(bytes, 5);
+  return out;
+}
+
+/**
+ * Encode a record of numbers under string keys as an inline table, in v1.
+ * A bigint is written as a Lua integer (i64), a number as a float.
+ * @param {Array<[string, number|bigint]>} fields
+ * @returns {Uint8Array}
+ */
+export function encodeRecord(fields) {
+  const names = fields.map(([name]) => textEncoder.encode(name));
+  const count = varintBytes(fields.length);
+  let length = 1 + count.length;
+  for (const name of names) length += 5 + name.length + 9;
+  const bytes = new Uint8Array(length);
+  const view = new DataView(bytes.buffer);
+  bytes[0] = TABLE_INLINE;
+  bytes.set(count, 1);
+  let offset = 1 + count.length;
+  for (let i = 0; i < fields.length; i++) {
+    bytes[offset] = STRING;
+    view.setUint32(offset + 1, names[i].length, true);
+    bytes.set(names[i], offset + 5);
+    offset += 5 + names[i].length;
+    const value = fields[i][1];
+    if (typeof value === 'bigint') {
+      bytes[offset] = INTEGER;
+      view.setBigInt64(offset + 1, value, true);
+    } else {
+      bytes[offset] = FLOAT;
+      view.setFloat64(offset + 1, value, true);
+    }
+    offset += 9;
+  }
+  return bytes;
+}
+
+/**
+ * Encode a Uint8Array, BigInt64Array or Float64Array as one packed value,
+ * in its own buffer (ValueWriter.typedArray() shares the writer's chunks)
+ * @returns {Uint8Array}
+ */
+export function encodeTypedArray(array) {
+  const bytes = new Uint8Array(TYPED_ARRAY_HEADER + array.byteLength);
+  bytes[0] = TYPED_ARRAY;
+  bytes[1] = typedArrayKind(array);
+  new DataView(bytes.buffer).setUint32(4, array.length, true);
+  bytes.set(new Uint8Array(array.buffer, array.byteOffset, array.byteLength), TYPED_ARRAY_HEADER);
+  return bytes;
+}
+
+/**
+ * Encode a reference to external table `tableId`
+ * @param {boolean} compact - Write v2 instead of v1
+ * @returns {Uint8Array}
+ */
+export function encodeTableRef(tableId, compact) {
+  if (compact) return new Uint8Array([V2_TABLE_REF, ...varintBytes(tableId)]);
+  const bytes = new Uint8Array(5);
+  bytes[0] = TABLE_REF;
+  new DataView(bytes.buffer).setUint32(1, tableId, true);
+  return bytes;
+}
+
+/**
+ * Call `visit` with the ID of each external table the value at `offset`
+ * refers to, including references inside inline tables. Other values are
+ * skipped by their tag without being decoded.
+ * @param {Uint8Array} buffer
+ * @param {function(number): void} visit
+ */
+export function forEachTableRef(buffer, visit, offset = 0, end = buffer.length) {
+  const tag = buffer[offset];
+  if (tag === TABLE_REF || tag === V2_TABLE_REF || tag === TABLE_INLINE || tag === CLOSURE) {
+    visitTableRefs(decodeValue(buffer, offset, end), visit);
+  }
+}
+
+function visitTableRefs(decoded, visit) {
+  if (!decoded) return;
+  if (decoded.tableId !== undefined) {
+    visit(decoded.tableId);
+  } else if (decoded.entries) {
+    for (const [, value] of decoded.entries) visitTableRefs(value, visit);
+  } else if (decoded.upvalues) {
+    for (const value of decoded.upvalues) visitTableRefs(value, visit);
+  }
+}
+
+/**
+ * Copy of the value at `offset` with each external table ID it refers to,
+ * including inside inline tables, replaced by `remap(id)`. References keep
+ * their encoding; the rest of the value is copied byte for byte.
+ * @param {Uint8Array} buffer
+ * @param {function(number): number} remap
+ * @returns {Uint8Array}
+ */
+export function remapTableRefs(buffer, remap, offset = 0, end = buffer.length) {
+  const parts = [];
+  remapInto(parts, buffer, remap, offset, end);
+  if (parts.length === 1) return parts[0].slice();
+  const out = new Uint8Array(parts.reduce((sum, part) => sum + part.length, 0));
+  let at = 0;
+  for (const part of parts) {
+    out.set(part, at);
+    at += part.length;
+  }
+  return out;
+}
+
+function remapInto(parts, buffer, remap, offset, end) {
+  const tag = buffer[offset];
+  const decoded = decodeValue(buffer, offset, end);
+  if (!decoded) throw new Error('Value is corrupt');
+  if (decoded.tableId !== undefined) {
+    parts.push(encodeTableRef(remap(decoded.tableId), tag === V2_TABLE_REF));
+  } else if (tag === TABLE_INLINE) {
+    const count = readVarint(buffer, offset + 1, end);
+    parts.push(buffer.subarray(offset, count.next));
+    let next = count.next;
+    for (let i = 0; i < count.value; i++) {
+      const key = decodeValue(buffer, next, end);
+      parts.push(buffer.subarray(next, next + key.bytesRead));
+      const value = decodeValue(buffer, next + key.bytesRead, end);
+      remapInto(parts, buffer, remap, next + key.bytesRead, end);
+      next += key.bytesRead + value.bytesRead;
+    }
+  } else {
+    if (tag === CLOSURE) {
+      visitTableRefs(decoded, () => {
+        throw new Error('Functions holding tables cannot be copied');
+      });
+    }
+    parts.push(buffer.subarray(offset, offset + decoded.bytesRead));
+  }
+}
+
+const MIN_CHUNK_BYTES = 256;
+const MAX_CHUNK_BYTES = 64 * 1024;
+
+/**
+ * Encodes many values without an allocation per value. Values are written
+ * back to back into a chunk that doubles in size as chunks fill up, and each
+ * one is returned as a view of its bytes, which stays valid when the writer
+ * moves on to the next chunk.
+ *
+ * A contiguous writer instead keeps everything in one buffer, grown by
+ * copying, so a value made of parts (an inline table and its entries) ends
+ * up as one run of bytes, read with written(). Views returned along the way
+ * are stale once it grows.
+ */
+export class ValueWriter {
+  /**
+   * @param {boolean} compact - Write v2 instead of v1
+   * @param {Object} [options]
+   * @param {boolean} [options.contiguous=false]
+   */
+  constructor(compact, { contiguous = false } = {}) {
+    this.compact = compact;
+    this.contiguous = contiguous;
+    this.bytes = new Uint8Array(0);
+    this.view = new DataView(this.bytes.buffer);
+    this.offset = 0;
+  }
+
+  /**
+   * Encode null, a boolean, a number or a string
+   * @returns {Uint8Array}
+   */
+  value(value) {
+    if (value === null || value === undefined) {
+      this.reserve(1);
+      this.bytes[this.offset] = NIL;
+      return this.take(1);
+    }
+    if (typeof value === 'boolean') {
+      this.reserve(2);
+      if (this.compact) {
+        this.bytes[this.offset] = value ? V2_TRUE : V2_FALSE;
+        return this.take(1);
+      }
+      this.bytes[this.offset] = BOOLEAN;
+      this.bytes[this.offset + 1] = value ? 1 : 0;
+      return this.take(2);
+    }
+    if (typeof value === 'number') {
+      return this.number(value);
+    }
+    return this.string(String(value));
+  }
+
+  /**
+   * Encode a Uint8Array, BigInt64Array or Float64Array as one packed value
+   * @returns {Uint8Array}
+   */
+  typedArray(array) {
+    const length = TYPED_ARRAY_HEADER + array.byteLength;
+    // Large arrays get their own buffer
+    const bytes = length > MAX_CHUNK_BYTES / 4 && !this.contiguous ? new Uint8Array(length) : this.reserveView(length);
+    const view = new DataView(bytes.buffer, bytes.byteOffset, bytes.byteLength);
+    bytes[0] = TYPED_ARRAY;
+    bytes[1] = typedArrayKind(array);
+    view.setUint16(2, 0);
+    view.setUint32(4, array.length, true);
+    bytes.set(new Uint8Array(array.buffer, array.byteOffset, array.byteLength), TYPED_ARRAY_HEADER);
+    return bytes;
+  }
+
+  /**
+   * Encode a BigInt as a Lua bigint
+   * @returns {Uint8Array}
+   */
+  bigint(value) {
+    const hex = (value < 0n ? -value : value).toString(16);
+    const count = value === 0n ? 0 : Math.ceil(hex.length / 8);
+    const length = BIGINT_HEADER + count * 4;
+    const bytes = length > MAX_CHUNK_BYTES / 4 && !this.contiguous ? new Uint8Array(length) : this.reserveView(length);
+    const view = new DataView(bytes.buffer, bytes.byteOffset, bytes.byteLength);
+    bytes[0] = BIGINT;
+    bytes[1] = value < 0n ? 1 : 0;
+    view.setUint16(2, 0);
+    view.setUint32(4, count, true);
+    // Words least significant first, each from 8 hex digits of the end
+    for (let i = 0; i < count; i++) {
+      const stop = hex.length - i * 8;
+      view.setUint32(BIGINT_HEADER + i * 4, parseInt(hex.slice(Math.max(stop - 8, 0), stop), 16), true);
+    }
+    return bytes;
+  }
+
+  /**
+   * Encode an ArrayBuffer as a blob, which Lua reads without copying it in
+   * @returns {Uint8Array}
+   */
+  blob(arrayBuffer) {
+    const length = BLOB_HEADER + arrayBuffer.byteLength;
+    const bytes = this.contiguous ? this.reserveView(length) : new Uint8Array(length);
+    bytes[0] = BLOB;
+    new DataView(bytes.buffer, bytes.byteOffset, BLOB_HEADER).setUint32(1, arrayBuffer.byteLength, true);
+    bytes.set(new Uint8Array(arrayBuffer), BLOB_HEADER);
+    return bytes;
+  }
+
+  /**
+   * Start an inline table of `count` entries, whose keys and values are
+   * written next, each key before its value
+   * @returns {Uint8Array}
+   */
+  inlineTable(count) {
+    this.reserve(11);
+    this.bytes[this.offset] = TABLE_INLINE;
+    return this.take(1 + this.varint(this.offset + 1, count));
+  }
+
+  /** @returns {Uint8Array} Everything a contiguous writer has written */
+  written() {
+    return this.bytes.subarray(0, this.offset);
+  }
+
+  /** @returns {Uint8Array} */
+  tableRef(tableId) {
+    this.reserve(6);
+    if (this.compact) {
+      this.bytes[this.offset] = V2_TABLE_REF;
+      return this.take(1 + this.varint(this.offset + 1, tableId));
+    }
+    this.bytes[this.offset] = TABLE_REF;
+    this.view.setUint32(this.offset + 1, tableId, true);
+    return this.take(5);
+  }
+
+  number(value) {
+    this.reserve(11);
+    const start = this.offset;
+    if (!Number.isSafeInteger(value)) {
+      this.bytes[start] = this.compact ? V2_FLOAT : FLOAT;
+      this.view.setFloat64(start + 1, value, true);
+      return this.take(9);
+    }
+    if (this.compact) {
+      if (value >= 0 && value <= SMALL_INT_MAX) {
+        this.bytes[start] = V2_SMALL_INT | value;
+        return this.take(1);
+      }
+      this.bytes[start] = V2_INTEGER;
+      return this.take(1 + this.varint(start + 1, zigzag(value)));
+    }
+    // i64 as two 32-bit halves, which is exact for safe integers
+    this.bytes[start] = INTEGER;
+    this.view.setUint32(start + 1, value >>> 0, true);
+    this.view.setInt32(start + 5, Math.floor(value / 2 ** 32), true);
+    return this.take(9);
+  }
+
+  string(text) {
+    // Worst case is 3 bytes per UTF-16 unit; longer strings get their own buffer
+    const maxLength = text.length * 3;
+    if (maxLength > MAX_CHUNK_BYTES / 4 && !this.contiguous) return encodeValue(text, this.compact);
+
+    const maxHeader = this.compact ? (maxLength <= SHORT_STRING_MAX ? 1 : 4) : 5;
+    this.reserve(maxHeader + maxLength);
+    const start = this.offset;
+    const { written } = textEncoder.encodeInto(text, this.bytes.subarray(start + maxHeader, start + maxHeader + maxLength));
+
+    let header;
+    if (!this.compact) {
+      this.bytes[start] = STRING;
+      this.view.setUint32(start + 1, written, true);
+      header = 5;
+    } else if (written <= SHORT_STRING_MAX) {
+      this.bytes[start] = V2_SHORT_STRING | written;
+      header = 1;
+    } else {
+      this.bytes[start] = V2_STRING;
+      header = 1 + this.varint(start + 1, written);
+    }
+    if (header < maxHeader) {
+      this.bytes.copyWithin(start + header, start + maxHeader, start + maxHeader + written);
+    }
+    return this.take(header + written);
+  }
+
+  varint(offset, value) {
+    if (typeof value === 'bigint') {
+      const bytes = varintBytes(value);
+      this.bytes.set(bytes, offset);
+      return bytes.length;
+    }
+    let i = offset;
+    while (value >= 0x80) {
+      this.bytes[i++] = (value % 0x80) | 0x80;
+      value = Math.floor(value / 0x80);
+    }
+    this.bytes[i++] = value;
+    return i - offset;
+  }
+
+  // Make room for `length` bytes, starting a larger chunk if needed
+  reserve(length) {
+    if (this.offset + length <= this.bytes.length) return;
+    if (this.contiguous) {
+      let size = Math.max(this.bytes.length * 2, MIN_CHUNK_BYTES);
+      while (size < this.offset + length) size *= 2;
+      const bytes = new Uint8Array(size);
+      bytes.set(this.bytes.subarray(0, this.offset));
+      this.bytes = bytes;
+      this.view = new DataView(bytes.buffer);
+      return;
+    }
+    let size = Math.min(Math.max(this.bytes.length * 2, MIN_CHUNK_BYTES), MAX_CHUNK_BYTES);
+    while (size < length) size *= 2;
+    this.bytes = new Uint8Array(size);
+    this.view = new DataView(this.bytes.buffer);
+    this.offset = 0;
+  }
+
+  reserveView(length) {
+    this.reserve(length);
+    return this.take(length);
+  }
+
+  take(length) {
+    const bytes = this.bytes.subarray(this.offset, this.offset + length);
+    this.offset += length;
+    return bytes;
+  }
+}
@@ -0,0 +1,241 @@
+/**
+ * Cu Worker
+ *
+ * cu-api's compute() is async, but the VM runs on the calling thread: a
+ * 200ms script blocks the page (or the Node event loop) for 200ms. A
+ * CuWorker runs one VM in a dedicated worker instead (cu-pool-worker.js),
+ * so the caller's thread only posts the request and receives the result.
+ *
+ * Requests run one at a time, in order. Each takes an AbortSignal: a
+ * request still waiting is dropped, and the running one is interrupted
+ * through a SharedArrayBuffer the VM polls every 1000 instructions. Without
+ * SharedArrayBuffer (pages that are not cross-origin isolated) or with a
+ * build that cannot poll (see interruptible), a running request finishes.
+ *
+ * With `ring`, requests and replies go through a pair of SharedArrayBuffer
+ * rings (cu-ring.js) as msgpack frames instead of postMessage: the worker
+ * sleeps in Atomics.wait and wakes as soon as a request is written, and no
+ * structured clone runs on either side. Arguments and results are then
+ * limited to what msgpack carries (see cu-msgpack.js), and a frame must fit
+ * its ring.
+ *
+ * Usage:
+ *   import { CuWorker } from './cu-worker.js';
+ *   const cu = await CuWorker.create({ wasmPath: './cu.wasm' });
+ *   const { result } = await cu.compute('return 1 + 1');
+ *   await cu.compute(longScript, { signal: AbortSignal.timeout(100) });
+ *   await cu.close();
+ *
+ *   const fast = await CuWorker.create({ ring: true });
+ */
+
+import { compileModule } from './cu-module.js';
+import { spawnWorker } from './cu-pool.js';
+import { ErrorCodes } from './cu-instance.js';
+import { CuRing, ringsSupported } from './cu-ring.js';
+import { encode, decode } from './cu-msgpack.js';
+
+const inNode = typeof process !== 'undefined' && process.versions?.node !== undefined;
+
+const DEFAULT_RING_BYTES = 1 << 20;
+
+function interruptedError(signal) {
+  const error = new Error('interrupted', { cause: signal?.reason });
+  error.code = ErrorCodes.INTERRUPTED;
+  return error;
+}
+
+export class CuWorker {
+  /**
+   * Start the worker and bring its VM up
+   * @param {Object} [options]
+   * @param {WebAssembly.Module} [options.module] - Compiled module to use
+   * @param {string|URL} [options.wasmPath='./cu.wasm'] - Where to fetch (or,
+   *   in Node, read) the module when none is given
+   * @param {string|URL} [options.workerUrl] - Worker script (default:
+   *   cu-pool-worker.js next to this file)
+   * @param {Object} [options.workerOptions] - Passed to the worker's load();
+   *   `init` holds its init() options (heapBytes, maxHeapBytes)
+   * @param {boolean|number} [options.ring] - Send requests through
+   *   SharedArrayBuffer rings of this many bytes each (true: 1 MiB); ignored
+   *   where SharedArrayBuffer or Atomics.waitAsync is missing (see usesRing)
+   * @param {SharedArrayBuffer|ArrayBuffer} [options.snapshot] - Tables
+   *   packed by CuInstance.shareState() to serve read-only, as CuPool
+   * @returns {Promise<CuWorker>}
+   */
+  static async create(options = {}) {
+    const module = options.module ?? await compileModule(options.wasmPath ?? './cu.wasm');
+    const workerUrl = options.workerUrl ?? new URL('./cu-pool-worker.js', import.meta.url);
+    const cu = new CuWorker(await spawnWorker(workerUrl));
+    const { interruptible } = await cu.request({
+      type: 'init',
+      module,
+      options: options.workerOptions ?? {},
+      interrupt: cu.interrupt?.buffer,
+      snapshot: options.snapshot,
+    });
+    cu.interruptible = interruptible === true;
+    if (options.ring && ringsSupported()) {
+      await cu.openRings(options.ring === true ? DEFAULT_RING_BYTES : options.ring);
+    }
+    return cu;
+  }
+
+  constructor(worker) {
+    this.worker = worker;
+    // The id of the request the VM should stop
+    this.interrupt = typeof SharedArrayBuffer === 'function' ? new Int32Array(new SharedArrayBuffer(4)) : null;
+    // Whether a running request can be interrupted
+    this.interruptible = false;
+    this.nextId = 1;
+    this.waiting = []; // requests not yet sent to the worker
+    this.running = null;
+    // { requests, responses } once requests go through rings
+    this.rings = null;
+
+    const onMessage = (message) => this.settle(message);
+    if (inNode) {
+      worker.on('message', onMessage);
+      worker.on('error', (error) => this.failAll(error));
+    } else {
+      worker.onmessage = (event) => onMessage(event.data);
+      worker.onerror = (event) => this.failAll(new Error(event.message));
+    }
+  }
+
+  /**
+   * Run Lua source in the worker
+   * @param {string} code
+   * @param {Object} [options]
+   * @param {AbortSignal} [options.signal] - Cancels the request
+   * @returns {Promise<{status: number, output: string, result: *, latencyMs: number}>}
+   *   Rejects with the Lua error (error.status < 0), or an "interrupted"
+   *   error (error.code === ErrorCodes.INTERRUPTED) once aborted
+   */
+  compute(code, { signal } = {}) {
+    return this.request({ type: 'compute', code }, signal);
+  }
+
+  /**
+   * Call a Lua function by name, as cu-api's call()
+   * @returns {Promise<{status: number, output: string, result: *, latencyMs: number}>}
+   */
+  call(name, args = [], { signal } = {}) {
+    return this.request({ type: 'call', name, args }, signal);
+  }
+
+  request(message, signal) {
+    if (this.worker === null) {
+      return Promise.reject(new Error('CuWorker is closed'));
+    }
+    if (signal?.aborted) {
+      return Promise.reject(interruptedError(signal));
+    }
+    return new Promise((resolve, reject) => {
+      const entry = { id: this.nextId++, message, resolve, reject, signal, start: performance.now() };
+      if (signal) {
+        entry.onAbort = () => this.abort(entry);
+        signal.addEventListener('abort', entry.onAbort, { once: true });
+      }
+      this.waiting.push(entry);
+      this.sendNext();
+    });
+  }
+
+  sendNext() {
+    if (this.running !== null || this.waiting.length === 0) return;
+    this.running = this.waiting.shift();
+    this.running.start = performance.now();
+    const message = { id: this.running.id, ...this.running.message };
+    if (this.rings === null) {
+      this.worker.postMessage(message);
+      return;
+    }
+
+    // One request is in flight at a time, so the ring is never full
+    try {
+      this.rings.requests.tryWrite(encode(message));
+    } catch (error) {
+      this.settle({ id: message.id, ok: false, error: error.message });
+    }
+  }
+
+  /** Whether requests go through SharedArrayBuffer rings */
+  get usesRing() {
+    return this.rings !== null;
+  }
+
+  async openRings(bytes) {
+    const requests = new CuRing(CuRing.allocate(bytes));
+    const responses = new CuRing(CuRing.allocate(bytes));
+    await this.request({ type: 'ring', requests: requests.buffer, responses: responses.buffer });
+    this.rings = { requests, responses };
+    this.receive(responses);
+  }
+
+  async receive(responses) {
+    for (;;) {
+      const frame = await responses.readAsync();
+      if (frame === null) return;
+      this.settle(decode(frame));
+    }
+  }
+
+  abort(entry) {
+    const index = this.waiting.indexOf(entry);
+    if (index !== -1) {
+      this.waiting.splice(index, 1);
+      entry.reject(interruptedError(entry.signal));
+    } else if (entry === this.running && this.interrupt) {
+      Atomics.store(this.interrupt, 0, entry.id);
+    }
+  }
+
+  settle(message) {
+    const entry = this.running;
+    if (entry === null || entry.id !== message.id) return;
+    this.running = null;
+    entry.signal?.removeEventListener('abort', entry.onAbort);
+
+    message.latencyMs = performance.now() - entry.start;
+    if (message.ok) {
+      entry.resolve(message);
+    } else if (message.code === ErrorCodes.INTERRUPTED) {
+      entry.reject(interruptedError(entry.signal));
+    } else {
+      const error = new Error(message.error ?? 'Worker request failed');
+      error.status = message.status;
+      error.code = message.code;
+      entry.reject(error);
+    }
+    this.sendNext();
+  }
+
+  failAll(error) {
+    const entries = this.running ? [this.running, ...this.waiting] : this.waiting;
+    this.running = null;
+    this.waiting = [];
+    for (const entry of entries) {
+      entry.signal?.removeEventListener('abort', entry.onAbort);
+      entry.reject(error);
+    }
+  }
+
+  /** Requests sent or waiting that have not been answered */
+  get queueDepth() {
+    return this.waiting.length + (this.running ? 1 : 0);
+  }
+
+  /** Stop the worker; requests not yet answered are rejected */
+  async close() {
+    const worker = this.worker;
+    if (worker === null) return;
+    this.worker = null;
+    this.failAll(new Error('CuWorker closed'));
+    if (this.rings !== null) {
+      this.rings.requests.close();
+      this.rings.responses.close();
+    }
+    await worker.terminate();
+  }
+}
@@ -11,7 +11,38 @@
  *   const result = await io.computeWithIo(code, inputData);
  */
 
-import * as cu from './cu-api.js';
+import { getDefaultInstance } from './cu-api.js';
+
+// Names of the functions processStream() turns its code into
+let nextStreamId = 1;
+
+/**
+ * Items of an array, iterable, async iterable or ReadableStream, pulled one
+ * at a time
+ * @param {Array|Iterable|AsyncIterable|ReadableStream} source
+ * @returns {{next: function(): Promise<{done: boolean, value: *}>, return: function(): Promise<void>}}
+ */
+function pullItems(source) {
+  if (source && typeof source[Symbol.asyncIterator] === 'function') {
+    const iterator = source[Symbol.asyncIterator]();
+    return { next: () => iterator.next(), return: async () => { await iterator.return?.(); } };
+  }
+  if (source && typeof source.getReader === 'function') {
+    const reader = source.getReader();
+    return {
+      next: () => reader.read(),
+      return: async () => {
+        await reader.cancel().catch(() => {});
+        reader.releaseLock();
+      }
+    };
+  }
+  if (source && typeof source[Symbol.iterator] === 'function') {
+    const iterator = source[Symbol.iterator]();
+    return { next: async () => iterator.next(), return: async () => { iterator.return?.(); } };
+  }
+  throw new Error('processStream() needs an array, an iterable or a ReadableStream');
+}
 
 /**
  * IoWrapper class - Provides high-level API for _io table operations
@@ -20,6 +51,14 @@ import * as cu from './cu-api.js';
  * convenient methods for common patterns like request/response and stream processing.
  */
 export class IoWrapper {
+  /**
+   * @param {CuInstance} [instance] - The instance to run on (default: the
+   *   one behind cu-api.js)
+   */
+  constructor(instance = getDefaultInstance()) {
+    this.instance = instance;
+  }
+
   /**
    * Execute Lua code with structured input/output via _io table
    * 
@@ -51,20 +90,21 @@ export class IoWrapper {
    */
   async computeWithIo(code, inputData = null, options = {}) {
     const { clearBefore = true, metadata = {} } = options;
+    const cu = this.instance;
     
     // Clear previous I/O state if requested
     if (clearBefore) {
-      lua.clearIo();
+      cu.clearIo();
     }
     
     // Set input if provided
     if (inputData !== null) {
-      lua.setInput(inputData);
+      cu.setInput(inputData);
     }
     
     // Set metadata with timestamp and request ID
     if (Object.keys(metadata).length > 0) {
-      lua.setMetadata({
+      cu.setMetadata({
         ...metadata,
         timestamp: Date.now(),
         requestId: this.generateRequestId()
@@ -72,14 +112,14 @@ export class IoWrapper {
     }
     
     // Execute code
-    const resultBytes = await lua.compute(code);
-    const result = lua.readResult(lua.getBufferPtr(), resultBytes);
+    const resultBytes = this.check(cu.compute(code));
+    const result = cu.readResult(cu.getResultPtr(), resultBytes);
     
     // Get output from _io.output
-    const output = lua.getOutput();
+    const output = cu.getOutput();
     
     return {
-      returnValue: result.value,
+      returnValue: result.result,
       output: output,
       metadata: metadata
     };
@@ -88,14 +128,28 @@ export class IoWrapper {
   /**
    * Stream processing pattern for large datasets
    * 
-   * Processes a large dataset in batches by repeatedly calling computeWithIo.
-   * Each batch is provided with metadata about its position in the stream.
+   * Pulls items from the source and runs the code once per micro-batch of
+   * up to batchSize items, with `_io.input = { batch, batchIndex, hasMore }`.
+   * The code is compiled once into a function that each batch calls, so a
+   * batch is one call into the VM, and the input tables are refilled in
+   * place batch after batch instead of taking new table IDs. The code must
+   * therefore copy anything it keeps from `_io.input` past its batch.
+   * 
+   * Each batch's `_io.output` goes to the sink, if there is one: the next
+   * batch is only pulled once the sink is ready for more, so a slow
+   * consumer slows the source down instead of queueing outputs. Without a
+   * sink, the outputs are collected and returned.
    * 
    * @param {string} code - Lua code to execute for each batch
-   * @param {Array} dataStream - Array of items to process
+   * @param {Array|Iterable|AsyncIterable|ReadableStream} dataStream - Items
+   *   to process
    * @param {Object} options - Optional configuration
    * @param {number} options.batchSize - Number of items per batch (default: 100)
-   * @returns {Promise<Array>} Array of output results from each batch
+   * @param {WritableStream} options.sink - Receives each batch's output
+   * @param {boolean} options.preventClose - Leave the sink open when the
+   *   source ends (default: false)
+   * @returns {Promise<Array|{batches: number, items: number}>} The output of
+   *   each batch, or with a sink, how many batches and items were processed
    * 
    * @example
    * const results = await io.processStream(`
@@ -106,24 +160,73 @@ export class IoWrapper {
    *   end
    *   _io.output = results
    * `, largeDataset, { batchSize: 1000 });
+   * 
+   * @example
+   * // From a ReadableStream of records into a WritableStream
+   * await io.processStream(code, records, { batchSize: 500, sink: writable });
    */
   async processStream(code, dataStream, options = {}) {
-    const { batchSize = 100 } = options;
+    const { batchSize = 100, sink = null, preventClose = false } = options;
+    if (!(batchSize >= 1)) {
+      throw new Error('batchSize must be at least 1');
+    }
+    const cu = this.instance;
+    const exports = cu.requireLoaded();
+    const items = pullItems(dataStream);
+    const writer = sink ? sink.getWriter() : null;
     const results = [];
-    
-    for (let i = 0; i < dataStream.length; i += batchSize) {
-      const batch = dataStream.slice(i, i + batchSize);
-      
-      const result = await this.computeWithIo(code, {
-        batch: batch,
-        batchIndex: Math.floor(i / batchSize),
-        hasMore: i + batchSize < dataStream.length
-      });
-      
-      results.push(result.output);
+    let batches = 0;
+    let count = 0;
+
+    // Builds without call() parse the code for every batch
+    const handler = exports.call ? `__io_stream_${nextStreamId++}` : null;
+    try {
+      if (handler) {
+        this.check(cu.compute(`${handler} = function()\n${code}\nend`));
+      }
+      let next = await items.next();
+      while (!next.done) {
+        if (writer) {
+          await writer.ready;
+        }
+        const batch = [];
+        while (!next.done && batch.length < batchSize) {
+          batch.push(next.value);
+          next = await items.next();
+        }
+
+        // Frees the previous batch's input tables, which setInput() refills
+        cu.clearIo();
+        cu.setInput({ batch, batchIndex: batches, hasMore: !next.done });
+        this.check(handler ? cu.call(handler) : cu.compute(code));
+        const output = cu.getOutput();
+        batches++;
+        count += batch.length;
+
+        if (writer) {
+          // A failed write errors the sink, which writer.ready reports
+          writer.write(output).catch(() => {});
+        } else {
+          results.push(output);
+        }
+      }
+      if (writer && !preventClose) {
+        await writer.close();
+      }
+    } catch (error) {
+      await items.return().catch(() => {});
+      if (writer) {
+        await writer.abort(error).catch(() => {});
+      }
+      throw error;
+    } finally {
+      writer?.releaseLock();
+      cu.clearIo();
+      if (handler) {
+        cu.compute(`${handler} = nil`);
+      }
     }
-    
-    return results;
+    return writer ? { batches, items: count } : results;
   }
   
   /**
@@ -183,6 +286,20 @@ export class IoWrapper {
   generateRequestId() {
     return `${Date.now()}-${Math.random().toString(36).substr(2, 9)}`;
   }
+
+  /**
+   * Throw the Lua error behind a negative compute()/call() result
+   * @param {number} status
+   * @returns {number} status
+   * @private
+   */
+  check(status) {
+    if (status < 0) {
+      const cu = this.instance;
+      throw new Error(cu.readBuffer(cu.getBufferPtr(), -status));
+    }
+    return status;
+  }
 }
 
 export default IoWrapper;
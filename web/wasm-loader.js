@@ -31,6 +31,32 @@ async function loadWasmModule(wasmPath) {
         console.log(`js_ext_table_keys called: tableId=${tableId}`);
         return 0;
       },
+      js_ext_table_set_many: (tableId, framesPtr, framesLen) => {
+        console.log(`js_ext_table_set_many called: tableId=${tableId}`);
+        return 0;
+      },
+      js_ext_table_get_many: () => -1, // ext.getMany() is not supported by this host
+      js_ext_key_intern: () => -1, // key handles are not supported by this host
+      js_ext_table_set_parts: () => -1, // values over the I/O buffer window are not supported by this host
+      js_blob_read: () => -1, // blobs are not supported by this host
+      js_blob_release: () => {},
+      js_ext_table_next: () => -1, // pairs() over external tables is not supported by this host
+      js_ext_table_order: () => 0,
+      js_ext_table_range: () => 0, // ext.range() is not supported by this host
+      js_ext_table_index: () => 0, // ext.index() / ext.lookup() are not supported by this host
+      js_ext_table_lookup: () => 0,
+      js_ext_transaction: () => -1, // ext.transaction() is not supported by this host
+      js_ext_table_cache: () => 0, // ext.cache() tables are unbounded on this host
+      js_ext_table_filter: () => -1, // Every miss reads the table on this host
+      js_ext_table_columns: () => -1, // ext.columns() is not supported by this host
+      js_ext_table_column: () => -1,
+      js_ext_table_array: () => -1, // ext.array() is not supported by this host
+      js_ext_table_push: () => -1,
+      js_ext_table_pop: () => -1,
+      js_ext_table_slice: () => -1,
+      js_interrupt_requested: () => 0,
+      js_write_output: () => {},
+      js_clock_ms: () => performance.now(),
     }
   };
 